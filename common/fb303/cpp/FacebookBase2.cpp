@@ -0,0 +1,20 @@
+/*
+ *  Copyright (c) 2004-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "common/fb303/cpp/FacebookBase2.h"
+
+#include "common/stats/ServiceData.h"
+
+namespace facebook { namespace fb303 {
+
+void FacebookBase2::getCounters(std::map<std::string, int64_t>& counters) {
+  fbData->getCounters(counters);
+}
+
+}}
@@ -9,17 +9,29 @@
  */
 #pragma once
 
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "common/fb303/if/gen-cpp2/FacebookService.h"
+
 namespace folly {
 class EventBaseManager;
 }
 
 namespace facebook { namespace fb303 {
 
-class FacebookBase2 {
+class FacebookBase2 : virtual public cpp2::FacebookServiceSvIf {
 public:
   explicit FacebookBase2(const char*) {}
 
   void setEventBaseManager(folly::EventBaseManager*) {}
+
+  /**
+   * Return every counter in fbData, including the dynamic counters and the
+   * aggregated thread-local statistics.
+   */
+  void getCounters(std::map<std::string, int64_t>& counters) override;
 };
 
 }}
@@ -11,6 +11,7 @@
 
 #include <folly/Range.h>
 #include <chrono>
+#include <memory>
 
 namespace facebook {
 
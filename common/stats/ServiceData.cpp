@@ -9,8 +9,90 @@
  */
 #include "common/stats/ServiceData.h"
 
+#include <vector>
+
 static facebook::stats::ServiceData payload;
 
 namespace facebook {
 facebook::stats::ServiceData* fbData = &payload;
+
+namespace stats {
+
+void DynamicCounters::registerCallback(
+    folly::StringPiece name,
+    Callback callback) {
+  (*callbacks_.lock())[name.str()] = std::move(callback);
+}
+
+void DynamicCounters::unregisterCallback(folly::StringPiece name) {
+  callbacks_.lock()->erase(name.str());
+}
+
+void DynamicCounters::getValues(std::map<std::string, int64_t>& values) const {
+  auto callbacks = callbacks_.lock();
+  for (const auto& entry : *callbacks) {
+    values[entry.first] = entry.second();
+  }
+}
+
+ServiceData::ServiceData() {}
+
+ServiceData::~ServiceData() {}
+
+void ServiceData::getCounters(std::map<std::string, int64_t>& values) const {
+  {
+    auto counters = counters_.rlock();
+    values.insert(counters->begin(), counters->end());
+  }
+  dynamicCounters_.getValues(values);
+
+  // Export the aggregated statistics without holding the lock, so that
+  // threads creating new statistics are not blocked behind the aggregation.
+  std::vector<std::pair<std::string, std::shared_ptr<AggregatedStat>>> stats;
+  {
+    auto aggregatedStats = aggregatedStats_.lock();
+    stats.assign(aggregatedStats->begin(), aggregatedStats->end());
+  }
+  for (const auto& stat : stats) {
+    stat.second->exportCounters(stat.first, values);
+  }
+}
+
+int64_t ServiceData::getCounter(folly::StringPiece key) const {
+  auto counters = counters_.rlock();
+  auto it = counters->find(key.str());
+  return it == counters->end() ? 0 : it->second;
+}
+
+int64_t ServiceData::clearCounter(folly::StringPiece key) {
+  auto counters = counters_.wlock();
+  auto it = counters->find(key.str());
+  if (it == counters->end()) {
+    return 0;
+  }
+  auto value = it->second;
+  counters->erase(it);
+  return value;
+}
+
+void ServiceData::setCounter(folly::StringPiece key, int64_t value) {
+  (*counters_.wlock())[key.str()] = value;
+}
+
+int64_t ServiceData::incrementCounter(folly::StringPiece key, int64_t amount) {
+  auto counters = counters_.wlock();
+  return (*counters)[key.str()] += amount;
+}
+
+std::shared_ptr<AggregatedStat> ServiceData::getOrCreateAggregatedStat(
+    folly::StringPiece name,
+    folly::FunctionRef<std::shared_ptr<AggregatedStat>()> create) {
+  auto aggregatedStats = aggregatedStats_.lock();
+  auto& stat = (*aggregatedStats)[name.str()];
+  if (!stat) {
+    stat = create();
+  }
+  return stat;
+}
+}
 }
@@ -9,27 +9,126 @@
  */
 #pragma once
 
-#include "common/stats/ExportedStatMap.h"
-#include "common/stats/ExportedHistogramMap.h"
+#include <folly/Function.h>
+#include <folly/Range.h>
+#include <folly/Synchronized.h>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "common/stats/ExportedHistogramMap.h"
+#include "common/stats/ExportedStatMap.h"
 
 namespace facebook { namespace stats {
 
+/**
+ * Counters whose values are computed by a callback each time they are read.
+ *
+ * Callbacks are invoked with the registry lock held, so once
+ * unregisterCallback() returns the callback is guaranteed not to be running.
+ * A callback must not register or unregister callbacks itself.
+ */
+class DynamicCounters {
+ public:
+  using Callback = std::function<int64_t()>;
+
+  void registerCallback(folly::StringPiece name, Callback callback);
+  void unregisterCallback(folly::StringPiece name);
+
+  /**
+   * Add the current value of every registered counter to values.
+   */
+  void getValues(std::map<std::string, int64_t>& values) const;
+
+ private:
+  folly::Synchronized<std::map<std::string, Callback>, std::mutex> callbacks_;
+};
+
+/**
+ * Statistics that are updated separately by each thread, and whose exported
+ * counters are computed by aggregating the per-thread values when they are
+ * read.  See ThreadLocalStats.h.
+ */
+class AggregatedStat {
+ public:
+  virtual ~AggregatedStat() {}
+
+  /**
+   * Add the counters exported for this statistic to values.
+   */
+  virtual void exportCounters(
+      folly::StringPiece name,
+      std::map<std::string, int64_t>& values) = 0;
+};
+
 class ServiceData {
-public:
+ public:
+  ServiceData();
+  ~ServiceData();
+
   ExportedStatMap* getStatMap() {
-    static ExportedStatMap it;
-    return &it;
+    return &statMap_;
   }
   ExportedHistogramMap* getHistogramMap() {
-    static ExportedHistogramMap it;
-    return &it;
+    return &histogramMap_;
   }
-  void getCounters(std::map<std::string, int64_t>&) {}
-  long getCounter(std::string) {return 0;};
-  long clearCounter(std::string) {return 0;};
+  DynamicCounters* getDynamicCounters() {
+    return &dynamicCounters_;
+  }
+
+  /**
+   * Get the value of every counter: the plain counters set with
+   * setCounter() and incrementCounter(), the dynamic counters, and the
+   * counters exported by the aggregated thread-local statistics.
+   *
+   * This is what the fb303 getCounters() thrift call returns.
+   */
+  void getCounters(std::map<std::string, int64_t>& values) const;
+
+  /**
+   * Get the value of a plain counter, or 0 if it has never been set.
+   */
+  int64_t getCounter(folly::StringPiece key) const;
+
+  /**
+   * Remove a plain counter.  Returns its value before it was removed.
+   */
+  int64_t clearCounter(folly::StringPiece key);
+
   void setUseOptionsAsFlags(bool) {}
-  void setCounter(folly::StringPiece, uint32_t) {}
+  void setCounter(folly::StringPiece key, int64_t value);
+
+  /**
+   * Add amount to a plain counter, creating it if necessary.
+   * Returns the new value.
+   */
+  int64_t incrementCounter(folly::StringPiece key, int64_t amount = 1);
+
+  /**
+   * Look up the aggregated statistic with the given name, calling create()
+   * to add it if there is none yet.
+   *
+   * Statistics are never removed once they have been created, so that their
+   * counters keep reporting the values of threads that have exited.
+   */
+  std::shared_ptr<AggregatedStat> getOrCreateAggregatedStat(
+      folly::StringPiece name,
+      folly::FunctionRef<std::shared_ptr<AggregatedStat>()> create);
+
+ private:
+  ServiceData(ServiceData const&) = delete;
+  ServiceData& operator=(ServiceData const&) = delete;
+
+  ExportedStatMap statMap_;
+  ExportedHistogramMap histogramMap_;
+  DynamicCounters dynamicCounters_;
+  folly::Synchronized<std::map<std::string, int64_t>> counters_;
+  folly::Synchronized<
+      std::map<std::string, std::shared_ptr<AggregatedStat>>,
+      std::mutex>
+      aggregatedStats_;
 };
 
 }
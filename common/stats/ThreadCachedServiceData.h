@@ -9,47 +9,42 @@
  */
 #pragma once
 
-#include <cstdint>
 #include <folly/Range.h>
+#include <folly/ThreadLocal.h>
+#include <cstdint>
 #include "common/stats/ExportedStatMap.h"
+#include "common/stats/ThreadLocalStats.h"
 
 namespace facebook { namespace stats {
 
+/**
+ * Per-thread statistics for fbData.  See ThreadLocalStats.h.
+ */
 class ThreadCachedServiceData {
-public:
-  class ThreadLocalStatsMap {
-  };
-
-  class TLTimeseries {
-  public:
-    TLTimeseries(ThreadLocalStatsMap*, folly::StringPiece,
-                 ExportType, ExportType = ExportType()) {}
-    void addValue(int64_t) {}
-  };
-
-  class TLHistogram {
-  public:
-    TLHistogram(ThreadLocalStatsMap*, folly::StringPiece, int, int, int) {}
-    TLHistogram(
-        ThreadLocalStatsMap*, folly::StringPiece, int, int, int,
-        facebook::stats::ExportType, int, int) {}
-    void addValue(int64_t) {}
-    void addRepeatedValue(int64_t /*value*/, int64_t /*nsamples*/) {}
-  };
+ public:
+  using ThreadLocalStatsMap = ThreadLocalStatsT<TLStatsThreadSafe>;
+  using TLTimeseries = ThreadLocalTimeseries;
+  using TLHistogram = ThreadLocalHistogram;
 
   static ThreadCachedServiceData* get() {
     static ThreadCachedServiceData it;
     return &it;
   }
   ThreadLocalStatsMap* getThreadStats() {
-    static ThreadLocalStatsMap it;
-    return &it;
+    return threadStats_.get();
   }
+
+  /**
+   * The statistics are aggregated whenever fbData's counters are read, so
+   * no publishing thread is needed.
+   */
   bool publishThreadRunning() const {
     return false;
   }
-  void publishStats() {
-  }
+  void publishStats() {}
+
+ private:
+  folly::ThreadLocal<ThreadLocalStatsMap> threadStats_;
 };
 
 }}
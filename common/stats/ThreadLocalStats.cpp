@@ -0,0 +1,251 @@
+/*
+ *  Copyright (c) 2004-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "common/stats/ThreadLocalStats.h"
+
+#include <folly/Conv.h>
+#include <algorithm>
+#include <stdexcept>
+
+using std::chrono::steady_clock;
+
+namespace facebook { namespace stats {
+
+namespace detail {
+
+namespace {
+const char* getExportSuffix(ExportType type) {
+  switch (type) {
+    case SUM:
+      return "sum";
+    case COUNT:
+      return "count";
+    case AVG:
+      return "avg";
+    case RATE:
+      return "rate";
+    case PERCENT:
+      return "pct";
+    case NUM_TYPES:
+      break;
+  }
+  throw std::invalid_argument(
+      folly::to<std::string>("invalid stats export type ", int(type)));
+}
+
+void exportValue(
+    folly::StringPiece name,
+    ExportType type,
+    int64_t sum,
+    int64_t count,
+    steady_clock::time_point start,
+    std::map<std::string, int64_t>& values) {
+  int64_t value = 0;
+  switch (type) {
+    case SUM:
+      value = sum;
+      break;
+    case COUNT:
+      value = count;
+      break;
+    case AVG:
+      value = count ? sum / count : 0;
+      break;
+    case RATE: {
+      auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
+          steady_clock::now() - start);
+      value = sum / std::max<int64_t>(elapsed.count(), 1);
+      break;
+    }
+    case PERCENT:
+      value = count ? (sum * 100) / count : 0;
+      break;
+    case NUM_TYPES:
+      break;
+  }
+  values[folly::to<std::string>(name, ".", getExportSuffix(type))] = value;
+}
+}
+
+HistogramData::HistogramData(int64_t bucketWidth, int64_t min, int64_t max)
+    : bucketWidth(bucketWidth), min(min), max(max) {
+  if (bucketWidth <= 0 || max <= min) {
+    throw std::invalid_argument(folly::to<std::string>(
+        "invalid histogram bucket width ",
+        bucketWidth,
+        " for range [",
+        min,
+        ", ",
+        max,
+        ")"));
+  }
+  buckets.resize((max - min + bucketWidth - 1) / bucketWidth + 2);
+}
+
+size_t HistogramData::getBucketIndex(int64_t value) const {
+  if (value < min) {
+    return 0;
+  } else if (value >= max) {
+    return buckets.size() - 1;
+  }
+  return 1 + (value - min) / bucketWidth;
+}
+
+int64_t HistogramData::getPercentileEstimate(double pct) const {
+  if (count == 0) {
+    return 0;
+  }
+
+  auto target = (pct / 100.0) * count;
+  double seen = 0;
+  for (size_t n = 0; n < buckets.size(); ++n) {
+    if (buckets[n] == 0 || seen + buckets[n] < target) {
+      seen += buckets[n];
+      continue;
+    }
+    if (n == 0) {
+      return min;
+    }
+    if (n == buckets.size() - 1) {
+      return max;
+    }
+    auto low = min + static_cast<int64_t>(n - 1) * bucketWidth;
+    auto high = std::min(low + bucketWidth, max);
+    auto fraction = (target - seen) / buckets[n];
+    return low + static_cast<int64_t>(fraction * (high - low));
+  }
+  return max;
+}
+
+HistogramSource::HistogramSource(const HistogramData& empty)
+    : layout_(empty),
+      buckets_(std::make_unique<std::atomic<int64_t>[]>(empty.buckets.size())) {
+}
+
+void HistogramSource::addTo(HistogramData& total) const {
+  for (size_t n = 0; n < total.buckets.size(); ++n) {
+    total.buckets[n] += buckets_[n].load(std::memory_order_relaxed);
+  }
+  total.sum += sum_.load(std::memory_order_relaxed);
+  total.count += count_.load(std::memory_order_relaxed);
+}
+
+TimeseriesAggregate::TimeseriesAggregate(std::vector<ExportType> exportTypes)
+    : StatAggregate<TimeseriesData, TimeseriesSource>(TimeseriesData{}),
+      exportTypes_(std::move(exportTypes)),
+      start_(steady_clock::now()) {}
+
+void TimeseriesAggregate::exportCounters(
+    folly::StringPiece name,
+    std::map<std::string, int64_t>& values) {
+  auto total = aggregate();
+  for (auto type : exportTypes_) {
+    exportValue(name, type, total.sum, total.count, start_, values);
+  }
+}
+
+HistogramAggregate::HistogramAggregate(
+    HistogramData empty,
+    std::vector<ExportType> exportTypes,
+    std::vector<int> percentiles)
+    : StatAggregate<HistogramData, HistogramSource>(std::move(empty)),
+      exportTypes_(std::move(exportTypes)),
+      percentiles_(std::move(percentiles)),
+      start_(steady_clock::now()) {}
+
+void HistogramAggregate::exportCounters(
+    folly::StringPiece name,
+    std::map<std::string, int64_t>& values) {
+  auto total = aggregate();
+  for (auto type : exportTypes_) {
+    exportValue(name, type, total.sum, total.count, start_, values);
+  }
+  for (auto pct : percentiles_) {
+    values[folly::to<std::string>(name, ".p", pct)] =
+        total.getPercentileEstimate(pct);
+  }
+}
+}
+
+namespace {
+template <typename Aggregate>
+std::shared_ptr<Aggregate> getAggregate(
+    ThreadLocalStatsBase* stats,
+    folly::StringPiece name,
+    folly::FunctionRef<std::shared_ptr<AggregatedStat>()> create) {
+  auto stat = stats->getServiceData()->getOrCreateAggregatedStat(name, create);
+  auto aggregate = std::dynamic_pointer_cast<Aggregate>(stat);
+  if (!aggregate) {
+    throw std::invalid_argument(folly::to<std::string>(
+        "statistic ", name, " was already created with a different type"));
+  }
+  return aggregate;
+}
+}
+
+ThreadLocalTimeseries::ThreadLocalTimeseries(
+    ThreadLocalStatsBase* stats,
+    folly::StringPiece name,
+    std::vector<ExportType> exportTypes)
+    : aggregate_(getAggregate<detail::TimeseriesAggregate>(
+          stats,
+          name,
+          [&] {
+            return std::make_shared<detail::TimeseriesAggregate>(
+                std::move(exportTypes));
+          })),
+      source_(aggregate_->addSource()) {}
+
+ThreadLocalTimeseries::~ThreadLocalTimeseries() {
+  if (source_) {
+    aggregate_->retireSource(source_.get());
+  }
+}
+
+ThreadLocalHistogram::ThreadLocalHistogram(
+    ThreadLocalStatsBase* stats,
+    folly::StringPiece name,
+    int64_t bucketWidth,
+    int64_t min,
+    int64_t max,
+    const std::vector<ExportArg>& exportArgs)
+    : aggregate_(getAggregate<detail::HistogramAggregate>(
+          stats,
+          name,
+          [&] {
+            std::vector<ExportType> exportTypes;
+            std::vector<int> percentiles;
+            for (const auto& arg : exportArgs) {
+              if (arg.percentile >= 0) {
+                percentiles.push_back(arg.percentile);
+              } else {
+                exportTypes.push_back(arg.type);
+              }
+            }
+            return std::make_shared<detail::HistogramAggregate>(
+                detail::HistogramData{bucketWidth, min, max},
+                std::move(exportTypes),
+                std::move(percentiles));
+          })) {
+  const auto& empty = aggregate_->getEmpty();
+  if (empty.bucketWidth != bucketWidth || empty.min != min ||
+      empty.max != max) {
+    throw std::invalid_argument(folly::to<std::string>(
+        "histogram ", name, " was already created with different buckets"));
+  }
+  source_ = aggregate_->addSource();
+}
+
+ThreadLocalHistogram::~ThreadLocalHistogram() {
+  if (source_) {
+    aggregate_->retireSource(source_.get());
+  }
+}
+
+}}
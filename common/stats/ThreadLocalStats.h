@@ -0,0 +1,342 @@
+/*
+ *  Copyright (c) 2004-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Range.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
+
+#include "common/stats/ExportedStatMap.h"
+#include "common/stats/ServiceData.h"
+
+namespace facebook { namespace stats {
+
+/*
+ * Statistics that each thread updates in its own copy, without contending
+ * with other threads.  The copies register with a shared aggregate of the
+ * same name in ServiceData, which combines them (and the final values of
+ * copies that have since been destroyed) when ServiceData::getCounters() is
+ * called.
+ *
+ * Each copy's values are relaxed atomics, so updating a statistic never
+ * takes a lock and reading the counters never blocks the threads updating
+ * them.  A reader may see a copy's sum and count from slightly different
+ * moments, which is fine for monitoring.
+ *
+ * All values are aggregated over the whole lifetime of the process.  The
+ * exported counter names are "<name>.<type>", e.g. "fuse.lookup_us.avg",
+ * and "<name>.p<percentile>" for histogram percentiles.
+ */
+
+/**
+ * Lock policy for ThreadLocalStatsT.  The statistics can be updated from any
+ * thread, although each copy should mostly be updated by the one thread
+ * that owns it.
+ */
+struct TLStatsThreadSafe {};
+
+namespace detail {
+
+struct TimeseriesData {
+  int64_t sum{0};
+  int64_t count{0};
+};
+
+/**
+ * One copy of a timeseries.
+ */
+class TimeseriesSource {
+ public:
+  explicit TimeseriesSource(const TimeseriesData& /* empty */) {}
+
+  void addRepeatedValue(int64_t value, int64_t nsamples) {
+    sum_.fetch_add(value * nsamples, std::memory_order_relaxed);
+    count_.fetch_add(nsamples, std::memory_order_relaxed);
+  }
+  void addTo(TimeseriesData& total) const {
+    total.sum += sum_.load(std::memory_order_relaxed);
+    total.count += count_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<int64_t> sum_{0};
+  std::atomic<int64_t> count_{0};
+};
+
+struct HistogramData {
+  HistogramData(int64_t bucketWidth, int64_t min, int64_t max);
+
+  size_t getBucketIndex(int64_t value) const;
+
+  /**
+   * Estimate the given percentile by interpolating within the bucket that
+   * contains it.  Values below min and above max are reported as min and
+   * max respectively.
+   */
+  int64_t getPercentileEstimate(double pct) const;
+
+  int64_t bucketWidth;
+  int64_t min;
+  int64_t max;
+  int64_t sum{0};
+  int64_t count{0};
+  // buckets.front() counts values below min, and buckets.back() values at
+  // or above max.
+  std::vector<int64_t> buckets;
+};
+
+/**
+ * One copy of a histogram, with the same buckets as the HistogramData it
+ * was created from.
+ */
+class HistogramSource {
+ public:
+  explicit HistogramSource(const HistogramData& empty);
+
+  void addRepeatedValue(int64_t value, int64_t nsamples) {
+    buckets_[layout_.getBucketIndex(value)].fetch_add(
+        nsamples, std::memory_order_relaxed);
+    sum_.fetch_add(value * nsamples, std::memory_order_relaxed);
+    count_.fetch_add(nsamples, std::memory_order_relaxed);
+  }
+  void addTo(HistogramData& total) const;
+
+ private:
+  // The aggregate that owns this HistogramData outlives its sources.
+  const HistogramData& layout_;
+  std::unique_ptr<std::atomic<int64_t>[]> buckets_;
+  std::atomic<int64_t> sum_{0};
+  std::atomic<int64_t> count_{0};
+};
+
+/**
+ * The state shared by every copy of a statistic with a given name.
+ */
+template <typename Data, typename SourceType>
+class StatAggregate : public AggregatedStat {
+ public:
+  using Source = SourceType;
+
+  explicit StatAggregate(Data empty)
+      : empty_(std::move(empty)), retired_(empty_) {}
+
+  std::unique_ptr<Source> addSource() {
+    auto source = std::make_unique<Source>(empty_);
+    std::lock_guard<std::mutex> guard(mutex_);
+    sources_.insert(source.get());
+    return source;
+  }
+
+  /**
+   * Remove a source that is about to be destroyed, keeping its values.
+   */
+  void retireSource(Source* source) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    source->addTo(retired_);
+    sources_.erase(source);
+  }
+
+  const Data& getEmpty() const {
+    return empty_;
+  }
+
+ protected:
+  Data aggregate() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    Data total = retired_;
+    for (auto* source : sources_) {
+      source->addTo(total);
+    }
+    return total;
+  }
+
+ private:
+  const Data empty_;
+  std::mutex mutex_;
+  Data retired_;
+  std::unordered_set<Source*> sources_;
+};
+
+class TimeseriesAggregate
+    : public StatAggregate<TimeseriesData, TimeseriesSource> {
+ public:
+  explicit TimeseriesAggregate(std::vector<ExportType> exportTypes);
+
+  void exportCounters(
+      folly::StringPiece name,
+      std::map<std::string, int64_t>& values) override;
+
+ private:
+  const std::vector<ExportType> exportTypes_;
+  const std::chrono::steady_clock::time_point start_;
+};
+
+class HistogramAggregate
+    : public StatAggregate<HistogramData, HistogramSource> {
+ public:
+  HistogramAggregate(
+      HistogramData empty,
+      std::vector<ExportType> exportTypes,
+      std::vector<int> percentiles);
+
+  void exportCounters(
+      folly::StringPiece name,
+      std::map<std::string, int64_t>& values) override;
+
+ private:
+  const std::vector<ExportType> exportTypes_;
+  const std::vector<int> percentiles_;
+  const std::chrono::steady_clock::time_point start_;
+};
+}
+
+class ThreadLocalTimeseries;
+class ThreadLocalHistogram;
+
+/**
+ * Base class for objects that group a thread's statistics, such as
+ * eden's per-thread EdenStats.
+ */
+class ThreadLocalStatsBase {
+ public:
+  using TLTimeseries = ThreadLocalTimeseries;
+  using TLHistogram = ThreadLocalHistogram;
+
+  explicit ThreadLocalStatsBase(ServiceData* serviceData = nullptr)
+      : serviceData_(serviceData ? serviceData : fbData) {}
+
+  ServiceData* getServiceData() const {
+    return serviceData_;
+  }
+
+  /**
+   * Values are aggregated when the counters are read, so there is nothing
+   * to do here.  This exists for compatibility with callers that publish
+   * their statistics periodically.
+   */
+  void aggregate() {}
+
+ private:
+  ServiceData* serviceData_;
+};
+
+template <class LockTraits>
+class ThreadLocalStatsT : public ThreadLocalStatsBase {
+ public:
+  static_assert(
+      std::is_same<LockTraits, TLStatsThreadSafe>::value,
+      "statistics are aggregated from other threads, so they must lock");
+
+  using ThreadLocalStatsBase::ThreadLocalStatsBase;
+};
+
+/**
+ * A thread's copy of a timeseries: a sum and count of values.
+ */
+class ThreadLocalTimeseries {
+ public:
+  template <typename... Types>
+  ThreadLocalTimeseries(
+      ThreadLocalStatsBase* stats,
+      folly::StringPiece name,
+      Types... exportTypes)
+      : ThreadLocalTimeseries(
+            stats,
+            name,
+            std::vector<ExportType>{exportTypes...}) {}
+  ThreadLocalTimeseries(
+      ThreadLocalStatsBase* stats,
+      folly::StringPiece name,
+      std::vector<ExportType> exportTypes);
+  ThreadLocalTimeseries(ThreadLocalTimeseries&&) = default;
+  ~ThreadLocalTimeseries();
+
+  void addValue(int64_t value) {
+    addRepeatedValue(value, 1);
+  }
+  void addRepeatedValue(int64_t value, int64_t nsamples) {
+    source_->addRepeatedValue(value, nsamples);
+  }
+
+ private:
+  ThreadLocalTimeseries(ThreadLocalTimeseries const&) = delete;
+  ThreadLocalTimeseries& operator=(ThreadLocalTimeseries const&) = delete;
+  ThreadLocalTimeseries& operator=(ThreadLocalTimeseries&&) = delete;
+
+  std::shared_ptr<detail::TimeseriesAggregate> aggregate_;
+  std::unique_ptr<detail::TimeseriesAggregate::Source> source_;
+};
+
+/**
+ * A thread's copy of a histogram with fixed-width buckets.
+ *
+ * The arguments after max are any mix of ExportTypes, which are applied to
+ * the sum and count of all values, and integer percentiles to export.
+ */
+class ThreadLocalHistogram {
+ public:
+  struct ExportArg {
+    /* implicit */ ExportArg(ExportType t) : type(t) {}
+    /* implicit */ ExportArg(int pct) : percentile(pct) {}
+
+    ExportType type{NUM_TYPES};
+    int percentile{-1};
+  };
+
+  template <typename... Args>
+  ThreadLocalHistogram(
+      ThreadLocalStatsBase* stats,
+      folly::StringPiece name,
+      int64_t bucketWidth,
+      int64_t min,
+      int64_t max,
+      Args... exportArgs)
+      : ThreadLocalHistogram(
+            stats,
+            name,
+            bucketWidth,
+            min,
+            max,
+            std::vector<ExportArg>{ExportArg(exportArgs)...}) {}
+  ThreadLocalHistogram(
+      ThreadLocalStatsBase* stats,
+      folly::StringPiece name,
+      int64_t bucketWidth,
+      int64_t min,
+      int64_t max,
+      const std::vector<ExportArg>& exportArgs);
+  ThreadLocalHistogram(ThreadLocalHistogram&&) = default;
+  ~ThreadLocalHistogram();
+
+  void addValue(int64_t value) {
+    addRepeatedValue(value, 1);
+  }
+  void addRepeatedValue(int64_t value, int64_t nsamples) {
+    source_->addRepeatedValue(value, nsamples);
+  }
+
+ private:
+  ThreadLocalHistogram(ThreadLocalHistogram const&) = delete;
+  ThreadLocalHistogram& operator=(ThreadLocalHistogram const&) = delete;
+  ThreadLocalHistogram& operator=(ThreadLocalHistogram&&) = delete;
+
+  std::shared_ptr<detail::HistogramAggregate> aggregate_;
+  std::unique_ptr<detail::HistogramAggregate::Source> source_;
+};
+
+}}
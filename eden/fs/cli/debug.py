@@ -12,6 +12,7 @@ import binascii
 import os
 import stat
 import sys
+import time
 from typing import Tuple
 
 from . import cmd_util
@@ -175,6 +176,128 @@ def do_inode(args: argparse.Namespace):
         _print_inode_info(inode_info)
 
 
+def do_slow_requests(args: argparse.Namespace):
+    config = cmd_util.create_config(args)
+    mount, _ = get_mount_path(args.path)
+
+    with config.get_thrift_client() as client:
+        results = client.debugGetRecentSlowRequests(mount, args.count)
+
+    print('{:<12} {:>10} {:>10} {:>10} {:>10} {:>10}'.format(
+        'operation', 'total_us', 'reply_us', 'inode_us', 'local_us',
+        'backing_us'))
+    for trace in results:
+        print('{:<12} {:>10} {:>10} {:>10} {:>10} {:>10}'.format(
+            trace.operation, trace.totalUs, trace.replyUs, trace.inodeLoadUs,
+            trace.localStoreUs, trace.backingStoreUs))
+
+
+def do_sample_requests(args: argparse.Namespace):
+    config = cmd_util.create_config(args)
+    mount, _ = get_mount_path(args.path)
+
+    with config.get_thrift_client() as client:
+        client.debugStartRequestSampling(
+            mount, int(args.duration * 1000), args.one_in)
+    time.sleep(args.duration)
+    with config.get_thrift_client() as client:
+        stacks = client.debugGetRequestSamples(mount)
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            f.write(stacks)
+    else:
+        sys.stdout.write(stacks)
+
+
+def do_lock_contention(args: argparse.Namespace):
+    config = cmd_util.create_config(args)
+
+    with config.get_thrift_client() as client:
+        client.debugSetLockProfiling(True)
+    try:
+        time.sleep(args.duration)
+    finally:
+        with config.get_thrift_client() as client:
+            contention = client.debugGetLockContention(args.sites)
+            client.debugSetLockProfiling(False)
+
+    fmt = '{:<16} {:>6} {:>12} {:>10} {:>10} {:>10} {:>10}'
+    print(fmt.format('lock', 'kind', 'count', 'total_us',
+                     'p50_us', 'p99_us', 'max_us'))
+    for lock in contention:
+        for kind, stats in (('wait', lock.wait), ('hold', lock.hold)):
+            print(fmt.format(lock.lock, kind, stats.count, stats.totalUs,
+                             stats.p50Us, stats.p99Us, stats.maxUs))
+    for lock in contention:
+        if not lock.topSites:
+            continue
+        print()
+        print('{}: {} contended acquisitions'.format(
+            lock.lock, lock.contended))
+        for site in lock.topSites:
+            print('  {:<40} {:>8} waits {:>12} us total {:>10} us max'.format(
+                site.site, site.contended, site.totalWaitUs, site.maxWaitUs))
+
+
+def do_mount_progress(args: argparse.Namespace):
+    config = cmd_util.create_config(args)
+    # The mount point is not usable yet while it is still loading, so use the
+    # path as given rather than looking it up with get_mount_path().
+    mount = os.path.realpath(args.path)
+
+    with config.get_thrift_client() as client:
+        progress = client.getMountLoadProgress(mount)
+
+    state = 'finished' if progress.finished else 'loading'
+    print('{}: {} directories and {} files loaded ({})'.format(
+        mount, progress.dirsLoaded, progress.filesLoaded, state))
+
+
+def do_checkout_stats(args: argparse.Namespace):
+    config = cmd_util.create_config(args)
+    mount, _ = get_mount_path(args.path)
+
+    with config.get_thrift_client() as client:
+        stats = client.getLastCheckoutStats(mount)
+
+    print('total:           {:>12} us'.format(stats.totalTimeUs))
+    print('fetch trees:     {:>12} us'.format(stats.fetchTreesTimeUs))
+    print('fetch blobs:     {:>12} us'.format(stats.fetchBlobsTimeUs))
+    print('write overlay:   {:>12} us'.format(stats.writeOverlayTimeUs))
+    print('invalidate:      {:>12} us'.format(stats.invalidateTimeUs))
+    print('check conflicts: {:>12} us'.format(stats.checkConflictsTimeUs))
+    print('{} entries processed, {} swapped'.format(
+        stats.entriesProcessed, stats.entriesSwapped))
+    print('{} conflicts, {} errors'.format(stats.conflicts, stats.errors))
+    print('{} trees and {} blobs ({} bytes) fetched'.format(
+        stats.treesFetched, stats.blobsFetched, stats.bytesFetched))
+
+
+def do_overlay_compact(args: argparse.Namespace):
+    config = cmd_util.create_config(args)
+    # The mount point may not be mounted, so look it up in the config rather
+    # than with get_mount_path().
+    mount = os.path.realpath(args.path)
+    client_dir = config.get_client_info(mount)['client-dir']
+
+    with config.get_thrift_client() as client:
+        result = client.debugCompactOverlay(mount, client_dir)
+
+    print('removed {} directories and {} files, reclaiming {} bytes'.format(
+        result.dirsRemoved, result.filesRemoved, result.bytesReclaimed))
+    print('max inode number: {}'.format(result.maxInodeNumber))
+
+
+def do_metrics(args: argparse.Namespace):
+    config = cmd_util.create_config(args)
+
+    with config.get_thrift_client() as client:
+        metrics = client.getOpenMetrics()
+
+    sys.stdout.write(metrics)
+
+
 def setup_argparse(parser: argparse.ArgumentParser):
     subparsers = parser.add_subparsers(dest='subparser_name')
 
@@ -214,3 +337,62 @@ def setup_argparse(parser: argparse.ArgumentParser):
         'a mount point is specified, only data about inodes under the '
         'specified subdirectory will be reported.')
     parser.set_defaults(func=do_inode)
+
+    parser = subparsers.add_parser(
+        'slow_requests',
+        help='Show the slowest recent FUSE requests and where their time went')
+    parser.add_argument('-n', '--count', type=int, default=20,
+                        help='The maximum number of requests to show')
+    parser.add_argument('path', help='The eden mount point path.')
+    parser.set_defaults(func=do_slow_requests)
+
+    parser = subparsers.add_parser(
+        'sample_requests',
+        help='Trace a sample of the FUSE requests on a mount point for a '
+        'while, and print where their time went as folded stacks for '
+        'flamegraph.pl')
+    parser.add_argument('-d', '--duration', type=float, default=10,
+                        help='How many seconds to sample for')
+    parser.add_argument('-n', '--one-in', type=int, default=1,
+                        help='Trace one in this many requests')
+    parser.add_argument('-o', '--output',
+                        help='Write the stacks to this file instead of stdout')
+    parser.add_argument('path', help='The eden mount point path.')
+    parser.set_defaults(func=do_sample_requests)
+
+    parser = subparsers.add_parser(
+        'lock_contention',
+        help='Profile the rename, directory contents and inode map locks of '
+        'all mount points for a while, and show how long they were waited '
+        'for and held, and which call sites waited the longest')
+    parser.add_argument('-d', '--duration', type=float, default=10,
+                        help='How many seconds to profile for')
+    parser.add_argument('-s', '--sites', type=int, default=10,
+                        help='How many call sites to show for each lock')
+    parser.set_defaults(func=do_lock_contention)
+
+    parser = subparsers.add_parser(
+        'mount_progress',
+        help='Show how many materialized inodes a mount point has loaded')
+    parser.add_argument('path', help='The eden mount point path.')
+    parser.set_defaults(func=do_mount_progress)
+
+    parser = subparsers.add_parser(
+        'checkout_stats',
+        help='Show timing for the most recent checkout of a mount point')
+    parser.add_argument('path', help='The eden mount point path.')
+    parser.set_defaults(func=do_checkout_stats)
+
+    parser = subparsers.add_parser(
+        'overlay_compact',
+        help='Remove overlay data that is unreachable from the root of a '
+        'client.  This works whether or not the client is mounted, but the '
+        'edenfs daemon must be running.')
+    parser.add_argument('path', help='The eden mount point path.')
+    parser.set_defaults(func=do_overlay_compact)
+
+    parser = subparsers.add_parser(
+        'metrics',
+        help='Print all of eden\'s counters in the OpenMetrics text format, '
+        'e.g. for the Prometheus node exporter\'s textfile collector')
+    parser.set_defaults(func=do_metrics)
@@ -108,6 +108,53 @@ def do_list(args):
         print(path)
 
 
+def do_perf(args):
+    config = create_config(args)
+    mount, _ = debug_mod.get_mount_path(args.path or os.getcwd())
+    with config.get_thrift_client() as client:
+        summary = client.getPerformanceSummary(mount)
+
+    print('FUSE requests on {}:'.format(mount))
+    print('  p50 {} us, p90 {} us, p99 {} us'.format(
+        summary.fuseP50Us, summary.fuseP90Us, summary.fuseP99Us))
+    print('  {} outstanding, {} interrupted'.format(
+        summary.fuseOutstanding, summary.fuseInterrupted))
+    if summary.fuseOperations:
+        print('  {:<12} {:>10} {:>10} {:>10} {:>10}'.format(
+            'operation', 'count', 'p50_us', 'p90_us', 'p99_us'))
+        for op in summary.fuseOperations[:args.operations]:
+            print('  {:<12} {:>10} {:>10} {:>10} {:>10}'.format(
+                op.operation, op.count, op.p50Us, op.p90Us, op.p99Us))
+
+    print('Caches:')
+    for cache in summary.caches:
+        lookups = cache.hits + cache.misses
+        rate = 'n/a'
+        if lookups:
+            rate = '{:.1f}%'.format(100.0 * cache.hits / lookups)
+        print('  {:<20} {:>7} hit rate ({} hits, {} misses)'.format(
+            cache.cache, rate, cache.hits, cache.misses))
+
+    print('Import queue:')
+    for priority, depth in sorted(summary.importQueueDepth.items()):
+        print('  {:<12} {} queued'.format(priority, depth))
+
+    print('Inodes: {} loaded, {} unloaded'.format(
+        summary.loadedInodes, summary.unloadedInodes))
+    print('Overlay: {} files, {} bytes'.format(
+        summary.overlayFiles, summary.overlayBytes))
+    print('Journal: {} deltas up to sequence {}, {} bytes in memory'.format(
+        summary.journalDeltas, summary.journalSequence,
+        summary.journalMemoryBytes))
+    print('Local store: {} bytes in {} SST files ({} at level 0)'.format(
+        summary.localStoreBytes, summary.localStoreSstFiles,
+        summary.localStoreLevel0Files))
+    print('  {} running compactions, {} bytes of compaction pending{}'.format(
+        summary.localStoreRunningCompactions,
+        summary.localStorePendingCompactionBytes,
+        ', WRITES STOPPED' if summary.localStoreWritesStopped else ''))
+
+
 def do_clone(args):
     args.path = normalize_path_arg(args.path)
     config = create_config(args)
@@ -356,6 +403,18 @@ def create_parser():
         'list', help='List available clients')
     list_parser.set_defaults(func=do_list)
 
+    perf_parser = subparsers.add_parser(
+        'perf', help='Summarize the performance of a mount point: FUSE '
+        'latency, cache hit rates, the import queue, and the sizes of the '
+        'inode map, overlay, journal and local store')
+    perf_parser.add_argument(
+        '-n', '--operations', type=int, default=10,
+        help='How many of the slowest FUSE operations to show')
+    perf_parser.add_argument(
+        'path', nargs='?', default=None,
+        help='A path inside the mount point (default: the current directory)')
+    perf_parser.set_defaults(func=do_perf)
+
     repository_parser = subparsers.add_parser(
         'repository', help='List all repositories')
     repository_parser.add_argument(
@@ -11,10 +11,12 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/range/adaptor/reversed.hpp>
+#include <folly/Conv.h>
 #include <folly/File.h>
 #include <folly/FileUtil.h>
 #include <folly/String.h>
 #include <folly/json.h>
+#include "SparseProfile.h"
 
 using std::string;
 
@@ -30,6 +32,8 @@ constexpr folly::StringPiece kName{"name"};
 constexpr folly::StringPiece kRepoHooksKey{"hooks"};
 constexpr folly::StringPiece kRepoTypeKey{"type"};
 constexpr folly::StringPiece kRepoSourceKey{"path"};
+constexpr folly::StringPiece kRepoImportHelpersKey{"import-helpers"};
+constexpr folly::StringPiece kOverlayDurabilityKey{"overlay-durability"};
 constexpr folly::StringPiece kPathsSection{"__paths__"};
 constexpr folly::StringPiece kEtcEdenDir{"etc-eden"};
 constexpr folly::StringPiece kUserConfigFile{"user-config"};
@@ -41,9 +45,31 @@ const facebook::eden::RelativePathPiece kBindMountsDir{"bind-mounts"};
 const facebook::eden::RelativePathPiece kCloneSuccessFile{"clone-succeeded"};
 const facebook::eden::RelativePathPiece kOverlayDir{"local"};
 const facebook::eden::RelativePathPiece kDirstateFile{"dirstate"};
+const facebook::eden::RelativePathPiece kHotTreesFile{"hot-trees"};
+const facebook::eden::RelativePathPiece kAccessSetFile{"access-set"};
+const facebook::eden::RelativePathPiece kSparseProfileFile{"sparse"};
+const facebook::eden::RelativePathPiece kJournalFile{"journal"};
 
 // File holding mapping of client directories.
 const facebook::eden::RelativePathPiece kClientDirectoryMap{"config.json"};
+
+facebook::eden::OverlayDurability parseOverlayDurability(
+    folly::StringPiece value) {
+  using facebook::eden::OverlayDurability;
+  if (value == "strict") {
+    return OverlayDurability::STRICT;
+  } else if (value == "batched") {
+    return OverlayDurability::BATCHED;
+  } else if (value == "relaxed") {
+    return OverlayDurability::RELAXED;
+  }
+  throw std::runtime_error(folly::to<string>(
+      "invalid ",
+      kOverlayDurabilityKey,
+      " setting \"",
+      value,
+      "\": must be strict, batched or relaxed"));
+}
 }
 
 namespace facebook {
@@ -91,6 +117,22 @@ AbsolutePath ClientConfig::getDirstateStoragePath() const {
   return clientDirectory_ + kDirstateFile;
 }
 
+AbsolutePath ClientConfig::getHotTreesPath() const {
+  return clientDirectory_ + kHotTreesFile;
+}
+
+AbsolutePath ClientConfig::getAccessSetPath() const {
+  return clientDirectory_ + kAccessSetFile;
+}
+
+AbsolutePath ClientConfig::getSparseProfilePath() const {
+  return clientDirectory_ + kSparseProfileFile;
+}
+
+AbsolutePath ClientConfig::getJournalPath() const {
+  return clientDirectory_ + kJournalFile;
+}
+
 ClientConfig::ConfigData ClientConfig::loadConfigData(
     AbsolutePathPiece etcEdenDirectory,
     AbsolutePathPiece configPath) {
@@ -180,6 +222,22 @@ std::unique_ptr<ClientConfig> ClientConfig::loadFromClientDirectory(
     config->repoHooks_ = AbsolutePath{hooksPath};
   }
 
+  config->numImportHelpers_ = folly::to<size_t>(
+      configData->get(repoHeader, kRepoImportHelpersKey, "0"));
+
+  // The client's own edenrc can override the repository's durability mode,
+  // so that individual checkouts can opt out of syncing.
+  config->overlayDurability_ = parseOverlayDurability(localConfig.get(
+      kRepoSection,
+      kOverlayDurabilityKey,
+      configData->get(repoHeader, kOverlayDurabilityKey, "strict")));
+
+  string sparseContents;
+  if (folly::readFile(
+          config->getSparseProfilePath().c_str(), sparseContents)) {
+    config->sparseProfile_ = std::make_shared<SparseProfile>(sparseContents);
+  }
+
   return config;
 }
 
@@ -12,6 +12,7 @@
 #include <boost/property_tree/ini_parser.hpp>
 #include <folly/Optional.h>
 #include <folly/dynamic.h>
+#include <memory>
 #include "InterpolatedPropertyTree.h"
 #include "eden/fs/model/Hash.h"
 #include "eden/utils/PathFuncs.h"
@@ -19,6 +20,8 @@
 namespace facebook {
 namespace eden {
 
+class SparseProfile;
+
 struct BindMount {
   BindMount(AbsolutePathPiece clientDirPath, AbsolutePathPiece mountDirPath)
       : pathInClientDir(clientDirPath), pathInMountDir(mountDirPath) {}
@@ -37,6 +40,30 @@ inline void operator<<(std::ostream& out, const BindMount& bindMount) {
       << "; pathInMountDir=" << bindMount.pathInMountDir << "}";
 }
 
+/**
+ * How a mount point's overlay trades crash durability for write throughput.
+ */
+enum class OverlayDurability {
+  /**
+   * Sync each file when it is materialized, and every batch of directory
+   * changes when it is written out.
+   */
+  STRICT,
+  /**
+   * Don't sync individual writes.  Each periodic overlay flush syncs
+   * everything written since the previous one in a single group commit.
+   * Explicit fsync() and fsyncdir() calls are still honored.
+   */
+  BATCHED,
+  /**
+   * Never sync, even on fsync() and fsyncdir().  Changes made shortly before
+   * a machine crash may be lost, and the next mount rescans the overlay to
+   * recover.  This is meant for checkouts whose local changes are disposable,
+   * such as on CI hosts.
+   */
+  RELAXED,
+};
+
 class ClientConfig {
  public:
   using ConfigData = InterpolatedPropertyTree;
@@ -112,6 +139,42 @@ class ClientConfig {
     return repoSource_;
   }
 
+  /**
+   * Get the maximum number of import helper processes to use for this
+   * repository.
+   *
+   * This is only used by mercurial repositories.  A value of 0 means the
+   * backing store should use its default.
+   */
+  size_t getNumImportHelpers() const {
+    return numImportHelpers_;
+  }
+
+  /**
+   * Get the durability mode for this client's overlay.
+   *
+   * This is the overlay-durability setting from the client's own edenrc
+   * [repository] section if present, or else from the repository's
+   * configuration, and defaults to strict.
+   */
+  OverlayDurability getOverlayDurability() const {
+    return overlayDurability_;
+  }
+
+  /**
+   * Get the sparse profile that limits which paths of this client are
+   * visible, or nullptr if everything is visible.
+   *
+   * The profile is read from the sparse file in the client directory, if
+   * there is one.  See SparseProfile for its format.
+   */
+  const std::shared_ptr<const SparseProfile>& getSparseProfile() const {
+    return sparseProfile_;
+  }
+
+  /** Path to the file holding the client's sparse profile. */
+  AbsolutePath getSparseProfilePath() const;
+
   /** Path to the directory where the scripts for the hooks are defined. */
   AbsolutePathPiece getRepoHooks() const;
 
@@ -121,6 +184,24 @@ class ClientConfig {
   /** Path to the file where the dirstate data is stored. */
   AbsolutePath getDirstateStoragePath() const;
 
+  /**
+   * Path to the file listing the Trees that were in use when the client was
+   * last unmounted, which are loaded again when it is next mounted.
+   */
+  AbsolutePath getHotTreesPath() const;
+
+  /**
+   * Path to the file listing the files read during the last access
+   * recording, which are prefetched when the recording is replayed.
+   */
+  AbsolutePath getAccessSetPath() const;
+
+  /**
+   * Path to the file holding the journal saved when the client was last
+   * unmounted, which the next mount continues from.
+   */
+  AbsolutePath getJournalPath() const;
+
   /** Path to the file where the current commit ID is stored */
   AbsolutePath getSnapshotPath() const;
 
@@ -139,6 +220,9 @@ class ClientConfig {
   std::string repoType_;
   std::string repoSource_;
   folly::Optional<AbsolutePath> repoHooks_;
+  size_t numImportHelpers_{0};
+  OverlayDurability overlayDurability_{OverlayDurability::STRICT};
+  std::shared_ptr<const SparseProfile> sparseProfile_;
 };
 }
 }
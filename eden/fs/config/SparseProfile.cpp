@@ -0,0 +1,33 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "SparseProfile.h"
+
+namespace facebook {
+namespace eden {
+
+namespace {
+const PathComponentPiece kDotHgName{".hg"};
+const PathComponentPiece kDotEdenName{".eden"};
+}
+
+SparseProfile::SparseProfile(folly::StringPiece contents) {
+  rules_.loadFile(contents);
+}
+
+bool SparseProfile::isExcluded(RelativePathPiece path) const {
+  // Source control and eden itself need these, however broad the patterns.
+  if (path.dirname().empty() &&
+      (path.basename() == kDotHgName || path.basename() == kDotEdenName)) {
+    return false;
+  }
+  return rules_.match(path) == GitIgnore::EXCLUDE;
+}
+}
+}
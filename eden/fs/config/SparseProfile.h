@@ -0,0 +1,58 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Range.h>
+#include "eden/fs/model/git/GitIgnore.h"
+#include "eden/utils/PathFuncs.h"
+
+namespace facebook {
+namespace eden {
+
+/**
+ * A sparse profile limits which parts of a checkout are visible.
+ *
+ * Paths excluded by the profile are not listed in directories, cannot be
+ * looked up, and are skipped by globs.  Since nothing under an excluded
+ * directory is ever accessed, its source control data is never imported
+ * and its inodes are never loaded.
+ *
+ * The profile uses gitignore syntax, with paths relative to the root of the
+ * checkout.  A matching pattern excludes a path, and a later pattern
+ * starting with "!" includes it again.  For example this hides everything
+ * at the top level except the project and tools directories:
+ *
+ *   /?*
+ *   !/project/
+ *   !/tools/
+ *
+ * As with gitignore, excluding a directory excludes everything under it, so
+ * the rules are only consulted for paths whose parent is visible.  The
+ * .hg and .eden directories are never excluded.
+ */
+class SparseProfile {
+ public:
+  explicit SparseProfile(folly::StringPiece contents);
+
+  /**
+   * Returns true if path is hidden by this profile.
+   *
+   * The parent directory of path is assumed to be visible.
+   */
+  bool isExcluded(RelativePathPiece path) const;
+
+ private:
+  SparseProfile(const SparseProfile&) = delete;
+  SparseProfile& operator=(const SparseProfile&) = delete;
+
+  GitIgnore rules_;
+};
+}
+}
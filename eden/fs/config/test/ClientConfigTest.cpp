@@ -11,12 +11,14 @@
 #include <folly/experimental/TestUtil.h>
 #include <gtest/gtest.h>
 #include "eden/fs/config/ClientConfig.h"
+#include "eden/fs/config/SparseProfile.h"
 #include "eden/utils/PathFuncs.h"
 
 using facebook::eden::AbsolutePath;
 using facebook::eden::BindMount;
 using facebook::eden::ClientConfig;
 using facebook::eden::Hash;
+using facebook::eden::OverlayDurability;
 using facebook::eden::RelativePath;
 
 namespace {
@@ -191,4 +193,110 @@ TEST_F(ClientConfigTest, testOnlySystemConfigData) {
                 AbsolutePath{"/tmp/someplace/path/to-my-path"}});
   EXPECT_EQ(expectedBindMounts, config->getBindMounts());
 }
+
+TEST_F(ClientConfigTest, testImportHelpers) {
+  auto configData = ClientConfig::loadConfigData(
+      AbsolutePath{etcEdenPath_.string()},
+      AbsolutePath{userConfigPath_.string()});
+  auto config = ClientConfig::loadFromClientDirectory(
+      AbsolutePath{mountPoint_.string()},
+      AbsolutePath{clientDir_.string()},
+      &configData);
+  EXPECT_EQ(0, config->getNumImportHelpers());
+
+  auto data =
+      "[repository fbsource]\n"
+      "path = /data/users/carenthomas/fbsource\n"
+      "type = hg\n"
+      "import-helpers = 8\n";
+  folly::writeFile(folly::StringPiece{data}, userConfigPath_.c_str());
+
+  configData = ClientConfig::loadConfigData(
+      AbsolutePath{etcEdenPath_.string()},
+      AbsolutePath{userConfigPath_.string()});
+  config = ClientConfig::loadFromClientDirectory(
+      AbsolutePath{mountPoint_.string()},
+      AbsolutePath{clientDir_.string()},
+      &configData);
+  EXPECT_EQ(8, config->getNumImportHelpers());
+}
+
+TEST_F(ClientConfigTest, testOverlayDurability) {
+  auto configData = ClientConfig::loadConfigData(
+      AbsolutePath{etcEdenPath_.string()},
+      AbsolutePath{userConfigPath_.string()});
+  auto config = ClientConfig::loadFromClientDirectory(
+      AbsolutePath{mountPoint_.string()},
+      AbsolutePath{clientDir_.string()},
+      &configData);
+  EXPECT_EQ(OverlayDurability::STRICT, config->getOverlayDurability());
+
+  // The repository configuration sets the default for its clients
+  auto data =
+      "[repository fbsource]\n"
+      "path = /data/users/carenthomas/fbsource\n"
+      "type = git\n"
+      "overlay-durability = batched\n";
+  folly::writeFile(folly::StringPiece{data}, userConfigPath_.c_str());
+  configData = ClientConfig::loadConfigData(
+      AbsolutePath{etcEdenPath_.string()},
+      AbsolutePath{userConfigPath_.string()});
+  config = ClientConfig::loadFromClientDirectory(
+      AbsolutePath{mountPoint_.string()},
+      AbsolutePath{clientDir_.string()},
+      &configData);
+  EXPECT_EQ(OverlayDurability::BATCHED, config->getOverlayDurability());
+
+  // which the client's own edenrc can override
+  auto localConfigPath = clientDir_ / "edenrc";
+  auto localData =
+      "[repository]\n"
+      "name = fbsource\n"
+      "overlay-durability = relaxed\n";
+  folly::writeFile(folly::StringPiece{localData}, localConfigPath.c_str());
+  config = ClientConfig::loadFromClientDirectory(
+      AbsolutePath{mountPoint_.string()},
+      AbsolutePath{clientDir_.string()},
+      &configData);
+  EXPECT_EQ(OverlayDurability::RELAXED, config->getOverlayDurability());
+
+  localData =
+      "[repository]\n"
+      "name = fbsource\n"
+      "overlay-durability = sometimes\n";
+  folly::writeFile(folly::StringPiece{localData}, localConfigPath.c_str());
+  EXPECT_THROW(
+      ClientConfig::loadFromClientDirectory(
+          AbsolutePath{mountPoint_.string()},
+          AbsolutePath{clientDir_.string()},
+          &configData),
+      std::runtime_error);
+}
+
+TEST_F(ClientConfigTest, testSparseProfile) {
+  auto configData = ClientConfig::loadConfigData(
+      AbsolutePath{etcEdenPath_.string()},
+      AbsolutePath{userConfigPath_.string()});
+  auto config = ClientConfig::loadFromClientDirectory(
+      AbsolutePath{mountPoint_.string()},
+      AbsolutePath{clientDir_.string()},
+      &configData);
+  EXPECT_EQ(nullptr, config->getSparseProfile());
+
+  auto sparsePath = clientDir_ / "sparse";
+  folly::writeFile(
+      folly::StringPiece{"/?*\n!/project/\n"}, sparsePath.c_str());
+  config = ClientConfig::loadFromClientDirectory(
+      AbsolutePath{mountPoint_.string()},
+      AbsolutePath{clientDir_.string()},
+      &configData);
+  const auto& sparse = config->getSparseProfile();
+  ASSERT_NE(nullptr, sparse);
+  EXPECT_TRUE(sparse->isExcluded(RelativePathPiece{"other"}));
+  EXPECT_TRUE(sparse->isExcluded(RelativePathPiece{"README"}));
+  EXPECT_FALSE(sparse->isExcluded(RelativePathPiece{"project"}));
+  EXPECT_FALSE(sparse->isExcluded(RelativePathPiece{"project/src"}));
+  EXPECT_FALSE(sparse->isExcluded(RelativePathPiece{".hg"}));
+  EXPECT_FALSE(sparse->isExcluded(RelativePathPiece{".eden"}));
+}
 }
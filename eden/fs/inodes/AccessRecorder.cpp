@@ -0,0 +1,185 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/inodes/AccessRecorder.h"
+
+#include <folly/Conv.h>
+#include <glog/logging.h>
+#include <thrift/lib/cpp2/protocol/Serializer.h>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include "eden/fs/inodes/gen-cpp2/access_set_types.h"
+#include "eden/fs/model/Tree.h"
+#include "eden/fs/store/ObjectStore.h"
+
+using apache::thrift::CompactSerializer;
+using folly::Future;
+using folly::StringPiece;
+using std::vector;
+
+namespace facebook {
+namespace eden {
+
+namespace {
+/** The recorded paths below a directory, as a tree of names. */
+struct PathNode {
+  /** Whether the path ending here was recorded */
+  bool accessed{false};
+  std::unordered_map<PathComponent, std::unique_ptr<PathNode>> children;
+};
+
+struct ResolveState {
+  explicit ResolveState(const ObjectStore* store) : store(store) {}
+
+  const ObjectStore* const store;
+  PathNode root;
+  vector<Hash> blobs;
+};
+
+/** The directories to load next, and the Trees they are at. */
+using ResolveLevel = vector<std::pair<const PathNode*, Hash>>;
+
+Future<folly::Unit> resolveLevel(
+    std::shared_ptr<ResolveState> state,
+    ResolveLevel level) {
+  if (level.empty()) {
+    return folly::makeFuture();
+  }
+
+  vector<Hash> ids;
+  ids.reserve(level.size());
+  for (const auto& dir : level) {
+    ids.push_back(dir.second);
+  }
+  return folly::collectAll(state->store->getTreesBatch(ids)).then([
+    state,
+    level = std::move(level)
+  ](vector<folly::Try<std::unique_ptr<Tree>>> trees) {
+    ResolveLevel next;
+    for (size_t n = 0; n < trees.size(); ++n) {
+      if (!trees[n].hasValue()) {
+        VLOG(2) << "unable to load tree while resolving recorded accesses: "
+                << trees[n].exception().what();
+        continue;
+      }
+      const auto& tree = trees[n].value();
+      for (const auto& child : level[n].first->children) {
+        auto* entry = tree->getEntryPtr(child.first);
+        if (!entry) {
+          continue;
+        }
+        if (entry->getType() == TreeEntryType::TREE) {
+          if (!child.second->children.empty()) {
+            next.emplace_back(child.second.get(), entry->getHash());
+          }
+        } else if (child.second->accessed) {
+          state->blobs.push_back(entry->getHash());
+        }
+      }
+    }
+    return resolveLevel(state, std::move(next));
+  });
+}
+}
+
+AccessRecorder::AccessRecorder(size_t maxPaths) : maxPaths_(maxPaths) {}
+
+void AccessRecorder::start() {
+  paths_.wlock()->clear();
+  recording_.store(true, std::memory_order_relaxed);
+}
+
+vector<RelativePath> AccessRecorder::stop() {
+  if (!recording_.exchange(false, std::memory_order_relaxed)) {
+    throw std::logic_error("access recording was not started");
+  }
+  std::unordered_set<RelativePath> recorded;
+  paths_.wlock()->swap(recorded);
+  vector<RelativePath> result(recorded.begin(), recorded.end());
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+void AccessRecorder::record(RelativePathPiece path) {
+  if (!isRecording()) {
+    return;
+  }
+  auto paths = paths_.wlock();
+  if (paths->size() < maxPaths_) {
+    paths->emplace(path);
+  }
+}
+
+std::string AccessRecorder::serialize(const vector<RelativePath>& paths) {
+  access::SerializedAccessSet saved;
+  StringPiece previous;
+  for (const auto& path : paths) {
+    auto current = path.stringPiece();
+    size_t shared = 0;
+    auto maxShared = std::min(previous.size(), current.size());
+    while (shared < maxShared && previous[shared] == current[shared]) {
+      ++shared;
+    }
+    saved.sharedPrefixLengths.push_back(static_cast<int32_t>(shared));
+    saved.suffixes.push_back(current.subpiece(shared).str());
+    previous = current;
+  }
+  return CompactSerializer::serialize<std::string>(saved);
+}
+
+vector<RelativePath> AccessRecorder::deserialize(StringPiece data) {
+  auto saved =
+      CompactSerializer::deserialize<access::SerializedAccessSet>(data);
+  if (saved.sharedPrefixLengths.size() != saved.suffixes.size()) {
+    throw std::runtime_error("corrupt access set: mismatched list sizes");
+  }
+
+  vector<RelativePath> result;
+  result.reserve(saved.suffixes.size());
+  std::string path;
+  for (size_t n = 0; n < saved.suffixes.size(); ++n) {
+    auto shared = saved.sharedPrefixLengths[n];
+    if (shared < 0 || static_cast<size_t>(shared) > path.size()) {
+      throw std::runtime_error(folly::to<std::string>(
+          "corrupt access set: bad prefix length ", shared));
+    }
+    path.resize(shared);
+    path.append(saved.suffixes[n]);
+    result.emplace_back(path);
+  }
+  return result;
+}
+
+Future<vector<Hash>> AccessRecorder::resolveBlobs(
+    const ObjectStore* store,
+    const Hash& rootTreeId,
+    const vector<RelativePath>& paths) {
+  auto state = std::make_shared<ResolveState>(store);
+  for (const auto& path : paths) {
+    auto* node = &state->root;
+    for (auto name : path.components()) {
+      auto& child = node->children[name.copy()];
+      if (!child) {
+        child = std::make_unique<PathNode>();
+      }
+      node = child.get();
+    }
+    node->accessed = true;
+  }
+
+  ResolveLevel level;
+  level.emplace_back(&state->root, rootTreeId);
+  return resolveLevel(state, std::move(level)).then([state] {
+    return std::move(state->blobs);
+  });
+}
+}
+}
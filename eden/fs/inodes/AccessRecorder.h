@@ -0,0 +1,98 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Range.h>
+#include <folly/Synchronized.h>
+#include <folly/futures/Future.h>
+#include <atomic>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "eden/fs/model/Hash.h"
+#include "eden/utils/PathFuncs.h"
+
+namespace facebook {
+namespace eden {
+
+class ObjectStore;
+
+/**
+ * AccessRecorder records the paths of the files opened for reading in a
+ * mount point between start() and stop(), e.g. for the duration of a
+ * build.
+ *
+ * The recorded paths can be saved, and replayed later as a bulk prefetch.
+ * Paths rather than blob hashes are recorded, so that a recording made at
+ * one commit still prefetches the right blobs after a checkout to another.
+ *
+ * AccessRecorder is thread-safe.  record() is cheap when not recording.
+ */
+class AccessRecorder {
+ public:
+  /** At most maxPaths distinct paths are recorded. */
+  explicit AccessRecorder(size_t maxPaths);
+
+  /**
+   * Start recording, discarding anything recorded before.
+   */
+  void start();
+
+  /**
+   * Stop recording, and return the recorded paths, sorted.
+   *
+   * Throws std::logic_error if recording was not started.
+   */
+  std::vector<RelativePath> stop();
+
+  bool isRecording() const {
+    return recording_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Record that a file was opened for reading, if recording.
+   */
+  void record(RelativePathPiece path);
+
+  /**
+   * Serialize sorted paths compactly, by storing only the part of each
+   * path that differs from the previous one.
+   */
+  static std::string serialize(const std::vector<RelativePath>& paths);
+
+  /**
+   * Parse the output of serialize().  Throws if the data is invalid.
+   */
+  static std::vector<RelativePath> deserialize(folly::StringPiece data);
+
+  /**
+   * Find the blobs that the given paths refer to in the Tree rootTreeId.
+   *
+   * Each level of directories is loaded with a single getTreesBatch()
+   * call.  Paths that do not exist, or are not files, in that Tree are
+   * skipped.  The ObjectStore must remain valid until the returned Future
+   * completes.
+   */
+  static folly::Future<std::vector<Hash>> resolveBlobs(
+      const ObjectStore* store,
+      const Hash& rootTreeId,
+      const std::vector<RelativePath>& paths);
+
+ private:
+  // Forbidden copy constructor and assignment operator
+  AccessRecorder(const AccessRecorder&) = delete;
+  AccessRecorder& operator=(const AccessRecorder&) = delete;
+
+  const size_t maxPaths_{0};
+  std::atomic<bool> recording_{false};
+  folly::Synchronized<std::unordered_set<RelativePath>> paths_;
+};
+}
+}
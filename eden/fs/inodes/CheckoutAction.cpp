@@ -9,11 +9,11 @@
  */
 #include "eden/fs/inodes/CheckoutAction.h"
 
+#include <folly/Executor.h>
 #include "eden/fs/inodes/CheckoutContext.h"
 #include "eden/fs/inodes/FileInode.h"
 #include "eden/fs/inodes/InodeBase.h"
 #include "eden/fs/inodes/TreeInode.h"
-#include "eden/fs/model/Blob.h"
 #include "eden/fs/model/Tree.h"
 #include "eden/fs/model/TreeEntry.h"
 #include "eden/fs/service/gen-cpp2/eden_types.h"
@@ -107,8 +107,8 @@ class CheckoutAction::LoadingRefcount {
 };
 
 Future<Unit> CheckoutAction::run(
-    CheckoutContext* /* ctx */,
-    ObjectStore* store) {
+    CheckoutContext* ctx,
+    ObjectStore* /* store */) {
   // Immediately create one LoadingRefcount, to ensure that our
   // numLoadsPending_ refcount does not drop to 0 until after we have started
   // all required load operations.
@@ -118,10 +118,10 @@ Future<Unit> CheckoutAction::run(
   LoadingRefcount refcount{this};
 
   try {
-    // Load the Blob or Tree for the old TreeEntry.
+    // Load the Tree or the Blob metadata for the old TreeEntry.
     if (oldScmEntry_.hasValue()) {
       if (oldScmEntry_.value().getType() == TreeEntryType::TREE) {
-        store->getTreeFuture(oldScmEntry_.value().getHash())
+        ctx->loadTree(oldScmEntry_.value().getHash())
             .then([rc = LoadingRefcount(this)](std::unique_ptr<Tree> oldTree) {
               rc->setOldTree(std::move(oldTree));
             })
@@ -129,21 +129,21 @@ Future<Unit> CheckoutAction::run(
               rc->error("error getting old tree", ew);
             });
       } else {
-        store->getBlobFuture(oldScmEntry_.value().getHash())
-            .then([rc = LoadingRefcount(this)](std::unique_ptr<Blob> oldBlob) {
-              rc->setOldBlob(std::move(oldBlob));
+        ctx->loadBlobMetadata(oldScmEntry_.value().getHash())
+            .then([rc = LoadingRefcount(this)](const BlobMetadata& metadata) {
+              rc->setOldBlobMetadata(metadata);
             })
             .onError([rc = LoadingRefcount(this)](const exception_wrapper& ew) {
-              rc->error("error getting old blob", ew);
+              rc->error("error getting old blob metadata", ew);
             });
       }
     }
 
-    // If we have a new TreeEntry, load the corresponding Blob or Tree
+    // If we have a new TreeEntry, load the Tree or prefetch the Blob
     if (newScmEntry_.hasValue()) {
       const auto& newEntry = newScmEntry_.value();
       if (newEntry.getType() == TreeEntryType::TREE) {
-        store->getTreeFuture(newEntry.getHash())
+        ctx->loadTree(newEntry.getHash())
             .then([rc = LoadingRefcount(this)](std::unique_ptr<Tree> newTree) {
               rc->setNewTree(std::move(newTree));
             })
@@ -151,13 +151,7 @@ Future<Unit> CheckoutAction::run(
               rc->error("error getting new tree", ew);
             });
       } else {
-        store->getBlobFuture(newEntry.getHash())
-            .then([rc = LoadingRefcount(this)](std::unique_ptr<Blob> newBlob) {
-              rc->setNewBlob(std::move(newBlob));
-            })
-            .onError([rc = LoadingRefcount(this)](const exception_wrapper& ew) {
-              rc->error("error getting new blob", ew);
-            });
+        ctx->prefetchBlob(newEntry.getHash());
       }
     }
 
@@ -182,28 +176,21 @@ Future<Unit> CheckoutAction::run(
 
 void CheckoutAction::setOldTree(std::unique_ptr<Tree> tree) {
   CHECK(!oldTree_);
-  CHECK(!oldBlob_);
+  CHECK(!oldBlobMetadata_);
   oldTree_ = std::move(tree);
 }
 
-void CheckoutAction::setOldBlob(std::unique_ptr<Blob> blob) {
+void CheckoutAction::setOldBlobMetadata(const BlobMetadata& metadata) {
   CHECK(!oldTree_);
-  CHECK(!oldBlob_);
-  oldBlob_ = std::move(blob);
+  CHECK(!oldBlobMetadata_);
+  oldBlobMetadata_ = metadata;
 }
 
 void CheckoutAction::setNewTree(std::unique_ptr<Tree> tree) {
   CHECK(!newTree_);
-  CHECK(!newBlob_);
   newTree_ = std::move(tree);
 }
 
-void CheckoutAction::setNewBlob(std::unique_ptr<Blob> blob) {
-  CHECK(!newTree_);
-  CHECK(!newBlob_);
-  newBlob_ = std::move(blob);
-}
-
 void CheckoutAction::setInode(InodePtr inode) {
   CHECK(!inode_);
   inode_ = std::move(inode);
@@ -223,6 +210,24 @@ void CheckoutAction::allLoadsComplete() noexcept {
     return;
   }
 
+  // The last load may have completed on an ObjectStore or BackingStore
+  // thread.  Apply the action on the checkout's executor instead, so that
+  // actions for many entries can run in parallel without tying up the
+  // threads that are fetching data.
+  auto* executor = ctx_->getExecutor();
+  if (!executor) {
+    startAction();
+    return;
+  }
+  try {
+    executor->add([this] { startAction(); });
+  } catch (const std::exception& ex) {
+    exception_wrapper ew{std::current_exception(), ex};
+    promise_.setException(ew);
+  }
+}
+
+void CheckoutAction::startAction() noexcept {
   try {
     doAction().then(
         [this](folly::Try<Unit>&& t) { this->promise_.setTry(std::move(t)); });
@@ -252,12 +257,13 @@ bool CheckoutAction::ensureDataReady() noexcept {
   // Make sure we actually have all the data we need.
   // (Just in case something went wrong when wiring up the callbacks in such a
   // way that we also failed to call error().)
-  if (oldScmEntry_.hasValue() && (!oldTree_ && !oldBlob_)) {
+  if (oldScmEntry_.hasValue() && (!oldTree_ && !oldBlobMetadata_)) {
     promise_.setException(
         std::runtime_error("failed to load data for old TreeEntry"));
     return false;
   }
-  if (newScmEntry_.hasValue() && (!newTree_ && !newBlob_)) {
+  if (newScmEntry_.hasValue() &&
+      newScmEntry_.value().getType() == TreeEntryType::TREE && !newTree_) {
     promise_.setException(
         std::runtime_error("failed to load data for new TreeEntry"));
     return false;
@@ -284,7 +290,10 @@ Future<Unit> CheckoutAction::doAction() {
   //   (merge, check-only, force)
 
   // Check for conflicts first.
-  if (hasConflict() && !ctx_->forceUpdate()) {
+  auto conflictCheckStart = std::chrono::steady_clock::now();
+  auto conflict = hasConflict();
+  ctx_->addTime(CheckoutContext::CHECK_CONFLICTS, conflictCheckStart);
+  if (conflict && !ctx_->forceUpdate()) {
     // hasConflict will have added the conflict information to ctx_
     return makeFuture();
   }
@@ -315,7 +324,7 @@ bool CheckoutAction::hasConflict() {
     // conflicts for individual leaf inodes that were modified, and not for the
     // parent directories.
     return false;
-  } else if (oldBlob_) {
+  } else if (oldBlobMetadata_) {
     auto fileInode = inode_.asFilePtrOrNull();
     if (!fileInode) {
       // This was a file, but has been replaced with a directory on disk
@@ -324,7 +333,9 @@ bool CheckoutAction::hasConflict() {
     }
 
     // Check that the file contents are the same as the old source control entry
-    if (!fileInode->isSameAs(*oldBlob_, oldScmEntry_.value().getMode())) {
+    const auto& oldEntry = oldScmEntry_.value();
+    if (!fileInode->isSameAs(
+            oldEntry.getHash(), oldBlobMetadata_->sha1, oldEntry.getMode())) {
       // The file contents or mode bits are different
       ctx_->addConflict(ConflictType::MODIFIED, inode_.get());
       return true;
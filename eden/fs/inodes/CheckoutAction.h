@@ -15,6 +15,7 @@
 #include <vector>
 #include "eden/fs/inodes/InodePtr.h"
 #include "eden/fs/model/TreeEntry.h"
+#include "eden/fs/store/BlobMetadata.h"
 
 namespace folly {
 class exception_wrapper;
@@ -23,7 +24,6 @@ class exception_wrapper;
 namespace facebook {
 namespace eden {
 
-class Blob;
 class CheckoutContext;
 class ObjectStore;
 class Tree;
@@ -90,6 +90,14 @@ class CheckoutAction {
 
   PathComponentPiece getEntryName() const;
 
+  /**
+   * Start the action.
+   *
+   * The loads the action needs are queued on the CheckoutContext, and do not
+   * start until the caller calls CheckoutContext::flushLoads().  Once all of
+   * the data is ready the action is applied on the CheckoutContext's
+   * executor.
+   */
   folly::Future<folly::Unit> run(CheckoutContext* ctx, ObjectStore* store);
 
  private:
@@ -106,13 +114,13 @@ class CheckoutAction {
       folly::Future<InodePtr> inodeFuture);
 
   void setOldTree(std::unique_ptr<Tree> tree);
-  void setOldBlob(std::unique_ptr<Blob> blob);
+  void setOldBlobMetadata(const BlobMetadata& metadata);
   void setNewTree(std::unique_ptr<Tree> tree);
-  void setNewBlob(std::unique_ptr<Blob> blob);
   void setInode(InodePtr inode);
   void error(folly::StringPiece msg, const folly::exception_wrapper& ew);
 
   void allLoadsComplete() noexcept;
+  void startAction() noexcept;
   bool ensureDataReady() noexcept;
   bool hasConflict();
   folly::Future<folly::Unit> doAction();
@@ -156,18 +164,18 @@ class CheckoutAction {
   /*
    * Data that we have to load to perform the checkout action.
    *
-   * Only one each oldTree_ and oldBlob_ will be loaded,
-   * and the same goes for newTree_ and newBlob_.
+   * Only one of oldTree_ and oldBlobMetadata_ will be loaded.  Checking a
+   * file for conflicts only needs the old blob's hash and SHA-1, so we never
+   * load the old blob contents.
    *
-   * TODO: We don't actually ever need the data from new blob.  If the
-   * destination entry is a blob we could just record this fact, and not bother
-   * loading the blob data itself.
+   * newTree_ is only loaded if the destination entry is a tree.  We don't
+   * need the data from a new blob; it is prefetched so that it is local by
+   * the time the file is read.
    */
   InodePtr inode_;
   std::unique_ptr<Tree> oldTree_;
-  std::unique_ptr<Blob> oldBlob_;
+  folly::Optional<BlobMetadata> oldBlobMetadata_;
   std::unique_ptr<Tree> newTree_;
-  std::unique_ptr<Blob> newBlob_;
 
   /**
    * The errors vector keeps track of any errors that occurred while trying to
@@ -9,23 +9,88 @@
  */
 #include "eden/fs/inodes/CheckoutContext.h"
 
+#include <folly/futures/Future.h>
+#include <gflags/gflags.h>
 #include "eden/fs/inodes/EdenMount.h"
 #include "eden/fs/inodes/InodePtr.h"
 #include "eden/fs/inodes/TreeInode.h"
+#include "eden/fs/model/Tree.h"
+#include "eden/fs/store/ObjectStore.h"
+#include "eden/fuse/Channel.h"
+
+#include <algorithm>
+
+DEFINE_int32(
+    checkout_prefetch_batch_size,
+    256,
+    "the number of blobs requested from the backing store at once when "
+    "prefetching the new contents of loaded files during checkout");
+DEFINE_int32(
+    checkout_prefetch_max_concurrency,
+    4,
+    "the maximum number of checkout prefetch batches outstanding at once");
 
 using folly::Future;
+using folly::makeFuture;
 using folly::Unit;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+using std::unique_ptr;
 using std::vector;
 
 namespace facebook {
 namespace eden {
 
+namespace {
+/**
+ * Records the time from its creation until it is destroyed in a phase of a
+ * checkout.
+ *
+ * This is held in a shared_ptr by each of the loads in a batch, so that the
+ * batch is timed until its last load completes.
+ */
+class PhaseTimer {
+ public:
+  PhaseTimer(CheckoutContext* ctx, CheckoutContext::Phase phase)
+      : ctx_(ctx), phase_(phase), start_(steady_clock::now()) {}
+  ~PhaseTimer() {
+    ctx_->addTime(phase_, start_);
+  }
+
+ private:
+  CheckoutContext* const ctx_;
+  CheckoutContext::Phase const phase_;
+  steady_clock::time_point const start_;
+};
+}
+
 CheckoutContext::CheckoutContext(
     folly::Synchronized<Hash>::LockedPtr&& snapshotLock,
-    bool force)
-    : force_{force}, snapshotLock_(std::move(snapshotLock)) {}
+    bool force,
+    fusell::Channel* fuseChannel,
+    folly::Executor* executor)
+    : force_{force},
+      snapshotLock_(std::move(snapshotLock)),
+      fuseChannel_{fuseChannel},
+      executor_{executor} {
+  for (auto& value : microseconds_) {
+    value.store(0, std::memory_order_relaxed);
+  }
+}
 
-CheckoutContext::~CheckoutContext() {}
+CheckoutContext::~CheckoutContext() {
+  // If the checkout failed part way through, finish() was never called, but
+  // the entries that were changed before the failure still need to be
+  // invalidated.
+  if (renameLock_) {
+    renameLock_.unlock();
+  }
+  if (!snapshotLock_.isNull()) {
+    snapshotLock_.unlock();
+  }
+  sendInvalidations();
+}
 
 void CheckoutContext::start(RenameLock&& renameLock) {
   renameLock_ = std::move(renameLock);
@@ -42,9 +107,137 @@ vector<CheckoutConflict> CheckoutContext::finish(Hash newSnapshot) {
   renameLock_.unlock();
   snapshotLock_.unlock();
 
+  // Tell the kernel about the entries we changed.  This is done after
+  // releasing the locks so that the writes to the FUSE device do not hold up
+  // other filesystem operations, but before returning, so that the caller
+  // does not see stale data from the kernel's cache once checkout completes.
+  auto invalidateStart = steady_clock::now();
+  sendInvalidations();
+  addTime(INVALIDATE, invalidateStart);
+
   // Return conflicts_ via a move operation.  We don't need them any more, and
   // can give ownership directly to our caller.
-  return std::move(*conflicts_.wlock());
+  auto conflicts = std::move(*conflicts_.wlock());
+  for (const auto& conflict : conflicts) {
+    if (conflict.type == ConflictType::ERROR) {
+      ++numErrors_;
+    } else {
+      ++numConflicts_;
+    }
+  }
+  return conflicts;
+}
+
+void CheckoutContext::addTime(Phase phase, steady_clock::time_point start) {
+  auto elapsed = duration_cast<microseconds>(steady_clock::now() - start);
+  microseconds_[phase].fetch_add(elapsed.count(), std::memory_order_relaxed);
+}
+
+CheckoutStats CheckoutContext::getStats() const {
+  auto phaseTime = [this](Phase phase) {
+    return microseconds_[phase].load(std::memory_order_relaxed);
+  };
+  CheckoutStats stats;
+  stats.totalTimeUs =
+      duration_cast<microseconds>(steady_clock::now() - startTime_).count();
+  stats.fetchTreesTimeUs = phaseTime(FETCH_TREES);
+  stats.fetchBlobsTimeUs = phaseTime(FETCH_BLOBS);
+  stats.writeOverlayTimeUs = phaseTime(WRITE_OVERLAY);
+  stats.invalidateTimeUs = phaseTime(INVALIDATE);
+  stats.checkConflictsTimeUs = phaseTime(CHECK_CONFLICTS);
+  stats.entriesProcessed = numFullyProcessed_.load(std::memory_order_relaxed);
+  stats.entriesSwapped = numHashSwaps_.load(std::memory_order_relaxed);
+  stats.conflicts = numConflicts_;
+  stats.errors = numErrors_;
+  stats.treesFetched = numTreesFetched_.load(std::memory_order_relaxed);
+  stats.blobsFetched = numBlobsFetched_.load(std::memory_order_relaxed);
+  stats.bytesFetched = bytesFetched_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void CheckoutContext::sendInvalidations() {
+  auto invalidations = std::move(*pendingInvalidations_.wlock());
+  if (fuseChannel_ && !invalidations.empty()) {
+    std::sort(invalidations.begin(), invalidations.end());
+    auto end = std::unique(invalidations.begin(), invalidations.end());
+    for (auto it = invalidations.begin(); it != end; ++it) {
+      try {
+        fuseChannel_->invalidateEntry(it->first, it->second);
+      } catch (const std::exception& ex) {
+        LOG(WARNING) << "error invalidating FUSE entry " << it->second
+                     << " in directory inode " << it->first << ": "
+                     << folly::exceptionStr(ex);
+      }
+    }
+    VLOG(4) << "checkout invalidated " << (end - invalidations.begin())
+            << " FUSE entries";
+  }
+
+  auto inodeInvalidations = std::move(*pendingInodeInvalidations_.wlock());
+  if (fuseChannel_ && !inodeInvalidations.empty()) {
+    std::sort(inodeInvalidations.begin(), inodeInvalidations.end());
+    auto end =
+        std::unique(inodeInvalidations.begin(), inodeInvalidations.end());
+    for (auto it = inodeInvalidations.begin(); it != end; ++it) {
+      try {
+        fuseChannel_->invalidateInode(*it, 0, 0);
+      } catch (const std::exception& ex) {
+        LOG(WARNING) << "error invalidating FUSE inode " << *it << ": "
+                     << folly::exceptionStr(ex);
+      }
+    }
+    VLOG(4) << "checkout invalidated " << (end - inodeInvalidations.begin())
+            << " FUSE inodes";
+  }
+}
+
+Future<unique_ptr<Tree>> CheckoutContext::loadTree(const Hash& id) {
+  return queuedLoads_.loadTree(id);
+}
+
+Future<BlobMetadata> CheckoutContext::loadBlobMetadata(const Hash& id) {
+  return queuedLoads_.loadBlobMetadata(id);
+}
+
+void CheckoutContext::prefetchBlob(const Hash& id) {
+  prefetchBlobs_.wlock()->push_back(id);
+}
+
+Future<Unit> CheckoutContext::flushLoads(ObjectStore* store) {
+  // Fulfilling the promises may run CheckoutActions, which can queue and
+  // flush loads of their own.  That is fine, since the batch only starts
+  // the loads queued before the flush.
+  auto counts = queuedLoads_.flush(
+      store,
+      std::make_shared<PhaseTimer>(this, FETCH_TREES),
+      std::make_shared<PhaseTimer>(this, FETCH_BLOBS));
+  numTreesFetched_.fetch_add(counts.trees, std::memory_order_relaxed);
+
+  vector<Hash> prefetchBlobs;
+  std::swap(prefetchBlobs, *prefetchBlobs_.wlock());
+  if (prefetchBlobs.empty()) {
+    return makeFuture();
+  }
+  auto prefetchStart = steady_clock::now();
+  return folly::makeFutureWith([&] {
+           return store->prefetchBlobs(
+               prefetchBlobs,
+               std::max(FLAGS_checkout_prefetch_batch_size, 1),
+               std::max(FLAGS_checkout_prefetch_max_concurrency, 1));
+         })
+      .then([this, prefetchStart](const BlobPrefetchStats& stats) {
+        addTime(FETCH_BLOBS, prefetchStart);
+        numBlobsFetched_.fetch_add(
+            stats.blobsFetched, std::memory_order_relaxed);
+        bytesFetched_.fetch_add(stats.bytesFetched, std::memory_order_relaxed);
+        VLOG(4) << "checkout prefetched " << stats.blobsFetched << " blobs ("
+                << stats.blobsAlreadyPresent << " already present, "
+                << stats.blobsFailed << " failed)";
+      })
+      .onError([](const std::exception& ex) {
+        LOG(WARNING) << "error prefetching blobs during checkout: "
+                     << folly::exceptionStr(ex);
+      });
 }
 
 void CheckoutContext::addConflict(ConflictType type, RelativePathPiece path) {
@@ -81,6 +274,16 @@ void CheckoutContext::addConflict(ConflictType type, InodeBase* inode) {
   addConflict(type, path.value());
 }
 
+void CheckoutContext::invalidateEntry(
+    fuse_ino_t parent,
+    PathComponentPiece name) {
+  pendingInvalidations_.wlock()->emplace_back(parent, PathComponent(name));
+}
+
+void CheckoutContext::invalidateInode(fuse_ino_t number) {
+  pendingInodeInvalidations_.wlock()->push_back(number);
+}
+
 void CheckoutContext::addError(
     TreeInode* parent,
     PathComponentPiece name,
@@ -10,14 +10,24 @@
 #pragma once
 
 #include <folly/Synchronized.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <utility>
 #include <vector>
+#include "eden/fuse/fuse_headers.h"
 #include "eden/fs/inodes/EdenMount.h"
 #include "eden/fs/inodes/InodePtrFwd.h"
+#include "eden/fs/model/Hash.h"
 #include "eden/fs/service/gen-cpp2/eden_types.h"
+#include "eden/fs/store/BlobMetadata.h"
+#include "eden/fs/store/ObjectBatch.h"
 #include "eden/utils/PathFuncs.h"
 
 namespace folly {
 class exception_wrapper;
+class Executor;
 template <typename T>
 class Future;
 class Unit;
@@ -25,8 +35,12 @@ class Unit;
 
 namespace facebook {
 namespace eden {
+namespace fusell {
+class Channel;
+}
 
 class CheckoutConflict;
+class ObjectStore;
 class TreeInode;
 class Tree;
 
@@ -35,9 +49,22 @@ class Tree;
  */
 class CheckoutContext {
  public:
+  /**
+   * Create a CheckoutContext.
+   *
+   * fuseChannel is the channel used to invalidate the kernel's caches for
+   * the entries changed by the checkout.  It may be null if the mount is not
+   * connected to FUSE.
+   *
+   * executor is used to apply CheckoutActions once their data has been
+   * loaded.  If it is null, actions are applied in whichever thread finished
+   * loading their data.
+   */
   CheckoutContext(
       folly::Synchronized<Hash>::LockedPtr&& snapshotLock,
-      bool force);
+      bool force,
+      fusell::Channel* fuseChannel,
+      folly::Executor* executor = nullptr);
   ~CheckoutContext();
 
   /**
@@ -73,6 +100,9 @@ class CheckoutContext {
   /**
    * Complete the checkout operation
    *
+   * This releases the checkout's locks and then sends the kernel the
+   * invalidations queued with invalidateEntry() and invalidateInode().
+   *
    * Returns the list of conflicts and errors that were encountered during the
    * operation.
    */
@@ -88,6 +118,105 @@ class CheckoutContext {
       PathComponentPiece name,
       const folly::exception_wrapper& ew);
 
+  /**
+   * Queue an invalidation of the kernel's cache for the directory entry
+   * parent/name.
+   *
+   * Each invalidation is a write to the FUSE device, so rather than sending
+   * them while holding TreeInode locks, checkout collects them here.  They
+   * are deduplicated and sent by finish() once the locks are released.
+   */
+  void invalidateEntry(fuse_ino_t parent, PathComponentPiece name);
+
+  /**
+   * Queue an invalidation of the kernel's cached attributes and data for the
+   * specified inode.
+   *
+   * This is needed when checkout changes the contents of an inode number
+   * that FUSE may already know about without loading the inode.
+   */
+  void invalidateInode(fuse_ino_t number);
+
+  /**
+   * Record that an entry was checked out by simply replacing its hash, since
+   * it was neither loaded nor materialized.
+   */
+  void recordHashSwap() {
+    numHashSwaps_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * Record that an entry required a CheckoutAction to process it.
+   */
+  void recordFullProcessing() {
+    numFullyProcessed_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  enum Phase : size_t {
+    /** Waiting for Trees to be fetched from the ObjectStore. */
+    FETCH_TREES,
+    /** Waiting for old blob metadata, and for new blobs to be prefetched. */
+    FETCH_BLOBS,
+    /** Writing updated directory state to the overlay. */
+    WRITE_OVERLAY,
+    /** Sending invalidations to the kernel. */
+    INVALIDATE,
+    /** Comparing loaded inodes against the old source control state. */
+    CHECK_CONFLICTS,
+    NUM_PHASES,
+  };
+
+  /**
+   * Add the time elapsed since start to a phase of the checkout.
+   *
+   * Directories are checked out concurrently, so phases may be recorded from
+   * several threads at once.
+   */
+  void addTime(Phase phase, std::chrono::steady_clock::time_point start);
+
+  /**
+   * Returns the timing and counters recorded for this checkout so far.
+   *
+   * Conflicts and errors are counted by finish().
+   */
+  CheckoutStats getStats() const;
+
+  folly::Executor* getExecutor() const {
+    return executor_;
+  }
+
+  /**
+   * Queue a load of the Tree with the given ID.
+   *
+   * Loads queued with loadTree(), loadBlobMetadata() and prefetchBlob() are
+   * not started until flushLoads() is called.  This lets all of the loads
+   * needed by the CheckoutActions for one directory be sent to the
+   * ObjectStore as a single batch, rather than one round trip at a time.
+   */
+  folly::Future<std::unique_ptr<Tree>> loadTree(const Hash& id);
+
+  /**
+   * Queue a load of the metadata for the Blob with the given ID.
+   */
+  folly::Future<BlobMetadata> loadBlobMetadata(const Hash& id);
+
+  /**
+   * Queue a prefetch of the Blob with the given ID into the LocalStore.
+   *
+   * Checkout does not need the contents of the new Blobs itself, but the
+   * affected files are already loaded, so they are likely to be read soon.
+   */
+  void prefetchBlob(const Hash& id);
+
+  /**
+   * Start all of the loads queued since the last call to flushLoads().
+   *
+   * Returns a Future that completes once the Blob prefetches it started have
+   * finished.  Failed prefetches are not treated as errors, since the Blobs
+   * will still be fetched on demand.
+   */
+  folly::Future<folly::Unit> flushLoads(ObjectStore* store);
+
   /**
    * Get a reference to the rename lock.
    *
@@ -99,6 +228,12 @@ class CheckoutContext {
   }
 
  private:
+  /**
+   * Send the queued invalidations to the kernel.  This must be called
+   * without holding any inode locks.
+   */
+  void sendInvalidations();
+
   bool const force_{false};
   folly::Synchronized<Hash>::LockedPtr snapshotLock_;
   RenameLock renameLock_;
@@ -107,6 +242,32 @@ class CheckoutContext {
   // if some data load operations complete asynchronously on other threads.
   // Therefore access to the conflicts list must be synchronized.
   folly::Synchronized<std::vector<CheckoutConflict>> conflicts_;
+
+  fusell::Channel* const fuseChannel_{nullptr};
+  folly::Executor* const executor_{nullptr};
+  folly::Synchronized<std::vector<std::pair<fuse_ino_t, PathComponent>>>
+      pendingInvalidations_;
+  folly::Synchronized<std::vector<fuse_ino_t>> pendingInodeInvalidations_;
+
+  // Statistics for getStats().  Counts of how entries were handled show how
+  // much of the checkout cost came from loaded state.
+  std::chrono::steady_clock::time_point const startTime_{
+      std::chrono::steady_clock::now()};
+  std::array<std::atomic<int64_t>, NUM_PHASES> microseconds_;
+  std::atomic<uint64_t> numHashSwaps_{0};
+  std::atomic<uint64_t> numFullyProcessed_{0};
+  std::atomic<uint64_t> numTreesFetched_{0};
+  std::atomic<uint64_t> numBlobsFetched_{0};
+  std::atomic<uint64_t> bytesFetched_{0};
+  size_t numConflicts_{0};
+  size_t numErrors_{0};
+
+  /**
+   * Loads and prefetches waiting for the next flushLoads() call.  Checkouts
+   * of separate directories proceed concurrently, so these are synchronized.
+   */
+  ObjectBatch queuedLoads_;
+  folly::Synchronized<std::vector<Hash>> prefetchBlobs_;
 };
 }
 }
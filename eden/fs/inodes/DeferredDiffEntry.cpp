@@ -16,8 +16,10 @@
 #include "eden/fs/inodes/EdenMount.h"
 #include "eden/fs/inodes/FileInode.h"
 #include "eden/fs/inodes/InodeDiffCallback.h"
+#include "eden/fs/inodes/TreeDiff.h"
 #include "eden/fs/inodes/TreeInode.h"
 #include "eden/fs/store/BlobMetadata.h"
+#include "eden/fs/store/ObjectBatch.h"
 #include "eden/fs/store/ObjectStore.h"
 #include "eden/utils/Bug.h"
 
@@ -96,73 +98,6 @@ class UntrackedDiffEntry : public DeferredDiffEntry {
   folly::Optional<folly::Future<InodePtr>> inodeFuture_;
 };
 
-/*
- * Helper functions for diffing removed directories.
- *
- * This is used by both RemovedDiffEntry and ModifiedEntryInfo.
- * (ModifiedBlobDiffEntry needs it for handling cases where a directory was
- * replaced with a file.)
- */
-namespace {
-// Overload that takes an already loaded Tree
-folly::Future<folly::Unit> diffRemovedTree(
-    const DiffContext* context,
-    RelativePath currentPath,
-    const Tree* tree);
-// Overload that takes a TreeEntry, and has to load the Tree in question first
-folly::Future<folly::Unit> diffRemovedTree(
-    const DiffContext* context,
-    RelativePath currentPath,
-    const TreeEntry& entry);
-
-folly::Future<folly::Unit> diffRemovedTree(
-    const DiffContext* context,
-    RelativePath currentPath,
-    const TreeEntry& entry) {
-  DCHECK_EQ(TreeEntryType::TREE, entry.getType());
-  return context->store->getTreeFuture(entry.getHash()).then([
-    context,
-    currentPath = RelativePath{std::move(currentPath)}
-  ](unique_ptr<Tree> && tree) {
-    return diffRemovedTree(context, std::move(currentPath), tree.get());
-  });
-}
-
-folly::Future<folly::Unit> diffRemovedTree(
-    const DiffContext* context,
-    RelativePath currentPath,
-    const Tree* tree) {
-  vector<Future<Unit>> subFutures;
-  for (const auto& entry : tree->getTreeEntries()) {
-    if (entry.getType() == TreeEntryType::TREE) {
-      auto f = diffRemovedTree(context, currentPath + entry.getName(), entry);
-      subFutures.emplace_back(std::move(f));
-    } else {
-      context->callback->removedFile(currentPath + entry.getName(), entry);
-    }
-  }
-
-  return folly::collectAll(subFutures).then([
-    currentPath = RelativePath{std::move(currentPath)},
-    tree = std::move(tree),
-    context
-  ](vector<folly::Try<Unit>> results) {
-    // Call diffError() for each error that occurred
-    for (size_t n = 0; n < results.size(); ++n) {
-      auto& result = results[n];
-      if (result.hasException()) {
-        const auto& entry = tree->getEntryAt(n);
-        context->callback->diffError(
-            currentPath + entry.getName(), result.exception());
-      }
-    }
-    // Return successfully after recording the errors.  (If we failed then
-    // our caller would also record us as an error, which we don't want.)
-    return makeFuture();
-  });
-}
-} // unnamed namespace
-
 class RemovedDiffEntry : public DeferredDiffEntry {
  public:
   RemovedDiffEntry(
@@ -191,12 +126,15 @@ class ModifiedDiffEntry : public DeferredDiffEntry {
       const TreeEntry& scmEntry,
       InodePtr inode,
       GitIgnoreStack* ignore,
-      bool isIgnored)
+      bool isIgnored,
+      ObjectBatch* batch)
       : DeferredDiffEntry{context, std::move(path)},
         ignore_{ignore},
         isIgnored_{isIgnored},
         scmEntry_{scmEntry},
-        inode_{std::move(inode)} {}
+        inode_{std::move(inode)} {
+    queueScmLoad(batch);
+  }
 
   ModifiedDiffEntry(
       const DiffContext* context,
@@ -204,17 +142,20 @@ class ModifiedDiffEntry : public DeferredDiffEntry {
       const TreeEntry& scmEntry,
       folly::Future<InodePtr>&& inodeFuture,
       GitIgnoreStack* ignore,
-      bool isIgnored)
+      bool isIgnored,
+      ObjectBatch* batch)
       : DeferredDiffEntry{context, std::move(path)},
         ignore_{ignore},
         isIgnored_{isIgnored},
         scmEntry_{scmEntry},
-        inodeFuture_{std::move(inodeFuture)} {}
+        inodeFuture_{std::move(inodeFuture)} {
+    queueScmLoad(batch);
+  }
 
   folly::Future<folly::Unit> run() override {
-    // If we have an inodeFuture_, wait on it to complete.
-    // TODO: Load the inode in parallel with loading the source control data
-    // below.
+    // If we have an inodeFuture_, wait on it to complete.  The source
+    // control data was queued when this entry was created, so it loads in
+    // parallel with the inode.
     if (inodeFuture_.hasValue()) {
       CHECK(!inode_) << "cannot have both inode_ and inodeFuture_ set";
       return inodeFuture_->then([this](InodePtr inode) {
@@ -249,13 +190,16 @@ class ModifiedDiffEntry : public DeferredDiffEntry {
       return diffRemovedTree(context_, getPath(), scmEntry_);
     }
 
-    // Possibly modified directory.  Load the Tree in question.
-    return context_->store->getTreeFuture(scmEntry_.getHash()).then([
+    // Possibly modified directory.  Wait for the Tree in question.
+    return std::move(scmTreeFuture_.value()).then([
       this,
       treeInode = std::move(treeInode)
     ](unique_ptr<Tree> && tree) {
-      return treeInode->diff(
-          context_, getPath(), std::move(tree), ignore_, isIgnored_);
+      return treeInode
+          ->diff(context_, getPath(), std::move(tree), ignore_, isIgnored_)
+          .then([ this, treeInode ] {
+            clean_ = treeInode->hasCleanDiff(scmEntry_.getHash());
+          });
     });
   }
 
@@ -269,6 +213,7 @@ class ModifiedDiffEntry : public DeferredDiffEntry {
       context_->callback->removedFile(getPath(), scmEntry_);
       auto treeInode = inode_.asTreePtr();
       if (isIgnored_ && !context_->listIgnored) {
+        ++context_->ignoredDirsPruned;
         return makeFuture();
       }
       return treeInode->diff(context_, getPath(), nullptr, ignore_, isIgnored_);
@@ -281,29 +226,42 @@ class ModifiedDiffEntry : public DeferredDiffEntry {
       return makeFuture();
     }
 
-    // TODO: If at some point we add file size info to the TreeEntry, we could
-    // first check to see if the file size is different, before having to load
-    // the SHA1 data.
-
-    // Load the blob SHA1 and the file contents SHA1, so we can check if the
-    // contents are modified.  Note that we want the FileInode to always
-    // return a SHA1 to us, even for symlink contents.
-    auto blobSha1Future = context_->store->getBlobMetadata(scmEntry_.getHash());
-    auto fileSha1Future = fileInode->getSHA1(false);
-    return folly::collect(blobSha1Future, fileSha1Future)
-        .then([this](const std::tuple<BlobMetadata, Hash>& result) {
-          if (std::get<0>(result).sha1 != std::get<1>(result)) {
+    // Wait for the blob metadata, and compare the file contents against it.
+    // The metadata includes the blob size, so a file whose size differs can
+    // be reported as modified without computing its SHA-1.  This works for
+    // symlink contents as well as regular files.
+    return std::move(scmMetadataFuture_.value())
+        .then([ this, fileInode = std::move(fileInode) ](
+            const BlobMetadata& metadata) {
+          return fileInode->contentsMatch(scmEntry_.getHash(), metadata);
+        })
+        .then([this](bool same) {
+          if (!same) {
             context_->callback->modifiedFile(getPath(), scmEntry_);
           }
+          clean_ = same;
         });
   }
 
+  /**
+   * Queue the load of the source control Tree or blob metadata that run()
+   * will compare the inode against.
+   */
+  void queueScmLoad(ObjectBatch* batch) {
+    if (scmEntry_.getType() == TreeEntryType::TREE) {
+      scmTreeFuture_ = batch->loadTree(scmEntry_.getHash());
+    } else {
+      scmMetadataFuture_ = batch->loadBlobMetadata(scmEntry_.getHash());
+    }
+  }
+
   GitIgnoreStack* ignore_{nullptr};
   bool isIgnored_{false};
   TreeEntry scmEntry_;
   folly::Optional<folly::Future<InodePtr>> inodeFuture_;
   InodePtr inode_;
-  unique_ptr<Tree> scmTree_;
+  folly::Optional<folly::Future<unique_ptr<Tree>>> scmTreeFuture_;
+  folly::Optional<folly::Future<BlobMetadata>> scmMetadataFuture_;
 };
 
 class ModifiedBlobDiffEntry : public DeferredDiffEntry {
@@ -312,25 +270,28 @@ class ModifiedBlobDiffEntry : public DeferredDiffEntry {
       const DiffContext* context,
       RelativePath path,
       const TreeEntry& scmEntry,
-      Hash currentBlobHash)
+      Hash currentBlobHash,
+      ObjectBatch* batch)
       : DeferredDiffEntry{context, std::move(path)},
         scmEntry_{scmEntry},
-        currentBlobHash_{currentBlobHash} {}
+        scmMetadataFuture_{batch->loadBlobMetadata(scmEntry.getHash())},
+        currentMetadataFuture_{batch->loadBlobMetadata(currentBlobHash)} {}
 
   folly::Future<folly::Unit> run() override {
-    auto f1 = context_->store->getBlobMetadata(scmEntry_.getHash());
-    auto f2 = context_->store->getBlobMetadata(currentBlobHash_);
-    return folly::collect(f1, f2).then(
+    return folly::collect(scmMetadataFuture_, currentMetadataFuture_).then(
         [this](const std::tuple<BlobMetadata, BlobMetadata>& info) {
           if (std::get<0>(info).sha1 != std::get<1>(info).sha1) {
             context_->callback->modifiedFile(getPath(), scmEntry_);
+          } else {
+            clean_ = true;
           }
         });
   }
 
  private:
   TreeEntry scmEntry_;
-  Hash currentBlobHash_;
+  folly::Future<BlobMetadata> scmMetadataFuture_;
+  folly::Future<BlobMetadata> currentMetadataFuture_;
 };
 
 } // unnamed namespace
@@ -369,9 +330,16 @@ unique_ptr<DeferredDiffEntry> DeferredDiffEntry::createModifiedEntry(
     const TreeEntry& scmEntry,
     InodePtr inode,
     GitIgnoreStack* ignore,
-    bool isIgnored) {
+    bool isIgnored,
+    ObjectBatch* batch) {
   return make_unique<ModifiedDiffEntry>(
-      context, std::move(path), scmEntry, std::move(inode), ignore, isIgnored);
+      context,
+      std::move(path),
+      scmEntry,
+      std::move(inode),
+      ignore,
+      isIgnored,
+      batch);
 }
 
 unique_ptr<DeferredDiffEntry>
@@ -381,23 +349,26 @@ DeferredDiffEntry::createModifiedEntryFromInodeFuture(
     const TreeEntry& scmEntry,
     folly::Future<InodePtr>&& inodeFuture,
     GitIgnoreStack* ignore,
-    bool isIgnored) {
+    bool isIgnored,
+    ObjectBatch* batch) {
   return make_unique<ModifiedDiffEntry>(
       context,
       std::move(path),
       scmEntry,
       std::move(inodeFuture),
       ignore,
-      isIgnored);
+      isIgnored,
+      batch);
 }
 
 unique_ptr<DeferredDiffEntry> DeferredDiffEntry::createModifiedEntry(
     const DiffContext* context,
     RelativePath path,
     const TreeEntry& scmEntry,
-    Hash currentBlobHash) {
+    Hash currentBlobHash,
+    ObjectBatch* batch) {
   return make_unique<ModifiedBlobDiffEntry>(
-      context, std::move(path), scmEntry, currentBlobHash);
+      context, std::move(path), scmEntry, currentBlobHash, batch);
 }
 }
 }
@@ -25,6 +25,7 @@ namespace eden {
 class DiffContext;
 class GitIgnoreStack;
 class Hash;
+class ObjectBatch;
 class ObjectStore;
 class TreeEntry;
 class TreeInode;
@@ -38,6 +39,11 @@ class InodeDiffCallback;
  * DeferredDiffEntry is used to store the data about which children need to be
  * examined.  The DeferredDiffEntry subclasses contain the logic for how to
  * then perform the diff on the child entry.
+ *
+ * The entries that compare against source control data queue its load in
+ * the ObjectBatch passed to them when they are created.  The caller must
+ * flush the batch once it has created all of the entries for a directory,
+ * before running them.
  */
 class DeferredDiffEntry {
  public:
@@ -51,6 +57,16 @@ class DeferredDiffEntry {
 
   virtual folly::Future<folly::Unit> run() = 0;
 
+  /**
+   * Returns true if run() completed and found the entry identical to source
+   * control, with no untracked files underneath it.  This is only used to
+   * decide whether the parent directory's diff result can be cached, so it
+   * may conservatively return false.
+   */
+  bool isClean() const {
+    return clean_;
+  }
+
   static std::unique_ptr<DeferredDiffEntry> createUntrackedEntry(
       const DiffContext* context,
       RelativePath path,
@@ -84,7 +100,8 @@ class DeferredDiffEntry {
       const TreeEntry& scmEntry,
       InodePtr inode,
       GitIgnoreStack* ignore,
-      bool isIgnored);
+      bool isIgnored,
+      ObjectBatch* batch);
 
   static std::unique_ptr<DeferredDiffEntry> createModifiedEntryFromInodeFuture(
       const DiffContext* context,
@@ -92,17 +109,20 @@ class DeferredDiffEntry {
       const TreeEntry& scmEntry,
       folly::Future<InodePtr>&& inodeFuture,
       GitIgnoreStack* ignore,
-      bool isIgnored);
+      bool isIgnored,
+      ObjectBatch* batch);
 
   static std::unique_ptr<DeferredDiffEntry> createModifiedEntry(
       const DiffContext* context,
       RelativePath path,
       const TreeEntry& scmEntry,
-      Hash currentBlobHash);
+      Hash currentBlobHash,
+      ObjectBatch* batch);
 
  protected:
   const DiffContext* const context_;
   RelativePath const path_;
+  bool clean_{false};
 };
 }
 }
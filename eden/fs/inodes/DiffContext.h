@@ -9,6 +9,14 @@
  */
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include "eden/utils/PathFuncs.h"
+
+namespace folly {
+class Executor;
+}
+
 namespace facebook {
 namespace eden {
 
@@ -22,8 +30,33 @@ namespace eden {
  */
 class DiffContext {
  public:
-  DiffContext(InodeDiffCallback* cb, bool listIgn, ObjectStore* os)
-      : callback{cb}, store{os}, listIgnored{listIgn} {}
+  DiffContext(
+      InodeDiffCallback* cb,
+      bool listIgn,
+      ObjectStore* os,
+      folly::Executor* exec = nullptr,
+      RelativePathPiece pfx = RelativePathPiece{})
+      : callback{cb},
+        store{os},
+        listIgnored{listIgn},
+        executor{exec},
+        prefix{pfx} {}
+
+  /**
+   * Returns true if path is the prefix or is underneath it, so that its
+   * differences should be reported.
+   */
+  bool isInPrefix(RelativePathPiece path) const {
+    return prefix.empty() || path == prefix || path.isSubDirOf(prefix);
+  }
+
+  /**
+   * Returns true if path has to be examined: either it is in the prefix, or
+   * it is a directory that the prefix is underneath.
+   */
+  bool isOnPrefixPath(RelativePathPiece path) const {
+    return isInPrefix(path) || path.empty() || path.isParentDirOf(prefix);
+  }
 
   InodeDiffCallback* const callback;
   ObjectStore* const store;
@@ -34,6 +67,35 @@ class DiffContext {
    * it can completely omit processing ignored subdirectories.
    */
   bool const listIgnored;
+  /**
+   * If executor is non-null, deferred work for each directory (diffing
+   * subdirectories and comparing file contents) is started on it, so that
+   * independent subtrees are diffed in parallel.  The number of threads in
+   * the executor bounds how much of that work runs at once.  If executor is
+   * null all of the work starts in the thread that found it.
+   */
+  folly::Executor* const executor;
+  /**
+   * If prefix is non-empty, only differences at or underneath this path are
+   * reported.  Directories that the prefix is not underneath are skipped
+   * without being loaded, so the cost of the diff depends on the size of
+   * the prefix rather than of the whole mount point.
+   */
+  RelativePath const prefix;
+  /**
+   * The number of ignored directories that were skipped entirely because
+   * listIgnored is false.  Neither the inodes nor the .gitignore files inside
+   * these directories are loaded.
+   *
+   * This is updated from whichever threads are performing the diff, so it is
+   * mutable and atomic even though the rest of the DiffContext is const.
+   */
+  mutable std::atomic<uint64_t> ignoredDirsPruned{0};
+  /**
+   * The number of directories that were not examined because a previous diff
+   * found them unchanged, and nothing underneath them has changed since.
+   */
+  mutable std::atomic<uint64_t> cachedDirsSkipped{0};
 };
 }
 }
@@ -12,8 +12,12 @@
 #include <folly/Format.h>
 #include <folly/Unit.h>
 #include <folly/experimental/StringKeyedUnorderedMap.h>
+#include <folly/futures/Future.h>
 #include <folly/io/Cursor.h>
 #include <folly/io/IOBuf.h>
+#include <algorithm>
+#include <mutex>
+#include <unordered_set>
 #include "eden/fs/config/ClientConfig.h"
 #include "eden/fs/inodes/DirstatePersistence.h"
 #include "eden/fs/inodes/EdenDispatcher.h"
@@ -25,9 +29,12 @@
 #include "eden/fs/inodes/InodeDiffCallback.h"
 #include "eden/fs/inodes/Overlay.h"
 #include "eden/fs/inodes/TreeInode.h"
+#include "eden/fs/journal/Journal.h"
+#include "eden/fs/journal/JournalDelta.h"
 #include "eden/fs/model/Blob.h"
 #include "eden/fs/model/git/GitIgnore.h"
 #include "eden/fs/model/git/GitIgnorePattern.h"
+#include "eden/fs/model/git/GitIgnoreStack.h"
 #include "eden/fs/store/ObjectStore.h"
 #include "eden/fs/store/ObjectStores.h"
 #include "eden/fuse/MountPoint.h"
@@ -95,48 +102,38 @@ std::string HgStatus::toString() const {
 
 namespace {
 /**
- * All entries added to the manifest must be under the `prefix`.
+ * Add the status for a user directive that was not accounted for by the walk
+ * of the working copy.
  */
-template <typename RelativePathType>
-void updateManifestWithDirectives(
-    RelativePathPiece prefix,
-    const std::unordered_map<RelativePathType, overlay::UserStatusDirective>*
-        unaccountedUserDirectives,
+void updateManifestWithDirective(
+    RelativePathPiece path,
+    overlay::UserStatusDirective directive,
     std::unordered_map<RelativePath, StatusCode>* manifest) {
-  // We should make sure that every entry in userDirectives_ is accounted for in
-  // the HgStatus that we return.
-  for (auto& pair : *unaccountedUserDirectives) {
-    if (!prefix.isParentDirOf(RelativePathPiece(pair.first))) {
-      continue;
-    }
-
-    switch (pair.second) {
-      case overlay::UserStatusDirective::Add:
-        // The file was marked for addition, but no longer exists in the working
-        // copy. The user should either restore the file or run `hg forget`.
-        manifest->emplace(RelativePath(pair.first), StatusCode::MISSING);
-        break;
-      case overlay::UserStatusDirective::Remove:
-        // The file was marked for removal, but it still exists in the working
-        // copy without any modifications. Although it may seem strange, it
-        // should still show up as REMOVED in `hg status` even though it is
-        // still on disk.
-        //
-        // Note that even if the file matches an ignore pattern, we currently
-        // report it just as REMOVED.  This matches mercurial's current
-        // behavior, but in the future it would probably be nicer to add a code
-        // for REMOVED+IGNORED.
-        manifest->emplace(RelativePath(pair.first), StatusCode::REMOVED);
-        break;
-    }
+  switch (directive) {
+    case overlay::UserStatusDirective::Add:
+      // The file was marked for addition, but no longer exists in the working
+      // copy. The user should either restore the file or run `hg forget`.
+      manifest->emplace(RelativePath(path), StatusCode::MISSING);
+      break;
+    case overlay::UserStatusDirective::Remove:
+      // The file was marked for removal, but it still exists in the working
+      // copy without any modifications. Although it may seem strange, it
+      // should still show up as REMOVED in `hg status` even though it is
+      // still on disk.
+      //
+      // Note that even if the file matches an ignore pattern, we currently
+      // report it just as REMOVED.  This matches mercurial's current
+      // behavior, but in the future it would probably be nicer to add a code
+      // for REMOVED+IGNORED.
+      manifest->emplace(RelativePath(path), StatusCode::REMOVED);
+      break;
   }
 }
 
 void processRemovedFile(
     RelativePath pathToEntry,
     std::unordered_map<RelativePath, StatusCode>* manifest,
-    const std::unordered_map<RelativePath, overlay::UserStatusDirective>*
-        userDirectives,
+    const UserDirectives* userDirectives,
     std::unordered_map<RelativePathPiece, overlay::UserStatusDirective>*
         copyOfUserDirectives) {
   auto result = userDirectives->find(pathToEntry);
@@ -163,6 +160,40 @@ void processRemovedFile(
   }
 }
 
+/**
+ * Read the .gitignore file in the specified directory.
+ *
+ * Returns none if the directory has no .gitignore file.
+ */
+folly::Optional<std::string> readIgnoreFile(
+    EdenMount* mount,
+    RelativePathPiece directory) {
+  // Ugh.  This is rather inefficient.
+  auto ignorePath = directory + PathComponentPiece(".gitignore");
+  VLOG(4) << "Loading ignore file at \"" << ignorePath << "\"";
+  FileInodePtr ignoreInode;
+  try {
+    ignoreInode = mount->getFileInodeBlocking(ignorePath);
+  } catch (const std::system_error& ex) {
+    if (ex.code().category() != std::system_category() ||
+        (ex.code().value() != ENOENT && ex.code().value() != ENOTDIR &&
+         ex.code().value() != EISDIR)) {
+      throw;
+    }
+  }
+
+  if (!ignoreInode) {
+    // No gitignore file to load.
+    return folly::none;
+  }
+
+  auto data = ignoreInode->getOrLoadData();
+  auto materializeFuture = data->ensureDataLoaded();
+  // TODO: Use a future callback rather than blocking here
+  materializeFuture.get();
+  return data->readAll();
+}
+
 // Short-term helper class until we implement gitignore
 // handling more efficiently.
 class IgnoreChecker {
@@ -231,42 +262,47 @@ class IgnoreChecker {
   }
 
   void loadIgnoreFile(StringPiece directory, GitIgnore* ignore) {
-    // Ugh.  This is rather inefficient.
-    auto ignorePath =
-        RelativePath(directory) + PathComponentPiece(".gitignore");
-    VLOG(4) << "Loading ignore file at \"" << ignorePath << "\"";
-    FileInodePtr ignoreInode;
-    try {
-      ignoreInode = mountPoint_->getFileInodeBlocking(ignorePath);
-    } catch (const std::system_error& ex) {
-      if (ex.code().category() != std::system_category() ||
-          (ex.code().value() != ENOENT && ex.code().value() != ENOTDIR)) {
-        throw;
-      }
+    auto contents = readIgnoreFile(mountPoint_, RelativePathPiece{directory});
+    if (contents.hasValue()) {
+      ignore->loadFile(contents.value());
     }
-
-    if (!ignoreInode) {
-      // No gitignore file to load.
-      return;
-    }
-
-    auto data = ignoreInode->getOrLoadData();
-    auto materializeFuture = data->ensureDataLoaded();
-    // TODO: Use a future callback rather than blocking here
-    materializeFuture.get();
-    ignore->loadFile(data->readAll());
   }
 
   EdenMount* const mountPoint_{nullptr};
   folly::StringKeyedUnorderedMap<GitIgnore> ignoreCache_;
 };
 
+/**
+ * Returns true if path is prefix or is underneath it.  Every path is
+ * underneath the empty prefix.
+ */
+bool isInPrefix(RelativePathPiece path, RelativePathPiece prefix) {
+  return prefix.empty() || path == prefix || path.isSubDirOf(prefix);
+}
+
 class ThriftStatusCallback : public InodeDiffCallback {
  public:
+  /**
+   * If prefix is non-empty, only the user directives at or underneath it
+   * are reported.
+   */
   explicit ThriftStatusCallback(
-      const std::unordered_map<RelativePath, UserStatusDirective>&
-          userDirectives)
-      : data_{folly::construct_in_place, userDirectives} {}
+      const UserDirectives& userDirectives,
+      RelativePathPiece prefix = RelativePathPiece{})
+      : data_{folly::construct_in_place, userDirectives, prefix} {}
+
+  /**
+   * Create a ThriftStatusCallback that passes its results to sendBatch each
+   * time batchSize entries have accumulated, rather than holding on to all
+   * of them until extractStatus() is called.
+   */
+  ThriftStatusCallback(
+      const UserDirectives& userDirectives,
+      size_t batchSize,
+      Dirstate::StatusBatchCallback sendBatch)
+      : data_{folly::construct_in_place, userDirectives, RelativePathPiece{}},
+        batchSize_{batchSize},
+        sendBatch_{std::move(sendBatch)} {}
 
   void ignoredFile(RelativePathPiece path) override {
     processChangedFile(
@@ -370,21 +406,29 @@ class ThriftStatusCallback : public InodeDiffCallback {
       StatusCode defaultStatus) {
     auto data = data_.wlock();
     auto iter = data->userDirectives.find(path.stringPiece());
-    if (iter != data->userDirectives.end()) {
-      if (iter->second == userDirectiveType) {
-        data->status.emplace(path.stringPiece().str(), userDirectiveStatus);
-        data->userDirectives.erase(iter);
-        return;
-      }
+    if (iter != data->userDirectives.end() &&
+        iter->second == userDirectiveType) {
+      data->status.emplace(path.stringPiece().str(), userDirectiveStatus);
+      data->userDirectives.erase(iter);
+    } else {
+      data->status.emplace(path.stringPiece().str(), defaultStatus);
+    }
+
+    // Pass on the results so far if enough of them have accumulated.  This
+    // is done with the lock held, so batches are never sent concurrently.
+    if (sendBatch_ && data->status.size() >= batchSize_) {
+      ThriftHgStatus batch;
+      batch.entries.swap(data->status);
+      sendBatch_(std::move(batch));
     }
-    data->status.emplace(path.stringPiece().str(), defaultStatus);
   }
 
   struct Data {
-    explicit Data(
-        const std::unordered_map<RelativePath, UserStatusDirective>& ud) {
+    Data(const UserDirectives& ud, RelativePathPiece prefix) {
       for (const auto& entry : ud) {
-        userDirectives.emplace(entry.first.stringPiece(), entry.second);
+        if (isInPrefix(entry.first, prefix)) {
+          userDirectives.emplace(entry.first.stringPiece(), entry.second);
+        }
       }
     }
 
@@ -392,24 +436,365 @@ class ThriftStatusCallback : public InodeDiffCallback {
     StringKeyedUnorderedMap<UserStatusDirective> userDirectives;
   };
   folly::Synchronized<Data> data_;
+  size_t const batchSize_{0};
+  Dirstate::StatusBatchCallback sendBatch_;
+};
+
+/**
+ * A diff result for one path, as reported to an InodeDiffCallback.
+ */
+struct RecordedDiffEntry {
+  enum class Type { IGNORED, UNTRACKED, REMOVED, MODIFIED };
+
+  Type type;
+  /** The source control entry, for REMOVED and MODIFIED paths. */
+  folly::Optional<TreeEntry> scmEntry;
+};
+using RecordedDiff = std::unordered_map<RelativePath, RecordedDiffEntry>;
+
+/**
+ * An InodeDiffCallback that records the results of a diff, so that they can
+ * be kept between status calls and replayed into a ThriftStatusCallback.
+ */
+class StatusRecorder : public InodeDiffCallback {
+ public:
+  explicit StatusRecorder(RecordedDiff* results) : results_{results} {}
+
+  void ignoredFile(RelativePathPiece path) override {
+    record(path, RecordedDiffEntry::Type::IGNORED, nullptr);
+  }
+  void untrackedFile(RelativePathPiece path) override {
+    record(path, RecordedDiffEntry::Type::UNTRACKED, nullptr);
+  }
+  void removedFile(RelativePathPiece path, const TreeEntry& sourceControlEntry)
+      override {
+    record(path, RecordedDiffEntry::Type::REMOVED, &sourceControlEntry);
+  }
+  void modifiedFile(RelativePathPiece path, const TreeEntry& sourceControlEntry)
+      override {
+    record(path, RecordedDiffEntry::Type::MODIFIED, &sourceControlEntry);
+  }
+  void diffError(RelativePathPiece path, const folly::exception_wrapper& ew)
+      override {
+    LOG(WARNING) << "error computing status data for " << path << ": "
+                 << folly::exceptionStr(ew);
+    std::lock_guard<std::mutex> guard(mutex_);
+    hadErrors_ = true;
+  }
+
+  /**
+   * Returns true if any path could not be diffed, in which case the results
+   * are incomplete and should not be kept.
+   */
+  bool hadErrors() const {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return hadErrors_;
+  }
+
+  /**
+   * Report each of the recorded results at or underneath prefix to
+   * callback.
+   */
+  static void replay(
+      const RecordedDiff& results,
+      InodeDiffCallback* callback,
+      RelativePathPiece prefix = RelativePathPiece{}) {
+    for (const auto& entry : results) {
+      const auto& path = entry.first;
+      if (!isInPrefix(path, prefix)) {
+        continue;
+      }
+      switch (entry.second.type) {
+        case RecordedDiffEntry::Type::IGNORED:
+          callback->ignoredFile(path);
+          break;
+        case RecordedDiffEntry::Type::UNTRACKED:
+          callback->untrackedFile(path);
+          break;
+        case RecordedDiffEntry::Type::REMOVED:
+          callback->removedFile(path, entry.second.scmEntry.value());
+          break;
+        case RecordedDiffEntry::Type::MODIFIED:
+          callback->modifiedFile(path, entry.second.scmEntry.value());
+          break;
+      }
+    }
+  }
+
+ private:
+  void record(
+      RelativePathPiece path,
+      RecordedDiffEntry::Type type,
+      const TreeEntry* scmEntry) {
+    RecordedDiffEntry entry{type, folly::none};
+    if (scmEntry) {
+      entry.scmEntry = *scmEntry;
+    }
+    std::lock_guard<std::mutex> guard(mutex_);
+    results_->emplace(RelativePath{path}, std::move(entry));
+  }
+
+  mutable std::mutex mutex_;
+  RecordedDiff* const results_{nullptr};
+  bool hadErrors_{false};
 };
+
+/**
+ * Computes the diff result for individual file paths, giving the same result
+ * for each path that a full EdenMount::diff() would.  This is used to update
+ * cached status results for just the paths that have changed.
+ */
+class PathDiffer {
+ public:
+  PathDiffer(EdenMount* mount, const Tree* rootTree, bool listIgnored)
+      : mount_{mount}, rootTree_{rootTree}, listIgnored_{listIgnored} {}
+
+  /**
+   * Report the diff result for path to callback, if it has one.
+   *
+   * Returns false without reporting anything if path refers to a directory,
+   * either now or in source control, or to a .gitignore file.  Changes to
+   * those can affect the status of other paths too.
+   */
+  bool diffPath(RelativePathPiece path, InodeDiffCallback* callback) {
+    static const PathComponentPiece kIgnoreFilename{".gitignore"};
+    if (path.basename() == kIgnoreFilename) {
+      return false;
+    }
+
+    auto* objectStore = mount_->getObjectStore();
+    auto scmEntry = getEntryForPath(path, rootTree_, objectStore);
+    if (scmEntry && scmEntry->getType() == TreeEntryType::TREE) {
+      return false;
+    }
+    auto inode = getInodeOrNull(path);
+    if (inode && inode.asTreePtrOrNull()) {
+      return false;
+    }
+    auto fileInode = inode.asFilePtrOrNull();
+
+    if (scmEntry && fileInode) {
+      // The same checks as the diff code's ModifiedDiffEntry.
+      if (fileInode->getMode() != scmEntry->getMode()) {
+        callback->modifiedFile(path, *scmEntry);
+        return true;
+      }
+      auto blobSha1 = objectStore->getBlobMetadata(scmEntry->getHash()).get();
+      if (fileInode->getSHA1(false).get() != blobSha1.sha1) {
+        callback->modifiedFile(path, *scmEntry);
+      }
+      return true;
+    } else if (scmEntry) {
+      callback->removedFile(path, *scmEntry);
+      return true;
+    } else if (!fileInode) {
+      // The path no longer exists either on disk or in source control.
+      return true;
+    }
+
+    // This is an untracked file.  Work out whether it is ignored by checking
+    // each directory down to it, the same way the diff code descends.
+    bool ignored = false;
+    for (auto prefix : path.paths()) {
+      auto result = getIgnoreStack(prefix.dirname())->match(prefix);
+      if (result == GitIgnore::HIDDEN) {
+        // Untracked hidden entries are skipped entirely, while tracked hidden
+        // directories are treated as ignored.
+        if (prefix == path ||
+            !getEntryForPath(prefix, rootTree_, objectStore)) {
+          return true;
+        }
+        ignored = true;
+        break;
+      } else if (result == GitIgnore::EXCLUDE) {
+        ignored = true;
+        break;
+      }
+    }
+
+    if (!ignored) {
+      callback->untrackedFile(path);
+    } else if (listIgnored_) {
+      callback->ignoredFile(path);
+    }
+    return true;
+  }
+
+ private:
+  InodePtr getInodeOrNull(RelativePathPiece path) {
+    try {
+      return mount_->getInodeBlocking(path);
+    } catch (const std::system_error& ex) {
+      if (ex.code().category() != std::system_category() ||
+          (ex.code().value() != ENOENT && ex.code().value() != ENOTDIR)) {
+        throw;
+      }
+    }
+    return InodePtr{};
+  }
+
+  /** Get the ignore rules for the entries inside directory. */
+  GitIgnoreStack* getIgnoreStack(RelativePathPiece directory) {
+    auto it = ignoreStacks_.find(directory.stringPiece());
+    if (it != ignoreStacks_.end()) {
+      return it->second.get();
+    }
+
+    // As in EdenMount::diff(), the root directory's rules sit on top of an
+    // empty stack node.
+    auto* parent = directory.stringPiece().empty()
+        ? &rootParent_
+        : getIgnoreStack(directory.dirname());
+    auto contents = readIgnoreFile(mount_, directory);
+    auto stack = contents.hasValue()
+        ? std::make_unique<GitIgnoreStack>(parent, contents.value())
+        : std::make_unique<GitIgnoreStack>(parent);
+    auto ret = ignoreStacks_.emplace(directory.stringPiece(), std::move(stack));
+    return ret.first->second.get();
+  }
+
+  EdenMount* const mount_{nullptr};
+  const Tree* const rootTree_{nullptr};
+  const bool listIgnored_{false};
+  GitIgnoreStack rootParent_{nullptr};
+  StringKeyedUnorderedMap<std::unique_ptr<GitIgnoreStack>> ignoreStacks_;
+};
+
+/**
+ * The most changed paths that getStatus() will recheck one at a time.  Past
+ * this a full diff is cheaper.
+ */
+constexpr size_t kMaxIncrementalStatusPaths = 10000;
 } // unnamed namespace
 
+struct Dirstate::StatusCache {
+  Journal::SequenceNumber sequence{0};
+  Hash snapshot;
+  bool listIgnored{false};
+  RecordedDiff results;
+};
+
 Dirstate::Dirstate(EdenMount* mount)
     : mount_(mount),
-      persistence_(mount->getConfig()->getDirstateStoragePath()) {
-  auto loadedData = persistence_.load();
-  userDirectives_.wlock()->swap(loadedData);
-}
+      persistence_(mount->getConfig()->getDirstateStoragePath()),
+      userDirectives_(folly::construct_in_place, persistence_.load()) {}
 
 Dirstate::~Dirstate() {}
 
-ThriftHgStatus Dirstate::getStatus(bool listIgnored) const {
-  ThriftStatusCallback callback(*userDirectives_.rlock());
-  mount_->diff(&callback, listIgnored);
+folly::Future<folly::Unit> Dirstate::streamStatus(
+    bool listIgnored,
+    size_t batchSize,
+    StatusBatchCallback sendBatch,
+    folly::Executor* executor) const {
+  auto callback = std::make_shared<ThriftStatusCallback>(
+      *userDirectives_.rlock(), std::max<size_t>(batchSize, 1), sendBatch);
+  return mount_->diff(callback.get(), listIgnored, executor)
+      .then([ callback, sendBatch = std::move(sendBatch) ]() {
+        // Send whatever is left, including user directives that the diff
+        // never saw.
+        auto status = callback->extractStatus();
+        if (!status.entries.empty()) {
+          sendBatch(std::move(status));
+        }
+      });
+}
+
+ThriftHgStatus Dirstate::getStatus(
+    bool listIgnored,
+    folly::Executor* executor,
+    RelativePathPiece prefix) const {
+  auto cache = statusCache_.wlock();
+
+  // Get the journal position before looking at anything, so that changes
+  // made while we run are rechecked by the next call.
+  auto latest = mount_->getJournal().getLatest();
+  auto sequence = latest ? latest->toSequence : 0;
+  auto snapshot = mount_->getSnapshotID();
+
+  bool updated = false;
+  if (*cache && (*cache)->snapshot == snapshot) {
+    try {
+      updated = updateStatusCache(cache->get(), latest.get(), listIgnored);
+    } catch (const std::exception& ex) {
+      LOG(WARNING) << "error updating cached status for " << mount_->getPath()
+                   << ", computing a full status instead: "
+                   << folly::exceptionStr(ex);
+    }
+  }
+
+  ThriftStatusCallback callback(*userDirectives_.rlock(), prefix);
+  if (!updated && !prefix.empty()) {
+    // The cache covers the whole mount point, so a diff of just the prefix
+    // cannot refresh it.  Drop it rather than keep a partially updated one.
+    cache->reset();
+    mount_->diff(&callback, listIgnored, executor, prefix).get();
+    return callback.extractStatus();
+  }
+  if (!updated) {
+    auto newCache = std::make_unique<StatusCache>();
+    newCache->listIgnored = listIgnored;
+    StatusRecorder recorder(&newCache->results);
+    mount_->diff(&recorder, listIgnored, executor).get();
+    StatusRecorder::replay(newCache->results, &callback);
+    if (recorder.hadErrors()) {
+      // Don't keep incomplete results.
+      cache->reset();
+      return callback.extractStatus();
+    }
+    *cache = std::move(newCache);
+  } else {
+    StatusRecorder::replay((*cache)->results, &callback, prefix);
+  }
+
+  (*cache)->sequence = sequence;
+  (*cache)->snapshot = snapshot;
   return callback.extractStatus();
 }
 
+bool Dirstate::updateStatusCache(
+    StatusCache* cache,
+    const JournalDelta* latest,
+    bool listIgnored) const {
+  if (cache->listIgnored != listIgnored) {
+    return false;
+  }
+
+  // Collect the paths changed since the cached results were computed.  A
+  // checkout or commit changes the snapshot without recording the files it
+  // changed, so any snapshot change at all needs a full diff.  So does a
+  // journal that was compacted past the cached position.
+  std::unordered_set<RelativePathPiece> changedPaths;
+  for (auto* delta = latest; delta && delta->toSequence > cache->sequence;
+       delta = delta->previous.get()) {
+    if (delta->fromHash != delta->toHash ||
+        delta->isTruncatedAfter(cache->sequence)) {
+      return false;
+    }
+    for (const auto& path : delta->changedFilesInOverlay) {
+      changedPaths.insert(path);
+    }
+    if (changedPaths.size() > kMaxIncrementalStatusPaths) {
+      return false;
+    }
+  }
+  if (changedPaths.empty()) {
+    return true;
+  }
+
+  auto rootTree = mount_->getRootTree();
+  PathDiffer differ(mount_, rootTree.get(), listIgnored);
+  StatusRecorder recorder(&cache->results);
+  for (auto path : changedPaths) {
+    cache->results.erase(RelativePath{path});
+    if (!differ.diffPath(path, &recorder)) {
+      return false;
+    }
+  }
+  VLOG(4) << "updated cached status for " << mount_->getPath() << " with "
+          << changedPaths.size() << " changed paths";
+  return !recorder.hadErrors();
+}
+
 std::unique_ptr<HgStatus> Dirstate::getStatusForExistingDirectory(
     RelativePathPiece directory) const {
   std::unordered_set<RelativePathPiece> toIgnore;
@@ -423,15 +808,21 @@ std::unique_ptr<HgStatus> Dirstate::getStatusForExistingDirectory(
   auto modifiedDirectories =
       getModifiedDirectories(mount_, directory, &toIgnore);
   std::unordered_map<RelativePath, StatusCode> manifest;
+  auto userDirectives = userDirectives_.rlock();
   if (modifiedDirectories.empty()) {
-    auto userDirectives = userDirectives_.rlock();
-    updateManifestWithDirectives(directory, &*userDirectives, &manifest);
+    userDirectives->forEachUnder(directory, [&](const auto& pair) {
+      updateManifestWithDirective(pair.first, pair.second, &manifest);
+    });
     return std::make_unique<HgStatus>(std::move(manifest));
   }
 
-  auto userDirectives = userDirectives_.rlock();
+  // Only the directives under this directory can be accounted for by the walk
+  // below, so only copy those.
   std::unordered_map<RelativePathPiece, overlay::UserStatusDirective>
-      copyOfUserDirectives(userDirectives->begin(), userDirectives->end());
+      copyOfUserDirectives;
+  userDirectives->forEachUnder(directory, [&](const auto& pair) {
+    copyOfUserDirectives.emplace(pair.first, pair.second);
+  });
 
   // TODO: This code is somewhat inefficient.
   // We ideally should restructure this so that we can compute diff and ignore
@@ -562,7 +953,9 @@ std::unique_ptr<HgStatus> Dirstate::getStatusForExistingDirectory(
     }
   }
 
-  updateManifestWithDirectives(directory, &copyOfUserDirectives, &manifest);
+  for (const auto& pair : copyOfUserDirectives) {
+    updateManifestWithDirective(pair.first, pair.second, &manifest);
+  }
 
   return std::make_unique<HgStatus>(std::move(manifest));
 }
@@ -571,8 +964,7 @@ void Dirstate::addDeletedEntries(
     const Tree* tree,
     RelativePathPiece pathToTree,
     std::unordered_map<RelativePath, StatusCode>* manifest,
-    const std::unordered_map<RelativePath, overlay::UserStatusDirective>*
-        userDirectives,
+    const UserDirectives* userDirectives,
     std::unordered_map<RelativePathPiece, overlay::UserStatusDirective>*
         copyOfUserDirectives) const {
   for (auto& entry : tree->getTreeEntries()) {
@@ -614,7 +1006,10 @@ bool hasMatchingAttributes(
   if (inodeEntry->isMaterialized()) {
     // If the the inode is materialized, then we cannot trust the Hash on the
     // TreeInode::Entry, so we must compare with the contents in the overlay.
+    // The caller must have loaded it with loadMaterializedFiles().
     auto fileInode = dynamic_cast<FileInode*>(inodeEntry->inode);
+    CHECK(fileInode != nullptr) << "materialized file in "
+                                << parent.getLogPath() << " is not loaded";
     auto overlaySHA1 = fileInode->getSHA1().get();
     auto blobSHA1 = objectStore->getSha1ForBlob(treeEntry->getHash());
     return overlaySHA1 == blobSHA1;
@@ -631,10 +1026,36 @@ inline bool isFile(mode_t mode) {
   return S_ISREG(mode) || S_ISLNK(mode);
 }
 
+/**
+ * Materialized inodes are loaded on demand, but hasMatchingAttributes() needs
+ * the FileInode for a materialized file, and has to be called with the parent
+ * directory's contents lock held.  Load the materialized files in dir before
+ * acquiring the lock.  The caller should hold on to the returned references
+ * so that the inodes stay loaded.
+ */
+std::vector<InodePtr> loadMaterializedFiles(TreeInode& dir) {
+  std::vector<PathComponent> names;
+  {
+    auto contents = dir.getContents().rlock();
+    for (const auto& entry : contents->entries) {
+      if (entry.second.isMaterialized() && isFile(entry.second.mode)) {
+        names.push_back(entry.first.copy());
+      }
+    }
+  }
+
+  std::vector<folly::Future<InodePtr>> futures;
+  for (const auto& name : names) {
+    futures.push_back(dir.getOrLoadChild(name));
+  }
+  return folly::collect(futures).get();
+}
+
 void Dirstate::computeDelta(
     const std::vector<TreeEntry>* treeEntries,
     TreeInode& current,
     DirectoryDelta& delta) const {
+  auto materializedFiles = loadMaterializedFiles(current);
   auto dir = current.getContents().rlock();
   auto& entries = dir->entries;
 
@@ -651,9 +1072,9 @@ void Dirstate::computeDelta(
       // Each remaining entry in overlayIterator should be added to delta.added
       // (unless it is a directory).
       while (overlayIterator != overlayEnd) {
-        auto mode = overlayIterator->second.get()->mode;
+        auto mode = overlayIterator->second.mode;
         if (isFile(mode)) {
-          delta.added.push_back(overlayIterator->first);
+          delta.added.push_back(overlayIterator->first.copy());
         }
         ++overlayIterator;
       }
@@ -675,7 +1096,7 @@ void Dirstate::computeDelta(
     }
 
     const auto& base = *baseIterator;
-    auto overlayName = overlayIterator->first;
+    auto overlayName = overlayIterator->first.piece();
     auto cmp = base.getName().stringPiece().compare(overlayName.stringPiece());
     if (cmp == 0) {
       // There are entries in the base commit and the overlay with the same
@@ -685,12 +1106,12 @@ void Dirstate::computeDelta(
       // 3. The entry was a file in the base commit but is now a directory.
       // 4. The entry was a directory in the base commit but is now a file.
       auto isFileInBase = isFile((*baseIterator).getMode());
-      auto isFileInOverlay = isFile(overlayIterator->second.get()->mode);
+      auto isFileInOverlay = isFile(overlayIterator->second.mode);
 
       if (isFileInBase && isFileInOverlay) {
         if (!hasMatchingAttributes(
                 &base,
-                overlayIterator->second.get(),
+                &overlayIterator->second,
                 mount_->getObjectStore(),
                 current,
                 *dir)) {
@@ -719,9 +1140,9 @@ void Dirstate::computeDelta(
       }
       baseIterator++;
     } else {
-      auto mode = overlayIterator->second.get()->mode;
+      auto mode = overlayIterator->second.mode;
       if (isFile(mode)) {
-        delta.added.push_back(overlayName);
+        delta.added.push_back(overlayName.copy());
       }
       overlayIterator++;
     }
@@ -802,21 +1223,30 @@ void Dirstate::addAll(
   // Find all of the untracked files and then update userDirectives, as
   // appropriate.
   std::unordered_map<RelativePath, AddAction> actions;
+
+  // The status of each directory is computed at most once, so that adding
+  // many files from the same directory does not diff it once per file.
+  std::unordered_map<RelativePathPiece, std::unique_ptr<HgStatus>>
+      statusByDirectory;
+  auto getDirectoryStatus = [&](RelativePathPiece directory) {
+    auto& status = statusByDirectory[directory];
+    if (!status) {
+      status = getStatusForExistingDirectory(directory);
+    }
+    return status.get();
+  };
+
   for (auto& path : paths) {
     auto pathStatus = getPathStatus(path, mount_);
     if (pathStatus == WorkingCopyStatus::File) {
       // Admittedly, this getStatusForExistingDirectory() call will also
       // traverse subdirectories of path.dirname(), so it will do some extra
-      // work. Similarly, if paths contains a list of files in the same
-      // directory, getStatusForExistingDirectory() will be called once per
-      // file instead of once for all files in that directory. If this turns
-      // out to be a bottleneck, then we can do some extra bookkeeping to
-      // reduce lookups.
-      auto status = getStatusForExistingDirectory(path.dirname());
+      // work.
+      auto status = getDirectoryStatus(path.dirname());
       auto code = status->statusForPath(path);
       assignAddAction(path, code, actions);
     } else if (pathStatus == WorkingCopyStatus::Directory) {
-      auto status = getStatusForExistingDirectory(path);
+      auto status = getDirectoryStatus(path);
       for (auto& pair : *status->list()) {
         // Only attempt to process the entry if it corresponds to a file in the
         // working copy.
@@ -838,19 +1268,24 @@ void Dirstate::addAll(
 
   // Apply all of the updates to userDirectives in one go.
   if (!actions.empty()) {
+    std::vector<overlay::DirstateLogEntry> changes;
     auto userDirectives = userDirectives_.wlock();
     for (auto& pair : actions) {
       auto action = pair.second;
       switch (action) {
         case AddAction::Add:
-          (*userDirectives)[pair.first] = overlay::UserStatusDirective::Add;
+          userDirectives->set(pair.first, overlay::UserStatusDirective::Add);
+          changes.push_back(DirstatePersistence::makeSetEntry(
+              pair.first, overlay::UserStatusDirective::Add));
           break;
         case AddAction::Erase:
-          userDirectives->erase(pair.first);
+          if (userDirectives->erase(pair.first)) {
+            changes.push_back(DirstatePersistence::makeEraseEntry(pair.first));
+          }
           break;
       }
     }
-    persistence_.save(*userDirectives);
+    persistence_.append(changes, userDirectives->getMap());
   }
 }
 
@@ -887,7 +1322,7 @@ ShouldBeDeleted shouldFileBeDeletedByHgRemove(
   for (auto& entry : entries) {
     if (entry.first == name) {
       if (hasMatchingAttributes(
-              treeEntry, entry.second.get(), objectStore, *treeInode, *dir)) {
+              treeEntry, &entry.second, objectStore, *treeInode, *dir)) {
         return ShouldBeDeleted::YES;
       } else {
         addDirstateAddRemoveError(
@@ -956,15 +1391,14 @@ void Dirstate::removeAll(
             directory.get(), path, objectStore, pathsToRemove);
         {
           auto userDirectives = userDirectives_.rlock();
-          for (auto& pair : *userDirectives) {
+          userDirectives->forEachUnder(path, [&](const auto& pair) {
             // Note that if the path is already marked as "Remove" in
             // userDirectives, ::remove() is a noop, so we can filter out those
             // paths here.
-            if (pair.second != overlay::UserStatusDirective::Remove &&
-                path.isParentDirOf(pair.first)) {
+            if (pair.second != overlay::UserStatusDirective::Remove) {
               pathsToRemove.set(pair.first, folly::unit);
             }
-          }
+          });
         }
       } else {
         pathsToRemove.set(path.copy(), folly::unit);
@@ -982,11 +1416,9 @@ void Dirstate::removeAll(
           // could be affected by this `hg rm` call.
           {
             auto userDirectives = userDirectives_.rlock();
-            for (auto& pair : *userDirectives) {
-              if (path.isParentDirOf(pair.first)) {
-                pathsToRemove.set(pair.first, folly::unit);
-              }
-            }
+            userDirectives->forEachUnder(path, [&](const auto& pair) {
+              pathsToRemove.set(pair.first, folly::unit);
+            });
           }
         } else {
           // We let remove() determine whether path is untracked or not.
@@ -998,7 +1430,7 @@ void Dirstate::removeAll(
         // file, run `hg add`, and then delete it before running `hg remove`.
         {
           auto userDirectives = userDirectives_.rlock();
-          auto result = userDirectives->find(path.copy());
+          auto result = userDirectives->find(path);
           if (result != userDirectives->end()) {
             // We let remove() determine whether path is untracked or not.
             pathsToRemove.set(path.copy(), folly::unit);
@@ -1011,13 +1443,25 @@ void Dirstate::removeAll(
     }
   }
 
-  // TODO(mbolin): It would be advantageous to redesign remove() to work in
-  // batches. Every call to remove() acquires the userDirectives lock and
-  // potentially writes to the persistence layer. It would be better to do both
-  // of those things once for the entire set of paths instead of once per path.
-  for (auto& pair : pathsToRemove) {
-    remove(pair.first, force, errorsToReport);
+  // remove() does not persist its changes, so that the directives are saved
+  // once for the entire set of paths instead of once per path.  Save them even
+  // if one of the removals throws, since the earlier ones have already taken
+  // effect.
+  std::vector<overlay::DirstateLogEntry> changes;
+  auto saveDirectives = [&] {
+    if (!changes.empty()) {
+      persistence_.append(changes, userDirectives_.wlock()->getMap());
+    }
+  };
+  try {
+    for (auto& pair : pathsToRemove) {
+      remove(pair.first, force, errorsToReport, &changes);
+    }
+  } catch (const std::exception&) {
+    saveDirectives();
+    throw;
   }
+  saveDirectives();
 
   // TODO(mbolin): If one of the original paths corresponds to a directory and
   // now that directory is empty (or contains only empty directories), then it
@@ -1032,7 +1476,8 @@ void Dirstate::removeAll(
 void Dirstate::remove(
     RelativePathPiece path,
     bool force,
-    std::vector<DirstateAddRemoveError>* errorsToReport) {
+    std::vector<DirstateAddRemoveError>* errorsToReport,
+    std::vector<overlay::DirstateLogEntry>* changes) {
   /*
    * Analogous to `hg rm <path>`. Note that the caller is responsible for
    * ensuring that `path` satisfies at least one of the following requirements:
@@ -1100,7 +1545,7 @@ void Dirstate::remove(
   auto shouldDelete = false;
   {
     auto userDirectives = userDirectives_.wlock();
-    auto result = userDirectives->find(path.copy());
+    auto result = userDirectives->find(path);
     if (result == userDirectives->end()) {
       // When there is no entry for the file in userChanges, we find the
       // corresponding TreeEntry in the manifest and compare it to its Entry in
@@ -1137,8 +1582,9 @@ void Dirstate::remove(
           }
         }
       }
-      (*userDirectives)[path.copy()] = overlay::UserStatusDirective::Remove;
-      persistence_.save(*userDirectives);
+      userDirectives->set(path, overlay::UserStatusDirective::Remove);
+      changes->push_back(DirstatePersistence::makeSetEntry(
+          path, overlay::UserStatusDirective::Remove));
     } else {
       switch (result->second) {
         case overlay::UserStatusDirective::Remove:
@@ -1153,8 +1599,8 @@ void Dirstate::remove(
                 errorsToReport);
             return;
           } else {
-            userDirectives->erase(path.copy());
-            persistence_.save(*userDirectives);
+            userDirectives->erase(path);
+            changes->push_back(DirstatePersistence::makeEraseEntry(path));
           }
           break;
       }
@@ -1206,57 +1652,46 @@ void Dirstate::markCommitted(
         commitID.toString()));
   }
 
-  // Perform a depth-first traversal of directories in the overlay and update
-  // the treeHash, as appropriate.
-  auto overlay = mount_->getOverlay();
-  auto toIgnore = std::unordered_set<RelativePathPiece>{
-      RelativePathPiece{".hg"}, RelativePathPiece{kDotEdenName}};
-  auto modifiedDirectories = getModifiedDirectoriesForMount(mount_, &toIgnore);
-  for (auto& directory : modifiedDirectories) {
-    auto treeForDirectory =
-        getTreeForDirectory(directory, treeForCommit.get(), objectStore);
-    if (treeForDirectory == nullptr) {
-      // This could happen because directory is:
-      // - .hg
-      // - a bind mount
-      // - an ignored directory.
-      continue;
-    }
-
-    auto treeInode = mount_->getTreeInodeBlocking(directory);
-    DCHECK(treeInode.get() != nullptr) << "Failed to get a TreeInode for "
-                                       << directory;
-
-    auto dir = treeInode->getContents().wlock();
-    dir->treeHash = treeForDirectory->getHash();
-    overlay->saveOverlayDir(treeInode->getNodeId(), &*dir);
-  }
+  // Walk the materialized directories alongside the committed Trees, so
+  // that only the Trees for changed directories are loaded.  The committed
+  // files, which hg has just read anyway, are hashed and dematerialized,
+  // along with any directories that then match the commit.  The directories
+  // that are still materialized record their committed tree hash.
+  auto rootInode = mount_->getRootInode();
+  auto count = rootInode->dematerializeUnchanged(*treeForCommit, true);
+  VLOG(1) << "dematerialized " << count << " committed inodes in "
+          << mount_->getPath();
 
   // Now that the hashes are written, we update the userDirectives.
   {
+    std::vector<overlay::DirstateLogEntry> changes;
     auto userDirectives = userDirectives_.wlock();
     // Do we need to do anything in the overlay at the end of this?
     for (auto& path : pathsToClean) {
       VLOG(1) << "calling clean on " << path;
-      auto numErased = userDirectives->erase(path.copy());
+      auto numErased = userDirectives->erase(path);
       if (numErased == 0) {
         VLOG(1)
             << "Was supposed to mark path " << path
             << " clean in the dirstate, but was not in userDirectives. "
             << "This is expected if the path was modified rather than added.";
+      } else {
+        changes.push_back(DirstatePersistence::makeEraseEntry(path));
       }
     }
 
     for (auto& path : pathsToDrop) {
       VLOG(1) << "calling drop on " << path;
-      auto numErased = userDirectives->erase(path.copy());
+      auto numErased = userDirectives->erase(path);
       if (numErased == 0) {
         VLOG(1) << "Was supposed to drop path " << path
                 << " in the dirstate, but was not in userDirectives.";
+      } else {
+        changes.push_back(DirstatePersistence::makeEraseEntry(path));
       }
     }
 
-    persistence_.save(*userDirectives);
+    persistence_.append(changes, userDirectives->getMap());
   }
 
   // With respect to maintaining consistency, this is the least important I/O
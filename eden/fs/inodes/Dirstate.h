@@ -9,13 +9,20 @@
  */
 #pragma once
 #include <folly/Synchronized.h>
+#include <folly/futures/Future.h>
+#include <functional>
 #include "eden/fs/inodes/DirstatePersistence.h"
 #include "eden/fs/inodes/InodePtrFwd.h"
+#include "eden/fs/inodes/UserDirectives.h"
 #include "eden/fs/inodes/gen-cpp2/overlay_types.h"
 #include "eden/fs/model/Tree.h"
 #include "eden/fs/service/gen-cpp2/EdenService.h"
 #include "eden/utils/PathFuncs.h"
 
+namespace folly {
+class Executor;
+}
+
 namespace {
 class DirectoryDelta;
 }
@@ -26,6 +33,7 @@ namespace eden {
 class ClientConfig;
 class EdenMount;
 class InodeBase;
+class JournalDelta;
 class ObjectStore;
 class Tree;
 class TreeInode;
@@ -97,15 +105,15 @@ std::ostream& operator<<(
     const DirstateAddRemoveError& status);
 
 /**
- * This is designed to be a simple implemenation of an Hg dirstate. It's
- * "simple" in that every call to `getStatus()` walks the entire overlay to
- * determine which files have been added/modified/removed, and then compares
- * those files with the base commit to determine the appropriate Hg status code.
+ * This is designed to be a simple implemenation of an Hg dirstate. The first
+ * call to `getStatus()` walks the entire overlay to determine which files have
+ * been added/modified/removed, and then compares those files with the base
+ * commit to determine the appropriate Hg status code.
  *
- * Ideally, we would cache information between calls to `getStatus()` to make
- * this more efficient, but this seems like an OK place to start. Once we have
- * a complete implementation built that is supported by a battery of tests, then
- * we can try to optimize things.
+ * The results are cached, and later calls only recheck the paths that the
+ * journal says have changed since then, so steady-state status is
+ * proportional to the number of changes rather than to the size of the
+ * overlay.
  *
  * For the moment, let's assume that we have the invariant that every file that
  * has been modified since the "base commit" exists in the overlay. This means
@@ -129,8 +137,34 @@ class Dirstate {
    *
    * @param listIgnored Whether or not to report information about ignored
    *     files.
+   * @param executor If non-null, a full diff of the mount point is computed
+   *     in parallel on this executor.  See EdenMount::diff().
+   * @param prefix If non-empty, only the status of paths at or underneath
+   *     this path is returned.  Up to date cached results are filtered;
+   *     otherwise only the prefix is diffed, and the cache is not refreshed.
    */
-  ThriftHgStatus getStatus(bool listIgnored) const;
+  ThriftHgStatus getStatus(
+      bool listIgnored,
+      folly::Executor* executor = nullptr,
+      RelativePathPiece prefix = RelativePathPiece{}) const;
+
+  using StatusBatchCallback = std::function<void(ThriftHgStatus&&)>;
+
+  /**
+   * Compute the same status information as getStatus(), but pass it to
+   * sendBatch in batches of up to batchSize entries as the diff finds them,
+   * instead of collecting all of it before returning anything.
+   *
+   * sendBatch may be called from any thread, but never from more than one
+   * at a time.  The returned Future completes once the last batch has been
+   * sent.  This neither uses nor updates the status cached by getStatus(),
+   * since the cache would have to hold on to every entry.
+   */
+  folly::Future<folly::Unit> streamStatus(
+      bool listIgnored,
+      size_t batchSize,
+      StatusBatchCallback sendBatch,
+      folly::Executor* executor = nullptr) const;
 
   /**
    * Analogous to `hg add <path1> <path2> ...` where each `<path>` identifies an
@@ -170,7 +204,9 @@ class Dirstate {
   /**
    * Called as part of `hg commit`, so this does three things (ideally
    * atomically):
-   * 1. Updates the hashes in the Overlay.
+   * 1. Updates the hashes in the Overlay, and dematerializes the files and
+   *    directories that now match the commit.  Only materialized directories
+   *    are visited, so this costs time proportional to the change.
    * 3. Updates SNAPSHOT to the commitID.
    * 4. Applies the changes represented by pathsToClean and pathsToDrop to the
    *    dirstate. Note that this may not clear the dirstate altogether if the
@@ -190,13 +226,36 @@ class Dirstate {
   std::unique_ptr<HgStatus> getStatusForExistingDirectory(
       RelativePathPiece directory) const;
 
+  /**
+   * The diff results from the last getStatus() call, along with the journal
+   * position and snapshot that they are up to date with.
+   */
+  struct StatusCache;
+
+  /**
+   * Bring the cached diff results up to date with the journal, by rechecking
+   * only the paths changed since they were computed.
+   *
+   * Returns false if the cache cannot be updated incrementally, such as when
+   * the snapshot changed or a directory was changed, in which case the caller
+   * has to compute a full diff instead.
+   */
+  bool updateStatusCache(
+      StatusCache* cache,
+      const JournalDelta* latest,
+      bool listIgnored) const;
+
   /**
    * Analogous to `hg rm <path>` where `<path>` is an ordinary file or symlink.
+   *
+   * Any change this makes to userDirectives_ is added to changes, but is not
+   * saved.  The caller is responsible for saving it with persistence_.
    */
   void remove(
       RelativePathPiece path,
       bool force,
-      std::vector<DirstateAddRemoveError>* errorsToReport);
+      std::vector<DirstateAddRemoveError>* errorsToReport,
+      std::vector<overlay::DirstateLogEntry>* changes);
 
   /**
    * Compares the TreeEntries from a Tree in the base commit with those in the
@@ -216,8 +275,7 @@ class Dirstate {
       const Tree* tree,
       RelativePathPiece pathToTree,
       std::unordered_map<RelativePath, StatusCode>* manifest,
-      const std::unordered_map<RelativePath, overlay::UserStatusDirective>*
-          userDirectives,
+      const UserDirectives* userDirectives,
       std::unordered_map<RelativePathPiece, overlay::UserStatusDirective>*
           copyOfUserDirectives) const;
 
@@ -234,11 +292,14 @@ class Dirstate {
   /**
    * Manifest of files in the working copy whose status is not CLEAN. These are
    * also referred to as "nonnormal" files.
-   * TODO(mbolin): Consider StringKeyedMap instead of unordered_map.
    */
-  folly::Synchronized<
-      std::unordered_map<RelativePath, overlay::UserStatusDirective>>
-      userDirectives_;
+  folly::Synchronized<UserDirectives> userDirectives_;
+  /**
+   * The cached diff results for getStatus().  The lock is held while they are
+   * computed, so concurrent status calls wait for each other rather than all
+   * walking the overlay.
+   */
+  mutable folly::Synchronized<std::unique_ptr<StatusCache>> statusCache_;
 };
 }
 }
@@ -9,14 +9,48 @@
  */
 #include "DirstatePersistence.h"
 
+#include <folly/Bits.h>
+#include <folly/Exception.h>
+#include <folly/File.h>
 #include <folly/FileUtil.h>
+#include <glog/logging.h>
 #include <thrift/lib/cpp2/protocol/Serializer.h>
+#include <unistd.h>
+#include <cstring>
 
 namespace facebook {
 namespace eden {
 
 using apache::thrift::CompactSerializer;
 
+namespace {
+/**
+ * The log is always allowed to grow to at least this many entries before it
+ * is compacted, so that a small number of directives does not cause a
+ * snapshot to be written on nearly every change.
+ */
+constexpr size_t kMinLogEntriesBeforeCompaction = 1000;
+
+/**
+ * Each log record is the length of the serialized DirstateLogEntry, as a
+ * little-endian uint32_t, followed by the entry itself.
+ */
+constexpr size_t kLogRecordHeaderSize = sizeof(uint32_t);
+
+void checkDirective(int32_t directive) {
+  auto name = overlay::_UserStatusDirective_VALUES_TO_NAMES.find(
+      static_cast<overlay::UserStatusDirective>(directive));
+  if (name == overlay::_UserStatusDirective_VALUES_TO_NAMES.end()) {
+    throw std::runtime_error(folly::to<std::string>(
+        "Illegal enum value for UserStatusDirective: ", directive));
+  }
+}
+}
+
+DirstatePersistence::DirstatePersistence(AbsolutePathPiece storageFile)
+    : storageFile_(storageFile),
+      logFile_(folly::to<std::string>(storageFile.stringPiece(), ".log")) {}
+
 void DirstatePersistence::save(
     const std::unordered_map<RelativePath, overlay::UserStatusDirective>&
         userDirectives) {
@@ -29,6 +63,46 @@ void DirstatePersistence::save(
   auto serializedData = CompactSerializer::serialize<std::string>(dirstateData);
 
   folly::writeFileAtomic(storageFile_.stringPiece(), serializedData, 0644);
+
+  // The snapshot now includes everything in the log.
+  if (unlink(logFile_.c_str()) != 0 && errno != ENOENT) {
+    folly::throwSystemError("failed to remove ", logFile_);
+  }
+  logEntries_ = 0;
+}
+
+void DirstatePersistence::append(
+    const std::vector<overlay::DirstateLogEntry>& changes,
+    const std::unordered_map<RelativePath, overlay::UserStatusDirective>&
+        userDirectives) {
+  if (changes.empty()) {
+    return;
+  }
+  if (logEntries_ + changes.size() >
+      std::max(kMinLogEntriesBeforeCompaction, userDirectives.size())) {
+    VLOG(3) << "compacting dirstate log " << logFile_ << " with "
+            << logEntries_ << " entries";
+    save(userDirectives);
+    return;
+  }
+
+  std::string records;
+  for (const auto& change : changes) {
+    auto entryData = CompactSerializer::serialize<std::string>(change);
+    auto length =
+        folly::Endian::little(static_cast<uint32_t>(entryData.size()));
+    records.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    records.append(entryData);
+  }
+
+  // All of the changes are written with a single write() call, so a crash
+  // leaves at most one partial record at the end of the log, which load()
+  // discards.
+  folly::File logFile(logFile_.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  auto bytesWritten =
+      folly::writeFull(logFile.fd(), records.data(), records.size());
+  folly::checkUnixError(bytesWritten, "failed to append to ", logFile_);
+  logEntries_ += changes.size();
 }
 
 std::unordered_map<RelativePath, overlay::UserStatusDirective>
@@ -37,25 +111,76 @@ DirstatePersistence::load() {
   std::unordered_map<RelativePath, overlay::UserStatusDirective> entries;
   if (!folly::readFile(storageFile_.c_str(), serializedData)) {
     int err = errno;
-    if (err == ENOENT) {
-      return entries;
+    if (err != ENOENT) {
+      folly::throwSystemErrorExplicit(err, "failed to read ", storageFile_);
+    }
+  } else {
+    auto dirstateData =
+        CompactSerializer::deserialize<overlay::DirstateData>(serializedData);
+    for (auto& pair : dirstateData.directives) {
+      checkDirective(static_cast<int32_t>(pair.second));
+      entries[RelativePath(pair.first)] = pair.second;
     }
-    folly::throwSystemErrorExplicit(err, "failed to read ", storageFile_);
   }
 
-  auto dirstateData =
-      CompactSerializer::deserialize<overlay::DirstateData>(serializedData);
-  for (auto& pair : dirstateData.directives) {
-    auto name = overlay::_UserStatusDirective_VALUES_TO_NAMES.find(pair.second);
-    if (name != overlay::_UserStatusDirective_VALUES_TO_NAMES.end()) {
-      entries[RelativePath(pair.first)] = pair.second;
+  // Apply the changes recorded in the log since the snapshot was written.
+  std::string logData;
+  logEntries_ = 0;
+  if (!folly::readFile(logFile_.c_str(), logData)) {
+    int err = errno;
+    if (err != ENOENT) {
+      folly::throwSystemErrorExplicit(err, "failed to read ", logFile_);
+    }
+    return entries;
+  }
+
+  size_t offset = 0;
+  while (offset + kLogRecordHeaderSize <= logData.size()) {
+    uint32_t length;
+    memcpy(&length, logData.data() + offset, sizeof(length));
+    length = folly::Endian::little(length);
+    if (offset + kLogRecordHeaderSize + length > logData.size()) {
+      break;
+    }
+    auto change = CompactSerializer::deserialize<overlay::DirstateLogEntry>(
+        folly::StringPiece{logData.data() + offset + kLogRecordHeaderSize,
+                           length});
+    offset += kLogRecordHeaderSize + length;
+    ++logEntries_;
+
+    if (change.erased) {
+      entries.erase(RelativePath(change.path));
     } else {
-      throw std::runtime_error(folly::to<std::string>(
-          "Illegal enum value for UserStatusDirective: ", pair.second));
+      checkDirective(static_cast<int32_t>(change.directive));
+      entries[RelativePath(change.path)] = change.directive;
     }
   }
 
+  if (offset != logData.size()) {
+    // The last record was only partially written.  Write a new snapshot so
+    // that later appends do not follow the partial record.
+    LOG(WARNING) << "discarding partial record at the end of " << logFile_;
+    save(entries);
+  }
   return entries;
 }
+
+overlay::DirstateLogEntry DirstatePersistence::makeSetEntry(
+    RelativePathPiece path,
+    overlay::UserStatusDirective directive) {
+  overlay::DirstateLogEntry entry;
+  entry.path = path.stringPiece().str();
+  entry.directive = directive;
+  entry.erased = false;
+  return entry;
+}
+
+overlay::DirstateLogEntry DirstatePersistence::makeEraseEntry(
+    RelativePathPiece path) {
+  overlay::DirstateLogEntry entry;
+  entry.path = path.stringPiece().str();
+  entry.erased = true;
+  return entry;
+}
 }
 }
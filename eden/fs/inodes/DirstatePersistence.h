@@ -10,6 +10,7 @@
 #pragma once
 
 #include <unordered_map>
+#include <vector>
 #include "eden/fs/inodes/gen-cpp2/overlay_types.h"
 #include "eden/utils/PathFuncs.h"
 
@@ -18,24 +19,55 @@ namespace eden {
 
 /**
  * Persists dirstate data to a local file.
+ *
+ * The data is stored as a snapshot of all of the directives, plus a log of
+ * the changes made since the snapshot was written.  Recording a change only
+ * appends to the log, so its cost is proportional to the size of the change
+ * rather than to the number of directives.  Once the log has grown large
+ * relative to the directives, it is compacted by writing a new snapshot.
  */
 class DirstatePersistence {
  public:
-  explicit DirstatePersistence(AbsolutePathPiece storageFile)
-      : storageFile_(storageFile) {}
+  explicit DirstatePersistence(AbsolutePathPiece storageFile);
 
+  /**
+   * Write a snapshot of all of the directives, and discard the log.
+   */
   void save(
       const std::unordered_map<RelativePath, overlay::UserStatusDirective>&
           userDirectives);
 
+  /**
+   * Record some changes by appending them to the log.
+   *
+   * userDirectives must be the full set of directives with the changes
+   * already applied.  It is used to write a new snapshot instead, if the log
+   * has grown large enough to need compacting.
+   */
+  void append(
+      const std::vector<overlay::DirstateLogEntry>& changes,
+      const std::unordered_map<RelativePath, overlay::UserStatusDirective>&
+          userDirectives);
+
   /**
    * If the underlying storage file does not exist, then this returns an empty
    * map.
    */
   std::unordered_map<RelativePath, overlay::UserStatusDirective> load();
 
+  /**
+   * Helpers for creating the change entries passed to append().
+   */
+  static overlay::DirstateLogEntry makeSetEntry(
+      RelativePathPiece path,
+      overlay::UserStatusDirective directive);
+  static overlay::DirstateLogEntry makeEraseEntry(RelativePathPiece path);
+
  private:
   AbsolutePath storageFile_;
+  AbsolutePath logFile_;
+  /** The number of entries in the log file. */
+  size_t logEntries_{0};
 };
 }
 }
@@ -11,14 +11,19 @@
 
 #include <dirent.h>
 #include <folly/Format.h>
+#include <sys/statvfs.h>
 #include <wangle/concurrent/CPUThreadPoolExecutor.h>
 #include <wangle/concurrent/GlobalExecutor.h>
 #include <shared_mutex>
 #include "EdenMount.h"
 #include "FileHandle.h"
 #include "FileInode.h"
+#include "InodeError.h"
 #include "InodeMap.h"
+#include "Overlay.h"
 #include "TreeInode.h"
+#include "eden/fs/config/ClientConfig.h"
+#include "eden/fs/config/SparseProfile.h"
 #include "eden/fuse/Channel.h"
 #include "eden/fuse/DirHandle.h"
 #include "eden/fuse/FileHandle.h"
@@ -55,6 +60,12 @@ DEFINE_int32(
     1,
     "how many seconds to delay before triggering the inode/vnode cache warmup");
 
+DEFINE_bool(
+    fuse_negative_entries,
+    true,
+    "reply to lookups of names that do not exist with negative entries, so "
+    "that the kernel caches the fact that they do not exist");
+
 namespace facebook {
 namespace eden {
 
@@ -170,6 +181,68 @@ fuse_entry_param computeEntryParam(
   entry.entry_timeout = attr.timeout;
   return entry;
 }
+
+/**
+ * Compute the fuse_entry_param for a reply that hands the kernel a new
+ * reference to inode.
+ *
+ * The InodePtr is moved rather than copied into the continuation, and if the
+ * attributes are already available no continuation is needed at all, so each
+ * reply costs as few refcount updates on the inode as possible.  This matters
+ * for the root and top-level directories, which nearly every request touches.
+ */
+Future<fuse_entry_param> makeEntryParam(InodePtr inode) {
+  auto attrFuture = inode->getattr();
+  if (attrFuture.isReady()) {
+    const auto& attr = attrFuture.value();
+    inode->incFuseRefcount();
+    return computeEntryParam(inode->getNodeId(), attr);
+  }
+  return attrFuture.then(
+      [inode = std::move(inode)](const fusell::Dispatcher::Attr& attr) {
+        inode->incFuseRefcount();
+        return computeEntryParam(inode->getNodeId(), attr);
+      });
+}
+
+/**
+ * Returns true if the mount point's sparse profile hides name in parent, in
+ * which case lookups of it fail as if it did not exist.
+ */
+bool isHiddenBySparseProfile(TreeInode& parent, PathComponentPiece name) {
+  const auto& sparse = parent.getMount()->getConfig()->getSparseProfile();
+  if (!sparse) {
+    return false;
+  }
+  auto parentPath = parent.getPath();
+  return parentPath.hasValue() && sparse->isExcluded(parentPath.value() + name);
+}
+
+/**
+ * Handle a failed lookup in parent.
+ *
+ * If the name does not exist, return an entry with inode number 0.  FUSE
+ * treats that as a negative entry, so the kernel caches the fact that the
+ * name does not exist, and repeated lookups of it (such as build tools
+ * probing include paths) never reach us.
+ */
+Future<fuse_entry_param> lookupFailed(
+    TreeInode& parent,
+    exception_wrapper&& ew) {
+  bool notFound = false;
+  ew.with_exception([&notFound](const std::system_error& ex) {
+    notFound = ex.code().category() == std::system_category() &&
+        ex.code().value() == ENOENT;
+  });
+  if (!notFound || !FLAGS_fuse_negative_entries) {
+    return makeFuture<fuse_entry_param>(std::move(ew));
+  }
+
+  fuse_entry_param entry = {};
+  entry.ino = 0;
+  entry.entry_timeout = parent.getNegativeEntryTtl();
+  return entry;
+}
 }
 
 void EdenDispatcher::initConnection(fuse_conn_info& /* conn */) {
@@ -183,6 +256,14 @@ void EdenDispatcher::initConnection(fuse_conn_info& /* conn */) {
 folly::Future<fusell::Dispatcher::Attr> EdenDispatcher::getattr(
     fuse_ino_t ino) {
   VLOG(7) << "getattr(" << ino << ")";
+  // Loaded inodes are found under the InodeMap shard lock in shared mode,
+  // without chaining a callback, so that a cached result can be returned as
+  // a ready Future and replied to from this thread.
+  auto loaded = inodeMap_->lookupLoadedInode(ino);
+  if (loaded) {
+    loaded->updateLastAccess();
+    return loaded->getattr();
+  }
   return inodeMap_->lookupInode(ino).then(
       [](const InodePtr& inode) { return inode->getattr(); });
 }
@@ -199,14 +280,37 @@ folly::Future<fuse_entry_param> EdenDispatcher::lookup(
     fuse_ino_t parent,
     PathComponentPiece namepiece) {
   VLOG(7) << "lookup(" << parent << ", " << namepiece << ")";
-  return inodeMap_->lookupTreeInode(parent)
-      .then([name = PathComponent(namepiece)](const TreeInodePtr& tree) {
-        return tree->getOrLoadChild(name);
-      })
-      .then([](const InodePtr& inode) {
-        return inode->getattr().then([inode](fusell::Dispatcher::Attr attr) {
-          inode->incFuseRefcount();
-          return computeEntryParam(inode->getNodeId(), attr);
+  // Fast path for the common case where both the parent and the child are
+  // already loaded: neither lookup needs an exclusive lock or a Future, and
+  // if the child's attributes are ready too the whole lookup completes
+  // synchronously.
+  auto loadedTree = inodeMap_->lookupLoadedTree(parent);
+  if (loadedTree) {
+    if (isHiddenBySparseProfile(*loadedTree, namepiece)) {
+      return lookupFailed(
+          *loadedTree,
+          make_exception_wrapper<InodeError>(ENOENT, loadedTree, namepiece));
+    }
+    auto inode = loadedTree->getLoadedChild(namepiece);
+    if (inode) {
+      return makeEntryParam(std::move(inode));
+    }
+  }
+
+  return inodeMap_->lookupTreeInode(parent).then(
+      [name = PathComponent(namepiece)](
+          TreeInodePtr&& tree) -> Future<fuse_entry_param> {
+        if (isHiddenBySparseProfile(*tree, name)) {
+          return lookupFailed(
+              *tree, make_exception_wrapper<InodeError>(ENOENT, tree, name));
+        }
+        auto childFuture = tree->getOrLoadChild(name);
+        return childFuture.then([tree = std::move(tree)](
+            Try<InodePtr>&& child) -> Future<fuse_entry_param> {
+          if (child.hasException()) {
+            return lookupFailed(*tree, std::move(child.exception()));
+          }
+          return makeEntryParam(std::move(child.value()));
         });
       });
 }
@@ -227,6 +331,13 @@ folly::Future<folly::Unit> EdenDispatcher::forget(
   return Unit{};
 }
 
+folly::Future<folly::Unit> EdenDispatcher::forgetMulti(
+    std::vector<std::pair<fuse_ino_t, uint32_t>> forgets) {
+  VLOG(7) << "forgetMulti(" << forgets.size() << " inodes)";
+  inodeMap_->decFuseRefcountBatch(forgets);
+  return Unit{};
+}
+
 folly::Future<std::shared_ptr<fusell::FileHandle>> EdenDispatcher::open(
     fuse_ino_t ino,
     const struct fuse_file_info& fi) {
@@ -273,11 +384,7 @@ folly::Future<fuse_entry_param> EdenDispatcher::mknod(
   return inodeMap_->lookupTreeInode(parent).then(
       [ childName = PathComponent{name}, mode, rdev ](
           const TreeInodePtr& inode) {
-        auto child = inode->mknod(childName, mode, rdev);
-        return child->getattr().then([child](fusell::Dispatcher::Attr attr) {
-          child->incFuseRefcount();
-          return computeEntryParam(child->getNodeId(), attr);
-        });
+        return makeEntryParam(inode->mknod(childName, mode, rdev));
       });
 }
 
@@ -286,11 +393,7 @@ EdenDispatcher::mkdir(fuse_ino_t parent, PathComponentPiece name, mode_t mode) {
   VLOG(7) << folly::sformat("mkdir({}, {}, {:#x})", parent, name, mode);
   return inodeMap_->lookupTreeInode(parent).then(
       [ childName = PathComponent{name}, mode ](const TreeInodePtr& inode) {
-        auto child = inode->mkdir(childName, mode);
-        return child->getattr().then([child](fusell::Dispatcher::Attr attr) {
-          child->incFuseRefcount();
-          return computeEntryParam(child->getNodeId(), attr);
-        });
+        return makeEntryParam(inode->mkdir(childName, mode));
       });
 }
 
@@ -336,9 +439,11 @@ folly::Future<fuse_entry_param> EdenDispatcher::symlink(
         childName = PathComponent{name} ](const TreeInodePtr& inode) {
         auto symlinkInode = inode->symlink(childName, linkContents);
         symlinkInode->incFuseRefcount();
-        return symlinkInode->getattr().then([symlinkInode](Attr&& attr) {
-          return computeEntryParam(symlinkInode->getNodeId(), attr);
-        });
+        auto attrFuture = symlinkInode->getattr();
+        return attrFuture.then(
+            [symlinkInode = std::move(symlinkInode)](Attr&& attr) {
+              return computeEntryParam(symlinkInode->getNodeId(), attr);
+            });
       });
 }
 
@@ -388,5 +493,58 @@ Future<vector<string>> EdenDispatcher::listxattr(fuse_ino_t ino) {
   return inodeMap_->lookupInode(ino).then(
       [](const InodePtr& inode) { return inode->listxattr(); });
 }
+
+namespace {
+/** The fragment size that statfs() reports block counts in */
+constexpr uint64_t kStatfsBlockSize = 4096;
+}
+
+Future<struct statvfs> EdenDispatcher::statfs(fuse_ino_t /* ino */) {
+  struct statvfs info;
+  memset(&info, 0, sizeof(info));
+
+  // Suggest a large blocksize to software that looks at that kind of thing
+  info.f_bsize = getConnInfo().max_readahead;
+  info.f_frsize = kStatfsBlockSize;
+  info.f_namemax = NAME_MAX;
+
+  // The space used is that of the overlay, which holds everything written to
+  // the mount point.  Programs checking for space before writing care about
+  // the free space the overlay can grow into.
+  auto usage = mount_->getOverlay()->getUsage();
+  auto freeSpace = getOverlayFreeSpace();
+  info.f_bfree = freeSpace.blocks;
+  info.f_bavail = freeSpace.blocks;
+  info.f_blocks =
+      (usage.bytes + kStatfsBlockSize - 1) / kStatfsBlockSize + info.f_bfree;
+
+  // Inode numbers never run out, but each materialized file needs an inode
+  // in the overlay's filesystem.
+  info.f_ffree = freeSpace.inodes;
+  info.f_favail = freeSpace.inodes;
+  info.f_files = inodeMap_->getNextInodeNumber() - 1 + info.f_ffree;
+  return info;
+}
+
+EdenDispatcher::FreeSpace EdenDispatcher::getOverlayFreeSpace() {
+  auto now = std::chrono::steady_clock::now();
+  auto freeSpace = freeSpace_.lock();
+  if (now - freeSpace->updated < std::chrono::seconds(1)) {
+    return *freeSpace;
+  }
+
+  struct statvfs fsInfo;
+  auto overlayDir = mount_->getOverlay()->getLocalDir();
+  if (::statvfs(overlayDir.value().c_str(), &fsInfo) != 0) {
+    // Keep reporting the last values rather than failing statfs().
+    PLOG(WARNING) << "unable to statvfs the overlay in " << overlayDir;
+  } else {
+    freeSpace->blocks = static_cast<uint64_t>(fsInfo.f_bavail) *
+        fsInfo.f_frsize / kStatfsBlockSize;
+    freeSpace->inodes = fsInfo.f_favail;
+  }
+  freeSpace->updated = now;
+  return *freeSpace;
+}
 }
 }
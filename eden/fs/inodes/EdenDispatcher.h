@@ -8,6 +8,9 @@
  *
  */
 #pragma once
+#include <folly/Synchronized.h>
+#include <chrono>
+#include <mutex>
 #include "eden/fs/inodes/InodePtr.h"
 #include "eden/fuse/Dispatcher.h"
 
@@ -45,6 +48,8 @@ class EdenDispatcher : public fusell::Dispatcher {
 
   folly::Future<folly::Unit> forget(fuse_ino_t ino,
                                     unsigned long nlookup) override;
+  folly::Future<folly::Unit> forgetMulti(
+      std::vector<std::pair<fuse_ino_t, uint32_t>> forgets) override;
   folly::Future<std::shared_ptr<fusell::FileHandle>> open(
       fuse_ino_t ino,
       const struct fuse_file_info& fi) override;
@@ -83,8 +88,23 @@ class EdenDispatcher : public fusell::Dispatcher {
   folly::Future<std::string> getxattr(fuse_ino_t ino, folly::StringPiece name)
       override;
   folly::Future<std::vector<std::string>> listxattr(fuse_ino_t ino) override;
+  folly::Future<struct statvfs> statfs(fuse_ino_t ino) override;
 
  private:
+  /** Free space on the filesystem holding the overlay, from statvfs() */
+  struct FreeSpace {
+    /** Blocks available, in units of the block size statfs() reports */
+    uint64_t blocks{0};
+    uint64_t inodes{0};
+    std::chrono::steady_clock::time_point updated;
+  };
+
+  /**
+   * Get the free space of the overlay's filesystem, calling statvfs() at
+   * most once per second.
+   */
+  FreeSpace getOverlayFreeSpace();
+
   // The EdenMount that owns this EdenDispatcher.
   EdenMount* const mount_;
   // The EdenMount's InodeMap.
@@ -92,6 +112,8 @@ class EdenDispatcher : public fusell::Dispatcher {
   // every FUSE request, and having it locally avoids  having to dereference
   // mount_ first.
   InodeMap* const inodeMap_;
+
+  folly::Synchronized<FreeSpace, std::mutex> freeSpace_;
 };
 }
 }
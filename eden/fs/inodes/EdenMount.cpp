@@ -9,9 +9,20 @@
  */
 #include "EdenMount.h"
 
+#include <fcntl.h>
+#include <folly/Conv.h>
 #include <folly/ExceptionWrapper.h>
+#include <folly/FileUtil.h>
+#include <folly/Optional.h>
 #include <folly/futures/Future.h>
+#include <folly/String.h>
+#include <folly/io/async/Request.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "eden/fs/config/ClientConfig.h"
 #include "eden/fs/inodes/CheckoutContext.h"
@@ -19,25 +30,60 @@
 #include "eden/fs/inodes/Dirstate.h"
 #include "eden/fs/inodes/EdenDispatcher.h"
 #include "eden/fs/inodes/EdenMounts.h"
+#include "eden/fs/inodes/FileHandle.h"
 #include "eden/fs/inodes/FileInode.h"
+#include "eden/fs/inodes/GitIgnoreCache.h"
+#include "eden/fs/inodes/InodeDiffCallback.h"
 #include "eden/fs/inodes/InodeError.h"
 #include "eden/fs/inodes/InodeMap.h"
 #include "eden/fs/inodes/Overlay.h"
+#include "eden/fs/inodes/TreeDiff.h"
 #include "eden/fs/inodes/TreeInode.h"
+#include "eden/fs/inodes/TreeInodeDirHandle.h"
+#include "eden/fs/journal/CommitChanges.h"
 #include "eden/fs/model/Hash.h"
 #include "eden/fs/model/Tree.h"
 #include "eden/fs/model/git/GitIgnoreStack.h"
+#include "eden/fs/store/ImportPriority.h"
 #include "eden/fs/store/ObjectStore.h"
+#include "eden/fs/store/ObjectStores.h"
+#include "eden/fs/store/TreePrefetcher.h"
+#include "eden/fs/takeover/gen-cpp2/takeover_types.h"
+#include "common/stats/ServiceData.h"
 #include "eden/fuse/MountPoint.h"
+#include "eden/fuse/RequestMetrics.h"
 
 using std::make_unique;
 using std::unique_ptr;
 using std::vector;
+using std::chrono::duration_cast;
+using std::chrono::steady_clock;
 using folly::Future;
 using folly::makeFuture;
 using folly::StringPiece;
 using folly::Unit;
 
+DEFINE_int32(
+    gitignore_cache_size,
+    10000,
+    "the maximum number of parsed .gitignore files cached by each mount, "
+    "for both unmodified and modified files");
+DEFINE_int32(
+    tree_prefetch_depth,
+    2,
+    "the maximum number of levels of subdirectory trees to prefetch when a "
+    "directory is listed or several of its children are looked up.  The "
+    "depth used adapts to the prefetch hit rate.  0 disables prefetching");
+DEFINE_int32(
+    tree_prefetch_budget,
+    512,
+    "the maximum number of trees that each mount's outstanding subdirectory "
+    "prefetches may load");
+DEFINE_int32(
+    access_recording_max_paths,
+    1000000,
+    "the maximum number of distinct files an access recording may hold");
+
 namespace facebook {
 namespace eden {
 
@@ -57,6 +103,233 @@ static const uint64_t globalProcessGeneration =
 // for a given mount instance.
 static std::atomic<uint16_t> mountGeneration{0};
 
+namespace {
+/**
+ * An InodeDiffCallback that collects every path that differs between two
+ * commits.
+ */
+class ChangedPathsCallback : public InodeDiffCallback {
+ public:
+  void ignoredFile(RelativePathPiece /* path */) override {}
+  void untrackedFile(RelativePathPiece path) override {
+    paths_.wlock()->emplace(path);
+  }
+  void removedFile(
+      RelativePathPiece path,
+      const TreeEntry& /* sourceControlEntry */) override {
+    paths_.wlock()->emplace(path);
+  }
+  void modifiedFile(
+      RelativePathPiece path,
+      const TreeEntry& /* sourceControlEntry */) override {
+    paths_.wlock()->emplace(path);
+  }
+  void diffError(RelativePathPiece path, const folly::exception_wrapper& ew)
+      override {
+    LOG(WARNING) << "error computing the paths changed between commits at "
+                 << path << ": " << folly::exceptionStr(ew);
+    auto error = error_.wlock();
+    if (!*error) {
+      *error = ew;
+    }
+  }
+
+  /**
+   * Return the collected paths, or throw the first error reported by the
+   * diff.  An incomplete set of paths would be worse than none at all.
+   */
+  CommitChanges::PathSet extractPaths() {
+    auto error = error_.wlock();
+    if (*error) {
+      error->throw_exception();
+    }
+    return std::move(*paths_.wlock());
+  }
+
+ private:
+  folly::Synchronized<CommitChanges::PathSet> paths_;
+  folly::Synchronized<folly::exception_wrapper> error_;
+};
+
+/**
+ * An InodeDiffCallback that records how each differing path changed.
+ */
+class ChangeKindCallback : public InodeDiffCallback {
+ public:
+  enum Kind { ADDED, REMOVED, MODIFIED };
+  using ChangeMap = std::unordered_map<RelativePath, Kind>;
+
+  void ignoredFile(RelativePathPiece /* path */) override {}
+  void untrackedFile(RelativePathPiece path) override {
+    changes_.wlock()->emplace(path, ADDED);
+  }
+  void removedFile(
+      RelativePathPiece path,
+      const TreeEntry& /* sourceControlEntry */) override {
+    changes_.wlock()->emplace(path, REMOVED);
+  }
+  void modifiedFile(
+      RelativePathPiece path,
+      const TreeEntry& /* sourceControlEntry */) override {
+    changes_.wlock()->emplace(path, MODIFIED);
+  }
+  void diffError(RelativePathPiece path, const folly::exception_wrapper& ew)
+      override {
+    LOG(WARNING) << "error checking for checkout conflicts at " << path
+                 << ": " << folly::exceptionStr(ew);
+    auto error = error_.wlock();
+    if (!*error) {
+      *error = ew;
+    }
+  }
+
+  /**
+   * Return the collected changes, or throw the first error reported by the
+   * diff, since conflicts may be missing from an incomplete set.
+   */
+  ChangeMap extractChanges() {
+    auto error = error_.wlock();
+    if (*error) {
+      error->throw_exception();
+    }
+    return std::move(*changes_.wlock());
+  }
+
+ private:
+  folly::Synchronized<ChangeMap> changes_;
+  folly::Synchronized<folly::exception_wrapper> error_;
+};
+
+/** The state shared by the steps of EdenMount::checkConflicts() */
+struct ConflictCheckState {
+  ChangeKindCallback commitDiff;
+  ChangeKindCallback localDiff;
+  ChangeKindCallback::ChangeMap commitChanges;
+};
+
+/** Returns the deepest directory that contains all of the changed paths. */
+RelativePath getCommonDirectory(const ChangeKindCallback::ChangeMap& changes) {
+  folly::Optional<RelativePathPiece> common;
+  for (const auto& change : changes) {
+    auto dir = change.first.dirname();
+    if (!common) {
+      common = dir;
+      continue;
+    }
+    while (!common->empty() && *common != dir &&
+           !dir.isSubDirOf(common.value())) {
+      common = common->dirname();
+    }
+  }
+  return common ? RelativePath{common.value()} : RelativePath{};
+}
+
+vector<CheckoutConflict> findConflicts(
+    const ChangeKindCallback::ChangeMap& commitChanges,
+    const ChangeKindCallback::ChangeMap& localChanges,
+    const Tree& newTree,
+    const ObjectStore* objectStore) {
+  using Kind = ChangeKindCallback::Kind;
+  vector<CheckoutConflict> conflicts;
+  auto addConflict = [&conflicts](ConflictType type, RelativePathPiece path) {
+    CheckoutConflict conflict;
+    conflict.path = path.value().str();
+    conflict.type = type;
+    conflicts.push_back(std::move(conflict));
+  };
+
+  // The directories that hold untracked files, and the ones that the new
+  // commit removes files from.
+  std::unordered_set<RelativePath> untrackedDirs;
+  for (const auto& change : localChanges) {
+    if (change.second == Kind::ADDED) {
+      for (auto dir : change.first.dirname().paths()) {
+        untrackedDirs.emplace(dir);
+      }
+    }
+  }
+  std::unordered_set<RelativePath> removalDirs;
+  for (const auto& change : commitChanges) {
+    if (change.second == Kind::REMOVED) {
+      for (auto dir : change.first.dirname().paths()) {
+        removalDirs.emplace(dir);
+      }
+    }
+  }
+
+  // These match the conflicts that TreeInode::checkout() and CheckoutAction
+  // report for each kind of change.
+  for (const auto& change : commitChanges) {
+    auto it = localChanges.find(change.first);
+    if (it == localChanges.end()) {
+      continue;
+    }
+    auto local = it->second;
+    switch (change.second) {
+      case Kind::ADDED:
+        if (local == Kind::ADDED) {
+          addConflict(ConflictType::UNTRACKED_ADDED, change.first);
+        }
+        break;
+      case Kind::MODIFIED:
+      case Kind::REMOVED:
+        if (local == Kind::MODIFIED || untrackedDirs.count(change.first)) {
+          // Modified, or replaced with a directory.
+          addConflict(ConflictType::MODIFIED, change.first);
+        } else if (local == Kind::REMOVED) {
+          addConflict(
+              change.second == Kind::MODIFIED
+                  ? ConflictType::REMOVED_MODIFIED
+                  : ConflictType::MISSING_REMOVED,
+              change.first);
+        }
+        break;
+    }
+  }
+
+  // A directory that the new commit removes, or replaces with a file, cannot
+  // be removed while it holds untracked or modified files.  Only directories
+  // that the new commit removes files from are looked up in its Tree.
+  std::unordered_map<RelativePath, bool> removedDirs;
+  auto isRemovedDir = [&](const RelativePath& dir) {
+    auto it = removedDirs.find(dir);
+    if (it != removedDirs.end()) {
+      return it->second;
+    }
+    bool removed = false;
+    auto commitChange = commitChanges.find(dir);
+    if (commitChange != commitChanges.end()) {
+      removed = commitChange->second == Kind::ADDED;
+    } else if (removalDirs.count(dir)) {
+      auto entry = getEntryForPath(dir, &newTree, objectStore);
+      removed = !entry || entry->getType() != TreeEntryType::TREE;
+    }
+    removedDirs.emplace(dir, removed);
+    return removed;
+  };
+  std::unordered_set<RelativePath> notEmptyDirs;
+  for (const auto& change : localChanges) {
+    if (change.second == Kind::REMOVED) {
+      continue;
+    }
+    for (auto dirPiece : change.first.dirname().paths()) {
+      RelativePath dir{dirPiece};
+      if (isRemovedDir(dir) && notEmptyDirs.insert(dir).second) {
+        addConflict(ConflictType::DIRECTORY_NOT_EMPTY, dir);
+      }
+    }
+  }
+
+  std::sort(
+      conflicts.begin(),
+      conflicts.end(),
+      [](const CheckoutConflict& a, const CheckoutConflict& b) {
+        return a.path < b.path;
+      });
+  return conflicts;
+}
+}
+
 std::shared_ptr<EdenMount> EdenMount::makeShared(
     std::unique_ptr<ClientConfig> config,
     std::unique_ptr<ObjectStore> objectStore,
@@ -74,14 +347,33 @@ EdenMount::EdenMount(
     AbsolutePathPiece socketPath,
     folly::ThreadLocal<fusell::EdenStats>* globalStats)
     : globalEdenStats_(globalStats),
+      mountStats_([this] {
+        // This is only called when a thread first records a stat, by which
+        // time config_ has been initialized.
+        return new fusell::EdenStats(
+            folly::to<std::string>("mount.", getPath().stringPiece(), "."),
+            globalEdenStats_);
+      }),
       config_(std::move(config)),
       inodeMap_{new InodeMap(this)},
       dispatcher_{new EdenDispatcher(this)},
       mountPoint_(
           new fusell::MountPoint(config_->getMountPath(), dispatcher_.get())),
       objectStore_(std::move(objectStore)),
-      overlay_(std::make_shared<Overlay>(config_->getOverlayPath())),
+      overlay_(std::make_shared<Overlay>(
+          config_->getOverlayPath(),
+          config_->getOverlayDurability())),
       dirstate_(std::make_unique<Dirstate>(this)),
+      gitIgnoreCache_(
+          std::make_unique<GitIgnoreCache>(FLAGS_gitignore_cache_size)),
+      treePrefetcher_(
+          FLAGS_tree_prefetch_depth > 0 && FLAGS_tree_prefetch_budget > 0
+              ? std::make_unique<TreePrefetcher>(
+                    objectStore_.get(),
+                    FLAGS_tree_prefetch_depth,
+                    FLAGS_tree_prefetch_budget)
+              : nullptr),
+      accessRecorder_(FLAGS_access_recording_max_paths),
       bindMounts_(config_->getBindMounts()),
       mountGeneration_(globalProcessGeneration | ++mountGeneration),
       socketPath_(socketPath) {
@@ -113,12 +405,43 @@ EdenMount::EdenMount(
   VLOG(2) << "Initializing eden mount " << getPath()
           << "; max existing inode number is " << maxInodeNumber;
 
-  // Record the transition from no snapshot to the current snapshot in
-  // the journal.  This also sets things up so that we can carry the
-  // snapshot id forward through subsequent journal entries.
-  auto delta = std::make_unique<JournalDelta>();
-  delta->toHash = snapshotID;
-  journal_.wlock()->addDelta(std::move(delta));
+  // Give the paths known to the last mount the same inode numbers again.
+  // This must happen before any inode other than the root is loaded.
+  try {
+    auto savedInodeMap = overlay_->takeSavedInodeMap();
+    if (savedInodeMap) {
+      inodeMap_->loadPersisted(savedInodeMap.value());
+      VLOG(2) << "restored " << savedInodeMap->unloadedInodes.size()
+              << " inode numbers for " << getPath();
+    }
+  } catch (const std::exception& ex) {
+    LOG(WARNING) << "error restoring the inode numbers of " << getPath()
+                 << ": " << folly::exceptionStr(ex);
+  }
+
+  // Continue the journal saved by the last mount, if there is one.
+  folly::Optional<uint64_t> savedGeneration;
+  try {
+    savedGeneration = journal_.restoreHistory(
+        config_->getJournalPath(), snapshotID, [this](Hash from, Hash to) {
+          return makeCommitChanges(from, to);
+        });
+  } catch (const std::exception& ex) {
+    LOG(WARNING) << "error restoring the journal of " << getPath() << ": "
+                 << folly::exceptionStr(ex);
+  }
+  if (savedGeneration) {
+    mountGeneration_ = savedGeneration.value();
+    VLOG(2) << "restored the journal of " << getPath() << " up to sequence "
+            << journal_.getLatest()->toSequence;
+  } else {
+    // Record the transition from no snapshot to the current snapshot in
+    // the journal.  This also sets things up so that we can carry the
+    // snapshot id forward through subsequent journal entries.
+    auto delta = std::make_unique<JournalDelta>();
+    delta->toHash = snapshotID;
+    journal_.addDelta(std::move(delta));
+  }
 
   // Set up the magic .eden dir
   getRootInode()
@@ -142,17 +465,120 @@ EdenMount::EdenMount(
             config_->getClientDirectory().stringPiece());
       })
       .get();
+
+  registerCounters();
+}
+
+EdenMount::~EdenMount() {
+  unregisterCounters();
+}
+
+void EdenMount::registerCounters() {
+  auto* counters = fbData->getDynamicCounters();
+  auto* metrics = &dispatcher_->getRequestMetrics();
+  auto prefix = folly::to<std::string>("mount.", getPath().stringPiece(), ".");
+  auto add = [&](StringPiece suffix, std::function<int64_t()> fn) {
+    auto name = folly::to<std::string>(prefix, suffix);
+    counters->registerCallback(name, std::move(fn));
+    counterNames_.push_back(std::move(name));
+  };
+
+  for (size_t n = 0; n < fusell::EdenStats::kNumOperations; ++n) {
+    add(folly::to<std::string>(
+            "fuse.outstanding.", fusell::EdenStats::getOperationName(n)),
+        [metrics, n] { return metrics->getOutstanding(n); });
+  }
+  add("fuse.outstanding",
+      [metrics] { return metrics->getTotalOutstanding(); });
+  add("fuse.interrupted",
+      [metrics] { return static_cast<int64_t>(metrics->getInterrupted()); });
+  for (auto percentile : {50, 90, 99}) {
+    add(folly::to<std::string>("fuse.age_us.p", percentile),
+        [metrics, percentile] {
+          return metrics->getAgePercentile(percentile).count();
+        });
+  }
+
+  auto* inodeMap = inodeMap_.get();
+  add("inode_map.loaded",
+      [inodeMap] { return inodeMap->getStats().loadedInodes; });
+  add("inode_map.unloaded",
+      [inodeMap] { return inodeMap->getStats().unloadedInodes; });
+  add("inode_map.memory_bytes",
+      [inodeMap] { return inodeMap->getStats().memoryBytes; });
+  add("inode_map.bytes_per_inode",
+      [inodeMap] { return inodeMap->getStats().getBytesPerInode(); });
+  add("journal.memory_bytes", [this] {
+    return static_cast<int64_t>(journal_.getMemoryUsage());
+  });
+  add("diff.ignored_dirs_pruned", [this] {
+    return static_cast<int64_t>(getDiffIgnoredDirsPruned());
+  });
+  add("diff.cached_dirs_skipped", [this] {
+    return static_cast<int64_t>(getDiffCachedDirsSkipped());
+  });
+
+  auto* prefetcher = treePrefetcher_.get();
+  if (prefetcher) {
+    add("tree_prefetch.prefetches",
+        [prefetcher] { return prefetcher->getStats().prefetches; });
+    add("tree_prefetch.skipped",
+        [prefetcher] { return prefetcher->getStats().skipped; });
+    add("tree_prefetch.trees_loaded",
+        [prefetcher] { return prefetcher->getStats().treesLoaded; });
+    add("tree_prefetch.hits",
+        [prefetcher] { return prefetcher->getStats().hits; });
+    add("tree_prefetch.misses",
+        [prefetcher] { return prefetcher->getStats().misses; });
+    add("tree_prefetch.hit_rate_pct", [prefetcher] {
+      return static_cast<int64_t>(prefetcher->getStats().getHitRate());
+    });
+    add("tree_prefetch.depth",
+        [prefetcher] { return prefetcher->getStats().depth; });
+  }
 }
 
-EdenMount::~EdenMount() {}
+void EdenMount::unregisterCounters() {
+  auto* counters = fbData->getDynamicCounters();
+  for (const auto& name : counterNames_) {
+    counters->unregisterCallback(name);
+  }
+  counterNames_.clear();
+}
 
 void EdenMount::destroy() {
   VLOG(1) << "beginning shutdown for EdenMount " << getPath();
+  // Write out any pending directory changes.  This also drops the references
+  // the overlay holds to the dirty inodes, which would otherwise keep them
+  // from being unloaded.
+  try {
+    overlay_->flushDirs(true);
+  } catch (const std::exception& ex) {
+    LOG(ERROR) << "error flushing overlay directories for " << getPath()
+               << ": " << folly::exceptionStr(ex);
+  }
+  // Record the inode numbers while the inodes are still loaded, so that the
+  // next mount can reuse them.
+  try {
+    overlay_->saveInodeMap(inodeMap_->save());
+  } catch (const std::exception& ex) {
+    LOG(WARNING) << "error saving the inode numbers for " << getPath()
+                 << ": " << folly::exceptionStr(ex);
+  }
   inodeMap_->beginShutdown();
 }
 
 void EdenMount::shutdownComplete() {
   VLOG(1) << "destruction complete for EdenMount " << getPath();
+  // All of our inodes have been destroyed, so no more inode numbers can be
+  // allocated.  Record the next inode number, so the next mount does not have
+  // to scan the overlay to find it.
+  try {
+    overlay_->saveNextInodeNumber(inodeMap_->getNextInodeNumber());
+  } catch (const std::exception& ex) {
+    LOG(WARNING) << "error saving the next inode number for " << getPath()
+                 << ": " << folly::exceptionStr(ex);
+  }
   delete this;
 }
 
@@ -169,13 +595,75 @@ const AbsolutePath& EdenMount::getSocketPath() const {
 }
 
 folly::ThreadLocal<fusell::EdenStats>* EdenMount::getStats() const {
-  return globalEdenStats_;
+  return &mountStats_;
 }
 
 const vector<BindMount>& EdenMount::getBindMounts() const {
   return bindMounts_;
 }
 
+void EdenMount::saveTakeoverState(takeover::SerializedMountState& state) {
+  // Save the inode map first: releasing the file handles below may drop the
+  // last InodePtr to some inodes, and they must keep their numbers.
+  state.inodeMap = inodeMap_->save();
+
+  auto& fileHandles = dispatcher_->getFileHandles();
+  for (const auto& entry : fileHandles.getAllHandles()) {
+    takeover::SerializedFileHandle handle;
+    handle.handleId = entry.first;
+    InodeBase* inode = nullptr;
+    if (auto file = std::dynamic_pointer_cast<FileHandle>(entry.second)) {
+      inode = file->getInode().get();
+      handle.isDir = false;
+      handle.flags = file->getOpenFlags();
+    } else if (auto dir = std::dynamic_pointer_cast<TreeInodeDirHandle>(
+                   entry.second)) {
+      inode = dir->getInode().get();
+      handle.isDir = true;
+      handle.flags = 0;
+    }
+    fileHandles.forgetGenericHandle(entry.first);
+
+    if (!inode || inode->isUnlinked()) {
+      // Unlinked inodes are not in the saved inode map, so the new process
+      // has nothing to reopen.
+      LOG(WARNING) << "not handing over file handle " << entry.first
+                   << " in " << getPath()
+                   << ": its inode is unlinked or of an unknown type";
+      continue;
+    }
+    handle.inodeNumber = inode->getNodeId();
+    state.fileHandles.push_back(std::move(handle));
+  }
+}
+
+void EdenMount::restoreTakeoverState(
+    const takeover::SerializedMountState& state) {
+  inodeMap_->load(state.inodeMap);
+
+  auto& fileHandles = dispatcher_->getFileHandles();
+  for (const auto& handle : state.fileHandles) {
+    try {
+      auto inode = inodeMap_->lookupInode(handle.inodeNumber).get();
+      struct fuse_file_info fi;
+      memset(&fi, 0, sizeof(fi));
+      std::shared_ptr<fusell::FileHandleBase> restored;
+      if (handle.isDir) {
+        restored = inode.asTreePtr()->opendir(fi).get();
+      } else {
+        // The file was already created or truncated by the original open.
+        fi.flags = handle.flags & ~(O_CREAT | O_EXCL | O_TRUNC);
+        restored = inode.asFilePtr()->open(fi).get();
+      }
+      fileHandles.restoreHandle(handle.handleId, std::move(restored));
+    } catch (const std::exception& ex) {
+      LOG(WARNING) << "unable to restore file handle " << handle.handleId
+                   << " for inode " << handle.inodeNumber << " in "
+                   << getPath() << ": " << folly::exceptionStr(ex);
+    }
+  }
+}
+
 TreeInodePtr EdenMount::getRootInode() const {
   return inodeMap_->getRootInode();
 }
@@ -213,25 +701,34 @@ FileInodePtr EdenMount::getFileInodeBlocking(RelativePathPiece path) const {
 
 folly::Future<std::vector<CheckoutConflict>> EdenMount::checkout(
     Hash snapshotHash,
-    bool force) {
+    bool force,
+    folly::Executor* executor) {
+  // Fetches for the checkout, including the ones made in continuations of
+  // the Futures created here, run after interactive requests.
+  folly::RequestContextScopeGuard contextGuard;
+  setCurrentImportPriority(ImportPriority::CHECKOUT);
+
   // Hold the snapshot lock for the duration of the entire checkout operation.
   //
   // This prevents multiple checkout operations from running in parallel.
   auto snapshotLock = currentSnapshot_.wlock();
   auto oldSnapshot = *snapshotLock;
-  auto ctx = std::make_shared<CheckoutContext>(std::move(snapshotLock), force);
+  auto ctx = std::make_shared<CheckoutContext>(
+      std::move(snapshotLock), force, getFuseChannel(), executor);
   VLOG(1) << "starting checkout for " << this->getPath() << ": " << oldSnapshot
           << " to " << snapshotHash;
 
+  auto treeFetchStart = steady_clock::now();
   auto fromTreeFuture = objectStore_->getTreeForCommit(oldSnapshot);
   auto toTreeFuture = objectStore_->getTreeForCommit(snapshotHash);
 
   return folly::collect(fromTreeFuture, toTreeFuture)
-      .then([this, ctx](
+      .then([this, ctx, treeFetchStart](
           std::tuple<unique_ptr<Tree>, unique_ptr<Tree>> treeResults) {
+        ctx->addTime(CheckoutContext::FETCH_TREES, treeFetchStart);
         auto& fromTree = std::get<0>(treeResults);
         auto& toTree = std::get<1>(treeResults);
-        ctx->start(this->acquireRenameLock());
+        ctx->start(this->acquireRenameLock("EdenMount::checkout"));
         return this->getRootInode()->checkout(
             ctx.get(), std::move(fromTree), std::move(toTree));
       })
@@ -241,26 +738,158 @@ folly::Future<std::vector<CheckoutConflict>> EdenMount::checkout(
                 << oldSnapshot << " to " << snapshotHash;
         this->config_->setSnapshotID(snapshotHash);
         auto conflicts = ctx->finish(snapshotHash);
+        this->recordCheckoutStats(ctx->getStats());
 
-        // Write a journal entry
-        // TODO: We don't include any file changes for now.  We'll need to
-        // figure out the desired data to pass to watchman.  We intentionally
-        // don't want to give it the full list of files that logically
-        // changed--we intentionally don't process files that were changed but
-        // have never been accessed.
+        // Write a journal entry.  The files that changed are not computed
+        // here, since the checkout intentionally does not process files that
+        // were changed but have never been accessed.  Instead the entry
+        // computes them from the two commits if a client asks for them.
         auto journalDelta = make_unique<JournalDelta>();
         journalDelta->fromHash = oldSnapshot;
         journalDelta->toHash = snapshotHash;
-        journal_.wlock()->addDelta(std::move(journalDelta));
+        journalDelta->commitChanges.push_back(
+            this->makeCommitChanges(oldSnapshot, snapshotHash));
+        journal_.addDelta(std::move(journalDelta));
 
         return conflicts;
       });
 }
 
-Future<Unit> EdenMount::diff(InodeDiffCallback* callback, bool listIgnored) {
+Future<vector<CheckoutConflict>> EdenMount::checkConflicts(
+    Hash snapshotHash,
+    folly::Executor* executor) {
+  folly::RequestContextScopeGuard contextGuard;
+  setCurrentImportPriority(ImportPriority::CHECKOUT);
+
+  auto oldSnapshot = getSnapshotID();
+  auto state = std::make_shared<ConflictCheckState>();
+  return diffCommits(oldSnapshot, snapshotHash, &state->commitDiff, executor)
+      .then([this, state, executor] {
+        state->commitChanges = state->commitDiff.extractChanges();
+        if (state->commitChanges.empty()) {
+          return makeFuture();
+        }
+        // Only the part of the working directory that the checkout would
+        // touch can conflict with it.
+        auto prefix = getCommonDirectory(state->commitChanges);
+        return diff(&state->localDiff, false, executor, prefix);
+      })
+      .then([this, state, snapshotHash] {
+        auto localChanges = state->localDiff.extractChanges();
+        if (localChanges.empty()) {
+          return makeFuture(vector<CheckoutConflict>{});
+        }
+        return objectStore_->getTreeForCommit(snapshotHash).then([
+          this,
+          state,
+          localChanges = std::move(localChanges)
+        ](std::unique_ptr<Tree> newTree) {
+          return findConflicts(
+              state->commitChanges,
+              localChanges,
+              *newTree,
+              objectStore_.get());
+        });
+      });
+}
+
+void EdenMount::recordCheckoutStats(const CheckoutStats& stats) {
+  VLOG(1) << "checkout of " << getPath() << " took " << stats.totalTimeUs
+          << "us: fetch trees " << stats.fetchTreesTimeUs
+          << "us, fetch blobs " << stats.fetchBlobsTimeUs
+          << "us, write overlay " << stats.writeOverlayTimeUs
+          << "us, invalidate " << stats.invalidateTimeUs
+          << "us, check conflicts " << stats.checkConflictsTimeUs << "us; "
+          << stats.entriesProcessed << " entries processed, "
+          << stats.entriesSwapped << " swapped, " << stats.conflicts
+          << " conflicts, " << stats.errors << " errors, "
+          << stats.treesFetched << " trees and " << stats.blobsFetched
+          << " blobs (" << stats.bytesFetched << " bytes) fetched";
+
+  {
+    auto now = duration_cast<std::chrono::seconds>(
+        steady_clock::now().time_since_epoch());
+    auto* edenStats = mountStats_.get();
+    auto record = [&](fusell::EdenStats::HistogramPtr item, int64_t us) {
+      edenStats->recordLatency(item, std::chrono::microseconds(us), now);
+    };
+    record(&fusell::EdenStats::checkoutTotal, stats.totalTimeUs);
+    record(&fusell::EdenStats::checkoutFetchTrees, stats.fetchTreesTimeUs);
+    record(&fusell::EdenStats::checkoutFetchBlobs, stats.fetchBlobsTimeUs);
+    record(
+        &fusell::EdenStats::checkoutWriteOverlay, stats.writeOverlayTimeUs);
+    record(&fusell::EdenStats::checkoutInvalidate, stats.invalidateTimeUs);
+    record(
+        &fusell::EdenStats::checkoutCheckConflicts,
+        stats.checkConflictsTimeUs);
+  }
+
+  *lastCheckoutStats_.wlock() = make_unique<CheckoutStats>(stats);
+}
+
+CheckoutStats EdenMount::getLastCheckoutStats() const {
+  auto stats = lastCheckoutStats_.rlock();
+  return *stats ? **stats : CheckoutStats{};
+}
+
+OverlayCompactStats EdenMount::compactOverlay() {
+  // Materializing an inode links it into its parent with the rename lock
+  // held, so holding it means every materialized inode that is not loaded is
+  // already reachable once the flush is done.  Inodes allocated after this
+  // point are kept regardless.
+  auto renameLock = acquireRenameLock("EdenMount::compactOverlay");
+  auto firstNewInode = inodeMap_->getNextInodeNumber();
+  overlay_->flushDirs(true);
+  auto* inodeMap = inodeMap_.get();
+  return overlay_->compact(firstNewInode, [inodeMap](fuse_ino_t number) {
+    return inodeMap->isInodeRemembered(number);
+  });
+}
+
+size_t EdenMount::dematerializeUnchangedFiles() {
+  auto rootTree = getRootTree();
+  auto count = getRootInode()->dematerializeUnchanged(*rootTree);
+  VLOG(1) << "dematerialized " << count << " unchanged inodes in "
+          << getPath();
+  return count;
+}
+
+Future<Hash> EdenMount::storeWorkingCopySnapshot(folly::Executor* executor) {
+  // skipNames is only used before storeSnapshot() returns.
+  std::vector<PathComponentPiece> skipNames{PathComponentPiece{".hg"},
+                                            PathComponentPiece{kDotEdenName}};
+  return getRootInode()->storeSnapshot(
+      objectStore_->getLocalStore().get(), executor, &skipNames);
+}
+
+bool EdenMount::compactJournal(size_t memoryLimit) {
+  auto latest = journal_.getLatest();
+  auto usage = journal_.getMemoryUsage();
+  if (!latest || usage <= memoryLimit) {
+    return false;
+  }
+
+  auto compacted = Journal::compactChain(*latest, memoryLimit);
+  if (!compacted) {
+    return false;
+  }
+  if (!journal_.replaceHistory(latest, std::move(compacted))) {
+    // Someone else replaced the journal while we were compacting it.
+    return false;
+  }
+  VLOG(1) << "compacted the journal for " << getPath() << " from " << usage
+          << " to " << journal_.getMemoryUsage() << " bytes";
+  return true;
+}
+
+Future<Unit> EdenMount::diff(
+    InodeDiffCallback* callback,
+    bool listIgnored,
+    folly::Executor* executor,
+    RelativePathPiece prefix) {
   // Create a DiffContext object for this diff operation.
-  auto context =
-      make_unique<DiffContext>(callback, listIgnored, getObjectStore());
+  auto context = make_unique<DiffContext>(
+      callback, listIgnored, getObjectStore(), executor, prefix);
   const DiffContext* ctxPtr = context.get();
 
   // TODO: Load the system-wide ignore settings and user-specific
@@ -275,14 +904,161 @@ Future<Unit> EdenMount::diff(InodeDiffCallback* callback, bool listIgnored) {
 
   auto rootInode = getRootInode();
   return getRootTreeFuture()
-      .then([ ctxPtr, ignorePtr, rootInode = std::move(rootInode) ](
+      .then([ this, ctxPtr, ignorePtr, rootInode = std::move(rootInode) ](
           std::unique_ptr<Tree> && rootTree) {
-        return rootInode->diff(
-            ctxPtr, RelativePathPiece{}, std::move(rootTree), ignorePtr, false);
+        // rootInode is captured by the ensure() callback too, so that this
+        // EdenMount stays alive until the counts have been recorded.
+        return rootInode
+            ->diff(
+                ctxPtr,
+                RelativePathPiece{},
+                std::move(rootTree),
+                ignorePtr,
+                false)
+            .ensure([this, ctxPtr, rootInode] {
+              diffIgnoredDirsPruned_ += ctxPtr->ignoredDirsPruned.load();
+              diffCachedDirsSkipped_ += ctxPtr->cachedDirsSkipped.load();
+            });
       })
       .ensure(std::move(stateHolder));
 }
 
+Future<Unit> EdenMount::diffCommits(
+    Hash fromCommit,
+    Hash toCommit,
+    InodeDiffCallback* callback,
+    folly::Executor* executor) {
+  auto context = make_unique<DiffContext>(
+      callback, false, getObjectStore(), executor);
+  const DiffContext* ctxPtr = context.get();
+
+  // stateHolder() exists to ensure that the DiffContext exists until the
+  // diff completes.
+  auto stateHolder = [ctx = std::move(context)]() {};
+
+  auto* store = getObjectStore();
+  return folly::collect(
+             store->getTreeForCommit(fromCommit),
+             store->getTreeForCommit(toCommit))
+      .then([ctxPtr](
+          std::tuple<std::unique_ptr<Tree>, std::unique_ptr<Tree>>&& trees) {
+        return diffTrees(
+            ctxPtr,
+            RelativePathPiece{},
+            std::move(std::get<0>(trees)),
+            std::move(std::get<1>(trees)));
+      })
+      .ensure(std::move(stateHolder));
+}
+
+Future<Unit> EdenMount::loadMaterializedInodes(folly::Executor* executor) {
+  auto* progress = &materializedLoadProgress_;
+  return getRootInode()
+      ->loadMaterializedChildren(executor, progress)
+      .ensure([progress] { progress->finished.store(true); });
+}
+
+Future<TreeWarmUpStats> EdenMount::warmUp(
+    size_t treeDepth,
+    size_t maxTrees) {
+  folly::RequestContextScopeGuard contextGuard;
+  setCurrentImportPriority(ImportPriority::PREFETCH);
+
+  vector<Hash> hotTrees;
+  std::string hotTreesData;
+  auto hotTreesPath = config_->getHotTreesPath();
+  if (folly::readFile(hotTreesPath.c_str(), hotTreesData)) {
+    folly::ByteRange bytes{StringPiece{hotTreesData}};
+    while (bytes.size() >= Hash::RAW_SIZE) {
+      hotTrees.emplace_back(bytes.subpiece(0, Hash::RAW_SIZE));
+      bytes.advance(Hash::RAW_SIZE);
+    }
+  }
+
+  return objectStore_->warmUpTrees(hotTrees, 1, maxTrees)
+      .then([this, treeDepth, maxTrees](TreeWarmUpStats hotStats) {
+        auto remaining = maxTrees - std::min(maxTrees, hotStats.treesLoaded);
+        if (treeDepth == 0 || remaining == 0) {
+          return makeFuture(hotStats);
+        }
+        return getRootTreeFuture()
+            .then([this, treeDepth, remaining](unique_ptr<Tree> rootTree) {
+              return objectStore_->warmUpTrees(
+                  {rootTree->getHash()}, treeDepth, remaining);
+            })
+            .then([hotStats](TreeWarmUpStats rootStats) {
+              rootStats.treesLoaded += hotStats.treesLoaded;
+              rootStats.treesFailed += hotStats.treesFailed;
+              return rootStats;
+            });
+      });
+}
+
+void EdenMount::saveHotTrees(size_t maxTrees) {
+  auto ids = objectStore_->getRecentTreeIds(maxTrees);
+  std::string data;
+  data.reserve(ids.size() * Hash::RAW_SIZE);
+  for (const auto& id : ids) {
+    auto bytes = id.getBytes();
+    data.append(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+  }
+  folly::writeFileAtomic(config_->getHotTreesPath().stringPiece(), data, 0644);
+  VLOG(1) << "saved " << ids.size() << " hot trees for " << getPath();
+}
+
+void EdenMount::startRecordingAccesses() {
+  accessRecorder_.start();
+  VLOG(1) << "started recording accesses in " << getPath();
+}
+
+size_t EdenMount::stopRecordingAccesses() {
+  auto paths = accessRecorder_.stop();
+  folly::writeFileAtomic(
+      config_->getAccessSetPath().stringPiece(),
+      AccessRecorder::serialize(paths),
+      0644);
+  VLOG(1) << "saved " << paths.size() << " recorded accesses for "
+          << getPath();
+  return paths.size();
+}
+
+Future<BlobPrefetchStats> EdenMount::replayAccesses(
+    size_t batchSize,
+    size_t maxConcurrency) {
+  std::string data;
+  if (!folly::readFile(config_->getAccessSetPath().c_str(), data)) {
+    return makeFuture(BlobPrefetchStats{});
+  }
+  auto paths = AccessRecorder::deserialize(data);
+
+  folly::RequestContextScopeGuard contextGuard;
+  setCurrentImportPriority(ImportPriority::PREFETCH);
+  return getRootTreeFuture()
+      .then([this, paths = std::move(paths)](unique_ptr<Tree> rootTree) {
+        return AccessRecorder::resolveBlobs(
+            objectStore_.get(), rootTree->getHash(), paths);
+      })
+      .then([this, batchSize, maxConcurrency](vector<Hash> blobs) {
+        VLOG(1) << "replaying " << blobs.size() << " recorded accesses in "
+                << getPath();
+        return objectStore_->prefetchBlobs(blobs, batchSize, maxConcurrency);
+      });
+}
+
+void EdenMount::saveJournal(size_t memoryLimit) {
+  auto latest = journal_.getLatest();
+  if (!latest) {
+    return;
+  }
+  auto compacted = Journal::compactChain(*latest, memoryLimit);
+  Journal::saveHistory(
+      config_->getJournalPath(),
+      mountGeneration_,
+      compacted ? *compacted : *latest);
+  VLOG(1) << "saved the journal of " << getPath() << " up to sequence "
+          << latest->toSequence;
+}
+
 void EdenMount::resetCommit(Hash snapshotHash) {
   // We currently don't verify that snapshotHash refers to a valid commit
   // in the ObjectStore.  We could do that just for verification purposes.
@@ -298,15 +1074,28 @@ void EdenMount::resetCommit(Hash snapshotHash) {
   auto journalDelta = make_unique<JournalDelta>();
   journalDelta->fromHash = oldSnapshot;
   journalDelta->toHash = snapshotHash;
-  journal_.wlock()->addDelta(std::move(journalDelta));
+  journalDelta->commitChanges.push_back(
+      makeCommitChanges(oldSnapshot, snapshotHash));
+  journal_.addDelta(std::move(journalDelta));
+}
+
+std::shared_ptr<CommitChanges> EdenMount::makeCommitChanges(
+    Hash fromCommit,
+    Hash toCommit) {
+  return std::make_shared<CommitChanges>(
+      fromCommit, toCommit, [this, fromCommit, toCommit]() {
+        auto callback = std::make_shared<ChangedPathsCallback>();
+        return diffCommits(fromCommit, toCommit, callback.get())
+            .then([callback]() { return callback->extractPaths(); });
+      });
 }
 
-RenameLock EdenMount::acquireRenameLock() {
-  return RenameLock{this};
+RenameLock EdenMount::acquireRenameLock(const char* site) {
+  return RenameLock{this, site};
 }
 
-SharedRenameLock EdenMount::acquireSharedRenameLock() {
-  return SharedRenameLock{this};
+SharedRenameLock EdenMount::acquireSharedRenameLock(const char* site) {
+  return SharedRenameLock{this, site};
 }
 }
 } // facebook::eden
@@ -12,16 +12,21 @@
 #include <folly/SharedMutex.h>
 #include <folly/Synchronized.h>
 #include <folly/ThreadLocal.h>
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <shared_mutex>
+#include "eden/fs/inodes/AccessRecorder.h"
 #include "eden/fs/inodes/InodePtrFwd.h"
 #include "eden/fs/journal/JournalDelta.h"
 #include "eden/fuse/EdenStats.h"
 #include "eden/fuse/fuse_headers.h"
+#include "eden/utils/LockProfiler.h"
 #include "eden/utils/PathFuncs.h"
+#include "eden/utils/RequestTrace.h"
 
 namespace folly {
+class Executor;
 template <typename T>
 class Future;
 }
@@ -32,22 +37,46 @@ namespace fusell {
 class Channel;
 class MountPoint;
 }
+namespace takeover {
+class SerializedMountState;
+}
 
 class BindMount;
 class CheckoutConflict;
+class CheckoutStats;
 class ClientConfig;
+class CommitChanges;
 class Dirstate;
 class EdenDispatcher;
+class GitIgnoreCache;
 class InodeDiffCallback;
 class InodeMap;
 class ObjectStore;
 class Overlay;
+struct OverlayCompactStats;
 class Journal;
 class Tree;
+class TreePrefetcher;
+struct BlobPrefetchStats;
+struct TreeWarmUpStats;
 
 class RenameLock;
 class SharedRenameLock;
 
+using RenameMutex = ProfiledMutex<LockProfiler::RENAME_LOCK>;
+
+/**
+ * Counts of the inodes loaded so far by EdenMount::loadMaterializedInodes().
+ *
+ * The counts are updated from multiple threads while the load is in
+ * progress, and may be read at any time.
+ */
+struct MaterializedLoadProgress {
+  std::atomic<uint64_t> dirsLoaded{0};
+  std::atomic<uint64_t> filesLoaded{0};
+  std::atomic<bool> finished{false};
+};
+
 /**
  * EdenMount contains all of the data about a specific eden mount point.
  *
@@ -127,6 +156,26 @@ class EdenMount {
    */
   const std::vector<BindMount>& getBindMounts() const;
 
+  /**
+   * Save the inode numbers and open file handles of this mount into the
+   * state that is handed to a new edenfs process during a graceful restart.
+   *
+   * This must only be called after the FUSE channel has stopped for a
+   * takeover.  The file handles are released, since the kernel now refers
+   * to them in the other process.
+   */
+  void saveTakeoverState(takeover::SerializedMountState& state);
+
+  /**
+   * Restore the inode numbers and file handles saved by saveTakeoverState()
+   * in the previous edenfs process.
+   *
+   * This must be called before the FUSE channel is started.  File handles
+   * that cannot be reopened are logged and dropped; the kernel gets EBADF
+   * for them.
+   */
+  void restoreTakeoverState(const takeover::SerializedMountState& state);
+
   /**
    * Return the ObjectStore used by this mount point.
    *
@@ -159,7 +208,22 @@ class EdenMount {
     return dirstate_.get();
   }
 
-  folly::Synchronized<Journal>& getJournal() {
+  /**
+   * Return the cache of parsed .gitignore files used by diff operations.
+   */
+  GitIgnoreCache* getGitIgnoreCache() const {
+    return gitIgnoreCache_.get();
+  }
+
+  /**
+   * Return the prefetcher that loads subdirectory trees ahead of lookups,
+   * or nullptr if --tree_prefetch_depth is 0.
+   */
+  TreePrefetcher* getTreePrefetcher() const {
+    return treePrefetcher_.get();
+  }
+
+  Journal& getJournal() {
     return journal_;
   }
 
@@ -223,10 +287,87 @@ class EdenMount {
 
   /**
    * Check out the specified commit.
+   *
+   * If executor is non-null, the individual checkout actions are applied on
+   * it, so that independent subtrees are updated in parallel.  Otherwise they
+   * are run in whichever thread completes the data they depend on.
    */
   folly::Future<std::vector<CheckoutConflict>> checkout(
       Hash snapshotHash,
-      bool force = false);
+      bool force = false,
+      folly::Executor* executor = nullptr);
+
+  /**
+   * Report the conflicts that checkout(snapshotHash) would find, without
+   * changing anything.
+   *
+   * Rather than walking the inodes the way checkout() does, this diffs the
+   * Trees of the current and new commits, skipping identical subtrees, and
+   * then diffs the working directory below the part of the mount point that
+   * changes.  Files are compared by size and cached SHA-1 first, and only
+   * hashed if that is not enough, with subtrees and hashing run in parallel
+   * on executor if it is non-null.  Neither the snapshot lock nor the rename
+   * lock is held, so this does not hold up filesystem operations, but the
+   * result may be stale if the working directory changes meanwhile.
+   *
+   * Ignored files are not examined, so an ignored file where the new commit
+   * adds a file, or inside a directory that it removes, is not reported.
+   */
+  folly::Future<std::vector<CheckoutConflict>> checkConflicts(
+      Hash snapshotHash,
+      folly::Executor* executor = nullptr);
+
+  /**
+   * Get the timing and counters for the most recent checkout that completed
+   * on this mount point.
+   *
+   * Returns all zeros if no checkout has completed yet.
+   */
+  CheckoutStats getLastCheckoutStats() const;
+
+  /**
+   * Remove the overlay data of inodes that are no longer reachable from the
+   * root directory, while the mount point is in use.
+   *
+   * The overlay's pending directory changes are flushed first.  Inodes still
+   * in the InodeMap, such as files unlinked while open, are left alone.  This
+   * holds the rename lock while it runs, so other renames and
+   * materializations wait for it.
+   */
+  OverlayCompactStats compactOverlay();
+
+  /**
+   * Dematerialize the files whose contents match the current commit again,
+   * such as after a revert or a build that rewrote them unchanged, along with
+   * any directories that then match the commit too.
+   *
+   * Files are compared using their size and already-computed SHA-1 only, so
+   * this never reads file contents.  Returns the number of inodes
+   * dematerialized.
+   */
+  size_t dematerializeUnchangedFiles();
+
+  /**
+   * Store the working directory state in the LocalStore as source control
+   * Trees and Blobs, and return the ID of the root Tree.
+   *
+   * Only locally modified files are read, straight from the overlay, so a
+   * commit can be made from the result without reading them back through
+   * FUSE.  The .hg and .eden directories are left out.  See
+   * TreeInode::storeSnapshot().
+   */
+  folly::Future<Hash> storeWorkingCopySnapshot(
+      folly::Executor* executor = nullptr);
+
+  /**
+   * Compact the journal if its deltas use more than memoryLimit bytes,
+   * merging old deltas into coarse ranges and dropping the oldest ones.
+   *
+   * The compacted journal is built from an immutable snapshot of the
+   * deltas, so this does not block filesystem operations that record changes.  Returns
+   * true if the journal was compacted.
+   */
+  bool compactJournal(size_t memoryLimit);
 
   /**
    * Compute differences between the current commit and the working directory
@@ -239,10 +380,130 @@ class EdenMount {
    * @param listIgnored Whether or not to inform the callback of ignored files.
    *     When listIgnored to false can speed up the diff computation, as the
    *     code does not need to descend into ignord directories at all.
+   * @param executor If non-null, subdirectories and file contents are
+   *     compared on this executor, so independent subtrees are diffed in
+   *     parallel, bounded by the executor's number of threads.
+   * @param prefix If non-empty, only differences at or underneath this path
+   *     are reported.  Only the directories leading to it are examined
+   *     outside of it, so this is much cheaper than a full diff when only
+   *     one part of the mount point is of interest.
    */
   folly::Future<folly::Unit> diff(
       InodeDiffCallback* callback,
-      bool listIgnored = false);
+      bool listIgnored = false,
+      folly::Executor* executor = nullptr,
+      RelativePathPiece prefix = RelativePathPiece{});
+
+  /**
+   * Compute differences between two commits.
+   *
+   * This only compares the commits' source control Trees, and never looks at
+   * inodes or the working directory state.  Identical subtrees are skipped
+   * without being loaded.  Files that are only present in toCommit are
+   * reported to the callback with untrackedFile().
+   *
+   * @param executor If non-null, subtrees are compared on this executor, as
+   *     with diff().
+   */
+  folly::Future<folly::Unit> diffCommits(
+      Hash fromCommit,
+      Hash toCommit,
+      InodeDiffCallback* callback,
+      folly::Executor* executor = nullptr);
+
+  /**
+   * Load the inodes for all materialized files and directories in this
+   * mount point.
+   *
+   * This should be called once, before the mount point is started.  The
+   * overlay data for materialized directories is read on the given
+   * executor, so the number of directories loaded concurrently is bounded
+   * by its number of threads.  If executor is null everything is loaded in
+   * the calling thread.
+   *
+   * Progress can be monitored with getMaterializedLoadProgress() while the
+   * load is running.
+   */
+  folly::Future<folly::Unit> loadMaterializedInodes(folly::Executor* executor);
+
+  const MaterializedLoadProgress& getMaterializedLoadProgress() const {
+    return materializedLoadProgress_;
+  }
+
+  /**
+   * Load the Trees recorded by saveHotTrees() when this client was last
+   * unmounted, and the Trees of the current snapshot down to treeDepth
+   * levels, so that the first requests after a restart do not all go to a
+   * cold LocalStore.
+   *
+   * This is meant to run in the background after the mount point starts.
+   * Its fetches run at prefetch priority, behind the ones that FUSE
+   * requests make, and at most maxTrees Trees are loaded.  The EdenMount
+   * must remain valid until the returned Future completes.
+   */
+  folly::Future<TreeWarmUpStats> warmUp(size_t treeDepth, size_t maxTrees);
+
+  /**
+   * Record the IDs of up to maxTrees recently used Trees in the client
+   * directory, for warmUp() to load when this client is next mounted.
+   */
+  void saveHotTrees(size_t maxTrees);
+
+  /**
+   * Start recording the files opened for reading in this mount point,
+   * discarding any recording in progress.
+   */
+  void startRecordingAccesses();
+
+  /**
+   * Stop recording accesses, and save the recorded paths in the client
+   * directory for replayAccesses().  Returns the number of paths saved.
+   *
+   * Throws std::logic_error if recording was not started.
+   */
+  size_t stopRecordingAccesses();
+
+  AccessRecorder& getAccessRecorder() {
+    return accessRecorder_;
+  }
+
+  /**
+   * Prefetch the blobs of the files saved by stopRecordingAccesses(), as
+   * they are in the current snapshot.
+   *
+   * This warms the caches before a build that reads the same files as the
+   * one recorded.  The fetches run at prefetch priority, with the given
+   * batch size and concurrency as for ObjectStore::prefetchBlobs().  Does
+   * nothing if no recording was saved.  The EdenMount must remain valid
+   * until the returned Future completes.
+   */
+  folly::Future<BlobPrefetchStats> replayAccesses(
+      size_t batchSize,
+      size_t maxConcurrency);
+
+  /**
+   * Save the journal in the client directory, compacted to use roughly
+   * memoryLimit bytes, so that the next mount of this client can continue
+   * it.  Clients can then still ask for the changes since the positions
+   * they were given before the restart.
+   */
+  void saveJournal(size_t memoryLimit);
+
+  /**
+   * Get the total number of ignored directories that diff() has skipped
+   * without loading, across all diff operations on this mount.
+   */
+  uint64_t getDiffIgnoredDirsPruned() const {
+    return diffIgnoredDirsPruned_.load();
+  }
+
+  /**
+   * Get the total number of directories that diff() has answered from the
+   * results of an earlier diff, across all diff operations on this mount.
+   */
+  uint64_t getDiffCachedDirsSkipped() const {
+    return diffCachedDirsSkipped_.load();
+  }
 
   /**
    * Reset the state to point to the specified commit, without modifying
@@ -252,13 +513,16 @@ class EdenMount {
 
   /**
    * Acquire the rename lock in exclusive mode.
+   *
+   * site names the caller, such as "TreeInode::rename", for the
+   * LockProfiler.  It must be a string literal.
    */
-  RenameLock acquireRenameLock();
+  RenameLock acquireRenameLock(const char* site);
 
   /**
    * Acquire the rename lock in shared mode.
    */
-  SharedRenameLock acquireSharedRenameLock();
+  SharedRenameLock acquireSharedRenameLock(const char* site);
 
   /**
    * shutdownComplete() will be called by InodeMap when all outstanding Inodes
@@ -271,9 +535,10 @@ class EdenMount {
   const AbsolutePath& getSocketPath() const;
 
   /**
-   * Returns a pointer to a stats instance associated with this mountpoint.
-   * Today this is the global stats instance, but in the future it will be
-   * a mount point specific instance. */
+   * Returns a pointer to the stats instance for this mount point.  Its
+   * histograms are named "mount.<path>.<name>", and everything recorded in
+   * them is also recorded in the global stats instance.
+   */
   folly::ThreadLocal<fusell::EdenStats>* getStats() const;
 
  private:
@@ -294,13 +559,39 @@ class EdenMount {
   ~EdenMount();
 
   /**
-   * The stats instance associated with this mount point.
-   * This is just a reference to a global stats instance today, but we'd
-   * like to make this its own child instance that aggregates up into
-   * the global instance in the future.
+   * Export this mount's fusell::RequestMetrics and InodeMapStats as dynamic
+   * ServiceData counters.  The counters are removed again by the destructor.
+   */
+  void registerCounters();
+  void unregisterCounters();
+
+  /**
+   * Log a summary of a completed checkout, add its phase times to the
+   * checkout histograms, and save it for getLastCheckoutStats().
+   */
+  void recordCheckoutStats(const CheckoutStats& stats);
+
+  /**
+   * Create the CommitChanges recorded in the journal when the snapshot
+   * moves from fromCommit to toCommit.  The changed paths are computed with
+   * diffCommits() the first time they are requested.
+   */
+  std::shared_ptr<CommitChanges> makeCommitChanges(
+      Hash fromCommit,
+      Hash toCommit);
+
+  /**
+   * The global stats instance, which aggregates the stats of all of the
+   * mount points.
    */
   folly::ThreadLocal<fusell::EdenStats>* globalEdenStats_{nullptr};
 
+  /**
+   * The stats instance for this mount point, a child of globalEdenStats_.
+   * This must be initialized before dispatcher_, which records into it.
+   */
+  mutable folly::ThreadLocal<fusell::EdenStats> mountStats_;
+
   std::unique_ptr<ClientConfig> config_;
   std::unique_ptr<InodeMap> inodeMap_;
   std::unique_ptr<EdenDispatcher> dispatcher_;
@@ -308,6 +599,10 @@ class EdenMount {
   std::unique_ptr<ObjectStore> objectStore_;
   std::shared_ptr<Overlay> overlay_;
   std::unique_ptr<Dirstate> dirstate_;
+  std::unique_ptr<GitIgnoreCache> gitIgnoreCache_;
+  /** Destroyed before objectStore_, since it waits for its prefetches. */
+  std::unique_ptr<TreePrefetcher> treePrefetcher_;
+  AccessRecorder accessRecorder_;
   fuse_ino_t dotEdenInodeNumber_{0};
 
   /**
@@ -316,8 +611,14 @@ class EdenMount {
    * This includes rename() operations as well as unlink() and rmdir().
    * Any operation that modifies an existing InodeBase's location_ data must
    * hold the rename lock.
+   *
+   * Renaming a file within a single directory only needs the lock in shared
+   * mode, along with that directory's contents lock: it changes the name of
+   * one non-directory inode but never its parent.  Holding the lock in
+   * shared mode therefore still guarantees that no directory is moved or
+   * renamed, and that the parent of every inode stays the same.
    */
-  folly::SharedMutex renameMutex_;
+  RenameMutex renameMutex_;
 
   /**
    * The hash of the current snapshot (i.e., commit) that is checked out in
@@ -331,18 +632,32 @@ class EdenMount {
    */
   const std::vector<BindMount> bindMounts_;
 
-  folly::Synchronized<Journal> journal_;
+  Journal journal_;
 
   /**
    * A number to uniquely identify this particular incarnation of this mount.
    * We use bits from the process id and the time at which we were mounted.
+   * If the journal saved by the last mount is restored, its generation is
+   * kept instead, since the journal positions are still valid.
    */
-  const uint64_t mountGeneration_;
+  uint64_t mountGeneration_;
 
   /**
    * The path to the unix socket that can be used to address us via thrift
    */
   AbsolutePath socketPath_;
+
+  /**
+   * The names of the dynamic counters registered by
+   * registerCounters().
+   */
+  std::vector<std::string> counterNames_;
+
+  MaterializedLoadProgress materializedLoadProgress_;
+  std::atomic<uint64_t> diffIgnoredDirsPruned_{0};
+  std::atomic<uint64_t> diffCachedDirsSkipped_{0};
+
+  folly::Synchronized<std::unique_ptr<CheckoutStats>> lastCheckoutStats_;
 };
 
 /**
@@ -350,13 +665,19 @@ class EdenMount {
  *
  * This is primarily useful so it can be forward declared easily,
  * but it also provides a helper method to ensure that it is currently holding
- * a lock on the desired mount.
+ * a lock on the desired mount.  The time spent waiting for the lock is added
+ * to the RENAME_LOCK phase of the current request's RequestTrace.
  */
-class RenameLock : public std::unique_lock<folly::SharedMutex> {
+class RenameLock : public std::unique_lock<RenameMutex> {
  public:
   RenameLock() {}
-  explicit RenameLock(EdenMount* mount)
-      : std::unique_lock<folly::SharedMutex>{mount->renameMutex_} {}
+  RenameLock(EdenMount* mount, const char* site)
+      : std::unique_lock<RenameMutex>{mount->renameMutex_, std::defer_lock} {
+    LockProfiler::SiteScope siteScope{site};
+    auto start = std::chrono::steady_clock::now();
+    lock();
+    RequestTrace::addTime(RequestTrace::RENAME_LOCK, start);
+  }
 
   bool isHeld(EdenMount* mount) const {
     return owns_lock() && (mutex() == &mount->renameMutex_);
@@ -366,10 +687,16 @@ class RenameLock : public std::unique_lock<folly::SharedMutex> {
 /**
  * SharedRenameLock is a holder for an EdenMount's rename mutex in shared mode.
  */
-class SharedRenameLock : public std::shared_lock<folly::SharedMutex> {
+class SharedRenameLock : public std::shared_lock<RenameMutex> {
  public:
-  explicit SharedRenameLock(EdenMount* mount)
-      : std::shared_lock<folly::SharedMutex>{mount->renameMutex_} {}
+  SharedRenameLock() {}
+  SharedRenameLock(EdenMount* mount, const char* site)
+      : std::shared_lock<RenameMutex>{mount->renameMutex_, std::defer_lock} {
+    LockProfiler::SiteScope siteScope{site};
+    auto start = std::chrono::steady_clock::now();
+    lock();
+    RequestTrace::addTime(RequestTrace::RENAME_LOCK, start);
+  }
 
   bool isHeld(EdenMount* mount) const {
     return owns_lock() && (mutex() == &mount->renameMutex_);
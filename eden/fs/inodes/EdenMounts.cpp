@@ -9,10 +9,10 @@
  */
 #include "EdenMounts.h"
 
-#include <boost/polymorphic_cast.hpp>
 #include "eden/fs/inodes/EdenMount.h"
 #include "eden/fs/inodes/TreeInode.h"
 #include "eden/fs/model/Tree.h"
+#include "eden/fs/store/LocalStore.h"
 #include "eden/fs/store/ObjectStore.h"
 #include "eden/utils/PathFuncs.h"
 
@@ -33,29 +33,35 @@ void getModifiedDirectoriesRecursive(
     return;
   }
 
-  dir->getContents().withRLock([&](const auto& contents) mutable {
-    if (!contents.materialized) {
+  std::vector<PathComponent> materializedDirs;
+  {
+    auto contents = dir->getContents().rlock();
+    if (!contents->materialized) {
       return;
     }
 
     modifiedDirectories.push_back(dirPath.copy());
-    for (auto& entIter : contents.entries) {
+    for (const auto& entIter : contents->entries) {
       const auto& ent = entIter.second;
-      if (S_ISDIR(ent->mode) && ent->isMaterialized()) {
-        const auto& name = entIter.first;
-        auto childInode = ent->inode;
-        CHECK(childInode != nullptr);
-        auto childPath = dirPath + name;
-        auto childDir = boost::polymorphic_downcast<TreeInode*>(childInode);
-        DCHECK(childDir->getContents().rlock()->materialized)
-            << (dirPath + name) << " entry " << ent.get()
-            << " materialized is true, but the contained dir is !materialized";
-
-        getModifiedDirectoriesRecursive(
-            childPath, childDir, toIgnore, modifiedDirectories);
+      if (S_ISDIR(ent.mode) && ent.isMaterialized()) {
+        materializedDirs.push_back(entIter.first.copy());
       }
     }
-  });
+  }
+
+  // Materialized directories are loaded on demand, so they may need to be
+  // loaded here.  This has to happen after releasing our contents lock.
+  for (const auto& name : materializedDirs) {
+    auto childPath = dirPath + name;
+    auto childDir = dir->getOrLoadChildTree(name).get();
+    DCHECK(childDir->getContents().rlock()->materialized)
+        << childPath
+        << " entry materialized is true, but the contained dir is "
+        << "!materialized";
+
+    getModifiedDirectoriesRecursive(
+        childPath, childDir.get(), toIgnore, modifiedDirectories);
+  }
 }
 
 std::vector<RelativePath> getModifiedDirectories(
@@ -86,5 +92,101 @@ std::vector<RelativePath> getModifiedDirectoriesForMount(
         "Could not find root TreeInode for ", mount->getPath()));
   }
 }
+namespace {
+void getTreeBlobs(
+    const Tree& tree,
+    const LocalStore& localStore,
+    std::unordered_set<Hash>* referencedBlobs,
+    std::unordered_set<Hash>* visitedTrees);
+
+void getTreeBlobs(
+    const Hash& treeID,
+    const LocalStore& localStore,
+    std::unordered_set<Hash>* referencedBlobs,
+    std::unordered_set<Hash>* visitedTrees) {
+  if (!visitedTrees->insert(treeID).second) {
+    return;
+  }
+  auto tree = localStore.getTree(treeID);
+  if (tree) {
+    getTreeBlobs(*tree, localStore, referencedBlobs, visitedTrees);
+  }
+}
+
+void getTreeBlobs(
+    const Tree& tree,
+    const LocalStore& localStore,
+    std::unordered_set<Hash>* referencedBlobs,
+    std::unordered_set<Hash>* visitedTrees) {
+  for (const auto& entry : tree.getTreeEntries()) {
+    if (entry.getType() == TreeEntryType::TREE) {
+      getTreeBlobs(
+          entry.getHash(), localStore, referencedBlobs, visitedTrees);
+    } else {
+      referencedBlobs->insert(entry.getHash());
+    }
+  }
+}
+
+void getInodeBlobs(
+    TreeInode* dir,
+    const LocalStore& localStore,
+    std::unordered_set<Hash>* referencedBlobs,
+    std::unordered_set<Hash>* visitedTrees) {
+  std::vector<PathComponent> materializedDirs;
+  {
+    auto contents = dir->getContents().rlock();
+    if (!contents->materialized) {
+      if (contents->treeHash.hasValue()) {
+        getTreeBlobs(
+            contents->treeHash.value(),
+            localStore,
+            referencedBlobs,
+            visitedTrees);
+      }
+      return;
+    }
+
+    for (const auto& entIter : contents->entries) {
+      const auto& ent = entIter.second;
+      if (!ent.isMaterialized()) {
+        if (S_ISDIR(ent.mode)) {
+          getTreeBlobs(
+              ent.getHash(), localStore, referencedBlobs, visitedTrees);
+        } else {
+          referencedBlobs->insert(ent.getHash());
+        }
+      } else if (S_ISDIR(ent.mode)) {
+        materializedDirs.push_back(entIter.first.copy());
+      }
+    }
+  }
+
+  // As in getModifiedDirectoriesRecursive(), materialized directories may
+  // not be loaded yet.
+  for (const auto& name : materializedDirs) {
+    auto childDir = dir->getOrLoadChildTree(name).get();
+    getInodeBlobs(childDir.get(), localStore, referencedBlobs, visitedTrees);
+  }
+}
+}
+
+void getReferencedBlobs(
+    const EdenMount* mount,
+    const LocalStore& localStore,
+    std::unordered_set<Hash>* referencedBlobs,
+    std::unordered_set<Hash>* visitedTrees) {
+  auto rootTree = mount->getRootTree();
+  if (visitedTrees->insert(rootTree->getHash()).second) {
+    getTreeBlobs(*rootTree, localStore, referencedBlobs, visitedTrees);
+  }
+
+  auto rootInode = mount->getRootInode();
+  if (!rootInode) {
+    throw std::runtime_error(folly::to<std::string>(
+        "Could not find root TreeInode for ", mount->getPath()));
+  }
+  getInodeBlobs(rootInode.get(), localStore, referencedBlobs, visitedTrees);
+}
 }
 }
@@ -10,7 +10,9 @@
 #pragma once
 
 #include <memory>
+#include <unordered_set>
 #include <vector>
+#include "eden/fs/model/Hash.h"
 #include "eden/utils/PathFuncs.h"
 
 /**
@@ -20,6 +22,7 @@ namespace facebook {
 namespace eden {
 
 class EdenMount;
+class LocalStore;
 
 /**
  * @param toIgnore elements of the set are relative to the root of the mount.
@@ -40,5 +43,21 @@ std::vector<RelativePath> getModifiedDirectories(
 std::vector<RelativePath> getModifiedDirectoriesForMount(
     const EdenMount* mount,
     const std::unordered_set<RelativePathPiece>* toIgnore);
+
+/**
+ * Add the IDs of all blobs the mount refers to to referencedBlobs: every blob
+ * reachable from the mount's current snapshot, and every blob referenced by
+ * the unmaterialized entries of materialized directories in the overlay.
+ *
+ * Trees are looked up in localStore only.  Trees that are not present there
+ * are skipped, since none of the blobs below them can have been loaded
+ * through them.  visitedTrees records the trees already walked, so that
+ * callers can share it across mounts to avoid walking common trees again.
+ */
+void getReferencedBlobs(
+    const EdenMount* mount,
+    const LocalStore& localStore,
+    std::unordered_set<Hash>* referencedBlobs,
+    std::unordered_set<Hash>* visitedTrees);
 }
 }
@@ -9,6 +9,7 @@
  */
 #include "FileData.h"
 
+#include <folly/Conv.h>
 #include <folly/Exception.h>
 #include <folly/FileUtil.h>
 #include <folly/Optional.h>
@@ -16,17 +17,28 @@
 #include <folly/String.h>
 #include <folly/io/Cursor.h>
 #include <folly/io/IOBuf.h>
+#include <gflags/gflags.h>
 #include <openssl/sha.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <system_error>
 #include "Overlay.h"
+#include "common/stats/ServiceData.h"
 #include "eden/fs/inodes/EdenMount.h"
 #include "eden/fs/inodes/FileInode.h"
 #include "eden/fs/inodes/Overlay.h"
 #include "eden/fs/model/Blob.h"
 #include "eden/fs/model/Hash.h"
+#include "eden/fs/store/BlobCache.h"
+#include "eden/fs/store/BlobPack.h"
+#include "eden/fs/store/BlobMetadata.h"
 #include "eden/fs/store/ObjectStore.h"
 #include "eden/fuse/BufVec.h"
 #include "eden/fuse/MountPoint.h"
 #include "eden/fuse/fuse_headers.h"
+#include "eden/utils/IoUring.h"
 #include "eden/utils/XAttr.h"
 
 using folly::ByteRange;
@@ -35,21 +47,151 @@ using folly::Future;
 using folly::makeFuture;
 using folly::Unit;
 
+DEFINE_int32(
+    overlay_sha1_buffer_size,
+    1024 * 1024,
+    "the size of the buffer used to read materialized files when computing "
+    "their SHA-1 hash");
+DEFINE_int32(
+    overlay_splice_min_read_size,
+    64 * 1024,
+    "reads of materialized files at least this large are spliced from the "
+    "overlay file to the FUSE device instead of being copied through a "
+    "buffer.  0 disables splicing");
+DEFINE_int64(
+    overlay_cow_min_size,
+    1024 * 1024,
+    "files at least this large are materialized copy-on-write: the overlay "
+    "file starts out sparse and only stores the blocks that are written, "
+    "while the rest is still read from the source control blob.  0 disables "
+    "copy-on-write materialization");
+DEFINE_int64(
+    overlay_write_buffer_size,
+    0,
+    "sequential writes to a materialized file smaller than this are "
+    "collected in memory and written to the overlay file together, once "
+    "this much data has accumulated or something reads the file.  0 "
+    "disables write buffering");
+DEFINE_int64(
+    overlay_dedupe_min_size,
+    0,
+    "materialized files at least this large whose contents are identical "
+    "share a single copy of them in the overlay, until one of them is "
+    "changed.  0 disables sharing");
+
 namespace facebook {
 namespace eden {
 
-FileData::FileData(FileInode* inode, const folly::Optional<Hash>& hash)
+namespace {
+/**
+ * The extended attribute holding the hash of the base blob of a copy-on-write
+ * overlay file.
+ */
+constexpr folly::StringPiece kXattrBaseBlob{"user.eden.base_blob"};
+
+/** The buffer size used when copying base blob data into an overlay file */
+constexpr size_t kCowCopyBufferSize = 1024 * 1024;
+
+/** See FileData::getTotalBlobBytes() */
+std::atomic<size_t> totalBlobBytes{0};
+
+/**
+ * Find the start of the next data region at or after pos in fd, returning
+ * end if the rest of the file before end is a hole.
+ */
+off_t seekData(int fd, off_t pos, off_t end) {
+  auto result = ::lseek(fd, pos, SEEK_DATA);
+  if (result < 0) {
+    if (errno == ENXIO) {
+      return end;
+    }
+    folly::throwSystemError("error looking for data in overlay file");
+  }
+  return std::min(result, end);
+}
+
+/** Find the start of the next hole at or after pos in fd */
+off_t seekHole(int fd, off_t pos, off_t end) {
+  auto result = ::lseek(fd, pos, SEEK_HOLE);
+  checkUnixError(result, "error looking for holes in overlay file");
+  return std::min(result, end);
+}
+
+/**
+ * Atomically replace the file at path, like folly::writeFileAtomic(), but
+ * without syncing the new contents first.  Overlays that are not in strict
+ * mode sync their files in batches, or not at all.
+ */
+void writeFileAtomicNoSync(AbsolutePathPiece path, iovec* iov, int count) {
+  auto tmpPath = folly::to<std::string>(path.stringPiece(), ".tmp");
+  folly::File tmpFile(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  checkUnixError(
+      folly::writevFull(tmpFile.fd(), iov, count), "error writing ", tmpPath);
+  tmpFile.close();
+  checkUnixError(
+      ::rename(tmpPath.c_str(), path.value().c_str()),
+      "error renaming ",
+      tmpPath);
+}
+}
+
+FileData::FileData(
+    FileInode* inode,
+    const folly::Optional<Hash>& hash,
+    std::unique_ptr<Sha1Prefix> sha1Prefix)
     : inode_(inode) {
+  SHA1_Init(&sha1Prefix_);
   // The rest of the FileData code assumes that we always have file_ if
   // this is a materialized file.
   if (!hash.hasValue()) {
     auto filePath = inode_->getLocalPath();
     file_ = folly::File(filePath.c_str(), O_RDWR | O_NOFOLLOW, 0600);
+    loadBaseHash();
+
+    struct stat st;
+    checkUnixError(fstat(file_.fd(), &st));
+    overlaySize_ = st.st_size;
+    sharedContents_ = st.st_nlink > 1;
+    if (sha1Prefix && sha1Prefix->size <= st.st_size) {
+      sha1Prefix_ = sha1Prefix->ctx;
+      sha1PrefixSize_ = sha1Prefix->size;
+    }
   }
 }
 
 FileData::FileData(FileInode* inode, folly::File&& file)
-    : inode_(inode), file_(std::move(file)) {}
+    : inode_(inode), file_(std::move(file)), sha1MaybeSaved_(false) {
+  SHA1_Init(&sha1Prefix_);
+}
+
+FileData::~FileData() {
+  try {
+    flushWriteBuffer();
+  } catch (const std::exception& ex) {
+    LOG(ERROR) << "error writing buffered data for inode "
+               << inode_->getNodeId()
+               << " to the overlay: " << folly::exceptionStr(ex);
+  }
+  setBlob(nullptr);
+}
+
+size_t FileData::getTotalBlobBytes() {
+  return totalBlobBytes.load(std::memory_order_relaxed);
+}
+
+void FileData::setBlob(std::shared_ptr<const Blob> blob) {
+  if (blob_) {
+    totalBlobBytes.fetch_sub(
+        blob_->getContents().computeChainDataLength(),
+        std::memory_order_relaxed);
+  }
+  blob_ = std::move(blob);
+  if (blob_) {
+    totalBlobBytes.fetch_add(
+        blob_->getContents().computeChainDataLength(),
+        std::memory_order_relaxed);
+  }
+}
 
 // Conditionally updates target with either the value provided by
 // the caller, or with the current time value, depending on the value
@@ -78,14 +220,24 @@ struct stat FileData::setAttr(const struct stat& attr, int to_set) {
   auto state = inode_->state_.wlock();
 
   CHECK(file_) << "MUST have a materialized file at this point";
+  flushWriteBuffer();
 
   // We most likely need the current information to apply the requested
   // changes below, so just fetch it here first.
   struct stat currentStat;
   checkUnixError(fstat(file_.fd(), &currentStat));
 
-  if (to_set & FUSE_SET_ATTR_SIZE) {
+  if ((to_set & FUSE_SET_ATTR_SIZE) && attr.st_size != currentStat.st_size) {
+    unshareContents(std::min(attr.st_size, currentStat.st_size));
+    invalidateSha1(std::min(attr.st_size, currentStat.st_size));
+    if (baseHash_ && attr.st_size < currentStat.st_size) {
+      // Holes left by growing the file again would read from the base blob
+      // rather than as zeros, so stop depending on it.  Most truncations are
+      // to 0, and then there is nothing to copy.
+      detachBase(attr.st_size);
+    }
     checkUnixError(ftruncate(file_.fd(), attr.st_size));
+    setOverlaySize(attr.st_size);
   }
 
   if (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
@@ -108,6 +260,9 @@ struct stat FileData::setAttr(const struct stat& attr, int to_set) {
 
   if (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME |
                 FUSE_SET_ATTR_ATIME_NOW | FUSE_SET_ATTR_MTIME_NOW)) {
+    // Shared contents share their timestamps too.
+    unshareContents(currentStat.st_size);
+
     // Changing various time components.
     // Element 0 is the atime, element 1 is the mtime.
     struct timespec times[2] = {currentStat.st_atim, currentStat.st_mtim};
@@ -127,12 +282,18 @@ struct stat FileData::setAttr(const struct stat& attr, int to_set) {
         attr.st_mtim);
 
     checkUnixError(futimens(file_.fd(), times));
+    if (sha1_) {
+      // The contents are the same, but the saved SHA-1 needs the new
+      // modification time to stay valid.
+      storeSha1(state, sha1_.value());
+    }
   }
 
   // We need to return the now-current stat information for this file.
   struct stat returnedStat;
   checkUnixError(fstat(file_.fd(), &returnedStat));
   returnedStat.st_mode = state->mode;
+  returnedStat.st_nlink = 1;
 
   return returnedStat;
 }
@@ -157,23 +318,62 @@ struct stat FileData::stat() {
     // so we can store the atime, mtime, and ctime in the header data.
     // Otherwise we won't be able to report the ctime accurately if we just
     // keep using the overlay file timestamps.
+    flushWriteBuffer();
     checkUnixError(fstat(file_.fd(), &st));
     st.st_mode = state->mode;
     st.st_rdev = state->rdev;
+    // The overlay file's own link count includes files sharing its contents.
+    st.st_nlink = 1;
     return st;
   }
 
   CHECK(blob_);
-  st.st_mode = state->mode;
+  return unmaterializedStat(
+      *state, blob_->getContents().computeChainDataLength());
+}
 
-  auto buf = blob_->getContents();
-  st.st_size = buf.computeChainDataLength();
+Future<struct stat> FileData::getAttr() {
+  folly::Optional<Hash> hash;
+  {
+    auto state = inode_->state_.rlock();
+    if (file_ || blob_) {
+      state.unlock();
+      return makeFuture(stat());
+    }
+    if (state->size.hasValue()) {
+      // The size came with the source control Tree.
+      return makeFuture(unmaterializedStat(*state, state->size.value()));
+    }
+    hash = state->hash;
+  }
+
+  // The caller must keep this FileData alive until the returned Future
+  // completes, as FileInode::getattr() does.
+  return getObjectStore()->getBlobMetadata(hash.value()).then(
+      [this, hash](const BlobMetadata& metadata) {
+        auto state = inode_->state_.rlock();
+        if (state->hash != hash) {
+          // The file was materialized while we were looking up the metadata.
+          state.unlock();
+          return stat();
+        }
+        return unmaterializedStat(*state, metadata.size);
+      });
+}
+
+struct stat FileData::unmaterializedStat(
+    const FileInode::State& state,
+    uint64_t size) {
+  auto st = inode_->getMount()->getMountPoint()->initStatData();
+  st.st_nlink = 1;
+  st.st_mode = state.mode;
+  st.st_size = size;
 
   // Report atime, mtime, and ctime as the time when we first loaded this
   // FileInode.  It hasn't been materialized yet, so this is a reasonble time
   // to use.  Once it is materialized we use the timestamps on the underlying
   // overlay file, which the kernel keeps up-to-date.
-  auto epochTime = state->creationTime.time_since_epoch();
+  auto epochTime = state.creationTime.time_since_epoch();
   auto epochSeconds =
       std::chrono::duration_cast<std::chrono::seconds>(epochTime);
   st.st_atime = epochSeconds.count();
@@ -195,39 +395,214 @@ struct stat FileData::stat() {
 }
 
 void FileData::flush(uint64_t /* lock_owner */) {
-  // We have no write buffers, so there is nothing for us to flush,
-  // but let's take this opportunity to update the sha1 attribute.
+  // Write out the write buffer, and take this opportunity to save the SHA-1.
   auto state = inode_->state_.wlock();
-  if (file_ && !sha1Valid_) {
-    recomputeAndStoreSha1(state);
+  if (file_) {
+    flushWriteBuffer();
+    saveSha1IfCheap(state);
+    shareContentsIfEligible(state);
   }
 }
 
-void FileData::fsync(bool datasync) {
-  auto state = inode_->state_.wlock();
-  if (!file_) {
-    // If we don't have an overlay file then we have nothing to sync.
-    return;
-  }
+folly::Future<folly::Unit> FileData::fsync(bool datasync) {
+  auto* overlay = inode_->getMount()->getOverlay();
+  folly::File file;
+  {
+    auto state = inode_->state_.wlock();
+    if (!file_) {
+      // If we don't have an overlay file then we have nothing to sync.
+      return folly::Unit{};
+    }
+
+    flushWriteBuffer();
 
-  auto res =
+    // Overlays in relaxed mode never sync.
+    if (overlay->getDurability() != OverlayDurability::RELAXED) {
+      if (overlay->getIoUring()) {
+        // Sync a descriptor of our own once the lock is released, rather
+        // than holding it while waiting for the disk.
+        file = file_.dup();
+      } else {
+        auto res =
 #ifndef __APPLE__
-      datasync ? ::fdatasync(file_.fd()) :
+            datasync ? ::fdatasync(file_.fd()) :
 #endif
-               ::fsync(file_.fd());
-  checkUnixError(res);
+                     ::fsync(file_.fd());
+        checkUnixError(res);
+      }
+    }
 
-  // let's take this opportunity to update the sha1 attribute.
-  if (!sha1Valid_) {
-    recomputeAndStoreSha1(state);
+    // let's take this opportunity to save the SHA-1.
+    saveSha1IfCheap(state);
+    shareContentsIfEligible(state);
+  }
+
+  if (!file) {
+    return folly::Unit{};
+  }
+  auto fd = file.fd();
+  return overlay->getIoUring()->fsync(fd, datasync).then(
+      [file = std::move(file)] {});
+}
+
+bool FileData::createCowFile(
+    AbsolutePathPiece filePath,
+    const Hash& baseHash,
+    uint64_t size) {
+  // Set the file up completely before moving it into place, so that the
+  // overlay never contains a sparse file without its base blob hash.
+  auto tmpPath = folly::to<std::string>(filePath.stringPiece(), ".tmp");
+  folly::File tmpFile(tmpPath, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  checkUnixError(ftruncate(tmpFile.fd(), size), "error resizing ", tmpPath);
+
+  // We depend on the filesystem reporting unwritten blocks as holes.  Those
+  // that don't report the whole file as data.
+  if (seekHole(tmpFile.fd(), 0, size) != 0) {
+    VLOG(3) << "overlay for " << inode_->getLogPath()
+            << " does not support sparse files; copying the whole blob";
+    tmpFile.close();
+    ::unlink(tmpPath.c_str());
+    return false;
+  }
+
+  fsetxattr(tmpFile.fd(), kXattrBaseBlob, baseHash.toString());
+  auto durability = inode_->getMount()->getOverlay()->getDurability();
+  if (durability == OverlayDurability::STRICT) {
+    checkUnixError(::fsync(tmpFile.fd()), "error syncing ", tmpPath);
+  }
+  checkUnixError(
+      ::rename(tmpPath.c_str(), filePath.value().c_str()),
+      "error renaming ",
+      tmpPath);
+  file_ = std::move(tmpFile);
+  return true;
+}
+
+void FileData::loadBaseHash() {
+  std::string value;
+  try {
+    value = fgetxattr(file_.fd(), kXattrBaseBlob);
+  } catch (const std::system_error& ex) {
+    if (ex.code().value() == kENOATTR) {
+      // This is an ordinary materialized file.
+      return;
+    }
+    throw;
+  }
+  baseHash_ = Hash{value};
+}
+
+void FileData::ensureBaseLoaded() {
+  if (baseHash_ && !blob_) {
+    setBlob(loadBlob(baseHash_.value()));
+  }
+}
+
+void FileData::readBase(uint8_t* dest, size_t size, off_t off) {
+  CHECK(blob_) << "the base blob must be loaded to read a copy-on-write file";
+  const auto& contents = blob_->getContents();
+  auto baseSize = static_cast<off_t>(contents.computeChainDataLength());
+  size_t fromBase = 0;
+  if (off < baseSize) {
+    fromBase = std::min<size_t>(size, baseSize - off);
+    folly::io::Cursor cursor(&contents);
+    cursor.skip(off);
+    cursor.pull(dest, fromBase);
+  }
+  memset(dest + fromBase, 0, size - fromBase);
+}
+
+size_t FileData::readCow(uint8_t* dest, size_t size, off_t off) {
+  struct stat st;
+  checkUnixError(fstat(file_.fd(), &st));
+  if (off >= st.st_size) {
+    return 0;
+  }
+  size = std::min<size_t>(size, st.st_size - off);
+
+  off_t end = off + size;
+  off_t pos = off;
+  while (pos < end) {
+    auto dataStart = seekData(file_.fd(), pos, end);
+    if (dataStart > pos) {
+      readBase(dest + (pos - off), dataStart - pos, pos);
+      pos = dataStart;
+      continue;
+    }
+
+    auto dataEnd = seekHole(file_.fd(), pos, end);
+    auto len =
+        folly::preadFull(file_.fd(), dest + (pos - off), dataEnd - pos, pos);
+    checkUnixError(len, "error reading overlay file");
+    pos = dataEnd;
+  }
+  return size;
+}
+
+void FileData::copyBaseIntoHoles(off_t start, off_t end) {
+  // Holes past the end of the base blob should read as zeros, which they
+  // already do.
+  auto baseSize =
+      static_cast<off_t>(blob_->getContents().computeChainDataLength());
+  end = std::min(end, baseSize);
+
+  std::unique_ptr<uint8_t[]> buf;
+  off_t pos = start;
+  while (pos < end) {
+    auto holeEnd = seekData(file_.fd(), pos, end);
+    while (pos < holeEnd) {
+      if (!buf) {
+        buf = std::make_unique<uint8_t[]>(kCowCopyBufferSize);
+      }
+      auto len = std::min<size_t>(kCowCopyBufferSize, holeEnd - pos);
+      readBase(buf.get(), len, pos);
+      checkUnixError(
+          folly::pwriteFull(file_.fd(), buf.get(), len, pos),
+          "error writing overlay file");
+      pos += len;
+    }
+    if (pos < end) {
+      pos = seekHole(file_.fd(), pos, end);
+    }
+  }
+}
+
+void FileData::prepareCowWrite(off_t off, size_t size) {
+  ensureBaseLoaded();
+  struct stat st;
+  checkUnixError(fstat(file_.fd(), &st));
+  off_t blockSize = st.st_blksize > 0 ? st.st_blksize : 4096;
+
+  off_t end = off + size;
+  off_t blockStart = off - off % blockSize;
+  off_t blockEnd = ((end + blockSize - 1) / blockSize) * blockSize;
+  copyBaseIntoHoles(blockStart, off);
+  copyBaseIntoHoles(end, blockEnd);
+}
+
+void FileData::detachBase(off_t size) {
+  if (!baseHash_) {
+    return;
   }
+  if (size > 0) {
+    ensureBaseLoaded();
+    copyBaseIntoHoles(0, size);
+  }
+  fremovexattr(file_.fd(), kXattrBaseBlob);
+  baseHash_.reset();
+  setBlob(nullptr);
 }
 
 std::unique_ptr<folly::IOBuf> FileData::readIntoBuffer(size_t size, off_t off) {
   auto state = inode_->state_.rlock();
 
   if (file_) {
+    flushWriteBuffer(off, size);
     auto buf = folly::IOBuf::createCombined(size);
+    if (baseHash_) {
+      buf->append(readCow(buf->writableBuffer(), size, off));
+      return buf;
+    }
     auto res = ::pread(file_.fd(), buf->writableBuffer(), size, off);
     checkUnixError(res);
     buf->append(res);
@@ -249,8 +624,87 @@ std::unique_ptr<folly::IOBuf> FileData::readIntoBuffer(size_t size, off_t off) {
   return result;
 }
 
+std::unique_ptr<folly::IOBuf>
+FileData::readRange(size_t size, off_t off, size_t readahead) {
+  Hash hash;
+  {
+    auto state = inode_->state_.rlock();
+    if (file_ || blob_) {
+      return nullptr;
+    }
+    hash = state->hash.value();
+  }
+
+  {
+    auto buffer = readahead_.lock();
+    if (buffer->contents && off >= buffer->offset &&
+        off + size <= buffer->offset +
+                buffer->contents->computeChainDataLength()) {
+      folly::io::Cursor cursor(buffer->contents.get());
+      cursor.skip(off - buffer->offset);
+      std::unique_ptr<folly::IOBuf> result;
+      cursor.cloneAtMost(result, size);
+      return result;
+    }
+  }
+
+  if (!rangeReadsUnsupported_.load(std::memory_order_relaxed)) {
+    auto contents = getObjectStore()->getBlobRange(hash, off, size + readahead);
+    if (contents) {
+      folly::io::Cursor cursor(contents.get());
+      std::unique_ptr<folly::IOBuf> result;
+      cursor.cloneAtMost(result, size);
+      if (!cursor.isAtEnd()) {
+        auto buffer = readahead_.lock();
+        buffer->offset = off;
+        buffer->contents = std::move(contents);
+      }
+      return result;
+    }
+    rangeReadsUnsupported_.store(true, std::memory_order_relaxed);
+  }
+
+  ensureDataLoaded().get();
+  return nullptr;
+}
+
+bool FileData::canReadRanges() {
+  Hash hash;
+  {
+    auto state = inode_->state_.rlock();
+    if (file_ || blob_ || !state->hash.hasValue()) {
+      return false;
+    }
+    hash = state->hash.value();
+  }
+  if (rangeReadsUnsupported_.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  return getObjectStore()->getBlobRange(hash, 0, 0) != nullptr;
+}
+
+std::unique_ptr<Sha1Prefix> FileData::takeSha1Prefix() {
+  if (!file_ || sha1PrefixSize_ == 0) {
+    return nullptr;
+  }
+  auto prefix = std::make_unique<Sha1Prefix>();
+  prefix->ctx = sha1Prefix_;
+  prefix->size = sha1PrefixSize_;
+  return prefix;
+}
+
 std::string FileData::readAll() {
   auto state = inode_->state_.rlock();
+  flushWriteBuffer();
+  if (file_ && baseHash_) {
+    struct stat st;
+    checkUnixError(fstat(file_.fd(), &st));
+    std::string result;
+    result.resize(st.st_size);
+    result.resize(readCow(
+        reinterpret_cast<uint8_t*>(&result[0]), result.size(), 0));
+    return result;
+  }
   if (file_) {
     std::string result;
     auto rc = lseek(file_.fd(), 0, SEEK_SET);
@@ -264,7 +718,42 @@ std::string FileData::readAll() {
   return cursor.readFixedString(contentsBuf.computeChainDataLength());
 }
 
-fusell::BufVec FileData::read(size_t size, off_t off) {
+folly::Future<fusell::BufVec> FileData::read(size_t size, off_t off) {
+  if (FLAGS_overlay_splice_min_read_size > 0 &&
+      size >= static_cast<size_t>(FLAGS_overlay_splice_min_read_size)) {
+    auto state = inode_->state_.rlock();
+    if (file_ && !baseHash_) {
+      flushWriteBuffer(off, size);
+      // The data is not read until the reply is sent, after the lock has
+      // been released, and file_ may be replaced in the meantime, so give
+      // the BufVec its own descriptor for the overlay file.  Smaller reads
+      // are cheaper to copy than to set up a splice for.
+      return fusell::BufVec(file_.dup(), size, off);
+    }
+  }
+
+  auto* ioUring = inode_->getMount()->getOverlay()->getIoUring();
+  if (ioUring) {
+    std::shared_ptr<folly::File> file;
+    {
+      auto state = inode_->state_.rlock();
+      if (file_ && !baseHash_) {
+        flushWriteBuffer(off, size);
+        // As with splicing, file_ may be replaced before the read completes.
+        file = std::make_shared<folly::File>(file_.dup());
+      }
+    }
+    if (file) {
+      auto buf = folly::IOBuf::createCombined(size);
+      auto* dest = buf->writableBuffer();
+      return ioUring->read(file->fd(), dest, size, off)
+          .then([ buf = std::move(buf), file ](size_t bytesRead) mutable {
+            buf->append(bytesRead);
+            return fusell::BufVec(std::move(buf));
+          });
+    }
+  }
+
   auto buf = readIntoBuffer(size, off);
   return fusell::BufVec(std::move(buf));
 }
@@ -276,10 +765,29 @@ size_t FileData::write(fusell::BufVec&& buf, off_t off) {
     folly::throwSystemErrorExplicit(EINVAL);
   }
 
-  sha1Valid_ = false;
   auto vec = buf.getIov();
+  unshareContents(std::numeric_limits<uint64_t>::max());
+  invalidateSha1(off);
+  if (bufferWrite(off, vec.data(), vec.size())) {
+    size_t size = 0;
+    for (const auto& iov : vec) {
+      size += iov.iov_len;
+    }
+    extendSha1Prefix(off, vec.data(), vec.size(), size);
+    growOverlaySize(off + size);
+    return size;
+  }
+  if (baseHash_) {
+    size_t size = 0;
+    for (const auto& iov : vec) {
+      size += iov.iov_len;
+    }
+    prepareCowWrite(off, size);
+  }
   auto xfer = ::pwritev(file_.fd(), vec.data(), vec.size(), off);
   checkUnixError(xfer);
+  extendSha1Prefix(off, vec.data(), vec.size(), xfer);
+  growOverlaySize(off + xfer);
   return xfer;
 }
 
@@ -290,9 +798,23 @@ size_t FileData::write(folly::StringPiece data, off_t off) {
     folly::throwSystemErrorExplicit(EINVAL);
   }
 
-  sha1Valid_ = false;
+  unshareContents(std::numeric_limits<uint64_t>::max());
+  invalidateSha1(off);
+  iovec iov;
+  iov.iov_base = const_cast<char*>(data.data());
+  iov.iov_len = data.size();
+  if (bufferWrite(off, &iov, 1)) {
+    extendSha1Prefix(off, &iov, 1, data.size());
+    growOverlaySize(off + data.size());
+    return data.size();
+  }
+  if (baseHash_) {
+    prepareCowWrite(off, data.size());
+  }
   auto xfer = ::pwrite(file_.fd(), data.data(), data.size(), off);
   checkUnixError(xfer);
+  extendSha1Prefix(off, &iov, 1, xfer);
+  growOverlaySize(off + xfer);
   return xfer;
 }
 
@@ -302,6 +824,7 @@ Future<Unit> FileData::ensureDataLoaded() {
   if (!state->hash.hasValue()) {
     // We should always have the file open if we are materialized.
     CHECK(file_);
+    ensureBaseLoaded();
     return makeFuture();
   }
 
@@ -321,7 +844,8 @@ Future<Unit> FileData::ensureDataLoaded() {
   // For now doing a blocking load with the inode_->state_ lock held ensures
   // that only one thread can load the data at a time.  It's pretty unfortunate
   // to block with the lock held, though :-(
-  blob_ = getObjectStore()->getBlob(state->hash.value());
+  setBlob(loadBlob(state->hash.value()));
+  readahead_.lock()->contents.reset();
   return makeFuture();
 }
 
@@ -334,10 +858,17 @@ Future<Unit> FileData::materializeForWrite(int openFlags) {
     CHECK(!state->hash.hasValue());
     if ((openFlags & O_TRUNC) != 0) {
       // truncating a file that we already have open
-      sha1Valid_ = false;
+      writeBuffer_.lock()->data.clear();
+      unshareContents(0);
+      resetSha1Prefix();
       checkUnixError(ftruncate(file_.fd(), 0));
+      setOverlaySize(0);
+      detachBase(0);
       auto emptySha1 = Hash::sha1(ByteRange{});
       storeSha1(state, emptySha1);
+      fbData->incrementCounter("inodes.materialize.truncated");
+    } else {
+      ensureBaseLoaded();
     }
     return makeFuture();
   }
@@ -348,23 +879,54 @@ Future<Unit> FileData::materializeForWrite(int openFlags) {
   Hash sha1;
   auto filePath = inode_->getLocalPath();
   if ((openFlags & O_TRUNC) != 0) {
+    // The old contents are being thrown away, so neither the blob nor its
+    // metadata is needed.  This must never fetch anything: it is how build
+    // tools and compilers write their outputs.
     file_ = folly::File(filePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    inode_->getMount()->getOverlay()->updateUsage(1, 0);
     sha1 = Hash::sha1(ByteRange{});
+    fbData->incrementCounter("inodes.materialize.truncated");
   } else {
+    const auto& hash = state->hash.value();
+    auto metadata = getObjectStore()->getBlobMetadata(hash).get();
+    if (FLAGS_overlay_cow_min_size > 0 &&
+        metadata.size >= static_cast<uint64_t>(FLAGS_overlay_cow_min_size) &&
+        createCowFile(filePath, hash, metadata.size)) {
+      // Keep reading the unwritten parts of the file from the blob, rather
+      // than copying all of it into the overlay.
+      baseHash_ = hash;
+      inode_->getMount()->getOverlay()->updateUsage(1, 0);
+      setOverlaySize(metadata.size);
+      ensureBaseLoaded();
+      storeSha1(state, metadata.sha1);
+      state->hash = folly::none;
+      state->size = folly::none;
+      fbData->incrementCounter("inodes.materialize.copy_on_write");
+      return makeFuture();
+    }
+
     if (!blob_) {
       // TODO: Load the blob using the non-blocking Future APIs.
       // However, just as in ensureDataLoaded() above we will also need
       // to add a mechanism to wait for already in-progress loads.
-      blob_ = getObjectStore()->getBlob(state->hash.value());
+      setBlob(loadBlob(hash));
     }
 
     // Write the blob contents out to the overlay
     auto iov = blob_->getContents().getIov();
-    folly::writeFileAtomic(
-        filePath.stringPiece(), iov.data(), iov.size(), 0600);
+    auto durability = inode_->getMount()->getOverlay()->getDurability();
+    if (durability == OverlayDurability::STRICT) {
+      folly::writeFileAtomic(
+          filePath.stringPiece(), iov.data(), iov.size(), 0600);
+    } else {
+      writeFileAtomicNoSync(filePath, iov.data(), iov.size());
+    }
     file_ = folly::File(filePath.c_str(), O_RDWR);
+    inode_->getMount()->getOverlay()->updateUsage(1, 0);
+    setOverlaySize(blob_->getContents().computeChainDataLength());
 
-    sha1 = getObjectStore()->getSha1ForBlob(state->hash.value());
+    sha1 = metadata.sha1;
+    fbData->incrementCounter("inodes.materialize.copied");
   }
 
   // Copy and apply the sha1 to the new file.  This saves us from
@@ -373,8 +935,10 @@ Future<Unit> FileData::materializeForWrite(int openFlags) {
   storeSha1(state, sha1);
 
   // Update the FileInode to indicate that we are materialized now
-  blob_.reset();
+  setBlob(nullptr);
+  readahead_.lock()->contents.reset();
   state->hash = folly::none;
+  state->size = folly::none;
 
   return makeFuture();
 }
@@ -382,49 +946,128 @@ Future<Unit> FileData::materializeForWrite(int openFlags) {
 Hash FileData::getSha1() {
   auto state = inode_->state_.wlock();
   if (file_) {
-    std::string shastr;
-    if (sha1Valid_) {
-      shastr = fgetxattr(file_.fd(), kXattrSha1);
+    flushWriteBuffer();
+    if (!sha1_ && sha1MaybeSaved_) {
+      struct stat st;
+      checkUnixError(fstat(file_.fd(), &st));
+      sha1_ = inode_->getMount()->getOverlay()->loadFileSha1(
+          inode_->getNodeId(), st);
     }
-    if (shastr.empty()) {
-      return recomputeAndStoreSha1(state);
-    } else {
-      return Hash(shastr);
+    if (sha1_) {
+      return sha1_.value();
     }
+    return recomputeAndStoreSha1(state);
   }
 
   CHECK(state->hash.hasValue());
   return getObjectStore()->getSha1ForBlob(state->hash.value());
 }
 
+folly::Optional<Hash> FileData::getCachedSha1(
+    const folly::Synchronized<FileInode::State>::LockedPtr& state,
+    uint64_t* size) {
+  DCHECK(!state->hash.hasValue());
+  struct stat st;
+  if (file_) {
+    flushWriteBuffer();
+    checkUnixError(fstat(file_.fd(), &st));
+  } else {
+    checkUnixError(stat(inode_->getLocalPath().c_str(), &st));
+  }
+  *size = st.st_size;
+
+  if (sha1_) {
+    return sha1_;
+  }
+  if (!sha1MaybeSaved_) {
+    return folly::none;
+  }
+  auto sha1 =
+      inode_->getMount()->getOverlay()->loadFileSha1(inode_->getNodeId(), st);
+  if (file_) {
+    sha1_ = sha1;
+  }
+  return sha1;
+}
+
 ObjectStore* FileData::getObjectStore() const {
   return inode_->getMount()->getObjectStore();
 }
 
+std::shared_ptr<const Blob> FileData::loadBlob(const Hash& hash) {
+  auto* objectStore = getObjectStore();
+  const auto& blobCache = objectStore->getBlobCache();
+  auto useCache = blobCache && blobCache->getMaxBytes() > 0;
+  std::shared_ptr<const Blob> blob;
+  if (useCache) {
+    blob = blobCache->get(hash);
+    if (blob) {
+      return blob;
+    }
+  }
+
+  // Blobs in the pack are read straight from the mapped pages.  Blobs loaded
+  // from the store are copied into it, and the copy is used from then on so
+  // that the heap allocated contents can be freed right away.
+  const auto& blobPack = objectStore->getBlobPack();
+  if (blobPack) {
+    blob = blobPack->get(hash);
+  }
+  if (!blob) {
+    blob = objectStore->getBlob(hash);
+    if (blobPack) {
+      auto packed = blobPack->insert(*blob);
+      if (packed) {
+        blob = std::move(packed);
+      }
+    }
+  }
+  if (useCache) {
+    blobCache->insert(blob);
+  }
+  return blob;
+}
+
 Hash FileData::recomputeAndStoreSha1(
     const folly::Synchronized<FileInode::State>::LockedPtr& state) {
-  uint8_t buf[8192];
-  off_t off = 0;
-  SHA_CTX ctx;
-  SHA1_Init(&ctx);
+  // OpenSSL picks the SHA-1 implementation for the CPU at runtime, and uses
+  // the SHA extensions (SHA-NI, or the ARMv8 crypto extensions) where they
+  // are available.  What's left is keeping it fed, so read in large chunks,
+  // and let the kernel know to read ahead of us.
+  ensureBaseLoaded();
+  flushWriteBuffer();
+  auto bufferSize = std::max<int32_t>(FLAGS_overlay_sha1_buffer_size, 4096);
+  auto buf = std::make_unique<uint8_t[]>(bufferSize);
+#ifndef __APPLE__
+  // This is only a hint, so don't fail if it is not supported.
+  posix_fadvise(file_.fd(), sha1PrefixSize_, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 
+  // Only the part after the prefix we have already hashed needs reading.
+  // The prefix is extended as we go, so that it is still consistent if a
+  // read fails part way through.
   while (true) {
+    auto off = sha1PrefixSize_;
     // Using pread here so that we don't move the file position;
     // the file descriptor is shared between multiple file handles
     // and while we serialize the requests to FileData, it seems
     // like a good property of this function to avoid changing that
     // state.
-    auto len = folly::preadNoInt(file_.fd(), buf, sizeof(buf), off);
+    ssize_t len = baseHash_
+        ? static_cast<ssize_t>(readCow(buf.get(), bufferSize, off))
+        : folly::preadNoInt(file_.fd(), buf.get(), bufferSize, off);
     if (len == 0) {
       break;
     }
     if (len == -1) {
       folly::throwSystemError();
     }
-    SHA1_Update(&ctx, buf, len);
-    off += len;
+    SHA1_Update(&sha1Prefix_, buf.get(), len);
+    sha1PrefixSize_ += len;
   }
 
+  // Finalize a copy, so that the prefix state can still be extended.
+  auto ctx = sha1Prefix_;
   uint8_t digest[SHA_DIGEST_LENGTH];
   SHA1_Final(digest, &ctx);
   auto sha1 = Hash(folly::ByteRange(digest, sizeof(digest)));
@@ -435,16 +1078,178 @@ Hash FileData::recomputeAndStoreSha1(
 void FileData::storeSha1(
     const folly::Synchronized<FileInode::State>::LockedPtr& /* state */,
     Hash sha1) {
+  sha1_ = sha1;
+  sha1MaybeSaved_ = true;
   try {
-    fsetxattr(file_.fd(), kXattrSha1, sha1.toString());
-    sha1Valid_ = true;
+    flushWriteBuffer();
+    struct stat st;
+    checkUnixError(fstat(file_.fd(), &st));
+    inode_->getMount()->getOverlay()->saveFileSha1(
+        inode_->getNodeId(), sha1, st);
   } catch (const std::exception& ex) {
-    // If something goes wrong storing the attribute just log a warning
-    // and leave sha1Valid_ as false.  We'll have to recompute the value
-    // next time we need it.
-    LOG(WARNING) << "error setting SHA1 attribute in the overlay: "
+    // If something goes wrong saving the SHA-1 just log a warning.  We'll
+    // have to recompute it the next time the file is loaded.
+    LOG(WARNING) << "error saving SHA-1 in the overlay: "
                  << folly::exceptionStr(ex);
   }
 }
+
+void FileData::saveSha1IfCheap(
+    const folly::Synchronized<FileInode::State>::LockedPtr& state) {
+  // Only finish computing the SHA-1 if the writes have already hashed the
+  // whole file.  Otherwise it is left until something asks for it, rather
+  // than reading the file back every time it is closed.
+  if (sha1_) {
+    return;
+  }
+  flushWriteBuffer();
+  struct stat st;
+  checkUnixError(fstat(file_.fd(), &st));
+  if (st.st_size == sha1PrefixSize_) {
+    recomputeAndStoreSha1(state);
+  }
+}
+
+void FileData::shareContentsIfEligible(
+    const folly::Synchronized<FileInode::State>::LockedPtr& state) {
+  // Copy-on-write files keep most of their contents in the base blob, so
+  // there is little to gain from sharing them.
+  if (FLAGS_overlay_dedupe_min_size <= 0 || sharedContents_ || baseHash_ ||
+      !sha1_ || overlaySize_ < FLAGS_overlay_dedupe_min_size) {
+    return;
+  }
+  try {
+    auto* overlay = inode_->getMount()->getOverlay();
+    if (overlay->shareFileContents(inode_->getNodeId(), sha1_.value())) {
+      reopenFile();
+      sharedContents_ = true;
+      // Sharing may have moved the modification time the saved SHA-1 is
+      // tagged with.
+      storeSha1(state, sha1_.value());
+      fbData->incrementCounter("inodes.overlay.shared");
+    }
+  } catch (const std::exception& ex) {
+    // The file keeps its own copy of its contents.
+    LOG(WARNING) << "error sharing the overlay data for "
+                 << inode_->getLogPath() << ": " << folly::exceptionStr(ex);
+  }
+}
+
+void FileData::unshareContents(uint64_t size) {
+  if (!sharedContents_) {
+    return;
+  }
+  inode_->getMount()->getOverlay()->unshareFileContents(
+      inode_->getNodeId(), size);
+  reopenFile();
+  sharedContents_ = false;
+}
+
+void FileData::reopenFile() {
+  file_ = folly::File(inode_->getLocalPath().c_str(), O_RDWR | O_NOFOLLOW);
+}
+
+bool FileData::bufferWrite(off_t off, const iovec* iov, size_t count) {
+  size_t size = 0;
+  for (size_t n = 0; n < count; ++n) {
+    size += iov[n].iov_len;
+  }
+  auto maxSize = static_cast<size_t>(
+      std::max<int64_t>(FLAGS_overlay_write_buffer_size, 0));
+  // Copy-on-write files need each write to go through prepareCowWrite(), so
+  // they are never buffered.
+  auto buffered = size < maxSize && !baseHash_;
+
+  auto buffer = writeBuffer_.lock();
+  auto bufferEnd = buffer->offset + static_cast<off_t>(buffer->data.size());
+  if (!buffer->data.empty() && (!buffered || off != bufferEnd)) {
+    writeOut(*buffer);
+  }
+  if (!buffered) {
+    return false;
+  }
+
+  if (buffer->data.empty()) {
+    buffer->offset = off;
+  }
+  for (size_t n = 0; n < count; ++n) {
+    buffer->data.append(
+        static_cast<const char*>(iov[n].iov_base), iov[n].iov_len);
+  }
+  if (buffer->data.size() >= maxSize) {
+    writeOut(*buffer);
+  }
+  return true;
+}
+
+void FileData::flushWriteBuffer() {
+  if (file_) {
+    writeOut(*writeBuffer_.lock());
+  }
+}
+
+void FileData::flushWriteBuffer(off_t off, size_t size) {
+  // Reads after the buffered range depend on it too, since it may extend
+  // the file.
+  auto buffer = writeBuffer_.lock();
+  if (file_ && off + static_cast<off_t>(size) > buffer->offset) {
+    writeOut(*buffer);
+  }
+}
+
+void FileData::writeOut(WriteBuffer& buffer) {
+  if (buffer.data.empty()) {
+    return;
+  }
+  auto result = folly::pwriteFull(
+      file_.fd(), buffer.data.data(), buffer.data.size(), buffer.offset);
+  // Drop the data even if the write failed, rather than failing every later
+  // operation on the file too.
+  buffer.data.clear();
+  checkUnixError(result, "error writing buffered data to the overlay");
+}
+
+void FileData::invalidateSha1(off_t off) {
+  sha1_.reset();
+  if (sha1MaybeSaved_) {
+    inode_->getMount()->getOverlay()->removeFileSha1(inode_->getNodeId());
+    sha1MaybeSaved_ = false;
+  }
+  if (off < sha1PrefixSize_) {
+    resetSha1Prefix();
+  }
+}
+
+void FileData::setOverlaySize(off_t size) {
+  inode_->getMount()->getOverlay()->updateUsage(0, size - overlaySize_);
+  overlaySize_ = size;
+}
+
+void FileData::growOverlaySize(off_t end) {
+  if (end > overlaySize_) {
+    setOverlaySize(end);
+  }
+}
+
+void FileData::extendSha1Prefix(
+    off_t off,
+    const iovec* iov,
+    size_t count,
+    size_t size) {
+  if (off != sha1PrefixSize_) {
+    return;
+  }
+  for (size_t n = 0; n < count && size > 0; ++n) {
+    auto len = std::min(size, iov[n].iov_len);
+    SHA1_Update(&sha1Prefix_, iov[n].iov_base, len);
+    sha1PrefixSize_ += len;
+    size -= len;
+  }
+}
+
+void FileData::resetSha1Prefix() {
+  SHA1_Init(&sha1Prefix_);
+  sha1PrefixSize_ = 0;
+}
 }
 }
@@ -9,18 +9,20 @@
  */
 #pragma once
 #include <folly/File.h>
+#include <folly/Optional.h>
 #include <folly/Portability.h>
+#include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
 #include <folly/io/IOBuf.h>
+#include <openssl/sha.h>
+#include <sys/uio.h>
+#include <atomic>
 #include <mutex>
+#include <string>
 #include "eden/fs/inodes/FileInode.h"
+#include "eden/fs/model/Hash.h"
 #include "eden/fs/model/Tree.h"
 
-namespace folly {
-template <typename T>
-class Optional;
-}
-
 namespace facebook {
 namespace eden {
 namespace fusell {
@@ -28,10 +30,17 @@ class BufVec;
 }
 
 class Blob;
-class Hash;
 class ObjectStore;
 class Overlay;
 
+/**
+ * The SHA-1 state after hashing the first size bytes of a materialized file.
+ */
+struct Sha1Prefix {
+  SHA_CTX ctx;
+  off_t size{0};
+};
+
 /**
  * FileData stores information about a file contents.
  *
@@ -44,8 +53,16 @@ class Overlay;
  */
 class FileData {
  public:
-  /** Construct a FileData from an overlay entry */
-  FileData(FileInode* inode, const folly::Optional<Hash>& hash);
+  /**
+   * Construct a FileData from an overlay entry.
+   *
+   * sha1Prefix is the state that an earlier FileData for the same
+   * materialized file returned from takeSha1Prefix(), if any.
+   */
+  FileData(
+      FileInode* inode,
+      const folly::Optional<Hash>& hash,
+      std::unique_ptr<Sha1Prefix> sha1Prefix = nullptr);
 
   /** Construct a freshly created FileData from a pre-opened File object.
    * file must be moved in (it has no copy constructor) and must have
@@ -54,6 +71,9 @@ class FileData {
    * O_EXCL correctly. */
   FileData(FileInode* inode, folly::File&& file);
 
+  /** Writes out any buffered writes. */
+  ~FileData();
+
   /**
    * Read up to size bytes from the file at the specified offset.
    *
@@ -66,12 +86,59 @@ class FileData {
    * May throw exceptions on error.
    */
   std::unique_ptr<folly::IOBuf> readIntoBuffer(size_t size, off_t off);
-  fusell::BufVec read(size_t size, off_t off);
+
+  /**
+   * Read up to size bytes at the specified offset of a file whose Blob has
+   * not been loaded, without loading the whole Blob.
+   *
+   * This reads just the covering part of the Blob from the LocalStore, along
+   * with up to readahead bytes after it, which are kept to serve the reads
+   * that follow.  Returns nullptr if the file is materialized or its Blob is
+   * loaded, in which case the caller should use read() instead.  If the
+   * LocalStore cannot serve partial reads of the Blob, this loads the whole
+   * Blob and returns nullptr.
+   */
+  std::unique_ptr<folly::IOBuf>
+  readRange(size_t size, off_t off, size_t readahead);
+
+  /**
+   * Returns true if this file is not materialized and its Blob can be read
+   * with readRange(), so opening it for reading does not have to load the
+   * whole Blob.
+   */
+  bool canReadRanges();
+
+  /**
+   * Read from the file.  Materialized files are read through the overlay's
+   * io_uring if it has one, in which case the Future completes once the
+   * disk has returned the data.
+   */
+  folly::Future<fusell::BufVec> read(size_t size, off_t off);
   size_t write(fusell::BufVec&& buf, off_t off);
   size_t write(folly::StringPiece data, off_t off);
   struct stat stat();
+
+  /**
+   * Get the stat information for this file without loading its contents.
+   *
+   * For a file that is not materialized and whose Blob has not been loaded,
+   * the size comes from the source control Tree if the backing store
+   * supplied it, and otherwise from the Blob's metadata in the ObjectStore,
+   * which is much cheaper than loading the Blob itself.  This makes listing
+   * the attributes of every file in a directory affordable.
+   */
+  folly::Future<struct stat> getAttr();
+
+  /**
+   * Write out any buffered writes, and save the SHA-1 if the writes have
+   * already computed it.
+   */
   void flush(uint64_t lock_owner);
-  void fsync(bool datasync);
+  /**
+   * Write out any buffered writes and sync the overlay file to disk.  The
+   * sync goes through the overlay's io_uring if it has one.
+   */
+  folly::Future<folly::Unit> fsync(bool datasync);
 
   /// Change attributes for this inode.
   // attr is a standard struct stat.  Only the members indicated
@@ -83,6 +150,27 @@ class FileData {
   /// Returns the sha1 hash of the content.
   Hash getSha1();
 
+  /**
+   * Get the SHA-1 of a materialized file if it is already known, without
+   * reading the file, and store the file size in size.
+   *
+   * The caller must hold the inode's state lock.
+   */
+  folly::Optional<Hash> getCachedSha1(
+      const folly::Synchronized<FileInode::State>::LockedPtr& state,
+      uint64_t* size);
+
+  /**
+   * Hand over the SHA-1 state of the part of a materialized file that has
+   * been hashed, so that the next FileData for the file can carry on from
+   * it.  Without this, appending to a file after reopening it would have to
+   * hash the whole file again.  Returns nullptr if nothing has been hashed.
+   *
+   * The caller must hold the inode's state lock, and be about to release
+   * this FileData.
+   */
+  std::unique_ptr<Sha1Prefix> takeSha1Prefix();
+
   /**
    * Read the entire file contents, and return them as a string.
    *
@@ -111,16 +199,145 @@ class FileData {
    */
   FOLLY_WARN_UNUSED_RESULT folly::Future<folly::Unit> ensureDataLoaded();
 
+  /**
+   * Get the total size of the Blobs held by all FileData objects in the
+   * process.  Blobs shared with the BlobCache or between files with the same
+   * contents are counted once per FileData.
+   */
+  static size_t getTotalBlobBytes();
+
  private:
   ObjectStore* getObjectStore() const;
 
-  /// Recompute the SHA1 content hash of the open file_.
+  /** Replace blob_, keeping getTotalBlobBytes() up to date. */
+  void setBlob(std::shared_ptr<const Blob> blob);
+
+  /**
+   * Load the Blob with the specified hash, using the ObjectStore's BlobCache
+   * if it has one, so that FileData objects with the same contents share
+   * the same Blob.
+   */
+  std::shared_ptr<const Blob> loadBlob(const Hash& hash);
+
+  /**
+   * Create the overlay file for a copy-on-write materialization of the blob
+   * with the specified hash and size.
+   *
+   * Returns false without creating anything if the overlay filesystem can't
+   * report holes in sparse files, in which case the caller has to copy the
+   * blob contents instead.
+   */
+  bool createCowFile(
+      AbsolutePathPiece filePath,
+      const Hash& baseHash,
+      uint64_t size);
+
+  /** Read the base blob hash stored on a copy-on-write overlay file. */
+  void loadBaseHash();
+  /** Load the base blob of a copy-on-write file if it isn't already. */
+  void ensureBaseLoaded();
+  /**
+   * Copy size bytes of the base blob at off into dest, filling anything past
+   * the end of the blob with zeros.
+   */
+  void readBase(uint8_t* dest, size_t size, off_t off);
+  /**
+   * Read from a copy-on-write file, taking the holes in the overlay file from
+   * the base blob.  Behaves like pread().
+   */
+  size_t readCow(uint8_t* dest, size_t size, off_t off);
+  /** Fill any holes in [start, end) in the overlay file from the base blob */
+  void copyBaseIntoHoles(off_t start, off_t end);
+  /**
+   * Prepare for a write of size bytes at off to a copy-on-write file.
+   *
+   * The filesystem tracks holes per block, so the parts of the first and last
+   * blocks that the write does not cover are filled from the base blob first.
+   */
+  void prepareCowWrite(off_t off, size_t size);
+  /**
+   * Turn a copy-on-write file into an ordinary materialized file that no
+   * longer depends on its base blob, copying the base data for the holes in
+   * the first size bytes.  The caller is about to truncate the file to size.
+   */
+  void detachBase(off_t size);
+
+  /**
+   * Add a write of the data in iov to the write buffer, if it is small
+   * enough to be buffered.
+   *
+   * Returns false if the caller has to write the data to the overlay file
+   * itself.  Any buffered data has been written out by then, so that the
+   * writes reach the file in order.  The caller must hold the inode's state
+   * lock for writing.
+   */
+  bool bufferWrite(off_t off, const iovec* iov, size_t count);
+  /**
+   * Write out the write buffer, if it holds any data.  This is a no-op for
+   * files that are not materialized.  The caller must hold the inode's state
+   * lock.
+   */
+  void flushWriteBuffer();
+  /** Write out the write buffer if a read of [off, off + size) needs it. */
+  void flushWriteBuffer(off_t off, size_t size);
+  struct WriteBuffer;
+  /** Write a locked write buffer's data to the overlay file, and empty it */
+  void writeOut(WriteBuffer& buffer);
+
+  /**
+   * Compute the stat information for a file that is not materialized, given
+   * the size of its Blob.
+   */
+  struct stat unmaterializedStat(const FileInode::State& state, uint64_t size);
+
+  /**
+   * Recompute the SHA1 content hash of the open file_, reading only the part
+   * after sha1PrefixSize_.
+   */
   Hash recomputeAndStoreSha1(
       const folly::Synchronized<FileInode::State>::LockedPtr& state);
   void storeSha1(
       const folly::Synchronized<FileInode::State>::LockedPtr& state,
       Hash sha1);
 
+  /**
+   * Forget the SHA-1 of a materialized file whose contents are about to
+   * change from offset off onwards.
+   */
+  void invalidateSha1(off_t off);
+  /**
+   * Save the SHA-1 of a file that was just written, if the writes have
+   * already computed it.
+   */
+  void saveSha1IfCheap(
+      const folly::Synchronized<FileInode::State>::LockedPtr& state);
+  /**
+   * Share the overlay file with the other materialized files with the same
+   * contents, if --overlay_dedupe_min_size allows and the SHA-1 is known.
+   * Failures are only logged.
+   */
+  void shareContentsIfEligible(
+      const folly::Synchronized<FileInode::State>::LockedPtr& state);
+  /**
+   * Give the file its own copy of the first size bytes of its contents, if
+   * they are shared, before its contents or timestamps change.
+   */
+  void unshareContents(uint64_t size);
+  /** Reopen file_, after the overlay has replaced the overlay file. */
+  void reopenFile();
+
+  /** Add size bytes just written at off to sha1Prefix_, if they extend it */
+  void extendSha1Prefix(off_t off, const iovec* iov, size_t count, size_t size);
+  void resetSha1Prefix();
+
+  /**
+   * Report a new size of the overlay file to the overlay's usage accounting.
+   * The caller must hold the inode's state lock for writing.
+   */
+  void setOverlaySize(off_t size);
+  /** Like setOverlaySize(), after a write that ends at end */
+  void growOverlaySize(off_t end);
+
   /**
    * The FileInode that this FileData object belongs to.
    *
@@ -130,14 +347,98 @@ class FileData {
    */
   FileInode* const inode_{nullptr};
 
-  /// if backed by tree, the data from the tree, else nullptr.
-  std::unique_ptr<Blob> blob_;
+  /**
+   * if backed by tree, the data from the tree.  For a copy-on-write
+   * materialized file, the base blob once it has been loaded.  Otherwise
+   * nullptr.
+   */
+  std::shared_ptr<const Blob> blob_;
+
+  /**
+   * For a copy-on-write materialized file, the hash of the blob holding the
+   * contents of the ranges that have not been written.
+   *
+   * Such a file is created as a sparse file of the blob's size, so every
+   * block that has not been written is a hole.  Reads take written blocks
+   * from the overlay file and holes from the blob, so materializing a large
+   * file for a small write does not copy the whole blob.  The hash is also
+   * stored in an extended attribute on the overlay file, so it is kept when
+   * the inode is unloaded.
+   */
+  folly::Optional<Hash> baseHash_;
 
   /// if backed by an overlay file, the open file descriptor
   folly::File file_;
 
-  /// if backed by an overlay file, whether the sha1 xattr is valid
-  bool sha1Valid_{false};
+  /**
+   * If backed by an overlay file, the SHA-1 of its contents if we know it.
+   * Any change to the contents resets it.
+   */
+  folly::Optional<Hash> sha1_;
+
+  /**
+   * Whether the overlay may have a SHA-1 saved for this file.
+   *
+   * The saved SHA-1 is removed before the contents first change, rather than
+   * relying on the size and modification time it is tagged with: a write may
+   * not change the size, and the modification time has limited resolution.
+   */
+  bool sha1MaybeSaved_{true};
+
+  /**
+   * Whether the overlay file is a hard link to contents shared with other
+   * files, which must be unshared before they are changed.
+   */
+  bool sharedContents_{false};
+
+  /**
+   * The size of the overlay file, as last reported to Overlay::updateUsage().
+   * This includes data still in the write buffer.
+   */
+  off_t overlaySize_{0};
+
+  /**
+   * If backed by an overlay file, the SHA-1 state after hashing its first
+   * sha1PrefixSize_ bytes.  Writes starting at sha1PrefixSize_ extend it, so
+   * files that are written sequentially or appended to never have to be read
+   * back to compute their SHA-1.  Changes before sha1PrefixSize_ reset it to
+   * the start of the file.
+   */
+  SHA_CTX sha1Prefix_;
+  off_t sha1PrefixSize_{0};
+
+  /**
+   * Sequential small writes to the overlay file that have not been written
+   * to it yet, and the offset in the file that they start at.
+   *
+   * Tools that write files a few bytes at a time would otherwise make one
+   * pwrite() call per FUSE write request.  The buffer is written out once
+   * it reaches --overlay_write_buffer_size, before any write that does not
+   * continue it, and before anything reads from or inspects the overlay
+   * file.  It is only used while the inode's state lock is held, but reads
+   * only hold that for reading, so it has a lock of its own too.
+   */
+  struct WriteBuffer {
+    off_t offset{0};
+    std::string data;
+  };
+  folly::Synchronized<WriteBuffer, std::mutex> writeBuffer_;
+
+  /**
+   * The data read ahead of the last readRange() call, and the offset in the
+   * file that it starts at.
+   */
+  struct ReadaheadBuffer {
+    off_t offset{0};
+    std::unique_ptr<folly::IOBuf> contents;
+  };
+  folly::Synchronized<ReadaheadBuffer, std::mutex> readahead_;
+
+  /**
+   * Set once the LocalStore turns out not to be able to serve partial reads
+   * of this file's Blob, so that readRange() does not keep asking.
+   */
+  std::atomic<bool> rangeReadsUnsupported_{false};
 };
 }
 }
@@ -9,12 +9,20 @@
  */
 #include "eden/fs/inodes/FileHandle.h"
 
+#include <fcntl.h>
+#include <gflags/gflags.h>
+#include <algorithm>
 #include "eden/fs/inodes/EdenMount.h"
 #include "eden/fs/inodes/FileData.h"
 #include "eden/fs/inodes/FileInode.h"
 #include "eden/fs/inodes/TreeInode.h"
 #include "eden/fs/store/LocalStore.h"
 
+DEFINE_int64(
+    max_readahead_bytes,
+    4 * 1024 * 1024,
+    "The most data to read ahead of sequential reads of large files that "
+    "have not been loaded");
 
 namespace facebook {
 namespace eden {
@@ -22,8 +30,14 @@ namespace eden {
 FileHandle::FileHandle(
     FileInodePtr inode,
     std::shared_ptr<FileData> data,
-    int flags)
-    : inode_(std::move(inode)), data_(std::move(data)), openFlags_(flags) {}
+    int flags,
+    bool committed)
+    : inode_(std::move(inode)),
+      data_(std::move(data)),
+      openFlags_(flags),
+      committed_(committed),
+      materialized_((flags & O_ACCMODE) != O_WRONLY ||
+                    (flags & (O_CREAT | O_TRUNC)) != 0) {}
 
 FileHandle::~FileHandle() {
   // Must reset the data point prior to calling fileHandleDidClose,
@@ -44,6 +58,11 @@ folly::Future<fusell::Dispatcher::Attr> FileHandle::setattr(
 }
 
 bool FileHandle::preserveCache() const {
+  // Every change to a file's contents either goes through the kernel, which
+  // updates its cache as it writes, or is made by a checkout, which
+  // invalidates the inode.  So the kernel can keep its cached pages across
+  // opens.  This matters most for unmaterialized files, which programs such
+  // as compilers tend to open and read over and over.
   return true;
 }
 
@@ -52,17 +71,52 @@ bool FileHandle::isSeekable() const {
 }
 
 folly::Future<fusell::BufVec> FileHandle::read(size_t size, off_t off) {
+  if (committed_) {
+    inode_->recordCommittedRead(size, off);
+  }
+  // Large files opened for reading are read from the LocalStore a range at a
+  // time, rather than loaded whole.  readRange() loads the data if that is
+  // not possible, which also covers reads through a write-only handle, which
+  // the kernel may make to fill its cache.
+  auto contents = data_->readRange(size, off, updateReadahead(size, off));
+  if (contents) {
+    return fusell::BufVec(std::move(contents));
+  }
   return data_->read(size, off);
 }
 
+size_t FileHandle::updateReadahead(size_t size, off_t off) {
+  auto sequential = nextReadOffset_.exchange(off + size) == off;
+  if (!sequential) {
+    readaheadSize_.store(0);
+    return 0;
+  }
+  auto readahead = std::min<size_t>(
+      FLAGS_max_readahead_bytes,
+      std::max(2 * readaheadSize_.load(), size));
+  readaheadSize_.store(readahead);
+  return readahead;
+}
+
+void FileHandle::ensureMaterialized() {
+  if (materialized_.load(std::memory_order_acquire)) {
+    return;
+  }
+  data_->materializeForWrite(openFlags_).get();
+  inode_->materializeInParent();
+  materialized_.store(true, std::memory_order_release);
+}
+
 folly::Future<size_t> FileHandle::write(fusell::BufVec&& buf, off_t off) {
   SCOPE_SUCCESS {
     auto myname = inode_->getPath();
     if (myname.hasValue()) {
-      inode_->getMount()->getJournal().wlock()->addDelta(
+      inode_->getMount()->getJournal().addDelta(
           std::make_unique<JournalDelta>(JournalDelta{myname.value()}));
     }
+    inode_->invalidateParentDiffCache();
   };
+  ensureMaterialized();
   return data_->write(std::move(buf), off);
 }
 
@@ -70,10 +124,12 @@ folly::Future<size_t> FileHandle::write(folly::StringPiece str, off_t off) {
   SCOPE_SUCCESS {
     auto myname = inode_->getPath();
     if (myname.hasValue()) {
-      inode_->getMount()->getJournal().wlock()->addDelta(
+      inode_->getMount()->getJournal().addDelta(
           std::make_unique<JournalDelta>(JournalDelta{myname.value()}));
     }
+    inode_->invalidateParentDiffCache();
   };
+  ensureMaterialized();
   return data_->write(str, off);
 }
 
@@ -83,8 +139,7 @@ folly::Future<folly::Unit> FileHandle::flush(uint64_t lock_owner) {
 }
 
 folly::Future<folly::Unit> FileHandle::fsync(bool datasync) {
-  data_->fsync(datasync);
-  return folly::Unit{};
+  return data_->fsync(datasync);
 }
 }
 }
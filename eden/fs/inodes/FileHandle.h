@@ -8,6 +8,7 @@
  *
  */
 #pragma once
+#include <atomic>
 #include "eden/fs/inodes/InodePtr.h"
 #include "eden/fuse/FileHandle.h"
 
@@ -21,10 +22,16 @@ class LocalStore;
 
 class FileHandle : public fusell::FileHandle {
  public:
-  explicit FileHandle(
+  /**
+   * committed should be true if the file was unmaterialized when it was
+   * opened read-only.  Reads through the handle are then recorded with
+   * FileInode::recordCommittedRead().
+   */
+  FileHandle(
       FileInodePtr inode,
       std::shared_ptr<FileData> data,
-      int flags);
+      int flags,
+      bool committed = false);
   ~FileHandle();
 
   folly::Future<fusell::Dispatcher::Attr> getattr() override;
@@ -40,10 +47,39 @@ class FileHandle : public fusell::FileHandle {
   folly::Future<folly::Unit> flush(uint64_t lock_owner) override;
   folly::Future<folly::Unit> fsync(bool datasync) override;
 
+  const FileInodePtr& getInode() const {
+    return inode_;
+  }
+
+  /** Returns the flags that the file was opened with. */
+  int getOpenFlags() const {
+    return openFlags_;
+  }
+
  private:
+  /**
+   * Materialize the file before the first write through a handle that
+   * FileInode::open() did not materialize.
+   */
+  void ensureMaterialized();
+
+  /**
+   * Record a read of size bytes at off, and return how many bytes to read
+   * ahead of it.
+   *
+   * The readahead window doubles with each sequential read, up to
+   * --max_readahead_bytes, and is reset by a read anywhere else.
+   */
+  size_t updateReadahead(size_t size, off_t off);
+
   FileInodePtr inode_;
   std::shared_ptr<FileData> data_;
   int openFlags_;
+  const bool committed_;
+  std::atomic<bool> materialized_;
+  /** The offset just past the end of the last read. */
+  std::atomic<off_t> nextReadOffset_{0};
+  std::atomic<size_t> readaheadSize_{0};
 };
 }
 }
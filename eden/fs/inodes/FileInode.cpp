@@ -16,8 +16,12 @@
 #include "Overlay.h"
 #include "TreeInode.h"
 #include "eden/fs/model/Blob.h"
+#include "common/stats/ServiceData.h"
 #include "eden/fs/model/Hash.h"
+#include "eden/fs/store/BlobMetadata.h"
+#include "eden/fs/store/LocalStore.h"
 #include "eden/fs/store/ObjectStore.h"
+#include "eden/utils/SlabPool.h"
 #include "eden/utils/XAttr.h"
 
 using folly::checkUnixError;
@@ -31,33 +35,60 @@ using std::vector;
 namespace facebook {
 namespace eden {
 
+namespace {
+// These pools are leaked, since inodes may outlive static destruction.
+SlabPool* const fileInodePool = new SlabPool("file_inode", sizeof(FileInode));
+// FileData is allocated together with its shared_ptr control block, whose
+// size is only known to std::allocate_shared().
+SlabPool* const fileDataPool = new SlabPool("file_data", 0);
+
+template <typename... Args>
+std::shared_ptr<FileData> makeFileData(Args&&... args) {
+  return std::allocate_shared<FileData>(
+      SlabAllocator<FileData>(fileDataPool), std::forward<Args>(args)...);
+}
+}
+
+void* FileInode::operator new(size_t size) {
+  return fileInodePool->allocate(size);
+}
+
+void FileInode::operator delete(void* ptr, size_t size) {
+  fileInodePool->deallocate(ptr, size);
+}
+
 FileInode::State::State(
     FileInode* inode,
     mode_t m,
-    const folly::Optional<Hash>& h)
-    : data(std::make_shared<FileData>(inode, h)),
+    const folly::Optional<Hash>& h,
+    folly::Optional<uint64_t> s)
+    : data(makeFileData(inode, h)),
       mode(m),
       creationTime(std::chrono::system_clock::now()),
-      hash(h) {}
+      hash(h),
+      size(h.hasValue() ? s : folly::none) {}
 
 FileInode::State::State(
     FileInode* inode,
     mode_t m,
     folly::File&& file,
     dev_t rdev)
-    : data(std::make_shared<FileData>(inode, std::move(file))),
+    : data(makeFileData(inode, std::move(file))),
       mode(m),
       rdev(rdev),
       creationTime(std::chrono::system_clock::now()) {}
 
+FileInode::State::~State() {}
+
 FileInode::FileInode(
     fuse_ino_t ino,
     TreeInodePtr parentInode,
     PathComponentPiece name,
     mode_t mode,
-    const folly::Optional<Hash>& hash)
+    const folly::Optional<Hash>& hash,
+    folly::Optional<uint64_t> size)
     : InodeBase(ino, std::move(parentInode), name),
-      state_(folly::construct_in_place, this, mode, hash) {}
+      state_(folly::construct_in_place, this, mode, hash, size) {}
 
 FileInode::FileInode(
     fuse_ino_t ino,
@@ -72,14 +103,14 @@ FileInode::FileInode(
 folly::Future<fusell::Dispatcher::Attr> FileInode::getattr() {
   auto data = getOrLoadData();
 
-  // Future optimization opportunity: right now, if we have not already
-  // materialized the data from the entry, we have to materialize it
-  // from the store.  If we augmented our metadata we could avoid this,
-  // and this would speed up operations like `ls`.
-  return data->ensureDataLoaded().then([ self = inodePtrFromThis(), data ]() {
+  // getAttr() gets the size of unmaterialized files from the Blob metadata,
+  // so this does not have to load the file contents.
+  return data->getAttr().then([ self = inodePtrFromThis(), data ](
+      struct stat st) {
     auto attr = fusell::Dispatcher::Attr{self->getMount()->getMountPoint()};
-    attr.st = data->stat();
+    attr.st = st;
     attr.st.st_ino = self->getNodeId();
+    attr.timeout = getKernelCacheTtl(!self->state_.rlock()->hash.hasValue());
     return attr;
   });
 }
@@ -105,10 +136,12 @@ folly::Future<fusell::Dispatcher::Attr> FileInode::setattr(
             fusell::Dispatcher::Attr{self->getMount()->getMountPoint()};
         result.st = data->setAttr(attr, to_set);
         result.st.st_ino = self->getNodeId();
+        result.timeout = getKernelCacheTtl(true);
+        self->invalidateParentDiffCache();
 
         auto path = self->getPath();
         if (path.hasValue()) {
-          self->getMount()->getJournal().wlock()->addDelta(
+          self->getMount()->getJournal().addDelta(
               std::make_unique<JournalDelta>(JournalDelta{path.value()}));
         }
 
@@ -125,6 +158,14 @@ folly::Future<std::string> FileInode::readlink() {
       throw InodeError(EINVAL, inodePtrFromThis(), "not a symlink");
     }
 
+    // The target of an unmaterialized symlink only depends on its blob, so
+    // it can come from the ObjectStore's symlink cache without loading the
+    // FileData.
+    if (state->hash.hasValue()) {
+      return getMount()->getObjectStore()->getSymlinkTarget(
+          state->hash.value());
+    }
+
     data = getOrLoadData(state);
   }
 
@@ -140,7 +181,8 @@ std::shared_ptr<FileData> FileInode::getOrLoadData() {
 std::shared_ptr<FileData> FileInode::getOrLoadData(
     const folly::Synchronized<State>::LockedPtr& state) {
   if (!state->data) {
-    state->data = std::make_shared<FileData>(this, state->hash);
+    state->data = makeFileData(
+        this, state->hash, std::move(state->sha1Prefix));
   }
 
   return state->data;
@@ -150,7 +192,10 @@ void FileInode::fileHandleDidClose() {
   {
     auto state = state_.wlock();
     if (state->data.unique()) {
-      // We're the only remaining user, no need to keep it around
+      // We're the only remaining user, no need to keep it around.  Keep
+      // what it has hashed of the file though, so that appending to the
+      // file after reopening it does not have to hash it all again.
+      state->sha1Prefix = state->data->takeSha1Prefix();
       state->data.reset();
     }
   }
@@ -160,11 +205,18 @@ AbsolutePath FileInode::getLocalPath() const {
   return getMount()->getOverlay()->getFilePath(getNodeId());
 }
 
-bool FileInode::isSameAs(const Blob& blob, mode_t mode) {
-  // When comparing mode bits, we only care about the
-  // file type and owner permissions.
-  auto relevantModeBits = [](mode_t m) { return (m & (S_IFMT | S_IRWXU)); };
+namespace {
+// When comparing mode bits, we only care about the
+// file type and owner permissions.
+mode_t relevantModeBits(mode_t m) {
+  return (m & (S_IFMT | S_IRWXU));
+}
+}
 
+bool FileInode::isSameAs(
+    const Hash& blobID,
+    const Hash& blobSha1,
+    mode_t mode) {
   shared_ptr<FileData> data;
   {
     auto state = state_.wlock();
@@ -174,13 +226,132 @@ bool FileInode::isSameAs(const Blob& blob, mode_t mode) {
 
     if (state->hash.hasValue()) {
       // This file is not materialized, so we can just compare hashes
-      return state->hash.value() == blob.getHash();
+      return state->hash.value() == blobID;
     }
 
     data = getOrLoadData(state);
   }
 
-  return data->getSha1() == Hash::sha1(&blob.getContents());
+  return data->getSha1() == blobSha1;
+}
+
+Future<bool> FileInode::contentsMatch(
+    const Hash& blobID,
+    const BlobMetadata& blobMetadata) {
+  shared_ptr<FileData> data;
+  folly::Optional<Hash> hash;
+  {
+    auto state = state_.wlock();
+    hash = state->hash;
+    if (!hash.hasValue()) {
+      uint64_t size;
+      folly::Optional<Hash> sha1;
+      if (state->data) {
+        sha1 = state->data->getCachedSha1(state, &size);
+      } else {
+        // Don't load the FileData, which opens the overlay file, unless we
+        // find that we have to hash it.
+        struct stat st;
+        checkUnixError(stat(getLocalPath().c_str(), &st));
+        size = st.st_size;
+        sha1 = getMount()->getOverlay()->loadFileSha1(getNodeId(), st);
+      }
+      if (size != blobMetadata.size) {
+        return makeFuture(false);
+      }
+      if (sha1.hasValue()) {
+        return makeFuture(sha1.value() == blobMetadata.sha1);
+      }
+      data = getOrLoadData(state);
+    }
+  }
+
+  if (hash.hasValue()) {
+    if (hash.value() == blobID) {
+      return makeFuture(true);
+    }
+    // Different blobs may still have the same contents.
+    return getMount()->getObjectStore()->getBlobMetadata(hash.value()).then(
+        [blobMetadata](const BlobMetadata& metadata) {
+          return metadata.size == blobMetadata.size &&
+              metadata.sha1 == blobMetadata.sha1;
+        });
+  }
+
+  return makeFuture(data->getSha1() == blobMetadata.sha1);
+}
+
+bool FileInode::dematerializeIfSameAs(
+    const RenameLock& renameLock,
+    const Hash& blobID,
+    const BlobMetadata& blobMetadata,
+    mode_t mode) {
+  auto loc = getLocationInfo(renameLock);
+  if (!loc.parent || loc.unlinked) {
+    return false;
+  }
+
+  {
+    auto state = state_.wlock();
+    if (state->hash.hasValue() || !S_ISREG(state->mode) ||
+        relevantModeBits(state->mode) != relevantModeBits(mode)) {
+      return false;
+    }
+    // Open handles, and operations in progress such as setattr(), hold a
+    // reference to the FileData and may still change the overlay file.
+    // Nobody can take a new reference while we hold the state lock.
+    if (state->data && !state->data.unique()) {
+      return false;
+    }
+
+    auto data = getOrLoadData(state);
+    uint64_t size;
+    auto sha1 = data->getCachedSha1(state, &size);
+    if (!sha1.hasValue() || size != blobMetadata.size ||
+        sha1.value() != blobMetadata.sha1) {
+      return false;
+    }
+
+    state->hash = blobID;
+    state->size = blobMetadata.size;
+    state->data.reset();
+  }
+
+  // Only remove the overlay file once our parent refers to the blob instead.
+  loc.parent->childDematerialized(renameLock, loc.name, blobID);
+  getMount()->getOverlay()->removeOverlayData(getNodeId());
+  fbData->incrementCounter("inodes.dematerialized");
+  return true;
+}
+
+Future<Hash> FileInode::storeSnapshot(LocalStore* store) {
+  std::shared_ptr<FileData> data;
+  {
+    auto state = state_.wlock();
+    if (state->hash.hasValue()) {
+      return makeFuture(state->hash.value());
+    }
+    data = getOrLoadData(state);
+  }
+
+  return data->ensureDataLoaded().then(
+      [ self = inodePtrFromThis(), data, store ]() {
+        auto contents = data->readAll();
+        // Use the ID of the git blob object, which is the SHA-1 of the
+        // contents with a header.
+        auto header = folly::to<string>("blob ", contents.size());
+        header.push_back('\0');
+        auto buf = folly::IOBuf::copyBuffer(header);
+        buf->prependChain(
+            folly::IOBuf::wrapBuffer(contents.data(), contents.size()));
+        auto id = Hash::sha1(buf.get());
+
+        Blob blob(
+            id,
+            folly::IOBuf::wrapBufferAsValue(contents.data(), contents.size()));
+        store->putBlob(id, &blob);
+        return id;
+      });
 }
 
 mode_t FileInode::getMode() const {
@@ -198,6 +369,7 @@ folly::Optional<Hash> FileInode::getBlobHash() const {
 folly::Future<std::shared_ptr<fusell::FileHandle>> FileInode::open(
     const struct fuse_file_info& fi) {
   shared_ptr<FileData> data;
+  bool committed = false;
 
 // TODO: We currently should ideally call fileHandleDidClose() if we fail
 // to create a FileHandle.  It's currently slightly tricky to do this right
@@ -227,8 +399,18 @@ folly::Future<std::shared_ptr<fusell::FileHandle>> FileInode::open(
     }
 
     data = getOrLoadData(state);
+    committed = state->hash.hasValue();
   }
 
+  if ((fi.flags & O_ACCMODE) == O_WRONLY &&
+      (fi.flags & (O_CREAT | O_TRUNC)) == 0) {
+    // Nothing can be read through this handle, so wait for the first write
+    // before materializing.  Programs that open a file for writing and then
+    // truncate it with ftruncate() are common, and this way they never
+    // have to fetch the old contents.
+    return shared_ptr<fusell::FileHandle>{
+        std::make_shared<FileHandle>(inodePtrFromThis(), data, fi.flags)};
+  }
   if (fi.flags & (O_RDWR | O_WRONLY | O_CREAT | O_TRUNC)) {
     return data->materializeForWrite(fi.flags).then(
         [ self = inodePtrFromThis(), data, flags = fi.flags ]() {
@@ -237,22 +419,61 @@ folly::Future<std::shared_ptr<fusell::FileHandle>> FileInode::open(
               std::make_shared<FileHandle>(self, data, flags)};
         });
   } else {
+    if (committed) {
+      fbData->incrementCounter("inodes.open.keep_cache");
+      // Modified files are not recorded, since replaying fetches the
+      // contents the paths have in the source control snapshot.
+      auto& recorder = getMount()->getAccessRecorder();
+      if (recorder.isRecording()) {
+        auto path = getPath();
+        if (path.hasValue()) {
+          recorder.record(path.value());
+        }
+      }
+    }
+    if (data->canReadRanges()) {
+      // The FileHandle reads the file from the LocalStore as it is needed.
+      return shared_ptr<fusell::FileHandle>{std::make_shared<FileHandle>(
+          inodePtrFromThis(), data, fi.flags, committed)};
+    }
     return data->ensureDataLoaded().then(
-        [ self = inodePtrFromThis(), data, flags = fi.flags ]() {
+        [ self = inodePtrFromThis(), data, flags = fi.flags, committed ]() {
           return shared_ptr<fusell::FileHandle>{
-              std::make_shared<FileHandle>(self, data, flags)};
+              std::make_shared<FileHandle>(self, data, flags, committed)};
         });
   }
 }
 
+void FileInode::recordCommittedRead(size_t size, off_t off) {
+  auto end = static_cast<uint64_t>(off) + size;
+  auto previous = committedReadEnd_.load(std::memory_order_relaxed);
+  while (previous < end &&
+         !committedReadEnd_.compare_exchange_weak(
+             previous, end, std::memory_order_relaxed)) {
+  }
+  if (end <= previous) {
+    fbData->incrementCounter("inodes.read.kernel_cache_miss");
+  } else {
+    fbData->incrementCounter("inodes.read.first");
+  }
+}
+
 void FileInode::materializeInParent() {
-  auto renameLock = getMount()->acquireRenameLock();
+  auto renameLock = getMount()->acquireRenameLock(
+      "FileInode::materializeInParent");
   auto loc = getLocationInfo(renameLock);
   if (loc.parent && !loc.unlinked) {
     loc.parent->childMaterialized(renameLock, loc.name, getNodeId());
   }
 }
 
+void FileInode::invalidateParentDiffCache() {
+  auto parent = getParentBuggy();
+  if (parent) {
+    parent->invalidateDiffCache();
+  }
+}
+
 std::shared_ptr<FileHandle> FileInode::finishCreate() {
   auto data = getOrLoadData();
   SCOPE_EXIT {
@@ -302,10 +523,31 @@ Future<Hash> FileInode::getSHA1(bool failIfSymlink) {
   }
 
   if (hash.hasValue()) {
-    return getMount()->getObjectStore()->getSha1ForBlob(hash.value());
+    return getBlobSha1(hash.value());
   }
 
   return data->getSha1();
 }
+
+Future<Hash> FileInode::getBlobSha1(const Hash& blobID) {
+  // The SHA-1 of a non-materialized file always comes from its blob's
+  // metadata, so that asking for it never loads the file's contents.
+  const auto& store = getMount()->getObjectStore();
+  auto localMetadata = store->getLocalStore()->getBlobMetadata(blobID);
+  if (localMetadata.hasValue()) {
+    return localMetadata.value().sha1;
+  }
+
+  // Callers such as build tools tend to ask for the SHA-1 of every file in
+  // a directory, so fetch the metadata of this file's siblings along with
+  // its own.
+  fbData->incrementCounter("inodes.sha1.metadata_fetch");
+  auto parent = getParentBuggy();
+  if (parent) {
+    parent->prefetchChildMetadata();
+  }
+  return store->getBlobMetadata(blobID).then(
+      [](const BlobMetadata& metadata) { return metadata.sha1; });
+}
 }
 }
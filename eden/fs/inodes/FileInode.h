@@ -10,7 +10,9 @@
 #pragma once
 #include <folly/Optional.h>
 #include <folly/Synchronized.h>
+#include <atomic>
 #include <chrono>
+#include <memory>
 #include "eden/fs/inodes/InodeBase.h"
 #include "eden/fs/model/Tree.h"
 
@@ -21,10 +23,13 @@ class File;
 namespace facebook {
 namespace eden {
 
-class Blob;
+class BlobMetadata;
 class FileHandle;
 class FileData;
 class Hash;
+class LocalStore;
+class RenameLock;
+struct Sha1Prefix;
 
 class FileInode : public InodeBase {
  public:
@@ -36,7 +41,8 @@ class FileInode : public InodeBase {
       TreeInodePtr parentInode,
       PathComponentPiece name,
       mode_t mode,
-      const folly::Optional<Hash>& hash);
+      const folly::Optional<Hash>& hash,
+      folly::Optional<uint64_t> size = folly::none);
 
   /** Construct an inode using a freshly created overlay file.
    * file must be moved in and must have been created by a call to
@@ -50,6 +56,13 @@ class FileInode : public InodeBase {
       folly::File&& file,
       dev_t rdev = 0);
 
+  /**
+   * FileInodes are allocated from a SlabPool, since mount points can have
+   * millions of them loaded.
+   */
+  static void* operator new(size_t size);
+  static void operator delete(void* ptr, size_t size);
+
   folly::Future<fusell::Dispatcher::Attr> getattr() override;
   folly::Future<fusell::Dispatcher::Attr> setattr(
       const struct stat& attr,
@@ -78,10 +91,50 @@ class FileInode : public InodeBase {
    * Check to see if the file has the same contents as the specified blob
    * and the same mode.
    *
-   * This is more efficient than manually comparing the contents, as it can
-   * perform a simple hash check if the file is not materialized.
+   * blobID is the blob's ID, and blobSha1 is the SHA-1 of its contents.  If
+   * the file is not materialized this is a simple comparison against blobID,
+   * otherwise the file's SHA-1 is compared against blobSha1.  Neither case
+   * requires loading the blob contents.
+   */
+  bool isSameAs(const Hash& blobID, const Hash& blobSha1, mode_t mode);
+
+  /**
+   * Check whether the file contents are the same as those of the specified
+   * blob.  The file mode is not compared.
+   *
+   * The file size is compared against the blob's before anything else, so
+   * the file is only hashed if the sizes match.  A materialized file whose
+   * SHA-1 the overlay still has on record for its current size and mtime is
+   * checked without opening or hashing it at all.
+   */
+  folly::Future<bool> contentsMatch(
+      const Hash& blobID,
+      const BlobMetadata& blobMetadata);
+
+  /**
+   * Dematerialize this file if its contents match the specified blob again,
+   * so that its parent directory refers to the blob and the overlay file can
+   * be removed.
+   *
+   * This only compares the file size and its SHA-1 if that is already known,
+   * and never reads the file.  It does nothing and returns false if the file
+   * is in use, such as by an open file handle, or if it is not a regular
+   * file with the same mode as the blob.
+   */
+  bool dematerializeIfSameAs(
+      const RenameLock& renameLock,
+      const Hash& blobID,
+      const BlobMetadata& blobMetadata,
+      mode_t mode);
+
+  /**
+   * Store this file's contents in the LocalStore as a Blob, and return its
+   * ID, for TreeInode::storeSnapshot().
+   *
+   * Materialized files are read straight from the overlay, and stored under
+   * the ID git would give them.  Other files just return their blob ID.
    */
-  bool isSameAs(const Blob& blob, mode_t mode);
+  folly::Future<Hash> storeSnapshot(LocalStore* store);
 
   /**
    * Get the file mode_t value.
@@ -121,8 +174,13 @@ class FileInode : public InodeBase {
    * any member variables of FileInode.
    */
   struct State {
-    State(FileInode* inode, mode_t mode, const folly::Optional<Hash>& hash);
+    State(
+        FileInode* inode,
+        mode_t mode,
+        const folly::Optional<Hash>& hash,
+        folly::Optional<uint64_t> size);
     State(FileInode* inode, mode_t mode, folly::File&& hash, dev_t rdev = 0);
+    ~State();
 
     std::shared_ptr<FileData> data;
     mode_t mode{0};
@@ -132,6 +190,16 @@ class FileInode : public InodeBase {
      */
     std::chrono::system_clock::time_point creationTime;
     folly::Optional<Hash> hash;
+    /**
+     * The size of the blob identified by hash, if it is known without
+     * fetching the blob or its metadata.  Only meaningful while hash is set.
+     */
+    folly::Optional<uint64_t> size;
+    /**
+     * The SHA-1 state of a materialized file whose FileData has been
+     * released, for the next FileData to carry on from.
+     */
+    std::unique_ptr<Sha1Prefix> sha1Prefix;
   };
 
   /**
@@ -149,16 +217,42 @@ class FileInode : public InodeBase {
   std::shared_ptr<FileData> getOrLoadData(
       const folly::Synchronized<State>::LockedPtr& state);
 
+  /**
+   * Get the SHA-1 of a non-materialized file's contents from the metadata of
+   * its blob.
+   */
+  folly::Future<Hash> getBlobSha1(const Hash& blobID);
+
   /**
    * Mark this FileInode materialized in its parent directory.
    */
   void materializeInParent();
 
+  /**
+   * Discard the cached diff results of the directories containing this file.
+   * This must be called after each change to the file's contents or mode.
+   */
+  void invalidateParentDiffCache();
+
   /// Called as part of shutting down an open handle.
   void fileHandleDidClose();
 
+  /**
+   * Record a FUSE read of the committed contents of this file, counting
+   * whether the kernel had already been given that range.
+   */
+  void recordCommittedRead(size_t size, off_t off);
+
   folly::Synchronized<State> state_;
 
+  /**
+   * The end of the furthest range of the committed contents read through
+   * FUSE.  Handles on unmaterialized files keep the kernel's page cache, so
+   * reads below this offset are data the kernel evicted and had to ask for
+   * again.
+   */
+  std::atomic<uint64_t> committedReadEnd_{0};
+
   friend class ::facebook::eden::FileHandle;
   friend class ::facebook::eden::FileData;
 };
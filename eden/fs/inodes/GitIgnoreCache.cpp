@@ -0,0 +1,60 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/inodes/GitIgnoreCache.h"
+
+#include "eden/fs/model/git/GitIgnore.h"
+
+namespace facebook {
+namespace eden {
+
+GitIgnoreCache::GitIgnoreCache(size_t maxEntries)
+    : blobs_{folly::construct_in_place, maxEntries},
+      contents_{folly::construct_in_place, maxEntries} {}
+
+GitIgnoreCache::~GitIgnoreCache() {}
+
+std::shared_ptr<const GitIgnore> GitIgnoreCache::getForBlob(
+    const Hash& blobHash) {
+  // EvictingCacheMap::find() updates the LRU order, so this needs a write
+  // lock.
+  auto blobs = blobs_.wlock();
+  auto it = blobs->find(blobHash);
+  if (it == blobs->end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
+void GitIgnoreCache::insertForBlob(
+    const Hash& blobHash,
+    std::shared_ptr<const GitIgnore> ignore) {
+  blobs_.wlock()->set(blobHash, std::move(ignore));
+}
+
+std::shared_ptr<const GitIgnore> GitIgnoreCache::getOrParse(
+    const std::string& contents) {
+  {
+    auto cache = contents_.wlock();
+    auto it = cache->find(contents);
+    if (it != cache->end()) {
+      return it->second;
+    }
+  }
+
+  // Parse without holding the lock.  If another thread parses the same
+  // contents concurrently, one of the results simply replaces the other.
+  auto ignore = std::make_shared<GitIgnore>();
+  ignore->loadFile(contents);
+  std::shared_ptr<const GitIgnore> result = std::move(ignore);
+  contents_.wlock()->set(contents, result);
+  return result;
+}
+}
+}
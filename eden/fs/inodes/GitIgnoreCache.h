@@ -0,0 +1,73 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/EvictingCacheMap.h>
+#include <folly/Synchronized.h>
+#include <memory>
+#include <string>
+#include "eden/fs/model/Hash.h"
+
+namespace facebook {
+namespace eden {
+
+class GitIgnore;
+
+/**
+ * A cache of parsed .gitignore files, so that diff operations do not need
+ * to read and parse every .gitignore file each time they run.
+ *
+ * Unmaterialized .gitignore files are looked up by the hash of their source
+ * control blob, which never changes, so a hit does not even require loading
+ * the file contents.  Materialized files are looked up by their contents.
+ * These must still be read, but the much more expensive parsing is skipped
+ * while they remain unchanged.
+ *
+ * The cached GitIgnore objects are immutable and may be shared by any
+ * number of concurrent diff operations.
+ */
+class GitIgnoreCache {
+ public:
+  explicit GitIgnoreCache(size_t maxEntries);
+  ~GitIgnoreCache();
+
+  /**
+   * Get the parsed contents of the .gitignore blob with the specified hash,
+   * or nullptr if they are not cached.
+   */
+  std::shared_ptr<const GitIgnore> getForBlob(const Hash& blobHash);
+
+  /**
+   * Record the parsed contents of the .gitignore blob with the specified
+   * hash.
+   */
+  void insertForBlob(
+      const Hash& blobHash,
+      std::shared_ptr<const GitIgnore> ignore);
+
+  /**
+   * Get the parsed GitIgnore for some .gitignore file contents, parsing them
+   * only if they are not already cached.
+   */
+  std::shared_ptr<const GitIgnore> getOrParse(const std::string& contents);
+
+ private:
+  GitIgnoreCache(const GitIgnoreCache&) = delete;
+  GitIgnoreCache& operator=(const GitIgnoreCache&) = delete;
+
+  folly::Synchronized<
+      folly::EvictingCacheMap<Hash, std::shared_ptr<const GitIgnore>>>
+      blobs_;
+  folly::Synchronized<
+      folly::EvictingCacheMap<std::string, std::shared_ptr<const GitIgnore>>>
+      contents_;
+};
+}
+}
@@ -10,6 +10,9 @@
 #include "eden/fs/inodes/InodeBase.h"
 
 #include <folly/Likely.h>
+#include <gflags/gflags.h>
+#include <algorithm>
+#include <atomic>
 #include "eden/fs/inodes/EdenMount.h"
 #include "eden/fs/inodes/InodeMap.h"
 #include "eden/fs/inodes/ParentInodeInfo.h"
@@ -17,6 +20,23 @@
 
 using namespace folly;
 
+DEFINE_double(
+    unmaterialized_cache_ttl,
+    86400,
+    "how long the kernel may cache attributes and directory entries for "
+    "files and directories that have not been modified, in seconds");
+DEFINE_double(
+    materialized_cache_ttl,
+    1,
+    "how long the kernel may cache attributes and directory entries for "
+    "files and directories that have been modified, in seconds");
+
+namespace {
+// Set by setKernelCacheTtls().  A negative value means the flag applies.
+std::atomic<double> materializedTtlOverride{-1};
+std::atomic<double> unmaterializedTtlOverride{-1};
+}
+
 namespace facebook {
 namespace eden {
 
@@ -35,6 +55,7 @@ InodeBase::InodeBase(EdenMount* mount)
           << mount_->getPath();
   // The root inode always starts with an implicit reference from FUSE.
   incFuseRefcount();
+  updateLastAccess();
 }
 
 InodeBase::InodeBase(
@@ -47,9 +68,28 @@ InodeBase::InodeBase(
   // Inode numbers generally shouldn't be 0.
   // Older versions of glibc have bugs handling files with an inode number of 0
   DCHECK_NE(ino_, 0);
+  updateLastAccess();
   VLOG(5) << "inode " << this << " (" << ino_ << ") created: " << getLogPath();
 }
 
+double InodeBase::getKernelCacheTtl(bool materialized) {
+  auto ttl = materialized
+      ? materializedTtlOverride.load(std::memory_order_relaxed)
+      : unmaterializedTtlOverride.load(std::memory_order_relaxed);
+  if (ttl >= 0) {
+    return ttl;
+  }
+  return materialized ? FLAGS_materialized_cache_ttl
+                      : FLAGS_unmaterialized_cache_ttl;
+}
+
+void InodeBase::setKernelCacheTtls(double materialized, double unmaterialized) {
+  materializedTtlOverride.store(
+      std::max(materialized, 0.0), std::memory_order_relaxed);
+  unmaterializedTtlOverride.store(
+      std::max(unmaterialized, 0.0), std::memory_order_relaxed);
+}
+
 // See Dispatcher::getattr
 folly::Future<fusell::Dispatcher::Attr> InodeBase::getattr() {
   FUSELL_NOT_IMPL();
@@ -193,9 +233,23 @@ std::unique_ptr<InodeBase> InodeBase::markUnlinked(
     TreeInode* parent,
     PathComponentPiece name,
     const RenameLock& renameLock) {
-  VLOG(5) << "inode " << this << " unlinked: " << getLogPath();
   DCHECK(renameLock.isHeld(mount_));
+  return markUnlinkedImpl(parent, name);
+}
 
+std::unique_ptr<InodeBase> InodeBase::markUnlinked(
+    TreeInode* parent,
+    PathComponentPiece name,
+    const SharedRenameLock& renameLock) {
+  DCHECK(renameLock.isHeld(mount_));
+  DCHECK(!dynamic_cast<TreeInode*>(this));
+  return markUnlinkedImpl(parent, name);
+}
+
+std::unique_ptr<InodeBase> InodeBase::markUnlinkedImpl(
+    TreeInode* parent,
+    PathComponentPiece name) {
+  VLOG(5) << "inode " << this << " unlinked: " << getLogPath();
   {
     auto loc = location_.wlock();
     DCHECK(!loc->unlinked);
@@ -234,9 +288,25 @@ void InodeBase::updateLocation(
     TreeInodePtr newParent,
     PathComponentPiece newName,
     const RenameLock& renameLock) {
+  DCHECK(renameLock.isHeld(mount_));
+  updateLocationImpl(std::move(newParent), newName);
+}
+
+void InodeBase::updateLocation(
+    TreeInodePtr newParent,
+    PathComponentPiece newName,
+    const SharedRenameLock& renameLock) {
+  DCHECK(renameLock.isHeld(mount_));
+  DCHECK(!dynamic_cast<TreeInode*>(this));
+  DCHECK_EQ(location_.rlock()->parent.get(), newParent.get());
+  updateLocationImpl(std::move(newParent), newName);
+}
+
+void InodeBase::updateLocationImpl(
+    TreeInodePtr newParent,
+    PathComponentPiece newName) {
   VLOG(5) << "inode " << this << " renamed: " << getLogPath() << " --> "
           << newParent->getLogPath() << " / \"" << newName << "\"";
-  DCHECK(renameLock.isHeld(mount_));
   DCHECK_EQ(mount_, newParent->mount_);
 
   auto loc = location_.wlock();
@@ -251,7 +321,7 @@ void InodeBase::onPtrRefZero() const {
 }
 
 ParentInodeInfo InodeBase::getParentInfo() const {
-  using ParentContentsPtr = folly::Synchronized<TreeInode::Dir>::LockedPtr;
+  using ParentContentsPtr = TreeInode::DirContents::LockedPtr;
 
   // Grab our parent's contents_ lock.
   //
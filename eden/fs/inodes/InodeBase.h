@@ -11,6 +11,7 @@
 #include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
 #include <atomic>
+#include <chrono>
 #include <memory>
 #include <vector>
 #include "eden/fs/inodes/InodePtr.h"
@@ -162,6 +163,14 @@ class InodeBase {
       TreeInode* parent,
       PathComponentPiece name,
       const RenameLock& renameLock);
+  /**
+   * The shared rename lock is sufficient when a file is replaced by a rename
+   * within its own directory.
+   */
+  std::unique_ptr<InodeBase> markUnlinked(
+      TreeInode* parent,
+      PathComponentPiece name,
+      const SharedRenameLock& renameLock);
 
   /**
    * updateLocation() should only be invoked by TreeInode.
@@ -172,6 +181,14 @@ class InodeBase {
       TreeInodePtr newParent,
       PathComponentPiece newName,
       const RenameLock& renameLock);
+  /**
+   * Rename a non-directory inode within its current parent, which only
+   * requires the shared rename lock.
+   */
+  void updateLocation(
+      TreeInodePtr newParent,
+      PathComponentPiece newName,
+      const SharedRenameLock& renameLock);
 
   /**
    * Check to see if the ptrAcquire reference count is zero.
@@ -226,6 +243,17 @@ class InodeBase {
     return numFuseReferences_.load(std::memory_order_acquire);
   }
 
+  /**
+   * Get the FUSE reference count of an inode that may still be referenced.
+   *
+   * This is only meaningful once the FUSE channel has stopped, so that
+   * nothing else changes the count.  It is used to hand the mount point over
+   * to another process.
+   */
+  uint32_t getFuseRefcountForTakeover() const {
+    return numFuseReferences_.load(std::memory_order_acquire);
+  }
+
   /**
    * Set the FUSE reference count.
    *
@@ -303,6 +331,49 @@ class InodeBase {
     return *loc;
   }
 
+  /**
+   * Get how long the kernel may cache attributes and directory entries for
+   * an inode, in seconds.
+   *
+   * Unmaterialized inodes only change when a checkout replaces them, and
+   * checkout explicitly invalidates the kernel's cache for every entry it
+   * changes, so they can be cached for a long time.  Materialized inodes
+   * get a short timeout.
+   */
+  static double getKernelCacheTtl(bool materialized);
+
+  /**
+   * Replace the kernel cache timeouts given by the flags.  This only
+   * affects replies sent from now on.
+   */
+  static void setKernelCacheTtls(double materialized, double unmaterialized);
+
+  /**
+   * Record that this inode has just been looked up.
+   *
+   * This is called by InodeMap::lookupInode() and TreeInode::getOrLoadChild()
+   * when they return an already loaded inode.  It is a relaxed atomic store,
+   * cheap enough to do on every lookup.
+   */
+  void updateLastAccess() const {
+    lastAccess_.store(
+        std::chrono::steady_clock::now().time_since_epoch().count(),
+        std::memory_order_relaxed);
+  }
+
+  /**
+   * Get the last time this inode was looked up, or the time it was loaded if
+   * it has not been looked up since.
+   *
+   * The periodic inode unloader uses this to pick inodes that have not been
+   * used recently.
+   */
+  std::chrono::steady_clock::time_point getLastAccess() const {
+    return std::chrono::steady_clock::time_point{
+        std::chrono::steady_clock::duration{
+            lastAccess_.load(std::memory_order_relaxed)}};
+  }
+
  private:
   template <typename InodeType>
   friend class InodePtrImpl;
@@ -312,8 +383,14 @@ class InodeBase {
       const;
 
   // incrementPtrRef() is called by InodePtr whenever an InodePtr is copied.
+  //
+  // As with std::shared_ptr, the increment can be relaxed: the caller already
+  // holds a reference, so the inode cannot be unloaded concurrently, and no
+  // other memory accesses need to be ordered against it.  Only the decrement
+  // needs acq_rel ordering, so that the thread that drops the last reference
+  // sees every access made through the others.
   void incrementPtrRef() const {
-    auto prevValue = ptrRefcount_.fetch_add(1, std::memory_order_acq_rel);
+    auto prevValue = ptrRefcount_.fetch_add(1, std::memory_order_relaxed);
     // Calls to incrementPtrRef() are not allowed to increment the reference
     // count from 0 to 1.
     //
@@ -342,6 +419,11 @@ class InodeBase {
   void onPtrRefZero() const;
   ParentInodeInfo getParentInfo() const;
 
+  std::unique_ptr<InodeBase> markUnlinkedImpl(
+      TreeInode* parent,
+      PathComponentPiece name);
+  void updateLocationImpl(TreeInodePtr newParent, PathComponentPiece newName);
+
   fuse_ino_t const ino_;
 
   /**
@@ -443,6 +525,12 @@ class InodeBase {
    */
   mutable std::atomic<uint32_t> ptrAcquireCount_{0};
 
+  /**
+   * The steady_clock time of the last lookup, as returned by
+   * getLastAccess().
+   */
+  mutable std::atomic<std::chrono::steady_clock::rep> lastAccess_{0};
+
   /**
    * Information about this Inode's location in the file system path.
    * Eden does not support hard links, so each Inode has exactly one location.
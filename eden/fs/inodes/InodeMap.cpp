@@ -9,24 +9,44 @@
  */
 #include "eden/fs/inodes/InodeMap.h"
 
+#include <folly/Conv.h>
 #include <folly/Exception.h>
 #include <folly/Likely.h>
+#include <algorithm>
+#include <iterator>
 #include "eden/fs/inodes/EdenMount.h"
 #include "eden/fs/inodes/FileInode.h"
 #include "eden/fs/inodes/Overlay.h"
 #include "eden/fs/inodes/ParentInodeInfo.h"
 #include "eden/fs/inodes/TreeInode.h"
+#include "eden/fs/takeover/gen-cpp2/takeover_types.h"
 #include "eden/utils/Bug.h"
+#include "eden/utils/RequestTrace.h"
 
 using folly::Future;
 using folly::Promise;
 using folly::throwSystemErrorExplicit;
 using std::string;
 
+namespace {
+/**
+ * The longest string that std::string stores without a heap allocation.
+ * This is the libstdc++ value; it only affects NamePool's memory estimate.
+ */
+constexpr size_t kInlineStringCapacity = 15;
+}
+
 namespace facebook {
 namespace eden {
 
-InodeMap::InodeMap(EdenMount* mount) : mount_{mount} {}
+constexpr size_t InodeMap::kNumShards;
+
+InodeMap::InodeMap(EdenMount* mount) : mount_{mount} {
+  shards_.reserve(kNumShards);
+  for (size_t n = 0; n < kNumShards; ++n) {
+    shards_.push_back(std::make_unique<Shard>());
+  }
+}
 
 InodeMap::~InodeMap() {
   // TODO: We need to clean up the EdenMount / InodeMap destruction process a
@@ -46,20 +66,23 @@ InodeMap::~InodeMap() {
 }
 
 void InodeMap::initialize(TreeInodePtr root, fuse_ino_t maxExistingInode) {
-  auto data = data_.wlock();
+  auto data = getShard(FUSE_ROOT_ID).wlock();
   CHECK(!root_);
   root_ = std::move(root);
   auto ret = data->loadedInodes_.emplace(FUSE_ROOT_ID, root_.get());
   CHECK(ret.second);
   DCHECK_GE(maxExistingInode, FUSE_ROOT_ID);
-  data->nextInodeNumber_ = maxExistingInode + 1;
+  nextInodeNumber_.store(maxExistingInode + 1, std::memory_order_relaxed);
 }
 
 Future<InodePtr> InodeMap::lookupInode(fuse_ino_t number) {
-  // Lock the data.
+  // Lock the shard containing this inode.
   // We hold it while doing most of our work below, but explicitly unlock it
   // before triggering inode loading or before fulfilling any Promises.
-  auto data = data_.wlock();
+  auto data = RequestTrace::lockTraced(
+      RequestTrace::INODE_MAP_LOCK,
+      "InodeMap::lookupInode",
+      [&] { return getShard(number).wlock(); });
 
   // Check to see if this Inode is already loaded
   auto loadedIter = data->loadedInodes_.find(number);
@@ -71,6 +94,7 @@ Future<InodePtr> InodeMap::lookupInode(fuse_ino_t number) {
     // makeFuture()'s memory allocation without the lock held.
     auto result = InodePtr::newPtrLocked(loadedIter->second);
     data.unlock();
+    result->updateLastAccess();
     return folly::makeFuture<InodePtr>(std::move(result));
   }
 
@@ -107,52 +131,57 @@ Future<InodePtr> InodeMap::lookupInode(fuse_ino_t number) {
   // For parents we don't find, add a promise that will trigger the lookup on
   // its necessary child.
   //
-  // (It might have been simpler to recursively call lookupInode() to get the
-  // parent, but that would require releasing and re-acquiring the lock more
-  // than necessary.)
+  // The parent may live in a different shard, and we never hold two shard
+  // locks at once, so copy out the data we need about the child and release
+  // its lock before locking the parent's shard.  Nothing else will start
+  // loading the child in the meantime: its promises list is non-empty, so
+  // shouldLoadChild() will leave the load to us.
   auto childInodeNumber = number;
+  auto parentNumber = unloadedData->parent;
+  PathComponent childName{unloadedData->getName()};
+  bool childIsUnlinked = unloadedData->isUnlinked;
+  data.unlock();
   while (true) {
+    auto parentData = getShard(parentNumber).wlock();
+
     // Check to see if this parent is loaded
-    loadedIter = data->loadedInodes_.find(unloadedData->parent);
-    if (loadedIter != data->loadedInodes_.end()) {
+    loadedIter = parentData->loadedInodes_.find(parentNumber);
+    if (loadedIter != parentData->loadedInodes_.end()) {
       // We found a loaded parent.
-      // Grab copies of the arguments we need for startChildLookup(),
-      // with the lock still held.
+      // Grab a reference to it with the lock still held.
       InodePtr firstLoadedParent = InodePtr::newPtrLocked(loadedIter->second);
-      PathComponent requiredChildName = unloadedData->name;
-      bool isUnlinked = unloadedData->isUnlinked;
       // Unlock the data before starting the child lookup
-      data.unlock();
+      parentData.unlock();
       // Trigger the lookup, then return to our caller.
       startChildLookup(
-          firstLoadedParent, requiredChildName, isUnlinked, childInodeNumber);
+          firstLoadedParent, childName, childIsUnlinked, childInodeNumber);
       return result;
     }
 
     // Look up the parent in unloadedInodes_
-    unloadedIter = data->unloadedInodes_.find(unloadedData->parent);
-    if (UNLIKELY(unloadedIter == data->unloadedInodes_.end())) {
+    unloadedIter = parentData->unloadedInodes_.find(parentNumber);
+    if (UNLIKELY(unloadedIter == parentData->unloadedInodes_.end())) {
       // This shouldn't happen.  We must know about the parent inode number if
       // we knew about the child.
-      auto bug = EDEN_BUG() << "unknown parent inode " << unloadedData->parent
-                            << " (of " << unloadedData->name << ")";
+      auto bug = EDEN_BUG() << "unknown parent inode " << parentNumber
+                            << " (of " << childName << ")";
       // Unlock our data before calling inodeLoadFailed()
-      data.unlock();
+      parentData.unlock();
       inodeLoadFailed(childInodeNumber, bug.toException());
       return result;
     }
 
-    auto* parentData = &unloadedIter->second;
-    alreadyLoading = !parentData->promises.empty();
+    auto* parentEntry = &unloadedIter->second;
+    alreadyLoading = !parentEntry->promises.empty();
 
     // Add a new entry to the promises list.
     // It should kick off loading of the current child inode when
     // it is fulfilled.
-    parentData->promises.emplace_back();
+    parentEntry->promises.emplace_back();
     setupParentLookupPromise(
-        parentData->promises.back(),
-        unloadedData->name,
-        unloadedData->isUnlinked,
+        parentEntry->promises.back(),
+        childName,
+        childIsUnlinked,
         childInodeNumber);
 
     if (alreadyLoading) {
@@ -162,8 +191,10 @@ Future<InodePtr> InodeMap::lookupInode(fuse_ino_t number) {
     }
 
     // Continue around the loop to look up our parent's parent
-    childInodeNumber = unloadedData->parent;
-    unloadedData = parentData;
+    childInodeNumber = parentNumber;
+    parentNumber = parentEntry->parent;
+    childName = PathComponent{parentEntry->getName()};
+    childIsUnlinked = parentEntry->isUnlinked;
   }
 }
 
@@ -226,7 +257,17 @@ InodeMap::PromiseVector InodeMap::inodeLoadComplete(InodeBase* inode) {
 
   PromiseVector promises;
   try {
-    auto data = data_.wlock();
+    // This must happen before the inode is in loadedInodes_, where its
+    // children could be looked up.  Our caller holds the parent's contents
+    // lock, which is always acquired before the child's.
+    if (UNLIKELY(hasRestoredChildren_.load(std::memory_order_acquire))) {
+      restoreChildInodeNumbers(inode);
+    }
+
+    auto data = RequestTrace::lockTraced(
+        RequestTrace::INODE_MAP_LOCK,
+        "InodeMap::inodeLoadComplete",
+        [&] { return getShard(number).wlock(); });
     auto it = data->unloadedInodes_.find(number);
     CHECK(it != data->unloadedInodes_.end())
         << "failed to find unloaded inode data when finishing load of inode "
@@ -237,7 +278,7 @@ InodeMap::PromiseVector InodeMap::inodeLoadComplete(InodeBase* inode) {
 
     // Insert the entry into loadedInodes_, and remove it from unloadedInodes_
     data->loadedInodes_.emplace(number, inode);
-    data->unloadedInodes_.erase(it);
+    data->eraseUnloaded(it);
     return promises;
   } catch (const std::exception& ex) {
     LOG(ERROR) << "error marking inode " << number
@@ -264,7 +305,7 @@ void InodeMap::inodeLoadFailed(
 InodeMap::PromiseVector InodeMap::extractPendingPromises(fuse_ino_t number) {
   PromiseVector promises;
   {
-    auto data = data_.wlock();
+    auto data = getShard(number).wlock();
     auto it = data->unloadedInodes_.find(number);
     CHECK(it != data->unloadedInodes_.end())
         << "failed to find unloaded inode data when finishing load of inode "
@@ -276,16 +317,19 @@ InodeMap::PromiseVector InodeMap::extractPendingPromises(fuse_ino_t number) {
 
 Future<TreeInodePtr> InodeMap::lookupTreeInode(fuse_ino_t number) {
   return lookupInode(number).then(
-      [](const InodePtr& inode) { return inode.asTreePtr(); });
+      [](InodePtr&& inode) { return std::move(inode).asTreePtr(); });
 }
 
 Future<FileInodePtr> InodeMap::lookupFileInode(fuse_ino_t number) {
   return lookupInode(number).then(
-      [](const InodePtr& inode) { return inode.asFilePtr(); });
+      [](InodePtr&& inode) { return std::move(inode).asFilePtr(); });
 }
 
 InodePtr InodeMap::lookupLoadedInode(fuse_ino_t number) {
-  auto data = data_.rlock();
+  auto data = RequestTrace::lockTraced(
+      RequestTrace::INODE_MAP_LOCK,
+      "InodeMap::lookupLoadedInode",
+      [&] { return getShard(number).rlock(); });
   auto it = data->loadedInodes_.find(number);
   if (it == data->loadedInodes_.end()) {
     return nullptr;
@@ -298,7 +342,7 @@ TreeInodePtr InodeMap::lookupLoadedTree(fuse_ino_t number) {
   if (!inode) {
     return nullptr;
   }
-  return inode.asTreePtr();
+  return std::move(inode).asTreePtr();
 }
 
 FileInodePtr InodeMap::lookupLoadedFile(fuse_ino_t number) {
@@ -306,11 +350,23 @@ FileInodePtr InodeMap::lookupLoadedFile(fuse_ino_t number) {
   if (!inode) {
     return nullptr;
   }
-  return inode.asFilePtr();
+  return std::move(inode).asFilePtr();
+}
+
+bool InodeMap::isInodeLoading(fuse_ino_t number) {
+  auto data = getShard(number).rlock();
+  auto it = data->unloadedInodes_.find(number);
+  return it != data->unloadedInodes_.end() && !it->second.promises.empty();
+}
+
+bool InodeMap::isInodeRemembered(fuse_ino_t number) {
+  auto data = getShard(number).rlock();
+  return data->loadedInodes_.find(number) != data->loadedInodes_.end() ||
+      data->unloadedInodes_.find(number) != data->unloadedInodes_.end();
 }
 
 UnloadedInodeData InodeMap::lookupUnloadedInode(fuse_ino_t number) {
-  auto data = data_.rlock();
+  auto data = getShard(number).rlock();
   auto it = data->unloadedInodes_.find(number);
   if (it == data->unloadedInodes_.end()) {
     // This generally shouldn't happen.  If a fuse_ino_t has been allocated
@@ -320,11 +376,14 @@ UnloadedInodeData InodeMap::lookupUnloadedInode(fuse_ino_t number) {
     throwSystemErrorExplicit(EINVAL, "unknown inode number ", number);
   }
 
-  return UnloadedInodeData(it->second.parent, it->second.name);
+  return UnloadedInodeData(it->second.parent, it->second.getName());
 }
 
 void InodeMap::decFuseRefcount(fuse_ino_t number, uint32_t count) {
-  auto data = data_.wlock();
+  auto data = RequestTrace::lockTraced(
+      RequestTrace::INODE_MAP_LOCK,
+      "InodeMap::decFuseRefcount",
+      [&] { return getShard(number).wlock(); });
 
   // First check in the loaded inode map
   auto loadedIter = data->loadedInodes_.find(number);
@@ -344,8 +403,54 @@ void InodeMap::decFuseRefcount(fuse_ino_t number, uint32_t count) {
   }
 
   // If it wasn't loaded, it should be in the unloaded map
-  auto unloadedIter = data->unloadedInodes_.find(number);
-  if (UNLIKELY(unloadedIter == data->unloadedInodes_.end())) {
+  decUnloadedFuseRefcount(*data, number, count);
+}
+
+void InodeMap::decFuseRefcountBatch(
+    const std::vector<std::pair<fuse_ino_t, uint32_t>>& forgets) {
+  // Group the forgets by shard, so that each shard lock is taken once.
+  std::vector<std::vector<size_t>> shardForgets(kNumShards);
+  for (size_t index = 0; index < forgets.size(); ++index) {
+    shardForgets[getShardIndex(forgets[index].first)].push_back(index);
+  }
+
+  // As in decFuseRefcount(), hold a pointer reference on each loaded inode
+  // while decrementing its FUSE reference count.
+  std::vector<std::pair<InodePtr, uint32_t>> loadedInodes;
+  for (size_t shardIndex = 0; shardIndex < kNumShards; ++shardIndex) {
+    if (shardForgets[shardIndex].empty()) {
+      continue;
+    }
+    auto data = RequestTrace::lockTraced(
+        RequestTrace::INODE_MAP_LOCK,
+        "InodeMap::decFuseRefcountBatch",
+        [&] { return shards_[shardIndex]->wlock(); });
+    for (auto index : shardForgets[shardIndex]) {
+      auto number = forgets[index].first;
+      auto count = forgets[index].second;
+      auto loadedIter = data->loadedInodes_.find(number);
+      if (loadedIter != data->loadedInodes_.end()) {
+        loadedInodes.emplace_back(
+            InodePtr::newPtrLocked(loadedIter->second), count);
+      } else {
+        decUnloadedFuseRefcount(*data, number, count);
+      }
+    }
+  }
+
+  // Releasing the pointers may unload inodes, which takes the shard locks
+  // again, so this must happen after all of them have been released.
+  for (auto& entry : loadedInodes) {
+    entry.first->decFuseRefcount(entry.second);
+  }
+}
+
+void InodeMap::decUnloadedFuseRefcount(
+    Members& data,
+    fuse_ino_t number,
+    uint32_t count) {
+  auto unloadedIter = data.unloadedInodes_.find(number);
+  if (UNLIKELY(unloadedIter == data.unloadedInodes_.end())) {
     EDEN_BUG() << "InodeMap::decFuseRefcount() called on unknown inode number "
                << number;
   }
@@ -357,13 +462,157 @@ void InodeMap::decFuseRefcount(fuse_ino_t number, uint32_t count) {
   if (unloadedEntry.numFuseReferences <= 0) {
     // We can completely forget about this unloaded inode now.
     VLOG(5) << "forgetting unloaded inode " << number << ": "
-            << unloadedEntry.parent << ":" << unloadedEntry.name;
-    data->unloadedInodes_.erase(unloadedIter);
+            << unloadedEntry.parent << ":" << unloadedEntry.getName();
+    data.eraseUnloaded(unloadedIter);
   }
 }
 
-void InodeMap::save() {
-  // TODO
+takeover::SerializedInodeMap InodeMap::save() {
+  takeover::SerializedInodeMap result;
+  result.nextInodeNumber = getNextInodeNumber();
+
+  // Hold the rename lock so that every inode's parent and name are consistent
+  // with each other.
+  auto renameLock = mount_->acquireRenameLock("InodeMap::save");
+
+  std::vector<InodePtr> loadedInodes;
+  for (auto& shard : shards_) {
+    auto data = shard->wlock();
+    for (const auto& entry : data->loadedInodes_) {
+      if (entry.first != FUSE_ROOT_ID) {
+        loadedInodes.push_back(InodePtr::newPtrLocked(entry.second));
+      }
+    }
+    for (const auto& entry : data->unloadedInodes_) {
+      // Entries without FUSE references are only there while their inodes
+      // are being loaded, and the kernel does not know their numbers yet.
+      if (entry.second.isUnlinked || entry.second.numFuseReferences <= 0) {
+        continue;
+      }
+      result.unloadedInodes.emplace_back();
+      auto& inode = result.unloadedInodes.back();
+      inode.inodeNumber = entry.first;
+      inode.parentInode = entry.second.parent;
+      inode.name = entry.second.getName().stringPiece().str();
+      inode.numFuseReferences = entry.second.numFuseReferences;
+    }
+  }
+
+  // Loaded inodes are recorded even without FUSE references, since they may
+  // be the parents of inodes that do have some.
+  for (const auto& inode : loadedInodes) {
+    auto location = inode->getLocationInfo(renameLock);
+    if (location.unlinked) {
+      continue;
+    }
+    result.unloadedInodes.emplace_back();
+    auto& entry = result.unloadedInodes.back();
+    entry.inodeNumber = inode->getNodeId();
+    entry.parentInode = location.parent->getNodeId();
+    entry.name = location.name.stringPiece().str();
+    entry.numFuseReferences = inode->getFuseRefcountForTakeover();
+  }
+  return result;
+}
+
+void InodeMap::load(const takeover::SerializedInodeMap& data) {
+  CHECK(root_);
+  std::unordered_map<fuse_ino_t, RestoredChildren> children;
+  auto nextInodeNumber = getNextInodeNumber();
+  for (const auto& inode : data.unloadedInodes) {
+    auto number = static_cast<fuse_ino_t>(inode.inodeNumber);
+    auto parent = static_cast<fuse_ino_t>(inode.parentInode);
+    PathComponentPiece name{inode.name};
+    {
+      auto shard = getShard(number).wlock();
+      auto ret = shard->emplaceUnloaded(number, parent, name);
+      if (!ret.second || number == FUSE_ROOT_ID) {
+        throw std::runtime_error(folly::to<string>(
+            "duplicate inode number ", number, " in saved InodeMap"));
+      }
+      ret.first->second.numFuseReferences = inode.numFuseReferences;
+    }
+    children[parent].emplace_back(PathComponent{name}, number);
+    nextInodeNumber = std::max(nextInodeNumber, number + 1);
+  }
+  nextInodeNumber = std::max(
+      nextInodeNumber, static_cast<fuse_ino_t>(data.nextInodeNumber));
+  nextInodeNumber_.store(nextInodeNumber, std::memory_order_relaxed);
+  addRestoredChildren(std::move(children));
+}
+
+void InodeMap::loadPersisted(const takeover::SerializedInodeMap& data) {
+  CHECK(root_);
+  std::unordered_map<fuse_ino_t, RestoredChildren> children;
+  auto nextInodeNumber = getNextInodeNumber();
+  for (const auto& inode : data.unloadedInodes) {
+    auto number = static_cast<fuse_ino_t>(inode.inodeNumber);
+    if (number <= FUSE_ROOT_ID || inode.name.empty()) {
+      throw std::runtime_error(folly::to<string>(
+          "invalid inode number ", number, " in saved InodeMap"));
+    }
+    auto parent = static_cast<fuse_ino_t>(inode.parentInode);
+    children[parent].emplace_back(PathComponent{inode.name}, number);
+    nextInodeNumber = std::max(nextInodeNumber, number + 1);
+  }
+  nextInodeNumber = std::max(
+      nextInodeNumber, static_cast<fuse_ino_t>(data.nextInodeNumber));
+  nextInodeNumber_.store(nextInodeNumber, std::memory_order_relaxed);
+  addRestoredChildren(std::move(children));
+}
+
+void InodeMap::addRestoredChildren(
+    std::unordered_map<fuse_ino_t, RestoredChildren>&& children) {
+  auto rootChildren = children.find(FUSE_ROOT_ID);
+  if (rootChildren != children.end()) {
+    root_->restoreChildInodeNumbers(rootChildren->second);
+    children.erase(rootChildren);
+  }
+  if (children.empty()) {
+    return;
+  }
+
+  auto restored = restoredChildren_.wlock();
+  if (restored->empty()) {
+    *restored = std::move(children);
+  } else {
+    // Both loadPersisted() and load() may run for the same mount, after a
+    // takeover.  They record the same numbers, since the persisted state is
+    // written by the process that handed the mount over.
+    for (auto& entry : children) {
+      auto& existing = (*restored)[entry.first];
+      existing.insert(
+          existing.end(),
+          std::make_move_iterator(entry.second.begin()),
+          std::make_move_iterator(entry.second.end()));
+    }
+  }
+  hasRestoredChildren_.store(true, std::memory_order_release);
+}
+
+void InodeMap::restoreChildInodeNumbers(InodeBase* inode) {
+  RestoredChildren children;
+  {
+    auto restored = restoredChildren_.wlock();
+    auto it = restored->find(inode->getNodeId());
+    if (it == restored->end()) {
+      return;
+    }
+    children = std::move(it->second);
+    restored->erase(it);
+    if (restored->empty()) {
+      hasRestoredChildren_.store(false, std::memory_order_release);
+    }
+  }
+
+  auto* tree = dynamic_cast<TreeInode*>(inode);
+  if (!tree) {
+    LOG(WARNING) << "inode " << inode->getNodeId() << " ("
+                 << inode->getLogPath()
+                 << ") has restored children but is not a directory";
+    return;
+  }
+  tree->restoreChildInodeNumbers(children);
 }
 
 void InodeMap::beginShutdown() {
@@ -379,10 +628,19 @@ void InodeMap::beginShutdown() {
   // walk we want to make sure that an Inode that hasn't been processed yet
   // cannot be moved from the unprocessed part of the tree into a processed
   // part of the tree.
+  auto numLoaded = getStats().loadedInodes;
+  auto start = std::chrono::steady_clock::now();
   {
-    auto renameLock = mount_->acquireSharedRenameLock();
+    auto renameLock = mount_->acquireSharedRenameLock(
+        "InodeMap::beginShutdown");
     root_->unloadChildrenNow();
   }
+  VLOG(1) << "unloaded " << numLoaded - getStats().loadedInodes << " of "
+          << numLoaded << " inodes in " << mount_->getPath() << " in "
+          << std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::steady_clock::now() - start)
+                 .count()
+          << "ms";
 
   // Also walk loadedInodes_ to immediately destroy all unreferenced unlinked
   // inodes.  (There may be unlinked inodes that have no outstanding pointer
@@ -398,19 +656,20 @@ void InodeMap::beginShutdown() {
     // to them, then let the normal pointer release process be responsible for
     // unloading them.
     std::vector<InodePtr> inodesToUnload;
-    auto data = data_.wlock();
-    for (const auto& entry : data->loadedInodes_) {
-      if (!entry.second->isPtrAcquireCountZero()) {
-        continue;
-      }
-      if (!entry.second->isUnlinked()) {
-        continue;
+    for (auto& shard : shards_) {
+      auto data = shard->wlock();
+      for (const auto& entry : data->loadedInodes_) {
+        if (!entry.second->isPtrAcquireCountZero()) {
+          continue;
+        }
+        if (!entry.second->isUnlinked()) {
+          continue;
+        }
+        inodesToUnload.push_back(InodePtr::newPtrLocked(entry.second));
       }
-      inodesToUnload.push_back(InodePtr::newPtrLocked(entry.second));
     }
-    // Release the lock, then release all of our InodePtrs to unload
-    // the inodes.
-    data.unlock();
+    // Release all of our InodePtrs to unload the inodes, now that we are no
+    // longer holding any shard lock.
     inodesToUnload.clear();
   }
 
@@ -437,8 +696,8 @@ void InodeMap::onInodeUnreferenced(
     ParentInodeInfo&& parentInfo) {
   VLOG(5) << "inode " << inode->getNodeId()
           << " unreferenced: " << inode->getLogPath();
-  // Acquire our lock.
-  auto data = data_.wlock();
+  // Acquire the lock for this inode's shard.
+  auto data = getShard(inode->getNodeId()).wlock();
 
   // Decrement the Inode's acquire count
   auto acquireCount = inode->decPtrAcquireCount();
@@ -483,8 +742,8 @@ void InodeMap::onInodeUnreferenced(
       const auto& parentContents = parentInfo.getParentContents();
       auto it = parentContents->entries.find(parentInfo.getName());
       CHECK(it != parentContents->entries.end());
-      CHECK_EQ(it->second->inode, inode);
-      it->second->inode = nullptr;
+      CHECK_EQ(it->second.inode, inode);
+      it->second.inode = nullptr;
     }
   }
 
@@ -499,8 +758,38 @@ void InodeMap::onInodeUnreferenced(
   }
 }
 
+size_t InodeMap::unloadInactiveInodes(
+    std::chrono::seconds maxAge,
+    size_t maxLoadedInodes) {
+  if (shuttingDown_.load(std::memory_order_acquire)) {
+    return 0;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  auto cutoff = now - maxAge;
+  auto numLoaded = getStats().loadedInodes;
+  if (maxLoadedInodes > 0 && numLoaded > maxLoadedInodes) {
+    VLOG(1) << numLoaded << " inodes loaded in " << mount_->getPath()
+            << ", above the limit of " << maxLoadedInodes
+            << "; unloading all unreferenced inodes";
+    cutoff = now;
+  }
+
+  auto numUnloaded = root_->unloadChildrenLastAccessedBefore(cutoff);
+  VLOG(1) << "unloaded " << numUnloaded << " of " << numLoaded
+          << " inodes in " << mount_->getPath();
+  return numUnloaded;
+}
+
 InodeMapLock InodeMap::lockForUnload() {
-  return InodeMapLock{data_.wlock()};
+  // Always acquire the shard locks in index order.  This is the only place
+  // that holds more than one shard lock at a time.
+  std::vector<Shard::LockedPtr> locks;
+  locks.reserve(shards_.size());
+  for (auto& shard : shards_) {
+    locks.push_back(shard->wlock());
+  }
+  return InodeMapLock{std::move(locks)};
 }
 
 void InodeMap::unloadInode(
@@ -509,7 +798,12 @@ void InodeMap::unloadInode(
     PathComponentPiece name,
     bool isUnlinked,
     const InodeMapLock& lock) {
-  return unloadInode(inode, parent, name, isUnlinked, lock.data_);
+  return unloadInode(
+      inode,
+      parent,
+      name,
+      isUnlinked,
+      lock.data_[getShardIndex(inode->getNodeId())]);
 }
 
 void InodeMap::unloadInode(
@@ -517,24 +811,21 @@ void InodeMap::unloadInode(
     TreeInode* parent,
     PathComponentPiece name,
     bool isUnlinked,
-    const folly::Synchronized<Members>::LockedPtr& data) {
+    const Shard::LockedPtr& data) {
   auto fuseCount = inode->getFuseRefcount();
-  if (fuseCount > 0) {
+  if (fuseCount > 0 && !shuttingDown_.load(std::memory_order_acquire)) {
     // Insert an unloaded entry
     VLOG(5) << "unloading inode " << inode->getNodeId()
             << " with FUSE refcount=" << fuseCount << ": "
             << inode->getLogPath();
-    auto unloadedEntry =
-        UnloadedInode(inode->getNodeId(), parent->getNodeId(), name);
+    VLOG(7) << "reverse unload emplace " << parent->getNodeId() << ":"
+            << name;
+    auto ret =
+        data->emplaceUnloaded(inode->getNodeId(), parent->getNodeId(), name);
+    CHECK(ret.second);
+    auto& unloadedEntry = ret.first->second;
     unloadedEntry.numFuseReferences = fuseCount;
     unloadedEntry.isUnlinked = isUnlinked;
-    auto reverseInsertKey =
-        std::make_pair(unloadedEntry.parent, unloadedEntry.name.piece());
-    VLOG(7) << "reverse unload emplace " << reverseInsertKey.first << ":"
-            << reverseInsertKey.second;
-    auto ret = data->unloadedInodes_.emplace(
-        inode->getNodeId(), std::move(unloadedEntry));
-    CHECK(ret.second);
   } else {
     VLOG(5) << "forgetting unreferenced inode " << inode->getNodeId() << ": "
             << inode->getLogPath();
@@ -552,13 +843,50 @@ void InodeMap::unloadInode(
                          << inode->getLogPath();
 }
 
+void InodeMap::unloadChildrenForShutdown(
+    std::vector<InodeBase**>& childSlots,
+    std::vector<InodeBase*>* unloaded) {
+  DCHECK(shuttingDown_.load(std::memory_order_acquire));
+  std::sort(
+      childSlots.begin(),
+      childSlots.end(),
+      [](InodeBase** a, InodeBase** b) {
+        return getShardIndex((*a)->getNodeId()) <
+            getShardIndex((*b)->getNodeId());
+      });
+
+  size_t n = 0;
+  while (n < childSlots.size()) {
+    auto shardIndex = getShardIndex((*childSlots[n])->getNodeId());
+    auto data = shards_[shardIndex]->wlock();
+    for (; n < childSlots.size() &&
+         getShardIndex((*childSlots[n])->getNodeId()) == shardIndex;
+         ++n) {
+      auto* inode = *childSlots[n];
+      // Checking this with the shard lock held ensures that a lookup by
+      // inode number cannot acquire a new reference before it is erased.
+      if (!inode->isPtrAcquireCountZero()) {
+        continue;
+      }
+      auto numErased = data->loadedInodes_.erase(inode->getNodeId());
+      CHECK_EQ(numErased, 1) << "inconsistent loaded inodes data: "
+                             << inode->getLogPath();
+      unloaded->push_back(inode);
+      *childSlots[n] = nullptr;
+    }
+  }
+}
+
 bool InodeMap::shouldLoadChild(
     TreeInode* parent,
     PathComponentPiece name,
     fuse_ino_t childInode,
     folly::Promise<InodePtr> promise) {
-  auto data = data_.wlock();
-  CHECK(childInode < data->nextInodeNumber_);
+  CHECK(childInode < nextInodeNumber_.load(std::memory_order_relaxed));
+  auto data = RequestTrace::lockTraced(
+      RequestTrace::INODE_MAP_LOCK,
+      "InodeMap::shouldLoadChild",
+      [&] { return getShard(childInode).wlock(); });
   auto iter = data->unloadedInodes_.find(childInode);
   UnloadedInode* unloadedData{nullptr};
   if (iter == data->unloadedInodes_.end()) {
@@ -568,14 +896,11 @@ bool InodeMap::shouldLoadChild(
     //
     // Insert a new entry into data->unloadedInodes_
     fuse_ino_t parentNumber = parent->getNodeId();
-    auto newUnloadedData = UnloadedInode(childInode, parentNumber, name);
-    auto ret =
-        data->unloadedInodes_.emplace(childInode, std::move(newUnloadedData));
+    auto ret = data->emplaceUnloaded(childInode, parentNumber, name);
     DCHECK(ret.second);
     unloadedData = &ret.first->second;
   } else {
     unloadedData = &iter->second;
-    DCHECK_EQ(unloadedData->number, childInode);
   }
 
   bool isFirstPromise = unloadedData->promises.empty();
@@ -593,44 +918,117 @@ fuse_ino_t InodeMap::newChildLoadStarted(
     TreeInode* parent,
     PathComponentPiece name,
     folly::Promise<InodePtr> promise) {
-  auto data = data_.wlock();
-
   // Allocate a new inode number
-  auto childNumber = allocateInodeNumber(*data);
+  auto childNumber = allocateInodeNumber();
 
   // Put an entry in unloadedInodes_
   fuse_ino_t parentNumber = parent->getNodeId();
-  auto unloadedData = UnloadedInode(childNumber, parentNumber, name);
-  unloadedData.promises.push_back(std::move(promise));
-  data->unloadedInodes_.emplace(childNumber, std::move(unloadedData));
+  auto data = getShard(childNumber).wlock();
+  auto ret = data->emplaceUnloaded(childNumber, parentNumber, name);
+  DCHECK(ret.second);
+  ret.first->second.promises.push_back(std::move(promise));
 
   // Return the inode number
   return childNumber;
 }
 
 fuse_ino_t InodeMap::allocateInodeNumber() {
-  auto data = data_.wlock();
-  return allocateInodeNumber(*data);
+  // fuse_ino_t should generally be 64-bits wide, in which case it isn't even
+  // worth bothering to handle the case where nextInodeNumber_ wraps.
+  // We don't need to bother checking for conflicts with existing inode numbers
+  // since this can only happen if we wrap around.
+  static_assert(
+      sizeof(fuse_ino_t) >= 8, "expected fuse_ino_t to be at least 64-bits");
+  auto number = nextInodeNumber_.fetch_add(1, std::memory_order_relaxed);
+  if (UNLIKELY(number >= reservedInodeLimit_.load(std::memory_order_acquire))) {
+    reserveInodeNumbers(number);
+  }
+  return number;
+}
+
+void InodeMap::reserveInodeNumbers(fuse_ino_t number) {
+  std::lock_guard<std::mutex> guard(reserveMutex_);
+  auto limit = reservedInodeLimit_.load(std::memory_order_relaxed);
+  if (number < limit) {
+    // Another thread reserved a block including this number while we were
+    // waiting for the lock.
+    return;
+  }
+
+  // The new limit has to be on disk before the number is returned, since
+  // the caller may store it in the overlay straight away.
+  limit = number + 1 + kInodeNumberReservation;
+  mount_->getOverlay()->saveInodeHighWaterMark(limit);
+  reservedInodeLimit_.store(limit, std::memory_order_release);
 }
 
 void InodeMap::inodeCreated(const InodePtr& inode) {
   VLOG(4) << "created new inode " << inode->getNodeId() << ": "
           << inode->getLogPath();
-  auto data = data_.wlock();
+  auto data = getShard(inode->getNodeId()).wlock();
   data->loadedInodes_.emplace(inode->getNodeId(), inode.get());
 }
 
-fuse_ino_t InodeMap::allocateInodeNumber(Members& data) {
-  // fuse_ino_t should generally be 64-bits wide, in which case it isn't even
-  // worth bothering to handle the case where nextInodeNumber_ wraps.
-  // We don't need to bother checking for conflicts with existing inode numbers
-  // since this can only happen if we wrap around.
-  static_assert(
-      sizeof(data.nextInodeNumber_) >= 8,
-      "expected fuse_ino_t to be at least 64-bits");
-  fuse_ino_t number = data.nextInodeNumber_;
-  ++data.nextInodeNumber_;
-  return number;
+InodeMapStats InodeMap::getStats() const {
+  InodeMapStats result;
+  for (const auto& shard : shards_) {
+    auto data = shard->rlock();
+    result.loadedInodes += data->loadedInodes_.size();
+    result.unloadedInodes += data->unloadedInodes_.size();
+    result.internedNames += data->names_.size();
+    result.memoryBytes += data->loadedInodes_.getMemoryUsage() +
+        data->unloadedInodes_.getMemoryUsage() +
+        data->names_.getMemoryUsage();
+  }
+  result.memoryBytes += sizeof(*this) + shards_.size() * sizeof(Shard);
+  return result;
+}
+
+std::pair<InodeMap::Members::UnloadedMap::iterator, bool>
+InodeMap::Members::emplaceUnloaded(
+    fuse_ino_t number,
+    fuse_ino_t parent,
+    PathComponentPiece name) {
+  auto ret = unloadedInodes_.emplace(number, parent, nullptr);
+  if (ret.second) {
+    ret.first->second.name = names_.intern(name);
+  }
+  return ret;
+}
+
+void InodeMap::Members::eraseUnloaded(UnloadedMap::iterator it) {
+  names_.release(it->second.name);
+  unloadedInodes_.erase(it);
+}
+
+const std::string* InodeMap::NamePool::intern(PathComponentPiece name) {
+  auto ret = names_.emplace(name.stringPiece().str(), 0);
+  if (ret.second && ret.first->first.capacity() > kInlineStringCapacity) {
+    stringBytes_ += ret.first->first.capacity() + 1;
+  }
+  ++ret.first->second;
+  return &ret.first->first;
+}
+
+void InodeMap::NamePool::release(const std::string* name) {
+  auto it = names_.find(*name);
+  DCHECK(it != names_.end());
+  DCHECK_EQ(&it->first, name);
+  if (--it->second == 0) {
+    if (it->first.capacity() > kInlineStringCapacity) {
+      stringBytes_ -= it->first.capacity() + 1;
+    }
+    names_.erase(it);
+  }
+}
+
+size_t InodeMap::NamePool::getMemoryUsage() const {
+  // Each entry is a separately allocated node holding the string, its
+  // reference count, the cached hash and the next pointer.
+  constexpr size_t kNodeSize = sizeof(std::pair<const std::string, size_t>) +
+      sizeof(size_t) + sizeof(void*);
+  return names_.size() * kNodeSize + names_.bucket_count() * sizeof(void*) +
+      stringBytes_;
 }
 }
 }
@@ -11,12 +11,19 @@
 
 #include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
+#include <atomic>
+#include <chrono>
 #include <list>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "eden/fs/inodes/InodePtr.h"
 #include "eden/fuse/fuse_headers.h"
+#include "eden/utils/IntHashMap.h"
+#include "eden/utils/LockProfiler.h"
 #include "eden/utils/PathFuncs.h"
 
 namespace folly {
@@ -26,6 +33,10 @@ class exception_wrapper;
 namespace facebook {
 namespace eden {
 
+namespace takeover {
+class SerializedInodeMap;
+}
+
 class EdenMount;
 class FileInode;
 class InodeBase;
@@ -41,6 +52,33 @@ struct UnloadedInodeData {
 
 class InodeMapLock;
 
+/**
+ * Statistics about an InodeMap.
+ */
+struct InodeMapStats {
+  /** The number of inodes currently loaded */
+  size_t loadedInodes{0};
+  /** The number of inode numbers remembered for inodes that are not loaded */
+  size_t unloadedInodes{0};
+  /** The number of distinct names stored for the unloaded inodes */
+  size_t internedNames{0};
+  /**
+   * An estimate of the memory used by the InodeMap's own data structures.
+   *
+   * This does not include the InodeBase objects themselves, or the promises
+   * of inodes that are currently being loaded.
+   */
+  size_t memoryBytes{0};
+
+  /**
+   * Returns the average memory used per inode number tracked by the map.
+   */
+  size_t getBytesPerInode() const {
+    auto numInodes = loadedInodes + unloadedInodes;
+    return numInodes == 0 ? 0 : memoryBytes / numInodes;
+  }
+};
+
 /**
  * InodeMap allows looking up Inode objects based on a inode number
  * (fuse_ino_t).
@@ -96,6 +134,25 @@ class InodeMapLock;
  *
  *   We currently always allocate a fuse_ino_t value for any new Inode object
  *   even if it is not needed yet by the FUSE APIs.
+ *
+ * Locking:
+ * - The maps are split into kNumShards shards by inode number, each with its
+ *   own lock, so that operations on different inodes from different FUSE
+ *   threads do not serialize on a single lock.  All state for a given inode
+ *   number lives in the same shard, and operations on a single inode only
+ *   ever hold that shard's lock.
+ * - No code ever holds more than one shard lock at a time, except
+ *   lockForUnload(), which acquires all of them in shard order.
+ *
+ * Shutdown:
+ * - Once beginShutdown() has been called, unloaded inodes are simply
+ *   forgotten.  The inode numbers were already saved for the next mount, so
+ *   recording them in unloadedInodes_ for FUSE would be wasted work, and
+ *   directories hand over their unreferenced children in bulk with
+ *   unloadChildrenForShutdown() rather than locking every shard for each
+ *   directory.
+ * - Inode numbers are allocated from an atomic counter and do not require
+ *   any lock.
  */
 class InodeMap {
  public:
@@ -208,6 +265,18 @@ class InodeMap {
    */
   UnloadedInodeData lookupUnloadedInode(fuse_ino_t number);
 
+  /**
+   * Returns true if a load of the specified inode number has been requested
+   * and is still in progress.
+   */
+  bool isInodeLoading(fuse_ino_t number);
+
+  /**
+   * Returns true if the specified inode is loaded, or is unloaded but still
+   * tracked because FUSE or a loaded parent may refer to it.
+   */
+  bool isInodeRemembered(fuse_ino_t number);
+
   /**
    * Decrement the number of outstanding FUSE references to an inode number.
    *
@@ -221,15 +290,54 @@ class InodeMap {
   void decFuseRefcount(fuse_ino_t number, uint32_t count = 1);
 
   /**
-   * Persist the inode number state to disk.
+   * Decrement the FUSE reference counts of several inode numbers, given as
+   * (number, count) pairs.
+   *
+   * This behaves like calling decFuseRefcount() for each pair, but takes
+   * each shard lock only once for the whole batch.  The reference counts of
+   * loaded inodes are only decremented after all of the shard locks have
+   * been released, so unloading the inodes that become unreferenced never
+   * holds up the rest of the batch.  This is used for FUSE forget_multi
+   * requests, which can drop thousands of references at once when the
+   * kernel prunes its dentry cache.
+   */
+  void decFuseRefcountBatch(
+      const std::vector<std::pair<fuse_ino_t, uint32_t>>& forgets);
+
+  /**
+   * Save the inode number state, so that another edenfs process can take
+   * over the mount point without unmounting it, or so that the next mount
+   * of it can give the same inodes the same numbers (see loadPersisted()).
+   *
+   * This records every inode other than the root, loaded or not, with its
+   * parent, name and FUSE reference count, so that load() can put them all
+   * into the unloadedInodes_ map.  It must only be called once the FUSE
+   * channel has stopped, so that the reference counts no longer change.
    *
-   * This API supports gracefully restarting the eden server without unmounting
-   * the mount point.
+   * Unlinked inodes are left out, since they cannot be found again from
+   * their parent.
+   */
+  takeover::SerializedInodeMap save();
+
+  /**
+   * Restore the state that save() recorded in another process.
    *
-   * This persists sufficient data to reconstruct all inode state into the
-   * unloadedInodes_ map.
+   * This must be called after initialize(), before the mount point starts
+   * serving FUSE requests.
    */
-  void save();
+  void load(const takeover::SerializedInodeMap& data);
+
+  /**
+   * Restore the inode numbers that save() recorded when the mount point was
+   * last cleanly shut down, so that paths keep their st_ino across restarts.
+   *
+   * Unlike load() this ignores the FUSE reference counts, since the kernel
+   * forgot every inode when the filesystem was unmounted.  The numbers are
+   * only handed to each TreeInode's children when it is next loaded.  This
+   * must be called after initialize(), before any inode other than the root
+   * is loaded.
+   */
+  void loadPersisted(const takeover::SerializedInodeMap& data);
 
   /**
    * beginShutdown() is invoked by EdenMount::destroy()
@@ -287,6 +395,40 @@ class InodeMap {
       bool isUnlinked,
       const InodeMapLock& lock);
 
+  /**
+   * Unload the unreferenced children of a TreeInode during shutdown.
+   *
+   * childSlots points at the inode fields of the TreeInode's entries for
+   * its loaded, non-directory children.  Each child that is unreferenced is
+   * removed from the loaded inodes, its slot is reset to null, and it is
+   * appended to unloaded.  Each shard's lock is acquired only once, so this
+   * is much cheaper than lockForUnload() and unloadInode() for each child.
+   *
+   * The caller must hold the TreeInode's contents lock, and must delete the
+   * unloaded inodes only after releasing it, as with unloadInode().
+   */
+  void unloadChildrenForShutdown(
+      std::vector<InodeBase**>& childSlots,
+      std::vector<InodeBase*>* unloaded);
+
+  /**
+   * Unload inodes that have not been used recently.
+   *
+   * Unreferenced inodes that have not been looked up within maxAge are
+   * unloaded.  If more than maxLoadedInodes inodes are loaded, all
+   * unreferenced inodes are unloaded regardless of age.  A maxLoadedInodes
+   * of 0 disables the limit.
+   *
+   * See TreeInode::unloadChildrenLastAccessedBefore() for which inodes are
+   * considered.  This works one directory at a time, and is safe to call
+   * while the mount is in use.
+   *
+   * Returns the number of inodes unloaded.
+   */
+  size_t unloadInactiveInodes(
+      std::chrono::seconds maxAge,
+      size_t maxLoadedInodes);
+
   /////////////////////////////////////////////////////////////////////////
   // The following public APIs should only be used by TreeInode
   /////////////////////////////////////////////////////////////////////////
@@ -390,6 +532,19 @@ class InodeMap {
   fuse_ino_t allocateInodeNumber();
   void inodeCreated(const InodePtr& inode);
 
+  /**
+   * Returns the inode number that the next call to allocateInodeNumber()
+   * will return.
+   */
+  fuse_ino_t getNextInodeNumber() const {
+    return nextInodeNumber_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Get a snapshot of the InodeMap statistics, summed over all shards.
+   */
+  InodeMapStats getStats() const;
+
  private:
   friend class InodeMapLock;
 
@@ -400,15 +555,22 @@ class InodeMap {
    * we return to callers.  This class tracks more state.
    */
   struct UnloadedInode {
-    UnloadedInode(
-        fuse_ino_t num,
-        fuse_ino_t parentNum,
-        PathComponentPiece entryName)
-        : number(num), parent(parentNum), name(entryName) {}
-
-    fuse_ino_t const number;
-    fuse_ino_t const parent;
-    PathComponent const name;
+    UnloadedInode() = default;
+    UnloadedInode(fuse_ino_t parentNum, const std::string* entryName)
+        : parent(parentNum), name(entryName) {}
+
+    PathComponentPiece getName() const {
+      return PathComponentPiece{*name, detail::SkipPathSanityCheck{}};
+    }
+
+    /*
+     * The inode number itself is not stored here, since it is the key of the
+     * entry in unloadedInodes_.  These are not const, since entries are moved
+     * around within the table as it changes.
+     */
+    fuse_ino_t parent{0};
+    /** The name of this inode in its parent, interned in the shard's names_ */
+    const std::string* name{nullptr};
 
     /**
      * A boolean indicating if this inode is unlinked.
@@ -428,7 +590,7 @@ class InodeMap {
      *
      * (We could use folly::SharedPromise here instead, but it has extra
      * overhead that we don't really need.  It performs its own locking, but we
-     * are already protected by the data_ lock.)
+     * are already protected by the shard lock.)
      */
     PromiseVector promises;
     /**
@@ -439,7 +601,65 @@ class InodeMap {
     int64_t numFuseReferences{0};
   };
 
+  /**
+   * A reference counted set of the names of unloaded inodes.
+   *
+   * Many unloaded inodes share the same few names (BUCK, TARGETS,
+   * __init__.py, ...), so each UnloadedInode points at a single shared copy
+   * of its name rather than holding its own string.
+   *
+   * NamePool is not thread-safe.  It is protected by the lock of the shard
+   * that contains it.
+   */
+  class NamePool {
+   public:
+    /**
+     * Returns the pooled copy of name, adding a reference to it.
+     * The pointer stays valid until the matching release() call.
+     */
+    const std::string* intern(PathComponentPiece name);
+    void release(const std::string* name);
+
+    size_t size() const {
+      return names_.size();
+    }
+
+    /**
+     * Returns an estimate of the memory used by the pool.
+     */
+    size_t getMemoryUsage() const;
+
+   private:
+    std::unordered_map<std::string, size_t> names_;
+    /** The heap memory used by the strings in names_ */
+    size_t stringBytes_{0};
+  };
+
+  /**
+   * The data for one shard of the map.
+   *
+   * A shard holds the entries for every inode number whose getShardIndex()
+   * is the shard's index.
+   */
   struct Members {
+    using UnloadedMap = IntHashMap<fuse_ino_t, UnloadedInode>;
+
+    /**
+     * Add an entry to unloadedInodes_, unless one already exists for number.
+     *
+     * All insertions into unloadedInodes_ should go through this method, so
+     * that the entry's name is taken from the names_ pool.
+     */
+    std::pair<UnloadedMap::iterator, bool> emplaceUnloaded(
+        fuse_ino_t number,
+        fuse_ino_t parent,
+        PathComponentPiece name);
+
+    /**
+     * Remove an entry from unloadedInodes_, releasing its name.
+     */
+    void eraseUnloaded(UnloadedMap::iterator it);
+
     /**
      * The map of loaded inodes
      *
@@ -448,22 +668,40 @@ class InodeMap {
      * looked up the InodeMap will wrap the Inode in an InodePtr so that the
      * caller acquires a reference.
      */
-    std::unordered_map<fuse_ino_t, InodeBase*> loadedInodes_;
+    IntHashMap<fuse_ino_t, InodeBase*> loadedInodes_;
 
     /**
      * The map of currently unloaded inodes
      */
-    std::unordered_map<fuse_ino_t, UnloadedInode> unloadedInodes_;
+    UnloadedMap unloadedInodes_;
 
-    /** The next inode number to allocate */
-    fuse_ino_t nextInodeNumber_{FUSE_ROOT_ID + 1};
+    /**
+     * The names of the inodes in unloadedInodes_
+     */
+    NamePool names_;
   };
+  using Shard =
+      folly::Synchronized<Members, ProfiledMutex<LockProfiler::INODE_MAP_LOCK>>;
+
+  /**
+   * The number of shards.
+   *
+   * Inode numbers are allocated sequentially, so taking the number modulo the
+   * shard count spreads inodes that are used together over all shards.
+   */
+  static constexpr size_t kNumShards = 64;
 
   InodeMap(InodeMap const&) = delete;
   InodeMap& operator=(InodeMap const&) = delete;
 
   void shutdownComplete();
 
+  /**
+   * Give a newly loaded TreeInode the numbers that load() restored for its
+   * children.
+   */
+  void restoreChildInodeNumbers(InodeBase* inode);
+
   void setupParentLookupPromise(
       folly::Promise<InodePtr>& promise,
       PathComponentPiece childName,
@@ -479,12 +717,28 @@ class InodeMap {
    * Extract the list of promises waiting on the specified inode number to be
    * loaded.
    *
-   * This method acquires the data_ lock internally.
+   * This method acquires the shard lock for number internally.
    * It should never be called while already holding the lock.
    */
   PromiseVector extractPendingPromises(fuse_ino_t number);
 
-  fuse_ino_t allocateInodeNumber(Members& data);
+  /**
+   * Decrement the FUSE reference count of an inode number that is not
+   * loaded, forgetting it once the count drops to zero.
+   *
+   * The caller must hold the lock for the number's shard.
+   */
+  void decUnloadedFuseRefcount(
+      Members& data,
+      fuse_ino_t number,
+      uint32_t count);
+
+  static size_t getShardIndex(fuse_ino_t number) {
+    return number % kNumShards;
+  }
+  Shard& getShard(fuse_ino_t number) {
+    return *shards_[getShardIndex(number)];
+  }
 
   /**
    * Unload an inode
@@ -493,14 +747,18 @@ class InodeMap {
    * referenced by FUSE, adds it to the unloadedInodes_ map.
    *
    * The caller is responsible for actually deleting the Inode object after
-   * releasing the InodeMap lock.
+   * releasing the InodeMap lock.  The lock passed in must be the lock for the
+   * shard containing the inode.
    */
   void unloadInode(
       const InodeBase* inode,
       TreeInode* parent,
       PathComponentPiece name,
       bool isUnlinked,
-      const folly::Synchronized<Members>::LockedPtr& lock);
+      const Shard::LockedPtr& lock);
+
+  /** Save a new inode high-water mark greater than number. */
+  void reserveInodeNumbers(fuse_ino_t number);
 
   /**
    * The EdenMount that owns this InodeMap.
@@ -520,17 +778,54 @@ class InodeMap {
    */
   std::atomic<bool> shuttingDown_{false};
 
+  /** The next inode number to allocate */
+  std::atomic<fuse_ino_t> nextInodeNumber_{FUSE_ROOT_ID + 1};
+
+  /**
+   * The inode high-water mark last saved in the overlay.
+   *
+   * Inode numbers below this can be handed out without touching the disk.
+   * Reaching it makes allocateInodeNumber() call reserveInodeNumbers() under
+   * reserveMutex_ to save a new one, kInodeNumberReservation numbers further
+   * on.  This way a mount that was not shut down cleanly can start again
+   * without scanning its whole overlay, at the cost of skipping the rest of
+   * the reserved block.
+   */
+  std::atomic<fuse_ino_t> reservedInodeLimit_{0};
+  std::mutex reserveMutex_;
+  static constexpr fuse_ino_t kInodeNumberReservation = 1 << 16;
+
+  using RestoredChildren = std::vector<std::pair<PathComponent, fuse_ino_t>>;
+  void addRestoredChildren(
+      std::unordered_map<fuse_ino_t, RestoredChildren>&& children);
   /**
-   * The locked data.
+   * The inode numbers restored by load() or loadPersisted() whose parents
+   * have not been loaded yet, keyed by parent inode number.
    *
-   * Note: be very careful to hold this lock only when necessary.  No other
-   * locks should be acquired when holding this lock.  In particular this means
-   * that we should never access any InodeBase objects while holding the lock,
-   * since we should not hold our lock while an InodeBase acquires its own
-   * internal lock.  (This makes it safe for InodeBase to perform operations on
-   * the InodeMap while holding their own lock.)
+   * A TreeInode loaded from source control does not know the numbers of its
+   * children, so the ones the kernel still uses are given to it when it
+   * finishes loading, before its children can be looked up by name.
+   * hasRestoredChildren_ lets inode loads skip the lock once this is empty.
+   */
+  folly::Synchronized<std::unordered_map<fuse_ino_t, RestoredChildren>>
+      restoredChildren_;
+  std::atomic<bool> hasRestoredChildren_{false};
+
+  /**
+   * The locked data, split into kNumShards shards.
+   *
+   * Each shard is allocated separately so that the locks of neighbouring
+   * shards are less likely to share a cache line.
+   *
+   * Note: be very careful to hold these locks only when necessary.  No other
+   * locks should be acquired when holding a shard lock, including the locks
+   * of other shards.  In particular this means that we should never access
+   * any InodeBase objects while holding the lock, since we should not hold
+   * our lock while an InodeBase acquires its own internal lock.  (This makes
+   * it safe for InodeBase to perform operations on the InodeMap while holding
+   * their own lock.)
    */
-  folly::Synchronized<Members> data_;
+  std::vector<std::unique_ptr<Shard>> shards_;
 };
 
 /**
@@ -538,21 +833,23 @@ class InodeMap {
  * in order to make multiple calls to unloadInode() without releasing and
  * re-acquiring the lock.
  *
+ * The inodes being unloaded may live in any shard, so this holds the locks
+ * for all of the InodeMap's shards.
+ *
  * This mostly exists to make forward declarations simpler.
  */
 class InodeMapLock {
  public:
-  explicit InodeMapLock(
-      folly::Synchronized<InodeMap::Members>::LockedPtr&& data)
+  explicit InodeMapLock(std::vector<InodeMap::Shard::LockedPtr>&& data)
       : data_(std::move(data)) {}
 
   void unlock() {
-    data_.unlock();
+    data_.clear();
   }
 
  private:
   friend class InodeMap;
-  folly::Synchronized<InodeMap::Members>::LockedPtr data_;
+  std::vector<InodeMap::Shard::LockedPtr> data_;
 };
 }
 }
@@ -12,9 +12,30 @@
 #include <folly/Exception.h>
 #include <folly/File.h>
 #include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <rocksdb/db.h>
+#include <rocksdb/write_batch.h>
 #include <thrift/lib/cpp2/protocol/Serializer.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <exception>
+#include <thread>
 #include "eden/fs/inodes/gen-cpp2/overlay_types.h"
+#include "eden/fs/rocksdb/RocksDbUtil.h"
+#include "eden/fs/rocksdb/RocksException.h"
+#include "eden/fs/takeover/gen-cpp2/takeover_types.h"
+#include "eden/utils/IoUring.h"
 #include "eden/utils/PathFuncs.h"
+#include "eden/utils/XAttr.h"
+
+DEFINE_bool(
+    overlay_io_uring,
+    false,
+    "Read and sync materialized files through io_uring rather than blocking "
+    "a FUSE worker thread on the disk");
 
 namespace facebook {
 namespace eden {
@@ -27,9 +48,10 @@ using folly::File;
 using folly::MutableStringPiece;
 using folly::Optional;
 using folly::StringPiece;
-using std::make_unique;
+using rocksdb::ReadOptions;
+using rocksdb::Slice;
+using rocksdb::WriteOptions;
 using std::string;
-using std::unique_ptr;
 
 /* Relative to the localDir, the metaFile holds the serialized rendition
  * of the overlay_ data.  We use thrift CompactSerialization for this.
@@ -37,6 +59,40 @@ using std::unique_ptr;
 constexpr StringPiece kMetaDir{"overlay"};
 constexpr StringPiece kMetaFile{"dirdata"};
 constexpr StringPiece kInfoFile{"info"};
+/**
+ * The RocksDB holding the serialized OverlayDir for each materialized
+ * directory.
+ */
+constexpr StringPiece kDirStoreDir{"dirs"};
+/**
+ * The kDirStoreDir column family holding the OverlayFileSha1 for each
+ * materialized file that has one.
+ */
+constexpr StringPiece kFileSha1Column{"file_sha1"};
+/**
+ * The directory holding one link to each file whose contents are shared by
+ * several materialized files, named after the SHA-1 of the contents and
+ * sharded by its first byte.
+ */
+constexpr StringPiece kSharedDir{"shared"};
+/** The extended attribute holding the SHA-1 of a shared file's contents */
+constexpr StringPiece kXattrSha1{"user.eden.sha1"};
+/** The buffer size used when copying shared contents */
+constexpr size_t kCopyBufferSize = 1024 * 1024;
+/** The number of overlay file operations that can be queued at a time */
+constexpr unsigned kIoUringEntries = 256;
+/**
+ * The next inode number to allocate, written when the overlay is cleanly
+ * closed.  It is removed as soon as it has been read, so that it is never
+ * trusted after an unclean shutdown.
+ */
+constexpr StringPiece kNextInodeNumberFile{"next-inode-number"};
+
+/**
+ * The inode numbers of the paths known to the last mount of this overlay,
+ * written alongside kNextInodeNumberFile and removed in the same way.
+ */
+constexpr StringPiece kInodeMapFile{"inode-map"};
 
 /**
  * 4-byte magic identifier to put at the start of the info file.
@@ -50,10 +106,29 @@ constexpr StringPiece kInfoHeaderMagic{"\xed\xe0\x00\x01"};
  * If we change the overlay storage format in the future we can bump this
  * version number to help identify when eden is reading overlay data created by
  * an older version of the code.
+ *
+ * Version 1 stored each directory in its own file, in the same place as the
+ * file contents.  Version 2 stores directories in the kDirStoreDir RocksDB.
+ * Version 1 overlays are upgraded when they are opened, and any directories
+ * still in the old format are moved to the RocksDB when they are loaded.
  */
-constexpr uint32_t kOverlayVersion = 1;
+constexpr uint32_t kOverlayVersion = 2;
+constexpr uint32_t kLegacyOverlayVersion = 1;
 constexpr size_t kInfoHeaderSize =
     kInfoHeaderMagic.size() + sizeof(kOverlayVersion);
+/**
+ * The info header may be followed by the inode high-water mark: a 64-bit big
+ * endian number that is greater than every inode number allocated so far.
+ * Older info files do not have it, and readers that do not know about it
+ * just ignore it.
+ */
+constexpr size_t kInfoHighWaterMarkSize = sizeof(uint64_t);
+
+/**
+ * The maximum number of threads scanning the overlay shard directories in
+ * scanForMaxRecordedInode().
+ */
+constexpr unsigned kMaxScanThreads = 16;
 
 /* Relative to the localDir, the overlay tree is where we create the
  * materialized directory structure; directories and files are created
@@ -61,6 +136,15 @@ constexpr size_t kInfoHeaderSize =
 constexpr StringPiece kOverlayTree{"tree"};
 
 namespace {
+/**
+ * Once a directory has more delta records than this fraction of its entries
+ * (plus kMinDirDeltas), the next flush rewrites it in full.  This keeps the
+ * cost of reading the deltas back in proportion to the directory size, while
+ * still amortizing each full rewrite over many changes.
+ */
+constexpr size_t kDirDeltaRatio = 4;
+constexpr size_t kMinDirDeltas = 16;
+
 /**
  * Get the name of the subdirectory to use for the overlay data for the
  * specified inode number.
@@ -75,12 +159,87 @@ void formatSubdirPath(MutableStringPiece subdirPath, fuse_ino_t inode) {
   subdirPath[0] = hexdigit[(inode >> 4) & 0xf];
   subdirPath[1] = hexdigit[inode & 0xf];
 }
+
+/**
+ * The key for an inode in the directory store.
+ *
+ * Inode numbers are stored big-endian so that the keys sort in numeric order.
+ */
+class DirKey {
+ public:
+  explicit DirKey(fuse_ino_t inodeNumber)
+      : value_(folly::Endian::big(static_cast<uint64_t>(inodeNumber))) {}
+
+  Slice slice() const {
+    return Slice{reinterpret_cast<const char*>(&value_), sizeof(value_)};
+  }
+
+  /**
+   * Get the key for a delta record for the named entry of this directory.
+   *
+   * Delta keys start with the directory's key, so they sort immediately after
+   * it, before the next directory.
+   */
+  string deltaKey(PathComponentPiece name) const {
+    auto nameStr = name.stringPiece();
+    string key{reinterpret_cast<const char*>(&value_), sizeof(value_)};
+    key.append(nameStr.data(), nameStr.size());
+    return key;
+  }
+
+  /** Returns true if key is this directory's record or one of its deltas */
+  bool matches(Slice key) const {
+    return key.starts_with(slice());
+  }
+
+  /**
+   * Get the inode number from a directory store key, which may be either a
+   * directory record or a delta.
+   */
+  static folly::Optional<fuse_ino_t> parse(Slice key) {
+    uint64_t value;
+    if (key.size() < sizeof(value)) {
+      return folly::none;
+    }
+    memcpy(&value, key.data(), sizeof(value));
+    return static_cast<fuse_ino_t>(folly::Endian::big(value));
+  }
+
+ private:
+  uint64_t value_;
+};
+
+/**
+ * Get the SHA-1 stored on an overlay file whose contents are shared, or none
+ * if it has none.
+ */
+Optional<Hash> getSharedFileSha1(int fd) {
+  try {
+    return Hash{fgetxattr(fd, kXattrSha1)};
+  } catch (const std::system_error& ex) {
+    if (ex.code().value() == kENOATTR) {
+      return folly::none;
+    }
+    throw;
+  }
+}
 }
 
-Overlay::Overlay(AbsolutePathPiece localDir) : localDir_(localDir) {
+Overlay::Overlay(AbsolutePathPiece localDir, OverlayDurability durability)
+    : localDir_(localDir), durability_(durability) {
   initOverlay();
+  if (FLAGS_overlay_io_uring) {
+    try {
+      ioUring_ = std::make_unique<IoUring>(kIoUringEntries);
+    } catch (const std::exception& ex) {
+      LOG(WARNING) << "not using io_uring for the overlay in " << localDir_
+                   << ": " << folly::exceptionStr(ex);
+    }
+  }
 }
 
+Overlay::~Overlay() {}
+
 void Overlay::initOverlay() {
   // Read the overlay version file.  If it does not exist, create it.
   //
@@ -102,7 +261,16 @@ void Overlay::initOverlay() {
     // This is an existing overlay directory.
     // Read the info file and make sure we are compatible with its version.
     File f(fd, true);
-    readExistingOverlay(f.fd());
+    auto version = readExistingOverlay(f.fd());
+    openDirStore();
+    scanUsage();
+    if (version == kLegacyOverlayVersion) {
+      // Directories are still read from their old files until they are next
+      // loaded, so nothing else needs to be converted up front.
+      LOG(INFO) << "upgrading eden overlay in " << localDir_
+                << " to version " << kOverlayVersion;
+      writeInfoFile();
+    }
   } else if (errno != ENOENT) {
     folly::throwSystemError(
         "error reading eden overlay info file ", infoPath.stringPiece());
@@ -121,7 +289,7 @@ bool Overlay::isOldFormatOverlay() const {
   return false;
 }
 
-void Overlay::readExistingOverlay(int infoFD) {
+uint32_t Overlay::readExistingOverlay(int infoFD) {
   // Read the info file header
   std::array<uint8_t, kInfoHeaderSize> infoHeader;
   auto sizeRead = folly::readFull(infoFD, infoHeader.data(), infoHeader.size());
@@ -148,10 +316,23 @@ void Overlay::readExistingOverlay(int infoFD) {
   version = folly::Endian::big(version);
 
   // Make sure we understand this version number
-  if (version != kOverlayVersion) {
+  if (version != kOverlayVersion && version != kLegacyOverlayVersion) {
     throw std::runtime_error(folly::to<string>(
         "Unsupported eden overlay format ", version, " in ", localDir_));
   }
+
+  // Read the inode high-water mark, if there is one
+  uint64_t highWaterMark;
+  sizeRead = folly::readFull(infoFD, &highWaterMark, sizeof(highWaterMark));
+  folly::checkUnixError(
+      sizeRead,
+      "error reading from overlay info file in ",
+      localDir_.stringPiece());
+  if (sizeRead == sizeof(highWaterMark)) {
+    inodeHighWaterMark_ =
+        static_cast<fuse_ino_t>(folly::Endian::big(highWaterMark));
+  }
+  return version;
 }
 
 void Overlay::initNewOverlay() {
@@ -162,6 +343,13 @@ void Overlay::initNewOverlay() {
     folly::throwSystemError(
         "error creating eden overlay directory ", localDir_.stringPiece());
   }
+
+  createShardDirectories();
+  openDirStore();
+  writeInfoFile();
+}
+
+void Overlay::createShardDirectories() {
   auto localDirFile = File(localDir_.stringPiece(), O_RDONLY);
 
   // We split the inode files across 256 subdirectories.
@@ -170,29 +358,81 @@ void Overlay::initNewOverlay() {
   subdirPath[2] = '\0';
   for (int n = 0; n < 256; ++n) {
     formatSubdirPath(MutableStringPiece{subdirPath.data(), 2}, n);
-    result = ::mkdirat(localDirFile.fd(), subdirPath.data(), 0755);
+    auto result = ::mkdirat(localDirFile.fd(), subdirPath.data(), 0755);
     if (result != 0 && errno != EEXIST) {
       folly::throwSystemError(
           "error creating eden overlay directory ",
           StringPiece{subdirPath.data()});
     }
   }
+}
 
-  // For now we just write a simple header, with a magic number to identify
-  // this as an eden overlay file, and the version number of the overlay
-  // format.
-  std::array<uint8_t, kInfoHeaderSize> infoHeader;
+void Overlay::writeInfoFile() {
+  // The file starts with a magic number to identify this as an eden overlay
+  // file, and the version number of the overlay format.  This is followed by
+  // the inode high-water mark, once one has been recorded.
+  std::array<uint8_t, kInfoHeaderSize + kInfoHighWaterMarkSize> infoHeader;
   memcpy(infoHeader.data(), kInfoHeaderMagic.data(), kInfoHeaderMagic.size());
   auto version = folly::Endian::big(kOverlayVersion);
   memcpy(
       infoHeader.data() + kInfoHeaderMagic.size(), &version, sizeof(version));
+  size_t infoSize = kInfoHeaderSize;
+  if (inodeHighWaterMark_ != 0) {
+    auto highWaterMark =
+        folly::Endian::big(static_cast<uint64_t>(inodeHighWaterMark_));
+    memcpy(
+        infoHeader.data() + kInfoHeaderSize,
+        &highWaterMark,
+        sizeof(highWaterMark));
+    infoSize += kInfoHighWaterMarkSize;
+  }
 
   auto infoPath = localDir_ + PathComponentPiece{kInfoFile};
   folly::writeFileAtomic(
-      infoPath.stringPiece(), ByteRange(infoHeader.data(), infoHeader.size()));
+      infoPath.stringPiece(), ByteRange(infoHeader.data(), infoSize));
+}
+
+void Overlay::openDirStore() {
+  auto dbPath = localDir_ + PathComponentPiece{kDirStoreDir};
+  rocksdb::DBOptions dbOptions;
+  dbOptions.IncreaseParallelism();
+  rocksdb::ColumnFamilyOptions columnOptions;
+  columnOptions.OptimizeLevelStyleCompaction();
+  // Directories are kept in the default column family, where overlays
+  // created before there were any others already have them.
+  std::vector<rocksdb::ColumnFamilyDescriptor> columns;
+  columns.emplace_back(rocksdb::kDefaultColumnFamilyName, columnOptions);
+  columns.emplace_back(kFileSha1Column.str(), columnOptions);
+  dirStore_ =
+      std::make_unique<RocksHandles>(dbPath.stringPiece(), dbOptions, columns);
+}
+
+rocksdb::ColumnFamilyHandle* Overlay::getFileSha1Column() const {
+  return dirStore_->columns[1].get();
+}
+
+void Overlay::syncOverlayFiles() {
+  // This is a single syscall for all of the files, rather than one fsync()
+  // for each file that has been written.
+  auto localDirFile = File(localDir_.stringPiece(), O_RDONLY);
+#ifdef __linux__
+  folly::checkUnixError(
+      ::syncfs(localDirFile.fd()), "error syncing overlay in ", localDir_);
+#else
+  ::sync();
+#endif
 }
 
 Optional<TreeInode::Dir> Overlay::loadOverlayDir(fuse_ino_t inodeNumber) const {
+  {
+    // Don't return data whose removal has not been flushed yet.
+    auto pending = pendingDirs_.rlock();
+    auto it = pending->find(inodeNumber);
+    if (it != pending->end() && !it->second.inode) {
+      return folly::none;
+    }
+  }
+
   auto dirData = deserializeOverlayDir(inodeNumber);
   if (!dirData.hasValue()) {
     return folly::none;
@@ -216,14 +456,13 @@ Optional<TreeInode::Dir> Overlay::loadOverlayDir(fuse_ino_t inodeNumber) const {
     const auto& name = iter.first;
     const auto& value = iter.second;
 
-    unique_ptr<TreeInode::Entry> entry;
     if (value.inodeNumber == 0) {
       auto hash = Hash(folly::ByteRange(folly::StringPiece(value.hash)));
-      entry = make_unique<TreeInode::Entry>(value.mode, hash);
+      result.entries.emplace(PathComponentPiece(name), value.mode, hash);
     } else {
-      entry = make_unique<TreeInode::Entry>(value.mode, value.inodeNumber);
+      result.entries.emplace(
+          PathComponentPiece(name), value.mode, value.inodeNumber);
     }
-    result.entries.emplace(PathComponentPiece(name), std::move(entry));
   }
 
   return folly::Optional<TreeInode::Dir>(std::move(result));
@@ -232,67 +471,732 @@ Optional<TreeInode::Dir> Overlay::loadOverlayDir(fuse_ino_t inodeNumber) const {
 void Overlay::saveOverlayDir(
     fuse_ino_t inodeNumber,
     const TreeInode::Dir* dir) {
+  // This is only used for new directories, so there are no delta records to
+  // remove.
+  putOverlayDir(inodeNumber, serializeOverlayDir(*dir));
+  (*storedDirs_.wlock())[inodeNumber] = 0;
+}
+
+overlay::OverlayEntry Overlay::serializeOverlayEntry(
+    const TreeInode::Entry& entry) {
+  overlay::OverlayEntry oent;
+  oent.mode = entry.mode;
+  if (entry.isMaterialized()) {
+    oent.inodeNumber = entry.getInodeNumber();
+    DCHECK_NE(oent.inodeNumber, 0);
+  } else {
+    oent.inodeNumber = 0;
+    auto bytes = entry.getHash().getBytes();
+    oent.hash =
+        std::string(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+  }
+  return oent;
+}
+
+string Overlay::serializeOverlayDir(const TreeInode::Dir& dir) {
   // Translate the data to the thrift equivalents
   overlay::OverlayDir odir;
 
-  if (dir->treeHash) {
-    auto bytes = dir->treeHash->getBytes();
+  if (dir.treeHash) {
+    auto bytes = dir.treeHash->getBytes();
     odir.treeHash =
         std::string(reinterpret_cast<const char*>(bytes.data()), bytes.size());
   }
-  for (auto& entIter : dir->entries) {
-    const auto& entName = entIter.first;
-    const auto ent = entIter.second.get();
+  for (auto& entIter : dir.entries) {
+    odir.entries.emplace(std::make_pair(
+        entIter.first.stringPiece().str(),
+        serializeOverlayEntry(entIter.second)));
+  }
+
+  // Ask thrift to serialize it.
+  return CompactSerializer::serialize<std::string>(odir);
+}
+
+void Overlay::markDirDirty(TreeInodePtr inode) {
+  auto inodeNumber = inode->getNodeId();
+  auto pending = pendingDirs_.wlock();
+  auto& dir = (*pending)[inodeNumber];
+  dir.inode = std::move(inode);
+  dir.rewrite = true;
+  dir.changedNames.clear();
+}
+
+void Overlay::markDirEntryDirty(TreeInodePtr inode, PathComponentPiece name) {
+  auto inodeNumber = inode->getNodeId();
+  auto pending = pendingDirs_.wlock();
+  auto ret = pending->emplace(inodeNumber, PendingDir{});
+  auto& dir = ret.first->second;
+  if (!dir.inode) {
+    dir.inode = std::move(inode);
+    // If this replaces a pending removal, whatever is stored for the
+    // directory is stale, so it has to be written out in full.
+    dir.rewrite = !ret.second;
+  }
+  if (!dir.rewrite) {
+    dir.changedNames.insert(name.copy());
+  }
+}
+
+void Overlay::flushDirs(bool sync) {
+  std::lock_guard<std::mutex> guard(flushMutex_);
+  PendingDirs pending;
+  pendingDirs_.wlock()->swap(pending);
+
+  if (durability_ == OverlayDurability::STRICT) {
+    sync = true;
+  } else if (durability_ == OverlayDurability::RELAXED) {
+    sync = false;
+  } else if (sync) {
+    // Batched mode doesn't sync files as they are written.  Sync them all
+    // now, before the directory records that may refer to them.
+    syncOverlayFiles();
+  }
+
+  WriteOptions options;
+  options.sync = sync;
+  if (pending.empty()) {
+    if (sync) {
+      auto status = dirStore_->db->SyncWAL();
+      RocksException::check(
+          status, "error syncing overlay directory store in ", localDir_);
+    }
+    return;
+  }
+
+  rocksdb::WriteBatch batch;
+  for (const auto& entry : pending) {
+    if (!entry.second.inode) {
+      deleteDirRecords(entry.first, true, &batch);
+      storedDirs_.wlock()->erase(entry.first);
+      continue;
+    }
+
+    // Serialize the directory as it is now.  Any changes made to it after we
+    // release the lock will mark it dirty again.
+    auto contents = entry.second.inode->getContents().rlock();
+    if (!contents->materialized) {
+      // The directory was dematerialized after it was marked dirty.  Its
+      // removal is queued separately.
+      continue;
+    }
+    addDirUpdates(entry.first, *contents, entry.second, &batch);
+  }
+
+  auto status = dirStore_->db->Write(options, &batch);
+  RocksException::check(
+      status,
+      "error writing ",
+      pending.size(),
+      " overlay directory updates in ",
+      localDir_);
+  VLOG(5) << "flushed " << pending.size() << " overlay directory updates in "
+          << localDir_;
+}
+
+void Overlay::addDirUpdates(
+    fuse_ino_t inodeNumber,
+    const TreeInode::Dir& dir,
+    const PendingDir& pending,
+    rocksdb::WriteBatch* batch) {
+  DirKey key{inodeNumber};
+  auto stored = storedDirs_.wlock();
+  auto storedIter = stored->find(inodeNumber);
+  auto maxDeltas = kMinDirDeltas + dir.entries.size() / kDirDeltaRatio;
+  if (pending.rewrite || storedIter == stored->end() ||
+      storedIter->second + pending.changedNames.size() > maxDeltas) {
+    // Write the whole directory, replacing any deltas stored after it.
+    bool haveDeltas = storedIter == stored->end() || storedIter->second > 0;
+    if (haveDeltas) {
+      deleteDirRecords(inodeNumber, false, batch);
+    }
+    batch->Put(key.slice(), serializeOverlayDir(dir));
+    (*stored)[inodeNumber] = 0;
+    return;
+  }
 
-    overlay::OverlayEntry oent;
-    oent.mode = ent->mode;
-    if (ent->isMaterialized()) {
-      oent.inodeNumber = ent->getInodeNumber();
-      DCHECK_NE(oent.inodeNumber, 0);
+  // Delta records hold the serialized OverlayEntry, or are empty if the
+  // entry has been removed.
+  for (const auto& name : pending.changedNames) {
+    auto deltaKey = key.deltaKey(name);
+    auto iter = dir.entries.find(name);
+    if (iter == dir.entries.end()) {
+      batch->Put(deltaKey, Slice{});
     } else {
-      oent.inodeNumber = 0;
-      auto bytes = ent->getHash().getBytes();
-      oent.hash = std::string(
-          reinterpret_cast<const char*>(bytes.data()), bytes.size());
+      batch->Put(
+          deltaKey,
+          CompactSerializer::serialize<std::string>(
+              serializeOverlayEntry(iter->second)));
     }
+  }
+  storedIter->second += pending.changedNames.size();
+}
 
-    odir.entries.emplace(
-        std::make_pair(entName.stringPiece().str(), std::move(oent)));
+void Overlay::deleteDirRecords(
+    fuse_ino_t inodeNumber,
+    bool includeDir,
+    rocksdb::WriteBatch* batch) const {
+  DirKey key{inodeNumber};
+  if (includeDir) {
+    batch->Delete(key.slice());
   }
+  std::unique_ptr<rocksdb::Iterator> it{
+      dirStore_->db->NewIterator(ReadOptions())};
+  for (it->Seek(key.slice()); it->Valid() && key.matches(it->key());
+       it->Next()) {
+    if (it->key().size() > key.slice().size()) {
+      batch->Delete(it->key());
+    }
+  }
+  RocksException::check(
+      it->status(), "error reading overlay data for directory ", inodeNumber);
+}
 
-  // Ask thrift to serialize it.
-  auto serializedData = CompactSerializer::serialize<std::string>(odir);
+void Overlay::putOverlayDir(fuse_ino_t inodeNumber, StringPiece data) const {
+  // We don't ask RocksDB to sync each write.  It appends the write to its log,
+  // which is enough to survive the process crashing, and it commits writes
+  // made concurrently by several threads as a single batch.
+  auto status = dirStore_->db->Put(
+      WriteOptions(),
+      DirKey{inodeNumber}.slice(),
+      Slice{data.data(), data.size()});
+  RocksException::check(
+      status, "error saving overlay data for directory inode ", inodeNumber);
+}
 
-  // And update the file on disk
-  folly::writeFileAtomic(
-      getFilePath(inodeNumber).stringPiece(), serializedData);
+void Overlay::updateUsage(int64_t filesDelta, int64_t bytesDelta) {
+  usageFiles_.fetch_add(filesDelta, std::memory_order_relaxed);
+  usageBytes_.fetch_add(bytesDelta, std::memory_order_relaxed);
+}
+
+OverlayUsage Overlay::getUsage() const {
+  // The two counts are updated separately, and may be briefly out of step.
+  OverlayUsage usage;
+  usage.files = std::max<int64_t>(usageFiles_.load(), 0);
+  usage.bytes = std::max<int64_t>(usageBytes_.load(), 0);
+  return usage;
 }
 
-void Overlay::removeOverlayData(fuse_ino_t inodeNumber) const {
+void Overlay::scanUsage() {
+  int64_t files = 0;
+  int64_t bytes = 0;
+  // Files with shared contents are only counted once.
+  std::unordered_set<ino_t> sharedFiles;
+  std::array<char, 2> subdir;
+  for (int n = 0; n < 256; ++n) {
+    formatSubdirPath(MutableStringPiece{subdir.data(), subdir.size()}, n);
+    auto subdirPath = localDir_ +
+        PathComponentPiece{StringPiece{subdir.data(), subdir.size()}};
+    auto boostPath = boost::filesystem::path{subdirPath.value().c_str()};
+    for (const auto& entry : boost::filesystem::directory_iterator(boostPath)) {
+      struct stat st;
+      if (::lstat(entry.path().c_str(), &st) == 0) {
+        ++files;
+        if (st.st_nlink <= 1 || sharedFiles.insert(st.st_ino).second) {
+          bytes += st.st_size;
+        }
+      }
+    }
+  }
+  updateUsage(files, bytes);
+}
+
+void Overlay::removeOverlayData(fuse_ino_t inodeNumber) {
+  // We don't know whether this inode is a file or a directory, so remove both
+  // the directory record and the file.  The file may also hold a directory
+  // in the legacy format.
+  //
+  // The directory record is only deleted by the next flush.  The parent's
+  // update is still pending too, and deleting the record first would leave
+  // the parent referring to a materialized child with no data if we crashed
+  // before the flush.
+  (*pendingDirs_.wlock())[inodeNumber] = PendingDir{};
+
+  removeOverlayFile(getFilePath(inodeNumber).value().toStdString());
+  removeFileSha1(inodeNumber);
+}
+
+folly::Optional<uint64_t> Overlay::removeOverlayFile(const string& path) {
+  struct stat st;
+  if (::lstat(path.c_str(), &st) != 0) {
+    if (errno != ENOENT) {
+      folly::throwSystemError("error looking up overlay file: ", path);
+    }
+    return folly::none;
+  }
+
+  folly::Optional<Hash> sha1;
+  std::unique_lock<std::mutex> lock;
+  if (st.st_nlink > 1) {
+    // The file may be the last one using a shared copy of its contents.
+    File file(path, O_RDONLY | O_NOFOLLOW);
+    sha1 = getSharedFileSha1(file.fd());
+    lock = std::unique_lock<std::mutex>(sharedFilesMutex_);
+  }
+
+  if (::unlink(path.c_str()) != 0) {
+    if (errno != ENOENT) {
+      folly::throwSystemError("error unlinking overlay file: ", path);
+    }
+    return folly::none;
+  }
+  if (st.st_nlink > 1 &&
+      !(sha1 && removeUnusedSharedFile(sha1.value(), st.st_ino, 1))) {
+    // Other files still use the contents.
+    updateUsage(-1, 0);
+    return 0;
+  }
+  updateUsage(-1, -st.st_size);
+  return st.st_blocks * 512;
+}
+
+bool Overlay::shareFileContents(fuse_ino_t inodeNumber, const Hash& sha1) {
   auto path = getFilePath(inodeNumber);
-  if (::unlink(path.value().c_str()) != 0 && errno != ENOENT) {
-    folly::throwSystemError("error unlinking overlay file: ", path);
+  auto sharedPath = getSharedFilePath(sha1);
+  std::lock_guard<std::mutex> guard(sharedFilesMutex_);
+
+  File file(path.value().toStdString(), O_RDONLY | O_NOFOLLOW);
+  struct stat st;
+  folly::checkUnixError(fstat(file.fd(), &st), "error looking up ", path);
+  if (st.st_nlink > 1) {
+    return true;
+  }
+
+  struct stat sharedSt;
+  if (::lstat(sharedPath.value().c_str(), &sharedSt) != 0) {
+    if (errno != ENOENT) {
+      folly::throwSystemError("error looking up shared file ", sharedPath);
+    }
+    // This is the first file with these contents, so it becomes the shared
+    // copy.
+    fsetxattr(file.fd(), kXattrSha1, sha1.toString());
+    auto result = ::link(path.value().c_str(), sharedPath.value().c_str());
+    if (result != 0 && errno == ENOENT) {
+      // The shared directories are created when they are first needed.
+      auto sharedDir = localDir_ + PathComponentPiece{kSharedDir};
+      for (const auto& dir : {sharedDir, sharedPath.dirname().copy()}) {
+        if (::mkdir(dir.value().c_str(), 0755) != 0 && errno != EEXIST) {
+          folly::throwSystemError("error creating ", dir);
+        }
+      }
+      result = ::link(path.value().c_str(), sharedPath.value().c_str());
+    }
+    folly::checkUnixError(result, "error linking ", sharedPath);
+    return true;
+  }
+
+  if (sharedSt.st_size != st.st_size) {
+    LOG(WARNING) << "not sharing the contents of overlay file " << path
+                 << ": shared file " << sharedPath << " has size "
+                 << sharedSt.st_size << " rather than " << st.st_size;
+    return false;
+  }
+  if (std::make_pair(st.st_mtim.tv_sec, st.st_mtim.tv_nsec) >
+      std::make_pair(sharedSt.st_mtim.tv_sec, sharedSt.st_mtim.tv_nsec)) {
+    // Only ever move modification times forwards, so that build tools do
+    // not take the files for being older than their inputs.
+    struct timespec times[2] = {sharedSt.st_atim, st.st_mtim};
+    folly::checkUnixError(
+        ::utimensat(AT_FDCWD, sharedPath.value().c_str(), times, 0),
+        "error setting the times of ",
+        sharedPath);
   }
+
+  auto tmpPath = folly::to<string>(path.stringPiece(), ".tmp");
+  if (::unlink(tmpPath.c_str()) != 0 && errno != ENOENT) {
+    folly::throwSystemError("error unlinking ", tmpPath);
+  }
+  folly::checkUnixError(
+      ::link(sharedPath.value().c_str(), tmpPath.c_str()),
+      "error linking ",
+      tmpPath);
+  folly::checkUnixError(
+      ::rename(tmpPath.c_str(), path.value().c_str()),
+      "error renaming ",
+      tmpPath);
+  updateUsage(0, -st.st_size);
+  return true;
+}
+
+void Overlay::unshareFileContents(fuse_ino_t inodeNumber, uint64_t size) {
+  auto path = getFilePath(inodeNumber);
+  std::unique_lock<std::mutex> lock(sharedFilesMutex_);
+  File file(path.value().toStdString(), O_RDONLY | O_NOFOLLOW);
+  struct stat st;
+  folly::checkUnixError(fstat(file.fd(), &st), "error looking up ", path);
+  if (st.st_nlink <= 1) {
+    return;
+  }
+  auto sha1 = getSharedFileSha1(file.fd());
+  if (st.st_nlink == 2 && sha1 &&
+      removeUnusedSharedFile(sha1.value(), st.st_ino, 2)) {
+    // No other file uses the contents, so this one can keep them.
+    fremovexattr(file.fd(), kXattrSha1);
+    return;
+  }
+  lock.unlock();
+
+  // Copy the contents without holding the lock.  Shared contents never
+  // change, and only the caller replaces this file.
+  auto tmpPath = folly::to<string>(path.stringPiece(), ".tmp");
+  {
+    File tmpFile(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    auto buf = std::make_unique<char[]>(kCopyBufferSize);
+    auto end = std::min<uint64_t>(size, st.st_size);
+    uint64_t pos = 0;
+    while (pos < end) {
+      auto len = std::min<uint64_t>(kCopyBufferSize, end - pos);
+      auto bytesRead = folly::preadFull(file.fd(), buf.get(), len, pos);
+      folly::checkUnixError(bytesRead, "error reading ", path);
+      if (bytesRead == 0) {
+        break;
+      }
+      folly::checkUnixError(
+          folly::writeFull(tmpFile.fd(), buf.get(), bytesRead),
+          "error writing ",
+          tmpPath);
+      pos += bytesRead;
+    }
+    struct timespec times[2] = {st.st_atim, st.st_mtim};
+    folly::checkUnixError(
+        futimens(tmpFile.fd(), times), "error setting the times of ", tmpPath);
+    if (durability_ == OverlayDurability::STRICT) {
+      folly::checkUnixError(::fsync(tmpFile.fd()), "error syncing ", tmpPath);
+    }
+  }
+
+  lock.lock();
+  folly::checkUnixError(
+      ::rename(tmpPath.c_str(), path.value().c_str()),
+      "error renaming ",
+      tmpPath);
+  // The file has all of its data to itself again, until the caller truncates
+  // it.
+  updateUsage(0, st.st_size);
+  // The other files may have stopped using the contents in the meantime.
+  if (sha1 && removeUnusedSharedFile(sha1.value(), st.st_ino, 1)) {
+    updateUsage(0, -st.st_size);
+  }
+}
+
+AbsolutePath Overlay::getSharedFilePath(const Hash& sha1) const {
+  auto name = sha1.toString();
+  return localDir_ + PathComponentPiece{kSharedDir} +
+      PathComponentPiece{StringPiece{name}.subpiece(0, 2)} +
+      PathComponentPiece{name};
+}
+
+bool Overlay::removeUnusedSharedFile(
+    const Hash& sha1,
+    ino_t ino,
+    nlink_t maxLinks) {
+  auto sharedPath = getSharedFilePath(sha1);
+  struct stat st;
+  if (::lstat(sharedPath.value().c_str(), &st) != 0 || st.st_ino != ino ||
+      st.st_nlink > maxLinks) {
+    return false;
+  }
+  if (::unlink(sharedPath.value().c_str()) != 0) {
+    folly::throwSystemError("error unlinking shared file ", sharedPath);
+  }
+  return true;
+}
+
+void Overlay::removeUnusedSharedFiles(OverlayCompactStats* result) {
+  auto sharedDir = localDir_ + PathComponentPiece{kSharedDir};
+  auto boostPath = boost::filesystem::path{sharedDir.value().c_str()};
+  if (!boost::filesystem::exists(boostPath)) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> guard(sharedFilesMutex_);
+  for (const auto& entry :
+       boost::filesystem::recursive_directory_iterator(boostPath)) {
+    struct stat st;
+    auto path = entry.path().string();
+    if (::lstat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) ||
+        st.st_nlink > 1) {
+      continue;
+    }
+    if (::unlink(path.c_str()) != 0) {
+      if (errno != ENOENT) {
+        folly::throwSystemError("error removing shared file ", path);
+      }
+      continue;
+    }
+    ++result->filesRemoved;
+    result->bytesReclaimed += st.st_blocks * 512;
+  }
+}
+
+void Overlay::saveFileSha1(
+    fuse_ino_t inodeNumber,
+    const Hash& sha1,
+    const struct stat& st) const {
+  overlay::OverlayFileSha1 record;
+  auto sha1Bytes = sha1.getBytes();
+  record.sha1 = string{reinterpret_cast<const char*>(sha1Bytes.data()),
+                       sha1Bytes.size()};
+  record.size = st.st_size;
+  record.mtimeSec = st.st_mtim.tv_sec;
+  record.mtimeNsec = st.st_mtim.tv_nsec;
+  auto data = CompactSerializer::serialize<string>(record);
+  auto status = dirStore_->db->Put(
+      WriteOptions(), getFileSha1Column(), DirKey{inodeNumber}.slice(), data);
+  RocksException::check(
+      status, "error saving overlay SHA-1 for file inode ", inodeNumber);
+}
+
+Optional<Hash> Overlay::loadFileSha1(
+    fuse_ino_t inodeNumber,
+    const struct stat& st) const {
+  string data;
+  auto status = dirStore_->db->Get(
+      ReadOptions(), getFileSha1Column(), DirKey{inodeNumber}.slice(), &data);
+  if (status.IsNotFound()) {
+    return folly::none;
+  }
+  RocksException::check(
+      status, "error loading overlay SHA-1 for file inode ", inodeNumber);
+
+  overlay::OverlayFileSha1 record;
+  try {
+    CompactSerializer::deserialize(data, record);
+  } catch (const std::exception& ex) {
+    LOG(WARNING) << "ignoring invalid overlay SHA-1 for file inode "
+                 << inodeNumber << ": " << folly::exceptionStr(ex);
+    return folly::none;
+  }
+  if (record.size != st.st_size || record.mtimeSec != st.st_mtim.tv_sec ||
+      record.mtimeNsec != st.st_mtim.tv_nsec ||
+      record.sha1.size() != Hash::RAW_SIZE) {
+    return folly::none;
+  }
+  return Hash{ByteRange{StringPiece{record.sha1}}};
+}
+
+void Overlay::removeFileSha1(fuse_ino_t inodeNumber) const {
+  auto status = dirStore_->db->Delete(
+      WriteOptions(), getFileSha1Column(), DirKey{inodeNumber}.slice());
+  RocksException::check(
+      status, "error removing overlay SHA-1 for file inode ", inodeNumber);
 }
 
 fuse_ino_t Overlay::getMaxRecordedInode() {
-  // TODO: We should probably store the max inode number in the header file
-  // during graceful unmount.  When opening an overlay we can then simply read
-  // back the max inode number from this file if the overlay was shut down
-  // cleanly last time.
-  //
-  // We would only then need to do a scan if the overlay was not cleanly shut
-  // down.
-  //
-  // For now we always do a scan.
+  auto nextInodeNumber = readNextInodeNumber();
+  if (nextInodeNumber.hasValue()) {
+    return nextInodeNumber.value() - 1;
+  }
+  if (inodeHighWaterMark_ > FUSE_ROOT_ID) {
+    // We were not shut down cleanly, but every inode number that could have
+    // been used is still below the high-water mark.
+    return inodeHighWaterMark_ - 1;
+  }
+  LOG(INFO) << "scanning overlay in " << localDir_
+            << " for the maximum inode number";
+  return scanForMaxRecordedInode();
+}
+
+void Overlay::saveInodeHighWaterMark(fuse_ino_t highWaterMark) {
+  CHECK_GT(highWaterMark, inodeHighWaterMark_);
+  inodeHighWaterMark_ = highWaterMark;
+  writeInfoFile();
+}
+
+void Overlay::resetInodeHighWaterMark(fuse_ino_t maxInode) {
+  inodeHighWaterMark_ = maxInode + 1;
+  writeInfoFile();
+}
+
+OverlayCompactStats Overlay::compact(
+    fuse_ino_t firstNewInode,
+    const std::function<bool(fuse_ino_t)>& isInUse) {
+  // Keep flushDirs() from changing the directory store under us.
+  std::lock_guard<std::mutex> guard(flushMutex_);
+
+  OverlayCompactStats result;
+  auto reachable = findReachableInodes();
+  result.maxInode = reachable.second;
+  if (!deserializeOverlayDir(FUSE_ROOT_ID).hasValue() &&
+      getMaxStoredDirInode() != FUSE_ROOT_ID) {
+    throw std::runtime_error(folly::to<string>(
+        "refusing to compact the overlay in ",
+        localDir_,
+        ": it has no root directory"));
+  }
+
+  auto keep = [&](fuse_ino_t number) {
+    if (number >= firstNewInode || reachable.first.count(number) != 0) {
+      return true;
+    }
+    if (pendingDirs_.rlock()->count(number) != 0) {
+      return true;
+    }
+    return isInUse(number);
+  };
+  compactDirStore(keep, &result);
+
+  std::array<char, 2> subdir;
+  for (int n = 0; n < 256; ++n) {
+    formatSubdirPath(MutableStringPiece{subdir.data(), subdir.size()}, n);
+    auto subdirPath = localDir_ +
+        PathComponentPiece{StringPiece{subdir.data(), subdir.size()}};
+
+    auto boostPath = boost::filesystem::path{subdirPath.value().c_str()};
+    for (const auto& entry : boost::filesystem::directory_iterator(boostPath)) {
+      // Files are named after their inode number.  Anything with a suffix is
+      // a temporary file left behind while one was being replaced.
+      auto name = entry.path().filename().string();
+      auto numberStr = StringPiece{name};
+      auto dot = name.find('.');
+      if (dot != string::npos) {
+        numberStr = numberStr.subpiece(0, dot);
+      }
+      auto number = folly::tryTo<fuse_ino_t>(numberStr);
+      if (!number.hasValue()) {
+        continue;
+      }
+      auto isTemporary = dot != string::npos;
+      if (isTemporary ? (number.value() >= firstNewInode ||
+                         isInUse(number.value()))
+                      : keep(number.value())) {
+        if (!isTemporary) {
+          result.maxInode = std::max(result.maxInode, number.value());
+        }
+        continue;
+      }
+
+      auto reclaimed = removeOverlayFile(entry.path().string());
+      if (reclaimed.hasValue()) {
+        ++result.filesRemoved;
+        result.bytesReclaimed += reclaimed.value();
+      }
+    }
+  }
+  removeUnusedSharedFiles(&result);
+
+  LOG(INFO) << "compacted overlay in " << localDir_ << ": removed "
+            << result.dirsRemoved << " directories and " << result.filesRemoved
+            << " files, reclaiming " << result.bytesReclaimed << " bytes";
+  return result;
+}
+
+void Overlay::compactDirStore(
+    const std::function<bool(fuse_ino_t)>& keep,
+    OverlayCompactStats* result) {
+  rocksdb::WriteBatch batch;
+  std::unordered_set<fuse_ino_t> removedDirs;
+  auto scanColumn = [&](rocksdb::ColumnFamilyHandle* column, bool isDirs) {
+    std::unique_ptr<rocksdb::Iterator> it{
+        dirStore_->db->NewIterator(ReadOptions(), column)};
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+      auto number = DirKey::parse(it->key());
+      if (!number.hasValue()) {
+        continue;
+      }
+      if (keep(number.value())) {
+        if (isDirs) {
+          result->maxInode = std::max(result->maxInode, number.value());
+        }
+        continue;
+      }
+      batch.Delete(column, it->key());
+      result->bytesReclaimed += it->key().size() + it->value().size();
+      if (isDirs) {
+        removedDirs.insert(number.value());
+      }
+    }
+    RocksException::check(
+        it->status(), "error scanning overlay directory store in ", localDir_);
+  };
+  scanColumn(dirStore_->db->DefaultColumnFamily(), true);
+  scanColumn(getFileSha1Column(), false);
 
-  // Walk the root directory downwards to find all (non-unlinked) directory
-  // inodes stored in the overlay.
+  WriteOptions options;
+  options.sync = true;
+  auto status = dirStore_->db->Write(options, &batch);
+  RocksException::check(
+      status, "error compacting overlay directory store in ", localDir_);
+
+  auto stored = storedDirs_.wlock();
+  for (auto number : removedDirs) {
+    stored->erase(number);
+  }
+  result->dirsRemoved = removedDirs.size();
+}
+
+void Overlay::saveNextInodeNumber(fuse_ino_t nextInodeNumber) {
+  auto value = folly::Endian::big(static_cast<uint64_t>(nextInodeNumber));
+  auto path = localDir_ + PathComponentPiece{kNextInodeNumberFile};
+  folly::writeFileAtomic(
+      path.stringPiece(),
+      ByteRange{reinterpret_cast<const uint8_t*>(&value), sizeof(value)});
+}
+
+Optional<fuse_ino_t> Overlay::readNextInodeNumber() {
+  auto path = localDir_ + PathComponentPiece{kNextInodeNumberFile};
+  string contents;
+  if (!folly::readFile(path.value().c_str(), contents)) {
+    return folly::none;
+  }
+  // Remove the file right away.  Inode numbers will be allocated from this
+  // point on, so it is stale until we write it again on shutdown.
+  if (::unlink(path.value().c_str()) != 0) {
+    folly::throwSystemError("error removing ", path);
+  }
+
+  uint64_t value;
+  if (contents.size() != sizeof(value)) {
+    LOG(WARNING) << "ignoring invalid " << kNextInodeNumberFile << " file in "
+                 << localDir_;
+    return folly::none;
+  }
+  memcpy(&value, contents.data(), sizeof(value));
+  value = folly::Endian::big(value);
+  if (value <= FUSE_ROOT_ID) {
+    LOG(WARNING) << "ignoring invalid next inode number " << value << " in "
+                 << localDir_;
+    return folly::none;
+  }
+  return static_cast<fuse_ino_t>(value);
+}
+
+void Overlay::saveInodeMap(const takeover::SerializedInodeMap& inodeMap) {
+  auto path = localDir_ + PathComponentPiece{kInodeMapFile};
+  folly::writeFileAtomic(
+      path.stringPiece(), CompactSerializer::serialize<string>(inodeMap));
+}
+
+Optional<takeover::SerializedInodeMap> Overlay::takeSavedInodeMap() {
+  auto path = localDir_ + PathComponentPiece{kInodeMapFile};
+  string contents;
+  if (!folly::readFile(path.value().c_str(), contents)) {
+    return folly::none;
+  }
+  if (::unlink(path.value().c_str()) != 0) {
+    folly::throwSystemError("error removing ", path);
+  }
+
+  try {
+    return CompactSerializer::deserialize<takeover::SerializedInodeMap>(
+        contents);
+  } catch (const std::exception& ex) {
+    LOG(WARNING) << "ignoring invalid " << kInodeMapFile << " file in "
+                 << localDir_ << ": " << folly::exceptionStr(ex);
+    return folly::none;
+  }
+}
+
+std::pair<std::unordered_set<fuse_ino_t>, fuse_ino_t>
+Overlay::findReachableInodes() const {
+  // Walk the root directory downwards to find all (non-unlinked) inodes
+  // stored in the overlay.
   //
   // TODO: It would be nicer if each overlay file contained a short header so
   // we could tell if it was a file or directory.  This way we could do a
   // simpler scan of opening every single file.  For now we have to walk the
   // directory tree from the root downwards.
+  std::unordered_set<fuse_ino_t> reachable;
+  reachable.insert(FUSE_ROOT_ID);
   fuse_ino_t maxInode = FUSE_ROOT_ID;
   std::vector<fuse_ino_t> toProcess;
   toProcess.push_back(FUSE_ROOT_ID);
@@ -310,30 +1214,99 @@ fuse_ino_t Overlay::getMaxRecordedInode() {
       if (entryInode == 0) {
         continue;
       }
+      reachable.insert(entryInode);
       maxInode = std::max(maxInode, entryInode);
       if (mode_to_dtype(entry.second.mode) == dtype_t::Dir) {
         toProcess.push_back(entry.second.inodeNumber);
       }
     }
   }
+  return std::make_pair(std::move(reachable), maxInode);
+}
 
-  // Look through the subdirectories and increment maxInode based on the
-  // filenames we see.  This is needed in case there are unlinked inodes
-  // present.
-  std::array<char, 2> subdir;
-  for (int n = 0; n < 256; ++n) {
-    formatSubdirPath(MutableStringPiece{subdir.data(), subdir.size()}, n);
-    auto subdirPath = localDir_ +
-        PathComponentPiece{StringPiece{subdir.data(), subdir.size()}};
+void Overlay::forEachMaterializedEntry(
+    const std::function<void(RelativePathPiece path, mode_t mode)>& callback)
+    const {
+  std::vector<std::pair<fuse_ino_t, RelativePath>> toProcess;
+  toProcess.emplace_back(FUSE_ROOT_ID, RelativePath{});
+  while (!toProcess.empty()) {
+    auto dirInodeNumber = toProcess.back().first;
+    auto dirPath = std::move(toProcess.back().second);
+    toProcess.pop_back();
 
-    auto boostPath = boost::filesystem::path{subdirPath.value().c_str()};
-    for (const auto& entry : boost::filesystem::directory_iterator(boostPath)) {
-      auto entryInodeNumber =
-          folly::tryTo<fuse_ino_t>(entry.path().filename().string());
-      if (entryInodeNumber.hasValue()) {
-        maxInode = std::max(maxInode, entryInodeNumber.value());
+    auto dir = deserializeOverlayDir(dirInodeNumber);
+    if (!dir.hasValue()) {
+      continue;
+    }
+
+    for (const auto& entry : dir.value().entries) {
+      auto entryInode = static_cast<fuse_ino_t>(entry.second.inodeNumber);
+      if (entryInode == 0) {
+        continue;
       }
+      auto entryPath = dirPath + PathComponentPiece{entry.first};
+      callback(entryPath, entry.second.mode);
+      if (mode_to_dtype(entry.second.mode) == dtype_t::Dir) {
+        toProcess.emplace_back(entryInode, std::move(entryPath));
+      }
+    }
+  }
+}
+
+fuse_ino_t Overlay::scanForMaxRecordedInode() {
+  auto maxInode = findReachableInodes().second;
+
+  // Directories in the directory store and files in the subdirectories may
+  // belong to unlinked inodes that are not reachable from the root, so look
+  // at all of them too.
+  maxInode = std::max(maxInode, getMaxStoredDirInode());
+
+  // Reading the shard directories is most of the work when there are a lot
+  // of materialized files, so split them between several threads.
+  std::atomic<int> nextShard{0};
+  auto scanShards = [this, &nextShard]() {
+    fuse_ino_t shardMax = FUSE_ROOT_ID;
+    std::array<char, 2> subdir;
+    for (int n = nextShard++; n < 256; n = nextShard++) {
+      formatSubdirPath(MutableStringPiece{subdir.data(), subdir.size()}, n);
+      auto subdirPath = localDir_ +
+          PathComponentPiece{StringPiece{subdir.data(), subdir.size()}};
+
+      auto boostPath = boost::filesystem::path{subdirPath.value().c_str()};
+      for (const auto& entry :
+           boost::filesystem::directory_iterator(boostPath)) {
+        auto entryInodeNumber =
+            folly::tryTo<fuse_ino_t>(entry.path().filename().string());
+        if (entryInodeNumber.hasValue()) {
+          shardMax = std::max(shardMax, entryInodeNumber.value());
+        }
+      }
+    }
+    return shardMax;
+  };
+
+  auto numThreads = std::max(
+      1u, std::min(kMaxScanThreads, std::thread::hardware_concurrency()));
+  std::vector<fuse_ino_t> results(numThreads, FUSE_ROOT_ID);
+  std::vector<std::exception_ptr> errors(numThreads);
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < numThreads; ++t) {
+    threads.emplace_back([&, t] {
+      try {
+        results[t] = scanShards();
+      } catch (...) {
+        errors[t] = std::current_exception();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (unsigned t = 0; t < numThreads; ++t) {
+    if (errors[t]) {
+      std::rethrow_exception(errors[t]);
     }
+    maxInode = std::max(maxInode, results[t]);
   }
 
   return maxInode;
@@ -353,21 +1326,86 @@ AbsolutePath Overlay::getFilePath(fuse_ino_t inodeNumber) const {
       PathComponentPiece{numberStr};
 }
 
+fuse_ino_t Overlay::getMaxStoredDirInode() const {
+  std::unique_ptr<rocksdb::Iterator> it{
+      dirStore_->db->NewIterator(ReadOptions())};
+  it->SeekToLast();
+  RocksException::check(
+      it->status(), "error scanning overlay directory store in ", localDir_);
+  if (!it->Valid()) {
+    return FUSE_ROOT_ID;
+  }
+  auto number = DirKey::parse(it->key());
+  if (!number.hasValue()) {
+    LOG(WARNING) << "ignoring invalid key in overlay directory store in "
+                 << localDir_;
+    return FUSE_ROOT_ID;
+  }
+  return number.value();
+}
+
 Optional<overlay::OverlayDir> Overlay::deserializeOverlayDir(
     fuse_ino_t inodeNumber) const {
+  DirKey key{inodeNumber};
+  std::unique_ptr<rocksdb::Iterator> it{
+      dirStore_->db->NewIterator(ReadOptions())};
+  it->Seek(key.slice());
+  RocksException::check(
+      it->status(), "error loading overlay data for directory ", inodeNumber);
+  if (!it->Valid() || it->key() != key.slice()) {
+    auto legacyData = readLegacyOverlayDir(inodeNumber);
+    if (!legacyData.hasValue()) {
+      // There is no overlay here
+      return folly::none;
+    }
+    return CompactSerializer::deserialize<overlay::OverlayDir>(
+        legacyData.value());
+  }
+
+  auto dir = CompactSerializer::deserialize<overlay::OverlayDir>(
+      it->value().ToString());
+
+  // Apply the delta records that follow the directory record, in name order.
+  // The latest change to each entry replaces any earlier one, so there is at
+  // most one delta per name.
+  size_t numDeltas = 0;
+  auto prefixLength = key.slice().size();
+  for (it->Next(); it->Valid() && key.matches(it->key()); it->Next()) {
+    auto name = it->key().ToString().substr(prefixLength);
+    if (it->value().empty()) {
+      dir.entries.erase(name);
+    } else {
+      dir.entries[name] = CompactSerializer::deserialize<overlay::OverlayEntry>(
+          it->value().ToString());
+    }
+    ++numDeltas;
+  }
+  RocksException::check(
+      it->status(), "error loading overlay data for directory ", inodeNumber);
+
+  (*storedDirs_.wlock())[inodeNumber] = numDeltas;
+  return dir;
+}
+
+Optional<string> Overlay::readLegacyOverlayDir(fuse_ino_t inodeNumber) const {
   auto path = getFilePath(inodeNumber);
 
-  // Read the file and de-serialize it into data
   std::string serializedData;
   if (!folly::readFile(path.value().c_str(), serializedData)) {
     int err = errno;
     if (err == ENOENT) {
-      // There is no overlay here
       return folly::none;
     }
     folly::throwSystemErrorExplicit(err, "failed to read ", path);
   }
-  return CompactSerializer::deserialize<overlay::OverlayDir>(serializedData);
+
+  // Move the directory into the directory store, so that we don't have to
+  // look for the file again, and its file path is free to be reused.
+  putOverlayDir(inodeNumber, serializedData);
+  if (::unlink(path.value().c_str()) != 0 && errno != ENOENT) {
+    folly::throwSystemError("error unlinking legacy overlay file: ", path);
+  }
+  return serializedData;
 }
 }
 }
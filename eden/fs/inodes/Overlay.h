@@ -10,17 +10,59 @@
 #pragma once
 #include <folly/Optional.h>
 #include <folly/Range.h>
+#include <folly/Synchronized.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include "TreeInode.h"
+#include "eden/fs/config/ClientConfig.h"
 #include "eden/utils/DirType.h"
 #include "eden/utils/PathFuncs.h"
 #include "eden/utils/PathMap.h"
 
+struct stat;
+
+namespace rocksdb {
+class ColumnFamilyHandle;
+class WriteBatch;
+}
+
 namespace facebook {
 namespace eden {
 
+class IoUring;
+struct RocksHandles;
+
 namespace overlay {
 class OverlayDir;
+class OverlayEntry;
 }
+namespace takeover {
+class SerializedInodeMap;
+}
+
+/** The results of Overlay::compact() */
+struct OverlayCompactStats {
+  /** The number of directories whose records were removed */
+  uint64_t dirsRemoved{0};
+  /** The number of files removed from the shard directories */
+  uint64_t filesRemoved{0};
+  /** The approximate space freed, in bytes */
+  uint64_t bytesReclaimed{0};
+  /** The largest inode number still recorded in the overlay */
+  fuse_ino_t maxInode{FUSE_ROOT_ID};
+};
+
+/** The space used by the files in an overlay, from Overlay::getUsage() */
+struct OverlayUsage {
+  /** The number of files in the overlay */
+  uint64_t files{0};
+  /** The total size of the files in the overlay, in bytes */
+  uint64_t bytes{0};
+};
 
 /** Manages the write overlay storage area.
  *
@@ -39,18 +81,176 @@ class OverlayDir;
  * file "foo/bar/baz" then the Overlay records metadata about the list
  * of files in the root, the list of files in "foo", the list of files in
  * "foo/bar" and finally materializes "foo/bar/baz".
+ *
+ * The contents of materialized files are stored in one file per inode,
+ * sharded across 256 subdirectories.  Materialized directories are stored
+ * as serialized OverlayDir records in a RocksDB in the overlay directory, so
+ * that updating a directory is a single write to the RocksDB log rather than
+ * writing and renaming a whole file.  Older overlays stored directories in
+ * the per-inode files too; these are still read, and are moved into the
+ * RocksDB the first time they are loaded.
+ *
+ * Materialized files with identical contents may share a single copy of them
+ * through hard links, with copy-on-write when one of them next changes.  See
+ * shareFileContents().
+ *
+ * Most directory changes are not written immediately.  TreeInode marks the
+ * directory dirty with markDirDirty(), and all dirty directories are
+ * serialized and written together by flushDirs(), which is called
+ * periodically, on fsyncdir(), and when the mount point is shut down.
+ *
+ * When only a few entries of a directory have changed, the flush writes a
+ * small delta record for each changed entry rather than rewriting the whole
+ * OverlayDir, so that changing one entry costs the same in a huge directory
+ * as in a small one.  The delta records are stored after the directory's own
+ * record, and are applied to it when it is loaded.  Once a directory has
+ * accumulated too many of them, relative to its size, the next flush folds
+ * them back into a single full record.
+ *
+ * How often writes are synced to disk depends on the OverlayDurability mode
+ * the Overlay was created with.
  */
 class Overlay {
  public:
-  explicit Overlay(AbsolutePathPiece localDir);
+  explicit Overlay(
+      AbsolutePathPiece localDir,
+      OverlayDurability durability = OverlayDurability::STRICT);
+  ~Overlay();
+
+  OverlayDurability getDurability() const {
+    return durability_;
+  }
 
   /** Returns the path to the root of the Overlay storage area */
   const AbsolutePath& getLocalDir() const;
 
+  /**
+   * Returns the io_uring used to read and sync the overlay's files without
+   * blocking the calling thread, or nullptr if --overlay_io_uring is off or
+   * the kernel does not support io_uring.
+   */
+  IoUring* getIoUring() const {
+    return ioUring_.get();
+  }
+
+  /**
+   * Record a change in the number or total size of the overlay's files.
+   *
+   * Callers report each file they create or resize, and
+   * removeOverlayData() reports the files it removes, so that getUsage()
+   * never has to look at the files themselves.
+   */
+  void updateUsage(int64_t filesDelta, int64_t bytesDelta);
+
+  /**
+   * Get the space used by the overlay's files.
+   *
+   * The usage of an existing overlay is found by scanning it when it is
+   * opened, and kept up to date by updateUsage() after that, so this is
+   * cheap enough to answer every statfs() call.
+   */
+  OverlayUsage getUsage() const;
+
   void saveOverlayDir(fuse_ino_t inodeNumber, const TreeInode::Dir* dir);
   folly::Optional<TreeInode::Dir> loadOverlayDir(fuse_ino_t inodeNumber) const;
 
-  void removeOverlayData(fuse_ino_t inodeNumber) const;
+  /**
+   * Record that a materialized directory has changed, so its overlay data
+   * needs to be rewritten.
+   *
+   * The directory is not serialized until the next flushDirs() call, so any
+   * number of changes to it in between only cost a single write.  The
+   * Overlay keeps a reference to the inode until then, so that it cannot be
+   * unloaded with unsaved changes.
+   *
+   * This may be called with the inode's contents lock held.
+   */
+  void markDirDirty(TreeInodePtr inode);
+
+  /**
+   * Record that a single entry of a materialized directory has been added,
+   * removed or modified.
+   *
+   * This is like markDirDirty(), but lets the next flush write just this
+   * entry rather than the whole directory.
+   */
+  void markDirEntryDirty(TreeInodePtr inode, PathComponentPiece name);
+
+  /**
+   * Write out all of the directories marked dirty since the last flush.
+   *
+   * All pending directory updates and removals are committed as a single
+   * atomic RocksDB write batch, so a crash never leaves only some of them
+   * applied.
+   *
+   * If sync is true the write is also synced to disk before this returns,
+   * unless the overlay is in relaxed mode.  In batched mode this also syncs
+   * the file contents written since the last synced flush.  In strict mode
+   * every flush is synced.
+   */
+  void flushDirs(bool sync = false);
+
+  /**
+   * Remove the overlay data for an inode.
+   *
+   * A file's data is removed immediately.  Removing a directory record is
+   * deferred to the next flushDirs(), so that it is committed together with
+   * the parent directory update that stopped referring to it.
+   */
+  void removeOverlayData(fuse_ino_t inodeNumber);
+
+  /**
+   * Save the SHA-1 of the contents of a materialized file, tagged with the
+   * size and modification time in st.
+   *
+   * This is a cache, so the write is not synced.
+   */
+  void saveFileSha1(
+      fuse_ino_t inodeNumber,
+      const Hash& sha1,
+      const struct stat& st) const;
+
+  /**
+   * Load the SHA-1 saved for a materialized file.
+   *
+   * Returns none if there is no saved SHA-1, or if it was saved when the file
+   * had a different size or modification time than in st.
+   */
+  folly::Optional<Hash> loadFileSha1(
+      fuse_ino_t inodeNumber,
+      const struct stat& st) const;
+
+  /**
+   * Remove the saved SHA-1 of a file, before its contents are changed.
+   */
+  void removeFileSha1(fuse_ino_t inodeNumber) const;
+
+  /**
+   * Store the contents of a materialized file only once, shared with any
+   * other materialized files with the same SHA-1.
+   *
+   * Files with the same contents are hard links to one file, which is also
+   * linked into the overlay's shared directory under the SHA-1, so its link
+   * count tracks how many files use it.  The shared copy keeps the later of
+   * the files' modification times.
+   *
+   * The caller must hold the inode's state lock, and have written out all of
+   * the file's data.  Returns true if the file's contents are now shared, in
+   * which case its overlay file may have been replaced, and the caller must
+   * reopen it.  Shared contents must be unshared with unshareFileContents()
+   * before they or their timestamps are changed.
+   */
+  bool shareFileContents(fuse_ino_t inodeNumber, const Hash& sha1);
+
+  /**
+   * Give a file whose contents were shared by shareFileContents() its own
+   * copy of the first size bytes of them again.
+   *
+   * If no other file uses the shared copy any more, the file just takes it
+   * over, and nothing is copied.  The caller must hold the inode's state
+   * lock, and must reopen the file's overlay file afterwards.
+   */
+  void unshareFileContents(fuse_ino_t inodeNumber, uint64_t size);
 
   /**
    * Get the path to the overlay file for the given inode
@@ -63,19 +263,215 @@ class Overlay {
    * This is called when opening a mount point, to make sure that new inodes
    * handed out from this point forwards are always greater than any inodes
    * already tracked in the overlay.
+   *
+   * If saveNextInodeNumber() was called when the overlay was last closed this
+   * just reads back the number it saved.  Otherwise it uses the high-water
+   * mark recorded by saveInodeHighWaterMark(), and only has to scan the whole
+   * overlay if there is none.
    */
   fuse_ino_t getMaxRecordedInode();
 
+  /**
+   * Record that no inode number greater than or equal to highWaterMark has
+   * been allocated, so that getMaxRecordedInode() can trust it even after an
+   * unclean shutdown.
+   *
+   * This writes the info file synchronously, so callers should reserve inode
+   * numbers in large blocks rather than calling it for every allocation.
+   * highWaterMark must be larger than any previously saved value.
+   */
+  void saveInodeHighWaterMark(fuse_ino_t highWaterMark);
+
+  /**
+   * Replace the inode high-water mark with maxInode + 1, even if that is lower
+   * than the current one.
+   *
+   * This is only safe while the overlay is not in use by a mount point, with
+   * maxInode from compact().
+   */
+  void resetInodeHighWaterMark(fuse_ino_t maxInode);
+
+  /**
+   * Call callback with the path and mode of every materialized file and
+   * directory reachable from the root directory.
+   *
+   * This only reads the stored directory records and never loads any
+   * inodes, so its cost depends on how much is materialized rather than on
+   * the size of the checkout.  Each directory is visited before its
+   * contents.  Changes that have not been flushed yet are not seen, so call
+   * flushDirs() first to include them.
+   */
+  void forEachMaterializedEntry(
+      const std::function<void(RelativePathPiece path, mode_t mode)>&
+          callback) const;
+
+  /**
+   * Remove the directory records, saved SHA-1s and files of inodes that are
+   * not reachable from the root directory.  These are left behind by inodes
+   * that were unlinked while they were still in use when eden stopped, and by
+   * crashes.
+   *
+   * Inodes numbered firstNewInode or above, and those for which isInUse()
+   * returns true, are kept even if they are unreachable, since they may still
+   * be about to be linked into their parent.  A mount point using the overlay
+   * must pass the inodes it has loaded or still remembers, flush the pending
+   * directory changes first, and prevent inodes from being materialized
+   * while this runs.
+   *
+   * Throws if the overlay has data but no root directory, rather than
+   * removing everything.
+   */
+  OverlayCompactStats compact(
+      fuse_ino_t firstNewInode,
+      const std::function<bool(fuse_ino_t)>& isInUse);
+
+  /**
+   * Record the next inode number to be allocated, so that the next
+   * getMaxRecordedInode() call does not need to scan the overlay.
+   *
+   * This should only be called when the mount point is cleanly shut down,
+   * once no more inode numbers can be allocated.
+   */
+  void saveNextInodeNumber(fuse_ino_t nextInodeNumber);
+
+  /**
+   * Save the inode numbers that InodeMap::save() recorded, so that the next
+   * mount of this overlay can give the same paths the same inode numbers.
+   *
+   * Like saveNextInodeNumber(), this should only be called when the mount
+   * point is cleanly shut down.
+   */
+  void saveInodeMap(const takeover::SerializedInodeMap& inodeMap);
+
+  /**
+   * Read back the inode numbers saved by saveInodeMap(), and remove them so
+   * that they are not trusted again after an unclean shutdown.
+   *
+   * Returns folly::none if none were saved, or if they cannot be read.
+   */
+  folly::Optional<takeover::SerializedInodeMap> takeSavedInodeMap();
+
  private:
   void initOverlay();
   bool isOldFormatOverlay() const;
-  void readExistingOverlay(int infoFD);
+  uint32_t readExistingOverlay(int infoFD);
   void initNewOverlay();
+  void createShardDirectories();
+  void writeInfoFile();
+  void openDirStore();
+  void scanUsage();
+  void syncOverlayFiles();
   folly::Optional<overlay::OverlayDir> deserializeOverlayDir(
       fuse_ino_t inodeNumber) const;
+  folly::Optional<std::string> readLegacyOverlayDir(
+      fuse_ino_t inodeNumber) const;
+  struct PendingDir;
+
+  static overlay::OverlayEntry serializeOverlayEntry(
+      const TreeInode::Entry& entry);
+  static std::string serializeOverlayDir(const TreeInode::Dir& dir);
+  void addDirUpdates(
+      fuse_ino_t inodeNumber,
+      const TreeInode::Dir& dir,
+      const PendingDir& pending,
+      rocksdb::WriteBatch* batch);
+  void deleteDirRecords(
+      fuse_ino_t inodeNumber,
+      bool includeDir,
+      rocksdb::WriteBatch* batch) const;
+  void putOverlayDir(fuse_ino_t inodeNumber, folly::StringPiece data) const;
+
+  AbsolutePath getSharedFilePath(const Hash& sha1) const;
+  /**
+   * Remove the shared copy of the contents with the given SHA-1 if it is
+   * the data with the given inode number, and it has no more than maxLinks
+   * links.  Returns true if it was removed.  sharedFilesMutex_ must be held.
+   */
+  bool removeUnusedSharedFile(const Hash& sha1, ino_t ino, nlink_t maxLinks);
+  /**
+   * Remove a file from the shard directories, along with the shared copy of
+   * its contents if it was the last file using it.
+   *
+   * Returns the approximate space freed, or none if there is no such file.
+   */
+  folly::Optional<uint64_t> removeOverlayFile(const std::string& path);
+  /** Remove the shared copies that no file uses, leftovers from crashes */
+  void removeUnusedSharedFiles(OverlayCompactStats* result);
+  rocksdb::ColumnFamilyHandle* getFileSha1Column() const;
+  fuse_ino_t getMaxStoredDirInode() const;
+  folly::Optional<fuse_ino_t> readNextInodeNumber();
+  fuse_ino_t scanForMaxRecordedInode();
+  /**
+   * Find every inode reachable from the root directory, returning them
+   * together with the maximum inode number found.
+   */
+  std::pair<std::unordered_set<fuse_ino_t>, fuse_ino_t> findReachableInodes()
+      const;
+  void compactDirStore(
+      const std::function<bool(fuse_ino_t)>& keep,
+      OverlayCompactStats* result);
 
   /** path to ".eden/CLIENT/local" */
   AbsolutePath localDir_;
+
+  const OverlayDurability durability_;
+
+  std::unique_ptr<IoUring> ioUring_;
+
+  /**
+   * The inode high-water mark saved in the info file, or 0 if there is none.
+   */
+  fuse_ino_t inodeHighWaterMark_{0};
+
+  /**
+   * The RocksDB holding the serialized OverlayDir for each materialized
+   * directory in its default column family, and the OverlayFileSha1 for
+   * materialized files in the column family from getFileSha1Column().
+   */
+  std::unique_ptr<RocksHandles> dirStore_;
+
+  /**
+   * A directory changed since the last flush.
+   */
+  struct PendingDir {
+    /** The directory, or null if its records are to be deleted */
+    TreeInodePtr inode;
+    /** Whether the whole directory needs to be written out */
+    bool rewrite{false};
+    /** The entries changed since the last flush, if rewrite is false */
+    std::unordered_set<PathComponent> changedNames;
+  };
+  using PendingDirs = std::unordered_map<fuse_ino_t, PendingDir>;
+  folly::Synchronized<PendingDirs> pendingDirs_;
+
+  /**
+   * The number of delta records stored after each directory's full record,
+   * for the directories known to have a full record in dirStore_.
+   *
+   * Directories that are not listed here are written in full the next time
+   * they change.
+   */
+  mutable folly::Synchronized<std::unordered_map<fuse_ino_t, size_t>>
+      storedDirs_;
+
+  /**
+   * Held for the duration of flushDirs(), so that a flush can never write
+   * out older directory contents after a later flush has already written
+   * newer ones.
+   */
+  std::mutex flushMutex_;
+
+  /**
+   * Held while adding or removing links to the shared copies of file
+   * contents, so that a shared copy is never removed while another file is
+   * being linked to it.
+   */
+  std::mutex sharedFilesMutex_;
+
+  /** The number of files in the overlay, maintained by updateUsage(). */
+  std::atomic<int64_t> usageFiles_{0};
+  /** The total size of the overlay's files, maintained by updateUsage(). */
+  std::atomic<int64_t> usageBytes_{0};
 };
 }
 }
@@ -0,0 +1,286 @@
+/*
+ *  Copyright (c) 2004-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/inodes/TreeDiff.h"
+
+#include <folly/Unit.h>
+#include <folly/futures/Future.h>
+#include <glog/logging.h>
+#include "eden/fs/inodes/DiffContext.h"
+#include "eden/fs/inodes/InodeDiffCallback.h"
+#include "eden/fs/model/Tree.h"
+#include "eden/fs/store/BlobMetadata.h"
+#include "eden/fs/store/ObjectStore.h"
+
+using folly::makeFuture;
+using folly::Future;
+using folly::Unit;
+using std::unique_ptr;
+using std::vector;
+
+namespace facebook {
+namespace eden {
+
+namespace {
+/**
+ * Wait for all of the futures to complete, and report an error for the path
+ * of each one that failed.
+ *
+ * This returns successfully after recording the errors.  (If it failed then
+ * our caller would also record us as an error, which we don't want.)
+ */
+Future<Unit> collectAndReportErrors(
+    const DiffContext* context,
+    vector<Future<Unit>>&& futures,
+    vector<RelativePath>&& paths) {
+  return folly::collectAll(futures).then([
+    context,
+    paths = std::move(paths)
+  ](vector<folly::Try<Unit>> results) {
+    for (size_t n = 0; n < results.size(); ++n) {
+      auto& result = results[n];
+      if (result.hasException()) {
+        context->callback->diffError(paths[n], result.exception());
+      }
+    }
+    return makeFuture();
+  });
+}
+
+/**
+ * Report every file under a Tree using reportFile, loading subtrees as
+ * necessary.
+ */
+template <typename ReportFn>
+Future<Unit> walkTree(
+    const DiffContext* context,
+    RelativePath currentPath,
+    const TreeEntry& entry,
+    ReportFn reportFile) {
+  DCHECK_EQ(TreeEntryType::TREE, entry.getType());
+  return context->store->getTreeFuture(entry.getHash()).then([
+    context,
+    currentPath = std::move(currentPath),
+    reportFile
+  ](unique_ptr<Tree> && tree) {
+    vector<Future<Unit>> subFutures;
+    vector<RelativePath> subPaths;
+    for (const auto& child : tree->getTreeEntries()) {
+      auto childPath = currentPath + child.getName();
+      if (!context->isOnPrefixPath(childPath)) {
+        continue;
+      }
+      if (child.getType() == TreeEntryType::TREE) {
+        subFutures.push_back(walkTree(context, childPath, child, reportFile));
+        subPaths.push_back(std::move(childPath));
+      } else {
+        reportFile(childPath, child);
+      }
+    }
+    return collectAndReportErrors(
+        context, std::move(subFutures), std::move(subPaths));
+  });
+}
+
+/**
+ * Report a file that is only present in the newer Tree.
+ */
+void reportAddedEntry(
+    const DiffContext* context,
+    RelativePath path,
+    const TreeEntry& entry,
+    vector<Future<Unit>>* futures,
+    vector<RelativePath>* paths) {
+  if (entry.getType() == TreeEntryType::TREE) {
+    futures->push_back(diffAddedTree(context, path, entry));
+    paths->push_back(std::move(path));
+  } else {
+    context->callback->untrackedFile(path);
+  }
+}
+
+/**
+ * Report a file that is only present in the older Tree.
+ */
+void reportRemovedEntry(
+    const DiffContext* context,
+    RelativePath path,
+    const TreeEntry& entry,
+    vector<Future<Unit>>* futures,
+    vector<RelativePath>* paths) {
+  if (entry.getType() == TreeEntryType::TREE) {
+    futures->push_back(diffRemovedTree(context, path, entry));
+    paths->push_back(std::move(path));
+  } else {
+    context->callback->removedFile(path, entry);
+  }
+}
+} // unnamed namespace
+
+Future<Unit> diffRemovedTree(
+    const DiffContext* context,
+    RelativePath currentPath,
+    const TreeEntry& entry) {
+  return walkTree(
+      context,
+      std::move(currentPath),
+      entry,
+      [context](RelativePathPiece path, const TreeEntry& fileEntry) {
+        context->callback->removedFile(path, fileEntry);
+      });
+}
+
+Future<Unit> diffAddedTree(
+    const DiffContext* context,
+    RelativePath currentPath,
+    const TreeEntry& entry) {
+  return walkTree(
+      context,
+      std::move(currentPath),
+      entry,
+      [context](RelativePathPiece path, const TreeEntry& /* fileEntry */) {
+        context->callback->untrackedFile(path);
+      });
+}
+
+Future<Unit> diffTrees(
+    const DiffContext* context,
+    RelativePathPiece currentPath,
+    unique_ptr<Tree> fromTree,
+    unique_ptr<Tree> toTree) {
+  vector<Future<Unit>> futures;
+  vector<RelativePath> paths;
+
+  // Pairs of entries with the same name and type but different hashes.
+  // Their contents are compared after the walk, so that all of the data they
+  // need can be fetched from the ObjectStore in batches.
+  vector<std::pair<TreeEntry, TreeEntry>> changedBlobs;
+  vector<std::pair<TreeEntry, TreeEntry>> changedTrees;
+
+  // This relies on the fact that the entries of both Trees are sorted in the
+  // same order, just like TreeInode::computeDiff().
+  const auto& fromEntries = fromTree->getTreeEntries();
+  const auto& toEntries = toTree->getTreeEntries();
+  size_t fromIdx = 0;
+  size_t toIdx = 0;
+  while (fromIdx < fromEntries.size() || toIdx < toEntries.size()) {
+    if (toIdx >= toEntries.size() ||
+        (fromIdx < fromEntries.size() &&
+         fromEntries[fromIdx].getName() < toEntries[toIdx].getName())) {
+      const auto& entry = fromEntries[fromIdx];
+      reportRemovedEntry(
+          context, currentPath + entry.getName(), entry, &futures, &paths);
+      ++fromIdx;
+      continue;
+    }
+    if (fromIdx >= fromEntries.size() ||
+        toEntries[toIdx].getName() < fromEntries[fromIdx].getName()) {
+      const auto& entry = toEntries[toIdx];
+      reportAddedEntry(
+          context, currentPath + entry.getName(), entry, &futures, &paths);
+      ++toIdx;
+      continue;
+    }
+
+    const auto& fromEntry = fromEntries[fromIdx];
+    const auto& toEntry = toEntries[toIdx];
+    ++fromIdx;
+    ++toIdx;
+    if (fromEntry.getMode() == toEntry.getMode() &&
+        fromEntry.getHash() == toEntry.getHash()) {
+      // Identical files or subtrees.  There is no need to load them.
+      continue;
+    }
+
+    auto entryPath = currentPath + toEntry.getName();
+    bool fromIsTree = fromEntry.getType() == TreeEntryType::TREE;
+    bool toIsTree = toEntry.getType() == TreeEntryType::TREE;
+    if (fromIsTree && toIsTree) {
+      changedTrees.emplace_back(fromEntry, toEntry);
+    } else if (fromIsTree || toIsTree) {
+      // A directory was replaced with a file, or vice-versa.
+      reportRemovedEntry(context, entryPath, fromEntry, &futures, &paths);
+      reportAddedEntry(context, entryPath, toEntry, &futures, &paths);
+    } else if (fromEntry.getMode() != toEntry.getMode()) {
+      // The mode is definitely modified
+      context->callback->modifiedFile(entryPath, fromEntry);
+    } else {
+      // Different blob hashes do not necessarily mean different contents,
+      // since mercurial blob IDs include history information.  Compare the
+      // content SHA-1s instead.
+      changedBlobs.emplace_back(fromEntry, toEntry);
+    }
+  }
+
+  if (!changedBlobs.empty()) {
+    vector<Hash> ids;
+    for (const auto& pair : changedBlobs) {
+      ids.push_back(pair.first.getHash());
+      ids.push_back(pair.second.getHash());
+    }
+    auto metadata = context->store->getBlobMetadataBatch(ids);
+    for (size_t n = 0; n < changedBlobs.size(); ++n) {
+      auto entryPath = currentPath + changedBlobs[n].second.getName();
+      futures.push_back(
+          folly::collect(metadata[2 * n], metadata[2 * n + 1])
+              .then([
+                context,
+                entryPath,
+                fromEntry = std::move(changedBlobs[n].first)
+              ](const std::tuple<BlobMetadata, BlobMetadata>& results) {
+                if (std::get<0>(results).sha1 != std::get<1>(results).sha1) {
+                  context->callback->modifiedFile(entryPath, fromEntry);
+                }
+              }));
+      paths.push_back(std::move(entryPath));
+    }
+  }
+
+  if (!changedTrees.empty()) {
+    vector<Hash> ids;
+    for (const auto& pair : changedTrees) {
+      ids.push_back(pair.first.getHash());
+      ids.push_back(pair.second.getHash());
+    }
+    auto trees = context->store->getTreesBatch(ids);
+    for (size_t n = 0; n < changedTrees.size(); ++n) {
+      auto entryPath = currentPath + changedTrees[n].second.getName();
+      futures.push_back(
+          folly::collect(trees[2 * n], trees[2 * n + 1])
+              .then([context, entryPath](
+                  std::tuple<unique_ptr<Tree>, unique_ptr<Tree>>&& subtrees) {
+                if (!context->executor) {
+                  return diffTrees(
+                      context,
+                      entryPath,
+                      std::move(std::get<0>(subtrees)),
+                      std::move(std::get<1>(subtrees)));
+                }
+                // Diff each subtree on the executor, so that independent
+                // subtrees are compared in parallel.
+                return folly::via(context->executor).then([
+                  context,
+                  entryPath,
+                  subtrees = std::move(subtrees)
+                ]() mutable {
+                  return diffTrees(
+                      context,
+                      entryPath,
+                      std::move(std::get<0>(subtrees)),
+                      std::move(std::get<1>(subtrees)));
+                });
+              }));
+      paths.push_back(std::move(entryPath));
+    }
+  }
+
+  return collectAndReportErrors(context, std::move(futures), std::move(paths));
+}
+}
+}
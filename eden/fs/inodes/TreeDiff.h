@@ -0,0 +1,68 @@
+/*
+ *  Copyright (c) 2004-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <memory>
+#include "eden/utils/PathFuncs.h"
+
+namespace folly {
+template <typename T>
+class Future;
+class Unit;
+}
+
+namespace facebook {
+namespace eden {
+
+class DiffContext;
+class Tree;
+class TreeEntry;
+
+/*
+ * Functions for diffing source control Trees directly, without looking at
+ * any inodes.
+ *
+ * These report their results to context->callback, like TreeInode::diff().
+ * Since there is no working directory state involved, a file that is only
+ * present in the newer Tree is reported with untrackedFile().  ignoredFile()
+ * is never called.
+ */
+
+/**
+ * Compute the differences between two Trees for the same path.
+ *
+ * Subtrees with the same hash are skipped without being loaded.  The Trees
+ * and blob metadata that do need to be compared are fetched from the
+ * ObjectStore in batches, and subtrees are diffed in parallel on
+ * context->executor if it is set.
+ */
+folly::Future<folly::Unit> diffTrees(
+    const DiffContext* context,
+    RelativePathPiece currentPath,
+    std::unique_ptr<Tree> fromTree,
+    std::unique_ptr<Tree> toTree);
+
+/**
+ * Report every file under a source control tree entry as removed.
+ */
+folly::Future<folly::Unit> diffRemovedTree(
+    const DiffContext* context,
+    RelativePath currentPath,
+    const TreeEntry& entry);
+
+/**
+ * Report every file under a source control tree entry as untracked.
+ */
+folly::Future<folly::Unit> diffAddedTree(
+    const DiffContext* context,
+    RelativePath currentPath,
+    const TreeEntry& entry);
+}
+}
@@ -10,8 +10,12 @@
 #include "eden/fs/inodes/TreeInode.h"
 
 #include <boost/polymorphic_cast.hpp>
+#include <folly/Executor.h>
 #include <folly/FileUtil.h>
 #include <folly/futures/Future.h>
+#include <gflags/gflags.h>
+#include <algorithm>
+#include <limits>
 #include <vector>
 #include "eden/fs/inodes/CheckoutAction.h"
 #include "eden/fs/inodes/CheckoutContext.h"
@@ -22,6 +26,7 @@
 #include "eden/fs/inodes/FileData.h"
 #include "eden/fs/inodes/FileHandle.h"
 #include "eden/fs/inodes/FileInode.h"
+#include "eden/fs/inodes/GitIgnoreCache.h"
 #include "eden/fs/inodes/InodeDiffCallback.h"
 #include "eden/fs/inodes/InodeError.h"
 #include "eden/fs/inodes/InodeMap.h"
@@ -33,13 +38,18 @@
 #include "eden/fs/model/git/GitIgnoreStack.h"
 #include "eden/fs/service/ThriftUtil.h"
 #include "eden/fs/service/gen-cpp2/eden_types.h"
+#include "eden/fs/store/LocalStore.h"
+#include "eden/fs/store/ObjectBatch.h"
 #include "eden/fs/store/ObjectStore.h"
+#include "eden/fs/store/TreePrefetcher.h"
 #include "eden/fuse/Channel.h"
 #include "eden/fuse/MountPoint.h"
 #include "eden/fuse/RequestData.h"
 #include "eden/utils/Bug.h"
 #include "eden/utils/DirType.h"
 #include "eden/utils/PathFuncs.h"
+#include "eden/utils/RequestTrace.h"
+#include "eden/utils/SlabPool.h"
 
 using folly::Future;
 using folly::makeFuture;
@@ -50,28 +60,40 @@ using std::make_unique;
 using std::unique_ptr;
 using std::vector;
 
+DEFINE_int32(
+    tree_prefetch_lookups,
+    4,
+    "prefetch a directory's subdirectory trees once this many of its "
+    "children have had to be loaded by lookups.  0 only prefetches when the "
+    "directory is listed");
+
 namespace facebook {
 namespace eden {
 
 /**
- * A helper class to track info about inode loads that we started while holding
- * the contents_ lock.
+ * A helper class to track info about inode loads that we registered with the
+ * InodeMap while holding the contents_ lock.
  *
- * Once we release the contents_ lock we need to call
- * registerInodeLoadComplete() for each load we started.  This structure
- * exists to remember the arguments for each call that we need to make.
+ * Once we release the contents_ lock we need to start each load and call
+ * registerInodeLoadComplete() for it.  Starting the load may fetch a Tree
+ * from the ObjectStore or read overlay data from disk, and constructing a
+ * TreeInode for a large directory is not free either, so none of this is
+ * done while other readers of the directory are blocked on contents_.  This
+ * structure exists to remember the arguments for each load.
  */
 class TreeInode::IncompleteInodeLoad {
  public:
   IncompleteInodeLoad(
       TreeInode* inode,
-      Future<unique_ptr<InodeBase>>&& future,
+      const Entry& entry,
       PathComponentPiece name,
-      fuse_ino_t number)
+      fuse_ino_t number,
+      folly::Executor* overlayExecutor = nullptr)
       : treeInode_{inode},
         number_{number},
         name_{name},
-        future_{std::move(future)} {}
+        info_{entry},
+        overlayExecutor_{overlayExecutor} {}
 
   IncompleteInodeLoad(IncompleteInodeLoad&&) = default;
   IncompleteInodeLoad& operator=(IncompleteInodeLoad&&) = default;
@@ -96,7 +118,10 @@ class TreeInode::IncompleteInodeLoad {
     // Call treeInode_.release() here before registerInodeLoadComplete() to
     // reset treeInode_ to null.  Setting it to null makes it clear to the
     // destructor that finish() does not need to be called again.
-    treeInode_.release()->registerInodeLoadComplete(future_, name_, number_);
+    auto* treeInode = treeInode_.release();
+    auto future = treeInode->startLoadingInodeNoThrow(
+        info_, name_, number_, overlayExecutor_);
+    treeInode->registerInodeLoadComplete(future, name_, number_);
   }
 
  private:
@@ -110,9 +135,20 @@ class TreeInode::IncompleteInodeLoad {
   std::unique_ptr<TreeInode, NoopDeleter> treeInode_;
   fuse_ino_t number_;
   PathComponent name_;
-  Future<unique_ptr<InodeBase>> future_;
+  LoadInfo info_;
+  folly::Executor* overlayExecutor_;
 };
 
+static_assert(
+    sizeof(TreeInode::Entry) <= 48,
+    "TreeInode::Entry is stored inline for every directory entry, "
+    "so avoid growing it");
+
+TreeInode::Entry::Entry(const TreeEntry& entry)
+    : hash_{entry.getHash()}, mode(entry.getMode()), materialized_{false} {
+  setSize(entry.getSize());
+}
+
 bool TreeInode::Entry::isDirectory() const {
   return mode_to_dtype(mode) == dtype_t::Dir;
 }
@@ -121,8 +157,8 @@ TreeInode::TreeInode(
     fuse_ino_t ino,
     TreeInodePtr parent,
     PathComponentPiece name,
-    std::unique_ptr<Tree>&& tree)
-    : TreeInode(ino, parent, name, buildDirFromTree(tree.get())) {}
+    std::shared_ptr<const Tree> tree)
+    : TreeInode(ino, parent, name, buildDirFromTree(std::move(tree))) {}
 
 TreeInode::TreeInode(
     fuse_ino_t ino,
@@ -133,14 +169,27 @@ TreeInode::TreeInode(
   DCHECK_NE(ino, FUSE_ROOT_ID);
 }
 
-TreeInode::TreeInode(EdenMount* mount, std::unique_ptr<Tree>&& tree)
-    : TreeInode(mount, buildDirFromTree(tree.get())) {}
+TreeInode::TreeInode(EdenMount* mount, std::shared_ptr<const Tree> tree)
+    : TreeInode(mount, buildDirFromTree(std::move(tree))) {}
 
 TreeInode::TreeInode(EdenMount* mount, Dir&& dir)
     : InodeBase(mount), contents_(std::move(dir)) {}
 
 TreeInode::~TreeInode() {}
 
+namespace {
+// Leaked, since inodes may outlive static destruction.
+SlabPool* const treeInodePool = new SlabPool("tree_inode", sizeof(TreeInode));
+}
+
+void* TreeInode::operator new(size_t size) {
+  return treeInodePool->allocate(size);
+}
+
+void TreeInode::operator delete(void* ptr, size_t size) {
+  treeInodePool->deallocate(ptr, size);
+}
+
 folly::Future<fusell::Dispatcher::Attr> TreeInode::getattr() {
   return getAttrLocked(&*contents_.rlock());
 }
@@ -155,22 +204,49 @@ fusell::Dispatcher::Attr TreeInode::getAttrLocked(const Dir* contents) {
   // For directories, nlink is the number of entries including the
   // "." and ".." links.
   attr.st.st_nlink = contents->entries.size() + 2;
+  attr.timeout = getKernelCacheTtl(contents->materialized);
   return attr;
 }
 
+double TreeInode::getNegativeEntryTtl() {
+  return getKernelCacheTtl(contents_.rlock()->materialized);
+}
+
 folly::Future<InodePtr> TreeInode::getChildByName(
     PathComponentPiece namepiece) {
   return getOrLoadChild(namepiece);
 }
 
+InodePtr TreeInode::getLoadedChild(PathComponentPiece name) {
+  // This only needs the contents_ lock in shared mode.  Any code that unloads
+  // a child holds our contents_ lock exclusively, so it is safe to hand out a
+  // new reference here.
+  auto contents = RequestTrace::lockTraced(
+      RequestTrace::CONTENTS_LOCK,
+      "TreeInode::getLoadedChild",
+      [&] { return contents_.rlock(); });
+  auto iter = contents->entries.find(name);
+  if (iter == contents->entries.end() || !iter->second.inode) {
+    return nullptr;
+  }
+  iter->second.inode->updateLastAccess();
+  return InodePtr::newPtrLocked(iter->second.inode);
+}
+
 Future<InodePtr> TreeInode::getOrLoadChild(PathComponentPiece name) {
-  folly::Optional<Future<unique_ptr<InodeBase>>> inodeLoadFuture;
+  // Most lookups are for children that are already loaded.
+  auto loaded = getLoadedChild(name);
+  if (loaded) {
+    return makeFuture<InodePtr>(std::move(loaded));
+  }
+
+  folly::Optional<IncompleteInodeLoad> pendingLoad;
   folly::Optional<Future<InodePtr>> returnFuture;
-  InodePtr childInodePtr;
-  InodeMap::PromiseVector promises;
-  fuse_ino_t childNumber;
   {
-    auto contents = contents_.wlock();
+    auto contents = RequestTrace::lockTraced(
+        RequestTrace::CONTENTS_LOCK,
+        "TreeInode::getOrLoadChild",
+        [&] { return contents_.wlock(); });
     auto iter = contents->entries.find(name);
     if (iter == contents->entries.end()) {
       if (name == kDotEdenName && getNodeId() != FUSE_ROOT_ID) {
@@ -182,53 +258,51 @@ Future<InodePtr> TreeInode::getOrLoadChild(PathComponentPiece name) {
       return makeFuture<InodePtr>(InodeError(ENOENT, inodePtrFromThis(), name));
     }
 
-    // Check to see if the entry is already loaded
-    auto& entryPtr = iter->second;
-    if (entryPtr->inode) {
-      return makeFuture<InodePtr>(InodePtr::newPtrLocked(entryPtr->inode));
+    // Check again to see if the entry was loaded while we did not hold the
+    // lock.
+    auto& entry = iter->second;
+    if (entry.inode) {
+      entry.inode->updateLastAccess();
+      return makeFuture<InodePtr>(InodePtr::newPtrLocked(entry.inode));
     }
 
     // The entry is not loaded yet.  Ask the InodeMap about the entry.
     // The InodeMap will tell us if this inode is already in the process of
     // being loaded, or if we need to start loading it now.
     folly::Promise<InodePtr> promise;
-    returnFuture = promise.getFuture();
+    auto loadStart = std::chrono::steady_clock::now();
+    returnFuture = promise.getFuture().then([loadStart](InodePtr inode) {
+      RequestTrace::addTime(RequestTrace::INODE_LOAD, loadStart);
+      return inode;
+    });
     bool startLoad;
-    if (entryPtr->hasInodeNumber()) {
-      childNumber = entryPtr->getInodeNumber();
+    fuse_ino_t childNumber;
+    if (entry.hasInodeNumber()) {
+      childNumber = entry.getInodeNumber();
       startLoad = getInodeMap()->shouldLoadChild(
           this, name, childNumber, std::move(promise));
     } else {
       childNumber =
           getInodeMap()->newChildLoadStarted(this, name, std::move(promise));
       // Immediately record the newly allocated inode number
-      entryPtr->setInodeNumber(childNumber);
+      entry.setInodeNumber(childNumber);
       startLoad = true;
     }
     if (startLoad) {
-      // The inode is not already being loaded.  We have to start loading it
-      // now.
-      auto loadFuture =
-          startLoadingInodeNoThrow(entryPtr.get(), name, childNumber);
-      if (loadFuture.isReady() && loadFuture.hasValue()) {
-        // If we finished loading the inode immediately, just call
-        // InodeMap::inodeLoadComplete() now, since we still have the data_
-        // lock.
-        auto childInode = loadFuture.get();
-        entryPtr->inode = childInode.get();
-        promises = getInodeMap()->inodeLoadComplete(childInode.get());
-        childInodePtr = InodePtr::newPtrLocked(childInode.release());
-      } else {
-        inodeLoadFuture = std::move(loadFuture);
-      }
+      // The inode is not already being loaded.  The load is now registered
+      // with the InodeMap, so anyone else looking up this child will wait for
+      // it.  Start it once we release the lock.
+      pendingLoad.emplace(this, entry, name, childNumber);
     }
   }
 
-  if (inodeLoadFuture) {
-    registerInodeLoadComplete(inodeLoadFuture.value(), name, childNumber);
-  } else {
-    for (auto& promise : promises) {
-      promise.setValue(childInodePtr);
+  if (pendingLoad) {
+    pendingLoad->finish();
+    // A directory whose children are being looked up one by one is likely
+    // being walked, so its other subdirectories will be needed soon too.
+    if (numChildLoads_.fetch_add(1) + 1 ==
+        static_cast<uint32_t>(FLAGS_tree_prefetch_lookups)) {
+      prefetchChildTrees();
     }
   }
 
@@ -237,14 +311,106 @@ Future<InodePtr> TreeInode::getOrLoadChild(PathComponentPiece name) {
 
 Future<TreeInodePtr> TreeInode::getOrLoadChildTree(PathComponentPiece name) {
   return getOrLoadChild(name).then([](InodePtr child) {
-    auto treeInode = child.asTreePtrOrNull();
+    // On failure the extracting conversion leaves child set, for the error.
+    auto treeInode = std::move(child).asTreePtrOrNull();
     if (!treeInode) {
       return makeFuture<TreeInodePtr>(InodeError(ENOTDIR, child));
     }
-    return makeFuture(treeInode);
+    return makeFuture(std::move(treeInode));
   });
 }
 
+Future<Unit> TreeInode::loadChildSizes(const vector<PathComponent>& names) {
+  vector<PathComponent> fetchNames;
+  vector<Hash> fetchIds;
+  {
+    auto contents = contents_.rlock();
+    for (const auto& name : names) {
+      auto iter = contents->entries.find(name);
+      if (iter == contents->entries.end()) {
+        continue;
+      }
+      const auto& entry = iter->second;
+      if (entry.inode || entry.isMaterialized() || entry.isDirectory() ||
+          entry.getSize().hasValue()) {
+        continue;
+      }
+      fetchNames.push_back(name);
+      fetchIds.push_back(entry.getHash());
+    }
+  }
+  if (fetchIds.empty()) {
+    return makeFuture();
+  }
+
+  auto metadata = getStore()->getBlobMetadataBatch(fetchIds);
+  return folly::collectAll(metadata).then(
+      [self = inodePtrFromThis(),
+       fetchNames = std::move(fetchNames),
+       fetchIds = std::move(fetchIds)](
+          vector<folly::Try<BlobMetadata>>&& results) {
+        auto contents = self->contents_.wlock();
+        for (size_t n = 0; n < results.size(); ++n) {
+          if (!results[n].hasValue()) {
+            continue;
+          }
+          // The entry may have been modified or loaded while the metadata
+          // was being fetched.
+          auto iter = contents->entries.find(fetchNames[n]);
+          if (iter == contents->entries.end()) {
+            continue;
+          }
+          auto& entry = iter->second;
+          if (!entry.inode && !entry.isMaterialized() &&
+              entry.getHash() == fetchIds[n]) {
+            entry.setBlobSize(results[n].value().size);
+          }
+        }
+      });
+}
+
+Future<Unit> TreeInode::prefetchChildMetadata() {
+  if (childMetadataPrefetched_.exchange(true)) {
+    return makeFuture();
+  }
+
+  vector<Hash> ids;
+  {
+    auto contents = contents_.rlock();
+    for (const auto& entry : contents->entries) {
+      if (!entry.second.isMaterialized() && !entry.second.isDirectory()) {
+        ids.push_back(entry.second.getHash());
+      }
+    }
+  }
+  if (ids.empty()) {
+    return makeFuture();
+  }
+
+  // The ObjectStore stores fetched metadata in the LocalStore, so there is
+  // nothing to do with the results.
+  return folly::collectAll(getStore()->getBlobMetadataBatch(ids)).unit();
+}
+
+void TreeInode::prefetchChildTrees() {
+  auto* prefetcher = getMount()->getTreePrefetcher();
+  if (!prefetcher || childTreesPrefetched_.exchange(true)) {
+    return;
+  }
+
+  vector<Hash> ids;
+  {
+    auto contents = contents_.rlock();
+    for (const auto& entry : contents->entries) {
+      if (entry.second.isDirectory() && !entry.second.isMaterialized() &&
+          !entry.second.inode) {
+        ids.push_back(entry.second.getHash());
+      }
+    }
+  }
+  prefetcher->prefetch(ids);
+}
+
 namespace {
 /**
  * A helper class for performing a recursive path lookup.
@@ -302,21 +468,57 @@ fuse_ino_t TreeInode::getChildInodeNumber(PathComponentPiece name) {
   }
 
   auto& ent = iter->second;
-  if (ent->inode) {
-    return ent->inode->getNodeId();
+  if (ent.inode) {
+    return ent.inode->getNodeId();
   }
 
-  if (ent->hasInodeNumber()) {
-    return ent->getInodeNumber();
+  if (ent.hasInodeNumber()) {
+    return ent.getInodeNumber();
   }
 
   auto inodeNumber = getInodeMap()->allocateInodeNumber();
-  ent->setInodeNumber(inodeNumber);
+  ent.setInodeNumber(inodeNumber);
   return inodeNumber;
 }
 
+void TreeInode::forEachChildNumber(
+    folly::Function<void(PathComponentPiece, mode_t, fuse_ino_t)> fn) {
+  auto contents = contents_.wlock();
+  auto* inodeMap = getInodeMap();
+  for (auto& entry : contents->entries) {
+    auto& ent = entry.second;
+    fuse_ino_t number;
+    if (ent.inode) {
+      number = ent.inode->getNodeId();
+    } else if (ent.hasInodeNumber()) {
+      number = ent.getInodeNumber();
+    } else {
+      number = inodeMap->allocateInodeNumber();
+      ent.setInodeNumber(number);
+    }
+    fn(entry.first, ent.mode, number);
+  }
+}
+
+void TreeInode::restoreChildInodeNumbers(
+    const std::vector<std::pair<PathComponent, fuse_ino_t>>& children) {
+  auto contents = contents_.wlock();
+  for (const auto& child : children) {
+    auto iter = contents->entries.find(child.first);
+    if (iter == contents->entries.end()) {
+      VLOG(2) << "not restoring inode " << child.second << ": "
+              << getLogPath() << " has no entry named " << child.first;
+      continue;
+    }
+    auto& entry = iter->second;
+    if (!entry.inode && !entry.hasInodeNumber()) {
+      entry.setInodeNumber(child.second);
+    }
+  }
+}
+
 void TreeInode::loadChildInode(PathComponentPiece name, fuse_ino_t number) {
-  folly::Optional<folly::Future<unique_ptr<InodeBase>>> future;
+  folly::Optional<IncompleteInodeLoad> pendingLoad;
   {
     auto contents = contents_.rlock();
     auto iter = contents->entries.find(name);
@@ -328,10 +530,10 @@ void TreeInode::loadChildInode(PathComponentPiece name, fuse_ino_t number) {
       return;
     }
 
-    auto& entryPtr = iter->second;
+    auto& entry = iter->second;
     // InodeMap makes sure to only try loading each inode once, so this entry
     // should not already be loaded.
-    if (entryPtr->inode != nullptr) {
+    if (entry.inode != nullptr) {
       auto bug = EDEN_BUG() << "InodeMap requested to load inode " << number
                             << "(" << name << " in " << getNodeId()
                             << "), which is already loaded";
@@ -346,9 +548,9 @@ void TreeInode::loadChildInode(PathComponentPiece name, fuse_ino_t number) {
       return;
     }
 
-    future = startLoadingInodeNoThrow(entryPtr.get(), name, number);
+    pendingLoad.emplace(this, entry, name, number);
   }
-  registerInodeLoadComplete(future.value(), name, number);
+  pendingLoad->finish();
 }
 
 void TreeInode::registerInodeLoadComplete(
@@ -392,7 +594,19 @@ void TreeInode::inodeLoadComplete(
           childName,
           "inode removed before loading finished");
     }
-    iter->second->inode = childInode.get();
+    // The load was started outside of the contents_ lock, from a copy of the
+    // entry.  Make sure the entry was not replaced in the meantime.
+    if (iter->second.hasInodeNumber() &&
+        iter->second.getInodeNumber() != childInode->getNodeId()) {
+      LOG(ERROR) << "child " << childName << " in " << getLogPath()
+                 << " replaced before it finished loading";
+      throw InodeError(
+          ESTALE,
+          inodePtrFromThis(),
+          childName,
+          "inode replaced before loading finished");
+    }
+    iter->second.inode = childInode.get();
     // Make sure that we are still holding the contents_ lock when
     // calling inodeLoadComplete().  This ensures that no-one can look up
     // the inode by name before it is also available in the InodeMap.
@@ -409,9 +623,10 @@ void TreeInode::inodeLoadComplete(
 }
 
 Future<unique_ptr<InodeBase>> TreeInode::startLoadingInodeNoThrow(
-    Entry* entry,
+    const LoadInfo& info,
     PathComponentPiece name,
-    fuse_ino_t number) noexcept {
+    fuse_ino_t number,
+    folly::Executor* overlayExecutor) noexcept {
   // The callers of startLoadingInodeNoThrow() need to make sure that they
   // always call InodeMap::inodeLoadComplete() or InodeMap::inodeLoadFailed()
   // afterwards.
@@ -420,7 +635,7 @@ Future<unique_ptr<InodeBase>> TreeInode::startLoadingInodeNoThrow(
   // and always return a Future object.  Therefore we simply wrap
   // startLoadingInode() and convert any thrown exceptions into Future.
   try {
-    return startLoadingInode(entry, name, number);
+    return startLoadingInode(info, name, number, overlayExecutor);
   } catch (const std::exception& ex) {
     // It's possible that makeFuture() itself could throw, but this only
     // happens on out of memory, in which case the whole process is pretty much
@@ -431,13 +646,13 @@ Future<unique_ptr<InodeBase>> TreeInode::startLoadingInodeNoThrow(
 }
 
 Future<unique_ptr<InodeBase>> TreeInode::startLoadingInode(
-    Entry* entry,
+    const LoadInfo& info,
     PathComponentPiece name,
-    fuse_ino_t number) {
+    fuse_ino_t number,
+    folly::Executor* overlayExecutor) {
   VLOG(5) << "starting to load inode " << number << ": " << getLogPath()
           << " / \"" << name << "\"";
-  DCHECK(entry->inode == nullptr);
-  if (!S_ISDIR(entry->mode)) {
+  if (!S_ISDIR(info.mode)) {
     // If this is a file we can just go ahead and create it now;
     // we don't need to load anything else.
     //
@@ -448,27 +663,42 @@ Future<unique_ptr<InodeBase>> TreeInode::startLoadingInode(
         number,
         inodePtrFromThis(),
         name,
-        entry->mode,
-        entry->getOptionalHash());
+        info.mode,
+        info.hash,
+        info.size);
   }
 
-  if (!entry->isMaterialized()) {
-    return getStore()->getTreeFuture(entry->getHash()).then([
+  if (info.hash) {
+    auto* prefetcher = getMount()->getTreePrefetcher();
+    if (prefetcher) {
+      prefetcher->recordLoad(info.hash.value());
+    }
+    return getStore()->getSharedTreeFuture(info.hash.value()).then([
       self = inodePtrFromThis(),
       childName = PathComponent{name},
       number
-    ](std::unique_ptr<Tree> tree)->unique_ptr<InodeBase> {
+    ](std::shared_ptr<const Tree> tree)->unique_ptr<InodeBase> {
       return make_unique<TreeInode>(number, self, childName, std::move(tree));
     });
   }
 
   // No corresponding TreeEntry, this exists only in the overlay.
-  CHECK_EQ(number, entry->getInodeNumber());
+  if (overlayExecutor) {
+    return folly::via(overlayExecutor).then([
+      self = inodePtrFromThis(),
+      childName = PathComponent{name},
+      number
+    ] { return self->loadOverlayTreeInode(childName, number); });
+  }
+  return loadOverlayTreeInode(name, number);
+}
+
+unique_ptr<InodeBase> TreeInode::loadOverlayTreeInode(
+    PathComponentPiece name,
+    fuse_ino_t number) {
   auto overlayDir = getOverlay()->loadOverlayDir(number);
   if (!overlayDir) {
-    auto bug = EDEN_BUG() << "missing overlay for " << getLogPath() << " / "
-                          << name;
-    return folly::makeFuture<unique_ptr<InodeBase>>(bug.toException());
+    EDEN_BUG() << "missing overlay for " << getLogPath() << " / " << name;
   }
   return make_unique<TreeInode>(
       number, inodePtrFromThis(), name, std::move(overlayDir.value()));
@@ -502,7 +732,7 @@ void TreeInode::materialize(const RenameLock* renameLock) {
     // are materialized but we don't think we are.
     RenameLock renameLock2;
     if (!renameLock) {
-      renameLock2 = getMount()->acquireRenameLock();
+      renameLock2 = getMount()->acquireRenameLock("TreeInode::materialize");
       renameLock = &renameLock2;
     }
 
@@ -525,7 +755,7 @@ void TreeInode::materialize(const RenameLock* renameLock) {
         return;
       }
       contents->materialized = true;
-      getOverlay()->saveOverlayDir(this->getNodeId(), &*contents);
+      getOverlay()->markDirDirty(inodePtrFromThis());
     }
 
     // Mark ourself materialized in our parent directory (if we have one)
@@ -553,17 +783,24 @@ void TreeInode::childMaterialized(
                  << getLogPath() << ": entry not present";
     }
 
-    auto* childEntry = iter->second.get();
+    auto* childEntry = &iter->second;
     if (contents->materialized && childEntry->isMaterialized()) {
-      // Nothing to do
+      // Nothing to do, except to discard the cached diff results, since the
+      // child is normally materialized again because it is being modified.
+      contents.unlock();
+      invalidateDiffCache();
       return;
     }
 
     childEntry->setMaterialized(childNodeId);
     contents->materialized = true;
-    getOverlay()->saveOverlayDir(this->getNodeId(), &*contents);
+    getOverlay()->markDirEntryDirty(inodePtrFromThis(), childName);
   }
 
+  // Our parent's childMaterialized() call below takes care of invalidating
+  // the diff cache of our ancestors.
+  diffGeneration_.fetch_add(1, std::memory_order_acq_rel);
+
   // If we have a parent directory, ask our parent to materialize itself
   // and mark us materialized when it does so.
   auto location = getLocationInfo(renameLock);
@@ -586,7 +823,7 @@ void TreeInode::childDematerialized(
                  << getLogPath() << ": entry not present";
     }
 
-    auto* childEntry = iter->second.get();
+    auto* childEntry = &iter->second;
     if (!childEntry->isMaterialized() &&
         childEntry->getHash() == childScmHash) {
       // Nothing to do.  Our child's state and our own are both unchanged.
@@ -605,8 +842,9 @@ void TreeInode::childDematerialized(
     // saveOverlayPostCheckout() on this directory, and here we will check to
     // see if we can dematerialize ourself.
     contents->materialized = true;
-    getOverlay()->saveOverlayDir(this->getNodeId(), &*contents);
+    getOverlay()->markDirEntryDirty(inodePtrFromThis(), childName);
   }
+  diffGeneration_.fetch_add(1, std::memory_order_acq_rel);
 
   // We are materialized now.
   // If we have a parent directory, ask our parent to materialize itself
@@ -617,7 +855,7 @@ void TreeInode::childDematerialized(
   }
 }
 
-TreeInode::Dir TreeInode::buildDirFromTree(const Tree* tree) {
+TreeInode::Dir TreeInode::buildDirFromTree(std::shared_ptr<const Tree> tree) {
   // Now build out the Dir based on what we know.
   Dir dir;
   if (!tree) {
@@ -628,11 +866,14 @@ TreeInode::Dir TreeInode::buildDirFromTree(const Tree* tree) {
   }
 
   dir.treeHash = tree->getHash();
+  // Tree entries are already sorted, so each insert appends to the end.
+  // The entry names are borrowed from the Tree, which the Dir keeps alive.
+  dir.entries.reserve(tree->getTreeEntries().size());
   for (const auto& treeEntry : tree->getTreeEntries()) {
-    Entry entry{treeEntry.getMode(), treeEntry.getHash()};
-    dir.entries.emplace(
-        treeEntry.getName(), std::make_unique<Entry>(std::move(entry)));
+    dir.entries.insert(std::make_pair(
+        DirEntryName::borrow(treeEntry.getName()), Entry{treeEntry}));
   }
+  dir.sourceTree = std::move(tree);
   return dir;
 }
 
@@ -672,19 +913,23 @@ TreeInode::create(PathComponentPiece name, mode_t mode, int flags) {
         filePath.c_str(),
         O_RDWR | O_CREAT | (flags & ~(O_RDONLY | O_WRONLY)),
         0600);
+    getOverlay()->updateUsage(1, 0);
 
     // The mode passed in by the caller may not have the file type bits set.
     // Ensure that we mark this as a regular file.
     mode = S_IFREG | (07777 & mode);
 
     // Record the new entry
-    auto& entry = contents->entries[name];
-    entry = std::make_unique<Entry>(mode, childNumber);
+    auto ret = contents->entries.emplace(name, mode, childNumber);
+    if (!ret.second) {
+      ret.first->second = Entry{mode, childNumber};
+    }
+    auto& entry = ret.first->second;
 
     // build a corresponding FileInode
     inode = FileInodePtr::makeNew(
         childNumber, this->inodePtrFromThis(), name, mode, std::move(file));
-    entry->inode = inode.get();
+    entry.inode = inode.get();
     inodeMap->inodeCreated(inode);
 
     // The kernel wants an open operation to return the inode,
@@ -692,11 +937,12 @@ TreeInode::create(PathComponentPiece name, mode_t mode, int flags) {
     // Let's open a file handle now.
     handle = inode->finishCreate();
 
-    this->getOverlay()->saveOverlayDir(getNodeId(), &*contents);
+    getOverlay()->markDirEntryDirty(inodePtrFromThis(), name);
   }
 
-  getMount()->getJournal().wlock()->addDelta(
+  getMount()->getJournal().addDelta(
       std::make_unique<JournalDelta>(JournalDelta{targetName}));
+  invalidateDiffCache();
 
   // Now that we have the file handle, let's look up the attributes.
   auto getattrResult = handle->getattr();
@@ -770,24 +1016,27 @@ FileInodePtr TreeInode::symlink(
           " bytes");
     }
 
-    auto entry = std::make_unique<Entry>(S_IFLNK | 0770, childNumber);
+    getOverlay()->updateUsage(1, symlinkTarget.size());
+
+    Entry entry{S_IFLNK | 0770, childNumber};
 
     // build a corresponding FileInode
     inode = FileInodePtr::makeNew(
         childNumber,
         this->inodePtrFromThis(),
         name,
-        entry->mode,
+        entry.mode,
         std::move(file));
-    entry->inode = inode.get();
+    entry.inode = inode.get();
     inodeMap->inodeCreated(inode);
     contents->entries.emplace(name, std::move(entry));
 
-    this->getOverlay()->saveOverlayDir(getNodeId(), &*contents);
+    getOverlay()->markDirEntryDirty(inodePtrFromThis(), name);
   }
 
-  getMount()->getJournal().wlock()->addDelta(
+  getMount()->getJournal().addDelta(
       std::make_unique<JournalDelta>(JournalDelta{targetName}));
+  invalidateDiffCache();
 
   return inode;
 }
@@ -806,6 +1055,11 @@ TreeInode::mknod(PathComponentPiece name, mode_t mode, dev_t rdev) {
         name,
         "only unix domain sockets are supported by mknod");
   }
+  if (rdev > std::numeric_limits<uint32_t>::max()) {
+    // TreeInode::Entry only stores 32 bits of rdev
+    throw InodeError(
+        EOVERFLOW, inodePtrFromThis(), name, "device number is too large");
+  }
 
   materialize();
 
@@ -840,24 +1094,27 @@ TreeInode::mknod(PathComponentPiece name, mode_t mode, dev_t rdev) {
       ::unlink(filePath.c_str());
     };
 
-    auto entry = std::make_unique<Entry>(mode, childNumber, rdev);
+    getOverlay()->updateUsage(1, 0);
+
+    Entry entry{mode, childNumber, rdev};
 
     // build a corresponding FileInode
     inode = FileInodePtr::makeNew(
         childNumber,
         this->inodePtrFromThis(),
         name,
-        entry->mode,
+        entry.mode,
         std::move(file));
-    entry->inode = inode.get();
+    entry.inode = inode.get();
     inodeMap->inodeCreated(inode);
     contents->entries.emplace(name, std::move(entry));
 
-    this->getOverlay()->saveOverlayDir(getNodeId(), &*contents);
+    getOverlay()->markDirEntryDirty(inodePtrFromThis(), name);
   }
 
-  getMount()->getJournal().wlock()->addDelta(
+  getMount()->getJournal().addDelta(
       std::make_unique<JournalDelta>(JournalDelta{targetName}));
+  invalidateDiffCache();
 
   return inode;
 }
@@ -896,14 +1153,15 @@ TreeInodePtr TreeInode::mkdir(PathComponentPiece name, mode_t mode) {
     // Ensure that we mark this as a directory.
     mode = S_IFDIR | (07777 & mode);
 
-    // Store the overlay entry for this dir
+    // Store the overlay entry for this dir.  This is written immediately
+    // rather than marked dirty, so that it is always on disk before our own
+    // entry referring to it is.
     Dir emptyDir;
     emptyDir.materialized = true;
     overlay->saveOverlayDir(childNumber, &emptyDir);
 
     // Add a new entry to contents_.entries
-    auto emplaceResult = contents->entries.emplace(
-        name, std::make_unique<Entry>(mode, childNumber));
+    auto emplaceResult = contents->entries.emplace(name, mode, childNumber);
     CHECK(emplaceResult.second)
         << "directory contents should not have changed since the check above";
     auto& entry = emplaceResult.first->second;
@@ -914,15 +1172,16 @@ TreeInodePtr TreeInode::mkdir(PathComponentPiece name, mode_t mode) {
         this->inodePtrFromThis(),
         name,
         std::move(emptyDir));
-    entry->inode = newChild.get();
+    entry.inode = newChild.get();
     inodeMap->inodeCreated(newChild);
 
     // Save our updated overlay data
-    overlay->saveOverlayDir(getNodeId(), &*contents);
+    overlay->markDirEntryDirty(inodePtrFromThis(), name);
   }
 
-  getMount()->getJournal().wlock()->addDelta(
+  getMount()->getJournal().addDelta(
       std::make_unique<JournalDelta>(JournalDelta{targetName}));
+  invalidateDiffCache();
 
   return newChild;
 }
@@ -962,7 +1221,7 @@ folly::Future<folly::Unit> TreeInode::removeImpl(
   }
 
   // Acquire the rename lock since we need to update our child's location
-  auto renameLock = getMount()->acquireRenameLock();
+  auto renameLock = getMount()->acquireRenameLock("TreeInode::removeImpl");
 
   // Get the path to the child, so we can update the journal later.
   // Make sure we only do this after we acquire the rename lock, so that the
@@ -985,7 +1244,7 @@ folly::Future<folly::Unit> TreeInode::removeImpl(
   int errnoValue = tryRemoveChild<InodePtrType>(renameLock, name, nullptr);
   if (errnoValue == 0) {
     // We successfuly removed the child.
-    getMount()->getJournal().wlock()->addDelta(
+    getMount()->getJournal().addDelta(
         std::make_unique<JournalDelta>(JournalDelta{targetName}));
 
     return folly::Unit{};
@@ -1028,6 +1287,102 @@ folly::Future<folly::Unit> TreeInode::removeImpl(
   });
 }
 
+folly::Future<folly::Unit> TreeInode::removeRecursive(
+    PathComponentPiece name) {
+  auto removed = std::make_shared<RemovedPaths>();
+  auto self = inodePtrFromThis();
+  auto childFuture = getOrLoadChild(name);
+  return childFuture
+      .then([ self, childName = PathComponent{name}, removed ](
+          InodePtr&& child) {
+        return self->removeRecursiveImpl(childName, std::move(child), removed);
+      })
+      .ensure([self, removed] {
+        // Record whatever was removed, even if we failed part way through.
+        auto paths = removed->wlock();
+        if (paths->empty()) {
+          return;
+        }
+        auto delta = std::make_unique<JournalDelta>();
+        for (auto& path : *paths) {
+          delta->changedFilesInOverlay.insert(std::move(path));
+        }
+        self->getMount()->getJournal().addDelta(std::move(delta));
+      });
+}
+
+Future<Unit> TreeInode::removeRecursiveImpl(
+    PathComponentPiece name,
+    InodePtr child,
+    std::shared_ptr<RemovedPaths> removed) {
+  auto tree = child.asTreePtrOrNull();
+  if (!tree) {
+    removeLoadedChild(name, std::move(child).asFilePtr(), *removed);
+    return folly::Unit{};
+  }
+
+  auto contentsFuture = tree->removeAllChildren(removed);
+  return contentsFuture.then([
+    self = inodePtrFromThis(),
+    childName = PathComponent{name},
+    tree = std::move(tree),
+    removed
+  ] { self->removeLoadedChild(childName, tree, *removed); });
+}
+
+Future<Unit> TreeInode::removeAllChildren(
+    std::shared_ptr<RemovedPaths> removed) {
+  vector<PathComponent> names;
+  {
+    auto contents = contents_.rlock();
+    names.reserve(contents->entries.size());
+    for (const auto& entry : contents->entries) {
+      names.push_back(entry.first.copy());
+    }
+  }
+
+  auto self = inodePtrFromThis();
+  vector<Future<Unit>> futures;
+  futures.reserve(names.size());
+  for (auto& name : names) {
+    auto childFuture = getOrLoadChild(name);
+    futures.push_back(childFuture.then(
+        [ self, childName = std::move(name), removed ](InodePtr&& child) {
+          return self->removeRecursiveImpl(
+              childName, std::move(child), removed);
+        }));
+  }
+
+  // Wait for all of the children, even if some fail, so that every path
+  // that was removed is known by the time removeRecursive() completes.
+  return folly::collectAll(futures).then(
+      [](vector<folly::Try<Unit>>&& results) {
+        for (auto& result : results) {
+          result.throwIfFailed();
+        }
+      });
+}
+
+template <typename InodePtrType>
+void TreeInode::removeLoadedChild(
+    PathComponentPiece name,
+    InodePtrType child,
+    RemovedPaths& removed) {
+  auto renameLock = getMount()->acquireRenameLock("TreeInode::removeRecursive");
+  auto myPath = getPath();
+  if (!myPath.hasValue()) {
+    throw InodeError(ENOENT, inodePtrFromThis());
+  }
+
+  // Unlike removeImpl() there is no retry if the entry was replaced while we
+  // were emptying it: the new entry was not part of the tree being removed.
+  int errnoValue = tryRemoveChild(renameLock, name, std::move(child));
+  if (errnoValue != 0) {
+    throw InodeError(errnoValue, inodePtrFromThis(), name);
+  }
+  removed.wlock()->push_back(myPath.value() + name);
+}
+
 template <typename InodePtrType>
 int TreeInode::tryRemoveChild(
     const RenameLock& renameLock,
@@ -1053,20 +1408,20 @@ int TreeInode::tryRemoveChild(
       return ENOENT;
     }
     auto& ent = entIter->second;
-    if (!ent->inode) {
+    if (!ent.inode) {
       // The inode in question is not loaded.  The caller will need to load it
       // and retry (if they want to retry).
       return EBADF;
     }
     if (child) {
-      if (ent->inode != child.get()) {
+      if (ent.inode != child.get()) {
         // This entry no longer refers to what the caller expected.
         return EBADF;
       }
     } else {
       // Make sure the entry being removed is the expected file/directory type.
       auto* currentChild =
-          dynamic_cast<typename InodePtrType::InodeType*>(ent->inode);
+          dynamic_cast<typename InodePtrType::InodeType*>(ent.inode);
       if (!currentChild) {
         return InodePtrType::InodeType::WRONG_TYPE_ERRNO;
       }
@@ -1087,8 +1442,9 @@ int TreeInode::tryRemoveChild(
 
     // Update the on-disk overlay
     auto overlay = this->getOverlay();
-    overlay->saveOverlayDir(getNodeId(), &*contents);
+    overlay->markDirEntryDirty(inodePtrFromThis(), name);
   }
+  invalidateDiffCache();
   deletedInode.reset();
   return 0;
 }
@@ -1122,14 +1478,56 @@ class TreeInode::TreeRenameLocks {
       TreeInode* destTree,
       PathComponentPiece destName);
 
+  /**
+   * Acquire the locks for a rename within a single directory while holding
+   * the rename lock in shared mode.  The caller must check that the rename
+   * only moves a file before performing it.
+   */
+  void acquireSharedLocks(
+      SharedRenameLock&& renameLock,
+      TreeInode* tree,
+      PathComponentPiece destName);
+
   void reset() {
     *this = TreeRenameLocks();
   }
 
+  /**
+   * Returns the exclusive rename lock.  This may only be called when the
+   * locks were acquired with acquireLocks().
+   */
   const RenameLock& renameLock() const {
+    DCHECK(renameLock_.owns_lock());
     return renameLock_;
   }
 
+  /**
+   * Mark the destination child unlinked, using whichever rename lock is held.
+   */
+  std::unique_ptr<InodeBase> unlinkDestChild(
+      TreeInode* destTree,
+      PathComponentPiece destName) {
+    if (sharedRenameLock_.owns_lock()) {
+      return destChild()->markUnlinked(destTree, destName, sharedRenameLock_);
+    }
+    return destChild()->markUnlinked(destTree, destName, renameLock_);
+  }
+
+  /**
+   * Update the location of the inode being renamed, using whichever rename
+   * lock is held.
+   */
+  void updateLocation(
+      InodeBase* child,
+      TreeInodePtr destTree,
+      PathComponentPiece destName) {
+    if (sharedRenameLock_.owns_lock()) {
+      child->updateLocation(std::move(destTree), destName, sharedRenameLock_);
+    } else {
+      child->updateLocation(std::move(destTree), destName, renameLock_);
+    }
+  }
+
   Dir* srcContents() {
     return srcContents_;
   }
@@ -1138,12 +1536,12 @@ class TreeInode::TreeRenameLocks {
     return destContents_;
   }
 
-  const PathMap<std::unique_ptr<Entry>>::iterator& destChildIter() const {
+  const EntryMap::iterator& destChildIter() const {
     return destChildIter_;
   }
   InodeBase* destChild() const {
     DCHECK(destChildExists());
-    return destChildIter_->second->inode;
+    return destChildIter_->second.inode;
   }
 
   bool destChildExists() const {
@@ -1151,7 +1549,7 @@ class TreeInode::TreeRenameLocks {
   }
   bool destChildIsDirectory() const {
     DCHECK(destChildExists());
-    return destChildIter_->second->isDirectory();
+    return destChildIter_->second.isDirectory();
   }
   bool destChildIsEmpty() const {
     DCHECK_NOTNULL(destChildContents_);
@@ -1162,9 +1560,10 @@ class TreeInode::TreeRenameLocks {
   void lockDestChild(PathComponentPiece destName);
 
   /**
-   * The mountpoint-wide rename lock.
+   * The mountpoint-wide rename lock.  Only one of these is held.
    */
   RenameLock renameLock_;
+  SharedRenameLock sharedRenameLock_;
 
   /**
    * Locks for the contents of the source and destination directories.
@@ -1173,9 +1572,9 @@ class TreeInode::TreeRenameLocks {
    * always both set, so that destContents_ can be used regardless of wether
    * the source and destination are both the same directory or not.
    */
-  folly::Synchronized<Dir>::LockedPtr srcContentsLock_;
-  folly::Synchronized<Dir>::LockedPtr destContentsLock_;
-  folly::Synchronized<Dir>::LockedPtr destChildContentsLock_;
+  DirContents::LockedPtr srcContentsLock_;
+  DirContents::LockedPtr destContentsLock_;
+  DirContents::LockedPtr destChildContentsLock_;
 
   /**
    * Pointers to the source and destination directory contents.
@@ -1193,17 +1592,39 @@ class TreeInode::TreeRenameLocks {
    * This may point to destContents_->entries.end() if the destination child
    * does not exist.
    */
-  PathMap<std::unique_ptr<Entry>>::iterator destChildIter_;
+  EntryMap::iterator destChildIter_;
 };
 
 Future<Unit> TreeInode::rename(
     PathComponentPiece name,
     TreeInodePtr destParent,
     PathComponentPiece destName) {
+  // Moving a file within a directory that is already materialized cannot
+  // change the location of any directory, so the rename lock is only needed
+  // in shared mode.  This is what build tools do when they write a temporary
+  // file and rename it into place, and it lets such renames in different
+  // directories proceed in parallel.  Anything else, including every case
+  // that fails, takes the exclusive path below.
+  if (destParent.get() == this) {
+    TreeRenameLocks locks;
+    locks.acquireSharedLocks(
+        getMount()->acquireSharedRenameLock("TreeInode::rename"),
+        this,
+        destName);
+    auto srcIter = locks.srcContents()->entries.find(name);
+    if (locks.srcContents()->materialized &&
+        srcIter != locks.srcContents()->entries.end() &&
+        !srcIter->second.isDirectory() && srcIter->second.inode &&
+        (!locks.destChildExists() ||
+         (!locks.destChildIsDirectory() && locks.destChild()))) {
+      return doRename(std::move(locks), name, srcIter, destParent, destName);
+    }
+  }
+
   bool needSrc = false;
   bool needDest = false;
   {
-    auto renameLock = getMount()->acquireRenameLock();
+    auto renameLock = getMount()->acquireRenameLock("TreeInode::rename");
     materialize(&renameLock);
     if (destParent.get() != this) {
       destParent->materialize(&renameLock);
@@ -1220,7 +1641,7 @@ Future<Unit> TreeInode::rename(
       // The source path does not exist.  Fail the rename.
       return makeFuture<Unit>(InodeError(ENOENT, inodePtrFromThis(), name));
     }
-    Entry* srcEntry = srcIter->second.get();
+    Entry* srcEntry = &srcIter->second;
 
     // Perform as much input validation as possible now, before starting inode
     // loads that might be necessary.
@@ -1322,10 +1743,10 @@ bool isAncestor(const RenameLock& renameLock, TreeInode* a, TreeInode* b) {
 Future<Unit> TreeInode::doRename(
     TreeRenameLocks&& locks,
     PathComponentPiece srcName,
-    PathMap<std::unique_ptr<Entry>>::iterator srcIter,
+    EntryMap::iterator srcIter,
     TreeInodePtr destParent,
     PathComponentPiece destName) {
-  Entry* srcEntry = srcIter->second.get();
+  Entry* srcEntry = &srcIter->second;
 
   // If the source and destination refer to exactly the same file,
   // then just succeed immediately.  Nothing needs to be done in this case.
@@ -1359,8 +1780,7 @@ Future<Unit> TreeInode::doRename(
   std::unique_ptr<InodeBase> deletedInode;
   auto* childInode = srcEntry->inode;
   if (locks.destChildExists()) {
-    deletedInode = locks.destChild()->markUnlinked(
-        destParent.get(), destName, locks.renameLock());
+    deletedInode = locks.unlinkDestChild(destParent.get(), destName);
 
     // Replace the destination contents entry with the source data
     locks.destChildIter()->second = std::move(srcIter->second);
@@ -1378,24 +1798,34 @@ Future<Unit> TreeInode::doRename(
   }
 
   // Inform the child inode that it has been moved
-  childInode->updateLocation(destParent, destName, locks.renameLock());
+  locks.updateLocation(childInode, destParent, destName);
 
   // Now remove the source information
   locks.srcContents()->entries.erase(srcIter);
 
   // Save the overlay data
   const auto& overlay = getOverlay();
-  overlay->saveOverlayDir(getNodeId(), locks.srcContents());
-  if (destParent.get() != this) {
-    // We have already verified that destParent is not unlinked, and we are
-    // holding the rename lock which prevents it from being renamed or unlinked
-    // while we are operating, so getPath() must have a value here.
-    overlay->saveOverlayDir(destParent->getNodeId(), locks.destContents());
+  overlay->markDirEntryDirty(inodePtrFromThis(), srcName);
+  overlay->markDirEntryDirty(destParent, destName);
+
+  // Record both names in the journal.  This has to be done while we still
+  // hold the rename lock, so the paths are the ones the rename affected.
+  auto delta = std::make_unique<JournalDelta>();
+  auto srcPath = getPath();
+  if (srcPath.hasValue()) {
+    delta->changedFilesInOverlay.insert(srcPath.value() + srcName);
   }
+  auto destPath = destParent->getPath();
+  if (destPath.hasValue()) {
+    delta->changedFilesInOverlay.insert(destPath.value() + destName);
+  }
+  getMount()->getJournal().addDelta(std::move(delta));
 
   // Release the rename locks before we destroy the deleted destination child
   // inode (if it exists).
   locks.reset();
+  invalidateDiffCache();
+  destParent->invalidateDiffCache();
   deletedInode.reset();
   return folly::Unit{};
 }
@@ -1467,6 +1897,17 @@ void TreeInode::TreeRenameLocks::acquireLocks(
   }
 }
 
+void TreeInode::TreeRenameLocks::acquireSharedLocks(
+    SharedRenameLock&& renameLock,
+    TreeInode* tree,
+    PathComponentPiece destName) {
+  sharedRenameLock_ = std::move(renameLock);
+  srcContentsLock_ = tree->contents_.wlock();
+  srcContents_ = &*srcContentsLock_;
+  destContents_ = &*srcContentsLock_;
+  lockDestChild(destName);
+}
+
 void TreeInode::TreeRenameLocks::lockDestChild(PathComponentPiece destName) {
   // Look up the destination child entry
   destChildIter_ = destContents_->entries.find(destName);
@@ -1497,6 +1938,15 @@ Future<Unit> TreeInode::diff(
     bool isIgnored) {
   static const PathComponentPiece kIgnoreFilename{".gitignore"};
 
+  // If nothing has changed underneath this directory since a previous diff
+  // found it identical to this tree, there is nothing to report.  This does
+  // not depend on the ignore rules, since a directory is only recorded as
+  // clean if it contains no untracked entries at all.
+  if (tree && hasCleanDiff(tree->getHash())) {
+    ++context->cachedDirsSkipped;
+    return makeFuture();
+  }
+
   // If this directory is already ignored, we don't need to bother loading its
   // .gitignore file.  Everything inside this directory must also be ignored,
   // unless it is explicitly tracked in source control.
@@ -1535,7 +1985,7 @@ Future<Unit> TreeInode::diff(
     Entry* inodeEntry = nullptr;
     auto iter = contents->entries.find(kIgnoreFilename);
     if (iter != contents->entries.end()) {
-      inodeEntry = iter->second.get();
+      inodeEntry = &iter->second;
       if (inodeEntry->isDirectory()) {
         // Ignore .gitignore directories
         VLOG(4) << "Ignoring .gitignore directory in " << getLogPath();
@@ -1622,6 +2072,24 @@ Future<Unit> TreeInode::loadGitIgnoreThenDiff(
         isIgnored);
   }
 
+  // Unmodified .gitignore files can be found in the cache without even
+  // loading their contents.
+  auto* ignoreCache = getMount()->getGitIgnoreCache();
+  auto blobHash = fileInode->getBlobHash();
+  if (blobHash.hasValue() && !S_ISLNK(fileInode->getMode())) {
+    auto cached = ignoreCache->getForBlob(blobHash.value());
+    if (cached) {
+      auto ignore = make_unique<GitIgnoreStack>(parentIgnore, cached);
+      return computeDiff(
+          contents_.wlock(),
+          context,
+          currentPath,
+          std::move(tree),
+          std::move(ignore),
+          isIgnored);
+    }
+  }
+
   auto data = fileInode->getOrLoadData();
   if (S_ISLNK(fileInode->getMode())) {
     auto dataFuture = data->ensureDataLoaded();
@@ -1650,10 +2118,20 @@ Future<Unit> TreeInode::loadGitIgnoreThenDiff(
     tree = std::move(tree),
     parentIgnore,
     isIgnored,
-    data = std::move(data)
+    data = std::move(data),
+    fileInode,
+    blobHash,
+    ignoreCache
   ]() mutable {
     auto ignoreFileContents = data->readAll();
-    auto ignore = make_unique<GitIgnoreStack>(parentIgnore, ignoreFileContents);
+    auto parsed = ignoreCache->getOrParse(ignoreFileContents);
+    // Only remember the blob's rules if the file was still unmodified after
+    // its contents were read.  Files are always materialized before being
+    // modified, so the contents must have come from the blob.
+    if (blobHash.hasValue() && fileInode->getBlobHash() == blobHash) {
+      ignoreCache->insertForBlob(blobHash.value(), parsed);
+    }
+    auto ignore = make_unique<GitIgnoreStack>(parentIgnore, std::move(parsed));
     return self->computeDiff(
         self->contents_.wlock(),
         context,
@@ -1665,7 +2143,7 @@ Future<Unit> TreeInode::loadGitIgnoreThenDiff(
 }
 
 Future<Unit> TreeInode::computeDiff(
-    folly::Synchronized<Dir>::LockedPtr contentsLock,
+    DirContents::LockedPtr contentsLock,
     const DiffContext* context,
     RelativePathPiece currentPath,
     unique_ptr<Tree> tree,
@@ -1687,11 +2165,21 @@ Future<Unit> TreeInode::computeDiff(
   std::vector<std::unique_ptr<DeferredDiffEntry>> deferredEntries;
   auto self = inodePtrFromThis();
 
+  // Whether everything examined so far is identical to the source control
+  // tree.  Any difference, and any untracked entry even if it is not
+  // reported, prevents this directory from being recorded as clean.  So
+  // does skipping entries outside of the diff's prefix.
+  bool clean = (tree != nullptr) && context->isInPrefix(currentPath);
+  uint64_t generation = 0;
+
   // Grab the contents_ lock, and loop to find children that might be
   // different.  In this first pass we primarily build the list of children to
   // examine, but we wait until after we release our contents_ lock to actually
   // examine any children InodeBase objects.
   std::vector<IncompleteInodeLoad> pendingLoads;
+  // The source control data that the deferred entries compare against, so
+  // that it is loaded in one batch for the whole directory.
+  ObjectBatch scmLoads;
   {
     // Move the contents lock into a variable inside this scope so it
     // will be released at the end of this scope.
@@ -1700,10 +2188,16 @@ Future<Unit> TreeInode::computeDiff(
     // need a write lock since we may have to load child inodes, affecting
     // their entry state.
     auto contents = std::move(contentsLock);
+    // Read the generation while holding the contents_ lock, so that any
+    // change to the entries we are about to examine invalidates the result.
+    generation = diffGeneration_.load(std::memory_order_acquire);
 
     auto processUntracked = [&](PathComponentPiece name, Entry* inodeEntry) {
       bool entryIgnored = isIgnored;
       auto entryPath = currentPath + name;
+      if (!context->isOnPrefixPath(entryPath)) {
+        return;
+      }
       if (!isIgnored) {
         auto ignoreStatus = ignore->match(entryPath);
         if (ignoreStatus == GitIgnore::HIDDEN) {
@@ -1713,29 +2207,32 @@ Future<Unit> TreeInode::computeDiff(
         }
         entryIgnored = (ignoreStatus == GitIgnore::EXCLUDE);
       }
+      clean = false;
 
       if (inodeEntry->isDirectory()) {
-        if (!entryIgnored || context->listIgnored) {
-          if (inodeEntry->inode) {
-            auto childPtr = InodePtr::newPtrLocked(inodeEntry->inode);
-            deferredEntries.emplace_back(
-                DeferredDiffEntry::createUntrackedEntryFromInodeFuture(
-                    context,
-                    entryPath,
-                    std::move(childPtr),
-                    ignore.get(),
-                    entryIgnored));
-          } else {
-            auto inodeFuture = self->loadChildLocked(
-                *contents, name, inodeEntry, &pendingLoads);
-            deferredEntries.emplace_back(
-                DeferredDiffEntry::createUntrackedEntryFromInodeFuture(
-                    context,
-                    entryPath,
-                    std::move(inodeFuture),
-                    ignore.get(),
-                    entryIgnored));
-          }
+        if (entryIgnored && !context->listIgnored) {
+          // Nothing inside an untracked ignored directory can be reported,
+          // so skip it without loading its inode or its .gitignore file.
+          ++context->ignoredDirsPruned;
+        } else if (inodeEntry->inode) {
+          auto childPtr = InodePtr::newPtrLocked(inodeEntry->inode);
+          deferredEntries.emplace_back(
+              DeferredDiffEntry::createUntrackedEntryFromInodeFuture(
+                  context,
+                  entryPath,
+                  std::move(childPtr),
+                  ignore.get(),
+                  entryIgnored));
+        } else {
+          auto inodeFuture = self->loadChildLocked(
+              *contents, name, inodeEntry, &pendingLoads);
+          deferredEntries.emplace_back(
+              DeferredDiffEntry::createUntrackedEntryFromInodeFuture(
+                  context,
+                  entryPath,
+                  std::move(inodeFuture),
+                  ignore.get(),
+                  entryIgnored));
         }
       } else {
         if (!entryIgnored) {
@@ -1750,12 +2247,16 @@ Future<Unit> TreeInode::computeDiff(
     };
 
     auto processRemoved = [&](const TreeEntry& scmEntry) {
+      auto entryPath = currentPath + scmEntry.getName();
+      if (!context->isOnPrefixPath(entryPath)) {
+        return;
+      }
+      clean = false;
       if (scmEntry.getType() == TreeEntryType::TREE) {
         deferredEntries.emplace_back(DeferredDiffEntry::createRemovedEntry(
-            context, currentPath + scmEntry.getName(), scmEntry));
+            context, std::move(entryPath), scmEntry));
       } else {
-        context->callback->removedFile(
-            currentPath + scmEntry.getName(), scmEntry);
+        context->callback->removedFile(entryPath, scmEntry);
       }
     };
 
@@ -1766,6 +2267,9 @@ Future<Unit> TreeInode::computeDiff(
           // is always included since it is already tracked in source control.
           bool entryIgnored = isIgnored;
           auto entryPath = currentPath + scmEntry.getName();
+          if (!context->isOnPrefixPath(entryPath)) {
+            return;
+          }
           if (!isIgnored && (inodeEntry->isDirectory() ||
                              scmEntry.getType() == TreeEntryType::TREE)) {
             auto ignoreStatus = ignore->match(entryPath);
@@ -1781,7 +2285,16 @@ Future<Unit> TreeInode::computeDiff(
             }
           }
 
-          if (inodeEntry->inode) {
+          if (entryIgnored && !context->listIgnored &&
+              inodeEntry->isDirectory() &&
+              scmEntry.getType() != TreeEntryType::TREE) {
+            // This was a file in source control but is now an ignored
+            // directory.  Report the file as removed, and skip the directory
+            // contents without loading the inode since they are all ignored.
+            context->callback->removedFile(entryPath, scmEntry);
+            ++context->ignoredDirsPruned;
+            clean = false;
+          } else if (inodeEntry->inode) {
             // This inode is already loaded.
             auto childInodePtr = InodePtr::newPtrLocked(inodeEntry->inode);
             deferredEntries.emplace_back(DeferredDiffEntry::createModifiedEntry(
@@ -1790,7 +2303,8 @@ Future<Unit> TreeInode::computeDiff(
                 scmEntry,
                 std::move(childInodePtr),
                 ignore.get(),
-                entryIgnored));
+                entryIgnored,
+                &scmLoads));
           } else if (inodeEntry->isMaterialized()) {
             // This inode is not loaded but is materialized.
             // We'll have to load it to confirm if it is the same or different.
@@ -1803,7 +2317,8 @@ Future<Unit> TreeInode::computeDiff(
                     scmEntry,
                     std::move(inodeFuture),
                     ignore.get(),
-                    entryIgnored));
+                    entryIgnored,
+                    &scmLoads));
           } else if (
               inodeEntry->getMode() == scmEntry.getMode() &&
               inodeEntry->getHash() == scmEntry.getHash()) {
@@ -1820,12 +2335,14 @@ Future<Unit> TreeInode::computeDiff(
                     scmEntry,
                     std::move(inodeFuture),
                     ignore.get(),
-                    entryIgnored));
+                    entryIgnored,
+                    &scmLoads));
           } else if (scmEntry.getType() == TreeEntryType::TREE) {
             // This used to be a directory in the source control state,
             // but is now a file or symlink.  Report the new file, then add a
             // deferred entry to report the entire source control Tree as
             // removed.
+            clean = false;
             if (entryIgnored) {
               if (context->listIgnored) {
                 context->callback->ignoredFile(entryPath);
@@ -1852,6 +2369,7 @@ Future<Unit> TreeInode::computeDiff(
             if (inodeEntry->getMode() != scmEntry.getMode()) {
               // The mode is definitely modified
               context->callback->modifiedFile(entryPath, scmEntry);
+              clean = false;
             } else {
               // TODO: Hopefully at some point we will track file sizes in the
               // parent TreeInode::Entry and the TreeEntry.  Once we have file
@@ -1859,7 +2377,11 @@ Future<Unit> TreeInode::computeDiff(
               // avoid loading the blob if they are different.
               deferredEntries.emplace_back(
                   DeferredDiffEntry::createModifiedEntry(
-                      context, entryPath, scmEntry, inodeEntry->getHash()));
+                      context,
+                      entryPath,
+                      scmEntry,
+                      inodeEntry->getHash(),
+                      &scmLoads));
             }
           }
         };
@@ -1871,7 +2393,7 @@ Future<Unit> TreeInode::computeDiff(
     // inode entries are both sorted in the same order.
     vector<TreeEntry> emptyEntries;
     const auto& scEntries = tree ? tree->getTreeEntries() : emptyEntries;
-    const auto& inodeEntries = contents->entries;
+    auto& inodeEntries = contents->entries;
     size_t scIdx = 0;
     auto inodeIter = inodeEntries.begin();
     while (true) {
@@ -1882,21 +2404,21 @@ Future<Unit> TreeInode::computeDiff(
         }
 
         // This entry is present locally but not in the source control tree.
-        processUntracked(inodeIter->first, inodeIter->second.get());
+        processUntracked(inodeIter->first, &inodeIter->second);
         ++inodeIter;
       } else if (inodeIter == inodeEntries.end()) {
         // This entry is present in the old tree but not the old one.
         processRemoved(scEntries[scIdx]);
         ++scIdx;
-      } else if (scEntries[scIdx].getName() < inodeIter->first) {
+      } else if (scEntries[scIdx].getName() < inodeIter->first.piece()) {
         processRemoved(scEntries[scIdx]);
         ++scIdx;
-      } else if (scEntries[scIdx].getName() > inodeIter->first) {
-        processUntracked(inodeIter->first, inodeIter->second.get());
+      } else if (scEntries[scIdx].getName() > inodeIter->first.piece()) {
+        processUntracked(inodeIter->first, &inodeIter->second);
         ++inodeIter;
       } else {
         const auto& scmEntry = scEntries[scIdx];
-        auto* inodeEntry = inodeIter->second.get();
+        auto* inodeEntry = &inodeIter->second;
         ++scIdx;
         ++inodeIter;
         processBothPresent(scmEntry, inodeEntry);
@@ -1905,21 +2427,35 @@ Future<Unit> TreeInode::computeDiff(
   }
 
   // Finish setting up any load operations we started while holding the
-  // contents_ lock above.
+  // contents_ lock above, and start loading the source control data.
   for (auto& load : pendingLoads) {
     load.finish();
   }
+  scmLoads.flush(context->store);
 
-  // Now process all of the deferred work.
+  // Now process all of the deferred work.  If we have an executor, start
+  // each entry on it so that sibling subtrees and file comparisons proceed
+  // in parallel rather than one after another in this thread.
   vector<Future<Unit>> deferredFutures;
   for (auto& entry : deferredEntries) {
-    deferredFutures.push_back(entry->run());
+    if (context->executor) {
+      auto* entryPtr = entry.get();
+      deferredFutures.push_back(folly::via(context->executor).then([entryPtr] {
+        return entryPtr->run();
+      }));
+    } else {
+      deferredFutures.push_back(entry->run());
+    }
   }
 
   // Wait on all of the deferred entries to complete.
   // Note that we explicitly move-capture the deferredFutures vector into this
   // callback, to ensure that the DeferredDiffEntry objects do not get
   // destroyed before they complete.
+  folly::Optional<Hash> treeHash;
+  if (clean) {
+    treeHash = tree->getHash();
+  }
   return folly::collectAll(deferredFutures).then([
     self = std::move(self),
     currentPath = RelativePath{std::move(currentPath)},
@@ -1927,16 +2463,25 @@ Future<Unit> TreeInode::computeDiff(
     // Capture ignore to ensure it remains valid until all of our children's
     // diff operations complete.
     ignore = std::move(ignore),
-    deferredJobs = std::move(deferredEntries)
+    deferredJobs = std::move(deferredEntries),
+    treeHash,
+    generation
   ](vector<folly::Try<Unit>> results) {
     // Call diffError() for any jobs that failed.
+    bool allClean = treeHash.hasValue();
     for (size_t n = 0; n < results.size(); ++n) {
       auto& result = results[n];
       if (result.hasException()) {
         context->callback->diffError(
             deferredJobs[n]->getPath(), result.exception());
+        allClean = false;
+      } else if (!deferredJobs[n]->isClean()) {
+        allClean = false;
       }
     }
+    if (allClean) {
+      *self->cleanDiff_.wlock() = CleanDiff{treeHash.value(), generation};
+    }
     // Report success here, even if some of our deferred jobs failed.
     // We will have reported those errors to the callback already, and so we
     // don't want our parent to report a new error at our path.
@@ -1944,6 +2489,29 @@ Future<Unit> TreeInode::computeDiff(
   });
 }
 
+bool TreeInode::hasCleanDiff(const Hash& treeHash) const {
+  auto generation = diffGeneration_.load(std::memory_order_acquire);
+  auto cleanDiff = cleanDiff_.rlock();
+  return cleanDiff->hasValue() && cleanDiff->value().treeHash == treeHash &&
+      cleanDiff->value().generation == generation;
+}
+
+void TreeInode::invalidateDiffCache() {
+  // Each ancestor's cached result covers this directory too.
+  //
+  // This looks up parents without the rename lock.  If this races with a
+  // rename we may update the old ancestors rather than the new ones, but the
+  // rename invalidates both its source and destination directories once it
+  // completes.
+  TreeInode* dir = this;
+  TreeInodePtr parent;
+  while (dir) {
+    dir->diffGeneration_.fetch_add(1, std::memory_order_acq_rel);
+    parent = dir->getParentBuggy();
+    dir = parent.get();
+  }
+}
+
 Future<Unit> TreeInode::checkout(
     CheckoutContext* ctx,
     std::unique_ptr<Tree> fromTree,
@@ -1966,13 +2534,18 @@ Future<Unit> TreeInode::checkout(
   for (const auto& action : actions) {
     actionFutures.emplace_back(action->run(ctx, getStore()));
   }
+  // The actions only queued their data loads.  Send them to the ObjectStore
+  // together now that all of the actions for this directory have started.
+  auto prefetchFuture = ctx->flushLoads(getStore());
+
   // Wait for all of the actions, and record any errors.
   return folly::collectAll(actionFutures).then([
     ctx,
     self = inodePtrFromThis(),
     toTree = std::move(toTree),
-    actions = std::move(actions)
-  ](vector<folly::Try<Unit>> actionResults) {
+    actions = std::move(actions),
+    prefetchFuture = std::move(prefetchFuture)
+  ](vector<folly::Try<Unit>> actionResults) mutable {
     // Record any errors that occurred
     size_t numErrors = 0;
     for (size_t n = 0; n < actionResults.size(); ++n) {
@@ -1985,10 +2558,16 @@ Future<Unit> TreeInode::checkout(
     }
 
     // Update our state in the overlay
+    auto overlayStart = std::chrono::steady_clock::now();
     self->saveOverlayPostCheckout(ctx, toTree.get());
+    ctx->addTime(CheckoutContext::WRITE_OVERLAY, overlayStart);
 
     VLOG(4) << "checkout: finished update of " << self->getLogPath() << ": "
             << numErrors << " errors";
+
+    // Don't report the checkout as complete until the new blobs for this
+    // directory have been fetched.
+    return std::move(prefetchFuture);
   });
 }
 
@@ -2089,9 +2668,9 @@ unique_ptr<CheckoutAction> TreeInode::processCheckoutEntry(
       // and does not currently exist in the filesystem.  Go ahead and add it
       // now.
       if (ctx->shouldApplyChanges()) {
-        auto newEntry =
-            make_unique<Entry>(newScmEntry->getMode(), newScmEntry->getHash());
-        contents.entries.emplace(newScmEntry->getName(), std::move(newEntry));
+        contents.entries.emplace(newScmEntry->getName(), *newScmEntry);
+        // The kernel may have cached a negative entry for this name.
+        ctx->invalidateEntry(getNodeId(), name);
       }
     } else if (!newScmEntry) {
       // This file exists in the old tree, but is being removed in the new
@@ -2107,9 +2686,8 @@ unique_ptr<CheckoutAction> TreeInode::processCheckoutEntry(
           ConflictType::REMOVED_MODIFIED, this, oldScmEntry->getName());
       if (ctx->forceUpdate()) {
         DCHECK(ctx->shouldApplyChanges());
-        auto newEntry =
-            make_unique<Entry>(newScmEntry->getMode(), newScmEntry->getHash());
-        contents.entries.emplace(newScmEntry->getName(), std::move(newEntry));
+        contents.entries.emplace(newScmEntry->getName(), *newScmEntry);
+        ctx->invalidateEntry(getNodeId(), name);
       }
     }
 
@@ -2118,13 +2696,35 @@ unique_ptr<CheckoutAction> TreeInode::processCheckoutEntry(
   }
 
   auto& entry = it->second;
-  if (entry->inode) {
+  if (entry.inode) {
     // If the inode is already loaded, create a CheckoutAction to process it
-    auto childPtr = InodePtr::newPtrLocked(entry->inode);
+    auto childPtr = InodePtr::newPtrLocked(entry.inode);
+    ctx->recordFullProcessing();
     return make_unique<CheckoutAction>(
         ctx, oldScmEntry, newScmEntry, std::move(childPtr));
   }
 
+  // If the entry is neither loaded nor materialized, and still refers to the
+  // old source control entry, then it cannot have been modified, and nothing
+  // beneath it can be loaded.  We can check it out just by pointing it at the
+  // new hash, without loading it or comparing its children.
+  if (canCheckoutByHashSwap(entry, oldScmEntry, newScmEntry)) {
+    if (ctx->shouldApplyChanges()) {
+      auto number = entry.hasInodeNumber() ? entry.getInodeNumber() : 0;
+      entry = Entry{*newScmEntry};
+      if (number != 0) {
+        // FUSE may know about this inode number.  Keep it, so that the
+        // kernel's references remain valid, but tell the kernel the contents
+        // have changed.
+        entry.setInodeNumber(number);
+        ctx->invalidateInode(number);
+        ctx->invalidateEntry(getNodeId(), name);
+      }
+    }
+    ctx->recordHashSwap();
+    return nullptr;
+  }
+
   // If this entry has an inode number assigned to it then load the InodeBase
   // object to process it.
   //
@@ -2133,12 +2733,12 @@ unique_ptr<CheckoutAction> TreeInode::processCheckoutEntry(
   //
   // This also handles materialized inodes--an inode cannot be materialized if
   // it does not have an inode number assigned to it.
-  if (entry->hasInodeNumber()) {
+  if (entry.hasInodeNumber()) {
     // This child is potentially modified, but is not currently loaded.
     // Start loading it and create a CheckoutAction to process it once it
     // is loaded.
-    auto inodeFuture =
-        loadChildLocked(contents, name, entry.get(), pendingLoads);
+    auto inodeFuture = loadChildLocked(contents, name, &entry, pendingLoads);
+    ctx->recordFullProcessing();
     return make_unique<CheckoutAction>(
         ctx, oldScmEntry, newScmEntry, std::move(inodeFuture));
   }
@@ -2147,16 +2747,17 @@ unique_ptr<CheckoutAction> TreeInode::processCheckoutEntry(
   auto conflictType = ConflictType::ERROR;
   if (!oldScmEntry) {
     conflictType = ConflictType::UNTRACKED_ADDED;
-  } else if (entry->getHash() != oldScmEntry->getHash()) {
+  } else if (entry.getHash() != oldScmEntry->getHash()) {
     conflictType = ConflictType::MODIFIED;
   }
   if (conflictType != ConflictType::ERROR) {
     // If this is are a directory we unfortunately have to load the directory
     // and recurse into it just so we can accurately report the list of files
     // with conflicts.
-    if (entry->isDirectory()) {
+    if (entry.isDirectory()) {
       auto inodeFuture =
-          loadChildLocked(contents, name, entry.get(), pendingLoads);
+          loadChildLocked(contents, name, &entry, pendingLoads);
+      ctx->recordFullProcessing();
       return make_unique<CheckoutAction>(
           ctx, oldScmEntry, newScmEntry, std::move(inodeFuture));
     }
@@ -2177,8 +2778,9 @@ unique_ptr<CheckoutAction> TreeInode::processCheckoutEntry(
   if (!newScmEntry) {
     contents.entries.erase(it);
   } else {
-    *entry = Entry{newScmEntry->getMode(), newScmEntry->getHash()};
+    entry = Entry{*newScmEntry};
   }
+  ctx->recordHashSwap();
 
   // Note that we intentionally don't bother calling
   // fuseChannel->invalidateEntry() here.
@@ -2190,6 +2792,33 @@ unique_ptr<CheckoutAction> TreeInode::processCheckoutEntry(
   return nullptr;
 }
 
+bool TreeInode::canCheckoutByHashSwap(
+    const Entry& entry,
+    const TreeEntry* oldScmEntry,
+    const TreeEntry* newScmEntry) {
+  if (entry.inode || entry.isMaterialized() || !oldScmEntry || !newScmEntry) {
+    return false;
+  }
+  if (entry.getHash() != oldScmEntry->getHash()) {
+    return false;
+  }
+  if (!entry.hasInodeNumber()) {
+    // We have never told FUSE about this entry, so it can change freely.
+    return true;
+  }
+
+  // The kernel may have this inode number cached, so it has to keep the same
+  // file type.
+  if ((oldScmEntry->getMode() & S_IFMT) != (newScmEntry->getMode() & S_IFMT)) {
+    return false;
+  }
+  // If another thread has started loading this inode it may already have
+  // read the old hash, so we must wait for the load and process it normally.
+  // Loads read the entry while holding our contents_ lock, so no new load can
+  // start until we have updated the entry.
+  return !getInodeMap()->isInodeLoading(entry.getInodeNumber());
+}
+
 Future<Unit> TreeInode::checkoutUpdateEntry(
     CheckoutContext* ctx,
     PathComponentPiece name,
@@ -2213,7 +2842,7 @@ Future<Unit> TreeInode::checkoutUpdateEntry(
           << inode->getLogPath();
       return folly::makeFuture<Unit>(bug.toException());
     }
-    if (it->second->inode != inode.get()) {
+    if (it->second.inode != inode.get()) {
       auto bug = EDEN_BUG()
           << "entry changed while holding rename lock during checkout: "
           << inode->getLogPath();
@@ -2225,17 +2854,14 @@ Future<Unit> TreeInode::checkoutUpdateEntry(
     deletedInode = inode->markUnlinked(this, name, ctx->renameLock());
     if (newScmEntry) {
       DCHECK_EQ(newScmEntry->getName(), name);
-      it->second =
-          make_unique<Entry>(newScmEntry->getMode(), newScmEntry->getHash());
+      it->second = Entry{*newScmEntry};
     } else {
       contents->entries.erase(it);
     }
 
-    // Tell FUSE to invalidate its cache for this entry.
-    auto* fuseChannel = getMount()->getFuseChannel();
-    if (fuseChannel) {
-      fuseChannel->invalidateEntry(getNodeId(), name);
-    }
+    // Tell FUSE to invalidate its cache for this entry once the checkout
+    // has released its locks.
+    ctx->invalidateEntry(getNodeId(), name);
 
     // We don't save our own overlay data right now:
     // we'll wait to do that until the checkout operation finishes touching all
@@ -2281,9 +2907,7 @@ Future<Unit> TreeInode::checkoutUpdateEntry(
     // Add the new entry
     auto contents = parentInode->contents_.wlock();
     DCHECK_EQ(TreeEntryType::BLOB, newEntry->getType());
-    auto newTreeEntry =
-        make_unique<Entry>(newEntry->getMode(), newEntry->getHash());
-    auto ret = contents->entries.emplace(name, std::move(newTreeEntry));
+    auto ret = contents->entries.emplace(name, *newEntry);
     if (!ret.second) {
       // Hmm.  Someone else already created a new entry in this location
       // before we had a chance to add our new entry.  We don't block new file
@@ -2325,42 +2949,7 @@ void TreeInode::saveOverlayPostCheckout(
         return true;
       }
 
-      const auto& scmEntries = tree->getTreeEntries();
-      // If we have a different number of entries we must be different from the
-      // Tree, and therefore must be materialized.
-      if (scmEntries.size() != contents->entries.size()) {
-        return true;
-      }
-
-      // This code relies on the fact that our contents->entries PathMap sorts
-      // paths in the same order as Tree's entry list.
-      auto inodeIter = contents->entries.begin();
-      auto scmIter = scmEntries.begin();
-      for (; scmIter != scmEntries.end(); ++inodeIter, ++scmIter) {
-        // If any of our children are materialized, we need to be materialized
-        // too to record the fact that we have materialized children.
-        //
-        // If our children are materialized this means they are likely different
-        // from the new source control state.  (This is not a 100% guarantee
-        // though, as writes may still be happening concurrently to the checkout
-        // operation.)  Even if the child is still identical to its source
-        // control state we still want to make sure we are materialized if the
-        // child is.
-        if (inodeIter->second->isMaterialized()) {
-          return true;
-        }
-
-        // If if the child is not materialized, it is the same as some source
-        // control object.  However, if it isn't the same as the object in our
-        // Tree, we have to materialize ourself.
-        if (inodeIter->second->getHash() != scmIter->getHash()) {
-          return true;
-        }
-      }
-
-      // If we're still here we are identical to the source control Tree.
-      // We can be dematerialized.
-      return false;
+      return !entriesMatchTree(*contents, *tree);
     };
 
     // If we are now empty as a result of the checkout we can remove ourself
@@ -2370,14 +2959,18 @@ void TreeInode::saveOverlayPostCheckout(
     materialize = shouldMaterialize();
     stateChanged = (materialize != contents->materialized);
     if (materialize) {
-      // If we need to be materialized, write out our state to the overlay.
-      // (It's possible our state is unchanged from what's already on disk,
-      // but for now we can't detect this, and just always write it out.)
-      getOverlay()->saveOverlayDir(getNodeId(), &*contents);
+      // If we need to be materialized, make sure our state gets written to
+      // the overlay.  (It's possible our state is unchanged from what's
+      // already on disk, but for now we can't detect this, and just always
+      // write it out.)
+      getOverlay()->markDirDirty(inodePtrFromThis());
     }
     contents->materialized = materialize;
   }
 
+  // The checkout may have replaced any of our entries.
+  invalidateDiffCache();
+
   if (deleteSelf) {
     // If we should be removed entirely, delete ourself.
     if (checkoutTryRemoveEmptyDir(ctx)) {
@@ -2427,6 +3020,138 @@ void TreeInode::saveOverlayPostCheckout(
   }
 }
 
+bool TreeInode::entriesMatchTree(const Dir& contents, const Tree& tree) {
+  const auto& scmEntries = tree.getTreeEntries();
+  // If we have a different number of entries we must be different from the
+  // Tree, and therefore must be materialized.
+  if (scmEntries.size() != contents.entries.size()) {
+    return false;
+  }
+
+  // This code relies on the fact that our contents.entries PathMap sorts
+  // paths in the same order as Tree's entry list.
+  auto inodeIter = contents.entries.begin();
+  auto scmIter = scmEntries.begin();
+  for (; scmIter != scmEntries.end(); ++inodeIter, ++scmIter) {
+    // If any of our children are materialized, we need to be materialized
+    // too to record the fact that we have materialized children.
+    //
+    // If our children are materialized this means they are likely different
+    // from the new source control state.  (This is not a 100% guarantee
+    // though, as writes may still be happening concurrently to the checkout
+    // operation.)  Even if the child is still identical to its source
+    // control state we still want to make sure we are materialized if the
+    // child is.
+    if (inodeIter->second.isMaterialized()) {
+      return false;
+    }
+
+    // If if the child is not materialized, it is the same as some source
+    // control object.  However, if it isn't the same as the object in our
+    // Tree, we have to materialize ourself.
+    if (inodeIter->second.getHash() != scmIter->getHash()) {
+      return false;
+    }
+  }
+
+  // If we're still here we are identical to the source control Tree.
+  return true;
+}
+
+size_t TreeInode::dematerializeUnchanged(const Tree& tree, bool hashFiles) {
+  // Find the materialized children that have a source control entry of the
+  // same kind.  Symlinks are left alone, since they are rarely rewritten.
+  std::vector<std::pair<PathComponent, const TreeEntry*>> candidates;
+  {
+    auto contents = contents_.rlock();
+    if (!contents->materialized) {
+      return 0;
+    }
+    for (const auto& entry : contents->entries) {
+      if (!entry.second.isMaterialized()) {
+        continue;
+      }
+      const auto* scmEntry = tree.getEntryPtr(entry.first);
+      if (!scmEntry || scmEntry->getFileType() == FileType::SYMLINK ||
+          entry.second.isDirectory() !=
+              (scmEntry->getType() == TreeEntryType::TREE)) {
+        continue;
+      }
+      candidates.emplace_back(entry.first.copy(), scmEntry);
+    }
+  }
+
+  size_t count = 0;
+  auto* objectStore = getMount()->getObjectStore();
+  for (const auto& candidate : candidates) {
+    const auto& name = candidate.first;
+    const auto* scmEntry = candidate.second;
+    try {
+      auto child = getOrLoadChild(name).get();
+      if (auto childTree = child.asTreePtrOrNull()) {
+        auto scmTree = objectStore->getTree(scmEntry->getHash());
+        count += childTree->dematerializeUnchanged(*scmTree, hashFiles);
+        continue;
+      }
+
+      auto metadata = objectStore->getBlobMetadata(scmEntry->getHash()).get();
+      if (hashFiles) {
+        // contentsMatch() only hashes the file if the sizes match, and the
+        // FileData keeps the SHA-1 for dematerializeIfSameAs() to use.
+        child.asFilePtr()->contentsMatch(scmEntry->getHash(), metadata).get();
+      }
+      auto renameLock = getMount()->acquireRenameLock(
+          "TreeInode::dematerializeUnchanged");
+      if (child.asFilePtr()->dematerializeIfSameAs(
+              renameLock, scmEntry->getHash(), metadata, scmEntry->getMode())) {
+        ++count;
+      }
+    } catch (const std::exception& ex) {
+      LOG(WARNING) << "error checking whether to dematerialize "
+                   << getLogPath() << "/" << name << ": "
+                   << folly::exceptionStr(ex);
+    }
+  }
+
+  if (dematerializeIfSameAs(tree)) {
+    ++count;
+    return count;
+  }
+
+  auto contents = contents_.wlock();
+  if (contents->materialized && contents->treeHash != tree.getHash()) {
+    contents->treeHash = tree.getHash();
+    getOverlay()->markDirDirty(inodePtrFromThis());
+  }
+  return count;
+}
+
+bool TreeInode::dematerializeIfSameAs(const Tree& tree) {
+  // As in materialize(), materialization state changes are only made with
+  // the rename lock held.
+  auto renameLock = getMount()->acquireRenameLock(
+      "TreeInode::dematerializeIfSameAs");
+  auto loc = getLocationInfo(renameLock);
+  if (!loc.parent || loc.unlinked) {
+    return false;
+  }
+
+  {
+    auto contents = contents_.wlock();
+    if (!contents->materialized || !entriesMatchTree(*contents, tree)) {
+      return false;
+    }
+    contents->materialized = false;
+    contents->treeHash = tree.getHash();
+  }
+
+  // As in saveOverlayPostCheckout(), only remove our overlay data once our
+  // parent no longer says that we are materialized.
+  loc.parent->childDematerialized(renameLock, loc.name, tree.getHash());
+  getOverlay()->removeOverlayData(getNodeId());
+  return true;
+}
+
 bool TreeInode::checkoutTryRemoveEmptyDir(CheckoutContext* ctx) {
   auto location = getLocationInfo(ctx->renameLock());
   DCHECK(!location.unlinked);
@@ -2442,11 +3167,19 @@ bool TreeInode::checkoutTryRemoveEmptyDir(CheckoutContext* ctx) {
 
 namespace {
 folly::Future<folly::Unit> recursivelyLoadMaterializedChildren(
-    const InodePtr& child) {
+    const InodePtr& child,
+    folly::Executor* executor,
+    MaterializedLoadProgress* progress) {
   // If this child is a directory, call loadMaterializedChildren() on it.
   TreeInodePtr treeChild = child.asTreePtrOrNull();
   if (treeChild) {
-    return treeChild->loadMaterializedChildren();
+    if (progress) {
+      ++progress->dirsLoaded;
+    }
+    return treeChild->loadMaterializedChildren(executor, progress);
+  }
+  if (progress) {
+    ++progress->filesLoaded;
   }
   return folly::makeFuture();
 }
@@ -2456,7 +3189,8 @@ folly::Future<InodePtr> TreeInode::loadChildLocked(
     Dir& /* contents */,
     PathComponentPiece name,
     Entry* entry,
-    std::vector<IncompleteInodeLoad>* pendingLoads) {
+    std::vector<IncompleteInodeLoad>* pendingLoads,
+    folly::Executor* overlayExecutor) {
   DCHECK(!entry->inode);
 
   bool startLoad;
@@ -2476,16 +3210,16 @@ folly::Future<InodePtr> TreeInode::loadChildLocked(
   }
 
   if (startLoad) {
-    auto loadFuture =
-        startLoadingInodeNoThrow(entry, name, entry->getInodeNumber());
     pendingLoads->emplace_back(
-        this, std::move(loadFuture), name, entry->getInodeNumber());
+        this, *entry, name, childNumber, overlayExecutor);
   }
 
   return future;
 }
 
-folly::Future<folly::Unit> TreeInode::loadMaterializedChildren() {
+folly::Future<folly::Unit> TreeInode::loadMaterializedChildren(
+    folly::Executor* executor,
+    MaterializedLoadProgress* progress) {
   std::vector<IncompleteInodeLoad> pendingLoads;
   std::vector<Future<InodePtr>> inodeFutures;
 
@@ -2497,21 +3231,22 @@ folly::Future<folly::Unit> TreeInode::loadMaterializedChildren() {
 
     for (auto& entry : contents->entries) {
       const auto& name = entry.first;
-      const auto& ent = entry.second;
-      if (!ent->isMaterialized()) {
+      auto& ent = entry.second;
+      if (!ent.isMaterialized()) {
         continue;
       }
 
-      if (ent->inode) {
+      if (ent.inode) {
         // We generally don't expect any inodes to be loaded already
         LOG(WARNING)
             << "found already-loaded inode for materialized child "
-            << ent->inode->getLogPath()
+            << ent.inode->getLogPath()
             << " when performing initial loading of materialized inodes";
         continue;
       }
 
-      auto future = loadChildLocked(*contents, name, ent.get(), &pendingLoads);
+      auto future =
+          loadChildLocked(*contents, name, &ent, &pendingLoads, executor);
       inodeFutures.emplace_back(std::move(future));
     }
   }
@@ -2527,40 +3262,137 @@ folly::Future<folly::Unit> TreeInode::loadMaterializedChildren() {
   // children directories when each child inode becomes ready.
   std::vector<Future<folly::Unit>> results;
   for (auto& future : inodeFutures) {
-    results.emplace_back(future.then(recursivelyLoadMaterializedChildren));
+    results.emplace_back(
+        future.then([executor, progress](const InodePtr& child) {
+          return recursivelyLoadMaterializedChildren(child, executor, progress);
+        }));
   }
 
   return folly::collectAll(results).unit();
 }
 
+namespace {
+FileType fileTypeFromMode(mode_t mode) {
+  if (S_ISDIR(mode)) {
+    return FileType::DIRECTORY;
+  }
+  return S_ISLNK(mode) ? FileType::SYMLINK : FileType::REGULAR_FILE;
+}
+
+Future<TreeEntry> storeChildSnapshot(
+    const InodePtr& child,
+    PathComponent name,
+    LocalStore* store,
+    folly::Executor* executor) {
+  if (auto tree = child.asTreePtrOrNull()) {
+    return tree->storeSnapshot(store, executor)
+        .then([name = std::move(name)](const Hash& id) mutable {
+          return TreeEntry(id, std::move(name), FileType::DIRECTORY, 0b111);
+        });
+  }
+  auto file = child.asFilePtr();
+  auto mode = file->getMode();
+  return file->storeSnapshot(store).then(
+      [ name = std::move(name), mode ](const Hash& id) mutable {
+        return TreeEntry(
+            id,
+            std::move(name),
+            fileTypeFromMode(mode),
+            TreeEntry::modeToOwnerPermissions(mode));
+      });
+}
+}
+
+Future<Hash> TreeInode::storeSnapshot(
+    LocalStore* store,
+    folly::Executor* executor,
+    const std::vector<PathComponentPiece>* skipNames) {
+  struct Child {
+    PathComponent name;
+    mode_t mode;
+    /** The source control ID, or none if the child is materialized */
+    folly::Optional<Hash> hash;
+  };
+  std::vector<Child> children;
+  {
+    auto contents = contents_.rlock();
+    if (!contents->materialized) {
+      return makeFuture(contents->treeHash.value());
+    }
+    children.reserve(contents->entries.size());
+    for (const auto& entry : contents->entries) {
+      if (skipNames &&
+          std::find(skipNames->begin(), skipNames->end(), entry.first) !=
+              skipNames->end()) {
+        continue;
+      }
+      folly::Optional<Hash> hash;
+      if (!entry.second.isMaterialized()) {
+        hash = entry.second.getHash();
+      }
+      children.push_back(Child{entry.first.copy(), entry.second.mode, hash});
+    }
+  }
+
+  // The children are in the same order as a Tree's entries, and collect()
+  // keeps that order.  Materialized children can only be loaded after
+  // releasing the contents lock.
+  vector<Future<TreeEntry>> entryFutures;
+  entryFutures.reserve(children.size());
+  for (auto& child : children) {
+    if (child.hash.hasValue()) {
+      entryFutures.push_back(makeFuture(TreeEntry(
+          child.hash.value(),
+          std::move(child.name),
+          fileTypeFromMode(child.mode),
+          TreeEntry::modeToOwnerPermissions(child.mode))));
+      continue;
+    }
+
+    auto future = getOrLoadChild(child.name);
+    if (executor) {
+      future = future.via(executor);
+    }
+    entryFutures.push_back(future.then([
+      name = std::move(child.name),
+      store,
+      executor
+    ](const InodePtr& inode) mutable {
+      return storeChildSnapshot(inode, std::move(name), store, executor);
+    }));
+  }
+
+  return folly::collect(entryFutures)
+      .then([store](vector<TreeEntry>&& entries) {
+        Tree tree(std::move(entries));
+        return store->putTree(&tree);
+      });
+}
+
 void TreeInode::unloadChildrenNow() {
   std::vector<TreeInodePtr> treeChildren;
   std::vector<InodeBase*> toDelete;
-  auto* inodeMap = getInodeMap();
   {
     auto contents = contents_.wlock();
-    auto inodeMapLock = inodeMap->lockForUnload();
 
+    std::vector<InodeBase**> fileChildren;
     for (auto& entry : contents->entries) {
-      if (!entry.second->inode) {
+      if (!entry.second.inode) {
         continue;
       }
 
-      auto* asTree = dynamic_cast<TreeInode*>(entry.second->inode);
+      auto* asTree = dynamic_cast<TreeInode*>(entry.second.inode);
       if (asTree) {
         treeChildren.push_back(TreeInodePtr::newPtrLocked(asTree));
       } else {
-        if (entry.second->inode->isPtrAcquireCountZero()) {
-          // Unload the inode
-          inodeMap->unloadInode(
-              entry.second->inode, this, entry.first, false, inodeMapLock);
-          // Record that we should now delete this inode after releasing
-          // the locks.
-          toDelete.push_back(entry.second->inode);
-          entry.second->inode = nullptr;
-        }
+        fileChildren.push_back(&entry.second.inode);
       }
     }
+    // Unload the unreferenced files in bulk.  They are deleted below, after
+    // releasing the contents lock.
+    if (!fileChildren.empty()) {
+      getInodeMap()->unloadChildrenForShutdown(fileChildren, &toDelete);
+    }
   }
 
   for (auto* child : toDelete) {
@@ -2575,6 +3407,58 @@ void TreeInode::unloadChildrenNow() {
   // all of our children trees, which may result in them being destroyed.
 }
 
+size_t TreeInode::unloadChildrenLastAccessedBefore(
+    std::chrono::steady_clock::time_point cutoff) {
+  // Process the child trees first.  A tree can only be unloaded once all of
+  // its own children have been, since each child holds a reference to it.
+  std::vector<TreeInodePtr> treeChildren;
+  {
+    auto contents = contents_.rlock();
+    for (const auto& entry : contents->entries) {
+      auto* asTree = dynamic_cast<TreeInode*>(entry.second.inode);
+      if (asTree) {
+        treeChildren.push_back(TreeInodePtr::newPtrLocked(asTree));
+      }
+    }
+  }
+
+  size_t numUnloaded = 0;
+  for (auto& child : treeChildren) {
+    numUnloaded += child->unloadChildrenLastAccessedBefore(cutoff);
+  }
+  // Release our references, so that the child trees can be unloaded below if
+  // nothing else is using them.
+  treeChildren.clear();
+
+  std::vector<InodeBase*> toDelete;
+  auto* inodeMap = getInodeMap();
+  {
+    auto contents = contents_.wlock();
+    auto inodeMapLock = inodeMap->lockForUnload();
+
+    for (auto& entry : contents->entries) {
+      auto* child = entry.second.inode;
+      if (!child || entry.second.isMaterialized()) {
+        continue;
+      }
+      if (!child->isPtrAcquireCountZero() || child->getFuseRefcount() != 0 ||
+          child->getLastAccess() >= cutoff) {
+        continue;
+      }
+
+      inodeMap->unloadInode(child, this, entry.first, false, inodeMapLock);
+      // Delete the inode only after releasing the locks.
+      toDelete.push_back(child);
+      entry.second.inode = nullptr;
+    }
+  }
+
+  for (auto* child : toDelete) {
+    delete child;
+  }
+  return numUnloaded + toDelete.size();
+}
+
 void TreeInode::getDebugStatus(vector<TreeInodeDebugInfo>& results) const {
   TreeInodeDebugInfo info;
   info.inodeNumber = getNodeId();
@@ -2592,20 +3476,20 @@ void TreeInode::getDebugStatus(vector<TreeInodeDebugInfo>& results) const {
     info.treeHash = thriftHash(contents->treeHash);
 
     for (const auto& entry : contents->entries) {
-      if (entry.second->inode) {
+      if (entry.second.inode) {
         // A child inode exists, so just grab an InodePtr and add it to the
         // childInodes list.  We will process all loaded children after
         // releasing our own contents_ lock (since we need to grab each child
         // Inode's own lock to get its data).
         childInodes.emplace_back(
-            entry.first, InodePtr::newPtrLocked(entry.second->inode));
+            entry.first.copy(), InodePtr::newPtrLocked(entry.second.inode));
       } else {
         // We can store data about unloaded entries immediately, since we have
         // the authoritative data ourself, and don't need to ask a separate
         // InodeBase object.
         info.entries.emplace_back();
         auto& infoEntry = info.entries.back();
-        auto* inodeEntry = entry.second.get();
+        auto* inodeEntry = &entry.second;
         infoEntry.name = entry.first.stringPiece().str();
         if (inodeEntry->hasInodeNumber()) {
           infoEntry.inodeNumber = inodeEntry->getInodeNumber();
@@ -2626,7 +3510,7 @@ void TreeInode::getDebugStatus(vector<TreeInodeDebugInfo>& results) const {
     info.entries.emplace_back();
     auto& infoEntry = info.entries.back();
     infoEntry.name = childData.first.stringPiece().str();
-    infoEntry.inodeNumber = childData.second->getNodeId();
+    infoEntry.inodeNumber = childData.second.getNodeId();
     infoEntry.loaded = true;
 
     auto childTree = childData.second.asTreePtrOrNull();
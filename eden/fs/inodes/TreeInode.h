@@ -8,13 +8,21 @@
  *
  */
 #pragma once
+#include <folly/Function.h>
 #include <folly/Optional.h>
 #include <folly/Portability.h>
 #include <folly/Synchronized.h>
+#include <atomic>
 #include "eden/fs/inodes/InodeBase.h"
 #include "eden/fs/model/Hash.h"
+#include "eden/utils/DirEntryName.h"
+#include "eden/utils/LockProfiler.h"
 #include "eden/utils/PathMap.h"
 
+namespace folly {
+class Executor;
+}
+
 namespace facebook {
 namespace eden {
 
@@ -26,6 +34,8 @@ class FileHandle;
 class GitIgnoreStack;
 class InodeDiffCallback;
 class InodeMap;
+class LocalStore;
+struct MaterializedLoadProgress;
 class ObjectStore;
 class Overlay;
 class RenameLock;
@@ -69,13 +79,25 @@ class TreeInode : public InodeBase {
     /**
      * Create a hash for a non-materialized entry.
      */
-    Entry(mode_t m, Hash hash) : mode(m), hash_{hash} {}
+    Entry(mode_t m, Hash hash)
+        : hash_{hash}, mode(m), size_{kUnknownSize}, materialized_{false} {}
+
+    /**
+     * Create a non-materialized entry for a source control TreeEntry,
+     * remembering the blob size if the TreeEntry has one.
+     */
+    explicit Entry(const TreeEntry& entry);
 
     /**
      * Create a hash for a materialized entry.
      */
     Entry(mode_t m, fuse_ino_t number, dev_t rdev = 0)
-        : mode(m), inodeNumber_{number}, rdev_(rdev) {}
+        : mode(m),
+          rdev_(static_cast<uint32_t>(rdev)),
+          materialized_{true},
+          inodeNumber_{number} {
+      DCHECK_EQ(rdev_, rdev);
+    }
 
     Entry(Entry&& e) = default;
     Entry& operator=(Entry&& e) = default;
@@ -84,15 +106,19 @@ class TreeInode : public InodeBase {
       // TODO: In the future we should probably only allow callers to invoke
       // this method when inode is not set.  If inode is set it should be the
       // authoritative source of data.
-      return !hash_.hasValue();
+      return materialized_;
     }
     Hash getHash() const {
       // TODO: In the future we should probably only allow callers to invoke
       // this method when inode is not set.  If inode is set it should be the
       // authoritative source of data.
-      return hash_.value();
+      DCHECK(!materialized_);
+      return hash_;
     }
-    const folly::Optional<Hash>& getOptionalHash() const {
+    folly::Optional<Hash> getOptionalHash() const {
+      if (materialized_) {
+        return folly::none;
+      }
       return hash_;
     }
 
@@ -112,10 +138,15 @@ class TreeInode : public InodeBase {
     void setMaterialized(fuse_ino_t inode) {
       DCHECK(inodeNumber_ == 0 || inode == inodeNumber_);
       inodeNumber_ = inode;
-      hash_.clear();
+      materialized_ = true;
+      // rdev_ shares storage with size_.  Materialized regular files never
+      // have a device number.
+      rdev_ = 0;
     }
     void setDematerialized(Hash hash) {
       hash_ = hash;
+      materialized_ = false;
+      size_ = kUnknownSize;
     }
 
     mode_t getMode() const {
@@ -134,47 +165,97 @@ class TreeInode : public InodeBase {
      */
     bool isDirectory() const;
 
-    // TODO: Make mode private and provide an accessor method instead
-    /** The complete st_mode value for this entry */
-    mode_t mode{0};
-
     dev_t getRdev() const {
       // Callers should not check getRdev() if an inode is loaded.
       // If the child inode is loaded it is the authoritative source for
       // the mode bits.
       DCHECK(!inode);
-      return rdev_;
+      return materialized_ ? rdev_ : 0;
+    }
+
+    /**
+     * Get the size of the source control blob for a non-materialized file,
+     * if the backing store supplied it with the Tree.
+     *
+     * This lets a FileInode report its size without fetching the blob or
+     * its metadata.
+     */
+    folly::Optional<uint64_t> getSize() const {
+      if (materialized_ || size_ == kUnknownSize) {
+        return folly::none;
+      }
+      return size_;
+    }
+
+    /**
+     * Remember the size of the source control blob for a non-materialized
+     * file, after looking it up separately from the Tree.
+     */
+    void setBlobSize(uint64_t size) {
+      DCHECK(!materialized_);
+      setSize(size);
     }
 
+    // The fields below are ordered to keep Entry small: directories store
+    // their entries inline in a sorted vector, so every byte here is paid
+    // once per entry in every loaded directory.
+
    private:
+    /** size_ value for sizes that are unknown or do not fit in 32 bits. */
+    static constexpr uint32_t kUnknownSize = ~uint32_t{0};
+
+    void setSize(const folly::Optional<uint64_t>& size) {
+      size_ = (size.hasValue() && size.value() < kUnknownSize)
+          ? static_cast<uint32_t>(size.value())
+          : kUnknownSize;
+    }
+
     /**
      * If the entry is not materialized, this contains the hash
      * identifying the source control Tree (if this is a directory) or Blob
      * (if this is a file) that contains the entry contents.
      *
-     * If the entry is materialized, this field is not set.
+     * If the entry is materialized, this field is unused.
      *
      * TODO: If inode is set, this field generally should not be used, and the
      * child InodeBase should be consulted instead.
      */
-    folly::Optional<Hash> hash_;
+    Hash hash_;
+
+   public:
+    // TODO: Make mode private and provide an accessor method instead
+    /** The complete st_mode value for this entry */
+    mode_t mode{0};
+
+   private:
+    union {
+      /**
+       * The value of the rdev field that we report in stat, for
+       * materialized entries.
+       * This is used for mknod and thus for unix domain sockets.  mknod()
+       * rejects device numbers that do not fit in 32 bits.
+       **/
+      uint32_t rdev_{0};
+      /**
+       * The blob size for non-materialized entries, or kUnknownSize.
+       * Files of 4GB or more fall back to the blob metadata.
+       */
+      uint32_t size_;
+    };
+
+    /** Whether the entry is materialized in the overlay, rather than hash_ */
+    bool materialized_{false};
 
     /**
      * The inode number, if one is allocated for this entry, or 0 if one is not
      * allocated.
      *
      * An inode number is required for materialized entries, so this is always
-     * non-zero if hash_ is not set.  (It may also be non-zero even when hash_
-     * is set.)
+     * non-zero if the entry is materialized.  (It may also be non-zero even
+     * when it is not.)
      */
     fuse_ino_t inodeNumber_{0};
 
-    /**
-     * The value of the rdev field that we report in stat.
-     * This is used for mknod and thus for unix domain sockets.
-     **/
-    dev_t rdev_{0};
-
    public:
     // TODO: Make inode private and provide an accessor method instead
     /**
@@ -194,10 +275,28 @@ class TreeInode : public InodeBase {
     InodeBase* inode{nullptr};
   };
 
+  using EntryMap = PathMap<Entry, DirEntryName>;
+
   /** Represents a directory in the overlay */
   struct Dir {
-    /** The direct children of this directory */
-    PathMap<std::unique_ptr<Entry>> entries;
+    /**
+     * The source control Tree this directory was built from, if any.
+     *
+     * Entry names that have not changed since then borrow their storage from
+     * this Tree rather than holding their own copy, so it must be kept alive
+     * as long as they exist.  Entries added later always own their names.
+     * The Tree is immutable, and may be shared with other mounts through the
+     * ObjectStore's LiveTreeTable.
+     */
+    std::shared_ptr<const Tree> sourceTree;
+
+    /**
+     * The direct children of this directory.
+     *
+     * Entries are stored inline, so inserting or erasing an entry
+     * invalidates pointers to the other entries.
+     */
+    EntryMap entries;
     /** If the origin of this dir was a Tree, the hash of that tree */
     folly::Optional<Hash> treeHash;
 
@@ -205,6 +304,8 @@ class TreeInode : public InodeBase {
      * If the contents match the original tree, this is false. */
     bool materialized{false};
   };
+  using DirContents =
+      folly::Synchronized<Dir, ProfiledMutex<LockProfiler::CONTENTS_LOCK>>;
 
   /** Holds the results of a create operation.
    *
@@ -226,7 +327,7 @@ class TreeInode : public InodeBase {
       fuse_ino_t ino,
       TreeInodePtr parent,
       PathComponentPiece name,
-      std::unique_ptr<Tree>&& tree);
+      std::shared_ptr<const Tree> tree);
 
   /// Construct an inode that only has backing in the Overlay area
   TreeInode(
@@ -236,14 +337,31 @@ class TreeInode : public InodeBase {
       Dir&& dir);
 
   /// Constructors for the root TreeInode
-  TreeInode(EdenMount* mount, std::unique_ptr<Tree>&& tree);
+  TreeInode(EdenMount* mount, std::shared_ptr<const Tree> tree);
   TreeInode(EdenMount* mount, Dir&& tree);
 
   ~TreeInode();
 
+  /**
+   * TreeInodes are allocated from a SlabPool, since mount points can have
+   * millions of them loaded.
+   */
+  static void* operator new(size_t size);
+  static void operator delete(void* ptr, size_t size);
+
   folly::Future<fusell::Dispatcher::Attr> getattr() override;
   fusell::Dispatcher::Attr getAttrLocked(const Dir* contents);
 
+  /**
+   * Get how long the kernel may cache the fact that a name does not exist in
+   * this directory, in seconds.
+   *
+   * This is the same as for the directory's existing entries.  Checkout
+   * invalidates the kernel's cache for each name it adds, and entries
+   * created through FUSE replace the kernel's negative entries itself.
+   */
+  double getNegativeEntryTtl();
+
   /** Implements the InodeBase method used by the Dispatcher
    * to create the Inode instance for a given name */
   folly::Future<InodePtr> getChildByName(PathComponentPiece namepiece);
@@ -256,6 +374,51 @@ class TreeInode : public InodeBase {
   folly::Future<InodePtr> getOrLoadChild(PathComponentPiece name);
   folly::Future<TreeInodePtr> getOrLoadChildTree(PathComponentPiece name);
 
+  /**
+   * Get the inode object for a child of this directory, only if it is
+   * already loaded.
+   *
+   * Returns nullptr if the child does not exist or is not loaded.  Unlike
+   * getOrLoadChild() this never allocates a Future, so callers that can
+   * answer a request synchronously should try it first.
+   */
+  InodePtr getLoadedChild(PathComponentPiece name);
+
+  /**
+   * Look up the sizes of several unloaded, non-materialized files in this
+   * directory with one batched metadata request, so that loading them and
+   * calling getattr() afterwards does not fetch metadata once per file.
+   *
+   * Names that do not exist, are already loaded, or whose size is already
+   * known are skipped.  Failures are ignored, since getattr() will simply
+   * look the size up again.
+   */
+  folly::Future<folly::Unit> loadChildSizes(
+      const std::vector<PathComponent>& names);
+
+  /**
+   * Fetch the metadata of every non-materialized file in this directory into
+   * the LocalStore with one batched request.
+   *
+   * This is called when a file's SHA-1 is requested and its metadata is not
+   * available locally, since tools that ask for one file's SHA-1 usually ask
+   * for its siblings' too.  Only the first call for a given TreeInode object
+   * does anything.  Failures are ignored, since each file will simply fetch
+   * its own metadata.
+   */
+  folly::Future<folly::Unit> prefetchChildMetadata();
+
+  /**
+   * Start prefetching the Trees of this directory's subdirectories that are
+   * not loaded yet, with the mount's TreePrefetcher.
+   *
+   * This is called when the directory is listed, or once
+   * --tree_prefetch_lookups of its children have been loaded by lookups.
+   * Only the first call for a given TreeInode object does anything, and it
+   * does not wait for the prefetch.
+   */
+  void prefetchChildTrees();
+
   /**
    * Recursively look up a child inode.
    *
@@ -266,6 +429,27 @@ class TreeInode : public InodeBase {
 
   fuse_ino_t getChildInodeNumber(PathComponentPiece name);
 
+  /**
+   * Call fn(name, mode, inodeNumber) for each child, in name order.
+   *
+   * The children that do not have an inode number yet are given one, all
+   * under a single acquisition of the contents lock, which is held while fn
+   * runs.  fn must not access this inode or its children.
+   */
+  void forEachChildNumber(
+      folly::Function<void(PathComponentPiece, mode_t, fuse_ino_t)> fn);
+
+  /**
+   * Give inode numbers to children that do not have one yet.
+   *
+   * This is used by InodeMap when taking over a mount point from another
+   * process, so that children keep the numbers the kernel knows them by.
+   * Children that already have a number, or that no longer exist, are left
+   * alone.
+   */
+  void restoreChildInodeNumbers(
+      const std::vector<std::pair<PathComponent, fuse_ino_t>>& children);
+
   folly::Future<std::shared_ptr<fusell::DirHandle>> opendir(
       const struct fuse_file_info& fi);
   folly::Future<folly::Unit> rename(
@@ -273,10 +457,10 @@ class TreeInode : public InodeBase {
       TreeInodePtr newParent,
       PathComponentPiece newName);
 
-  const folly::Synchronized<Dir>& getContents() const {
+  const DirContents& getContents() const {
     return contents_;
   }
-  folly::Synchronized<Dir>& getContents() {
+  DirContents& getContents() {
     return contents_;
   }
 
@@ -305,6 +489,20 @@ class TreeInode : public InodeBase {
   folly::Future<folly::Unit> unlink(PathComponentPiece name);
   folly::Future<folly::Unit> rmdir(PathComponentPiece name);
 
+  /**
+   * Remove the child called name and, if it is a directory, everything
+   * under it, like `rm -rf`.
+   *
+   * This is much cheaper than removing the entries one at a time over FUSE,
+   * as there is no kernel round trip per entry, and all of the removed paths
+   * are recorded in the journal as a single delta at the end.
+   *
+   * If an entry is added under the directory while it is being removed, this
+   * fails with ENOTEMPTY.  Whatever was removed before the failure stays
+   * removed.
+   */
+  folly::Future<folly::Unit> removeRecursive(PathComponentPiece name);
+
   /**
    * Create a special filesystem node.
    * Only unix domain sockets are supported; attempting to create any
@@ -319,6 +517,7 @@ class TreeInode : public InodeBase {
    * @param context A pointer to the DiffContext containing parameters for the
    *     current diff operation.  The caller is responsible for ensuring that
    *     the DiffContext object remains valid until this diff completes.
+   *     If its prefix is set, entries outside of the prefix are skipped.
    * @param currentPath The path to this Tree, as used for the purpose of diff
    *     computation.  Note that we do not block renames and other filesystem
    *     layout changes during diff operations, so this might not actually
@@ -340,6 +539,10 @@ class TreeInode : public InodeBase {
    * @return Returns a Future that will be fulfilled when the diff operation
    *     completes.  The caller must ensure that the InodeDiffCallback parameter
    *     remains valid until this Future completes.
+   *
+   * If an earlier diff found that this directory was identical to tree, and
+   * nothing underneath it has changed since then, this returns immediately
+   * without examining any children.
    */
   folly::Future<folly::Unit> diff(
       const DiffContext* context,
@@ -348,6 +551,23 @@ class TreeInode : public InodeBase {
       GitIgnoreStack* parentIgnore,
       bool isIgnored);
 
+  /**
+   * Returns true if the most recent diff() of this directory found no
+   * differences at all from the Tree with the given hash, and nothing
+   * underneath this directory has changed since that diff started.
+   */
+  bool hasCleanDiff(const Hash& treeHash) const;
+
+  /**
+   * Discard the cached diff results for this directory and all of its
+   * ancestors.
+   *
+   * This must be called after any change to the entries of this directory or
+   * to the contents of a file inside it.  (Calling it before the change
+   * completes would allow a concurrent diff to cache the old state.)
+   */
+  void invalidateDiffCache();
+
   /**
    * Update this directory so that it matches the specified source control Tree
    * object.
@@ -416,6 +636,20 @@ class TreeInode : public InodeBase {
       PathComponentPiece childName,
       Hash childScmHash);
 
+  /**
+   * Dematerialize the children of this directory whose contents match the
+   * corresponding entries of tree again, recursing into materialized
+   * subdirectories.  This directory is then dematerialized too if it matches
+   * tree, unless it is the root.  Otherwise it records tree as its source
+   * control tree.
+   *
+   * Files are compared using only their size and their SHA-1 if it is
+   * already known, so this never reads file contents unless hashFiles is
+   * true, in which case files of the same size as their blob are hashed.
+   * Returns the number of inodes dematerialized.
+   */
+  size_t dematerializeUnchanged(const Tree& tree, bool hashFiles = false);
+
   /**
    * Internal API only for use by InodeMap.
    *
@@ -429,24 +663,66 @@ class TreeInode : public InodeBase {
    * Unload all unreferenced children under this tree (recursively).
    *
    * This walks the children underneath this tree, unloading any inodes that
-   * are unreferenced.
+   * are unreferenced.  It is only used while the mount point is shutting
+   * down, and unloads the children of each directory in bulk with
+   * InodeMap::unloadChildrenForShutdown().
    */
   void unloadChildrenNow();
 
+  /**
+   * Unload unreferenced children under this tree (recursively) that have
+   * not been looked up since cutoff.
+   *
+   * Unlike unloadChildrenNow() this is meant to run while the mount is in
+   * use.  It holds only one directory's contents lock at a time and does not
+   * need the rename lock, so it never blocks other operations for long.
+   * Materialized inodes and inodes with outstanding FUSE references are left
+   * loaded.
+   *
+   * Returns the number of inodes unloaded.
+   */
+  size_t unloadChildrenLastAccessedBefore(
+      std::chrono::steady_clock::time_point cutoff);
+
   /**
    * Load all materialized children underneath this TreeInode.
    *
    * This recursively descends into children directories.
    *
-   * This method is intended to be called during the mount point initialization
-   * to trigger loading of materialized inodes.  This allows other parts of the
-   * code to assume that materialized inodes are always loaded once the mount
-   * point has been initialized.
+   * Materialized inodes are normally loaded on demand like any other inode.
+   * This can optionally be called during mount point initialization to load
+   * all of them up front.
+   *
+   * If executor is non-null, the overlay data for materialized child
+   * directories is read on it rather than in the calling thread, so that
+   * separate directories are loaded in parallel.  If progress is non-null it
+   * is updated as each inode is loaded.
    *
    * Returns a Future that completes once all materialized inodes have been
    * loaded.
    */
-  folly::Future<folly::Unit> loadMaterializedChildren();
+  folly::Future<folly::Unit> loadMaterializedChildren(
+      folly::Executor* executor = nullptr,
+      MaterializedLoadProgress* progress = nullptr);
+
+  /**
+   * Store this directory and everything under it in the LocalStore as
+   * source control Trees and Blobs, and return the ID of its Tree.
+   *
+   * Unmodified files and directories are referred to by their existing
+   * IDs, so only materialized inodes are visited, and only materialized
+   * files are read, from the overlay.  If executor is non-null, the
+   * materialized children are stored on it in parallel.
+   *
+   * Untracked and ignored files are included, since this directory does
+   * not know which files are tracked.  If skipNames is non-null, the
+   * entries of this directory (but not of its subdirectories) with those
+   * names are left out.  It is not used after this returns.
+   */
+  folly::Future<Hash> storeSnapshot(
+      LocalStore* store,
+      folly::Executor* executor,
+      const std::vector<PathComponentPiece>* skipNames = nullptr);
 
   /*
    * Update a tree entry as part of a checkout operation.
@@ -492,6 +768,23 @@ class TreeInode : public InodeBase {
   class TreeRenameLocks;
   class IncompleteInodeLoad;
 
+  /**
+   * The parts of an Entry that are needed to load its inode.  These are
+   * copied out of the Entry so that the load can be started after releasing
+   * the contents_ lock.
+   */
+  struct LoadInfo {
+    explicit LoadInfo(const Entry& entry)
+        : mode{entry.getMode()},
+          hash{entry.getOptionalHash()},
+          size{entry.getSize()} {}
+
+    mode_t mode;
+    // Set unless the entry is materialized.
+    folly::Optional<Hash> hash;
+    folly::Optional<uint64_t> size;
+  };
+
   void registerInodeLoadComplete(
       folly::Future<std::unique_ptr<InodeBase>>& future,
       PathComponentPiece name,
@@ -501,12 +794,24 @@ class TreeInode : public InodeBase {
       std::unique_ptr<InodeBase> childInode);
 
   folly::Future<std::unique_ptr<InodeBase>> startLoadingInodeNoThrow(
-      Entry* entry,
+      const LoadInfo& info,
       PathComponentPiece name,
-      fuse_ino_t number) noexcept;
+      fuse_ino_t number,
+      folly::Executor* overlayExecutor = nullptr) noexcept;
 
-  folly::Future<std::unique_ptr<InodeBase>>
-  startLoadingInode(Entry* entry, PathComponentPiece name, fuse_ino_t number);
+  folly::Future<std::unique_ptr<InodeBase>> startLoadingInode(
+      const LoadInfo& info,
+      PathComponentPiece name,
+      fuse_ino_t number,
+      folly::Executor* overlayExecutor);
+
+  /**
+   * Create the TreeInode for a materialized child directory from its
+   * overlay data.
+   */
+  std::unique_ptr<InodeBase> loadOverlayTreeInode(
+      PathComponentPiece name,
+      fuse_ino_t number);
 
   /**
    * Materialize this directory in the overlay.
@@ -519,13 +824,13 @@ class TreeInode : public InodeBase {
   folly::Future<folly::Unit> doRename(
       TreeRenameLocks&& locks,
       PathComponentPiece srcName,
-      PathMap<std::unique_ptr<Entry>>::iterator srcIter,
+      EntryMap::iterator srcIter,
       TreeInodePtr destParent,
       PathComponentPiece destName);
 
   /** Translates a Tree object from our store into a Dir object
    * used to track the directory in the inode */
-  static Dir buildDirFromTree(const Tree* tree);
+  static Dir buildDirFromTree(std::shared_ptr<const Tree> tree);
 
   /**
    * Get a TreeInodePtr to ourself.
@@ -552,6 +857,32 @@ class TreeInode : public InodeBase {
   folly::Future<folly::Unit>
   removeImpl(PathComponent name, InodePtr child, unsigned int attemptNum);
 
+  /** The paths removed so far by a removeRecursive() call */
+  using RemovedPaths = folly::Synchronized<std::vector<RelativePath>>;
+
+  /**
+   * Remove the loaded child called name, and everything under it, as part of
+   * removeRecursive().
+   */
+  folly::Future<folly::Unit> removeRecursiveImpl(
+      PathComponentPiece name,
+      InodePtr child,
+      std::shared_ptr<RemovedPaths> removed);
+
+  /** Remove all of our children, recursively, for removeRecursive(). */
+  folly::Future<folly::Unit> removeAllChildren(
+      std::shared_ptr<RemovedPaths> removed);
+
+  /**
+   * Unlink a loaded child that removeRecursive() has emptied, and add its
+   * path to removed instead of recording it in the journal.
+   */
+  template <typename InodePtrType>
+  void removeLoadedChild(
+      PathComponentPiece name,
+      InodePtrType child,
+      RemovedPaths& removed);
+
   /**
    * tryRemoveChild() actually unlinks a child from our entry list.
    *
@@ -596,16 +927,21 @@ class TreeInode : public InodeBase {
   static FOLLY_WARN_UNUSED_RESULT int checkPreRemove(const FileInodePtr& child);
 
   /**
-   * This helper function starts loading a currently unloaded child inode.
-   * It must be held with the contents_ lock held.  (The Dir argument is only
-   * required as a parameter to ensure that the caller is actually holding the
-   * lock.)
+   * This helper function registers the load of a currently unloaded child
+   * inode with the InodeMap.  It must be called with the contents_ lock held.
+   * (The Dir argument is only required as a parameter to ensure that the
+   * caller is actually holding the lock.)  The load itself is started by
+   * IncompleteInodeLoad::finish(), after the caller releases the lock.
+   *
+   * If overlayExecutor is non-null and the child is a materialized
+   * directory, its overlay data is read on overlayExecutor.
    */
   folly::Future<InodePtr> loadChildLocked(
       Dir& dir,
       PathComponentPiece name,
       Entry* entry,
-      std::vector<IncompleteInodeLoad>* pendingLoads);
+      std::vector<IncompleteInodeLoad>* pendingLoads,
+      folly::Executor* overlayExecutor = nullptr);
 
   /**
    * Load the .gitignore file for this directory, then call computeDiff() once
@@ -628,7 +964,7 @@ class TreeInode : public InodeBase {
    * diff once all .gitignore data is loaded.
    */
   folly::Future<folly::Unit> computeDiff(
-      folly::Synchronized<Dir>::LockedPtr contentsLock,
+      DirContents::LockedPtr contentsLock,
       const DiffContext* context,
       RelativePathPiece currentPath,
       std::unique_ptr<Tree> tree,
@@ -647,8 +983,29 @@ class TreeInode : public InodeBase {
       const TreeEntry* oldScmEntry,
       const TreeEntry* newScmEntry,
       std::vector<IncompleteInodeLoad>* pendingLoads);
+  /**
+   * Returns true if the entry can be checked out just by replacing its hash.
+   *
+   * This is the case when the entry is neither loaded nor materialized, and
+   * still refers to oldScmEntry.  The caller must hold the contents_ lock.
+   */
+  bool canCheckoutByHashSwap(
+      const Entry& entry,
+      const TreeEntry* oldScmEntry,
+      const TreeEntry* newScmEntry);
   void saveOverlayPostCheckout(CheckoutContext* ctx, const Tree* tree);
 
+  /**
+   * Returns true if no entry in contents is materialized, and the entries
+   * refer to the same objects as the entries of tree.
+   */
+  static bool entriesMatchTree(const Dir& contents, const Tree& tree);
+  /**
+   * Dematerialize this directory if its entries match tree.  Returns false
+   * if they do not, or if this is the root or an unlinked directory.
+   */
+  bool dematerializeIfSameAs(const Tree& tree);
+
   /**
    * Attempt to remove an empty directory during a checkout operation.
    *
@@ -658,7 +1015,31 @@ class TreeInode : public InodeBase {
    */
   FOLLY_WARN_UNUSED_RESULT bool checkoutTryRemoveEmptyDir(CheckoutContext* ctx);
 
-  folly::Synchronized<Dir> contents_;
+  /**
+   * Records that a diff() found this directory identical to a source control
+   * Tree.
+   */
+  struct CleanDiff {
+    Hash treeHash;
+    /** The value of diffGeneration_ when that diff started. */
+    uint64_t generation;
+  };
+
+  DirContents contents_;
+
+  /**
+   * Incremented by invalidateDiffCache().  A CleanDiff is only valid while
+   * its generation is still current, so a change made while a diff is in
+   * progress prevents that diff's result from being used later.
+   */
+  std::atomic<uint64_t> diffGeneration_{0};
+  /** Set by the first call to prefetchChildMetadata(). */
+  std::atomic<bool> childMetadataPrefetched_{false};
+  /** Set by the first call to prefetchChildTrees(). */
+  std::atomic<bool> childTreesPrefetched_{false};
+  /** The number of children that getOrLoadChild() has started loading */
+  std::atomic<uint32_t> numChildLoads_{0};
+  folly::Synchronized<folly::Optional<CleanDiff>> cleanDiff_;
 };
 }
 }
@@ -10,6 +10,9 @@
 #include "TreeInodeDirHandle.h"
 
 #include "Overlay.h"
+#include "eden/fs/config/ClientConfig.h"
+#include "eden/fs/config/SparseProfile.h"
+#include "eden/fs/inodes/EdenMount.h"
 #include "eden/fs/inodes/TreeInode.h"
 #include "eden/fs/model/Tree.h"
 #include "eden/utils/DirType.h"
@@ -31,94 +34,69 @@ folly::Future<fusell::DirList> TreeInodeDirHandle::readdir(
   // DirList.
   // We need to return as soon as we have filled the available space in the
   // provided DirList object.
-
-  // The inode of this directory
-  auto dir_inode = inode_->getNodeId();
-
-  // It's pretty complicated to stitch together the directory contents
-  // while trying to skip around and respect the offset parameter.
-  // Let's go for the simple approach and see if that is good enough.
-  //
-  // There are three components to the DirList that we need to populate:
-  // 1. The "." and ".." entries
-  // 2. The overlay entries if we have any
-  // 3. The tree entries if we do not have an overlay entry for this dir.
   //
-  // We're going to build a vector of this combined information,
-  // then we can paginate sanely using the off parameter.
-
-  /** This struct is pretty lightweight and doesn't need to make any
-   * heap copies of names as we accumulate the view of the entries */
-  struct Entry {
-    const char* name;
-    dtype_t type;
-    /// If 0, look up/assign it based on name
-    fuse_ino_t ino;
-
-    Entry(const char* name, dtype_t type, fuse_ino_t ino = 0)
-        : name(name), type(type), ino(ino) {}
-  };
-  folly::fbvector<Entry> entries;
-
+  // The offset of an entry is its index in the listing plus one.
+  std::shared_ptr<const Listing> listing;
   {
-    auto dir = inode_->getContents().rlock();
-    entries.reserve(2 /* "." and ".." */ + dir->entries.size());
-
-    // Reserved entries for linking to parent and self.
-    entries.emplace_back(".", dtype_t::Dir, dir_inode);
-    auto parent = inode_->getParentBuggy();
-    if (!parent) {
-      // For the root of the mount point, just add its own inode ID
-      // as its parent.
-      entries.emplace_back("..", dtype_t::Dir, dir_inode);
-    } else {
-      entries.emplace_back("..", dtype_t::Dir, parent->getNodeId());
-    }
-
-    for (const auto& entry : dir->entries) {
-      entries.emplace_back(
-          entry.first.value().c_str(), mode_to_dtype(entry.second->mode));
+    auto lockedListing = listing_.lock();
+    if (off == 0 || !*lockedListing) {
+      *lockedListing = makeListing();
     }
+    listing = *lockedListing;
+  }
+  if (off == 0) {
+    // Listing a directory is usually the first step of walking it.
+    inode_->prefetchChildTrees();
   }
 
-  // And now the easy part: seek to the provided offset and fill up
-  // the DirList with the entries that remain.
-  auto entry_iter = entries.begin();
-  std::advance(entry_iter, off);
-
-  // The stat struct is only used by the fuse machinery to compute the type
-  // of the entry so that it can report an appropriate DT_XXX type up to
-  // the caller of readdir(), so we zero initialize it and only fill in
-  // the type bits of the mode.  The reset are irrelevant and we don't
-  // need to waste effort populating them.  We zero out the struct here
-  // once and vary just the bits that need to be updated in the loop below.
-  // https://www.daemon-systems.org/man/DTTOIF.3.html
-  struct stat st;
-  memset(&st, 0, sizeof(st));
-
-  while (entry_iter < entries.end()) {
-    const auto& entry = *entry_iter;
-    st.st_ino = entry.ino;
-    st.st_mode = dtype_to_mode(entry.type);
-
-    if (st.st_ino == 0) {
-      // We haven't looked up its inode yet, do so now.
-      // We defer it from the first pass above in case we have a huge
-      // dir and need to paginate through it across several calls into
-      // this function.
-      st.st_ino = inode_->getChildInodeNumber(PathComponentPiece{entry.name});
-    }
-
-    if (!list.add(entry.name, st, ++off)) {
+  for (auto index = static_cast<size_t>(off); index < listing->entries.size();
+       ++index) {
+    const auto& entry = listing->entries[index];
+    auto name = folly::StringPiece{listing->names}.subpiece(
+        entry.nameOffset, entry.nameLength);
+    if (!list.add(name, entry.ino, entry.type, index + 1)) {
       break;
     }
-
-    ++entry_iter;
   }
 
   return std::move(list);
 }
 
+std::shared_ptr<const TreeInodeDirHandle::Listing>
+TreeInodeDirHandle::makeListing() {
+  auto listing = std::make_shared<Listing>();
+  auto addEntry = [&](folly::StringPiece name, dtype_t type, fuse_ino_t ino) {
+    listing->entries.push_back(
+        Listing::Entry{static_cast<uint32_t>(listing->names.size()),
+                       static_cast<uint32_t>(name.size()),
+                       type,
+                       ino});
+    listing->names.append(name.data(), name.size());
+  };
+
+  // Reserved entries for linking to parent and self.
+  auto dirInode = inode_->getNodeId();
+  addEntry(".", dtype_t::Dir, dirInode);
+  auto parent = inode_->getParentBuggy();
+  // For the root of the mount point, just add its own inode ID as its parent.
+  addEntry("..", dtype_t::Dir, parent ? parent->getNodeId() : dirInode);
+
+  // Leave out anything the sparse profile hides.
+  const auto& sparse = inode_->getMount()->getConfig()->getSparseProfile();
+  folly::Optional<RelativePath> dirPath;
+  if (sparse) {
+    dirPath = inode_->getPath();
+  }
+  inode_->forEachChildNumber(
+      [&](PathComponentPiece name, mode_t mode, fuse_ino_t ino) {
+        if (dirPath.hasValue() && sparse->isExcluded(dirPath.value() + name)) {
+          return;
+        }
+        addEntry(name.stringPiece(), mode_to_dtype(mode), ino);
+      });
+  return listing;
+}
+
 folly::Future<fusell::Dispatcher::Attr> TreeInodeDirHandle::setattr(
     const struct stat& attr,
     int to_set) {
@@ -126,7 +104,10 @@ folly::Future<fusell::Dispatcher::Attr> TreeInodeDirHandle::setattr(
 }
 
 folly::Future<folly::Unit> TreeInodeDirHandle::fsyncdir(bool datasync) {
-  // We're read-only here, so there is nothing to sync
+  // Directory changes are written to the overlay in batches, so write out
+  // everything still pending.  This includes changes to other directories
+  // too, but they are all committed in a single write anyway.
+  inode_->getOverlay()->flushDirs(true);
   return folly::Unit{};
 }
 
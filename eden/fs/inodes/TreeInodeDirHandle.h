@@ -8,8 +8,14 @@
  *
  */
 #pragma once
+#include <folly/Synchronized.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 #include "eden/fs/inodes/InodePtr.h"
 #include "eden/fuse/DirHandle.h"
+#include "eden/utils/DirType.h"
 
 namespace facebook {
 namespace eden {
@@ -27,8 +33,40 @@ class TreeInodeDirHandle : public fusell::DirHandle {
   folly::Future<folly::Unit> fsyncdir(bool datasync) override;
   folly::Future<fusell::Dispatcher::Attr> getattr() override;
 
+  const TreeInodePtr& getInode() const {
+    return inode_;
+  }
+
  private:
+  /**
+   * A snapshot of the directory contents, which readdir() returns slices of.
+   *
+   * The names are stored back to back in a single string, rather than each
+   * in its own allocation.
+   */
+  struct Listing {
+    struct Entry {
+      uint32_t nameOffset;
+      uint32_t nameLength;
+      dtype_t type;
+      fuse_ino_t ino;
+    };
+
+    std::string names;
+    std::vector<Entry> entries;
+  };
+
+  std::shared_ptr<const Listing> makeListing();
+
   TreeInodePtr inode_;
+
+  /**
+   * The listing taken by the last readdir() from offset 0, which is how
+   * reading starts after opendir() or rewinddir().  Reads at other offsets
+   * continue from it, so a directory read in many small chunks is only
+   * listed once, and the offsets stay consistent between the chunks.
+   */
+  folly::Synchronized<std::shared_ptr<const Listing>, std::mutex> listing_;
 };
 }
 }
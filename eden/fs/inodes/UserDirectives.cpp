@@ -0,0 +1,103 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/inodes/UserDirectives.h"
+
+#include <glog/logging.h>
+#include <vector>
+
+namespace facebook {
+namespace eden {
+
+UserDirectives::UserDirectives(Map&& directives)
+    : directives_{std::move(directives)} {
+  for (const auto& entry : directives_) {
+    addToTrie(&entry);
+  }
+}
+
+void UserDirectives::set(
+    RelativePathPiece path,
+    overlay::UserStatusDirective directive) {
+  auto ret = directives_.emplace(path.copy(), directive);
+  if (ret.second) {
+    addToTrie(&*ret.first);
+  } else {
+    ret.first->second = directive;
+  }
+}
+
+UserDirectives::const_iterator UserDirectives::find(
+    RelativePathPiece path) const {
+  const auto* node = findNode(path);
+  if (!node || !node->directive) {
+    return directives_.end();
+  }
+  return directives_.find(node->directive->first);
+}
+
+size_t UserDirectives::erase(RelativePathPiece path) {
+  // Walk down to the node for this path, remembering the way back up so that
+  // nodes left with no directive and no children can be pruned.
+  std::vector<std::pair<Node*, folly::StringPiece>> parents;
+  auto* node = &root_;
+  for (auto name : path.components()) {
+    auto child = node->children.find(name.stringPiece());
+    if (child == node->children.end()) {
+      return 0;
+    }
+    parents.emplace_back(node, name.stringPiece());
+    node = child->second.get();
+  }
+  if (!node->directive) {
+    return 0;
+  }
+
+  auto iter = directives_.find(node->directive->first);
+  CHECK(iter != directives_.end())
+      << "user directive for " << path << " is missing from the map";
+  node->directive = nullptr;
+  directives_.erase(iter);
+
+  while (!parents.empty() && !node->directive && node->children.empty()) {
+    node = parents.back().first;
+    node->children.erase(parents.back().second);
+    parents.pop_back();
+  }
+  return 1;
+}
+
+void UserDirectives::addToTrie(const Map::value_type* directive) {
+  auto* node = &root_;
+  for (auto name : directive->first.components()) {
+    auto child = node->children.find(name.stringPiece());
+    if (child == node->children.end()) {
+      child = node->children
+                  .emplace(name.stringPiece(), std::make_unique<Node>())
+                  .first;
+    }
+    node = child->second.get();
+  }
+  node->directive = directive;
+}
+
+const UserDirectives::Node* UserDirectives::findNode(
+    RelativePathPiece path) const {
+  const auto* node = &root_;
+  for (auto name : path.components()) {
+    auto child = node->children.find(name.stringPiece());
+    if (child == node->children.end()) {
+      return nullptr;
+    }
+    node = child->second.get();
+  }
+  return node;
+}
+}
+}
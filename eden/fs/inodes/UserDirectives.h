@@ -0,0 +1,128 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/experimental/StringKeyedUnorderedMap.h>
+#include <memory>
+#include <unordered_map>
+#include "eden/fs/inodes/gen-cpp2/overlay_types.h"
+#include "eden/utils/PathFuncs.h"
+
+namespace facebook {
+namespace eden {
+
+/**
+ * The `hg add` and `hg rm` directives recorded in the Dirstate.
+ *
+ * Directives are kept in a flat map for lookups by path, and are also indexed
+ * in a trie by directory, so that the directives under a given directory can
+ * be found without scanning all of them.  Dirstate frequently needs these
+ * per-directory queries, and with a flat map alone `hg add` of many files was
+ * quadratic in the number of directives.
+ */
+class UserDirectives {
+ public:
+  using Map = std::unordered_map<RelativePath, overlay::UserStatusDirective>;
+  using const_iterator = Map::const_iterator;
+
+  UserDirectives() {}
+  explicit UserDirectives(Map&& directives);
+
+  UserDirectives(const UserDirectives&) = delete;
+  UserDirectives& operator=(const UserDirectives&) = delete;
+
+  const Map& getMap() const {
+    return directives_;
+  }
+  size_t size() const {
+    return directives_.size();
+  }
+  bool empty() const {
+    return directives_.empty();
+  }
+  const_iterator begin() const {
+    return directives_.begin();
+  }
+  const_iterator end() const {
+    return directives_.end();
+  }
+  const_iterator find(const RelativePath& path) const {
+    return directives_.find(path);
+  }
+
+  /**
+   * Find the directive for a path that is not already a RelativePath.
+   *
+   * Looking up a RelativePathPiece in directives_ would mean copying it into
+   * a temporary RelativePath, so this finds the stored key through the trie
+   * instead, which allocates nothing.
+   */
+  const_iterator find(RelativePathPiece path) const;
+
+  /**
+   * Set the directive for the specified path, replacing any existing one.
+   */
+  void set(RelativePathPiece path, overlay::UserStatusDirective directive);
+
+  /**
+   * Remove the directive for the specified path.
+   *
+   * Returns the number of directives removed (0 or 1).
+   */
+  size_t erase(RelativePathPiece path);
+
+  /**
+   * Call fn(const Map::value_type&) for every directive strictly below the
+   * specified directory.  (This uses the same definition as
+   * RelativePathPiece::isParentDirOf(), so the empty path matches all
+   * directives.)
+   *
+   * This takes time proportional to the size of the subtree under directory,
+   * rather than the total number of directives.
+   */
+  template <typename Fn>
+  void forEachUnder(RelativePathPiece directory, Fn&& fn) const {
+    const auto* node = findNode(directory);
+    if (node) {
+      for (const auto& child : node->children) {
+        visit(child.second.get(), fn);
+      }
+    }
+  }
+
+ private:
+  struct Node {
+    /** The directive at this exact path, if there is one. */
+    const Map::value_type* directive{nullptr};
+    folly::StringKeyedUnorderedMap<std::unique_ptr<Node>> children;
+  };
+
+  void addToTrie(const Map::value_type* directive);
+  const Node* findNode(RelativePathPiece path) const;
+
+  template <typename Fn>
+  static void visit(const Node* node, Fn& fn) {
+    if (node->directive) {
+      fn(*node->directive);
+    }
+    for (const auto& child : node->children) {
+      visit(child.second.get(), fn);
+    }
+  }
+
+  Map directives_;
+  /**
+   * The trie of path components.  Node::directive points into directives_;
+   * this is safe since unordered_map never moves its elements.
+   */
+  Node root_;
+};
+}
+}
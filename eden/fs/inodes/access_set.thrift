@@ -0,0 +1,10 @@
+namespace cpp2 facebook.eden.access
+
+// The files opened for reading while access recording was on, saved so
+// that they can be prefetched later.  The paths are sorted, and each one is
+// stored as the length of the prefix it shares with the previous path,
+// followed by the rest of the path.
+struct SerializedAccessSet {
+  1: list<i32> sharedPrefixLengths
+  2: list<string> suffixes
+}
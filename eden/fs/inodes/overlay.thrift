@@ -25,6 +25,16 @@ struct OverlayDir {
   2: Hash treeHash
 }
 
+// The SHA-1 of a materialized file's contents, kept so that it does not have
+// to be recomputed when the file is next loaded.  It is only trusted while
+// the file still has the size and modification time recorded with it.
+struct OverlayFileSha1 {
+  1: Hash sha1
+  2: i64 size
+  3: i64 mtimeSec
+  4: i64 mtimeNsec
+}
+
 struct OverlayData {
   // A map of RelativePath -> OverlayDir for the entire contents of the
   // overlay area.  The assumption is that the locally materialized data
@@ -41,3 +51,12 @@ enum UserStatusDirective {
 struct DirstateData {
   1: map<RelativePath, UserStatusDirective> directives
 }
+
+// A single change to the user directives, as appended to the dirstate log.
+// If erased is true the directive for path was removed, and directive is
+// not used.
+struct DirstateLogEntry {
+  1: RelativePath path
+  2: UserStatusDirective directive
+  3: bool erased
+}
@@ -0,0 +1,103 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/inodes/AccessRecorder.h"
+
+#include <folly/experimental/TestUtil.h>
+#include <gtest/gtest.h>
+#include <thrift/lib/cpp2/protocol/Serializer.h>
+#include <algorithm>
+#include "eden/fs/inodes/gen-cpp2/access_set_types.h"
+#include "eden/fs/model/Tree.h"
+#include "eden/fs/store/LocalStore.h"
+#include "eden/fs/store/ObjectStore.h"
+#include "eden/fs/testharness/FakeBackingStore.h"
+#include "eden/fs/testharness/StoredObject.h"
+
+using namespace facebook::eden;
+using folly::test::TemporaryDirectory;
+using std::make_shared;
+using std::vector;
+
+TEST(AccessRecorder, recordsOnlyWhileRecording) {
+  AccessRecorder recorder(10);
+  recorder.record(RelativePathPiece{"before"});
+  EXPECT_THROW(recorder.stop(), std::logic_error);
+
+  recorder.start();
+  recorder.record(RelativePathPiece{"src/b.cpp"});
+  recorder.record(RelativePathPiece{"src/a.cpp"});
+  recorder.record(RelativePathPiece{"src/b.cpp"});
+  auto paths = recorder.stop();
+  EXPECT_EQ(
+      (vector<RelativePath>{RelativePath{"src/a.cpp"},
+                            RelativePath{"src/b.cpp"}}),
+      paths);
+  EXPECT_FALSE(recorder.isRecording());
+}
+
+TEST(AccessRecorder, limitsPaths) {
+  AccessRecorder recorder(2);
+  recorder.start();
+  recorder.record(RelativePathPiece{"a"});
+  recorder.record(RelativePathPiece{"b"});
+  recorder.record(RelativePathPiece{"c"});
+  EXPECT_EQ(2, recorder.stop().size());
+}
+
+TEST(AccessRecorder, serializeRoundTrip) {
+  vector<RelativePath> paths{RelativePath{"a/b/c.txt"},
+                             RelativePath{"a/b/d.txt"},
+                             RelativePath{"a/bc"},
+                             RelativePath{"z"}};
+  auto data = AccessRecorder::serialize(paths);
+  EXPECT_EQ(paths, AccessRecorder::deserialize(data));
+  EXPECT_TRUE(AccessRecorder::deserialize(AccessRecorder::serialize({}))
+                  .empty());
+}
+
+TEST(AccessRecorder, deserializeRejectsBadPrefix) {
+  access::SerializedAccessSet saved;
+  saved.sharedPrefixLengths = {0, 5};
+  saved.suffixes = {"abc", "d"};
+  auto data =
+      apache::thrift::CompactSerializer::serialize<std::string>(saved);
+  EXPECT_THROW(AccessRecorder::deserialize(data), std::runtime_error);
+}
+
+TEST(AccessRecorder, resolveBlobs) {
+  TemporaryDirectory testDir("eden_test");
+  auto localStore =
+      make_shared<LocalStore>(AbsolutePathPiece{testDir.path().string()});
+  auto backingStore = make_shared<FakeBackingStore>(localStore);
+  ObjectStore objectStore(localStore, backingStore);
+
+  auto* blob1 = backingStore->putBlob("one");
+  auto* blob2 = backingStore->putBlob("two");
+  auto* blob3 = backingStore->putBlob("three");
+  auto* subTree = backingStore->putTree({{"one.txt", blob1}, {"two", blob2}});
+  auto* rootTree =
+      backingStore->putTree({{"src", subTree}, {"three.txt", blob3}});
+  subTree->setReady();
+  rootTree->setReady();
+
+  auto blobs = AccessRecorder::resolveBlobs(
+                   &objectStore,
+                   rootTree->get().getHash(),
+                   {RelativePath{"missing/file"},
+                    RelativePath{"src"},
+                    RelativePath{"src/two"},
+                    RelativePath{"three.txt"}})
+                   .get();
+  // Directories and paths that no longer exist are skipped.
+  std::sort(blobs.begin(), blobs.end());
+  vector<Hash> expected{blob2->get().getHash(), blob3->get().getHash()};
+  std::sort(expected.begin(), expected.end());
+  EXPECT_EQ(expected, blobs);
+}
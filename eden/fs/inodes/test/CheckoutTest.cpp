@@ -12,6 +12,7 @@
 #include <folly/test/TestUtils.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <algorithm>
 #include "eden/fs/inodes/EdenMount.h"
 #include "eden/fs/inodes/FileInode.h"
 #include "eden/fs/inodes/TreeInode.h"
@@ -573,6 +574,122 @@ TEST(Checkout, removeSubdirectorySimple) {
   }
 }
 
+TEST(Checkout, modifyUnloadedSubdirectory) {
+  auto builder1 = FakeTreeBuilder();
+  builder1.setFile("readme.txt", "just filling out the tree\n");
+  builder1.setFile("src/main.c", "int main() { return 0; }\n");
+  builder1.setFile("src/lib/util.c", "void util() {}\n");
+  TestMount testMount{builder1};
+
+  auto builder2 = builder1.clone();
+  builder2.replaceFile("src/lib/util.c", "void util() { return; }\n");
+  builder2.finalize(testMount.getBackingStore(), true);
+  auto commit2 = testMount.getBackingStore()->putCommit("2", builder2);
+  commit2->setReady();
+
+  // Assign an inode number to src, but do not load it
+  auto srcNumber =
+      testMount.getEdenMount()->getRootInode()->getChildInodeNumber(
+          PathComponentPiece{"src"});
+  auto* inodeMap = testMount.getEdenMount()->getInodeMap();
+  ASSERT_FALSE(inodeMap->lookupLoadedInode(srcNumber));
+
+  auto checkoutResult = testMount.getEdenMount()->checkout(makeTestHash("2"));
+  ASSERT_TRUE(checkoutResult.isReady());
+  EXPECT_EQ(0, checkoutResult.get().size());
+
+  // Checkout should have updated src without loading it,
+  // and it should keep the same inode number.
+  auto stats = testMount.getEdenMount()->getLastCheckoutStats();
+  EXPECT_EQ(1, stats.entriesSwapped);
+  EXPECT_EQ(0, stats.entriesProcessed);
+  EXPECT_FALSE(inodeMap->lookupLoadedInode(srcNumber));
+  EXPECT_EQ(srcNumber, testMount.getTreeInode("src")->getNodeId());
+  EXPECT_FILE_INODE(
+      testMount.getFileInode("src/lib/util.c"),
+      "void util() { return; }\n",
+      0644);
+}
+
+TEST(Checkout, dryRunReportsConflicts) {
+  auto builder1 = FakeTreeBuilder();
+  builder1.setFile("readme.txt", "just filling out the tree\n");
+  builder1.setFile("src/main.c", "int main() { return 0; }\n");
+  builder1.setFile("src/util.c", "void util() {}\n");
+  builder1.setFile("src/gone.c", "void gone() {}\n");
+  builder1.setFile("old/a.txt", "old file\n");
+  TestMount testMount{builder1};
+
+  auto builder2 = builder1.clone();
+  builder2.replaceFile("src/main.c", "int main() { return 1; }\n");
+  builder2.replaceFile("src/util.c", "void util() { return; }\n");
+  builder2.removeFile("src/gone.c");
+  builder2.removeFile("old/a.txt");
+  builder2.setFile("src/new.c", "void new() {}\n");
+  builder2.finalize(testMount.getBackingStore(), true);
+  auto commit2 = testMount.getBackingStore()->putCommit("2", builder2);
+  commit2->setReady();
+
+  testMount.overwriteFile("src/main.c", "int main() { return 2; }\n");
+  testMount.deleteFile("src/util.c");
+  testMount.deleteFile("src/gone.c");
+  testMount.addFile("src/new.c", "untracked\n");
+  testMount.addFile("old/untracked.txt", "untracked\n");
+
+  auto originalSnapshot = testMount.getEdenMount()->getSnapshotID();
+  auto dryRunResult =
+      testMount.getEdenMount()->checkConflicts(makeTestHash("2"));
+  ASSERT_TRUE(dryRunResult.isReady());
+  auto dryRunConflicts = dryRunResult.get();
+  std::vector<CheckoutConflict> expected{
+      makeConflict(ConflictType::DIRECTORY_NOT_EMPTY, "old"),
+      makeConflict(ConflictType::MISSING_REMOVED, "src/gone.c"),
+      makeConflict(ConflictType::MODIFIED, "src/main.c"),
+      makeConflict(ConflictType::UNTRACKED_ADDED, "src/new.c"),
+      makeConflict(ConflictType::REMOVED_MODIFIED, "src/util.c"),
+  };
+  EXPECT_EQ(expected, dryRunConflicts);
+
+  // Nothing was changed.
+  EXPECT_EQ(originalSnapshot, testMount.getEdenMount()->getSnapshotID());
+  EXPECT_FILE_INODE(
+      testMount.getFileInode("src/main.c"),
+      "int main() { return 2; }\n",
+      0644);
+  EXPECT_FALSE(testMount.hasFileAt("src/util.c"));
+
+  // A real checkout finds the same conflicts.
+  auto checkoutResult = testMount.getEdenMount()->checkout(makeTestHash("2"));
+  ASSERT_TRUE(checkoutResult.isReady());
+  auto conflicts = checkoutResult.get();
+  std::sort(
+      conflicts.begin(),
+      conflicts.end(),
+      [](const CheckoutConflict& a, const CheckoutConflict& b) {
+        return a.path < b.path;
+      });
+  EXPECT_EQ(expected, conflicts);
+}
+
+TEST(Checkout, dryRunWithoutChanges) {
+  auto builder1 = FakeTreeBuilder();
+  builder1.setFile("src/main.c", "int main() { return 0; }\n");
+  builder1.setFile("src/util.c", "void util() {}\n");
+  TestMount testMount{builder1};
+
+  auto builder2 = builder1.clone();
+  builder2.replaceFile("src/util.c", "void util() { return; }\n");
+  builder2.finalize(testMount.getBackingStore(), true);
+  auto commit2 = testMount.getBackingStore()->putCommit("2", builder2);
+  commit2->setReady();
+
+  // Files that the new commit does not change do not conflict.
+  testMount.overwriteFile("src/main.c", "int main() { return 2; }\n");
+  auto result = testMount.getEdenMount()->checkConflicts(makeTestHash("2"));
+  ASSERT_TRUE(result.isReady());
+  EXPECT_EQ(0, result.get().size());
+}
+
 // TODO:
 // - remove subdirectory
 //   - with no untracked/ignored files, it should get removed entirely
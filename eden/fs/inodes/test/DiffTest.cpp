@@ -8,6 +8,7 @@
  *
  */
 #include <folly/ExceptionWrapper.h>
+#include <folly/futures/ManualExecutor.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include "eden/fs/inodes/FileInode.h"
@@ -153,9 +154,12 @@ class DiffTest {
     mount_.initialize(builder_);
   }
 
-  DiffResults diff(bool listIgnored = false) {
+  DiffResults diff(
+      bool listIgnored = false,
+      RelativePathPiece prefix = RelativePathPiece{}) {
     DiffResultsCallback callback;
-    auto diffFuture = mount_.getEdenMount()->diff(&callback, listIgnored);
+    auto diffFuture = mount_.getEdenMount()->diff(
+        &callback, listIgnored, nullptr, prefix);
     EXPECT_FUTURE_RESULT(diffFuture);
     return callback.extractResults();
   }
@@ -267,6 +271,28 @@ TEST(DiffTest, fileModified) {
       result.getModified(), UnorderedElementsAre(RelativePath{"src/1.txt"}));
 }
 
+TEST(DiffTest, fileModifiedSameSize) {
+  DiffTest test;
+  // The sizes match, so the contents have to be compared.
+  test.getMount().overwriteFile("src/1.txt", "This is src/X.txt.\n");
+  test.getMount().overwriteFile("src/2.txt", "This is src/2.txt.\n");
+
+  auto result = test.diff();
+  EXPECT_THAT(result.getErrors(), UnorderedElementsAre());
+  EXPECT_THAT(result.getUntracked(), UnorderedElementsAre());
+  EXPECT_THAT(result.getRemoved(), UnorderedElementsAre());
+  EXPECT_THAT(
+      result.getModified(), UnorderedElementsAre(RelativePath{"src/1.txt"}));
+
+  // A repeated diff gives the same answer from the recorded SHA-1s.
+  result = test.diff();
+  EXPECT_THAT(
+      result.getModified(), UnorderedElementsAre(RelativePath{"src/1.txt"}));
+
+  test.getMount().overwriteFile("src/1.txt", "This is src/1.txt.\n");
+  test.checkNoChanges();
+}
+
 TEST(DiffTest, fileModeChanged) {
   DiffTest test;
   test.getMount().chmod("src/2.txt", 0755);
@@ -743,6 +769,168 @@ TEST(DiffTest, ignoreToplevelOnly) {
   EXPECT_THAT(result.getModified(), UnorderedElementsAre());
 }
 
+// Ignored directories should be skipped entirely when listIgnored is false
+TEST(DiffTest, ignoredDirectoriesPruned) {
+  DiffTest test({
+      {".gitignore", "build/\nout\n"},
+      {"src/x.txt", "test\n"},
+      {"out", "tracked file\n"},
+  });
+
+  auto& mount = test.getMount();
+  mount.mkdir("build");
+  mount.mkdir("build/obj");
+  mount.addFile("build/obj/x.o", "object\n");
+  mount.addFile("build/.gitignore", "!x.o\n");
+  mount.deleteFile("out");
+  mount.mkdir("out");
+  mount.addFile("out/log.txt", "log\n");
+
+  auto* edenMount = mount.getEdenMount().get();
+  EXPECT_EQ(0U, edenMount->getDiffIgnoredDirsPruned());
+
+  auto result = test.diff();
+  EXPECT_THAT(result.getErrors(), UnorderedElementsAre());
+  EXPECT_THAT(result.getUntracked(), UnorderedElementsAre());
+  EXPECT_THAT(result.getIgnored(), UnorderedElementsAre());
+  EXPECT_THAT(result.getRemoved(), UnorderedElementsAre(RelativePath{"out"}));
+  EXPECT_THAT(result.getModified(), UnorderedElementsAre());
+  EXPECT_EQ(2U, edenMount->getDiffIgnoredDirsPruned());
+
+  // With listIgnored the directories are walked, and nothing more is pruned.
+  result = test.diff(true);
+  EXPECT_THAT(result.getErrors(), UnorderedElementsAre());
+  EXPECT_THAT(result.getUntracked(), UnorderedElementsAre());
+  EXPECT_THAT(
+      result.getIgnored(),
+      UnorderedElementsAre(
+          RelativePath{"build/.gitignore"},
+          RelativePath{"build/obj/x.o"},
+          RelativePath{"out/log.txt"}));
+  EXPECT_THAT(result.getRemoved(), UnorderedElementsAre(RelativePath{"out"}));
+  EXPECT_THAT(result.getModified(), UnorderedElementsAre());
+  EXPECT_EQ(2U, edenMount->getDiffIgnoredDirsPruned());
+}
+
+TEST(DiffTest, cachedCleanDirectories) {
+  DiffTest test({
+      {"src/a/x.txt", "x\n"},
+      {"src/b/y.txt", "y\n"},
+      {"top.txt", "top\n"},
+  });
+
+  // Materialize some files without changing their contents, so that the
+  // diff has to descend into their directories.
+  auto& mount = test.getMount();
+  mount.overwriteFile("src/a/x.txt", "x\n");
+  mount.overwriteFile("src/b/y.txt", "y\n");
+  auto* edenMount = mount.getEdenMount().get();
+
+  auto result = test.diff();
+  EXPECT_THAT(result.getErrors(), UnorderedElementsAre());
+  EXPECT_THAT(result.getModified(), UnorderedElementsAre());
+  EXPECT_EQ(0U, edenMount->getDiffCachedDirsSkipped());
+
+  // Nothing has changed, so the second diff is answered at the root.
+  result = test.diff();
+  EXPECT_THAT(result.getErrors(), UnorderedElementsAre());
+  EXPECT_THAT(result.getModified(), UnorderedElementsAre());
+  EXPECT_EQ(1U, edenMount->getDiffCachedDirsSkipped());
+
+  // A change to src/b/y.txt invalidates src/b and its ancestors, but src/a
+  // can still be skipped.
+  mount.overwriteFile("src/b/y.txt", "changed\n");
+  result = test.diff();
+  EXPECT_THAT(result.getErrors(), UnorderedElementsAre());
+  EXPECT_THAT(
+      result.getModified(), UnorderedElementsAre(RelativePath{"src/b/y.txt"}));
+  EXPECT_EQ(2U, edenMount->getDiffCachedDirsSkipped());
+
+  // A directory with differences is never cached.
+  result = test.diff();
+  EXPECT_THAT(
+      result.getModified(), UnorderedElementsAre(RelativePath{"src/b/y.txt"}));
+  EXPECT_EQ(3U, edenMount->getDiffCachedDirsSkipped());
+
+  // Untracked files are reported even after the directory was cached.
+  mount.overwriteFile("src/b/y.txt", "y\n");
+  mount.addFile("src/a/new.txt", "new\n");
+  result = test.diff();
+  EXPECT_THAT(result.getErrors(), UnorderedElementsAre());
+  EXPECT_THAT(
+      result.getUntracked(),
+      UnorderedElementsAre(RelativePath{"src/a/new.txt"}));
+  EXPECT_THAT(result.getModified(), UnorderedElementsAre());
+}
+
+TEST(DiffTest, diffPrefix) {
+  DiffTest test({
+      {".gitignore", "*.log\n"},
+      {"src/1.txt", "1\n"},
+      {"src/a/b/3.txt", "3\n"},
+      {"src/a/b/c/4.txt", "4\n"},
+      {"doc/readme.txt", "readme\n"},
+      {"toplevel.txt", "toplevel\n"},
+  });
+  auto& mount = test.getMount();
+  mount.overwriteFile("src/1.txt", "changed\n");
+  mount.deleteFile("src/a/b/c/4.txt");
+  mount.rmdir("src/a/b/c");
+  mount.addFile("src/a/b/new.txt", "new\n");
+  mount.addFile("src/a/b/build.log", "log\n");
+  mount.addFile("top.txt", "new\n");
+  mount.deleteFile("doc/readme.txt");
+  mount.rmdir("doc");
+
+  auto result = test.diff(false, RelativePathPiece{"src/a"});
+  EXPECT_THAT(result.getErrors(), UnorderedElementsAre());
+  EXPECT_THAT(
+      result.getUntracked(),
+      UnorderedElementsAre(RelativePath{"src/a/b/new.txt"}));
+  // The ignore rules of the directories above the prefix still apply.
+  EXPECT_THAT(result.getIgnored(), UnorderedElementsAre());
+  EXPECT_THAT(
+      result.getRemoved(),
+      UnorderedElementsAre(RelativePath{"src/a/b/c/4.txt"}));
+  EXPECT_THAT(result.getModified(), UnorderedElementsAre());
+
+  result = test.diff(true, RelativePathPiece{"src/a/b/build.log"});
+  EXPECT_THAT(result.getUntracked(), UnorderedElementsAre());
+  EXPECT_THAT(
+      result.getIgnored(),
+      UnorderedElementsAre(RelativePath{"src/a/b/build.log"}));
+
+  result = test.diff(false, RelativePathPiece{"src/1.txt"});
+  EXPECT_THAT(result.getUntracked(), UnorderedElementsAre());
+  EXPECT_THAT(result.getRemoved(), UnorderedElementsAre());
+  EXPECT_THAT(
+      result.getModified(), UnorderedElementsAre(RelativePath{"src/1.txt"}));
+
+  // A prefix whose directory was removed still reports what is inside it.
+  result = test.diff(false, RelativePathPiece{"doc"});
+  EXPECT_THAT(result.getUntracked(), UnorderedElementsAre());
+  EXPECT_THAT(
+      result.getRemoved(),
+      UnorderedElementsAre(RelativePath{"doc/readme.txt"}));
+  EXPECT_THAT(result.getModified(), UnorderedElementsAre());
+
+  // A scoped diff does not let a later full diff skip the directories it
+  // only partly examined.
+  mount.overwriteFile("src/1.txt", "1\n");
+  test.diff(false, RelativePathPiece{"src/a"});
+  result = test.diff();
+  EXPECT_THAT(result.getErrors(), UnorderedElementsAre());
+  EXPECT_THAT(
+      result.getUntracked(),
+      UnorderedElementsAre(
+          RelativePath{"src/a/b/new.txt"}, RelativePath{"top.txt"}));
+  EXPECT_THAT(
+      result.getRemoved(),
+      UnorderedElementsAre(
+          RelativePath{"src/a/b/c/4.txt"}, RelativePath{"doc/readme.txt"}));
+  EXPECT_THAT(result.getModified(), UnorderedElementsAre());
+}
+
 // Test with a .gitignore file in the top-level directory
 TEST(DiffTest, ignoreInSubdirectories) {
   DiffTest test({
@@ -984,3 +1172,71 @@ TEST(DiffTest, ignoreHidden) {
   EXPECT_THAT(
       result.getModified(), UnorderedElementsAre(RelativePath{"a/c/1.txt"}));
 }
+
+TEST(DiffTest, diffOnExecutor) {
+  DiffTest test;
+  test.getMount().overwriteFile("src/1.txt", "This file has been updated.\n");
+  test.getMount().overwriteFile("src/a/b/c/4.txt", "updated 4.txt\n");
+  test.getMount().addFile("src/a/b/new.txt", "extra stuff");
+  test.getMount().deleteFile("doc/readme.txt");
+
+  // Deferred work for each directory is started on the executor, so the
+  // diff cannot complete until the executor runs it.
+  folly::ManualExecutor executor;
+  DiffResultsCallback callback;
+  auto diffFuture =
+      test.getMount().getEdenMount()->diff(&callback, false, &executor);
+  EXPECT_FALSE(diffFuture.isReady());
+  for (int n = 0; n < 100 && !diffFuture.isReady(); ++n) {
+    executor.run();
+  }
+  EXPECT_FUTURE_RESULT(diffFuture);
+
+  auto result = callback.extractResults();
+  EXPECT_THAT(result.getErrors(), UnorderedElementsAre());
+  EXPECT_THAT(
+      result.getUntracked(),
+      UnorderedElementsAre(RelativePath{"src/a/b/new.txt"}));
+  EXPECT_THAT(result.getIgnored(), UnorderedElementsAre());
+  EXPECT_THAT(
+      result.getRemoved(),
+      UnorderedElementsAre(RelativePath{"doc/readme.txt"}));
+  EXPECT_THAT(
+      result.getModified(),
+      UnorderedElementsAre(
+          RelativePath{"src/1.txt"}, RelativePath{"src/a/b/c/4.txt"}));
+}
+
+TEST(DiffTest, diffCommits) {
+  DiffTest test;
+  auto& mount = test.getMount();
+  auto fromCommit = mount.getEdenMount()->getSnapshotID();
+
+  auto b2 = test.getBuilder().clone();
+  b2.replaceFile("src/1.txt", "This file has been updated.\n");
+  b2.replaceFile("src/2.txt", "This is src/2.txt.\n", 0755);
+  b2.removeFile("src/a/b/c/4.txt");
+  b2.setFile("src/x/y.txt", "new file\n");
+  Hash toCommit{"0123456789abcdef0123456789abcdef01234567"};
+  mount.resetCommit(toCommit, b2, true);
+
+  // Local changes to the working directory should not affect the results.
+  mount.addFile("src/untracked.txt", "untracked\n");
+
+  DiffResultsCallback callback;
+  auto diffFuture =
+      mount.getEdenMount()->diffCommits(fromCommit, toCommit, &callback);
+  EXPECT_FUTURE_RESULT(diffFuture);
+  auto result = callback.extractResults();
+  EXPECT_THAT(result.getErrors(), UnorderedElementsAre());
+  EXPECT_THAT(
+      result.getUntracked(), UnorderedElementsAre(RelativePath{"src/x/y.txt"}));
+  EXPECT_THAT(result.getIgnored(), UnorderedElementsAre());
+  EXPECT_THAT(
+      result.getRemoved(),
+      UnorderedElementsAre(RelativePath{"src/a/b/c/4.txt"}));
+  EXPECT_THAT(
+      result.getModified(),
+      UnorderedElementsAre(
+          RelativePath{"src/1.txt"}, RelativePath{"src/2.txt"}));
+}
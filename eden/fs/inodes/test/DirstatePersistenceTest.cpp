@@ -7,6 +7,7 @@
  *  of patent rights can be found in the PATENTS file in the same directory.
  *
  */
+#include <boost/filesystem.hpp>
 #include <folly/FileUtil.h>
 #include <folly/experimental/TestUtil.h>
 #include <gtest/gtest.h>
@@ -16,6 +17,7 @@
 
 using namespace facebook::eden;
 using apache::thrift::CompactSerializer;
+using folly::test::TemporaryDirectory;
 using folly::test::TemporaryFile;
 
 TEST(DirstatePersistence, saveAndReadDirectivesBackOut) {
@@ -66,3 +68,63 @@ TEST(DirstatePersistence, attemptLoadFromNonExistentFile) {
   auto directives = persistence.load();
   EXPECT_EQ(0, directives.size());
 }
+
+TEST(DirstatePersistence, appendChangesToLog) {
+  TemporaryDirectory dir("eden_test");
+  AbsolutePath storageFilePath((dir.path() / "dirstate").c_str());
+  std::unordered_map<RelativePath, overlay::UserStatusDirective>
+      userDirectives = {
+          {RelativePath("add.txt"), overlay::UserStatusDirective::Add},
+          {RelativePath("remove.txt"), overlay::UserStatusDirective::Remove},
+      };
+  {
+    DirstatePersistence persistence(storageFilePath);
+    persistence.save(userDirectives);
+
+    userDirectives.erase(RelativePath("add.txt"));
+    userDirectives[RelativePath("new.txt")] = overlay::UserStatusDirective::Add;
+    persistence.append(
+        {DirstatePersistence::makeEraseEntry(RelativePathPiece("add.txt")),
+         DirstatePersistence::makeSetEntry(
+             RelativePathPiece("new.txt"), overlay::UserStatusDirective::Add)},
+        userDirectives);
+  }
+
+  // The snapshot is unchanged, and the changes are read back from the log.
+  DirstatePersistence persistence(storageFilePath);
+  EXPECT_EQ(userDirectives, persistence.load());
+  EXPECT_TRUE(boost::filesystem::exists(dir.path() / "dirstate.log"));
+
+  // Saving a snapshot discards the log.
+  persistence.save(userDirectives);
+  EXPECT_FALSE(boost::filesystem::exists(dir.path() / "dirstate.log"));
+  EXPECT_EQ(userDirectives, DirstatePersistence(storageFilePath).load());
+}
+
+TEST(DirstatePersistence, ignorePartialLogRecord) {
+  TemporaryDirectory dir("eden_test");
+  AbsolutePath storageFilePath((dir.path() / "dirstate").c_str());
+  std::unordered_map<RelativePath, overlay::UserStatusDirective>
+      userDirectives = {
+          {RelativePath("add.txt"), overlay::UserStatusDirective::Add},
+      };
+  {
+    DirstatePersistence persistence(storageFilePath);
+    persistence.append(
+        {DirstatePersistence::makeSetEntry(
+            RelativePathPiece("add.txt"), overlay::UserStatusDirective::Add)},
+        userDirectives);
+  }
+
+  // Simulate a crash partway through appending another record.
+  auto logPath = (dir.path() / "dirstate.log").string();
+  std::string logData;
+  ASSERT_TRUE(folly::readFile(logPath.c_str(), logData));
+  logData.append(logData.substr(0, logData.size() - 1));
+  ASSERT_TRUE(folly::writeFile(logData, logPath.c_str()));
+
+  EXPECT_EQ(userDirectives, DirstatePersistence(storageFilePath).load());
+  // The partial record was compacted away, so later appends are readable.
+  EXPECT_FALSE(boost::filesystem::exists(logPath));
+  EXPECT_EQ(userDirectives, DirstatePersistence(storageFilePath).load());
+}
@@ -8,12 +8,15 @@
  *
  */
 
+#include <folly/Conv.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include "eden/fs/inodes/Dirstate.h"
 #include "eden/fs/service/PrettyPrinters.h"
+#include "eden/fs/testharness/FakeBackingStore.h"
 #include "eden/fs/testharness/FakeTreeBuilder.h"
 #include "eden/fs/testharness/TestMount.h"
+#include "eden/fs/testharness/TestUtil.h"
 
 using namespace facebook::eden;
 using ::testing::UnorderedElementsAre;
@@ -863,3 +866,121 @@ TEST(Dirstate, checkRemovingDotEden) {
                              "foo/.eden/socket: cannot be part of a commit"});
   verifyEmptyDirstate(dirstate);
 }
+
+TEST(Dirstate, statusIsUpdatedAsFilesChange) {
+  FakeTreeBuilder builder;
+  builder.setFiles({
+      {".gitignore", "*.log\n"}, {"src/a.c", "a\n"}, {"src/b.c", "b\n"},
+  });
+  TestMount testMount{builder};
+  auto dirstate = testMount.getDirstate();
+  verifyEmptyDirstate(dirstate);
+
+  // After the first status, later calls only recheck the files that the
+  // journal says have changed.  They must still give the same results that a
+  // full diff would.
+  testMount.overwriteFile("src/a.c", "changed\n");
+  testMount.deleteFile("src/b.c");
+  testMount.addFile("src/new.c", "new\n");
+  testMount.addFile("src/build.log", "log\n");
+  verifyExpectedDirstate(
+      dirstate,
+      {
+          {"src/a.c", StatusCode::MODIFIED},
+          {"src/b.c", StatusCode::MISSING},
+          {"src/build.log", StatusCode::IGNORED},
+          {"src/new.c", StatusCode::NOT_TRACKED},
+      });
+
+  // Renames are recorded for both the old and the new name.
+  testMount.overwriteFile("src/a.c", "a\n");
+  auto src = testMount.getTreeInode("src");
+  src->rename(PathComponentPiece{"new.c"}, src, PathComponentPiece{"b.c"})
+      .get();
+  verifyExpectedDirstate(
+      dirstate,
+      {
+          {"src/b.c", StatusCode::MODIFIED},
+          {"src/build.log", StatusCode::IGNORED},
+      });
+  EXPECT_EQ(
+      (std::map<std::string, StatusCode>{{"src/b.c", StatusCode::MODIFIED}}),
+      dirstate->getStatus(false).entries);
+}
+
+TEST(Dirstate, streamStatusSendsBatches) {
+  FakeTreeBuilder builder;
+  builder.setFiles({{"src/a.c", "a\n"}, {"src/b.c", "b\n"}});
+  TestMount testMount{builder};
+  auto dirstate = testMount.getDirstate();
+
+  testMount.overwriteFile("src/a.c", "changed\n");
+  testMount.deleteFile("src/b.c");
+  for (int n = 0; n < 5; ++n) {
+    testMount.addFile(folly::to<std::string>("src/new", n, ".c"), "new\n");
+  }
+
+  std::vector<std::map<std::string, StatusCode>> batches;
+  dirstate
+      ->streamStatus(
+          false,
+          3,
+          [&](ThriftHgStatus&& batch) {
+            batches.push_back(std::move(batch.entries));
+          })
+      .get();
+
+  // Every entry is sent exactly once, in batches of no more than 3.
+  std::map<std::string, StatusCode> combined;
+  for (const auto& batch : batches) {
+    EXPECT_LE(batch.size(), 3);
+    EXPECT_FALSE(batch.empty());
+    for (const auto& entry : batch) {
+      EXPECT_TRUE(combined.insert(entry).second) << entry.first;
+    }
+  }
+  EXPECT_EQ(3, batches.size());
+  EXPECT_EQ(dirstate->getStatus(false).entries, combined);
+}
+
+TEST(Dirstate, markCommittedDematerializesCommittedFiles) {
+  FakeTreeBuilder builder;
+  builder.setFile("src/main.c", "int main() { return 0; }\n");
+  builder.setFile("src/test.c", "testy tests");
+  builder.setFile("docs/readme.txt", "read me");
+  TestMount testMount{builder};
+  auto dirstate = testMount.getDirstate();
+
+  testMount.overwriteFile("src/test.c", "changed");
+  testMount.addFile("src/new.c", "new");
+  scmAddFile(dirstate, "src/new.c");
+  testMount.overwriteFile("docs/readme.txt", "read me too");
+  testMount.addFile("docs/notes.txt", "not committed");
+
+  auto commitBuilder = builder.clone();
+  commitBuilder.replaceFile("src/test.c", "changed");
+  commitBuilder.setFile("src/new.c", "new");
+  commitBuilder.replaceFile("docs/readme.txt", "read me too");
+  auto* rootTree = commitBuilder.finalize(testMount.getBackingStore(), true);
+  auto commitHash = makeTestHash("2");
+  testMount.getBackingStore()
+      ->putCommit(commitHash, rootTree->get().getHash())
+      ->setReady();
+
+  // The committed files are hashed as needed and dematerialized, and src
+  // then matches the commit too.  docs still has an untracked file, so it
+  // stays materialized, but refers to its committed Tree.
+  dirstate->markCommitted(commitHash, {RelativePathPiece{"src/new.c"}}, {});
+  EXPECT_TRUE(testMount.getFileInode("src/test.c")->getBlobHash().hasValue());
+  EXPECT_TRUE(testMount.getFileInode("src/new.c")->getBlobHash().hasValue());
+  EXPECT_TRUE(
+      testMount.getFileInode("docs/readme.txt")->getBlobHash().hasValue());
+  auto src = testMount.getTreeInode("src");
+  EXPECT_FALSE(src->getContents().rlock()->materialized);
+  auto docs = testMount.getTreeInode("docs");
+  EXPECT_TRUE(docs->getContents().rlock()->materialized);
+  EXPECT_EQ(
+      rootTree->get().getEntryPtr(PathComponentPiece{"docs"})->getHash(),
+      docs->getContents().rlock()->treeHash.value());
+  EXPECT_EQ(commitHash, testMount.getEdenMount()->getConfig()->getSnapshotID());
+}
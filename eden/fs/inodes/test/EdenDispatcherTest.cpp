@@ -0,0 +1,65 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/inodes/EdenDispatcher.h"
+
+#include <gtest/gtest.h>
+#include "eden/fs/inodes/EdenMount.h"
+#include "eden/fs/inodes/TreeInode.h"
+#include "eden/fs/testharness/FakeTreeBuilder.h"
+#include "eden/fs/testharness/TestMount.h"
+
+using namespace facebook::eden;
+
+TEST(EdenDispatcher, lookupExistingEntry) {
+  FakeTreeBuilder builder;
+  builder.setFiles({{"src/main.c", "int main() { return 0; }\n"}});
+  TestMount testMount{builder};
+  auto* dispatcher = testMount.getEdenMount()->getDispatcher();
+
+  auto entry =
+      dispatcher->lookup(FUSE_ROOT_ID, PathComponentPiece{"src"}).get();
+  EXPECT_NE(0, entry.ino);
+  EXPECT_TRUE(S_ISDIR(entry.attr.st_mode));
+}
+
+TEST(EdenDispatcher, lookupMissingEntryIsNegative) {
+  FakeTreeBuilder builder;
+  builder.setFiles({{"src/main.c", "int main() { return 0; }\n"}});
+  TestMount testMount{builder};
+  auto* dispatcher = testMount.getEdenMount()->getDispatcher();
+  auto src = testMount.getTreeInode("src");
+
+  auto entry =
+      dispatcher->lookup(src->getNodeId(), PathComponentPiece{"main.h"}).get();
+  EXPECT_EQ(0, entry.ino);
+  EXPECT_EQ(src->getNegativeEntryTtl(), entry.entry_timeout);
+  EXPECT_GT(entry.entry_timeout, 0);
+}
+
+TEST(EdenDispatcher, lookupOfLoadedEntryIsReady) {
+  FakeTreeBuilder builder;
+  builder.setFiles({{"src/main.c", "int main() { return 0; }\n"}});
+  TestMount testMount{builder};
+  auto* dispatcher = testMount.getEdenMount()->getDispatcher();
+  auto src = testMount.getTreeInode("src");
+  EXPECT_EQ(nullptr, src->getLoadedChild(PathComponentPiece{"main.c"}));
+
+  auto file = testMount.getFileInode("src/main.c");
+  EXPECT_EQ(file, src->getLoadedChild(PathComponentPiece{"main.c"}));
+
+  auto entryFuture =
+      dispatcher->lookup(src->getNodeId(), PathComponentPiece{"main.c"});
+  ASSERT_TRUE(entryFuture.isReady());
+  EXPECT_EQ(file->getNodeId(), entryFuture.get().ino);
+
+  auto attrFuture = dispatcher->getattr(file->getNodeId());
+  ASSERT_TRUE(attrFuture.isReady());
+  EXPECT_EQ(file->getNodeId(), attrFuture.get().st.st_ino);
+}
@@ -14,6 +14,9 @@
 #include "eden/fs/inodes/TreeInode.h"
 #include "eden/fs/journal/Journal.h"
 #include "eden/fs/journal/JournalDelta.h"
+#include "eden/fs/model/Blob.h"
+#include "eden/fs/store/LocalStore.h"
+#include "eden/fs/store/ObjectStore.h"
 #include "eden/fs/testharness/FakeBackingStore.h"
 #include "eden/fs/testharness/FakeTreeBuilder.h"
 #include "eden/fs/testharness/TestChecks.h"
@@ -47,7 +50,7 @@ TEST(EdenMount, resetCommit) {
   const auto& edenMount = testMount.getEdenMount();
   EXPECT_EQ(makeTestHash("1"), edenMount->getSnapshotID());
   EXPECT_EQ(makeTestHash("1"), edenMount->getConfig()->getSnapshotID());
-  auto latestJournalEntry = edenMount->getJournal()->getLatest();
+  auto latestJournalEntry = edenMount->getJournal().getLatest();
   EXPECT_EQ(makeTestHash("1"), latestJournalEntry->fromHash);
   EXPECT_EQ(makeTestHash("1"), latestJournalEntry->toHash);
   EXPECT_FILE_INODE(testMount.getFileInode("src/test.c"), "testy tests", 0644);
@@ -58,7 +61,7 @@ TEST(EdenMount, resetCommit) {
   // The snapshot ID should be updated, both in memory and on disk
   EXPECT_EQ(makeTestHash("2"), edenMount->getSnapshotID());
   EXPECT_EQ(makeTestHash("2"), edenMount->getConfig()->getSnapshotID());
-  latestJournalEntry = edenMount->getJournal()->getLatest();
+  latestJournalEntry = edenMount->getJournal().getLatest();
   EXPECT_EQ(makeTestHash("1"), latestJournalEntry->fromHash);
   EXPECT_EQ(makeTestHash("2"), latestJournalEntry->toHash);
   // The file contents should not have changed.
@@ -67,5 +70,79 @@ TEST(EdenMount, resetCommit) {
   EXPECT_FILE_INODE(testMount.getFileInode("src/test.c"), "testy tests", 0644);
   EXPECT_FALSE(testMount.hasFileAt("src/extra.h"));
 }
+
+TEST(EdenMount, dematerializeUnchangedFiles) {
+  FakeTreeBuilder builder;
+  builder.setFile("src/main.c", "int main() { return 0; }\n");
+  builder.setFile("src/test.c", "testy tests");
+  TestMount testMount{builder};
+  const auto& edenMount = testMount.getEdenMount();
+  auto isMaterialized = [&](folly::StringPiece path) {
+    return testMount.getTreeInode(path)->getContents().rlock()->materialized;
+  };
+
+  // Rewrite one file with its original contents, and change the other.
+  // Computing the SHA-1s, as a status would, is what makes them comparable.
+  testMount.overwriteFile("src/main.c", "int main() { return 0; }\n");
+  testMount.overwriteFile("src/test.c", "changed");
+  auto mainFile = testMount.getFileInode("src/main.c");
+  auto testFile = testMount.getFileInode("src/test.c");
+  EXPECT_FALSE(mainFile->getBlobHash().hasValue());
+  mainFile->getSHA1().get();
+  testFile->getSHA1().get();
+
+  EXPECT_EQ(1, edenMount->dematerializeUnchangedFiles());
+  EXPECT_TRUE(mainFile->getBlobHash().hasValue());
+  EXPECT_FALSE(testFile->getBlobHash().hasValue());
+  EXPECT_FILE_INODE(mainFile, "int main() { return 0; }\n", 0644);
+  // src still has a modified file, so it stays materialized.
+  EXPECT_TRUE(isMaterialized("src"));
+
+  // Once the other file is restored too, src matches source control again.
+  testMount.overwriteFile("src/test.c", "testy tests");
+  testFile->getSHA1().get();
+  EXPECT_EQ(2, edenMount->dematerializeUnchangedFiles());
+  EXPECT_TRUE(testFile->getBlobHash().hasValue());
+  EXPECT_FALSE(isMaterialized("src"));
+  EXPECT_FILE_INODE(testFile, "testy tests", 0644);
+}
+
+TEST(EdenMount, storeWorkingCopySnapshot) {
+  FakeTreeBuilder builder;
+  builder.setFile("src/main.c", "int main() { return 0; }\n");
+  builder.setFile("docs/readme.txt", "read me");
+  TestMount testMount{builder};
+  const auto& edenMount = testMount.getEdenMount();
+
+  testMount.overwriteFile("src/main.c", "int main() { return 1; }\n");
+  testMount.addFile("src/new.c", "new");
+  testMount.mkdir(".hg");
+  testMount.addFile(".hg/dirstate", "");
+
+  auto rootID = edenMount->storeWorkingCopySnapshot().get();
+  const auto& localStore = edenMount->getObjectStore()->getLocalStore();
+  auto root = localStore->getTree(rootID);
+  ASSERT_TRUE(root);
+  EXPECT_FALSE(root->getEntryPtr(PathComponentPiece{".hg"}));
+  // docs is unmodified, so it is stored as the Tree it already refers to.
+  EXPECT_EQ(
+      testMount.getTreeInode("docs")->getContents().rlock()->treeHash.value(),
+      root->getEntryAt(PathComponentPiece{"docs"}).getHash());
+
+  auto src = localStore->getTree(
+      root->getEntryAt(PathComponentPiece{"src"}).getHash());
+  ASSERT_TRUE(src);
+  EXPECT_EQ(2, src->getTreeEntries().size());
+  auto blob = localStore->getBlob(
+      src->getEntryAt(PathComponentPiece{"main.c"}).getHash());
+  ASSERT_TRUE(blob);
+  EXPECT_EQ(
+      "int main() { return 1; }\n",
+      blob->getContents().clone()->moveToFbString().toStdString());
+  // New files get the blob IDs git would give them.
+  EXPECT_EQ(
+      Hash{"3e5126c4e761fd09582fc517918a1601b218dff0"},
+      src->getEntryAt(PathComponentPiece{"new.c"}).getHash());
+}
 }
 }
@@ -0,0 +1,316 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/inodes/FileData.h"
+
+#include <folly/Conv.h>
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <map>
+#include "common/stats/ServiceData.h"
+#include "eden/fs/inodes/EdenMount.h"
+#include "eden/fs/inodes/FileHandle.h"
+#include "eden/fs/inodes/FileInode.h"
+#include "eden/fs/inodes/Overlay.h"
+#include "eden/fs/model/Hash.h"
+#include "eden/fs/testharness/FakeTreeBuilder.h"
+#include "eden/fs/testharness/TestMount.h"
+#include "eden/fuse/fuse_headers.h"
+
+DECLARE_int64(overlay_cow_min_size);
+DECLARE_int64(overlay_dedupe_min_size);
+DECLARE_int64(overlay_write_buffer_size);
+
+using namespace facebook::eden;
+using folly::StringPiece;
+
+namespace {
+int64_t getCounter(StringPiece name) {
+  std::map<std::string, int64_t> counters;
+  facebook::fbData->getCounters(counters);
+  return counters[name.str()];
+}
+
+std::string makeContents(size_t size) {
+  std::string contents;
+  contents.reserve(size);
+  for (size_t n = 0; n < size; ++n) {
+    contents.push_back('a' + (n % 26));
+  }
+  return contents;
+}
+}
+
+TEST(FileData, copyOnWriteMaterialization) {
+  gflags::FlagSaver flagSaver;
+  FLAGS_overlay_cow_min_size = 1;
+
+  // Large enough to span several filesystem blocks
+  auto contents = makeContents(100000);
+  FakeTreeBuilder builder;
+  builder.setFile("big.txt", contents);
+  TestMount testMount{builder};
+
+  auto file = testMount.getFileInode("big.txt");
+  auto data = file->getOrLoadData();
+  data->materializeForWrite(O_WRONLY).get();
+  EXPECT_EQ(contents, data->readAll());
+
+  // Writes replace just the data they cover, even within a block.
+  data->write(StringPiece{"XY"}, 5000);
+  contents.replace(5000, 2, "XY");
+  data->write(StringPiece{"end\n"}, contents.size());
+  contents.append("end\n");
+  EXPECT_EQ(contents, data->readAll());
+  EXPECT_EQ(contents.size(), data->stat().st_size);
+  EXPECT_EQ(
+      Hash::sha1(folly::ByteRange{StringPiece{contents}}), data->getSha1());
+
+  // Reads spanning written and unwritten ranges
+  auto buf = data->readIntoBuffer(100, 4950);
+  EXPECT_EQ(contents.substr(4950, 100), buf->moveToFbString().toStdString());
+
+  // Shrinking the file and then growing it again reads zeros in the new part,
+  // not the old contents.
+  struct stat attr;
+  attr.st_size = 1000;
+  data->setAttr(attr, FUSE_SET_ATTR_SIZE);
+  attr.st_size = 2000;
+  data->setAttr(attr, FUSE_SET_ATTR_SIZE);
+  contents = contents.substr(0, 1000) + std::string(1000, '\0');
+  EXPECT_EQ(contents, data->readAll());
+}
+
+TEST(FileData, truncateDoesNotLoadBlob) {
+  FakeTreeBuilder builder;
+  builder.setFile("obj/a.o", "old contents\n");
+  builder.setFile("obj/b.o", "old contents\n");
+  // Only the trees are made ready, so anything that tries to load either
+  // blob will not complete.
+  TestMount testMount{builder, false};
+  builder.setReady("");
+  builder.setReady("obj");
+
+  fuse_file_info fi = {};
+  fi.flags = O_WRONLY | O_TRUNC;
+  auto file = testMount.getFileInode("obj/a.o");
+  auto handleFuture = file->open(fi);
+  ASSERT_TRUE(handleFuture.isReady());
+  auto handle = handleFuture.get();
+  handle->write(StringPiece{"new\n"}, 0).get();
+  EXPECT_EQ("new\n", file->getOrLoadData()->readAll());
+
+  // Opening write-only and then truncating with ftruncate() does not load
+  // the blob either.
+  fi.flags = O_WRONLY;
+  file = testMount.getFileInode("obj/b.o");
+  handleFuture = file->open(fi);
+  ASSERT_TRUE(handleFuture.isReady());
+  handle = handleFuture.get();
+  struct stat attr = {};
+  attr.st_size = 0;
+  auto attrFuture = handle->setattr(attr, FUSE_SET_ATTR_SIZE);
+  ASSERT_TRUE(attrFuture.isReady());
+  EXPECT_EQ(0, attrFuture.get().st.st_size);
+  handle->write(StringPiece{"new\n"}, 0).get();
+  EXPECT_EQ("new\n", file->getOrLoadData()->readAll());
+}
+
+TEST(FileData, sha1IsSavedInOverlay) {
+  FakeTreeBuilder builder;
+  builder.setFile("src/a.c", "a\n");
+  TestMount testMount{builder};
+  testMount.addFile("src/new.c", "");
+  auto file = testMount.getFileInode("src/new.c");
+  auto data = file->getOrLoadData();
+  const auto& overlay = testMount.getEdenMount()->getOverlay();
+  auto overlayStat = [&] {
+    struct stat st;
+    EXPECT_EQ(0, ::stat(file->getLocalPath().value().c_str(), &st));
+    return st;
+  };
+
+  // Sequential writes are hashed as they are written, so the SHA-1 can be
+  // saved when the file is closed without reading it back.
+  std::string contents;
+  for (int n = 0; n < 100; ++n) {
+    auto line = folly::to<std::string>("line ", n, "\n");
+    data->write(StringPiece{line}, contents.size());
+    contents += line;
+  }
+  data->flush(0);
+  auto expected = Hash::sha1(folly::ByteRange{StringPiece{contents}});
+  auto saved = overlay->loadFileSha1(file->getNodeId(), overlayStat());
+  ASSERT_TRUE(saved.hasValue());
+  EXPECT_EQ(expected, saved.value());
+  EXPECT_EQ(expected, data->getSha1());
+
+  // Overwriting part of the file removes the saved SHA-1 straight away.
+  data->write(StringPiece{"LINE"}, 0);
+  contents.replace(0, 4, "LINE");
+  EXPECT_FALSE(
+      overlay->loadFileSha1(file->getNodeId(), overlayStat()).hasValue());
+  EXPECT_EQ(
+      Hash::sha1(folly::ByteRange{StringPiece{contents}}), data->getSha1());
+
+  // The saved SHA-1 is only valid for the size it was saved with.
+  auto st = overlayStat();
+  ASSERT_TRUE(overlay->loadFileSha1(file->getNodeId(), st).hasValue());
+  st.st_size += 1;
+  EXPECT_FALSE(overlay->loadFileSha1(file->getNodeId(), st).hasValue());
+}
+
+TEST(FileData, smallWritesAreBuffered) {
+  gflags::FlagSaver flagSaver;
+  FLAGS_overlay_write_buffer_size = 64;
+
+  FakeTreeBuilder builder;
+  builder.setFile("src/a.c", "a\n");
+  TestMount testMount{builder};
+  testMount.addFile("src/new.c", "");
+  auto file = testMount.getFileInode("src/new.c");
+  auto data = file->getOrLoadData();
+  auto overlaySize = [&] {
+    struct stat st;
+    EXPECT_EQ(0, ::stat(file->getLocalPath().value().c_str(), &st));
+    return st.st_size;
+  };
+
+  // Sequential small writes stay in memory until the buffer fills up, or
+  // something looks at the file.
+  std::string contents;
+  for (int n = 0; n < 9; ++n) {
+    data->write(StringPiece{"0123456"}, contents.size());
+    contents += "0123456";
+  }
+  EXPECT_EQ(0, overlaySize());
+  EXPECT_EQ(63, data->stat().st_size);
+  EXPECT_EQ(63, overlaySize());
+  for (int n = 0; n < 10; ++n) {
+    data->write(StringPiece{"0123456"}, contents.size());
+    contents += "0123456";
+  }
+  // The last write filled the buffer.
+  EXPECT_EQ(133, overlaySize());
+
+  // A write elsewhere in the file writes out the buffered data first.
+  data->write(StringPiece{"abc"}, contents.size());
+  contents += "abc";
+  data->write(StringPiece{"X"}, 0);
+  contents[0] = 'X';
+  EXPECT_EQ(136, overlaySize());
+
+  // Reading the buffered range writes it out.
+  auto buf = data->readIntoBuffer(1, 0);
+  EXPECT_EQ("X", buf->moveToFbString().toStdString());
+  EXPECT_EQ(contents, data->readAll());
+
+  data->write(StringPiece{"tail"}, contents.size());
+  contents += "tail";
+  data->flush(0);
+  EXPECT_EQ(contents.size(), overlaySize());
+  EXPECT_EQ(
+      Hash::sha1(folly::ByteRange{StringPiece{contents}}), data->getSha1());
+}
+
+TEST(FileData, appendsAfterReopeningExtendTheSha1) {
+  FakeTreeBuilder builder;
+  builder.setFile("src/a.c", "a\n");
+  TestMount testMount{builder};
+  testMount.addFile("test.log", "");
+  auto file = testMount.getFileInode("test.log");
+  const auto& overlay = testMount.getEdenMount()->getOverlay();
+
+  std::string contents;
+  fuse_file_info fi = {};
+  fi.flags = O_WRONLY | O_APPEND;
+  for (int n = 0; n < 3; ++n) {
+    auto handle = file->open(fi).get();
+    auto line = folly::to<std::string>("run ", n, "\n");
+    handle->write(StringPiece{line}, contents.size()).get();
+    contents += line;
+    handle->flush(0).get();
+
+    // The SHA-1 is saved on close without reading the file back, since the
+    // earlier handles' hashing of the file carries over.
+    struct stat st;
+    ASSERT_EQ(0, ::stat(file->getLocalPath().value().c_str(), &st));
+    auto saved = overlay->loadFileSha1(file->getNodeId(), st);
+    ASSERT_TRUE(saved.hasValue());
+    EXPECT_EQ(Hash::sha1(folly::ByteRange{StringPiece{contents}}), *saved);
+  }
+}
+
+TEST(FileData, identicalFilesShareOverlayData) {
+  gflags::FlagSaver flagSaver;
+  FLAGS_overlay_dedupe_min_size = 1;
+
+  FakeTreeBuilder builder;
+  builder.setFile("src/a.c", "a\n");
+  TestMount testMount{builder};
+  const auto& overlay = testMount.getEdenMount()->getOverlay();
+  auto before = overlay->getUsage();
+  auto overlayIno = [](const FileInodePtr& file) {
+    struct stat st;
+    EXPECT_EQ(0, ::stat(file->getLocalPath().value().c_str(), &st));
+    return st.st_ino;
+  };
+
+  // The files are shared when they are synced, since their writes have
+  // already computed their SHA-1.
+  auto contents = makeContents(10000);
+  testMount.addFile("a.bin", contents);
+  testMount.addFile("b.bin", contents);
+  auto a = testMount.getFileInode("a.bin");
+  auto b = testMount.getFileInode("b.bin");
+  EXPECT_EQ(overlayIno(a), overlayIno(b));
+  auto bData = b->getOrLoadData();
+  EXPECT_EQ(1, bData->stat().st_nlink);
+  auto usage = overlay->getUsage();
+  EXPECT_EQ(before.files + 2, usage.files);
+  EXPECT_EQ(before.bytes + contents.size(), usage.bytes);
+
+  // Changing one of them gives it its own copy again.
+  bData->write(StringPiece{"X"}, 0);
+  EXPECT_NE(overlayIno(a), overlayIno(b));
+  EXPECT_EQ(contents, a->getOrLoadData()->readAll());
+  EXPECT_EQ("X" + contents.substr(1), bData->readAll());
+  EXPECT_EQ(before.bytes + 2 * contents.size(), overlay->getUsage().bytes);
+
+  // The last file using the shared copy keeps it without copying.
+  auto aIno = overlayIno(a);
+  a->getOrLoadData()->write(StringPiece{"Y"}, 0);
+  EXPECT_EQ(aIno, overlayIno(a));
+  EXPECT_EQ(before.bytes + 2 * contents.size(), overlay->getUsage().bytes);
+}
+
+TEST(FileData, rereadsOfCommittedFilesAreCounted) {
+  FakeTreeBuilder builder;
+  builder.setFile("include/a.h", "#pragma once\n");
+  TestMount testMount{builder};
+  auto file = testMount.getFileInode("include/a.h");
+  auto opens = getCounter("inodes.open.keep_cache");
+  auto firstReads = getCounter("inodes.read.first");
+  auto misses = getCounter("inodes.read.kernel_cache_miss");
+
+  fuse_file_info fi = {};
+  fi.flags = O_RDONLY;
+  for (int n = 0; n < 2; ++n) {
+    auto handle = file->open(fi).get();
+    EXPECT_TRUE(handle->preserveCache());
+    handle->read(4096, 0).get();
+  }
+
+  // The kernel keeps the pages it read through the first handle, so the
+  // second read means they were evicted.
+  EXPECT_EQ(opens + 2, getCounter("inodes.open.keep_cache"));
+  EXPECT_EQ(firstReads + 1, getCounter("inodes.read.first"));
+  EXPECT_EQ(misses + 1, getCounter("inodes.read.kernel_cache_miss"));
+}
@@ -0,0 +1,45 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/inodes/GitIgnoreCache.h"
+
+#include <gtest/gtest.h>
+#include "eden/fs/model/git/GitIgnore.h"
+
+using namespace facebook::eden;
+
+TEST(GitIgnoreCache, parsedContentsAreShared) {
+  GitIgnoreCache cache(10);
+  auto ignore1 = cache.getOrParse("*.o\n");
+  auto ignore2 = cache.getOrParse("*.o\n");
+  auto ignore3 = cache.getOrParse("*.a\n");
+  EXPECT_EQ(ignore1, ignore2);
+  EXPECT_NE(ignore1, ignore3);
+  EXPECT_EQ(GitIgnore::EXCLUDE, ignore1->match(RelativePathPiece{"x.o"}));
+  EXPECT_EQ(GitIgnore::NO_MATCH, ignore3->match(RelativePathPiece{"x.o"}));
+}
+
+TEST(GitIgnoreCache, blobLookup) {
+  GitIgnoreCache cache(2);
+  Hash hash1{"0000000000000000000000000000000000000001"};
+  Hash hash2{"0000000000000000000000000000000000000002"};
+  Hash hash3{"0000000000000000000000000000000000000003"};
+  EXPECT_EQ(nullptr, cache.getForBlob(hash1));
+
+  auto ignore = cache.getOrParse("build/\n");
+  cache.insertForBlob(hash1, ignore);
+  cache.insertForBlob(hash2, ignore);
+  EXPECT_EQ(ignore, cache.getForBlob(hash1));
+
+  // The least recently used entry is evicted once the cache is full.
+  cache.insertForBlob(hash3, ignore);
+  EXPECT_EQ(ignore, cache.getForBlob(hash1));
+  EXPECT_EQ(nullptr, cache.getForBlob(hash2));
+  EXPECT_EQ(ignore, cache.getForBlob(hash3));
+}
@@ -0,0 +1,445 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Benchmark.h>
+#include <folly/Conv.h>
+#include <folly/executors/CPUThreadPoolExecutor.h>
+#include <folly/init/Init.h>
+#include <gflags/gflags.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "eden/fs/inodes/EdenDispatcher.h"
+#include "eden/fs/inodes/EdenMount.h"
+#include "eden/fs/inodes/FileHandle.h"
+#include "eden/fs/inodes/InodeDiffCallback.h"
+#include "eden/fs/inodes/TreeInode.h"
+#include "eden/fs/inodes/TreeInodeDirHandle.h"
+#include "eden/fs/service/GlobNode.h"
+#include "eden/fs/testharness/FakeBackingStore.h"
+#include "eden/fs/testharness/FakeTreeBuilder.h"
+#include "eden/fs/testharness/TestMount.h"
+#include "eden/fs/testharness/TestUtil.h"
+#include "eden/fuse/DirList.h"
+
+/*
+ * Inode operations on a TestMount, without FUSE or a real backing store, so
+ * that the cost of eden's own data structures can be measured in isolation.
+ *
+ * The synthetic repository has three parts:
+ * - tree/: --files files, 100 per directory, two directory levels deep
+ * - wide/: a single directory with --wide_entries files
+ * - deep/: a chain of --deep_depth directories, with a file at the bottom
+ *
+ * The defaults keep a run to a few minutes; pass --files=2000000 to
+ * measure a repository the size of a large monorepo.
+ */
+
+DEFINE_uint64(files, 100000, "The number of files under tree/");
+DEFINE_uint64(wide_entries, 10000, "The number of files in wide/");
+DEFINE_uint64(deep_depth, 64, "The number of directory levels in deep/");
+DEFINE_uint64(
+    changed_files,
+    1000,
+    "The number of files that differ between the checkout commits");
+DEFINE_uint64(
+    materialized_files,
+    1000,
+    "The number of modified files in the mount used by the diff benchmarks");
+DEFINE_int32(threads, 8, "The number of threads for multi-threaded runs");
+
+using namespace facebook::eden;
+using folly::StringPiece;
+using std::string;
+
+namespace {
+constexpr size_t kFilesPerDir = 100;
+
+string treeFilePath(size_t n) {
+  return folly::to<string>(
+      "tree/d",
+      n / (kFilesPerDir * kFilesPerDir),
+      "/d",
+      (n / kFilesPerDir) % kFilesPerDir,
+      "/file_",
+      n % kFilesPerDir,
+      ".cpp");
+}
+
+string wideFilePath(size_t n) {
+  return folly::to<string>("wide/file_", n, ".cpp");
+}
+
+string deepFilePath() {
+  string path = "deep";
+  for (size_t n = 0; n < FLAGS_deep_depth; ++n) {
+    folly::toAppend("/d", n, &path);
+  }
+  return path + "/file.cpp";
+}
+
+FakeTreeBuilder makeRepo() {
+  FakeTreeBuilder builder;
+  for (size_t n = 0; n < FLAGS_files; ++n) {
+    builder.setFile(
+        treeFilePath(n), folly::to<string>("// source file ", n, "\n"));
+  }
+  for (size_t n = 0; n < FLAGS_wide_entries; ++n) {
+    builder.setFile(
+        wideFilePath(n), folly::to<string>("// wide file ", n, "\n"));
+  }
+  builder.setFile(deepFilePath(), "// deep file\n");
+  // A directory for the benchmarks that create and rename files.
+  builder.setFile("scratch/README", "scratch space\n");
+  return builder;
+}
+
+/**
+ * The indices of count files spread evenly over tree/.
+ */
+std::vector<size_t> spreadFiles(size_t count) {
+  std::vector<size_t> indices;
+  count = std::min<size_t>(count, FLAGS_files);
+  if (count == 0) {
+    return indices;
+  }
+  for (size_t n = 0; n < count; ++n) {
+    indices.push_back(n * (FLAGS_files / count));
+  }
+  return indices;
+}
+
+/**
+ * The mount used by the lookup, readdir, glob and mutation benchmarks.
+ *
+ * Building the repository is far more expensive than any of the operations
+ * measured, so each kind of mount is only built once and is shared by all
+ * of the calls folly makes to a benchmark.
+ */
+TestMount& getMount() {
+  static std::unique_ptr<TestMount> mount;
+  if (!mount) {
+    auto builder = makeRepo();
+    mount = std::make_unique<TestMount>(builder);
+  }
+  return *mount;
+}
+
+/**
+ * A mount whose commit "2" differs from commit "1" in --changed_files
+ * files.
+ */
+TestMount& getCheckoutMount() {
+  static std::unique_ptr<TestMount> mount;
+  if (!mount) {
+    auto builder1 = makeRepo();
+    mount = std::make_unique<TestMount>(builder1);
+    auto builder2 = builder1.clone();
+    for (auto n : spreadFiles(FLAGS_changed_files)) {
+      builder2.replaceFile(
+          treeFilePath(n), folly::to<string>("// changed file ", n, "\n"));
+    }
+    builder2.finalize(mount->getBackingStore(), true);
+    mount->getBackingStore()->putCommit("2", builder2)->setReady();
+  }
+  return *mount;
+}
+
+/**
+ * A mount with --materialized_files modified files.
+ */
+TestMount& getDiffMount() {
+  static std::unique_ptr<TestMount> mount;
+  if (!mount) {
+    auto builder = makeRepo();
+    mount = std::make_unique<TestMount>(builder);
+    for (auto n : spreadFiles(FLAGS_materialized_files)) {
+      mount->overwriteFile(
+          treeFilePath(n), folly::to<string>("// modified file ", n, "\n"));
+    }
+  }
+  return *mount;
+}
+
+/**
+ * Run fn(n) for every n in [0, iters) on numThreads threads.
+ */
+template <typename Fn>
+void runOnThreads(size_t iters, size_t numThreads, Fn&& fn) {
+  if (numThreads <= 1) {
+    for (size_t n = 0; n < iters; ++n) {
+      fn(n);
+    }
+    return;
+  }
+  std::atomic<size_t> next{0};
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < numThreads; ++t) {
+    threads.emplace_back([&] {
+      for (auto n = next++; n < iters; n = next++) {
+        fn(n);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+size_t getThreads(bool multiThreaded) {
+  return multiThreaded ? std::max(FLAGS_threads, 1) : 1;
+}
+
+/**
+ * Look up the paths returned by pathFn(n), with all of the inodes already
+ * loaded.
+ */
+template <typename PathFn>
+void lookupPaths(
+    size_t iters,
+    size_t numPaths,
+    bool multiThreaded,
+    PathFn&& pathFn) {
+  EdenMount* edenMount;
+  std::vector<RelativePath> paths;
+  BENCHMARK_SUSPEND {
+    edenMount = getMount().getEdenMount().get();
+    numPaths = std::min(numPaths, iters);
+    paths.reserve(numPaths);
+    for (size_t n = 0; n < numPaths; ++n) {
+      paths.emplace_back(pathFn(n));
+      edenMount->getInodeBlocking(paths.back());
+    }
+  }
+  runOnThreads(iters, getThreads(multiThreaded), [&](size_t n) {
+    folly::doNotOptimizeAway(
+        edenMount->getInodeBlocking(paths[n % paths.size()]));
+  });
+}
+
+void lookupTree(size_t iters, bool multiThreaded) {
+  lookupPaths(iters, FLAGS_files, multiThreaded, [](size_t n) {
+    // Step through the files in a different order than they are numbered,
+    // so that consecutive lookups are in different directories.
+    return treeFilePath((n * 7919) % FLAGS_files);
+  });
+}
+
+void lookupWide(size_t iters, bool multiThreaded) {
+  lookupPaths(iters, FLAGS_wide_entries, multiThreaded, wideFilePath);
+}
+
+void lookupDeep(size_t iters, bool multiThreaded) {
+  lookupPaths(iters, 1, multiThreaded, [](size_t) { return deepFilePath(); });
+}
+
+void readdirWide(size_t iters, bool multiThreaded) {
+  TreeInodePtr dir;
+  size_t bufferSize;
+  BENCHMARK_SUSPEND {
+    dir = getMount().getTreeInode("wide");
+    // Read the whole directory in one call.  The kernel reads in pages, but
+    // the listing is only taken once per opendir() either way.
+    bufferSize = (FLAGS_wide_entries + 2) * 64;
+  }
+  runOnThreads(iters, getThreads(multiThreaded), [&](size_t) {
+    fuse_file_info info{};
+    auto handle = dir->opendir(info).get();
+    folly::doNotOptimizeAway(
+        handle->readdir(fusell::DirList{bufferSize}, 0).get());
+  });
+}
+
+/**
+ * Answer getattr for a loaded inode the way the FUSE dispatch code does.
+ *
+ * The chained form runs the request through continuations on ready
+ * Futures, with error handling appended and a cancellation handle
+ * allocated, as every request used to.  The direct form uses the result as
+ * soon as it is ready, as RequestData::dispatch() does.
+ */
+void getattr(size_t iters, bool chained) {
+  EdenDispatcher* dispatcher;
+  fuse_ino_t ino;
+  BENCHMARK_SUSPEND {
+    auto& mount = getMount();
+    dispatcher = mount.getEdenMount()->getDispatcher();
+    ino = mount.getFileInode(treeFilePath(0))->getNodeId();
+  }
+  struct stat st;
+  auto reply = [&st](fusell::Dispatcher::Attr&& attr) { st = attr.st; };
+  for (size_t n = 0; n < iters; ++n) {
+    if (chained) {
+      auto fut = folly::makeFuture()
+                     .then([&] { return dispatcher->getattr(ino); })
+                     .then(reply)
+                     .onError([](const std::exception&) {})
+                     .ensure([] {});
+      folly::doNotOptimizeAway(
+          std::make_unique<folly::Future<folly::Unit>>(std::move(fut)));
+    } else {
+      auto fut =
+          folly::makeFutureWith([&] { return dispatcher->getattr(ino); });
+      if (fut.isReady()) {
+        reply(std::move(fut.value()));
+      }
+    }
+    folly::doNotOptimizeAway(st);
+  }
+}
+
+void checkout(size_t iters, bool multiThreaded) {
+  EdenMount* edenMount;
+  std::unique_ptr<folly::CPUThreadPoolExecutor> executor;
+  BENCHMARK_SUSPEND {
+    edenMount = getCheckoutMount().getEdenMount().get();
+    if (multiThreaded) {
+      executor = std::make_unique<folly::CPUThreadPoolExecutor>(
+          getThreads(multiThreaded));
+    }
+  }
+  // Alternate between the two commits, starting from whichever one the
+  // previous call left the mount at.
+  static size_t checkouts = 0;
+  for (size_t n = 0; n < iters; ++n) {
+    auto commit = makeTestHash(++checkouts % 2 == 1 ? "2" : "1");
+    edenMount->checkout(commit, false, executor.get()).get();
+  }
+}
+
+class CountingDiffCallback : public InodeDiffCallback {
+ public:
+  void ignoredFile(RelativePathPiece) override {}
+  void untrackedFile(RelativePathPiece) override {
+    ++count;
+  }
+  void removedFile(RelativePathPiece, const TreeEntry&) override {
+    ++count;
+  }
+  void modifiedFile(RelativePathPiece, const TreeEntry&) override {
+    ++count;
+  }
+  void diffError(RelativePathPiece, const folly::exception_wrapper&)
+      override {}
+
+  std::atomic<size_t> count{0};
+};
+
+void diff(size_t iters, bool multiThreaded) {
+  EdenMount* edenMount;
+  std::unique_ptr<folly::CPUThreadPoolExecutor> executor;
+  BENCHMARK_SUSPEND {
+    edenMount = getDiffMount().getEdenMount().get();
+    if (multiThreaded) {
+      executor = std::make_unique<folly::CPUThreadPoolExecutor>(
+          getThreads(multiThreaded));
+    }
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    CountingDiffCallback callback;
+    edenMount->diff(&callback, false, executor.get()).get();
+    folly::doNotOptimizeAway(callback.count.load());
+  }
+}
+
+void globFiles(size_t iters, StringPiece pattern, bool multiThreaded) {
+  TreeInodePtr root;
+  std::unique_ptr<folly::CPUThreadPoolExecutor> executor;
+  BENCHMARK_SUSPEND {
+    root = getMount().getEdenMount()->getRootInode();
+    if (multiThreaded) {
+      executor = std::make_unique<folly::CPUThreadPoolExecutor>(
+          getThreads(multiThreaded));
+    }
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    GlobNode globRoot;
+    globRoot.parse(pattern);
+    GlobResults results;
+    globRoot.evaluate(RelativePathPiece(), root, &results, executor.get())
+        .get();
+    folly::doNotOptimizeAway(results.extractPaths());
+  }
+}
+}
+
+BENCHMARK_NAMED_PARAM(lookupTree, single, false);
+BENCHMARK_NAMED_PARAM(lookupTree, threads, true);
+BENCHMARK_NAMED_PARAM(lookupWide, single, false);
+BENCHMARK_NAMED_PARAM(lookupWide, threads, true);
+BENCHMARK_NAMED_PARAM(lookupDeep, single, false);
+BENCHMARK_NAMED_PARAM(lookupDeep, threads, true);
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_NAMED_PARAM(readdirWide, single, false);
+BENCHMARK_NAMED_PARAM(readdirWide, threads, true);
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_NAMED_PARAM(getattr, chained, true);
+BENCHMARK_RELATIVE_NAMED_PARAM(getattr, direct, false);
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(createUnlink, iters) {
+  TreeInodePtr dir;
+  BENCHMARK_SUSPEND {
+    dir = getMount().getTreeInode("scratch");
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    PathComponentPiece name{"new_file.cpp"};
+    dir->create(name, S_IFREG | 0644, O_CREAT | O_RDWR).get();
+    dir->unlink(name).get();
+  }
+}
+BENCHMARK(mkdirRmdir, iters) {
+  TreeInodePtr dir;
+  BENCHMARK_SUSPEND {
+    dir = getMount().getTreeInode("scratch");
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    PathComponentPiece name{"new_dir"};
+    dir->mkdir(name, S_IFDIR | 0755);
+    dir->rmdir(name).get();
+  }
+}
+BENCHMARK(renameFile, iters) {
+  TreeInodePtr dir;
+  BENCHMARK_SUSPEND {
+    dir = getMount().getTreeInode("scratch");
+  }
+  PathComponentPiece names[] = {PathComponentPiece{"README"},
+                                PathComponentPiece{"README.renamed"}};
+  for (size_t n = 0; n < iters; ++n) {
+    dir->rename(names[n % 2], dir, names[(n + 1) % 2]).get();
+  }
+  // Leave the file under its original name for the next call.
+  if (iters % 2 == 1) {
+    BENCHMARK_SUSPEND {
+      dir->rename(names[1], dir, names[0]).get();
+    }
+  }
+}
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_NAMED_PARAM(checkout, single, false);
+BENCHMARK_NAMED_PARAM(checkout, threads, true);
+BENCHMARK_NAMED_PARAM(diff, single, false);
+BENCHMARK_NAMED_PARAM(diff, threads, true);
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_NAMED_PARAM(globFiles, wide_single, "wide/*.cpp", false);
+BENCHMARK_NAMED_PARAM(globFiles, tree_single, "tree/**/file_1*.cpp", false);
+BENCHMARK_NAMED_PARAM(globFiles, tree_threads, "tree/**/file_1*.cpp", true);
+
+int main(int argc, char** argv) {
+  folly::init(&argc, &argv);
+  folly::runBenchmarks();
+  return 0;
+}
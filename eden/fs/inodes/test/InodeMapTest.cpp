@@ -13,9 +13,12 @@
 #include <folly/Format.h>
 #include <folly/String.h>
 #include <gtest/gtest.h>
+#include <thread>
+#include <unordered_set>
 #include "eden/fs/inodes/EdenMount.h"
 #include "eden/fs/inodes/FileInode.h"
 #include "eden/fs/inodes/TreeInode.h"
+#include "eden/fs/takeover/gen-cpp2/takeover_types.h"
 #include "eden/fs/testharness/FakeTreeBuilder.h"
 #include "eden/fs/testharness/TestMount.h"
 #include "eden/fs/testharness/TestUtil.h"
@@ -279,3 +282,177 @@ TEST(InodeMap, renameDuringRecursiveLookupAndLoad) {
   EXPECT_EQ(
       RelativePathPiece{"a/b/x/d/file.txt"}, fileInode->getPath().value());
 }
+
+TEST(InodeMap, concurrentInodeNumberAllocation) {
+  FakeTreeBuilder builder;
+  builder.setFile("README", "docs go here\n");
+  TestMount testMount{builder};
+  auto* inodeMap = testMount.getEdenMount()->getInodeMap();
+
+  constexpr size_t kNumThreads = 8;
+  constexpr size_t kNumPerThread = 1000;
+  std::vector<std::vector<fuse_ino_t>> allocated(kNumThreads);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([&, t] {
+      for (size_t n = 0; n < kNumPerThread; ++n) {
+        allocated[t].push_back(inodeMap->allocateInodeNumber());
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::unordered_set<fuse_ino_t> numbers;
+  for (const auto& threadNumbers : allocated) {
+    for (auto number : threadNumbers) {
+      EXPECT_GT(number, FUSE_ROOT_ID);
+      EXPECT_TRUE(numbers.insert(number).second) << "duplicate " << number;
+    }
+  }
+  EXPECT_EQ(kNumThreads * kNumPerThread, numbers.size());
+}
+
+TEST(InodeMap, stats) {
+  FakeTreeBuilder builder;
+  builder.setFile("Makefile", "all:\necho success\n");
+  builder.setFile("src/noop.c", "int main() { return 0; }\n");
+  TestMount testMount{builder};
+  auto* inodeMap = testMount.getEdenMount()->getInodeMap();
+
+  auto before = inodeMap->getStats();
+  EXPECT_GE(before.loadedInodes, 1);
+  EXPECT_GT(before.memoryBytes, 0);
+
+  auto root = testMount.getEdenMount()->getRootInode();
+  auto srcTree = root->getOrLoadChild(PathComponentPiece{"src"}).get();
+  srcTree.asTreePtr()->getOrLoadChild(PathComponentPiece{"noop.c"}).get();
+
+  auto after = inodeMap->getStats();
+  EXPECT_EQ(before.loadedInodes + 2, after.loadedInodes);
+  EXPECT_GT(after.getBytesPerInode(), 0);
+}
+
+TEST(InodeMap, unloadInactiveInodes) {
+  FakeTreeBuilder builder;
+  builder.setFile("Makefile", "all:\necho success\n");
+  builder.setFile("src/noop.c", "int main() { return 0; }\n");
+  TestMount testMount{builder};
+  auto* inodeMap = testMount.getEdenMount()->getInodeMap();
+  auto root = testMount.getEdenMount()->getRootInode();
+
+  fuse_ino_t srcNumber;
+  fuse_ino_t noopNumber;
+  {
+    auto srcTree =
+        root->getOrLoadChild(PathComponentPiece{"src"}).get().asTreePtr();
+    auto noop = srcTree->getOrLoadChild(PathComponentPiece{"noop.c"}).get();
+    srcNumber = srcTree->getNodeId();
+    noopNumber = noop->getNodeId();
+
+    // Nothing is unloaded while it is still referenced.
+    inodeMap->unloadInactiveInodes(std::chrono::seconds(0), 0);
+    EXPECT_TRUE(inodeMap->lookupLoadedInode(srcNumber));
+    EXPECT_TRUE(inodeMap->lookupLoadedInode(noopNumber));
+  }
+
+  // Inodes used recently are not unloaded.
+  EXPECT_EQ(0, inodeMap->unloadInactiveInodes(std::chrono::hours(1), 0));
+  EXPECT_TRUE(inodeMap->lookupLoadedInode(noopNumber));
+
+  // Once they are old enough both src and src/noop.c are unloaded, the tree
+  // after its child.
+  auto before = inodeMap->getStats().loadedInodes;
+  EXPECT_EQ(2, inodeMap->unloadInactiveInodes(std::chrono::seconds(0), 0));
+  EXPECT_EQ(before - 2, inodeMap->getStats().loadedInodes);
+
+  // They can be loaded again by name.
+  auto noop = testMount.getEdenMount()
+                  ->getInode(RelativePathPiece{"src/noop.c"})
+                  .get();
+  EXPECT_EQ(RelativePath{"src/noop.c"}, noop->getPath());
+}
+
+TEST(InodeMap, unloadInactiveInodesAboveLimit) {
+  FakeTreeBuilder builder;
+  builder.setFile("src/a.c", "a\n");
+  builder.setFile("src/b.c", "b\n");
+  TestMount testMount{builder};
+  auto* inodeMap = testMount.getEdenMount()->getInodeMap();
+  auto edenMount = testMount.getEdenMount();
+  edenMount->getInode(RelativePathPiece{"src/a.c"}).get();
+  edenMount->getInode(RelativePathPiece{"src/b.c"}).get();
+
+  // Below the limit recently used inodes are kept, but above it everything
+  // unreferenced is unloaded.
+  auto numLoaded = inodeMap->getStats().loadedInodes;
+  EXPECT_EQ(
+      0, inodeMap->unloadInactiveInodes(std::chrono::hours(1), numLoaded));
+  EXPECT_EQ(
+      3,
+      inodeMap->unloadInactiveInodes(std::chrono::hours(1), numLoaded - 1));
+}
+
+TEST(InodeMap, decFuseRefcountBatch) {
+  FakeTreeBuilder builder;
+  builder.setFile("Makefile", "all:\necho success\n");
+  builder.setFile("src/noop.c", "int main() { return 0; }\n");
+  TestMount testMount{builder};
+  auto* inodeMap = testMount.getEdenMount()->getInodeMap();
+  auto edenMount = testMount.getEdenMount();
+
+  // Makefile is unloaded, but still referenced by FUSE.
+  fuse_ino_t makefileNumber;
+  {
+    auto makefile = edenMount->getInode(RelativePathPiece{"Makefile"}).get();
+    makefile->incFuseRefcount();
+    makefileNumber = makefile->getNodeId();
+  }
+  inodeMap->unloadInactiveInodes(std::chrono::seconds(0), 0);
+  EXPECT_FALSE(inodeMap->lookupLoadedInode(makefileNumber));
+  EXPECT_TRUE(inodeMap->isInodeRemembered(makefileNumber));
+
+  auto noop = edenMount->getInode(RelativePathPiece{"src/noop.c"}).get();
+  noop->incFuseRefcount();
+  noop->incFuseRefcount();
+
+  inodeMap->decFuseRefcountBatch({{noop->getNodeId(), 1},
+                                  {makefileNumber, 1},
+                                  {noop->getNodeId(), 1}});
+  EXPECT_EQ(0, noop->getFuseRefcount());
+  EXPECT_FALSE(inodeMap->isInodeRemembered(makefileNumber));
+}
+
+TEST(InodeMap, loadPersistedKeepsInodeNumbers) {
+  auto makeBuilder = [](FakeTreeBuilder& builder) {
+    builder.setFile("src/a.c", "a\n");
+    builder.setFile("src/sub/b.c", "b\n");
+  };
+
+  FakeTreeBuilder builder1;
+  makeBuilder(builder1);
+  TestMount testMount1{builder1};
+  auto edenMount1 = testMount1.getEdenMount();
+  // Load the inodes in a different order than below, so that they would get
+  // different numbers if they were not restored.
+  auto b1 = edenMount1->getInode(RelativePathPiece{"src/sub/b.c"}).get();
+  auto a1 = edenMount1->getInode(RelativePathPiece{"src/a.c"}).get();
+  auto saved = edenMount1->getInodeMap()->save();
+
+  FakeTreeBuilder builder2;
+  makeBuilder(builder2);
+  TestMount testMount2{builder2};
+  auto edenMount2 = testMount2.getEdenMount();
+  edenMount2->getInodeMap()->loadPersisted(saved);
+
+  auto a2 = edenMount2->getInode(RelativePathPiece{"src/a.c"}).get();
+  auto b2 = edenMount2->getInode(RelativePathPiece{"src/sub/b.c"}).get();
+  EXPECT_EQ(a1->getNodeId(), a2->getNodeId());
+  EXPECT_EQ(b1->getNodeId(), b2->getNodeId());
+
+  // New inodes are numbered after all of the restored ones.
+  testMount2.addFile("src/new.c", "new\n");
+  auto newFile = edenMount2->getInode(RelativePathPiece{"src/new.c"}).get();
+  EXPECT_GE(newFile->getNodeId(), saved.nextInodeNumber);
+}
@@ -0,0 +1,334 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/inodes/Overlay.h"
+
+#include <boost/filesystem.hpp>
+#include <folly/Conv.h>
+#include <folly/FileUtil.h>
+#include <folly/experimental/TestUtil.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <map>
+#include <thrift/lib/cpp2/protocol/Serializer.h>
+#include "eden/fs/inodes/EdenMount.h"
+#include "eden/fs/inodes/FileInode.h"
+#include "eden/fs/inodes/gen-cpp2/overlay_types.h"
+#include "eden/fs/testharness/FakeTreeBuilder.h"
+#include "eden/fs/testharness/TestMount.h"
+#include "eden/fuse/fuse_headers.h"
+
+using namespace facebook::eden;
+using folly::StringPiece;
+using folly::test::TemporaryDirectory;
+
+namespace {
+
+AbsolutePath makeOverlayPath(const TemporaryDirectory& tmpDir) {
+  return AbsolutePath{(tmpDir.path() / "local").string()};
+}
+
+TreeInode::Dir makeDir() {
+  TreeInode::Dir dir;
+  dir.materialized = true;
+  dir.entries.emplace(PathComponentPiece{"file.txt"}, S_IFREG | 0644, 5);
+  dir.entries.emplace(
+      PathComponentPiece{"unmodified.txt"},
+      S_IFREG | 0644,
+      Hash{"0123456789abcdef0123456789abcdef01234567"});
+  dir.entries.emplace(PathComponentPiece{"subdir"}, S_IFDIR | 0755, 6);
+  return dir;
+}
+
+void expectSameEntries(const TreeInode::Dir& expected, TreeInode::Dir& actual) {
+  EXPECT_TRUE(actual.materialized);
+  ASSERT_EQ(expected.entries.size(), actual.entries.size());
+  for (const auto& entry : expected.entries) {
+    auto it = actual.entries.find(entry.first);
+    ASSERT_NE(actual.entries.end(), it) << "missing entry " << entry.first;
+    EXPECT_EQ(entry.second.mode, it->second.mode);
+    EXPECT_EQ(entry.second.isMaterialized(), it->second.isMaterialized());
+    if (entry.second.isMaterialized()) {
+      EXPECT_EQ(
+          entry.second.getInodeNumber(), it->second.getInodeNumber());
+    } else {
+      EXPECT_EQ(entry.second.getHash(), it->second.getHash());
+    }
+  }
+}
+}
+
+TEST(Overlay, saveAndLoadDir) {
+  TemporaryDirectory tmpDir("eden_overlay_test_");
+  auto dir = makeDir();
+  {
+    Overlay overlay{makeOverlayPath(tmpDir)};
+    EXPECT_FALSE(overlay.loadOverlayDir(FUSE_ROOT_ID).hasValue());
+    overlay.saveOverlayDir(FUSE_ROOT_ID, &dir);
+  }
+
+  // The directory should still be there once the overlay is reopened.
+  Overlay overlay{makeOverlayPath(tmpDir)};
+  auto loaded = overlay.loadOverlayDir(FUSE_ROOT_ID);
+  ASSERT_TRUE(loaded.hasValue());
+  expectSameEntries(dir, loaded.value());
+  // Directories are not stored in per-inode files any more.
+  EXPECT_FALSE(boost::filesystem::exists(
+      overlay.getFilePath(FUSE_ROOT_ID).value().toStdString()));
+
+  overlay.removeOverlayData(FUSE_ROOT_ID);
+  EXPECT_FALSE(overlay.loadOverlayDir(FUSE_ROOT_ID).hasValue());
+}
+
+TEST(Overlay, readLegacyDirFile) {
+  TemporaryDirectory tmpDir("eden_overlay_test_");
+  auto overlayPath = makeOverlayPath(tmpDir);
+  AbsolutePath legacyFilePath;
+  {
+    // Create an overlay, then make it look like a version 1 overlay with a
+    // directory stored in its per-inode file.
+    Overlay overlay{overlayPath};
+    legacyFilePath = overlay.getFilePath(10);
+  }
+  folly::writeFile(
+      folly::StringPiece{"\xed\xe0\x00\x01\x00\x00\x00\x01", 8},
+      (overlayPath + PathComponentPiece{"info"}).value().c_str());
+
+  overlay::OverlayDir odir;
+  overlay::OverlayEntry oent;
+  oent.mode = S_IFREG | 0644;
+  oent.inodeNumber = 11;
+  odir.entries.emplace("legacy.txt", oent);
+  auto serialized =
+      apache::thrift::CompactSerializer::serialize<std::string>(odir);
+  folly::writeFile(serialized, legacyFilePath.value().c_str());
+
+  Overlay overlay{overlayPath};
+  auto loaded = overlay.loadOverlayDir(10);
+  ASSERT_TRUE(loaded.hasValue());
+  ASSERT_EQ(1, loaded->entries.size());
+  auto it = loaded->entries.find(PathComponentPiece{"legacy.txt"});
+  ASSERT_NE(loaded->entries.end(), it);
+  EXPECT_EQ(11, it->second.getInodeNumber());
+
+  // Loading the directory moves it out of the legacy file.
+  EXPECT_FALSE(
+      boost::filesystem::exists(legacyFilePath.value().toStdString()));
+  loaded = overlay.loadOverlayDir(10);
+  ASSERT_TRUE(loaded.hasValue());
+  EXPECT_EQ(1, loaded->entries.size());
+}
+
+TEST(Overlay, maxRecordedInodeIncludesUnlinkedDirs) {
+  TemporaryDirectory tmpDir("eden_overlay_test_");
+  Overlay overlay{makeOverlayPath(tmpDir)};
+  auto dir = makeDir();
+  overlay.saveOverlayDir(FUSE_ROOT_ID, &dir);
+  // Inode 300 is not reachable from the root.
+  TreeInode::Dir unlinked;
+  unlinked.materialized = true;
+  overlay.saveOverlayDir(300, &unlinked);
+
+  EXPECT_EQ(300, overlay.getMaxRecordedInode());
+}
+
+TEST(Overlay, maxRecordedInodeUsesHighWaterMark) {
+  TemporaryDirectory tmpDir("eden_overlay_test_");
+  auto dir = makeDir();
+  {
+    Overlay overlay{makeOverlayPath(tmpDir)};
+    overlay.saveOverlayDir(FUSE_ROOT_ID, &dir);
+    overlay.saveOverlayDir(300, &dir);
+    overlay.saveInodeHighWaterMark(1000);
+  }
+
+  // The overlay was not closed with saveNextInodeNumber(), but the
+  // high-water mark saves it from having to scan.
+  {
+    Overlay overlay{makeOverlayPath(tmpDir)};
+    EXPECT_EQ(999, overlay.getMaxRecordedInode());
+    overlay.saveNextInodeNumber(400);
+  }
+
+  // A cleanly saved next inode number is more precise, so it wins.
+  Overlay overlay{makeOverlayPath(tmpDir)};
+  EXPECT_EQ(399, overlay.getMaxRecordedInode());
+}
+
+TEST(Overlay, dirtyDirsAreWrittenOnFlush) {
+  FakeTreeBuilder builder;
+  builder.setFile("src/a.c", "a\n");
+  TestMount testMount{builder};
+  const auto& overlay = testMount.getEdenMount()->getOverlay();
+
+  // Each new file changes src, but nothing is written until the flush.
+  for (int n = 0; n < 10; ++n) {
+    testMount.addFile(folly::to<std::string>("src/new", n, ".c"), "new\n");
+  }
+  auto srcNumber = testMount.getTreeInode("src")->getNodeId();
+  EXPECT_FALSE(overlay->loadOverlayDir(srcNumber).hasValue());
+
+  overlay->flushDirs();
+  auto loaded = overlay->loadOverlayDir(srcNumber);
+  ASSERT_TRUE(loaded.hasValue());
+  EXPECT_EQ(11, loaded->entries.size());
+
+  // Removals are deferred until the next flush too, but are visible to
+  // loadOverlayDir() right away.
+  overlay->removeOverlayData(srcNumber);
+  EXPECT_FALSE(overlay->loadOverlayDir(srcNumber).hasValue());
+}
+
+TEST(Overlay, changedEntriesAreWrittenAsDeltas) {
+  FakeTreeBuilder builder;
+  builder.setFile("src/a.c", "a\n");
+  TestMount testMount{builder};
+  const auto& overlay = testMount.getEdenMount()->getOverlay();
+  auto srcNumber = testMount.getTreeInode("src")->getNodeId();
+
+  // The first change materializes src, which writes it in full.
+  testMount.addFile("src/b.c", "b\n");
+  overlay->flushDirs();
+
+  // Later changes are written as deltas, and applied when it is loaded.
+  testMount.addFile("src/c.c", "c\n");
+  testMount.deleteFile("src/a.c");
+  overlay->flushDirs();
+  auto loaded = overlay->loadOverlayDir(srcNumber);
+  ASSERT_TRUE(loaded.hasValue());
+  EXPECT_EQ(2, loaded->entries.size());
+  EXPECT_TRUE(loaded->entries.find(PathComponentPiece{"a.c"}) ==
+              loaded->entries.end());
+  auto it = loaded->entries.find(PathComponentPiece{"c.c"});
+  ASSERT_TRUE(it != loaded->entries.end());
+  EXPECT_TRUE(it->second.isMaterialized());
+
+  // Enough separate changes make the flush rewrite the directory in full
+  // again.  The result must be the same either way.
+  for (int n = 0; n < 50; ++n) {
+    testMount.addFile(folly::to<std::string>("src/new", n, ".c"), "new\n");
+    overlay->flushDirs();
+  }
+  testMount.deleteFile("src/b.c");
+  overlay->flushDirs();
+  loaded = overlay->loadOverlayDir(srcNumber);
+  ASSERT_TRUE(loaded.hasValue());
+  EXPECT_EQ(51, loaded->entries.size());
+  EXPECT_TRUE(loaded->entries.find(PathComponentPiece{"b.c"}) ==
+              loaded->entries.end());
+}
+
+TEST(Overlay, compactRemovesUnreachableData) {
+  TemporaryDirectory tmpDir("eden_overlay_test_");
+  Overlay overlay{makeOverlayPath(tmpDir)};
+  // The root refers to file 5 and directory 6.
+  auto dir = makeDir();
+  overlay.saveOverlayDir(FUSE_ROOT_ID, &dir);
+  TreeInode::Dir subdir;
+  subdir.materialized = true;
+  overlay.saveOverlayDir(6, &subdir);
+  // Directory 300 and files 400, 401 and 402 are not reachable.
+  overlay.saveOverlayDir(300, &subdir);
+  auto writeOverlayFile = [&](fuse_ino_t number, StringPiece suffix) {
+    auto path = folly::to<std::string>(
+        overlay.getFilePath(number).stringPiece(), suffix);
+    ASSERT_TRUE(folly::writeFile(StringPiece{"contents\n"}, path.c_str()));
+  };
+  writeOverlayFile(5, "");
+  writeOverlayFile(400, "");
+  writeOverlayFile(401, "");
+  writeOverlayFile(402, ".tmp");
+
+  // Inode 401 is still in use, so it is kept.
+  auto stats = overlay.compact(
+      1000, [](fuse_ino_t number) { return number == 401; });
+  EXPECT_EQ(1, stats.dirsRemoved);
+  EXPECT_EQ(2, stats.filesRemoved);
+  EXPECT_GT(stats.bytesReclaimed, 0);
+  EXPECT_EQ(401, stats.maxInode);
+
+  EXPECT_TRUE(overlay.loadOverlayDir(6).hasValue());
+  EXPECT_FALSE(overlay.loadOverlayDir(300).hasValue());
+  auto exists = [&](fuse_ino_t number) {
+    return boost::filesystem::exists(
+        overlay.getFilePath(number).value().toStdString());
+  };
+  EXPECT_TRUE(exists(5));
+  EXPECT_FALSE(exists(400));
+  EXPECT_TRUE(exists(401));
+}
+
+TEST(Overlay, usageIsScannedOnOpenAndUpdated) {
+  TemporaryDirectory tmpDir("eden_overlay_test_");
+  {
+    Overlay overlay{makeOverlayPath(tmpDir)};
+    EXPECT_EQ(0, overlay.getUsage().files);
+    ASSERT_TRUE(folly::writeFile(
+        StringPiece{"contents\n"}, overlay.getFilePath(5).c_str()));
+    ASSERT_TRUE(folly::writeFile(
+        StringPiece{"more contents\n"}, overlay.getFilePath(300).c_str()));
+  }
+
+  Overlay overlay{makeOverlayPath(tmpDir)};
+  auto usage = overlay.getUsage();
+  EXPECT_EQ(2, usage.files);
+  EXPECT_EQ(23, usage.bytes);
+
+  overlay.removeOverlayData(300);
+  usage = overlay.getUsage();
+  EXPECT_EQ(1, usage.files);
+  EXPECT_EQ(9, usage.bytes);
+}
+
+TEST(Overlay, usageFollowsFileChanges) {
+  FakeTreeBuilder builder;
+  builder.setFile("src/a.c", "int a;\n");
+  TestMount testMount{builder};
+  const auto& overlay = testMount.getEdenMount()->getOverlay();
+  auto before = overlay->getUsage();
+
+  testMount.addFile("src/new.c", "int x;\n");
+  testMount.overwriteFile("src/a.c", "int a = 1;\n");
+  auto usage = overlay->getUsage();
+  EXPECT_EQ(before.files + 2, usage.files);
+  EXPECT_EQ(before.bytes + 18, usage.bytes);
+
+  struct stat attr = {};
+  attr.st_size = 3;
+  testMount.getFileInode("src/a.c")->setattr(attr, FUSE_SET_ATTR_SIZE).get();
+  EXPECT_EQ(before.bytes + 10, overlay->getUsage().bytes);
+}
+
+TEST(Overlay, forEachMaterializedEntrySkipsUnmodifiedData) {
+  FakeTreeBuilder builder;
+  builder.setFiles({{"src/a.c", "int a;\n"},
+                    {"src/b.c", "int b;\n"},
+                    {"docs/README", "docs\n"}});
+  TestMount testMount{builder};
+  testMount.addFile("src/new.c", "int x;\n");
+  testMount.overwriteFile("src/a.c", "int a = 1;\n");
+  testMount.mkdir("src/sub");
+
+  const auto& overlay = testMount.getEdenMount()->getOverlay();
+  overlay->flushDirs();
+  std::map<std::string, mode_t> entries;
+  overlay->forEachMaterializedEntry([&](RelativePathPiece path, mode_t mode) {
+    entries.emplace(path.stringPiece().str(), mode);
+  });
+
+  std::vector<std::string> paths;
+  for (const auto& entry : entries) {
+    paths.push_back(entry.first);
+  }
+  EXPECT_EQ(
+      (std::vector<std::string>{"src", "src/a.c", "src/new.c", "src/sub"}),
+      paths);
+  EXPECT_TRUE(S_ISDIR(entries["src/sub"]));
+  EXPECT_TRUE(S_ISREG(entries["src/new.c"]));
+}
@@ -12,6 +12,8 @@
 #include "eden/fs/inodes/FileData.h"
 #include "eden/fs/inodes/FileInode.h"
 #include "eden/fs/inodes/TreeInode.h"
+#include "eden/fs/journal/Journal.h"
+#include "eden/fs/journal/JournalDelta.h"
 #include "eden/fs/testharness/FakeTreeBuilder.h"
 #include "eden/fs/testharness/TestChecks.h"
 #include "eden/fs/testharness/TestMount.h"
@@ -131,6 +133,48 @@ TEST_F(UnlinkTest, created) {
   EXPECT_FILE_INODE(file, contents, 0644);
 }
 
+TEST_F(UnlinkTest, removeRecursive) {
+  mount_.mkdir("dir/sub");
+  mount_.addFile("dir/sub/new.txt", "new file\n");
+  auto file = mount_.getFileInode("dir/sub/new.txt");
+  auto root = mount_.getEdenMount()->getRootInode();
+
+  auto removeFuture = root->removeRecursive(PathComponentPiece{"dir"});
+  ASSERT_TRUE(removeFuture.isReady());
+  removeFuture.get();
+
+  EXPECT_THROW_ERRNO(
+      root->getChildInodeNumber(PathComponentPiece{"dir"}), ENOENT);
+  EXPECT_NE(0, root->getChildInodeNumber(PathComponentPiece{"readme.txt"}));
+  // Open files can still be read after they are removed
+  EXPECT_FILE_INODE(file, "new file\n", 0644);
+
+  // Everything removed is recorded in a single journal delta
+  auto delta = mount_.getEdenMount()->getJournal().getLatest();
+  ASSERT_NE(nullptr, delta);
+  EXPECT_EQ(
+      (std::unordered_set<RelativePath>{RelativePath{"dir"},
+                                        RelativePath{"dir/a.txt"},
+                                        RelativePath{"dir/b.txt"},
+                                        RelativePath{"dir/c.txt"},
+                                        RelativePath{"dir/sub"},
+                                        RelativePath{"dir/sub/new.txt"}}),
+      delta->changedFilesInOverlay);
+}
+
+TEST_F(UnlinkTest, removeRecursiveFile) {
+  auto root = mount_.getEdenMount()->getRootInode();
+  root->removeRecursive(PathComponentPiece{"readme.txt"}).get();
+  EXPECT_THROW_ERRNO(
+      root->getChildInodeNumber(PathComponentPiece{"readme.txt"}), ENOENT);
+}
+
+TEST_F(UnlinkTest, removeRecursiveEnoent) {
+  auto root = mount_.getEdenMount()->getRootInode();
+  EXPECT_THROW_ERRNO(
+      root->removeRecursive(PathComponentPiece{"notpresent"}).get(), ENOENT);
+}
+
 // TODO: It would be nice to adds some tests for concurrent load+unlink
 // However, loading a FileInode does not wait for the file data to be loaded
 // from the ObjectStore, so we currently don't have a good way to test
@@ -188,6 +188,28 @@ TEST_F(RenameTest, renameFileToSamePath) {
   EXPECT_EQ(path, origFile->getPath().value());
 }
 
+TEST_F(RenameTest, replaceFileSameDirectoryWithSharedRenameLock) {
+  // Renaming a file within a materialized directory only needs the rename
+  // lock in shared mode, so it can proceed while another shared holder
+  // exists.
+  auto origSrc = mount_->getFileInode("a/b/c/doc.txt");
+  auto origDest = mount_->getFileInode("a/b/c/readme.txt");
+  auto dir = mount_->getTreeInode("a/b/c");
+  {
+    auto renameLock = mount_->getEdenMount()->acquireSharedRenameLock(
+        "RenameTest::replaceFileSameDirectoryWithSharedRenameLock");
+    auto renameFuture = dir->rename(
+        PathComponentPiece{"doc.txt"}, dir, PathComponentPiece{"readme.txt"});
+    ASSERT_TRUE(renameFuture.isReady());
+    renameFuture.get();
+  }
+
+  EXPECT_EQ(RelativePath{"a/b/c/readme.txt"}, origSrc->getPath().value());
+  EXPECT_TRUE(origDest->isUnlinked());
+  EXPECT_EQ(origSrc.get(), mount_->getFileInode("a/b/c/readme.txt").get());
+  EXPECT_THROW_ERRNO(mount_->getFileInode("a/b/c/doc.txt"), ENOENT);
+}
+
 /*
  * Basic tests for renaming directories
  */
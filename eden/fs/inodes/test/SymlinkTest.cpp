@@ -35,6 +35,8 @@ class SymlinkTest : public ::testing::Test {
     builder.setFiles({
         {"doc.txt", "hello\n"},
     });
+    builder.setSymlink("link1", "doc.txt");
+    builder.setSymlink("link2", "doc.txt");
     mount_.initialize(builder);
     mount_.mkdir("a");
   }
@@ -71,3 +73,18 @@ TEST_F(SymlinkTest, makeSymlinkCollisionDir) {
   // Name already exists, so we expect this to fail
   EXPECT_THROW_ERRNO(root->symlink(PathComponentPiece{name}, target), EEXIST);
 }
+
+TEST_F(SymlinkTest, readCommittedSymlinks) {
+  // Both symlinks share the same blob, so the second readlink() is served
+  // from the ObjectStore's symlink cache.
+  auto link1 = mount_.getFileInode("link1");
+  auto link2 = mount_.getFileInode("link2");
+  EXPECT_EQ("doc.txt", link1->readlink().get());
+  EXPECT_EQ("doc.txt", link2->readlink().get());
+  EXPECT_EQ(link1->getBlobHash(), link2->getBlobHash());
+  EXPECT_EQ("doc.txt", link1->readlink().get());
+
+  // Reading a file that is not a symlink still fails.
+  auto doc = mount_.getFileInode("doc.txt");
+  EXPECT_THROW_ERRNO(doc->readlink().get(), EINVAL);
+}
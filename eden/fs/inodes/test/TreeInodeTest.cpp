@@ -0,0 +1,132 @@
+/*
+ *  Copyright (c) 2004-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/inodes/TreeInode.h"
+
+#include <gtest/gtest.h>
+#include <linux/fuse.h>
+#include "eden/fs/inodes/FileInode.h"
+#include "eden/fs/store/LocalStore.h"
+#include "eden/fs/testharness/FakeTreeBuilder.h"
+#include "eden/fs/testharness/TestMount.h"
+#include "eden/fuse/DirHandle.h"
+#include "eden/fuse/DirList.h"
+#include "eden/utils/XAttr.h"
+
+using namespace facebook::eden;
+
+namespace {
+/**
+ * Read one chunk of a directory, of at most bufferSize bytes, returning the
+ * names and the offset to continue from.
+ */
+std::vector<std::string> readdirChunk(
+    fusell::DirHandle& handle,
+    off_t* off,
+    size_t bufferSize = 4096) {
+  auto list = handle.readdir(fusell::DirList{bufferSize}, *off).get();
+  auto buf = list.getBuf();
+  std::vector<std::string> names;
+  while (!buf.empty()) {
+    auto* dirent = reinterpret_cast<const fuse_dirent*>(buf.data());
+    names.emplace_back(dirent->name, dirent->namelen);
+    *off = dirent->off;
+    buf.advance(FUSE_DIRENT_SIZE(dirent));
+  }
+  return names;
+}
+}
+
+TEST(TreeInode, loadChildSizes) {
+  FakeTreeBuilder builder;
+  builder.setFile("dir/a.txt", "hello");
+  builder.setFile("dir/b.txt", "hello world");
+  builder.setFile("dir/sub/c.txt", "ignored");
+  TestMount testMount{builder};
+
+  auto dir = testMount.getTreeInode("dir");
+  std::vector<PathComponent> names{PathComponent{"a.txt"},
+                                   PathComponent{"sub"},
+                                   PathComponent{"missing"}};
+  dir->loadChildSizes(names).get();
+
+  auto contents = dir->getContents().rlock();
+  const auto& a = contents->entries.at(PathComponentPiece{"a.txt"});
+  EXPECT_FALSE(a.inode);
+  EXPECT_EQ(5, a.getSize().value_or(0));
+  // Only the requested files are looked up.
+  const auto& b = contents->entries.at(PathComponentPiece{"b.txt"});
+  EXPECT_FALSE(b.getSize().hasValue());
+}
+
+TEST(TreeInode, sha1XattrPrefetchesSiblingMetadata) {
+  FakeTreeBuilder builder;
+  builder.setFile("dir/a.txt", "hello");
+  builder.setFile("dir/b.txt", "hello world");
+  builder.setFile("dir/sub/c.txt", "ignored");
+  TestMount testMount{builder};
+
+  auto dir = testMount.getTreeInode("dir");
+  Hash bHash;
+  {
+    auto contents = dir->getContents().rlock();
+    bHash = contents->entries.at(PathComponentPiece{"b.txt"}).getHash();
+  }
+  const auto& localStore = testMount.getLocalStore();
+  EXPECT_FALSE(localStore->getBlobMetadata(bHash).hasValue());
+
+  auto a = testMount.getFileInode("dir/a.txt");
+  EXPECT_EQ(
+      Hash::sha1(folly::ByteRange{folly::StringPiece{"hello"}}).toString(),
+      a->getxattr(kXattrSha1).get());
+  // Looking up a.txt's metadata fetched b.txt's along with it.
+  auto bMetadata = localStore->getBlobMetadata(bHash);
+  ASSERT_TRUE(bMetadata.hasValue());
+  EXPECT_EQ(
+      Hash::sha1(folly::ByteRange{folly::StringPiece{"hello world"}}),
+      bMetadata->sha1);
+  EXPECT_EQ(11, bMetadata->size);
+}
+
+TEST(TreeInode, readdirListsDirectoryOnceUntilRewound) {
+  FakeTreeBuilder builder;
+  builder.setFile("dir/a.txt", "a");
+  builder.setFile("dir/b.txt", "b");
+  builder.setFile("dir/c.txt", "c");
+  TestMount testMount{builder};
+
+  auto dir = testMount.getTreeInode("dir");
+  fuse_file_info info{};
+  auto handle = dir->opendir(info).get();
+
+  // Read one entry at a time.  Changes made while reading do not show up
+  // until the directory is read from the start again.
+  off_t off = 0;
+  constexpr size_t kOneEntry = FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET + 8);
+  std::vector<std::string> names;
+  auto chunk = readdirChunk(*handle, &off, kOneEntry);
+  ASSERT_EQ(1, chunk.size());
+  names.push_back(chunk[0]);
+  testMount.addFile("dir/0.txt", "new");
+  while (true) {
+    chunk = readdirChunk(*handle, &off, kOneEntry);
+    if (chunk.empty()) {
+      break;
+    }
+    ASSERT_EQ(1, chunk.size());
+    names.push_back(chunk[0]);
+  }
+  EXPECT_EQ(
+      (std::vector<std::string>{".", "..", "a.txt", "b.txt", "c.txt"}), names);
+
+  off = 0;
+  EXPECT_EQ(
+      (std::vector<std::string>{".", "..", "0.txt", "a.txt", "b.txt", "c.txt"}),
+      readdirChunk(*handle, &off));
+}
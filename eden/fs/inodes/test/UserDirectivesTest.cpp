@@ -0,0 +1,108 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/inodes/UserDirectives.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using namespace facebook::eden;
+using overlay::UserStatusDirective;
+using ::testing::UnorderedElementsAre;
+
+namespace {
+std::vector<RelativePath> pathsUnder(
+    const UserDirectives& directives,
+    RelativePathPiece directory) {
+  std::vector<RelativePath> paths;
+  directives.forEachUnder(directory, [&](const auto& pair) {
+    paths.push_back(pair.first);
+  });
+  return paths;
+}
+}
+
+TEST(UserDirectives, forEachUnder) {
+  UserDirectives directives({
+      {RelativePath("a/b/1.txt"), UserStatusDirective::Add},
+      {RelativePath("a/b/c/2.txt"), UserStatusDirective::Remove},
+      {RelativePath("a/bc/3.txt"), UserStatusDirective::Add},
+      {RelativePath("top.txt"), UserStatusDirective::Add},
+  });
+
+  EXPECT_THAT(
+      pathsUnder(directives, RelativePathPiece{"a/b"}),
+      UnorderedElementsAre(
+          RelativePath{"a/b/1.txt"}, RelativePath{"a/b/c/2.txt"}));
+  EXPECT_THAT(
+      pathsUnder(directives, RelativePathPiece{"a/bc"}),
+      UnorderedElementsAre(RelativePath{"a/bc/3.txt"}));
+  EXPECT_THAT(
+      pathsUnder(directives, RelativePathPiece{"top.txt"}),
+      UnorderedElementsAre());
+  EXPECT_THAT(
+      pathsUnder(directives, RelativePathPiece{"missing"}),
+      UnorderedElementsAre());
+  EXPECT_EQ(4U, pathsUnder(directives, RelativePathPiece{}).size());
+}
+
+TEST(UserDirectives, setAndErase) {
+  UserDirectives directives;
+  directives.set(RelativePathPiece{"x/y/z.txt"}, UserStatusDirective::Add);
+  directives.set(RelativePathPiece{"x/w.txt"}, UserStatusDirective::Add);
+  directives.set(RelativePathPiece{"x/w.txt"}, UserStatusDirective::Remove);
+  EXPECT_EQ(2U, directives.size());
+  EXPECT_EQ(
+      UserStatusDirective::Remove,
+      directives.find(RelativePath{"x/w.txt"})->second);
+
+  EXPECT_EQ(1U, directives.erase(RelativePath{"x/y/z.txt"}));
+  EXPECT_EQ(0U, directives.erase(RelativePath{"x/y/z.txt"}));
+  EXPECT_EQ(0U, directives.erase(RelativePath{"x/y"}));
+  EXPECT_TRUE(directives.find(RelativePath{"x/y/z.txt"}) == directives.end());
+  EXPECT_THAT(
+      pathsUnder(directives, RelativePathPiece{"x"}),
+      UnorderedElementsAre(RelativePath{"x/w.txt"}));
+  EXPECT_THAT(
+      pathsUnder(directives, RelativePathPiece{"x/y"}),
+      UnorderedElementsAre());
+
+  // A directive can be set on a path that is also a parent of other
+  // directives, and erasing it leaves the others in place.
+  directives.set(RelativePathPiece{"x"}, UserStatusDirective::Add);
+  EXPECT_EQ(1U, directives.erase(RelativePath{"x"}));
+  EXPECT_THAT(
+      pathsUnder(directives, RelativePathPiece{}),
+      UnorderedElementsAre(RelativePath{"x/w.txt"}));
+}
+
+TEST(UserDirectives, findAndEraseByPiece) {
+  UserDirectives directives({
+      {RelativePath("a/b/1.txt"), UserStatusDirective::Add},
+      {RelativePath("a/c.txt"), UserStatusDirective::Remove},
+  });
+
+  auto iter = directives.find(RelativePathPiece{"a/c.txt"});
+  ASSERT_TRUE(iter != directives.end());
+  EXPECT_EQ(RelativePath{"a/c.txt"}, iter->first);
+  EXPECT_EQ(UserStatusDirective::Remove, iter->second);
+  // Directories in the trie that have no directive of their own
+  EXPECT_TRUE(directives.find(RelativePathPiece{"a/b"}) == directives.end());
+  EXPECT_TRUE(directives.find(RelativePathPiece{"a/d"}) == directives.end());
+  EXPECT_TRUE(directives.find(RelativePathPiece{}) == directives.end());
+
+  EXPECT_EQ(0U, directives.erase(RelativePathPiece{"a/b"}));
+  EXPECT_EQ(0U, directives.erase(RelativePathPiece{"a/b/2.txt"}));
+  EXPECT_EQ(1U, directives.erase(RelativePathPiece{"a/b/1.txt"}));
+  EXPECT_TRUE(
+      directives.find(RelativePathPiece{"a/b/1.txt"}) == directives.end());
+  EXPECT_THAT(
+      pathsUnder(directives, RelativePathPiece{"a"}),
+      UnorderedElementsAre(RelativePath{"a/c.txt"}));
+}
@@ -0,0 +1,60 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "CommitChanges.h"
+
+using folly::Future;
+using folly::makeFuture;
+using std::shared_ptr;
+
+namespace facebook {
+namespace eden {
+
+CommitChanges::CommitChanges(Hash fromHash, Hash toHash, ComputeFn compute)
+    : fromHash_(fromHash), toHash_(toHash), compute_(std::move(compute)) {}
+
+Future<shared_ptr<const CommitChanges::PathSet>> CommitChanges::getPaths() {
+  SharedPromiseType promise;
+  {
+    auto state = state_.wlock();
+    if (state->paths) {
+      return makeFuture(state->paths);
+    }
+    if (state->pending) {
+      return state->pending->getFuture();
+    }
+    promise = std::make_shared<SharedPromiseType::element_type>();
+    state->pending = promise;
+  }
+
+  // Call compute_ without holding the lock, since it may complete
+  // immediately and run the callback below inline.
+  auto future = promise->getFuture();
+  folly::makeFutureWith([this] { return compute_(); })
+      .then([ self = shared_from_this(), promise ](folly::Try<PathSet> && t) {
+        shared_ptr<const PathSet> paths;
+        if (t.hasValue()) {
+          paths = std::make_shared<const PathSet>(std::move(t.value()));
+        }
+        {
+          // On failure paths is still null, so the next call tries again.
+          auto state = self->state_.wlock();
+          state->paths = paths;
+          state->pending.reset();
+        }
+        if (paths) {
+          promise->setValue(std::move(paths));
+        } else {
+          promise->setException(t.exception());
+        }
+      });
+  return future;
+}
+}
+}
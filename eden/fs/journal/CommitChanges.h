@@ -0,0 +1,82 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Function.h>
+#include <folly/Synchronized.h>
+#include <folly/futures/Future.h>
+#include <folly/futures/SharedPromise.h>
+#include <memory>
+#include <unordered_set>
+#include "eden/fs/model/Hash.h"
+#include "eden/utils/PathFuncs.h"
+
+namespace facebook {
+namespace eden {
+
+/**
+ * The set of paths that differ in source control between two snapshots.
+ *
+ * Journal entries for checkouts carry one of these, so that clients can
+ * find out which files a checkout changed without walking the whole tree.
+ * Computing the set requires diffing the two commits, so that is only done
+ * the first time someone asks for it.  The result is then kept for later
+ * callers.
+ */
+class CommitChanges : public std::enable_shared_from_this<CommitChanges> {
+ public:
+  using PathSet = std::unordered_set<RelativePath>;
+  using ComputeFn = folly::Function<folly::Future<PathSet>()>;
+
+  /**
+   * Create a CommitChanges for the snapshots fromHash and toHash.
+   *
+   * compute is called to compute the changed paths when they are first
+   * needed.  It may be called again if it fails.  It may refer to objects
+   * owned by whoever recorded the change (such as the EdenMount), so
+   * getPaths() must only be called while those are still alive.
+   */
+  CommitChanges(Hash fromHash, Hash toHash, ComputeFn compute);
+
+  const Hash& getFromHash() const {
+    return fromHash_;
+  }
+  const Hash& getToHash() const {
+    return toHash_;
+  }
+
+  /**
+   * Get the changed paths, computing them if this is the first call.
+   *
+   * Concurrent callers share a single computation.  If it fails, the error
+   * is returned to the callers that were waiting on it, and the next call
+   * tries again.
+   */
+  folly::Future<std::shared_ptr<const PathSet>> getPaths();
+
+ private:
+  using SharedPromiseType =
+      std::shared_ptr<folly::SharedPromise<std::shared_ptr<const PathSet>>>;
+
+  struct State {
+    /** The paths, once they have been computed */
+    std::shared_ptr<const PathSet> paths;
+    /** Set while the paths are being computed */
+    SharedPromiseType pending;
+  };
+
+  const Hash fromHash_;
+  const Hash toHash_;
+  /** Only called by the thread that set state_.pending */
+  ComputeFn compute_;
+  folly::Synchronized<State> state_;
+};
+}
+}
@@ -9,49 +9,445 @@
  */
 #include "JournalDelta.h"
 
+#include <folly/Exception.h>
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <glog/logging.h>
+#include <thrift/lib/cpp2/protocol/Serializer.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "eden/fs/journal/CommitChanges.h"
+#include "eden/fs/journal/gen-cpp2/journal_types.h"
+
+using apache::thrift::CompactSerializer;
+using folly::ByteRange;
+using folly::StringPiece;
+
 namespace facebook {
 namespace eden {
 
-void Journal::addDelta(std::unique_ptr<JournalDelta>&& delta) {
-  delta->toSequence = nextSequence_++;
-  delta->fromSequence = delta->toSequence;
+namespace {
+/**
+ * compactChain() merges old deltas into ranges that each use about this
+ * fraction of the memory limit, so that the remaining history is still
+ * divided into a reasonable number of positions.
+ */
+constexpr size_t kCompactedRangesPerLimit = 32;
+
+/**
+ * Merge delta into the checkpoint being built in *pending, starting a new
+ * checkpoint if there is none.  delta->previous must already be set.
+ */
+void addToCheckpoint(
+    std::unique_ptr<JournalDelta>* pending,
+    size_t* pendingDeltas,
+    const JournalDelta& delta) {
+  if (!*pending) {
+    *pending = std::make_unique<JournalDelta>();
+    (*pending)->previous = delta.previous;
+    (*pending)->fromSequence = delta.fromSequence;
+    (*pending)->fromTime = delta.fromTime;
+    (*pending)->fromHash = delta.fromHash;
+    *pendingDeltas = 0;
+  }
+  auto& checkpoint = **pending;
+  checkpoint.toSequence = delta.toSequence;
+  checkpoint.toTime = delta.toTime;
+  checkpoint.toHash = delta.toHash;
+  checkpoint.changedFilesInOverlay.insert(
+      delta.changedFilesInOverlay.begin(), delta.changedFilesInOverlay.end());
+  checkpoint.commitChanges.insert(
+      checkpoint.commitChanges.end(),
+      delta.commitChanges.begin(),
+      delta.commitChanges.end());
+  ++*pendingDeltas;
+}
+
+/**
+ * Link a new delta on top of previous, and attach a checkpoint to it if
+ * enough deltas have accumulated since the last one.
+ */
+void linkDelta(
+    JournalDelta* delta,
+    std::shared_ptr<const JournalDelta> previous,
+    std::unique_ptr<JournalDelta>* pending,
+    size_t* pendingDeltas) {
+  delta->previous = std::move(previous);
+  delta->checkpoint.reset();
+  addToCheckpoint(pending, pendingDeltas, *delta);
+  if (*pendingDeltas >= Journal::kCheckpointInterval) {
+    delta->checkpoint = std::move(*pending);
+    *pendingDeltas = 0;
+  }
+}
+
+std::string hashToBytes(const Hash& hash) {
+  auto bytes = hash.getBytes();
+  return std::string{reinterpret_cast<const char*>(bytes.data()),
+                     bytes.size()};
+}
+
+Hash hashFromBytes(StringPiece bytes) {
+  return Hash{ByteRange{bytes}};
+}
+
+size_t chainMemoryUsage(const JournalDelta* delta) {
+  size_t usage = 0;
+  for (; delta; delta = delta->previous.get()) {
+    usage += delta->estimateMemoryUsage();
+  }
+  return usage;
+}
+}
+
+constexpr size_t Journal::kCheckpointInterval;
+
+Journal::Journal() {}
+
+Journal::~Journal() {
+  auto* node = pending_.exchange(nullptr);
+  while (node) {
+    std::unique_ptr<PendingDelta> owned(node);
+    node = owned->next;
+  }
+}
 
+void Journal::addDelta(std::unique_ptr<JournalDelta>&& delta) {
   delta->toTime = std::chrono::steady_clock::now();
   delta->fromTime = delta->toTime;
 
-  delta->previous = latest_;
+  auto* node = new PendingDelta{std::move(delta), nullptr};
+  node->next = pending_.load();
+  while (!pending_.compare_exchange_weak(node->next, node)) {
+  }
+
+  // Link the pending deltas ourselves, unless another appender is already
+  // doing so.  In that case it is guaranteed to see our delta: it checks
+  // pending_ again after clearing linking_.
+  while (pending_.load() && !linking_.exchange(true)) {
+    bool linked;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      linked = linkPendingLocked();
+    }
+    linking_.store(false);
+    if (linked) {
+      notifySubscribers();
+    }
+  }
+}
+
+bool Journal::linkPendingLocked() {
+  auto* node = pending_.exchange(nullptr);
+  if (!node) {
+    return false;
+  }
+
+  // The stack is newest first, so reverse it.
+  PendingDelta* oldest = nullptr;
+  while (node) {
+    auto* next = node->next;
+    node->next = oldest;
+    oldest = node;
+    node = next;
+  }
+  while (oldest) {
+    std::unique_ptr<PendingDelta> owned(oldest);
+    oldest = owned->next;
+    appendLocked(std::move(owned->delta));
+  }
+  return true;
+}
+
+void Journal::appendLocked(std::unique_ptr<JournalDelta>&& delta) {
+  delta->toSequence = nextSequence_++;
+  delta->fromSequence = delta->toSequence;
 
   // If the hashes were not set to anything, default to copying
   // the value from the prior journal entry
-  if (delta->previous && delta->fromHash == kZeroHash &&
-      delta->toHash == kZeroHash) {
-    delta->fromHash = delta->previous->toHash;
+  if (latest_ && delta->fromHash == kZeroHash && delta->toHash == kZeroHash) {
+    delta->fromHash = latest_->toHash;
     delta->toHash = delta->fromHash;
   }
 
+  linkDelta(
+      delta.get(), latest_, &pendingCheckpoint_, &pendingCheckpointDeltas_);
+  memoryUsage_ += delta->estimateMemoryUsage();
   latest_ = std::shared_ptr<const JournalDelta>(std::move(delta));
+}
 
-  for (auto& sub : subscribers_) {
+void Journal::notifySubscribers() {
+  auto subscribers = subscribers_.wlock();
+  for (auto& sub : subscribers->callbacks) {
     sub.second();
   }
 }
 
-std::shared_ptr<const JournalDelta> Journal::getLatest() const {
-  return latest_;
+std::shared_ptr<const JournalDelta> Journal::getLatest() {
+  bool linked;
+  std::shared_ptr<const JournalDelta> latest;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    linked = linkPendingLocked();
+    latest = latest_;
+  }
+  if (linked) {
+    notifySubscribers();
+  }
+  return latest;
+}
+
+size_t Journal::getMemoryUsage() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return memoryUsage_;
 }
 
 void Journal::replaceJournal(std::unique_ptr<JournalDelta>&& delta) {
+  // Any pending deltas are left alone, and will be linked on top of the
+  // new chain.
+  std::lock_guard<std::mutex> guard(mutex_);
+  replaceJournalLocked(std::move(delta));
+}
+
+void Journal::replaceJournalLocked(std::unique_ptr<JournalDelta>&& delta) {
   latest_ = std::shared_ptr<const JournalDelta>(std::move(delta));
+  memoryUsage_ = chainMemoryUsage(latest_.get());
+  rebuildPendingCheckpoint();
+}
+
+void Journal::rebuildPendingCheckpoint() {
+  pendingCheckpoint_.reset();
+  pendingCheckpointDeltas_ = 0;
+
+  // The deltas after the newest checkpoint are already shared, so a
+  // checkpoint covering them can only be attached to the next new delta.
+  std::vector<const JournalDelta*> uncovered;
+  for (auto* delta = latest_.get(); delta && !delta->checkpoint;
+       delta = delta->previous.get()) {
+    uncovered.push_back(delta);
+  }
+  for (auto it = uncovered.rbegin(); it != uncovered.rend(); ++it) {
+    addToCheckpoint(&pendingCheckpoint_, &pendingCheckpointDeltas_, **it);
+  }
+}
+
+std::unique_ptr<JournalDelta> Journal::compactChain(
+    const JournalDelta& latest,
+    size_t memoryLimit) {
+  // Keep the newest deltas as they are, so that recent positions (which
+  // are by far the most commonly queried) remain exact.
+  std::vector<const JournalDelta*> recent;
+  size_t usage = 0;
+  const JournalDelta* delta = &latest;
+  while (delta) {
+    auto deltaUsage = delta->estimateMemoryUsage();
+    if (!recent.empty() && usage + deltaUsage > memoryLimit / 2) {
+      break;
+    }
+    usage += deltaUsage;
+    recent.push_back(delta);
+    delta = delta->previous.get();
+  }
+  if (!delta) {
+    return nullptr;
+  }
+
+  // Merge the older deltas into coarse ranges, newest first, until the
+  // limit is reached.  Anything older than that is dropped.
+  auto rangeLimit = std::max<size_t>(memoryLimit / kCompactedRangesPerLimit, 1);
+  std::vector<std::unique_ptr<JournalDelta>> ranges;
+  while (delta && usage < memoryLimit) {
+    auto range = std::make_unique<JournalDelta>();
+    range->toSequence = delta->toSequence;
+    range->toTime = delta->toTime;
+    range->toHash = delta->toHash;
+    size_t rangeUsage = 0;
+    while (delta && rangeUsage < rangeLimit) {
+      range->fromSequence = delta->fromSequence;
+      range->fromTime = delta->fromTime;
+      range->fromHash = delta->fromHash;
+      range->changedFilesInOverlay.insert(
+          delta->changedFilesInOverlay.begin(),
+          delta->changedFilesInOverlay.end());
+      range->commitChanges.insert(
+          range->commitChanges.end(),
+          delta->commitChanges.begin(),
+          delta->commitChanges.end());
+      // Recomputing the full estimate on every step would be quadratic, so
+      // just count the size of each delta.  This overestimates ranges that
+      // contain the same path several times, which only makes them smaller.
+      rangeUsage += delta->estimateMemoryUsage();
+      delta = delta->previous.get();
+    }
+    usage += range->estimateMemoryUsage();
+    ranges.push_back(std::move(range));
+  }
+  if (delta) {
+    VLOG(2) << "journal compaction dropped the changes up to sequence "
+            << delta->toSequence;
+  }
+
+  // Link the new chain together, starting from the oldest range, and give
+  // it new checkpoints.  (The old ones refer to the old chain.)
+  std::shared_ptr<const JournalDelta> previous;
+  std::unique_ptr<JournalDelta> pending;
+  size_t pendingDeltas = 0;
+  for (auto it = ranges.rbegin(); it != ranges.rend(); ++it) {
+    linkDelta(it->get(), std::move(previous), &pending, &pendingDeltas);
+    previous = std::shared_ptr<const JournalDelta>(std::move(*it));
+  }
+  std::unique_ptr<JournalDelta> result;
+  for (auto it = recent.rbegin(); it != recent.rend(); ++it) {
+    if (result) {
+      previous = std::shared_ptr<const JournalDelta>(std::move(result));
+    }
+    result = std::make_unique<JournalDelta>(**it);
+    linkDelta(result.get(), std::move(previous), &pending, &pendingDeltas);
+  }
+  return result;
+}
+
+bool Journal::replaceHistory(
+    const std::shared_ptr<const JournalDelta>& oldLatest,
+    std::unique_ptr<JournalDelta>&& compacted) {
+  std::lock_guard<std::mutex> guard(mutex_);
+
+  // Find the deltas that were added after oldLatest.  Pending deltas will
+  // be linked on top of the result later.
+  std::vector<const JournalDelta*> newer;
+  const JournalDelta* delta = latest_.get();
+  while (delta != oldLatest.get()) {
+    if (!delta) {
+      return false;
+    }
+    newer.push_back(delta);
+    delta = delta->previous.get();
+  }
+
+  // The copies do not get checkpoints of their own here.  replaceJournal()
+  // includes them in the next checkpoint instead.
+  auto result = std::move(compacted);
+  for (auto it = newer.rbegin(); it != newer.rend(); ++it) {
+    auto copy = std::make_unique<JournalDelta>(**it);
+    copy->previous = std::shared_ptr<const JournalDelta>(std::move(result));
+    copy->checkpoint.reset();
+    result = std::move(copy);
+  }
+  replaceJournalLocked(std::move(result));
+  return true;
+}
+
+void Journal::saveHistory(
+    AbsolutePathPiece path,
+    uint64_t mountGeneration,
+    const JournalDelta& latest) {
+  std::vector<const JournalDelta*> chain;
+  for (auto* delta = &latest; delta; delta = delta->previous.get()) {
+    chain.push_back(delta);
+  }
+
+  journal::SerializedJournal saved;
+  saved.mountGeneration = static_cast<int64_t>(mountGeneration);
+  for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+    const auto& delta = **it;
+    journal::SerializedJournalDelta out;
+    out.fromSequence = static_cast<int64_t>(delta.fromSequence);
+    out.toSequence = static_cast<int64_t>(delta.toSequence);
+    out.fromHash = hashToBytes(delta.fromHash);
+    out.toHash = hashToBytes(delta.toHash);
+    for (const auto& file : delta.changedFilesInOverlay) {
+      out.changedFilesInOverlay.push_back(file.stringPiece().str());
+    }
+    for (const auto& changes : delta.commitChanges) {
+      journal::SerializedCommitChanges outChanges;
+      outChanges.fromHash = hashToBytes(changes->getFromHash());
+      outChanges.toHash = hashToBytes(changes->getToHash());
+      out.commitChanges.push_back(std::move(outChanges));
+    }
+    saved.deltas.push_back(std::move(out));
+  }
+  folly::writeFileAtomic(
+      path.stringPiece(), CompactSerializer::serialize<std::string>(saved));
+}
+
+folly::Optional<uint64_t> Journal::restoreHistory(
+    AbsolutePathPiece path,
+    const Hash& snapshotHash,
+    const CommitChangesFactory& makeCommitChanges) {
+  std::string contents;
+  if (!folly::readFile(path.value().c_str(), contents)) {
+    return folly::none;
+  }
+  if (::unlink(path.value().c_str()) != 0) {
+    folly::throwSystemError("error removing ", path);
+  }
+
+  // Convert everything before touching the journal, so that a bad file
+  // leaves it empty rather than half restored.
+  std::vector<std::unique_ptr<JournalDelta>> deltas;
+  uint64_t mountGeneration;
+  try {
+    auto saved = CompactSerializer::deserialize<journal::SerializedJournal>(
+        contents);
+    mountGeneration = static_cast<uint64_t>(saved.mountGeneration);
+    auto now = std::chrono::steady_clock::now();
+    SequenceNumber lastSequence = 0;
+    for (const auto& in : saved.deltas) {
+      auto delta = std::make_unique<JournalDelta>();
+      delta->fromSequence = static_cast<SequenceNumber>(in.fromSequence);
+      delta->toSequence = static_cast<SequenceNumber>(in.toSequence);
+      if (delta->fromSequence <= lastSequence ||
+          delta->toSequence < delta->fromSequence) {
+        throw std::runtime_error("the sequence numbers are out of order");
+      }
+      lastSequence = delta->toSequence;
+      delta->fromTime = now;
+      delta->toTime = now;
+      delta->fromHash = hashFromBytes(in.fromHash);
+      delta->toHash = hashFromBytes(in.toHash);
+      for (const auto& file : in.changedFilesInOverlay) {
+        delta->changedFilesInOverlay.emplace(file);
+      }
+      for (const auto& changes : in.commitChanges) {
+        delta->commitChanges.push_back(makeCommitChanges(
+            hashFromBytes(changes.fromHash), hashFromBytes(changes.toHash)));
+      }
+      deltas.push_back(std::move(delta));
+    }
+  } catch (const std::exception& ex) {
+    LOG(WARNING) << "ignoring invalid journal file " << path << ": "
+                 << folly::exceptionStr(ex);
+    return folly::none;
+  }
+  if (deltas.empty() || !(deltas.back()->toHash == snapshotHash)) {
+    LOG(WARNING) << "ignoring journal file " << path
+                 << " that does not end at the current snapshot "
+                 << snapshotHash;
+    return folly::none;
+  }
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  DCHECK(!latest_ && !pending_.load());
+  for (auto& delta : deltas) {
+    linkDelta(
+        delta.get(), latest_, &pendingCheckpoint_, &pendingCheckpointDeltas_);
+    memoryUsage_ += delta->estimateMemoryUsage();
+    latest_ = std::shared_ptr<const JournalDelta>(std::move(delta));
+  }
+  nextSequence_ = latest_->toSequence + 1;
+  return mountGeneration;
 }
 
 uint64_t Journal::registerSubscriber(folly::Function<void()>&& callback) {
-  auto id = nextSubscriberId_++;
-  subscribers_[id] = std::move(callback);
+  auto subscribers = subscribers_.wlock();
+  auto id = subscribers->nextId++;
+  subscribers->callbacks[id] = std::move(callback);
   return id;
 }
 
 void Journal::cancelSubscriber(uint64_t id) {
-  subscribers_.erase(id);
+  subscribers_.wlock()->callbacks.erase(id);
 }
 }
 }
@@ -9,13 +9,21 @@
  */
 #pragma once
 #include <folly/Function.h>
+#include <folly/Optional.h>
+#include <folly/Synchronized.h>
+#include <atomic>
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
+#include "eden/utils/PathFuncs.h"
 
 namespace facebook {
 namespace eden {
 
+class CommitChanges;
+class Hash;
 class JournalDelta;
 
 /** The Journal exists to answer questions about how files are changing
@@ -31,22 +39,36 @@ class JournalDelta;
  * revisions (the prior and new revision hash) from which we can derive
  * the larger list of files.
  *
- * The Journal class is not internally threadsafe; we make it safe
- * through the use of folly::Synchronized in the EdenMount class
- * that owns the Journal.
+ * The Journal class is internally threadsafe.  Appending a delta never
+ * blocks: the delta is pushed onto a lock-free stack of pending deltas, and
+ * whichever thread next finds the journal idle assigns sequence numbers to
+ * everything pending and links it into the chain.  Readers link any pending
+ * deltas before looking at the chain, so a thread always sees the deltas it
+ * added itself.
  */
 class Journal {
  public:
   using SequenceNumber = uint64_t;
 
+  /** The number of deltas covered by each JournalDelta::checkpoint */
+  static constexpr size_t kCheckpointInterval = 256;
+
+  Journal();
+  ~Journal();
+
+  Journal(const Journal&) = delete;
+  Journal& operator=(const Journal&) = delete;
+
   /** Add a delta to the journal
    * The delta will have a new sequence number and timestamp
-   * applied. */
+   * applied.  The timestamp is applied immediately, but the sequence
+   * number may be applied later by another thread; deltas added
+   * concurrently by different threads are ordered arbitrarily. */
   void addDelta(std::unique_ptr<JournalDelta>&& delta);
 
   /** Get a shared, immutable reference to the tip of the journal.
    * May return nullptr if there have been no changes */
-  std::shared_ptr<const JournalDelta> getLatest() const;
+  std::shared_ptr<const JournalDelta> getLatest();
 
   /** Replace the journal with a new delta.
    * The new delta will typically be the result of JournalDelta::merge().
@@ -54,9 +76,76 @@ class Journal {
    * supplied delta is moved in and replaces current tip. */
   void replaceJournal(std::unique_ptr<JournalDelta>&& delta);
 
+  /** Get an estimate of the memory held by the deltas in the journal.
+   * Deltas that are still referenced elsewhere after being replaced, and
+   * deltas that have not been linked into the chain yet, are not
+   * included. */
+  size_t getMemoryUsage();
+
+  /** Build a compacted copy of the chain of deltas ending at latest,
+   * using roughly memoryLimit bytes.
+   *
+   * The newest deltas that fit in half of the limit are copied unchanged.
+   * Older deltas are merged into coarse ranges, which only use memory once
+   * for each path that changed repeatedly, and the oldest ranges are
+   * dropped entirely once the limit is reached.  A query that reaches the
+   * end of the chain before the position it is looking for must report
+   * that the journal was truncated; see JournalDelta::isTruncatedAfter().
+   *
+   * This only reads the (immutable) deltas, so it does not block changes to
+   * the journal.  Returns nullptr if there is nothing to compact. */
+  static std::unique_ptr<JournalDelta> compactChain(
+      const JournalDelta& latest,
+      size_t memoryLimit);
+
+  /** Replace the deltas up to and including oldLatest with compacted, which
+   * is typically the result of compactChain(oldLatest).
+   *
+   * Any deltas that were added after oldLatest are copied on top of
+   * compacted, so nothing recorded while the compacted chain was being
+   * built is lost.  Returns false without changing anything if oldLatest is
+   * no longer part of the journal. */
+  bool replaceHistory(
+      const std::shared_ptr<const JournalDelta>& oldLatest,
+      std::unique_ptr<JournalDelta>&& compacted);
+
+  /** Write the chain of deltas ending at latest to a file at path, along
+   * with the mountGeneration that the positions in it belong to.
+   *
+   * This is meant to be called when the mount point is unmounted, with a
+   * chain that has been compacted to a reasonable size, so that the next
+   * mount can continue the journal with restoreHistory(). */
+  static void saveHistory(
+      AbsolutePathPiece path,
+      uint64_t mountGeneration,
+      const JournalDelta& latest);
+
+  using CommitChangesFactory =
+      std::function<std::shared_ptr<CommitChanges>(Hash, Hash)>;
+
+  /** Read back the deltas written by saveHistory() and continue the
+   * journal from them, so that new deltas get the sequence numbers that
+   * follow on from the saved ones.
+   *
+   * The file is removed, so that it is not trusted again after an unclean
+   * shutdown.  It is ignored if it cannot be read, or if it does not end at
+   * snapshotHash.  makeCommitChanges is used to recreate the CommitChanges
+   * of the saved deltas.  The timestamps of the restored deltas are all set
+   * to the current time, since steady_clock times do not survive a restart.
+   *
+   * This must be called before any deltas are added.  Returns the saved
+   * mountGeneration, or folly::none if nothing was restored. */
+  folly::Optional<uint64_t> restoreHistory(
+      AbsolutePathPiece path,
+      const Hash& snapshotHash,
+      const CommitChangesFactory& makeCommitChanges);
+
   /** Register a subscriber.
    * A subscriber is just a callback that is called whenever the
    * journal has changed.
+   * Subscribers are called after the new deltas have been linked, without
+   * any journal locks held.  A batch of deltas that are linked together
+   * results in a single call.
    * It is recommended that the subscriber callback do the minimal
    * amount of work needed to schedule the real work to happen in
    * some other context because journal updates are likely to happen
@@ -69,15 +158,53 @@ class Journal {
   void cancelSubscriber(uint64_t id);
 
  private:
+  /** A delta that has been added but not yet linked into the chain */
+  struct PendingDelta {
+    std::unique_ptr<JournalDelta> delta;
+    PendingDelta* next;
+  };
+
+  /** Link the pending deltas into the chain, in the order they were added.
+   * mutex_ must be held.  Returns whether there were any. */
+  bool linkPendingLocked();
+  /** Link a single new delta on top of latest_.  mutex_ must be held. */
+  void appendLocked(std::unique_ptr<JournalDelta>&& delta);
+  void replaceJournalLocked(std::unique_ptr<JournalDelta>&& delta);
+  /** Recompute pendingCheckpoint_ after latest_ has been replaced */
+  void rebuildPendingCheckpoint();
+  void notifySubscribers();
+
+  /** The deltas added since the last time the chain was updated, newest
+   * first */
+  std::atomic<PendingDelta*> pending_{nullptr};
+  /** Set while a thread in addDelta() is linking the pending deltas, so
+   * that other appenders can leave their deltas for it instead of
+   * waiting. */
+  std::atomic<bool> linking_{false};
+
+  /** Protects the members below */
+  std::mutex mutex_;
   /** The sequence number that we'll use for the next entry
    * that we link into the chain */
   SequenceNumber nextSequence_{1};
   /** The most recently recorded entry */
   std::shared_ptr<const JournalDelta> latest_;
-  /** The next id to assign to subscribers */
-  uint64_t nextSubscriberId_{1};
-  /** The subscribers */
-  std::unordered_map<uint64_t, folly::Function<void()>> subscribers_;
+  /** The estimated memory used by latest_ and its chain */
+  size_t memoryUsage_{0};
+  /** The checkpoint for the deltas added since the most recent delta with
+   * a checkpoint.  It is attached to the next delta once it covers
+   * kCheckpointInterval deltas. */
+  std::unique_ptr<JournalDelta> pendingCheckpoint_;
+  size_t pendingCheckpointDeltas_{0};
+
+  struct Subscribers {
+    /** The next id to assign to subscribers */
+    uint64_t nextId{1};
+    std::unordered_map<uint64_t, folly::Function<void()>> callbacks;
+  };
+  /** The subscribers.  This has its own lock so that they are never called
+   * while mutex_ is held. */
+  folly::Synchronized<Subscribers> subscribers_;
 };
 }
 }
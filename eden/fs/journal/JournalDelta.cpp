@@ -27,18 +27,31 @@ std::unique_ptr<JournalDelta> JournalDelta::merge(
 
   result->toSequence = current->toSequence;
   result->toTime = current->toTime;
+  result->toHash = current->toHash;
 
   while (current) {
     if (current->toSequence < limitSequence) {
       break;
     }
 
+    // If every delta covered by the checkpoint is needed, use the checkpoint
+    // instead of visiting each of them.
+    if (current->checkpoint &&
+        current->checkpoint->fromSequence >= limitSequence) {
+      current = current->checkpoint.get();
+    }
+
     result->fromSequence = current->fromSequence;
     result->fromTime = current->fromTime;
+    result->fromHash = current->fromHash;
 
     result->changedFilesInOverlay.insert(
         current->changedFilesInOverlay.begin(),
         current->changedFilesInOverlay.end());
+    result->commitChanges.insert(
+        result->commitChanges.end(),
+        current->commitChanges.begin(),
+        current->commitChanges.end());
 
     // Continue the chain, but not if the caller requested that
     // we prune it out.
@@ -51,5 +64,22 @@ std::unique_ptr<JournalDelta> JournalDelta::merge(
 
   return result;
 }
+
+size_t JournalDelta::estimateMemoryUsage() const {
+  size_t usage = sizeof(JournalDelta);
+  usage += changedFilesInOverlay.bucket_count() * sizeof(void*);
+  for (const auto& path : changedFilesInOverlay) {
+    // Each path lives in a hash table node, along with its cached hash and
+    // the pointer to the next node.
+    usage += sizeof(RelativePath) + 2 * sizeof(void*) + path.value().size();
+  }
+  // The CommitChanges are shared with merged deltas and checkpoints, so
+  // only count the references to them.
+  usage += commitChanges.capacity() * sizeof(std::shared_ptr<CommitChanges>);
+  if (checkpoint) {
+    usage += checkpoint->estimateMemoryUsage();
+  }
+  return usage;
+}
 }
 }
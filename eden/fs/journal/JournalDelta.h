@@ -12,12 +12,15 @@
 
 #include <chrono>
 #include <unordered_set>
+#include <vector>
 #include "eden/fs/model/Hash.h"
 #include "eden/utils/PathFuncs.h"
 
 namespace facebook {
 namespace eden {
 
+class CommitChanges;
+
 class JournalDelta {
  public:
   JournalDelta() = default;
@@ -43,8 +46,26 @@ class JournalDelta {
   /** The set of files that changed in the overlay in this update */
   std::unordered_set<RelativePath> changedFilesInOverlay;
 
+  /** The files that changed in source control when this update moved to a
+   * different snapshot, such as in a checkout.  A merged delta carries the
+   * changes for every snapshot transition that it covers.  The paths are
+   * computed lazily; see CommitChanges. */
+  std::vector<std::shared_ptr<CommitChanges>> commitChanges;
+
+  /** A checkpoint that lets code walking the chain skip over many deltas at
+   * once.
+   *
+   * The Journal sets this on every few hundred deltas.  It is a delta
+   * covering the range from just after the previous delta with a checkpoint
+   * up to and including this one, with all of their changed files merged
+   * together.  Its previous pointer is the delta just before that range.
+   * It is null on all other deltas. */
+  std::shared_ptr<const JournalDelta> checkpoint;
+
   /** Merge the deltas running back from this delta for all deltas
    * whose toSequence is >= limitSequence.
+   * Ranges covered by a checkpoint are merged all at once, so this only
+   * needs to visit a few deltas at either end of the range.
    * The default limit value is 0 which is never assigned by the Journal
    * and thus indicates that all deltas should be merged.
    * if pruneAfterLimit is true and we stop due to hitting limitSequence,
@@ -55,6 +76,19 @@ class JournalDelta {
   std::unique_ptr<JournalDelta> merge(
       Journal::SequenceNumber limitSequence = 0,
       bool pruneAfterLimit = false) const;
+
+  /** Returns true if this is the oldest delta in its chain, and changes made
+   * after sequence are missing from the chain because older deltas were
+   * dropped when the journal was compacted.
+   * Code that walks the chain looking for the changes since sequence should
+   * call this on the last delta it reaches. */
+  bool isTruncatedAfter(Journal::SequenceNumber sequence) const {
+    return !previous && fromSequence > sequence + 1;
+  }
+
+  /** Returns an estimate of the memory used by this delta and its
+   * checkpoint, not including the rest of the chain. */
+  size_t estimateMemoryUsage() const;
 };
 }
 }
@@ -0,0 +1,29 @@
+namespace cpp2 facebook.eden.journal
+
+typedef binary Hash
+typedef string RelativePath
+
+// The commits of a CommitChanges.  The paths that changed between them are
+// computed again when they are next needed.
+struct SerializedCommitChanges {
+  1: Hash fromHash
+  2: Hash toHash
+}
+
+struct SerializedJournalDelta {
+  1: i64 fromSequence
+  2: i64 toSequence
+  3: Hash fromHash
+  4: Hash toHash
+  5: list<RelativePath> changedFilesInOverlay
+  6: list<SerializedCommitChanges> commitChanges
+}
+
+// A mount point's journal, saved when it was unmounted.
+struct SerializedJournal {
+  // The mountGeneration of the mount that recorded the journal, which the
+  // next mount keeps so that the positions it handed out stay valid.
+  1: i64 mountGeneration
+  // Oldest first
+  2: list<SerializedJournalDelta> deltas
+}
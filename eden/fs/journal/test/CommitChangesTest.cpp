@@ -0,0 +1,86 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/journal/CommitChanges.h"
+
+#include <folly/futures/Promise.h>
+#include <gtest/gtest.h>
+#include "eden/fs/journal/JournalDelta.h"
+
+using namespace facebook::eden;
+using folly::Future;
+using folly::makeFuture;
+
+TEST(CommitChanges, computedOnceOnDemand) {
+  size_t numCalls = 0;
+  folly::Promise<CommitChanges::PathSet> promise;
+  auto changes = std::make_shared<CommitChanges>(
+      Hash{}, Hash{}, [&]() -> Future<CommitChanges::PathSet> {
+        ++numCalls;
+        return promise.getFuture();
+      });
+  EXPECT_EQ(0, numCalls);
+
+  // Concurrent callers share the same computation.
+  auto future1 = changes->getPaths();
+  auto future2 = changes->getPaths();
+  EXPECT_EQ(1, numCalls);
+  EXPECT_FALSE(future1.isReady());
+
+  promise.setValue(CommitChanges::PathSet{RelativePath("a/b"),
+                                          RelativePath("c")});
+  ASSERT_TRUE(future1.isReady());
+  ASSERT_TRUE(future2.isReady());
+  EXPECT_EQ(2, future1.value()->size());
+  EXPECT_EQ(future1.value(), future2.value());
+
+  // Later callers get the memoized result.
+  auto future3 = changes->getPaths();
+  ASSERT_TRUE(future3.isReady());
+  EXPECT_EQ(future1.value(), future3.value());
+  EXPECT_EQ(1, numCalls);
+}
+
+TEST(CommitChanges, retriedAfterFailure) {
+  size_t numCalls = 0;
+  auto changes = std::make_shared<CommitChanges>(
+      Hash{}, Hash{}, [&]() -> Future<CommitChanges::PathSet> {
+        if (++numCalls == 1) {
+          return makeFuture<CommitChanges::PathSet>(
+              std::runtime_error("failed to fetch tree"));
+        }
+        return makeFuture(CommitChanges::PathSet{RelativePath("x")});
+      });
+
+  auto future = changes->getPaths();
+  ASSERT_TRUE(future.isReady());
+  EXPECT_THROW(future.value(), std::runtime_error);
+
+  future = changes->getPaths();
+  ASSERT_TRUE(future.isReady());
+  EXPECT_EQ(1, future.value()->count(RelativePath("x")));
+  EXPECT_EQ(2, numCalls);
+}
+
+TEST(CommitChanges, mergedDeltasKeepAllChanges) {
+  Journal journal;
+  for (int n = 0; n < 3; ++n) {
+    auto delta = std::make_unique<JournalDelta>();
+    delta->commitChanges.push_back(std::make_shared<CommitChanges>(
+        Hash{}, Hash{}, [] { return makeFuture(CommitChanges::PathSet{}); }));
+    journal.addDelta(std::move(delta));
+    journal.addDelta(std::make_unique<JournalDelta>(
+        JournalDelta{RelativePath("file")}));
+  }
+
+  auto merged = journal.getLatest()->merge(2, true);
+  ASSERT_TRUE(merged != nullptr);
+  EXPECT_EQ(2, merged->commitChanges.size());
+  EXPECT_EQ(3, journal.getLatest()->merge()->commitChanges.size());
+}
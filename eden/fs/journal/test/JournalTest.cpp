@@ -7,7 +7,13 @@
  *  of patent rights can be found in the PATENTS file in the same directory.
  *
  */
+#include <folly/Conv.h>
+#include <folly/experimental/TestUtil.h>
 #include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "eden/fs/journal/CommitChanges.h"
 #include "eden/fs/journal/JournalDelta.h"
 
 using namespace facebook::eden;
@@ -78,3 +84,217 @@ TEST(Journal, chain) {
   EXPECT_EQ(1, latest->fromSequence);
   EXPECT_TRUE(latest->previous == nullptr);
 }
+
+TEST(Journal, compaction) {
+  Journal journal;
+  EXPECT_EQ(0, journal.getMemoryUsage());
+
+  // Record many changes to a small set of files, as a build would.
+  for (int n = 0; n < 100; ++n) {
+    auto delta = std::make_unique<JournalDelta>();
+    delta->changedFilesInOverlay.insert(
+        RelativePath(folly::to<std::string>("dir/file", n % 10)));
+    journal.addDelta(std::move(delta));
+  }
+  auto latest = journal.getLatest();
+  auto usage = journal.getMemoryUsage();
+  EXPECT_LT(0, usage);
+
+  // Even with a limit that the journal already fits in, the older half of
+  // the deltas is merged into ranges.
+  auto compacted = Journal::compactChain(*latest, usage);
+  ASSERT_TRUE(compacted != nullptr);
+
+  // A change recorded while the compacted chain was being built is kept.
+  auto delta = std::make_unique<JournalDelta>();
+  delta->changedFilesInOverlay.insert(RelativePath("new"));
+  journal.addDelta(std::move(delta));
+
+  EXPECT_TRUE(journal.replaceHistory(latest, std::move(compacted)));
+  EXPECT_GT(usage, journal.getMemoryUsage());
+
+  auto newLatest = journal.getLatest();
+  EXPECT_EQ(101, newLatest->toSequence);
+  EXPECT_EQ(1, newLatest->changedFilesInOverlay.count(RelativePath("new")));
+  EXPECT_EQ(100, newLatest->previous->toSequence);
+
+  // The compacted chain still covers every sequence number, and all of the
+  // paths, just with coarser ranges.
+  const JournalDelta* oldest = newLatest.get();
+  size_t numDeltas = 1;
+  while (oldest->previous) {
+    EXPECT_EQ(oldest->fromSequence, oldest->previous->toSequence + 1);
+    oldest = oldest->previous.get();
+    ++numDeltas;
+  }
+  EXPECT_EQ(1, oldest->fromSequence);
+  EXPECT_FALSE(oldest->isTruncatedAfter(0));
+  EXPECT_GT(101, numDeltas);
+  EXPECT_EQ(11, newLatest->merge()->changedFilesInOverlay.size());
+
+  // The old chain is no longer part of the journal.
+  EXPECT_FALSE(journal.replaceHistory(
+      latest, Journal::compactChain(*newLatest, usage)));
+}
+
+TEST(Journal, compactionTruncates) {
+  Journal journal;
+  for (int n = 0; n < 10; ++n) {
+    auto delta = std::make_unique<JournalDelta>();
+    delta->changedFilesInOverlay.insert(
+        RelativePath(folly::to<std::string>("file", n)));
+    journal.addDelta(std::move(delta));
+  }
+
+  // With a tiny limit only the newest delta is kept.
+  auto latest = journal.getLatest();
+  auto compacted = Journal::compactChain(*latest, 1);
+  EXPECT_TRUE(journal.replaceHistory(latest, std::move(compacted)));
+  latest = journal.getLatest();
+  EXPECT_EQ(10, latest->fromSequence);
+  EXPECT_TRUE(latest->previous == nullptr);
+  EXPECT_TRUE(latest->isTruncatedAfter(5));
+  EXPECT_FALSE(latest->isTruncatedAfter(9));
+}
+
+TEST(Journal, saveAndRestore) {
+  folly::test::TemporaryDirectory tmpDir{"eden_journal_test"};
+  AbsolutePath path{(tmpDir.path() / "journal").string()};
+  Hash commit1{"1111111111111111111111111111111111111111"};
+  Hash commit2{"2222222222222222222222222222222222222222"};
+  auto makeCommitChanges = [](Hash from, Hash to) {
+    return std::make_shared<CommitChanges>(from, to, [] {
+      return folly::makeFuture(CommitChanges::PathSet{});
+    });
+  };
+
+  Journal journal;
+  auto delta = std::make_unique<JournalDelta>();
+  delta->toHash = commit1;
+  journal.addDelta(std::move(delta));
+  journal.addDelta(std::make_unique<JournalDelta>(
+      std::initializer_list<RelativePath>{RelativePath("foo/bar")}));
+  delta = std::make_unique<JournalDelta>();
+  delta->fromHash = commit1;
+  delta->toHash = commit2;
+  delta->commitChanges.push_back(makeCommitChanges(commit1, commit2));
+  journal.addDelta(std::move(delta));
+  Journal::saveHistory(path, 1234, *journal.getLatest());
+
+  // The saved journal is only used if it ends at the current snapshot.
+  Journal other;
+  EXPECT_FALSE(
+      other.restoreHistory(path, commit1, makeCommitChanges).hasValue());
+  Journal::saveHistory(path, 1234, *journal.getLatest());
+
+  Journal restored;
+  auto generation = restored.restoreHistory(path, commit2, makeCommitChanges);
+  ASSERT_TRUE(generation.hasValue());
+  EXPECT_EQ(1234, generation.value());
+  auto latest = restored.getLatest();
+  EXPECT_EQ(3, latest->toSequence);
+  ASSERT_EQ(1, latest->commitChanges.size());
+  EXPECT_EQ(commit1, latest->commitChanges[0]->getFromHash());
+  EXPECT_EQ(commit2, latest->commitChanges[0]->getToHash());
+  auto merged = latest->merge(2);
+  EXPECT_EQ(2, merged->fromSequence);
+  EXPECT_EQ(1, merged->changedFilesInOverlay.count(RelativePath("foo/bar")));
+
+  // New deltas continue the sequence, and the file was removed so that it
+  // is only restored once.
+  restored.addDelta(std::make_unique<JournalDelta>());
+  EXPECT_EQ(4, restored.getLatest()->toSequence);
+  EXPECT_EQ(commit2, restored.getLatest()->toHash);
+  Journal again;
+  EXPECT_FALSE(
+      again.restoreHistory(path, commit2, makeCommitChanges).hasValue());
+}
+
+TEST(Journal, checkpoints) {
+  Journal journal;
+  const size_t numDeltas = 3 * Journal::kCheckpointInterval + 10;
+  for (size_t n = 1; n <= numDeltas; ++n) {
+    auto delta = std::make_unique<JournalDelta>();
+    delta->changedFilesInOverlay.insert(
+        RelativePath(folly::to<std::string>("file", n)));
+    journal.addDelta(std::move(delta));
+  }
+
+  // Every kCheckpointInterval'th delta has a checkpoint covering the deltas
+  // since the previous one.
+  size_t numCheckpoints = 0;
+  for (auto* delta = journal.getLatest().get(); delta;
+       delta = delta->previous.get()) {
+    if (delta->checkpoint) {
+      ++numCheckpoints;
+      EXPECT_EQ(0, delta->toSequence % Journal::kCheckpointInterval);
+      EXPECT_EQ(delta->toSequence, delta->checkpoint->toSequence);
+      EXPECT_EQ(
+          delta->toSequence - Journal::kCheckpointInterval + 1,
+          delta->checkpoint->fromSequence);
+      EXPECT_EQ(
+          Journal::kCheckpointInterval,
+          delta->checkpoint->changedFilesInOverlay.size());
+    }
+  }
+  EXPECT_EQ(3, numCheckpoints);
+
+  // Merging from any position gives the same results as visiting every
+  // delta.
+  auto latest = journal.getLatest();
+  for (Journal::SequenceNumber limit : {1, 5, 256, 257, 300, 700, 778}) {
+    auto merged = latest->merge(limit, true);
+    ASSERT_TRUE(merged != nullptr);
+    EXPECT_EQ(limit, merged->fromSequence);
+    EXPECT_EQ(numDeltas, merged->toSequence);
+    EXPECT_EQ(numDeltas - limit + 1, merged->changedFilesInOverlay.size());
+    EXPECT_EQ(
+        1,
+        merged->changedFilesInOverlay.count(
+            RelativePath(folly::to<std::string>("file", limit))));
+    EXPECT_FALSE(merged->isTruncatedAfter(limit - 1));
+  }
+}
+
+TEST(Journal, concurrentAppends) {
+  Journal journal;
+  std::atomic<size_t> notifications{0};
+  journal.registerSubscriber([&] { ++notifications; });
+
+  constexpr size_t kThreads = 8;
+  constexpr size_t kDeltasPerThread = 1000;
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&journal, t] {
+      for (size_t n = 0; n < kDeltasPerThread; ++n) {
+        auto delta = std::make_unique<JournalDelta>();
+        delta->changedFilesInOverlay.insert(
+            RelativePath(folly::to<std::string>("thread", t, "/file", n)));
+        journal.addDelta(std::move(delta));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  // Every delta was linked exactly once, with consecutive sequence numbers.
+  constexpr size_t kNumDeltas = kThreads * kDeltasPerThread;
+  auto latest = journal.getLatest();
+  ASSERT_TRUE(latest != nullptr);
+  EXPECT_EQ(kNumDeltas, latest->toSequence);
+  size_t numDeltas = 0;
+  auto expectedSequence = latest->toSequence;
+  for (auto* delta = latest.get(); delta; delta = delta->previous.get()) {
+    EXPECT_EQ(expectedSequence, delta->toSequence);
+    --expectedSequence;
+    ++numDeltas;
+  }
+  EXPECT_EQ(kNumDeltas, numDeltas);
+  EXPECT_EQ(kNumDeltas, latest->merge(1, true)->changedFilesInOverlay.size());
+
+  // Subscribers are called at least once, but batches of deltas that were
+  // linked together only result in one call.
+  EXPECT_LE(1, notifications.load());
+  EXPECT_GE(kNumDeltas, notifications.load());
+}
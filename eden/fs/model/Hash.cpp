@@ -11,13 +11,11 @@
 
 #include <folly/Conv.h>
 #include <folly/Format.h>
-#include <folly/String.h>
 #include <folly/io/Cursor.h>
 #include <folly/io/IOBuf.h>
 #include <folly/ssl/OpenSSLHash.h>
 #include <string>
 
-using std::string;
 using folly::ByteRange;
 using folly::StringPiece;
 using folly::range;
@@ -31,6 +29,35 @@ const Hash kZeroHash;
 namespace {
 Hash::Storage hexToBytes(StringPiece hex);
 Hash::Storage byteRangeToArray(ByteRange bytes);
+
+constexpr char kHexDigits[] = "0123456789abcdef";
+
+/**
+ * The value of each hex digit, indexed by character, or kInvalidHex for
+ * characters that are not hex digits.
+ *
+ * This is built at compile time, since Hash objects are often constructed
+ * from hex strings during static initialization.
+ */
+constexpr uint8_t kInvalidHex = 0xff;
+struct HexTable {
+  uint8_t values[256];
+};
+constexpr HexTable makeHexTable() {
+  HexTable table{};
+  for (int n = 0; n < 256; ++n) {
+    table.values[n] = kInvalidHex;
+  }
+  for (int n = 0; n < 10; ++n) {
+    table.values['0' + n] = n;
+  }
+  for (int n = 0; n < 6; ++n) {
+    table.values['a' + n] = 10 + n;
+    table.values['A' + n] = 10 + n;
+  }
+  return table;
+}
+constexpr HexTable kHexValues = makeHexTable();
 }
 
 Hash::Hash() : bytes_{{0}} {}
@@ -46,15 +73,16 @@ ByteRange Hash::getBytes() const {
 }
 
 std::string Hash::toString() const {
-  std::string result;
-  folly::hexlify(bytes_, result);
-  return result;
+  auto hex = toHex();
+  return std::string(hex.data(), hex.size());
 }
 
-std::size_t Hash::getHashCode() const {
-  static_assert(sizeof(size_t) <= RAW_SIZE, "crazy size_t type");
-  size_t result;
-  memcpy(&result, bytes_.data(), sizeof(size_t));
+Hash::HexStorage Hash::toHex() const {
+  HexStorage result;
+  for (size_t n = 0; n < RAW_SIZE; ++n) {
+    result[n * 2] = kHexDigits[bytes_[n] >> 4];
+    result[n * 2 + 1] = kHexDigits[bytes_[n] & 0xf];
+  }
   return result;
 }
 
@@ -77,15 +105,20 @@ Hash::Storage hexToBytes(StringPiece hex) {
         hex.size()));
   }
 
-  string bytes;
-  bool isSuccess = folly::unhexlify(hex, bytes);
-  if (!isSuccess) {
+  Hash::Storage hashBytes;
+  // Check all of the digits at once at the end, rather than branching on
+  // every one of them.
+  uint8_t invalid = 0;
+  for (size_t n = 0; n < Hash::RAW_SIZE; ++n) {
+    auto high = kHexValues.values[static_cast<uint8_t>(hex[n * 2])];
+    auto low = kHexValues.values[static_cast<uint8_t>(hex[n * 2 + 1])];
+    invalid |= high | low;
+    hashBytes[n] = static_cast<uint8_t>((high << 4) | low);
+  }
+  if (invalid & 0xf0) {
     throw std::invalid_argument(folly::sformat(
         "{} could not be unhexlified: likely due to invalid characters", hex));
   }
-
-  Hash::Storage hashBytes;
-  std::copy(bytes.begin(), bytes.end(), hashBytes.data());
   return hashBytes;
 }
 
@@ -117,12 +150,14 @@ Hash Hash::sha1(ByteRange data) {
 }
 
 std::ostream& operator<<(std::ostream& os, const Hash& hash) {
-  os << hash.toString();
+  auto hex = hash.toHex();
+  os.write(hex.data(), hex.size());
   return os;
 }
 
 void toAppend(const Hash& hash, std::string* result) {
-  folly::toAppend(hash.toString(), result);
+  auto hex = hash.toHex();
+  result->append(hex.data(), hex.size());
 }
 }
 }
@@ -13,6 +13,7 @@
 #include <folly/Range.h>
 #include <stdint.h>
 #include <array>
+#include <cstring>
 #include <iosfwd>
 
 namespace folly {
@@ -27,8 +28,9 @@ namespace eden {
  */
 class Hash : boost::totally_ordered<Hash> {
  public:
-  enum { RAW_SIZE = 20 };
+  enum { RAW_SIZE = 20, HEX_SIZE = RAW_SIZE * 2 };
   using Storage = std::array<uint8_t, RAW_SIZE>;
+  using HexStorage = std::array<char, HEX_SIZE>;
 
   /**
    * Create a 0-initialized hash
@@ -40,7 +42,9 @@ class Hash : boost::totally_ordered<Hash> {
   explicit Hash(folly::ByteRange bytes);
 
   /**
-   * @param hex is a string of 40 hexadecimal characters.
+   * @param hex is a string of 40 hexadecimal characters, in either case.
+   *
+   * Throws std::invalid_argument if hex is not a valid hash.
    */
   explicit Hash(folly::StringPiece hex);
 
@@ -59,7 +63,24 @@ class Hash : boost::totally_ordered<Hash> {
   /** @return 40-character [lowercase] hex representation of this hash. */
   std::string toString() const;
 
-  std::size_t getHashCode() const;
+  /**
+   * Returns the lowercase hex representation of this hash, without
+   * allocating.  This is what operator<< and toAppend() use.
+   */
+  HexStorage toHex() const;
+
+  /**
+   * Returns a hash code for use in hash tables.
+   *
+   * The bytes of a SHA-1 are already uniformly distributed, so this is just
+   * the first bytes of the hash, and does not need to be mixed any further.
+   */
+  std::size_t getHashCode() const {
+    static_assert(sizeof(size_t) <= RAW_SIZE, "crazy size_t type");
+    size_t result;
+    memcpy(&result, bytes_.data(), sizeof(size_t));
+    return result;
+  }
 
   bool operator==(const Hash&) const;
   bool operator<(const Hash&) const;
@@ -0,0 +1,266 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "NativeTree.h"
+
+#include <folly/Bits.h>
+#include <folly/Conv.h>
+#include <glog/logging.h>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include "eden/fs/model/Hash.h"
+#include "eden/fs/model/Tree.h"
+
+using folly::ByteRange;
+using folly::IOBuf;
+using folly::StringPiece;
+using std::invalid_argument;
+using std::vector;
+
+namespace facebook {
+namespace eden {
+
+const uint8_t kNativeTreeMagic[3] = {0xed, 'T', 'r'};
+
+namespace {
+// Offsets of the fields within each entry of the table
+constexpr size_t kHashOffset = 0;
+constexpr size_t kFileTypeOffset = Hash::RAW_SIZE;
+constexpr size_t kPermissionsOffset = kFileTypeOffset + 1;
+constexpr size_t kNameOffsetOffset = kPermissionsOffset + 3;
+constexpr size_t kNameLengthOffset = kNameOffsetOffset + 4;
+constexpr size_t kSizeOffset = kNameLengthOffset + 4;
+static_assert(
+    kSizeOffset == kNativeTreeV1EntrySize,
+    "version 1 entries end where the size begins");
+static_assert(
+    kSizeOffset + 8 == kNativeTreeEntrySize,
+    "native tree entry fields must fill the entry exactly");
+
+uint32_t loadUint32(const uint8_t* p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return folly::Endian::little(value);
+}
+
+void storeUint32(uint8_t* p, uint32_t value) {
+  value = folly::Endian::little(value);
+  memcpy(p, &value, sizeof(value));
+}
+
+uint64_t loadUint64(const uint8_t* p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return folly::Endian::little(value);
+}
+
+void storeUint64(uint8_t* p, uint64_t value) {
+  value = folly::Endian::little(value);
+  memcpy(p, &value, sizeof(value));
+}
+}
+
+bool isNativeTree(ByteRange data) {
+  return data.size() >= kNativeTreeHeaderSize &&
+      memcmp(data.data(), kNativeTreeMagic, sizeof(kNativeTreeMagic)) == 0 &&
+      (data[sizeof(kNativeTreeMagic)] == kNativeTreeVersion ||
+       data[sizeof(kNativeTreeMagic)] == 1);
+}
+
+Hash NativeTreeView::Entry::getHash() const {
+  return Hash(ByteRange{record_ + kHashOffset, Hash::RAW_SIZE});
+}
+
+uint8_t NativeTreeView::Entry::getOwnerPermissions() const {
+  return record_[kPermissionsOffset];
+}
+
+folly::Optional<uint64_t> NativeTreeView::Entry::getSize() const {
+  if (!hasSize_) {
+    return folly::none;
+  }
+  auto size = loadUint64(record_ + kSizeOffset);
+  if (size == kNativeTreeUnknownSize) {
+    return folly::none;
+  }
+  return size;
+}
+
+TreeEntry NativeTreeView::Entry::toTreeEntry() const {
+  return TreeEntry(
+      getHash(), name_.copy(), fileType_, getOwnerPermissions(), getSize());
+}
+
+NativeTreeView::NativeTreeView(const Hash& hash, IOBuf data)
+    : hash_{hash}, data_{std::move(data)} {
+  auto bytes = data_.coalesce();
+  if (!isNativeTree(bytes)) {
+    throw invalid_argument("data is not a native eden tree");
+  }
+  if (bytes[sizeof(kNativeTreeMagic)] == 1) {
+    entrySize_ = kNativeTreeV1EntrySize;
+  }
+  numEntries_ = loadUint32(bytes.data() + 4);
+  auto tableEnd = kNativeTreeHeaderSize +
+      static_cast<uint64_t>(numEntries_) * entrySize_;
+  if (tableEnd > bytes.size()) {
+    throw invalid_argument(folly::to<std::string>(
+        "native tree with ",
+        numEntries_,
+        " entries is truncated at ",
+        bytes.size(),
+        " bytes"));
+  }
+  names_ = ByteRange{bytes.data() + tableEnd, bytes.end()};
+}
+
+const uint8_t* NativeTreeView::record(size_t index) const {
+  DCHECK_LT(index, numEntries_);
+  return data_.data() + kNativeTreeHeaderSize + index * entrySize_;
+}
+
+PathComponentPiece NativeTreeView::nameAt(size_t index) const {
+  auto* r = record(index);
+  auto offset = loadUint32(r + kNameOffsetOffset);
+  auto length = loadUint32(r + kNameLengthOffset);
+  if (offset > names_.size() || length > names_.size() - offset) {
+    throw invalid_argument(folly::to<std::string>(
+        "native tree entry ", index, " has a name out of bounds"));
+  }
+  // The names were checked when they were serialized, so there is no need
+  // to check them again.
+  return PathComponentPiece{
+      StringPiece{ByteRange{names_.data() + offset, length}},
+      SkipPathSanityCheck()};
+}
+
+NativeTreeView::Entry NativeTreeView::getEntryAt(size_t index) const {
+  if (index >= numEntries_) {
+    throw std::out_of_range(folly::to<std::string>(
+        "entry ", index, " is out of range for a tree with ", numEntries_));
+  }
+  auto* r = record(index);
+  auto fileType = static_cast<FileType>(r[kFileTypeOffset]);
+  switch (fileType) {
+    case FileType::DIRECTORY:
+    case FileType::REGULAR_FILE:
+    case FileType::SYMLINK:
+      break;
+    default:
+      throw invalid_argument(folly::to<std::string>(
+          "native tree entry ",
+          index,
+          " has unknown file type ",
+          static_cast<int>(r[kFileTypeOffset])));
+  }
+  return Entry{r, nameAt(index), fileType, entrySize_ > kSizeOffset};
+}
+
+folly::Optional<NativeTreeView::Entry> NativeTreeView::getEntry(
+    PathComponentPiece name) const {
+  // The entries are sorted the same way as Tree::getEntryPtr() expects.
+  size_t low = 0;
+  size_t high = numEntries_;
+  auto target = name.stringPiece();
+  while (low < high) {
+    auto mid = low + (high - low) / 2;
+    auto cmp = nameAt(mid).stringPiece().compare(target);
+    if (cmp == 0) {
+      return getEntryAt(mid);
+    } else if (cmp < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return folly::none;
+}
+
+std::unique_ptr<Tree> NativeTreeView::toTree() const {
+  vector<TreeEntry> entries;
+  entries.reserve(numEntries_);
+  for (size_t n = 0; n < numEntries_; ++n) {
+    entries.push_back(getEntryAt(n).toTreeEntry());
+  }
+  return std::make_unique<Tree>(std::move(entries), hash_);
+}
+
+size_t getNativeTreeSize(const vector<TreeEntry>& entries) {
+  size_t namesSize = 0;
+  for (const auto& entry : entries) {
+    namesSize += entry.getName().stringPiece().size();
+  }
+  if (namesSize > std::numeric_limits<uint32_t>::max()) {
+    throw std::runtime_error(folly::to<std::string>(
+        "tree names are too large to serialize: ", namesSize, " bytes"));
+  }
+  return kNativeTreeHeaderSize + entries.size() * kNativeTreeEntrySize +
+      namesSize;
+}
+
+void serializeNativeTree(
+    const vector<TreeEntry>& entries,
+    folly::MutableByteRange out) {
+  DCHECK_GE(out.size(), getNativeTreeSize(entries));
+  auto tableSize = entries.size() * kNativeTreeEntrySize;
+
+  auto* data = out.data();
+  memset(data, 0, kNativeTreeHeaderSize + tableSize);
+  memcpy(data, kNativeTreeMagic, sizeof(kNativeTreeMagic));
+  data[sizeof(kNativeTreeMagic)] = kNativeTreeVersion;
+  storeUint32(data + 4, folly::to<uint32_t>(entries.size()));
+
+  auto* entryData = data + kNativeTreeHeaderSize;
+  auto* names = entryData + tableSize;
+  uint32_t nameOffset = 0;
+  for (const auto& entry : entries) {
+    auto name = entry.getName().stringPiece();
+    auto hashBytes = entry.getHash().getBytes();
+    memcpy(entryData + kHashOffset, hashBytes.data(), hashBytes.size());
+    entryData[kFileTypeOffset] = static_cast<uint8_t>(entry.getFileType());
+    entryData[kPermissionsOffset] = entry.getOwnerPermissions();
+    storeUint32(entryData + kNameOffsetOffset, nameOffset);
+    storeUint32(entryData + kNameLengthOffset, name.size());
+    storeUint64(
+        entryData + kSizeOffset,
+        entry.getSize().value_or(kNativeTreeUnknownSize));
+    memcpy(names + nameOffset, name.data(), name.size());
+    nameOffset += name.size();
+    entryData += kNativeTreeEntrySize;
+  }
+}
+
+IOBuf serializeNativeTree(const Tree& tree) {
+  const auto& entries = tree.getTreeEntries();
+  auto totalSize = getNativeTreeSize(entries);
+  IOBuf buf(IOBuf::CREATE, totalSize);
+  serializeNativeTree(entries, {buf.writableData(), totalSize});
+  buf.append(totalSize);
+  return buf;
+}
+
+std::unique_ptr<Tree> deserializeNativeTree(
+    const Hash& hash,
+    ByteRange treeData) {
+  return NativeTreeView{hash, IOBuf{IOBuf::WRAP_BUFFER, treeData}}.toTree();
+}
+
+folly::Optional<TreeEntry> findNativeTreeEntry(
+    ByteRange treeData,
+    PathComponentPiece name) {
+  NativeTreeView view{Hash(), IOBuf{IOBuf::WRAP_BUFFER, treeData}};
+  auto entry = view.getEntry(name);
+  if (!entry) {
+    return folly::none;
+  }
+  return entry->toTreeEntry();
+}
+}
+}
@@ -0,0 +1,210 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Optional.h>
+#include <folly/Range.h>
+#include <folly/io/IOBuf.h>
+#include <memory>
+#include <vector>
+#include "eden/fs/model/Hash.h"
+#include "eden/fs/model/TreeEntry.h"
+#include "eden/utils/PathFuncs.h"
+
+namespace facebook {
+namespace eden {
+
+class Tree;
+
+/*
+ * Eden's own serialization format for Trees.
+ *
+ * This is cheaper to decode than the git tree format, and individual
+ * entries can be found without decoding the whole Tree.  All integers are
+ * little-endian.
+ *
+ * Header (kNativeTreeHeaderSize bytes):
+ *   3 bytes  kNativeTreeMagic
+ *   1 byte   format version, kNativeTreeVersion
+ *   4 bytes  number of entries
+ *
+ * Entry table (kNativeTreeEntrySize bytes per entry, in Tree order):
+ *   20 bytes  hash
+ *   1 byte    FileType
+ *   1 byte    owner permissions
+ *   2 bytes   reserved, always 0
+ *   4 bytes   offset of the name, from the start of the name area
+ *   4 bytes   length of the name
+ *   8 bytes   size of the blob, or kNativeTreeUnknownSize
+ *
+ * Version 1 entries are kNativeTreeV1EntrySize bytes, without the size.
+ * They are still accepted, and read as having unknown sizes.
+ *
+ * Name area:
+ *   The entry names, one after another, with no terminators.
+ *
+ * The entries are in the same order as in the Tree, which is sorted by name,
+ * so an entry can be found with a binary search of the fixed-size table.
+ *
+ * The first byte of the magic value is never 't', so this format can always
+ * be told apart from a git tree object, which starts with "tree ".
+ */
+constexpr size_t kNativeTreeHeaderSize = 8;
+constexpr size_t kNativeTreeEntrySize = 40;
+constexpr size_t kNativeTreeV1EntrySize = 32;
+constexpr uint8_t kNativeTreeVersion = 2;
+constexpr uint64_t kNativeTreeUnknownSize = ~uint64_t{0};
+extern const uint8_t kNativeTreeMagic[3];
+
+/**
+ * Returns true if data looks like a Tree in the native format, of a
+ * version that we understand (1 or kNativeTreeVersion).
+ */
+bool isNativeTree(folly::ByteRange data);
+
+/**
+ * Serialize a Tree in the native format.
+ *
+ * The Tree's hash is not included in the result.
+ */
+folly::IOBuf serializeNativeTree(const Tree& tree);
+
+/**
+ * Returns the number of bytes needed to serialize these entries in the
+ * native format.
+ */
+size_t getNativeTreeSize(const std::vector<TreeEntry>& entries);
+
+/**
+ * Serialize a list of sorted entries in the native format, into a buffer
+ * supplied by the caller that is at least getNativeTreeSize(entries) bytes.
+ *
+ * This lets callers that build many Trees, such as HgManifestImporter, write
+ * them into memory they manage themselves, without first constructing a Tree.
+ */
+void serializeNativeTree(
+    const std::vector<TreeEntry>& entries,
+    folly::MutableByteRange out);
+
+/**
+ * Create a Tree from its native serialization.
+ *
+ * Throws std::invalid_argument if the data is not a valid native Tree.
+ */
+std::unique_ptr<Tree> deserializeNativeTree(
+    const Hash& hash,
+    folly::ByteRange treeData);
+
+/**
+ * A read-only Tree that refers directly to its native serialization.
+ *
+ * Tree holds a TreeEntry, with its own name string, for every entry, which
+ * means thousands of small allocations for large directories.  This instead
+ * keeps the serialized buffer, which may be a pinned RocksDB block (see
+ * StoreResult::extractIOBuf()), and decodes fields from it on demand.
+ *
+ * The buffer is only checked when fields are accessed, so accessors throw
+ * std::invalid_argument if they find that it is corrupt.
+ */
+class NativeTreeView {
+ public:
+  /**
+   * A view of one entry.  It is only valid as long as the NativeTreeView it
+   * came from.
+   */
+  class Entry {
+   public:
+    Hash getHash() const;
+    PathComponentPiece getName() const {
+      return name_;
+    }
+    FileType getFileType() const {
+      return fileType_;
+    }
+    uint8_t getOwnerPermissions() const;
+    folly::Optional<uint64_t> getSize() const;
+    TreeEntryType getType() const {
+      return fileType_ == FileType::DIRECTORY ? TreeEntryType::TREE
+                                              : TreeEntryType::BLOB;
+    }
+
+    /**
+     * Make an owned copy of this entry.
+     */
+    TreeEntry toTreeEntry() const;
+
+   private:
+    friend class NativeTreeView;
+    Entry(
+        const uint8_t* record,
+        PathComponentPiece name,
+        FileType fileType,
+        bool hasSize)
+        : record_{record},
+          name_{name},
+          fileType_{fileType},
+          hasSize_{hasSize} {}
+
+    const uint8_t* record_;
+    PathComponentPiece name_;
+    FileType fileType_;
+    bool hasSize_;
+  };
+
+  /**
+   * Create a view of a native Tree.  Chained IOBufs are coalesced.
+   *
+   * Throws std::invalid_argument if the header or the size of the entry
+   * table is invalid.
+   */
+  NativeTreeView(const Hash& hash, folly::IOBuf data);
+
+  const Hash& getHash() const {
+    return hash_;
+  }
+
+  size_t size() const {
+    return numEntries_;
+  }
+
+  Entry getEntryAt(size_t index) const;
+
+  /**
+   * Find an entry by name, with a binary search of the entry table.
+   */
+  folly::Optional<Entry> getEntry(PathComponentPiece name) const;
+
+  /**
+   * Decode the whole view into a Tree.
+   */
+  std::unique_ptr<Tree> toTree() const;
+
+ private:
+  const uint8_t* record(size_t index) const;
+  PathComponentPiece nameAt(size_t index) const;
+
+  Hash hash_;
+  folly::IOBuf data_;
+  folly::ByteRange names_;
+  uint32_t numEntries_{0};
+  size_t entrySize_{kNativeTreeEntrySize};
+};
+
+/**
+ * Find a single entry by name, directly in the serialized data.
+ *
+ * This does a binary search of the entry table, and only decodes the entry
+ * that matches.  Returns folly::none if there is no such entry.
+ */
+folly::Optional<TreeEntry> findNativeTreeEntry(
+    folly::ByteRange treeData,
+    PathComponentPiece name);
+}
+}
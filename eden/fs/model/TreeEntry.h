@@ -13,6 +13,7 @@
 #include "TreeEntry.h"
 #include "eden/utils/PathFuncs.h"
 
+#include <folly/Optional.h>
 #include <folly/String.h>
 #include <iosfwd>
 
@@ -42,11 +43,29 @@ class TreeEntry {
       const Hash& hash,
       folly::StringPiece name,
       FileType fileType,
-      uint8_t ownerPermissions)
+      uint8_t ownerPermissions,
+      folly::Optional<uint64_t> size = folly::none)
       : fileType_(fileType),
         ownerPermissions_(ownerPermissions),
         hash_(hash),
-        name_(PathComponentPiece(name)) {}
+        name_(PathComponentPiece(name)),
+        size_(size) {}
+
+  /**
+   * Construct a TreeEntry from a name that is already a PathComponent,
+   * without checking it again.
+   */
+  explicit TreeEntry(
+      const Hash& hash,
+      PathComponent&& name,
+      FileType fileType,
+      uint8_t ownerPermissions,
+      folly::Optional<uint64_t> size = folly::none)
+      : fileType_(fileType),
+        ownerPermissions_(ownerPermissions),
+        hash_(hash),
+        name_(std::move(name)),
+        size_(size) {}
 
   const Hash& getHash() const {
     return hash_;
@@ -69,6 +88,17 @@ class TreeEntry {
     return ownerPermissions_;
   }
 
+  /**
+   * The size of the blob, if the backing store supplied it when the Tree
+   * was imported.
+   *
+   * This lets callers report a file's size without fetching its Blob or
+   * BlobMetadata.  It is always folly::none for directories.
+   */
+  const folly::Optional<uint64_t>& getSize() const {
+    return size_;
+  }
+
   mode_t getMode() const {
     mode_t mode = static_cast<mode_t>(fileType_) << 9;
     // We should always honor the explicit owner permissions.
@@ -95,6 +125,7 @@ class TreeEntry {
   uint8_t ownerPermissions_;
   Hash hash_;
   PathComponent name_;
+  folly::Optional<uint64_t> size_;
 };
 
 std::ostream& operator<<(std::ostream& os, TreeEntryType type);
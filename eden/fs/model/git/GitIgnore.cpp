@@ -9,6 +9,7 @@
  */
 #include "GitIgnore.h"
 
+#include <folly/Hash.h>
 #include <algorithm>
 #include "GitIgnorePattern.h"
 
@@ -63,19 +64,102 @@ void GitIgnore::loadFile(StringPiece contents) {
   // stop at the first match.
   std::reverse(newRules.begin(), newRules.end());
   std::swap(rules_, newRules);
+  buildIndexes();
+}
+
+size_t GitIgnore::StringPieceHash::operator()(StringPiece str) const {
+  return folly::hash::fnv64_buf(str.data(), str.size());
+}
+
+void GitIgnore::buildIndexes() {
+  basenameRules_.clear();
+  pathRules_.clear();
+  suffixRules_.clear();
+  prefixRules_.clear();
+  suffixLengths_.clear();
+  prefixLengths_.clear();
+  globRules_.clear();
+
+  // emplace() keeps the existing entry for duplicate keys, which is the one
+  // with higher precedence.
+  for (size_t idx = 0; idx < rules_.size(); ++idx) {
+    const auto& rule = rules_[idx];
+    switch (rule.getKind()) {
+      case GitIgnorePattern::Kind::LITERAL:
+        if (rule.isBasenameOnly()) {
+          basenameRules_.emplace(rule.getLiteral(), idx);
+        } else {
+          pathRules_.emplace(rule.getLiteral(), idx);
+        }
+        break;
+      case GitIgnorePattern::Kind::SUFFIX:
+        suffixRules_.emplace(rule.getLiteral(), idx);
+        suffixLengths_.push_back(rule.getLiteral().size());
+        break;
+      case GitIgnorePattern::Kind::PREFIX:
+        prefixRules_.emplace(rule.getLiteral(), idx);
+        prefixLengths_.push_back(rule.getLiteral().size());
+        break;
+      case GitIgnorePattern::Kind::GLOB:
+        globRules_.push_back(idx);
+        break;
+    }
+  }
+
+  for (auto* lengths : {&suffixLengths_, &prefixLengths_}) {
+    std::sort(lengths->begin(), lengths->end());
+    lengths->erase(
+        std::unique(lengths->begin(), lengths->end()), lengths->end());
+  }
+}
+
+void GitIgnore::findRule(
+    const RuleIndex& index,
+    StringPiece text,
+    size_t* best) {
+  auto it = index.find(text);
+  if (it != index.end() && it->second < *best) {
+    *best = it->second;
+  }
 }
 
 GitIgnore::MatchResult GitIgnore::match(
     RelativePathPiece path,
     PathComponentPiece basename) const {
-  for (const auto& pattern : rules_) {
-    auto result = pattern.match(path, basename);
-    if (result != NO_MATCH) {
-      return result;
+  // Find the highest precedence rule that matches, starting with the ones
+  // that can be looked up directly.
+  size_t best = rules_.size();
+  auto name = basename.stringPiece();
+  findRule(basenameRules_, name, &best);
+  findRule(pathRules_, path.stringPiece(), &best);
+  for (auto length : suffixLengths_) {
+    if (length > name.size()) {
+      break;
     }
+    findRule(suffixRules_, name.subpiece(name.size() - length), &best);
+  }
+  for (auto length : prefixLengths_) {
+    if (length > name.size()) {
+      break;
+    }
+    findRule(prefixRules_, name.subpiece(0, length), &best);
   }
 
-  return NO_MATCH;
+  // Only the glob rules with higher precedence than that need to be tested.
+  for (auto idx : globRules_) {
+    if (idx >= best) {
+      break;
+    }
+    if (rules_[idx].match(path, basename) != NO_MATCH) {
+      best = idx;
+      break;
+    }
+  }
+
+  if (best == rules_.size()) {
+    return NO_MATCH;
+  }
+  return rules_[best].getMatchResult();
 }
 
 string GitIgnore::matchString(MatchResult result) {
@@ -10,6 +10,7 @@
 #pragma once
 
 #include <folly/Range.h>
+#include <unordered_map>
 #include <vector>
 #include "eden/utils/PathFuncs.h"
 
@@ -136,12 +137,54 @@ class GitIgnore {
   GitIgnore(GitIgnore const&) = delete;
   GitIgnore& operator=(GitIgnore const&) = delete;
 
+  struct StringPieceHash {
+    size_t operator()(folly::StringPiece str) const;
+  };
+  /**
+   * A map from the literal text of some rules to the index of the highest
+   * precedence rule with that text.  The keys point into the rules
+   * themselves.
+   */
+  using RuleIndex =
+      std::unordered_map<folly::StringPiece, size_t, StringPieceHash>;
+
+  /**
+   * Sort the rules into the indexes below.
+   */
+  void buildIndexes();
+
+  /**
+   * Look up text in one of the indexes, and lower *best to the index of the
+   * matching rule if it has higher precedence.
+   */
+  static void findRule(
+      const RuleIndex& index,
+      folly::StringPiece text,
+      size_t* best);
+
   /*
    * The patterns loaded from the gitignore file.  These are sorted from
    * highest to lowest precedence (the reverse of the order they are actually
    * listed in the .gitignore file).
    */
   std::vector<GitIgnorePattern> rules_;
+
+  /*
+   * The rules, grouped by the form of their pattern, so that match() only
+   * needs to test the rules that contain wildcards one at a time.  The
+   * others are found with a few hash table lookups, no matter how many
+   * there are.
+   */
+  RuleIndex basenameRules_;
+  RuleIndex pathRules_;
+  RuleIndex suffixRules_;
+  RuleIndex prefixRules_;
+  /** The distinct lengths of the keys in suffixRules_, in increasing order */
+  std::vector<size_t> suffixLengths_;
+  /** The distinct lengths of the keys in prefixRules_, in increasing order */
+  std::vector<size_t> prefixLengths_;
+  /** The indexes of all other rules, in increasing order */
+  std::vector<size_t> globRules_;
 };
 }
 }
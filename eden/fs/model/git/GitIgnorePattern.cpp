@@ -16,6 +16,12 @@ using std::string;
 namespace facebook {
 namespace eden {
 
+namespace {
+bool isLiteral(StringPiece pattern) {
+  return pattern.find_first_of("*?[\\") == StringPiece::npos;
+}
+}
+
 Optional<GitIgnorePattern> GitIgnorePattern::parseLine(StringPiece line) {
   uint32_t flags = 0;
 
@@ -139,11 +145,37 @@ Optional<GitIgnorePattern> GitIgnorePattern::parseLine(StringPiece line) {
     return folly::none;
   }
 
-  return GitIgnorePattern(flags, std::move(matcher).value());
+  // Look for the common simple forms of patterns, such as "*.o".  Prefixes
+  // and suffixes are only recognized for basename patterns, since "*" does
+  // not match "/" in full path patterns.
+  Kind kind = Kind::GLOB;
+  StringPiece literal;
+  if (isLiteral(line)) {
+    kind = Kind::LITERAL;
+    literal = line;
+  } else if ((flags & FLAG_BASENAME_ONLY) && line.size() > 1) {
+    if (line.front() == '*' && isLiteral(line.subpiece(1))) {
+      kind = Kind::SUFFIX;
+      literal = line.subpiece(1);
+    } else if (
+        line.back() == '*' && isLiteral(line.subpiece(0, line.size() - 1))) {
+      kind = Kind::PREFIX;
+      literal = line.subpiece(0, line.size() - 1);
+    }
+  }
+
+  return GitIgnorePattern(flags, kind, literal, std::move(matcher).value());
 }
 
-GitIgnorePattern::GitIgnorePattern(uint32_t flags, GlobMatcher&& matcher)
-    : flags_(flags), matcher_(std::move(matcher)) {}
+GitIgnorePattern::GitIgnorePattern(
+    uint32_t flags,
+    Kind kind,
+    StringPiece literal,
+    GlobMatcher&& matcher)
+    : flags_(flags),
+      kind_(kind),
+      literal_(literal.str()),
+      matcher_(std::move(matcher)) {}
 
 GitIgnorePattern::~GitIgnorePattern() {}
 
@@ -166,7 +198,7 @@ GitIgnore::MatchResult GitIgnorePattern::match(
   }
 
   if (isMatch) {
-    return (flags_ & FLAG_INCLUDE) ? GitIgnore::INCLUDE : GitIgnore::EXCLUDE;
+    return getMatchResult();
   }
 
   return GitIgnore::NO_MATCH;
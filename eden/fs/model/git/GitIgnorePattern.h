@@ -11,6 +11,7 @@
 
 #include <folly/Optional.h>
 #include <folly/Range.h>
+#include <string>
 #include "eden/fs/model/git/GitIgnore.h"
 #include "eden/fs/model/git/GlobMatcher.h"
 
@@ -26,6 +27,24 @@ namespace eden {
  */
 class GitIgnorePattern {
  public:
+  /**
+   * The form of the glob pattern.
+   *
+   * Simple patterns are classified so that GitIgnore can find the ones that
+   * may match a path with hash table lookups, instead of testing every
+   * pattern in turn.
+   */
+  enum class Kind {
+    // The pattern contains no wildcards, and only matches getLiteral().
+    LITERAL,
+    // The pattern is "*" followed by getLiteral(), which has no wildcards.
+    SUFFIX,
+    // The pattern is getLiteral(), which has no wildcards, followed by "*".
+    PREFIX,
+    // Anything else.
+    GLOB,
+  };
+
   /**
    * Parse a line from a gitignore file.
    *
@@ -66,6 +85,34 @@ class GitIgnorePattern {
       RelativePathPiece path,
       PathComponentPiece basename) const;
 
+  Kind getKind() const {
+    return kind_;
+  }
+
+  /**
+   * The literal text of the pattern, without the wildcard for SUFFIX and
+   * PREFIX patterns.  Only valid for patterns that are not GLOB.
+   */
+  folly::StringPiece getLiteral() const {
+    return literal_;
+  }
+
+  /**
+   * Returns true if the pattern is matched against the basename of a path,
+   * rather than the path itself.
+   */
+  bool isBasenameOnly() const {
+    return flags_ & FLAG_BASENAME_ONLY;
+  }
+
+  /**
+   * The result of match() for paths that match this pattern: either
+   * INCLUDE or EXCLUDE.
+   */
+  GitIgnore::MatchResult getMatchResult() const {
+    return (flags_ & FLAG_INCLUDE) ? GitIgnore::INCLUDE : GitIgnore::EXCLUDE;
+  }
+
  private:
   /**
    * Flag values that can be bitwise-ORed to create the flags_ value.
@@ -81,7 +128,11 @@ class GitIgnorePattern {
     FLAG_BASENAME_ONLY = 0x04,
   };
 
-  GitIgnorePattern(uint32_t flags, GlobMatcher&& matcher);
+  GitIgnorePattern(
+      uint32_t flags,
+      Kind kind,
+      folly::StringPiece literal,
+      GlobMatcher&& matcher);
 
   GitIgnorePattern(GitIgnorePattern const&) = delete;
   GitIgnorePattern& operator=(GitIgnorePattern const&) = delete;
@@ -90,6 +141,8 @@ class GitIgnorePattern {
    * A bit set of the Flags defined above.
    */
   uint32_t flags_{0};
+  Kind kind_{Kind::GLOB};
+  std::string literal_;
   /**
    * The GlobMatcher object for performing matching.
    */
@@ -45,12 +45,14 @@ GitIgnore::MatchResult GitIgnoreStack::match(RelativePathPiece path) const {
       ++suffixIter;
     }
 
-    const GitIgnore* ignore = &node->ignore_;
+    const GitIgnore* ignore = node->ignore_.get();
     node = node->parent_;
 
-    auto result = ignore->match(suffix, basename);
-    if (result != GitIgnore::NO_MATCH) {
-      return result;
+    if (ignore) {
+      auto result = ignore->match(suffix, basename);
+      if (result != GitIgnore::NO_MATCH) {
+        return result;
+      }
     }
 
     // We always expect to reach the end of the suffix iteration before
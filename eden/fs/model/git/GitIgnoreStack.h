@@ -9,6 +9,7 @@
  */
 #pragma once
 
+#include <memory>
 #include <string>
 #include "eden/fs/model/git/GitIgnore.h"
 #include "eden/utils/PathFuncs.h"
@@ -57,9 +58,23 @@ class GitIgnoreStack {
    */
   GitIgnoreStack(GitIgnoreStack* parent, std::string ignoreFileContents)
       : parent_{parent} {
-    ignore_.loadFile(ignoreFileContents);
+    auto ignore = std::make_shared<GitIgnore>();
+    ignore->loadFile(ignoreFileContents);
+    ignore_ = std::move(ignore);
   }
 
+  /**
+   * Create a new GitIgnoreStack for a directory whose .gitignore file has
+   * already been parsed.
+   *
+   * This allows the same parsed GitIgnore to be shared by many stacks, such
+   * as the ones built by separate diff operations.
+   */
+  GitIgnoreStack(
+      GitIgnoreStack* parent,
+      std::shared_ptr<const GitIgnore> ignore)
+      : ignore_{std::move(ignore)}, parent_{parent} {}
+
   /**
    * Get the MatchResult for a path.
    */
@@ -67,9 +82,10 @@ class GitIgnoreStack {
 
  private:
   /**
-   * The GitIgnore info for this node on the stack
+   * The GitIgnore info for this node on the stack, or null if this
+   * directory has no .gitignore file
    */
-  GitIgnore ignore_;
+  std::shared_ptr<const GitIgnore> ignore_;
 
   /**
    * A pointer to the next node in the stack.
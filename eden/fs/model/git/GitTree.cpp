@@ -129,6 +129,15 @@ enum size_t {
   TREE_PREFIX_HEADROOM = 32
 };
 
+Hash computeGitTreeHash(const vector<TreeEntry>& entries) {
+  GitTreeSerializer serializer;
+  for (const auto& entry : entries) {
+    serializer.addEntry(entry);
+  }
+  IOBuf gitTreeBuf = serializer.finalize();
+  return Hash::sha1(&gitTreeBuf);
+}
+
 GitTreeSerializer::GitTreeSerializer()
     : buf_(IOBuf::CREATE, INITIAL_TREE_BUF_SIZE),
       appender_(&buf_, TREE_BUF_GROW_SIZE) {
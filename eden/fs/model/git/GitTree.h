@@ -12,6 +12,7 @@
 #include <folly/Range.h>
 #include <folly/io/Cursor.h>
 #include <folly/io/IOBuf.h>
+#include <vector>
 
 namespace facebook {
 namespace eden {
@@ -31,6 +32,12 @@ std::unique_ptr<Tree> deserializeGitTree(
     const Hash& hash,
     folly::ByteRange treeData);
 
+/**
+ * Compute the hash of the git tree object for a list of entries, which must
+ * already be in git tree order.
+ */
+Hash computeGitTreeHash(const std::vector<TreeEntry>& entries);
+
 /*
  * A class for serializing git tree objects in a streaming fashion.
  *
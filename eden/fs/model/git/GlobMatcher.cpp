@@ -37,19 +37,18 @@ enum : uint8_t {
   // - 1 or more characters followed by a slash
   GLOB_STAR_STAR_SLASH = 'X',
   // GLOB_CHAR_CLASS matches a character class.
-  // This is followed by a list of characters to match.
-  // The matching characters are encoded as follows:
-  // - '\x00' indicates the end of the character class
+  // This is followed by a kCharClassBitmapSize byte bitmap with one bit set
+  // for each character that matches, so that matching a character is a
+  // single lookup no matter how complicated the class is.  Negated classes
+  // are simply stored with the bits inverted.
+  GLOB_CHAR_CLASS = '[',
+  // While a bracket expression is being parsed its entries are first
+  // collected as a list of bytes, which is then converted into the bitmap:
   // - '\x01' indicates a range.  It is followed by 2 bytes, the low and high
   //    bounds of the range (inclusive).
   // - any other character matches only that character.
-  // A literal '\x00' or '\x01' is encoded as a range with itself as both the
-  // lower and upper bound.  e.g. '\x00' gets encoded as '\x01\x00\x00'.
-  GLOB_CHAR_CLASS = '[',
-  // GLOB_CHAR_CLASS_NEGATED is like GLOB_CHAR_CLASS, but matches
-  // only if the character does not match the character class.
-  GLOB_CHAR_CLASS_NEGATED = ']',
-  GLOB_CHAR_CLASS_END = '\x00',
+  // A literal '\x01' is encoded as a range with itself as both the lower and
+  // upper bound.
   GLOB_CHAR_CLASS_RANGE = '\x01',
   // GLOB_QMARK matches any single character except for '/'
   GLOB_QMARK = '?',
@@ -58,12 +57,51 @@ enum : uint8_t {
   // GLOB_ENDS_WITH.
   GLOB_ENDS_WITH = '$',
 };
+
+constexpr size_t kCharClassBitmapSize = 256 / 8;
+
+/**
+ * Patterns with at least this many opcodes that may need to try several
+ * positions in the text have their failed positions remembered while
+ * matching.  Without that, patterns like "*a*b*c*d" can take exponential
+ * time on text that almost matches.
+ */
+constexpr size_t kMinBacktrackOpsForMemo = 2;
 }
 
 namespace facebook {
 namespace eden {
 GlobMatcher::GlobMatcher(vector<uint8_t> pattern)
-    : pattern_(std::move(pattern)) {}
+    : pattern_(std::move(pattern)) {
+  // Compute the minimum length of text that can match, and count the
+  // opcodes that may try several positions in the text.
+  size_t idx = 0;
+  while (idx < pattern_.size()) {
+    switch (pattern_[idx]) {
+      case GLOB_LITERAL:
+      case GLOB_ENDS_WITH:
+        minTextLength_ += pattern_[idx + 1];
+        idx += 2 + pattern_[idx + 1];
+        break;
+      case GLOB_CHAR_CLASS:
+        ++minTextLength_;
+        idx += 1 + kCharClassBitmapSize;
+        break;
+      case GLOB_QMARK:
+        ++minTextLength_;
+        ++idx;
+        break;
+      case GLOB_STAR:
+      case GLOB_STAR_STAR_SLASH:
+        ++numBacktrackOps_;
+        ++idx;
+        break;
+      default:
+        ++idx;
+        break;
+    }
+  }
+}
 
 GlobMatcher::GlobMatcher() {}
 
@@ -205,16 +243,19 @@ Expected<size_t, string> GlobMatcher::parseBracketExpr(
   if (idx + 1 >= glob.size()) {
     return folly::makeUnexpected<string>("unterminated bracket sequence");
   }
+  bool negated = false;
   if (glob[idx + 1] == '!' || glob[idx + 1] == '^') {
-    pattern->push_back(GLOB_CHAR_CLASS_NEGATED);
+    negated = true;
     ++idx;
     if (idx >= glob.size()) {
       return folly::makeUnexpected<string>("unterminated bracket sequence");
     }
-  } else {
-    pattern->push_back(GLOB_CHAR_CLASS);
   }
 
+  // Collect the entries of the class, then convert them into the bitmap
+  // that is actually stored in the pattern buffer.
+  vector<uint8_t> entries;
+
   // Set NO_PREV_CHAR to something outside of the range [-128, 255]
   // We want to make sure it can't possibly correspond to a valid char value,
   // regardless of whether char types are signed or unsigned on this platform.
@@ -223,14 +264,13 @@ Expected<size_t, string> GlobMatcher::parseBracketExpr(
   auto addPrevChar = [&]() {
     if (prevChar == NO_PREV_CHAR) {
       return;
-    } else if (
-        prevChar == GLOB_CHAR_CLASS_END || prevChar == GLOB_CHAR_CLASS_RANGE) {
-      // Escape these characters by turning them into ranges.
-      pattern->push_back(GLOB_CHAR_CLASS_RANGE);
-      pattern->push_back(prevChar);
-      pattern->push_back(prevChar);
+    } else if (prevChar == GLOB_CHAR_CLASS_RANGE) {
+      // Escape this character by turning it into a range.
+      entries.push_back(GLOB_CHAR_CLASS_RANGE);
+      entries.push_back(prevChar);
+      entries.push_back(prevChar);
     } else {
-      pattern->push_back(prevChar);
+      entries.push_back(prevChar);
     }
   };
 
@@ -292,9 +332,9 @@ Expected<size_t, string> GlobMatcher::parseBracketExpr(
           // though.  We just ignore this one range, since it can never match
           // anything.)
           if (prevChar <= highBound) {
-            pattern->push_back(GLOB_CHAR_CLASS_RANGE);
-            pattern->push_back(prevChar);
-            pattern->push_back(highBound);
+            entries.push_back(GLOB_CHAR_CLASS_RANGE);
+            entries.push_back(prevChar);
+            entries.push_back(highBound);
           }
           prevChar = NO_PREV_CHAR;
         }
@@ -307,7 +347,7 @@ Expected<size_t, string> GlobMatcher::parseBracketExpr(
         for (auto end = classStart; end + 1 < glob.size(); ++end) {
           if (glob[end] == ':' && glob[end + 1] == ']') {
             StringPiece charClass(glob.data() + classStart, glob.data() + end);
-            if (!addCharClass(charClass, pattern)) {
+            if (!addCharClass(charClass, &entries)) {
               return folly::makeUnexpected<string>(
                   "unknown character class \"" + charClass.str() + "\"");
             }
@@ -330,7 +370,26 @@ Expected<size_t, string> GlobMatcher::parseBracketExpr(
   }
 
   addPrevChar();
-  pattern->push_back(GLOB_CHAR_CLASS_END);
+
+  uint8_t bitmap[kCharClassBitmapSize] = {};
+  auto setBits = [&](uint8_t low, uint8_t high) {
+    for (unsigned int ch = low; ch <= high; ++ch) {
+      bitmap[ch / 8] |= (1 << (ch % 8));
+    }
+  };
+  for (size_t n = 0; n < entries.size(); ++n) {
+    if (entries[n] == GLOB_CHAR_CLASS_RANGE) {
+      DCHECK_LT(n + 2, entries.size());
+      setBits(entries[n + 1], entries[n + 2]);
+      n += 2;
+    } else {
+      setBits(entries[n], entries[n]);
+    }
+  }
+  pattern->push_back(GLOB_CHAR_CLASS);
+  for (auto byte : bitmap) {
+    pattern->push_back(negated ? static_cast<uint8_t>(~byte) : byte);
+  }
   return idx;
 }
 
@@ -411,13 +470,45 @@ bool GlobMatcher::addCharClass(
 }
 
 bool GlobMatcher::match(StringPiece text) const {
-  return tryMatchAt(text, 0, 0);
+  if (text.size() < minTextLength_) {
+    return false;
+  }
+  if (numBacktrackOps_ < kMinBacktrackOpsForMemo) {
+    // With at most one wildcard that can backtrack, each position is only
+    // ever tried once anyway.
+    return tryMatchAt(text, 0, 0, nullptr);
+  }
+  FailedPositions failed;
+  return tryMatchAt(text, 0, 0, &failed);
+}
+
+bool GlobMatcher::tryMatchFrom(
+    StringPiece text,
+    size_t textIdx,
+    size_t patternIdx,
+    FailedPositions* failed) const {
+  // Whether the rest of the pattern matches the rest of the text only
+  // depends on where they start, so there is no point in trying the same
+  // positions again after they have failed once.
+  if (!failed) {
+    return tryMatchAt(text, textIdx, patternIdx, nullptr);
+  }
+  auto key = (static_cast<uint64_t>(patternIdx) << 32) | textIdx;
+  if (failed->count(key)) {
+    return false;
+  }
+  if (tryMatchAt(text, textIdx, patternIdx, failed)) {
+    return true;
+  }
+  failed->insert(key);
+  return false;
 }
 
 bool GlobMatcher::tryMatchAt(
     StringPiece text,
     size_t textIdx,
-    size_t patternIdx) const {
+    size_t patternIdx,
+    FailedPositions* failed) const {
   // Loop through all opcodes in the pattern buffer.
   // It's kind of unfortunate how big and complicated this while loop is.
   //
@@ -480,7 +571,8 @@ bool GlobMatcher::tryMatchAt(
           if (nextSlash < literalIdx) {
             return false;
           }
-          if (tryMatchAt(text, literalIdx + literalLength, patternIdx)) {
+          if (tryMatchFrom(
+                  text, literalIdx + literalLength, patternIdx, failed)) {
             return true;
           }
           // No match here.  Move forwards and try again.
@@ -493,7 +585,7 @@ bool GlobMatcher::tryMatchAt(
         //
         // In practice this type of pattern is rare.
         while (textIdx < text.size()) {
-          if (tryMatchAt(text, textIdx, patternIdx)) {
+          if (tryMatchFrom(text, textIdx, patternIdx, failed)) {
             return true;
           }
           if (text[textIdx] == '/') {
@@ -530,7 +622,7 @@ bool GlobMatcher::tryMatchAt(
       // characters followed by a slash.
       ++patternIdx;
       while (true) {
-        if (tryMatchAt(text, textIdx, patternIdx)) {
+        if (tryMatchFrom(text, textIdx, patternIdx, failed)) {
           return true;
         }
         textIdx = text.find('/', textIdx + 1);
@@ -555,15 +647,11 @@ bool GlobMatcher::tryMatchAt(
       }
 
       if (pattern_[patternIdx] == GLOB_CHAR_CLASS) {
-        // An inclusive character class
-        if (!charClassMatch(ch, &patternIdx)) {
-          return false;
-        }
-      } else if (pattern_[patternIdx] == GLOB_CHAR_CLASS_NEGATED) {
-        // An exclusive character class
-        if (charClassMatch(ch, &patternIdx)) {
+        // A character class, with the matching characters stored as a bitmap
+        if (!(pattern_[patternIdx + 1 + ch / 8] & (1 << (ch % 8)))) {
           return false;
         }
+        patternIdx += 1 + kCharClassBitmapSize;
       } else if (pattern_[patternIdx] == GLOB_QMARK) {
         // '?' matches any character except '/'
         // (which we already excluded above)
@@ -578,56 +666,5 @@ bool GlobMatcher::tryMatchAt(
 
   return textIdx == text.size();
 }
-
-bool GlobMatcher::charClassMatch(uint8_t ch, size_t* patternIdx) const {
-  size_t idx = *patternIdx + 1;
-  while (true) {
-    DCHECK_LT(idx, pattern_.size());
-    if (pattern_[idx] == GLOB_CHAR_CLASS_END) {
-      // Reached the end of the character class with no match.
-      *patternIdx = idx + 1;
-      return false;
-    } else if (pattern_[idx] == GLOB_CHAR_CLASS_RANGE) {
-      DCHECK_LT(idx + 2, pattern_.size());
-      uint8_t lowBound = pattern_[idx + 1];
-      uint8_t highBound = pattern_[idx + 2];
-      idx += 2;
-      if (lowBound <= ch && ch <= highBound) {
-        // Found a match
-        break;
-      }
-    } else {
-      if (ch == pattern_[idx]) {
-        // Found a match
-        ++idx;
-        break;
-      }
-      ++idx;
-    }
-  }
-
-  // If we broke out of the loop then we found a match.
-  // Advance patternIdx to the end of the character class.
-  //
-  // We just keep scanning through the data until we find GLOB_CHAR_CLASS_END.
-  //
-  // In theory we could put a length byte after the GLOB_CHAR_CLASS opcode,
-  // similar to what we do for GLOB_LITERAL, so we could avoid scanning here.
-  // However this would introduce some complications: we would potentially have
-  // to re-arrange the data so it fits in 255 bytes.  (Any character class can
-  // be represented in 255 bytes, but our naive literal encoding currently
-  // might end up using more than 255 bytes.)  In practice character class data
-  // is normally very short, so the cost of a scan doesn't really matter here.
-  while (true) {
-    if (pattern_[idx] == GLOB_CHAR_CLASS_END) {
-      *patternIdx = idx + 1;
-      return true;
-    } else if (pattern_[idx] == GLOB_CHAR_CLASS_RANGE) {
-      idx += 3;
-    } else {
-      ++idx;
-    }
-  }
-}
 }
 }
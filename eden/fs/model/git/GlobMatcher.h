@@ -12,6 +12,7 @@
 #include <folly/Expected.h>
 #include <folly/Range.h>
 #include <cstdint>
+#include <unordered_set>
 #include <vector>
 
 namespace facebook {
@@ -73,24 +74,39 @@ class GlobMatcher {
       folly::StringPiece charClass,
       std::vector<uint8_t>* pattern);
 
+  /**
+   * The (patternIdx, textIdx) pairs that have already been found not to
+   * match during a single call to match().
+   */
+  using FailedPositions = std::unordered_set<uint64_t>;
+
   /**
    * Returns true if the trailing section of the input text (starting at
    * textIdx) is a mattern for the trailing portion of the pattern buffer
    * (starting at patternIdx).
+   *
+   * failed may be null, in which case positions that fail to match are not
+   * remembered.
    */
-  bool tryMatchAt(folly::StringPiece text, size_t textIdx, size_t patternIdx)
-      const;
+  bool tryMatchAt(
+      folly::StringPiece text,
+      size_t textIdx,
+      size_t patternIdx,
+      FailedPositions* failed) const;
 
   /**
-   * Check to see if the given character matches the character class opcode
-   * starting at the specified index in the pattern buffer.
-   *
-   * Returns true if the character matches, and false otherwise.
+   * Like tryMatchAt(), but skips positions that are already in failed, and
+   * adds this position to it if it does not match.
    *
-   * The patternIdx argument is updated to point to the next opcode after this
-   * character calss.
+   * This is used when a wildcard tries the rest of the pattern at several
+   * text positions, which keeps the worst case polynomial in the length of
+   * the text for patterns with several wildcards.
    */
-  bool charClassMatch(uint8_t ch, size_t* patternIdx) const;
+  bool tryMatchFrom(
+      folly::StringPiece text,
+      size_t textIdx,
+      size_t patternIdx,
+      FailedPositions* failed) const;
 
   /**
    * pattern_ is a pre-processed version of the glob pattern.
@@ -103,6 +119,17 @@ class GlobMatcher {
    * rather than heap-allocating them in a vector.
    */
   std::vector<uint8_t> pattern_;
+
+  /**
+   * The shortest text that can possibly match this pattern, so that shorter
+   * text can be rejected without looking at it.
+   */
+  size_t minTextLength_{0};
+
+  /**
+   * The number of '*' and "**\/" opcodes in the pattern.
+   */
+  size_t numBacktrackOps_{0};
 };
 }
 }
@@ -0,0 +1,133 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Benchmark.h>
+#include <folly/init/Init.h>
+
+#include "eden/fs/model/git/GitIgnore.h"
+#include "eden/fs/model/git/GitIgnoreStack.h"
+
+using namespace facebook::eden;
+using folly::StringPiece;
+
+namespace {
+// A top-level .gitignore of the sort found in large mixed-language
+// repositories.
+const char* const kRootIgnore =
+    "*.o\n"
+    "*.a\n"
+    "*.so\n"
+    "*.pyc\n"
+    "*.class\n"
+    "*~\n"
+    ".*.swp\n"
+    ".DS_Store\n"
+    "/buck-out/\n"
+    "/build/\n"
+    "node_modules/\n"
+    "**/generated/**\n"
+    "*.log\n"
+    "!keep.log\n"
+    "/third-party/*/src/\n"
+    "TAGS\n"
+    "tags\n"
+    "cscope.*\n";
+
+// A project-level .gitignore further down the tree.
+const char* const kProjectIgnore =
+    "/out/\n"
+    "*.generated.h\n"
+    "*.tmp\n"
+    "!important.tmp\n"
+    "test/fixtures/*.bin\n";
+
+const char* const kUserIgnore =
+    ".idea/\n"
+    "*.iml\n"
+    ".vscode/\n";
+
+// Paths relative to the repository root, all inside kDirectory.  Most of
+// them do not match anything, which is the common case during status.
+const StringPiece kDirectory{"fbcode/project/src"};
+const std::vector<StringPiece> kBasenames = {
+    "main.cpp",
+    "main.o",
+    "EdenServiceHandler.cpp",
+    "EdenServiceHandler.h",
+    "README",
+    "TARGETS",
+    ".main.cpp.swp",
+    "service.generated.h",
+    "scratch.tmp",
+    "important.tmp",
+    "debug.log",
+    "keep.log",
+    "node_modules",
+    "ThisIsALongFileNameThatShowsUpInJavaAndObjCProjects.java",
+    "utils.py",
+    "utils.pyc",
+};
+
+std::vector<RelativePath> makeCorpus() {
+  std::vector<RelativePath> corpus;
+  for (auto name : kBasenames) {
+    corpus.push_back(RelativePathPiece{kDirectory} + PathComponentPiece{name});
+  }
+  return corpus;
+}
+
+void matchSingle(size_t iters, StringPiece contents) {
+  GitIgnore ignore;
+  std::vector<RelativePath> corpus;
+  BENCHMARK_SUSPEND {
+    ignore.loadFile(contents);
+    corpus = makeCorpus();
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(ignore.match(corpus[n % corpus.size()]));
+  }
+}
+
+void loadFile(size_t iters, StringPiece contents) {
+  for (size_t n = 0; n < iters; ++n) {
+    GitIgnore ignore;
+    ignore.loadFile(contents);
+    folly::doNotOptimizeAway(ignore);
+  }
+}
+}
+
+BENCHMARK_NAMED_PARAM(matchSingle, root, kRootIgnore);
+BENCHMARK_NAMED_PARAM(matchSingle, project, kProjectIgnore);
+// Match against a stack shaped like the one diff builds for kDirectory:
+// user rules, the root .gitignore, then one node per directory level with
+// the project .gitignore at fbcode/project.
+BENCHMARK(matchStack, iters) {
+  std::vector<RelativePath> corpus;
+  BENCHMARK_SUSPEND {
+    corpus = makeCorpus();
+  }
+  GitIgnoreStack user{nullptr, kUserIgnore};
+  GitIgnoreStack root{&user, kRootIgnore};
+  GitIgnoreStack fbcode{&root};
+  GitIgnoreStack project{&fbcode, kProjectIgnore};
+  GitIgnoreStack src{&project};
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(src.match(corpus[n % corpus.size()]));
+  }
+}
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_NAMED_PARAM(loadFile, root, kRootIgnore);
+
+int main(int argc, char** argv) {
+  folly::init(&argc, &argv);
+  folly::runBenchmarks();
+  return 0;
+}
@@ -625,3 +625,43 @@ TEST(GitIgnore, testCornerCases) {
   EXPECT_IGNORE(ignore, NO_MATCH, "test/path");
   EXPECT_IGNORE(ignore, EXCLUDE, "bar");
 }
+
+TEST(GitIgnore, testPatternBuckets) {
+  GitIgnore ignore;
+
+  // Mix literal, suffix, prefix and glob patterns, and make sure the last
+  // matching pattern still wins regardless of its form.
+  ignore.loadFile(
+      "*.o\n"
+      "*.tmp\n"
+      "build\n"
+      "/out/gen\n"
+      "tmp*\n"
+      "!keep.o\n"
+      "!tmp_keep*\n"
+      "*.[ch]~\n"
+      "!*.tmp\n"
+      "core\n"
+      "!core\n"
+      "*.o\n");
+  EXPECT_IGNORE(ignore, EXCLUDE, "foo.o");
+  EXPECT_IGNORE(ignore, EXCLUDE, "dir/foo.o");
+  EXPECT_IGNORE(ignore, EXCLUDE, ".o");
+  EXPECT_IGNORE(ignore, EXCLUDE, "keep.o");
+  EXPECT_IGNORE(ignore, INCLUDE, "foo.tmp");
+  EXPECT_IGNORE(ignore, EXCLUDE, "build");
+  EXPECT_IGNORE(ignore, EXCLUDE, "a/b/build");
+  EXPECT_IGNORE(ignore, NO_MATCH, "builds");
+  EXPECT_IGNORE(ignore, EXCLUDE, "out/gen");
+  EXPECT_IGNORE(ignore, NO_MATCH, "a/out/gen");
+  EXPECT_IGNORE(ignore, NO_MATCH, "gen");
+  EXPECT_IGNORE(ignore, EXCLUDE, "tmp");
+  EXPECT_IGNORE(ignore, EXCLUDE, "dir/tmpfile");
+  EXPECT_IGNORE(ignore, INCLUDE, "tmp_keep_this");
+  EXPECT_IGNORE(ignore, INCLUDE, "tmp_keep.tmp");
+  EXPECT_IGNORE(ignore, EXCLUDE, "foo.c~");
+  EXPECT_IGNORE(ignore, NO_MATCH, "foo.x~");
+  EXPECT_IGNORE(ignore, INCLUDE, "core");
+  EXPECT_IGNORE(ignore, NO_MATCH, "o");
+  EXPECT_IGNORE(ignore, NO_MATCH, "");
+}
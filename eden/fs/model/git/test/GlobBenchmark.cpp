@@ -249,6 +249,19 @@ BENCHMARK_RELATIVE(fullpath_re2, numIters) {
   runBenchmark<RE2Impl>(numIters, ".*/[^/]io[^/]*o[^/]*", fullnameCorpus);
 }
 
+BENCHMARK(manyStars_globmatch, numIters) {
+  runBenchmark<GlobMatcherImpl>(numIters, "*a*b*c*d*e", basenameCorpus);
+}
+
+BENCHMARK_RELATIVE(manyStars_wildmatch, numIters) {
+  runBenchmark<WildmatchImpl>(numIters, "*a*b*c*d*e", basenameCorpus);
+}
+
+BENCHMARK_RELATIVE(manyStars_re2, numIters) {
+  runBenchmark<RE2Impl>(
+      numIters, "[^/]*a[^/]*b[^/]*c[^/]*d[^/]*e", basenameCorpus);
+}
+
 void initGlobBenchmark();
 
 int main(int argc, char* argv[]) {
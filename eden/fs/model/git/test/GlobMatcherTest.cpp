@@ -256,6 +256,30 @@ TEST(Glob, testOther) {
   EXPECT_NOMATCH("foo\x9atest", "foo[\xa0-\xaf]test");
 }
 
+TEST(Glob, testBacktracking) {
+  // Patterns with many wildcards used to take exponential time on text that
+  // almost matches.  These should all complete quickly.
+  std::string text(200, 'a');
+  EXPECT_NOMATCH(text, "*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*b");
+  EXPECT_MATCH(text + "b", "*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*b");
+  EXPECT_NOMATCH(text, "**/*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*b");
+  EXPECT_MATCH("x/y/" + text + "b", "**/*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*b");
+  EXPECT_NOMATCH(text + "/b", "*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*b");
+
+  // Text shorter than the pattern could ever match
+  EXPECT_NOMATCH("ab", "a*b?c");
+  EXPECT_MATCH("abxc", "a*b?c");
+}
+
+TEST(Glob, testNegatedCharClass) {
+  EXPECT_MATCH(StringPiece("a\0c", 3), "a[!b]c");
+  EXPECT_NOMATCH(StringPiece("a\0c", 3), StringPiece("a[!\0]c", 6));
+  EXPECT_MATCH(StringPiece("a\1c", 3), "a[\1]c");
+  EXPECT_NOMATCH("abc", "a[!a-z]c");
+  EXPECT_MATCH("aBc", "a[!a-z]c");
+  EXPECT_NOMATCH("a/c", "a[!a-z]c");
+}
+
 void testCharClass(StringPiece name, int (*libcFn)(int)) {
   auto matcher = GlobMatcher::create("[[:" + name.str() + ":]]").value();
 
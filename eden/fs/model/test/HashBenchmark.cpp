@@ -0,0 +1,107 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Benchmark.h>
+#include <folly/Conv.h>
+#include <folly/String.h>
+#include <string>
+#include <unordered_set>
+
+#include "eden/fs/model/Hash.h"
+
+using namespace facebook::eden;
+using folly::StringPiece;
+
+/*
+ * Benchmarks for converting Hashes to and from hex, and for using them as
+ * hash table keys.
+ *
+ * These are linked into the same binary as the other benchmarks in this
+ * directory, which provide main().  Use --bm_regex to run only these.
+ */
+
+namespace {
+const std::string kHex = "faceb00cdeadbeefc00010ff1badb0028badf00d";
+
+Hash makeHash(size_t n) {
+  Hash::Storage bytes;
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    bytes[i] = static_cast<uint8_t>(n * 131 + i * 7);
+  }
+  return Hash(bytes);
+}
+}
+
+BENCHMARK(parseHexUnhexlify, iters) {
+  for (size_t n = 0; n < iters; ++n) {
+    std::string bytes;
+    folly::unhexlify(kHex, bytes);
+    folly::doNotOptimizeAway(Hash(folly::ByteRange(StringPiece(bytes))));
+  }
+}
+
+BENCHMARK_RELATIVE(parseHex, iters) {
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(Hash(StringPiece(kHex)));
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(formatHexlify, iters) {
+  Hash hash(kHex);
+  for (size_t n = 0; n < iters; ++n) {
+    std::string result;
+    folly::hexlify(hash.getBytes(), result);
+    folly::doNotOptimizeAway(result);
+  }
+}
+
+BENCHMARK_RELATIVE(formatToString, iters) {
+  Hash hash(kHex);
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(hash.toString());
+  }
+}
+
+BENCHMARK_RELATIVE(formatToHex, iters) {
+  Hash hash(kHex);
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(hash.toHex());
+  }
+}
+
+BENCHMARK_RELATIVE(formatToAppend, iters) {
+  Hash hash(kHex);
+  std::string result;
+  result.reserve(Hash::HEX_SIZE);
+  for (size_t n = 0; n < iters; ++n) {
+    result.clear();
+    toAppend(hash, &result);
+    folly::doNotOptimizeAway(result);
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(hashSetLookup, iters) {
+  std::unordered_set<Hash> hashes;
+  std::vector<Hash> lookups;
+  BENCHMARK_SUSPEND {
+    for (size_t n = 0; n < 100000; ++n) {
+      hashes.insert(makeHash(n));
+    }
+    for (size_t n = 0; n < 1000; ++n) {
+      lookups.push_back(makeHash(n * 97));
+    }
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(hashes.count(lookups[n % lookups.size()]));
+  }
+}
@@ -13,6 +13,7 @@
 #include <folly/String.h>
 #include <folly/io/Cursor.h>
 #include <gtest/gtest.h>
+#include <sstream>
 
 using facebook::eden::Hash;
 using folly::ByteRange;
@@ -136,6 +137,40 @@ TEST(Hash, ensureStringConstructorRejectsArgumentBadCharacters) {
       Hash("ZZZZb00cdeadbeefc00010ff1badb0028badf00d"), std::invalid_argument);
 }
 
+TEST(Hash, parseAndFormatHex) {
+  // Upper and lower case digits are accepted, and the output is lowercase
+  Hash upper("FACEB00CDEADBEEFC00010FF1BADB0028BADF00D");
+  EXPECT_EQ(testHash, upper);
+  EXPECT_EQ(testHashHex, upper.toString());
+
+  auto hex = testHash.toHex();
+  EXPECT_EQ(testHashHex, StringPiece(hex.data(), hex.size()));
+  EXPECT_EQ(testHashHex, folly::to<string>(testHash));
+  std::ostringstream os;
+  os << testHash;
+  EXPECT_EQ(testHashHex, os.str());
+
+  // Every byte value round trips
+  Hash::Storage bytes;
+  for (size_t n = 0; n < 256; n += Hash::RAW_SIZE) {
+    for (size_t i = 0; i < Hash::RAW_SIZE; ++i) {
+      bytes[i] = static_cast<uint8_t>(n + i);
+    }
+    Hash hash(bytes);
+    EXPECT_EQ(folly::hexlify(hash.getBytes()), hash.toString());
+    EXPECT_EQ(hash, Hash(hash.toString()));
+  }
+
+  // Invalid characters anywhere in the string are rejected
+  for (size_t n = 0; n < testHashHex.size(); ++n) {
+    for (char c : {'g', 'G', ' ', '/', ':', '@', '`', '\0'}) {
+      auto bad = testHashHex;
+      bad[n] = c;
+      EXPECT_THROW(Hash{StringPiece{bad}}, std::invalid_argument);
+    }
+  }
+}
+
 TEST(Hash, sha1IOBuf) {
   // Test computing the SHA1 of data spread across an IOBuf chain
   auto buf1 = IOBuf::create(50);
@@ -0,0 +1,180 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/model/NativeTree.h"
+
+#include <gtest/gtest.h>
+#include "eden/fs/model/Hash.h"
+#include "eden/fs/model/Tree.h"
+#include "eden/fs/model/TreeEntry.h"
+
+using namespace facebook::eden;
+using folly::ByteRange;
+using folly::StringPiece;
+using std::string;
+using std::vector;
+
+namespace {
+Hash blobHash("faceb00cdeadbeefc00010ff1badb0028badf00d");
+Hash treeHash("0123456789abcdef0123456789abcdef01234567");
+
+Tree makeTree() {
+  vector<TreeEntry> entries;
+  entries.emplace_back(
+      blobHash, ".gitignore", FileType::REGULAR_FILE, 0b110, uint64_t{42});
+  entries.emplace_back(blobHash, "README", FileType::REGULAR_FILE, 0b110);
+  entries.emplace_back(
+      blobHash, "latest", FileType::SYMLINK, 0b111, uint64_t{0x123456789});
+  entries.emplace_back(treeHash, "lib", FileType::DIRECTORY, 0b111);
+  entries.emplace_back(blobHash, "run.sh", FileType::REGULAR_FILE, 0b111);
+  return Tree(std::move(entries));
+}
+
+string serialize(const Tree& tree) {
+  auto buf = serializeNativeTree(tree);
+  return buf.moveToFbString().toStdString();
+}
+}
+
+TEST(NativeTree, roundTrip) {
+  auto tree = makeTree();
+  auto data = serialize(tree);
+  EXPECT_TRUE(isNativeTree(ByteRange{StringPiece{data}}));
+
+  auto result = deserializeNativeTree(treeHash, ByteRange{StringPiece{data}});
+  EXPECT_EQ(treeHash, result->getHash());
+  const auto& expected = tree.getTreeEntries();
+  const auto& actual = result->getTreeEntries();
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t n = 0; n < expected.size(); ++n) {
+    EXPECT_EQ(expected[n].getName(), actual[n].getName());
+    EXPECT_EQ(expected[n].getHash(), actual[n].getHash());
+    EXPECT_EQ(expected[n].getFileType(), actual[n].getFileType());
+    EXPECT_EQ(
+        expected[n].getOwnerPermissions(), actual[n].getOwnerPermissions());
+    EXPECT_EQ(expected[n].getSize(), actual[n].getSize());
+  }
+  EXPECT_EQ(42, result->getEntryAt(0).getSize().value());
+  EXPECT_FALSE(result->getEntryAt(1).getSize().hasValue());
+}
+
+TEST(NativeTree, readsVersion1) {
+  // A version 1 tree with a single entry, which has no size field.
+  string data("\xedTr\x01\x01\x00\x00\x00", 8);
+  auto hashBytes = blobHash.getBytes();
+  data.append(reinterpret_cast<const char*>(hashBytes.data()), Hash::RAW_SIZE);
+  data.append("\x40\x06\x00\x00", 4); // REGULAR_FILE, rw-, reserved
+  data.append("\x00\x00\x00\x00\x06\x00\x00\x00", 8); // name at 0, 6 long
+  data.append("README");
+  ASSERT_EQ(kNativeTreeHeaderSize + kNativeTreeV1EntrySize + 6, data.size());
+
+  ByteRange bytes{StringPiece{data}};
+  EXPECT_TRUE(isNativeTree(bytes));
+  auto result = deserializeNativeTree(treeHash, bytes);
+  ASSERT_EQ(1, result->getTreeEntries().size());
+  const auto& entry = result->getEntryAt(0);
+  EXPECT_EQ("README", entry.getName());
+  EXPECT_EQ(blobHash, entry.getHash());
+  EXPECT_EQ(FileType::REGULAR_FILE, entry.getFileType());
+  EXPECT_EQ(0b110, entry.getOwnerPermissions());
+  EXPECT_FALSE(entry.getSize().hasValue());
+}
+
+TEST(NativeTree, emptyTree) {
+  auto data = serialize(Tree(vector<TreeEntry>{}));
+  EXPECT_EQ(kNativeTreeHeaderSize, data.size());
+  auto result = deserializeNativeTree(treeHash, ByteRange{StringPiece{data}});
+  EXPECT_EQ(0, result->getTreeEntries().size());
+}
+
+TEST(NativeTree, serializeIntoBuffer) {
+  auto tree = makeTree();
+  const auto& entries = tree.getTreeEntries();
+  auto expected = serialize(tree);
+  ASSERT_EQ(expected.size(), getNativeTreeSize(entries));
+
+  std::vector<uint8_t> buf(getNativeTreeSize(entries));
+  serializeNativeTree(entries, {buf.data(), buf.size()});
+  EXPECT_EQ(expected, StringPiece{ByteRange{buf.data(), buf.size()}});
+}
+
+TEST(NativeTree, findEntry) {
+  vector<TreeEntry> entries;
+  for (char c = 'a'; c <= 'z'; ++c) {
+    entries.emplace_back(
+        blobHash, string(c - 'a' + 1, c), FileType::REGULAR_FILE, 0b110);
+  }
+  auto data = serialize(Tree(std::move(entries)));
+  ByteRange bytes{StringPiece{data}};
+
+  for (char c = 'a'; c <= 'z'; ++c) {
+    string name(c - 'a' + 1, c);
+    auto entry = findNativeTreeEntry(bytes, PathComponentPiece{name});
+    ASSERT_TRUE(entry.hasValue()) << name;
+    EXPECT_EQ(name, entry->getName().stringPiece());
+  }
+  EXPECT_FALSE(findNativeTreeEntry(bytes, PathComponentPiece{"b"}).hasValue());
+  EXPECT_FALSE(findNativeTreeEntry(bytes, PathComponentPiece{"0"}).hasValue());
+  EXPECT_FALSE(findNativeTreeEntry(bytes, PathComponentPiece{"zz"}).hasValue());
+}
+
+TEST(NativeTree, view) {
+  auto tree = makeTree();
+  NativeTreeView view{treeHash, serializeNativeTree(tree)};
+  EXPECT_EQ(treeHash, view.getHash());
+  ASSERT_EQ(tree.getTreeEntries().size(), view.size());
+
+  for (size_t n = 0; n < view.size(); ++n) {
+    const auto& expected = tree.getEntryAt(n);
+    auto entry = view.getEntryAt(n);
+    EXPECT_EQ(expected.getName(), entry.getName());
+    EXPECT_EQ(expected.getHash(), entry.getHash());
+    EXPECT_EQ(expected.getType(), entry.getType());
+    EXPECT_EQ(expected.getFileType(), entry.getFileType());
+    EXPECT_EQ(expected.getOwnerPermissions(), entry.getOwnerPermissions());
+    EXPECT_EQ(expected.getSize(), entry.getSize());
+  }
+  EXPECT_THROW(view.getEntryAt(view.size()), std::out_of_range);
+
+  auto lib = view.getEntry(PathComponentPiece{"lib"});
+  ASSERT_TRUE(lib.hasValue());
+  EXPECT_EQ(TreeEntryType::TREE, lib->getType());
+  EXPECT_EQ(treeHash, lib->getHash());
+  EXPECT_FALSE(view.getEntry(PathComponentPiece{"missing"}).hasValue());
+
+  auto copy = view.toTree();
+  EXPECT_EQ(treeHash, copy->getHash());
+  EXPECT_EQ(view.size(), copy->getTreeEntries().size());
+  EXPECT_EQ("run.sh", copy->getEntryAt(4).getName());
+}
+
+TEST(NativeTree, rejectsBadData) {
+  EXPECT_FALSE(isNativeTree(ByteRange{StringPiece{"tree 5\0hello", 12}}));
+  EXPECT_FALSE(isNativeTree(ByteRange{}));
+
+  auto data = serialize(makeTree());
+  // Truncated in the entry table
+  EXPECT_THROW(
+      deserializeNativeTree(
+          treeHash, ByteRange{StringPiece{data}.subpiece(0, 40)}),
+      std::invalid_argument);
+  // Truncated in the names
+  EXPECT_THROW(
+      deserializeNativeTree(
+          treeHash, ByteRange{StringPiece{data}.subpiece(0, data.size() - 1)}),
+      std::invalid_argument);
+
+  // An unsupported version
+  auto badVersion = data;
+  badVersion[3] = kNativeTreeVersion + 1;
+  EXPECT_FALSE(isNativeTree(ByteRange{StringPiece{badVersion}}));
+  EXPECT_THROW(
+      deserializeNativeTree(treeHash, ByteRange{StringPiece{badVersion}}),
+      std::invalid_argument);
+}
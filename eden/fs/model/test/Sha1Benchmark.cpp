@@ -0,0 +1,147 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Benchmark.h>
+#include <folly/Exception.h>
+#include <folly/File.h>
+#include <folly/FileUtil.h>
+#include <folly/experimental/TestUtil.h>
+#include <folly/init/Init.h>
+#include <folly/io/IOBuf.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <fcntl.h>
+
+#include "eden/fs/model/Hash.h"
+
+using namespace facebook::eden;
+using folly::ByteRange;
+using folly::IOBuf;
+
+/*
+ * Compare the ways eden can compute SHA-1 hashes.
+ *
+ * OpenSSL chooses its SHA-1 implementation when it is initialized, using the
+ * SHA extensions of the CPU if it has them, so running this on machines with
+ * and without them (or with OPENSSL_ia32cap set to mask them out) compares
+ * the hardware and software implementations.
+ */
+
+namespace {
+constexpr size_t kFileSize = 64 * 1024 * 1024;
+
+const std::string& getData() {
+  static const std::string data = [] {
+    std::string result(kFileSize, '\0');
+    for (size_t n = 0; n < result.size(); ++n) {
+      result[n] = static_cast<char>(n * 7 + (n >> 11));
+    }
+    return result;
+  }();
+  return data;
+}
+
+void hashLowLevel(size_t iters, size_t size) {
+  ByteRange data{folly::StringPiece{getData()}.subpiece(0, size)};
+  for (size_t n = 0; n < iters; ++n) {
+    uint8_t digest[SHA_DIGEST_LENGTH];
+    SHA1(data.data(), data.size(), digest);
+    folly::doNotOptimizeAway(digest);
+  }
+}
+
+void hashEvp(size_t iters, size_t size) {
+  ByteRange data{folly::StringPiece{getData()}.subpiece(0, size)};
+  for (size_t n = 0; n < iters; ++n) {
+    uint8_t digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLength;
+    EVP_Digest(
+        data.data(), data.size(), digest, &digestLength, EVP_sha1(), nullptr);
+    folly::doNotOptimizeAway(digest);
+  }
+}
+
+void hashIOBuf(size_t iters, size_t size) {
+  // A chain of 64KB buffers, like the contents of a Blob loaded in pieces.
+  auto data = folly::StringPiece{getData()}.subpiece(0, size);
+  std::unique_ptr<IOBuf> chain;
+  constexpr size_t kChunkSize = 64 * 1024;
+  for (size_t off = 0; off < data.size(); off += kChunkSize) {
+    auto chunk = IOBuf::wrapBuffer(data.subpiece(off, kChunkSize));
+    if (chain) {
+      chain->prependChain(std::move(chunk));
+    } else {
+      chain = std::move(chunk);
+    }
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(Hash::sha1(chain.get()));
+  }
+}
+
+folly::test::TemporaryFile& getFile() {
+  static auto file = [] {
+    auto result =
+        std::make_unique<folly::test::TemporaryFile>("eden_sha1_bench");
+    folly::writeFull(result->fd(), getData().data(), getData().size());
+    return result;
+  }();
+  return *file;
+}
+
+/*
+ * Hash a file the way FileData::recomputeAndStoreSha1() does.
+ */
+void hashFile(size_t iters, size_t bufferSize, bool readahead) {
+  BENCHMARK_SUSPEND {
+    getFile();
+  }
+  auto fd = getFile().fd();
+  auto buf = std::make_unique<uint8_t[]>(bufferSize);
+  for (size_t n = 0; n < iters; ++n) {
+#ifndef __APPLE__
+    posix_fadvise(
+        fd, 0, 0, readahead ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+#endif
+    SHA_CTX ctx;
+    SHA1_Init(&ctx);
+    off_t off = 0;
+    while (true) {
+      auto len = folly::preadNoInt(fd, buf.get(), bufferSize, off);
+      if (len == 0) {
+        break;
+      }
+      folly::checkUnixError(len, "pread failed");
+      SHA1_Update(&ctx, buf.get(), len);
+      off += len;
+    }
+    uint8_t digest[SHA_DIGEST_LENGTH];
+    SHA1_Final(digest, &ctx);
+    folly::doNotOptimizeAway(digest);
+  }
+}
+}
+
+BENCHMARK_PARAM(hashLowLevel, 4096);
+BENCHMARK_RELATIVE_PARAM(hashEvp, 4096);
+BENCHMARK_PARAM(hashLowLevel, 1048576);
+BENCHMARK_RELATIVE_PARAM(hashEvp, 1048576);
+BENCHMARK_RELATIVE_PARAM(hashIOBuf, 1048576);
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_NAMED_PARAM(hashFile, 8k_no_readahead, 8192, false);
+BENCHMARK_RELATIVE_NAMED_PARAM(hashFile, 8k_readahead, 8192, true);
+BENCHMARK_RELATIVE_NAMED_PARAM(hashFile, 128k_readahead, 128 * 1024, true);
+BENCHMARK_RELATIVE_NAMED_PARAM(hashFile, 1m_readahead, 1024 * 1024, true);
+
+int main(int argc, char** argv) {
+  folly::init(&argc, &argv);
+  folly::runBenchmarks();
+  return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Benchmark.h>
+#include <folly/Conv.h>
+#include <folly/io/IOBuf.h>
+
+#include "eden/fs/model/Hash.h"
+#include "eden/fs/model/NativeTree.h"
+#include "eden/fs/model/Tree.h"
+#include "eden/fs/model/git/GitTree.h"
+
+using namespace facebook::eden;
+using folly::ByteRange;
+using folly::IOBuf;
+
+/*
+ * Compare decoding Trees stored in the git tree format with the native
+ * format that LocalStore now uses.
+ *
+ * These are linked into the same binary as the other benchmarks in this
+ * directory, which provide main().  Use --bm_regex to run only these.
+ */
+
+namespace {
+/**
+ * A Tree with numEntries entries, with names like those in a typical
+ * source directory.
+ */
+Tree makeTree(size_t numEntries) {
+  std::vector<TreeEntry> entries;
+  for (size_t n = 0; n < numEntries; ++n) {
+    auto name = folly::to<std::string>("source_file_", 100000 + n, ".cpp");
+    auto hash = Hash::sha1(ByteRange{folly::StringPiece{name}});
+    if (n % 10 == 0) {
+      entries.emplace_back(hash, name, FileType::DIRECTORY, 0b111);
+    } else {
+      entries.emplace_back(hash, name, FileType::REGULAR_FILE, 0b110);
+    }
+  }
+  return Tree(std::move(entries));
+}
+
+std::string serializeGit(const Tree& tree) {
+  GitTreeSerializer serializer;
+  for (const auto& entry : tree.getTreeEntries()) {
+    serializer.addEntry(entry);
+  }
+  return serializer.finalize().moveToFbString().toStdString();
+}
+
+std::string serializeNative(const Tree& tree) {
+  return serializeNativeTree(tree).moveToFbString().toStdString();
+}
+
+void deserializeGit(size_t iters, size_t numEntries) {
+  std::string data;
+  BENCHMARK_SUSPEND {
+    data = serializeGit(makeTree(numEntries));
+  }
+  Hash hash;
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(
+        deserializeGitTree(hash, ByteRange{folly::StringPiece{data}}));
+  }
+}
+
+void deserializeNative(size_t iters, size_t numEntries) {
+  std::string data;
+  BENCHMARK_SUSPEND {
+    data = serializeNative(makeTree(numEntries));
+  }
+  Hash hash;
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(
+        deserializeNativeTree(hash, ByteRange{folly::StringPiece{data}}));
+  }
+}
+
+void lookupGit(size_t iters, size_t numEntries) {
+  std::string data;
+  PathComponent name;
+  BENCHMARK_SUSPEND {
+    auto tree = makeTree(numEntries);
+    data = serializeGit(tree);
+    name = tree.getEntryAt(numEntries / 2).getName();
+  }
+  Hash hash;
+  for (size_t n = 0; n < iters; ++n) {
+    auto tree = deserializeGitTree(hash, ByteRange{folly::StringPiece{data}});
+    folly::doNotOptimizeAway(tree->getEntryPtr(name.piece()));
+  }
+}
+
+void lookupNative(size_t iters, size_t numEntries) {
+  std::string data;
+  PathComponent name;
+  BENCHMARK_SUSPEND {
+    auto tree = makeTree(numEntries);
+    data = serializeNative(tree);
+    name = tree.getEntryAt(numEntries / 2).getName();
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(
+        findNativeTreeEntry(ByteRange{folly::StringPiece{data}}, name.piece()));
+  }
+}
+}
+
+BENCHMARK_PARAM(deserializeGit, 10);
+BENCHMARK_RELATIVE_PARAM(deserializeNative, 10);
+BENCHMARK_PARAM(deserializeGit, 1000);
+BENCHMARK_RELATIVE_PARAM(deserializeNative, 1000);
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(lookupGit, 1000);
+BENCHMARK_RELATIVE_PARAM(lookupNative, 1000);
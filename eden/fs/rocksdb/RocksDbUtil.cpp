@@ -38,5 +38,28 @@ unique_ptr<DB> createRocksDb(StringPiece dbPath) {
 
   return unique_ptr<DB>(db);
 }
+
+RocksHandles::RocksHandles(
+    StringPiece dbPath,
+    const rocksdb::DBOptions& dbOptions,
+    const std::vector<rocksdb::ColumnFamilyDescriptor>& columnDescriptors) {
+  auto options = dbOptions;
+  options.create_if_missing = true;
+  options.create_missing_column_families = true;
+
+  DB* dbRaw;
+  std::vector<rocksdb::ColumnFamilyHandle*> handles;
+  Status status =
+      DB::Open(options, dbPath.str(), columnDescriptors, &handles, &dbRaw);
+  if (!status.ok()) {
+    throw std::runtime_error(
+        folly::to<string>("Failed to open DB: ", status.ToString()));
+  }
+
+  db.reset(dbRaw);
+  for (auto handle : handles) {
+    columns.emplace_back(handle);
+  }
+}
 }
 }
@@ -13,6 +13,7 @@
 #include <rocksdb/db.h>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace facebook {
 namespace eden {
@@ -22,5 +23,31 @@ namespace eden {
  * storage. If there is an existing RocksDB at that path, it will be used.
  */
 std::unique_ptr<rocksdb::DB> createRocksDb(folly::StringPiece dbPath);
+
+/**
+ * RocksHandles holds an open RocksDB together with the handles for its
+ * column families.
+ *
+ * The column family handles must be released before the DB is closed, so
+ * they are declared after the DB and are destroyed first.
+ */
+struct RocksHandles {
+  std::unique_ptr<rocksdb::DB> db;
+  std::vector<std::unique_ptr<rocksdb::ColumnFamilyHandle>> columns;
+
+  /**
+   * Open the RocksDB in the specified directory, with the specified column
+   * families.
+   *
+   * The DB and any missing column families are created if necessary.  The
+   * descriptors must include the default column family, and every column
+   * family already present in an existing DB.  The handles in columns are
+   * in the same order as the descriptors.
+   */
+  RocksHandles(
+      folly::StringPiece dbPath,
+      const rocksdb::DBOptions& dbOptions,
+      const std::vector<rocksdb::ColumnFamilyDescriptor>& columnDescriptors);
+};
 }
 }
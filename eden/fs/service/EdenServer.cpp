@@ -13,25 +13,216 @@
 #include <boost/filesystem/path.hpp>
 #include <folly/SocketAddress.h>
 #include <folly/String.h>
+#include <folly/experimental/FunctionScheduler.h>
+#include <folly/futures/Future.h>
 #include <gflags/gflags.h>
 #include <thrift/lib/cpp2/server/ThriftServer.h>
 #include <wangle/concurrent/CPUThreadPoolExecutor.h>
 #include <wangle/concurrent/GlobalExecutor.h>
+#include <algorithm>
+#include <thread>
 
 #include "EdenServiceHandler.h"
+#include "common/stats/ServiceData.h"
 #include "eden/fs/config/ClientConfig.h"
 #include "eden/fs/inodes/Dirstate.h"
 #include "eden/fs/inodes/EdenMount.h"
+#include "eden/fs/inodes/EdenMounts.h"
+#include "eden/fs/inodes/FileData.h"
+#include "eden/fs/inodes/FileInode.h"
+#include "eden/fs/inodes/InodeBase.h"
+#include "eden/fs/inodes/InodeMap.h"
+#include "eden/fs/inodes/Overlay.h"
+#include "eden/fs/store/BlobCache.h"
+#include "eden/fs/store/LiveTreeTable.h"
+#include "eden/fs/store/BlobPack.h"
+#include "eden/fs/store/CachingBackingStore.h"
 #include "eden/fs/store/EmptyBackingStore.h"
 #include "eden/fs/store/LocalStore.h"
+#include "eden/fs/store/ObjectStore.h"
+#include "eden/fs/store/PrioritizedExecutor.h"
 #include "eden/fs/store/git/GitBackingStore.h"
 #include "eden/fs/store/hg/HgBackingStore.h"
+#include "eden/fs/takeover/TakeoverClient.h"
+#include "eden/fs/takeover/TakeoverServer.h"
+#include "eden/fuse/FuseChannelData.h"
 #include "eden/fuse/MountPoint.h"
 #include "eden/fuse/privhelper/PrivHelper.h"
+#include "eden/utils/MemoryGovernor.h"
+#include "eden/utils/SlabPool.h"
 
 DEFINE_bool(debug, false, "run fuse in debug mode");
+DEFINE_bool(
+    takeover,
+    false,
+    "take over the mount points of the edenfs process already running for "
+    "this eden directory, without unmounting them");
 
 DEFINE_int32(num_eden_threads, 12, "the number of eden CPU worker threads");
+DEFINE_int32(
+    num_backing_store_threads,
+    8,
+    "the number of threads used to fetch data from the backing stores");
+DEFINE_int32(
+    backing_store_max_queue_delay_ms,
+    1000,
+    "the longest that a backing store fetch waits behind more urgent ones "
+    "before it is run anyway, in milliseconds");
+DEFINE_int32(
+    num_remount_threads,
+    8,
+    "the number of clients to remount in parallel at startup");
+DEFINE_int32(
+    num_mount_load_threads,
+    8,
+    "the number of threads used to read overlay data when loading the "
+    "materialized inodes of a mount point at mount time");
+DEFINE_int32(
+    num_diff_threads,
+    8,
+    "the number of threads used to compare subdirectories and file "
+    "contents in parallel when computing the status of a mount point");
+DEFINE_uint64(
+    blob_cache_size,
+    512 * 1024 * 1024,
+    "the maximum number of bytes of file contents to keep in memory after "
+    "the inodes using them have been unloaded.  0 disables the blob cache");
+DEFINE_uint64(
+    blob_pack_size,
+    0,
+    "the maximum number of bytes of hot file contents to keep in "
+    "memory-mapped files, which are read without copying.  0 disables the "
+    "blob pack");
+DEFINE_uint64(
+    blob_pack_segment_size,
+    64 * 1024 * 1024,
+    "the size of each file in the blob pack.  The blob pack evicts a whole "
+    "segment at a time, and does not store files larger than a segment");
+DEFINE_int32(
+    local_store_gc_interval,
+    3600,
+    "how often, in seconds, to garbage collect the local store when a "
+    "max-size is configured for it.  0 disables periodic garbage collection");
+DEFINE_int32(
+    local_store_maintenance_interval,
+    60,
+    "how often, in seconds, to check the compaction state of the local "
+    "store, and compact the key spaces that need it.  0 disables this");
+DEFINE_uint64(
+    local_store_compact_after_import_bytes,
+    1024 * 1024 * 1024,
+    "compact the local store key spaces with more than one level 0 file "
+    "once this many bytes have been imported in bulk since the last "
+    "compaction");
+DEFINE_uint64(
+    local_store_compact_pending_bytes,
+    256 * 1024 * 1024,
+    "compact a local store key space when RocksDB estimates that its "
+    "compactions are this many bytes behind");
+DEFINE_int32(
+    local_store_maintenance_max_fuse_latency_ms,
+    50,
+    "defer local store maintenance while the 99th percentile FUSE request "
+    "latency is above this many milliseconds.  0 disables the check");
+DEFINE_uint64(
+    local_store_scrub_bytes_per_second,
+    4 * 1024 * 1024,
+    "how many bytes of the local store to check for corruption each second, "
+    "removing the corrupt objects so that they are fetched again.  0 "
+    "disables scrubbing");
+DEFINE_int32(
+    local_store_scrub_pass_interval,
+    7 * 24 * 3600,
+    "the minimum time, in seconds, between the starts of passes of the local "
+    "store scrubber over the whole store");
+DEFINE_int32(
+    inode_unload_interval,
+    300,
+    "how often, in seconds, to unload inodes that have not been used "
+    "recently.  0 disables periodic inode unloading");
+DEFINE_int32(
+    inode_unload_age,
+    3600,
+    "unload unreferenced inodes that have not been looked up for this many "
+    "seconds");
+DEFINE_uint64(
+    inode_unload_max_loaded,
+    1000000,
+    "when a mount point has more than this many inodes loaded, unload all "
+    "unreferenced inodes regardless of age.  0 disables the limit");
+DEFINE_int32(
+    overlay_flush_interval_ms,
+    1000,
+    "how often, in milliseconds, to write out directory changes that are "
+    "pending in the overlay, and to sync overlays in batched durability "
+    "mode.  0 only writes them on fsyncdir() and unmount");
+DEFINE_int32(
+    dematerialize_interval,
+    1800,
+    "how often, in seconds, to dematerialize files whose contents match the "
+    "current commit again.  0 disables periodic dematerialization");
+DEFINE_int32(
+    journal_compact_interval,
+    60,
+    "how often, in seconds, to check whether each mount point's journal "
+    "needs to be compacted.  0 disables journal compaction");
+DEFINE_uint64(
+    journal_memory_limit,
+    256 * 1024 * 1024,
+    "the approximate number of bytes of change history each mount point's "
+    "journal may hold before old changes are merged together and the "
+    "oldest ones are dropped");
+DEFINE_uint64(
+    journal_save_limit,
+    16 * 1024 * 1024,
+    "the approximate number of bytes of change history saved from each mount "
+    "point's journal when it is unmounted, for the next mount to continue "
+    "from.  0 disables saving the journal");
+DEFINE_int32(
+    memory_pressure_interval_ms,
+    1000,
+    "how often, in milliseconds, to check the memory pressure of the host "
+    "and shrink the caches if it is too high.  0 disables this");
+DEFINE_string(
+    memory_pressure_file,
+    "/proc/pressure/memory",
+    "the pressure stall information file to read memory pressure from.  Use "
+    "a cgroup's memory.pressure file to react to pressure within the cgroup");
+DEFINE_double(
+    memory_pressure_threshold,
+    10,
+    "the percentage of time stalled on memory, averaged over 10 seconds, at "
+    "which the caches are shrunk");
+DEFINE_double(
+    memory_pressure_keep_fraction,
+    0.5,
+    "the fraction of their contents that the caches keep each time they are "
+    "shrunk because of memory pressure");
+DEFINE_int32(
+    warm_up_tree_depth,
+    0,
+    "after mounting, load the trees of the current snapshot down to this "
+    "many levels in the background.  0 disables this");
+DEFINE_int32(
+    warm_up_hot_trees,
+    0,
+    "the number of recently used trees to record for each mount when it is "
+    "unmounted, and to load in the background when it is next mounted.  0 "
+    "disables this");
+DEFINE_int32(
+    warm_up_max_trees,
+    100000,
+    "the maximum number of trees to load when warming up a mount point");
+DEFINE_int32(
+    shared_object_cache_timeout_ms,
+    200,
+    "how long, in milliseconds, to wait for the shared object cache before "
+    "fetching objects from the backing store instead");
+DEFINE_int32(
+    shared_object_cache_batch_size,
+    256,
+    "the maximum number of objects to look up in one request to the shared "
+    "object cache");
 
 DEFINE_string(thrift_address, "", "The address for the thrift server socket");
 DEFINE_int32(thrift_num_workers, 2, "The number of thrift worker threads");
@@ -47,18 +238,42 @@ DEFINE_int32(
     200,
     "Minimum response compression size");
 
+DECLARE_uint64(treeCacheSize);
+DECLARE_int32(hgNumImporters);
+DECLARE_int32(hgImporterPipelineDepth);
+DECLARE_int32(fuseNumThreads);
+DECLARE_double(materialized_cache_ttl);
+DECLARE_double(unmaterialized_cache_ttl);
+
 using apache::thrift::ThriftServer;
+using folly::Future;
 using folly::StringPiece;
 using std::make_shared;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
+using std::vector;
 
 namespace {
+constexpr StringPiece kTakeoverSocketName{"takeover"};
+// How long to wait for the previous edenfs process to exit and release the
+// eden lock after it has handed over its mount points.
+constexpr std::chrono::seconds kTakeoverLockTimeout{60};
+// The caches are shrunk at most this often under memory pressure.  This is
+// the window of the pressure average, so that it reflects the last shrink.
+constexpr std::chrono::seconds kMemoryPressureCooldown{10};
+// The InodeMap only knows the size of its own tables, so count each loaded
+// inode as the size of a FileInode, which is a lower bound for any inode.
+constexpr size_t kLoadedInodeBytes = sizeof(facebook::eden::FileInode);
+
 folly::SocketAddress getThriftAddress(
     StringPiece argument,
     StringPiece edenDir);
 std::string getPathToUnixDomainSocket(StringPiece edenDir);
+facebook::eden::LocalStoreOptions getLocalStoreOptions(
+    const facebook::eden::InterpolatedPropertyTree& config);
+facebook::eden::EdenServer::RuntimeSettings loadRuntimeSettings(
+    const facebook::eden::InterpolatedPropertyTree& config);
 }
 
 namespace facebook {
@@ -98,17 +313,391 @@ void EdenServer::unmountAll() {
 }
 
 void EdenServer::run() {
-  acquireEdenLock();
+  // Take over the mount points before acquiring the lock: the previous
+  // process only exits, releasing the lock and the local store, once it has
+  // handed them over.
+  folly::Optional<TakeoverData> takeoverData;
+  if (FLAGS_takeover) {
+    takeoverData =
+        takeOverMounts(edenDir_ + PathComponent(kTakeoverSocketName));
+    LOG(INFO) << "taking over " << takeoverData->mounts.size()
+              << " mount points";
+  }
+  acquireEdenLock(takeoverData.hasValue());
   createThriftServer();
-  localStore_ = make_shared<LocalStore>(rocksPath_);
+  reloadConfig();
+  localStore_ = make_shared<LocalStore>(
+      rocksPath_, getLocalStoreOptions(*getConfig()));
+  // reloadConfig() has already read the settings, but ran before there
+  // was anything to apply them to.
+  auto settings = getRuntimeSettings();
+  blobCache_ = make_shared<BlobCache>(settings.blobCacheSize);
+  liveTrees_ = make_shared<LiveTreeTable>();
+  if (FLAGS_blob_pack_size > 0) {
+    blobPack_ = make_shared<BlobPack>(
+        edenDir_, FLAGS_blob_pack_size, FLAGS_blob_pack_segment_size);
+  }
 
-  auto pool =
-      make_shared<wangle::CPUThreadPoolExecutor>(FLAGS_num_eden_threads);
-  wangle::setCPUExecutor(pool);
+  cpuPool_ =
+      make_shared<wangle::CPUThreadPoolExecutor>(settings.numEdenThreads);
+  wangle::setCPUExecutor(cpuPool_);
+  // Backing store fetches may block for a long time on the underlying
+  // repository, so they get their own pool rather than tying up the main
+  // CPU workers or FUSE threads.
+  backingStorePool_ = make_shared<wangle::CPUThreadPoolExecutor>(
+      settings.numBackingStoreThreads);
+  backingStoreExecutor_ = std::make_unique<PrioritizedExecutor>(
+      backingStorePool_.get(),
+      std::chrono::milliseconds(FLAGS_backing_store_max_queue_delay_ms));
+  mountLoadPool_ = make_shared<wangle::CPUThreadPoolExecutor>(
+      FLAGS_num_mount_load_threads);
+  diffPool_ =
+      make_shared<wangle::CPUThreadPoolExecutor>(settings.numDiffThreads);
 
-  reloadConfig();
+  if (FLAGS_local_store_gc_interval > 0) {
+    auto interval = std::chrono::seconds(FLAGS_local_store_gc_interval);
+    gcScheduler_ = std::make_unique<folly::FunctionScheduler>();
+    gcScheduler_->addFunction(
+        [this] { runPeriodicLocalStoreGc(); },
+        interval,
+        "localstore_gc",
+        interval);
+    gcScheduler_->setThreadName("localstore_gc");
+    gcScheduler_->start();
+  }
+
+  if (FLAGS_local_store_maintenance_interval > 0) {
+    exportLocalStoreCounters();
+    auto interval =
+        std::chrono::seconds(FLAGS_local_store_maintenance_interval);
+    maintenanceScheduler_ = std::make_unique<folly::FunctionScheduler>();
+    maintenanceScheduler_->addFunction(
+        [this] { runPeriodicLocalStoreMaintenance(); },
+        interval,
+        "localstore_maintenance",
+        interval);
+    maintenanceScheduler_->setThreadName("localstore_maint");
+    maintenanceScheduler_->start();
+  }
+
+  if (FLAGS_local_store_scrub_bytes_per_second > 0) {
+    scrubPosition_ = std::make_unique<LocalStoreScrubPosition>();
+    scrubPassStart_ = std::chrono::steady_clock::now();
+    scrubScheduler_ = std::make_unique<folly::FunctionScheduler>();
+    scrubScheduler_->addFunction(
+        [this] { runPeriodicLocalStoreScrub(); },
+        std::chrono::seconds(1),
+        "localstore_scrub");
+    scrubScheduler_->setThreadName("localstore_scrub");
+    scrubScheduler_->start();
+  }
+
+  if (FLAGS_inode_unload_interval > 0) {
+    auto interval = std::chrono::seconds(FLAGS_inode_unload_interval);
+    unloadScheduler_ = std::make_unique<folly::FunctionScheduler>();
+    unloadScheduler_->addFunction(
+        [this] { runPeriodicInodeUnload(); },
+        interval,
+        "inode_unload",
+        interval);
+    unloadScheduler_->setThreadName("inode_unload");
+    unloadScheduler_->start();
+  }
+
+  if (FLAGS_overlay_flush_interval_ms > 0) {
+    auto interval =
+        std::chrono::milliseconds(FLAGS_overlay_flush_interval_ms);
+    overlayFlushScheduler_ = std::make_unique<folly::FunctionScheduler>();
+    overlayFlushScheduler_->addFunction(
+        [this] { runPeriodicOverlayFlush(); },
+        interval,
+        "overlay_flush",
+        interval);
+    overlayFlushScheduler_->setThreadName("overlay_flush");
+    overlayFlushScheduler_->start();
+  }
+
+  if (FLAGS_dematerialize_interval > 0) {
+    auto interval = std::chrono::seconds(FLAGS_dematerialize_interval);
+    dematerializeScheduler_ = std::make_unique<folly::FunctionScheduler>();
+    dematerializeScheduler_->addFunction(
+        [this] { runPeriodicDematerialize(); },
+        interval,
+        "dematerialize",
+        interval);
+    dematerializeScheduler_->setThreadName("dematerialize");
+    dematerializeScheduler_->start();
+  }
+
+  if (FLAGS_journal_compact_interval > 0) {
+    auto interval = std::chrono::seconds(FLAGS_journal_compact_interval);
+    journalCompactScheduler_ = std::make_unique<folly::FunctionScheduler>();
+    journalCompactScheduler_->addFunction(
+        [this] { runPeriodicJournalCompaction(); },
+        interval,
+        "journal_compact",
+        interval);
+    journalCompactScheduler_->setThreadName("journal_compact");
+    journalCompactScheduler_->start();
+  }
+
+  if (FLAGS_memory_pressure_interval_ms > 0) {
+    createMemoryGovernor();
+    auto interval =
+        std::chrono::milliseconds(FLAGS_memory_pressure_interval_ms);
+    memoryPressureScheduler_ = std::make_unique<folly::FunctionScheduler>();
+    memoryPressureScheduler_->addFunction(
+        [this] { memoryGovernor_->check(); },
+        interval,
+        "memory_pressure",
+        interval);
+    memoryPressureScheduler_->setThreadName("memory_pressure");
+    memoryPressureScheduler_->start();
+  }
+
+  // Remount the existing mount points in the background, so that the
+  // thrift server can report their progress, and one slow mount does not
+  // hold up the others.
+  if (takeoverData) {
+    takeOverClients(std::move(takeoverData.value()));
+  } else {
+    remountClients();
+  }
+  takeoverServer_ = std::make_unique<TakeoverServer>(
+      edenDir_ + PathComponent(kTakeoverSocketName),
+      [this] { return startTakeoverShutdown(); });
+  takeoverServer_->start();
+  prepareThriftAddress();
+  runThriftServer();
+
+  // This waits for a takeover in progress to finish sending the mount
+  // points to the new process.
+  takeoverServer_.reset();
+
+  // Wait for any remounts that are still running, so that unmountAll() sees
+  // every mount point they start.
+  remountPool_->join();
+
+  if (gcScheduler_) {
+    gcScheduler_->shutdown();
+  }
+  if (maintenanceScheduler_) {
+    maintenanceScheduler_->shutdown();
+  }
+  if (scrubScheduler_) {
+    scrubScheduler_->shutdown();
+  }
+  if (unloadScheduler_) {
+    unloadScheduler_->shutdown();
+  }
+  if (overlayFlushScheduler_) {
+    overlayFlushScheduler_->shutdown();
+  }
+  if (dematerializeScheduler_) {
+    dematerializeScheduler_->shutdown();
+  }
+  if (journalCompactScheduler_) {
+    journalCompactScheduler_->shutdown();
+  }
+  if (memoryPressureScheduler_) {
+    memoryPressureScheduler_->shutdown();
+  }
+  auto* counters = fbData->getDynamicCounters();
+  for (const auto& name : counterNames_) {
+    counters->unregisterCallback(name);
+  }
+  counterNames_.clear();
+}
+
+void EdenServer::createMemoryGovernor() {
+  memoryGovernor_ = std::make_unique<MemoryGovernor>(
+      AbsolutePathPiece{FLAGS_memory_pressure_file},
+      FLAGS_memory_pressure_threshold,
+      FLAGS_memory_pressure_keep_fraction,
+      kMemoryPressureCooldown);
 
-  // Remount existing mount points
+  auto blobCache = blobCache_;
+  memoryGovernor_->addConsumer(
+      "blob_cache",
+      [blobCache] { return blobCache->getStats().totalBytes; },
+      [blobCache](double keepFraction) {
+        blobCache->shrink(blobCache->getStats().totalBytes * keepFraction);
+      });
+  memoryGovernor_->addConsumer(
+      "tree_cache",
+      [this] {
+        size_t bytes = 0;
+        for (const auto& mount : getMountPoints()) {
+          bytes += mount->getObjectStore()->getTreeCacheStats().totalBytes;
+        }
+        return bytes;
+      },
+      [this](double keepFraction) {
+        for (const auto& mount : getMountPoints()) {
+          auto* store = mount->getObjectStore();
+          store->shrinkTreeCache(
+              store->getTreeCacheStats().totalBytes * keepFraction);
+        }
+      });
+  // Inodes that are in use cannot be unloaded, and the others are not
+  // ordered by age across directories, so unload all of the unreferenced
+  // ones rather than a fraction.  Their FileData and Blobs go with them.
+  memoryGovernor_->addConsumer(
+      "inodes",
+      [this] {
+        size_t bytes = 0;
+        for (const auto& mount : getMountPoints()) {
+          auto stats = mount->getInodeMap()->getStats();
+          bytes += stats.memoryBytes + stats.loadedInodes * kLoadedInodeBytes;
+        }
+        return bytes;
+      },
+      [this](double /* keepFraction */) {
+        for (const auto& mount : getMountPoints()) {
+          try {
+            mount->getInodeMap()->unloadInactiveInodes(
+                std::chrono::seconds(0), 0);
+          } catch (const std::exception& ex) {
+            LOG(ERROR) << "error unloading inodes in " << mount->getPath()
+                       << ": " << folly::exceptionStr(ex);
+          }
+        }
+      });
+  // Open files hold on to their Blobs, so these are only tracked.
+  memoryGovernor_->addConsumer(
+      "file_data", [] { return FileData::getTotalBlobBytes(); }, nullptr);
+
+  auto* governor = memoryGovernor_.get();
+  auto add = [this](StringPiece name, std::function<int64_t()> fn) {
+    addCounter(name, std::move(fn));
+  };
+  add("memory.pressure", [governor] {
+    return static_cast<int64_t>(governor->getStats().pressure);
+  });
+  add("memory.pressure_events", [governor] {
+    return static_cast<int64_t>(governor->getStats().pressureEvents);
+  });
+  add("memory.total_bytes", [governor] {
+    return static_cast<int64_t>(governor->getStats().totalBytes);
+  });
+  auto numConsumers = governor->getStats().consumers.size();
+  for (size_t n = 0; n < numConsumers; ++n) {
+    auto prefix = folly::to<string>(
+        "memory.", governor->getStats().consumers[n].name, ".");
+    add(prefix + "bytes", [governor, n] {
+      return static_cast<int64_t>(governor->getStats().consumers[n].bytes);
+    });
+    add(prefix + "pressure_shrinks", [governor, n] {
+      return static_cast<int64_t>(
+          governor->getStats().consumers[n].pressureShrinks);
+    });
+    add(prefix + "pressure_freed_bytes", [governor, n] {
+      return static_cast<int64_t>(
+          governor->getStats().consumers[n].pressureFreedBytes);
+    });
+  }
+
+  // The slab pools keep their peak size, so report it separately from the
+  // estimates above.
+  auto numPools = SlabPool::getAllStats().size();
+  auto getPoolStats = [](size_t n) {
+    auto pools = SlabPool::getAllStats();
+    return n < pools.size() ? pools[n] : SlabPoolStats{};
+  };
+  for (size_t n = 0; n < numPools; ++n) {
+    auto prefix =
+        folly::to<string>("memory.pool.", getPoolStats(n).name, ".");
+    add(prefix + "reserved_bytes", [getPoolStats, n] {
+      return static_cast<int64_t>(getPoolStats(n).reservedBytes);
+    });
+    add(prefix + "objects", [getPoolStats, n] {
+      return static_cast<int64_t>(getPoolStats(n).objectsInUse);
+    });
+    add(prefix + "object_bytes", [getPoolStats, n] {
+      return static_cast<int64_t>(getPoolStats(n).objectSize);
+    });
+  }
+
+  // The Trees shared by the mount points.  These overlap with the tree
+  // caches, so they are not a separate consumer.
+  auto liveTrees = liveTrees_;
+  add("memory.live_trees.count", [liveTrees] {
+    return static_cast<int64_t>(liveTrees->getStats().numTrees);
+  });
+  add("memory.live_trees.bytes", [liveTrees] {
+    return static_cast<int64_t>(liveTrees->getStats().totalBytes);
+  });
+}
+
+void EdenServer::exportLocalStoreCounters() {
+  // Reading the RocksDB properties walks the SST file metadata, so the
+  // counters report the snapshot taken by the maintenance task rather than
+  // querying RocksDB on every read.
+  auto get = [this](std::function<uint64_t(const LocalStoreHealth&)> fn) {
+    return [this, fn] {
+      auto health = *localStoreHealth_.rlock();
+      return health ? static_cast<int64_t>(fn(*health)) : 0;
+    };
+  };
+  for (size_t n = 0; n < LocalStore::KeySpace::End; ++n) {
+    auto prefix = folly::to<string>(
+        "local_store.",
+        LocalStore::getKeySpaceName(static_cast<LocalStore::KeySpace>(n)),
+        ".");
+    addCounter(
+        prefix + "sst_files",
+        get([n](const LocalStoreHealth& h) {
+          return h.columns[n].numSstFiles;
+        }));
+    addCounter(
+        prefix + "level0_files",
+        get([n](const LocalStoreHealth& h) {
+          return h.columns[n].numLevel0Files;
+        }));
+    addCounter(
+        prefix + "pending_compaction_bytes",
+        get([n](const LocalStoreHealth& h) {
+          return h.columns[n].pendingCompactionBytes;
+        }));
+  }
+  addCounter(
+      "local_store.running_compactions",
+      get([](const LocalStoreHealth& h) { return h.runningCompactions; }));
+  addCounter(
+      "local_store.write_stopped",
+      get([](const LocalStoreHealth& h) { return h.writesStopped ? 1 : 0; }));
+  addCounter(
+      "local_store.delayed_write_rate",
+      get([](const LocalStoreHealth& h) { return h.delayedWriteRate; }));
+  addCounter("local_store.maintenance_compactions", [this] {
+    return static_cast<int64_t>(maintenanceCompactions_.load());
+  });
+  addCounter("local_store.maintenance_deferrals", [this] {
+    return static_cast<int64_t>(maintenanceDeferrals_.load());
+  });
+  addCounter("local_store.scrub.objects_checked", [this] {
+    return static_cast<int64_t>(scrubObjectsChecked_.load());
+  });
+  addCounter("local_store.scrub.bytes_checked", [this] {
+    return static_cast<int64_t>(scrubBytesChecked_.load());
+  });
+  addCounter("local_store.scrub.objects_quarantined", [this] {
+    return static_cast<int64_t>(scrubObjectsQuarantined_.load());
+  });
+  addCounter("local_store.scrub.passes", [this] {
+    return static_cast<int64_t>(scrubPasses_.load());
+  });
+  addCounter("local_store.scrub.deferrals", [this] {
+    return static_cast<int64_t>(scrubDeferrals_.load());
+  });
+}
+
+void EdenServer::addCounter(StringPiece name, std::function<int64_t()> fn) {
+  fbData->getDynamicCounters()->registerCallback(name, std::move(fn));
+  counterNames_.push_back(name.str());
+}
+
+void EdenServer::remountClients() {
   folly::dynamic dirs = folly::dynamic::object();
   try {
     dirs = ClientConfig::loadClientDirectoryMap(edenDir_);
@@ -116,24 +705,108 @@ void EdenServer::run() {
     LOG(ERROR) << "Could not parse config.json file: " << ex.what()
                << " Skipping remount step.";
   }
+
+  remountPool_ = make_shared<wangle::CPUThreadPoolExecutor>(
+      std::max(FLAGS_num_remount_threads, 1));
   for (auto& client : dirs.items()) {
-    auto mountInfo = std::make_unique<MountInfo>();
-    mountInfo->mountPoint = client.first.c_str();
+    auto mountPoint = client.first.asString();
     auto edenClientPath = edenDir_ + PathComponent("clients") +
         PathComponent(client.second.c_str());
-    mountInfo->edenClientPath = edenClientPath.stringPiece().str();
-    try {
-      handler_->mount(std::move(mountInfo));
-    } catch (const std::exception& ex) {
-      LOG(ERROR) << "Failed to perform remount for " << client.first.c_str()
-                 << ": " << ex.what();
-    }
+    startupMountStates_.wlock()->emplace(mountPoint, StartupMountState{});
+    remountPool_->add([this, mountPoint, edenClientPath] {
+      auto mountInfo = std::make_unique<MountInfo>();
+      mountInfo->mountPoint = mountPoint;
+      mountInfo->edenClientPath = edenClientPath.stringPiece().str();
+      try {
+        handler_->mount(std::move(mountInfo));
+        startupMountStates_.wlock()->erase(mountPoint);
+        LOG(INFO) << "remounted " << mountPoint;
+      } catch (const std::exception& ex) {
+        LOG(ERROR) << "Failed to perform remount for " << mountPoint << ": "
+                   << ex.what();
+        (*startupMountStates_.wlock())[mountPoint].error =
+            folly::exceptionStr(ex).toStdString();
+      }
+    });
   }
-  prepareThriftAddress();
-  runThriftServer();
+}
+
+void EdenServer::takeOverClients(TakeoverData&& data) {
+  remountPool_ = make_shared<wangle::CPUThreadPoolExecutor>(
+      std::max(FLAGS_num_remount_threads, 1));
+  for (auto& mount : data.mounts) {
+    auto mountPoint = mount.state.mountPath;
+    startupMountStates_.wlock()->emplace(mountPoint, StartupMountState{});
+    auto info = make_shared<TakeoverData::MountInfo>(std::move(mount));
+    remountPool_->add([this, mountPoint, info] {
+      const auto& state = info->state;
+      try {
+        auto edenMount = createEdenMount(
+            mountPoint, AbsolutePathPiece{state.clientPath});
+        edenMount->restoreTakeoverState(state);
+        // Register the mount point and its bind mounts with our privhelper,
+        // so that they are unmounted if we exit.
+        fusell::privilegedTakeoverStartup(mountPoint, state.bindMounts);
+        fusell::FuseChannelData channelData{std::move(info->fuseDevice),
+                                            state.fuseInitRequest};
+        startMount(edenMount, &channelData);
+        startupMountStates_.wlock()->erase(mountPoint);
+        LOG(INFO) << "took over " << mountPoint;
+      } catch (const std::exception& ex) {
+        LOG(ERROR) << "Failed to take over " << mountPoint << ": "
+                   << folly::exceptionStr(ex);
+        (*startupMountStates_.wlock())[mountPoint].error =
+            folly::exceptionStr(ex).toStdString();
+        // Nothing is serving the mount point any more, so unmount it rather
+        // than leave it hanging.
+        try {
+          fusell::privilegedTakeoverStartup(mountPoint, state.bindMounts);
+          fusell::privilegedFuseUnmount(mountPoint);
+        } catch (const std::exception& unmountEx) {
+          LOG(ERROR) << "Failed to unmount " << mountPoint << ": "
+                     << folly::exceptionStr(unmountEx);
+        }
+      }
+    });
+  }
+}
+
+std::unordered_map<std::string, EdenServer::StartupMountState>
+EdenServer::getStartupMountStates() const {
+  return *startupMountStates_.rlock();
+}
+
+shared_ptr<EdenMount> EdenServer::createEdenMount(
+    StringPiece mountPoint,
+    AbsolutePathPiece clientPath) {
+  auto initialConfig = ClientConfig::loadFromClientDirectory(
+      AbsolutePathPiece{mountPoint}, clientPath, getConfig().get());
+
+  auto backingStore = getBackingStore(
+      initialConfig->getRepoType(),
+      initialConfig->getRepoSource(),
+      *initialConfig);
+  auto objectStore = std::make_unique<ObjectStore>(
+      getLocalStore(),
+      backingStore,
+      getBlobCache(),
+      getBlobPack(),
+      getLiveTreeTable());
+
+  return EdenMount::makeShared(
+      std::move(initialConfig),
+      std::move(objectStore),
+      getSocketPath(),
+      getStats());
 }
 
 void EdenServer::mount(shared_ptr<EdenMount> edenMount) {
+  startMount(std::move(edenMount), nullptr);
+}
+
+void EdenServer::startMount(
+    shared_ptr<EdenMount> edenMount,
+    fusell::FuseChannelData* takeoverData) {
   // Add the mount point to mountPoints_.
   // This also makes sure we don't have this path mounted already
   auto mountPath = edenMount->getPath().stringPiece();
@@ -146,10 +819,19 @@ void EdenServer::mount(shared_ptr<EdenMount> edenMount) {
           "mount point \"", mountPath, "\" is already mounted"));
     }
   }
+  // This comes after adding the mount to mountPoints_, so that any
+  // concurrent reloadConfig() either stored its settings before we read
+  // them here, or sees the mount and applies them itself.
+  applyRuntimeSettings(getRuntimeSettings(), edenMount.get());
 
   auto onFinish = [this, edenMount]() { this->mountFinished(edenMount.get()); };
   try {
-    edenMount->getMountPoint()->start(FLAGS_debug, onFinish);
+    if (takeoverData) {
+      edenMount->getMountPoint()->startTakeover(
+          FLAGS_debug, std::move(*takeoverData), onFinish);
+    } else {
+      edenMount->getMountPoint()->start(FLAGS_debug, onFinish);
+    }
   } catch (...) {
     // If we fail to start the mount point, call mountFinished()
     // to make sure it gets removed from mountPoints_.
@@ -161,23 +843,67 @@ void EdenServer::mount(shared_ptr<EdenMount> edenMount) {
     throw;
   }
 
-  // Perform all of the bind mounts associated with the client.
-  for (auto& bindMount : edenMount->getBindMounts()) {
-    auto pathInMountDir = bindMount.pathInMountDir;
-    try {
-      // If pathInMountDir does not exist, then it must be created before the
-      // bind mount is performed.
-      boost::system::error_code errorCode;
-      boost::filesystem::path mountDir = pathInMountDir.c_str();
-      boost::filesystem::create_directories(mountDir, errorCode);
-
-      fusell::privilegedBindMount(
-          bindMount.pathInClientDir.c_str(), pathInMountDir.c_str());
-    } catch (...) {
+  // Perform all of the bind mounts associated with the client.  After a
+  // takeover they are still in place from the previous process.
+  if (!takeoverData) {
+    performBindMounts(edenMount.get());
+  }
+
+  if (FLAGS_warm_up_tree_depth > 0 || FLAGS_warm_up_hot_trees > 0) {
+    auto warmUpStart = std::chrono::steady_clock::now();
+    edenMount
+        ->warmUp(
+            std::max(FLAGS_warm_up_tree_depth, 0),
+            std::max(FLAGS_warm_up_max_trees, 0))
+        .then([edenMount, warmUpStart](const TreeWarmUpStats& stats) {
+          auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now() - warmUpStart);
+          LOG(INFO) << "warmed up " << stats.treesLoaded << " trees for "
+                    << edenMount->getPath() << " in " << elapsed.count()
+                    << "ms (" << stats.treesFailed << " failed)";
+        })
+        .onError([edenMount](const folly::exception_wrapper& ew) {
+          LOG(WARNING) << "error warming up " << edenMount->getPath() << ": "
+                       << folly::exceptionStr(ew);
+        });
+  }
+}
+
+void EdenServer::performBindMounts(EdenMount* edenMount) {
+  const auto& bindMounts = edenMount->getBindMounts();
+  if (bindMounts.empty()) {
+    return;
+  }
+
+  vector<std::pair<string, string>> paths;
+  for (const auto& bindMount : bindMounts) {
+    // If pathInMountDir does not exist, then it must be created before the
+    // bind mount is performed.
+    boost::system::error_code errorCode;
+    boost::filesystem::path mountDir = bindMount.pathInMountDir.c_str();
+    boost::filesystem::create_directories(mountDir, errorCode);
+
+    paths.emplace_back(
+        bindMount.pathInClientDir.stringPiece().str(),
+        bindMount.pathInMountDir.stringPiece().str());
+  }
+
+  // Send them to the privhelper in batches, rather than one round trip
+  // each.
+  vector<folly::exception_wrapper> results;
+  try {
+    results = fusell::privilegedBindMounts(paths);
+  } catch (const std::exception& ex) {
+    LOG(ERROR) << "Failed to perform the bind mounts for "
+               << edenMount->getPath() << ": " << folly::exceptionStr(ex);
+    return;
+  }
+  for (size_t n = 0; n < results.size(); ++n) {
+    if (results[n]) {
       // Consider recording all failed bind mounts in a way that can be
       // communicated back to the caller in a structured way.
-      LOG(ERROR) << "Failed to perform bind mount for "
-                 << pathInMountDir.stringPiece() << ".";
+      LOG(ERROR) << "Failed to perform bind mount for " << paths[n].second
+                 << ": " << folly::exceptionStr(results[n]);
     }
   }
 }
@@ -192,9 +918,106 @@ void EdenServer::unmount(StringPiece mountPath) {
   }
 }
 
+Future<TakeoverData> EdenServer::startTakeoverShutdown() {
+  vector<Future<TakeoverData::MountInfo>> futures;
+  for (const auto& mount : getMountPoints()) {
+    auto mountPath = mount->getPath().stringPiece().str();
+    {
+      auto promises = takeoverPromises_.wlock();
+      if (promises->count(mountPath)) {
+        throw std::runtime_error("a takeover is already in progress");
+      }
+      futures.push_back((*promises)[mountPath].getFuture());
+    }
+    try {
+      mount->getMountPoint()->stopForTakeover();
+    } catch (const std::exception& ex) {
+      auto promises = takeoverPromises_.wlock();
+      auto it = promises->find(mountPath);
+      if (it != promises->end()) {
+        it->second.setException(
+            folly::exception_wrapper(std::current_exception(), ex));
+        promises->erase(it);
+      }
+    }
+  }
+
+  return folly::collectAll(futures).then(
+      [this](vector<folly::Try<TakeoverData::MountInfo>>&& results) {
+        TakeoverData data;
+        for (auto& result : results) {
+          if (result.hasException()) {
+            LOG(ERROR) << "unable to hand over a mount point: "
+                       << result.exception().what();
+            continue;
+          }
+          data.mounts.push_back(std::move(result.value()));
+        }
+        LOG(INFO) << "handing over " << data.mounts.size()
+                  << " mount points";
+        stop();
+        return data;
+      });
+}
+
+TakeoverData::MountInfo EdenServer::getTakeoverMountInfo(
+    EdenMount* edenMount) {
+  auto mountPath = edenMount->getPath().stringPiece();
+  auto channelData = edenMount->getMountPoint()->takeStoppedChannelData();
+  if (!channelData) {
+    throw std::runtime_error(folly::to<string>(
+        "mount point \"", mountPath, "\" stopped without being handed over"));
+  }
+
+  TakeoverData::MountInfo info;
+  info.state.mountPath = mountPath.str();
+  info.state.clientPath =
+      edenMount->getConfig()->getClientDirectory().stringPiece().str();
+  info.state.fuseInitRequest = std::move(channelData->initRequest);
+  for (const auto& bindMount : edenMount->getBindMounts()) {
+    info.state.bindMounts.push_back(
+        bindMount.pathInMountDir.stringPiece().str());
+  }
+  edenMount->saveTakeoverState(info.state);
+  // Write out pending directory changes so the new process sees them.
+  edenMount->getOverlay()->flushDirs(true);
+  // Stop our privhelper from unmounting the mount point when we exit.
+  fusell::privilegedTakeoverShutdown(mountPath);
+  info.fuseDevice = std::move(channelData->fuseDevice);
+  return info;
+}
+
 void EdenServer::mountFinished(EdenMount* edenMount) {
   auto mountPath = edenMount->getPath().stringPiece();
   LOG(INFO) << "mount point \"" << mountPath << "\" stopped";
+  folly::Optional<folly::Promise<TakeoverData::MountInfo>> takeoverPromise;
+  {
+    auto promises = takeoverPromises_.wlock();
+    auto it = promises->find(mountPath.str());
+    if (it != promises->end()) {
+      takeoverPromise = std::move(it->second);
+      promises->erase(it);
+    }
+  }
+  if (takeoverPromise) {
+    takeoverPromise->setWith([&] { return getTakeoverMountInfo(edenMount); });
+  }
+  if (FLAGS_warm_up_hot_trees > 0) {
+    try {
+      edenMount->saveHotTrees(FLAGS_warm_up_hot_trees);
+    } catch (const std::exception& ex) {
+      LOG(WARNING) << "error saving the hot trees of " << mountPath << ": "
+                   << folly::exceptionStr(ex);
+    }
+  }
+  if (FLAGS_journal_save_limit > 0) {
+    try {
+      edenMount->saveJournal(FLAGS_journal_save_limit);
+    } catch (const std::exception& ex) {
+      LOG(WARNING) << "error saving the journal of " << mountPath << ": "
+                   << folly::exceptionStr(ex);
+    }
+  }
   {
     std::lock_guard<std::mutex> guard(mountPointsMutex_);
     auto numErased = mountPoints_.erase(mountPath);
@@ -240,17 +1063,288 @@ shared_ptr<EdenMount> EdenServer::getMountOrNull(StringPiece mountPath) const {
 }
 
 void EdenServer::reloadConfig() {
-  *configData_.wlock() = make_shared<ConfigData>(
+  std::lock_guard<std::mutex> guard(reloadConfigMutex_);
+  auto config = make_shared<ConfigData>(
       ClientConfig::loadConfigData(etcEdenDir_.piece(), configPath_.piece()));
+  auto settings = loadRuntimeSettings(*config);
+
+  // The compression settings are the only local store options that can be
+  // changed without restarting.  They only affect newly written data.
+  if (localStore_) {
+    auto options = getLocalStoreOptions(*config);
+    localStore_->setCompression(
+        LocalStore::BlobFamily, options.blobCompression);
+    localStore_->setCompression(
+        LocalStore::TreeFamily, options.treeCompression);
+  }
+
+  *configData_.wlock() = std::move(config);
+  *runtimeSettings_.wlock() = settings;
+  applyRuntimeSettings(settings);
+}
+
+void EdenServer::applyRuntimeSettings(const RuntimeSettings& settings) {
+  if (blobCache_) {
+    blobCache_->setMaxBytes(settings.blobCacheSize);
+  }
+  if (cpuPool_) {
+    cpuPool_->setNumThreads(settings.numEdenThreads);
+  }
+  if (backingStorePool_) {
+    backingStorePool_->setNumThreads(settings.numBackingStoreThreads);
+  }
+  if (diffPool_) {
+    diffPool_->setNumThreads(settings.numDiffThreads);
+  }
+  InodeBase::setKernelCacheTtls(
+      settings.materializedCacheTtl, settings.unmaterializedCacheTtl);
+
+  vector<shared_ptr<BackingStore>> stores;
+  {
+    auto lockedStores = backingStores_.rlock();
+    for (const auto& entry : *lockedStores) {
+      stores.push_back(entry.second);
+    }
+  }
+  for (const auto& store : stores) {
+    applyRuntimeSettings(settings, store.get());
+  }
+  for (const auto& mount : getMountPoints()) {
+    applyRuntimeSettings(settings, mount.get());
+  }
+}
+
+void EdenServer::applyRuntimeSettings(
+    const RuntimeSettings& settings,
+    BackingStore* store) {
+  if (auto* cachingStore = dynamic_cast<CachingBackingStore*>(store)) {
+    store = cachingStore->getInnerStore().get();
+  }
+  if (auto* hgStore = dynamic_cast<HgBackingStore*>(store)) {
+    hgStore->setImporterLimits(
+        settings.hgNumImporters, settings.hgImporterPipelineDepth);
+  }
+}
+
+void EdenServer::applyRuntimeSettings(
+    const RuntimeSettings& settings,
+    EdenMount* edenMount) {
+  edenMount->getObjectStore()->setTreeCacheSize(settings.treeCacheSize);
+  edenMount->getMountPoint()->setNumFuseWorkers(settings.fuseNumThreads);
 }
 
 shared_ptr<EdenServer::ConfigData> EdenServer::getConfig() {
   return *configData_.rlock();
 }
 
+LocalStoreGcStats EdenServer::collectLocalStoreGarbage() {
+  auto maxSize = getLocalStoreOptions(*getConfig()).maxSize;
+  if (maxSize == 0) {
+    return LocalStoreGcStats();
+  }
+
+  std::lock_guard<std::mutex> guard(localStoreGcMutex_);
+  // Blobs loaded while we run have fresh access times, so they are at the
+  // back of the eviction order even if they are not in referencedBlobs.
+  std::unordered_set<Hash> referencedBlobs;
+  std::unordered_set<Hash> visitedTrees;
+  for (const auto& mount : getMountPoints()) {
+    getReferencedBlobs(
+        mount.get(), *localStore_, &referencedBlobs, &visitedTrees);
+  }
+  VLOG(1) << "found " << referencedBlobs.size() << " blobs referenced by "
+          << visitedTrees.size() << " trees in the mounted checkouts";
+  return localStore_->collectGarbage(maxSize, referencedBlobs);
+}
+
+void EdenServer::runPeriodicLocalStoreGc() {
+  try {
+    collectLocalStoreGarbage();
+  } catch (const std::exception& ex) {
+    LOG(ERROR) << "local store garbage collection failed: "
+               << folly::exceptionStr(ex);
+  }
+}
+
+void EdenServer::compactLocalStore() {
+  std::lock_guard<std::mutex> guard(localStoreCompactMutex_);
+  auto bulkBytes = localStore_->getHealth().bulkBytesWritten;
+  for (size_t n = 0; n < LocalStore::KeySpace::End; ++n) {
+    localStore_->compact(static_cast<LocalStore::KeySpace>(n));
+  }
+  lastCompactedBulkBytes_ = bulkBytes;
+}
+
+RequestMetrics::AgeHistogram EdenServer::getFuseAgeHistogram() const {
+  RequestMetrics::AgeHistogram total{};
+  for (const auto& mount : getMountPoints()) {
+    auto ages = mount->getDispatcher()->getRequestMetrics().getAgeHistogram();
+    for (size_t n = 0; n < total.size(); ++n) {
+      total[n] += ages[n];
+    }
+  }
+  return total;
+}
+
+bool EdenServer::isFuseLatencyHigh(
+    const RequestMetrics::AgeHistogram& since) const {
+  if (FLAGS_local_store_maintenance_max_fuse_latency_ms <= 0) {
+    return false;
+  }
+  auto delta = getFuseAgeHistogram();
+  for (size_t n = 0; n < delta.size(); ++n) {
+    // Mount points come and go, so the sums are not monotonic.
+    delta[n] = delta[n] > since[n] ? delta[n] - since[n] : 0;
+  }
+  auto p99 = RequestMetrics::getAgePercentile(delta, 0.99);
+  return p99 > std::chrono::milliseconds(
+                   FLAGS_local_store_maintenance_max_fuse_latency_ms);
+}
+
+void EdenServer::runPeriodicLocalStoreMaintenance() {
+  try {
+    auto health = std::make_shared<const LocalStoreHealth>(
+        localStore_->getHealth());
+    *localStoreHealth_.wlock() = health;
+
+    std::lock_guard<std::mutex> guard(localStoreCompactMutex_);
+    auto importedBytes = health->bulkBytesWritten - lastCompactedBulkBytes_;
+    bool afterImport =
+        importedBytes >= FLAGS_local_store_compact_after_import_bytes;
+    std::vector<LocalStore::KeySpace> keySpaces;
+    for (size_t n = 0; n < health->columns.size(); ++n) {
+      const auto& column = health->columns[n];
+      if (column.pendingCompactionBytes >=
+              FLAGS_local_store_compact_pending_bytes ||
+          (afterImport && column.numLevel0Files > 1)) {
+        keySpaces.push_back(static_cast<LocalStore::KeySpace>(n));
+      }
+    }
+
+    // RocksDB has no priority for manual compactions, so rather than
+    // competing with FUSE requests for the disk, wait for a quieter time.
+    // This is checked again after each key space, since a compaction can
+    // take a while.
+    auto ages = getFuseAgeHistogram();
+    bool busy = isFuseLatencyHigh(lastFuseAges_);
+    lastFuseAges_ = ages;
+    for (auto keySpace : keySpaces) {
+      if (busy) {
+        VLOG(1) << "deferring local store compaction while FUSE latency is "
+                << "high";
+        ++maintenanceDeferrals_;
+        return;
+      }
+      localStore_->compact(keySpace);
+      ++maintenanceCompactions_;
+      busy = isFuseLatencyHigh(lastFuseAges_);
+      lastFuseAges_ = getFuseAgeHistogram();
+    }
+    if (afterImport) {
+      lastCompactedBulkBytes_ = health->bulkBytesWritten;
+    }
+    if (!keySpaces.empty()) {
+      *localStoreHealth_.wlock() =
+          std::make_shared<const LocalStoreHealth>(localStore_->getHealth());
+    }
+  } catch (const std::exception& ex) {
+    LOG(ERROR) << "local store maintenance failed: "
+               << folly::exceptionStr(ex);
+  }
+}
+
+void EdenServer::runPeriodicLocalStoreScrub() {
+  try {
+    if (scrubPosition_->finished) {
+      auto interval =
+          std::chrono::seconds(FLAGS_local_store_scrub_pass_interval);
+      auto now = std::chrono::steady_clock::now();
+      if (now - scrubPassStart_ < interval) {
+        return;
+      }
+      *scrubPosition_ = LocalStoreScrubPosition();
+      scrubPassStart_ = now;
+    }
+
+    // Scrubbing reads the store sequentially from disk, so like compaction
+    // it waits while FUSE requests are slow.
+    auto ages = getFuseAgeHistogram();
+    bool busy = isFuseLatencyHigh(lastScrubFuseAges_);
+    lastScrubFuseAges_ = ages;
+    if (busy) {
+      ++scrubDeferrals_;
+      return;
+    }
+
+    auto stats = localStore_->scrub(
+        scrubPosition_.get(), FLAGS_local_store_scrub_bytes_per_second);
+    scrubObjectsChecked_ += stats.objectsChecked;
+    scrubBytesChecked_ += stats.bytesChecked;
+    scrubObjectsQuarantined_ += stats.objectsQuarantined;
+    if (scrubPosition_->finished) {
+      ++scrubPasses_;
+      auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::steady_clock::now() - scrubPassStart_);
+      LOG(INFO) << "finished scrubbing the local store in " << elapsed.count()
+                << "s: " << scrubObjectsQuarantined_.load()
+                << " corrupt objects removed since startup";
+    }
+  } catch (const std::exception& ex) {
+    LOG(ERROR) << "local store scrub failed: " << folly::exceptionStr(ex);
+  }
+}
+
+void EdenServer::runPeriodicInodeUnload() {
+  auto maxAge = std::chrono::seconds(FLAGS_inode_unload_age);
+  for (const auto& mount : getMountPoints()) {
+    try {
+      mount->getInodeMap()->unloadInactiveInodes(
+          maxAge, FLAGS_inode_unload_max_loaded);
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "error unloading inodes in " << mount->getPath() << ": "
+                 << folly::exceptionStr(ex);
+    }
+  }
+}
+
+void EdenServer::runPeriodicOverlayFlush() {
+  for (const auto& mount : getMountPoints()) {
+    try {
+      // This is the periodic group commit for overlays in batched mode.
+      mount->getOverlay()->flushDirs(true);
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "error flushing overlay directories in "
+                 << mount->getPath() << ": " << folly::exceptionStr(ex);
+    }
+  }
+}
+
+void EdenServer::runPeriodicDematerialize() {
+  for (const auto& mount : getMountPoints()) {
+    try {
+      mount->dematerializeUnchangedFiles();
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "error dematerializing unchanged files in "
+                 << mount->getPath() << ": " << folly::exceptionStr(ex);
+    }
+  }
+}
+
+void EdenServer::runPeriodicJournalCompaction() {
+  for (const auto& mount : getMountPoints()) {
+    try {
+      mount->compactJournal(FLAGS_journal_memory_limit);
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "error compacting the journal for " << mount->getPath()
+                 << ": " << folly::exceptionStr(ex);
+    }
+  }
+}
+
 shared_ptr<BackingStore> EdenServer::getBackingStore(
     StringPiece type,
-    StringPiece name) {
+    StringPiece name,
+    const ClientConfig& config) {
   BackingStoreKey key{type.str(), name.str()};
   SYNCHRONIZED(lockedStores, backingStores_) {
     auto it = lockedStores.find(key);
@@ -258,7 +1352,7 @@ shared_ptr<BackingStore> EdenServer::getBackingStore(
       return it->second;
     }
 
-    auto store = createBackingStore(type, name);
+    auto store = createBackingStore(type, name, config);
     lockedStores.emplace(key, store);
     return store;
   }
@@ -272,17 +1366,43 @@ shared_ptr<BackingStore> EdenServer::getBackingStore(
 
 shared_ptr<BackingStore> EdenServer::createBackingStore(
     StringPiece type,
-    StringPiece name) {
+    StringPiece name,
+    const ClientConfig& config) {
+  shared_ptr<BackingStore> store;
+  // Trees imported from mercurial refer to their entries by proxy hashes,
+  // which only this machine's LocalStore can resolve, so only git trees can
+  // be shared through the shared object cache.
+  bool cacheTrees = false;
   if (type == "null") {
     return make_shared<EmptyBackingStore>();
   } else if (type == "hg") {
-    return make_shared<HgBackingStore>(name, localStore_.get());
+    store = make_shared<HgBackingStore>(
+        name,
+        localStore_.get(),
+        config.getNumImportHelpers(),
+        backingStoreExecutor_.get());
+    // This runs with backingStores_ locked, so reloadConfig() cannot miss
+    // the new store.
+    applyRuntimeSettings(getRuntimeSettings(), store.get());
   } else if (type == "git") {
-    return make_shared<GitBackingStore>(name, localStore_.get());
+    store = make_shared<GitBackingStore>(
+        name, localStore_.get(), backingStoreExecutor_.get());
+    cacheTrees = true;
   } else {
     throw std::domain_error(
         folly::to<string>("unsupported backing store type: ", type));
   }
+
+  if (!sharedObjectCache_) {
+    return store;
+  }
+  return make_shared<CachingBackingStore>(
+      std::move(store),
+      sharedObjectCache_,
+      localStore_.get(),
+      cacheTrees,
+      std::chrono::milliseconds(FLAGS_shared_object_cache_timeout_ms),
+      FLAGS_shared_object_cache_batch_size);
 }
 
 void EdenServer::createThriftServer() {
@@ -301,11 +1421,18 @@ void EdenServer::createThriftServer() {
   server_->setAddress(address);
 }
 
-void EdenServer::acquireEdenLock() {
+void EdenServer::acquireEdenLock(bool waitForLock) {
   boost::filesystem::path edenPath{edenDir_.stringPiece().str()};
   boost::filesystem::path lockPath = edenPath / "lock";
   lockFile_ = folly::File(lockPath.string(), O_WRONLY | O_CREAT);
-  if (!lockFile_.try_lock()) {
+  auto deadline = std::chrono::steady_clock::now() + kTakeoverLockTimeout;
+  bool locked = lockFile_.try_lock();
+  while (!locked && waitForLock &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    locked = lockFile_.try_lock();
+  }
+  if (!locked) {
     throw std::runtime_error(
         "another instance of Eden appears to be running for " +
         edenDir_.stringPiece().str());
@@ -337,6 +1464,14 @@ void EdenServer::prepareThriftAddress() {
   }
 }
 
+folly::Executor* EdenServer::getMountLoadExecutor() const {
+  return mountLoadPool_.get();
+}
+
+folly::Executor* EdenServer::getDiffExecutor() const {
+  return diffPool_.get();
+}
+
 void EdenServer::stop() const {
   server_->stop();
 }
@@ -388,4 +1523,116 @@ std::string getPathToUnixDomainSocket(StringPiece edenDir) {
   return socketPath.string();
 }
 
+/*
+ * Read section.key from the eden config into *value, leaving it unchanged
+ * if the setting is not present.
+ */
+template <typename T>
+void loadConfigValue(
+    const facebook::eden::InterpolatedPropertyTree& config,
+    StringPiece section,
+    StringPiece key,
+    T* value) {
+  auto str = config.get(section, key, folly::to<string>(*value));
+  try {
+    *value = folly::to<T>(str);
+  } catch (const std::range_error& ex) {
+    throw std::runtime_error(folly::to<string>(
+        "invalid value \"", str, "\" for ", section, ".", key, ": ",
+        ex.what()));
+  }
+}
+
+/*
+ * Read the [localstore] section of the eden config.  Settings that are not
+ * present keep their default values.
+ */
+facebook::eden::LocalStoreOptions getLocalStoreOptions(
+    const facebook::eden::InterpolatedPropertyTree& config) {
+  constexpr StringPiece kSection{"localstore"};
+  facebook::eden::LocalStoreOptions options;
+  auto load = [&](StringPiece key, auto* value) {
+    loadConfigValue(config, kSection, key, value);
+  };
+
+  load("block-cache-size", &options.blockCacheSize);
+  load("blob-block-cache-size", &options.blobBlockCacheSize);
+  load("write-buffer-size", &options.writeBufferSize);
+  load("blob-write-buffer-size", &options.blobWriteBufferSize);
+  load("bloom-filter-bits-per-key", &options.bloomFilterBitsPerKey);
+  load("direct-io-for-compaction", &options.useDirectIoForCompaction);
+  load("background-threads", &options.backgroundThreads);
+  load(
+      "blob-compression-dictionary-size",
+      &options.blobCompressionDictionarySize);
+  load("max-size", &options.maxSize);
+  load("content-defined-blob-chunks", &options.contentDefinedBlobChunks);
+
+  auto loadCompression = [&](StringPiece key,
+                             facebook::eden::LocalStoreCompression* value) {
+    auto str = config.get(kSection, key, "");
+    if (str.empty()) {
+      return;
+    }
+    try {
+      *value = facebook::eden::parseLocalStoreCompression(str);
+    } catch (const std::invalid_argument& ex) {
+      throw std::runtime_error(folly::to<string>(
+          "invalid value \"", str, "\" for ", kSection, ".", key, ": ",
+          ex.what()));
+    }
+  };
+  loadCompression("blob-compression", &options.blobCompression);
+  loadCompression("tree-compression", &options.treeCompression);
+  return options;
+}
+
+/*
+ * Read the [tuning] section of the eden config.  Settings that are not
+ * present default to the corresponding command line flags.
+ */
+facebook::eden::EdenServer::RuntimeSettings loadRuntimeSettings(
+    const facebook::eden::InterpolatedPropertyTree& config) {
+  constexpr StringPiece kSection{"tuning"};
+  auto toCount = [](int32_t flag) {
+    return static_cast<size_t>(std::max(flag, 1));
+  };
+  facebook::eden::EdenServer::RuntimeSettings settings;
+  settings.blobCacheSize = FLAGS_blob_cache_size;
+  settings.treeCacheSize = FLAGS_treeCacheSize;
+  settings.numEdenThreads = toCount(FLAGS_num_eden_threads);
+  settings.numBackingStoreThreads = toCount(FLAGS_num_backing_store_threads);
+  settings.numDiffThreads = toCount(FLAGS_num_diff_threads);
+  settings.hgNumImporters = toCount(FLAGS_hgNumImporters);
+  settings.hgImporterPipelineDepth = toCount(FLAGS_hgImporterPipelineDepth);
+  settings.fuseNumThreads = toCount(FLAGS_fuseNumThreads);
+  settings.materializedCacheTtl = FLAGS_materialized_cache_ttl;
+  settings.unmaterializedCacheTtl = FLAGS_unmaterialized_cache_ttl;
+
+  auto load = [&](StringPiece key, auto* value) {
+    loadConfigValue(config, kSection, key, value);
+  };
+  load("blob-cache-size", &settings.blobCacheSize);
+  load("tree-cache-size", &settings.treeCacheSize);
+  load("eden-threads", &settings.numEdenThreads);
+  load("backing-store-threads", &settings.numBackingStoreThreads);
+  load("diff-threads", &settings.numDiffThreads);
+  load("hg-importers", &settings.hgNumImporters);
+  load("hg-importer-pipeline-depth", &settings.hgImporterPipelineDepth);
+  load("fuse-threads", &settings.fuseNumThreads);
+  load("materialized-cache-ttl", &settings.materializedCacheTtl);
+  load("unmaterialized-cache-ttl", &settings.unmaterializedCacheTtl);
+
+  // None of these work with no threads at all.
+  for (auto* count : {&settings.numEdenThreads,
+                      &settings.numBackingStoreThreads,
+                      &settings.numDiffThreads,
+                      &settings.hgNumImporters,
+                      &settings.hgImporterPipelineDepth,
+                      &settings.fuseNumThreads}) {
+    *count = std::max<size_t>(*count, 1);
+  }
+  return settings;
+}
+
 } // unnamed namespace
@@ -10,19 +10,26 @@
 #pragma once
 
 #include <folly/File.h>
+#include <folly/Optional.h>
 #include <folly/Range.h>
 #include <folly/SocketAddress.h>
 #include <folly/Synchronized.h>
 #include <folly/ThreadLocal.h>
 #include <folly/experimental/StringKeyedMap.h>
+#include <folly/futures/Promise.h>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
 #include "eden/fs/config/InterpolatedPropertyTree.h"
+#include "eden/fs/takeover/TakeoverData.h"
 #include "eden/fuse/EdenStats.h"
+#include "eden/fuse/RequestMetrics.h"
 #include "eden/utils/PathFuncs.h"
 
 namespace apache {
@@ -31,14 +38,37 @@ class ThriftServer;
 }
 }
 
+namespace folly {
+class Executor;
+class FunctionScheduler;
+}
+
+namespace wangle {
+class CPUThreadPoolExecutor;
+}
+
 namespace facebook {
 namespace eden {
+namespace fusell {
+struct FuseChannelData;
+}
 
 class BackingStore;
+class BlobCache;
+class LiveTreeTable;
+class BlobPack;
+class ClientConfig;
 class Dirstate;
 class EdenMount;
 class EdenServiceHandler;
 class LocalStore;
+class MemoryGovernor;
+class PrioritizedExecutor;
+class SharedObjectCache;
+class TakeoverServer;
+struct LocalStoreGcStats;
+struct LocalStoreHealth;
+struct LocalStoreScrubPosition;
 
 /*
  * EdenServer contains logic for running the Eden main loop.
@@ -54,6 +84,14 @@ class EdenServer {
   using MountMap = folly::StringKeyedMap<std::shared_ptr<EdenMount>>;
   using DirstateMap = folly::StringKeyedMap<std::shared_ptr<Dirstate>>;
 
+  /**
+   * The state of a client that run() is remounting at startup.
+   */
+  struct StartupMountState {
+    /** Why the remount failed, or none if it is still in progress. */
+    folly::Optional<std::string> error;
+  };
+
   EdenServer(
       AbsolutePathPiece edenDir,
       AbsolutePathPiece etcEdenDir,
@@ -90,6 +128,23 @@ class EdenServer {
    */
   void mount(std::shared_ptr<EdenMount> edenMount);
 
+  /**
+   * Create the EdenMount for a client, without mounting it.
+   */
+  std::shared_ptr<EdenMount> createEdenMount(
+      folly::StringPiece mountPoint,
+      AbsolutePathPiece clientPath);
+
+  /**
+   * Stop serving all mount points, without unmounting them, so that a new
+   * edenfs process can take them over, and then stop this server.
+   *
+   * The returned Future completes once every mount point has stopped, with
+   * the state the new process needs to resume serving them.  Mount points
+   * that fail to stop are logged and left out.
+   */
+  folly::Future<TakeoverData> startTakeoverShutdown();
+
   /**
    * Unmount an EdenMount.
    */
@@ -126,13 +181,131 @@ class EdenServer {
    */
   std::shared_ptr<EdenMount> getMountOrNull(folly::StringPiece mountPath) const;
 
+  /**
+   * Get the state of the clients that run() is remounting, or failed to
+   * remount, by mount path.
+   *
+   * run() remounts the clients from the previous run in parallel, in the
+   * background, while the thrift server starts up.  Clients are removed
+   * from this once they have been mounted, since getMountPoints() includes
+   * them from then on.
+   */
+  std::unordered_map<std::string, StartupMountState> getStartupMountStates()
+      const;
+
   std::shared_ptr<LocalStore> getLocalStore() const {
     return localStore_;
   }
 
+  /**
+   * Get the in-memory cache of file contents shared by all mount points.
+   */
+  std::shared_ptr<BlobCache> getBlobCache() const {
+    return blobCache_;
+  }
+
+  /**
+   * Get the table of Trees in use, through which all mount points share
+   * their directory contents.
+   */
+  std::shared_ptr<LiveTreeTable> getLiveTreeTable() const {
+    return liveTrees_;
+  }
+
+  /**
+   * Get the executor that runs the BackingStores' work in priority order.
+   * This is null until run() has been called.
+   */
+  PrioritizedExecutor* getBackingStoreExecutor() const {
+    return backingStoreExecutor_.get();
+  }
+
+  /**
+   * Get the memory-mapped pack of hot file contents shared by all mount
+   * points, or nullptr if it is disabled.
+   */
+  std::shared_ptr<BlobPack> getBlobPack() const {
+    return blobPack_;
+  }
+
+  /**
+   * Performance settings that can be changed without restarting.
+   *
+   * These are read from the [tuning] section of the eden config, and
+   * default to the corresponding command line flags.  reloadConfig()
+   * applies them to the running caches, thread pools, hg importers and
+   * FUSE channels, and new mount points and backing stores pick them up
+   * when they are created.
+   */
+  struct RuntimeSettings {
+    /** blob-cache-size: see --blob_cache_size */
+    uint64_t blobCacheSize{0};
+    /** tree-cache-size: see --treeCacheSize */
+    uint64_t treeCacheSize{0};
+    /** eden-threads: see --num_eden_threads */
+    size_t numEdenThreads{1};
+    /** backing-store-threads: see --num_backing_store_threads */
+    size_t numBackingStoreThreads{1};
+    /** diff-threads: see --num_diff_threads */
+    size_t numDiffThreads{1};
+    /** hg-importers: see --hgNumImporters */
+    size_t hgNumImporters{1};
+    /** hg-importer-pipeline-depth: see --hgImporterPipelineDepth */
+    size_t hgImporterPipelineDepth{1};
+    /** fuse-threads: see --fuseNumThreads */
+    size_t fuseNumThreads{1};
+    /** materialized-cache-ttl: see --materialized_cache_ttl */
+    double materializedCacheTtl{0};
+    /** unmaterialized-cache-ttl: see --unmaterialized_cache_ttl */
+    double unmaterializedCacheTtl{0};
+  };
+
+  /**
+   * Re-read the eden config, and apply any changed RuntimeSettings.
+   *
+   * Throws if the config contains invalid settings, in which case nothing
+   * is changed.
+   */
   void reloadConfig();
   std::shared_ptr<ConfigData> getConfig();
 
+  RuntimeSettings getRuntimeSettings() const {
+    return *runtimeSettings_.rlock();
+  }
+
+  /**
+   * Garbage collect the LocalStore, evicting least recently used blobs until
+   * it is under the max-size set in the [localstore] config section.
+   *
+   * Blobs referenced by any mounted snapshot or by the overlay of any mount
+   * point are never evicted.  If the referenced blobs cannot be determined,
+   * this throws without evicting anything.  This does nothing if no
+   * max-size is configured.
+   *
+   * This is also run periodically, every --local_store_gc_interval seconds.
+   */
+  LocalStoreGcStats collectLocalStoreGarbage();
+
+  /**
+   * Compact every key space of the LocalStore now, regardless of FUSE
+   * latency.  This blocks until the compaction has finished.
+   *
+   * The store is also compacted periodically, when it needs it and the
+   * mount points are not busy; see runPeriodicLocalStoreMaintenance().
+   */
+  void compactLocalStore();
+
+  /**
+   * Set a cache, shared with other machines, to look up trees and blobs in
+   * before fetching them from the backing stores.
+   *
+   * This only affects BackingStores created afterwards, so it should be
+   * called before anything is mounted.
+   */
+  void setSharedObjectCache(std::shared_ptr<SharedObjectCache> cache) {
+    sharedObjectCache_ = std::move(cache);
+  }
+
   /**
    * Look up the BackingStore object for the specified repository type+name.
    *
@@ -143,10 +316,14 @@ class EdenServer {
    * If this is the first time this given (type, name) has been used, a new
    * BackingStore object will be created and returned.  Otherwise this will
    * return the existing BackingStore that was previously created.
+   *
+   * The ClientConfig is used to tune a newly created BackingStore.  Settings
+   * from the first mount point to use a given repository take effect.
    */
   std::shared_ptr<BackingStore> getBackingStore(
       folly::StringPiece type,
-      folly::StringPiece name);
+      folly::StringPiece name,
+      const ClientConfig& config);
 
   AbsolutePathPiece getEdenDir() {
     return edenDir_;
@@ -156,6 +333,18 @@ class EdenServer {
     return &edenStats_;
   }
 
+  /**
+   * Get the executor used to load the materialized inodes of mount points
+   * as they are mounted.
+   */
+  folly::Executor* getMountLoadExecutor() const;
+
+  /**
+   * Get the executor used to diff independent subtrees of a mount point in
+   * parallel when computing its status.
+   */
+  folly::Executor* getDiffExecutor() const;
+
  private:
   using BackingStoreKey = std::pair<std::string, std::string>;
   using BackingStoreMap =
@@ -167,15 +356,75 @@ class EdenServer {
 
   std::shared_ptr<BackingStore> createBackingStore(
       folly::StringPiece type,
-      folly::StringPiece name);
+      folly::StringPiece name,
+      const ClientConfig& config);
+  void remountClients();
+  /**
+   * Resume serving the mount points handed over by the previous edenfs
+   * process, in place of remountClients().
+   */
+  void takeOverClients(TakeoverData&& data);
+  /**
+   * Start serving a mount point.  If takeoverData is non-null, the FUSE
+   * connection it holds is used instead of mounting the filesystem.
+   */
+  void startMount(
+      std::shared_ptr<EdenMount> edenMount,
+      fusell::FuseChannelData* takeoverData);
+  /**
+   * Apply settings to everything that already exists.  The caller must
+   * hold reloadConfigMutex_.
+   */
+  void applyRuntimeSettings(const RuntimeSettings& settings);
+  static void applyRuntimeSettings(
+      const RuntimeSettings& settings,
+      BackingStore* store);
+  static void applyRuntimeSettings(
+      const RuntimeSettings& settings,
+      EdenMount* edenMount);
+  TakeoverData::MountInfo getTakeoverMountInfo(EdenMount* edenMount);
+  void performBindMounts(EdenMount* edenMount);
   void runThriftServer();
   void createThriftServer();
-  void acquireEdenLock();
+  void acquireEdenLock(bool waitForLock);
   void prepareThriftAddress();
 
   // Called when a mount has been unmounted and has stopped.
   void mountFinished(EdenMount* mountPoint);
 
+  // Called periodically by gcScheduler_.
+  void runPeriodicLocalStoreGc();
+  // Called periodically by unloadScheduler_, every --inode_unload_interval
+  // seconds.
+  void runPeriodicInodeUnload();
+  // Called periodically by overlayFlushScheduler_, every
+  // --overlay_flush_interval_ms milliseconds.
+  void runPeriodicOverlayFlush();
+  // Called periodically by dematerializeScheduler_, every
+  // --dematerialize_interval seconds.
+  void runPeriodicDematerialize();
+  // Called periodically by journalCompactScheduler_, every
+  // --journal_compact_interval seconds.
+  void runPeriodicJournalCompaction();
+  // Called periodically by maintenanceScheduler_, every
+  // --local_store_maintenance_interval seconds.
+  void runPeriodicLocalStoreMaintenance();
+  // Called every second by scrubScheduler_, to check the next
+  // --local_store_scrub_bytes_per_second bytes of the LocalStore.
+  void runPeriodicLocalStoreScrub();
+  // Returns the sum of the FUSE request age histograms of all mount points.
+  RequestMetrics::AgeHistogram getFuseAgeHistogram() const;
+  // Returns true if the p99 FUSE request age since the given snapshot of
+  // getFuseAgeHistogram() is over the maintenance latency limit.
+  bool isFuseLatencyHigh(const RequestMetrics::AgeHistogram& since) const;
+  // Create memoryGovernor_, tracking the caches, and export its stats.
+  void createMemoryGovernor();
+  // Export the LocalStore's compaction state, as last seen by
+  // runPeriodicLocalStoreMaintenance().
+  void exportLocalStoreCounters();
+  // Register a dynamic counter, unregistered when run() returns.
+  void addCounter(folly::StringPiece name, std::function<int64_t()> fn);
+
   /*
    * Member variables.
    *
@@ -191,16 +440,152 @@ class EdenServer {
   AbsolutePath rocksPath_;
   folly::File lockFile_;
   folly::Synchronized<std::shared_ptr<ConfigData>> configData_;
+  /** Serializes reloadConfig() calls, so that the last one read wins. */
+  std::mutex reloadConfigMutex_;
+  folly::Synchronized<RuntimeSettings> runtimeSettings_;
   std::shared_ptr<EdenServiceHandler> handler_;
   std::shared_ptr<apache::thrift::ThriftServer> server_;
 
   std::shared_ptr<LocalStore> localStore_;
+  std::shared_ptr<BlobCache> blobCache_;
+  std::shared_ptr<LiveTreeTable> liveTrees_;
+  std::shared_ptr<BlobPack> blobPack_;
+  std::shared_ptr<SharedObjectCache> sharedObjectCache_;
   folly::Synchronized<BackingStoreMap> backingStores_;
+  /**
+   * The main CPU thread pool, which is also installed as the global
+   * wangle CPU executor.
+   */
+  std::shared_ptr<wangle::CPUThreadPoolExecutor> cpuPool_;
+  /**
+   * The thread pool used by the BackingStores.  This is declared after
+   * backingStores_ so that it is stopped before the BackingStores that its
+   * pending work refers to are destroyed.
+   */
+  std::shared_ptr<wangle::CPUThreadPoolExecutor> backingStorePool_;
+  /**
+   * Runs the BackingStores' work on backingStorePool_ in order of priority,
+   * so that fetches for one mount's prefetch or checkout do not hold up
+   * interactive requests from other mounts sharing the same BackingStore.
+   */
+  std::unique_ptr<PrioritizedExecutor> backingStoreExecutor_;
+  /**
+   * The thread pool used to remount clients at startup.
+   */
+  std::shared_ptr<wangle::CPUThreadPoolExecutor> remountPool_;
+  folly::Synchronized<std::unordered_map<std::string, StartupMountState>>
+      startupMountStates_;
+  /**
+   * The thread pool used to read overlay data while loading the
+   * materialized inodes of newly mounted mount points.
+   */
+  std::shared_ptr<wangle::CPUThreadPoolExecutor> mountLoadPool_;
+  /**
+   * The thread pool used to diff subdirectories and compare file contents
+   * in parallel for status requests.
+   */
+  std::shared_ptr<wangle::CPUThreadPoolExecutor> diffPool_;
 
   mutable std::mutex mountPointsMutex_;
   std::condition_variable mountPointsCV_;
   MountMap mountPoints_;
+  /**
+   * The mount points that startTakeoverShutdown() is waiting for, by mount
+   * path.  mountFinished() fulfills these instead of discarding the mount.
+   */
+  folly::Synchronized<
+      std::unordered_map<std::string, folly::Promise<TakeoverData::MountInfo>>>
+      takeoverPromises_;
+  /**
+   * Accepts a takeover from a new edenfs process.  It is only running while
+   * run() is.
+   */
+  std::unique_ptr<TakeoverServer> takeoverServer_;
   mutable folly::ThreadLocal<fusell::EdenStats> edenStats_;
+
+  /**
+   * Serializes LocalStore garbage collection passes.
+   */
+  std::mutex localStoreGcMutex_;
+  /**
+   * Runs the periodic LocalStore garbage collection.  It is only running
+   * while run() is.
+   */
+  std::unique_ptr<folly::FunctionScheduler> gcScheduler_;
+  /**
+   * Periodically unloads inodes that have not been used recently.  It is
+   * only running while run() is.
+   */
+  std::unique_ptr<folly::FunctionScheduler> unloadScheduler_;
+  /**
+   * Periodically writes out the directory changes pending in each mount
+   * point's overlay.  It is only running while run() is.
+   */
+  std::unique_ptr<folly::FunctionScheduler> overlayFlushScheduler_;
+  /**
+   * Periodically dematerializes files whose contents match source control
+   * again.  It is only running while run() is.
+   */
+  std::unique_ptr<folly::FunctionScheduler> dematerializeScheduler_;
+  /**
+   * Periodically compacts the journal of each mount point that has grown
+   * past --journal_memory_limit.  It is only running while run() is.
+   */
+  std::unique_ptr<folly::FunctionScheduler> journalCompactScheduler_;
+  /**
+   * Shrinks the caches when the host is short of memory.  Null if
+   * --memory_pressure_interval_ms is 0.
+   */
+  std::unique_ptr<MemoryGovernor> memoryGovernor_;
+  /**
+   * Periodically has memoryGovernor_ check the memory pressure.  It is only
+   * running while run() is.
+   */
+  std::unique_ptr<folly::FunctionScheduler> memoryPressureScheduler_;
+  /**
+   * Periodically checks the LocalStore's compaction state, and compacts it
+   * when needed.  It is only running while run() is.
+   */
+  std::unique_ptr<folly::FunctionScheduler> maintenanceScheduler_;
+  /**
+   * Serializes LocalStore compactions, and protects lastCompactedBulkBytes_,
+   * the LocalStoreHealth::bulkBytesWritten as of the last compaction.
+   */
+  std::mutex localStoreCompactMutex_;
+  uint64_t lastCompactedBulkBytes_{0};
+  /**
+   * The result of the last LocalStore::getHealth() call by
+   * runPeriodicLocalStoreMaintenance(), for the counters.
+   */
+  folly::Synchronized<std::shared_ptr<const LocalStoreHealth>>
+      localStoreHealth_;
+  std::atomic<uint64_t> maintenanceCompactions_{0};
+  std::atomic<uint64_t> maintenanceDeferrals_{0};
+  /**
+   * The FUSE request age histogram as of the last maintenance run.  Only
+   * used by maintenanceScheduler_'s thread.
+   */
+  RequestMetrics::AgeHistogram lastFuseAges_{};
+  /**
+   * Checks the LocalStore for corrupt objects, a little at a time.  It is
+   * only running while run() is.
+   */
+  std::unique_ptr<folly::FunctionScheduler> scrubScheduler_;
+  /**
+   * How far the current scrub pass has got, when it started, and the FUSE
+   * request age histogram as of the last scrub run.  Only used by
+   * scrubScheduler_'s thread.
+   */
+  std::unique_ptr<LocalStoreScrubPosition> scrubPosition_;
+  std::chrono::steady_clock::time_point scrubPassStart_;
+  RequestMetrics::AgeHistogram lastScrubFuseAges_{};
+  std::atomic<uint64_t> scrubObjectsChecked_{0};
+  std::atomic<uint64_t> scrubBytesChecked_{0};
+  std::atomic<uint64_t> scrubObjectsQuarantined_{0};
+  std::atomic<uint64_t> scrubPasses_{0};
+  std::atomic<uint64_t> scrubDeferrals_{0};
+  /** The names of the counters registered by addCounter() */
+  std::vector<std::string> counterNames_;
 };
 }
 } // facebook::eden
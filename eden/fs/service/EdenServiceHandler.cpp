@@ -11,9 +11,21 @@
 
 #include <boost/polymorphic_cast.hpp>
 #include <folly/FileUtil.h>
+#include <folly/ScopeGuard.h>
 #include <folly/String.h>
 #include <folly/Subprocess.h>
+#include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
+#include <folly/futures/SharedPromise.h>
+#include <folly/io/Cursor.h>
+#include <folly/io/async/Request.h>
+#include <gflags/gflags.h>
+#include <wangle/concurrent/GlobalExecutor.h>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <map>
+#include <unordered_map>
 #include <unordered_set>
 #include "EdenError.h"
 #include "EdenServer.h"
@@ -23,20 +35,46 @@
 #include "eden/fs/inodes/EdenDispatcher.h"
 #include "eden/fs/inodes/EdenMount.h"
 #include "eden/fs/inodes/FileInode.h"
+#include "eden/fs/inodes/InodeDiffCallback.h"
 #include "eden/fs/inodes/InodeError.h"
 #include "eden/fs/inodes/Overlay.h"
 #include "eden/fs/inodes/TreeInode.h"
+#include "eden/fs/journal/CommitChanges.h"
+#include "eden/fs/journal/Journal.h"
+#include "eden/fs/journal/JournalDelta.h"
 #include "eden/fs/model/Blob.h"
 #include "eden/fs/model/Hash.h"
+#include "eden/fs/model/NativeTree.h"
 #include "eden/fs/model/Tree.h"
 #include "eden/fs/model/TreeEntry.h"
 #include "eden/fs/service/GlobNode.h"
 #include "eden/fs/service/StreamingSubscriber.h"
 #include "eden/fs/service/ThriftUtil.h"
+#include "eden/fs/store/BlobCache.h"
 #include "eden/fs/store/BlobMetadata.h"
+#include "eden/fs/store/ImportPriority.h"
 #include "eden/fs/store/LocalStore.h"
 #include "eden/fs/store/ObjectStore.h"
+#include "eden/fs/store/PrioritizedExecutor.h"
+#include "eden/fuse/Channel.h"
 #include "eden/fuse/MountPoint.h"
+#include "eden/utils/LockProfiler.h"
+#include "eden/utils/OpenMetrics.h"
+#include "eden/utils/RequestTrace.h"
+
+DEFINE_int32(
+    status_stream_batch_size,
+    1000,
+    "the number of entries to send in each batch of a streamed status");
+DEFINE_int32(
+    glob_stream_batch_size,
+    1000,
+    "the number of paths to send in each batch of a streamed glob");
+DEFINE_int32(
+    scm_blob_stream_chunk_size,
+    1024 * 1024,
+    "the maximum number of bytes of blob contents to send in each chunk of a "
+    "streamScmBlobs() call");
 
 using std::make_unique;
 using std::string;
@@ -47,9 +85,417 @@ using folly::Future;
 using folly::makeFuture;
 using folly::StringPiece;
 
+DEFINE_int32(
+    prefetch_batch_size,
+    256,
+    "the number of blobs requested from the backing store at once by the "
+    "prefetch thrift call");
+DEFINE_int32(
+    prefetch_max_concurrency,
+    2,
+    "the maximum number of prefetch batches outstanding at once.  Keep this "
+    "below --num_backing_store_threads, so that blobs needed by regular "
+    "filesystem accesses are not stuck behind a prefetch");
+DEFINE_bool(
+    load_materialized_inodes_at_mount,
+    false,
+    "load the inodes for all materialized files and directories before "
+    "starting a mount point, rather than loading them on first access");
+DEFINE_bool(
+    replay_accesses_after_checkout,
+    false,
+    "after a checkout completes, prefetch in the background the files read "
+    "during the mount point's last access recording");
+
 namespace facebook {
 namespace eden {
 
+namespace {
+/**
+ * Add the IDs of the unmaterialized entries of a directory to blobIDs and
+ * treeIDs, descending into materialized subdirectories.  Materialized files
+ * live in the overlay, so there is nothing to fetch for them.
+ */
+void getPrefetchIDs(
+    TreeInodePtr dir,
+    vector<Hash>* blobIDs,
+    vector<Hash>* treeIDs) {
+  vector<PathComponent> materializedDirs;
+  {
+    auto contents = dir->getContents().rlock();
+    if (!contents->materialized && contents->treeHash.hasValue()) {
+      treeIDs->push_back(contents->treeHash.value());
+      return;
+    }
+    for (const auto& entry : contents->entries) {
+      if (entry.second.isMaterialized()) {
+        if (S_ISDIR(entry.second.mode)) {
+          materializedDirs.push_back(entry.first.copy());
+        }
+      } else if (S_ISDIR(entry.second.mode)) {
+        treeIDs->push_back(entry.second.getHash());
+      } else {
+        blobIDs->push_back(entry.second.getHash());
+      }
+    }
+  }
+
+  for (const auto& name : materializedDirs) {
+    getPrefetchIDs(dir->getOrLoadChildTree(name).get(), blobIDs, treeIDs);
+  }
+}
+
+/**
+ * Convert a Tree to the entries of a debugGetScmTree() result.
+ */
+vector<ScmTreeEntry> toScmTreeEntries(const Tree& tree) {
+  vector<ScmTreeEntry> entries;
+  entries.reserve(tree.getTreeEntries().size());
+  for (const auto& entry : tree.getTreeEntries()) {
+    entries.emplace_back();
+    auto& out = entries.back();
+    out.name = entry.getName().stringPiece().str();
+    out.mode = entry.getMode();
+    out.id = thriftHash(entry.getHash());
+  }
+  return entries;
+}
+
+vector<ScmTreeEntry> toScmTreeEntries(const NativeTreeView& tree) {
+  vector<ScmTreeEntry> entries;
+  entries.reserve(tree.size());
+  for (size_t n = 0; n < tree.size(); ++n) {
+    auto entry = tree.getEntryAt(n);
+    entries.emplace_back();
+    auto& out = entries.back();
+    out.name = entry.getName().stringPiece().str();
+    out.mode = entry.toTreeEntry().getMode();
+    out.id = thriftHash(entry.getHash());
+  }
+  return entries;
+}
+
+/**
+ * Copy the contents of a Blob into a thrift binary value.  The chained
+ * buffers of large blobs are appended one at a time, rather than coalesced
+ * into a temporary buffer first.
+ */
+string toScmBlobData(const Blob& blob) {
+  const auto& contents = blob.getContents();
+  string data;
+  data.reserve(contents.computeChainDataLength());
+  for (auto range : contents) {
+    data.append(reinterpret_cast<const char*>(range.data()), range.size());
+  }
+  return data;
+}
+
+/**
+ * Load a Blob for the debugGetScmBlob() family of calls.  Throws if it does
+ * not exist.
+ */
+std::unique_ptr<Blob>
+loadScmBlob(const ObjectStore* store, const Hash& id, bool localStoreOnly) {
+  auto blob = localStoreOnly ? store->getLocalStore()->getBlob(id)
+                             : store->getBlobFuture(id).get();
+  if (!blob) {
+    throw newEdenError("no blob found for id ", id.toString());
+  }
+  return blob;
+}
+
+/**
+ * An InodeDiffCallback for EdenMount::diffCommits() that passes the results
+ * to sendBatch each time batchSize of them have accumulated.
+ */
+class CommitDiffCallback : public InodeDiffCallback {
+ public:
+  using SendBatch = std::function<void(ThriftHgStatus&&)>;
+
+  CommitDiffCallback(size_t batchSize, SendBatch sendBatch)
+      : batchSize_{batchSize}, sendBatch_{std::move(sendBatch)} {}
+
+  void ignoredFile(RelativePathPiece /* path */) override {}
+  void untrackedFile(RelativePathPiece path) override {
+    addEntry(path, StatusCode::ADDED);
+  }
+  void removedFile(
+      RelativePathPiece path,
+      const TreeEntry& /* sourceControlEntry */) override {
+    addEntry(path, StatusCode::REMOVED);
+  }
+  void modifiedFile(
+      RelativePathPiece path,
+      const TreeEntry& /* sourceControlEntry */) override {
+    addEntry(path, StatusCode::MODIFIED);
+  }
+  void diffError(RelativePathPiece path, const folly::exception_wrapper& ew)
+      override {
+    LOG(WARNING) << "error diffing commits at " << path << ": "
+                 << folly::exceptionStr(ew);
+    auto error = error_.wlock();
+    if (!*error) {
+      *error = ew;
+    }
+  }
+
+  /**
+   * Send whatever is left over once the diff has completed.
+   *
+   * Returns the first error reported by the diff, if any.
+   */
+  folly::exception_wrapper finish() {
+    auto batch = batch_.wlock();
+    if (!batch->entries.empty()) {
+      sendBatch_(std::move(*batch));
+      batch->entries.clear();
+    }
+    return *error_.rlock();
+  }
+
+ private:
+  void addEntry(RelativePathPiece path, StatusCode code) {
+    // Batches are sent with the lock held, so they are never sent
+    // concurrently.
+    auto batch = batch_.wlock();
+    batch->entries.emplace(path.stringPiece().str(), code);
+    if (batch->entries.size() >= batchSize_) {
+      ThriftHgStatus full;
+      full.entries.swap(batch->entries);
+      sendBatch_(std::move(full));
+    }
+  }
+
+  size_t const batchSize_;
+  SendBatch const sendBatch_;
+  folly::Synchronized<ThriftHgStatus> batch_;
+  folly::Synchronized<folly::exception_wrapper> error_;
+};
+
+/**
+ * Looks up directories in a mount point, loading each one only once no
+ * matter how many of the requested paths are in it or below it.
+ *
+ * resolve() must not be called concurrently, but the Futures it returns
+ * may complete on any thread.
+ */
+class DirectoryResolver {
+ public:
+  explicit DirectoryResolver(TreeInodePtr root) : root_{std::move(root)} {}
+
+  Future<TreeInodePtr> resolve(RelativePathPiece dir) {
+    if (dir.empty()) {
+      return makeFuture(root_);
+    }
+    auto iter = dirs_.find(dir.copy());
+    if (iter != dirs_.end()) {
+      return iter->second->getFuture();
+    }
+
+    auto promise = std::make_shared<folly::SharedPromise<TreeInodePtr>>();
+    dirs_.emplace(dir.copy(), promise);
+    resolve(dir.dirname())
+        .then([name = dir.basename().copy()](const TreeInodePtr& parent) {
+          return parent->getOrLoadChildTree(name);
+        })
+        .then([promise](folly::Try<TreeInodePtr>&& result) {
+          promise->setTry(std::move(result));
+        });
+    return promise->getFuture();
+  }
+
+ private:
+  TreeInodePtr root_;
+  std::unordered_map<
+      RelativePath,
+      std::shared_ptr<folly::SharedPromise<TreeInodePtr>>>
+      dirs_;
+};
+
+/**
+ * The requested paths of one getFileInformation() call that are in the
+ * same directory, along with their positions in the request.
+ */
+struct FileInformationGroup {
+  vector<PathComponent> names;
+  vector<size_t> indexes;
+};
+
+Future<vector<folly::Try<fusell::Dispatcher::Attr>>> getChildAttrs(
+    TreeInodePtr dir,
+    std::shared_ptr<FileInformationGroup> group) {
+  return dir->loadChildSizes(group->names).then([dir, group] {
+    vector<Future<fusell::Dispatcher::Attr>> futures;
+    futures.reserve(group->names.size());
+    for (const auto& name : group->names) {
+      futures.push_back(dir->getOrLoadChild(name).then(
+          [](const InodePtr& inode) { return inode->getattr(); }));
+    }
+    return folly::collectAll(std::move(futures));
+  });
+}
+
+/**
+ * Gathers the SHA-1s of the regular files in a directory for
+ * getSHA1ForDirectory().
+ *
+ * Loaded and materialized files are asked for their SHA-1 directly.  Other
+ * files only have their blob IDs recorded during the walk, so that all of
+ * their metadata can be looked up with one batched request at the end.
+ * Unloaded directories that are not materialized are walked through their
+ * source control Trees, without loading any inodes.
+ */
+class DirectorySha1Collector
+    : public std::enable_shared_from_this<DirectorySha1Collector> {
+ public:
+  DirectorySha1Collector(ObjectStore* store, bool recursive)
+      : store_{store}, recursive_{recursive} {}
+
+  Future<folly::Unit> addInode(TreeInodePtr dir, RelativePath path) {
+    vector<PathComponent> loadNames;
+    vector<std::pair<PathComponent, Hash>> trees;
+    {
+      auto contents = dir->getContents().rlock();
+      auto state = state_.wlock();
+      for (const auto& entry : contents->entries) {
+        const auto& child = entry.second;
+        if (child.isDirectory()) {
+          if (!recursive_) {
+            continue;
+          }
+          if (child.inode || child.isMaterialized()) {
+            loadNames.push_back(entry.first);
+          } else {
+            trees.emplace_back(entry.first, child.getHash());
+          }
+        } else if (child.inode || child.isMaterialized()) {
+          loadNames.push_back(entry.first);
+        } else if (S_ISREG(child.getMode())) {
+          state->blobPaths.push_back(path + entry.first);
+          state->blobIds.push_back(child.getHash());
+        }
+      }
+    }
+
+    // The inodes are loaded and the Trees fetched after releasing the locks,
+    // since their Futures may complete immediately.
+    vector<Future<folly::Unit>> children;
+    for (const auto& tree : trees) {
+      children.push_back(addTree(tree.second, path + tree.first));
+    }
+    for (const auto& name : loadNames) {
+      children.push_back(dir->getOrLoadChild(name).then(
+          [ self = shared_from_this(), childPath = path + name ](
+              const InodePtr& inode) {
+            return self->addChildInode(inode, childPath);
+          }));
+    }
+    return folly::collect(children).unit();
+  }
+
+  Future<folly::Unit> addTree(const Hash& treeId, RelativePath path) {
+    return store_->getSharedTreeFuture(treeId).then([
+      self = shared_from_this(),
+      path = std::move(path)
+    ](std::shared_ptr<const Tree> tree) {
+      vector<const TreeEntry*> trees;
+      {
+        auto state = self->state_.wlock();
+        for (const auto& entry : tree->getTreeEntries()) {
+          if (entry.getType() == TreeEntryType::TREE) {
+            if (self->recursive_) {
+              trees.push_back(&entry);
+            }
+          } else if (entry.getFileType() == FileType::REGULAR_FILE) {
+            state->blobPaths.push_back(path + entry.getName());
+            state->blobIds.push_back(entry.getHash());
+          }
+        }
+      }
+
+      vector<Future<folly::Unit>> subdirs;
+      for (const auto* entry : trees) {
+        subdirs.push_back(
+            self->addTree(entry->getHash(), path + entry->getName()));
+      }
+      return folly::collect(subdirs).unit();
+    });
+  }
+
+  /**
+   * Look up the SHA-1s of all of the files found by the walk, once it is
+   * complete.
+   */
+  Future<unique_ptr<vector<FileSHA1>>> finish() {
+    State state;
+    std::swap(state, *state_.wlock());
+
+    auto results = make_unique<vector<FileSHA1>>();
+    results->reserve(state.blobPaths.size() + state.inodePaths.size());
+    vector<Future<Hash>> sha1s;
+    sha1s.reserve(state.blobPaths.size() + state.inodePaths.size());
+    auto blobMetadata = store_->getBlobMetadataBatch(state.blobIds);
+    for (size_t n = 0; n < blobMetadata.size(); ++n) {
+      results->emplace_back();
+      results->back().path = state.blobPaths[n].stringPiece().str();
+      sha1s.push_back(blobMetadata[n].then(
+          [](const BlobMetadata& metadata) { return metadata.sha1; }));
+    }
+    for (size_t n = 0; n < state.inodePaths.size(); ++n) {
+      results->emplace_back();
+      results->back().path = state.inodePaths[n].stringPiece().str();
+      sha1s.push_back(std::move(state.inodeSha1s[n]));
+    }
+
+    return folly::collectAll(sha1s).then([results = std::move(results)](
+        vector<folly::Try<Hash>>&& sha1Results) mutable {
+      for (size_t n = 0; n < sha1Results.size(); ++n) {
+        auto& sha1 = (*results)[n].sha1;
+        if (sha1Results[n].hasValue()) {
+          sha1.set_sha1(thriftHash(sha1Results[n].value()));
+        } else {
+          sha1.set_error(newEdenError(sha1Results[n].exception()));
+        }
+      }
+      std::sort(
+          results->begin(),
+          results->end(),
+          [](const FileSHA1& a, const FileSHA1& b) { return a.path < b.path; });
+      return std::move(results);
+    });
+  }
+
+ private:
+  struct State {
+    /** Files whose SHA-1 comes from the metadata of their blobs */
+    vector<RelativePath> blobPaths;
+    vector<Hash> blobIds;
+    /** Files whose SHA-1 comes from their loaded inodes */
+    vector<RelativePath> inodePaths;
+    vector<Future<Hash>> inodeSha1s;
+  };
+
+  Future<folly::Unit> addChildInode(const InodePtr& inode, RelativePath path) {
+    auto dir = inode.asTreePtrOrNull();
+    if (dir) {
+      return addInode(std::move(dir), std::move(path));
+    }
+    auto file = inode.asFilePtr();
+    if (S_ISREG(file->getMode())) {
+      auto sha1 = file->getSHA1();
+      auto state = state_.wlock();
+      state->inodePaths.push_back(std::move(path));
+      state->inodeSha1s.push_back(std::move(sha1));
+    }
+    return makeFuture();
+  }
+
+  ObjectStore* const store_;
+  const bool recursive_;
+  folly::Synchronized<State> state_;
+};
+}
+
 EdenServiceHandler::EdenServiceHandler(EdenServer* server)
     : FacebookBase2("Eden"), server_(server) {}
 
@@ -69,29 +515,24 @@ void EdenServiceHandler::mount(std::unique_ptr<MountInfo> info) {
 
 void EdenServiceHandler::mountImpl(const MountInfo& info) {
   server_->reloadConfig();
-  auto initialConfig = ClientConfig::loadFromClientDirectory(
-      AbsolutePathPiece{info.mountPoint},
-      AbsolutePathPiece{info.edenClientPath},
-      server_->getConfig().get());
-
-  auto repoType = initialConfig->getRepoType();
-  auto backingStore =
-      server_->getBackingStore(repoType, initialConfig->getRepoSource());
-  auto objectStore =
-      make_unique<ObjectStore>(server_->getLocalStore(), backingStore);
-
-  auto edenMount = EdenMount::makeShared(
-      std::move(initialConfig),
-      std::move(objectStore),
-      server_->getSocketPath(),
-      server_->getStats());
-  // We gave ownership of initialConfig to the EdenMount.
-  // Get a pointer to it that we can use for the remainder of this function.
+  auto edenMount = server_->createEdenMount(
+      info.mountPoint, AbsolutePathPiece{info.edenClientPath});
   auto* config = edenMount->getConfig();
-
-  // Load InodeBase objects for any materialized files in this mount point
-  // before we start mounting.
-  edenMount->getRootInode()->loadMaterializedChildren().wait();
+  auto repoType = config->getRepoType();
+
+  // Materialized inodes are normally loaded on demand, the same as any other
+  // inode.  Loading them all up front is only still supported as a fallback.
+  loadingMounts_.wlock()->emplace(info.mountPoint, edenMount);
+  SCOPE_EXIT {
+    loadingMounts_.wlock()->erase(info.mountPoint);
+  };
+  if (FLAGS_load_materialized_inodes_at_mount) {
+    edenMount->loadMaterializedInodes(server_->getMountLoadExecutor()).wait();
+    const auto& progress = edenMount->getMaterializedLoadProgress();
+    LOG(INFO) << "loaded " << progress.dirsLoaded.load()
+              << " directories and " << progress.filesLoaded.load()
+              << " files from the overlay for " << info.mountPoint;
+  }
 
   // TODO(mbolin): Use the result of config.getBindMounts() to perform the
   // appropriate bind mounts for the client.
@@ -170,6 +611,39 @@ void EdenServiceHandler::listMounts(std::vector<MountInfo>& results) {
   }
 }
 
+void EdenServiceHandler::getMountStatuses(
+    std::vector<MountStatus>& results) {
+  std::unordered_set<std::string> seen;
+  auto addStatus = [&](std::string mountPoint,
+                       MountState state,
+                       std::string error) {
+    if (!seen.insert(mountPoint).second) {
+      return;
+    }
+    MountStatus status;
+    status.mountPoint = std::move(mountPoint);
+    status.state = state;
+    status.error = std::move(error);
+    results.push_back(std::move(status));
+  };
+
+  for (const auto& edenMount : server_->getMountPoints()) {
+    addStatus(
+        edenMount->getPath().stringPiece().str(), MountState::RUNNING, "");
+  }
+  for (const auto& entry : *loadingMounts_.rlock()) {
+    addStatus(entry.first, MountState::STARTING, "");
+  }
+  for (auto& entry : server_->getStartupMountStates()) {
+    if (entry.second.error.hasValue()) {
+      auto& error = entry.second.error.value();
+      addStatus(entry.first, MountState::FAILED, std::move(error));
+    } else {
+      addStatus(entry.first, MountState::STARTING, "");
+    }
+  }
+}
+
 void EdenServiceHandler::getCurrentSnapshot(
     std::string& result,
     std::unique_ptr<std::string> mountPoint) {
@@ -177,16 +651,47 @@ void EdenServiceHandler::getCurrentSnapshot(
   result = thriftHash(edenMount->getSnapshotID());
 }
 
-void EdenServiceHandler::checkOutRevision(
-    std::vector<CheckoutConflict>& results,
+Future<unique_ptr<vector<CheckoutConflict>>>
+EdenServiceHandler::future_checkOutRevision(
     std::unique_ptr<std::string> mountPoint,
     std::unique_ptr<std::string> hash,
     bool force) {
   auto hashObj = hashFromThrift(*hash);
 
   auto edenMount = server_->getMount(*mountPoint);
-  auto checkoutFuture = edenMount->checkout(hashObj, force);
-  results = checkoutFuture.get();
+  return edenMount
+      ->checkout(hashObj, force, wangle::getCPUExecutor().get())
+      // Keep the EdenMount alive until the checkout is done.
+      .then([edenMount](vector<CheckoutConflict>&& conflicts) {
+        if (FLAGS_replay_accesses_after_checkout) {
+          edenMount
+              ->replayAccesses(
+                  std::max(FLAGS_prefetch_batch_size, 1),
+                  std::max(FLAGS_prefetch_max_concurrency, 1))
+              .then([edenMount](folly::Try<BlobPrefetchStats>&& result) {
+                if (result.hasException()) {
+                  LOG(WARNING) << "unable to replay accesses in "
+                               << edenMount->getPath() << " after checkout: "
+                               << result.exception().what();
+                }
+              });
+        }
+        return make_unique<vector<CheckoutConflict>>(std::move(conflicts));
+      });
+}
+
+folly::Future<std::unique_ptr<std::vector<CheckoutConflict>>>
+EdenServiceHandler::future_checkOutRevisionDryRun(
+    std::unique_ptr<std::string> mountPoint,
+    std::unique_ptr<std::string> hash) {
+  auto hashObj = hashFromThrift(*hash);
+
+  auto edenMount = server_->getMount(*mountPoint);
+  return edenMount->checkConflicts(hashObj, server_->getDiffExecutor())
+      // Keep the EdenMount alive until the check is done.
+      .then([edenMount](vector<CheckoutConflict>&& conflicts) {
+        return make_unique<vector<CheckoutConflict>>(std::move(conflicts));
+      });
 }
 
 void EdenServiceHandler::resetParentCommit(
@@ -197,8 +702,16 @@ void EdenServiceHandler::resetParentCommit(
   edenMount->resetCommit(hashObj);
 }
 
-void EdenServiceHandler::getSHA1(
-    vector<SHA1Result>& out,
+void EdenServiceHandler::snapshotWorkingCopy(
+    std::string& result,
+    std::unique_ptr<std::string> mountPoint) {
+  auto edenMount = server_->getMount(*mountPoint);
+  auto rootTreeID =
+      edenMount->storeWorkingCopySnapshot(server_->getDiffExecutor()).get();
+  result = thriftHash(rootTreeID);
+}
+
+Future<unique_ptr<vector<SHA1Result>>> EdenServiceHandler::future_getSHA1(
     unique_ptr<string> mountPoint,
     unique_ptr<vector<string>> paths) {
   vector<Future<Hash>> futures;
@@ -206,16 +719,21 @@ void EdenServiceHandler::getSHA1(
     futures.emplace_back(getSHA1ForPathDefensively(*mountPoint, path));
   }
 
-  auto results = folly::collectAll(std::move(futures)).get();
-  for (auto& result : results) {
-    out.emplace_back();
-    SHA1Result& sha1Result = out.back();
-    if (result.hasValue()) {
-      sha1Result.set_sha1(thriftHash(result.value()));
-    } else {
-      sha1Result.set_error(newEdenError(result.exception()));
-    }
-  }
+  return folly::collectAll(std::move(futures))
+      .then([](vector<folly::Try<Hash>>&& results) {
+        auto out = make_unique<vector<SHA1Result>>();
+        out->reserve(results.size());
+        for (auto& result : results) {
+          out->emplace_back();
+          SHA1Result& sha1Result = out->back();
+          if (result.hasValue()) {
+            sha1Result.set_sha1(thriftHash(result.value()));
+          } else {
+            sha1Result.set_error(newEdenError(result.exception()));
+          }
+        }
+        return out;
+      });
 }
 
 Future<Hash> EdenServiceHandler::getSHA1ForPathDefensively(
@@ -251,6 +769,22 @@ Future<Hash> EdenServiceHandler::getSHA1ForPath(
   });
 }
 
+Future<unique_ptr<vector<FileSHA1>>>
+EdenServiceHandler::future_getSHA1ForDirectory(
+    unique_ptr<string> mountPoint,
+    unique_ptr<string> directory,
+    bool recursive) {
+  auto edenMount = server_->getMount(*mountPoint);
+  auto collector = std::make_shared<DirectorySha1Collector>(
+      edenMount->getObjectStore(), recursive);
+  auto path = RelativePath{*directory};
+  return edenMount->getInode(path)
+      .then([collector, path](const InodePtr& inode) {
+        return collector->addInode(inode.asTreePtr(), path);
+      })
+      .then([collector] { return collector->finish(); });
+}
+
 void EdenServiceHandler::getBindMounts(
     std::vector<string>& out,
     std::unique_ptr<string> mountPointPtr) {
@@ -269,7 +803,7 @@ void EdenServiceHandler::getCurrentJournalPosition(
     JournalPosition& out,
     std::unique_ptr<std::string> mountPoint) {
   auto edenMount = server_->getMount(*mountPoint);
-  auto latest = edenMount->getJournal().rlock()->getLatest();
+  auto latest = edenMount->getJournal().getLatest();
 
   out.mountGeneration = edenMount->getMountGeneration();
   out.sequenceNumber = latest->toSequence;
@@ -279,12 +813,12 @@ void EdenServiceHandler::getCurrentJournalPosition(
 void EdenServiceHandler::async_tm_subscribe(
     std::unique_ptr<apache::thrift::StreamingHandlerCallback<
         std::unique_ptr<JournalPosition>>> callback,
-    std::unique_ptr<std::string> mountPoint) {
+    std::unique_ptr<std::string> mountPoint,
+    std::unique_ptr<SubscribeParams> params) {
   auto edenMount = server_->getMount(*mountPoint);
-  auto delta = edenMount->getJournal().rlock()->getLatest();
 
   auto sub = std::make_shared<StreamingSubscriber>(
-      std::move(callback), std::move(edenMount));
+      std::move(callback), std::move(edenMount), *params);
   // The subscribe call sets up a journal subscriber which captures
   // a reference to the `sub` shared_ptr.  This keeps it alive for
   // the duration of the subscription so that it doesn't get immediately
@@ -292,12 +826,11 @@ void EdenServiceHandler::async_tm_subscribe(
   sub->subscribe();
 }
 
-void EdenServiceHandler::getFilesChangedSince(
-    FileDelta& out,
+Future<unique_ptr<FileDelta>> EdenServiceHandler::future_getFilesChangedSince(
     std::unique_ptr<std::string> mountPoint,
     std::unique_ptr<JournalPosition> fromPosition) {
   auto edenMount = server_->getMount(*mountPoint);
-  auto delta = edenMount->getJournal().rlock()->getLatest();
+  auto delta = edenMount->getJournal().getLatest();
 
   if (fromPosition->mountGeneration != edenMount->getMountGeneration()) {
     throw newEdenError(
@@ -307,97 +840,560 @@ void EdenServiceHandler::getFilesChangedSince(
         "You need to compute a new basis for delta queries.");
   }
 
-  std::unordered_set<RelativePath> changedFiles;
-
-  out.toPosition.sequenceNumber = delta->toSequence;
-  out.toPosition.snapshotHash = thriftHash(delta->toHash);
-  out.toPosition.mountGeneration = edenMount->getMountGeneration();
+  auto out = make_unique<FileDelta>();
+  out->toPosition.sequenceNumber = delta->toSequence;
+  out->toPosition.snapshotHash = thriftHash(delta->toHash);
+  out->toPosition.mountGeneration = edenMount->getMountGeneration();
 
-  out.fromPosition = out.toPosition;
-
-  while (delta) {
-    if (delta->toSequence <= fromPosition->sequenceNumber) {
-      // We've reached the end of the interesting section
-      break;
-    }
+  out->fromPosition = out->toPosition;
 
-    changedFiles.insert(
-        delta->changedFilesInOverlay.begin(),
-        delta->changedFilesInOverlay.end());
-
-    out.fromPosition.sequenceNumber = delta->fromSequence;
-    out.fromPosition.snapshotHash = thriftHash(delta->fromHash);
-    out.fromPosition.mountGeneration = edenMount->getMountGeneration();
-
-    delta = delta->previous;
+  // merge() uses the journal's checkpoints to skip over most of the deltas
+  // in between, so catching up from an old position is not much more
+  // expensive than from a recent one.
+  auto merged = delta->merge(fromPosition->sequenceNumber + 1, true);
+  if (!merged) {
+    // Nothing has changed since fromPosition.
+    return makeFuture(std::move(out));
+  }
+  if (merged->isTruncatedAfter(fromPosition->sequenceNumber)) {
+    throw newEdenError(
+        ERANGE,
+        "the journal no longer records all of the changes since "
+        "fromPosition, because it has been compacted.  "
+        "You need to compute a new basis for delta queries.");
   }
 
-  for (auto& path : changedFiles) {
-    out.paths.emplace_back(path.stringPiece().str());
+  out->fromPosition.sequenceNumber = merged->fromSequence;
+  out->fromPosition.snapshotHash = thriftHash(merged->fromHash);
+
+  // Checkouts record the files they changed lazily.  Computing them the
+  // first time requires diffing the commits, but the results are shared
+  // with later queries.
+  vector<Future<std::shared_ptr<const CommitChanges::PathSet>>> futures;
+  for (const auto& changes : merged->commitChanges) {
+    futures.push_back(changes->getPaths());
   }
+  return folly::collect(futures).then(
+      [ edenMount, merged = std::move(merged), out = std::move(out) ](
+          vector<std::shared_ptr<const CommitChanges::PathSet>> &&
+          commitPaths) mutable {
+        std::unordered_set<RelativePath> paths =
+            merged->changedFilesInOverlay;
+        for (const auto& pathSet : commitPaths) {
+          paths.insert(pathSet->begin(), pathSet->end());
+        }
+        for (auto& path : paths) {
+          out->paths.emplace_back(path.stringPiece().str());
+        }
+        return std::move(out);
+      });
 }
 
-void EdenServiceHandler::getFileInformation(
-    std::vector<FileInformationOrError>& out,
+Future<unique_ptr<vector<FileInformationOrError>>>
+EdenServiceHandler::future_getFileInformation(
     std::unique_ptr<std::string> mountPoint,
     std::unique_ptr<std::vector<std::string>> paths) {
+  using Attr = fusell::Dispatcher::Attr;
   auto edenMount = server_->getMount(*mountPoint);
   auto rootInode = edenMount->getRootInode();
 
-  for (auto& path : *paths) {
-    FileInformationOrError result;
+  // Group the paths by directory, so that each directory is looked up once
+  // and the sizes of its files can be fetched with one metadata request.
+  // Sorting the directories means parents are resolved before children.
+  std::map<RelativePath, FileInformationGroup> groups;
+  vector<size_t> rootIndexes;
+  for (size_t n = 0; n < paths->size(); ++n) {
+    RelativePathPiece path{(*paths)[n]};
+    if (path.empty()) {
+      rootIndexes.push_back(n);
+      continue;
+    }
+    auto& group = groups[path.dirname().copy()];
+    group.names.push_back(path.basename().copy());
+    group.indexes.push_back(n);
+  }
 
-    try {
-      auto relativePath = RelativePathPiece{path};
-      auto inodeBase = edenMount->getInodeBlocking(relativePath);
+  // Each result is written by exactly one of the futures below.
+  auto results = std::make_shared<vector<folly::Try<Attr>>>(paths->size());
+  vector<Future<folly::Unit>> futures;
+  futures.reserve(groups.size() + rootIndexes.size());
+  DirectoryResolver resolver{rootInode};
+  for (auto& entry : groups) {
+    auto group =
+        std::make_shared<FileInformationGroup>(std::move(entry.second));
+    futures.push_back(
+        resolver.resolve(entry.first)
+            .then([group](const TreeInodePtr& dir) {
+              return getChildAttrs(dir, group);
+            })
+            .then([group, results](folly::Try<vector<folly::Try<Attr>>>&& t) {
+              for (size_t n = 0; n < group->indexes.size(); ++n) {
+                auto& result = (*results)[group->indexes[n]];
+                if (t.hasValue()) {
+                  result = std::move(t.value()[n]);
+                } else {
+                  result = folly::Try<Attr>(t.exception());
+                }
+              }
+            }));
+  }
+  for (auto index : rootIndexes) {
+    futures.push_back(rootInode->getattr().then(
+        [results, index](folly::Try<Attr>&& t) {
+          (*results)[index] = std::move(t);
+        }));
+  }
 
-      // we've reached the item of interest.
-      auto attr = inodeBase->getattr().get();
-      FileInformation info;
-      info.size = attr.st.st_size;
-      info.mtime.seconds = attr.st.st_mtim.tv_sec;
-      info.mtime.nanoSeconds = attr.st.st_mtim.tv_nsec;
-      info.mode = attr.st.st_mode;
+  // Keep the EdenMount alive until all of the lookups are done.
+  return folly::collectAll(std::move(futures))
+      .then([edenMount, results] {
+        auto out = make_unique<vector<FileInformationOrError>>();
+        out->reserve(results->size());
+        for (auto& result : *results) {
+          out->emplace_back();
+          if (result.hasValue()) {
+            const auto& attr = result.value();
+            FileInformation info;
+            info.size = attr.st.st_size;
+            info.mtime.seconds = attr.st.st_mtim.tv_sec;
+            info.mtime.nanoSeconds = attr.st.st_mtim.tv_nsec;
+            info.mode = attr.st.st_mode;
+            out->back().set_info(std::move(info));
+          } else if (result.exception()
+                         .is_compatible_with<std::system_error>()) {
+            out->back().set_error(newEdenError(result.exception()));
+          } else {
+            result.exception().throw_exception();
+          }
+        }
+        return out;
+      });
+}
+
+Future<unique_ptr<vector<string>>> EdenServiceHandler::future_glob(
+    unique_ptr<string> mountPoint,
+    unique_ptr<vector<string>> globs) {
+  // Don't let a prefetch hold up the interactive requests of any mount.
+  folly::RequestContextScopeGuard contextGuard;
+  setCurrentImportPriority(ImportPriority::PREFETCH);
 
-      result.set_info(info);
-      out.emplace_back(std::move(result));
+  auto edenMount = server_->getMount(*mountPoint);
+  auto rootInode = edenMount->getRootInode();
 
-    } catch (const std::system_error& e) {
-      result.set_error(newEdenError(e));
-      out.emplace_back(std::move(result));
-    }
+  // Compile the list of globs into a tree.  As in async_tm_streamGlob(),
+  // the glob strings have to be kept alive along with the GlobNode tree
+  // until the evaluation completes.
+  std::shared_ptr<vector<string>> sharedGlobs{std::move(globs)};
+  auto globRoot = std::make_shared<GlobNode>();
+  for (auto& globString : *sharedGlobs) {
+    globRoot->parse(globString);
   }
+
+  // and evaluate it against the root
+  auto results = std::make_shared<GlobResults>();
+  return globRoot
+      ->evaluate(
+          RelativePathPiece(),
+          rootInode,
+          results.get(),
+          server_->getDiffExecutor())
+      .then([sharedGlobs, globRoot, results] {
+        auto matches = results->extractPaths();
+        auto out = make_unique<vector<string>>();
+        out->reserve(matches.size());
+        for (auto& fileName : matches) {
+          out->emplace_back(fileName.stringPiece().toString());
+        }
+        return out;
+      });
 }
 
-void EdenServiceHandler::glob(
-    vector<string>& out,
+void EdenServiceHandler::prefetch(
+    PrefetchResult& result,
     unique_ptr<string> mountPoint,
     unique_ptr<vector<string>> globs) {
   auto edenMount = server_->getMount(*mountPoint);
   auto rootInode = edenMount->getRootInode();
 
-  // Compile the list of globs into a tree
   GlobNode globRoot;
   for (auto& globString : *globs) {
     globRoot.parse(globString);
   }
+  GlobResults results;
+  globRoot
+      .evaluate(
+          RelativePathPiece(), rootInode, &results, server_->getDiffExecutor())
+      .get();
+  auto matches = results.extractPaths();
+  result.matchedPaths = matches.size();
+
+  vector<Hash> blobIDs;
+  vector<Hash> treeIDs;
+  for (const auto& path : matches) {
+    auto parent = edenMount->getTreeInodeBlocking(path.dirname());
+    TreeInodePtr materializedDir;
+    {
+      auto contents = parent->getContents().rlock();
+      auto it = contents->entries.find(path.basename());
+      if (it == contents->entries.end()) {
+        // The path was removed since the glob was evaluated.
+        continue;
+      }
+      const auto& entry = it->second;
+      if (!entry.isMaterialized()) {
+        if (S_ISDIR(entry.mode)) {
+          treeIDs.push_back(entry.getHash());
+        } else {
+          blobIDs.push_back(entry.getHash());
+        }
+        continue;
+      }
+      if (!S_ISDIR(entry.mode)) {
+        continue;
+      }
+    }
+    getPrefetchIDs(
+        parent->getOrLoadChildTree(path.basename()).get(), &blobIDs, &treeIDs);
+  }
 
-  // and evaluate it against the root
-  auto matches = globRoot.evaluate(RelativePathPiece(), rootInode).get();
-  for (auto& fileName : matches) {
-    out.emplace_back(fileName.stringPiece().toString());
+  // Walk the matching trees a level at a time, so that the trees at each
+  // level are loaded in parallel.
+  auto objectStore = edenMount->getObjectStore();
+  std::unordered_set<Hash> visitedTrees;
+  while (!treeIDs.empty()) {
+    vector<Hash> level;
+    for (const auto& id : treeIDs) {
+      if (visitedTrees.insert(id).second) {
+        level.push_back(id);
+      }
+    }
+    treeIDs.clear();
+
+    auto trees = objectStore->getTreesBatch(level);
+    for (auto& treeFuture : trees) {
+      auto tree = treeFuture.get();
+      for (const auto& entry : tree->getTreeEntries()) {
+        if (entry.getType() == TreeEntryType::TREE) {
+          treeIDs.push_back(entry.getHash());
+        } else {
+          blobIDs.push_back(entry.getHash());
+        }
+      }
+    }
+  }
+
+  auto stats = objectStore
+                   ->prefetchBlobs(
+                       blobIDs,
+                       std::max(FLAGS_prefetch_batch_size, 1),
+                       std::max(FLAGS_prefetch_max_concurrency, 1))
+                   .get();
+  result.blobsAlreadyPresent = stats.blobsAlreadyPresent;
+  result.blobsFetched = stats.blobsFetched;
+  result.blobsFailed = stats.blobsFailed;
+  LOG(INFO) << "prefetch of " << matches.size() << " paths in "
+            << *mountPoint << " fetched " << stats.blobsFetched << " blobs ("
+            << stats.blobsAlreadyPresent << " already present, "
+            << stats.blobsFailed << " failed)";
+}
+
+void EdenServiceHandler::startRecordingAccesses(
+    std::unique_ptr<std::string> mountPoint) {
+  server_->getMount(*mountPoint)->startRecordingAccesses();
+}
+
+int64_t EdenServiceHandler::stopRecordingAccesses(
+    std::unique_ptr<std::string> mountPoint) {
+  auto edenMount = server_->getMount(*mountPoint);
+  try {
+    return edenMount->stopRecordingAccesses();
+  } catch (const std::logic_error& ex) {
+    throw newEdenError(EINVAL, ex.what());
   }
 }
 
+void EdenServiceHandler::replayAccesses(
+    PrefetchResult& result,
+    std::unique_ptr<std::string> mountPoint) {
+  auto edenMount = server_->getMount(*mountPoint);
+  auto stats = edenMount
+                   ->replayAccesses(
+                       std::max(FLAGS_prefetch_batch_size, 1),
+                       std::max(FLAGS_prefetch_max_concurrency, 1))
+                   .get();
+  result.matchedPaths =
+      stats.blobsAlreadyPresent + stats.blobsFetched + stats.blobsFailed;
+  result.blobsAlreadyPresent = stats.blobsAlreadyPresent;
+  result.blobsFetched = stats.blobsFetched;
+  result.blobsFailed = stats.blobsFailed;
+  LOG(INFO) << "replay of recorded accesses in " << *mountPoint
+            << " fetched " << stats.blobsFetched << " blobs ("
+            << stats.blobsAlreadyPresent << " already present, "
+            << stats.blobsFailed << " failed)";
+}
+
+void EdenServiceHandler::getMaterializedEntries(
+    std::vector<MaterializedEntry>& result,
+    std::unique_ptr<std::string> mountPoint) {
+  const auto& overlay = server_->getMount(*mountPoint)->getOverlay();
+  overlay->flushDirs();
+  overlay->forEachMaterializedEntry([&](RelativePathPiece path, mode_t mode) {
+    result.emplace_back();
+    result.back().path = path.stringPiece().str();
+    result.back().mode = mode;
+  });
+}
+
+void EdenServiceHandler::async_tm_streamMaterializedEntries(
+    std::unique_ptr<apache::thrift::StreamingHandlerCallback<
+        std::unique_ptr<MaterializedEntryBatch>>> callback,
+    std::unique_ptr<std::string> mountPoint) {
+  auto overlay = server_->getMount(*mountPoint)->getOverlay();
+
+  // As in async_tm_scmStreamStatus(), the overlay is read on the diff
+  // threads, but the callback may only be used in its EventBase thread.
+  std::shared_ptr<apache::thrift::StreamingHandlerCallback<
+      std::unique_ptr<MaterializedEntryBatch>>>
+      sharedCallback{std::move(callback)};
+  auto* evb = sharedCallback->getEventBase();
+  auto sendBatch = [sharedCallback, evb](MaterializedEntryBatch&& batch) {
+    evb->runInEventBaseThread(
+        [ sharedCallback, batch = std::move(batch) ]() {
+          sharedCallback->write(batch);
+        });
+  };
+
+  auto batchSize = std::max<size_t>(FLAGS_status_stream_batch_size, 1);
+  folly::via(server_->getDiffExecutor())
+      .then([overlay, batchSize, sendBatch] {
+        overlay->flushDirs();
+        MaterializedEntryBatch batch;
+        overlay->forEachMaterializedEntry(
+            [&](RelativePathPiece path, mode_t mode) {
+              batch.entries.emplace_back();
+              batch.entries.back().path = path.stringPiece().str();
+              batch.entries.back().mode = mode;
+              if (batch.entries.size() >= batchSize) {
+                MaterializedEntryBatch full;
+                full.entries.swap(batch.entries);
+                sendBatch(std::move(full));
+              }
+            });
+        if (!batch.entries.empty()) {
+          sendBatch(std::move(batch));
+        }
+      })
+      .then([sharedCallback, evb](folly::Try<folly::Unit>&& result) {
+        evb->runInEventBaseThread(
+            [ sharedCallback, result = std::move(result) ]() {
+              if (result.hasException()) {
+                sharedCallback->exception(result.exception());
+              } else {
+                sharedCallback->done();
+              }
+            });
+      });
+}
+
+Future<folly::Unit> EdenServiceHandler::future_removeRecursive(
+    unique_ptr<string> mountPoint,
+    unique_ptr<string> path) {
+  auto edenMount = server_->getMount(*mountPoint);
+  RelativePathPiece relativePath{*path};
+  if (relativePath.empty()) {
+    throw newEdenError(EINVAL, "cannot remove the root of a mount point");
+  }
+
+  auto parent = edenMount->getInodeBlocking(relativePath.dirname()).asTreePtr();
+  auto name = PathComponent{relativePath.basename()};
+  auto removeFuture = parent->removeRecursive(name);
+  return removeFuture.ensure(
+      [ edenMount, parent = std::move(parent), name = std::move(name) ] {
+        // The removal did not go through the kernel, so make it forget the
+        // entry.  Cached entries below it can no longer be reached.
+        auto channel = edenMount->getFuseChannel();
+        if (channel) {
+          channel->invalidateEntry(parent->getNodeId(), name);
+        }
+      });
+}
+
 void EdenServiceHandler::scmGetStatus(
     ThriftHgStatus& out,
     std::unique_ptr<std::string> mountPoint,
+    bool listIgnored,
+    std::unique_ptr<std::string> pathPrefix) {
+  auto dirstate = server_->getMount(*mountPoint)->getDirstate();
+  DCHECK(dirstate != nullptr) << "Failed to get dirstate for "
+                              << mountPoint.get();
+
+  out = dirstate->getStatus(
+      listIgnored,
+      server_->getDiffExecutor(),
+      RelativePathPiece{*pathPrefix});
+}
+
+void EdenServiceHandler::async_tm_scmStreamStatus(
+    std::unique_ptr<apache::thrift::StreamingHandlerCallback<
+        std::unique_ptr<ThriftHgStatus>>> callback,
+    std::unique_ptr<std::string> mountPoint,
     bool listIgnored) {
   auto dirstate = server_->getMount(*mountPoint)->getDirstate();
   DCHECK(dirstate != nullptr) << "Failed to get dirstate for "
                               << mountPoint.get();
 
-  out = dirstate->getStatus(listIgnored);
+  // The status is computed on the diff threads, but the callback may only
+  // be used in its EventBase thread, so hand each batch over to it there.
+  std::shared_ptr<apache::thrift::StreamingHandlerCallback<
+      std::unique_ptr<ThriftHgStatus>>>
+      sharedCallback{std::move(callback)};
+  auto* evb = sharedCallback->getEventBase();
+  auto sendBatch = [sharedCallback, evb](ThriftHgStatus&& batch) {
+    evb->runInEventBaseThread(
+        [ sharedCallback, batch = std::move(batch) ]() {
+          sharedCallback->write(batch);
+        });
+  };
+  dirstate
+      ->streamStatus(
+          listIgnored,
+          FLAGS_status_stream_batch_size,
+          std::move(sendBatch),
+          server_->getDiffExecutor())
+      .then([sharedCallback, evb](folly::Try<folly::Unit>&& result) {
+        evb->runInEventBaseThread(
+            [ sharedCallback, result = std::move(result) ]() {
+              if (result.hasException()) {
+                sharedCallback->exception(result.exception());
+              } else {
+                sharedCallback->done();
+              }
+            });
+      });
+}
+
+void EdenServiceHandler::async_tm_streamDiffCommits(
+    std::unique_ptr<apache::thrift::StreamingHandlerCallback<
+        std::unique_ptr<ThriftHgStatus>>> callback,
+    std::unique_ptr<std::string> mountPoint,
+    std::unique_ptr<std::string> fromCommit,
+    std::unique_ptr<std::string> toCommit) {
+  auto edenMount = server_->getMount(*mountPoint);
+
+  // As in async_tm_scmStreamStatus(), the diff runs on the diff threads, but
+  // the callback may only be used in its EventBase thread.
+  std::shared_ptr<apache::thrift::StreamingHandlerCallback<
+      std::unique_ptr<ThriftHgStatus>>>
+      sharedCallback{std::move(callback)};
+  auto* evb = sharedCallback->getEventBase();
+  auto diffCallback = std::make_shared<CommitDiffCallback>(
+      std::max<size_t>(FLAGS_status_stream_batch_size, 1),
+      [sharedCallback, evb](ThriftHgStatus&& batch) {
+        evb->runInEventBaseThread(
+            [ sharedCallback, batch = std::move(batch) ]() {
+              sharedCallback->write(batch);
+            });
+      });
+  edenMount
+      ->diffCommits(
+          hashFromThrift(*fromCommit),
+          hashFromThrift(*toCommit),
+          diffCallback.get(),
+          server_->getDiffExecutor())
+      .then([diffCallback, sharedCallback, evb](
+          folly::Try<folly::Unit>&& result) {
+        folly::exception_wrapper error;
+        if (result.hasException()) {
+          error = result.exception();
+        } else {
+          error = diffCallback->finish();
+        }
+        evb->runInEventBaseThread(
+            [ sharedCallback, error = std::move(error) ]() {
+              if (error) {
+                sharedCallback->exception(error);
+              } else {
+                sharedCallback->done();
+              }
+            });
+      });
+}
+
+void EdenServiceHandler::async_tm_streamGlob(
+    std::unique_ptr<apache::thrift::StreamingHandlerCallback<
+        std::unique_ptr<GlobResultBatch>>> callback,
+    std::unique_ptr<std::string> mountPoint,
+    std::unique_ptr<std::vector<std::string>> globs) {
+  auto edenMount = server_->getMount(*mountPoint);
+  auto rootInode = edenMount->getRootInode();
+
+  // The GlobNode tree refers to the glob strings, so they have to be kept
+  // alive along with it until the evaluation completes.
+  std::shared_ptr<vector<string>> sharedGlobs{std::move(globs)};
+  auto globRoot = std::make_shared<GlobNode>();
+  for (auto& globString : *sharedGlobs) {
+    globRoot->parse(globString);
+  }
+
+  // As in async_tm_scmStreamStatus(), the glob is evaluated on the diff
+  // threads, but the callback may only be used in its EventBase thread.
+  std::shared_ptr<apache::thrift::StreamingHandlerCallback<
+      std::unique_ptr<GlobResultBatch>>>
+      sharedCallback{std::move(callback)};
+  auto* evb = sharedCallback->getEventBase();
+  auto sendBatch = [sharedCallback, evb](GlobResultBatch&& batch) {
+    evb->runInEventBaseThread([ sharedCallback, batch = std::move(batch) ]() {
+      sharedCallback->write(batch);
+    });
+  };
+
+  // Batches are sent with the lock held, so they are never sent
+  // concurrently.
+  auto batchSize = std::max<size_t>(FLAGS_glob_stream_batch_size, 1);
+  auto batch = std::make_shared<folly::Synchronized<GlobResultBatch>>();
+  auto results = std::make_shared<GlobResults>(
+      [batch, batchSize, sendBatch](RelativePathPiece path) {
+        auto locked = batch->wlock();
+        locked->matchingFiles.push_back(path.stringPiece().str());
+        if (locked->matchingFiles.size() >= batchSize) {
+          GlobResultBatch full;
+          full.matchingFiles.swap(locked->matchingFiles);
+          sendBatch(std::move(full));
+        }
+      });
+
+  globRoot
+      ->evaluate(
+          RelativePathPiece(),
+          rootInode,
+          results.get(),
+          server_->getDiffExecutor())
+      .then([
+        // The globs, GlobNode tree and results are captured just to keep
+        // them alive until the evaluation is done.
+        sharedGlobs,
+        globRoot,
+        results,
+        batch,
+        sendBatch,
+        sharedCallback,
+        evb
+      ](folly::Try<folly::Unit>&& result) {
+        {
+          auto locked = batch->wlock();
+          if (!result.hasException() && !locked->matchingFiles.empty()) {
+            sendBatch(std::move(*locked));
+          }
+        }
+        evb->runInEventBaseThread(
+            [ sharedCallback, result = std::move(result) ]() {
+              if (result.hasException()) {
+                sharedCallback->exception(result.exception());
+              } else {
+                sharedCallback->done();
+              }
+            });
+      });
 }
 
 void EdenServiceHandler::scmAdd(
@@ -488,14 +1484,7 @@ void EdenServiceHandler::debugGetScmTree(
   if (!tree) {
     throw newEdenError("no tree found for id ", *idStr);
   }
-
-  for (const auto& entry : tree->getTreeEntries()) {
-    entries.emplace_back();
-    auto& out = entries.back();
-    out.name = entry.getName().stringPiece().str();
-    out.mode = entry.getMode();
-    out.id = thriftHash(entry.getHash());
-  }
+  entries = toScmTreeEntries(*tree);
 }
 
 void EdenServiceHandler::debugGetScmBlob(
@@ -505,21 +1494,277 @@ void EdenServiceHandler::debugGetScmBlob(
     bool localStoreOnly) {
   auto edenMount = server_->getMount(*mountPoint);
   auto id = hashFromThrift(*idStr);
+  auto blob = loadScmBlob(edenMount->getObjectStore(), id, localStoreOnly);
+  data = toScmBlobData(*blob);
+}
 
-  std::unique_ptr<Blob> blob;
+void EdenServiceHandler::debugGetScmTreesBatch(
+    vector<ScmTreeOrError>& results,
+    unique_ptr<string> mountPoint,
+    unique_ptr<vector<string>> idStrs,
+    bool localStoreOnly) {
+  auto edenMount = server_->getMount(*mountPoint);
+  vector<Hash> ids;
+  ids.reserve(idStrs->size());
+  for (const auto& idStr : *idStrs) {
+    ids.push_back(hashFromThrift(idStr));
+  }
+
+  vector<folly::Try<std::unique_ptr<Tree>>> trees;
   auto store = edenMount->getObjectStore();
   if (localStoreOnly) {
-    auto localStore = store->getLocalStore();
-    blob = localStore->getBlob(id);
+    for (auto& tree : store->getLocalStore()->getTreeBatch(ids)) {
+      trees.emplace_back(std::move(tree));
+    }
   } else {
-    blob = store->getBlobFuture(id).get();
+    trees = folly::collectAll(store->getTreesBatch(ids)).get();
   }
 
-  if (!blob) {
-    throw newEdenError("no blob found for id ", *idStr);
+  results.resize(trees.size());
+  for (size_t n = 0; n < trees.size(); ++n) {
+    if (trees[n].hasException()) {
+      results[n].set_error(newEdenError(trees[n].exception()));
+    } else if (!trees[n].value()) {
+      results[n].set_error(
+          newEdenError("no tree found for id ", ids[n].toString()));
+    } else {
+      results[n].set_entries(toScmTreeEntries(*trees[n].value()));
+    }
+  }
+}
+
+void EdenServiceHandler::debugGetScmBlobsBatch(
+    vector<ScmBlobOrError>& results,
+    unique_ptr<string> mountPoint,
+    unique_ptr<vector<string>> idStrs,
+    bool localStoreOnly) {
+  auto edenMount = server_->getMount(*mountPoint);
+  auto store = edenMount->getObjectStore();
+  // Blobs are loaded one at a time, so that at most one is held in memory
+  // besides the copies in the result.
+  results.resize(idStrs->size());
+  for (size_t n = 0; n < idStrs->size(); ++n) {
+    try {
+      auto blob = loadScmBlob(
+          store, hashFromThrift((*idStrs)[n]), localStoreOnly);
+      results[n].set_blob(toScmBlobData(*blob));
+    } catch (const std::exception& ex) {
+      results[n].set_error(newEdenError(ex));
+    }
+  }
+}
+
+void EdenServiceHandler::async_tm_streamScmTrees(
+    std::unique_ptr<apache::thrift::StreamingHandlerCallback<
+        std::unique_ptr<ScmTreeResult>>> callback,
+    std::unique_ptr<std::string> mountPoint,
+    std::unique_ptr<std::vector<std::string>> idStrs,
+    bool localStoreOnly) {
+  auto edenMount = server_->getMount(*mountPoint);
+  auto ids = std::make_shared<vector<Hash>>();
+  ids->reserve(idStrs->size());
+  for (const auto& idStr : *idStrs) {
+    ids->push_back(hashFromThrift(idStr));
   }
-  auto dataBuf = blob->getContents().cloneCoalescedAsValue();
-  data.assign(reinterpret_cast<const char*>(dataBuf.data()), dataBuf.length());
+
+  // As in async_tm_scmStreamStatus(), the trees are loaded on the diff
+  // threads, but the callback may only be used in its EventBase thread.
+  std::shared_ptr<apache::thrift::StreamingHandlerCallback<
+      std::unique_ptr<ScmTreeResult>>>
+      sharedCallback{std::move(callback)};
+  auto* evb = sharedCallback->getEventBase();
+  auto sendTree = [sharedCallback, evb](size_t index, ScmTreeOrError&& tree) {
+    ScmTreeResult result;
+    result.index = index;
+    result.tree = std::move(tree);
+    evb->runInEventBaseThread(
+        [ sharedCallback, result = std::move(result) ]() {
+          sharedCallback->write(result);
+        });
+  };
+
+  folly::via(server_->getDiffExecutor())
+      .then([edenMount, ids, localStoreOnly, sendTree] {
+        auto store = edenMount->getObjectStore();
+        auto missing = [&](size_t n) {
+          ScmTreeOrError tree;
+          tree.set_error(
+              newEdenError("no tree found for id ", (*ids)[n].toString()));
+          return tree;
+        };
+
+        if (localStoreOnly) {
+          // Views avoid decoding each Tree into TreeEntry objects, which
+          // are only converted to thrift structs again.
+          auto localStore = store->getLocalStore();
+          for (size_t n = 0; n < ids->size(); ++n) {
+            ScmTreeOrError tree;
+            try {
+              auto view = localStore->getTreeView((*ids)[n]);
+              if (view) {
+                tree.set_entries(toScmTreeEntries(*view));
+              } else {
+                tree = missing(n);
+              }
+            } catch (const std::exception& ex) {
+              tree.set_error(newEdenError(ex));
+            }
+            sendTree(n, std::move(tree));
+          }
+          return;
+        }
+
+        // Each Tree is sent as soon as it and those before it are loaded.
+        auto futures = store->getTreesBatch(*ids);
+        for (size_t n = 0; n < futures.size(); ++n) {
+          auto result = futures[n].getTry();
+          ScmTreeOrError tree;
+          if (result.hasException()) {
+            tree.set_error(newEdenError(result.exception()));
+          } else if (!result.value()) {
+            tree = missing(n);
+          } else {
+            tree.set_entries(toScmTreeEntries(*result.value()));
+          }
+          sendTree(n, std::move(tree));
+        }
+      })
+      .then([sharedCallback, evb](folly::Try<folly::Unit>&& result) {
+        evb->runInEventBaseThread(
+            [ sharedCallback, result = std::move(result) ]() {
+              if (result.hasException()) {
+                sharedCallback->exception(result.exception());
+              } else {
+                sharedCallback->done();
+              }
+            });
+      });
+}
+
+void EdenServiceHandler::async_tm_streamScmBlobs(
+    std::unique_ptr<apache::thrift::StreamingHandlerCallback<
+        std::unique_ptr<ScmBlobChunk>>> callback,
+    std::unique_ptr<std::string> mountPoint,
+    std::unique_ptr<std::vector<std::string>> idStrs,
+    bool localStoreOnly) {
+  auto edenMount = server_->getMount(*mountPoint);
+  auto ids = std::make_shared<vector<Hash>>();
+  ids->reserve(idStrs->size());
+  for (const auto& idStr : *idStrs) {
+    ids->push_back(hashFromThrift(idStr));
+  }
+
+  std::shared_ptr<apache::thrift::StreamingHandlerCallback<
+      std::unique_ptr<ScmBlobChunk>>>
+      sharedCallback{std::move(callback)};
+  auto* evb = sharedCallback->getEventBase();
+  // The chunks share the buffers of the Blob they came from, rather than
+  // copying them.  owner keeps those buffers alive until the chunk has been
+  // serialized, in case they are not reference counted.
+  auto sendChunk = [sharedCallback, evb](
+      ScmBlobChunk&& chunk, std::shared_ptr<const Blob> owner) {
+    evb->runInEventBaseThread(
+        [ sharedCallback, chunk = std::move(chunk), owner ]() {
+          sharedCallback->write(chunk);
+        });
+  };
+  auto makeChunk = [](size_t index,
+                      uint64_t offset,
+                      std::unique_ptr<folly::IOBuf> data,
+                      bool last) {
+    ScmBlobChunk chunk;
+    chunk.index = index;
+    chunk.offset = offset;
+    chunk.data = std::move(data);
+    chunk.last = last;
+    return chunk;
+  };
+
+  auto chunkSize = std::max<size_t>(FLAGS_scm_blob_stream_chunk_size, 1);
+  folly::via(server_->getDiffExecutor())
+      .then([
+        edenMount,
+        ids,
+        localStoreOnly,
+        chunkSize,
+        sendChunk,
+        makeChunk
+      ] {
+        auto store = edenMount->getObjectStore();
+        auto localStore = store->getLocalStore();
+
+        // Send the contents of a loaded Blob.
+        auto sendBlob = [&](size_t index, std::shared_ptr<const Blob> blob) {
+          const auto& contents = blob->getContents();
+          auto total = contents.computeChainDataLength();
+          folly::io::Cursor cursor(&contents);
+          uint64_t offset = 0;
+          do {
+            auto length = std::min<uint64_t>(chunkSize, total - offset);
+            std::unique_ptr<folly::IOBuf> data;
+            cursor.clone(data, length);
+            offset += length;
+            sendChunk(
+                makeChunk(
+                    index, offset - length, std::move(data), offset == total),
+                blob);
+          } while (offset < total);
+        };
+
+        // Read a blob that the LocalStore keeps in chunks one range at a
+        // time, so that it is never all in memory at once.  Returns false
+        // if the blob is not stored in chunks.
+        auto sendChunkedBlob = [&](size_t index, const Hash& id) {
+          auto data = localStore->getBlobRange(id, 0, chunkSize);
+          if (!data) {
+            return false;
+          }
+          uint64_t offset = 0;
+          while (true) {
+            auto length = data->computeChainDataLength();
+            std::unique_ptr<folly::IOBuf> next;
+            if (length == chunkSize) {
+              next = localStore->getBlobRange(id, offset + length, chunkSize);
+              if (!next) {
+                throw newEdenError(
+                    "blob ", id.toString(), " was removed while being read");
+              }
+            }
+            auto last = !next || next->empty();
+            sendChunk(
+                makeChunk(index, offset, std::move(data), last), nullptr);
+            if (last) {
+              return true;
+            }
+            offset += length;
+            data = std::move(next);
+          }
+        };
+
+        for (size_t n = 0; n < ids->size(); ++n) {
+          try {
+            if (localStoreOnly && sendChunkedBlob(n, (*ids)[n])) {
+              continue;
+            }
+            sendBlob(n, loadScmBlob(store, (*ids)[n], localStoreOnly));
+          } catch (const std::exception& ex) {
+            auto chunk = makeChunk(n, 0, folly::IOBuf::create(0), true);
+            chunk.__isset.error = true;
+            chunk.error = newEdenError(ex);
+            sendChunk(std::move(chunk), nullptr);
+          }
+        }
+      })
+      .then([sharedCallback, evb](folly::Try<folly::Unit>&& result) {
+        evb->runInEventBaseThread(
+            [ sharedCallback, result = std::move(result) ]() {
+              if (result.hasException()) {
+                sharedCallback->exception(result.exception());
+              } else {
+                sharedCallback->done();
+              }
+            });
+      });
 }
 
 void EdenServiceHandler::debugGetScmBlobMetadata(
@@ -562,6 +1807,303 @@ void EdenServiceHandler::debugInodeStatus(
   inode->getDebugStatus(inodeInfo);
 }
 
+void EdenServiceHandler::debugGetRecentSlowRequests(
+    vector<FuseRequestTrace>& requests,
+    unique_ptr<string> mountPoint,
+    int32_t count) {
+  auto edenMount = server_->getMount(*mountPoint);
+  auto slowRequests =
+      edenMount->getDispatcher()->getSlowRequestLog().getRequests();
+  std::sort(
+      slowRequests.begin(),
+      slowRequests.end(),
+      [](const fusell::SlowRequest& a, const fusell::SlowRequest& b) {
+        return a.total > b.total;
+      });
+  if (count >= 0 && slowRequests.size() > static_cast<size_t>(count)) {
+    slowRequests.resize(count);
+  }
+
+  for (const auto& slow : slowRequests) {
+    FuseRequestTrace trace;
+    trace.operation = slow.operation.str();
+    trace.startTimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            slow.startTime.time_since_epoch())
+                            .count();
+    trace.totalUs = slow.total.count();
+    trace.replyUs = slow.untilReply.count();
+    trace.inodeLoadUs = slow.phases[RequestTrace::INODE_LOAD].count();
+    trace.localStoreUs = slow.phases[RequestTrace::LOCAL_STORE].count();
+    trace.backingStoreUs = slow.phases[RequestTrace::BACKING_STORE].count();
+    requests.push_back(std::move(trace));
+  }
+}
+
+void EdenServiceHandler::debugStartRequestSampling(
+    unique_ptr<string> mountPoint,
+    int32_t durationMs,
+    int32_t sampleOneIn) {
+  if (durationMs <= 0 || sampleOneIn <= 0) {
+    throw newEdenError(EINVAL, "durationMs and sampleOneIn must be positive");
+  }
+  auto edenMount = server_->getMount(*mountPoint);
+  edenMount->getDispatcher()->getRequestSampler().start(
+      std::chrono::milliseconds(durationMs), sampleOneIn);
+}
+
+void EdenServiceHandler::debugGetRequestSamples(
+    string& result,
+    unique_ptr<string> mountPoint) {
+  auto edenMount = server_->getMount(*mountPoint);
+  result = edenMount->getDispatcher()->getRequestSampler().getFoldedStacks();
+}
+
+namespace {
+LockDurationStats toThrift(const LockProfiler::DurationSummary& summary) {
+  LockDurationStats stats;
+  stats.count = summary.count;
+  stats.totalUs = summary.totalUs;
+  stats.maxUs = summary.maxUs;
+  stats.p50Us = summary.p50Us;
+  stats.p90Us = summary.p90Us;
+  stats.p99Us = summary.p99Us;
+  return stats;
+}
+}
+
+void EdenServiceHandler::debugSetLockProfiling(bool enabled) {
+  LockProfiler::setEnabled(enabled);
+}
+
+void EdenServiceHandler::debugGetLockContention(
+    std::vector<LockContentionStats>& result,
+    int32_t maxSites) {
+  if (maxSites < 0) {
+    throw newEdenError(EINVAL, "maxSites must not be negative");
+  }
+  for (const auto& summary : LockProfiler::getSummary(maxSites)) {
+    LockContentionStats stats;
+    stats.lock = LockProfiler::getLockName(summary.lock).str();
+    stats.wait = toThrift(summary.wait);
+    stats.hold = toThrift(summary.hold);
+    stats.contended = summary.contended;
+    for (const auto& site : summary.topSites) {
+      LockSiteStats siteStats;
+      siteStats.site = site.site;
+      siteStats.contended = site.contended;
+      siteStats.totalWaitUs = site.totalWaitUs;
+      siteStats.maxWaitUs = site.maxWaitUs;
+      stats.topSites.push_back(std::move(siteStats));
+    }
+    result.push_back(std::move(stats));
+  }
+}
+
+void EdenServiceHandler::collectLocalStoreGarbage(LocalStoreGcResult& result) {
+  auto stats = server_->collectLocalStoreGarbage();
+  result.sizeBefore = stats.sizeBefore;
+  result.blobsEvicted = stats.blobsEvicted;
+  result.bytesEvicted = stats.bytesEvicted;
+}
+
+void EdenServiceHandler::debugCompactLocalStore(
+    LocalStoreCompactResult& result) {
+  auto localStore = server_->getLocalStore();
+  auto countSstFiles = [&localStore] {
+    uint64_t count = 0;
+    for (const auto& column : localStore->getHealth().columns) {
+      count += column.numSstFiles;
+    }
+    return count;
+  };
+  result.sizeBefore = localStore->getApproximateSize();
+  result.sstFilesBefore = countSstFiles();
+  server_->compactLocalStore();
+  result.sizeAfter = localStore->getApproximateSize();
+  result.sstFilesAfter = countSstFiles();
+}
+
+void EdenServiceHandler::getMountLoadProgress(
+    MountLoadProgress& result,
+    std::unique_ptr<std::string> mountPoint) {
+  std::shared_ptr<EdenMount> edenMount;
+  {
+    auto loadingMounts = loadingMounts_.rlock();
+    auto it = loadingMounts->find(*mountPoint);
+    if (it != loadingMounts->end()) {
+      edenMount = it->second;
+    }
+  }
+  if (!edenMount) {
+    edenMount = server_->getMount(*mountPoint);
+  }
+
+  const auto& progress = edenMount->getMaterializedLoadProgress();
+  result.dirsLoaded = progress.dirsLoaded.load();
+  result.filesLoaded = progress.filesLoaded.load();
+  result.finished =
+      progress.finished.load() || !FLAGS_load_materialized_inodes_at_mount;
+}
+
+void EdenServiceHandler::getLastCheckoutStats(
+    CheckoutStats& result,
+    std::unique_ptr<std::string> mountPoint) {
+  auto edenMount = server_->getMount(*mountPoint);
+  result = edenMount->getLastCheckoutStats();
+}
+
+void EdenServiceHandler::debugCompactOverlay(
+    OverlayCompactResult& result,
+    std::unique_ptr<std::string> mountPoint,
+    std::unique_ptr<std::string> edenClientPath) {
+  OverlayCompactStats stats;
+  auto edenMount = server_->getMountOrNull(*mountPoint);
+  if (edenMount) {
+    stats = edenMount->compactOverlay();
+  } else {
+    if (loadingMounts_.rlock()->count(*mountPoint) != 0) {
+      throw newEdenError(
+          EBUSY, "mount point {} is still being mounted", *mountPoint);
+    }
+    if (edenClientPath->empty()) {
+      throw newEdenError(
+          ENOENT,
+          "mount point {} is not mounted, and no client path was given",
+          *mountPoint);
+    }
+    // Opening the overlay fails if a mount point starts using it in the
+    // meantime, since its directory store can only be opened once.
+    auto config = ClientConfig::loadFromClientDirectory(
+        AbsolutePathPiece{*mountPoint},
+        AbsolutePathPiece{*edenClientPath},
+        server_->getConfig().get());
+    Overlay overlay{config->getOverlayPath(), config->getOverlayDurability()};
+    stats = overlay.compact(
+        std::numeric_limits<fuse_ino_t>::max(),
+        [](fuse_ino_t) { return false; });
+    overlay.resetInodeHighWaterMark(stats.maxInode);
+  }
+
+  result.dirsRemoved = stats.dirsRemoved;
+  result.filesRemoved = stats.filesRemoved;
+  result.bytesReclaimed = stats.bytesReclaimed;
+  result.maxInodeNumber = stats.maxInode;
+}
+
+void EdenServiceHandler::getOpenMetrics(std::string& result) {
+  std::map<std::string, int64_t> counters;
+  getCounters(counters);
+
+  std::vector<std::string> mountPoints;
+  for (const auto& edenMount : server_->getMountPoints()) {
+    mountPoints.push_back(edenMount->getPath().stringPiece().str());
+  }
+  result = renderOpenMetrics(counters, mountPoints);
+}
+
+void EdenServiceHandler::getPerformanceSummary(
+    PerformanceSummary& result,
+    std::unique_ptr<std::string> mountPoint) {
+  auto edenMount = server_->getMount(*mountPoint);
+
+  const auto& metrics = edenMount->getDispatcher()->getRequestMetrics();
+  result.fuseP50Us = metrics.getAgePercentile(50).count();
+  result.fuseP90Us = metrics.getAgePercentile(90).count();
+  result.fuseP99Us = metrics.getAgePercentile(99).count();
+  result.fuseOutstanding = metrics.getTotalOutstanding();
+  result.fuseInterrupted = metrics.getInterrupted();
+
+  // The per-operation latency histograms are thread-local, and are only
+  // aggregated when they are exported as counters.
+  std::map<std::string, int64_t> counters;
+  getCounters(counters);
+  auto getCounter = [&counters](const std::string& name) -> int64_t {
+    auto it = counters.find(name);
+    return it == counters.end() ? 0 : it->second;
+  };
+  auto prefix = folly::to<std::string>("mount.", *mountPoint, ".fuse.");
+  for (size_t n = 0; n < fusell::EdenStats::kNumOperations; ++n) {
+    auto name = folly::to<std::string>(
+        prefix, fusell::EdenStats::getOperationName(n), "_us.");
+    FuseOperationLatency latency;
+    latency.count = getCounter(name + "count");
+    if (latency.count == 0) {
+      continue;
+    }
+    latency.operation = fusell::EdenStats::getOperationName(n).str();
+    latency.p50Us = getCounter(name + "p50");
+    latency.p90Us = getCounter(name + "p90");
+    latency.p99Us = getCounter(name + "p99");
+    result.fuseOperations.push_back(std::move(latency));
+  }
+  std::sort(
+      result.fuseOperations.begin(),
+      result.fuseOperations.end(),
+      [](const FuseOperationLatency& a, const FuseOperationLatency& b) {
+        return a.p99Us > b.p99Us;
+      });
+
+  auto addCache = [&result](StringPiece name, int64_t hits, int64_t misses) {
+    CacheHitRate cache;
+    cache.cache = name.str();
+    cache.hits = hits;
+    cache.misses = misses;
+    result.caches.push_back(std::move(cache));
+  };
+  auto treeCacheStats = edenMount->getObjectStore()->getTreeCacheStats();
+  addCache("tree_cache", treeCacheStats.hits, treeCacheStats.misses);
+  auto blobCache = server_->getBlobCache();
+  if (blobCache) {
+    auto blobCacheStats = blobCache->getStats();
+    addCache("blob_cache", blobCacheStats.hits, blobCacheStats.misses);
+  }
+  for (auto keySpace : {LocalStore::TreeFamily, LocalStore::BlobFamily}) {
+    auto name = folly::to<std::string>(
+        "local_store.", LocalStore::getKeySpaceName(keySpace));
+    addCache(
+        name,
+        getCounter(name + ".hit.sum"),
+        getCounter(name + ".miss.sum"));
+  }
+
+  auto* executor = server_->getBackingStoreExecutor();
+  for (size_t n = 0; n < kNumImportPriorities; ++n) {
+    auto priority = static_cast<ImportPriority>(n);
+    result.importQueueDepth[getImportPriorityName(priority).str()] =
+        executor ? executor->getNumQueued(priority) : 0;
+  }
+
+  auto inodeMapStats = edenMount->getInodeMap()->getStats();
+  result.loadedInodes = inodeMapStats.loadedInodes;
+  result.unloadedInodes = inodeMapStats.unloadedInodes;
+
+  auto overlayUsage = edenMount->getOverlay()->getUsage();
+  result.overlayFiles = overlayUsage.files;
+  result.overlayBytes = overlayUsage.bytes;
+
+  auto& journal = edenMount->getJournal();
+  auto latest = journal.getLatest();
+  if (latest) {
+    result.journalSequence = latest->toSequence;
+    // latest keeps the whole chain alive while it is walked.
+    for (auto* delta = latest.get(); delta; delta = delta->previous.get()) {
+      ++result.journalDeltas;
+    }
+  }
+  result.journalMemoryBytes = journal.getMemoryUsage();
+
+  auto localStore = server_->getLocalStore();
+  result.localStoreBytes = localStore->getApproximateSize();
+  auto health = localStore->getHealth();
+  for (const auto& column : health.columns) {
+    result.localStoreSstFiles += column.numSstFiles;
+    result.localStoreLevel0Files += column.numLevel0Files;
+    result.localStorePendingCompactionBytes += column.pendingCompactionBytes;
+  }
+  result.localStoreRunningCompactions = health.runningCompactions;
+  result.localStoreWritesStopped = health.writesStopped;
+}
+
 void EdenServiceHandler::shutdown() {
   server_->stop();
 }
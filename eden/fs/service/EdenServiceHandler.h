@@ -9,6 +9,10 @@
  */
 #pragma once
 
+#include <folly/Synchronized.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include "common/fb303/cpp/FacebookBase2.h"
 #include "eden/fs/service/gen-cpp2/StreamingEdenService.h"
 #include "eden/utils/PathFuncs.h"
@@ -22,6 +26,7 @@ namespace facebook {
 namespace eden {
 
 class Hash;
+class EdenMount;
 class EdenServer;
 class TreeInode;
 
@@ -41,57 +46,119 @@ class EdenServiceHandler : virtual public StreamingEdenServiceSvIf,
 
   void listMounts(std::vector<MountInfo>& results) override;
 
+  void getMountStatuses(std::vector<MountStatus>& results) override;
+
   void getCurrentSnapshot(
       std::string& result,
       std::unique_ptr<std::string> mountPoint) override;
 
-  void checkOutRevision(
-      std::vector<CheckoutConflict>& results,
+  folly::Future<std::unique_ptr<std::vector<CheckoutConflict>>>
+  future_checkOutRevision(
       std::unique_ptr<std::string> mountPoint,
       std::unique_ptr<std::string> hash,
       bool force) override;
 
+  folly::Future<std::unique_ptr<std::vector<CheckoutConflict>>>
+  future_checkOutRevisionDryRun(
+      std::unique_ptr<std::string> mountPoint,
+      std::unique_ptr<std::string> hash) override;
+
   void resetParentCommit(
       std::unique_ptr<std::string> mountPoint,
       std::unique_ptr<std::string> hash) override;
 
+  void snapshotWorkingCopy(
+      std::string& result,
+      std::unique_ptr<std::string> mountPoint) override;
+
   void getBindMounts(
       std::vector<std::string>& out,
       std::unique_ptr<std::string> mountPoint) override;
 
-  void getSHA1(
-      std::vector<SHA1Result>& out,
+  folly::Future<std::unique_ptr<std::vector<SHA1Result>>> future_getSHA1(
       std::unique_ptr<std::string> mountPoint,
       std::unique_ptr<std::vector<std::string>> paths) override;
 
+  folly::Future<std::unique_ptr<std::vector<FileSHA1>>>
+  future_getSHA1ForDirectory(
+      std::unique_ptr<std::string> mountPoint,
+      std::unique_ptr<std::string> directory,
+      bool recursive) override;
+
   void getCurrentJournalPosition(
       JournalPosition& out,
       std::unique_ptr<std::string> mountPoint) override;
 
-  void getFilesChangedSince(
-      FileDelta& out,
+  folly::Future<std::unique_ptr<FileDelta>> future_getFilesChangedSince(
       std::unique_ptr<std::string> mountPoint,
       std::unique_ptr<JournalPosition> fromPosition) override;
 
-  void getFileInformation(
-      std::vector<FileInformationOrError>& out,
+  folly::Future<std::unique_ptr<std::vector<FileInformationOrError>>>
+  future_getFileInformation(
       std::unique_ptr<std::string> mountPoint,
       std::unique_ptr<std::vector<std::string>> paths) override;
 
-  void glob(
-      std::vector<std::string>& out,
+  folly::Future<std::unique_ptr<std::vector<std::string>>> future_glob(
       std::unique_ptr<std::string> mountPoint,
       std::unique_ptr<std::vector<std::string>> globs) override;
 
+  void prefetch(
+      PrefetchResult& result,
+      std::unique_ptr<std::string> mountPoint,
+      std::unique_ptr<std::vector<std::string>> globs) override;
+
+  void startRecordingAccesses(std::unique_ptr<std::string> mountPoint) override;
+
+  int64_t stopRecordingAccesses(
+      std::unique_ptr<std::string> mountPoint) override;
+
+  void replayAccesses(
+      PrefetchResult& result,
+      std::unique_ptr<std::string> mountPoint) override;
+
+  void getMaterializedEntries(
+      std::vector<MaterializedEntry>& result,
+      std::unique_ptr<std::string> mountPoint) override;
+
+  void async_tm_streamMaterializedEntries(
+      std::unique_ptr<apache::thrift::StreamingHandlerCallback<
+          std::unique_ptr<MaterializedEntryBatch>>> callback,
+      std::unique_ptr<std::string> mountPoint) override;
+
+  folly::Future<folly::Unit> future_removeRecursive(
+      std::unique_ptr<std::string> mountPoint,
+      std::unique_ptr<std::string> path) override;
+
   void async_tm_subscribe(
       std::unique_ptr<apache::thrift::StreamingHandlerCallback<
           std::unique_ptr<JournalPosition>>> callback,
-      std::unique_ptr<std::string> mountPoint) override;
+      std::unique_ptr<std::string> mountPoint,
+      std::unique_ptr<SubscribeParams> params) override;
+
+  void async_tm_scmStreamStatus(
+      std::unique_ptr<apache::thrift::StreamingHandlerCallback<
+          std::unique_ptr<ThriftHgStatus>>> callback,
+      std::unique_ptr<std::string> mountPoint,
+      bool listIgnored) override;
+
+  void async_tm_streamDiffCommits(
+      std::unique_ptr<apache::thrift::StreamingHandlerCallback<
+          std::unique_ptr<ThriftHgStatus>>> callback,
+      std::unique_ptr<std::string> mountPoint,
+      std::unique_ptr<std::string> fromCommit,
+      std::unique_ptr<std::string> toCommit) override;
+
+  void async_tm_streamGlob(
+      std::unique_ptr<apache::thrift::StreamingHandlerCallback<
+          std::unique_ptr<GlobResultBatch>>> callback,
+      std::unique_ptr<std::string> mountPoint,
+      std::unique_ptr<std::vector<std::string>> globs) override;
 
   void scmGetStatus(
       ThriftHgStatus& out,
       std::unique_ptr<std::string> mountPoint,
-      bool listIgnored) override;
+      bool listIgnored,
+      std::unique_ptr<std::string> pathPrefix) override;
 
   void scmAdd(
       std::vector<ScmAddRemoveError>& errorsToReport,
@@ -128,11 +195,80 @@ class EdenServiceHandler : virtual public StreamingEdenServiceSvIf,
       std::unique_ptr<std::string> id,
       bool localStoreOnly) override;
 
+  void debugGetScmTreesBatch(
+      std::vector<ScmTreeOrError>& results,
+      std::unique_ptr<std::string> mountPoint,
+      std::unique_ptr<std::vector<std::string>> ids,
+      bool localStoreOnly) override;
+
+  void debugGetScmBlobsBatch(
+      std::vector<ScmBlobOrError>& results,
+      std::unique_ptr<std::string> mountPoint,
+      std::unique_ptr<std::vector<std::string>> ids,
+      bool localStoreOnly) override;
+
+  void async_tm_streamScmTrees(
+      std::unique_ptr<apache::thrift::StreamingHandlerCallback<
+          std::unique_ptr<ScmTreeResult>>> callback,
+      std::unique_ptr<std::string> mountPoint,
+      std::unique_ptr<std::vector<std::string>> ids,
+      bool localStoreOnly) override;
+
+  void async_tm_streamScmBlobs(
+      std::unique_ptr<apache::thrift::StreamingHandlerCallback<
+          std::unique_ptr<ScmBlobChunk>>> callback,
+      std::unique_ptr<std::string> mountPoint,
+      std::unique_ptr<std::vector<std::string>> ids,
+      bool localStoreOnly) override;
+
   void debugInodeStatus(
       std::vector<TreeInodeDebugInfo>& inodeInfo,
       std::unique_ptr<std::string> mountPoint,
       std::unique_ptr<std::string> path) override;
 
+  void debugGetRecentSlowRequests(
+      std::vector<FuseRequestTrace>& requests,
+      std::unique_ptr<std::string> mountPoint,
+      int32_t count) override;
+
+  void debugStartRequestSampling(
+      std::unique_ptr<std::string> mountPoint,
+      int32_t durationMs,
+      int32_t sampleOneIn) override;
+
+  void debugGetRequestSamples(
+      std::string& result,
+      std::unique_ptr<std::string> mountPoint) override;
+
+  void debugSetLockProfiling(bool enabled) override;
+
+  void debugGetLockContention(
+      std::vector<LockContentionStats>& result,
+      int32_t maxSites) override;
+
+  void collectLocalStoreGarbage(LocalStoreGcResult& result) override;
+
+  void debugCompactLocalStore(LocalStoreCompactResult& result) override;
+
+  void getMountLoadProgress(
+      MountLoadProgress& result,
+      std::unique_ptr<std::string> mountPoint) override;
+
+  void getLastCheckoutStats(
+      CheckoutStats& result,
+      std::unique_ptr<std::string> mountPoint) override;
+
+  void debugCompactOverlay(
+      OverlayCompactResult& result,
+      std::unique_ptr<std::string> mountPoint,
+      std::unique_ptr<std::string> edenClientPath) override;
+
+  void getOpenMetrics(std::string& result) override;
+
+  void getPerformanceSummary(
+      PerformanceSummary& result,
+      std::unique_ptr<std::string> mountPoint) override;
+
   /**
    * When this Thrift handler is notified to shutdown, it notifies the
    * EdenServer to shut down, as well.
@@ -157,6 +293,14 @@ class EdenServiceHandler : virtual public StreamingEdenServiceSvIf,
   AbsolutePath getPathToDirstateStorage(AbsolutePathPiece mountPointPath);
 
   EdenServer* const server_;
+
+  /**
+   * Mount points whose materialized inodes are still being loaded by
+   * mountImpl(), and so are not yet known to the EdenServer.
+   */
+  folly::Synchronized<
+      std::unordered_map<std::string, std::shared_ptr<EdenMount>>>
+      loadingMounts_;
 };
 }
 } // facebook::eden
@@ -8,14 +8,28 @@
  *
  */
 #include "GlobNode.h"
+#include <folly/Optional.h>
+#include <gflags/gflags.h>
 #include "EdenError.h"
+#include "eden/fs/config/ClientConfig.h"
+#include "eden/fs/config/SparseProfile.h"
+#include "eden/fs/inodes/EdenMount.h"
 #include "eden/fs/inodes/TreeInode.h"
+#include "eden/fs/model/Tree.h"
+#include "eden/fs/store/ObjectStore.h"
+
+DEFINE_int32(
+    glob_directory_concurrency,
+    8,
+    "the maximum number of subdirectories of each directory that a glob "
+    "loads and evaluates at once");
 
 using std::string;
 using std::unique_ptr;
 using std::vector;
 using folly::Future;
 using folly::makeFuture;
+using folly::Unit;
 using std::make_unique;
 using folly::StringPiece;
 using std::unordered_set;
@@ -23,6 +37,191 @@ using std::unordered_set;
 namespace facebook {
 namespace eden {
 
+namespace {
+/**
+ * Accessors for the entries of a loaded TreeInode, used while its contents
+ * are locked.
+ *
+ * forEach() and lookup() call fn(name, isDir, treeHash) for the entries.
+ * treeHash is set for directories that can be evaluated by walking their
+ * source control Tree rather than by loading their inode.
+ */
+class InodeEntries {
+ public:
+  explicit InodeEntries(const TreeInode::EntryMap& entries)
+      : entries_(entries) {}
+
+  template <typename Fn>
+  void forEach(Fn&& fn) const {
+    for (const auto& entry : entries_) {
+      visit(entry, fn);
+    }
+  }
+
+  template <typename Fn>
+  void lookup(PathComponentPiece name, Fn&& fn) const {
+    auto it = entries_.find(name);
+    if (it != entries_.end()) {
+      visit(*it, fn);
+    }
+  }
+
+ private:
+  template <typename Entry, typename Fn>
+  static void visit(const Entry& entry, Fn& fn) {
+    bool isDir = S_ISDIR(entry.second.mode);
+    folly::Optional<Hash> treeHash;
+    // A directory that is neither materialized nor loaded is exactly the
+    // same as its source control Tree.
+    if (isDir && !entry.second.isMaterialized() && !entry.second.inode) {
+      treeHash = entry.second.getHash();
+    }
+    fn(entry.first.piece(), isDir, treeHash);
+  }
+
+  const TreeInode::EntryMap& entries_;
+};
+
+/**
+ * Accessors for the entries of a source control Tree, with the same
+ * interface as InodeEntries.  Every subdirectory has a treeHash.
+ */
+class TreeEntries {
+ public:
+  explicit TreeEntries(const Tree& tree) : tree_(tree) {}
+
+  template <typename Fn>
+  void forEach(Fn&& fn) const {
+    for (const auto& entry : tree_.getTreeEntries()) {
+      visit(entry, fn);
+    }
+  }
+
+  template <typename Fn>
+  void lookup(PathComponentPiece name, Fn&& fn) const {
+    auto entry = tree_.getEntryPtr(name);
+    if (entry) {
+      visit(*entry, fn);
+    }
+  }
+
+ private:
+  template <typename Fn>
+  static void visit(const TreeEntry& entry, Fn& fn) {
+    bool isDir = entry.getType() == TreeEntryType::TREE;
+    folly::Optional<Hash> treeHash;
+    if (isDir) {
+      treeHash = entry.getHash();
+    }
+    fn(entry.getName().piece(), isDir, treeHash);
+  }
+
+  const Tree& tree_;
+};
+
+template <typename Fn>
+void withEntries(const TreeInodePtr& dir, Fn&& fn) {
+  auto contents = dir->getContents().rlock();
+  fn(InodeEntries{contents->entries});
+}
+
+template <typename Fn>
+void withEntries(const std::shared_ptr<const Tree>& dir, Fn&& fn) {
+  fn(TreeEntries{*dir});
+}
+
+TreeInodePtr inodeOf(const TreeInodePtr& dir) {
+  return dir;
+}
+
+TreeInodePtr inodeOf(const std::shared_ptr<const Tree>& /* dir */) {
+  return TreeInodePtr{};
+}
+
+/**
+ * A subdirectory that still has to be evaluated.
+ */
+struct SubDir {
+  SubDir(RelativePath p, const folly::Optional<Hash>& hash, GlobNode* n)
+      : path{std::move(p)}, treeHash{hash}, node{n} {}
+
+  RelativePath path;
+  folly::Optional<Hash> treeHash;
+  GlobNode* node;
+};
+
+/**
+ * Load a subdirectory and call evaluateDir() with it.
+ *
+ * If the subdirectory has a treeHash this passes its source control Tree,
+ * without loading any inodes.  Otherwise it passes the TreeInode, loaded
+ * from parent.
+ *
+ * If executor is non-null, evaluateDir() is called on it, rather than in
+ * whichever thread finished loading the directory.
+ */
+template <typename Fn>
+Future<Unit> loadSubDir(
+    ObjectStore* store,
+    const TreeInodePtr& parent,
+    const SubDir& subDir,
+    folly::Executor* executor,
+    Fn evaluateDir) {
+  if (subDir.treeHash.hasValue()) {
+    auto future = store->getSharedTreeFuture(subDir.treeHash.value());
+    if (executor) {
+      future = std::move(future).via(executor);
+    }
+    return future.then([evaluateDir](std::shared_ptr<const Tree> tree) {
+      return evaluateDir(std::move(tree));
+    });
+  }
+
+  DCHECK(parent);
+  auto future = parent->getOrLoadChildTree(subDir.path.basename());
+  if (executor) {
+    future = std::move(future).via(executor);
+  }
+  return future.then(
+      [evaluateDir](TreeInodePtr dir) { return evaluateDir(std::move(dir)); });
+}
+
+Future<Unit> collectUnits(vector<Future<Unit>>& futures) {
+  return folly::collect(futures).then([](const vector<Unit>&) {});
+}
+}
+
+GlobResults::GlobResults(MatchCallback onMatch)
+    : onMatch_{std::move(onMatch)} {}
+
+void GlobResults::add(RelativePath path) {
+  {
+    auto paths = paths_.wlock();
+    auto ret = paths->insert(path);
+    if (!ret.second) {
+      return;
+    }
+  }
+  if (onMatch_) {
+    onMatch_(path);
+  }
+}
+
+void GlobResults::setSparseProfile(
+    std::shared_ptr<const SparseProfile> profile) {
+  sparseProfile_ = std::move(profile);
+}
+
+bool GlobResults::isExcluded(RelativePathPiece path) const {
+  return sparseProfile_ && sparseProfile_->isExcluded(path);
+}
+
+unordered_set<RelativePath> GlobResults::extractPaths() {
+  unordered_set<RelativePath> result;
+  paths_.wlock()->swap(result);
+  return result;
+}
+
 GlobNode::GlobNode(StringPiece pattern, bool hasSpecials)
     : pattern_(pattern), hasSpecials_(hasSpecials) {
   if (pattern_ == "**" || pattern_ == "*") {
@@ -79,79 +278,97 @@ void GlobNode::parse(StringPiece pattern) {
   }
 }
 
-Future<unordered_set<RelativePath>> GlobNode::evaluate(
+Future<Unit> GlobNode::evaluate(
     RelativePathPiece rootPath,
-    TreeInodePtr root) {
-  unordered_set<RelativePath> results =
-      evaluateRecursiveComponent(rootPath, root).get();
-  vector<std::pair<PathComponent, GlobNode*>> recurse;
+    TreeInodePtr root,
+    GlobResults* results,
+    folly::Executor* executor) {
+  auto store = root->getStore();
+  results->setSparseProfile(root->getMount()->getConfig()->getSparseProfile());
+  return evaluateImpl(store, rootPath, std::move(root), results, executor);
+}
 
-  {
-    auto contents = root->getContents().rlock();
+Future<Unit> GlobNode::evaluate(
+    ObjectStore* store,
+    RelativePathPiece rootPath,
+    std::shared_ptr<const Tree> root,
+    GlobResults* results,
+    folly::Executor* executor) {
+  return evaluateImpl(store, rootPath, std::move(root), results, executor);
+}
+
+template <typename Dir>
+Future<Unit> GlobNode::evaluateImpl(
+    ObjectStore* store,
+    RelativePathPiece rootPath,
+    Dir root,
+    GlobResults* results,
+    folly::Executor* executor) {
+  vector<Future<Unit>> futures;
+  futures.push_back(
+      evaluateRecursiveComponentImpl(store, rootPath, root, results, executor));
+  vector<SubDir> recurse;
+
+  withEntries(root, [&](const auto& entries) {
     for (auto& node : children_) {
+      auto onMatch = [&](PathComponentPiece name,
+                         bool isDir,
+                         const folly::Optional<Hash>& treeHash) {
+        auto path = rootPath + name;
+        if (results->isExcluded(path)) {
+          return;
+        }
+        if (node->isLeaf_) {
+          results->add(std::move(path));
+          return;
+        }
+        // Not the leaf of a pattern; if this is a dir, we need to recurse
+        if (isDir) {
+          recurse.emplace_back(std::move(path), treeHash, node.get());
+        }
+      };
+
       if (!node->hasSpecials_) {
         // We can try a lookup for the exact name
-        auto it = contents->entries.find(PathComponentPiece(node->pattern_));
-        if (it != contents->entries.end()) {
-          // Matched!
-          if (node->isLeaf_) {
-            results.emplace((rootPath + it->first));
-            continue;
-          }
-
-          // Not the leaf of a pattern; if this is a dir, we need to recurse
-          if (S_ISDIR(it->second->mode)) {
-            recurse.emplace_back(std::make_pair(it->first, node.get()));
-          }
-        }
+        entries.lookup(PathComponentPiece(node->pattern_), onMatch);
       } else {
-        // We need to match it out of the entries in this inode
-        for (auto& entry : contents->entries) {
-          if (node->alwaysMatch_ ||
-              node->matcher_.match(entry.first.stringPiece())) {
-            if (node->isLeaf_) {
-              results.emplace((rootPath + entry.first));
-              continue;
-            }
-            // Not the leaf of a pattern; if this is a dir, we need to
-            // recurse
-            if (S_ISDIR(entry.second->mode)) {
-              recurse.emplace_back(std::make_pair(entry.first, node.get()));
-            }
+        // We need to match it out of the entries in this directory
+        entries.forEach([&](PathComponentPiece name,
+                            bool isDir,
+                            const folly::Optional<Hash>& treeHash) {
+          if (node->alwaysMatch_ || node->matcher_.match(name.stringPiece())) {
+            onMatch(name, isDir, treeHash);
           }
-        }
+        });
       }
     }
-  }
-
-  // Recursively load child inodes and evaluate matches with a concurrency
-  // constraint.
-  // For now we only evaluate 1 child dir at a time.
-  // We could go larger but need to be careful about how this expands
-  // with the depth of the tree.
-  const constexpr size_t kConcurrency = 1;
+  });
 
-  auto childInodes = folly::window(
+  // Recursively load child directories and evaluate matches with a
+  // concurrency constraint.  This only limits the number of children of this
+  // directory that are in progress at once; the executor bounds the total
+  // amount of work running in parallel.
+  auto childFutures = folly::window(
       std::move(recurse),
-      [ rootPath = rootPath.copy(), root, this ](
-          const std::pair<PathComponent, GlobNode*>& item) {
-        auto candidateName = rootPath + item.first;
-        return root->getOrLoadChildTree(item.first).then([
-          candidateName,
-          node = item.second
-        ](TreeInodePtr dir) { return node->evaluate(candidateName, dir); });
+      [ store, parent = inodeOf(root), results, executor ](
+          const SubDir& subDir) {
+        return loadSubDir(
+            store,
+            parent,
+            subDir,
+            executor,
+            [ store, subDir, results, executor ](auto dir) {
+              return subDir.node->evaluateImpl(
+                  store, subDir.path, std::move(dir), results, executor);
+            });
       },
-      kConcurrency);
+      FLAGS_glob_directory_concurrency);
+  for (auto& future : childFutures) {
+    futures.push_back(std::move(future));
+  }
 
-  // Merge the results to yield a de-duplicated set of matches
-  return folly::unorderedReduce(
-      std::move(childInodes),
-      std::move(results),
-      [](unordered_set<RelativePath> result,
-         const unordered_set<RelativePath>& matches) {
-        result.insert(matches.begin(), matches.end());
-        return result;
-      });
+  // Every match has already been added to results.
+  return collectUnits(futures);
 }
 
 StringPiece GlobNode::tokenize(StringPiece& pattern, bool* hasSpecials) {
@@ -192,24 +409,31 @@ GlobNode* GlobNode::lookupToken(
   return nullptr;
 }
 
-Future<unordered_set<RelativePath>> GlobNode::evaluateRecursiveComponent(
+template <typename Dir>
+Future<Unit> GlobNode::evaluateRecursiveComponentImpl(
+    ObjectStore* store,
     RelativePathPiece rootPath,
-    TreeInodePtr root) {
-  unordered_set<RelativePath> results;
+    const Dir& root,
+    GlobResults* results,
+    folly::Executor* executor) {
   if (recursiveChildren_.empty()) {
-    return results;
+    return makeFuture();
   }
 
-  vector<RelativePath> subDirNames;
-  {
-    auto contents = root->getContents().rlock();
-    for (auto& entry : contents->entries) {
-      auto candidateName = rootPath + entry.first;
+  vector<SubDir> subDirs;
+  withEntries(root, [&](const auto& entries) {
+    entries.forEach([&](PathComponentPiece name,
+                        bool isDir,
+                        const folly::Optional<Hash>& treeHash) {
+      auto candidateName = rootPath + name;
+      if (results->isExcluded(candidateName)) {
+        return;
+      }
 
       for (auto& node : recursiveChildren_) {
         if (node->alwaysMatch_ ||
             node->matcher_.match(candidateName.stringPiece())) {
-          results.emplace(candidateName);
+          results->add(candidateName);
           // No sense running multiple matches for this same file.
           break;
         }
@@ -217,39 +441,31 @@ Future<unordered_set<RelativePath>> GlobNode::evaluateRecursiveComponent(
 
       // Remember to recurse through child dirs after we've released
       // the lock on the contents.
-      if (S_ISDIR(entry.second->mode)) {
-        subDirNames.emplace_back(candidateName);
+      if (isDir) {
+        subDirs.emplace_back(std::move(candidateName), treeHash, this);
       }
-    }
-  }
+    });
+  });
 
-  // Recursively load child inodes and evaluate matches with a concurrency
-  // constraint.
-  // For now we only evaluate 1 child dir at a time.
-  // We could go larger but need to be careful about how this expands
-  // with the depth of the tree.
-  const constexpr size_t kConcurrency = 1;
-
-  auto childInodes = folly::window(
-      std::move(subDirNames),
-      [ rootPath = rootPath.copy(), root, this ](
-          const RelativePath& candidateName) {
-        return root->getOrLoadChildTree(candidateName.basename())
-            .then([candidateName, this](TreeInodePtr dir) {
-              return evaluateRecursiveComponent(candidateName, dir);
+  // Recursively load child directories and evaluate matches with a
+  // concurrency constraint, as in evaluateImpl().
+  auto childFutures = folly::window(
+      std::move(subDirs),
+      [ store, parent = inodeOf(root), results, executor, this ](
+          const SubDir& subDir) {
+        return loadSubDir(
+            store,
+            parent,
+            subDir,
+            executor,
+            [ store, path = subDir.path, results, executor, this ](auto dir) {
+              return evaluateRecursiveComponentImpl(
+                  store, path, dir, results, executor);
             });
       },
-      kConcurrency);
-
-  // Merge the results to yield a de-duplicated set of matches
-  return folly::unorderedReduce(
-      childInodes,
-      results,
-      [](unordered_set<RelativePath> result,
-         const unordered_set<RelativePath>& matches) {
-        result.insert(matches.begin(), matches.end());
-        return result;
-      });
+      FLAGS_glob_directory_concurrency);
+
+  return collectUnits(childFutures);
 }
 }
 }
@@ -8,14 +8,73 @@
  *
  */
 #pragma once
+#include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
+#include <functional>
+#include <memory>
+#include <unordered_set>
 #include "eden/fs/inodes/InodePtrFwd.h"
 #include "eden/fs/model/git/GlobMatcher.h"
 #include "eden/utils/PathFuncs.h"
 
+namespace folly {
+class Executor;
+}
+
 namespace facebook {
 namespace eden {
 
+class ObjectStore;
+class SparseProfile;
+class Tree;
+
+/**
+ * Collects the paths matched by GlobNode::evaluate().
+ *
+ * Sibling directories are evaluated concurrently, so all of them add their
+ * matches here, from whichever threads they run on.  Each path is only
+ * recorded once, even if it matches several globs.
+ */
+class GlobResults {
+ public:
+  using MatchCallback = std::function<void(RelativePathPiece path)>;
+
+  GlobResults() = default;
+
+  /**
+   * Also call onMatch with each new match as soon as it is found, so the
+   * results can be passed on while the rest of the glob is still being
+   * evaluated.  onMatch may be called concurrently from several threads.
+   */
+  explicit GlobResults(MatchCallback onMatch);
+
+  void add(RelativePath path);
+
+  /**
+   * Skip the paths that profile excludes, along with everything under them.
+   *
+   * GlobNode::evaluate() sets this to the mount point's sparse profile when
+   * it is evaluated against the mount point's inodes.
+   */
+  void setSparseProfile(std::shared_ptr<const SparseProfile> profile);
+
+  /**
+   * Returns true if path is hidden by the sparse profile, and should be
+   * neither matched nor descended into.
+   */
+  bool isExcluded(RelativePathPiece path) const;
+
+  /**
+   * Take all of the paths matched so far.
+   */
+  std::unordered_set<RelativePath> extractPaths();
+
+ private:
+  MatchCallback const onMatch_;
+  std::shared_ptr<const SparseProfile> sparseProfile_;
+  folly::Synchronized<std::unordered_set<RelativePath>> paths_;
+};
+
 /** Represents the compiled state of a tree-walking glob operation.
  * We split the glob into path components and build a tree of name
  * matching operations.
@@ -39,12 +98,28 @@ class GlobNode {
   void parse(folly::StringPiece pattern);
   // This is a recursive function to evaluate the compiled glob against
   // the provided input path and inode.
-  // It returns the set of matching file names.
+  // The matching file names are added to results as they are found.
+  // Subdirectories are loaded and evaluated concurrently, a limited number
+  // per directory at a time.  If executor is non-null they are evaluated
+  // on it, which bounds how many run in parallel.
+  // Subdirectories that are neither materialized nor loaded are evaluated
+  // by walking their source control Trees, so globbing large unmodified
+  // parts of the repository does not load inodes for them.
   // Note: the caller is responsible for ensuring that this
-  // GlobNode exists until the returned Future is resolved.
-  folly::Future<std::unordered_set<RelativePath>> evaluate(
+  // GlobNode and results exist until the returned Future is resolved.
+  folly::Future<folly::Unit> evaluate(
       RelativePathPiece rootPath,
-      TreeInodePtr root);
+      TreeInodePtr root,
+      GlobResults* results,
+      folly::Executor* executor = nullptr);
+  // Evaluate the compiled glob against a source control Tree, fetching
+  // its subtrees from store.
+  folly::Future<folly::Unit> evaluate(
+      ObjectStore* store,
+      RelativePathPiece rootPath,
+      std::shared_ptr<const Tree> root,
+      GlobResults* results,
+      folly::Executor* executor = nullptr);
 
  private:
   // Returns the next glob node token.
@@ -67,12 +142,25 @@ class GlobNode {
   // This is a recursive function which evaluates the current GlobNode against
   // the recursive set of children.
   // By contrast, evaluate() walks down through the GlobNodes AND the
-  // inode children.
+  // directory children.
   // The difference is because a pattern like "**/foo" must be recursively
-  // matched against all the children of the inode.
-  folly::Future<std::unordered_set<RelativePath>> evaluateRecursiveComponent(
+  // matched against all the children of the directory.
+  // Dir is either a TreeInodePtr or a std::shared_ptr<const Tree>.
+  template <typename Dir>
+  folly::Future<folly::Unit> evaluateRecursiveComponentImpl(
+      ObjectStore* store,
+      RelativePathPiece rootPath,
+      const Dir& root,
+      GlobResults* results,
+      folly::Executor* executor);
+  // The implementation of both evaluate() overloads.
+  template <typename Dir>
+  folly::Future<folly::Unit> evaluateImpl(
+      ObjectStore* store,
       RelativePathPiece rootPath,
-      TreeInodePtr root);
+      Dir root,
+      GlobResults* results,
+      folly::Executor* executor);
   // The pattern fragment for this node
   folly::StringPiece pattern_;
   // The compiled pattern
@@ -9,7 +9,13 @@
  */
 #include "StreamingSubscriber.h"
 
+#include "eden/fs/journal/JournalDelta.h"
+#include "eden/fs/service/EdenError.h"
+
 using folly::StringPiece;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
 
 namespace facebook {
 namespace eden {
@@ -17,8 +23,23 @@ namespace eden {
 StreamingSubscriber::StreamingSubscriber(
     std::unique_ptr<apache::thrift::StreamingHandlerCallback<
         std::unique_ptr<JournalPosition>>> callback,
-    std::shared_ptr<EdenMount> edenMount)
-    : callback_(std::move(callback)), edenMount_(std::move(edenMount)) {}
+    std::shared_ptr<EdenMount> edenMount,
+    const SubscribeParams& params)
+    : callback_(std::move(callback)),
+      edenMount_(std::move(edenMount)),
+      minInterval_(std::max<int64_t>(params.minIntervalMs, 0)) {
+  for (const auto& prefix : params.pathPrefixes) {
+    pathPrefixes_.emplace_back(prefix);
+  }
+  for (const auto& glob : params.globs) {
+    auto matcher = GlobMatcher::create(glob);
+    if (matcher.hasError()) {
+      throw newEdenError(
+          EINVAL, "invalid glob \"{}\": {}", glob, matcher.error());
+    }
+    globs_.push_back(std::move(matcher).value());
+  }
+}
 
 StreamingSubscriber::~StreamingSubscriber() {
   // NOTE: we can't call callback_->done() directly from here as there is no
@@ -26,11 +47,8 @@ StreamingSubscriber::~StreamingSubscriber() {
 }
 
 void StreamingSubscriber::subscribe() {
-  subscriberId_ = edenMount_->getJournal()
-                      .wlock()
-                      ->registerSubscriber([self = shared_from_this()]() {
-                        self->schedule();
-                      });
+  subscriberId_ = edenMount_->getJournal().registerSubscriber(
+      [self = shared_from_this()]() { self->schedule(); });
 
   // Suggest to the subscription that the journal has been updated so that
   // it will compute initial delta information.
@@ -55,18 +73,47 @@ void StreamingSubscriber::journalUpdated() {
     // Peer disconnected, so tear down the subscription
     // TODO: is this the right way to detect this?
     VLOG(1) << "Subscription is no longer active";
-    edenMount_->getJournal().wlock()->cancelSubscriber(subscriberId_);
+    edenMount_->getJournal().cancelSubscriber(subscriberId_);
     callback_->done();
     callback_.reset();
     return;
   }
 
-  JournalPosition pos;
+  // Changes made while a delayed update is pending will be picked up when
+  // it runs.
+  if (delayPending_) {
+    return;
+  }
+
+  auto delta = edenMount_->getJournal().getLatest();
+  if (lastSent_) {
+    if (!isInteresting(*delta)) {
+      lastSequence_ = delta->toSequence;
+      return;
+    }
 
-  auto delta = edenMount_->getJournal().rlock()->getLatest();
+    auto nextAllowed = *lastSent_ + minInterval_;
+    auto now = steady_clock::now();
+    if (now < nextAllowed) {
+      delayPending_ = true;
+      auto delay = duration_cast<milliseconds>(nextAllowed - now);
+      callback_->getEventBase()->runAfterDelay(
+          [self = shared_from_this()]() {
+            self->delayPending_ = false;
+            self->journalUpdated();
+          },
+          delay.count() + 1);
+      return;
+    }
+  }
+
+  JournalPosition pos;
   pos.sequenceNumber = delta->toSequence;
   pos.snapshotHash = StringPiece(delta->toHash.getBytes()).str();
   pos.mountGeneration = edenMount_->getMountGeneration();
+  lastSent_ = steady_clock::now();
+  lastSequence_ = delta->toSequence;
+  lastHash_ = delta->toHash;
 
   try {
     // And send it
@@ -75,5 +122,42 @@ void StreamingSubscriber::journalUpdated() {
     LOG(ERROR) << "Error while sending subscription update: " << exc.what();
   }
 }
+
+bool StreamingSubscriber::isInteresting(const JournalDelta& latest) const {
+  if (latest.toSequence == lastSequence_) {
+    return false;
+  }
+  if (latest.toHash != lastHash_ ||
+      (pathPrefixes_.empty() && globs_.empty())) {
+    return true;
+  }
+
+  auto merged = latest.merge(lastSequence_ + 1, true);
+  if (!merged || merged->isTruncatedAfter(lastSequence_) ||
+      merged->fromHash != lastHash_) {
+    // We can no longer tell what changed, so let the subscriber find out.
+    return true;
+  }
+  for (const auto& path : merged->changedFilesInOverlay) {
+    if (matchesFilter(path)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool StreamingSubscriber::matchesFilter(RelativePathPiece path) const {
+  for (const auto& prefix : pathPrefixes_) {
+    if (path == prefix || path.isSubDirOf(prefix)) {
+      return true;
+    }
+  }
+  for (const auto& glob : globs_) {
+    if (glob.match(path.stringPiece())) {
+      return true;
+    }
+  }
+  return false;
+}
 }
 }
@@ -8,8 +8,12 @@
  *
  */
 #pragma once
+#include <folly/Optional.h>
+#include <chrono>
 #include <memory>
+#include <vector>
 #include "eden/fs/inodes/EdenMount.h"
+#include "eden/fs/model/git/GlobMatcher.h"
 #include "eden/fs/service/gen-cpp2/StreamingEdenService.h"
 
 namespace facebook {
@@ -19,13 +23,11 @@ namespace eden {
  * connected subscribers so that they can take action as files
  * are modified in the eden mount.
  *
- * This initial implementation is relatively dumb in that it
- * will immediately try to send a notification to the subscriber.
- *
- * Future iterations will add the ability to rate control these
- * updates (no more than 1 update per specified time interval)
- * and potentially also add a predicate so that we only notify
- * for updates that match certain criteria.
+ * The SubscribeParams supplied by the client control the updates:
+ * no more than one update is sent per minIntervalMs, with any changes
+ * made in the meantime coalesced into the next update, and if any path
+ * filters are given then changes that do not touch a matching path are
+ * not sent at all.
  */
 
 class StreamingSubscriber
@@ -34,7 +36,8 @@ class StreamingSubscriber
   StreamingSubscriber(
       std::unique_ptr<apache::thrift::StreamingHandlerCallback<
           std::unique_ptr<JournalPosition>>> callback,
-      std::shared_ptr<EdenMount> edenMount);
+      std::shared_ptr<EdenMount> edenMount,
+      const SubscribeParams& params);
   ~StreamingSubscriber();
 
   /** Establishes a subscription with the journal in the edenMount
@@ -57,11 +60,33 @@ class StreamingSubscriber
    * This is ensured by only ever calling it via the schedule() method. */
   void journalUpdated();
 
+  /** Returns true if the changes in the journal after lastSequence_, which
+   * end with latest, include anything that the subscriber asked for */
+  bool isInteresting(const JournalDelta& latest) const;
+  bool matchesFilter(RelativePathPiece path) const;
+
   std::unique_ptr<apache::thrift::StreamingHandlerCallback<
       std::unique_ptr<JournalPosition>>>
       callback_;
   std::shared_ptr<EdenMount> edenMount_;
   uint64_t subscriberId_;
+
+  std::chrono::milliseconds minInterval_;
+  std::vector<RelativePath> pathPrefixes_;
+  std::vector<GlobMatcher> globs_;
+
+  /** The following members are only accessed on the client's thread */
+
+  /** When the last update was sent, or none if no update has been sent
+   * yet */
+  folly::Optional<std::chrono::steady_clock::time_point> lastSent_;
+  /** The journal position that the last update covered, including changes
+   * that were skipped by the filter */
+  Journal::SequenceNumber lastSequence_{0};
+  Hash lastHash_;
+  /** Set while a delayed call to journalUpdated() is pending, so that
+   * changes made during the interval do not schedule more of them */
+  bool delayPending_{false};
 };
 }
 }
@@ -31,11 +31,42 @@ struct MountInfo {
   2: string edenClientPath
 }
 
+enum MountState {
+  /**
+   * The mount point is still being mounted, for instance while Eden remounts
+   * its clients at startup.
+   */
+  STARTING = 0,
+  RUNNING = 1,
+  /**
+   * Eden failed to remount this client at startup.
+   */
+  FAILED = 2,
+}
+
+struct MountStatus {
+  1: string mountPoint
+  2: MountState state
+  /**
+   * Why mounting failed, if state is FAILED.
+   */
+  3: string error
+}
+
 union SHA1Result {
   1: BinaryHash sha1
   2: EdenError error
 }
 
+/**
+ * The SHA-1 of one file in a getSHA1ForDirectory() result.
+ */
+struct FileSHA1 {
+  /** The path of the file, relative to the mount point */
+  1: string path
+  2: SHA1Result sha1
+}
+
 /**
  * Effectively a `struct timespec`
  */
@@ -92,6 +123,24 @@ struct FileDelta {
   3: list<string> paths
 }
 
+/** Controls which journal changes are pushed to a subscriber, and how often.
+ * The default values push every change as soon as it happens.
+ */
+struct SubscribeParams {
+  /** The minimum time between two notifications, in milliseconds.
+   * Changes made within the interval are coalesced into a single
+   * notification that is sent when the interval has passed. */
+  1: i64 minIntervalMs
+  /** If not empty, only changes to paths inside one of these directories
+   * (or to the paths themselves) cause a notification. */
+  2: list<string> pathPrefixes
+  /** If not empty, only changes to paths matching one of these globs cause
+   * a notification.  The globs use the gitignore syntax, and are matched
+   * against the full path relative to the root of the mount.
+   * A change that matches either pathPrefixes or globs is sufficient. */
+  3: list<string> globs
+}
+
 enum StatusCode {
   CLEAN = 0x0,
   MODIFIED = 0x1,
@@ -158,6 +207,44 @@ struct CheckoutConflict {
   3: string message
 }
 
+/**
+ * Timing and counters for a checkout operation.
+ *
+ * Directories are checked out concurrently, and the time for each phase is
+ * summed over all of them, so the phase times may add up to more than
+ * totalTimeUs.
+ */
+struct CheckoutStats {
+  1: i64 totalTimeUs
+  2: i64 fetchTreesTimeUs
+  /**
+   * Time spent fetching old blob metadata, and prefetching new blobs.
+   */
+  3: i64 fetchBlobsTimeUs
+  4: i64 writeOverlayTimeUs
+  /**
+   * Time spent telling the kernel to invalidate its cached entries and inodes.
+   */
+  5: i64 invalidateTimeUs
+  /**
+   * Time spent comparing loaded inodes against the old source control state.
+   */
+  6: i64 checkConflictsTimeUs
+  /**
+   * The number of entries that required loading an inode to check them out.
+   */
+  7: i64 entriesProcessed
+  /**
+   * The number of unloaded entries updated just by replacing their hash.
+   */
+  8: i64 entriesSwapped
+  9: i64 conflicts
+  10: i64 errors
+  11: i64 treesFetched
+  12: i64 blobsFetched
+  13: i64 bytesFetched
+}
+
 struct ScmBlobMetadata {
   1: i64 size
   2: BinaryHash contentsSha1
@@ -169,6 +256,31 @@ struct ScmTreeEntry {
   3: BinaryHash id
 }
 
+/**
+ * The entries of a source control Tree, or an error loading it.
+ */
+union ScmTreeOrError {
+  1: list<ScmTreeEntry> entries
+  2: EdenError error
+}
+
+/**
+ * The contents of a source control Blob, or an error loading it.
+ */
+union ScmBlobOrError {
+  1: binary blob
+  2: EdenError error
+}
+
+/**
+ * One Tree of a streamed list of Trees.
+ */
+struct ScmTreeResult {
+  /** The position of the Tree's ID in the request */
+  1: i32 index
+  2: ScmTreeOrError tree
+}
+
 struct TreeInodeEntryDebugInfo {
   /**
    * The entry name.  This is just a PathComponent, not the full path
@@ -206,11 +318,249 @@ struct TreeInodeDebugInfo {
   5: list<TreeInodeEntryDebugInfo> entries
 }
 
+/**
+ * The timeline of a slow FUSE request.
+ *
+ * The phase durations may overlap: inodeLoadUs includes the time spent
+ * fetching the inode's data from the local store or backing store.
+ */
+struct FuseRequestTrace {
+  /**
+   * The FUSE operation, such as "lookup" or "read".
+   */
+  1: string operation
+  /**
+   * When the request was dispatched, in milliseconds since the epoch.
+   */
+  2: i64 startTimeMs
+  3: i64 totalUs
+  /**
+   * The time from dispatch until the reply was sent to the kernel.
+   */
+  4: i64 replyUs
+  5: i64 inodeLoadUs
+  6: i64 localStoreUs
+  7: i64 backingStoreUs
+}
+
+/**
+ * A distribution of lock wait or hold times, in microseconds.
+ *
+ * The percentiles are the upper bounds of power-of-two buckets, so they are
+ * only accurate to within a factor of two.
+ */
+struct LockDurationStats {
+  1: i64 count
+  2: i64 totalUs
+  3: i64 maxUs
+  4: i64 p50Us
+  5: i64 p90Us
+  6: i64 p99Us
+}
+
+/**
+ * The acquisitions of one kind of lock from one call site that had to wait.
+ */
+struct LockSiteStats {
+  1: string site
+  2: i64 contended
+  3: i64 totalWaitUs
+  4: i64 maxWaitUs
+}
+
+struct LockContentionStats {
+  /**
+   * "rename_lock", "contents_lock" or "inode_map_lock".
+   */
+  1: string lock
+  2: LockDurationStats wait
+  /**
+   * Hold times are only recorded for exclusive acquisitions.
+   */
+  3: LockDurationStats hold
+  /**
+   * The number of acquisitions that waited at least one microsecond.
+   */
+  4: i64 contended
+  /**
+   * The call sites with the most total wait time, longest first.
+   */
+  5: list<LockSiteStats> topSites
+}
+
+struct PrefetchResult {
+  /**
+   * The number of paths that matched the globs.
+   */
+  1: i64 matchedPaths
+  2: i64 blobsAlreadyPresent
+  3: i64 blobsFetched
+  /**
+   * The number of blobs that could not be fetched.  These will still be
+   * fetched on demand when they are accessed.
+   */
+  4: i64 blobsFailed
+}
+
+/**
+ * Some of the paths that matched a streamed glob.
+ */
+struct GlobResultBatch {
+  1: list<string> matchingFiles
+}
+
+/**
+ * A file or directory that is materialized, so that its contents are stored
+ * locally in the overlay instead of coming from source control.
+ */
+struct MaterializedEntry {
+  1: string path
+  /**
+   * The mode_t of the entry, which includes its type.
+   */
+  2: i32 mode
+}
+
+/**
+ * Some of the entries of a streamed list of materialized entries.
+ */
+struct MaterializedEntryBatch {
+  1: list<MaterializedEntry> entries
+}
+
+struct MountLoadProgress {
+  /**
+   * The number of materialized directories and files whose inodes have been
+   * loaded so far.
+   */
+  1: i64 dirsLoaded
+  2: i64 filesLoaded
+  /**
+   * True once all materialized inodes have been loaded.
+   */
+  3: bool finished
+}
+
+struct LocalStoreGcResult {
+  /**
+   * The approximate size of the local store before garbage collection.
+   */
+  1: i64 sizeBefore
+  2: i64 blobsEvicted
+  /**
+   * The total uncompressed size of the evicted blobs.
+   */
+  3: i64 bytesEvicted
+}
+
+struct LocalStoreCompactResult {
+  /**
+   * The approximate size of the local store before and after compaction.
+   */
+  1: i64 sizeBefore
+  2: i64 sizeAfter
+  /**
+   * The number of SST files in all key spaces before and after compaction.
+   */
+  3: i64 sstFilesBefore
+  4: i64 sstFilesAfter
+}
+
+struct OverlayCompactResult {
+  /**
+   * The number of unreachable directories and files removed from the
+   * overlay.
+   */
+  1: i64 dirsRemoved
+  2: i64 filesRemoved
+  /**
+   * The approximate disk space freed.
+   */
+  3: i64 bytesReclaimed
+  /**
+   * The largest inode number still recorded in the overlay.
+   */
+  4: i64 maxInodeNumber
+}
+
+/**
+ * The latency of one FUSE operation on a mount point since it was mounted,
+ * in microseconds.
+ */
+struct FuseOperationLatency {
+  1: string operation
+  2: i64 count
+  3: i64 p50Us
+  4: i64 p90Us
+  5: i64 p99Us
+}
+
+/**
+ * The number of lookups that hit and missed one of eden's caches.
+ */
+struct CacheHitRate {
+  1: string cache
+  2: i64 hits
+  3: i64 misses
+}
+
+struct PerformanceSummary {
+  /**
+   * The age of all FUSE requests on the mount point at completion, since it
+   * was mounted.  These are the upper bounds of power of two buckets.
+   */
+  1: i64 fuseP50Us
+  2: i64 fuseP90Us
+  3: i64 fuseP99Us
+  4: i64 fuseOutstanding
+  5: i64 fuseInterrupted
+  /**
+   * The operations that have had any requests, slowest p99 first.
+   */
+  6: list<FuseOperationLatency> fuseOperations
+  7: list<CacheHitRate> caches
+  /**
+   * The backing store loads waiting for a thread, by ImportPriority name.
+   * The backing stores are shared by all mount points.
+   */
+  8: map<string, i64> importQueueDepth
+  9: i64 loadedInodes
+  10: i64 unloadedInodes
+  11: i64 overlayFiles
+  12: i64 overlayBytes
+  /**
+   * The number of deltas in the journal, the sequence number of the latest
+   * one, and the memory they use.
+   */
+  13: i64 journalDeltas
+  14: i64 journalSequence
+  15: i64 journalMemoryBytes
+  /**
+   * The state of the local store, which is shared by all mount points.
+   */
+  16: i64 localStoreBytes
+  17: i64 localStoreSstFiles
+  18: i64 localStoreLevel0Files
+  19: i64 localStorePendingCompactionBytes
+  20: i64 localStoreRunningCompactions
+  21: bool localStoreWritesStopped
+}
+
 service EdenService extends fb303.FacebookService {
   list<MountInfo> listMounts() throws (1: EdenError ex)
   void mount(1: MountInfo info) throws (1: EdenError ex)
   void unmount(1: string mountPoint) throws (1: EdenError ex)
 
+  /**
+   * Get the state of every mount point Eden knows about.
+   *
+   * Unlike listMounts(), this includes the mount points that are still
+   * being mounted, and the ones that Eden failed to remount at startup.
+   * Clients are remounted in parallel, so some may be RUNNING while others
+   * are still STARTING.
+   */
+  list<MountStatus> getMountStatuses() throws (1: EdenError ex)
+
   /**
    * Get the current snapshot that is checked out in the given mount point.
    */
@@ -245,6 +595,19 @@ service EdenService extends fb303.FacebookService {
     3: bool force)
       throws (1: EdenError ex)
 
+  /**
+   * Return the conflicts that checkOutRevision() would report without force,
+   * without changing the mount point.
+   *
+   * This only examines the paths that differ between the current and the
+   * given snapshot, and does not block filesystem operations while it runs.
+   * Ignored files are not checked.
+   */
+  list<CheckoutConflict> checkOutRevisionDryRun(
+    1: string mountPoint,
+    2: BinaryHash snapshotHash)
+      throws (1: EdenError ex)
+
   /**
    * Reset the working directory's parent commit, without changing the working
    * directory contents.
@@ -256,6 +619,20 @@ service EdenService extends fb303.FacebookService {
     2: BinaryHash snapshotHash)
       throws (1: EdenError ex)
 
+  /**
+   * Store the working directory state as source control Trees and Blobs in
+   * the local store, and return the ID of the root Tree.
+   *
+   * Only locally modified files are read, straight from the overlay rather
+   * than through the mount point, so a commit can be created from the
+   * result without reading the files back through FUSE.  Untracked and
+   * ignored files are included, so callers should leave out the entries they
+   * do not want to commit.  The results can be read with debugGetScmTree()
+   * and debugGetScmBlob() with localStoreOnly set.
+   */
+  BinaryHash snapshotWorkingCopy(1: string mountPoint)
+      throws (1: EdenError ex)
+
   // Mount-specific APIs.
 
   /**
@@ -269,6 +646,21 @@ service EdenService extends fb303.FacebookService {
   list<SHA1Result> getSHA1(1: string mountPoint, 2: list<string> paths)
     throws (1: EdenError ex)
 
+  /**
+   * Returns the SHA-1 of every regular file in a directory, and in all of
+   * its subdirectories too if recursive is true.  Symlinks are skipped.
+   *
+   * The directory is walked once, and the SHA-1s of files that have not been
+   * modified are looked up from their blob metadata in batches, so this is
+   * much cheaper than calling getSHA1() with every path.  An empty directory
+   * means the root of the mount.  The result is sorted by path.
+   */
+  list<FileSHA1> getSHA1ForDirectory(
+    1: string mountPoint,
+    2: string directory,
+    3: bool recursive)
+      throws (1: EdenError ex)
+
   /**
    * Returns a list of paths relative to the mountPoint.
    */
@@ -314,12 +706,85 @@ service EdenService extends fb303.FacebookService {
     2: list<string> globs)
       throws (1: EdenError ex)
 
+  /**
+   * Fetch the contents of all of the files matching the input globs into
+   * the local store ahead of time, so that they don't have to be fetched
+   * one at a time when they are opened.
+   *
+   * Directories that match are prefetched recursively.  The blobs are
+   * fetched in batches, with a limited number of batches in flight, so that
+   * the prefetch does not starve normal filesystem accesses.  This returns
+   * once all of the blobs have been fetched.
+   */
+  PrefetchResult prefetch(
+    1: string mountPoint,
+    2: list<string> globs)
+      throws (1: EdenError ex)
+
+  /**
+   * Start recording the files opened for reading in a mount point, for
+   * example at the start of a build.  Any recording in progress is
+   * discarded.
+   */
+  void startRecordingAccesses(1: string mountPoint)
+      throws (1: EdenError ex)
+
+  /**
+   * Stop recording accesses, and save the paths of the files that were
+   * read in the client directory.  Returns the number of paths saved.
+   *
+   * Fails with EINVAL if startRecordingAccesses() was not called.
+   */
+  i64 stopRecordingAccesses(1: string mountPoint)
+      throws (1: EdenError ex)
+
+  /**
+   * Prefetch the files saved by the last stopRecordingAccesses() call, as
+   * they are in the current snapshot, like prefetch().  matchedPaths is the
+   * number of recorded paths that are still files.
+   */
+  PrefetchResult replayAccesses(1: string mountPoint)
+      throws (1: EdenError ex)
+
+  /**
+   * List every materialized file and directory in a mount point.
+   *
+   * Everything that has been modified locally is materialized, so this is
+   * a cheap superset of the locally modified files.  It is answered from
+   * the overlay's directory records, without loading any inodes, so its
+   * cost depends only on how much is materialized.  A directory is listed
+   * before its contents.
+   */
+  list<MaterializedEntry> getMaterializedEntries(1: string mountPoint)
+      throws (1: EdenError ex)
+
+  /**
+   * Remove a file, or a directory and everything under it, like `rm -rf`.
+   *
+   * This is much faster than removing a large tree through the mount point,
+   * which costs a FUSE request per entry.  The removed paths are recorded in
+   * the journal as a single change.  The root of the mount point cannot be
+   * removed.
+   */
+  void removeRecursive(
+    1: string mountPoint,
+    2: string path)
+      throws (1: EdenError ex)
+
   //////// Source Control APIs ////////
 
   // TODO(mbolin): `hg status` has a ton of command line flags to support.
+  /**
+   * Get the status of the files that differ from the current commit.
+   *
+   * If pathPrefix is non-empty, only the status of paths at or underneath it
+   * is returned, and only that part of the mount point is diffed, as for
+   * `hg status path/`.
+   */
   ThriftHgStatus scmGetStatus(
     1: string mountPoint,
     2: bool listIgnored,
+    3: string pathPrefix,
   ) throws (1: EdenError ex)
 
   list<ScmAddRemoveError> scmAdd(
@@ -385,6 +850,33 @@ service EdenService extends fb303.FacebookService {
     3: bool localStoreOnly,
   ) throws (1: EdenError ex)
 
+  /**
+   * Get the contents of several source control Trees.
+   *
+   * Returns one result per input ID, in the same order.  A Tree that cannot
+   * be loaded gets an error, rather than failing the whole call.  Trees that
+   * are not already in memory are looked up in the LocalStore in a single
+   * pass, which is much cheaper than calling debugGetScmTree() once per ID.
+   */
+  list<ScmTreeOrError> debugGetScmTreesBatch(
+    1: string mountPoint,
+    2: list<BinaryHash> ids,
+    3: bool localStoreOnly,
+  ) throws (1: EdenError ex)
+
+  /**
+   * Get the contents of several source control Blobs.
+   *
+   * Returns one result per input ID, in the same order.  A Blob that cannot
+   * be loaded gets an error, rather than failing the whole call.  The whole
+   * result is returned at once, so use streamScmBlobs() for large blobs.
+   */
+  list<ScmBlobOrError> debugGetScmBlobsBatch(
+    1: string mountPoint,
+    2: list<BinaryHash> ids,
+    3: bool localStoreOnly,
+  ) throws (1: EdenError ex)
+
   /**
    * Get status about currently loaded inode objects.
    *
@@ -410,4 +902,135 @@ service EdenService extends fb303.FacebookService {
     1: string mountPoint,
     2: string path,
   ) throws (1: EdenError ex)
+
+  /**
+   * Get the slowest of the recent FUSE requests on a mount point, slowest
+   * first, with a breakdown of where their time went.
+   *
+   * Only requests that took longer than --fuseSlowRequestThresholdUs are
+   * remembered, and only the most recent --fuseSlowRequestLogSize of them.
+   * At most count requests are returned.
+   */
+  list<FuseRequestTrace> debugGetRecentSlowRequests(
+    1: string mountPoint,
+    2: i32 count,
+  ) throws (1: EdenError ex)
+
+  /**
+   * Trace one in every sampleOneIn FUSE requests on a mount point that start
+   * within the next durationMs milliseconds, discarding the samples from any
+   * previous window.
+   *
+   * Use debugGetRequestSamples() to read the samples.
+   */
+  void debugStartRequestSampling(
+    1: string mountPoint,
+    2: i32 durationMs,
+    3: i32 sampleOneIn,
+  ) throws (1: EdenError ex)
+
+  /**
+   * Get the samples from the current or most recent sampling window of a mount
+   * point, in the folded stack format read by flamegraph.pl.
+   *
+   * Each line is "<operation>;<phase> <microseconds>", summed over all of the
+   * sampled requests.  The phases are inode_load, local_store, backing_store,
+   * and the waits for the inode_map_lock, contents_lock and rename_lock; time
+   * that is not in any phase is reported against the operation alone.
+   */
+  string debugGetRequestSamples(1: string mountPoint) throws (1: EdenError ex)
+
+  /**
+   * Turn lock contention profiling on or off for the rename lock, the
+   * TreeInode contents locks and the InodeMap locks of all mount points.
+   *
+   * Turning profiling on discards the statistics from any previous run.
+   * Use debugGetLockContention() to read them.
+   */
+  void debugSetLockProfiling(1: bool enabled)
+
+  /**
+   * Get the lock statistics recorded since profiling was last turned on,
+   * with at most maxSites call sites per lock.
+   */
+  list<LockContentionStats> debugGetLockContention(1: i32 maxSites)
+
+  /**
+   * Garbage collect the local store now, rather than waiting for the next
+   * periodic collection.
+   *
+   * The least recently used blobs are evicted until the store is under the
+   * max-size set in the [localstore] section of the config.  Blobs referenced
+   * by any mounted snapshot or overlay are never evicted.  Nothing is evicted
+   * if no max-size is configured.
+   */
+  LocalStoreGcResult collectLocalStoreGarbage() throws (1: EdenError ex)
+
+  /**
+   * Compact every key space of the local store now.  This returns once the
+   * compaction has finished.
+   *
+   * The local store is also compacted periodically when it needs it, but
+   * that is deferred while FUSE requests are slow.  This is not.
+   */
+  LocalStoreCompactResult debugCompactLocalStore() throws (1: EdenError ex)
+
+  /**
+   * Get the progress of loading the materialized inodes of a mount point.
+   *
+   * With --load_materialized_inodes_at_mount, Eden loads the inodes for all
+   * materialized files and directories before it starts a mount point, which
+   * can take a while when the overlay is large.  This may be called while the
+   * mount() call is still in progress.  Without that flag nothing is loaded
+   * up front, and finished is always true.
+   */
+  MountLoadProgress getMountLoadProgress(1: string mountPoint)
+    throws (1: EdenError ex)
+
+  /**
+   * Get the timing and counters for the most recent checkOutRevision() call
+   * on a mount point.
+   *
+   * All of the values are zero if no checkout has completed since the mount
+   * point was mounted.
+   */
+  CheckoutStats getLastCheckoutStats(1: string mountPoint)
+    throws (1: EdenError ex)
+
+  /**
+   * Remove the overlay data of inodes that are no longer reachable from the
+   * root directory of a client.  This is left behind by files that were
+   * unlinked while still open when eden stopped, and by crashes.
+   *
+   * If the client is mounted this runs online, and keeps the data of any
+   * inode the mount point still has loaded.  Otherwise the overlay in
+   * edenClientPath is compacted offline, and its inode high-water mark is
+   * rebuilt from the inodes that remain.
+   */
+  OverlayCompactResult debugCompactOverlay(
+    1: string mountPoint,
+    2: string edenClientPath,
+  ) throws (1: EdenError ex)
+
+  /**
+   * Get all of the counters that getCounters() returns, rendered in the
+   * OpenMetrics text format for Prometheus.
+   *
+   * The per-mount counters are labelled with their mount point, and the
+   * latency histograms are rendered as summaries.  This only reads the
+   * counters, so it never blocks FUSE requests.
+   */
+  string getOpenMetrics() throws (1: EdenError ex)
+
+  /**
+   * Get the figures that are usually needed to tell why a mount point is
+   * slow, in one call: its FUSE latency, the hit rates of the caches it uses,
+   * the backing store queues, its inode, overlay and journal sizes, and the
+   * state of the local store.
+   *
+   * This only reads counters and statistics that are already maintained,
+   * apart from asking RocksDB for its size and compaction state.
+   */
+  PerformanceSummary getPerformanceSummary(1: string mountPoint)
+    throws (1: EdenError ex)
 }
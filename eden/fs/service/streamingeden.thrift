@@ -5,6 +5,25 @@ namespace cpp2 facebook.eden
  * This is only available to cpp2 clients and won't compile for other
  * language/runtimes. */
 
+/** Unlike binary, this is sent without being copied into a std::string, so
+ * that blob contents can be sent straight from the LocalStore's buffers. */
+typedef binary (cpp.type = "std::unique_ptr<folly::IOBuf>") IOBufPtr
+
+/** Part of the contents of a streamed source control Blob.
+ * The chunks of each Blob are sent in order, and the last one has last set.
+ * If the Blob cannot be loaded, a single chunk with error set is sent for
+ * it instead.
+ */
+struct ScmBlobChunk {
+  /** The position of the Blob's ID in the request */
+  1: i32 index
+  /** The offset of data in the Blob's contents */
+  2: i64 offset
+  3: IOBufPtr data
+  4: bool last
+  5: optional eden.EdenError error
+}
+
 service StreamingEdenService extends eden.EdenService {
   /** Request notification about changes to the journal for
    * the specified mountPoint.
@@ -13,7 +32,76 @@ service StreamingEdenService extends eden.EdenService {
    * be pushed to the client in near-real-time.
    * The client may then use methods like getFilesChangedSince()
    * to determine the precise nature of the changes.
+   * params may be used to rate limit the notifications, and to only be
+   * notified about changes to certain paths.  Changes to the snapshot hash
+   * always cause a notification.
    */
   stream<eden.JournalPosition> subscribe(
+    1: string mountPoint,
+    2: eden.SubscribeParams params)
+
+  /** Compute the same status information as scmGetStatus(), but push it to
+   * the client in batches as it is computed, rather than all at once when it
+   * is complete.  Each path appears in only one batch, and the stream ends
+   * once the whole status has been sent.
+   * This lets clients start working on the results right away, and keeps
+   * the daemon from holding the entire status in memory when a very large
+   * number of files have changed.
+   */
+  stream<eden.ThriftHgStatus> scmStreamStatus(
+    1: string mountPoint,
+    2: bool listIgnored)
+
+  /** Push the differences between two commits to the client in batches.
+   * Files that only exist in toCommit are reported as ADDED, files that only
+   * exist in fromCommit as REMOVED, and files whose contents or mode differ
+   * as MODIFIED.
+   * This only compares the commits' source control trees, so it neither
+   * requires nor changes a checkout of either commit.  Subtrees that are
+   * identical in both commits are skipped without being fetched.
+   */
+  stream<eden.ThriftHgStatus> streamDiffCommits(
+    1: string mountPoint,
+    2: eden.BinaryHash fromCommit,
+    3: eden.BinaryHash toCommit)
+
+  /** Compute the same result as glob(), but push the matching files to the
+   * client in batches as they are found, rather than all at once when the
+   * whole glob has been evaluated.  Each path appears in only one batch,
+   * and the stream ends once the glob has been fully evaluated.
+   */
+  stream<eden.GlobResultBatch> streamGlob(
+    1: string mountPoint,
+    2: list<string> globs)
+
+  /** Compute the same result as getMaterializedEntries(), but push the
+   * entries to the client in batches as the overlay is read, rather than
+   * all at once at the end.  The stream ends once every materialized entry
+   * has been sent.
+   */
+  stream<eden.MaterializedEntryBatch> streamMaterializedEntries(
     1: string mountPoint)
+
+  /** Compute the same results as debugGetScmTreesBatch(), but push each Tree
+   * to the client as soon as it is loaded, rather than all at once at the
+   * end.  Trees are sent in the order of ids.  If localStoreOnly is true, the
+   * entries are read straight from the LocalStore without decoding each
+   * Tree first.
+   */
+  stream<eden.ScmTreeResult> streamScmTrees(
+    1: string mountPoint,
+    2: list<eden.BinaryHash> ids,
+    3: bool localStoreOnly)
+
+  /** Push the contents of several source control Blobs to the client, in
+   * chunks of at most --scm_blob_stream_chunk_size bytes.  Blobs are sent
+   * one after another in the order of ids.
+   * The chunks refer to the LocalStore's buffers rather than copies of them.
+   * If localStoreOnly is true, large blobs are read from the LocalStore one
+   * chunk at a time, so a blob never has to be held in memory all at once.
+   */
+  stream<ScmBlobChunk> streamScmBlobs(
+    1: string mountPoint,
+    2: list<eden.BinaryHash> ids,
+    3: bool localStoreOnly)
 }
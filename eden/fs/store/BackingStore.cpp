@@ -0,0 +1,37 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "BackingStore.h"
+
+#include <folly/futures/Future.h>
+#include "eden/fs/model/Blob.h"
+#include "eden/fs/model/Hash.h"
+
+using folly::Future;
+using std::unique_ptr;
+
+namespace facebook {
+namespace eden {
+
+std::vector<Future<unique_ptr<Blob>>> BackingStore::getBlobs(
+    const std::vector<Hash>& ids) {
+  std::vector<Future<unique_ptr<Blob>>> results;
+  results.reserve(ids.size());
+  for (const auto& id : ids) {
+    results.push_back(getBlob(id));
+  }
+  return results;
+}
+
+Future<folly::Optional<BlobMetadata>> BackingStore::getBlobMetadata(
+    const Hash& /* id */) {
+  return folly::makeFuture(folly::Optional<BlobMetadata>{});
+}
+}
+} // facebook::eden
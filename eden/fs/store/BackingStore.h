@@ -9,7 +9,10 @@
  */
 #pragma once
 
+#include <folly/Optional.h>
 #include <memory>
+#include <vector>
+#include "eden/fs/store/BlobMetadata.h"
 
 namespace folly {
 template <typename T>
@@ -42,6 +45,41 @@ class BackingStore {
   virtual folly::Future<std::unique_ptr<Tree>> getTreeForCommit(
       const Hash& commitID) = 0;
 
+  /**
+   * Fetch several blobs at once.
+   *
+   * Returns one Future per input ID, in the same order.  BackingStore
+   * implementations that can fetch multiple blobs more efficiently than one
+   * at a time should override this.  The default implementation simply calls
+   * getBlob() for each ID.
+   */
+  virtual std::vector<folly::Future<std::unique_ptr<Blob>>> getBlobs(
+      const std::vector<Hash>& ids);
+
+  /**
+   * Fetch only the size and SHA-1 of a blob's contents.
+   *
+   * BackingStores that can compute these without transferring the whole
+   * blob to eden should override this.  The default implementation returns
+   * folly::none, in which case the ObjectStore fetches the whole blob with
+   * getBlob() and computes the metadata itself.
+   */
+  virtual folly::Future<folly::Optional<BlobMetadata>> getBlobMetadata(
+      const Hash& id);
+
+  /**
+   * Whether the LocalStore should keep a copy of the contents of the blobs
+   * fetched from this BackingStore.
+   *
+   * BackingStores that read blobs from local disk about as fast as the
+   * LocalStore can may return false, in which case only the blob metadata
+   * is stored, and the contents are fetched from the BackingStore each time
+   * they are needed.
+   */
+  virtual bool shouldStoreBlobContents() const {
+    return true;
+  }
+
  private:
   // Forbidden copy constructor and assignment operator
   BackingStore(BackingStore const&) = delete;
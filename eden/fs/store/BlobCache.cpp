@@ -0,0 +1,94 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "BlobCache.h"
+
+#include "eden/fs/model/Blob.h"
+
+using std::shared_ptr;
+
+namespace facebook {
+namespace eden {
+
+BlobCache::BlobCache(size_t maxBytes) : maxBytes_(maxBytes) {}
+
+BlobCache::~BlobCache() {}
+
+shared_ptr<const Blob> BlobCache::get(const Hash& id) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = index_.find(id);
+  if (it == index_.end()) {
+    ++stats_.misses;
+    return nullptr;
+  }
+
+  ++stats_.hits;
+  lru_.splice(lru_.begin(), lru_, it->second);
+  return *it->second;
+}
+
+void BlobCache::insert(shared_ptr<const Blob> blob) {
+  auto size = estimateSize(*blob);
+  if (size > getMaxBytes()) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = index_.find(blob->getHash());
+  if (it != index_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return;
+  }
+
+  // The budget may have shrunk since the check above.
+  auto maxBytes = getMaxBytes();
+  if (size > maxBytes) {
+    return;
+  }
+  evictLocked(maxBytes - size);
+
+  auto id = blob->getHash();
+  lru_.push_front(std::move(blob));
+  index_.emplace(id, lru_.begin());
+  stats_.totalBytes += size;
+}
+
+void BlobCache::setMaxBytes(size_t maxBytes) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  maxBytes_.store(maxBytes, std::memory_order_relaxed);
+  evictLocked(maxBytes);
+}
+
+void BlobCache::shrink(size_t targetBytes) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  evictLocked(targetBytes);
+}
+
+void BlobCache::evictLocked(size_t maxBytes) {
+  while (stats_.totalBytes > maxBytes) {
+    const auto& victim = lru_.back();
+    stats_.totalBytes -= estimateSize(*victim);
+    index_.erase(victim->getHash());
+    lru_.pop_back();
+    ++stats_.evictions;
+  }
+}
+
+BlobCacheStats BlobCache::getStats() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto result = stats_;
+  result.numEntries = index_.size();
+  return result;
+}
+
+size_t BlobCache::estimateSize(const Blob& blob) {
+  return sizeof(Blob) + blob.getContents().computeChainDataLength();
+}
+}
+} // facebook::eden
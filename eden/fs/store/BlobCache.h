@@ -0,0 +1,126 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "eden/fs/model/Hash.h"
+
+namespace facebook {
+namespace eden {
+
+class Blob;
+
+/**
+ * Statistics about a BlobCache.
+ */
+struct BlobCacheStats {
+  /** The number of lookups that found the Blob in the cache */
+  uint64_t hits{0};
+  /** The number of lookups that did not find the Blob in the cache */
+  uint64_t misses{0};
+  /** The number of Blobs evicted to stay within the memory budget */
+  uint64_t evictions{0};
+  /** The number of Blobs currently in the cache */
+  size_t numEntries{0};
+  /** The number of bytes of Blob data currently in the cache */
+  size_t totalBytes{0};
+};
+
+/**
+ * BlobCache keeps the contents of recently used Blobs in memory.
+ *
+ * FileData objects that are backed by the same Blob share a single copy of
+ * its contents through the cache, and the contents remain available after
+ * the inodes using them have been unloaded, so reopening a file does not
+ * have to load it from the LocalStore again.
+ *
+ * The cache is bounded by the total size of the cached Blob contents.  The
+ * least recently used Blobs are evicted first.  Blobs that are still in use
+ * by a FileData stay in memory after eviction until they are released, so
+ * the budget bounds the memory used for Blobs that nothing is using.
+ *
+ * BlobCache is thread-safe.  It is shared by all mount points.
+ */
+class BlobCache {
+ public:
+  /**
+   * Create a BlobCache holding up to maxBytes of Blob data.  A maxBytes of 0
+   * disables the cache.
+   */
+  explicit BlobCache(size_t maxBytes);
+  virtual ~BlobCache();
+
+  /**
+   * Look up a Blob by ID.
+   *
+   * Returns nullptr if the Blob is not in the cache.
+   */
+  std::shared_ptr<const Blob> get(const Hash& id);
+
+  /**
+   * Add a Blob to the cache, evicting older Blobs as necessary.
+   *
+   * Blobs larger than the whole memory budget are not cached.
+   */
+  void insert(std::shared_ptr<const Blob> blob);
+
+  /**
+   * Get a snapshot of the cache statistics.
+   */
+  BlobCacheStats getStats() const;
+
+  size_t getMaxBytes() const {
+    return maxBytes_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Change the memory budget, evicting Blobs right away if the cache holds
+   * more than the new budget.
+   */
+  void setMaxBytes(size_t maxBytes);
+
+  /**
+   * Evict the least recently used Blobs until the cache holds at most
+   * targetBytes, without changing its budget.
+   */
+  void shrink(size_t targetBytes);
+
+  /**
+   * Estimate the memory used by a Blob.
+   */
+  static size_t estimateSize(const Blob& blob);
+
+ private:
+  using LruList = std::list<std::shared_ptr<const Blob>>;
+
+  // Forbidden copy constructor and assignment operator
+  BlobCache(const BlobCache&) = delete;
+  BlobCache& operator=(const BlobCache&) = delete;
+
+  /**
+   * Evict the least recently used Blobs until the cache holds at most
+   * maxBytes.  mutex_ must be held.
+   */
+  void evictLocked(size_t maxBytes);
+
+  std::atomic<size_t> maxBytes_{0};
+
+  mutable std::mutex mutex_;
+  /** The cached Blobs, most recently used first.  Protected by mutex_. */
+  LruList lru_;
+  std::unordered_map<Hash, LruList::iterator> index_;
+  BlobCacheStats stats_;
+};
+}
+} // facebook::eden
@@ -0,0 +1,217 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "BlobPack.h"
+
+#include <folly/Conv.h>
+#include <folly/Exception.h>
+#include <folly/File.h>
+#include <folly/FileUtil.h>
+#include <folly/io/IOBuf.h>
+#include <glog/logging.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+#include "eden/fs/model/Blob.h"
+
+using folly::checkUnixError;
+using folly::IOBuf;
+using std::shared_ptr;
+
+namespace facebook {
+namespace eden {
+
+/**
+ * A fixed size, append-only file mapped read-only into memory.
+ *
+ * Data is written with pwrite() rather than through the mapping, so a full
+ * disk shows up as an error from append() instead of a SIGBUS on a later
+ * read.
+ */
+class BlobPack::Segment {
+ public:
+  Segment(AbsolutePathPiece directory, uint64_t number, size_t size)
+      : number_(number), size_(size) {
+    auto name = folly::to<std::string>("blobpack.", getpid(), ".", number);
+    auto path = directory + PathComponentPiece{name};
+    file_ = folly::File(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    // Only the mapping is needed from here on, and unlinking now means the
+    // space is given back however the process exits.
+    checkUnixError(unlink(path.c_str()), "unable to unlink ", path);
+    checkUnixError(ftruncate(file_.fd(), size_), "unable to size ", path);
+    auto addr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, file_.fd(), 0);
+    checkUnixError(
+        addr == MAP_FAILED ? -1 : 0, "unable to map blob pack segment ", path);
+    data_ = static_cast<const uint8_t*>(addr);
+  }
+
+  ~Segment() {
+    munmap(const_cast<uint8_t*>(data_), size_);
+  }
+
+  uint64_t getNumber() const {
+    return number_;
+  }
+
+  const uint8_t* getData() const {
+    return data_;
+  }
+
+  bool hasRoomFor(size_t length) const {
+    return length <= size_ - used_;
+  }
+
+  /**
+   * Copy data to the end of the segment and return the offset it was
+   * written at.
+   */
+  size_t append(const Hash& id, const uint8_t* data, size_t length) {
+    DCHECK(hasRoomFor(length));
+    auto offset = used_;
+    auto written = folly::pwriteFull(file_.fd(), data, length, offset);
+    checkUnixError(written, "error writing to blob pack segment");
+    used_ += length;
+    ids_.push_back(id);
+    return offset;
+  }
+
+  /** The IDs of all Blobs ever appended to this segment. */
+  const std::vector<Hash>& getIds() const {
+    return ids_;
+  }
+
+ private:
+  Segment(const Segment&) = delete;
+  Segment& operator=(const Segment&) = delete;
+
+  const uint64_t number_;
+  const size_t size_;
+  folly::File file_;
+  const uint8_t* data_{nullptr};
+  size_t used_{0};
+  std::vector<Hash> ids_;
+};
+
+BlobPack::BlobPack(
+    AbsolutePathPiece directory,
+    size_t maxBytes,
+    size_t segmentSize)
+    : directory_(directory),
+      segmentSize_(segmentSize),
+      maxSegments_(segmentSize == 0 ? 0 : maxBytes / segmentSize) {}
+
+BlobPack::~BlobPack() {}
+
+shared_ptr<const Blob> BlobPack::get(const Hash& id) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = index_.find(id);
+  if (it == index_.end()) {
+    ++stats_.misses;
+    return nullptr;
+  }
+
+  ++stats_.hits;
+  // Take a copy, which keeps the old segment mapped while the data is copied
+  // out of it, even if making room drops it from the pack.
+  auto location = it->second;
+  if (isNearEviction(*location.segment)) {
+    location = append(
+        id, location.segment->getData() + location.offset, location.length);
+    index_[id] = location;
+    ++stats_.promotions;
+  }
+  return makeBlob(id, location);
+}
+
+shared_ptr<const Blob> BlobPack::insert(const Blob& blob) {
+  const auto& contents = blob.getContents();
+  auto length = contents.computeChainDataLength();
+  if (maxSegments_ == 0 || length > segmentSize_) {
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  const auto& id = blob.getHash();
+  auto it = index_.find(id);
+  if (it != index_.end()) {
+    return makeBlob(id, it->second);
+  }
+
+  Location location;
+  if (contents.isChained()) {
+    auto copy = contents.clone();
+    location = append(id, copy->coalesce().data(), length);
+  } else {
+    location = append(id, contents.data(), length);
+  }
+  index_.emplace(id, location);
+  return makeBlob(id, location);
+}
+
+BlobPackStats BlobPack::getStats() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto result = stats_;
+  result.numEntries = index_.size();
+  result.numSegments = segments_.size();
+  return result;
+}
+
+BlobPack::Location
+BlobPack::append(const Hash& id, const uint8_t* data, size_t length) {
+  if (segments_.empty() || !segments_.back()->hasRoomFor(length)) {
+    if (segments_.size() >= maxSegments_) {
+      auto victim = std::move(segments_.front());
+      segments_.pop_front();
+      for (const auto& victimId : victim->getIds()) {
+        auto it = index_.find(victimId);
+        if (it != index_.end() && it->second.segment == victim) {
+          index_.erase(it);
+          ++stats_.evictions;
+        }
+      }
+    }
+    segments_.push_back(std::make_shared<Segment>(
+        directory_, nextSegmentNumber_++, segmentSize_));
+  }
+
+  const auto& segment = segments_.back();
+  auto offset = segment->append(id, data, length);
+  return Location{segment, offset, length};
+}
+
+bool BlobPack::isNearEviction(const Segment& segment) const {
+  // Only copy Blobs forward once the pack is full, and only out of the
+  // oldest quarter of it, so that each hot Blob is copied at most once per
+  // trip through the pack.
+  if (segments_.size() < maxSegments_ || &segment == segments_.back().get()) {
+    return false;
+  }
+  auto oldest = segments_.front()->getNumber();
+  auto nearCount = std::max<size_t>(1, maxSegments_ / 4);
+  return segment.getNumber() < oldest + nearCount;
+}
+
+shared_ptr<const Blob> BlobPack::makeBlob(
+    const Hash& id,
+    const Location& location) {
+  // The IOBuf holds a reference to the segment so that its pages stay
+  // mapped as long as the Blob is in use.
+  auto* holder = new shared_ptr<Segment>(location.segment);
+  IOBuf buf(
+      IOBuf::TAKE_OWNERSHIP,
+      const_cast<uint8_t*>(location.segment->getData() + location.offset),
+      location.length,
+      [](void* /* buf */, void* userData) {
+        delete static_cast<shared_ptr<Segment>*>(userData);
+      },
+      holder);
+  return std::make_shared<Blob>(id, std::move(buf));
+}
+}
+} // facebook::eden
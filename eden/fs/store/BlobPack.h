@@ -0,0 +1,136 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "eden/fs/model/Hash.h"
+#include "eden/utils/PathFuncs.h"
+
+namespace facebook {
+namespace eden {
+
+class Blob;
+
+/**
+ * Statistics about a BlobPack.
+ */
+struct BlobPackStats {
+  /** The number of lookups that found the Blob in the pack */
+  uint64_t hits{0};
+  /** The number of lookups that did not find the Blob in the pack */
+  uint64_t misses{0};
+  /** The number of Blobs dropped along with the oldest segment */
+  uint64_t evictions{0};
+  /** The number of Blobs copied forward to keep them in the pack */
+  uint64_t promotions{0};
+  /** The number of Blobs currently in the pack */
+  size_t numEntries{0};
+  /** The number of segments currently in the pack */
+  size_t numSegments{0};
+};
+
+/**
+ * BlobPack keeps the contents of hot Blobs in memory-mapped files.
+ *
+ * Blobs read from the LocalStore have to be copied out of RocksDB into a
+ * heap allocated buffer on every load.  Blobs in the pack are instead
+ * returned as IOBufs that point straight at the mapped pages, so loading
+ * them costs no copy, and their memory is page cache that the kernel can
+ * reclaim under pressure rather than anonymous memory.
+ *
+ * The pack is append-only.  It is split into fixed size segment files, and
+ * Blobs are appended to the newest one.  Once the pack holds maxBytes of
+ * segments the oldest segment is dropped as a whole to make room.  A Blob
+ * found in one of the oldest segments is copied forward into the newest
+ * one, so Blobs that are still being read survive, which approximates
+ * least recently used eviction without any per-read bookkeeping.
+ *
+ * The segment files are unlinked as soon as they are created, so the pack
+ * never outlives the process and needs no cleanup after a crash.  IOBufs
+ * returned by get() keep their segment mapped until they are destroyed,
+ * even after the segment has been dropped from the pack.
+ *
+ * BlobPack is thread-safe.  It is shared by all mount points.
+ */
+class BlobPack {
+ public:
+  /**
+   * Create a BlobPack that keeps its segment files in directory.
+   *
+   * The pack uses up to maxBytes of space, in segments of segmentSize
+   * bytes.  Blobs larger than a segment are never stored.
+   */
+  BlobPack(AbsolutePathPiece directory, size_t maxBytes, size_t segmentSize);
+  virtual ~BlobPack();
+
+  /**
+   * Look up a Blob by ID.
+   *
+   * Returns nullptr if the Blob is not in the pack.  The returned Blob's
+   * contents refer to the mapped segment rather than a copy.
+   */
+  std::shared_ptr<const Blob> get(const Hash& id);
+
+  /**
+   * Add a Blob to the pack, dropping the oldest segment if necessary.
+   *
+   * Returns a Blob with the same contents backed by the pack, which callers
+   * should use in place of the original so that the copy can be freed, or
+   * nullptr if the Blob is too large to be stored.
+   */
+  std::shared_ptr<const Blob> insert(const Blob& blob);
+
+  /**
+   * Get a snapshot of the pack statistics.
+   */
+  BlobPackStats getStats() const;
+
+ private:
+  class Segment;
+
+  struct Location {
+    std::shared_ptr<Segment> segment;
+    size_t offset;
+    size_t length;
+  };
+
+  // Forbidden copy constructor and assignment operator
+  BlobPack(const BlobPack&) = delete;
+  BlobPack& operator=(const BlobPack&) = delete;
+
+  /**
+   * Copy data into the newest segment, starting a new segment first if it
+   * does not fit.  The caller must hold mutex_.
+   */
+  Location append(const Hash& id, const uint8_t* data, size_t length);
+
+  /** Returns true if segment is one of the next to be dropped. */
+  bool isNearEviction(const Segment& segment) const;
+
+  static std::shared_ptr<const Blob> makeBlob(
+      const Hash& id,
+      const Location& location);
+
+  const AbsolutePath directory_;
+  const size_t segmentSize_{0};
+  const size_t maxSegments_{0};
+
+  mutable std::mutex mutex_;
+  /** The segments, oldest first.  Protected by mutex_. */
+  std::deque<std::shared_ptr<Segment>> segments_;
+  std::unordered_map<Hash, Location> index_;
+  uint64_t nextSegmentNumber_{0};
+  BlobPackStats stats_;
+};
+}
+} // facebook::eden
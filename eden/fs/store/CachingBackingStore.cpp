@@ -0,0 +1,204 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "CachingBackingStore.h"
+
+#include <folly/Conv.h>
+#include <folly/ExceptionWrapper.h>
+#include <folly/String.h>
+#include <folly/futures/Future.h>
+#include <folly/futures/Promise.h>
+#include <glog/logging.h>
+#include <algorithm>
+#include "common/stats/ServiceData.h"
+#include "eden/fs/model/Blob.h"
+#include "eden/fs/model/Hash.h"
+#include "eden/fs/model/NativeTree.h"
+#include "eden/fs/model/Tree.h"
+#include "eden/fs/store/LocalStore.h"
+#include "eden/utils/CancellationToken.h"
+
+using folly::Future;
+using folly::IOBuf;
+using folly::Optional;
+using folly::makeFuture;
+using std::unique_ptr;
+using std::vector;
+
+namespace facebook {
+namespace eden {
+
+using ObjectType = SharedObjectCache::ObjectType;
+
+CachingBackingStore::CachingBackingStore(
+    std::shared_ptr<BackingStore> inner,
+    std::shared_ptr<SharedObjectCache> cache,
+    LocalStore* localStore,
+    bool cacheTrees,
+    std::chrono::milliseconds timeout,
+    size_t maxBatchSize)
+    : inner_{std::move(inner)},
+      cache_{std::move(cache)},
+      localStore_{localStore},
+      cacheTrees_{cacheTrees},
+      timeout_{timeout},
+      maxBatchSize_{std::max<size_t>(maxBatchSize, 1)} {}
+
+CachingBackingStore::~CachingBackingStore() {}
+
+Future<vector<Optional<IOBuf>>> CachingBackingStore::lookup(
+    ObjectType type,
+    const vector<Hash>& ids) {
+  auto numIds = ids.size();
+  auto missing = [numIds](const folly::exception_wrapper& ew) {
+    VLOG(2) << "shared object cache lookup failed: "
+            << folly::exceptionStr(ew);
+    fbData->incrementCounter("shared_object_cache.error");
+    return vector<Optional<IOBuf>>(numIds);
+  };
+
+  return folly::makeFutureWith([&] { return cache_->get(type, ids); })
+      .within(timeout_)
+      .then([numIds](vector<Optional<IOBuf>>&& results) {
+        if (results.size() != numIds) {
+          throw std::runtime_error(folly::to<std::string>(
+              "shared object cache returned ",
+              results.size(),
+              " results for ",
+              numIds,
+              " objects"));
+        }
+        return std::move(results);
+      })
+      .onError(missing);
+}
+
+Future<unique_ptr<Tree>> CachingBackingStore::getTree(const Hash& id) {
+  if (!cacheTrees_) {
+    return inner_->getTree(id);
+  }
+
+  // The current token may only be current for the duration of this call,
+  // e.g. one installed by an InFlightMap, so make it current again for the
+  // inner fetch.
+  auto token = CancellationToken::getCurrent();
+  return lookup(ObjectType::TREE, {id}).then(
+      [this, id, token](vector<Optional<IOBuf>>&& found) {
+        if (found[0]) {
+          try {
+            auto tree = deserializeNativeTree(id, found[0]->coalesce());
+            localStore_->putTree(tree.get());
+            fbData->incrementCounter("shared_object_cache.tree.hit");
+            return makeFuture(std::move(tree));
+          } catch (const std::exception& ex) {
+            VLOG(2) << "ignoring invalid tree " << id
+                    << " from the shared object cache: "
+                    << folly::exceptionStr(ex);
+          }
+        }
+
+        fbData->incrementCounter("shared_object_cache.tree.miss");
+        CancellationToken::Scope scope(token);
+        return inner_->getTree(id).then(
+            [cache = cache_, id](unique_ptr<Tree> tree) {
+              if (tree) {
+                cache->put(ObjectType::TREE, id, serializeNativeTree(*tree));
+              }
+              return tree;
+            });
+      });
+}
+
+Future<unique_ptr<Blob>> CachingBackingStore::getBlob(const Hash& id) {
+  return std::move(getBlobs({id}).front());
+}
+
+vector<Future<unique_ptr<Blob>>> CachingBackingStore::getBlobs(
+    const vector<Hash>& ids) {
+  using BlobPromises = vector<folly::Promise<unique_ptr<Blob>>>;
+  auto promises = std::make_shared<BlobPromises>(ids.size());
+  vector<Future<unique_ptr<Blob>>> results;
+  results.reserve(ids.size());
+  for (auto& promise : *promises) {
+    results.push_back(promise.getFuture());
+  }
+
+  // As in getTree(), make the current token current again for the inner
+  // fetches.
+  auto token = CancellationToken::getCurrent();
+  for (size_t start = 0; start < ids.size(); start += maxBatchSize_) {
+    auto end = std::min(start + maxBatchSize_, ids.size());
+    vector<Hash> batch(ids.begin() + start, ids.begin() + end);
+    lookup(ObjectType::BLOB, batch)
+        .then([this, promises, start, batch, token](
+                  vector<Optional<IOBuf>>&& found) {
+          vector<Hash> missingIds;
+          vector<size_t> missingIndexes;
+          for (size_t n = 0; n < batch.size(); ++n) {
+            if (found[n]) {
+              fbData->incrementCounter("shared_object_cache.blob.hit");
+              (*promises)[start + n].setValue(
+                  std::make_unique<Blob>(batch[n], std::move(*found[n])));
+            } else {
+              missingIds.push_back(batch[n]);
+              missingIndexes.push_back(start + n);
+            }
+          }
+          if (missingIds.empty()) {
+            return;
+          }
+
+          fbData->incrementCounter(
+              "shared_object_cache.blob.miss", missingIds.size());
+          CancellationToken::Scope scope(token);
+          auto fetched = inner_->getBlobs(missingIds);
+          for (size_t n = 0; n < fetched.size(); ++n) {
+            auto index = missingIndexes[n];
+            fetched[n]
+                .then([cache = cache_, id = missingIds[n]](
+                          unique_ptr<Blob> blob) {
+                  if (blob) {
+                    cache->put(ObjectType::BLOB, id, blob->getContents());
+                  }
+                  return blob;
+                })
+                .then([promises, index](folly::Try<unique_ptr<Blob>>&& t) {
+                  (*promises)[index].setTry(std::move(t));
+                });
+          }
+        })
+        .onError([promises, start, end](const folly::exception_wrapper& ew) {
+          // The inner BackingStore failed before returning its Futures, so
+          // any blob in this batch that is still pending gets the error.
+          for (auto index = start; index < end; ++index) {
+            auto& promise = (*promises)[index];
+            if (!promise.isFulfilled()) {
+              promise.setException(ew);
+            }
+          }
+        });
+  }
+  return results;
+}
+
+Future<unique_ptr<Tree>> CachingBackingStore::getTreeForCommit(
+    const Hash& commitID) {
+  return inner_->getTreeForCommit(commitID);
+}
+
+Future<Optional<BlobMetadata>> CachingBackingStore::getBlobMetadata(
+    const Hash& id) {
+  return inner_->getBlobMetadata(id);
+}
+
+bool CachingBackingStore::shouldStoreBlobContents() const {
+  return inner_->shouldStoreBlobContents();
+}
+}
+} // facebook::eden
@@ -0,0 +1,96 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <chrono>
+#include "eden/fs/store/BackingStore.h"
+#include "eden/fs/store/SharedObjectCache.h"
+
+namespace facebook {
+namespace eden {
+
+class LocalStore;
+
+/**
+ * A BackingStore that looks up trees and blobs in a SharedObjectCache before
+ * fetching them from another BackingStore.
+ *
+ * Objects that are not in the shared cache, or that the cache does not
+ * return within the timeout, are fetched from the inner BackingStore and
+ * then added to the shared cache.  Errors from the shared cache are never
+ * reported to callers; they only cause a fallback to the inner store.
+ *
+ * Trees found in the shared cache are stored in the LocalStore, as the
+ * other BackingStores do with the trees they import.  Blobs are stored by
+ * the ObjectStore.
+ *
+ * A Tree from the shared cache is only usable if the inner BackingStore can
+ * fetch the objects it refers to when the cache does not have them.  This
+ * holds when hashes identify contents, as with git, but not for the proxy
+ * hashes that HgBackingStore uses, which are only resolvable on the machine
+ * that imported their tree.  cacheTrees should be false for such stores, in
+ * which case only blobs go through the shared cache.
+ */
+class CachingBackingStore : public BackingStore {
+ public:
+  CachingBackingStore(
+      std::shared_ptr<BackingStore> inner,
+      std::shared_ptr<SharedObjectCache> cache,
+      LocalStore* localStore,
+      bool cacheTrees,
+      std::chrono::milliseconds timeout,
+      size_t maxBatchSize);
+  virtual ~CachingBackingStore();
+
+  folly::Future<std::unique_ptr<Tree>> getTree(const Hash& id) override;
+  folly::Future<std::unique_ptr<Blob>> getBlob(const Hash& id) override;
+  folly::Future<std::unique_ptr<Tree>> getTreeForCommit(
+      const Hash& commitID) override;
+
+  /**
+   * Look up the blobs in the shared cache with one request per
+   * maxBatchSize IDs, and fetch the ones it is missing from the inner
+   * BackingStore with one getBlobs() call per batch.
+   */
+  std::vector<folly::Future<std::unique_ptr<Blob>>> getBlobs(
+      const std::vector<Hash>& ids) override;
+
+  folly::Future<folly::Optional<BlobMetadata>> getBlobMetadata(
+      const Hash& id) override;
+  bool shouldStoreBlobContents() const override;
+
+  const std::shared_ptr<BackingStore>& getInnerStore() const {
+    return inner_;
+  }
+
+ private:
+  // Forbidden copy constructor and assignment operator
+  CachingBackingStore(CachingBackingStore const&) = delete;
+  CachingBackingStore& operator=(CachingBackingStore const&) = delete;
+
+  /**
+   * Look up objects in the shared cache.  The result always has one entry
+   * per ID; if the request fails or times out, all of them are none.
+   */
+  folly::Future<std::vector<folly::Optional<folly::IOBuf>>> lookup(
+      SharedObjectCache::ObjectType type,
+      const std::vector<Hash>& ids);
+
+  folly::Future<std::unique_ptr<Blob>> fetchBlob(const Hash& id);
+
+  std::shared_ptr<BackingStore> inner_;
+  std::shared_ptr<SharedObjectCache> cache_;
+  LocalStore* localStore_{nullptr};
+  bool cacheTrees_{false};
+  std::chrono::milliseconds timeout_;
+  size_t maxBatchSize_{1};
+};
+}
+} // facebook::eden
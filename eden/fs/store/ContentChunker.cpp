@@ -0,0 +1,79 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/store/ContentChunker.h"
+
+#include <folly/Bits.h>
+#include <folly/io/IOBuf.h>
+#include <glog/logging.h>
+#include <array>
+#include <cstdint>
+
+namespace facebook {
+namespace eden {
+
+namespace {
+/**
+ * The random value that the rolling hash mixes in for each byte value.
+ *
+ * The values are generated with splitmix64 from a fixed seed, since the
+ * chunk boundaries of stored blobs must not change between releases.
+ */
+const std::array<uint64_t, 256>& getGearTable() {
+  static const auto table = [] {
+    std::array<uint64_t, 256> values;
+    uint64_t state = 0x6564656e63686e6bULL;
+    for (auto& value : values) {
+      state += 0x9e3779b97f4a7c15ULL;
+      auto z = state;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      value = z ^ (z >> 31);
+    }
+    return values;
+  }();
+  return table;
+}
+}
+
+std::vector<size_t> findContentDefinedChunks(
+    const folly::IOBuf& data,
+    size_t minSize,
+    size_t averageSize,
+    size_t maxSize) {
+  CHECK(folly::isPowTwo(averageSize))
+      << "the average chunk size must be a power of two";
+  CHECK_LE(minSize, maxSize);
+  const auto& gear = getGearTable();
+  // Each byte shifts out of the hash after 64 more, so the top bits depend
+  // on the most bytes.
+  auto maskBits = folly::findLastSet(averageSize) - 1;
+  uint64_t mask = maskBits == 0 ? 0 : ~uint64_t{0} << (64 - maskBits);
+
+  std::vector<size_t> chunks;
+  size_t length = 0;
+  uint64_t hash = 0;
+  for (auto range : data) {
+    for (auto byte : range) {
+      hash = (hash << 1) + gear[byte];
+      ++length;
+      if ((length >= minSize && (hash & mask) == 0) || length >= maxSize) {
+        chunks.push_back(length);
+        length = 0;
+        hash = 0;
+      }
+    }
+  }
+  if (length > 0) {
+    chunks.push_back(length);
+  }
+  return chunks;
+}
+}
+}
@@ -0,0 +1,42 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace folly {
+class IOBuf;
+}
+
+namespace facebook {
+namespace eden {
+
+/**
+ * Split data into chunks at content-defined boundaries, and return the
+ * length of each chunk.
+ *
+ * A boundary is placed wherever a rolling hash of the preceding 64 bytes
+ * has its top log2(averageSize) bits clear, so boundaries depend only on
+ * the nearby contents.  An insertion or deletion only changes the chunks
+ * around it, and the rest of the chunks are the same as those of the
+ * original data.
+ *
+ * Chunks are at least minSize bytes long, apart from the last one, and at
+ * most maxSize bytes long.  averageSize must be a power of two; the actual
+ * average chunk length is roughly minSize + averageSize.
+ */
+std::vector<size_t> findContentDefinedChunks(
+    const folly::IOBuf& data,
+    size_t minSize,
+    size_t averageSize,
+    size_t maxSize);
+}
+}
@@ -0,0 +1,64 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "ImportPriority.h"
+
+#include <folly/io/async/Request.h>
+#include <atomic>
+#include <memory>
+#include <string>
+
+namespace facebook {
+namespace eden {
+
+namespace {
+const std::string kImportPriorityKey("eden.import_priority");
+
+class ImportPriorityData : public folly::RequestData {
+ public:
+  explicit ImportPriorityData(ImportPriority priority) : priority(priority) {}
+
+  std::atomic<ImportPriority> priority;
+};
+
+ImportPriorityData* getImportPriorityData() {
+  return static_cast<ImportPriorityData*>(
+      folly::RequestContext::get()->getContextData(kImportPriorityKey));
+}
+}
+
+folly::StringPiece getImportPriorityName(ImportPriority priority) {
+  switch (priority) {
+    case ImportPriority::INTERACTIVE:
+      return "interactive";
+    case ImportPriority::CHECKOUT:
+      return "checkout";
+    case ImportPriority::PREFETCH:
+      return "prefetch";
+  }
+  return "unknown";
+}
+
+ImportPriority getCurrentImportPriority() {
+  auto* data = getImportPriorityData();
+  return data ? data->priority.load() : ImportPriority::INTERACTIVE;
+}
+
+void setCurrentImportPriority(ImportPriority priority) {
+  // RequestContext refuses to replace existing data, so update it in place.
+  auto* data = getImportPriorityData();
+  if (data) {
+    data->priority.store(priority);
+    return;
+  }
+  folly::RequestContext::get()->setContextData(
+      kImportPriorityKey, std::make_unique<ImportPriorityData>(priority));
+}
+}
+} // facebook::eden
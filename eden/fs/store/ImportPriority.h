@@ -0,0 +1,59 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Range.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace facebook {
+namespace eden {
+
+/**
+ * The priority of a BackingStore fetch, from most to least urgent.
+ *
+ * The priority is a property of the request that causes the fetch, so it is
+ * attached to the folly::RequestContext rather than passed down through the
+ * ObjectStore and BackingStore APIs.  That way it also follows the request
+ * into Future continuations, and fetches shared by several layers do not
+ * each need to know what they are being done for.
+ */
+enum class ImportPriority : uint8_t {
+  /** A user is waiting on the result, e.g. for a FUSE read. */
+  INTERACTIVE,
+  /** Data needed to complete a checkout. */
+  CHECKOUT,
+  /** Speculative fetches, such as an explicit prefetch. */
+  PREFETCH,
+};
+
+constexpr size_t kNumImportPriorities = 3;
+
+/**
+ * Returns a short name for the priority, for use in logs and counter names.
+ */
+folly::StringPiece getImportPriorityName(ImportPriority priority);
+
+/**
+ * Returns the priority of the current request.  Requests that have not set
+ * one are INTERACTIVE.
+ */
+ImportPriority getCurrentImportPriority();
+
+/**
+ * Set the priority of the current request.
+ *
+ * This modifies the current folly::RequestContext, so callers must have a
+ * context of their own, e.g. from a folly::RequestContextScopeGuard, rather
+ * than the process-wide default one.
+ */
+void setCurrentImportPriority(ImportPriority priority);
+}
+} // facebook::eden
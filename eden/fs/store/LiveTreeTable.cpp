@@ -0,0 +1,102 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "LiveTreeTable.h"
+
+#include <algorithm>
+#include "eden/fs/model/Tree.h"
+#include "eden/fs/store/TreeCache.h"
+
+using std::shared_ptr;
+
+namespace facebook {
+namespace eden {
+
+constexpr size_t LiveTreeTable::kDefaultShards;
+constexpr size_t LiveTreeTable::kMinSweepThreshold;
+
+LiveTreeTable::LiveTreeTable(size_t numShards) {
+  numShards = std::max<size_t>(numShards, 1);
+  shards_.reserve(numShards);
+  for (size_t n = 0; n < numShards; ++n) {
+    shards_.push_back(std::make_unique<Shard>());
+  }
+}
+
+LiveTreeTable::~LiveTreeTable() {}
+
+LiveTreeTable::Shard& LiveTreeTable::getShard(const Hash& id) {
+  return *shards_[std::hash<Hash>()(id) % shards_.size()];
+}
+
+shared_ptr<const Tree> LiveTreeTable::get(const Hash& id) {
+  auto& shard = getShard(id);
+  std::lock_guard<std::mutex> guard(shard.mutex);
+  auto it = shard.trees.find(id);
+  shared_ptr<const Tree> tree;
+  if (it != shard.trees.end()) {
+    tree = it->second.lock();
+  }
+  if (tree) {
+    ++shard.hits;
+  } else {
+    ++shard.misses;
+  }
+  return tree;
+}
+
+shared_ptr<const Tree> LiveTreeTable::intern(shared_ptr<const Tree> tree) {
+  auto& shard = getShard(tree->getHash());
+  std::lock_guard<std::mutex> guard(shard.mutex);
+  auto& entry = shard.trees[tree->getHash()];
+  auto existing = entry.lock();
+  if (existing) {
+    // Trees are immutable, so the one already in use is just as good.
+    ++shard.hits;
+    return existing;
+  }
+
+  ++shard.misses;
+  entry = tree;
+  if (shard.trees.size() >= shard.sweepThreshold) {
+    sweepLocked(shard);
+    shard.sweepThreshold =
+        std::max(shard.trees.size() * 2, kMinSweepThreshold);
+  }
+  return tree;
+}
+
+void LiveTreeTable::sweepLocked(Shard& shard) {
+  for (auto it = shard.trees.begin(); it != shard.trees.end();) {
+    if (it->second.expired()) {
+      it = shard.trees.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+LiveTreeTableStats LiveTreeTable::getStats() const {
+  LiveTreeTableStats result;
+  for (const auto& shard : shards_) {
+    std::lock_guard<std::mutex> guard(shard->mutex);
+    result.hits += shard->hits;
+    result.misses += shard->misses;
+    for (const auto& entry : shard->trees) {
+      auto tree = entry.second.lock();
+      if (tree) {
+        ++result.numTrees;
+        result.totalBytes += TreeCache::estimateSize(*tree);
+      }
+    }
+  }
+  return result;
+}
+}
+} // facebook::eden
@@ -0,0 +1,108 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "eden/fs/model/Hash.h"
+
+namespace facebook {
+namespace eden {
+
+class Tree;
+
+/**
+ * Statistics about a LiveTreeTable.
+ */
+struct LiveTreeTableStats {
+  /** The number of lookups that found a Tree already in use */
+  uint64_t hits{0};
+  /** The number of lookups that did not */
+  uint64_t misses{0};
+  /** The number of distinct Trees currently in use */
+  size_t numTrees{0};
+  /** The estimated memory used by the Trees currently in use */
+  size_t totalBytes{0};
+};
+
+/**
+ * LiveTreeTable tracks every Tree that is currently in use by any mount
+ * point, so that mounts of the same repository at the same or nearby commits
+ * share one copy of each Tree rather than loading their own.
+ *
+ * The unmaterialized TreeInodes of every mount keep a reference to the Tree
+ * they were loaded from, and borrow their entry names from it, so sharing
+ * the Trees means that only the per-inode state and local modifications
+ * cost memory in each additional mount.
+ *
+ * The table only holds weak references.  A Tree stays in it for as long as
+ * something else, such as a TreeInode or a TreeCache, still references it,
+ * and no longer.  Entries for Trees that have been freed are swept out as
+ * the table grows.
+ *
+ * LiveTreeTable is thread-safe.  It is shared by all mount points.
+ */
+class LiveTreeTable {
+ public:
+  explicit LiveTreeTable(size_t numShards = kDefaultShards);
+  virtual ~LiveTreeTable();
+
+  /**
+   * Look up a Tree by ID.
+   *
+   * Returns nullptr if no Tree with that ID is currently in use.
+   */
+  std::shared_ptr<const Tree> get(const Hash& id);
+
+  /**
+   * Return the Tree with the same ID as tree if one is already in use, or
+   * else add tree to the table and return it.
+   *
+   * Callers should use the returned Tree in place of their own copy.
+   */
+  std::shared_ptr<const Tree> intern(std::shared_ptr<const Tree> tree);
+
+  /**
+   * Get a snapshot of the table statistics, summed over all shards.
+   */
+  LiveTreeTableStats getStats() const;
+
+  static constexpr size_t kDefaultShards = 16;
+
+ private:
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<Hash, std::weak_ptr<const Tree>> trees;
+    /** Sweep out expired entries once trees reaches this size. */
+    size_t sweepThreshold{kMinSweepThreshold};
+    uint64_t hits{0};
+    uint64_t misses{0};
+  };
+
+  // Forbidden copy constructor and assignment operator
+  LiveTreeTable(const LiveTreeTable&) = delete;
+  LiveTreeTable& operator=(const LiveTreeTable&) = delete;
+
+  Shard& getShard(const Hash& id);
+
+  /**
+   * Erase the entries of Trees that have been freed.  The shard's mutex must
+   * be held.
+   */
+  static void sweepLocked(Shard& shard);
+
+  static constexpr size_t kMinSweepThreshold = 64;
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+}
+} // facebook::eden
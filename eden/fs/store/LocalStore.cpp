@@ -11,19 +11,36 @@
 
 #include <folly/Bits.h>
 #include <folly/Format.h>
+#include <folly/Hash.h>
 #include <folly/Optional.h>
+#include <folly/Random.h>
+#include <folly/SpookyHashV2.h>
+#include <folly/ScopeGuard.h>
 #include <folly/String.h>
 #include <folly/io/Cursor.h>
 #include <folly/io/IOBuf.h>
+#include <folly/ssl/OpenSSLHash.h>
+#include <rocksdb/cache.h>
 #include <rocksdb/db.h>
+#include <rocksdb/filter_policy.h>
+#include <rocksdb/metadata.h>
+#include <rocksdb/slice_transform.h>
+#include <rocksdb/table.h>
+#include <rocksdb/utilities/write_batch_with_index.h>
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cstring>
 #include "eden/fs/model/Blob.h"
+#include "eden/fs/model/NativeTree.h"
 #include "eden/fs/model/Tree.h"
 #include "eden/fs/model/git/GitBlob.h"
 #include "eden/fs/model/git/GitTree.h"
 #include "eden/fs/rocksdb/RocksDbUtil.h"
 #include "eden/fs/rocksdb/RocksException.h"
+#include "eden/fs/store/ContentChunker.h"
 #include "eden/fs/store/StoreResult.h"
+#include "eden/fs/store/StoreStats.h"
 
 using facebook::eden::Hash;
 using folly::ByteRange;
@@ -35,6 +52,8 @@ using rocksdb::ReadOptions;
 using rocksdb::Slice;
 using rocksdb::SliceParts;
 using rocksdb::WriteBatch;
+using rocksdb::WriteBatchBase;
+using rocksdb::WriteBatchWithIndex;
 using rocksdb::WriteOptions;
 using std::string;
 using std::unique_ptr;
@@ -43,34 +62,202 @@ namespace {
 using namespace facebook::eden;
 
 /**
- * For each blob, we also store an entry containing the blob metadata.
- * This is stored under a key that is the blob's key plus the
- * ATTRIBUTE_METADATA suffix.
- *
- * (We should potentially switch to RocksDB column families instead in the
- * future, rather than using a key suffix.)
+ * Static information about each of the LocalStore key spaces.
  */
-const unsigned char ATTRIBUTE_METADATA = 'x';
+struct KeySpaceInfo {
+  /** The name of the RocksDB column family */
+  const char* name;
+  /**
+   * The suffix older versions of eden appended to keys in this key space,
+   * when all objects were stored in the default column family.
+   */
+  StringPiece legacySuffix;
+  /** Whether older versions of eden stored this key space at all */
+  bool hasLegacyData;
+};
 
-class BlobMetadataKey {
- public:
-  explicit BlobMetadataKey(const Hash& id) {
-    memcpy(key_.data(), id.getBytes().data(), Hash::RAW_SIZE);
-    key_[Hash::RAW_SIZE] = ATTRIBUTE_METADATA;
+constexpr KeySpaceInfo kKeySpaces[] = {
+    {"blob", "", true},
+    {"blobmeta", "x", true},
+    {"tree", "", true},
+    {"hgproxyhash", "hgx", true},
+    {"hgcommit2tree", "hgc", true},
+    {"blobaccess", "", false},
+    {"blobchunk", "", false},
+};
+static_assert(
+    sizeof(kKeySpaces) / sizeof(kKeySpaces[0]) == LocalStore::KeySpace::End,
+    "there must be one KeySpaceInfo per LocalStore::KeySpace");
+
+rocksdb::CompressionType toRocksCompression(LocalStoreCompression compression) {
+  switch (compression) {
+    case LocalStoreCompression::None:
+      return rocksdb::kNoCompression;
+    case LocalStoreCompression::Snappy:
+      return rocksdb::kSnappyCompression;
+    case LocalStoreCompression::LZ4:
+      return rocksdb::kLZ4Compression;
+    case LocalStoreCompression::Zstd:
+      return rocksdb::kZSTD;
   }
+  throw std::invalid_argument(folly::to<string>(
+      "unknown local store compression ", static_cast<int>(compression)));
+}
 
-  ByteRange bytes() const {
-    return ByteRange(key_.data(), key_.size());
+StringPiece rocksCompressionName(LocalStoreCompression compression) {
+  switch (compression) {
+    case LocalStoreCompression::None:
+      return "kNoCompression";
+    case LocalStoreCompression::Snappy:
+      return "kSnappyCompression";
+    case LocalStoreCompression::LZ4:
+      return "kLZ4Compression";
+    case LocalStoreCompression::Zstd:
+      return "kZSTD";
+  }
+  throw std::invalid_argument(folly::to<string>(
+      "unknown local store compression ", static_cast<int>(compression)));
+}
+
+/**
+ * The first two levels are never compressed.  Data there is about to be
+ * compacted again, so compressing it would only cost CPU, and most of the
+ * data, which is what takes up the disk space, lives in the lower levels.
+ */
+constexpr int kNumUncompressedLevels = 2;
+
+std::vector<rocksdb::CompressionType> compressionPerLevel(
+    LocalStoreCompression compression,
+    int numLevels) {
+  std::vector<rocksdb::CompressionType> levels;
+  for (int level = 0; level < numLevels; ++level) {
+    levels.push_back(
+        level < kNumUncompressedLevels ? rocksdb::kNoCompression
+                                       : toRocksCompression(compression));
+  }
+  return levels;
+}
+
+/**
+ * The initial compression for each key space.  Only blobs and trees are
+ * configurable; everything else is small and hash-like, so it doesn't
+ * compress.
+ */
+LocalStoreCompression initialCompression(
+    LocalStore::KeySpace keySpace,
+    const LocalStoreOptions& storeOptions) {
+  switch (keySpace) {
+    case LocalStore::BlobFamily:
+      return storeOptions.blobCompression;
+    case LocalStore::TreeFamily:
+      return storeOptions.treeCompression;
+    default:
+      return LocalStoreCompression::None;
+  }
+}
+
+/**
+ * Blobs get their own block cache, so that streaming a lot of blob data does
+ * not evict trees and metadata, which share the other block cache.  Blob
+ * contents are also cached in memory above the LocalStore, so the blob block
+ * cache can be comparatively small.
+ */
+rocksdb::ColumnFamilyOptions makeColumnOptions(
+    LocalStore::KeySpace keySpace,
+    const LocalStoreOptions& storeOptions,
+    const std::shared_ptr<rocksdb::Cache>& blockCache,
+    const std::shared_ptr<rocksdb::Cache>& blobBlockCache) {
+  auto isBlob = keySpace == LocalStore::BlobFamily;
+  auto writeBufferSize = isBlob ? storeOptions.blobWriteBufferSize
+                                : storeOptions.writeBufferSize;
+
+  rocksdb::ColumnFamilyOptions options;
+  options.OptimizeLevelStyleCompaction(writeBufferSize * 4);
+  options.compression_per_level = compressionPerLevel(
+      initialCompression(keySpace, storeOptions), options.num_levels);
+  if (isBlob && storeOptions.blobCompression == LocalStoreCompression::Zstd) {
+    options.compression_opts.max_dict_bytes =
+        storeOptions.blobCompressionDictionarySize;
+  }
+
+  rocksdb::BlockBasedTableOptions tableOptions;
+  if (storeOptions.bloomFilterBitsPerKey > 0) {
+    tableOptions.filter_policy.reset(
+        rocksdb::NewBloomFilterPolicy(storeOptions.bloomFilterBitsPerKey));
+  }
+  if (isBlob) {
+    // Blobs are comparatively large, so use larger blocks to keep the index
+    // small.
+    tableOptions.block_cache = blobBlockCache;
+    tableOptions.block_size = 64 * 1024;
+  } else {
+    // Everything else is small and only ever looked up by its full key, so
+    // use a hash index, as ColumnFamilyOptions::OptimizeForPointLookup()
+    // would.
+    tableOptions.block_cache = blockCache;
+    tableOptions.index_type = rocksdb::BlockBasedTableOptions::kHashSearch;
+    options.prefix_extractor.reset(rocksdb::NewNoopTransform());
+  }
+  options.table_factory.reset(rocksdb::NewBlockBasedTableFactory(tableOptions));
+  return options;
+}
+
+/**
+ * Reads record their access time for one in this many blobs.  Writes always
+ * record it.  This keeps the cost of tracking low, while blobs that are read
+ * often are still very likely to have a recent access time.
+ */
+constexpr uint32_t kBlobAccessSampleRate = 16;
+
+/**
+ * The number of evictions collectGarbage() puts in each write batch.
+ */
+constexpr size_t kGcBatchSize = 1024;
+
+/**
+ * The BlobAccessFamily value for a blob: the time it was last accessed, in
+ * seconds since the epoch, followed by its uncompressed size.  Both are
+ * stored as big-endian 64-bit integers.
+ */
+class SerializedBlobAccess {
+ public:
+  SerializedBlobAccess(uint64_t accessTime, uint64_t size) {
+    accessTime = folly::Endian::big(accessTime);
+    size = folly::Endian::big(size);
+    memcpy(data_.data(), &accessTime, sizeof(uint64_t));
+    memcpy(data_.data() + sizeof(uint64_t), &size, sizeof(uint64_t));
   }
 
   Slice slice() const {
-    return Slice{reinterpret_cast<const char*>(key_.data()), key_.size()};
+    return Slice{reinterpret_cast<const char*>(data_.data()), data_.size()};
+  }
+
+  /**
+   * Parse a serialized access record, returning false if it is malformed.
+   */
+  static bool parse(Slice value, uint64_t* accessTime, uint64_t* size) {
+    if (value.size() != SIZE) {
+      return false;
+    }
+    memcpy(accessTime, value.data(), sizeof(uint64_t));
+    memcpy(size, value.data() + sizeof(uint64_t), sizeof(uint64_t));
+    *accessTime = folly::Endian::big(*accessTime);
+    *size = folly::Endian::big(*size);
+    return true;
   }
 
  private:
-  std::array<uint8_t, Hash::RAW_SIZE + 1> key_;
+  static constexpr size_t SIZE = 2 * sizeof(uint64_t);
+
+  std::array<uint8_t, SIZE> data_;
 };
 
+uint64_t currentAccessTime() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
 class SerializedBlobMetadata {
  public:
   explicit SerializedBlobMetadata(const BlobMetadata& metadata) {
@@ -124,13 +311,79 @@ rocksdb::Slice _createSlice(folly::ByteRange bytes) {
   return Slice(reinterpret_cast<const char*>(bytes.data()), bytes.size());
 }
 
+std::vector<rocksdb::ColumnFamilyDescriptor> makeColumnDescriptors(
+    const LocalStoreOptions& storeOptions) {
+  auto blockCache = rocksdb::NewLRUCache(storeOptions.blockCacheSize);
+  auto blobBlockCache = rocksdb::NewLRUCache(storeOptions.blobBlockCacheSize);
+
+  std::vector<rocksdb::ColumnFamilyDescriptor> columns;
+  // The default column family must always be opened.  It only contains data
+  // written by older versions of eden.
+  columns.emplace_back(
+      rocksdb::kDefaultColumnFamilyName, rocksdb::ColumnFamilyOptions());
+  for (size_t n = 0; n < LocalStore::KeySpace::End; ++n) {
+    auto keySpace = static_cast<LocalStore::KeySpace>(n);
+    columns.emplace_back(
+        kKeySpaces[n].name,
+        makeColumnOptions(
+            keySpace, storeOptions, blockCache, blobBlockCache));
+  }
+  return columns;
+}
+
+rocksdb::DBOptions makeDbOptions(const LocalStoreOptions& storeOptions) {
+  rocksdb::DBOptions options;
+  options.IncreaseParallelism(std::max(storeOptions.backgroundThreads, 1));
+  options.use_direct_io_for_flush_and_compaction =
+      storeOptions.useDirectIoForCompaction;
+  return options;
+}
+
 }
 
 namespace facebook {
 namespace eden {
 
-LocalStore::LocalStore(AbsolutePathPiece pathToRocksDb)
-    : db_(createRocksDb(pathToRocksDb.stringPiece())) {}
+LocalStoreCompression parseLocalStoreCompression(StringPiece name) {
+  if (name == "none") {
+    return LocalStoreCompression::None;
+  } else if (name == "snappy") {
+    return LocalStoreCompression::Snappy;
+  } else if (name == "lz4") {
+    return LocalStoreCompression::LZ4;
+  } else if (name == "zstd") {
+    return LocalStoreCompression::Zstd;
+  }
+  throw std::invalid_argument(
+      folly::to<string>("unknown local store compression \"", name, "\""));
+}
+
+LocalStore::LocalStore(
+    AbsolutePathPiece pathToRocksDb,
+    const LocalStoreOptions& options)
+    : dbHandles_(std::make_unique<RocksHandles>(
+          pathToRocksDb.stringPiece(),
+          makeDbOptions(options),
+          makeColumnDescriptors(options))),
+      contentDefinedBlobChunks_(options.contentDefinedBlobChunks) {
+  {
+    auto compression = compression_.wlock();
+    for (size_t n = 0; n < KeySpace::End; ++n) {
+      (*compression)[n] =
+          initialCompression(static_cast<KeySpace>(n), options);
+    }
+  }
+
+  unique_ptr<rocksdb::Iterator> it(dbHandles_->db->NewIterator(
+      ReadOptions(), dbHandles_->db->DefaultColumnFamily()));
+  it->SeekToFirst();
+  hasLegacyData_ = it->Valid();
+  if (hasLegacyData_) {
+    LOG(INFO) << "local store " << pathToRocksDb
+              << " contains data from an older version of eden; "
+                 "falling back to it for objects not found elsewhere";
+  }
+}
 
 LocalStore::~LocalStore() {
 #ifdef FOLLY_SANITIZE_ADDRESS
@@ -147,14 +400,24 @@ LocalStore::~LocalStore() {
 #endif
 }
 
-StoreResult LocalStore::get(ByteRange key) const {
-  string value;
-  flushForRead();
-  auto status = db_.get()->Get(ReadOptions(), _createSlice(key), &value);
+StringPiece LocalStore::getKeySpaceName(KeySpace keySpace) {
+  return kKeySpaces[keySpace].name;
+}
+
+rocksdb::ColumnFamilyHandle* LocalStore::getColumn(KeySpace keySpace) const {
+  // Column 0 is the default column family.
+  return dbHandles_->columns[keySpace + 1].get();
+}
+
+bool LocalStore::lookupInColumn(
+    rocksdb::ColumnFamilyHandle* column,
+    ByteRange key,
+    rocksdb::PinnableSlice* value) const {
+  auto status =
+      dbHandles_->db->Get(ReadOptions(), column, _createSlice(key), value);
   if (!status.ok()) {
     if (status.IsNotFound()) {
-      // Return an empty StoreResult
-      return StoreResult();
+      return false;
     }
 
     // TODO: RocksDB can return a "TryAgain" error.
@@ -165,47 +428,392 @@ StoreResult LocalStore::get(ByteRange key) const {
     throw RocksException::build(
         status, "failed to get ", folly::hexlify(key), " from local store");
   }
+  return true;
+}
+
+bool LocalStore::lookup(
+    KeySpace keySpace,
+    ByteRange key,
+    rocksdb::PinnableSlice* value) const {
+  if (lookupInColumn(getColumn(keySpace), key, value)) {
+    return true;
+  }
+  return lookupLegacy(keySpace, key, value);
+}
+
+bool LocalStore::lookupLegacy(
+    KeySpace keySpace,
+    ByteRange key,
+    rocksdb::PinnableSlice* value) const {
+  if (!hasLegacyData_ || !kKeySpaces[keySpace].hasLegacyData) {
+    return false;
+  }
+
+  auto legacyKey = StringPiece{key}.str();
+  const auto& suffix = kKeySpaces[keySpace].legacySuffix;
+  legacyKey.append(suffix.data(), suffix.size());
+  return lookupInColumn(
+      dbHandles_->db->DefaultColumnFamily(), StringPiece{legacyKey}, value);
+}
+
+StoreResult LocalStore::get(KeySpace keySpace, ByteRange key) const {
+  auto start = std::chrono::steady_clock::now();
+  auto& stats = StoreStats::get()->localStore(keySpace);
+  SCOPE_EXIT {
+    StoreStats::recordLatency(stats.get, start);
+  };
+
+  string pendingValue;
+  if (lookupPending(keySpace, key, &pendingValue)) {
+    stats.hit.addValue(1);
+    stats.bytesRead.addValue(pendingValue.size());
+    return StoreResult(std::move(pendingValue));
+  }
+
+  // Pin the value rather than copying it out of the block cache, so that
+  // large blobs can be handed out without any copies.
+  auto value = std::make_unique<rocksdb::PinnableSlice>();
+  if (!lookup(keySpace, key, value.get())) {
+    stats.miss.addValue(1);
+    // Return an empty StoreResult
+    return StoreResult();
+  }
+  stats.hit.addValue(1);
+  stats.bytesRead.addValue(value->size());
   return StoreResult(std::move(value));
 }
 
-StoreResult LocalStore::get(const Hash& id) const {
-  return get(id.getBytes());
+StoreResult LocalStore::get(KeySpace keySpace, const Hash& id) const {
+  return get(keySpace, id.getBytes());
+}
+
+std::vector<StoreResult> LocalStore::getBatch(
+    KeySpace keySpace,
+    const std::vector<Hash>& ids) const {
+  std::vector<StoreResult> results(ids.size());
+  auto recordStats = [&] {
+    auto& stats = StoreStats::get()->localStore(keySpace);
+    for (const auto& result : results) {
+      if (result.isValid()) {
+        stats.hit.addValue(1);
+        stats.bytesRead.addValue(result.bytes().size());
+      } else {
+        stats.miss.addValue(1);
+      }
+    }
+  };
+
+  // Answer what we can from the pending writes, and look up everything else
+  // with a single MultiGet().
+  std::vector<size_t> indexes;
+  std::vector<Slice> keys;
+  for (size_t n = 0; n < ids.size(); ++n) {
+    string pendingValue;
+    if (lookupPending(keySpace, ids[n].getBytes(), &pendingValue)) {
+      results[n] = StoreResult(std::move(pendingValue));
+    } else {
+      indexes.push_back(n);
+      keys.push_back(_createSlice(ids[n].getBytes()));
+    }
+  }
+  if (keys.empty()) {
+    recordStats();
+    return results;
+  }
+
+  std::vector<rocksdb::ColumnFamilyHandle*> columns(
+      keys.size(), getColumn(keySpace));
+  std::vector<string> values;
+  auto statuses =
+      dbHandles_->db->MultiGet(ReadOptions(), columns, keys, &values);
+
+  for (size_t k = 0; k < keys.size(); ++k) {
+    auto n = indexes[k];
+    if (statuses[k].ok()) {
+      results[n] = StoreResult(std::move(values[k]));
+    } else if (statuses[k].IsNotFound()) {
+      // Keys written by older versions of eden are still looked up one at a
+      // time.
+      auto value = std::make_unique<rocksdb::PinnableSlice>();
+      if (lookupLegacy(keySpace, ids[n].getBytes(), value.get())) {
+        results[n] = StoreResult(std::move(value));
+      }
+    } else {
+      throw RocksException::build(
+          statuses[k],
+          "failed to get ",
+          ids[n].toString(),
+          " from local store");
+    }
+  }
+  recordStats();
+  return results;
 }
 
 // TODO(mbolin): Currently, all objects in our RocksDB are Git objects. We
-// probably want to namespace these by column family going forward, at which
-// point we might want to have a GitLocalStore that delegates to an
-// LocalStore so a vanilla LocalStore has no knowledge of deserializeGitTree()
-// or deserializeGitBlob().
+// might want to have a GitLocalStore that delegates to an LocalStore so a
+// vanilla LocalStore has no knowledge of deserializeGitTree() or
+// deserializeGitBlob().
+
+namespace {
+/**
+ * Blobs larger than LocalStore::kBlobChunkSize are stored in chunks, with a
+ * manifest stored under the blob ID.  Smaller blobs are stored whole, in the
+ * git blob format.
+ *
+ * Fixed-size chunks have a manifest of the form "chunked <size>\0", and are
+ * stored in the BlobFamily under the blob ID followed by the big-endian
+ * 32-bit index of each chunk.
+ *
+ * Content-defined chunks have a manifest of the form "cdc <size>\0" followed
+ * by the SHA-1 and big-endian 32-bit length of each chunk.  They are stored
+ * in the BlobChunkFamily under their SHA-1, so a chunk shared by several
+ * blobs is only stored once.  Each blob that uses a chunk also has an empty
+ * reference record there, under the chunk SHA-1 followed by the blob ID.
+ */
+constexpr StringPiece kChunkedBlobPrefix{"chunked "};
+constexpr StringPiece kContentChunkedBlobPrefix{"cdc "};
+constexpr size_t kManifestEntrySize = Hash::RAW_SIZE + sizeof(uint32_t);
+
+/** Where one chunk of a chunked blob is stored */
+struct BlobChunk {
+  LocalStore::KeySpace keySpace;
+  string key;
+  /** The offset of the chunk in the blob contents */
+  uint64_t offset;
+  uint64_t length;
+};
+
+struct ChunkedBlob {
+  uint64_t size;
+  /** Whether the chunks are content-defined, and so may be shared */
+  bool contentDefined;
+  std::vector<BlobChunk> chunks;
+};
+
+string makeChunkedBlobManifest(StringPiece prefix, uint64_t size) {
+  auto manifest = folly::to<string>(prefix, size);
+  manifest.push_back('\0');
+  return manifest;
+}
+
+string makeBlobChunkKey(const Hash& id, uint64_t index) {
+  auto key = StringPiece{id.getBytes()}.str();
+  auto bigEndianIndex = folly::Endian::big(static_cast<uint32_t>(index));
+  key.append(
+      reinterpret_cast<const char*>(&bigEndianIndex), sizeof(bigEndianIndex));
+  return key;
+}
+
+string makeBlobChunkRefKey(StringPiece chunkKey, const Hash& id) {
+  auto key = chunkKey.str();
+  key.append(StringPiece{id.getBytes()}.data(), Hash::RAW_SIZE);
+  return key;
+}
+
+/**
+ * Parse the manifest of a chunked blob.  Returns folly::none if the value is
+ * not a chunked blob manifest.
+ */
+Optional<ChunkedBlob> parseChunkedBlob(const Hash& id, StringPiece value) {
+  ChunkedBlob blob;
+  if (value.startsWith(kChunkedBlobPrefix)) {
+    blob.contentDefined = false;
+    value.advance(kChunkedBlobPrefix.size());
+  } else if (value.startsWith(kContentChunkedBlobPrefix)) {
+    blob.contentDefined = true;
+    value.advance(kContentChunkedBlobPrefix.size());
+  } else {
+    return folly::none;
+  }
+  auto sizeEnd = value.find('\0');
+  if (sizeEnd == StringPiece::npos) {
+    return folly::none;
+  }
+  blob.size = folly::to<uint64_t>(value.subpiece(0, sizeEnd));
+  value.advance(sizeEnd + 1);
+
+  if (!blob.contentDefined) {
+    for (uint64_t offset = 0; offset < blob.size;
+         offset += LocalStore::kBlobChunkSize) {
+      blob.chunks.push_back(BlobChunk{
+          LocalStore::BlobFamily,
+          makeBlobChunkKey(id, offset / LocalStore::kBlobChunkSize),
+          offset,
+          std::min<uint64_t>(LocalStore::kBlobChunkSize, blob.size - offset)});
+    }
+    return blob;
+  }
+
+  uint64_t offset = 0;
+  for (; value.size() >= kManifestEntrySize;
+       value.advance(kManifestEntrySize)) {
+    uint32_t length;
+    memcpy(&length, value.data() + Hash::RAW_SIZE, sizeof(length));
+    length = folly::Endian::big(length);
+    blob.chunks.push_back(BlobChunk{LocalStore::BlobChunkFamily,
+                                    value.subpiece(0, Hash::RAW_SIZE).str(),
+                                    offset,
+                                    length});
+    offset += length;
+  }
+  if (!value.empty() || offset != blob.size) {
+    throw std::domain_error(folly::to<string>(
+        "malformed chunk manifest for blob ", id.toString()));
+  }
+  return blob;
+}
+
+/**
+ * Trees written by older versions of eden are stored in the git tree
+ * format, and newer ones in the native format.
+ */
+std::unique_ptr<Tree> deserializeTree(const Hash& id, ByteRange data) {
+  if (isNativeTree(data)) {
+    return deserializeNativeTree(id, data);
+  }
+  return deserializeGitTree(id, data);
+}
+}
 
 std::unique_ptr<Tree> LocalStore::getTree(const Hash& id) const {
-  auto result = get(id.getBytes());
+  auto result = get(TreeFamily, id);
+  if (!result.isValid()) {
+    return nullptr;
+  }
+  return deserializeTree(id, result.bytes());
+}
+
+std::unique_ptr<NativeTreeView> LocalStore::getTreeView(const Hash& id) const {
+  auto result = get(TreeFamily, id);
   if (!result.isValid()) {
     return nullptr;
   }
-  return deserializeGitTree(id, result.bytes());
+  if (isNativeTree(result.bytes())) {
+    return std::make_unique<NativeTreeView>(id, result.extractIOBuf());
+  }
+  auto tree = deserializeGitTree(id, result.bytes());
+  return std::make_unique<NativeTreeView>(id, serializeNativeTree(*tree));
+}
+
+std::vector<std::unique_ptr<Tree>> LocalStore::getTreeBatch(
+    const std::vector<Hash>& ids) const {
+  auto results = getBatch(TreeFamily, ids);
+  std::vector<std::unique_ptr<Tree>> trees;
+  trees.reserve(ids.size());
+  for (size_t n = 0; n < ids.size(); ++n) {
+    if (results[n].isValid()) {
+      trees.push_back(deserializeTree(ids[n], results[n].bytes()));
+    } else {
+      trees.push_back(nullptr);
+    }
+  }
+  return trees;
 }
 
 std::unique_ptr<Blob> LocalStore::getBlob(const Hash& id) const {
-  // We have to hold this string in scope while we deserialize and build
-  // the blob; otherwise, the results are undefined.
-  auto result = get(id.getBytes());
+  // The IOBuf takes over the data pinned by RocksDB, and the Blob contents
+  // are a managed clone of it, so the contents are never copied.
+  auto result = get(BlobFamily, id);
+  if (!result.isValid()) {
+    return nullptr;
+  }
+  auto chunked = parseChunkedBlob(id, result.piece());
+  if (folly::Random::oneIn(kBlobAccessSampleRate)) {
+    recordBlobAccess(
+        id, chunked ? chunked->size : result.piece().size(), nullptr);
+  }
+  if (!chunked) {
+    auto buf = result.extractIOBuf();
+    return deserializeGitBlob(id, &buf);
+  }
+
+  // Chain the chunks together, so that they are not copied either.
+  auto contents = IOBuf::create(0);
+  for (const auto& chunk : chunked->chunks) {
+    contents->prependChain(std::make_unique<IOBuf>(
+        getBlobChunk(id, chunk.keySpace, StringPiece{chunk.key})
+            .extractIOBuf()));
+  }
+  return std::make_unique<Blob>(id, std::move(*contents));
+}
+
+unique_ptr<IOBuf>
+LocalStore::getBlobRange(const Hash& id, uint64_t offset, size_t length) const {
+  auto result = get(BlobFamily, id);
   if (!result.isValid()) {
     return nullptr;
   }
-  auto buf = result.extractIOBuf();
-  return deserializeGitBlob(id, &buf);
+  auto chunked = parseChunkedBlob(id, result.piece());
+  if (!chunked) {
+    return nullptr;
+  }
+  if (folly::Random::oneIn(kBlobAccessSampleRate)) {
+    recordBlobAccess(id, chunked->size, nullptr);
+  }
+
+  auto contents = IOBuf::create(0);
+  auto end = std::min<uint64_t>(chunked->size, offset + length);
+  for (const auto& chunkInfo : chunked->chunks) {
+    auto chunkStart = chunkInfo.offset;
+    auto chunkEnd = chunkStart + chunkInfo.length;
+    if (chunkEnd <= offset) {
+      continue;
+    }
+    if (chunkStart >= end) {
+      break;
+    }
+    auto chunk = std::make_unique<IOBuf>(
+        getBlobChunk(id, chunkInfo.keySpace, StringPiece{chunkInfo.key})
+            .extractIOBuf());
+    if (chunkEnd > end) {
+      chunk->trimEnd(chunkEnd - end);
+    }
+    if (offset > chunkStart) {
+      chunk->trimStart(offset - chunkStart);
+    }
+    contents->prependChain(std::move(chunk));
+  }
+  return contents;
+}
+
+StoreResult LocalStore::getBlobChunk(
+    const Hash& id,
+    KeySpace keySpace,
+    ByteRange key) const {
+  auto result = get(keySpace, key);
+  if (!result.isValid()) {
+    throw std::domain_error(folly::sformat(
+        "chunk {} of blob {} is missing from the local store",
+        folly::hexlify(key),
+        id.toString()));
+  }
+  return result;
 }
 
 Optional<BlobMetadata> LocalStore::getBlobMetadata(const Hash& id) const {
-  BlobMetadataKey key(id);
-  auto result = get(key.bytes());
+  auto result = get(BlobMetaDataFamily, id);
   if (!result.isValid()) {
     return folly::none;
   }
   return SerializedBlobMetadata::parse(id, result);
 }
 
+std::vector<Optional<BlobMetadata>> LocalStore::getBlobMetadataBatch(
+    const std::vector<Hash>& ids) const {
+  auto results = getBatch(BlobMetaDataFamily, ids);
+  std::vector<Optional<BlobMetadata>> metadata;
+  metadata.reserve(ids.size());
+  for (size_t n = 0; n < ids.size(); ++n) {
+    if (results[n].isValid()) {
+      metadata.push_back(SerializedBlobMetadata::parse(ids[n], results[n]));
+    } else {
+      metadata.push_back(folly::none);
+    }
+  }
+  return metadata;
+}
+
 Optional<Hash> LocalStore::getSha1ForBlob(const Hash& id) const {
   auto metadata = getBlobMetadata(id);
   if (!metadata) {
@@ -214,22 +822,128 @@ Optional<Hash> LocalStore::getSha1ForBlob(const Hash& id) const {
   return metadata.value().sha1;
 }
 
+Optional<Hash> LocalStore::getCommitRootTree(const Hash& commitID) const {
+  auto result = get(HgCommitToTreeFamily, commitID);
+  if (!result.isValid()) {
+    return folly::none;
+  }
+  auto bytes = result.bytes();
+  if (bytes.size() != Hash::RAW_SIZE) {
+    throw std::invalid_argument(folly::sformat(
+        "Root tree mapping for commit {} had unexpected size {}.",
+        commitID.toString(),
+        bytes.size()));
+  }
+  return Hash{bytes};
+}
+
+void LocalStore::putCommitRootTree(
+    const Hash& commitID,
+    const Hash& rootTreeID) {
+  put(HgCommitToTreeFamily, commitID, rootTreeID.getBytes());
+}
+
 BlobMetadata LocalStore::putBlob(const Hash& id, const Blob* blob) {
-  const IOBuf& contents = blob->getContents();
+  // Most blobs are already present when re-importing or prefetching, so
+  // check for them before spending time hashing their contents.  The
+  // metadata may have been stored without the contents by
+  // putBlobMetadata(), in which case the contents are still written.
+  auto existing = getBlobMetadata(id);
+  if (existing.hasValue()) {
+    return putBlob(id, blob, existing.value().sha1);
+  }
+  return putBlob(id, blob, Hash::sha1(&blob->getContents()));
+}
 
+BlobMetadata LocalStore::putBlobMetadata(const Hash& id, const Blob* blob) {
+  auto existing = getBlobMetadata(id);
+  if (existing.hasValue()) {
+    return existing.value();
+  }
+
+  const IOBuf& contents = blob->getContents();
   BlobMetadata metadata{Hash::sha1(&contents),
                         contents.computeChainDataLength()};
-  if (hasKey(id)) {
+  putBlobMetadata(id, metadata);
+  return metadata;
+}
+
+void LocalStore::putBlobMetadata(
+    const Hash& id,
+    const BlobMetadata& metadata) {
+  SerializedBlobMetadata metadataBytes(metadata);
+  auto hashSlice = _createSlice(id.getBytes());
+  write(id.getBytes(), [&](WriteBatchBase& batch) {
+    batch.Put(getColumn(BlobMetaDataFamily), hashSlice, metadataBytes.slice());
+  });
+}
+
+BlobMetadata LocalStore::putBlob(
+    const Hash& id,
+    const Blob* blob,
+    const Hash& contentsSha1) {
+  const IOBuf& contents = blob->getContents();
+
+  BlobMetadata metadata{contentsSha1, contents.computeChainDataLength()};
+  if (hasKey(BlobFamily, id)) {
     return metadata;
   }
 
-  BlobMetadataKey metadataKey(id);
   SerializedBlobMetadata metadataBytes(metadata);
 
   auto hashSlice = _createSlice(id.getBytes());
   SliceParts keyParts(&hashSlice, 1);
 
-  ByteRange bodyBytes;
+  if (metadata.size > kBlobChunkSize) {
+    auto start = std::chrono::steady_clock::now();
+    auto addMetadata = [&](WriteBatchBase& batch) {
+      batch.Put(
+          getColumn(BlobMetaDataFamily), hashSlice, metadataBytes.slice());
+      recordBlobAccess(id, metadata.size, &batch);
+    };
+    if (contentDefinedBlobChunks_) {
+      // Shared chunks are written immediately rather than batched, holding
+      // blobChunkRefsMutex_, so that collectGarbage() can't delete a chunk
+      // this blob is about to reference.
+      WriteBatch batch;
+      std::lock_guard<std::mutex> guard(blobChunkRefsMutex_);
+      addContentDefinedChunks(id, contents, batch);
+      addMetadata(batch);
+      auto status = dbHandles_->db->Write(WriteOptions(), &batch);
+      RocksException::check(
+          status, "error putting blob ", id.toString(), " in local store");
+    } else {
+      auto manifest =
+          makeChunkedBlobManifest(kChunkedBlobPrefix, metadata.size);
+      write(id.getBytes(), [&](WriteBatchBase& batch) {
+        Cursor cursor(&contents);
+        for (uint64_t index = 0; !cursor.isAtEnd(); ++index) {
+          auto chunkKey = makeBlobChunkKey(id, index);
+          Slice chunkKeySlice{chunkKey};
+          std::vector<Slice> chunkSlices;
+          size_t remaining = kBlobChunkSize;
+          while (remaining > 0 && !cursor.isAtEnd()) {
+            auto bytes = cursor.peekBytes();
+            bytes = bytes.subpiece(0, remaining);
+            chunkSlices.push_back(_createSlice(bytes));
+            cursor.skip(bytes.size());
+            remaining -= bytes.size();
+          }
+          batch.Put(
+              getColumn(BlobFamily),
+              SliceParts(&chunkKeySlice, 1),
+              SliceParts(chunkSlices.data(), chunkSlices.size()));
+        }
+        batch.Put(getColumn(BlobFamily), hashSlice, Slice{manifest});
+        addMetadata(batch);
+      });
+    }
+    recentKeys_.insert(hashKey(BlobFamily, id.getBytes()));
+    auto& stats = StoreStats::get()->localStore(BlobFamily);
+    StoreStats::recordLatency(stats.put, start);
+    stats.bytesWritten.addValue(metadata.size);
+    return metadata;
+  }
 
   // Add a git-style blob prefix
   auto prefix = folly::to<string>("blob ", contents.computeChainDataLength());
@@ -250,40 +964,69 @@ BlobMetadata LocalStore::putBlob(const Hash& id, const Blob* blob) {
 
   SliceParts bodyParts(bodySlices.data(), bodySlices.size());
 
-  {
-    auto pending = pending_.wlock();
-    if (!pending->writeBatch) {
-      pending->writeBatch = std::make_unique<WriteBatch>(writeBatchBufferSize_);
-    }
+  auto start = std::chrono::steady_clock::now();
+  write(id.getBytes(), [&](WriteBatchBase& batch) {
+    batch.Put(getColumn(BlobFamily), keyParts, bodyParts);
+    batch.Put(getColumn(BlobMetaDataFamily), hashSlice, metadataBytes.slice());
+    recordBlobAccess(id, metadata.size, &batch);
+  });
+  recentKeys_.insert(hashKey(BlobFamily, id.getBytes()));
+  auto& stats = StoreStats::get()->localStore(BlobFamily);
+  StoreStats::recordLatency(stats.put, start);
+  stats.bytesWritten.addValue(metadata.size);
 
-    pending->writeBatch->Put(keyParts, bodyParts);
-    pending->writeBatch->Put(metadataKey.slice(), metadataBytes.slice());
+  return metadata;
+}
 
-    if (writeBatchBufferSize_ > 0) {
-      // Only track the inserted keys in batch mode
-      pending->batchedKeys.insert(StringPiece{id.getBytes()});
-      pending->batchedKeys.insert(StringPiece{metadataKey.bytes()});
+void LocalStore::addContentDefinedChunks(
+    const Hash& id,
+    const IOBuf& contents,
+    WriteBatchBase& batch) const {
+  auto manifest = makeChunkedBlobManifest(
+      kContentChunkedBlobPrefix, contents.computeChainDataLength());
+  auto lengths = findContentDefinedChunks(
+      contents, kBlobChunkSize / 4, kBlobChunkSize, kBlobChunkSize * 4);
+  Cursor cursor(&contents);
+  for (auto length : lengths) {
+    unique_ptr<IOBuf> chunk;
+    cursor.clone(chunk, length);
+    auto chunkId = Hash::sha1(chunk.get());
+    auto chunkKey = _createSlice(chunkId.getBytes());
+    if (!hasKey(BlobChunkFamily, chunkId)) {
+      std::vector<Slice> chunkSlices;
+      for (auto bytes : *chunk) {
+        chunkSlices.push_back(_createSlice(bytes));
+      }
+      batch.Put(
+          getColumn(BlobChunkFamily),
+          SliceParts(&chunkKey, 1),
+          SliceParts(chunkSlices.data(), chunkSlices.size()));
     }
+    batch.Put(
+        getColumn(BlobChunkFamily),
+        makeBlobChunkRefKey(StringPiece{chunkId.getBytes()}, id),
+        Slice{});
+
+    manifest.append(StringPiece{chunkId.getBytes()}.data(), Hash::RAW_SIZE);
+    auto bigEndianLength = folly::Endian::big(static_cast<uint32_t>(length));
+    manifest.append(
+        reinterpret_cast<const char*>(&bigEndianLength),
+        sizeof(bigEndianLength));
   }
-
-  flushIfNotBatch();
-
-  return metadata;
+  batch.Put(
+      getColumn(BlobFamily), _createSlice(id.getBytes()), Slice{manifest});
 }
 
 std::pair<Hash, folly::IOBuf> LocalStore::serializeTree(
     const Tree* tree) const {
-  GitTreeSerializer serializer;
-  for (auto& entry : tree->getTreeEntries()) {
-    serializer.addEntry(std::move(entry));
-  }
-  IOBuf treeBuf = serializer.finalize();
-
   auto id = tree->getHash();
   if (id == Hash()) {
-    id = Hash::sha1(&treeBuf);
+    // Trees without an ID of their own (such as the ones imported from
+    // mercurial) are still identified by the hash of their git tree
+    // serialization, so that they keep the same IDs as before.
+    id = computeGitTreeHash(tree->getTreeEntries());
   }
-  return std::make_pair(id, treeBuf);
+  return std::make_pair(id, serializeNativeTree(*tree));
 }
 
 Hash LocalStore::putTree(const Tree* tree) {
@@ -291,76 +1034,150 @@ Hash LocalStore::putTree(const Tree* tree) {
   ByteRange treeData = serialized.second.coalesce();
 
   auto& id = serialized.first;
-  put(id.getBytes(), treeData);
+  put(TreeFamily, id, treeData);
   return id;
 }
 
-void LocalStore::put(const Hash& id, folly::ByteRange value) {
-  put(id.getBytes(), value);
+void LocalStore::put(
+    KeySpace keySpace,
+    const Hash& id,
+    folly::ByteRange value) {
+  put(keySpace, id.getBytes(), value);
 }
 
-void LocalStore::put(folly::ByteRange key, folly::ByteRange value) {
-  if (hasKey(key)) {
+void LocalStore::put(
+    KeySpace keySpace,
+    folly::ByteRange key,
+    folly::ByteRange value) {
+  if (hasKey(keySpace, key)) {
     // Don't try to overwrite an existing key
     return;
   }
 
-  {
-    auto pending = pending_.wlock();
-    if (!pending->writeBatch) {
-      pending->writeBatch = std::make_unique<WriteBatch>(writeBatchBufferSize_);
-    }
-
-    pending->writeBatch->Put(_createSlice(key), _createSlice(value));
-    if (writeBatchBufferSize_ > 0) {
-      // Only track the inserted keys in batch mode
-      pending->batchedKeys.insert(StringPiece{key});
-    }
-  }
+  auto start = std::chrono::steady_clock::now();
+  write(key, [&](WriteBatchBase& batch) {
+    batch.Put(getColumn(keySpace), _createSlice(key), _createSlice(value));
+  });
+  recentKeys_.insert(hashKey(keySpace, key));
+  auto& stats = StoreStats::get()->localStore(keySpace);
+  StoreStats::recordLatency(stats.put, start);
+  stats.bytesWritten.addValue(value.size());
+}
 
-  flushIfNotBatch();
+LocalStore::PendingShard& LocalStore::getPendingShard(ByteRange key) const {
+  key = key.subpiece(0, Hash::RAW_SIZE);
+  return pending_[folly::hash::fnv64_buf(key.data(), key.size()) %
+                  pending_.size()];
 }
 
-void LocalStore::flushIfNotBatch() {
-  bool needFlush = writeBatchBufferSize_ == 0;
+template <typename AddRecords>
+void LocalStore::write(ByteRange key, AddRecords&& addRecords) {
+  auto bufferSize = writeBatchBufferSize_.load(std::memory_order_acquire);
+  if (bufferSize == 0) {
+    WriteBatch batch;
+    addRecords(batch);
+    auto status = dbHandles_->db->Write(WriteOptions(), &batch);
+    RocksException::check(
+        status, "error putting ", folly::hexlify(key), " in local store");
+    return;
+  }
 
-  if (!needFlush) {
-    auto pending = pending_.wlock();
+  // All of the records for one key go in the same shard, so that a reader
+  // that finds one of them in the shard also finds the rest.
+  auto& shard = getPendingShard(key);
+  bool needFlush;
+  {
+    auto pending = shard.wlock();
     if (!pending->writeBatch) {
-      return;
+      pending->writeBatch = std::make_unique<WriteBatchWithIndex>(
+          rocksdb::BytewiseComparator(), 0, true);
+      numPendingBatches_.fetch_add(1, std::memory_order_release);
     }
-    needFlush = pending->writeBatch->GetDataSize() >= writeBatchBufferSize_;
+    addRecords(*pending->writeBatch);
+    needFlush = pending->writeBatch->GetWriteBatch()->GetDataSize() >=
+        bufferSize / kNumPendingShards;
   }
 
   if (needFlush) {
-    flush();
+    flushShard(shard);
+  }
+}
+
+bool LocalStore::lookupPending(
+    KeySpace keySpace,
+    ByteRange key,
+    string* value) const {
+  if (numPendingBatches_.load(std::memory_order_acquire) == 0) {
+    return false;
+  }
+  auto pending = getPendingShard(key).wlock();
+  if (!pending->writeBatch) {
+    return false;
   }
+
+  auto keySlice = _createSlice(key);
+  unique_ptr<rocksdb::WBWIIterator> it(
+      pending->writeBatch->NewIterator(getColumn(keySpace)));
+  it->Seek(keySlice);
+  if (!it->Valid()) {
+    return false;
+  }
+  // Each key is only ever put, and the batch only keeps the latest entry for
+  // each key, so this is the only entry for the key.
+  auto entry = it->Entry();
+  if (entry.type != rocksdb::kPutRecord || entry.key != keySlice) {
+    return false;
+  }
+  if (value) {
+    value->assign(entry.value.data(), entry.value.size());
+  }
+  return true;
 }
 
 void LocalStore::enableBatchMode(size_t bufferSize) {
-  CHECK_EQ(writeBatchBufferSize_, 0) << "Must not already be in batch mode";
-  writeBatchBufferSize_ = bufferSize;
+  CHECK_NE(bufferSize, 0) << "the batch mode buffer size must be non-zero";
+  std::lock_guard<std::mutex> guard(batchModeMutex_);
+  ++batchModeUsers_;
+  if (bufferSize > writeBatchBufferSize_.load(std::memory_order_relaxed)) {
+    writeBatchBufferSize_.store(bufferSize, std::memory_order_release);
+  }
 }
 
 void LocalStore::disableBatchMode() {
-  CHECK_NE(writeBatchBufferSize_, 0) << "Should not already be in batch mode";
-  writeBatchBufferSize_ = 0;
-  pending_.wlock()->batchedKeys.clear();
+  {
+    std::lock_guard<std::mutex> guard(batchModeMutex_);
+    CHECK_NE(batchModeUsers_, 0) << "Should already be in batch mode";
+    --batchModeUsers_;
+    if (batchModeUsers_ == 0) {
+      writeBatchBufferSize_.store(0, std::memory_order_release);
+    }
+  }
+  // Flush even if other importers are still running, so that the caller's
+  // data is durable when this returns.
   flush();
 }
 
 void LocalStore::flush() {
-  auto pending = pending_.wlock();
+  for (auto& shard : pending_) {
+    flushShard(shard);
+  }
+}
+
+void LocalStore::flushShard(PendingShard& shard) {
+  auto pending = shard.wlock();
   if (!pending->writeBatch) {
     return;
   }
 
-  VLOG(5) << "Flushing " << pending->writeBatch->Count()
-          << " entries with data size of "
-          << pending->writeBatch->GetDataSize();
-  auto status = db_->Write(WriteOptions(), pending->writeBatch.get());
+  auto* batch = pending->writeBatch->GetWriteBatch();
+  VLOG(5) << "Flushing " << batch->Count() << " entries with data size of "
+          << batch->GetDataSize();
+  auto dataSize = batch->GetDataSize();
+  auto status = dbHandles_->db->Write(WriteOptions(), batch);
   VLOG(5) << "... Flushed";
   pending->writeBatch.reset();
+  numPendingBatches_.fetch_sub(1, std::memory_order_release);
+  bulkBytesWritten_.fetch_add(dataSize, std::memory_order_relaxed);
 
   if (!status.ok()) {
     throw RocksException::build(
@@ -368,54 +1185,506 @@ void LocalStore::flush() {
   }
 }
 
-void LocalStore::flushForRead() const {
-  auto pending = pending_.wlock();
-  if (!pending->writeBatch) {
+bool LocalStore::hasKey(KeySpace keySpace, folly::ByteRange key) const {
+  if (recentKeys_.contains(hashKey(keySpace, key))) {
+    return true;
+  }
+  if (lookupPending(keySpace, key, nullptr)) {
+    return true;
+  }
+
+  // KeyMayExist() only checks the memtables, the bloom filters and the
+  // block cache, so a key that is not stored, which is the common case when
+  // importing, is usually ruled out without any I/O.
+  auto* column = getColumn(keySpace);
+  string value;
+  bool valueFound = false;
+  if (!dbHandles_->db->KeyMayExist(
+          ReadOptions(), column, _createSlice(key), &value, &valueFound)) {
+    rocksdb::PinnableSlice legacyValue;
+    return lookupLegacy(keySpace, key, &legacyValue);
+  }
+  if (valueFound) {
+    return true;
+  }
+  // Pinning the value avoids copying it just to check that it exists.
+  rocksdb::PinnableSlice pinnedValue;
+  return lookup(keySpace, key, &pinnedValue);
+}
+
+uint64_t LocalStore::hashKey(KeySpace keySpace, folly::ByteRange key) {
+  return folly::hash::SpookyHashV2::Hash64(key.data(), key.size(), keySpace);
+}
+
+bool LocalStore::hasKey(KeySpace keySpace, const Hash& id) const {
+  return hasKey(keySpace, id.getBytes());
+}
+
+void LocalStore::setCompression(
+    KeySpace keySpace,
+    LocalStoreCompression compression) {
+  auto current = compression_.wlock();
+  if ((*current)[keySpace] == compression) {
     return;
   }
 
-  VLOG(5) << "READ op: Flushing " << pending->writeBatch->Count()
-          << " entries with data size of "
-          << pending->writeBatch->GetDataSize();
-  auto status = db_->Write(WriteOptions(), pending->writeBatch.get());
-  VLOG(5) << "... Flushed";
-  pending->writeBatch.reset();
+  auto* column = getColumn(keySpace);
+  auto numLevels = dbHandles_->db->GetOptions(column).num_levels;
+  std::vector<StringPiece> levels;
+  for (int level = 0; level < numLevels; ++level) {
+    levels.push_back(
+        level < kNumUncompressedLevels ? rocksCompressionName(
+                                             LocalStoreCompression::None)
+                                       : rocksCompressionName(compression));
+  }
+
+  auto status = dbHandles_->db->SetOptions(
+      column, {{"compression_per_level", folly::join(":", levels)}});
+  RocksException::check(
+      status,
+      "failed to change the compression of the ",
+      kKeySpaces[keySpace].name,
+      " column family");
+  (*current)[keySpace] = compression;
+  LOG(INFO) << "local store " << kKeySpaces[keySpace].name
+            << " compression changed to " << rocksCompressionName(compression);
+}
 
+void LocalStore::recordBlobAccess(
+    const Hash& id,
+    uint64_t size,
+    WriteBatchBase* writeBatch) const {
+  SerializedBlobAccess access(currentAccessTime(), size);
+  auto key = _createSlice(id.getBytes());
+  if (writeBatch) {
+    writeBatch->Put(getColumn(BlobAccessFamily), key, access.slice());
+    return;
+  }
+
+  // Losing a few access times in a crash is harmless, so don't pay for the
+  // write-ahead log.  Failures are not worth failing the read for either.
+  WriteOptions options;
+  options.disableWAL = true;
+  auto status = dbHandles_->db->Put(
+      options, getColumn(BlobAccessFamily), key, access.slice());
   if (!status.ok()) {
-    throw RocksException::build(
-        status, "error putting blob batch in local store");
+    LOG(WARNING) << "failed to record access time for blob " << id << ": "
+                 << status.ToString();
   }
 }
 
-bool LocalStore::hasKey(folly::ByteRange key) const {
-  {
-    auto pending = pending_.rlock();
-    auto keyStr = StringPiece{key};
-    if (pending->batchedKeys.find(keyStr) != pending->batchedKeys.end()) {
-      return true;
+uint64_t LocalStore::getApproximateSize() const {
+  uint64_t total = 0;
+  for (const auto& column : dbHandles_->columns) {
+    for (auto property : {rocksdb::DB::Properties::kTotalSstFilesSize,
+                          rocksdb::DB::Properties::kCurSizeAllMemTables}) {
+      uint64_t value;
+      if (dbHandles_->db->GetIntProperty(column.get(), property, &value)) {
+        total += value;
+      }
     }
   }
-  string value;
-  auto status = db_.get()->Get(ReadOptions(), _createSlice(key), &value);
-  if (!status.ok()) {
-    if (status.IsNotFound()) {
-      return false;
+  return total;
+}
+
+LocalStoreHealth LocalStore::getHealth() const {
+  LocalStoreHealth health;
+  auto* db = dbHandles_->db.get();
+  health.columns.resize(KeySpace::End);
+  for (size_t n = 0; n < KeySpace::End; ++n) {
+    auto* column = getColumn(static_cast<KeySpace>(n));
+    auto& columnHealth = health.columns[n];
+    rocksdb::ColumnFamilyMetaData metadata;
+    db->GetColumnFamilyMetaData(column, &metadata);
+    columnHealth.numSstFiles = metadata.file_count;
+    if (!metadata.levels.empty()) {
+      columnHealth.numLevel0Files = metadata.levels[0].files.size();
     }
+    db->GetIntProperty(
+        column,
+        rocksdb::DB::Properties::kEstimatePendingCompactionBytes,
+        &columnHealth.pendingCompactionBytes);
+  }
 
-    // TODO: RocksDB can return a "TryAgain" error.
-    // Should we try again for the user, rather than re-throwing the error?
+  uint64_t value = 0;
+  if (db->GetIntProperty(
+          rocksdb::DB::Properties::kNumRunningCompactions, &value)) {
+    health.runningCompactions = value;
+  }
+  if (db->GetIntProperty(rocksdb::DB::Properties::kIsWriteStopped, &value)) {
+    health.writesStopped = value != 0;
+  }
+  if (db->GetIntProperty(
+          rocksdb::DB::Properties::kActualDelayedWriteRate, &value)) {
+    health.delayedWriteRate = value;
+  }
+  health.bulkBytesWritten = bulkBytesWritten_.load(std::memory_order_relaxed);
+  return health;
+}
 
-    // We don't use RocksException::check(), since we don't want to waste our
-    // time computing the hex string of the key if we succeeded.
-    throw RocksException::build(
-        status, "failed to get ", folly::hexlify(key), " from local store");
+void LocalStore::compact(KeySpace keySpace) {
+  // Include the writes of any bulk import still in progress.
+  flush();
+
+  rocksdb::CompactRangeOptions options;
+  // Let automatic compactions keep running, so that writes do not stall
+  // behind a long manual compaction.
+  options.exclusive_manual_compaction = false;
+  auto start = std::chrono::steady_clock::now();
+  auto status = dbHandles_->db->CompactRange(
+      options, getColumn(keySpace), nullptr, nullptr);
+  RocksException::check(
+      status,
+      "error compacting ",
+      getKeySpaceName(keySpace),
+      " in local store");
+  VLOG(1) << "compacted " << getKeySpaceName(keySpace) << " in "
+          << std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::steady_clock::now() - start)
+                 .count()
+          << "ms";
+}
+
+LocalStoreGcStats LocalStore::collectGarbage(
+    uint64_t maxBytes,
+    const std::unordered_set<Hash>& referencedBlobs) {
+  // Make sure the access records of pending writes are visible.
+  flush();
+
+  LocalStoreGcStats stats;
+  stats.sizeBefore = getApproximateSize();
+  if (stats.sizeBefore <= maxBytes) {
+    return stats;
   }
-  return true;
+  auto excessBytes = stats.sizeBefore - maxBytes;
+
+  struct Candidate {
+    uint64_t accessTime;
+    uint64_t size;
+    Hash id;
+  };
+  std::vector<Candidate> candidates;
+  unique_ptr<rocksdb::Iterator> it(dbHandles_->db->NewIterator(
+      ReadOptions(), getColumn(BlobAccessFamily)));
+  for (it->SeekToFirst(); it->Valid(); it->Next()) {
+    auto key = it->key();
+    Candidate candidate;
+    if (key.size() != Hash::RAW_SIZE ||
+        !SerializedBlobAccess::parse(
+            it->value(), &candidate.accessTime, &candidate.size)) {
+      LOG(WARNING) << "ignoring malformed blob access record "
+                   << folly::hexlify(StringPiece{key.data(), key.size()});
+      continue;
+    }
+    candidate.id = Hash{ByteRange{StringPiece{key.data(), key.size()}}};
+    if (referencedBlobs.find(candidate.id) == referencedBlobs.end()) {
+      candidates.push_back(candidate);
+    }
+  }
+  RocksException::check(
+      it->status(), "error reading blob access times from local store");
+  it.reset();
+
+  std::sort(
+      candidates.begin(),
+      candidates.end(),
+      [](const Candidate& a, const Candidate& b) {
+        return a.accessTime < b.accessTime;
+      });
+
+  WriteBatch batch;
+  auto writeBatch = [&] {
+    auto status = dbHandles_->db->Write(WriteOptions(), &batch);
+    RocksException::check(status, "error evicting blobs from local store");
+    batch.Clear();
+    // hasKey() must not find the deleted keys in recentKeys_.
+    recentKeys_.clear();
+  };
+  std::vector<string> sharedChunks;
+  for (const auto& candidate : candidates) {
+    if (stats.bytesEvicted >= excessBytes) {
+      break;
+    }
+
+    addBlobDeletes(
+        candidate.id, candidate.size > kBlobChunkSize, &batch, &sharedChunks);
+    ++stats.blobsEvicted;
+    stats.bytesEvicted += candidate.size;
+    if (batch.Count() >= kGcBatchSize) {
+      writeBatch();
+    }
+  }
+  if (batch.Count() > 0) {
+    writeBatch();
+  }
+  deleteUnusedChunks(sharedChunks);
+
+  // Deleted data only goes away once the files holding it are compacted.
+  if (stats.blobsEvicted > 0) {
+    auto columns = {getColumn(BlobFamily),
+                    getColumn(BlobMetaDataFamily),
+                    getColumn(BlobChunkFamily)};
+    for (auto* column : columns) {
+      auto status = dbHandles_->db->CompactRange(
+          rocksdb::CompactRangeOptions(), column, nullptr, nullptr);
+      RocksException::check(status, "error compacting local store");
+    }
+    if (hasLegacyData_) {
+      auto status = dbHandles_->db->CompactRange(
+          rocksdb::CompactRangeOptions(),
+          dbHandles_->db->DefaultColumnFamily(),
+          nullptr,
+          nullptr);
+      RocksException::check(status, "error compacting local store");
+    }
+  }
+
+  LOG(INFO) << "local store garbage collection evicted " << stats.blobsEvicted
+            << " blobs (" << stats.bytesEvicted << " bytes); the store was "
+            << stats.sizeBefore << " bytes, with a limit of " << maxBytes;
+  return stats;
+}
+
+void LocalStore::addBlobDeletes(
+    const Hash& id,
+    bool mayBeChunked,
+    WriteBatch* batch,
+    std::vector<string>* sharedChunks) {
+  auto key = _createSlice(id.getBytes());
+  if (mayBeChunked) {
+    Optional<ChunkedBlob> chunked;
+    try {
+      auto manifest = get(BlobFamily, id);
+      if (manifest.isValid()) {
+        chunked = parseChunkedBlob(id, manifest.piece());
+      }
+    } catch (const std::exception& ex) {
+      // The chunks are left behind, but the blob itself is still removed.
+      LOG(WARNING) << "unable to find the chunks of blob " << id << ": "
+                   << folly::exceptionStr(ex);
+    }
+    if (chunked) {
+      for (const auto& chunk : chunked->chunks) {
+        if (chunked->contentDefined) {
+          // The chunk itself is deleted by deleteUnusedChunks() if no other
+          // blob uses it.
+          batch->Delete(
+              getColumn(BlobChunkFamily), makeBlobChunkRefKey(chunk.key, id));
+          sharedChunks->push_back(chunk.key);
+        } else {
+          batch->Delete(getColumn(chunk.keySpace), chunk.key);
+        }
+      }
+    }
+  }
+  for (auto keySpace : {BlobFamily, BlobMetaDataFamily, BlobAccessFamily}) {
+    batch->Delete(getColumn(keySpace), key);
+    if (hasLegacyData_ && kKeySpaces[keySpace].hasLegacyData) {
+      auto legacyKey = key.ToString();
+      const auto& suffix = kKeySpaces[keySpace].legacySuffix;
+      legacyKey.append(suffix.data(), suffix.size());
+      batch->Delete(dbHandles_->db->DefaultColumnFamily(), legacyKey);
+    }
+  }
+}
+
+void LocalStore::deleteUnusedChunks(const std::vector<string>& chunkKeys) {
+  if (chunkKeys.empty()) {
+    return;
+  }
+
+  // Hold blobChunkRefsMutex_ so that no blob starts using a chunk between
+  // checking its references and deleting it.
+  std::lock_guard<std::mutex> guard(blobChunkRefsMutex_);
+  WriteBatch batch;
+  auto writeBatch = [&] {
+    auto status = dbHandles_->db->Write(WriteOptions(), &batch);
+    RocksException::check(
+        status, "error deleting blob chunks from local store");
+    batch.Clear();
+    recentKeys_.clear();
+  };
+  unique_ptr<rocksdb::Iterator> chunkIt(dbHandles_->db->NewIterator(
+      ReadOptions(), getColumn(BlobChunkFamily)));
+  for (const auto& chunkKey : chunkKeys) {
+    // The references to a chunk sort right after the chunk itself.
+    Slice chunkSlice{chunkKey};
+    chunkIt->Seek(chunkSlice);
+    if (chunkIt->Valid() && chunkIt->key() == chunkSlice) {
+      chunkIt->Next();
+    }
+    RocksException::check(
+        chunkIt->status(), "error reading blob chunks from local store");
+    if (!chunkIt->Valid() || !chunkIt->key().starts_with(chunkSlice)) {
+      batch.Delete(getColumn(BlobChunkFamily), chunkSlice);
+      if (batch.Count() >= kGcBatchSize) {
+        writeBatch();
+      }
+    }
+  }
+  chunkIt.reset();
+  if (batch.Count() > 0) {
+    writeBatch();
+  }
+}
+
+LocalStoreScrubStats LocalStore::scrub(
+    LocalStoreScrubPosition* position,
+    uint64_t maxBytes) {
+  LocalStoreScrubStats stats;
+  ReadOptions readOptions;
+  readOptions.verify_checksums = true;
+  // Keep the data that FUSE requests need in the block cache.
+  readOptions.fill_cache = false;
+
+  while (!position->finished && stats.bytesChecked < maxBytes) {
+    auto keySpace = position->keySpace;
+    unique_ptr<rocksdb::Iterator> it(
+        dbHandles_->db->NewIterator(readOptions, getColumn(keySpace)));
+    if (position->nextKey.empty()) {
+      it->SeekToFirst();
+    } else {
+      it->Seek(position->nextKey);
+    }
+    for (; it->Valid() && stats.bytesChecked < maxBytes; it->Next()) {
+      auto key = it->key();
+      // Fixed-size blob chunks are checked along with their blob.
+      if (key.size() != Hash::RAW_SIZE) {
+        continue;
+      }
+      Hash id{ByteRange{StringPiece{key.data(), key.size()}}};
+      auto value = StringPiece{it->value().data(), it->value().size()};
+      ++stats.objectsChecked;
+      stats.bytesChecked += value.size();
+      auto problem = keySpace == TreeFamily
+          ? checkTree(id, value)
+          : checkBlob(id, value, readOptions, &stats.bytesChecked);
+      if (problem) {
+        quarantine(keySpace, id, problem.value());
+        ++stats.objectsQuarantined;
+      }
+    }
+    if (it->Valid()) {
+      position->nextKey = it->key().ToString();
+      break;
+    }
+    if (it->status().IsCorruption()) {
+      // RocksDB's checksums caught a corrupt block, and the keys it holds
+      // are unknown, so they cannot be removed.
+      LOG(ERROR) << "the " << getKeySpaceName(keySpace)
+                 << " key space of the local store is corrupt, skipping the "
+                 << "rest of it: " << it->status().ToString();
+      ++stats.unreadableKeySpaces;
+    } else {
+      RocksException::check(it->status(), "error scrubbing local store");
+    }
+
+    position->nextKey.clear();
+    if (keySpace == TreeFamily) {
+      position->keySpace = BlobFamily;
+    } else {
+      position->finished = true;
+    }
+  }
+  return stats;
+}
+
+Optional<string> LocalStore::checkTree(const Hash& id, StringPiece value) {
+  try {
+    deserializeTree(id, ByteRange{value});
+  } catch (const std::exception& ex) {
+    return folly::exceptionStr(ex).toStdString();
+  }
+  return folly::none;
 }
 
-bool LocalStore::hasKey(const Hash& id) const {
-  return hasKey(id.getBytes());
+Optional<string> LocalStore::checkBlob(
+    const Hash& id,
+    StringPiece value,
+    const ReadOptions& readOptions,
+    uint64_t* bytesRead) const {
+  try {
+    auto metadata = getBlobMetadata(id);
+    if (!metadata) {
+      // There is nothing to check the contents against.
+      return folly::none;
+    }
+
+    uint64_t size;
+    Hash sha1;
+    auto chunked = parseChunkedBlob(id, value);
+    if (chunked) {
+      // Hash the chunks one at a time, rather than reading the whole blob
+      // into memory.
+      folly::ssl::OpenSSLHash::Digest digest;
+      digest.hash_init(EVP_sha1());
+      for (const auto& chunk : chunked->chunks) {
+        rocksdb::PinnableSlice data;
+        auto status = dbHandles_->db->Get(
+            readOptions, getColumn(chunk.keySpace), chunk.key, &data);
+        if (status.IsNotFound()) {
+          return folly::to<string>(
+              "chunk ", folly::hexlify(chunk.key), " is missing");
+        }
+        RocksException::check(status, "error reading blob chunk");
+        if (data.size() != chunk.length) {
+          return folly::to<string>(
+              "chunk ",
+              folly::hexlify(chunk.key),
+              " has ",
+              data.size(),
+              " bytes rather than ",
+              chunk.length);
+        }
+        digest.hash_update(ByteRange{StringPiece{data.data(), data.size()}});
+        *bytesRead += data.size();
+      }
+      std::array<uint8_t, Hash::RAW_SIZE> hashBytes;
+      digest.hash_final(folly::range(hashBytes));
+      sha1 = Hash{folly::range(hashBytes)};
+      size = chunked->size;
+    } else {
+      auto buf = IOBuf::wrapBufferAsValue(value.data(), value.size());
+      auto blob = deserializeGitBlob(id, &buf);
+      sha1 = Hash::sha1(&blob->getContents());
+      size = blob->getContents().computeChainDataLength();
+    }
+
+    if (size != metadata->size) {
+      return folly::to<string>(
+          "its size is ", size, " rather than ", metadata->size);
+    }
+    if (sha1 != metadata->sha1) {
+      return folly::to<string>(
+          "its SHA-1 is ",
+          sha1.toString(),
+          " rather than ",
+          metadata->sha1.toString());
+    }
+  } catch (const std::exception& ex) {
+    return folly::exceptionStr(ex).toStdString();
+  }
+  return folly::none;
 }
 
+void LocalStore::quarantine(
+    KeySpace keySpace,
+    const Hash& id,
+    StringPiece problem) {
+  LOG(ERROR) << "removing corrupt " << getKeySpaceName(keySpace) << " entry "
+             << id << " from the local store, so that it is fetched again: "
+             << problem;
+  WriteBatch batch;
+  std::vector<string> sharedChunks;
+  if (keySpace == BlobFamily) {
+    addBlobDeletes(id, true, &batch, &sharedChunks);
+  } else {
+    batch.Delete(getColumn(keySpace), _createSlice(id.getBytes()));
+  }
+  auto status = dbHandles_->db->Write(WriteOptions(), &batch);
+  RocksException::check(status, "error removing corrupt data from local store");
+  recentKeys_.clear();
+  deleteUnusedChunks(sharedChunks);
+}
 }
 }
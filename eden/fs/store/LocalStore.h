@@ -11,18 +11,29 @@
 
 #include <folly/Range.h>
 #include <folly/Synchronized.h>
-#include <folly/experimental/StringKeyedUnorderedSet.h>
+#include <array>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
 #include "eden/fs/store/BlobMetadata.h"
+#include "eden/fs/store/RecentKeyFilter.h"
 #include "eden/utils/PathFuncs.h"
 
 namespace folly {
+class IOBuf;
 template <typename T>
 class Optional;
 }
 namespace rocksdb {
-class DB;
+class ColumnFamilyHandle;
+class PinnableSlice;
+struct ReadOptions;
 class WriteBatch;
+class WriteBatchBase;
+class WriteBatchWithIndex;
 }
 
 namespace facebook {
@@ -30,9 +41,140 @@ namespace eden {
 
 class Blob;
 class Hash;
+struct RocksHandles;
 class StoreResult;
+class NativeTreeView;
 class Tree;
 
+/**
+ * The compression codecs LocalStore can use for a column family.
+ */
+enum class LocalStoreCompression {
+  None,
+  Snappy,
+  LZ4,
+  Zstd,
+};
+
+/**
+ * Parse a compression codec name: "none", "snappy", "lz4" or "zstd".
+ *
+ * Throws std::invalid_argument if the name is not recognized.
+ */
+LocalStoreCompression parseLocalStoreCompression(folly::StringPiece name);
+
+/**
+ * Options used to tune the RocksDB underlying a LocalStore.
+ *
+ * The defaults are suitable for a developer machine.  Hosts with plenty of
+ * memory will want larger block caches and write buffers.
+ */
+struct LocalStoreOptions {
+  /** The size of the LRU block cache shared by everything but blobs */
+  size_t blockCacheSize{128 * 1024 * 1024};
+  /** The size of the separate LRU block cache used for blob contents */
+  size_t blobBlockCacheSize{64 * 1024 * 1024};
+  /** The memtable size for each column family other than blobs */
+  size_t writeBufferSize{8 * 1024 * 1024};
+  /** The memtable size for the blob column family */
+  size_t blobWriteBufferSize{64 * 1024 * 1024};
+  /** The number of bloom filter bits per key.  0 disables bloom filters. */
+  int bloomFilterBitsPerKey{10};
+  /** Whether flushes and compactions should bypass the page cache */
+  bool useDirectIoForCompaction{false};
+  /** The number of background threads used for flushes and compactions */
+  int backgroundThreads{16};
+  /** The codec used to compress blob contents */
+  LocalStoreCompression blobCompression{LocalStoreCompression::Zstd};
+  /** The codec used to compress trees */
+  LocalStoreCompression treeCompression{LocalStoreCompression::None};
+  /**
+   * The maximum size of the dictionary zstd builds from sampled blob
+   * contents, which makes small source files compress much better.  0
+   * disables dictionary compression.
+   */
+  size_t blobCompressionDictionarySize{16 * 1024};
+  /**
+   * The size that EdenServer's periodic garbage collection keeps the store
+   * under.  0 disables garbage collection.
+   */
+  uint64_t maxSize{0};
+  /**
+   * Whether blobs larger than LocalStore::kBlobChunkSize are split at
+   * content-defined boundaries rather than every kBlobChunkSize bytes.
+   * Content-defined chunks are shared by all the blobs that contain them, so
+   * the versions of a large file that only differ in places mostly share
+   * their storage.
+   */
+  bool contentDefinedBlobChunks{false};
+};
+
+/**
+ * The results of a LocalStore garbage collection pass.
+ */
+struct LocalStoreGcStats {
+  /** The approximate size of the store before garbage collection */
+  uint64_t sizeBefore{0};
+  /** The number of blobs evicted */
+  uint64_t blobsEvicted{0};
+  /** The uncompressed size of the blobs evicted */
+  uint64_t bytesEvicted{0};
+};
+
+/**
+ * The compaction state of one RocksDB column family of a LocalStore.
+ */
+struct LocalStoreColumnHealth {
+  /** The number of SST files at all levels */
+  uint64_t numSstFiles{0};
+  /**
+   * The number of SST files at level 0.  Every lookup has to check each of
+   * these, so a large number means high read amplification.
+   */
+  uint64_t numLevel0Files{0};
+  /** RocksDB's estimate of the bytes compaction still has to rewrite */
+  uint64_t pendingCompactionBytes{0};
+};
+
+/**
+ * The compaction state of a LocalStore's RocksDB, as reported by
+ * LocalStore::getHealth().
+ */
+struct LocalStoreHealth {
+  /** Per column family, indexed by LocalStore::KeySpace */
+  std::vector<LocalStoreColumnHealth> columns;
+  /** The number of compactions currently running */
+  uint64_t runningCompactions{0};
+  /** Whether RocksDB has stopped writes until compaction catches up */
+  bool writesStopped{false};
+  /** The rate writes are slowed to until compaction catches up, or 0 */
+  uint64_t delayedWriteRate{0};
+  /**
+   * The bytes written in batch mode, i.e. by bulk imports, since the store
+   * was opened.
+   */
+  uint64_t bulkBytesWritten{0};
+};
+
+/**
+ * The work done by a LocalStore::scrub() call.
+ */
+struct LocalStoreScrubStats {
+  /** The number of trees and blobs checked */
+  uint64_t objectsChecked{0};
+  /** The number of bytes of tree and blob data read */
+  uint64_t bytesChecked{0};
+  /** The number of corrupt trees and blobs removed from the store */
+  uint64_t objectsQuarantined{0};
+  /**
+   * The number of key spaces whose remaining data was skipped because
+   * RocksDB found corrupt blocks in it, which cannot be attributed to keys.
+   */
+  uint64_t unreadableKeySpaces{0};
+};
+
+struct LocalStoreScrubPosition;
+
 /*
  * LocalStore stores objects (trees and blobs) locally on disk.
  *
@@ -42,16 +184,44 @@ class Tree;
  * The LocalStore is only a cache.  If an object is not found in the LocalStore
  * then it will need to be retrieved from the BackingStore.
  *
- * LocalStore uses RocksDB for the underlying storage.
+ * LocalStore uses RocksDB for the underlying storage.  Each type of object is
+ * stored in its own RocksDB column family, so that it can be tuned
+ * separately, and so that streaming large amounts of blob data does not push
+ * trees and metadata out of the block cache.
  *
  * LocalStore is thread-safe, and can be used from multiple threads without
  * requiring the caller to perform locking around accesses to the LocalStore.
  */
 class LocalStore {
  public:
-  explicit LocalStore(AbsolutePathPiece pathToRocksDb);
+  /**
+   * The key spaces that LocalStore stores data in.
+   *
+   * Each key space is stored in a separate RocksDB column family, so the same
+   * key may be used independently in different key spaces.
+   */
+  enum KeySpace : size_t {
+    BlobFamily = 0,
+    BlobMetaDataFamily,
+    TreeFamily,
+    HgProxyHashFamily,
+    HgCommitToTreeFamily,
+    BlobAccessFamily,
+    BlobChunkFamily,
+    End, // Must be last
+  };
+
+  explicit LocalStore(
+      AbsolutePathPiece pathToRocksDb,
+      const LocalStoreOptions& options = LocalStoreOptions());
   virtual ~LocalStore();
 
+  /**
+   * Returns the name of a KeySpace, which is also the name of its RocksDB
+   * column family.
+   */
+  static folly::StringPiece getKeySpaceName(KeySpace keySpace);
+
   /**
    * Get arbitrary unserialized data from the store.
    *
@@ -60,8 +230,21 @@ class LocalStore {
    *
    * May throw exceptions on error.
    */
-  StoreResult get(folly::ByteRange key) const;
-  StoreResult get(const Hash& id) const;
+  StoreResult get(KeySpace keySpace, folly::ByteRange key) const;
+  StoreResult get(KeySpace keySpace, const Hash& id) const;
+
+  /**
+   * Get the data for several keys in the same key space.
+   *
+   * This looks up all of the keys in a single RocksDB MultiGet() call, which
+   * is cheaper than calling get() once per key.  Returns one StoreResult per
+   * input key, in the same order.
+   *
+   * May throw exceptions on error.
+   */
+  std::vector<StoreResult> getBatch(
+      KeySpace keySpace,
+      const std::vector<Hash>& ids) const;
 
   /**
    * Get a Tree from the store.
@@ -72,6 +255,26 @@ class LocalStore {
    */
   std::unique_ptr<Tree> getTree(const Hash& id) const;
 
+  /**
+   * Get several Trees from the store with a single lookup pass.
+   *
+   * Returns one result per input ID, in the same order.  Results are nullptr
+   * for IDs that are not present in the store.
+   */
+  std::vector<std::unique_ptr<Tree>> getTreeBatch(
+      const std::vector<Hash>& ids) const;
+
+  /**
+   * Get a read-only view of a Tree, without decoding its entries.
+   *
+   * The view refers directly to the data pinned in RocksDB, so loading a
+   * large directory this way does not allocate anything per entry.  Trees
+   * stored in the older git format are converted.
+   *
+   * Returns nullptr if this key is not present in the store.
+   */
+  std::unique_ptr<NativeTreeView> getTreeView(const Hash& id) const;
+
   /**
    * Get a Blob from the store.
    *
@@ -83,6 +286,24 @@ class LocalStore {
    */
   std::unique_ptr<Blob> getBlob(const Hash& id) const;
 
+  /**
+   * Blobs larger than this are stored in chunks, so that part of a large
+   * file can be read without reading all of it.  The chunks are this size,
+   * or average about this size with content-defined chunking.
+   */
+  static constexpr size_t kBlobChunkSize = 1024 * 1024;
+
+  /**
+   * Read up to length bytes of a blob's contents, starting at offset.
+   *
+   * Only the chunks that cover the range are read.  Returns nullptr if the
+   * blob contents are not present in the store, or if the blob is not stored
+   * in chunks: smaller blobs are cheaper to read with getBlob().  The result
+   * is empty if offset is at or past the end of the blob.
+   */
+  std::unique_ptr<folly::IOBuf>
+  getBlobRange(const Hash& id, uint64_t offset, size_t length) const;
+
   /**
    * Get the size of a blob and the SHA-1 hash of its contents.
    *
@@ -91,6 +312,15 @@ class LocalStore {
    */
   folly::Optional<BlobMetadata> getBlobMetadata(const Hash& id) const;
 
+  /**
+   * Get the metadata for several blobs with a single lookup pass.
+   *
+   * Returns one result per input ID, in the same order.  Results are
+   * folly::none for IDs that are not present in the store.
+   */
+  std::vector<folly::Optional<BlobMetadata>> getBlobMetadataBatch(
+      const std::vector<Hash>& ids) const;
+
   /**
    * Get the SHA-1 hash of the blob contents for the specified blob.
    *
@@ -100,7 +330,23 @@ class LocalStore {
   folly::Optional<Hash> getSha1ForBlob(const Hash& id) const;
 
   /**
-   * Compute the serialized version of the tree.
+   * Get the root Tree hash recorded for a source control commit.
+   *
+   * Returns folly::none if no mapping has been recorded for this commit, or
+   * throws an exception on error.
+   */
+  folly::Optional<Hash> getCommitRootTree(const Hash& commitID) const;
+
+  /**
+   * Record the root Tree hash for a source control commit, so that later
+   * lookups of the same commit do not need to consult the BackingStore.
+   */
+  void putCommitRootTree(const Hash& commitID, const Hash& rootTreeID);
+
+  /**
+   * Compute the serialized version of the tree, in the native tree format
+   * (see NativeTree.h).  Trees without a hash of their own are keyed by the
+   * SHA-1 of their git tree serialization.
    * Returns the key and the (not coalesced) serialized data.
    * This does not modify the contents of the store; it is the method
    * used by the putTree method to compute the data that it stores.
@@ -114,31 +360,66 @@ class LocalStore {
    * Store a Blob.
    *
    * Returns a BlobMetadata about the blob, which includes the SHA-1 hash of
-   * its contents.
+   * its contents.  If the blob is already stored, its existing metadata is
+   * returned without hashing the contents again.
    */
   BlobMetadata putBlob(const Hash& id, const Blob* blob);
 
+  /**
+   * Store a Blob whose contents SHA-1 hash is already known, so that the
+   * contents do not need to be hashed.
+   *
+   * The caller is responsible for contentsSha1 being correct.
+   */
+  BlobMetadata putBlob(
+      const Hash& id,
+      const Blob* blob,
+      const Hash& contentsSha1);
+
+  /**
+   * Store only the metadata of a Blob, and not its contents.
+   *
+   * This is for BackingStores that can read blob contents back cheaply
+   * themselves (see BackingStore::shouldStoreBlobContents()).  getBlob()
+   * continues to return nullptr for the blob, while getBlobMetadata()
+   * finds it.  A later putBlob() call still stores the contents.
+   */
+  BlobMetadata putBlobMetadata(const Hash& id, const Blob* blob);
+
+  /**
+   * Store metadata that a BackingStore computed without fetching the Blob
+   * (see BackingStore::getBlobMetadata()).
+   */
+  void putBlobMetadata(const Hash& id, const BlobMetadata& metadata);
+
   /**
    * Put arbitrary data in the store.
    */
-  void put(folly::ByteRange key, folly::ByteRange value);
-  void put(const Hash& id, folly::ByteRange value);
+  void put(KeySpace keySpace, folly::ByteRange key, folly::ByteRange value);
+  void put(KeySpace keySpace, const Hash& id, folly::ByteRange value);
 
   /**
    * Enables batch loading mode.
    * This configures the store to optimize for a bulk load of data
    * during manifest import.
    * In bulk loading mode, put operations will be deferred until flush
-   * is called, or until a read operation is performed.
+   * is called, or until the buffer fills up.  Reads see deferred writes
+   * without flushing them.
    *
    * The bufferSize configures the maximum amount of data to accumulate
    * (in encoded bytes) before flushing to storage.
+   *
+   * Several importers may use batch mode concurrently.  Each call must be
+   * paired with a call to disableBatchMode(), and the store stays in batch
+   * mode, with the largest requested bufferSize, until the last importer
+   * disables it.
    */
   void enableBatchMode(size_t bufferSize);
 
   /**
    * Disables batch loading mode.
-   * This will disable batch loading mode and flush any pending data.
+   * This will disable batch loading mode, unless other importers are still
+   * using it, and flush any pending data.
    * This may throw a RocksException if the flush fails.
    */
   void disableBatchMode();
@@ -151,42 +432,288 @@ class LocalStore {
 
   /**
    * Test whether the key is stored, or whether the key is pending storage
-   * as part of batch mode */
-  bool hasKey(folly::ByteRange key) const;
-  bool hasKey(const Hash& id) const;
+   * as part of batch mode.
+   *
+   * This is cheap enough to call before every put(): keys written recently
+   * are found in memory, and RocksDB's bloom filters and KeyMayExist() rule
+   * out most missing keys without reading from disk.
+   */
+  bool hasKey(KeySpace keySpace, folly::ByteRange key) const;
+  bool hasKey(KeySpace keySpace, const Hash& id) const;
+
+  /**
+   * Change the codec used to compress a key space.
+   *
+   * This takes effect for data written by subsequent flushes and
+   * compactions.  Existing data stays readable, and is recompressed as it is
+   * compacted.  Throws a RocksException on error.
+   */
+  void setCompression(KeySpace keySpace, LocalStoreCompression compression);
+
+  /**
+   * Get the approximate size of the store on disk, including data that has
+   * not been flushed from the memtables yet.
+   */
+  uint64_t getApproximateSize() const;
 
- private:
   /**
-   * In order to preserve read after write consistency, we must flush
-   * any pending writes prior to a read operation.  This is a const
-   * version of flush with some different logging to help detect
-   * and protect against this. */
-  void flushForRead() const;
+   * Evict blobs until the store is no larger than maxBytes.
+   *
+   * Blobs are evicted least recently used first, together with their
+   * metadata.  Blobs in referencedBlobs are never evicted.  Access times are
+   * only recorded for a sample of reads, and sizes are uncompressed, so this
+   * is approximate, and the store may stay somewhat above maxBytes until the
+   * next pass.
+   *
+   * Trees and the other key spaces are never evicted: they are comparatively
+   * small, and trees imported from flat manifests cannot be fetched from the
+   * BackingStore again on their own.
+   *
+   * Throws a RocksException on error.
+   */
+  LocalStoreGcStats collectGarbage(
+      uint64_t maxBytes,
+      const std::unordered_set<Hash>& referencedBlobs);
 
   /**
-   * Flushes the writeBatch if batch loading mode is not enabled, or
-   * if the writeBatchBufferSize_ is exceeded */
-  void flushIfNotBatch();
+   * Get the compaction state of the underlying RocksDB.
+   */
+  LocalStoreHealth getHealth() const;
+
+  /**
+   * Flush pending writes, and compact the whole key range of a key space
+   * down to the bottommost level.
+   *
+   * This blocks until the compaction has finished, which may take a long
+   * time for a large key space.  Background compactions keep running
+   * meanwhile.  Throws a RocksException on error.
+   */
+  void compact(KeySpace keySpace);
+
+  /**
+   * Check that the trees and blobs in the store are intact, continuing from
+   * position and stopping once about maxBytes bytes have been read.
+   *
+   * Trees must deserialize, and the contents of blobs must match the size
+   * and SHA-1 in their metadata.  Corrupt objects are removed, so that the
+   * ObjectStore fetches them from the BackingStore again the next time they
+   * are needed.  Reads bypass the block cache, so that scrubbing does not
+   * evict the data that FUSE requests use.
+   *
+   * Reads of objects never check them, so calling this a little at a time
+   * from a background thread is how the store is checked without slowing
+   * down reads.  Throws a RocksException on error.
+   */
+  LocalStoreScrubStats scrub(
+      LocalStoreScrubPosition* position,
+      uint64_t maxBytes);
+
+ private:
+  rocksdb::ColumnFamilyHandle* getColumn(KeySpace keySpace) const;
 
-  std::unique_ptr<rocksdb::DB> db_;
+  /**
+   * Look up a key in the key space's column family, falling back to the
+   * default column family of a DB written by an older version of eden.
+   *
+   * Returns false if the key is not present, or throws on error.  This does
+   * not consult or flush the pending writes.
+   */
+  bool lookup(
+      KeySpace keySpace,
+      folly::ByteRange key,
+      rocksdb::PinnableSlice* value) const;
+  bool lookupLegacy(
+      KeySpace keySpace,
+      folly::ByteRange key,
+      rocksdb::PinnableSlice* value) const;
+  bool lookupInColumn(
+      rocksdb::ColumnFamilyHandle* column,
+      folly::ByteRange key,
+      rocksdb::PinnableSlice* value) const;
 
   struct PendingWrite {
     /**
      * We need to track this via a pointer to avoid pulling in the full
-     * rocksdb headers */
-    std::unique_ptr<rocksdb::WriteBatch> writeBatch;
-    /**
-     * Tracks all of the keys inserted since enableBatchMode() was
-     * called. */
-    folly::StringKeyedUnorderedSet batchedKeys;
+     * rocksdb headers.  The batch is indexed, so that reads can find the
+     * keys in it without flushing it. */
+    std::unique_ptr<rocksdb::WriteBatchWithIndex> writeBatch;
   };
-  mutable folly::Synchronized<PendingWrite> pending_;
+  using PendingShard = folly::Synchronized<PendingWrite>;
+
+  /**
+   * Pending writes are split into shards by key, so that concurrent importers
+   * rarely contend on the same lock, and so that a read only has to check
+   * the one shard its key belongs to.
+   */
+  static constexpr size_t kNumPendingShards = 16;
+
+  /**
+   * Keys are sharded by their first Hash::RAW_SIZE bytes, so that the chunks
+   * of a blob are in the same shard as the blob itself.
+   */
+  PendingShard& getPendingShard(folly::ByteRange key) const;
+
+  /**
+   * Look up a key in the pending writes.  If value is non-null, the value is
+   * copied into it.  Returns false if the key is not pending.
+   */
+  bool lookupPending(
+      KeySpace keySpace,
+      folly::ByteRange key,
+      std::string* value) const;
+
+  /**
+   * Write the records added by addRecords(rocksdb::WriteBatchBase&) for key.
+   *
+   * Outside of batch mode the records are written immediately.  In batch
+   * mode they are added to the key's pending shard, which is flushed once it
+   * holds its share of writeBatchBufferSize_.
+   */
+  template <typename AddRecords>
+  void write(folly::ByteRange key, AddRecords&& addRecords);
+
+  /**
+   * Flush the writes pending in one shard.
+   * Will throw RocksException if an error is encountered.
+   */
+  void flushShard(PendingShard& shard);
+
+  /**
+   * Record that a blob was accessed, for use by collectGarbage().  If
+   * writeBatch is non-null the record is added to it, otherwise it is
+   * written immediately.
+   */
+  void recordBlobAccess(
+      const Hash& id,
+      uint64_t size,
+      rocksdb::WriteBatchBase* writeBatch) const;
+
+  /**
+   * Read one chunk of the chunked blob id from keySpace.  Throws if the
+   * chunk is missing.
+   */
+  StoreResult
+  getBlobChunk(const Hash& id, KeySpace keySpace, folly::ByteRange key) const;
+
+  /**
+   * Add the content-defined chunks of the blob id that are not already
+   * stored, its references to them and its chunk manifest to batch.
+   *
+   * The caller must hold blobChunkRefsMutex_.
+   */
+  void addContentDefinedChunks(
+      const Hash& id,
+      const folly::IOBuf& contents,
+      rocksdb::WriteBatchBase& batch) const;
+
+  /**
+   * Add the deletes that remove a blob along with its metadata, access
+   * record and chunks to batch.  If mayBeChunked is false the blob is
+   * assumed to be stored whole, which saves reading it.
+   *
+   * Content-defined chunks may be used by other blobs too, so only the
+   * blob's references to them are deleted.  Their keys are added to
+   * sharedChunks, to be passed to deleteUnusedChunks() once the batch has
+   * been written.
+   */
+  void addBlobDeletes(
+      const Hash& id,
+      bool mayBeChunked,
+      rocksdb::WriteBatch* batch,
+      std::vector<std::string>* sharedChunks);
+
+  /** Delete the content-defined chunks in chunkKeys that no blob uses. */
+  void deleteUnusedChunks(const std::vector<std::string>& chunkKeys);
+
+  /**
+   * Check a stored tree or blob for scrub(), returning a description of the
+   * problem if it is corrupt.  checkBlob() adds the size of any chunks it
+   * reads to bytesRead.
+   */
+  static folly::Optional<std::string> checkTree(
+      const Hash& id,
+      folly::StringPiece value);
+  folly::Optional<std::string> checkBlob(
+      const Hash& id,
+      folly::StringPiece value,
+      const rocksdb::ReadOptions& readOptions,
+      uint64_t* bytesRead) const;
+
+  /** Remove a corrupt tree or blob found by scrub() */
+  void
+  quarantine(KeySpace keySpace, const Hash& id, folly::StringPiece problem);
+
+  std::unique_ptr<RocksHandles> dbHandles_;
+
+  /**
+   * Set if the default column family contains data, which means the DB was
+   * written by an older version of eden that kept all objects there, with
+   * key suffixes in place of column families.
+   */
+  bool hasLegacyData_{false};
+
+  /** Whether large blobs are stored in content-defined chunks */
+  const bool contentDefinedBlobChunks_{false};
+
+  /**
+   * Held while writing content-defined chunks and while collectGarbage()
+   * deletes the ones that are no longer referenced.
+   */
+  std::mutex blobChunkRefsMutex_;
+
+  /**
+   * The compression currently configured for each key space.
+   */
+  folly::Synchronized<std::array<LocalStoreCompression, KeySpace::End>>
+      compression_;
+
+  mutable std::array<PendingShard, kNumPendingShards> pending_;
+  /**
+   * The number of shards in pending_ that have a writeBatch, so that
+   * lookups can skip locking the shards when there are none.
+   */
+  std::atomic<size_t> numPendingBatches_{0};
+
+  /**
+   * Returns the hash of a key in a key space, for recentKeys_.
+   */
+  static uint64_t hashKey(KeySpace keySpace, folly::ByteRange key);
+
+  static constexpr size_t kRecentKeySlots = 256 * 1024;
+  /**
+   * The keys written by put() and putBlob() recently, so that importers
+   * find them again without a RocksDB lookup.  Cleared whenever keys are
+   * deleted.
+   */
+  RecentKeyFilter recentKeys_{kRecentKeySlots};
 
   /**
    * Controls whether we are in batch mode or not.
    * 0 means no, otherwise it holds the size of the buffer to use for batching.
    */
-  size_t writeBatchBufferSize_{0};
+  std::atomic<size_t> writeBatchBufferSize_{0};
+
+  /** The value of LocalStoreHealth::bulkBytesWritten */
+  std::atomic<uint64_t> bulkBytesWritten_{0};
+
+  /**
+   * Protects batchModeUsers_, the number of importers that have enabled
+   * batch mode and not yet disabled it.
+   */
+  std::mutex batchModeMutex_;
+  size_t batchModeUsers_{0};
+};
+
+/**
+ * How far a pass of LocalStore::scrub() calls through the store has got.  A
+ * default constructed position starts a new pass.
+ */
+struct LocalStoreScrubPosition {
+  LocalStore::KeySpace keySpace{LocalStore::TreeFamily};
+  /** The key in keySpace to continue from, or empty to start from the top */
+  std::string nextKey;
+  /** Set once the pass has checked everything */
+  bool finished{false};
 };
 }
 }
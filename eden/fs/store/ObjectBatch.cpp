@@ -0,0 +1,113 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/store/ObjectBatch.h"
+
+#include <glog/logging.h>
+#include "eden/fs/model/Tree.h"
+#include "eden/fs/store/ObjectStore.h"
+
+using folly::Future;
+using std::shared_ptr;
+using std::unique_ptr;
+using std::vector;
+
+namespace facebook {
+namespace eden {
+
+namespace {
+template <typename T>
+vector<Hash> getIDs(const vector<std::pair<Hash, folly::Promise<T>>>& loads) {
+  vector<Hash> ids;
+  ids.reserve(loads.size());
+  for (const auto& load : loads) {
+    ids.push_back(load.first);
+  }
+  return ids;
+}
+
+/**
+ * Start the loads with startLoads(), and fulfil each of the promises with
+ * the corresponding result.
+ */
+template <typename T, typename StartLoads>
+void fulfilPromises(
+    vector<std::pair<Hash, folly::Promise<T>>>& promises,
+    StartLoads&& startLoads,
+    shared_ptr<void> token) {
+  if (promises.empty()) {
+    return;
+  }
+
+  vector<Future<T>> results;
+  try {
+    results = startLoads(getIDs(promises));
+  } catch (const std::exception& ex) {
+    folly::exception_wrapper ew{std::current_exception(), ex};
+    for (auto& entry : promises) {
+      entry.second.setException(ew);
+    }
+    return;
+  }
+
+  CHECK_EQ(promises.size(), results.size());
+  for (size_t n = 0; n < results.size(); ++n) {
+    results[n].then([ promise = std::move(promises[n].second), token ](
+        folly::Try<T> && t) mutable {
+      // Release the token before fulfilling the promise, which may run the
+      // continuation waiting on it.
+      token.reset();
+      promise.setTry(std::move(t));
+    });
+  }
+}
+}
+
+ObjectBatch::ObjectBatch() {}
+
+ObjectBatch::~ObjectBatch() {}
+
+Future<unique_ptr<Tree>> ObjectBatch::loadTree(const Hash& id) {
+  folly::Promise<unique_ptr<Tree>> promise;
+  auto future = promise.getFuture();
+  queued_.wlock()->trees.emplace_back(id, std::move(promise));
+  return future;
+}
+
+Future<BlobMetadata> ObjectBatch::loadBlobMetadata(const Hash& id) {
+  folly::Promise<BlobMetadata> promise;
+  auto future = promise.getFuture();
+  queued_.wlock()->blobMetadata.emplace_back(id, std::move(promise));
+  return future;
+}
+
+ObjectBatch::FlushCounts ObjectBatch::flush(
+    ObjectStore* store,
+    shared_ptr<void> treeToken,
+    shared_ptr<void> blobToken) {
+  QueuedLoads loads;
+  std::swap(loads, *queued_.wlock());
+
+  FlushCounts counts;
+  counts.trees = loads.trees.size();
+  counts.blobMetadata = loads.blobMetadata.size();
+  fulfilPromises(
+      loads.trees,
+      [store](const vector<Hash>& ids) { return store->getTreesBatch(ids); },
+      std::move(treeToken));
+  fulfilPromises(
+      loads.blobMetadata,
+      [store](const vector<Hash>& ids) {
+        return store->getBlobMetadataBatch(ids);
+      },
+      std::move(blobToken));
+  return counts;
+}
+}
+}
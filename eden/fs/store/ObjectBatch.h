@@ -0,0 +1,92 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <folly/futures/Future.h>
+#include <folly/futures/Promise.h>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "eden/fs/model/Hash.h"
+#include "eden/fs/store/BlobMetadata.h"
+
+namespace facebook {
+namespace eden {
+
+class ObjectStore;
+class Tree;
+
+/**
+ * ObjectBatch collects the Tree and BlobMetadata loads that code walking a
+ * directory needs, and sends them to the ObjectStore together.
+ *
+ * Callers queue loads while deciding what to do with each entry, and get a
+ * Future for each right away, so they can be written as ordinary Future
+ * continuations.  The loads are only started by flush(), which issues a
+ * single getTreesBatch() and getBlobMetadataBatch() call, so the objects
+ * that are not cached in memory are looked up in the LocalStore in one pass
+ * per batch rather than one per entry.
+ *
+ * ObjectBatch is thread-safe, so it may be shared by work running on
+ * several threads, and flushed repeatedly.
+ */
+class ObjectBatch {
+ public:
+  /** The number of loads started by a flush() call */
+  struct FlushCounts {
+    size_t trees{0};
+    size_t blobMetadata{0};
+  };
+
+  ObjectBatch();
+  ~ObjectBatch();
+
+  /**
+   * Queue a load of the Tree with the given ID.
+   */
+  folly::Future<std::unique_ptr<Tree>> loadTree(const Hash& id);
+
+  /**
+   * Queue a load of the metadata for the Blob with the given ID.
+   */
+  folly::Future<BlobMetadata> loadBlobMetadata(const Hash& id);
+
+  /**
+   * Start all of the loads queued since the last call to flush().
+   *
+   * treeToken and blobToken, if set, are held until the last Tree or
+   * BlobMetadata load completes respectively, and are released just before
+   * its Future is fulfilled.  This lets callers time the batch without
+   * including the work of the continuations waiting on it.
+   *
+   * If the ObjectStore fails to start the loads, their Futures fail with the
+   * same error.  Loads queued by continuations that run during flush() are
+   * left for the next call.
+   */
+  FlushCounts flush(
+      ObjectStore* store,
+      std::shared_ptr<void> treeToken = nullptr,
+      std::shared_ptr<void> blobToken = nullptr);
+
+ private:
+  // Forbidden copy constructor and assignment operator
+  ObjectBatch(const ObjectBatch&) = delete;
+  ObjectBatch& operator=(const ObjectBatch&) = delete;
+
+  struct QueuedLoads {
+    std::vector<std::pair<Hash, folly::Promise<std::unique_ptr<Tree>>>> trees;
+    std::vector<std::pair<Hash, folly::Promise<BlobMetadata>>> blobMetadata;
+  };
+
+  folly::Synchronized<QueuedLoads> queued_;
+};
+}
+}
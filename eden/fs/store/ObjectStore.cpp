@@ -12,12 +12,21 @@
 #include <folly/Conv.h>
 #include <folly/Optional.h>
 #include <folly/futures/Future.h>
+#include <folly/io/Cursor.h>
 #include <folly/io/IOBuf.h>
+#include <gflags/gflags.h>
+#include <algorithm>
 #include <stdexcept>
+#include <unordered_set>
 #include "BackingStore.h"
+#include "LiveTreeTable.h"
 #include "LocalStore.h"
+#include "TreeCache.h"
+#include "common/stats/ServiceData.h"
 #include "eden/fs/model/Blob.h"
 #include "eden/fs/model/Tree.h"
+#include "eden/utils/NumaTopology.h"
+#include "eden/utils/RequestTrace.h"
 
 using folly::Future;
 using folly::IOBuf;
@@ -25,15 +34,95 @@ using folly::makeFuture;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
+using std::chrono::steady_clock;
+
+DEFINE_uint64(
+    treeCacheSize,
+    64 * 1024 * 1024,
+    "The approximate maximum number of bytes of deserialized Trees to keep "
+    "in memory for each mount point.  0 disables the in-memory tree cache");
+DEFINE_uint64(
+    treeCacheShards,
+    16,
+    "The number of independently locked shards to split the in-memory tree "
+    "cache into.  With --numaAware, each NUMA node gets this many shards");
+DEFINE_uint64(
+    symlinkCacheSize,
+    16 * 1024,
+    "The maximum number of symlink targets to keep in memory for each mount "
+    "point");
 
 namespace facebook {
 namespace eden {
 
+namespace {
+/**
+ * Replace a Tree loaded from the LocalStore or BackingStore with the copy
+ * other mounts are already using, if there is one, and add it to the
+ * TreeCache.  liveTrees may be null.
+ */
+shared_ptr<const Tree> shareTree(
+    TreeCache& treeCache,
+    LiveTreeTable* liveTrees,
+    shared_ptr<const Tree> tree) {
+  if (liveTrees) {
+    tree = liveTrees->intern(std::move(tree));
+  }
+  if (treeCache.getMaxBytes() > 0) {
+    treeCache.insert(tree);
+  }
+  return tree;
+}
+
+/**
+ * Add a Tree loaded from the LocalStore or BackingStore to the TreeCache, and
+ * return a copy of it for the caller.
+ */
+unique_ptr<Tree> cacheTree(
+    TreeCache& treeCache,
+    LiveTreeTable* liveTrees,
+    unique_ptr<Tree> tree) {
+  if (treeCache.getMaxBytes() == 0) {
+    return tree;
+  }
+  auto sharedTree = shareTree(
+      treeCache, liveTrees, shared_ptr<const Tree>(std::move(tree)));
+  return std::make_unique<Tree>(*sharedTree);
+}
+
+/**
+ * Store a Blob fetched from the BackingStore in the LocalStore, or only its
+ * metadata if the BackingStore does not need the LocalStore to keep a copy.
+ */
+BlobMetadata storeBlob(
+    LocalStore& localStore,
+    const BackingStore& backingStore,
+    const Hash& id,
+    const Blob* blob) {
+  if (backingStore.shouldStoreBlobContents()) {
+    return localStore.putBlob(id, blob);
+  }
+  return localStore.putBlobMetadata(id, blob);
+}
+}
+
 ObjectStore::ObjectStore(
     shared_ptr<LocalStore> localStore,
-    shared_ptr<BackingStore> backingStore)
+    shared_ptr<BackingStore> backingStore,
+    shared_ptr<BlobCache> blobCache,
+    shared_ptr<BlobPack> blobPack,
+    shared_ptr<LiveTreeTable> liveTrees)
     : localStore_(std::move(localStore)),
-      backingStore_(std::move(backingStore)) {}
+      backingStore_(std::move(backingStore)),
+      treeCache_(std::make_shared<TreeCache>(
+          FLAGS_treeCacheSize,
+          FLAGS_treeCacheShards,
+          NumaTopology::get().getNumNodes())),
+      blobCache_(std::move(blobCache)),
+      blobPack_(std::move(blobPack)),
+      liveTrees_(std::move(liveTrees)),
+      symlinkCache_(std::make_shared<SymlinkCache>(
+          std::max<uint64_t>(FLAGS_symlinkCacheSize, 1))) {}
 
 ObjectStore::~ObjectStore() {}
 
@@ -42,25 +131,151 @@ unique_ptr<Tree> ObjectStore::getTree(const Hash& id) const {
 }
 
 Future<unique_ptr<Tree>> ObjectStore::getTreeFuture(const Hash& id) const {
-  // Check in the LocalStore first
+  // Check the in-memory cache first.  Callers get their own copy of the
+  // cached Tree, which is still much cheaper than reading it from the
+  // LocalStore and deserializing it again.
+  auto cachedTree = getCachedTree(id);
+  if (cachedTree) {
+    return makeFuture(std::make_unique<Tree>(*cachedTree));
+  }
+
+  // Then check in the LocalStore
+  auto lookupStart = steady_clock::now();
   auto tree = localStore_->getTree(id);
+  RequestTrace::addTime(RequestTrace::LOCAL_STORE, lookupStart);
   if (tree) {
     VLOG(4) << "tree " << id << " found in local store";
-    return makeFuture(std::move(tree));
+    return makeFuture(
+        cacheTree(*treeCache_, liveTrees_.get(), std::move(tree)));
+  }
+
+  return getTreeFromBackingStore(id);
+}
+
+Future<shared_ptr<const Tree>> ObjectStore::getSharedTreeFuture(
+    const Hash& id) const {
+  auto cachedTree = getCachedTree(id);
+  if (cachedTree) {
+    return makeFuture(std::move(cachedTree));
   }
 
-  // Note: We don't currently have logic here to avoid duplicate work if
-  // multiple callers request the same tree at once.  We could store a map of
-  // pending lookups as (Hash --> std::list<Promise<unique_ptr<Tree>>), and
-  // just add a new Promise to the list if this Hash already exists in the
-  // pending list.
-  //
-  // However, de-duplication of object loads will already be done at the Inode
-  // layer.  Therefore we currently don't bother de-duping loads at this layer.
+  auto lookupStart = steady_clock::now();
+  auto tree = localStore_->getTree(id);
+  RequestTrace::addTime(RequestTrace::LOCAL_STORE, lookupStart);
+  if (tree) {
+    VLOG(4) << "tree " << id << " found in local store";
+    return makeFuture(shareTree(
+        *treeCache_,
+        liveTrees_.get(),
+        shared_ptr<const Tree>(std::move(tree))));
+  }
+
+  return getSharedTreeFromBackingStore(id);
+}
+
+std::vector<Future<unique_ptr<Tree>>> ObjectStore::getTreesBatch(
+    const std::vector<Hash>& ids) const {
+  // Look up everything that is not in the in-memory cache in a single
+  // LocalStore pass.
+  std::vector<shared_ptr<const Tree>> cachedTrees;
+  std::vector<Hash> uncachedIds;
+  cachedTrees.reserve(ids.size());
+  for (const auto& id : ids) {
+    cachedTrees.push_back(getCachedTree(id));
+    if (!cachedTrees.back()) {
+      uncachedIds.push_back(id);
+    }
+  }
+  auto lookupStart = steady_clock::now();
+  auto localTrees = localStore_->getTreeBatch(uncachedIds);
+  RequestTrace::addTime(RequestTrace::LOCAL_STORE, lookupStart);
+
+  std::vector<Future<unique_ptr<Tree>>> results;
+  results.reserve(ids.size());
+  size_t localIndex = 0;
+  for (size_t n = 0; n < ids.size(); ++n) {
+    if (cachedTrees[n]) {
+      results.push_back(makeFuture(std::make_unique<Tree>(*cachedTrees[n])));
+      continue;
+    }
+
+    auto& localTree = localTrees[localIndex++];
+    if (localTree) {
+      results.push_back(
+          makeFuture(cacheTree(
+              *treeCache_, liveTrees_.get(), std::move(localTree))));
+    } else {
+      results.push_back(getTreeFromBackingStore(ids[n]));
+    }
+  }
+  return results;
+}
+
+shared_ptr<const Tree> ObjectStore::getCachedTree(const Hash& id) const {
+  if (treeCache_->getMaxBytes() > 0) {
+    auto cachedTree = treeCache_->get(id);
+    if (cachedTree) {
+      VLOG(4) << "tree " << id << " found in tree cache";
+      fbData->incrementCounter("object_store.tree_cache.hit");
+      return cachedTree;
+    }
+    fbData->incrementCounter("object_store.tree_cache.miss");
+  }
+
+  // Another mount point may be using this Tree already.
+  if (liveTrees_) {
+    auto liveTree = liveTrees_->get(id);
+    if (liveTree) {
+      VLOG(4) << "tree " << id << " found in use by another mount";
+      fbData->incrementCounter("object_store.live_trees.hit");
+      if (treeCache_->getMaxBytes() > 0) {
+        treeCache_->insert(liveTree);
+      }
+      return liveTree;
+    }
+  }
+  return nullptr;
+}
+
+Future<unique_ptr<Tree>> ObjectStore::getTreeFromBackingStore(
+    const Hash& id) const {
+  // Each caller gets its own copy of the shared result.
+  return getSharedTreeFromBackingStore(id).then(
+      [](shared_ptr<const Tree> loadedTree) {
+        return std::make_unique<Tree>(*loadedTree);
+      });
+}
+
+Future<shared_ptr<const Tree>> ObjectStore::getSharedTreeFromBackingStore(
+    const Hash& id) const {
+  // Load the tree from the BackingStore, sharing the fetch with any other
+  // callers currently waiting on the same tree.
+  auto fetchStart = steady_clock::now();
+  return pendingTrees_.get(id, [this, id] { return fetchTree(id); })
+      .then([fetchStart](shared_ptr<const Tree> loadedTree) {
+        RequestTrace::addTime(RequestTrace::BACKING_STORE, fetchStart);
+        return loadedTree;
+      });
+}
+
+TreeCacheStats ObjectStore::getTreeCacheStats() const {
+  return treeCache_->getStats();
+}
+
+void ObjectStore::setTreeCacheSize(size_t maxBytes) {
+  treeCache_->setMaxBytes(maxBytes);
+}
+
+void ObjectStore::shrinkTreeCache(size_t targetBytes) {
+  treeCache_->shrink(targetBytes);
+}
 
-  // Load the tree from the BackingStore.
-  return backingStore_->getTree(id).then([id](
-      std::unique_ptr<Tree> loadedTree) {
+Future<shared_ptr<const Tree>> ObjectStore::fetchTree(const Hash& id) const {
+  return backingStore_->getTree(id).then([
+    treeCache = treeCache_,
+    liveTrees = liveTrees_,
+    id
+  ](std::unique_ptr<Tree> loadedTree) {
     if (!loadedTree) {
       // TODO: Perhaps we should do some short-term negative caching?
       VLOG(2) << "unable to find tree " << id;
@@ -74,7 +289,10 @@ Future<unique_ptr<Tree>> ObjectStore::getTreeFuture(const Hash& id) const {
     //
     // localStore_->putTree(loadedTree.get());
     VLOG(3) << "tree " << id << " retrieved from backing store";
-    return loadedTree;
+    return shareTree(
+        *treeCache,
+        liveTrees.get(),
+        shared_ptr<const Tree>(std::move(loadedTree)));
   });
 }
 
@@ -83,15 +301,60 @@ unique_ptr<Blob> ObjectStore::getBlob(const Hash& id) const {
 }
 
 Future<unique_ptr<Blob>> ObjectStore::getBlobFuture(const Hash& id) const {
+  auto lookupStart = steady_clock::now();
   auto blob = localStore_->getBlob(id);
+  RequestTrace::addTime(RequestTrace::LOCAL_STORE, lookupStart);
   if (blob) {
     VLOG(4) << "blob " << id << "  found in local store";
     return makeFuture(std::move(blob));
   }
 
-  // Look in the BackingStore
+  // Look in the BackingStore.  Copying a Blob is cheap, since the copies
+  // share the same underlying buffer.
+  auto fetchStart = steady_clock::now();
+  return pendingBlobs_.get(id, [this, id] { return fetchBlob(id); })
+      .then([fetchStart](shared_ptr<const Blob> loadedBlob) {
+        RequestTrace::addTime(RequestTrace::BACKING_STORE, fetchStart);
+        return std::make_unique<Blob>(*loadedBlob);
+      });
+}
+
+unique_ptr<folly::IOBuf>
+ObjectStore::getBlobRange(const Hash& id, uint64_t offset, size_t length)
+    const {
+  auto lookupStart = steady_clock::now();
+  auto contents = localStore_->getBlobRange(id, offset, length);
+  RequestTrace::addTime(RequestTrace::LOCAL_STORE, lookupStart);
+  return contents;
+}
+
+Future<string> ObjectStore::getSymlinkTarget(const Hash& id) const {
+  {
+    std::lock_guard<std::mutex> guard(symlinkCache_->mutex);
+    auto it = symlinkCache_->targets.find(id);
+    if (it != symlinkCache_->targets.end()) {
+      fbData->incrementCounter("object_store.symlink_cache.hit");
+      return makeFuture(it->second);
+    }
+  }
+
+  fbData->incrementCounter("object_store.symlink_cache.miss");
+  return getBlobFuture(id).then(
+      [ cache = symlinkCache_, id ](unique_ptr<Blob> blob) {
+        const auto& contents = blob->getContents();
+        folly::io::Cursor cursor(&contents);
+        auto target =
+            cursor.readFixedString(contents.computeChainDataLength());
+        std::lock_guard<std::mutex> guard(cache->mutex);
+        cache->targets.set(id, target);
+        return target;
+      });
+}
+
+Future<shared_ptr<const Blob>> ObjectStore::fetchBlob(const Hash& id) const {
   return backingStore_->getBlob(id).then(
-      [ localStore = localStore_, id ](std::unique_ptr<Blob> loadedBlob) {
+      [ localStore = localStore_, backingStore = backingStore_, id ](
+          std::unique_ptr<Blob> loadedBlob) {
         if (!loadedBlob) {
           VLOG(2) << "unable to find blob " << id;
           // TODO: Perhaps we should do some short-term negative caching?
@@ -100,8 +363,8 @@ Future<unique_ptr<Blob>> ObjectStore::getBlobFuture(const Hash& id) const {
         }
 
         VLOG(3) << "blob " << id << "  retrieved from backing store";
-        localStore->putBlob(id, loadedBlob.get());
-        return loadedBlob;
+        storeBlob(*localStore, *backingStore, id, loadedBlob.get());
+        return shared_ptr<const Blob>(std::move(loadedBlob));
       });
 }
 
@@ -109,18 +372,21 @@ Future<unique_ptr<Tree>> ObjectStore::getTreeForCommit(
     const Hash& commitID) const {
   VLOG(3) << "getTreeForCommit(" << commitID << ")";
 
-  return backingStore_->getTreeForCommit(commitID).then(
-      [commitID](std::unique_ptr<Tree> tree) {
-        if (!tree) {
-          throw std::domain_error(folly::to<string>(
-              "unable to import commit ", commitID.toString()));
-        }
+  return backingStore_->getTreeForCommit(commitID).then([
+    treeCache = treeCache_,
+    liveTrees = liveTrees_,
+    commitID
+  ](std::unique_ptr<Tree> tree) {
+    if (!tree) {
+      throw std::domain_error(
+          folly::to<string>("unable to import commit ", commitID.toString()));
+    }
 
-        // For now we assume that the BackingStore will insert the Tree into the
-        // LocalStore on its own, so we don't have to update the LocalStore
-        // ourselves here.
-        return tree;
-      });
+    // For now we assume that the BackingStore will insert the Tree into the
+    // LocalStore on its own, so we don't have to update the LocalStore
+    // ourselves here.
+    return cacheTree(*treeCache, liveTrees.get(), std::move(tree));
+  });
 }
 
 Hash ObjectStore::getSha1ForBlob(const Hash& id) const {
@@ -129,26 +395,211 @@ Hash ObjectStore::getSha1ForBlob(const Hash& id) const {
 }
 
 Future<BlobMetadata> ObjectStore::getBlobMetadata(const Hash& id) const {
+  auto lookupStart = steady_clock::now();
   auto localData = localStore_->getBlobMetadata(id);
+  RequestTrace::addTime(RequestTrace::LOCAL_STORE, lookupStart);
   if (localData.hasValue()) {
     return localData.value();
   }
+  return getBlobMetadataFromBackingStore(id);
+}
 
-  // Load the blob from the BackingStore.
-  //
-  // TODO: It would be nice to add a smarter API to the BackingStore so that we
-  // can query it just for the blob metadata if it supports getting that
-  // without retrieving the full blob data.
-  return backingStore_->getBlob(id).then(
-      [ localStore = localStore_, id ](std::unique_ptr<Blob> blob) {
-        if (!blob) {
-          // TODO: Perhaps we should do some short-term negative caching?
-          throw std::domain_error(
-              folly::to<string>("blob ", id.toString(), " not found"));
+std::vector<Future<BlobMetadata>> ObjectStore::getBlobMetadataBatch(
+    const std::vector<Hash>& ids) const {
+  auto lookupStart = steady_clock::now();
+  auto localData = localStore_->getBlobMetadataBatch(ids);
+  RequestTrace::addTime(RequestTrace::LOCAL_STORE, lookupStart);
+
+  std::vector<Future<BlobMetadata>> results;
+  results.reserve(ids.size());
+  for (size_t n = 0; n < ids.size(); ++n) {
+    if (localData[n].hasValue()) {
+      results.push_back(makeFuture(localData[n].value()));
+    } else {
+      results.push_back(getBlobMetadataFromBackingStore(ids[n]));
+    }
+  }
+  return results;
+}
+
+Future<BlobMetadata> ObjectStore::getBlobMetadataFromBackingStore(
+    const Hash& id) const {
+  auto fetchStart = steady_clock::now();
+  return pendingMetadata_.get(id, [this, id] { return fetchBlobMetadata(id); })
+      .then([fetchStart](shared_ptr<const BlobMetadata> metadata) {
+        RequestTrace::addTime(RequestTrace::BACKING_STORE, fetchStart);
+        return *metadata;
+      });
+}
+
+Future<shared_ptr<const BlobMetadata>> ObjectStore::fetchBlobMetadata(
+    const Hash& id) const {
+  // Ask the BackingStore for just the metadata first, so that stat() and
+  // SHA-1 requests for cold files don't transfer their whole contents.
+  using MetadataTry = folly::Try<folly::Optional<BlobMetadata>>;
+  return backingStore_->getBlobMetadata(id).then([this, id](
+      MetadataTry&& result) -> Future<shared_ptr<const BlobMetadata>> {
+    if (result.hasException()) {
+      VLOG(2) << "unable to fetch metadata of blob " << id
+              << " alone, fetching the whole blob: "
+              << result.exception().what();
+    } else if (result.value().hasValue()) {
+      VLOG(3) << "metadata of blob " << id << " retrieved from backing store";
+      fbData->incrementCounter("object_store.blob_metadata.direct");
+      const auto& metadata = result.value().value();
+      localStore_->putBlobMetadata(id, metadata);
+      return makeFuture(shared_ptr<const BlobMetadata>(
+          std::make_shared<BlobMetadata>(metadata)));
+    }
+
+    // Load the whole blob.  This shares the fetch with any concurrent
+    // getBlobFuture() calls for the same blob.
+    fbData->incrementCounter("object_store.blob_metadata.blob_load");
+    return pendingBlobs_.get(id, [this, id] { return fetchBlob(id); })
+        .then([
+          localStore = localStore_,
+          backingStore = backingStore_,
+          id
+        ](shared_ptr<const Blob> blob) {
+          // fetchBlob() has already stored the blob, so this just looks up
+          // its metadata.
+          return shared_ptr<const BlobMetadata>(std::make_shared<BlobMetadata>(
+              storeBlob(*localStore, *backingStore, id, blob.get())));
+        });
+  });
+}
+
+Future<BlobPrefetchStats> ObjectStore::prefetchBlobs(
+    const std::vector<Hash>& ids,
+    size_t batchSize,
+    size_t maxConcurrency) const {
+  auto stats = std::make_shared<BlobPrefetchStats>();
+  std::vector<std::vector<Hash>> batches;
+  std::unordered_set<Hash> seen;
+  // If the LocalStore only keeps blob metadata, prefetching just fills that
+  // in, and there is nothing to do for blobs whose metadata is present.
+  auto presentKeySpace = backingStore_->shouldStoreBlobContents()
+      ? LocalStore::BlobFamily
+      : LocalStore::BlobMetaDataFamily;
+  for (const auto& id : ids) {
+    if (!seen.insert(id).second) {
+      continue;
+    }
+    if (localStore_->hasKey(presentKeySpace, id)) {
+      ++stats->blobsAlreadyPresent;
+      continue;
+    }
+    if (batches.empty() || batches.back().size() >= batchSize) {
+      batches.emplace_back();
+      batches.back().reserve(batchSize);
+    }
+    batches.back().push_back(id);
+  }
+  fbData->incrementCounter(
+      "object_store.prefetch.already_present", stats->blobsAlreadyPresent);
+  VLOG(1) << "prefetching " << (ids.size() - stats->blobsAlreadyPresent)
+          << " blobs in " << batches.size() << " batches";
+
+  auto batchFutures = folly::window(
+      std::move(batches),
+      [ localStore = localStore_, backingStore = backingStore_, stats ](
+          const std::vector<Hash>& batch) {
+        return folly::collectAll(backingStore->getBlobs(batch))
+            .then([localStore, backingStore, stats, batch](
+                std::vector<folly::Try<unique_ptr<Blob>>> results) {
+              BlobPrefetchStats batchStats;
+              for (size_t n = 0; n < results.size(); ++n) {
+                if (results[n].hasValue() && results[n].value()) {
+                  const auto& blob = results[n].value();
+                  storeBlob(*localStore, *backingStore, batch[n], blob.get());
+                  ++batchStats.blobsFetched;
+                  batchStats.bytesFetched +=
+                      blob->getContents().computeChainDataLength();
+                } else {
+                  VLOG(2) << "failed to prefetch blob " << batch[n];
+                }
+              }
+              // Update the counters as each batch completes, so they show
+              // the progress of a large prefetch.  The continuations of
+              // different batches may run concurrently, so the stats are
+              // only summed up once all of them are done.
+              batchStats.blobsFailed = results.size() - batchStats.blobsFetched;
+              fbData->incrementCounter(
+                  "object_store.prefetch.fetched", batchStats.blobsFetched);
+              fbData->incrementCounter(
+                  "object_store.prefetch.failed", batchStats.blobsFailed);
+              return batchStats;
+            });
+      },
+      std::max<size_t>(maxConcurrency, 1));
+
+  return folly::collectAll(batchFutures)
+      .then([stats](std::vector<folly::Try<BlobPrefetchStats>> results) {
+        for (const auto& result : results) {
+          if (result.hasValue()) {
+            stats->blobsFetched += result.value().blobsFetched;
+            stats->blobsFailed += result.value().blobsFailed;
+            stats->bytesFetched += result.value().bytesFetched;
+          } else {
+            LOG(WARNING) << "error prefetching blobs: "
+                         << result.exception().what();
+          }
         }
+        return *stats;
+      });
+}
+
+Future<TreeWarmUpStats> ObjectStore::warmUpTrees(
+    const std::vector<Hash>& ids,
+    size_t depth,
+    size_t maxTrees) const {
+  auto stats = std::make_shared<TreeWarmUpStats>();
+  return warmUpTreeLevel(ids, depth, maxTrees, stats).then([stats] {
+    fbData->incrementCounter(
+        "object_store.warm_up.trees_loaded", stats->treesLoaded);
+    fbData->incrementCounter(
+        "object_store.warm_up.trees_failed", stats->treesFailed);
+    return *stats;
+  });
+}
 
-        return localStore->putBlob(id, blob.get());
+Future<folly::Unit> ObjectStore::warmUpTreeLevel(
+    std::vector<Hash> ids,
+    size_t depth,
+    size_t maxTrees,
+    shared_ptr<TreeWarmUpStats> stats) const {
+  auto numDone = stats->treesLoaded + stats->treesFailed;
+  if (depth == 0 || ids.empty() || numDone >= maxTrees) {
+    return folly::makeFuture();
+  }
+  if (ids.size() > maxTrees - numDone) {
+    ids.resize(maxTrees - numDone);
+  }
+
+  return folly::collectAll(getTreesBatch(ids)).then(
+      [this, depth, maxTrees, stats](
+          std::vector<folly::Try<unique_ptr<Tree>>> results) {
+        std::vector<Hash> subtrees;
+        for (const auto& result : results) {
+          if (!result.hasValue()) {
+            VLOG(2) << "failed to warm up tree: " << result.exception().what();
+            ++stats->treesFailed;
+            continue;
+          }
+          ++stats->treesLoaded;
+          for (const auto& entry : result.value()->getTreeEntries()) {
+            if (entry.getType() == TreeEntryType::TREE) {
+              subtrees.push_back(entry.getHash());
+            }
+          }
+        }
+        return warmUpTreeLevel(
+            std::move(subtrees), depth - 1, maxTrees, stats);
       });
 }
+
+std::vector<Hash> ObjectStore::getRecentTreeIds(size_t maxTrees) const {
+  return treeCache_->getRecentIds(maxTrees);
+}
 }
 } // facebook::eden
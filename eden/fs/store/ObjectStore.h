@@ -9,18 +9,56 @@
  */
 #pragma once
 
+#include <folly/EvictingCacheMap.h>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "eden/fs/model/Hash.h"
+#include "eden/fs/store/BlobMetadata.h"
 #include "eden/fs/store/IObjectStore.h"
+#include "eden/fs/store/TreeCache.h"
+#include "eden/utils/InFlightMap.h"
+
+namespace folly {
+class IOBuf;
+}
 
 namespace facebook {
 namespace eden {
 
 class BackingStore;
 class Blob;
-class Hash;
+class BlobCache;
+class BlobPack;
+class LiveTreeTable;
 class LocalStore;
 class Tree;
 
+/**
+ * The results of ObjectStore::prefetchBlobs().
+ */
+struct BlobPrefetchStats {
+  /** The number of Blobs that were already in the LocalStore */
+  size_t blobsAlreadyPresent{0};
+  /** The number of Blobs fetched from the BackingStore */
+  size_t blobsFetched{0};
+  /** The number of Blobs the BackingStore failed to fetch */
+  size_t blobsFailed{0};
+  /** The total size of the Blobs fetched from the BackingStore */
+  uint64_t bytesFetched{0};
+};
+
+/**
+ * The results of ObjectStore::warmUpTrees().
+ */
+struct TreeWarmUpStats {
+  /** The number of Trees loaded */
+  size_t treesLoaded{0};
+  /** The number of Trees that could not be loaded */
+  size_t treesFailed{0};
+};
+
 /**
  * ObjectStore is a content-addressed store for eden object data.
  *
@@ -30,12 +68,28 @@ class Tree;
  * - BackingStore, which represents the authoritative source for the object
  *   data.  The BackingStore is generally more expensive to query for object
  *   data, and may not be available during offline operation.
+ *
+ * Recently used Trees are also kept deserialized in memory in a TreeCache,
+ * in front of the LocalStore.  Concurrent requests for the same object that
+ * miss in the LocalStore share a single BackingStore fetch.  ObjectStores
+ * that share a LiveTreeTable also share the Trees that any of them is using.
  */
 class ObjectStore : public IObjectStore {
  public:
+  /**
+   * Create an ObjectStore.
+   *
+   * blobCache may be null, in which case Blob contents are not cached in
+   * memory.  Likewise blobPack may be null, in which case hot Blobs are not
+   * kept in memory-mapped files, and liveTrees may be null, in which case
+   * Trees are not shared with other ObjectStores.
+   */
   ObjectStore(
       std::shared_ptr<LocalStore> localStore,
-      std::shared_ptr<BackingStore> backingStore);
+      std::shared_ptr<BackingStore> backingStore,
+      std::shared_ptr<BlobCache> blobCache = nullptr,
+      std::shared_ptr<BlobPack> blobPack = nullptr,
+      std::shared_ptr<LiveTreeTable> liveTrees = nullptr);
   virtual ~ObjectStore();
 
   /**
@@ -78,6 +132,16 @@ class ObjectStore : public IObjectStore {
   folly::Future<std::unique_ptr<Tree>> getTreeFuture(
       const Hash& id) const override;
 
+  /**
+   * Get a Tree by ID, sharing it with the in-memory tree cache.
+   *
+   * This behaves like getTreeFuture(), but avoids copying the Tree when it
+   * is already cached.  Callers that keep the Tree around for a long time
+   * (such as TreeInode) should prefer this.
+   */
+  folly::Future<std::shared_ptr<const Tree>> getSharedTreeFuture(
+      const Hash& id) const;
+
   /**
    * Get a Blob by ID.
    *
@@ -88,6 +152,26 @@ class ObjectStore : public IObjectStore {
   folly::Future<std::unique_ptr<Blob>> getBlobFuture(
       const Hash& id) const override;
 
+  /**
+   * Read up to length bytes of a Blob's contents, starting at offset, without
+   * loading the whole Blob.
+   *
+   * This is only possible for large blobs that are already in the
+   * LocalStore (see LocalStore::getBlobRange()).  Returns nullptr otherwise,
+   * in which case the caller should load the whole Blob instead.
+   */
+  std::unique_ptr<folly::IOBuf>
+  getBlobRange(const Hash& id, uint64_t offset, size_t length) const;
+
+  /**
+   * Get the contents of a Blob as a string, for use as a symlink target.
+   *
+   * Symlink targets are small and read far more often than other files, so
+   * the most recently used ones are kept in a dedicated cache keyed by Blob
+   * ID, and do not have to be loaded again from the LocalStore.
+   */
+  folly::Future<std::string> getSymlinkTarget(const Hash& id) const;
+
   /**
    * Get a commit's root Tree.
    *
@@ -107,6 +191,65 @@ class ObjectStore : public IObjectStore {
    */
   folly::Future<BlobMetadata> getBlobMetadata(const Hash& id) const override;
 
+  /**
+   * Get several Trees by ID.
+   *
+   * The Trees that are not in the in-memory cache are looked up in the
+   * LocalStore in a single pass, which is cheaper than calling
+   * getTreeFuture() once per ID.  Returns one Future per input ID, in the
+   * same order.
+   */
+  std::vector<folly::Future<std::unique_ptr<Tree>>> getTreesBatch(
+      const std::vector<Hash>& ids) const;
+
+  /**
+   * Get metadata about several Blobs.
+   *
+   * The metadata is looked up in the LocalStore in a single pass, which is
+   * cheaper than calling getBlobMetadata() once per ID.  Returns one Future
+   * per input ID, in the same order.
+   */
+  std::vector<folly::Future<BlobMetadata>> getBlobMetadataBatch(
+      const std::vector<Hash>& ids) const;
+
+  /**
+   * Make sure that the specified Blobs are in the LocalStore, fetching the
+   * ones that are missing from the BackingStore.
+   *
+   * The missing Blobs are requested from the BackingStore in batches of
+   * batchSize, with at most maxConcurrency batches outstanding at once, so
+   * that a large prefetch leaves BackingStore capacity for the Blobs that
+   * are needed right away.  Failures to fetch individual Blobs are counted
+   * and logged, but do not fail the prefetch, since those Blobs will still
+   * be fetched on demand.
+   */
+  folly::Future<BlobPrefetchStats> prefetchBlobs(
+      const std::vector<Hash>& ids,
+      size_t batchSize,
+      size_t maxConcurrency) const;
+
+  /**
+   * Load the Trees with the given IDs, and their subtrees down to depth
+   * levels, so that later lookups find them in memory.
+   *
+   * A depth of 1 loads just the given Trees.  Each level is requested with
+   * a single getTreesBatch() call, and at most maxTrees Trees are loaded in
+   * total.  Failures to load individual Trees are counted, but do not fail
+   * the warm-up.
+   *
+   * The ObjectStore must remain valid until the returned Future completes.
+   */
+  folly::Future<TreeWarmUpStats> warmUpTrees(
+      const std::vector<Hash>& ids,
+      size_t depth,
+      size_t maxTrees) const;
+
+  /**
+   * Get the IDs of up to maxTrees of the most recently used Trees in the
+   * in-memory tree cache.
+   */
+  std::vector<Hash> getRecentTreeIds(size_t maxTrees) const;
+
   /**
    * Get the LocalStore used by this ObjectStore
    */
@@ -121,11 +264,69 @@ class ObjectStore : public IObjectStore {
     return backingStore_;
   }
 
+  /**
+   * Get the in-memory cache of Blob contents, or nullptr if there is none.
+   *
+   * Multiple ObjectStores may share the same BlobCache.
+   */
+  const std::shared_ptr<BlobCache>& getBlobCache() const {
+    return blobCache_;
+  }
+
+  /**
+   * Get the memory-mapped pack of hot Blob contents, or nullptr if there is
+   * none.
+   *
+   * Multiple ObjectStores may share the same BlobPack.
+   */
+  const std::shared_ptr<BlobPack>& getBlobPack() const {
+    return blobPack_;
+  }
+
+  /**
+   * Get a snapshot of the in-memory tree cache statistics.
+   */
+  TreeCacheStats getTreeCacheStats() const;
+
+  /**
+   * Change the memory budget of the in-memory tree cache.  0 disables it.
+   */
+  void setTreeCacheSize(size_t maxBytes);
+
+  /**
+   * Evict Trees from the in-memory tree cache until it holds at most
+   * targetBytes.  The cache may grow back to its full size afterwards.
+   */
+  void shrinkTreeCache(size_t targetBytes);
+
  private:
   // Forbidden copy constructor and assignment operator
   ObjectStore(ObjectStore const&) = delete;
   ObjectStore& operator=(ObjectStore const&) = delete;
 
+  /**
+   * Look up a Tree in the in-memory cache, returning nullptr if it is not
+   * present.
+   */
+  std::shared_ptr<const Tree> getCachedTree(const Hash& id) const;
+  folly::Future<std::unique_ptr<Tree>> getTreeFromBackingStore(
+      const Hash& id) const;
+  folly::Future<std::shared_ptr<const Tree>> getSharedTreeFromBackingStore(
+      const Hash& id) const;
+  folly::Future<BlobMetadata> getBlobMetadataFromBackingStore(
+      const Hash& id) const;
+  folly::Future<std::shared_ptr<const BlobMetadata>> fetchBlobMetadata(
+      const Hash& id) const;
+
+  folly::Future<folly::Unit> warmUpTreeLevel(
+      std::vector<Hash> ids,
+      size_t depth,
+      size_t maxTrees,
+      std::shared_ptr<TreeWarmUpStats> stats) const;
+
+  folly::Future<std::shared_ptr<const Tree>> fetchTree(const Hash& id) const;
+  folly::Future<std::shared_ptr<const Blob>> fetchBlob(const Hash& id) const;
+
   /*
    * The LocalStore.
    *
@@ -139,6 +340,49 @@ class ObjectStore : public IObjectStore {
    * Multiple ObjectStores may share the same BackingStore.
    */
   std::shared_ptr<BackingStore> backingStore_;
+  /*
+   * The in-memory cache of recently used Trees.
+   *
+   * This is shared with the continuations of pending BackingStore fetches,
+   * so that they can populate it even if the ObjectStore is destroyed first.
+   */
+  std::shared_ptr<TreeCache> treeCache_;
+  /*
+   * The in-memory cache of Blob contents.  This may be null.
+   */
+  std::shared_ptr<BlobCache> blobCache_;
+  /*
+   * The memory-mapped pack of hot Blob contents.  This may be null.
+   */
+  std::shared_ptr<BlobPack> blobPack_;
+  /*
+   * The Trees in use by any ObjectStore sharing this table.  This may be
+   * null.
+   *
+   * Trees loaded by this ObjectStore are replaced with the copy already in
+   * use elsewhere, if any, so that mounts of the same repository share them.
+   */
+  std::shared_ptr<LiveTreeTable> liveTrees_;
+  /*
+   * The targets of recently read symlinks, keyed by Blob ID.
+   *
+   * Like treeCache_, this is shared with the continuations that populate it.
+   */
+  struct SymlinkCache {
+    explicit SymlinkCache(size_t maxEntries) : targets(maxEntries) {}
+
+    std::mutex mutex;
+    folly::EvictingCacheMap<Hash, std::string> targets;
+  };
+  std::shared_ptr<SymlinkCache> symlinkCache_;
+
+  /*
+   * The BackingStore fetches currently in progress, so that concurrent
+   * requests for the same object can share them.
+   */
+  mutable InFlightMap<Hash, const Tree> pendingTrees_;
+  mutable InFlightMap<Hash, const Blob> pendingBlobs_;
+  mutable InFlightMap<Hash, const BlobMetadata> pendingMetadata_;
 };
 }
 } // facebook::eden
@@ -0,0 +1,117 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "PrioritizedExecutor.h"
+
+#include <folly/Conv.h>
+#include <glog/logging.h>
+#include <string>
+#include "common/stats/ServiceData.h"
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+
+namespace facebook {
+namespace eden {
+
+namespace {
+struct QueuedFunc {
+  folly::Func func;
+  steady_clock::time_point queuedAt;
+};
+
+struct PriorityCounters {
+  std::string count;
+  std::string waitTime;
+};
+}
+
+struct PrioritizedExecutor::Queues {
+  explicit Queues(std::chrono::milliseconds delay) : maxQueueDelay(delay) {
+    for (size_t n = 0; n < kNumImportPriorities; ++n) {
+      auto prefix = folly::to<std::string>(
+          "backing_store.queue.",
+          getImportPriorityName(static_cast<ImportPriority>(n)));
+      counters[n].count = folly::to<std::string>(prefix, ".count");
+      counters[n].waitTime = folly::to<std::string>(prefix, ".wait_us");
+    }
+  }
+
+  const std::chrono::milliseconds maxQueueDelay;
+  std::array<PriorityCounters, kNumImportPriorities> counters;
+
+  mutable std::mutex mutex;
+  /** One FIFO queue per priority.  Protected by mutex. */
+  std::array<std::deque<QueuedFunc>, kNumImportPriorities> queued;
+};
+
+PrioritizedExecutor::PrioritizedExecutor(
+    folly::Executor* executor,
+    std::chrono::milliseconds maxQueueDelay)
+    : executor_{executor}, queues_{std::make_shared<Queues>(maxQueueDelay)} {}
+
+PrioritizedExecutor::~PrioritizedExecutor() {}
+
+void PrioritizedExecutor::add(folly::Func func) {
+  addWithImportPriority(std::move(func), getCurrentImportPriority());
+}
+
+void PrioritizedExecutor::addWithImportPriority(
+    folly::Func func,
+    ImportPriority priority) {
+  {
+    std::lock_guard<std::mutex> guard(queues_->mutex);
+    queues_->queued[static_cast<size_t>(priority)].push_back(
+        QueuedFunc{std::move(func), steady_clock::now()});
+  }
+  // Each task given to executor_ runs one queued function, but not
+  // necessarily the one that was just added.
+  executor_->add([queues = queues_] { runNext(*queues); });
+}
+
+size_t PrioritizedExecutor::getNumQueued(ImportPriority priority) const {
+  std::lock_guard<std::mutex> guard(queues_->mutex);
+  return queues_->queued[static_cast<size_t>(priority)].size();
+}
+
+void PrioritizedExecutor::runNext(Queues& queues) {
+  QueuedFunc next;
+  size_t priority = kNumImportPriorities;
+  auto now = steady_clock::now();
+  {
+    std::lock_guard<std::mutex> guard(queues.mutex);
+    // Run the function that has been waiting the longest if it is overdue,
+    // and otherwise the oldest function of the most urgent priority.
+    for (size_t n = 0; n < kNumImportPriorities; ++n) {
+      const auto& queue = queues.queued[n];
+      if (queue.empty()) {
+        continue;
+      }
+      if (priority == kNumImportPriorities) {
+        priority = n;
+      } else if (
+          now - queue.front().queuedAt > queues.maxQueueDelay &&
+          queue.front().queuedAt < queues.queued[priority].front().queuedAt) {
+        priority = n;
+      }
+    }
+    // There is one task per queued function, so there is always one left.
+    DCHECK_LT(priority, kNumImportPriorities);
+    next = std::move(queues.queued[priority].front());
+    queues.queued[priority].pop_front();
+  }
+
+  auto waited = duration_cast<microseconds>(now - next.queuedAt);
+  fbData->incrementCounter(queues.counters[priority].count);
+  fbData->incrementCounter(queues.counters[priority].waitTime, waited.count());
+  next.func();
+}
+}
+} // facebook::eden
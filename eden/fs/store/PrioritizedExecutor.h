@@ -0,0 +1,72 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Executor.h>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include "eden/fs/store/ImportPriority.h"
+
+namespace facebook {
+namespace eden {
+
+/**
+ * PrioritizedExecutor runs functions on another Executor in the order of
+ * their ImportPriority, rather than in the order they were added.
+ *
+ * The BackingStores are shared by all mounts of a repository, so without
+ * this a large prefetch or checkout in one mount would hold up the FUSE
+ * requests of every other mount behind it.
+ *
+ * Each add() call queues the function by the priority of the current
+ * request (see getCurrentImportPriority()), and hands the underlying
+ * Executor a task that runs the most urgent queued function.  To prevent
+ * starvation, a function that has been queued for longer than maxQueueDelay
+ * runs next regardless of its priority.
+ *
+ * The time each function spends queued is exported in the
+ * "backing_store.queue.<priority>.*" counters.
+ */
+class PrioritizedExecutor : public folly::Executor {
+ public:
+  PrioritizedExecutor(
+      folly::Executor* executor,
+      std::chrono::milliseconds maxQueueDelay);
+  ~PrioritizedExecutor() override;
+
+  void add(folly::Func func) override;
+  void addWithImportPriority(folly::Func func, ImportPriority priority);
+
+  /**
+   * Returns the number of functions queued at a priority that have not
+   * started running yet.
+   */
+  size_t getNumQueued(ImportPriority priority) const;
+
+ private:
+  struct Queues;
+
+  PrioritizedExecutor(const PrioritizedExecutor&) = delete;
+  PrioritizedExecutor& operator=(const PrioritizedExecutor&) = delete;
+
+  static void runNext(Queues& queues);
+
+  folly::Executor* const executor_{nullptr};
+  /**
+   * The queues are shared with the tasks given to executor_, so that they
+   * remain valid if those run after the PrioritizedExecutor is destroyed.
+   */
+  std::shared_ptr<Queues> queues_;
+};
+}
+} // facebook::eden
@@ -0,0 +1,40 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/store/RecentKeyFilter.h"
+
+#include <folly/Bits.h>
+#include <algorithm>
+
+namespace facebook {
+namespace eden {
+
+RecentKeyFilter::RecentKeyFilter(size_t numSlots)
+    : mask_(folly::nextPowTwo(std::max<size_t>(numSlots, 1)) - 1),
+      slots_(new std::atomic<uint64_t>[mask_ + 1]) {
+  clear();
+}
+
+void RecentKeyFilter::insert(uint64_t keyHash) {
+  slots_[keyHash & mask_].store(
+      toSlotValue(keyHash), std::memory_order_release);
+}
+
+bool RecentKeyFilter::contains(uint64_t keyHash) const {
+  return slots_[keyHash & mask_].load(std::memory_order_acquire) ==
+      toSlotValue(keyHash);
+}
+
+void RecentKeyFilter::clear() {
+  for (size_t n = 0; n <= mask_; ++n) {
+    slots_[n].store(0, std::memory_order_release);
+  }
+}
+}
+}
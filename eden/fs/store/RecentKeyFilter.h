@@ -0,0 +1,60 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace facebook {
+namespace eden {
+
+/**
+ * RecentKeyFilter remembers the 64-bit hashes of recently written keys, so
+ * that checking whether a key was just written does not have to go to
+ * RocksDB.
+ *
+ * It is a direct-mapped table: each hash has a single slot, and replaces
+ * whatever was there.  contains() may therefore return false for a key that
+ * was inserted, but only returns true for a key that was not if its full
+ * 64-bit hash collides with one that was.
+ *
+ * RecentKeyFilter is thread-safe and lock-free.
+ */
+class RecentKeyFilter {
+ public:
+  /** numSlots is rounded up to a power of two. */
+  explicit RecentKeyFilter(size_t numSlots);
+
+  void insert(uint64_t keyHash);
+  bool contains(uint64_t keyHash) const;
+
+  /**
+   * Forget every key, e.g. because keys have been deleted.  Keys inserted
+   * concurrently may or may not be forgotten.
+   */
+  void clear();
+
+ private:
+  // Forbidden copy constructor and assignment operator
+  RecentKeyFilter(const RecentKeyFilter&) = delete;
+  RecentKeyFilter& operator=(const RecentKeyFilter&) = delete;
+
+  /** 0 marks an empty slot, so a hash of 0 is stored as 1. */
+  static uint64_t toSlotValue(uint64_t keyHash) {
+    return keyHash == 0 ? 1 : keyHash;
+  }
+
+  const size_t mask_{0};
+  std::unique_ptr<std::atomic<uint64_t>[]> slots_;
+};
+}
+}
@@ -0,0 +1,77 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Optional.h>
+#include <folly/io/IOBuf.h>
+#include <vector>
+
+namespace folly {
+template <typename T>
+class Future;
+}
+
+namespace facebook {
+namespace eden {
+
+class Hash;
+
+/**
+ * Abstract interface for an object cache shared between machines, such as a
+ * network cache service that sits in front of the source control servers.
+ *
+ * CachingBackingStore consults a SharedObjectCache before asking the real
+ * BackingStore for an object, so that objects another machine has already
+ * imported do not have to be imported again.
+ *
+ * Objects are keyed by their eden hash.  Trees are stored in the native tree
+ * format (see NativeTree.h), and blobs as their raw contents.
+ *
+ * SharedObjectCache implementations must be thread-safe.
+ */
+class SharedObjectCache {
+ public:
+  enum class ObjectType : uint8_t {
+    TREE,
+    BLOB,
+  };
+
+  SharedObjectCache() {}
+  virtual ~SharedObjectCache() {}
+
+  /**
+   * Look up several objects of the same type in one request.
+   *
+   * The result holds one entry per input ID, in the same order, which is
+   * folly::none if the cache does not have that object.  If the whole
+   * request fails, the Future should contain the error.
+   */
+  virtual folly::Future<std::vector<folly::Optional<folly::IOBuf>>> get(
+      ObjectType type,
+      const std::vector<Hash>& ids) = 0;
+
+  /**
+   * Add an object to the cache.
+   *
+   * This should not block on the cache service.  Errors are not reported to
+   * the caller, since there is nothing it could do about them.
+   */
+  virtual void put(
+      ObjectType type,
+      const Hash& id,
+      const folly::IOBuf& data) = 0;
+
+ private:
+  // Forbidden copy constructor and assignment operator
+  SharedObjectCache(SharedObjectCache const&) = delete;
+  SharedObjectCache& operator=(SharedObjectCache const&) = delete;
+};
+}
+} // facebook::eden
@@ -10,19 +10,51 @@
 #include "StoreResult.h"
 
 #include <folly/io/IOBuf.h>
+#include <rocksdb/slice.h>
 
 using folly::IOBuf;
+using folly::StringPiece;
 
 namespace {
 void freeString(void* /* buffer */, void* userData) {
   auto str = static_cast<std::string*>(userData);
   delete str;
 }
+
+void freePinnableSlice(void* /* buffer */, void* userData) {
+  auto slice = static_cast<rocksdb::PinnableSlice*>(userData);
+  delete slice;
+}
 }
 
 namespace facebook {
 namespace eden {
 
+StoreResult::StoreResult(std::unique_ptr<rocksdb::PinnableSlice> pinned)
+    : valid_(true), pinned_(std::move(pinned)) {}
+
+StoreResult::StoreResult(StoreResult&&) noexcept = default;
+StoreResult& StoreResult::operator=(StoreResult&&) noexcept = default;
+StoreResult::~StoreResult() {}
+
+StringPiece StoreResult::piece() const {
+  ensureValid();
+  if (pinned_) {
+    return StringPiece{pinned_->data(), pinned_->size()};
+  }
+  return StringPiece{data_};
+}
+
+std::string StoreResult::extractValue() {
+  ensureValid();
+  valid_ = false;
+  if (pinned_) {
+    auto pinned = std::move(pinned_);
+    return pinned->ToString();
+  }
+  return std::move(data_);
+}
+
 IOBuf StoreResult::iobufWrapper() const {
   ensureValid();
   return IOBuf{IOBuf::WRAP_BUFFER, bytes()};
@@ -31,10 +63,19 @@ IOBuf StoreResult::iobufWrapper() const {
 folly::IOBuf StoreResult::extractIOBuf() {
   ensureValid();
 
-  // Unfortunately RocksDB returns data to us in a std::string.  This makes it
-  // difficult for us to control the lifetime.  We end up having to allocate a
-  // new std::string on the heap, just to control when it will free the
-  // underlying data it points to.
+  if (pinned_) {
+    // The IOBuf takes over the pin, so the data stays valid in the RocksDB
+    // block cache until the last clone of the IOBuf is destroyed.
+    auto data = const_cast<char*>(pinned_->data());
+    auto size = pinned_->size();
+    valid_ = false;
+    return IOBuf(
+        IOBuf::TAKE_OWNERSHIP, data, size, freePinnableSlice, pinned_.release());
+  }
+
+  // A std::string makes it difficult for us to control the lifetime of the
+  // data.  We end up having to allocate a new std::string on the heap, just to
+  // control when it will free the underlying data it points to.
   auto stringPtr = std::make_unique<std::string>(std::move(data_));
   // Extract the data and size before we pass stringPtr.release()
   // to the IOBuf constructor.  Arguments are evaluated in an arbitrary order,
@@ -10,11 +10,15 @@
 #pragma once
 
 #include <folly/Range.h>
+#include <memory>
 #include <string>
 
 namespace folly {
 class IOBuf;
 }
+namespace rocksdb {
+class PinnableSlice;
+}
 
 namespace facebook {
 namespace eden {
@@ -22,10 +26,12 @@ namespace eden {
 /*
  * StoreResult contains the result of a LocalStore lookup.
  *
- * RocksDB returns the data in a std::string (which is somewhat unfortunate,
- * since it gives us relatively poor memory management control).
+ * The data is either held in a std::string, or in a rocksdb::PinnableSlice
+ * that points directly at the RocksDB block cache (or memtable copy) without
+ * copying it.  A pinned result keeps its block cache entry alive until the
+ * StoreResult, and any IOBuf extracted from it, is destroyed.
  *
- * This class is a wrapper around the returned string, with a few benefits:
+ * This class is a wrapper around the returned data, with a few benefits:
  * - It can also represent a "not found" result, so we can efficiently handle
  *   key lookups that are not present, without throwing an exception.
  * - It is move-only, so prevents us from ever unintentionally copying the
@@ -45,8 +51,14 @@ class StoreResult {
   explicit StoreResult(std::string&& data)
       : valid_(true), data_(std::move(data)) {}
 
-  StoreResult(StoreResult&&) = default;
-  StoreResult& operator=(StoreResult&&) = default;
+  /**
+   * Construct a StoreResult from data pinned by RocksDB.
+   */
+  explicit StoreResult(std::unique_ptr<rocksdb::PinnableSlice> pinned);
+
+  StoreResult(StoreResult&&) noexcept;
+  StoreResult& operator=(StoreResult&&) noexcept;
+  ~StoreResult();
 
   /**
    * Returns true if the value was found in the store,
@@ -56,24 +68,13 @@ class StoreResult {
     return valid_;
   }
 
-  /**
-   * Get a reference to the std::string result.
-   *
-   * Throws std::domain_error if the key was not present in the store.
-   */
-  const std::string& asString() const {
-    ensureValid();
-    return data_;
-  }
-
   /**
    * Get a ByteRange pointing to the result.
    *
    * Throws std::domain_error if the key was not present in the store.
    */
   folly::ByteRange bytes() const {
-    ensureValid();
-    return folly::StringPiece{data_};
+    return piece();
   }
 
   /**
@@ -81,10 +82,7 @@ class StoreResult {
    *
    * Throws std::domain_error if the key was not present in the store.
    */
-  folly::StringPiece piece() const {
-    ensureValid();
-    return folly::StringPiece{data_};
-  }
+  folly::StringPiece piece() const;
 
   /**
    * Return an IOBuf that temporarily wraps this StoreResult.
@@ -96,23 +94,22 @@ class StoreResult {
   folly::IOBuf iobufWrapper() const;
 
   /**
-   * Extract the std::string contained in this StoreResult.
+   * Extract the data contained in this StoreResult as a std::string.
+   *
+   * This copies the data if it was pinned by RocksDB.
    */
-  std::string extractValue() {
-    ensureValid();
-    valid_ = false;
-    return std::move(data_);
-  }
+  std::string extractValue();
 
   /**
    * Extract the data as an IOBuf.
    *
-   * This will return a managed IOBuf, which will free the result data when
-   * the last IOBuf clone is destroyed.
+   * This will return a managed IOBuf, which will free the result data (or
+   * release the RocksDB pin) when the last IOBuf clone is destroyed.  The
+   * data itself is never copied.
    *
-   * This does require a memory allocation to move the stored std::string onto
-   * the heap (but it just does a small allocation for the string object
-   * itself, and not the string data).
+   * For a std::string result this does require a memory allocation to move
+   * the string onto the heap (but it just does a small allocation for the
+   * string object itself, and not the string data).
    */
   folly::IOBuf extractIOBuf();
 
@@ -136,8 +133,10 @@ class StoreResult {
   // Whether or not the result is value
   // If the key was not found in the store, valid_ will be false.
   bool valid_{false};
-  // The std::string containing the data
+  // The std::string containing the data, if it is not pinned
   std::string data_;
+  // The pinned data, if any
+  std::unique_ptr<rocksdb::PinnableSlice> pinned_;
 };
 }
 } // facebook::eden
@@ -0,0 +1,124 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "StoreStats.h"
+
+#include <folly/Conv.h>
+#include <folly/ThreadLocal.h>
+
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+
+namespace facebook {
+namespace eden {
+
+namespace {
+// LocalStore reads usually come from the RocksDB block cache, and writes
+// only go to the memtable, so these are fast.
+constexpr microseconds kLocalStoreBucketSize{100};
+constexpr microseconds kLocalStoreMaxValue{10000};
+// Imports from mercurial can take seconds for large manifests.
+constexpr microseconds kImportBucketSize{50000};
+constexpr microseconds kImportMaxValue{5000000};
+constexpr microseconds kGitBucketSize{1000};
+constexpr microseconds kGitMaxValue{100000};
+
+StoreStats::Histogram createLocalStoreHistogram(
+    StoreStats* stats,
+    folly::StringPiece keySpace,
+    folly::StringPiece name) {
+  return StoreStats::Histogram{
+      stats,
+      folly::to<std::string>("local_store.", keySpace, ".", name),
+      kLocalStoreBucketSize.count(),
+      0,
+      kLocalStoreMaxValue.count(),
+      facebook::stats::COUNT,
+      facebook::stats::SUM,
+      50,
+      90,
+      99};
+}
+
+StoreStats::Timeseries createLocalStoreCounter(
+    StoreStats* stats,
+    folly::StringPiece keySpace,
+    folly::StringPiece name) {
+  return StoreStats::Timeseries{
+      stats,
+      folly::to<std::string>("local_store.", keySpace, ".", name),
+      facebook::stats::SUM,
+      facebook::stats::RATE};
+}
+}
+
+StoreStats::KeySpaceStats::KeySpaceStats(
+    StoreStats* stats,
+    folly::StringPiece keySpace)
+    : get{createLocalStoreHistogram(stats, keySpace, "get_us")},
+      put{createLocalStoreHistogram(stats, keySpace, "put_us")},
+      hit{createLocalStoreCounter(stats, keySpace, "hit")},
+      miss{createLocalStoreCounter(stats, keySpace, "miss")},
+      bytesRead{createLocalStoreCounter(stats, keySpace, "bytes_read")},
+      bytesWritten{createLocalStoreCounter(stats, keySpace, "bytes_written")} {
+}
+
+StoreStats::StoreStats() {
+  localStore_.reserve(LocalStore::KeySpace::End);
+  for (size_t n = 0; n < LocalStore::KeySpace::End; ++n) {
+    localStore_.emplace_back(
+        this,
+        LocalStore::getKeySpaceName(static_cast<LocalStore::KeySpace>(n)));
+  }
+}
+
+StoreStats* StoreStats::get() {
+  static folly::ThreadLocal<StoreStats> stats;
+  return stats.get();
+}
+
+void StoreStats::recordLatency(
+    Histogram& histogram,
+    steady_clock::time_point start) {
+  histogram.addValue(
+      std::chrono::duration_cast<microseconds>(steady_clock::now() - start)
+          .count());
+}
+
+StoreStats::Histogram StoreStats::createHistogram(
+    const std::string& name,
+    microseconds bucketSize,
+    microseconds maxValue) {
+  return Histogram{this,
+                   name,
+                   bucketSize.count(),
+                   0,
+                   maxValue.count(),
+                   facebook::stats::COUNT,
+                   facebook::stats::SUM,
+                   50,
+                   90,
+                   99};
+}
+
+StoreStats::Histogram StoreStats::createImportHistogram(
+    const std::string& name) {
+  return createHistogram(name, kImportBucketSize, kImportMaxValue);
+}
+
+StoreStats::Histogram StoreStats::createGitHistogram(const std::string& name) {
+  return createHistogram(name, kGitBucketSize, kGitMaxValue);
+}
+
+StoreStats::Timeseries StoreStats::createCounter(const std::string& name) {
+  return Timeseries{
+      this, name, facebook::stats::SUM, facebook::stats::RATE};
+}
+}
+}
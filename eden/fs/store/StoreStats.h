@@ -0,0 +1,109 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Range.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "common/stats/ThreadLocalStats.h"
+#include "eden/fs/store/LocalStore.h"
+
+namespace facebook {
+namespace eden {
+
+/**
+ * Latency histograms and counters for the LocalStore and the backing stores,
+ * so that slow FUSE requests can be attributed to the storage layer that
+ * made them slow.
+ *
+ * Like fusell::EdenStats, each thread updates its own StoreStats, and the
+ * values are only combined when the counters are read.  Latencies are in
+ * microseconds, hence the _us suffix on the histogram names.
+ */
+class StoreStats : public facebook::stats::ThreadLocalStatsT<
+                       facebook::stats::TLStatsThreadSafe> {
+ public:
+  using Histogram = TLHistogram;
+  using Timeseries = TLTimeseries;
+  using HistogramPtr = Histogram StoreStats::*;
+
+  StoreStats();
+
+  /**
+   * Returns the StoreStats for the calling thread.
+   */
+  static StoreStats* get();
+
+  /**
+   * Statistics for one LocalStore::KeySpace, named
+   * "local_store.<keyspace>.<name>".
+   */
+  struct KeySpaceStats {
+    KeySpaceStats(StoreStats* stats, folly::StringPiece keySpace);
+
+    Histogram get;
+    Histogram put;
+    Timeseries hit;
+    Timeseries miss;
+    Timeseries bytesRead;
+    Timeseries bytesWritten;
+  };
+
+  KeySpaceStats& localStore(LocalStore::KeySpace keySpace) {
+    return localStore_[keySpace];
+  }
+
+  // Requests sent to hg_import_helper.py, from the time they are sent until
+  // the last chunk of the response arrives.
+  Histogram hgManifest{createImportHistogram("hg_importer.manifest_us")};
+  Histogram hgCatFile{createImportHistogram("hg_importer.cat_file_us")};
+  Histogram hgCatFiles{createImportHistogram("hg_importer.cat_files_us")};
+  Histogram hgTree{createImportHistogram("hg_importer.tree_us")};
+  Histogram hgManifestNode{
+      createImportHistogram("hg_importer.manifest_node_us")};
+  Histogram hgManifestDiff{
+      createImportHistogram("hg_importer.manifest_diff_us")};
+  Histogram hgFileMetadata{
+      createImportHistogram("hg_importer.file_metadata_us")};
+  Timeseries hgBytesImported{createCounter("hg_importer.bytes")};
+  Timeseries hgErrors{createCounter("hg_importer.errors")};
+  // Helper processes killed because they stopped responding, helper
+  // processes replaced after exiting or being killed, and requests retried
+  // on another helper as a result.
+  Timeseries hgHelperTimeouts{createCounter("hg_importer.helper_timeouts")};
+  Timeseries hgHelperRestarts{createCounter("hg_importer.helper_restarts")};
+  Timeseries hgRetries{createCounter("hg_importer.retries")};
+
+  // Objects read from the git repository by GitBackingStore.
+  Histogram gitTree{createGitHistogram("git.tree_us")};
+  Histogram gitBlob{createGitHistogram("git.blob_us")};
+  Timeseries gitBytesImported{createCounter("git.bytes")};
+
+  /**
+   * Record the time since start in a histogram.
+   */
+  static void recordLatency(
+      Histogram& histogram,
+      std::chrono::steady_clock::time_point start);
+
+ private:
+  Histogram createHistogram(
+      const std::string& name,
+      std::chrono::microseconds bucketSize,
+      std::chrono::microseconds maxValue);
+  Histogram createImportHistogram(const std::string& name);
+  Histogram createGitHistogram(const std::string& name);
+  Timeseries createCounter(const std::string& name);
+
+  std::vector<KeySpaceStats> localStore_;
+};
+}
+}
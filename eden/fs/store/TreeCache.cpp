@@ -0,0 +1,210 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "TreeCache.h"
+
+#include <algorithm>
+#include <unordered_set>
+#include "eden/fs/model/Tree.h"
+#include "eden/utils/NumaTopology.h"
+
+using std::shared_ptr;
+
+namespace facebook {
+namespace eden {
+
+TreeCache::TreeCache(size_t maxBytes, size_t numShards, size_t numNodes)
+    : maxBytes_(maxBytes),
+      numNodes_(std::max<size_t>(numNodes, 1)),
+      shardsPerNode_(std::max<size_t>(numShards, 1)) {
+  auto totalShards = numNodes_ * shardsPerNode_;
+  maxBytesPerShard_ = maxBytes / totalShards;
+  shards_.reserve(totalShards);
+  for (size_t n = 0; n < totalShards; ++n) {
+    shards_.push_back(std::make_unique<Shard>());
+  }
+}
+
+TreeCache::~TreeCache() {}
+
+size_t TreeCache::getCurrentNode() const {
+  if (numNodes_ == 1) {
+    return 0;
+  }
+  return NumaTopology::get().getCurrentNode() % numNodes_;
+}
+
+TreeCache::Shard& TreeCache::getShard(const Hash& id, size_t node) {
+  return *shards_
+      [node * shardsPerNode_ + std::hash<Hash>()(id) % shardsPerNode_];
+}
+
+shared_ptr<const Tree> TreeCache::findInShard(Shard& shard, const Hash& id) {
+  std::lock_guard<std::mutex> guard(shard.mutex);
+  auto it = shard.index.find(id);
+  return it == shard.index.end() ? nullptr : *it->second;
+}
+
+shared_ptr<const Tree> TreeCache::get(const Hash& id) {
+  auto node = getCurrentNode();
+  auto& shard = getShard(id, node);
+  {
+    std::lock_guard<std::mutex> guard(shard.mutex);
+    auto it = shard.index.find(id);
+    if (it != shard.index.end()) {
+      ++shard.stats.hits;
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+      return *it->second;
+    }
+  }
+
+  // Another node may have the Tree.  Copy it, rather than sharing it, so
+  // that the copy is allocated by this thread in this node's memory.
+  for (size_t other = 0; other < numNodes_; ++other) {
+    if (other == node) {
+      continue;
+    }
+    auto remoteTree = findInShard(getShard(id, other), id);
+    if (remoteTree) {
+      auto tree = std::make_shared<const Tree>(*remoteTree);
+      auto size = estimateSize(*tree);
+      std::lock_guard<std::mutex> guard(shard.mutex);
+      ++shard.stats.hits;
+      ++shard.stats.remoteHits;
+      insertIntoShard(shard, tree, size);
+      return tree;
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(shard.mutex);
+  ++shard.stats.misses;
+  return nullptr;
+}
+
+void TreeCache::insert(shared_ptr<const Tree> tree) {
+  auto size = estimateSize(*tree);
+  if (size > maxBytesPerShard_.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  auto& shard = getShard(tree->getHash(), getCurrentNode());
+  std::lock_guard<std::mutex> guard(shard.mutex);
+  insertIntoShard(shard, std::move(tree), size);
+}
+
+void TreeCache::insertIntoShard(
+    Shard& shard,
+    shared_ptr<const Tree> tree,
+    size_t size) {
+  auto it = shard.index.find(tree->getHash());
+  if (it != shard.index.end()) {
+    // Trees are immutable, so the cached copy is just as good.  Treat this
+    // as a use of the existing entry.
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    return;
+  }
+
+  // The budget may have shrunk since the caller checked it.
+  auto maxBytes = maxBytesPerShard_.load(std::memory_order_relaxed);
+  if (size > maxBytes) {
+    return;
+  }
+  evictLocked(shard, maxBytes - size);
+
+  auto id = tree->getHash();
+  shard.lru.push_front(std::move(tree));
+  shard.index.emplace(id, shard.lru.begin());
+  shard.stats.totalBytes += size;
+}
+
+void TreeCache::setMaxBytes(size_t maxBytes) {
+  auto maxBytesPerShard = maxBytes / shards_.size();
+  maxBytes_.store(maxBytes, std::memory_order_relaxed);
+  maxBytesPerShard_.store(maxBytesPerShard, std::memory_order_relaxed);
+  for (const auto& shard : shards_) {
+    std::lock_guard<std::mutex> guard(shard->mutex);
+    evictLocked(*shard, maxBytesPerShard);
+  }
+}
+
+void TreeCache::shrink(size_t targetBytes) {
+  auto targetBytesPerShard = targetBytes / shards_.size();
+  for (const auto& shard : shards_) {
+    std::lock_guard<std::mutex> guard(shard->mutex);
+    evictLocked(*shard, targetBytesPerShard);
+  }
+}
+
+void TreeCache::evictLocked(Shard& shard, size_t maxBytes) {
+  while (shard.stats.totalBytes > maxBytes) {
+    const auto& victim = shard.lru.back();
+    shard.stats.totalBytes -= estimateSize(*victim);
+    shard.index.erase(victim->getHash());
+    shard.lru.pop_back();
+    ++shard.stats.evictions;
+  }
+}
+
+TreeCacheStats TreeCache::getStats() const {
+  TreeCacheStats result;
+  for (const auto& shard : shards_) {
+    std::lock_guard<std::mutex> guard(shard->mutex);
+    result.hits += shard->stats.hits;
+    result.misses += shard->stats.misses;
+    result.remoteHits += shard->stats.remoteHits;
+    result.evictions += shard->stats.evictions;
+    result.numEntries += shard->index.size();
+    result.totalBytes += shard->stats.totalBytes;
+  }
+  return result;
+}
+
+std::vector<Hash> TreeCache::getRecentIds(size_t maxIds) const {
+  auto perShard = (maxIds + shards_.size() - 1) / shards_.size();
+  std::vector<std::vector<Hash>> shardIds;
+  shardIds.reserve(shards_.size());
+  for (const auto& shard : shards_) {
+    std::lock_guard<std::mutex> guard(shard->mutex);
+    shardIds.emplace_back();
+    for (const auto& tree : shard->lru) {
+      if (shardIds.back().size() >= perShard) {
+        break;
+      }
+      shardIds.back().push_back(tree->getHash());
+    }
+  }
+
+  std::vector<Hash> result;
+  result.reserve(maxIds);
+  // A Tree may be cached by more than one NUMA node.
+  std::unordered_set<Hash> seen;
+  for (size_t rank = 0; rank < perShard; ++rank) {
+    for (const auto& ids : shardIds) {
+      if (result.size() >= maxIds) {
+        return result;
+      }
+      if (rank < ids.size() &&
+          (numNodes_ == 1 || seen.insert(ids[rank]).second)) {
+        result.push_back(ids[rank]);
+      }
+    }
+  }
+  return result;
+}
+
+size_t TreeCache::estimateSize(const Tree& tree) {
+  const auto& entries = tree.getTreeEntries();
+  size_t size = sizeof(Tree) + entries.capacity() * sizeof(TreeEntry);
+  for (const auto& entry : entries) {
+    size += entry.getName().stringPiece().size();
+  }
+  return size;
+}
+}
+} // facebook::eden
@@ -0,0 +1,179 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "eden/fs/model/Hash.h"
+
+namespace facebook {
+namespace eden {
+
+class Tree;
+
+/**
+ * Statistics about a TreeCache.
+ */
+struct TreeCacheStats {
+  /** The number of lookups that found the Tree in the cache */
+  uint64_t hits{0};
+  /** The number of lookups that did not find the Tree in the cache */
+  uint64_t misses{0};
+  /**
+   * The number of hits that only found the Tree in another NUMA node's
+   * shards.  These are also counted in hits.
+   */
+  uint64_t remoteHits{0};
+  /** The number of Trees evicted to stay within the memory budget */
+  uint64_t evictions{0};
+  /** The number of Trees currently in the cache */
+  size_t numEntries{0};
+  /** The estimated memory used by the Trees currently in the cache */
+  size_t totalBytes{0};
+};
+
+/**
+ * TreeCache is an in-memory cache of deserialized Tree objects.
+ *
+ * It sits above the LocalStore, so that frequently accessed Trees do not
+ * have to be read from RocksDB and deserialized again on every lookup.
+ *
+ * The cache is bounded by an estimate of the memory used by the cached
+ * Trees rather than by their number, since Trees vary widely in size.  The
+ * least recently used Trees are evicted first.  The cache is split into
+ * shards with separate locks, so that concurrent lookups of different Trees
+ * rarely contend with each other.  Each shard gets an equal share of the
+ * memory budget.
+ *
+ * On machines with more than one NUMA node, the cache can be given a set of
+ * shards for each node.  Trees are inserted into the shards of the node
+ * that the calling thread runs on.  A lookup that only finds a Tree in
+ * another node's shards copies it into the local ones, so that later
+ * lookups from this node read local memory.  Popular Trees may therefore be
+ * cached once per node, out of a budget that is split between the nodes.
+ *
+ * TreeCache is thread-safe.
+ */
+class TreeCache {
+ public:
+  /**
+   * Create a TreeCache holding up to maxBytes worth of Trees, split into
+   * numShards shards for each of numNodes NUMA nodes.  A maxBytes of 0
+   * disables the cache.
+   */
+  TreeCache(size_t maxBytes, size_t numShards, size_t numNodes = 1);
+  virtual ~TreeCache();
+
+  /**
+   * Look up a Tree by ID.
+   *
+   * Returns nullptr if the Tree is not in the cache.
+   */
+  std::shared_ptr<const Tree> get(const Hash& id);
+
+  /**
+   * Add a Tree to the cache, evicting older Trees as necessary.
+   *
+   * Trees larger than a shard's share of the memory budget are not cached.
+   */
+  void insert(std::shared_ptr<const Tree> tree);
+
+  /**
+   * Get a snapshot of the cache statistics, summed over all shards.
+   */
+  TreeCacheStats getStats() const;
+
+  /**
+   * Get the IDs of up to maxIds of the most recently used Trees.
+   *
+   * Recency is only tracked within each shard, so the result takes the most
+   * recently used Trees of every shard in turn, which is only approximately
+   * in order of recency overall.
+   */
+  std::vector<Hash> getRecentIds(size_t maxIds) const;
+
+  size_t getMaxBytes() const {
+    return maxBytes_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Change the memory budget, evicting Trees right away from any shard that
+   * holds more than its share of the new budget.
+   */
+  void setMaxBytes(size_t maxBytes);
+
+  /**
+   * Evict the least recently used Trees until the cache holds at most
+   * targetBytes, without changing its budget.  Each shard is shrunk to its
+   * share of targetBytes.
+   */
+  void shrink(size_t targetBytes);
+
+  /**
+   * Estimate the memory used by a Tree.
+   */
+  static size_t estimateSize(const Tree& tree);
+
+ protected:
+  /**
+   * Get the NUMA node whose shards the calling thread should use, from 0 to
+   * numNodes - 1.
+   */
+  virtual size_t getCurrentNode() const;
+
+ private:
+  struct Shard {
+    using LruList = std::list<std::shared_ptr<const Tree>>;
+
+    std::mutex mutex;
+    /** The cached Trees, most recently used first. */
+    LruList lru;
+    std::unordered_map<Hash, LruList::iterator> index;
+    TreeCacheStats stats;
+  };
+
+  // Forbidden copy constructor and assignment operator
+  TreeCache(const TreeCache&) = delete;
+  TreeCache& operator=(const TreeCache&) = delete;
+
+  Shard& getShard(const Hash& id, size_t node);
+
+  /**
+   * Look up a Tree in one shard, without updating its statistics.
+   */
+  static std::shared_ptr<const Tree> findInShard(Shard& shard, const Hash& id);
+
+  /**
+   * Add a Tree of the given estimated size to a shard.
+   */
+  void insertIntoShard(
+      Shard& shard,
+      std::shared_ptr<const Tree> tree,
+      size_t size);
+
+  /**
+   * Evict the least recently used Trees of shard until it holds at most
+   * maxBytes.  The shard's mutex must be held.
+   */
+  static void evictLocked(Shard& shard, size_t maxBytes);
+
+  std::atomic<size_t> maxBytes_{0};
+  std::atomic<size_t> maxBytesPerShard_{0};
+  const size_t numNodes_{1};
+  const size_t shardsPerNode_{1};
+  /** The shards of node N are at N * shardsPerNode_ onwards */
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+}
+} // facebook::eden
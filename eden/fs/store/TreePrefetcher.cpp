@@ -0,0 +1,148 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/store/TreePrefetcher.h"
+
+#include <folly/io/async/Request.h>
+#include <glog/logging.h>
+#include <algorithm>
+#include "eden/fs/store/ImportPriority.h"
+#include "eden/fs/store/ObjectStore.h"
+
+namespace facebook {
+namespace eden {
+
+namespace {
+/** The number of prefetched child Tree IDs remembered to count hits */
+constexpr size_t kMaxTracked = 4096;
+/** The number of hits and misses between depth adjustments */
+constexpr size_t kAdjustInterval = 128;
+/** Grow the depth when at least this fraction of Trees are used */
+constexpr double kGrowHitRate = 0.5;
+/** Shrink the depth when less than this fraction of Trees are used */
+constexpr double kShrinkHitRate = 0.2;
+}
+
+TreePrefetcher::TreePrefetcher(
+    ObjectStore* store,
+    size_t maxDepth,
+    size_t budget)
+    : store_(store), maxDepth_(std::max<size_t>(maxDepth, 1)), budget_(budget) {
+  stats_.depth = 1;
+}
+
+TreePrefetcher::~TreePrefetcher() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idleCV_.wait(lock, [this] { return numOutstanding_ == 0; });
+}
+
+void TreePrefetcher::prefetch(const std::vector<Hash>& ids) {
+  if (ids.empty()) {
+    return;
+  }
+
+  size_t depth;
+  size_t maxTrees;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (reserved_ >= budget_) {
+      ++stats_.skipped;
+      return;
+    }
+    depth = stats_.depth;
+    maxTrees = budget_ - reserved_;
+    if (depth == 1) {
+      maxTrees = std::min(maxTrees, ids.size());
+    }
+    reserved_ += maxTrees;
+    ++numOutstanding_;
+    ++stats_.prefetches;
+    for (size_t n = 0; n < std::min(ids.size(), maxTrees); ++n) {
+      trackLocked(ids[n]);
+    }
+  }
+
+  // Run behind the fetches of requests that are waiting, and do not let
+  // an interrupt of the request that triggered the prefetch cancel it.
+  folly::RequestContextScopeGuard contextGuard;
+  setCurrentImportPriority(ImportPriority::PREFETCH);
+  store_->warmUpTrees(ids, depth, maxTrees)
+      .then([this, maxTrees](folly::Try<TreeWarmUpStats>&& result) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (result.hasValue()) {
+          stats_.treesLoaded += result.value().treesLoaded;
+          stats_.treesFailed += result.value().treesFailed;
+        } else {
+          VLOG(2) << "tree prefetch failed: " << result.exception().what();
+        }
+        reserved_ -= maxTrees;
+        --numOutstanding_;
+        // Notify with the lock held, since the destructor may destroy the
+        // condition variable as soon as it sees no outstanding prefetches.
+        idleCV_.notify_all();
+      });
+}
+
+void TreePrefetcher::trackLocked(const Hash& id) {
+  if (tracked_.count(id)) {
+    return;
+  }
+  auto sequence = nextSequence_++;
+  tracked_.emplace(id, sequence);
+  trackedOrder_.emplace_back(id, sequence);
+  while (trackedOrder_.size() > kMaxTracked) {
+    auto oldest = trackedOrder_.front();
+    trackedOrder_.pop_front();
+    // Entries that were used, or tracked again since, are stale.
+    auto it = tracked_.find(oldest.first);
+    if (it != tracked_.end() && it->second == oldest.second) {
+      tracked_.erase(it);
+      recordOutcomeLocked(false);
+    }
+  }
+}
+
+void TreePrefetcher::recordLoad(const Hash& id) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (tracked_.erase(id)) {
+    recordOutcomeLocked(true);
+  }
+}
+
+void TreePrefetcher::recordOutcomeLocked(bool hit) {
+  if (hit) {
+    ++stats_.hits;
+    ++recentHits_;
+  } else {
+    ++stats_.misses;
+  }
+  if (++recentOutcomes_ < kAdjustInterval) {
+    return;
+  }
+
+  auto hitRate = static_cast<double>(recentHits_) / recentOutcomes_;
+  if (hitRate >= kGrowHitRate && stats_.depth < maxDepth_) {
+    ++stats_.depth;
+    VLOG(3) << "tree prefetch hit rate " << hitRate
+            << ": increasing depth to " << stats_.depth;
+  } else if (hitRate < kShrinkHitRate && stats_.depth > 1) {
+    --stats_.depth;
+    VLOG(3) << "tree prefetch hit rate " << hitRate
+            << ": decreasing depth to " << stats_.depth;
+  }
+  recentHits_ = 0;
+  recentOutcomes_ = 0;
+}
+
+TreePrefetchStats TreePrefetcher::getStats() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return stats_;
+}
+}
+}
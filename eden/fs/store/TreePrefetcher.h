@@ -0,0 +1,120 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "eden/fs/model/Hash.h"
+
+namespace facebook {
+namespace eden {
+
+class ObjectStore;
+
+/**
+ * Statistics about a TreePrefetcher.
+ */
+struct TreePrefetchStats {
+  /** The number of prefetches started */
+  uint64_t prefetches{0};
+  /** The number of prefetches skipped because the budget was used up */
+  uint64_t skipped{0};
+  /** The number of Trees loaded by prefetches, at every depth */
+  uint64_t treesLoaded{0};
+  /** The number of Trees that prefetches failed to load */
+  uint64_t treesFailed{0};
+  /** The number of prefetched child Trees that were then loaded as inodes */
+  uint64_t hits{0};
+  /** The number of prefetched child Trees forgotten before being used */
+  uint64_t misses{0};
+  /** The depth prefetches currently use */
+  size_t depth{0};
+
+  /** Returns hits as a percentage of hits and misses. */
+  double getHitRate() const {
+    auto total = hits + misses;
+    return total == 0 ? 0.0 : 100.0 * hits / total;
+  }
+};
+
+/**
+ * TreePrefetcher speculatively loads the Trees of subdirectories before they
+ * are looked up, since tools that list or look into a directory usually go
+ * on to walk its subdirectories.
+ *
+ * Prefetches load Trees into the ObjectStore's tree cache with
+ * ObjectStore::warmUpTrees(), at prefetch priority.  At most budget Trees
+ * are requested by all outstanding prefetches together; a prefetch that
+ * finds the budget used up is skipped rather than queued.
+ *
+ * The depth adapts to how useful prefetching turns out to be.  The child
+ * Trees a prefetch was asked for are remembered until they are loaded as
+ * inodes, which counts as a hit, or until too many newer ones have been
+ * prefetched, which counts as a miss.  The depth starts at 1, grows towards
+ * maxDepth while most prefetched Trees are used, and shrinks back when few
+ * of them are.
+ *
+ * TreePrefetcher is thread-safe.  Its destructor waits for outstanding
+ * prefetches, so it must be destroyed before the ObjectStore.
+ */
+class TreePrefetcher {
+ public:
+  TreePrefetcher(ObjectStore* store, size_t maxDepth, size_t budget);
+  ~TreePrefetcher();
+
+  /**
+   * Prefetch the given Trees, and their subtrees down to the current depth.
+   */
+  void prefetch(const std::vector<Hash>& ids);
+
+  /**
+   * Record that the Tree with the given ID was loaded as an inode.
+   */
+  void recordLoad(const Hash& id);
+
+  TreePrefetchStats getStats() const;
+
+ private:
+  // Forbidden copy constructor and assignment operator
+  TreePrefetcher(const TreePrefetcher&) = delete;
+  TreePrefetcher& operator=(const TreePrefetcher&) = delete;
+
+  /** Remember a prefetched ID.  Must be called with mutex_ held. */
+  void trackLocked(const Hash& id);
+  /** Record a hit or miss.  Must be called with mutex_ held. */
+  void recordOutcomeLocked(bool hit);
+
+  ObjectStore* const store_{nullptr};
+  const size_t maxDepth_{0};
+  const size_t budget_{0};
+
+  mutable std::mutex mutex_;
+  /** Signalled when an outstanding prefetch completes */
+  std::condition_variable idleCV_;
+  // The fields below are protected by mutex_.
+  /** The number of Trees the outstanding prefetches may load */
+  size_t reserved_{0};
+  size_t numOutstanding_{0};
+  /** The prefetched child Tree IDs not used yet, with their sequence */
+  std::unordered_map<Hash, uint64_t> tracked_;
+  /** The tracked IDs in the order they were prefetched */
+  std::deque<std::pair<Hash, uint64_t>> trackedOrder_;
+  uint64_t nextSequence_{0};
+  /** Hits and misses since the depth was last adjusted */
+  size_t recentHits_{0};
+  size_t recentOutcomes_{0};
+  TreePrefetchStats stats_;
+};
+}
+}
@@ -9,9 +9,16 @@
  */
 #include "GitBackingStore.h"
 
+#include <boost/filesystem.hpp>
 #include <folly/Conv.h>
+#include <folly/Executor.h>
 #include <folly/futures/Future.h>
+#include <folly/futures/Promise.h>
+#include <gflags/gflags.h>
 #include <git2.h>
+#include <algorithm>
+#include <numeric>
+#include <tuple>
 
 #include "eden/fs/model/Blob.h"
 #include "eden/fs/model/Hash.h"
@@ -19,16 +26,35 @@
 #include "eden/fs/model/TreeEntry.h"
 #include "eden/fs/model/git/GitTree.h"
 #include "eden/fs/store/LocalStore.h"
+#include "eden/fs/store/StoreStats.h"
+#include "eden/fs/store/git/GitPackIndex.h"
 
 using folly::ByteRange;
 using folly::Future;
 using folly::IOBuf;
-using folly::makeFuture;
 using folly::StringPiece;
 using std::make_unique;
 using std::string;
 using std::unique_ptr;
 
+DEFINE_int32(
+    gitNumRepositoryHandles,
+    8,
+    "The maximum number of libgit2 handles to open for each git repository, "
+    "which limits the number of concurrent reads from it");
+
+DEFINE_int32(
+    gitBlobImportBufferSize,
+    64 * 1024 * 1024, // 64MB
+    "Buffer size for batching LocalStore writes during git blob batch fetches");
+
+DEFINE_bool(
+    gitStoreBlobContents,
+    true,
+    "Keep a copy of the contents of git blobs in the LocalStore.  If false, "
+    "only their size and SHA-1 are stored, and the contents are read from "
+    "the git repository each time they are needed");
+
 namespace {
 
 template <typename... Args>
@@ -41,6 +67,19 @@ void gitCheckError(int error, Args&&... args) {
   }
 }
 
+/**
+ * Run fn on the executor, or immediately in the calling thread if executor is
+ * null, and return a Future with its result.
+ */
+template <typename Fn>
+auto runOnExecutor(folly::Executor* executor, Fn&& fn)
+    -> decltype(folly::makeFutureWith(std::forward<Fn>(fn))) {
+  if (!executor) {
+    return folly::makeFutureWith(std::forward<Fn>(fn));
+  }
+  return folly::via(executor, std::forward<Fn>(fn));
+}
+
 void freeBlobIOBufData(void* blobData, void* blobObject) {
   git_blob* gitBlob = static_cast<git_blob*>(blobObject);
   git_blob_free(gitBlob);
@@ -50,38 +89,122 @@ void freeBlobIOBufData(void* blobData, void* blobObject) {
 namespace facebook {
 namespace eden {
 
-GitBackingStore::GitBackingStore(StringPiece repository, LocalStore* localStore)
-    : localStore_{localStore} {
+/**
+ * A repository handle borrowed from a GitBackingStore, which is returned to
+ * it when the lease is destroyed.
+ */
+class GitBackingStore::RepositoryLease {
+ public:
+  RepositoryLease(GitBackingStore* store, git_repository* repo)
+      : store_{store}, repo_{repo} {}
+  RepositoryLease(RepositoryLease&& other) noexcept
+      : store_{other.store_}, repo_{other.repo_} {
+    other.repo_ = nullptr;
+  }
+  ~RepositoryLease() {
+    if (repo_) {
+      store_->releaseRepository(repo_);
+    }
+  }
+
+  git_repository* get() const {
+    return repo_;
+  }
+
+ private:
+  RepositoryLease(const RepositoryLease&) = delete;
+  RepositoryLease& operator=(const RepositoryLease&) = delete;
+  RepositoryLease& operator=(RepositoryLease&&) = delete;
+
+  GitBackingStore* store_;
+  git_repository* repo_;
+};
+
+GitBackingStore::GitBackingStore(
+    StringPiece repository,
+    LocalStore* localStore,
+    folly::Executor* executor)
+    : localStore_{localStore},
+      executor_{executor},
+      maxRepos_{
+          static_cast<size_t>(std::max(FLAGS_gitNumRepositoryHandles, 1))} {
   // Make sure libgit2 is initialized.
   // (git_libgit2_init() is safe to call multiple times if multiple
   // GitBackingStore objects are created.  git_libgit2_shutdown() should be
   // called once for each call to git_libgit2_init().)
   git_libgit2_init();
 
-  auto error = git_repository_open(&repo_, repository.str().c_str());
+  // Open the first handle now, so that errors are reported immediately.
+  git_repository* repo = nullptr;
+  auto error = git_repository_open(&repo, repository.str().c_str());
   gitCheckError(error, "error opening git repository", repository);
+  path_ = git_repository_path(repo);
+  idleRepos_.push_back(repo);
+  numRepos_ = 1;
 }
 
 GitBackingStore::~GitBackingStore() {
-  git_repository_free(repo_);
+  DCHECK_EQ(idleRepos_.size(), numRepos_)
+      << "GitBackingStore destroyed while repository handles are in use";
+  for (auto* repo : idleRepos_) {
+    git_repository_free(repo);
+  }
   git_libgit2_shutdown();
 }
 
 const char* GitBackingStore::getPath() const {
-  return git_repository_path(repo_);
+  return path_.c_str();
+}
+
+GitBackingStore::RepositoryLease GitBackingStore::acquireRepository() {
+  std::unique_lock<std::mutex> lock(repoMutex_);
+  while (idleRepos_.empty()) {
+    if (numRepos_ < maxRepos_) {
+      // Open another handle, without holding the lock while we do.
+      ++numRepos_;
+      lock.unlock();
+      git_repository* repo = nullptr;
+      auto error = git_repository_open(&repo, path_.c_str());
+      if (error) {
+        {
+          std::lock_guard<std::mutex> guard(repoMutex_);
+          --numRepos_;
+        }
+        repoAvailable_.notify_one();
+        gitCheckError(error, "error opening git repository", path_);
+      }
+      VLOG(2) << "opened git repository handle " << numRepos_ << " for "
+              << path_;
+      return RepositoryLease(this, repo);
+    }
+    repoAvailable_.wait(lock);
+  }
+
+  auto* repo = idleRepos_.back();
+  idleRepos_.pop_back();
+  return RepositoryLease(this, repo);
+}
+
+void GitBackingStore::releaseRepository(git_repository* repo) {
+  {
+    std::lock_guard<std::mutex> guard(repoMutex_);
+    idleRepos_.push_back(repo);
+  }
+  repoAvailable_.notify_one();
 }
 
 Future<unique_ptr<Tree>> GitBackingStore::getTree(const Hash& id) {
-  // TODO: Use a separate thread pool to do the git I/O
-  return makeFuture(getTreeImpl(id));
+  return runOnExecutor(executor_, [this, id] { return getTreeImpl(id); });
 }
 
 unique_ptr<Tree> GitBackingStore::getTreeImpl(const Hash& id) {
   VLOG(4) << "importing tree " << id;
 
+  auto start = std::chrono::steady_clock::now();
+  auto repo = acquireRepository();
   git_oid treeOID = hash2Oid(id);
   git_tree* gitTree = nullptr;
-  auto error = git_tree_lookup(&gitTree, repo_, &treeOID);
+  auto error = git_tree_lookup(&gitTree, repo.get(), &treeOID);
   gitCheckError(
       error, "unable to find git tree ", id, " in repository ", getPath());
   SCOPE_EXIT {
@@ -122,6 +245,7 @@ unique_ptr<Tree> GitBackingStore::getTreeImpl(const Hash& id) {
     entries.emplace_back(entryHash, entryName, fileType, ownerPerms);
   }
   auto tree = make_unique<Tree>(std::move(entries), id);
+  StoreStats::recordLatency(StoreStats::get()->gitTree, start);
   auto hash = localStore_->putTree(tree.get());
   DCHECK_EQ(id, hash);
 
@@ -129,16 +253,23 @@ unique_ptr<Tree> GitBackingStore::getTreeImpl(const Hash& id) {
 }
 
 Future<unique_ptr<Blob>> GitBackingStore::getBlob(const Hash& id) {
-  // TODO: Use a separate thread pool to do the git I/O
-  return makeFuture(getBlobImpl(id));
+  return runOnExecutor(executor_, [this, id] { return getBlobImpl(id); });
 }
 
 unique_ptr<Blob> GitBackingStore::getBlobImpl(const Hash& id) {
   VLOG(5) << "importing blob " << id;
 
+  auto repo = acquireRepository();
+  return readBlob(repo.get(), id);
+}
+
+unique_ptr<Blob> GitBackingStore::readBlob(
+    git_repository* repo,
+    const Hash& id) {
+  auto start = std::chrono::steady_clock::now();
   auto blobOID = hash2Oid(id);
   git_blob* blob = nullptr;
-  int error = git_blob_lookup(&blob, repo_, &blobOID);
+  int error = git_blob_lookup(&blob, repo, &blobOID);
   gitCheckError(
       error, "unable to find git blob ", id, " in repository ", getPath());
 
@@ -152,35 +283,238 @@ unique_ptr<Blob> GitBackingStore::getBlobImpl(const Hash& id) {
       freeBlobIOBufData,
       blob);
 
+  auto* stats = StoreStats::get();
+  StoreStats::recordLatency(stats->gitBlob, start);
+  stats->gitBytesImported.addValue(dataSize);
+
   // Create the blob
   return make_unique<Blob>(id, std::move(buf));
 }
 
-Future<unique_ptr<Tree>> GitBackingStore::getTreeForCommit(
-    const Hash& commitID) {
-  // TODO: Use a separate thread pool to do the git I/O
-  return makeFuture(getTreeForCommitImpl(commitID));
+Future<folly::Optional<BlobMetadata>> GitBackingStore::getBlobMetadata(
+    const Hash& id) {
+  return runOnExecutor(executor_, [this, id] {
+    return folly::Optional<BlobMetadata>{getBlobMetadataImpl(id)};
+  });
 }
 
-unique_ptr<Tree> GitBackingStore::getTreeForCommitImpl(const Hash& commitID) {
-  VLOG(4) << "resolving tree for commit " << commitID;
+BlobMetadata GitBackingStore::getBlobMetadataImpl(const Hash& id) {
+  VLOG(5) << "importing metadata of blob " << id;
+
+  auto repo = acquireRepository();
+  git_odb* odb = nullptr;
+  gitCheckError(
+      git_repository_odb(&odb, repo.get()),
+      "unable to open the object database of repository ",
+      getPath());
+  SCOPE_EXIT {
+    git_odb_free(odb);
+  };
 
-  // Look up the commit info
-  git_oid commitOID = hash2Oid(commitID);
-  git_commit* commit = nullptr;
-  auto error = git_commit_lookup(&commit, repo_, &commitOID);
+  // Read the object directly from the object database rather than through
+  // git_blob_lookup(), which caches it in the repository handle.  Only the
+  // SHA-1 is kept, and the contents are freed as soon as they are hashed.
+  auto blobOID = hash2Oid(id);
+  git_odb_object* object = nullptr;
   gitCheckError(
-      error,
-      "unable to find git commit ",
-      commitID,
+      git_odb_read(&object, odb, &blobOID),
+      "unable to find git blob ",
+      id,
       " in repository ",
       getPath());
   SCOPE_EXIT {
-    git_commit_free(commit);
+    git_odb_object_free(object);
   };
+  if (git_odb_object_type(object) != GIT_OBJ_BLOB) {
+    throw std::domain_error(folly::to<string>(
+        "git object ", id, " in repository ", getPath(), " is not a blob"));
+  }
 
-  // Get the tree ID for this commit.
-  Hash treeID = oid2Hash(git_commit_tree_id(commit));
+  auto size = git_odb_object_size(object);
+  ByteRange data{static_cast<const uint8_t*>(git_odb_object_data(object)),
+                 size};
+  return BlobMetadata{Hash::sha1(data), size};
+}
+
+bool GitBackingStore::shouldStoreBlobContents() const {
+  return FLAGS_gitStoreBlobContents;
+}
+
+std::vector<Future<unique_ptr<Blob>>> GitBackingStore::getBlobs(
+    const std::vector<Hash>& ids) {
+  if (ids.size() < 2) {
+    return BackingStore::getBlobs(ids);
+  }
+
+  auto promises =
+      std::make_shared<std::vector<folly::Promise<unique_ptr<Blob>>>>(
+          ids.size());
+  std::vector<Future<unique_ptr<Blob>>> results;
+  results.reserve(ids.size());
+  for (auto& promise : *promises) {
+    results.push_back(promise.getFuture());
+  }
+
+  runOnExecutor(executor_, [this, ids, promises] {
+    getBlobsImpl(ids, *promises);
+  });
+  return results;
+}
+
+void GitBackingStore::getBlobsImpl(
+    const std::vector<Hash>& ids,
+    std::vector<folly::Promise<unique_ptr<Blob>>>& promises) {
+  std::vector<size_t> order;
+  try {
+    order = getPackOrder(ids);
+  } catch (const std::exception& ex) {
+    // The order is only an optimization, so fall back to the requested order.
+    LOG(WARNING) << "unable to sort git blobs by packfile offset: "
+                 << ex.what();
+    order.resize(ids.size());
+    std::iota(order.begin(), order.end(), 0);
+  }
+  VLOG(4) << "importing " << ids.size() << " git blobs in packfile order";
+
+  localStore_->enableBatchMode(FLAGS_gitBlobImportBufferSize);
+  size_t numDone = 0;
+  try {
+    auto repo = acquireRepository();
+    for (; numDone < order.size(); ++numDone) {
+      auto n = order[numDone];
+      promises[n].setWith([&] {
+        auto blob = readBlob(repo.get(), ids[n]);
+        if (FLAGS_gitStoreBlobContents) {
+          localStore_->putBlob(ids[n], blob.get());
+        } else {
+          localStore_->putBlobMetadata(ids[n], blob.get());
+        }
+        return blob;
+      });
+    }
+  } catch (const std::exception& ex) {
+    folly::exception_wrapper error{std::current_exception(), ex};
+    for (; numDone < order.size(); ++numDone) {
+      promises[order[numDone]].setException(error);
+    }
+  }
+  try {
+    localStore_->disableBatchMode();
+  } catch (const std::exception& ex) {
+    // The blobs have already been returned, and callers store them again
+    // if they are not present, so this only costs us the batching.
+    LOG(WARNING) << "error flushing git blobs to the LocalStore: "
+                 << ex.what();
+  }
+}
+
+std::vector<size_t> GitBackingStore::getPackOrder(
+    const std::vector<Hash>& ids) {
+  auto packs = loadPackIndexes();
+
+  // (pack number, offset in the pack, index in ids)
+  std::vector<std::tuple<size_t, uint64_t, size_t>> locations;
+  locations.reserve(ids.size());
+  for (size_t n = 0; n < ids.size(); ++n) {
+    std::tuple<size_t, uint64_t, size_t> location{packs.size(), 0, n};
+    for (size_t pack = 0; pack < packs.size(); ++pack) {
+      auto offset = packs[pack]->findOffset(ids[n]);
+      if (offset.hasValue()) {
+        location = std::make_tuple(pack, offset.value(), n);
+        break;
+      }
+    }
+    locations.push_back(location);
+  }
+  std::sort(locations.begin(), locations.end());
+
+  std::vector<size_t> order;
+  order.reserve(ids.size());
+  for (const auto& location : locations) {
+    order.push_back(std::get<2>(location));
+  }
+  return order;
+}
+
+std::vector<std::shared_ptr<const GitPackIndex>>
+GitBackingStore::loadPackIndexes() {
+  boost::filesystem::path packDir{path_};
+  packDir /= "objects";
+  packDir /= "pack";
+
+  std::vector<std::string> names;
+  boost::system::error_code error;
+  boost::filesystem::directory_iterator it{packDir, error};
+  if (error) {
+    // A repository without any packs has no objects/pack directory.
+    VLOG(4) << "no git packfiles in " << packDir.string() << ": "
+            << error.message();
+    return {};
+  }
+  for (; it != boost::filesystem::directory_iterator(); ++it) {
+    if (it->path().extension() == ".idx") {
+      names.push_back(it->path().filename().string());
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(packMutex_);
+  // Drop the indexes of packs that have been removed, e.g. by "git gc".
+  std::map<std::string, std::shared_ptr<const GitPackIndex>> indexes;
+  for (const auto& name : names) {
+    auto existing = packIndexes_.find(name);
+    if (existing != packIndexes_.end()) {
+      indexes.emplace(name, existing->second);
+      continue;
+    }
+    auto path = (packDir / name).string();
+    try {
+      indexes.emplace(
+          name, std::make_shared<GitPackIndex>(AbsolutePathPiece{path}));
+    } catch (const std::exception& ex) {
+      LOG(WARNING) << "unable to read git pack index " << path << ": "
+                   << ex.what();
+    }
+  }
+  packIndexes_ = std::move(indexes);
+
+  std::vector<std::shared_ptr<const GitPackIndex>> result;
+  result.reserve(packIndexes_.size());
+  for (const auto& entry : packIndexes_) {
+    result.push_back(entry.second);
+  }
+  return result;
+}
+
+Future<unique_ptr<Tree>> GitBackingStore::getTreeForCommit(
+    const Hash& commitID) {
+  return runOnExecutor(
+      executor_, [this, commitID] { return getTreeForCommitImpl(commitID); });
+}
+
+unique_ptr<Tree> GitBackingStore::getTreeForCommitImpl(const Hash& commitID) {
+  VLOG(4) << "resolving tree for commit " << commitID;
+
+  Hash treeID;
+  {
+    auto repo = acquireRepository();
+
+    // Look up the commit info
+    git_oid commitOID = hash2Oid(commitID);
+    git_commit* commit = nullptr;
+    auto error = git_commit_lookup(&commit, repo.get(), &commitOID);
+    gitCheckError(
+        error,
+        "unable to find git commit ",
+        commitID,
+        " in repository ",
+        getPath());
+    SCOPE_EXIT {
+      git_commit_free(commit);
+    };
+
+    // Get the tree ID for this commit.
+    treeID = oid2Hash(git_commit_tree_id(commit));
+  }
 
   // Now get the specified tree.
   auto tree = localStore_->getTree(treeID);
@@ -12,6 +12,17 @@
 #include "eden/fs/store/BackingStore.h"
 
 #include <folly/Range.h>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace folly {
+class Executor;
+template <typename T>
+class Promise;
+}
 
 struct git_oid;
 struct git_repository;
@@ -19,6 +30,7 @@ struct git_repository;
 namespace facebook {
 namespace eden {
 
+class GitPackIndex;
 class Hash;
 class LocalStore;
 
@@ -33,8 +45,18 @@ class GitBackingStore : public BackingStore {
    * The LocalStore object is owned by the EdenServer (which also owns this
    * GitBackingStore object).  It is guaranteed to be valid for the lifetime of
    * the GitBackingStore object.
+   *
+   * If an executor is given, all git I/O is performed on it, and the returned
+   * Futures complete on the executor's threads.  Otherwise the work is done
+   * synchronously in the calling thread.
+   *
+   * Up to --gitNumRepositoryHandles requests are served in parallel, each
+   * with a libgit2 repository handle of its own.
    */
-  GitBackingStore(folly::StringPiece repository, LocalStore* localStore);
+  GitBackingStore(
+      folly::StringPiece repository,
+      LocalStore* localStore,
+      folly::Executor* executor = nullptr);
   virtual ~GitBackingStore();
 
   /**
@@ -49,19 +71,95 @@ class GitBackingStore : public BackingStore {
   folly::Future<std::unique_ptr<Tree>> getTreeForCommit(
       const Hash& commitID) override;
 
+  /**
+   * Fetch several blobs at once.
+   *
+   * The blobs are read in the order they are stored in the repository's
+   * packfiles, rather than in the order requested, so that a large batch
+   * (such as the blobs needed by a checkout) reads each packfile
+   * sequentially instead of seeking around in it.  The blobs are also
+   * written to the LocalStore in batches.
+   */
+  std::vector<folly::Future<std::unique_ptr<Blob>>> getBlobs(
+      const std::vector<Hash>& ids) override;
+
+  /**
+   * Read a blob from the object database and compute its metadata, without
+   * creating a Blob or storing its contents in the LocalStore.
+   */
+  folly::Future<folly::Optional<BlobMetadata>> getBlobMetadata(
+      const Hash& id) override;
+
+  /**
+   * Blobs are already stored compressed in the git repository, so with
+   * --gitStoreBlobContents=false the LocalStore only keeps their metadata,
+   * and their contents are read from git on demand.
+   */
+  bool shouldStoreBlobContents() const override;
+
  private:
   GitBackingStore(GitBackingStore const&) = delete;
   GitBackingStore& operator=(GitBackingStore const&) = delete;
 
   std::unique_ptr<Tree> getTreeImpl(const Hash& id);
   std::unique_ptr<Blob> getBlobImpl(const Hash& id);
+  BlobMetadata getBlobMetadataImpl(const Hash& id);
   std::unique_ptr<Tree> getTreeForCommitImpl(const Hash& commitID);
+  void getBlobsImpl(
+      const std::vector<Hash>& ids,
+      std::vector<folly::Promise<std::unique_ptr<Blob>>>& promises);
+  std::unique_ptr<Blob> readBlob(git_repository* repo, const Hash& id);
+
+  /**
+   * Returns the indexes into ids, sorted by the packfile and offset of each
+   * object.  Objects that are not in any pack (loose objects, or objects in
+   * packs created since the indexes were loaded) sort last, in their
+   * original order.
+   */
+  std::vector<size_t> getPackOrder(const std::vector<Hash>& ids);
+
+  /**
+   * Load the indexes of the repository's current packfiles, reusing the
+   * ones that were already loaded.
+   */
+  std::vector<std::shared_ptr<const GitPackIndex>> loadPackIndexes();
+
+  class RepositoryLease;
+
+  /**
+   * Take an idle repository handle, opening a new one if all of them are
+   * busy and we are below the limit.  Blocks until one is available.
+   */
+  RepositoryLease acquireRepository();
+  void releaseRepository(git_repository* repo);
 
   static git_oid hash2Oid(const Hash& hash);
   static Hash oid2Hash(const git_oid* oid);
 
   LocalStore* localStore_{nullptr};
-  git_repository* repo_{nullptr};
+  folly::Executor* executor_{nullptr};
+  /** The path to the .git directory */
+  std::string path_;
+
+  /**
+   * libgit2 does not allow a git_repository to be used from multiple threads
+   * at once, so each request borrows a handle of its own, and lookups
+   * through separate handles proceed in parallel.
+   *
+   * repoMutex_ protects idleRepos_ and numRepos_.
+   */
+  std::mutex repoMutex_;
+  std::condition_variable repoAvailable_;
+  std::vector<git_repository*> idleRepos_;
+  size_t numRepos_{0};
+  const size_t maxRepos_{1};
+
+  /**
+   * The pack indexes loaded so far, by file name.  packMutex_ protects
+   * packIndexes_.
+   */
+  std::mutex packMutex_;
+  std::map<std::string, std::shared_ptr<const GitPackIndex>> packIndexes_;
 };
 }
 }
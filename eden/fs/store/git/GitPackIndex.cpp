@@ -0,0 +1,131 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "GitPackIndex.h"
+
+#include <folly/Bits.h>
+#include <folly/Conv.h>
+#include <cstring>
+#include <stdexcept>
+#include "eden/fs/model/Hash.h"
+
+using std::string;
+
+namespace facebook {
+namespace eden {
+
+namespace {
+/*
+ * A version 2 index consists of:
+ *   4 bytes     magic number, "\377tOc"
+ *   4 bytes     version, big-endian
+ *   256*4 bytes fanout table: the number of objects whose first byte is <= n
+ *   N*20 bytes  sorted object IDs
+ *   N*4 bytes   CRC32 of each packed object
+ *   N*4 bytes   offset of each object, or if the top bit is set, the index
+ *               of its offset in the following table
+ *   M*8 bytes   offsets that do not fit in 31 bits
+ *   40 bytes    SHA-1 of the packfile and of the index
+ */
+constexpr uint8_t kMagic[] = {0xff, 't', 'O', 'c'};
+constexpr uint32_t kVersion2 = 2;
+constexpr size_t kHeaderSize = 8;
+constexpr size_t kFanoutSize = 256 * 4;
+constexpr size_t kTrailerSize = 2 * Hash::RAW_SIZE;
+constexpr uint32_t kLargeOffsetFlag = 0x80000000;
+
+uint32_t loadBE32(const uint8_t* p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return folly::Endian::big(value);
+}
+
+uint64_t loadBE64(const uint8_t* p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return folly::Endian::big(value);
+}
+}
+
+GitPackIndex::GitPackIndex(AbsolutePathPiece path)
+    : path_(path.copy()), mapping_(path_.c_str()) {
+  auto bytes = mapping_.range();
+  if (bytes.size() < kHeaderSize + kFanoutSize + kTrailerSize) {
+    throw std::runtime_error(
+        folly::to<string>("git pack index ", path_, " is truncated"));
+  }
+  if (memcmp(bytes.data(), kMagic, sizeof(kMagic)) != 0) {
+    // Version 1 indexes have no header, and start with the fanout table.
+    throw std::domain_error(
+        folly::to<string>("unsupported git pack index version in ", path_));
+  }
+  auto version = loadBE32(bytes.data() + 4);
+  if (version != kVersion2) {
+    throw std::domain_error(folly::to<string>(
+        "unsupported git pack index version ", version, " in ", path_));
+  }
+
+  fanout_ = bytes.data() + kHeaderSize;
+  numObjects_ = loadBE32(fanout_ + kFanoutSize - 4);
+  auto tablesSize = numObjects_ * (Hash::RAW_SIZE + 4 + 4);
+  auto fixedSize = kHeaderSize + kFanoutSize + tablesSize + kTrailerSize;
+  if (bytes.size() < fixedSize || (bytes.size() - fixedSize) % 8 != 0) {
+    throw std::runtime_error(folly::to<string>(
+        "git pack index ",
+        path_,
+        " has the wrong size for ",
+        numObjects_,
+        " objects"));
+  }
+
+  ids_ = fanout_ + kFanoutSize;
+  // Skip the CRC32 table, which we have no use for.
+  offsets_ = ids_ + numObjects_ * (Hash::RAW_SIZE + 4);
+  largeOffsets_ = offsets_ + numObjects_ * 4;
+  numLargeOffsets_ = (bytes.size() - fixedSize) / 8;
+}
+
+folly::Optional<uint64_t> GitPackIndex::findOffset(const Hash& id) const {
+  auto idBytes = id.getBytes();
+  auto firstByte = idBytes[0];
+  size_t begin = firstByte == 0 ? 0 : loadBE32(fanout_ + 4 * (firstByte - 1));
+  size_t end = loadBE32(fanout_ + 4 * firstByte);
+  if (begin > end || end > numObjects_) {
+    throw std::runtime_error(folly::to<string>(
+        "git pack index ", path_, " has a corrupt fanout table"));
+  }
+
+  while (begin < end) {
+    auto mid = begin + (end - begin) / 2;
+    auto cmp =
+        memcmp(ids_ + mid * Hash::RAW_SIZE, idBytes.data(), Hash::RAW_SIZE);
+    if (cmp < 0) {
+      begin = mid + 1;
+    } else if (cmp > 0) {
+      end = mid;
+    } else {
+      auto offset = loadBE32(offsets_ + mid * 4);
+      if ((offset & kLargeOffsetFlag) == 0) {
+        return uint64_t{offset};
+      }
+      auto largeIndex = offset & ~kLargeOffsetFlag;
+      if (largeIndex >= numLargeOffsets_) {
+        throw std::runtime_error(folly::to<string>(
+            "git pack index ",
+            path_,
+            " has an out of range offset for ",
+            id.toString()));
+      }
+      return loadBE64(largeOffsets_ + largeIndex * 8);
+    }
+  }
+  return folly::none;
+}
+}
+} // facebook::eden
@@ -0,0 +1,63 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/MemoryMapping.h>
+#include <folly/Optional.h>
+#include "eden/utils/PathFuncs.h"
+
+namespace facebook {
+namespace eden {
+
+class Hash;
+
+/**
+ * A read-only git pack index (a .idx file in objects/pack).
+ *
+ * libgit2 does not expose where objects live in a packfile, which is what
+ * GitBackingStore needs to read a batch of objects in the order they are
+ * stored.  This reads the index directly to find that out.
+ *
+ * Only version 2 indexes are supported, which git has written by default
+ * since 1.5.2.  Other versions cause std::domain_error to be thrown, and
+ * malformed indexes std::runtime_error.
+ */
+class GitPackIndex {
+ public:
+  explicit GitPackIndex(AbsolutePathPiece path);
+
+  /**
+   * Returns the number of objects in the pack.
+   */
+  size_t size() const {
+    return numObjects_;
+  }
+
+  /**
+   * Find the offset of an object in the packfile, or folly::none if it is
+   * not in this pack.
+   */
+  folly::Optional<uint64_t> findOffset(const Hash& id) const;
+
+ private:
+  GitPackIndex(const GitPackIndex&) = delete;
+  GitPackIndex& operator=(const GitPackIndex&) = delete;
+
+  AbsolutePath path_;
+  folly::MemoryMapping mapping_;
+  size_t numObjects_{0};
+  const uint8_t* fanout_{nullptr};
+  const uint8_t* ids_{nullptr};
+  const uint8_t* offsets_{nullptr};
+  const uint8_t* largeOffsets_{nullptr};
+  size_t numLargeOffsets_{0};
+};
+}
+} // facebook::eden
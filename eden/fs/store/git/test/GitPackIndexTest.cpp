@@ -0,0 +1,143 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/store/git/GitPackIndex.h"
+
+#include <folly/Bits.h>
+#include <folly/FileUtil.h>
+#include <folly/experimental/TestUtil.h>
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#include "eden/fs/model/Hash.h"
+
+using namespace facebook::eden;
+
+using folly::StringPiece;
+using folly::test::TemporaryDirectory;
+using std::string;
+
+namespace {
+void appendBE32(string* out, uint32_t value) {
+  value = folly::Endian::big(value);
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void appendBE64(string* out, uint64_t value) {
+  value = folly::Endian::big(value);
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+/**
+ * Build a version 2 pack index for the given objects and offsets.
+ */
+string makeIndex(std::vector<std::pair<Hash, uint64_t>> objects) {
+  std::sort(objects.begin(), objects.end());
+
+  string data("\377tOc", 4);
+  appendBE32(&data, 2);
+  for (unsigned int byte = 0; byte < 256; ++byte) {
+    auto count = std::count_if(
+        objects.begin(), objects.end(), [byte](const auto& object) {
+          return object.first.getBytes()[0] <= byte;
+        });
+    appendBE32(&data, count);
+  }
+  for (const auto& object : objects) {
+    auto bytes = object.first.getBytes();
+    data.append(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+  }
+  for (size_t n = 0; n < objects.size(); ++n) {
+    appendBE32(&data, 0); // CRC32
+  }
+  std::vector<uint64_t> largeOffsets;
+  for (const auto& object : objects) {
+    if (object.second >= 0x80000000) {
+      appendBE32(&data, 0x80000000 | largeOffsets.size());
+      largeOffsets.push_back(object.second);
+    } else {
+      appendBE32(&data, object.second);
+    }
+  }
+  for (auto offset : largeOffsets) {
+    appendBE64(&data, offset);
+  }
+  data.append(40, '\0'); // Checksums
+  return data;
+}
+
+AbsolutePath writeIndex(const TemporaryDirectory& dir, StringPiece data) {
+  auto path =
+      AbsolutePath{dir.path().string()} + PathComponentPiece{"pack-test.idx"};
+  folly::writeFile(data, path.c_str());
+  return path;
+}
+
+Hash hash1("0000000000000000000000000000000000000001");
+Hash hash2("4a4a4a4a4a4a4a4a4a4a4a4a4a4a4a4a4a4a4a4a");
+Hash hash3("4a4a4a4a4a4a4a4a4a4a4a4a4a4a4a4a4a4a4a4b");
+Hash hash4("ffffffffffffffffffffffffffffffffffffffff");
+}
+
+TEST(GitPackIndex, findOffset) {
+  TemporaryDirectory dir("eden_git_pack_index_test");
+  auto path = writeIndex(
+      dir,
+      makeIndex({{hash3, 300},
+                 {hash1, 12},
+                 {hash4, 0x123456789},
+                 {hash2, 0x7fffffff}}));
+
+  GitPackIndex index(path);
+  EXPECT_EQ(4, index.size());
+  EXPECT_EQ(12, index.findOffset(hash1).value());
+  EXPECT_EQ(0x7fffffff, index.findOffset(hash2).value());
+  EXPECT_EQ(300, index.findOffset(hash3).value());
+  EXPECT_EQ(0x123456789, index.findOffset(hash4).value());
+
+  EXPECT_FALSE(
+      index.findOffset(Hash("0000000000000000000000000000000000000000"))
+          .hasValue());
+  EXPECT_FALSE(
+      index.findOffset(Hash("4a4a4a4a4a4a4a4a4a4a4a4a4a4a4a4a4a4a4a4c"))
+          .hasValue());
+}
+
+TEST(GitPackIndex, empty) {
+  TemporaryDirectory dir("eden_git_pack_index_test");
+  GitPackIndex index(writeIndex(dir, makeIndex({})));
+  EXPECT_EQ(0, index.size());
+  EXPECT_FALSE(index.findOffset(hash1).hasValue());
+}
+
+TEST(GitPackIndex, rejectsBadData) {
+  TemporaryDirectory dir("eden_git_pack_index_test");
+  auto data = makeIndex({{hash1, 12}, {hash2, 34}});
+
+  // Truncated
+  EXPECT_THROW(
+      GitPackIndex(writeIndex(dir, StringPiece{data}.subpiece(0, 100))),
+      std::runtime_error);
+  EXPECT_THROW(
+      GitPackIndex(
+          writeIndex(dir, StringPiece{data}.subpiece(0, data.size() - 4))),
+      std::runtime_error);
+
+  // A version 1 index, which has no header
+  EXPECT_THROW(
+      GitPackIndex(writeIndex(dir, StringPiece{data}.subpiece(8))),
+      std::domain_error);
+
+  // An unknown version
+  auto badVersion = data;
+  badVersion[7] = 3;
+  EXPECT_THROW(GitPackIndex(writeIndex(dir, badVersion)), std::domain_error);
+}
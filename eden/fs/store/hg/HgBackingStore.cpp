@@ -9,81 +9,439 @@
  */
 #include "HgBackingStore.h"
 
+#include <folly/Executor.h>
 #include <folly/futures/Future.h>
+#include <gflags/gflags.h>
+#include <numeric>
+#include <utility>
 
+#include "common/stats/ServiceData.h"
 #include "eden/fs/model/Blob.h"
 #include "eden/fs/model/Hash.h"
 #include "eden/fs/model/Tree.h"
 #include "eden/fs/store/LocalStore.h"
 #include "eden/fs/store/StoreResult.h"
+#include "eden/fs/store/StoreStats.h"
+#include "eden/fs/store/hg/HgImporter.h"
+#include "eden/fs/store/hg/HgNativeImporter.h"
+#include "eden/utils/CancellationToken.h"
 
-using folly::ByteRange;
 using folly::Future;
 using folly::StringPiece;
-using folly::makeFuture;
 using std::make_unique;
 using std::unique_ptr;
 
+DEFINE_int32(
+    hgNumImporters,
+    4,
+    "The default maximum number of hg_import_helper.py processes to run for "
+    "each mercurial repository");
+DEFINE_int32(
+    hgImporterPipelineDepth,
+    8,
+    "The maximum number of requests to pipeline to a single "
+    "hg_import_helper.py process at once");
+DEFINE_int32(
+    hgImportTimeoutSeconds,
+    120,
+    "Kill an hg_import_helper.py process that takes longer than this to "
+    "start, or that goes this long without responding to outstanding "
+    "requests, and retry its requests on another one.  0 disables this.");
+DEFINE_int32(
+    hgCatFilesBatchSize,
+    256,
+    "The maximum number of files to request from hg_import_helper.py in a "
+    "single CMD_CAT_FILES request");
+DEFINE_bool(
+    hgTreeManifestImport,
+    true,
+    "Import mercurial trees lazily from tree manifests when the repository "
+    "supports them, rather than importing the full flat manifest");
+DEFINE_bool(
+    hgIncrementalManifestImport,
+    true,
+    "When importing a flat manifest, only import the trees that differ from "
+    "the most recently imported commit");
+DEFINE_bool(
+    hgNativeImport,
+    true,
+    "Read file contents and flat manifests directly from the repository's "
+    "revlogs when possible, rather than through hg_import_helper.py");
+
+namespace {
+/**
+ * Run fn on the executor, or immediately in the calling thread if executor is
+ * null, and return a Future with its result.
+ */
+template <typename Fn>
+auto runOnExecutor(folly::Executor* executor, Fn&& fn)
+    -> decltype(folly::makeFutureWith(std::forward<Fn>(fn))) {
+  if (!executor) {
+    return folly::makeFutureWith(std::forward<Fn>(fn));
+  }
+  return folly::via(executor, std::forward<Fn>(fn));
+}
+
+/**
+ * Throw rather than start a queued fetch if every request waiting on it has
+ * been interrupted, so that it does not take up an importer.
+ */
+void skipIfCancelled(
+    const std::shared_ptr<facebook::eden::CancellationToken>& token) {
+  if (token && token->isCancelled()) {
+    fbData->incrementCounter("backing_store.cancelled_fetches");
+    token->throwIfCancelled();
+  }
+}
+
+/**
+ * Call fn with an importer from the pool.  If the importer's helper process
+ * exits or is killed before answering, fn is retried once with another
+ * importer.
+ */
+template <typename Fn>
+auto withImporter(facebook::eden::HgImporterPool& pool, Fn&& fn)
+    -> decltype(fn(std::declval<facebook::eden::HgImporter&>())) {
+  try {
+    auto importer = pool.acquire();
+    return fn(*importer);
+  } catch (const facebook::eden::HgImportHelperError& ex) {
+    LOG(WARNING) << "retrying request to hg_import_helper: " << ex.what();
+    facebook::eden::StoreStats::get()->hgRetries.addValue(1);
+  }
+  auto importer = pool.acquire();
+  return fn(*importer);
+}
+
+/**
+ * Fetch the contents of a batch of blobs with a single request to one
+ * importer, and wait for all of them.  Blobs that were not received because
+ * the helper process died are requested once more from another importer.
+ */
+std::vector<folly::Try<folly::IOBuf>> fetchContentsBatch(
+    facebook::eden::HgImporterPool& pool,
+    const std::vector<facebook::eden::Hash>& ids) {
+  std::vector<folly::Try<folly::IOBuf>> results(ids.size());
+  std::vector<size_t> pending(ids.size());
+  std::iota(pending.begin(), pending.end(), 0);
+  for (bool canRetry = true;; canRetry = false) {
+    std::vector<facebook::eden::Hash> request;
+    request.reserve(pending.size());
+    for (auto index : pending) {
+      request.push_back(ids[index]);
+    }
+
+    std::vector<Future<folly::IOBuf>> contents;
+    {
+      auto importer = pool.acquire();
+      contents = importer->fetchFileContentsBatch(request);
+      for (auto& future : contents) {
+        future.wait();
+      }
+    }
+
+    std::vector<size_t> retry;
+    for (size_t n = 0; n < contents.size(); ++n) {
+      auto& result = contents[n].getTry();
+      if (canRetry && result.hasException() &&
+          result.exception()
+              .is_compatible_with<facebook::eden::HgImportHelperError>()) {
+        retry.push_back(pending[n]);
+      } else {
+        results[pending[n]] = std::move(result);
+      }
+    }
+    if (retry.empty()) {
+      return results;
+    }
+    LOG(WARNING) << "retrying " << retry.size()
+                 << " blobs after hg_import_helper failed";
+    facebook::eden::StoreStats::get()->hgRetries.addValue(1);
+    pending = std::move(retry);
+  }
+}
+}
+
 namespace facebook {
 namespace eden {
 
-HgBackingStore::HgBackingStore(StringPiece repository, LocalStore* localStore)
-    : importer_(folly::construct_in_place, repository, localStore),
-      localStore_(localStore) {}
+HgBackingStore::HgBackingStore(
+    StringPiece repository,
+    LocalStore* localStore,
+    size_t numImporters,
+    folly::Executor* executor)
+    : configuredNumImporters_(numImporters),
+      importers_(
+          repository,
+          localStore,
+          numImporters > 0 ? numImporters : FLAGS_hgNumImporters,
+          FLAGS_hgImporterPipelineDepth,
+          std::chrono::seconds(std::max(FLAGS_hgImportTimeoutSeconds, 0))),
+      localStore_(localStore),
+      executor_(executor) {
+  if (FLAGS_hgNativeImport) {
+    try {
+      nativeImporter_ =
+          HgNativeImporter::create(AbsolutePathPiece{repository}, localStore);
+    } catch (const std::exception& ex) {
+      LOG(WARNING) << "unable to read revlogs of mercurial repository "
+                   << repository << " directly: " << ex.what();
+    }
+  }
+}
 
 HgBackingStore::~HgBackingStore() {}
 
 Future<unique_ptr<Tree>> HgBackingStore::getTree(const Hash& id) {
-  // HgBackingStore imports all relevant Tree objects when the root Tree is
-  // imported by getTreeForCommit().  We should never have a case where
-  // we are asked for a Tree that hasn't already been imported.
-  LOG(ERROR) << "HgBackingStore asked for unknown tree ID " << id.toString();
-  return makeFuture<unique_ptr<Tree>>(std::domain_error(
-      "HgBackingStore asked for unknown tree ID " + id.toString()));
+  // Trees are only imported here for commits imported from tree manifests.
+  // When the flat manifest is imported, getTreeForCommit() imports every
+  // Tree up front, so we should never be asked for them.
+  auto token = CancellationToken::getCurrent();
+  return runOnExecutor(executor_, [this, id, token] {
+    skipIfCancelled(token);
+    try {
+      return withImporter(importers_, [&](HgImporter& importer) {
+        return importer.importTree(id);
+      });
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "HgBackingStore failed to import tree " << id.toString()
+                 << ": " << ex.what();
+      throw;
+    }
+  });
 }
 
 Future<unique_ptr<Blob>> HgBackingStore::getBlob(const Hash& id) {
-  // TODO: Perform hg loading in a separate thread pool
+  // We wait for the result on the executor thread rather than returning the
+  // Future from fetchFileContents(), since it would be fulfilled on the
+  // importer's reader thread, and callers may chain further work onto it.
+  // Concurrent callers are still pipelined to the same helper process.
+  auto token = CancellationToken::getCurrent();
+  return runOnExecutor(executor_, [this, id, token] {
+    skipIfCancelled(token);
+    auto blob = getBlobNative(id);
+    if (blob) {
+      return blob;
+    }
+    auto buf = withImporter(importers_, [&](HgImporter& importer) {
+      return importer.importFileContents(id);
+    });
+    return make_unique<Blob>(id, std::move(buf));
+  });
+}
+
+unique_ptr<Blob> HgBackingStore::getBlobNative(const Hash& id) {
+  if (!nativeImporter_) {
+    return nullptr;
+  }
   try {
-    auto buf = importer_->importFileContents(id);
-    return makeFuture(make_unique<Blob>(id, std::move(buf)));
+    return make_unique<Blob>(id, nativeImporter_->importFileContents(id));
   } catch (const std::exception& ex) {
-    return makeFuture<unique_ptr<Blob>>(
-        folly::exception_wrapper{std::current_exception(), ex});
+    VLOG(3) << "reading blob " << id.toString()
+            << " through hg_import_helper.py: " << ex.what();
+    return nullptr;
+  }
+}
+
+Future<folly::Optional<BlobMetadata>> HgBackingStore::getBlobMetadata(
+    const Hash& id) {
+  using MetadataResult = folly::Optional<BlobMetadata>;
+  auto token = CancellationToken::getCurrent();
+  return runOnExecutor(executor_, [this, id, token]() -> MetadataResult {
+    skipIfCancelled(token);
+    if (nativeImporter_) {
+      try {
+        return nativeImporter_->getFileMetadata(id);
+      } catch (const std::exception& ex) {
+        VLOG(3) << "reading metadata of blob " << id.toString()
+                << " through hg_import_helper.py: " << ex.what();
+      }
+    }
+    // As in getBlob(), wait here rather than on the reader thread.
+    return withImporter(importers_, [&](HgImporter& importer) {
+      return importer.fetchFileMetadata(id).get();
+    });
+  });
+}
+
+std::vector<Future<unique_ptr<Blob>>> HgBackingStore::getBlobs(
+    const std::vector<Hash>& ids) {
+  std::vector<Future<unique_ptr<Blob>>> results;
+  results.reserve(ids.size());
+
+  // Split the request into batches, so a huge request doesn't monopolize a
+  // single helper process.  Each batch is dispatched to an importer as one
+  // CMD_CAT_FILES request, and the batches are fetched in parallel on the
+  // executor.
+  auto batchSize = std::max<size_t>(FLAGS_hgCatFilesBatchSize, 1);
+  for (size_t start = 0; start < ids.size(); start += batchSize) {
+    auto end = std::min(ids.size(), start + batchSize);
+    auto batch = std::make_shared<BlobBatch>();
+    batch->ids.assign(ids.begin() + start, ids.begin() + end);
+    batch->promises.resize(batch->ids.size());
+    batch->cancellation = CancellationToken::getCurrent();
+    for (auto& promise : batch->promises) {
+      results.push_back(promise.getFuture());
+    }
+
+    runOnExecutor(executor_, [this, batch] { fetchBlobBatch(*batch); });
+  }
+  return results;
+}
+
+void HgBackingStore::fetchBlobBatch(BlobBatch& batch) {
+  try {
+    skipIfCancelled(batch.cancellation);
+  } catch (const std::exception& ex) {
+    folly::exception_wrapper error{std::current_exception(), ex};
+    for (auto& promise : batch.promises) {
+      promise.setException(error);
+    }
+    return;
+  }
+
+  if (nativeImporter_) {
+    // Only send the blobs that can't be read from the revlogs to the helper.
+    BlobBatch remaining;
+    for (size_t n = 0; n < batch.ids.size(); ++n) {
+      auto blob = getBlobNative(batch.ids[n]);
+      if (blob) {
+        batch.promises[n].setValue(std::move(blob));
+      } else {
+        remaining.ids.push_back(batch.ids[n]);
+        remaining.promises.push_back(std::move(batch.promises[n]));
+      }
+    }
+    if (remaining.ids.empty()) {
+      return;
+    }
+    batch = std::move(remaining);
+  }
+
+  // As in getBlob(), we wait for the batch to complete here rather than
+  // letting callers chain work onto the importer's reader thread.
+  std::vector<folly::Try<folly::IOBuf>> contents;
+  try {
+    contents = fetchContentsBatch(importers_, batch.ids);
+  } catch (const std::exception& ex) {
+    folly::exception_wrapper error{std::current_exception(), ex};
+    for (auto& promise : batch.promises) {
+      promise.setException(error);
+    }
+    return;
+  }
+
+  for (size_t n = 0; n < contents.size(); ++n) {
+    auto& result = contents[n];
+    if (result.hasException()) {
+      batch.promises[n].setException(result.exception());
+    } else {
+      batch.promises[n].setValue(
+          make_unique<Blob>(batch.ids[n], std::move(result.value())));
+    }
   }
 }
 
 Future<unique_ptr<Tree>> HgBackingStore::getTreeForCommit(
     const Hash& commitID) {
-  // TODO: Perform hg loading in a separate thread pool
-  return makeFuture(getTreeForCommitImpl(commitID));
+  return runOnExecutor(executor_, [this, commitID] {
+    return getTreeForCommitImpl(commitID);
+  });
 }
 
 unique_ptr<Tree> HgBackingStore::getTreeForCommitImpl(const Hash& commitID) {
-  // TODO: We should probably switch to using a RocksDB column family rather
-  // than a key suffix here.
-  static constexpr StringPiece mappingSuffix{"hgc"};
-  std::array<uint8_t, Hash::RAW_SIZE + mappingSuffix.size()> mappingKeyStorage;
-  memcpy(mappingKeyStorage.data(), commitID.getBytes().data(), Hash::RAW_SIZE);
-  memcpy(
-      mappingKeyStorage.data() + Hash::RAW_SIZE, "hgc", mappingSuffix.size());
-  ByteRange mappingKey(mappingKeyStorage.data(), mappingKeyStorage.size());
-
+  // Commits we have seen before are answered straight from the LocalStore,
+  // without having to talk to hg_import_helper.py at all.
   Hash rootTreeHash;
-  auto result = localStore_->get(mappingKey);
-  if (result.isValid()) {
-    rootTreeHash = Hash{result.bytes()};
+  auto existing = localStore_->getCommitRootTree(commitID);
+  if (existing.hasValue()) {
+    rootTreeHash = existing.value();
     VLOG(5) << "found existing tree " << rootTreeHash.toString()
             << " for mercurial commit " << commitID.toString();
+    *lastImport_.wlock() = ImportedCommit{commitID, rootTreeHash};
   } else {
-    rootTreeHash = importer_->importManifest(commitID.toString());
+    rootTreeHash = importRootTree(commitID);
     VLOG(1) << "imported mercurial commit " << commitID.toString()
             << " as tree " << rootTreeHash.toString();
 
-    localStore_->put(mappingKey, rootTreeHash.getBytes());
+    localStore_->putCommitRootTree(commitID, rootTreeHash);
   }
 
   return localStore_->getTree(rootTreeHash);
 }
+
+Hash HgBackingStore::importRootTree(const Hash& commitID) {
+  auto revName = commitID.toString();
+  if (FLAGS_hgTreeManifestImport && useTreeManifest_.load()) {
+    auto rootTreeHash = withImporter(importers_, [&](HgImporter& importer) {
+      return importer.importTreeManifest(revName);
+    });
+    if (rootTreeHash.hasValue()) {
+      return rootTreeHash.value();
+    }
+    LOG(INFO) << "mercurial repository does not use tree manifests; "
+                 "falling back to flat manifest import";
+    useTreeManifest_.store(false);
+  }
+
+  return importFlatManifest(commitID);
+}
+
+Hash HgBackingStore::importFlatManifest(const Hash& commitID) {
+  auto revName = commitID.toString();
+  Hash rootTreeHash;
+
+  auto base = *lastImport_.rlock();
+  if (FLAGS_hgIncrementalManifestImport && base.hasValue()) {
+    try {
+      rootTreeHash = withImporter(importers_, [&](HgImporter& importer) {
+        return importer.importManifestDiff(
+            revName, base->commitID, base->rootTree);
+      });
+    } catch (const std::exception& ex) {
+      // This can happen if the base commit's trees were imported lazily
+      // from a tree manifest and are not all present in the LocalStore.
+      LOG(WARNING) << "incremental import of mercurial commit " << revName
+                   << " relative to " << base->commitID.toString()
+                   << " failed; falling back to a full import: " << ex.what();
+    }
+  }
+
+  if (rootTreeHash == Hash()) {
+    // LocalStore batch mode is global to the store, so only one full
+    // manifest import may run at a time.
+    std::lock_guard<std::mutex> guard(manifestImportMutex_);
+    if (nativeImporter_) {
+      try {
+        rootTreeHash = nativeImporter_->importManifest(commitID);
+      } catch (const std::exception& ex) {
+        LOG(WARNING) << "unable to read the manifest of mercurial commit "
+                     << revName << " from its revlog; falling back to "
+                     << "hg_import_helper.py: " << ex.what();
+      }
+    }
+    if (rootTreeHash == Hash()) {
+      rootTreeHash = withImporter(importers_, [&](HgImporter& importer) {
+        return importer.importManifest(revName);
+      });
+    }
+  }
+
+  *lastImport_.wlock() = ImportedCommit{commitID, rootTreeHash};
+  return rootTreeHash;
+}
+
+HgImporterPoolStats HgBackingStore::getImporterStats() const {
+  return importers_.getStats();
+}
+
+void HgBackingStore::setImporterLimits(
+    size_t defaultNumImporters,
+    size_t maxRequestsPerImporter) {
+  importers_.setLimits(
+      configuredNumImporters_ > 0 ? configuredNumImporters_
+                                  : defaultNumImporters,
+      maxRequestsPerImporter);
+}
 }
 } // facebook::eden
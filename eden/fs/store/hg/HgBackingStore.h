@@ -9,15 +9,26 @@
  */
 #pragma once
 
+#include "eden/fs/model/Hash.h"
 #include "eden/fs/store/BackingStore.h"
-#include "eden/fs/store/hg/HgImporter.h"
+#include "eden/fs/store/hg/HgImporterPool.h"
 
+#include <folly/Optional.h>
 #include <folly/Range.h>
 #include <folly/Synchronized.h>
+#include <folly/futures/Promise.h>
+#include <atomic>
+#include <mutex>
+
+namespace folly {
+class Executor;
+}
 
 namespace facebook {
 namespace eden {
 
+class CancellationToken;
+class HgNativeImporter;
 class LocalStore;
 
 /**
@@ -31,27 +42,109 @@ class HgBackingStore : public BackingStore {
    * The LocalStore object is owned by the EdenServer (which also owns this
    * HgBackingStore object).  It is guaranteed to be valid for the lifetime of
    * the HgBackingStore object.
+   *
+   * numImporters controls the maximum number of hg_import_helper.py
+   * processes that may be used to import data from this repository in
+   * parallel.  If it is 0 the --hgNumImporters flag value is used.
+   *
+   * If an executor is given, all imports are performed on it, and the
+   * returned Futures complete on the executor's threads.  Otherwise the work
+   * is done synchronously in the calling thread.
+   *
+   * With --hgNativeImport, file contents and flat manifests are read
+   * directly from the repository's revlogs when possible, and the helper
+   * processes are only used for data that can't be read that way.
    */
-  HgBackingStore(folly::StringPiece repository, LocalStore* localStore);
+  HgBackingStore(
+      folly::StringPiece repository,
+      LocalStore* localStore,
+      size_t numImporters = 0,
+      folly::Executor* executor = nullptr);
   virtual ~HgBackingStore();
 
   folly::Future<std::unique_ptr<Tree>> getTree(const Hash& id) override;
   folly::Future<std::unique_ptr<Blob>> getBlob(const Hash& id) override;
   folly::Future<std::unique_ptr<Tree>> getTreeForCommit(
       const Hash& commitID) override;
+  std::vector<folly::Future<std::unique_ptr<Blob>>> getBlobs(
+      const std::vector<Hash>& ids) override;
+
+  /**
+   * Compute the metadata from the revlogs directly when possible, and
+   * otherwise have hg_import_helper.py compute it, so that the contents
+   * never cross the pipe.
+   */
+  folly::Future<folly::Optional<BlobMetadata>> getBlobMetadata(
+      const Hash& id) override;
+
+  /**
+   * Get statistics about the pool of HgImporter objects used by this
+   * HgBackingStore.
+   */
+  HgImporterPoolStats getImporterStats() const;
+
+  /**
+   * Change the limits of the importer pool.  defaultNumImporters only
+   * applies if no numImporters was given for this repository when it was
+   * created.
+   */
+  void setImporterLimits(
+      size_t defaultNumImporters,
+      size_t maxRequestsPerImporter);
 
  private:
   // Forbidden copy constructor and assignment operator
   HgBackingStore(HgBackingStore const&) = delete;
   HgBackingStore& operator=(HgBackingStore const&) = delete;
 
+  struct ImportedCommit {
+    Hash commitID;
+    Hash rootTree;
+  };
+
+  struct BlobBatch {
+    std::vector<Hash> ids;
+    std::vector<folly::Promise<std::unique_ptr<Blob>>> promises;
+    /** The requests waiting on the batch, if they can be cancelled */
+    std::shared_ptr<CancellationToken> cancellation;
+  };
+
   std::unique_ptr<Tree> getTreeForCommitImpl(const Hash& commitID);
+  /**
+   * Read a blob directly from the revlogs.  Returns null if it must be
+   * fetched through hg_import_helper.py instead.
+   */
+  std::unique_ptr<Blob> getBlobNative(const Hash& id);
+  /**
+   * Fetch one batch of blobs for getBlobs(), and fulfill its promises.
+   */
+  void fetchBlobBatch(BlobBatch& batch);
+  /**
+   * Import the root Tree for a commit, using the tree manifest if the
+   * repository has one, and the flat manifest otherwise.
+   */
+  Hash importRootTree(const Hash& commitID);
+  /**
+   * Import a commit from its flat manifest, incrementally relative to the
+   * last imported commit if possible.
+   */
+  Hash importFlatManifest(const Hash& commitID);
 
-  // TODO: In the future we may want to maintain a pool of HgImporter objects,
-  // rather than just a single one, so we can perform multiple imports in
-  // parallel.
-  folly::Synchronized<HgImporter> importer_;
+  /** The numImporters given to the constructor */
+  const size_t configuredNumImporters_{0};
+  HgImporterPool importers_;
+  /** Null if the repository's revlogs can't be read directly. */
+  std::unique_ptr<HgNativeImporter> nativeImporter_;
+  std::mutex manifestImportMutex_;
+  /** Cleared once we find that the repository has no tree manifests. */
+  std::atomic<bool> useTreeManifest_{true};
+  /**
+   * The most recently imported commit, which is used as the base for
+   * incremental manifest imports.
+   */
+  folly::Synchronized<folly::Optional<ImportedCommit>> lastImport_;
   LocalStore* localStore_{nullptr};
+  folly::Executor* executor_{nullptr};
 };
 }
 } // facebook::eden
@@ -15,17 +15,25 @@
 #include <folly/Bits.h>
 #include <folly/Conv.h>
 #include <folly/FileUtil.h>
+#include <folly/Optional.h>
+#include <folly/String.h>
 #include <folly/io/Cursor.h>
 #include <folly/io/IOBuf.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <poll.h>
 #include <unistd.h>
+#include <wangle/concurrent/CPUThreadPoolExecutor.h>
+#include <algorithm>
 #include <mutex>
 
 #include "HgManifestImporter.h"
+#include "HgProxyHash.h"
+#include "eden/fs/model/Tree.h"
 #include "eden/fs/model/TreeEntry.h"
 #include "eden/fs/store/LocalStore.h"
 #include "eden/fs/store/StoreResult.h"
+#include "eden/fs/store/StoreStats.h"
 #include "eden/utils/PathFuncs.h"
 
 using folly::ByteRange;
@@ -41,6 +49,11 @@ DEFINE_string(
     hgImportHelper,
     "",
     "The path to the mercurial import helper script");
+DEFINE_int32(
+    hgManifestImportThreads,
+    4,
+    "The number of threads used to serialize and hash trees during a full "
+    "manifest import, or 0 to do this on the importing thread");
 
 namespace {
 
@@ -62,165 +75,6 @@ using namespace facebook::eden;
  */
 constexpr int HELPER_PIPE_FD = 5;
 
-/**
- * HgBlobInfo manages mercurial (path, revHash) data in the LocalStore.
- *
- * Mercurial doesn't really have a blob hash the same way eden and git do.
- * Instead, mercurial file revision hashes are always relative to a specific
- * path.  To use the data in eden, we need to create a blob hash that we can
- * use instead.
- *
- * To do so, we hash the (path, revHash) tuple, and use this hash as the blob
- * hash in eden.  We store the eden_blob_hash --> (path, hgRevHash) mapping
- * in the LocalStore.  The HgBlobInfo class helps store and retrieve these
- * mappings.
- */
-struct HgBlobInfo {
- public:
-  /**
-   * Load HgBlobInfo data for the given eden blob hash from the LocalStore.
-   */
-  HgBlobInfo(LocalStore* store, Hash edenBlobHash) {
-    // Read the path name and file rev hash
-    auto infoResult = store->get(StringPiece(getBlobKey(edenBlobHash)));
-    if (!infoResult.isValid()) {
-      LOG(ERROR) << "received unknown mercurial blob hash "
-                 << edenBlobHash.toString();
-      // Fall through and let infoResult.extractValue() throw
-    }
-
-    value_ = infoResult.extractValue();
-    parseValue(edenBlobHash);
-  }
-
-  ~HgBlobInfo() {}
-
-  const RelativePathPiece& path() const {
-    return path_;
-  }
-
-  const Hash& revHash() const {
-    return revHash_;
-  }
-
-  /**
-   * Store HgBlobInfo data in the LocalStore.
-   *
-   * Returns an eden blob hash that can be used to retrieve the data later
-   * (using the HgBlobInfo constructor defined above).
-   */
-  static Hash store(LocalStore* store, RelativePathPiece path, Hash hgRevHash) {
-    // Serialize the (path, hgRevHash) tuple into a buffer.
-    auto buf = serialize(path, hgRevHash);
-
-    // Compute the hash of the serialized buffer
-    ByteRange serializedInfo = buf.coalesce();
-    auto edenBlobHash = Hash::sha1(serializedInfo);
-
-    // Save the data in the store
-    store->put(StringPiece(getBlobKey(edenBlobHash)), serializedInfo);
-    return edenBlobHash;
-  }
-
- private:
-  // Not movable or copyable.
-  // path_ points into value_, and would need to be updated after
-  // copying/moving the data.  Since no-one needs to copy or move HgBlobInfo
-  // objects, we don't implement this for now.
-  HgBlobInfo(const HgBlobInfo&) = delete;
-  HgBlobInfo& operator=(const HgBlobInfo&) = delete;
-  HgBlobInfo(HgBlobInfo&&) = delete;
-  HgBlobInfo& operator=(HgBlobInfo&&) = delete;
-
-  static std::string getBlobKey(Hash edenBlobHash) {
-    // TODO: Use a RocksDB column family for this rather than having to
-    // use a key suffix.
-    auto key = StringPiece(edenBlobHash.getBytes()).str();
-    key.append("hgx");
-    return key;
-  }
-
-  /**
-   * Serialize the (path, hgRevHash) data into a buffer that will be stored in
-   * the LocalStore.
-   */
-  static IOBuf serialize(RelativePathPiece path, Hash hgRevHash) {
-    // We serialize the data as <hash_bytes><path_length><path>
-    //
-    // The path_length is stored as a big-endian uint32_t.
-    auto pathStr = path.stringPiece();
-    IOBuf buf(
-        IOBuf::CREATE, Hash::RAW_SIZE + sizeof(uint32_t) + pathStr.size());
-    Appender appender(&buf, 0);
-    appender.push(hgRevHash.getBytes());
-    appender.writeBE<uint32_t>(pathStr.size());
-    appender.push(pathStr);
-
-    return buf;
-  }
-
-  /**
-   * Parse the serialized data found in value_, and set revHash_ and path_.
-   *
-   * The value_ member variable should already contain the serialized data,
-   * (as returned by serialize()).
-   *
-   * Note that path_ will be set to a RelativePathPiece pointing into the
-   * string data owned by value_.  (This lets us avoid copying the string data
-   * out.)
-   */
-  void parseValue(Hash edenBlobHash) {
-    ByteRange infoBytes = StringPiece(value_);
-    // Make sure the data is long enough to contain the rev hash and path length
-    if (infoBytes.size() < Hash::RAW_SIZE + sizeof(uint32_t)) {
-      auto msg = folly::to<string>(
-          "mercurial blob info data for ",
-          edenBlobHash.toString(),
-          " is too short (",
-          infoBytes.size(),
-          " bytes)");
-      LOG(ERROR) << msg;
-      throw std::length_error(msg);
-    }
-
-    // Extract the revHash_
-    revHash_ = Hash(infoBytes.subpiece(0, Hash::RAW_SIZE));
-    infoBytes.advance(Hash::RAW_SIZE);
-
-    // Extract the path length
-    uint32_t pathLength;
-    memcpy(&pathLength, infoBytes.data(), sizeof(uint32_t));
-    pathLength = Endian::big(pathLength);
-    infoBytes.advance(sizeof(uint32_t));
-    // Make sure the path length agrees with the length of data remaining
-    if (infoBytes.size() != pathLength) {
-      auto msg = folly::to<string>(
-          "mercurial blob info data for ",
-          edenBlobHash.toString(),
-          " has inconsistent path length");
-      LOG(ERROR) << msg;
-      throw std::length_error(msg);
-    }
-
-    // Extract the path_
-    path_ = RelativePathPiece(StringPiece(infoBytes));
-  }
-
-  /**
-   * The serialized data.
-   */
-  std::string value_;
-  /**
-   * The revision hash.
-   */
-  Hash revHash_;
-  /**
-   * The path name.  Note that this points into the serialized value_ data.
-   * path_ itself does not own the data it points to.
-   */
-  RelativePathPiece path_;
-};
-
 /**
  * Internal helper function for use by getImportHelperPath().
  *
@@ -302,12 +156,67 @@ std::string getImportHelperPath() {
   return helperPath;
 }
 
+/**
+ * Read the <rev_hash><tab><flag><tab> prefix of a manifest entry sent by
+ * hg_import_helper.py, leaving the cursor pointing at the entry's path.
+ *
+ * Returns the mercurial flag character, or ' ' if the flag is empty.
+ */
+char readManifestEntryPrefix(Cursor& cursor, Hash* revHash) {
+  Hash::Storage hashBuf;
+  cursor.pull(hashBuf.data(), hashBuf.size());
+  *revHash = Hash(hashBuf);
+
+  auto sep = cursor.read<char>();
+  if (sep != '\t') {
+    throw std::runtime_error(folly::to<string>(
+        "unexpected separator char: ", static_cast<int>(sep)));
+  }
+  auto flag = cursor.read<char>();
+  if (flag == '\t') {
+    return ' ';
+  }
+  sep = cursor.read<char>();
+  if (sep != '\t') {
+    throw std::runtime_error(folly::to<string>(
+        "unexpected separator char: ", static_cast<int>(sep)));
+  }
+  return flag;
+}
+
+/**
+ * Convert the mercurial flag for a file into the eden file type and owner
+ * permissions.
+ */
+void parseFileFlag(
+    char flag,
+    StringPiece pathStr,
+    FileType* fileType,
+    uint8_t* ownerPermissions) {
+  if (flag == ' ') {
+    *fileType = FileType::REGULAR_FILE;
+    *ownerPermissions = 0b110;
+  } else if (flag == 'x') {
+    *fileType = FileType::REGULAR_FILE;
+    *ownerPermissions = 0b111;
+  } else if (flag == 'l') {
+    *fileType = FileType::SYMLINK;
+    *ownerPermissions = 0b111;
+  } else {
+    throw std::runtime_error(folly::to<string>(
+        "unsupported file flags for ", pathStr, ": ", static_cast<int>(flag)));
+  }
+}
+
 } // unnamed namespace
 
 namespace facebook {
 namespace eden {
 
-HgImporter::HgImporter(StringPiece repoPath, LocalStore* store)
+HgImporter::HgImporter(
+    StringPiece repoPath,
+    LocalStore* store,
+    std::chrono::milliseconds startTimeout)
     : store_(store) {
   std::vector<string> cmd = {
       getImportHelperPath(),
@@ -333,6 +242,23 @@ HgImporter::HgImporter(StringPiece repoPath, LocalStore* store)
 
   // Wait for the import helper to send the CMD_STARTED message indicating
   // that it has started successfully.
+  if (startTimeout.count() > 0) {
+    struct pollfd pfd;
+    pfd.fd = helperOut_;
+    pfd.events = POLLIN;
+    int rc;
+    do {
+      rc = poll(&pfd, 1, static_cast<int>(startTimeout.count()));
+    } while (rc < 0 && errno == EINTR);
+    if (rc == 0) {
+      StoreStats::get()->hgHelperTimeouts.addValue(1);
+      helper_.kill();
+      throw HgImportHelperError(folly::to<string>(
+          "hg_import_helper did not start within ",
+          startTimeout.count(),
+          "ms"));
+    }
+  }
   auto header = readChunkHeader();
   if (header.command != CMD_STARTED) {
     // This normally shouldn't happen.  If an error occurs, the
@@ -342,127 +268,373 @@ HgImporter::HgImporter(StringPiece repoPath, LocalStore* store)
     throw std::runtime_error(
         "unexpected start message from hg_import_helper script");
   }
+
+  // Now that the helper has started, all further responses are read by the
+  // reader thread.
+  readerThread_ = std::thread([this] { readerLoop(); });
 }
 
 HgImporter::~HgImporter() {
+  // Closing the helper's stdin causes it to exit once it has finished
+  // processing any requests it has already received.  The reader thread will
+  // then see EOF and exit.
   helper_.closeParentFd(STDIN_FILENO);
+  if (readerThread_.joinable()) {
+    readerThread_.join();
+  }
   helper_.wait();
 }
 
 Hash HgImporter::importManifest(StringPiece revName) {
-  // Send the manifest request to the helper process
-  sendManifestRequest(revName);
-
-  HgManifestImporter importer(store_);
+  // Use a pool of our own, rather than a shared executor, since finish()
+  // blocks waiting for it.  The pool must outlive the importer.
+  std::unique_ptr<wangle::CPUThreadPoolExecutor> pool;
+  if (FLAGS_hgManifestImportThreads > 0) {
+    pool = std::make_unique<wangle::CPUThreadPoolExecutor>(
+        FLAGS_hgManifestImportThreads);
+  }
+  HgManifestImporter importer(store_, pool.get());
   size_t numPaths = 0;
 
-  IOBuf chunkData;
-  while (true) {
-    // Read the chunk header
-    auto header = readChunkHeader();
-
-    // Allocate a larger chunk buffer if we need to,
-    // but prefer to re-use the old buffer if we can.
-    if (header.dataLength > chunkData.capacity()) {
-      chunkData = IOBuf(IOBuf::CREATE, header.dataLength);
-    } else {
-      chunkData.clear();
-    }
-    folly::readFull(helperOut_, chunkData.writableTail(), header.dataLength);
-    chunkData.append(header.dataLength);
-
-    // Now process the entries in the chunk
+  // The manifest chunks are processed on the reader thread as they arrive.
+  // We block until the final chunk has been processed, so it is safe for the
+  // callback to refer to importer and numPaths on our stack.
+  auto onChunk = [this, &importer, &numPaths](
+      const ChunkHeader& /* header */, IOBuf&& chunkData) {
     Cursor cursor(&chunkData);
     while (!cursor.isAtEnd()) {
       readManifestEntry(importer, cursor);
       ++numPaths;
     }
+  };
+  sendManifestRequest(revName, std::move(onChunk)).get();
 
-    if ((header.flags & FLAG_MORE_CHUNKS) == 0) {
-      break;
-    }
-  }
   auto rootHash = importer.finish();
   VLOG(1) << "processed " << numPaths << " manifest paths";
 
   return rootHash;
 }
 
+Hash HgImporter::importManifestDiff(
+    StringPiece revName,
+    const Hash& baseCommitID,
+    const Hash& baseRootTree) {
+  HgManifestImporter importer(store_, baseRootTree);
+  size_t numChanges = 0;
+
+  auto onChunk = [this, &importer, &numChanges](
+      const ChunkHeader& /* header */, IOBuf&& chunkData) {
+    Cursor cursor(&chunkData);
+    while (!cursor.isAtEnd()) {
+      readManifestDiffEntry(importer, cursor);
+      ++numChanges;
+    }
+  };
+  std::array<struct iovec, 2> iov;
+  iov[0].iov_base = const_cast<uint8_t*>(baseCommitID.getBytes().data());
+  iov[0].iov_len = Hash::RAW_SIZE;
+  iov[1].iov_base = const_cast<char*>(revName.data());
+  iov[1].iov_len = revName.size();
+  sendRequest(CMD_MANIFEST_DIFF, iov.data(), iov.size(), std::move(onChunk))
+      .get();
+
+  auto rootHash = importer.finish();
+  VLOG(1) << "processed " << numChanges << " manifest changes relative to "
+          << baseCommitID.toString();
+
+  return rootHash;
+}
+
+folly::Optional<Hash> HgImporter::importTreeManifest(StringPiece revName) {
+  auto manifestNode = resolveManifestNode(revName);
+  if (!manifestNode.hasValue()) {
+    return folly::none;
+  }
+
+  // Only the root Tree is imported now.  Its subdirectories are imported by
+  // importTree() as they are accessed.
+  auto rootHash =
+      HgProxyHash::store(store_, RelativePathPiece(), manifestNode.value());
+  importTree(rootHash);
+  return rootHash;
+}
+
+std::unique_ptr<Tree> HgImporter::importTree(const Hash& edenTreeHash) {
+  HgProxyHash hgInfo(store_, edenTreeHash);
+  auto dirPath = hgInfo.path();
+  VLOG(5) << "importing tree '" << dirPath << "', "
+          << hgInfo.revHash().toString();
+
+  // As in importManifest(), we block until the final chunk has been
+  // processed, so the callback can refer to entries on our stack.
+  std::vector<TreeEntry> entries;
+  auto onChunk = [this, &entries, dirPath](
+      const ChunkHeader& /* header */, IOBuf&& chunkData) {
+    Cursor cursor(&chunkData);
+    while (!cursor.isAtEnd()) {
+      entries.push_back(readTreeEntry(dirPath, cursor));
+    }
+  };
+  sendTreeRequest(dirPath, hgInfo.revHash(), std::move(onChunk)).get();
+
+  // Mercurial sorts subdirectories as if their names had a trailing slash,
+  // but Tree expects entries to be sorted by name alone.
+  std::sort(
+      entries.begin(),
+      entries.end(),
+      [](const TreeEntry& a, const TreeEntry& b) {
+        return a.getName() < b.getName();
+      });
+
+  auto tree = std::make_unique<Tree>(std::move(entries), edenTreeHash);
+  store_->putTree(tree.get());
+  return tree;
+}
+
 IOBuf HgImporter::importFileContents(Hash blobHash) {
+  return fetchFileContents(blobHash).get();
+}
+
+folly::Future<IOBuf> HgImporter::fetchFileContents(Hash blobHash) {
   // Look up the mercurial path and file revision hash,
   // which we need to import the data from mercurial
-  HgBlobInfo hgInfo(store_, blobHash);
+  HgProxyHash hgInfo(store_, blobHash);
   VLOG(5) << "requesting file contents of '" << hgInfo.path() << "', "
           << hgInfo.revHash().toString();
 
-  // Ask the import helper process for the file contents
-  sendFileRequest(hgInfo.path(), hgInfo.revHash());
-
-  // Read the response.  The response body contains the file contents,
-  // which is exactly what we want to return.
+  // The response body contains the file contents, which is exactly what we
+  // want to return.
   //
   // Note: For now we expect to receive the entire contents in a single chunk.
   // In the future we might want to consider if it is more efficient to receive
   // the body data in fixed-size chunks, particularly for very large files.
-  auto header = readChunkHeader();
-  auto buf = IOBuf(IOBuf::CREATE, header.dataLength);
-  folly::readFull(helperOut_, buf.writableTail(), header.dataLength);
-  buf.append(header.dataLength);
-
-  return buf;
+  auto contents = std::make_shared<IOBuf>();
+  auto onChunk = [contents](const ChunkHeader& /* header */, IOBuf&& data) {
+    if (contents->empty() && !contents->isChained()) {
+      *contents = std::move(data);
+    } else {
+      contents->prependChain(std::make_unique<IOBuf>(std::move(data)));
+    }
+  };
+  return sendFileRequest(hgInfo.path(), hgInfo.revHash(), std::move(onChunk))
+      .then([contents]() { return std::move(*contents); });
 }
 
-void HgImporter::readManifestEntry(
-    HgManifestImporter& importer,
-    folly::io::Cursor& cursor) {
-  Hash::Storage hashBuf;
-  cursor.pull(hashBuf.data(), hashBuf.size());
-  Hash fileRevHash(hashBuf);
+folly::Future<BlobMetadata> HgImporter::fetchFileMetadata(Hash blobHash) {
+  HgProxyHash hgInfo(store_, blobHash);
+  VLOG(5) << "requesting file metadata of '" << hgInfo.path() << "', "
+          << hgInfo.revHash().toString();
 
-  auto sep = cursor.read<char>();
-  if (sep != '\t') {
-    throw std::runtime_error(folly::to<string>(
-        "unexpected separator char: ", static_cast<int>(sep)));
+  auto metadata = std::make_shared<folly::Optional<BlobMetadata>>();
+  auto onChunk = [metadata](const ChunkHeader& /* header */, IOBuf&& data) {
+    Cursor cursor(&data);
+    auto size = cursor.readBE<uint64_t>();
+    Hash::Storage sha1Bytes;
+    cursor.pull(sha1Bytes.data(), sha1Bytes.size());
+    Hash sha1{sha1Bytes};
+    if (!cursor.isAtEnd()) {
+      throw std::runtime_error("trailing data in file metadata response");
+    }
+    *metadata = BlobMetadata{sha1, size};
+  };
+  return sendFileRequest(
+             hgInfo.path(),
+             hgInfo.revHash(),
+             std::move(onChunk),
+             CMD_FILE_METADATA)
+      .then([metadata, blobHash]() {
+        if (!metadata->hasValue()) {
+          throw std::runtime_error(folly::to<string>(
+              "no metadata received for blob ", blobHash.toString()));
+        }
+        return metadata->value();
+      });
+}
+
+std::vector<folly::Future<IOBuf>> HgImporter::fetchFileContentsBatch(
+    const std::vector<Hash>& blobHashes) {
+  // Build the request body, looking up the mercurial path and file revision
+  // hash for each blob.  Blobs that we fail to look up are not sent to the
+  // helper, and just get a failed Future.
+  std::vector<folly::exception_wrapper> lookupErrors(blobHashes.size());
+  size_t numRequested = 0;
+  IOBuf body(IOBuf::CREATE, sizeof(uint32_t));
+  {
+    Appender appender(&body, 4096);
+    appender.writeBE<uint32_t>(0); // Placeholder for the file count
+    for (size_t idx = 0; idx < blobHashes.size(); ++idx) {
+      try {
+        HgProxyHash hgInfo(store_, blobHashes[idx]);
+        auto pathStr = hgInfo.path().stringPiece();
+        appender.push(hgInfo.revHash().getBytes());
+        appender.writeBE<uint32_t>(pathStr.size());
+        appender.push(pathStr);
+        ++numRequested;
+      } catch (const std::exception& ex) {
+        lookupErrors[idx] =
+            folly::exception_wrapper{std::current_exception(), ex};
+      }
+    }
   }
-  auto flag = cursor.read<char>();
-  if (flag == '\t') {
-    flag = ' ';
-  } else {
-    sep = cursor.read<char>();
-    if (sep != '\t') {
-      throw std::runtime_error(folly::to<string>(
-          "unexpected separator char: ", static_cast<int>(sep)));
+  auto bodyBytes = body.coalesce();
+  uint32_t numRequestedBE = Endian::big<uint32_t>(numRequested);
+  memcpy(body.writableData(), &numRequestedBE, sizeof(numRequestedBE));
+  VLOG(5) << "requesting contents of " << numRequested << " files";
+
+  // The helper sends exactly one chunk per file, in request order.
+  struct BatchState {
+    std::vector<folly::Promise<IOBuf>> promises;
+    size_t numReceived{0};
+  };
+  auto state = std::make_shared<BatchState>();
+  state->promises.resize(numRequested);
+
+  std::vector<folly::Future<IOBuf>> results;
+  results.reserve(blobHashes.size());
+  size_t promiseIdx = 0;
+  for (auto& error : lookupErrors) {
+    if (error) {
+      results.push_back(folly::makeFuture<IOBuf>(std::move(error)));
+    } else {
+      results.push_back(state->promises[promiseIdx++].getFuture());
+    }
+  }
+  if (numRequested == 0) {
+    return results;
+  }
+
+  auto onChunk = [state](const ChunkHeader& /* header */, IOBuf&& data) {
+    if (state->numReceived >= state->promises.size()) {
+      throw std::runtime_error(
+          "received too many responses from hg_import_helper for "
+          "CMD_CAT_FILES request");
+    }
+    state->promises[state->numReceived++].setValue(std::move(data));
+  };
+  std::array<struct iovec, 1> iov;
+  iov[0].iov_base = const_cast<uint8_t*>(bodyBytes.data());
+  iov[0].iov_len = bodyBytes.size();
+  sendRequest(CMD_CAT_FILES, iov.data(), iov.size(), std::move(onChunk))
+      .then([state](folly::Try<folly::Unit>&& result) {
+        // Fail any files that we did not receive
+        auto error = result.hasException()
+            ? result.exception()
+            : folly::make_exception_wrapper<std::runtime_error>(
+                  "hg_import_helper sent too few responses for "
+                  "CMD_CAT_FILES request");
+        for (auto idx = state->numReceived; idx < state->promises.size();
+             ++idx) {
+          state->promises[idx].setException(error);
+        }
+      });
+
+  return results;
+}
+
+size_t HgImporter::getNumOutstandingRequests() const {
+  std::lock_guard<std::mutex> guard(outstandingMutex_);
+  return outstanding_.size();
+}
+
+bool HgImporter::isHelperAlive() const {
+  std::lock_guard<std::mutex> guard(outstandingMutex_);
+  return !helperError_;
+}
+
+bool HgImporter::killIfHung(std::chrono::steady_clock::duration timeout) {
+  auto now = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<std::mutex> guard(outstandingMutex_);
+    if (helperError_ || !killReason_.empty() || outstanding_.empty() ||
+        now - lastProgress_ <= timeout) {
+      return false;
     }
+    auto seconds =
+        std::chrono::duration_cast<std::chrono::seconds>(now - lastProgress_);
+    killReason_ = folly::to<string>(
+        "hg_import_helper made no progress on ",
+        outstanding_.size(),
+        " outstanding requests for ",
+        seconds.count(),
+        "s and was killed");
   }
 
+  LOG(ERROR) << "killing hung hg_import_helper process " << helper_.pid();
+  StoreStats::get()->hgHelperTimeouts.addValue(1);
+  // The reader thread sees EOF once the process is gone, and fails the
+  // outstanding requests.
+  helper_.kill();
+  return true;
+}
+
+HgImporter::PipeStats HgImporter::getPipeStats() const {
+  PipeStats stats;
+  stats.bytesSent = bytesSent_.load(std::memory_order_relaxed);
+  stats.bytesReceived = bytesReceived_.load(std::memory_order_relaxed);
+  stats.chunksReceived = chunksReceived_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void HgImporter::readManifestEntry(
+    HgManifestImporter& importer,
+    folly::io::Cursor& cursor) {
+  Hash fileRevHash;
+  auto flag = readManifestEntryPrefix(cursor, &fileRevHash);
   auto pathStr = cursor.readTerminatedString();
 
   FileType fileType;
   uint8_t ownerPermissions;
-  if (flag == ' ') {
-    fileType = FileType::REGULAR_FILE;
-    ownerPermissions = 0b110;
-  } else if (flag == 'x') {
-    fileType = FileType::REGULAR_FILE;
-    ownerPermissions = 0b111;
-  } else if (flag == 'l') {
-    fileType = FileType::SYMLINK;
-    ownerPermissions = 0b111;
-  } else {
-    throw std::runtime_error(folly::to<string>(
-        "unsupported file flags for ", pathStr, ": ", static_cast<int>(flag)));
-  }
+  parseFileFlag(flag, pathStr, &fileType, &ownerPermissions);
 
   RelativePathPiece path(pathStr);
 
   // Generate a blob hash from the mercurial (path, fileRev) information
-  auto blobHash = HgBlobInfo::store(store_, path, fileRevHash);
+  auto blobHash = HgProxyHash::store(store_, path, fileRevHash);
 
   auto entry =
       TreeEntry(blobHash, path.basename().value(), fileType, ownerPermissions);
   importer.processEntry(path.dirname(), std::move(entry));
 }
 
+void HgImporter::readManifestDiffEntry(
+    HgManifestImporter& importer,
+    folly::io::Cursor& cursor) {
+  auto status = cursor.read<char>();
+  if (status == 'M') {
+    readManifestEntry(importer, cursor);
+  } else if (status == 'R') {
+    Hash unusedRevHash;
+    readManifestEntryPrefix(cursor, &unusedRevHash);
+    auto pathStr = cursor.readTerminatedString();
+    importer.removeEntry(RelativePathPiece(pathStr));
+  } else {
+    throw std::runtime_error(folly::to<string>(
+        "unexpected manifest diff status: ", static_cast<int>(status)));
+  }
+}
+
+TreeEntry HgImporter::readTreeEntry(
+    RelativePathPiece dirPath,
+    folly::io::Cursor& cursor) {
+  Hash revHash;
+  auto flag = readManifestEntryPrefix(cursor, &revHash);
+  auto name = cursor.readTerminatedString();
+  auto path = dirPath + PathComponentPiece(name);
+
+  // Subdirectories and files both get proxy hashes.  For subdirectories
+  // revHash is the tree manifest node, which importTree() will look up when
+  // the subdirectory is first accessed.
+  auto proxyHash = HgProxyHash::store(store_, path, revHash);
+  if (flag == 't') {
+    return TreeEntry(proxyHash, name, FileType::DIRECTORY, 0b111);
+  }
+
+  FileType fileType;
+  uint8_t ownerPermissions;
+  parseFileFlag(flag, path.stringPiece(), &fileType, &ownerPermissions);
+  return TreeEntry(proxyHash, name, fileType, ownerPermissions);
+}
+
 HgImporter::ChunkHeader HgImporter::readChunkHeader() {
   ChunkHeader header;
   folly::readFull(helperOut_, &header, sizeof(header));
@@ -484,37 +656,270 @@ HgImporter::ChunkHeader HgImporter::readChunkHeader() {
   return header;
 }
 
-void HgImporter::sendManifestRequest(folly::StringPiece revName) {
-  ChunkHeader header;
-  header.command = Endian::big<uint32_t>(CMD_MANIFEST);
-  header.requestID = Endian::big<uint32_t>(nextRequestID_++);
-  header.flags = 0;
-  header.dataLength = Endian::big<uint32_t>(revName.size());
+folly::Future<folly::Unit> HgImporter::sendManifestRequest(
+    folly::StringPiece revName,
+    ChunkCallback&& onChunk) {
+  std::array<struct iovec, 1> iov;
+  iov[0].iov_base = const_cast<char*>(revName.data());
+  iov[0].iov_len = revName.size();
+  return sendRequest(CMD_MANIFEST, iov.data(), iov.size(), std::move(onChunk));
+}
+
+folly::Future<folly::Unit> HgImporter::sendTreeRequest(
+    RelativePathPiece path,
+    Hash manifestNode,
+    ChunkCallback&& onChunk) {
+  StringPiece pathStr = path.stringPiece();
 
   std::array<struct iovec, 2> iov;
-  iov[0].iov_base = &header;
-  iov[0].iov_len = sizeof(header);
-  iov[1].iov_base = const_cast<char*>(revName.data());
-  iov[1].iov_len = revName.size();
-  folly::writevFull(helperIn_, iov.data(), iov.size());
+  iov[0].iov_base = const_cast<uint8_t*>(manifestNode.getBytes().data());
+  iov[0].iov_len = Hash::RAW_SIZE;
+  iov[1].iov_base = const_cast<char*>(pathStr.data());
+  iov[1].iov_len = pathStr.size();
+  return sendRequest(CMD_TREE, iov.data(), iov.size(), std::move(onChunk));
+}
+
+folly::Optional<Hash> HgImporter::resolveManifestNode(StringPiece revName) {
+  IOBuf response;
+  auto onChunk = [&response](const ChunkHeader& /* header */, IOBuf&& data) {
+    response = std::move(data);
+  };
+  std::array<struct iovec, 1> iov;
+  iov[0].iov_base = const_cast<char*>(revName.data());
+  iov[0].iov_len = revName.size();
+  sendRequest(CMD_MANIFEST_NODE, iov.data(), iov.size(), std::move(onChunk))
+      .get();
+
+  // The helper sends an empty response if the repository does not use tree
+  // manifests.
+  auto bytes = response.coalesce();
+  if (bytes.empty()) {
+    return folly::none;
+  }
+  if (bytes.size() != Hash::RAW_SIZE) {
+    throw std::runtime_error(folly::to<string>(
+        "unexpected manifest node length from hg_import_helper: ",
+        bytes.size()));
+  }
+  return Hash(bytes);
 }
 
-void HgImporter::sendFileRequest(RelativePathPiece path, Hash revHash) {
+folly::Future<folly::Unit> HgImporter::sendFileRequest(
+    RelativePathPiece path,
+    Hash revHash,
+    ChunkCallback&& onChunk,
+    uint32_t command) {
+  StringPiece pathStr = path.stringPiece();
+
+  std::array<struct iovec, 2> iov;
+  iov[0].iov_base = const_cast<uint8_t*>(revHash.getBytes().data());
+  iov[0].iov_len = Hash::RAW_SIZE;
+  iov[1].iov_base = const_cast<char*>(pathStr.data());
+  iov[1].iov_len = pathStr.size();
+  return sendRequest(command, iov.data(), iov.size(), std::move(onChunk));
+}
+
+folly::Future<folly::Unit> HgImporter::sendRequest(
+    uint32_t command,
+    struct iovec* body,
+    size_t numBodyIovecs,
+    ChunkCallback&& onChunk) {
+  std::lock_guard<std::mutex> writeGuard(writeMutex_);
+  auto requestID = nextRequestID_++;
+
+  // Register the request before sending it, so the reader thread can
+  // always find it when the response arrives.
+  OutstandingRequest request(std::move(onChunk));
+  request.command = command;
+  request.startTime = std::chrono::steady_clock::now();
+  auto future = request.promise.getFuture();
+  {
+    std::lock_guard<std::mutex> guard(outstandingMutex_);
+    if (helperError_) {
+      return folly::makeFuture<folly::Unit>(helperError_);
+    }
+    if (outstanding_.empty()) {
+      lastProgress_ = request.startTime;
+    }
+    outstanding_.emplace(requestID, std::move(request));
+  }
+
   ChunkHeader header;
-  header.command = Endian::big<uint32_t>(CMD_CAT_FILE);
-  header.requestID = Endian::big<uint32_t>(nextRequestID_++);
+  header.command = Endian::big<uint32_t>(command);
+  header.requestID = Endian::big<uint32_t>(requestID);
   header.flags = 0;
-  StringPiece pathStr = path.stringPiece();
-  header.dataLength = Endian::big<uint32_t>(Hash::RAW_SIZE + pathStr.size());
 
-  std::array<struct iovec, 3> iov;
+  std::vector<struct iovec> iov(numBodyIovecs + 1);
   iov[0].iov_base = &header;
   iov[0].iov_len = sizeof(header);
-  iov[1].iov_base = const_cast<uint8_t*>(revHash.getBytes().data());
-  iov[1].iov_len = Hash::RAW_SIZE;
-  iov[2].iov_base = const_cast<char*>(pathStr.data());
-  iov[2].iov_len = pathStr.size();
-  folly::writevFull(helperIn_, iov.data(), iov.size());
+  size_t dataLength = 0;
+  for (size_t n = 0; n < numBodyIovecs; ++n) {
+    iov[n + 1] = body[n];
+    dataLength += body[n].iov_len;
+  }
+  header.dataLength = Endian::big<uint32_t>(dataLength);
+
+  auto bytesWritten = folly::writevFull(helperIn_, iov.data(), iov.size());
+  if (bytesWritten < 0) {
+    auto errnum = errno;
+    LOG(ERROR) << "error sending request to hg_import_helper: "
+               << folly::errnoStr(errnum);
+    // The helper cannot have responded to a request that it has not
+    // received in full, so the reader thread is not using this entry.
+    folly::Optional<OutstandingRequest> failedRequest;
+    {
+      std::lock_guard<std::mutex> guard(outstandingMutex_);
+      auto it = outstanding_.find(requestID);
+      if (it != outstanding_.end()) {
+        failedRequest.emplace(std::move(it->second));
+        outstanding_.erase(it);
+      }
+    }
+    if (failedRequest) {
+      // The helper has almost certainly exited, so let the caller retry.
+      failedRequest->promise.setException(HgImportHelperError(
+          folly::to<string>(
+              "error sending request to hg_import_helper: ",
+              folly::errnoStr(errnum))));
+    }
+  } else {
+    bytesSent_.fetch_add(bytesWritten, std::memory_order_relaxed);
+  }
+
+  return future;
+}
+
+void HgImporter::readerLoop() {
+  while (true) {
+    ChunkHeader header;
+    auto bytesRead = folly::readFull(helperOut_, &header, sizeof(header));
+    if (bytesRead != static_cast<ssize_t>(sizeof(header))) {
+      break;
+    }
+    header.requestID = Endian::big(header.requestID);
+    header.command = Endian::big(header.command);
+    header.flags = Endian::big(header.flags);
+    header.dataLength = Endian::big(header.dataLength);
+
+    IOBuf data(IOBuf::CREATE, header.dataLength);
+    bytesRead =
+        folly::readFull(helperOut_, data.writableTail(), header.dataLength);
+    if (bytesRead != static_cast<ssize_t>(header.dataLength)) {
+      break;
+    }
+    data.append(header.dataLength);
+    bytesReceived_.fetch_add(
+        sizeof(header) + header.dataLength, std::memory_order_relaxed);
+    chunksReceived_.fetch_add(1, std::memory_order_relaxed);
+
+    dispatchChunk(header, std::move(data));
+  }
+
+  VLOG(1) << "hg_import_helper process closed its output pipe";
+  string reason;
+  {
+    std::lock_guard<std::mutex> guard(outstandingMutex_);
+    reason = killReason_;
+  }
+  if (reason.empty()) {
+    reason = "hg_import_helper process exited";
+  }
+  failAllRequests(folly::make_exception_wrapper<HgImportHelperError>(reason));
+}
+
+void HgImporter::dispatchChunk(const ChunkHeader& header, IOBuf&& data) {
+  // Only the reader thread removes entries from outstanding_ once a request
+  // has been sent, and std::unordered_map never invalidates references to
+  // its elements on insertion, so it is safe to use this pointer after
+  // releasing the lock.
+  OutstandingRequest* request;
+  {
+    std::lock_guard<std::mutex> guard(outstandingMutex_);
+    auto it = outstanding_.find(header.requestID);
+    if (it == outstanding_.end()) {
+      LOG(WARNING) << "received hg_import_helper response for unknown request "
+                   << header.requestID;
+      return;
+    }
+    request = &it->second;
+    lastProgress_ = std::chrono::steady_clock::now();
+  }
+
+  auto* stats = StoreStats::get();
+  bool isLast = (header.flags & FLAG_MORE_CHUNKS) == 0;
+  if ((header.flags & FLAG_ERROR) != 0) {
+    stats->hgErrors.addValue(1);
+    auto errStr = StringPiece(data.coalesce()).str();
+    LOG(WARNING) << "error received from hg helper process: " << errStr;
+    if (!request->failed) {
+      request->failed = true;
+      request->promise.setException(std::runtime_error(errStr));
+    }
+    isLast = true;
+  } else if (!request->failed) {
+    stats->hgBytesImported.addValue(header.dataLength);
+    try {
+      request->onChunk(header, std::move(data));
+    } catch (const std::exception& ex) {
+      request->failed = true;
+      request->promise.setException(
+          folly::exception_wrapper{std::current_exception(), ex});
+    }
+  }
+
+  if (!isLast) {
+    return;
+  }
+
+  folly::Optional<OutstandingRequest> finished;
+  {
+    std::lock_guard<std::mutex> guard(outstandingMutex_);
+    auto it = outstanding_.find(header.requestID);
+    finished.emplace(std::move(it->second));
+    outstanding_.erase(it);
+  }
+  auto histogram = getCommandHistogram(finished->command);
+  if (histogram) {
+    StoreStats::recordLatency(stats->*histogram, finished->startTime);
+  }
+  if (!finished->failed) {
+    finished->promise.setValue();
+  }
+}
+
+StoreStats::HistogramPtr HgImporter::getCommandHistogram(uint32_t command) {
+  switch (command) {
+    case CMD_MANIFEST:
+      return &StoreStats::hgManifest;
+    case CMD_CAT_FILE:
+      return &StoreStats::hgCatFile;
+    case CMD_CAT_FILES:
+      return &StoreStats::hgCatFiles;
+    case CMD_TREE:
+      return &StoreStats::hgTree;
+    case CMD_MANIFEST_NODE:
+      return &StoreStats::hgManifestNode;
+    case CMD_MANIFEST_DIFF:
+      return &StoreStats::hgManifestDiff;
+    case CMD_FILE_METADATA:
+      return &StoreStats::hgFileMetadata;
+  }
+  return nullptr;
+}
+
+void HgImporter::failAllRequests(const folly::exception_wrapper& error) {
+  std::unordered_map<uint32_t, OutstandingRequest> requests;
+  {
+    std::lock_guard<std::mutex> guard(outstandingMutex_);
+    helperError_ = error;
+    requests.swap(outstanding_);
+  }
+
+  for (auto& entry : requests) {
+    if (!entry.second.failed) {
+      entry.second.promise.setException(error);
+    }
+  }
 }
 }
 } // facebook::eden
@@ -9,13 +9,30 @@
  */
 #pragma once
 
+#include <folly/Function.h>
+#include <folly/Optional.h>
 #include <folly/Range.h>
 #include <folly/Subprocess.h>
+#include <folly/futures/Future.h>
+#include <folly/io/IOBuf.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include "eden/fs/store/BlobMetadata.h"
+#include "eden/fs/store/StoreStats.h"
 #include "eden/utils/PathFuncs.h"
 
 namespace folly {
-class IOBuf;
 namespace io {
 class Cursor;
 }
@@ -27,6 +44,20 @@ namespace eden {
 class Hash;
 class HgManifestImporter;
 class LocalStore;
+class Tree;
+class TreeEntry;
+
+/**
+ * The error that requests fail with when the hg_import_helper.py process
+ * exits, or is killed for not responding, before answering them.
+ *
+ * Unlike errors reported by the helper itself, these say nothing about the
+ * request, so it can be retried with another HgImporter.
+ */
+class HgImportHelperError : public std::runtime_error {
+ public:
+  using std::runtime_error::runtime_error;
+};
 
 /**
  * HgImporter provides an API for extracting data out of a mercurial
@@ -36,9 +67,12 @@ class LocalStore;
  * code.  HgImporter hides all of the interaction with the underlying python
  * code.
  *
- * HgImporter is not thread safe.  The external caller must provide their own
- * locking around each HgImporter object.  However, to achieve parallelism
- * multiple HgImporter objects can be created for the same repository and used
+ * HgImporter is thread safe.  Requests from multiple threads are pipelined
+ * over the same pipe to the helper process: each request is tagged with a
+ * unique request ID, and a dedicated reader thread matches response chunks
+ * back to the outstanding request with the same ID.  The helper process
+ * handles requests one at a time, so to achieve more parallelism multiple
+ * HgImporter objects can be created for the same repository and used
  * simultaneously.
  */
 class HgImporter {
@@ -49,8 +83,15 @@ class HgImporter {
    *
    * The caller is responsible for ensuring that the LocalStore object remains
    * valid for the lifetime of the HgImporter object.
+   *
+   * If startTimeout is non-zero and the helper process has not finished
+   * loading the repository by then, it is killed and HgImportHelperError is
+   * thrown.
    */
-  HgImporter(folly::StringPiece repoPath, LocalStore* store);
+  HgImporter(
+      folly::StringPiece repoPath,
+      LocalStore* store,
+      std::chrono::milliseconds startTimeout = std::chrono::milliseconds{0});
   virtual ~HgImporter();
 
   /**
@@ -60,6 +101,46 @@ class HgImporter {
    */
   Hash importManifest(folly::StringPiece revName);
 
+  /**
+   * Import the manifest for the specified revision, relative to a revision
+   * that has already been imported.
+   *
+   * baseCommitID is the mercurial commit ID of the already imported revision,
+   * and baseRootTree is the Hash of its root Tree.  Only the Trees along the
+   * paths that differ between the two revisions are imported.  All of the
+   * base revision's Trees must be present in the LocalStore.
+   *
+   * Returns a Hash identifying the root Tree for the imported revision.
+   */
+  Hash importManifestDiff(
+      folly::StringPiece revName,
+      const Hash& baseCommitID,
+      const Hash& baseRootTree);
+
+  /**
+   * Import the root Tree for the specified revision from its tree manifest.
+   *
+   * Unlike importManifest(), this does not import the whole revision up
+   * front.  Only the root Tree is imported, and its subdirectories are
+   * imported on demand by importTree().
+   *
+   * Returns a Hash identifying the root Tree, or folly::none if the
+   * repository does not use tree manifests.  In that case the caller should
+   * fall back to importManifest().
+   */
+  folly::Optional<Hash> importTreeManifest(folly::StringPiece revName);
+
+  /**
+   * Import a single Tree from a tree manifest.
+   *
+   * Takes a hash identifying the requested tree.  (Tree hashes are returned
+   * by importTreeManifest(), or can be found in the TreeEntry objects of
+   * trees imported by importTree().)
+   *
+   * The Tree is also saved in the LocalStore.
+   */
+  std::unique_ptr<Tree> importTree(const Hash& edenTreeHash);
+
   /**
    * Import file information
    *
@@ -70,6 +151,81 @@ class HgImporter {
    */
   folly::IOBuf importFileContents(Hash blobHash);
 
+  /**
+   * Asynchronously fetch file contents.
+   *
+   * This sends the request to the helper process and returns immediately,
+   * without waiting for the response.  The returned Future will be fulfilled
+   * on the reader thread once the response has been received, so callers
+   * should not chain expensive or blocking work directly onto it.
+   */
+  folly::Future<folly::IOBuf> fetchFileContents(Hash blobHash);
+
+  /**
+   * Asynchronously fetch the contents of several files with a single request.
+   *
+   * This is more efficient than calling fetchFileContents() for each blob,
+   * since the helper process can handle the whole batch at once.
+   *
+   * Returns one Future per input hash, in the same order.  Each Future is
+   * fulfilled on the reader thread as soon as the contents of that file have
+   * been received.
+   */
+  std::vector<folly::Future<folly::IOBuf>> fetchFileContentsBatch(
+      const std::vector<Hash>& blobHashes);
+
+  /**
+   * Asynchronously fetch the size and SHA-1 of a file's contents.
+   *
+   * The helper process still reads the file, but only sends us its
+   * metadata.  As with fetchFileContents(), the returned Future is fulfilled
+   * on the reader thread.
+   */
+  folly::Future<BlobMetadata> fetchFileMetadata(Hash blobHash);
+
+  /**
+   * Get the number of requests that have been sent to the helper process
+   * but have not yet been fully answered.
+   */
+  size_t getNumOutstandingRequests() const;
+
+  /**
+   * Counts of the traffic exchanged with the helper process so far,
+   * including the chunk headers.
+   */
+  struct PipeStats {
+    uint64_t bytesSent{0};
+    uint64_t bytesReceived{0};
+    uint64_t chunksReceived{0};
+  };
+  PipeStats getPipeStats() const;
+
+  /**
+   * Returns false once the helper process has exited or been killed.  All
+   * requests to a dead importer fail with HgImportHelperError.
+   */
+  bool isHelperAlive() const;
+
+  /**
+   * Kill the helper process if it appears to be hung: that is, if requests
+   * are outstanding but no response chunk has arrived for longer than
+   * timeout.  The outstanding requests then fail with HgImportHelperError.
+   *
+   * Since the helper answers requests one at a time, this bounds how long
+   * any request can wait without the helper making progress, without
+   * failing requests that are merely queued behind a long one.
+   *
+   * Returns true if the helper was killed.
+   */
+  bool killIfHung(std::chrono::steady_clock::duration timeout);
+
+  /**
+   * Get the process ID of the hg_import_helper.py process.
+   */
+  pid_t getHelperPid() const {
+    return helper_.pid();
+  }
+
  private:
   /**
    * Chunk header flags.
@@ -91,6 +247,11 @@ class HgImporter {
     CMD_RESPONSE = 1,
     CMD_MANIFEST = 2,
     CMD_CAT_FILE = 3,
+    CMD_CAT_FILES = 4,
+    CMD_TREE = 5,
+    CMD_MANIFEST_NODE = 6,
+    CMD_MANIFEST_DIFF = 7,
+    CMD_FILE_METADATA = 8,
   };
   struct ChunkHeader {
     uint32_t requestID;
@@ -99,6 +260,29 @@ class HgImporter {
     uint32_t dataLength;
   };
 
+  /**
+   * A callback invoked on the reader thread for each response chunk
+   * received for a request.  If it throws, the request fails with that
+   * exception, and any remaining chunks for the request are discarded.
+   */
+  using ChunkCallback =
+      folly::Function<void(const ChunkHeader& header, folly::IOBuf&& data)>;
+
+  /**
+   * State for a request that has been sent to the helper process.
+   */
+  struct OutstandingRequest {
+    explicit OutstandingRequest(ChunkCallback&& callback)
+        : onChunk(std::move(callback)) {}
+
+    ChunkCallback onChunk;
+    folly::Promise<folly::Unit> promise;
+    bool failed{false};
+    // For the StoreStats import latency histograms.
+    uint32_t command{0};
+    std::chrono::steady_clock::time_point startTime;
+  };
+
   // Forbidden copy constructor and assignment operator
   HgImporter(const HgImporter&) = delete;
   HgImporter& operator=(const HgImporter&) = delete;
@@ -114,27 +298,129 @@ class HgImporter {
   void readManifestEntry(
       HgManifestImporter& importer,
       folly::io::Cursor& cursor);
+  /**
+   * Read a single entry from a manifest diff response chunk, and give it to
+   * the HgManifestImporter for processing.
+   */
+  void readManifestDiffEntry(
+      HgManifestImporter& importer,
+      folly::io::Cursor& cursor);
+  /**
+   * Read a single entry from a tree response chunk.
+   *
+   * dirPath is the path of the directory being imported.  The cursor is
+   * updated to point to the next entry.
+   */
+  TreeEntry readTreeEntry(RelativePathPiece dirPath, folly::io::Cursor& cursor);
   /**
    * Read a response chunk header from the helper process
    *
    * If the header indicates an error, this will read the full error message
    * and throw a std::runtime_error.
+   *
+   * This is only used before the reader thread has been started.
    */
   ChunkHeader readChunkHeader();
   /**
    * Send a request to the helper process, asking it to send us the manifest
    * for the specified revision.
    */
-  void sendManifestRequest(folly::StringPiece revName);
+  folly::Future<folly::Unit> sendManifestRequest(
+      folly::StringPiece revName,
+      ChunkCallback&& onChunk);
+  /**
+   * Send a request to the helper process, asking it to send us the entries
+   * of the given directory at the specified tree manifest node.
+   */
+  folly::Future<folly::Unit> sendTreeRequest(
+      RelativePathPiece path,
+      Hash manifestNode,
+      ChunkCallback&& onChunk);
+  /**
+   * Ask the helper process for the root tree manifest node of the specified
+   * revision.
+   *
+   * Returns folly::none if the repository does not use tree manifests.
+   */
+  folly::Optional<Hash> resolveManifestNode(folly::StringPiece revName);
   /**
    * Send a request to the helper process, asking it to send us the contents
    * of the given file at the specified file revision.
    */
-  void sendFileRequest(RelativePathPiece path, Hash fileRevHash);
+  folly::Future<folly::Unit> sendFileRequest(
+      RelativePathPiece path,
+      Hash fileRevHash,
+      ChunkCallback&& onChunk,
+      uint32_t command = CMD_CAT_FILE);
+  /**
+   * Register a new outstanding request and write it to the helper process.
+   *
+   * The body iovecs are sent after the request header.  The returned Future
+   * completes once the final response chunk has been processed.
+   */
+  folly::Future<folly::Unit> sendRequest(
+      uint32_t command,
+      struct iovec* body,
+      size_t numBodyIovecs,
+      ChunkCallback&& onChunk);
+
+  /**
+   * The main loop for the reader thread.
+   *
+   * This reads response chunks from the helper process and dispatches them to
+   * the matching OutstandingRequest until the helper exits.
+   */
+  void readerLoop();
+  /**
+   * Process a single response chunk on the reader thread.
+   */
+  void dispatchChunk(const ChunkHeader& header, folly::IOBuf&& data);
+  /**
+   * Fail all outstanding requests, and any future requests, with the
+   * specified error.  Called by the reader thread when the helper process
+   * goes away.
+   */
+  void failAllRequests(const folly::exception_wrapper& error);
+  /**
+   * Returns the StoreStats latency histogram for a request command, or
+   * nullptr if there is none.
+   */
+  static StoreStats::HistogramPtr getCommandHistogram(uint32_t command);
 
   folly::Subprocess helper_;
   LocalStore* store_{nullptr};
+
+  /**
+   * writeMutex_ serializes writes to the helper process, and protects
+   * nextRequestID_.
+   */
+  std::mutex writeMutex_;
   uint32_t nextRequestID_{0};
+
+  /**
+   * The requests that have been sent but not fully answered, keyed by
+   * request ID.  Protected by outstandingMutex_.
+   */
+  mutable std::mutex outstandingMutex_;
+  std::unordered_map<uint32_t, OutstandingRequest> outstanding_;
+  /**
+   * Set once the reader thread has seen the helper process exit.  Protected
+   * by outstandingMutex_.
+   */
+  folly::exception_wrapper helperError_;
+  /**
+   * When a response chunk was last received, or when the first of the
+   * current outstanding requests was sent if that was later.  Protected by
+   * outstandingMutex_.
+   */
+  std::chrono::steady_clock::time_point lastProgress_;
+  /**
+   * Why killIfHung() killed the helper process, if it did.  Protected by
+   * outstandingMutex_.
+   */
+  std::string killReason_;
+
+  std::thread readerThread_;
   /**
    * The input and output file descriptors to the helper subprocess.
    * We don't own these FDs, and don't need to close them--they will be closed
@@ -145,6 +431,10 @@ class HgImporter {
    */
   int helperIn_{-1};
   int helperOut_{-1};
+
+  std::atomic<uint64_t> bytesSent_{0};
+  std::atomic<uint64_t> bytesReceived_{0};
+  std::atomic<uint64_t> chunksReceived_{0};
 };
 }
 } // facebook::eden
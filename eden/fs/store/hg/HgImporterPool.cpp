@@ -0,0 +1,309 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "HgImporterPool.h"
+
+#include <glog/logging.h>
+
+#include "HgImporter.h"
+#include "eden/fs/store/StoreStats.h"
+
+using folly::StringPiece;
+using std::make_unique;
+using std::unique_ptr;
+
+namespace facebook {
+namespace eden {
+
+HgImporterPool::Slot::Slot(unique_ptr<HgImporter> imp)
+    : importer(std::move(imp)) {}
+HgImporterPool::Slot::Slot(Slot&&) noexcept = default;
+HgImporterPool::Slot& HgImporterPool::Slot::operator=(Slot&&) noexcept =
+    default;
+HgImporterPool::Slot::~Slot() {}
+
+HgImporterPool::HgImporterPool(
+    StringPiece repoPath,
+    LocalStore* store,
+    size_t maxImporters,
+    size_t maxRequestsPerImporter,
+    std::chrono::milliseconds requestTimeout)
+    : repoPath_(repoPath.str()),
+      store_(store),
+      requestTimeout_(requestTimeout),
+      maxImporters_(std::max<size_t>(maxImporters, 1)),
+      maxRequestsPerImporter_(std::max<size_t>(maxRequestsPerImporter, 1)) {
+  if (requestTimeout_.count() > 0) {
+    watchdogThread_ = std::thread([this] { watchdogLoop(); });
+  }
+}
+
+HgImporterPool::~HgImporterPool() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stopping_ = true;
+  }
+  watchdogCV_.notify_all();
+  if (watchdogThread_.joinable()) {
+    watchdogThread_.join();
+  }
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  for (const auto& slot : slots_) {
+    DCHECK_EQ(slot.stats.inFlight, 0)
+        << "HgImporterPool destroyed while requests are still in flight";
+  }
+}
+
+bool HgImporterPool::isUsableLocked(size_t index) const {
+  const auto& importer = slots_[index].importer;
+  return index < maxImporters_ && importer && importer->isHelperAlive();
+}
+
+size_t HgImporterPool::countUsableLocked() const {
+  size_t count = 0;
+  for (size_t index = 0; index < slots_.size(); ++index) {
+    if (isUsableLocked(index)) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+void HgImporterPool::takeDeadImportersLocked(
+    std::vector<unique_ptr<HgImporter>>& dead) {
+  for (size_t index = 0; index < slots_.size(); ++index) {
+    auto& slot = slots_[index];
+    if (slot.importer && slot.stats.inFlight == 0 &&
+        !slot.importer->isHelperAlive()) {
+      LOG(WARNING) << "hg importer " << index << " for " << repoPath_
+                   << " lost its helper process; it will be replaced";
+      dead.push_back(std::move(slot.importer));
+      // A helper dying is no reason not to try starting another one, even if
+      // starting one failed before.
+      canGrow_ = true;
+    }
+  }
+}
+
+size_t HgImporterPool::pickSlot() const {
+  size_t best = slots_.size();
+  for (size_t index = 0; index < slots_.size(); ++index) {
+    if (!isUsableLocked(index)) {
+      continue;
+    }
+    auto inFlight = slots_[index].stats.inFlight;
+    if (inFlight >= maxRequestsPerImporter_) {
+      continue;
+    }
+    if (best == slots_.size() || inFlight < slots_[best].stats.inFlight) {
+      best = index;
+    }
+  }
+  return best;
+}
+
+HgImporterPool::Lease HgImporterPool::acquire() {
+  // Declared before the lock, so that dead importers are destroyed after it
+  // has been released.
+  std::vector<unique_ptr<HgImporter>> dead;
+  std::unique_lock<std::mutex> lock(mutex_);
+  ++queueDepth_;
+  maxQueueDepth_ = std::max(maxQueueDepth_, queueDepth_);
+
+  size_t index;
+  while (true) {
+    takeDeadImportersLocked(dead);
+    index = pickSlot();
+    bool idle = index < slots_.size() && slots_[index].stats.inFlight == 0;
+    bool canStart =
+        canGrow_ && countUsableLocked() + numStarting_ < maxImporters_;
+    if (idle || (index < slots_.size() && !canStart)) {
+      break;
+    }
+    if (!canStart) {
+      availableCV_.wait(lock);
+      continue;
+    }
+
+    // Every importer is busy, and we are allowed to start another one.
+    // This spawns a new hg_import_helper.py process and waits for it to load
+    // the repository, so we don't hold the lock while doing it.
+    ++numStarting_;
+    lock.unlock();
+    unique_ptr<HgImporter> importer;
+    try {
+      importer = make_unique<HgImporter>(repoPath_, store_, requestTimeout_);
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "error starting additional hg importer for "
+                 << repoPath_ << ": " << ex.what();
+      lock.lock();
+      --numStarting_;
+      if (countUsableLocked() > 0) {
+        // We still have working importers.  Stop trying to grow the pool,
+        // and share the existing importers rather than failing this request.
+        canGrow_ = false;
+        continue;
+      }
+      --queueDepth_;
+      availableCV_.notify_one();
+      throw;
+    }
+    lock.lock();
+    --numStarting_;
+    // Reuse a slot vacated by a dead importer if there is one.
+    index = 0;
+    while (index < slots_.size() &&
+           (slots_[index].importer || index >= maxImporters_)) {
+      ++index;
+    }
+    VLOG(1) << "started hg importer " << index << " for " << repoPath_;
+    if (index < slots_.size()) {
+      slots_[index].importer = std::move(importer);
+      ++numRestarts_;
+      StoreStats::get()->hgHelperRestarts.addValue(1);
+    } else {
+      index = slots_.size();
+      slots_.emplace_back(std::move(importer));
+    }
+    // Other callers may be waiting for an importer to become available,
+    // and the new importer can accept pipelined requests.
+    availableCV_.notify_all();
+    break;
+  }
+
+  --queueDepth_;
+  auto& slot = slots_[index];
+  if (slot.stats.inFlight == 0) {
+    slot.busySince = std::chrono::steady_clock::now();
+  }
+  ++slot.stats.inFlight;
+  ++slot.stats.numRequests;
+  return Lease(this, index, slot.importer.get());
+}
+
+void HgImporterPool::release(size_t index) {
+  // Dead importers are not destroyed here, since a Lease may be released on
+  // the importer's own reader thread, which the destructor joins.  The next
+  // acquire() or the watchdog cleans them up.
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto& slot = slots_[index];
+    DCHECK_GT(slot.stats.inFlight, 0);
+    --slot.stats.inFlight;
+    if (slot.stats.inFlight == 0) {
+      slot.stats.busyTime += std::chrono::steady_clock::now() - slot.busySince;
+    }
+  }
+  availableCV_.notify_one();
+}
+
+void HgImporterPool::watchdogLoop() {
+  // Check often enough that a hung helper is noticed soon after the timeout
+  // expires.
+  auto interval = std::max<std::chrono::steady_clock::duration>(
+      requestTimeout_ / 4, std::chrono::seconds{1});
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_) {
+    watchdogCV_.wait_for(lock, interval);
+    if (stopping_) {
+      break;
+    }
+
+    // Only importers with requests in flight can hang, and they are not
+    // destroyed while we hold the lock.
+    for (const auto& slot : slots_) {
+      if (slot.importer && slot.stats.inFlight > 0 &&
+          slot.importer->killIfHung(requestTimeout_)) {
+        ++numHungHelpers_;
+      }
+    }
+
+    // Clean up dead importers even if no further requests arrive.
+    std::vector<unique_ptr<HgImporter>> dead;
+    takeDeadImportersLocked(dead);
+    if (!dead.empty()) {
+      lock.unlock();
+      dead.clear();
+      availableCV_.notify_all();
+      lock.lock();
+    }
+  }
+}
+
+size_t HgImporterPool::getMaxImporters() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return maxImporters_;
+}
+
+void HgImporterPool::setLimits(
+    size_t maxImporters,
+    size_t maxRequestsPerImporter) {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    maxImporters_ = std::max<size_t>(maxImporters, 1);
+    maxRequestsPerImporter_ = std::max<size_t>(maxRequestsPerImporter, 1);
+  }
+  // Waiting callers may be able to use the new capacity.
+  availableCV_.notify_all();
+}
+
+HgImporterPoolStats HgImporterPool::getStats() const {
+  HgImporterPoolStats stats;
+  auto now = std::chrono::steady_clock::now();
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  stats.maxImporters = maxImporters_;
+  stats.maxRequestsPerImporter = maxRequestsPerImporter_;
+  stats.queueDepth = queueDepth_;
+  stats.maxQueueDepth = maxQueueDepth_;
+  stats.numHungHelpers = numHungHelpers_;
+  stats.numRestarts = numRestarts_;
+  stats.importers.reserve(slots_.size());
+  for (const auto& slot : slots_) {
+    stats.importers.push_back(slot.stats);
+    if (slot.stats.inFlight > 0) {
+      // Include the time spent on the in-progress requests
+      stats.importers.back().busyTime += now - slot.busySince;
+    }
+  }
+  return stats;
+}
+
+HgImporterPool::Lease::Lease(Lease&& other) noexcept
+    : pool_(other.pool_), index_(other.index_), importer_(other.importer_) {
+  other.pool_ = nullptr;
+  other.importer_ = nullptr;
+}
+
+HgImporterPool::Lease& HgImporterPool::Lease::operator=(
+    Lease&& other) noexcept {
+  reset();
+  pool_ = other.pool_;
+  index_ = other.index_;
+  importer_ = other.importer_;
+  other.pool_ = nullptr;
+  other.importer_ = nullptr;
+  return *this;
+}
+
+HgImporterPool::Lease::~Lease() {
+  reset();
+}
+
+void HgImporterPool::Lease::reset() {
+  if (pool_) {
+    pool_->release(index_);
+    pool_ = nullptr;
+    importer_ = nullptr;
+  }
+}
+}
+} // facebook::eden
@@ -0,0 +1,247 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Range.h>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace facebook {
+namespace eden {
+
+class HgImporter;
+class LocalStore;
+
+/**
+ * Statistics about a single HgImporter in an HgImporterPool.
+ */
+struct HgImporterStats {
+  /** The number of requests currently dispatched to this importer */
+  size_t inFlight{0};
+  /** The number of requests dispatched to this importer */
+  uint64_t numRequests{0};
+  /** The total amount of time this importer has had requests in flight */
+  std::chrono::steady_clock::duration busyTime{0};
+};
+
+/**
+ * Statistics about an HgImporterPool as a whole.
+ */
+struct HgImporterPoolStats {
+  /** The maximum number of importers the pool is allowed to start */
+  size_t maxImporters{0};
+  /** The maximum number of requests pipelined to a single importer */
+  size_t maxRequestsPerImporter{0};
+  /** The number of callers currently waiting for an importer */
+  size_t queueDepth{0};
+  /** The largest queueDepth seen since the pool was created */
+  size_t maxQueueDepth{0};
+  /** The number of helper processes killed for not responding */
+  uint64_t numHungHelpers{0};
+  /** The number of importers started to replace ones whose helper died */
+  uint64_t numRestarts{0};
+  /**
+   * Per-importer statistics, in the order the importers were first
+   * started.  A replacement importer keeps the statistics of the one it
+   * replaced.
+   */
+  std::vector<HgImporterStats> importers;
+};
+
+/**
+ * HgImporterPool manages a set of HgImporter objects for a single
+ * repository, and dispatches requests to the least loaded importer.
+ *
+ * Each HgImporter talks to its own hg_import_helper.py subprocess.  The
+ * helper processes requests one at a time, but HgImporter pipelines several
+ * requests over the same pipe so the helper never waits on a round trip.
+ * The pool lets multiple threads import data from the same repository in
+ * parallel.
+ *
+ * Importers are started lazily, up to maxImporters, when a request arrives
+ * and no existing importer is idle.  No importer is started until the first
+ * request, so a repository whose data has all been imported already never
+ * needs to spawn hg_import_helper.py.  Once the limit has been reached requests
+ * are pipelined to the least loaded importer, up to maxRequestsPerImporter
+ * each.  Beyond that callers block until a request completes.
+ *
+ * If a request timeout is given, a watchdog thread kills any helper process
+ * that has outstanding requests but has sent nothing back for that long.
+ * An importer whose helper process has exited, or been killed, receives no
+ * new requests.  Once its in-flight requests have failed it is destroyed,
+ * and a replacement is started the next time one is needed.  Callers are
+ * responsible for retrying the requests that failed with
+ * HgImportHelperError.
+ *
+ * HgImporterPool is thread-safe.
+ */
+class HgImporterPool {
+ public:
+  class Lease;
+
+  /**
+   * Create a new HgImporterPool.
+   *
+   * The caller is responsible for ensuring that the LocalStore object remains
+   * valid for the lifetime of the HgImporterPool object.
+   *
+   * requestTimeout bounds both how long a helper process may take to start,
+   * and how long it may go without responding to outstanding requests.
+   * Zero disables the timeouts.
+   */
+  HgImporterPool(
+      folly::StringPiece repoPath,
+      LocalStore* store,
+      size_t maxImporters,
+      size_t maxRequestsPerImporter,
+      std::chrono::milliseconds requestTimeout);
+  virtual ~HgImporterPool();
+
+  /**
+   * Reserve a request slot on the least loaded HgImporter.
+   *
+   * This blocks until an importer has spare capacity.  Throws if no working
+   * importer is running and a new one cannot be started.  The slot is returned
+   * to the pool when the Lease is destroyed, so callers should keep the Lease
+   * alive until their request has completed.
+   */
+  Lease acquire();
+
+  /**
+   * Get a snapshot of the current pool statistics.
+   */
+  HgImporterPoolStats getStats() const;
+
+  size_t getMaxImporters() const;
+
+  /**
+   * Change the pool limits.
+   *
+   * Raising maxImporters lets the pool start more importers as requests
+   * arrive.  Lowering it does not stop running importers, but no new
+   * requests are sent to the ones beyond the limit, so their helper
+   * processes sit idle.
+   */
+  void setLimits(size_t maxImporters, size_t maxRequestsPerImporter);
+
+ private:
+  struct Slot {
+    explicit Slot(std::unique_ptr<HgImporter> imp);
+    Slot(Slot&&) noexcept;
+    Slot& operator=(Slot&&) noexcept;
+    ~Slot();
+
+    /** Null once a dead importer has been destroyed, until it is replaced */
+    std::unique_ptr<HgImporter> importer;
+    HgImporterStats stats;
+    std::chrono::steady_clock::time_point busySince;
+  };
+
+  // Forbidden copy constructor and assignment operator
+  HgImporterPool(const HgImporterPool&) = delete;
+  HgImporterPool& operator=(const HgImporterPool&) = delete;
+
+  /**
+   * Find the best importer to dispatch a new request to, or return
+   * slots_.size() if all working importers are at capacity.
+   *
+   * mutex_ must be held by the caller.
+   */
+  size_t pickSlot() const;
+  /**
+   * Returns true if the slot at index is within the current limit and has
+   * an importer whose helper process is still running.
+   *
+   * mutex_ must be held by the caller.
+   */
+  bool isUsableLocked(size_t index) const;
+  size_t countUsableLocked() const;
+  /**
+   * Move the importers whose helper process has died, and which have no
+   * requests in flight, into dead, so the caller can destroy them once it
+   * has released mutex_.
+   */
+  void takeDeadImportersLocked(std::vector<std::unique_ptr<HgImporter>>& dead);
+  void release(size_t index);
+  /**
+   * Periodically kill hung helper processes, and clean up after dead ones.
+   */
+  void watchdogLoop();
+
+  const std::string repoPath_;
+  LocalStore* const store_{nullptr};
+  const std::chrono::milliseconds requestTimeout_{0};
+
+  mutable std::mutex mutex_;
+  std::condition_variable availableCV_;
+  std::condition_variable watchdogCV_;
+  // The fields below are protected by mutex_.
+  size_t maxImporters_{1};
+  size_t maxRequestsPerImporter_{1};
+  /** All importers started so far, and slots vacated by dead ones. */
+  std::vector<Slot> slots_;
+  /** Number of importers currently being started outside of mutex_. */
+  size_t numStarting_{0};
+  /** Cleared if starting an additional importer fails. */
+  bool canGrow_{true};
+  size_t queueDepth_{0};
+  size_t maxQueueDepth_{0};
+  uint64_t numHungHelpers_{0};
+  uint64_t numRestarts_{0};
+  bool stopping_{false};
+
+  std::thread watchdogThread_;
+};
+
+/**
+ * A Lease reserves one request slot on an HgImporter from an HgImporterPool.
+ *
+ * The HgImporter may be shared with other Lease holders, since HgImporter
+ * itself is thread-safe.  The slot is returned to the pool when the Lease is
+ * destroyed.
+ */
+class HgImporterPool::Lease {
+ public:
+  Lease(Lease&& other) noexcept;
+  Lease& operator=(Lease&& other) noexcept;
+  ~Lease();
+
+  HgImporter* get() const {
+    return importer_;
+  }
+  HgImporter* operator->() const {
+    return importer_;
+  }
+  HgImporter& operator*() const {
+    return *importer_;
+  }
+
+ private:
+  friend class HgImporterPool;
+
+  Lease(HgImporterPool* pool, size_t index, HgImporter* importer)
+      : pool_(pool), index_(index), importer_(importer) {}
+
+  Lease(const Lease&) = delete;
+  Lease& operator=(const Lease&) = delete;
+
+  void reset();
+
+  HgImporterPool* pool_{nullptr};
+  size_t index_{0};
+  HgImporter* importer_{nullptr};
+};
+}
+} // facebook::eden
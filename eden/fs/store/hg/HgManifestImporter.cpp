@@ -9,10 +9,17 @@
  */
 #include "HgManifestImporter.h"
 
+#include <folly/Conv.h>
+#include <folly/Optional.h>
+#include <folly/futures/Future.h>
 #include <folly/io/Cursor.h>
 #include <folly/io/IOBuf.h>
 #include <rocksdb/db.h>
+#include <map>
+#include <mutex>
+#include <set>
 
+#include "eden/fs/model/NativeTree.h"
 #include "eden/fs/model/Tree.h"
 #include "eden/fs/model/TreeEntry.h"
 #include "eden/fs/model/git/GitTree.h"
@@ -31,6 +38,48 @@ DEFINE_int32(
 namespace facebook {
 namespace eden {
 
+/*
+ * TreeDataArena holds the serialized Trees for a full import until they are
+ * recorded in the store.
+ *
+ * A full import computes every Tree in the repository before recording any
+ * of them, so giving each one its own buffer would mean one allocation per
+ * directory that all stay live for the whole import.  Instead the data is
+ * carved out of large blocks, which are all freed at once in finish().
+ *
+ * Trees may be computed on several threads at once, so allocate() is
+ * synchronized.
+ */
+class HgManifestImporter::TreeDataArena {
+ public:
+  folly::MutableByteRange allocate(size_t size) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (size > kBlockSize / 4) {
+      // Give large Trees a block of their own, rather than wasting the rest
+      // of the current block.
+      blocks_.emplace_back(new uint8_t[size]);
+      return {blocks_.back().get(), size};
+    }
+    if (size > available_) {
+      blocks_.emplace_back(new uint8_t[kBlockSize]);
+      next_ = blocks_.back().get();
+      available_ = kBlockSize;
+    }
+    folly::MutableByteRange result{next_, size};
+    next_ += size;
+    available_ -= size;
+    return result;
+  }
+
+ private:
+  static constexpr size_t kBlockSize = 1024 * 1024;
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<uint8_t[]>> blocks_;
+  uint8_t* next_{nullptr};
+  size_t available_{0};
+};
+
 /*
  * PartialTree records the in-progress data for a Tree object as we are
  * continuing to receive information about paths inside this directory.
@@ -47,8 +96,24 @@ class HgManifestImporter::PartialTree {
     return path_;
   }
 
+  const Hash& getId() const {
+    DCHECK(computed_);
+    return id_;
+  }
+
   void addEntry(TreeEntry&& entry);
 
+  /** Add a subdirectory that is still being computed.
+   * Its entry is added to this tree once its hash is known; see
+   * HgManifestImporter::computeTree(). */
+  void addPendingTree(folly::Future<PartialTree>&& tree) {
+    pendingTrees_.push_back(std::move(tree));
+  }
+
+  std::vector<folly::Future<PartialTree>> extractPendingTrees() {
+    return std::move(pendingTrees_);
+  }
+
   /** move in a computed sub-tree.
    * The tree will be recorded in the store in the second pass of
    * the import, but only if the parent(s) are not stored. */
@@ -62,7 +127,7 @@ class HgManifestImporter::PartialTree {
   /** Compute the serialized version of this tree.
    * Records the id and data ready to be stored by a later call
    * to the record() method. */
-  Hash compute(LocalStore* store);
+  Hash compute(TreeDataArena* arena);
 
  private:
   // The full path from the root of this repository
@@ -73,12 +138,52 @@ class HgManifestImporter::PartialTree {
 
   // Serialized data and id that we may need to store;
   // this is the representation of this PartialTree instance.
+  // The data is owned by the importer's TreeDataArena.
   Hash id_;
-  folly::IOBuf treeData_;
+  folly::ByteRange treeData_;
   bool computed_{false};
 
   // Children that we may need to store
   std::vector<PartialTree> trees_;
+
+  // Children that have not finished computing yet
+  std::vector<folly::Future<PartialTree>> pendingTrees_;
+};
+
+/*
+ * IncrementalState records the changes to apply to the base revision, when
+ * importing a revision relative to one that has already been imported.
+ */
+struct HgManifestImporter::IncrementalState {
+  struct Change {
+    PathComponent name;
+    /** The new entry, or none if the path was removed. */
+    folly::Optional<TreeEntry> entry;
+  };
+
+  explicit IncrementalState(std::unique_ptr<Tree> root)
+      : baseRoot(std::move(root)) {}
+
+  /** Note that path has changes somewhere below it. */
+  void markChanged(RelativePathPiece dirname) {
+    // Walk up to the root, stopping early once we reach a directory that
+    // has already been marked, since its parents must be marked as well.
+    auto dir = dirname.copy();
+    while (!dir.stringPiece().empty()) {
+      auto parent = dir.dirname().copy();
+      if (!changedDirs[parent].insert(dir.basename().copy()).second) {
+        break;
+      }
+      dir = std::move(parent);
+    }
+  }
+
+  std::unique_ptr<Tree> baseRoot;
+  /** Changes to entries directly inside each directory */
+  std::map<RelativePath, std::vector<Change>, std::less<>> changes;
+  /** The subdirectories of each directory that contain changes */
+  std::map<RelativePath, std::set<PathComponent>, std::less<>> changedDirs;
+  size_t numTreesWritten{0};
 };
 
 HgManifestImporter::PartialTree::PartialTree(RelativePathPiece path)
@@ -112,10 +217,19 @@ void HgManifestImporter::PartialTree::addEntry(TreeEntry&& entry) {
   ++numPaths_;
 }
 
-Hash HgManifestImporter::PartialTree::compute(LocalStore* store) {
+Hash HgManifestImporter::PartialTree::compute(TreeDataArena* arena) {
   DCHECK(!computed_) << "Can only compute a PartialTree once";
-  auto tree = Tree(std::move(entries_));
-  std::tie(id_, treeData_) = store->serializeTree(&tree);
+  DCHECK(pendingTrees_.empty()) << "subdirectories must be computed first";
+  // Serialize the entries directly, rather than moving them into a Tree
+  // for LocalStore::serializeTree().  This is equivalent for Trees without
+  // a hash of their own.
+  id_ = computeGitTreeHash(entries_);
+  auto data = arena->allocate(getNativeTreeSize(entries_));
+  serializeNativeTree(entries_, data);
+  treeData_ = data;
+  // The entries are not needed any more, so free them now rather than
+  // holding on to them until the end of the import.
+  entries_ = std::vector<TreeEntry>();
 
   computed_ = true;
   VLOG(6) << "compute tree: '" << path_ << "' --> " << id_.toString() << " ("
@@ -128,7 +242,7 @@ Hash HgManifestImporter::PartialTree::record(LocalStore* store) {
   DCHECK(computed_) << "Must have computed PartialTree prior to recording";
   // If the store already has data on this node, then we don't need to
   // recurse into any of our children; we're done!
-  if (store->hasKey(id_)) {
+  if (store->hasKey(LocalStore::TreeFamily, id_)) {
     return id_;
   }
 
@@ -139,7 +253,7 @@ Hash HgManifestImporter::PartialTree::record(LocalStore* store) {
     it.record(store);
   }
 
-  store->put(id_, treeData_.coalesce());
+  store->put(LocalStore::TreeFamily, id_, treeData_);
 
   VLOG(6) << "record tree: '" << path_ << "' --> " << id_.toString() << " ("
           << numPaths_ << " paths, " << trees_.size() << " trees)";
@@ -147,17 +261,53 @@ Hash HgManifestImporter::PartialTree::record(LocalStore* store) {
   return id_;
 }
 
-HgManifestImporter::HgManifestImporter(LocalStore* store) : store_(store) {
+HgManifestImporter::HgManifestImporter(
+    LocalStore* store,
+    folly::Executor* executor)
+    : store_(store),
+      executor_(executor),
+      arena_(std::make_shared<TreeDataArena>()) {
   // Push the root directory onto the stack
   dirStack_.emplace_back(RelativePath(""));
   store_->enableBatchMode(FLAGS_hgManifestImportBufferSize);
+  batchMode_ = true;
 }
 
-HgManifestImporter::~HgManifestImporter() {}
+HgManifestImporter::HgManifestImporter(
+    LocalStore* store,
+    const Hash& baseRootTree)
+    : store_(store) {
+  auto baseRoot = store_->getTree(baseRootTree);
+  if (!baseRoot) {
+    throw std::domain_error(folly::to<string>(
+        "base tree ", baseRootTree.toString(), " for incremental manifest "
+        "import is not present in the LocalStore"));
+  }
+  incremental_ = std::make_unique<IncrementalState>(std::move(baseRoot));
+  // Incremental imports only write the trees along the changed paths, so
+  // we don't bother with batch mode.
+}
+
+HgManifestImporter::~HgManifestImporter() {
+  // If the import was abandoned before finish() completed, we still have to
+  // leave batch mode, or the store would stay in it for good.
+  if (batchMode_) {
+    batchMode_ = false;
+  store_->disableBatchMode();
+  }
+}
 
 void HgManifestImporter::processEntry(
     RelativePathPiece dirname,
     TreeEntry&& entry) {
+  if (incremental_) {
+    incremental_->markChanged(dirname);
+    auto name = entry.getName().copy();
+    incremental_->changes[dirname.copy()].push_back(
+        IncrementalState::Change{std::move(name), std::move(entry)});
+    return;
+  }
+
   CHECK(!dirStack_.empty());
 
   // mercurial always maintains the manifest in sorted order,
@@ -198,7 +348,29 @@ void HgManifestImporter::processEntry(
   }
 }
 
+void HgManifestImporter::removeEntry(RelativePathPiece path) {
+  CHECK(incremental_) << "removeEntry() requires an incremental import";
+  auto dirname = path.dirname();
+  incremental_->markChanged(dirname);
+  incremental_->changes[dirname.copy()].push_back(
+      IncrementalState::Change{path.basename().copy(), folly::none});
+}
+
 Hash HgManifestImporter::finish() {
+  if (incremental_) {
+    auto rootHash =
+        rewriteTree(RelativePathPiece(), incremental_->baseRoot.get());
+    if (rootHash == Hash()) {
+      // Every file was removed.  The root directory must still exist.
+      auto emptyTree = Tree(std::vector<TreeEntry>());
+      rootHash = store_->putTree(&emptyTree);
+    }
+    VLOG(5) << "incremental import wrote " << incremental_->numTreesWritten
+            << " trees";
+    incremental_.reset();
+    return rootHash;
+  }
+
   CHECK(!dirStack_.empty());
 
   // The last entry may have been in a deep subdirectory.
@@ -208,30 +380,141 @@ Hash HgManifestImporter::finish() {
     popCurrentDir();
   }
 
-  auto rootHash = dirStack_.back().compute(store_);
-  dirStack_.back().record(store_);
+  auto root = computeTree(std::move(dirStack_.back())).get();
   dirStack_.pop_back();
   CHECK(dirStack_.empty());
+  // Every Tree has been computed once the root has, so record them all on
+  // this thread.  record() skips the subtrees of any Tree that is already
+  // in the store, which only works from the top down.
+  auto rootHash = root.record(store_);
+  arena_.reset();
 
   store_->disableBatchMode();
 
   return rootHash;
 }
 
-void HgManifestImporter::popCurrentDir() {
-  PathComponent entryName = dirStack_.back().getPath().basename().copy();
+Hash HgManifestImporter::rewriteTree(
+    RelativePathPiece path,
+    const Tree* base) {
+  std::vector<TreeEntry> entries;
+  if (base) {
+    entries = base->getTreeEntries();
+  }
+  auto findEntry = [&entries](PathComponentPiece name) {
+    return std::lower_bound(
+        entries.begin(),
+        entries.end(),
+        name,
+        [](const TreeEntry& entry, PathComponentPiece piece) {
+          return entry.getName() < piece;
+        });
+  };
+
+  // Apply the changes to files directly inside this directory first.
+  // A file may have been replaced by a directory, in which case the file
+  // removal must be applied before we process the new subdirectory below.
+  auto changesIter = incremental_->changes.find(path);
+  if (changesIter != incremental_->changes.end()) {
+    for (auto& change : changesIter->second) {
+      auto iter = findEntry(change.name);
+      bool exists = iter != entries.end() && iter->getName() == change.name;
+      if (!change.entry.hasValue()) {
+        if (exists) {
+          entries.erase(iter);
+        }
+      } else if (exists) {
+        *iter = std::move(change.entry.value());
+      } else {
+        entries.insert(iter, std::move(change.entry.value()));
+      }
+    }
+  }
+
+  // Recurse into the subdirectories that contain changes.
+  auto dirsIter = incremental_->changedDirs.find(path);
+  if (dirsIter != incremental_->changedDirs.end()) {
+    for (const auto& name : dirsIter->second) {
+      auto iter = findEntry(name);
+      bool exists = iter != entries.end() && iter->getName() == name;
+
+      std::unique_ptr<Tree> childBase;
+      if (exists && iter->getType() == TreeEntryType::TREE) {
+        childBase = store_->getTree(iter->getHash());
+        if (!childBase) {
+          throw std::domain_error(folly::to<string>(
+              "tree ", iter->getHash().toString(), " for '", path + name,
+              "' is not present in the LocalStore"));
+        }
+      }
+
+      auto childHash = rewriteTree(path + name, childBase.get());
+      if (childHash == Hash()) {
+        if (exists) {
+          entries.erase(iter);
+        }
+        continue;
+      }
+
+      uint8_t ownerPermissions = 0111;
+      TreeEntry dirEntry(
+          childHash, name.stringPiece(), FileType::DIRECTORY, ownerPermissions);
+      if (exists) {
+        *iter = std::move(dirEntry);
+      } else {
+        entries.insert(iter, std::move(dirEntry));
+      }
+    }
+  }
+
+  if (entries.empty()) {
+    return Hash();
+  }
+
+  auto tree = Tree(std::move(entries));
+  Hash id;
+  IOBuf treeData;
+  std::tie(id, treeData) = store_->serializeTree(&tree);
+  if (!store_->hasKey(LocalStore::TreeFamily, id)) {
+    store_->put(LocalStore::TreeFamily, id, treeData.coalesce());
+    ++incremental_->numTreesWritten;
+  }
+  VLOG(6) << "rewrite tree: '" << path << "' --> " << id.toString();
+  return id;
+}
 
+void HgManifestImporter::popCurrentDir() {
   PartialTree back = std::move(dirStack_.back());
   dirStack_.pop_back();
   DCHECK(!dirStack_.empty());
 
-  auto dirHash = back.compute(store_);
+  dirStack_.back().addPendingTree(computeTree(std::move(back)));
+}
 
-  uint8_t ownerPermissions = 0111;
-  TreeEntry dirEntry(
-      dirHash, entryName.stringPiece(), FileType::DIRECTORY, ownerPermissions);
-  dirStack_.back().addEntry(std::move(dirEntry));
-  dirStack_.back().addPartialTree(std::move(back));
+folly::Future<HgManifestImporter::PartialTree> HgManifestImporter::computeTree(
+    PartialTree&& tree) {
+  // A Tree can only be serialized once the hashes of all of its
+  // subdirectories are known.  Sibling directories don't depend on each
+  // other, though, so with an executor they are computed in parallel while
+  // we carry on processing the manifest.
+  auto children = folly::collect(tree.extractPendingTrees());
+  if (executor_) {
+    children = std::move(children).via(executor_);
+  }
+  return children.then([ tree = std::move(tree), arena = arena_ ](
+      std::vector<PartialTree> && subtrees) mutable {
+    for (auto& subtree : subtrees) {
+      uint8_t ownerPermissions = 0111;
+      tree.addEntry(TreeEntry(
+          subtree.getId(),
+          subtree.getPath().basename().copy(),
+          FileType::DIRECTORY,
+          ownerPermissions));
+      tree.addPartialTree(std::move(subtree));
+    }
+    tree.compute(arena.get());
+    return std::move(tree);
+  });
 }
 }
 } // facebook::eden
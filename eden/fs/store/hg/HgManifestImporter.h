@@ -9,15 +9,23 @@
  */
 #pragma once
 
+#include <memory>
 #include <vector>
 
 #include "eden/utils/PathFuncs.h"
 
+namespace folly {
+class Executor;
+template <typename T>
+class Future;
+}
+
 namespace facebook {
 namespace eden {
 
 class Hash;
 class LocalStore;
+class Tree;
 class TreeEntry;
 
 /*
@@ -26,7 +34,32 @@ class TreeEntry;
  */
 class HgManifestImporter {
  public:
-  explicit HgManifestImporter(LocalStore* store);
+  /**
+   * Create an HgManifestImporter for a full manifest import.
+   *
+   * If executor is non-null, each directory is serialized and hashed on it
+   * once all of its entries have been processed, in parallel with the rest
+   * of the import.  Otherwise this is done in the thread calling
+   * processEntry().  finish() blocks until every directory has been
+   * computed, so the executor must be able to make progress without the
+   * thread that calls finish().
+   */
+  explicit HgManifestImporter(
+      LocalStore* store,
+      folly::Executor* executor = nullptr);
+  /**
+   * Create an HgManifestImporter that builds a revision by applying changes
+   * to an already imported root Tree, rather than from the full manifest.
+   *
+   * In this mode processEntry() should be called for each path that was
+   * added or modified relative to the base revision, and removeEntry() for
+   * each path that was removed, in any order.  finish() then rewrites only
+   * the Trees along the changed paths, and reuses every other Tree from the
+   * base revision.
+   *
+   * Throws std::domain_error if the base Tree is not present in the store.
+   */
+  HgManifestImporter(LocalStore* store, const Hash& baseRootTree);
   virtual ~HgManifestImporter();
 
   /**
@@ -37,6 +70,14 @@ class HgManifestImporter {
    */
   void processEntry(RelativePathPiece dirname, TreeEntry&& entry);
 
+  /**
+   * removeEntry() records that a file was removed relative to the base
+   * revision.
+   *
+   * This may only be used with the incremental constructor.
+   */
+  void removeEntry(RelativePathPiece path);
+
   /**
    * finish() should be called once processEntry() has been called for
    * all entries in the manifest.
@@ -47,15 +88,42 @@ class HgManifestImporter {
 
  private:
   class PartialTree;
+  class TreeDataArena;
+  struct IncrementalState;
 
   // Forbidden copy constructor and assignment operator
   HgManifestImporter(const HgManifestImporter&) = delete;
   HgManifestImporter& operator=(const HgManifestImporter&) = delete;
 
   void popCurrentDir();
+  /**
+   * Serialize and hash a directory once all of its subdirectories have
+   * been computed.
+   */
+  folly::Future<PartialTree> computeTree(PartialTree&& tree);
+  /**
+   * Build the new version of the Tree at the given path from its version in
+   * the base revision (which may be null if the directory is new), and save
+   * it in the store.
+   *
+   * Returns a zero hash if the resulting directory is empty and should be
+   * removed.
+   */
+  Hash rewriteTree(RelativePathPiece path, const Tree* base);
 
   LocalStore* store_{nullptr};
+  folly::Executor* executor_{nullptr};
   std::vector<PartialTree> dirStack_;
+  /**
+   * Holds the serialized Trees of a full import until finish().  This is
+   * shared with the callbacks computing the Trees, which may outlive us if
+   * the import is abandoned.
+   */
+  std::shared_ptr<TreeDataArena> arena_;
+  /** Whether we have enabled batch mode in the store and not disabled it */
+  bool batchMode_{false};
+  /** Only set when applying changes to a base revision. */
+  std::unique_ptr<IncrementalState> incremental_;
 };
 }
 } // facebook::eden
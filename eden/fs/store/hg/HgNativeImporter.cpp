@@ -0,0 +1,379 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "HgNativeImporter.h"
+
+#include <folly/Conv.h>
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <wangle/concurrent/CPUThreadPoolExecutor.h>
+#include <cstring>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+#include "HgManifestImporter.h"
+#include "HgProxyHash.h"
+#include "HgRevlog.h"
+#include "eden/fs/model/Hash.h"
+#include "eden/fs/model/TreeEntry.h"
+#include "eden/fs/store/BlobMetadata.h"
+
+using folly::ByteRange;
+using folly::IOBuf;
+using folly::StringPiece;
+using std::string;
+
+DEFINE_bool(
+    hgImportFileSizes,
+    true,
+    "Record file sizes from the filelog indexes in the trees imported from "
+    "flat manifests, so that stat() does not need to fetch file contents");
+DECLARE_int32(hgManifestImportThreads);
+
+namespace facebook {
+namespace eden {
+
+namespace {
+/**
+ * The longest path that mercurial stores without hashing it, when the
+ * repository has the "fncache" requirement.
+ */
+constexpr size_t kMaxStorePathLength = 120;
+
+void appendEscaped(string* result, char c) {
+  folly::stringAppendf(result, "~%02x", static_cast<unsigned char>(c));
+}
+
+/**
+ * Mercurial appends ".hg" to directory names that end in ".hg", ".i" or
+ * ".d", so that they can't collide with revlog files.
+ */
+string encodeDirs(StringPiece path) {
+  string result = path.str();
+  for (auto suffix : {".hg/", ".i/", ".d/"}) {
+    StringPiece from{suffix};
+    auto to = folly::to<string>(from.subpiece(0, from.size() - 1), ".hg/");
+    size_t pos = 0;
+    while ((pos = result.find(from.data(), pos, from.size())) != string::npos) {
+      result.replace(pos, from.size(), to);
+      pos += to.size();
+    }
+  }
+  return result;
+}
+
+/**
+ * Escape characters that are not safe on case-insensitive or Windows
+ * filesystems.
+ */
+string encodeFilename(StringPiece path) {
+  string result;
+  result.reserve(path.size());
+  for (char c : path) {
+    auto u = static_cast<unsigned char>(c);
+    if (c == '_') {
+      result.append("__");
+    } else if (c >= 'A' && c <= 'Z') {
+      result.push_back('_');
+      result.push_back(c - 'A' + 'a');
+    } else if (u < 32 || u >= 127 || strchr("\\:*?\"<>|", c) != nullptr) {
+      appendEscaped(&result, c);
+    } else {
+      result.push_back(c);
+    }
+  }
+  return result;
+}
+
+/**
+ * Escape path components that Windows reserves, and, with dotencode,
+ * leading periods and spaces.
+ */
+string encodeComponent(StringPiece component, bool dotencode) {
+  string result;
+  if (component.empty()) {
+    return result;
+  }
+
+  if (dotencode && (component[0] == '.' || component[0] == ' ')) {
+    appendEscaped(&result, component[0]);
+    result.append(component.begin() + 1, component.end());
+  } else {
+    auto dot = component.find('.');
+    auto stem = component.subpiece(0, dot);
+    auto isReserved3 = stem.size() == 3 &&
+        (stem == "aux" || stem == "con" || stem == "prn" || stem == "nul");
+    auto isReserved4 = stem.size() == 4 && stem[3] >= '1' && stem[3] <= '9' &&
+        (stem.startsWith("com") || stem.startsWith("lpt"));
+    if (isReserved3 || isReserved4) {
+      // Encode the third letter, so "aux" becomes "au~78"
+      result.append(component.begin(), component.begin() + 2);
+      appendEscaped(&result, component[2]);
+      result.append(component.begin() + 3, component.end());
+    } else {
+      result = component.str();
+    }
+  }
+
+  if (result.back() == '.' || result.back() == ' ') {
+    auto last = result.back();
+    result.pop_back();
+    appendEscaped(&result, last);
+  }
+  return result;
+}
+
+/**
+ * Convert a mercurial manifest flag into the eden file type and owner
+ * permissions.
+ */
+void parseManifestFlags(
+    StringPiece flags,
+    StringPiece path,
+    FileType* fileType,
+    uint8_t* ownerPermissions) {
+  if (flags.empty()) {
+    *fileType = FileType::REGULAR_FILE;
+    *ownerPermissions = 0b110;
+  } else if (flags == "x") {
+    *fileType = FileType::REGULAR_FILE;
+    *ownerPermissions = 0b111;
+  } else if (flags == "l") {
+    *fileType = FileType::SYMLINK;
+    *ownerPermissions = 0b111;
+  } else {
+    throw std::domain_error(folly::to<string>(
+        "unsupported manifest flags for ", path, ": ", flags));
+  }
+}
+}
+
+string encodeHgStorePath(StringPiece path, bool fncache, bool dotencode) {
+  auto encoded = encodeFilename(encodeDirs(path));
+  if (!fncache) {
+    return encoded;
+  }
+
+  std::vector<StringPiece> components;
+  folly::split('/', encoded, components);
+  string result;
+  for (const auto& component : components) {
+    if (!result.empty()) {
+      result.push_back('/');
+    }
+    result.append(encodeComponent(component, dotencode));
+  }
+  if (result.size() > kMaxStorePathLength) {
+    throw std::domain_error(folly::to<string>(
+        "mercurial uses a hashed store path for ", path));
+  }
+  return result;
+}
+
+std::unique_ptr<HgNativeImporter> HgNativeImporter::create(
+    AbsolutePathPiece repoPath,
+    LocalStore* store) {
+  auto hgDir = repoPath + PathComponentPiece{".hg"};
+  string requiresData;
+  if (!folly::readFile((hgDir + PathComponentPiece{"requires"}).c_str(),
+                       requiresData)) {
+    LOG(WARNING) << "unable to read the requirements of mercurial repository "
+                 << repoPath << "; not reading revlogs directly";
+    return nullptr;
+  }
+
+  static const std::set<StringPiece> kSupported = {
+      "dotencode", "fncache", "generaldelta", "revlogv1", "shared", "store"};
+  std::vector<StringPiece> lines;
+  folly::split('\n', requiresData, lines);
+  std::set<StringPiece> requirements;
+  for (auto line : lines) {
+    line = folly::trimWhitespace(line);
+    if (line.empty()) {
+      continue;
+    }
+    if (kSupported.find(line) == kSupported.end()) {
+      LOG(INFO) << "mercurial repository " << repoPath << " requires "
+                << line << "; not reading revlogs directly";
+      return nullptr;
+    }
+    requirements.insert(line);
+  }
+  if (requirements.count("revlogv1") == 0 || requirements.count("store") == 0) {
+    LOG(INFO) << "mercurial repository " << repoPath
+              << " uses an old store format; not reading revlogs directly";
+    return nullptr;
+  }
+
+  auto storeDir = hgDir + PathComponentPiece{"store"};
+  if (requirements.count("shared")) {
+    // The store lives in the .hg directory of the repository we share with.
+    string sharedPath;
+    if (!folly::readFile((hgDir + PathComponentPiece{"sharedpath"}).c_str(),
+                         sharedPath)) {
+      LOG(WARNING) << "unable to read the shared path of mercurial "
+                   << "repository " << repoPath;
+      return nullptr;
+    }
+    storeDir = AbsolutePathPiece{folly::trimWhitespace(sharedPath)} +
+        PathComponentPiece{"store"};
+  }
+
+  return std::unique_ptr<HgNativeImporter>(new HgNativeImporter(
+      std::move(storeDir),
+      requirements.count("fncache") != 0,
+      requirements.count("dotencode") != 0,
+      store));
+}
+
+HgNativeImporter::HgNativeImporter(
+    AbsolutePath storePath,
+    bool fncache,
+    bool dotencode,
+    LocalStore* store)
+    : storePath_(std::move(storePath)),
+      fncache_(fncache),
+      dotencode_(dotencode),
+      store_(store) {}
+
+AbsolutePath HgNativeImporter::getFilelogPath(RelativePathPiece path) const {
+  auto encoded = encodeHgStorePath(
+      folly::to<string>("data/", path, ".i"), fncache_, dotencode_);
+  return storePath_ + RelativePathPiece{encoded};
+}
+
+folly::Optional<uint64_t> HgNativeImporter::getFileSize(
+    RelativePathPiece path,
+    const Hash& revHash) const {
+  try {
+    HgRevlog filelog(getFilelogPath(path));
+    auto rev = filelog.findNode(revHash);
+    if (!rev.hasValue()) {
+      return folly::none;
+    }
+    return filelog.getFileSize(rev.value());
+  } catch (const std::exception& ex) {
+    // The size is only an optimization.  Without it the size is read from
+    // the blob metadata when it is first needed.
+    VLOG(5) << "unable to read the size of " << path << " from its filelog: "
+            << folly::exceptionStr(ex);
+    return folly::none;
+  }
+}
+
+string HgNativeImporter::readFileText(
+    const Hash& blobHash,
+    size_t* contentsOffset) {
+  HgProxyHash hgInfo(store_, blobHash);
+  VLOG(5) << "reading file contents of '" << hgInfo.path() << "', "
+          << hgInfo.revHash().toString() << " from its filelog";
+
+  HgRevlog filelog(getFilelogPath(hgInfo.path()));
+  auto text = filelog.getText(hgInfo.revHash());
+
+  // Revisions with copy information start with a metadata block, which is
+  // delimited by "\1\n" at both ends.
+  *contentsOffset = 0;
+  StringPiece textPiece{text};
+  if (textPiece.startsWith("\1\n")) {
+    auto end = textPiece.find("\1\n", 2);
+    if (end == StringPiece::npos) {
+      throw std::runtime_error(folly::to<string>(
+          "unterminated metadata in revision ",
+          hgInfo.revHash().toString(),
+          " of ",
+          hgInfo.path()));
+    }
+    *contentsOffset = end + 2;
+  }
+  return text;
+}
+
+IOBuf HgNativeImporter::importFileContents(const Hash& blobHash) {
+  size_t offset;
+  auto text = readFileText(blobHash, &offset);
+  return IOBuf(IOBuf::COPY_BUFFER, text.data() + offset, text.size() - offset);
+}
+
+BlobMetadata HgNativeImporter::getFileMetadata(const Hash& blobHash) {
+  size_t offset;
+  auto text = readFileText(blobHash, &offset);
+  auto contents = StringPiece{text}.subpiece(offset);
+  return BlobMetadata{Hash::sha1(ByteRange{contents}), contents.size()};
+}
+
+Hash HgNativeImporter::importManifest(const Hash& commitID) {
+  // The first line of a changeset is the hex node of its manifest.
+  HgRevlog changelog(storePath_ + PathComponentPiece{"00changelog.i"});
+  auto changeset = changelog.getText(commitID);
+  StringPiece changesetText{changeset};
+  if (changesetText.find('\n') != Hash::HEX_SIZE) {
+    throw std::runtime_error(folly::to<string>(
+        "changeset ", commitID.toString(), " has a malformed manifest node"));
+  }
+  Hash manifestNode{changesetText.subpiece(0, Hash::HEX_SIZE)};
+
+  HgRevlog manifestlog(storePath_ + PathComponentPiece{"00manifest.i"});
+  auto manifest = manifestlog.getText(manifestNode);
+
+  // Use a pool of our own, as HgImporter::importManifest() does.
+  std::unique_ptr<wangle::CPUThreadPoolExecutor> pool;
+  if (FLAGS_hgManifestImportThreads > 0) {
+    pool = std::make_unique<wangle::CPUThreadPoolExecutor>(
+        FLAGS_hgManifestImportThreads);
+  }
+  HgManifestImporter importer(store_, pool.get());
+
+  // Each manifest line is <path>\0<hex file node><flags>\n, sorted by path.
+  StringPiece remaining{manifest};
+  size_t numPaths = 0;
+  while (!remaining.empty()) {
+    auto nul = remaining.find('\0');
+    auto newline = remaining.find('\n');
+    if (nul == StringPiece::npos || newline == StringPiece::npos ||
+        newline < nul + 1 + Hash::HEX_SIZE) {
+      throw std::runtime_error(folly::to<string>(
+          "malformed entry in manifest ", manifestNode.toString()));
+    }
+    auto pathStr = remaining.subpiece(0, nul);
+    Hash fileRevHash{remaining.subpiece(nul + 1, Hash::HEX_SIZE)};
+    auto flags = remaining.subpiece(
+        nul + 1 + Hash::HEX_SIZE, newline - nul - 1 - Hash::HEX_SIZE);
+    remaining.advance(newline + 1);
+
+    FileType fileType;
+    uint8_t ownerPermissions;
+    parseManifestFlags(flags, pathStr, &fileType, &ownerPermissions);
+
+    RelativePathPiece path(pathStr);
+    auto blobHash = HgProxyHash::store(store_, path, fileRevHash);
+    folly::Optional<uint64_t> size;
+    if (FLAGS_hgImportFileSizes) {
+      size = getFileSize(path, fileRevHash);
+    }
+    importer.processEntry(
+        path.dirname(),
+        TreeEntry(
+            blobHash,
+            path.basename().value(),
+            fileType,
+            ownerPermissions,
+            size));
+    ++numPaths;
+  }
+
+  auto rootHash = importer.finish();
+  VLOG(1) << "read " << numPaths << " manifest paths from revlogs";
+  return rootHash;
+}
+}
+} // facebook::eden
@@ -0,0 +1,114 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Optional.h>
+#include <folly/Range.h>
+#include <folly/io/IOBuf.h>
+#include <memory>
+#include <string>
+#include "eden/utils/PathFuncs.h"
+
+namespace facebook {
+namespace eden {
+
+class BlobMetadata;
+class Hash;
+class LocalStore;
+
+/**
+ * HgNativeImporter reads file contents and flat manifests straight from the
+ * revlogs of a local mercurial repository, without hg_import_helper.py.
+ *
+ * This avoids the cost of the python helper for the most common requests,
+ * but only understands plain revlog based repositories.  Callers should use
+ * HgImporter as a fallback whenever a method here throws, since that may
+ * just mean the data is stored in a way that only mercurial itself knows how
+ * to read (for instance with remotefilelog or lfs, or a file whose store
+ * path is hashed because it is too long).
+ */
+class HgNativeImporter {
+ public:
+  /**
+   * Create an HgNativeImporter for the repository at repoPath.
+   *
+   * Returns null if the repository uses any features that this does not
+   * support, according to its .hg/requires file.
+   */
+  static std::unique_ptr<HgNativeImporter> create(
+      AbsolutePathPiece repoPath,
+      LocalStore* store);
+
+  /**
+   * Read the contents of a file, identified by its eden blob hash (as
+   * created by HgProxyHash).
+   */
+  folly::IOBuf importFileContents(const Hash& blobHash);
+
+  /**
+   * Compute the size and SHA-1 of a file's contents, without copying them
+   * out of the revlog's buffers.
+   */
+  BlobMetadata getFileMetadata(const Hash& blobHash);
+
+  /**
+   * Import the flat manifest of a commit into the LocalStore, like
+   * HgImporter::importManifest().
+   *
+   * Returns a Hash identifying the root Tree for the commit.
+   */
+  Hash importManifest(const Hash& commitID);
+
+ private:
+  HgNativeImporter(
+      AbsolutePath storePath,
+      bool fncache,
+      bool dotencode,
+      LocalStore* store);
+
+  HgNativeImporter(const HgNativeImporter&) = delete;
+  HgNativeImporter& operator=(const HgNativeImporter&) = delete;
+
+  AbsolutePath getFilelogPath(RelativePathPiece path) const;
+
+  /**
+   * Read the full text of a file revision from its filelog.  The file
+   * contents start at contentsOffset, after any copy metadata.
+   */
+  std::string readFileText(const Hash& blobHash, size_t* contentsOffset);
+
+  /**
+   * Get the size of a file revision from its filelog index, or folly::none
+   * if it cannot be determined that way.
+   */
+  folly::Optional<uint64_t> getFileSize(
+      RelativePathPiece path,
+      const Hash& revHash) const;
+
+  AbsolutePath storePath_;
+  bool fncache_{false};
+  bool dotencode_{false};
+  LocalStore* store_{nullptr};
+};
+
+/**
+ * Encode the path of a file in a mercurial store, such as "data/foo.i", the
+ * way mercurial does for repositories with the "store" requirement.  The
+ * "fncache" and "dotencode" requirements enable further encoding.
+ *
+ * Throws std::domain_error if the encoded path is too long, in which case
+ * mercurial stores the file under a hashed name that this does not compute.
+ */
+std::string encodeHgStorePath(
+    folly::StringPiece path,
+    bool fncache,
+    bool dotencode);
+}
+} // facebook::eden
@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "HgProxyHash.h"
+
+#include <folly/Bits.h>
+#include <folly/Conv.h>
+#include <folly/io/Cursor.h>
+#include <glog/logging.h>
+#include <cstring>
+#include <stdexcept>
+
+#include "eden/fs/store/LocalStore.h"
+#include "eden/fs/store/StoreResult.h"
+
+using folly::ByteRange;
+using folly::Endian;
+using folly::io::Appender;
+using folly::IOBuf;
+using folly::StringPiece;
+using std::string;
+
+namespace facebook {
+namespace eden {
+
+HgProxyHash::HgProxyHash(LocalStore* store, Hash edenBlobHash) {
+  // Read the path name and file rev hash
+  auto infoResult = store->get(LocalStore::HgProxyHashFamily, edenBlobHash);
+  if (!infoResult.isValid()) {
+    LOG(ERROR) << "received unknown mercurial proxy hash "
+               << edenBlobHash.toString();
+    // Fall through and let infoResult.extractValue() throw
+  }
+
+  value_ = infoResult.extractValue();
+  parseValue(edenBlobHash);
+}
+
+Hash HgProxyHash::store(
+    LocalStore* store,
+    RelativePathPiece path,
+    Hash hgRevHash) {
+  // Serialize the (path, hgRevHash) tuple into a buffer.
+  auto buf = serialize(path, hgRevHash);
+
+  // Compute the hash of the serialized buffer
+  ByteRange serializedInfo = buf.coalesce();
+  auto edenBlobHash = Hash::sha1(serializedInfo);
+
+  // Save the data in the store
+  store->put(LocalStore::HgProxyHashFamily, edenBlobHash, serializedInfo);
+  return edenBlobHash;
+}
+
+IOBuf HgProxyHash::serialize(RelativePathPiece path, Hash hgRevHash) {
+  // We serialize the data as <hash_bytes><path_length><path>
+  //
+  // The path_length is stored as a big-endian uint32_t.
+  auto pathStr = path.stringPiece();
+  IOBuf buf(IOBuf::CREATE, Hash::RAW_SIZE + sizeof(uint32_t) + pathStr.size());
+  Appender appender(&buf, 0);
+  appender.push(hgRevHash.getBytes());
+  appender.writeBE<uint32_t>(pathStr.size());
+  appender.push(pathStr);
+
+  return buf;
+}
+
+void HgProxyHash::parseValue(Hash edenBlobHash) {
+  ByteRange infoBytes = StringPiece(value_);
+  // Make sure the data is long enough to contain the rev hash and path length
+  if (infoBytes.size() < Hash::RAW_SIZE + sizeof(uint32_t)) {
+    auto msg = folly::to<string>(
+        "mercurial proxy hash data for ",
+        edenBlobHash.toString(),
+        " is too short (",
+        infoBytes.size(),
+        " bytes)");
+    LOG(ERROR) << msg;
+    throw std::length_error(msg);
+  }
+
+  // Extract the revHash_
+  revHash_ = Hash(infoBytes.subpiece(0, Hash::RAW_SIZE));
+  infoBytes.advance(Hash::RAW_SIZE);
+
+  // Extract the path length
+  uint32_t pathLength;
+  memcpy(&pathLength, infoBytes.data(), sizeof(uint32_t));
+  pathLength = Endian::big(pathLength);
+  infoBytes.advance(sizeof(uint32_t));
+  // Make sure the path length agrees with the length of data remaining
+  if (infoBytes.size() != pathLength) {
+    auto msg = folly::to<string>(
+        "mercurial proxy hash data for ",
+        edenBlobHash.toString(),
+        " has inconsistent path length");
+    LOG(ERROR) << msg;
+    throw std::length_error(msg);
+  }
+
+  // Extract the path_
+  path_ = RelativePathPiece(StringPiece(infoBytes));
+}
+}
+} // facebook::eden
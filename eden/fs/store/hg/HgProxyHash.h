@@ -0,0 +1,105 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/io/IOBuf.h>
+#include <string>
+#include "eden/fs/model/Hash.h"
+#include "eden/utils/PathFuncs.h"
+
+namespace facebook {
+namespace eden {
+
+class LocalStore;
+
+/**
+ * HgProxyHash manages mercurial (path, revHash) data in the LocalStore.
+ *
+ * Mercurial doesn't really have a blob hash the same way eden and git do.
+ * Instead, mercurial file revision hashes are always relative to a specific
+ * path.  Tree manifest nodes are similarly relative to a directory path.  To
+ * use the data in eden, we need to create a blob or tree hash that we can use
+ * instead.
+ *
+ * To do so, we hash the (path, revHash) tuple, and use this hash as the blob
+ * or tree hash in eden.  We store the eden_hash --> (path, hgRevHash) mapping
+ * in the LocalStore.  The HgProxyHash class helps store and retrieve these
+ * mappings.
+ */
+class HgProxyHash {
+ public:
+  /**
+   * Load HgProxyHash data for the given eden blob or tree hash from the
+   * LocalStore.
+   */
+  HgProxyHash(LocalStore* store, Hash edenBlobHash);
+
+  ~HgProxyHash() {}
+
+  const RelativePathPiece& path() const {
+    return path_;
+  }
+
+  const Hash& revHash() const {
+    return revHash_;
+  }
+
+  /**
+   * Store HgProxyHash data in the LocalStore.
+   *
+   * Returns an eden hash that can be used to retrieve the data later
+   * (using the HgProxyHash constructor defined above).
+   */
+  static Hash store(LocalStore* store, RelativePathPiece path, Hash hgRevHash);
+
+ private:
+  // Not movable or copyable.
+  // path_ points into value_, and would need to be updated after
+  // copying/moving the data.  Since no-one needs to copy or move HgProxyHash
+  // objects, we don't implement this for now.
+  HgProxyHash(const HgProxyHash&) = delete;
+  HgProxyHash& operator=(const HgProxyHash&) = delete;
+  HgProxyHash(HgProxyHash&&) = delete;
+  HgProxyHash& operator=(HgProxyHash&&) = delete;
+
+  /**
+   * Serialize the (path, hgRevHash) data into a buffer that will be stored in
+   * the LocalStore.
+   */
+  static folly::IOBuf serialize(RelativePathPiece path, Hash hgRevHash);
+
+  /**
+   * Parse the serialized data found in value_, and set revHash_ and path_.
+   *
+   * The value_ member variable should already contain the serialized data,
+   * (as returned by serialize()).
+   *
+   * Note that path_ will be set to a RelativePathPiece pointing into the
+   * string data owned by value_.  (This lets us avoid copying the string data
+   * out.)
+   */
+  void parseValue(Hash edenBlobHash);
+
+  /**
+   * The serialized data.
+   */
+  std::string value_;
+  /**
+   * The revision hash.
+   */
+  Hash revHash_;
+  /**
+   * The path name.  Note that this points into the serialized value_ data.
+   * path_ itself does not own the data it points to.
+   */
+  RelativePathPiece path_;
+};
+}
+} // facebook::eden
@@ -0,0 +1,363 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "HgRevlog.h"
+
+#include <folly/Bits.h>
+#include <folly/Conv.h>
+#include <folly/Exception.h>
+#include <folly/File.h>
+#include <folly/io/Compression.h>
+#include <folly/io/IOBuf.h>
+#include <glog/logging.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+using folly::ByteRange;
+using folly::IOBuf;
+using folly::StringPiece;
+using std::string;
+
+namespace facebook {
+namespace eden {
+
+namespace {
+constexpr size_t kIndexEntrySize = 64;
+constexpr uint32_t kRevlogVersionMask = 0xffff;
+constexpr uint32_t kRevlogV1 = 1;
+constexpr uint32_t kFlagInlineData = 1 << 16;
+constexpr uint32_t kFlagGeneralDelta = 1 << 17;
+constexpr size_t kDeltaHunkHeaderSize = 12;
+
+// Offsets of the fields within an index entry
+constexpr size_t kOffsetFlagsOffset = 0;
+constexpr size_t kCompressedLengthOffset = 8;
+constexpr size_t kLengthOffset = 12;
+constexpr size_t kBaseRevOffset = 16;
+constexpr size_t kParent1Offset = 24;
+constexpr size_t kParent2Offset = 28;
+constexpr size_t kNodeOffset = 32;
+
+uint32_t loadBE32(const uint8_t* p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return folly::Endian::big(value);
+}
+
+uint64_t loadBE64(const uint8_t* p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return folly::Endian::big(value);
+}
+
+string uncompressWith(folly::io::CodecType type, ByteRange data) {
+  auto codec = folly::io::getCodec(type);
+  IOBuf buf(IOBuf::WRAP_BUFFER, data);
+  auto result = codec->uncompress(&buf);
+  return result->moveToFbString().toStdString();
+}
+}
+
+/**
+ * A file mapped read-only into memory.
+ */
+class HgRevlog::MappedFile {
+ public:
+  explicit MappedFile(const char* path) : file_(path) {
+    struct stat st;
+    folly::checkUnixError(fstat(file_.fd(), &st), "fstat ", path);
+    size_ = st.st_size;
+    if (size_ > 0) {
+      auto addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file_.fd(), 0);
+      if (addr == MAP_FAILED) {
+        folly::throwSystemError("mmap ", path);
+      }
+      data_ = static_cast<const uint8_t*>(addr);
+    }
+  }
+
+  ~MappedFile() {
+    if (data_) {
+      munmap(const_cast<uint8_t*>(data_), size_);
+    }
+  }
+
+  ByteRange bytes() const {
+    return ByteRange{data_, size_};
+  }
+
+ private:
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  folly::File file_;
+  const uint8_t* data_{nullptr};
+  size_t size_{0};
+};
+
+HgRevlog::HgRevlog(AbsolutePathPiece indexPath)
+    : indexPath_(indexPath.copy()) {
+  index_ = std::make_unique<MappedFile>(indexPath_.c_str());
+  auto bytes = index_->bytes();
+  if (bytes.empty()) {
+    // An empty revlog, with no header
+    return;
+  }
+  if (bytes.size() < kIndexEntrySize) {
+    throw std::runtime_error(
+        folly::to<string>("revlog index ", indexPath_, " is truncated"));
+  }
+
+  // The first four bytes of the first entry hold the version and flags.
+  auto header = loadBE32(bytes.data());
+  auto version = header & kRevlogVersionMask;
+  if (version != kRevlogV1) {
+    throw std::domain_error(folly::to<string>(
+        "unsupported revlog version ", version, " in ", indexPath_));
+  }
+  auto flags = header & ~kRevlogVersionMask;
+  if ((flags & ~(kFlagInlineData | kFlagGeneralDelta)) != 0) {
+    throw std::domain_error(folly::to<string>(
+        "unsupported revlog flags ", flags, " in ", indexPath_));
+  }
+  inline_ = (flags & kFlagInlineData) != 0;
+  generalDelta_ = (flags & kFlagGeneralDelta) != 0;
+
+  if (inline_) {
+    uint64_t pos = 0;
+    while (pos < bytes.size()) {
+      if (bytes.size() - pos < kIndexEntrySize) {
+        throw std::runtime_error(
+            folly::to<string>("revlog index ", indexPath_, " is truncated"));
+      }
+      inlineEntryPositions_.push_back(pos);
+      pos += kIndexEntrySize +
+          loadBE32(bytes.data() + pos + kCompressedLengthOffset);
+    }
+    if (pos != bytes.size()) {
+      throw std::runtime_error(
+          folly::to<string>("revlog index ", indexPath_, " is truncated"));
+    }
+    numRevs_ = inlineEntryPositions_.size();
+  } else {
+    if (bytes.size() % kIndexEntrySize != 0) {
+      throw std::runtime_error(
+          folly::to<string>("revlog index ", indexPath_, " is truncated"));
+    }
+    numRevs_ = bytes.size() / kIndexEntrySize;
+
+    auto dataPath = indexPath_.value();
+    DCHECK(StringPiece{dataPath}.endsWith(".i"));
+    dataPath.back() = 'd';
+    data_ = std::make_unique<MappedFile>(dataPath.c_str());
+  }
+}
+
+HgRevlog::~HgRevlog() {}
+
+HgRevlog::IndexEntry HgRevlog::getEntry(uint32_t rev) const {
+  DCHECK_LT(rev, numRevs_);
+  auto* p = index_->bytes().data() +
+      (inline_ ? inlineEntryPositions_[rev] : rev * kIndexEntrySize);
+
+  IndexEntry entry;
+  auto offsetFlags = loadBE64(p + kOffsetFlagsOffset);
+  // The offset of the first revision is always 0; its bytes hold the header.
+  entry.offset = rev == 0 ? 0 : offsetFlags >> 16;
+  entry.flags = offsetFlags & 0xffff;
+  entry.compressedLength = loadBE32(p + kCompressedLengthOffset);
+  entry.length = loadBE32(p + kLengthOffset);
+  entry.baseRev = static_cast<int32_t>(loadBE32(p + kBaseRevOffset));
+  entry.p1 = static_cast<int32_t>(loadBE32(p + kParent1Offset));
+  entry.p2 = static_cast<int32_t>(loadBE32(p + kParent2Offset));
+  entry.node = ByteRange{p + kNodeOffset, Hash::RAW_SIZE};
+  return entry;
+}
+
+folly::Optional<uint32_t> HgRevlog::findNode(const Hash& node) const {
+  auto target = node.getBytes();
+  for (uint32_t rev = 0; rev < numRevs_; ++rev) {
+    if (getEntry(rev).node == target) {
+      return rev;
+    }
+  }
+  return folly::none;
+}
+
+Hash HgRevlog::getNode(uint32_t rev) const {
+  return Hash(getEntry(rev).node);
+}
+
+folly::Optional<uint64_t> HgRevlog::getFileSize(uint32_t rev) const {
+  if (rev >= numRevs_) {
+    throw std::out_of_range(folly::to<string>(
+        "revision ", rev, " is out of range for ", indexPath_));
+  }
+  auto entry = getEntry(rev);
+  if (entry.flags != 0 || entry.p1 < 0) {
+    return folly::none;
+  }
+  return uint64_t{entry.length};
+}
+
+Hash HgRevlog::getParentNode(int32_t rev) const {
+  if (rev < 0) {
+    return kZeroHash;
+  }
+  if (static_cast<size_t>(rev) >= numRevs_) {
+    throw std::runtime_error(folly::to<string>(
+        "revlog ", indexPath_, " has an out of range parent ", rev));
+  }
+  return getNode(rev);
+}
+
+string HgRevlog::decompress(uint32_t rev, const IndexEntry& entry) const {
+  ByteRange data;
+  uint64_t start;
+  if (inline_) {
+    data = index_->bytes();
+    start = inlineEntryPositions_[rev] + kIndexEntrySize;
+  } else {
+    data = data_->bytes();
+    start = entry.offset;
+  }
+  if (start > data.size() || entry.compressedLength > data.size() - start) {
+    throw std::runtime_error(folly::to<string>(
+        "revision ", rev, " of ", indexPath_, " is out of bounds"));
+  }
+  auto chunk = data.subpiece(start, entry.compressedLength);
+  if (chunk.empty()) {
+    return string();
+  }
+
+  // The first byte identifies how the chunk was compressed.
+  switch (chunk[0]) {
+    case '\0':
+      // Uncompressed data that happens to start with a NUL byte
+      return StringPiece{chunk}.str();
+    case 'u':
+      return StringPiece{chunk.subpiece(1)}.str();
+    case 'x':
+      return uncompressWith(folly::io::CodecType::ZLIB, chunk);
+    case '(':
+      // The first byte of the zstd frame magic number
+      return uncompressWith(folly::io::CodecType::ZSTD, chunk);
+  }
+  throw std::domain_error(folly::to<string>(
+      "unsupported compression type ",
+      static_cast<int>(chunk[0]),
+      " for revision ",
+      rev,
+      " of ",
+      indexPath_));
+}
+
+string HgRevlog::getText(uint32_t rev) const {
+  if (rev >= numRevs_) {
+    throw std::out_of_range(folly::to<string>(
+        "revision ", rev, " is out of range for ", indexPath_));
+  }
+
+  // Walk back along the delta chain to the full snapshot it starts from.
+  std::vector<std::pair<uint32_t, IndexEntry>> chain;
+  uint32_t current = rev;
+  while (true) {
+    auto entry = getEntry(current);
+    if (entry.flags != 0) {
+      throw std::domain_error(folly::to<string>(
+          "revision ", current, " of ", indexPath_, " has unsupported flags ",
+          entry.flags));
+    }
+    chain.emplace_back(current, entry);
+    if (entry.baseRev == static_cast<int32_t>(current)) {
+      break;
+    }
+    // With general delta the base is the revision this one is a delta
+    // against.  Otherwise it is the start of the chain, and each revision is
+    // a delta against the previous one.
+    int64_t next = generalDelta_ ? entry.baseRev : int64_t{current} - 1;
+    if (next < 0 || next >= current) {
+      throw std::runtime_error(folly::to<string>(
+          "revision ", current, " of ", indexPath_, " has an invalid delta "
+          "base ", entry.baseRev));
+    }
+    current = next;
+  }
+
+  auto text = decompress(chain.back().first, chain.back().second);
+  for (auto it = chain.rbegin() + 1; it != chain.rend(); ++it) {
+    auto delta = decompress(it->first, it->second);
+    text = applyDelta(text, ByteRange{StringPiece{delta}});
+  }
+
+  const auto& entry = chain.front().second;
+  if (text.size() != entry.length) {
+    throw std::runtime_error(folly::to<string>(
+        "revision ", rev, " of ", indexPath_, " has length ", text.size(),
+        " rather than ", entry.length));
+  }
+
+  // The node is the SHA-1 of the sorted parent nodes followed by the text.
+  auto p1 = getParentNode(entry.p1);
+  auto p2 = getParentNode(entry.p2);
+  if (p2 < p1) {
+    std::swap(p1, p2);
+  }
+  std::array<uint8_t, Hash::RAW_SIZE * 2> parents;
+  memcpy(parents.data(), p1.getBytes().data(), Hash::RAW_SIZE);
+  memcpy(parents.data() + Hash::RAW_SIZE, p2.getBytes().data(), Hash::RAW_SIZE);
+  IOBuf buf(IOBuf::WRAP_BUFFER, parents.data(), parents.size());
+  buf.prependChain(IOBuf::wrapBuffer(text.data(), text.size()));
+  if (Hash::sha1(&buf) != Hash(entry.node)) {
+    throw std::runtime_error(folly::to<string>(
+        "revision ", rev, " of ", indexPath_, " does not match its node ",
+        Hash(entry.node).toString()));
+  }
+
+  return text;
+}
+
+string HgRevlog::getText(const Hash& node) const {
+  auto rev = findNode(node);
+  if (!rev.hasValue()) {
+    throw std::domain_error(folly::to<string>(
+        "node ", node.toString(), " not found in ", indexPath_));
+  }
+  return getText(rev.value());
+}
+
+string HgRevlog::applyDelta(StringPiece base, ByteRange delta) {
+  string result;
+  result.reserve(base.size() + delta.size());
+  size_t last = 0;
+  while (!delta.empty()) {
+    if (delta.size() < kDeltaHunkHeaderSize) {
+      throw std::runtime_error("truncated mercurial delta");
+    }
+    auto start = loadBE32(delta.data());
+    auto end = loadBE32(delta.data() + 4);
+    auto length = loadBE32(delta.data() + 8);
+    delta.advance(kDeltaHunkHeaderSize);
+    if (start < last || end < start || end > base.size() ||
+        length > delta.size()) {
+      throw std::runtime_error("invalid mercurial delta");
+    }
+    result.append(base.data() + last, start - last);
+    result.append(reinterpret_cast<const char*>(delta.data()), length);
+    delta.advance(length);
+    last = end;
+  }
+  result.append(base.data() + last, base.size() - last);
+  return result;
+}
+}
+} // facebook::eden
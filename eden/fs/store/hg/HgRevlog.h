@@ -0,0 +1,139 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Optional.h>
+#include <folly/Range.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "eden/fs/model/Hash.h"
+#include "eden/utils/PathFuncs.h"
+
+namespace facebook {
+namespace eden {
+
+/**
+ * A read-only mercurial revlog.
+ *
+ * This reads version 1 ("RevlogNG") revlogs directly, without going through
+ * hg_import_helper.py.  The index and data files are mapped into memory when
+ * the HgRevlog is created, so it only sees the revisions that existed at
+ * that point.
+ *
+ * Features that this does not understand, such as other revlog versions,
+ * unknown compression engines, or revisions with flags set (censored or
+ * externally stored data), cause std::domain_error to be thrown.  Callers can
+ * use this to fall back to the python helper.  Corrupt data results in
+ * std::runtime_error.
+ */
+class HgRevlog {
+ public:
+  /**
+   * Open the revlog whose index is at indexPath.  If the revlog does not
+   * store its data inline, the data file is found next to the index, with
+   * the ".d" suffix in place of ".i".
+   */
+  explicit HgRevlog(AbsolutePathPiece indexPath);
+  ~HgRevlog();
+
+  /**
+   * Returns the number of revisions in this revlog.
+   */
+  size_t size() const {
+    return numRevs_;
+  }
+
+  /**
+   * Find the revision number for a node, or folly::none if it is not in
+   * this revlog.
+   */
+  folly::Optional<uint32_t> findNode(const Hash& node) const;
+
+  Hash getNode(uint32_t rev) const;
+
+  /**
+   * Get the full text of a revision, by applying its delta chain.
+   *
+   * The result is checked against the revision's node.
+   */
+  std::string getText(uint32_t rev) const;
+
+  /**
+   * Get the full text of a revision by its node.
+   *
+   * Throws std::domain_error if the node is not in this revlog.
+   */
+  std::string getText(const Hash& node) const;
+
+  /**
+   * Get the size of a file revision in a filelog from the index alone,
+   * without reading or decompressing its data.
+   *
+   * The text of a filelog revision that records a copy starts with a
+   * metadata block, which is not part of the file contents, so its length
+   * is not the file size.  Mercurial only records copies in revisions with
+   * no first parent, so this returns folly::none for those, and for
+   * revisions with flags set.  Like mercurial's filelog.size(), this does
+   * not account for the rare files whose contents themselves start with
+   * the metadata marker.
+   */
+  folly::Optional<uint64_t> getFileSize(uint32_t rev) const;
+
+  /**
+   * Apply a mercurial binary delta to base.
+   *
+   * A delta is a list of hunks, in increasing order, each of which replaces
+   * the range [start, end) of base with new data:
+   *   4 bytes  start, big-endian
+   *   4 bytes  end, big-endian
+   *   4 bytes  length of the data, big-endian
+   *   data
+   */
+  static std::string applyDelta(
+      folly::StringPiece base,
+      folly::ByteRange delta);
+
+ private:
+  class MappedFile;
+
+  struct IndexEntry {
+    uint64_t offset;
+    uint16_t flags;
+    uint32_t compressedLength;
+    uint32_t length;
+    int32_t baseRev;
+    int32_t p1;
+    int32_t p2;
+    folly::ByteRange node;
+  };
+
+  HgRevlog(const HgRevlog&) = delete;
+  HgRevlog& operator=(const HgRevlog&) = delete;
+
+  IndexEntry getEntry(uint32_t rev) const;
+  std::string decompress(uint32_t rev, const IndexEntry& entry) const;
+  Hash getParentNode(int32_t rev) const;
+
+  AbsolutePath indexPath_;
+  std::unique_ptr<MappedFile> index_;
+  std::unique_ptr<MappedFile> data_;
+  bool inline_{false};
+  bool generalDelta_{false};
+  size_t numRevs_{0};
+  /**
+   * In an inline revlog each revision's data follows its index entry, so
+   * the entries are not at fixed positions.  This holds the position of
+   * each entry in the index file.
+   */
+  std::vector<uint64_t> inlineEntryPositions_;
+};
+}
+} // facebook::eden
@@ -14,6 +14,7 @@ from __future__ import unicode_literals
 
 import argparse
 import binascii
+import hashlib
 import logging
 import os
 import struct
@@ -34,9 +35,10 @@ import mercurial.ui
 # - Transaction ID
 #   This is a numeric identifier used for associating a response with a given
 #   request.  The response for a particular request will always contain the
-#   same transaction ID as was sent in the request.  (Currently responses are
-#   always sent in the same order that requests were received, so this is
-#   primarily used just as a sanity check.)
+#   same transaction ID as was sent in the request.  Responses are sent in
+#   the same order that requests were received, but the C++ side pipelines
+#   several requests at once and uses this ID to match each response chunk to
+#   the request it belongs to.
 #
 # - Command ID
 #   This is one of the CMD_* constants below.
@@ -64,6 +66,11 @@ CMD_STARTED = 0
 CMD_RESPONSE = 1
 CMD_MANIFEST = 2
 CMD_CAT_FILE = 3
+CMD_CAT_FILES = 4
+CMD_TREE = 5
+CMD_MANIFEST_NODE = 6
+CMD_MANIFEST_DIFF = 7
+CMD_FILE_METADATA = 8
 
 #
 # Flag values.
@@ -269,6 +276,207 @@ class HgServer(object):
         contents = self.get_file(path, rev_hash)
         self.send_chunk(request, contents)
 
+    @cmd(CMD_FILE_METADATA)
+    def cmd_file_metadata(self, request):
+        '''
+        Handler for CMD_FILE_METADATA requests.
+
+        This requests the size and SHA-1 hash of a file's contents, without
+        sending the contents themselves.
+
+        Request body format:
+          The same as for CMD_CAT_FILE.
+
+        Response body format:
+        - <size><sha1>
+          Fields:
+          - <size>: The length of the file contents, as a 64-bit big-endian
+            integer.
+          - <sha1>: The SHA-1 hash of the file contents, as a 20-byte binary
+            value.
+        '''
+        if len(request.body) < SHA1_NUM_BYTES + 1:
+            raise Exception('file_metadata request data too short')
+
+        rev_hash = request.body[:SHA1_NUM_BYTES]
+        path = request.body[SHA1_NUM_BYTES:]
+        self.debug('getting metadata of file %r revision %s', path,
+                   binascii.hexlify(rev_hash))
+
+        contents = self.get_file(path, rev_hash)
+        sha1 = hashlib.sha1(contents).digest()
+        self.send_chunk(request, struct.pack('>Q', len(contents)) + sha1)
+
+    @cmd(CMD_CAT_FILES)
+    def cmd_cat_files(self, request):
+        '''
+        Handler for CMD_CAT_FILES requests.
+
+        This requests the contents of several files at once.  It is
+        equivalent to sending a CMD_CAT_FILE request for each file, but avoids
+        the per-request overhead, and lets us prefetch all of the files at
+        once when using remotefilelog.
+
+        Request body format:
+        - <num_files><file>...
+          Fields:
+          - <num_files>: The number of files requested, as a 32-bit
+            big-endian integer.
+          - <file>: <rev_hash><path_length><path>
+            - <rev_hash>: The file revision hash, as a 20-byte binary value.
+            - <path_length>: The length of the path, as a 32-bit big-endian
+              integer.
+            - <path>: The file path, relative to the root of the repository.
+
+        Response body format:
+          The response consists of exactly one chunk per requested file, in
+          the same order as the files were listed in the request.
+          (FLAG_MORE_CHUNKS will be set on all but the last chunk.)  Each
+          chunk body consists solely of the raw file contents.
+
+          If an error occurs loading any of the files an error chunk is sent
+          and no further chunks are sent for this request.
+        '''
+        files = self._parse_cat_files_request(request.body)
+        self.debug('getting contents of %d files', len(files))
+        self.prefetch_files(files)
+
+        # Reuse the filelog objects across files in the same batch, since
+        # looking them up and opening the revlog has a non-trivial cost.
+        filelogs = {}
+        for idx, (path, rev_hash) in enumerate(files):
+            contents = self.get_file(path, rev_hash, filelogs)
+            self.send_chunk(request, contents,
+                            is_last=(idx == len(files) - 1))
+
+        if not files:
+            self.send_chunk(request, b'')
+
+    @cmd(CMD_TREE)
+    def cmd_tree(self, request):
+        '''
+        Handler for CMD_TREE requests.
+
+        This requests the contents of a single directory from a tree
+        manifest.  Unlike CMD_MANIFEST, subdirectories are not expanded: the
+        caller can request them individually with further CMD_TREE requests
+        as they are needed.
+
+        This is only supported in repositories that use tree manifests.
+
+        Request body format:
+        - <manifest_node><path>
+          Fields:
+          - <manifest_node>: The tree manifest node for this directory, as a
+            20-byte binary value.
+          - <path>: The directory path, relative to the root of the
+            repository.  This is empty for the root directory.
+
+        Response body format:
+          The response body is a list of entries, in the same format used by
+          CMD_MANIFEST, split across one or more chunks.  Each entry's path
+          is just the name of the entry inside this directory, and
+          subdirectories are reported with the 't' flag and the tree manifest
+          node of the subdirectory.
+        '''
+        if len(request.body) < SHA1_NUM_BYTES:
+            raise Exception('tree request data too short')
+
+        manifest_node = request.body[:SHA1_NUM_BYTES]
+        path = request.body[SHA1_NUM_BYTES:]
+        self.debug('sending tree %r revision %s', path,
+                   binascii.hexlify(manifest_node))
+        self.dump_tree(path, manifest_node, request)
+
+    @cmd(CMD_MANIFEST_NODE)
+    def cmd_manifest_node(self, request):
+        '''
+        Handler for CMD_MANIFEST_NODE requests.
+
+        This requests the root tree manifest node for a given revision, which
+        can then be used with CMD_TREE to import the root directory.
+
+        Request body format:
+        - Revision name (string)
+          This is the mercurial revision ID, as for CMD_MANIFEST.
+
+        Response body format:
+        - <manifest_node>
+          The root manifest node for this revision, as a 20-byte binary
+          value.  If the repository does not use tree manifests the response
+          body is empty, and the caller should use CMD_MANIFEST instead.
+        '''
+        rev_name = request.body
+        if not self.has_tree_manifests():
+            self.send_chunk(request, b'')
+            return
+
+        try:
+            ctx = mercurial.scmutil.revsingle(self.repo, rev_name)
+        except Exception:
+            self.repo.invalidate()
+            ctx = mercurial.scmutil.revsingle(self.repo, rev_name)
+        self.send_chunk(request, ctx.manifestnode())
+
+    @cmd(CMD_MANIFEST_DIFF)
+    def cmd_manifest_diff(self, request):
+        '''
+        Handler for CMD_MANIFEST_DIFF requests.
+
+        This requests the manifest entries that differ between a base
+        revision and the specified revision.  This lets the caller import a
+        revision relative to one that it has already imported, without
+        transferring the entire manifest.
+
+        Request body format:
+        - <base_node><rev_name>
+          Fields:
+          - <base_node>: The base commit ID, as a 20-byte binary value.
+          - <rev_name>: The mercurial revision ID, as for CMD_MANIFEST.
+
+        Response body format:
+          The response body is a list of entries, split across one or more
+          chunks.  Each entry consists of a status character followed by an
+          entry in the same format used by CMD_MANIFEST:
+          - <status><rev_hash><tab><flag><tab><path><nul>
+
+          The status is 'M' for files that were added or modified, and 'R'
+          for files that were removed.  For removed files the rev_hash is all
+          zeros and the flag is empty.
+        '''
+        if len(request.body) < SHA1_NUM_BYTES:
+            raise Exception('manifest_diff request data too short')
+
+        base_node = request.body[:SHA1_NUM_BYTES]
+        rev_name = request.body[SHA1_NUM_BYTES:]
+        self.debug('sending manifest diff for revision %r relative to %s',
+                   rev_name, binascii.hexlify(base_node))
+        self.dump_manifest_diff(base_node, rev_name, request)
+
+    def _parse_cat_files_request(self, body):
+        if len(body) < 4:
+            raise Exception('cat_files request data too short')
+        num_files, = struct.unpack(b'>I', body[:4])
+        offset = 4
+
+        files = []
+        for _ in range(num_files):
+            if len(body) < offset + SHA1_NUM_BYTES + 4:
+                raise Exception('truncated cat_files request')
+            rev_hash = body[offset:offset + SHA1_NUM_BYTES]
+            offset += SHA1_NUM_BYTES
+            path_len, = struct.unpack(b'>I', body[offset:offset + 4])
+            offset += 4
+            path = body[offset:offset + path_len]
+            if len(path) != path_len:
+                raise Exception('truncated cat_files request')
+            offset += path_len
+            files.append((path, rev_hash))
+
+        if offset != len(body):
+            raise Exception('trailing data in cat_files request')
+        return files
+
     def send_chunk(self, request, data, is_last=True):
         flags = 0
         if not is_last:
@@ -335,13 +543,121 @@ class HgServer(object):
         self.debug('sent manifest with %d paths in %s seconds',
                    num_paths, time.time() - start)
 
-    def get_file(self, path, rev_hash):
+    def dump_manifest_diff(self, base_node, rev, request):
+        '''
+        Send the manifest entries that differ between two revisions.
+        '''
+        start = time.time()
+        try:
+            base_mf = self.repo[base_node].manifest()
+            mf = mercurial.scmutil.revsingle(self.repo, rev).manifest()
+        except Exception:
+            self.repo.invalidate()
+            base_mf = self.repo[base_node].manifest()
+            mf = mercurial.scmutil.revsingle(self.repo, rev).manifest()
+
+        entries = []
+        for path, (_old, new) in base_mf.diff(mf).iteritems():
+            hashval, flags = new
+            if hashval is None:
+                entry = b'\t'.join(
+                    (b'R' + mercurial.node.nullid, b'', path + b'\0'))
+            else:
+                entry = b'\t'.join((b'M' + hashval, flags, path + b'\0'))
+            entries.append(entry)
+
+        self.send_entries(request, entries)
+        self.debug('sent manifest diff with %d paths in %s seconds',
+                   len(entries), time.time() - start)
+
+    def send_entries(self, request, entries):
+        '''
+        Send a list of encoded manifest entries, split across as many chunks
+        as needed.
+        '''
+        # As in dump_manifest(), 100 entries per chunk is a reasonable
+        # balance between the number of writes and pipeline stalls.
+        ENTRIES_PER_CHUNK = 100
+
+        for idx in range(0, max(len(entries), 1), ENTRIES_PER_CHUNK):
+            chunk = entries[idx:idx + ENTRIES_PER_CHUNK]
+            is_last = (idx + ENTRIES_PER_CHUNK >= len(entries))
+            self.send_chunk(request, b''.join(chunk), is_last=is_last)
+
+    def has_tree_manifests(self):
+        if b'treemanifest' in self.repo.requirements:
+            return True
+        # The treemanifest extension keeps trees in a separate datastore
+        # rather than in the manifest revlog.
+        return getattr(self.repo.manifestlog, 'datastore', None) is not None
+
+    def get_tree_text(self, path, manifest_node):
+        mfl = self.repo.manifestlog
+        datastore = getattr(mfl, 'datastore', None)
+        if datastore is not None:
+            return datastore.get(path, manifest_node)
+
+        # Core mercurial tree manifests keep one revlog per directory
+        revlog = mfl._revlog
+        if path:
+            revlog = revlog.dirlog(path + b'/')
+        return revlog.revision(manifest_node)
+
+    def dump_tree(self, path, manifest_node, request):
+        '''
+        Send the entries of a single tree manifest.
+        '''
+        try:
+            text = self.get_tree_text(path, manifest_node)
+        except Exception:
+            self.repo.invalidate()
+            text = self.get_tree_text(path, manifest_node)
+
+        # Each line of the tree text is <name><nul><hex_node><flags>
+        entries = []
+        for line in text.splitlines():
+            name, rest = line.split(b'\0', 1)
+            hashval = binascii.unhexlify(rest[:40])
+            flags = rest[40:]
+            entries.append(b'\t'.join((hashval, flags, name + b'\0')))
+
+        self.send_entries(request, entries)
+
+    def get_file(self, path, rev_hash, filelogs=None):
+        if filelogs is None:
+            try:
+                fctx = self.repo.filectx(path, fileid=rev_hash)
+            except Exception:
+                self.repo.invalidate()
+                fctx = self.repo.filectx(path, fileid=rev_hash)
+            return fctx.data()
+
+        # When a filelog cache is supplied, read directly from the filelog.
+        # This is what filectx.data() does internally, but lets the caller
+        # reuse the filelog across multiple requests for the same path.
+        fl = filelogs.get(path)
+        if fl is None:
+            fl = self.repo.file(path)
+            filelogs[path] = fl
         try:
-            fctx = self.repo.filectx(path, fileid=rev_hash)
+            return fl.read(rev_hash)
         except Exception:
             self.repo.invalidate()
-            fctx = self.repo.filectx(path, fileid=rev_hash)
-        return fctx.data()
+            fl = self.repo.file(path)
+            filelogs[path] = fl
+            return fl.read(rev_hash)
+
+    def prefetch_files(self, files):
+        '''
+        Ask remotefilelog to fetch all of the (path, rev_hash) pairs in a
+        single round trip, if this repository uses remotefilelog.
+        '''
+        fileservice = getattr(self.repo, 'fileservice', None)
+        if fileservice is None or not files:
+            return
+        fileservice.prefetch([
+            (path, binascii.hexlify(rev_hash)) for path, rev_hash in files
+        ])
 
     def prefetch(self, rev):
         if not hasattr(self.repo, 'prefetch'):
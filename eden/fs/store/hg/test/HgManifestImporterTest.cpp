@@ -0,0 +1,149 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Conv.h>
+#include <folly/experimental/TestUtil.h>
+#include <gtest/gtest.h>
+#include <wangle/concurrent/CPUThreadPoolExecutor.h>
+#include <map>
+#include <string>
+#include "eden/fs/model/Hash.h"
+#include "eden/fs/model/Tree.h"
+#include "eden/fs/model/TreeEntry.h"
+#include "eden/fs/store/LocalStore.h"
+#include "eden/fs/store/hg/HgManifestImporter.h"
+
+using namespace facebook::eden;
+
+using folly::StringPiece;
+using folly::test::TemporaryDirectory;
+using std::string;
+
+namespace {
+/** A manifest, as a map from file path to the file contents hash */
+using Manifest = std::map<string, string>;
+
+TreeEntry makeEntry(RelativePathPiece path, StringPiece contents) {
+  return TreeEntry(
+      Hash::sha1(folly::ByteRange(contents)),
+      path.basename().stringPiece(),
+      FileType::REGULAR_FILE,
+      0b110);
+}
+}
+
+class HgManifestImporterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    testDir_ = std::make_unique<TemporaryDirectory>("eden_test");
+    auto path = AbsolutePathPiece{testDir_->path().string()};
+    store_ = std::make_unique<LocalStore>(path);
+  }
+
+  void TearDown() override {
+    store_.reset();
+    testDir_.reset();
+  }
+
+  Hash importFull(
+      const Manifest& manifest,
+      folly::Executor* executor = nullptr) {
+    HgManifestImporter importer(store_.get(), executor);
+    for (const auto& entry : manifest) {
+      RelativePathPiece path(entry.first);
+      importer.processEntry(path.dirname(), makeEntry(path, entry.second));
+    }
+    return importer.finish();
+  }
+
+  Hash importDiff(
+      const Hash& baseRoot,
+      const Manifest& base,
+      const Manifest& result) {
+    HgManifestImporter importer(store_.get(), baseRoot);
+    for (const auto& entry : result) {
+      auto iter = base.find(entry.first);
+      if (iter == base.end() || iter->second != entry.second) {
+        RelativePathPiece path(entry.first);
+        importer.processEntry(path.dirname(), makeEntry(path, entry.second));
+      }
+    }
+    for (const auto& entry : base) {
+      if (result.find(entry.first) == result.end()) {
+        importer.removeEntry(RelativePathPiece(entry.first));
+      }
+    }
+    return importer.finish();
+  }
+
+  std::unique_ptr<TemporaryDirectory> testDir_;
+  std::unique_ptr<LocalStore> store_;
+};
+
+TEST_F(HgManifestImporterTest, incrementalImportMatchesFullImport) {
+  Manifest base = {
+      {"README", "readme"},
+      {"src/a.cpp", "a"},
+      {"src/b.cpp", "b"},
+      {"src/old/c.cpp", "c"},
+      {"tools/build", "build"},
+  };
+  Manifest result = {
+      {"README", "readme v2"},
+      {"src/a.cpp", "a"},
+      {"src/b.cpp", "b"},
+      {"src/new/d.cpp", "d"},
+      {"tools/build/main.py", "main"},
+  };
+
+  auto baseRoot = importFull(base);
+  auto diffRoot = importDiff(baseRoot, base, result);
+  EXPECT_EQ(importFull(result).toString(), diffRoot.toString());
+
+  // The old directory was removed and the new one was added
+  auto root = store_->getTree(diffRoot);
+  ASSERT_NE(nullptr, root);
+  auto src =
+      store_->getTree(root->getEntryAt(PathComponentPiece("src")).getHash());
+  ASSERT_NE(nullptr, src);
+  EXPECT_EQ(nullptr, src->getEntryPtr(PathComponentPiece("old")));
+  EXPECT_NE(nullptr, src->getEntryPtr(PathComponentPiece("new")));
+}
+
+TEST_F(HgManifestImporterTest, parallelImportMatchesSerialImport) {
+  Manifest manifest;
+  for (int dir = 0; dir < 20; ++dir) {
+    for (int file = 0; file < 10; ++file) {
+      auto path = folly::to<string>("dir", dir, "/sub", file % 3, "/f", file);
+      manifest[path] = path;
+    }
+    manifest[folly::to<string>("file", dir)] = "contents";
+  }
+
+  auto serialRoot = importFull(manifest);
+  wangle::CPUThreadPoolExecutor pool(4);
+  EXPECT_EQ(serialRoot.toString(), importFull(manifest, &pool).toString());
+}
+
+TEST_F(HgManifestImporterTest, incrementalImportRemovingEverything) {
+  Manifest base = {{"dir/file", "contents"}};
+  auto baseRoot = importFull(base);
+  auto diffRoot = importDiff(baseRoot, base, Manifest{});
+
+  auto root = store_->getTree(diffRoot);
+  ASSERT_NE(nullptr, root);
+  EXPECT_EQ(0, root->getTreeEntries().size());
+}
+
+TEST_F(HgManifestImporterTest, incrementalImportRequiresBaseTree) {
+  EXPECT_THROW(
+      HgManifestImporter(
+          store_.get(), Hash("0123456789abcdef0123456789abcdef01234567")),
+      std::domain_error);
+}
@@ -0,0 +1,52 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/store/hg/HgNativeImporter.h"
+
+#include <gtest/gtest.h>
+#include <string>
+
+using namespace facebook::eden;
+
+using std::string;
+
+namespace {
+string encode(folly::StringPiece path) {
+  return encodeHgStorePath(path, true, true);
+}
+}
+
+TEST(HgNativeImporter, encodeStorePath) {
+  EXPECT_EQ("data/foo/bar.c.i", encode("data/foo/bar.c.i"));
+  EXPECT_EQ("data/_r_e_a_d_m_e__x.i", encode("data/README_x.i"));
+  EXPECT_EQ("data/a~3ab~3f.i", encode("data/a:b?.i"));
+  EXPECT_EQ("data/~2ehgignore.i", encode("data/.hgignore.i"));
+  EXPECT_EQ("data/au~78.c.i", encode("data/aux.c.i"));
+  EXPECT_EQ("data/co~6d1/x.i", encode("data/com1/x.i"));
+  EXPECT_EQ("data/com10/x.i", encode("data/com10/x.i"));
+  EXPECT_EQ("data/dir~2e/x.i", encode("data/dir./x.i"));
+  EXPECT_EQ("data/dir.i.hg/x.d.hg/y.i", encode("data/dir.i/x.d/y.i"));
+}
+
+TEST(HgNativeImporter, encodeStorePathWithoutFncache) {
+  // Only the basic encoding is used without fncache, and there is no limit
+  // on the length of the path.
+  EXPECT_EQ("data/aux.i", encodeHgStorePath("data/aux.i", false, false));
+  EXPECT_EQ(
+      "data/_a.hg.hg/b.i", encodeHgStorePath("data/A.hg/b.i", false, false));
+  string longPath = "data/" + string(200, 'a') + ".i";
+  EXPECT_EQ(longPath, encodeHgStorePath(longPath, false, false));
+}
+
+TEST(HgNativeImporter, hashedStorePathIsUnsupported) {
+  EXPECT_THROW(encode("data/" + string(200, 'a') + ".i"), std::domain_error);
+  // Without dotencode a leading period is left alone
+  EXPECT_EQ(
+      "data/.hgignore.i", encodeHgStorePath("data/.hgignore.i", true, false));
+}
@@ -0,0 +1,153 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/store/hg/HgRevlog.h"
+
+#include <folly/Bits.h>
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <folly/experimental/TestUtil.h>
+#include <gtest/gtest.h>
+#include <string>
+#include "eden/fs/model/Hash.h"
+
+using namespace facebook::eden;
+
+using folly::ByteRange;
+using folly::StringPiece;
+using folly::test::TemporaryDirectory;
+using std::string;
+
+namespace {
+constexpr uint32_t kInlineGeneralDeltaV1 = 1 | (1 << 16) | (1 << 17);
+
+void appendBE32(string* out, uint32_t value) {
+  value = folly::Endian::big(value);
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+string delta(uint32_t start, uint32_t end, StringPiece data) {
+  string result;
+  appendBE32(&result, start);
+  appendBE32(&result, end);
+  appendBE32(&result, data.size());
+  result.append(data.data(), data.size());
+  return result;
+}
+
+Hash hgNode(const Hash& p1, const Hash& p2, StringPiece text) {
+  auto parents = p1 < p2 ? p1.toString() + p2.toString()
+                         : p2.toString() + p1.toString();
+  string data;
+  folly::unhexlify(parents, data);
+  data.append(text.data(), text.size());
+  return Hash::sha1(ByteRange{StringPiece{data}});
+}
+
+/**
+ * Builds an inline revlog with general delta, one revision at a time.
+ */
+class RevlogBuilder {
+ public:
+  void add(
+      StringPiece chunk,
+      uint32_t length,
+      int32_t base,
+      int32_t p1,
+      const Hash& node) {
+    auto rev = numRevs_++;
+    // The offset is never needed for inline revlogs, so leave it at zero,
+    // apart from the header in the first entry.
+    appendBE32(&data_, rev == 0 ? kInlineGeneralDeltaV1 : 0);
+    appendBE32(&data_, 0);
+    appendBE32(&data_, chunk.size());
+    appendBE32(&data_, length);
+    appendBE32(&data_, base);
+    appendBE32(&data_, rev);
+    appendBE32(&data_, p1);
+    appendBE32(&data_, -1);
+    auto nodeBytes = node.getBytes();
+    data_.append(reinterpret_cast<const char*>(nodeBytes.data()), 20);
+    data_.append(12, '\0');
+    data_.append(chunk.data(), chunk.size());
+  }
+
+  AbsolutePath write(const TemporaryDirectory& dir) const {
+    auto path =
+        AbsolutePath{dir.path().string()} + PathComponentPiece{"test.i"};
+    folly::writeFile(data_, path.c_str());
+    return path;
+  }
+
+ private:
+  string data_;
+  uint32_t numRevs_{0};
+};
+}
+
+TEST(HgRevlog, applyDelta) {
+  EXPECT_EQ("hello", HgRevlog::applyDelta("hello", ByteRange{}));
+
+  auto hunks = delta(0, 1, "J") + delta(3, 5, "ly") + delta(5, 5, "!");
+  EXPECT_EQ(
+      "Jelly!", HgRevlog::applyDelta("hello", ByteRange{StringPiece{hunks}}));
+
+  // Hunks that are out of order or out of range are rejected
+  auto backwards = delta(3, 4, "x") + delta(0, 1, "y");
+  EXPECT_THROW(
+      HgRevlog::applyDelta("hello", ByteRange{StringPiece{backwards}}),
+      std::runtime_error);
+  auto pastEnd = delta(3, 9, "x");
+  EXPECT_THROW(
+      HgRevlog::applyDelta("hello", ByteRange{StringPiece{pastEnd}}),
+      std::runtime_error);
+  auto truncated = delta(0, 1, "xyz");
+  truncated.pop_back();
+  EXPECT_THROW(
+      HgRevlog::applyDelta("hello", ByteRange{StringPiece{truncated}}),
+      std::runtime_error);
+}
+
+TEST(HgRevlog, readInlineRevlog) {
+  string text0 = "hello\nworld\n";
+  string text1 = "hello\neden\n";
+  auto node0 = hgNode(kZeroHash, kZeroHash, text0);
+  auto node1 = hgNode(node0, kZeroHash, text1);
+
+  RevlogBuilder builder;
+  builder.add("u" + text0, text0.size(), 0, -1, node0);
+  // The delta starts with a NUL byte, so it is stored without a prefix.
+  builder.add(delta(6, 12, "eden\n"), text1.size(), 0, 0, node1);
+
+  TemporaryDirectory dir("eden_hg_revlog_test");
+  HgRevlog revlog(builder.write(dir));
+  EXPECT_EQ(2, revlog.size());
+  EXPECT_EQ(node1, revlog.getNode(1));
+  EXPECT_EQ(1, revlog.findNode(node1).value());
+  EXPECT_FALSE(revlog.findNode(kZeroHash).hasValue());
+
+  EXPECT_EQ(text0, revlog.getText(0));
+  EXPECT_EQ(text1, revlog.getText(1));
+  EXPECT_EQ(text1, revlog.getText(node1));
+  EXPECT_THROW(revlog.getText(kZeroHash), std::domain_error);
+
+  // The first revision has no parent, so it may hold copy metadata.
+  EXPECT_FALSE(revlog.getFileSize(0).hasValue());
+  EXPECT_EQ(text1.size(), revlog.getFileSize(1).value());
+}
+
+TEST(HgRevlog, rejectsMismatchedNode) {
+  string text = "contents\n";
+  RevlogBuilder builder;
+  builder.add("u" + text, text.size(), 0, -1, hgNode(kZeroHash, kZeroHash, ""));
+
+  TemporaryDirectory dir("eden_hg_revlog_test");
+  HgRevlog revlog(builder.write(dir));
+  EXPECT_THROW(revlog.getText(0), std::runtime_error);
+}
@@ -9,18 +9,200 @@
  */
 #include "eden/fs/model/Hash.h"
 
+#include <folly/FileUtil.h>
+#include <folly/String.h>
 #include <folly/init/Init.h>
 #include <gflags/gflags.h>
 #include <sysexits.h>
+#include <unistd.h>
+#include <chrono>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
 
 #include "HgImporter.h"
+#include "eden/fs/model/Tree.h"
+#include "eden/fs/model/TreeEntry.h"
 #include "eden/fs/store/LocalStore.h"
 #include "eden/utils/PathFuncs.h"
 
 DEFINE_string(edenDir, "", "The path to the .eden directory");
 DEFINE_string(rev, "", "The revision ID to import");
+DEFINE_int32(
+    manifestIterations,
+    1,
+    "The number of times to import the manifest, to get a stable timing");
+DEFINE_int32(
+    files,
+    0,
+    "After importing the manifest, import the contents of this many files "
+    "from it, or -1 to import all of them");
+DEFINE_int32(
+    importers,
+    1,
+    "The number of HgImporter objects, each with its own helper process, "
+    "to import file contents with");
+DEFINE_int32(
+    inFlight,
+    1,
+    "The number of file requests to keep outstanding on each importer");
+DEFINE_int32(
+    batchSize,
+    0,
+    "If non-zero, request this many files at a time with "
+    "fetchFileContentsBatch() rather than one at a time");
 
 using namespace facebook::eden;
+using folly::IOBuf;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+namespace {
+
+/**
+ * A snapshot of the counters that the benchmark reports, summed over all of
+ * the importers.
+ */
+struct Counters {
+  steady_clock::time_point time;
+  double helperCpuSeconds{0};
+  HgImporter::PipeStats pipe;
+};
+
+/**
+ * Returns the user plus system CPU time used by a process so far.
+ *
+ * This is how long the python side of the import has spent working,
+ * including mercurial itself.
+ */
+double getCpuSeconds(pid_t pid) {
+  std::string stat;
+  auto path = folly::to<std::string>("/proc/", pid, "/stat");
+  if (!folly::readFile(path.c_str(), stat)) {
+    return 0;
+  }
+  // The command name in the second field may contain spaces, so skip past
+  // it before splitting.  utime and stime are fields 14 and 15.
+  auto commEnd = stat.rfind(')');
+  if (commEnd == std::string::npos) {
+    return 0;
+  }
+  std::vector<folly::StringPiece> fields;
+  folly::split(' ', folly::StringPiece{stat}.subpiece(commEnd + 2), fields);
+  if (fields.size() < 13) {
+    return 0;
+  }
+  auto ticks =
+      folly::to<uint64_t>(fields[11]) + folly::to<uint64_t>(fields[12]);
+  return static_cast<double>(ticks) / sysconf(_SC_CLK_TCK);
+}
+
+Counters getCounters(
+    const std::vector<std::unique_ptr<HgImporter>>& importers) {
+  Counters counters;
+  counters.time = steady_clock::now();
+  for (const auto& importer : importers) {
+    counters.helperCpuSeconds += getCpuSeconds(importer->getHelperPid());
+    auto pipe = importer->getPipeStats();
+    counters.pipe.bytesSent += pipe.bytesSent;
+    counters.pipe.bytesReceived += pipe.bytesReceived;
+    counters.pipe.chunksReceived += pipe.chunksReceived;
+  }
+  return counters;
+}
+
+double toMB(uint64_t bytes) {
+  return static_cast<double>(bytes) / (1024 * 1024);
+}
+
+void printCounters(const Counters& start, const Counters& end) {
+  auto seconds = duration<double>(end.time - start.time).count();
+  auto received = end.pipe.bytesReceived - start.pipe.bytesReceived;
+  printf(
+      "  pipe:       %.2f MB sent, %.2f MB received in %lu chunks "
+      "(%.2f MB/s)\n",
+      toMB(end.pipe.bytesSent - start.pipe.bytesSent),
+      toMB(received),
+      static_cast<unsigned long>(
+          end.pipe.chunksReceived - start.pipe.chunksReceived),
+      toMB(received) / seconds);
+  printf(
+      "  helper CPU: %.3fs (%.0f%% of wall time)\n",
+      end.helperCpuSeconds - start.helperCpuSeconds,
+      100.0 * (end.helperCpuSeconds - start.helperCpuSeconds) / seconds);
+}
+
+/**
+ * Walk the trees imported by importManifest() and collect the hashes of up
+ * to maxFiles regular files, in breadth-first order.
+ */
+std::vector<Hash>
+collectFiles(const LocalStore& store, const Hash& rootHash, size_t maxFiles) {
+  std::vector<Hash> files;
+  std::deque<Hash> trees{rootHash};
+  while (!trees.empty() && files.size() < maxFiles) {
+    auto tree = store.getTree(trees.front());
+    if (!tree) {
+      throw std::runtime_error(folly::to<std::string>(
+          "tree ", trees.front().toString(), " not found in the LocalStore"));
+    }
+    trees.pop_front();
+    for (const auto& entry : tree->getTreeEntries()) {
+      if (entry.getType() == TreeEntryType::TREE) {
+        trees.push_back(entry.getHash());
+      } else if (entry.getFileType() == FileType::REGULAR_FILE) {
+        files.push_back(entry.getHash());
+        if (files.size() >= maxFiles) {
+          break;
+        }
+      }
+    }
+  }
+  return files;
+}
+
+/**
+ * Import the contents of files [begin, end) with a single importer, keeping
+ * FLAGS_inFlight requests outstanding.  Returns the number of content bytes
+ * received.
+ */
+uint64_t importFiles(
+    HgImporter& importer,
+    const std::vector<Hash>& files,
+    size_t begin,
+    size_t end) {
+  uint64_t bytes = 0;
+  std::deque<std::vector<folly::Future<IOBuf>>> outstanding;
+  auto waitForOldest = [&] {
+    for (auto& future : outstanding.front()) {
+      bytes += future.get().computeChainDataLength();
+    }
+    outstanding.pop_front();
+  };
+
+  size_t perRequest = FLAGS_batchSize > 0 ? FLAGS_batchSize : 1;
+  for (size_t idx = begin; idx < end; idx += perRequest) {
+    if (outstanding.size() >= static_cast<size_t>(FLAGS_inFlight)) {
+      waitForOldest();
+    }
+    if (FLAGS_batchSize > 0) {
+      std::vector<Hash> batch(
+          files.begin() + idx,
+          files.begin() + std::min(idx + perRequest, end));
+      outstanding.push_back(importer.fetchFileContentsBatch(batch));
+    } else {
+      outstanding.emplace_back();
+      outstanding.back().push_back(importer.fetchFileContents(files[idx]));
+    }
+  }
+  while (!outstanding.empty()) {
+    waitForOldest();
+  }
+  return bytes;
+}
+}
 
 int main(int argc, char* argv[]) {
   folly::init(&argc, &argv);
@@ -34,6 +216,14 @@ int main(int argc, char* argv[]) {
     fprintf(stderr, "error: --edenDir must be specified\n");
     return EX_USAGE;
   }
+  if (FLAGS_manifestIterations < 1 || FLAGS_importers < 1 ||
+      FLAGS_inFlight < 1 || FLAGS_batchSize < 0) {
+    fprintf(
+        stderr,
+        "error: --manifestIterations, --importers and --inFlight must be "
+        "positive, and --batchSize must not be negative\n");
+    return EX_USAGE;
+  }
   auto rocksPath =
       canonicalPath(FLAGS_edenDir) + RelativePathPiece{"storage/rocks-db"};
 
@@ -43,9 +233,72 @@ int main(int argc, char* argv[]) {
   }
 
   LocalStore store(rocksPath);
-  HgImporter importer(repoPath, &store);
-  auto rootHash = importer.importManifest(revName);
+  std::vector<std::unique_ptr<HgImporter>> importers;
+  importers.push_back(std::make_unique<HgImporter>(repoPath, &store));
+
+  Hash rootHash;
+  auto manifestStart = getCounters(importers);
+  for (int n = 0; n < FLAGS_manifestIterations; ++n) {
+    rootHash = importers[0]->importManifest(revName);
+  }
+  auto manifestEnd = getCounters(importers);
   printf("Imported root tree: %s\n", rootHash.toString().c_str());
+  printf(
+      "importManifest: %.3fs per import\n",
+      duration<double>(manifestEnd.time - manifestStart.time).count() /
+          FLAGS_manifestIterations);
+  printCounters(manifestStart, manifestEnd);
+
+  if (FLAGS_files == 0) {
+    return EX_OK;
+  }
+
+  auto maxFiles = FLAGS_files < 0 ? std::numeric_limits<size_t>::max()
+                                  : static_cast<size_t>(FLAGS_files);
+  auto files = collectFiles(store, rootHash, maxFiles);
+  // Start the extra helper processes before timing anything: they take a
+  // while to load mercurial.
+  while (importers.size() < static_cast<size_t>(FLAGS_importers)) {
+    importers.push_back(std::make_unique<HgImporter>(repoPath, &store));
+  }
+
+  std::vector<uint64_t> bytesPerImporter(importers.size());
+  std::vector<std::thread> threads;
+  auto filesStart = getCounters(importers);
+  auto perImporter = (files.size() + importers.size() - 1) / importers.size();
+  for (size_t n = 0; n < importers.size(); ++n) {
+    auto begin = std::min(n * perImporter, files.size());
+    auto end = std::min(begin + perImporter, files.size());
+    threads.emplace_back([&, n, begin, end] {
+      bytesPerImporter[n] = importFiles(*importers[n], files, begin, end);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto filesEnd = getCounters(importers);
+
+  uint64_t totalBytes = 0;
+  for (auto bytes : bytesPerImporter) {
+    totalBytes += bytes;
+  }
+  auto seconds = duration<double>(filesEnd.time - filesStart.time).count();
+  printf(
+      "importFileContents: %lu files, %.2f MB in %.3fs with %d importers, "
+      "%d in flight each, %s\n",
+      static_cast<unsigned long>(files.size()),
+      toMB(totalBytes),
+      seconds,
+      FLAGS_importers,
+      FLAGS_inFlight,
+      FLAGS_batchSize > 0
+          ? folly::to<std::string>("batches of ", FLAGS_batchSize).c_str()
+          : "unbatched");
+  printf(
+      "  throughput: %.1f files/s, %.2f MB/s\n",
+      files.size() / seconds,
+      toMB(totalBytes) / seconds);
+  printCounters(filesStart, filesEnd);
 
   return EX_OK;
 }
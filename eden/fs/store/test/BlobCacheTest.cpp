@@ -0,0 +1,100 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/io/IOBuf.h>
+#include <gtest/gtest.h>
+#include "eden/fs/model/Blob.h"
+#include "eden/fs/store/BlobCache.h"
+
+using namespace facebook::eden;
+using folly::IOBuf;
+using std::make_shared;
+using std::shared_ptr;
+
+namespace {
+shared_ptr<const Blob> makeBlob(const std::string& hash, size_t size) {
+  std::string contents(size, 'x');
+  return make_shared<Blob>(
+      Hash(hash), IOBuf(IOBuf::COPY_BUFFER, contents.data(), contents.size()));
+}
+
+const std::string kHash1 = "1111111111111111111111111111111111111111";
+const std::string kHash2 = "2222222222222222222222222222222222222222";
+const std::string kHash3 = "3333333333333333333333333333333333333333";
+}
+
+TEST(BlobCache, getAndInsert) {
+  BlobCache cache(1024 * 1024);
+  EXPECT_EQ(nullptr, cache.get(Hash(kHash1)));
+
+  auto blob = makeBlob(kHash1, 100);
+  cache.insert(blob);
+  EXPECT_EQ(blob, cache.get(Hash(kHash1)));
+
+  auto stats = cache.getStats();
+  EXPECT_EQ(1, stats.hits);
+  EXPECT_EQ(1, stats.misses);
+  EXPECT_EQ(1, stats.numEntries);
+  EXPECT_EQ(BlobCache::estimateSize(*blob), stats.totalBytes);
+}
+
+TEST(BlobCache, evictsLeastRecentlyUsed) {
+  auto blob1 = makeBlob(kHash1, 1000);
+  auto blob2 = makeBlob(kHash2, 1000);
+  auto blob3 = makeBlob(kHash3, 1000);
+  auto size = BlobCache::estimateSize(*blob1);
+  BlobCache cache(size * 2 + size / 2);
+
+  cache.insert(blob1);
+  cache.insert(blob2);
+  // Touch blob1 so that blob2 is the least recently used.
+  EXPECT_EQ(blob1, cache.get(Hash(kHash1)));
+  cache.insert(blob3);
+
+  EXPECT_EQ(blob1, cache.get(Hash(kHash1)));
+  EXPECT_EQ(nullptr, cache.get(Hash(kHash2)));
+  EXPECT_EQ(blob3, cache.get(Hash(kHash3)));
+  EXPECT_EQ(1, cache.getStats().evictions);
+  EXPECT_EQ(size * 2, cache.getStats().totalBytes);
+}
+
+TEST(BlobCache, doesNotCacheOversizedBlobs) {
+  auto blob = makeBlob(kHash1, 1000);
+  BlobCache cache(BlobCache::estimateSize(*blob) - 1);
+  cache.insert(blob);
+  EXPECT_EQ(nullptr, cache.get(Hash(kHash1)));
+  EXPECT_EQ(0, cache.getStats().numEntries);
+}
+
+TEST(BlobCache, disabled) {
+  BlobCache cache(0);
+  cache.insert(makeBlob(kHash1, 10));
+  EXPECT_EQ(nullptr, cache.get(Hash(kHash1)));
+}
+
+TEST(BlobCache, setMaxBytes) {
+  auto blob1 = makeBlob(kHash1, 1000);
+  auto blob2 = makeBlob(kHash2, 1000);
+  auto size = BlobCache::estimateSize(*blob1);
+  BlobCache cache(size * 2);
+  cache.insert(blob1);
+  cache.insert(blob2);
+
+  // Shrinking the cache evicts the least recently used Blob right away.
+  cache.setMaxBytes(size);
+  EXPECT_EQ(size, cache.getMaxBytes());
+  EXPECT_EQ(nullptr, cache.get(Hash(kHash1)));
+  EXPECT_EQ(blob2, cache.get(Hash(kHash2)));
+  EXPECT_EQ(1, cache.getStats().evictions);
+
+  cache.setMaxBytes(size * 2);
+  cache.insert(blob1);
+  EXPECT_EQ(blob1, cache.get(Hash(kHash1)));
+  EXPECT_EQ(blob2, cache.get(Hash(kHash2)));
+}
@@ -0,0 +1,116 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <boost/filesystem.hpp>
+#include <folly/experimental/TestUtil.h>
+#include <folly/io/IOBuf.h>
+#include <gtest/gtest.h>
+#include "eden/fs/model/Blob.h"
+#include "eden/fs/store/BlobPack.h"
+
+using namespace facebook::eden;
+using folly::IOBuf;
+using folly::StringPiece;
+using folly::test::TemporaryDirectory;
+
+namespace {
+Blob makeBlob(const std::string& hash, size_t size, char fill) {
+  std::string contents(size, fill);
+  return Blob(
+      Hash(hash), IOBuf(IOBuf::COPY_BUFFER, contents.data(), contents.size()));
+}
+
+std::string getContents(const Blob& blob) {
+  return StringPiece{blob.getContents().clone()->coalesce()}.str();
+}
+
+const std::string kHash1 = "1111111111111111111111111111111111111111";
+const std::string kHash2 = "2222222222222222222222222222222222222222";
+const std::string kHash3 = "3333333333333333333333333333333333333333";
+const std::string kHash4 = "4444444444444444444444444444444444444444";
+
+class BlobPackTest : public ::testing::Test {
+ protected:
+  AbsolutePath getDir() const {
+    return AbsolutePath{testDir_.path().string()};
+  }
+
+  TemporaryDirectory testDir_{"eden_blob_pack_test"};
+};
+}
+
+TEST_F(BlobPackTest, getAndInsert) {
+  BlobPack pack(getDir(), 1024 * 1024, 64 * 1024);
+  EXPECT_EQ(nullptr, pack.get(Hash(kHash1)));
+
+  auto packed = pack.insert(makeBlob(kHash1, 100, 'a'));
+  ASSERT_NE(nullptr, packed);
+  EXPECT_EQ(Hash(kHash1), packed->getHash());
+  EXPECT_EQ(std::string(100, 'a'), getContents(*packed));
+
+  auto blob = pack.get(Hash(kHash1));
+  ASSERT_NE(nullptr, blob);
+  EXPECT_EQ(std::string(100, 'a'), getContents(*blob));
+  // Both Blobs refer to the same mapped bytes rather than to copies.
+  EXPECT_EQ(packed->getContents().data(), blob->getContents().data());
+
+  auto stats = pack.getStats();
+  EXPECT_EQ(1, stats.hits);
+  EXPECT_EQ(1, stats.misses);
+  EXPECT_EQ(1, stats.numEntries);
+  EXPECT_EQ(1, stats.numSegments);
+}
+
+TEST_F(BlobPackTest, segmentFilesAreUnlinked) {
+  BlobPack pack(getDir(), 1024 * 1024, 64 * 1024);
+  ASSERT_NE(nullptr, pack.insert(makeBlob(kHash1, 100, 'a')));
+  EXPECT_TRUE(boost::filesystem::is_empty(testDir_.path()));
+}
+
+TEST_F(BlobPackTest, blobsLargerThanASegmentAreNotStored) {
+  BlobPack pack(getDir(), 1024 * 1024, 4096);
+  EXPECT_EQ(nullptr, pack.insert(makeBlob(kHash1, 4097, 'a')));
+  EXPECT_EQ(nullptr, pack.get(Hash(kHash1)));
+}
+
+TEST_F(BlobPackTest, dropsOldestSegment) {
+  // Two segments, each with room for one Blob.
+  BlobPack pack(getDir(), 8192, 4096);
+  auto blob1 = pack.insert(makeBlob(kHash1, 3000, 'a'));
+  pack.insert(makeBlob(kHash2, 3000, 'b'));
+  pack.insert(makeBlob(kHash3, 3000, 'c'));
+
+  EXPECT_EQ(nullptr, pack.get(Hash(kHash1)));
+  EXPECT_NE(nullptr, pack.get(Hash(kHash3)));
+  auto stats = pack.getStats();
+  EXPECT_EQ(1, stats.evictions);
+  EXPECT_EQ(2, stats.numSegments);
+
+  // Blobs still in use stay readable after their segment is dropped.
+  EXPECT_EQ(std::string(3000, 'a'), getContents(*blob1));
+}
+
+TEST_F(BlobPackTest, readsKeepBlobsInThePack) {
+  BlobPack pack(getDir(), 8192, 4096);
+  pack.insert(makeBlob(kHash1, 3000, 'a'));
+  pack.insert(makeBlob(kHash2, 3000, 'b'));
+
+  // Reading blob1 out of the oldest segment copies it forward, so the next
+  // insert drops blob2's segment instead.
+  auto blob1 = pack.get(Hash(kHash1));
+  ASSERT_NE(nullptr, blob1);
+  EXPECT_EQ(1, pack.getStats().promotions);
+  pack.insert(makeBlob(kHash3, 3000, 'c'));
+
+  blob1 = pack.get(Hash(kHash1));
+  ASSERT_NE(nullptr, blob1);
+  EXPECT_EQ(std::string(3000, 'a'), getContents(*blob1));
+  EXPECT_EQ(nullptr, pack.get(Hash(kHash2)));
+  EXPECT_NE(nullptr, pack.get(Hash(kHash3)));
+}
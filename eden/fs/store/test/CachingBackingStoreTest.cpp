@@ -0,0 +1,183 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/store/CachingBackingStore.h"
+
+#include <folly/Conv.h>
+#include <folly/experimental/TestUtil.h>
+#include <folly/futures/Future.h>
+#include <gtest/gtest.h>
+#include <unordered_map>
+#include "eden/fs/model/Blob.h"
+#include "eden/fs/model/NativeTree.h"
+#include "eden/fs/model/Tree.h"
+#include "eden/fs/store/LocalStore.h"
+#include "eden/fs/testharness/FakeBackingStore.h"
+
+using namespace facebook::eden;
+using folly::IOBuf;
+using folly::Optional;
+using folly::test::TemporaryDirectory;
+using std::make_shared;
+using std::shared_ptr;
+using std::vector;
+using ObjectType = SharedObjectCache::ObjectType;
+
+namespace {
+/**
+ * An in-memory SharedObjectCache.
+ */
+class FakeSharedObjectCache : public SharedObjectCache {
+ public:
+  folly::Future<vector<Optional<IOBuf>>> get(
+      ObjectType type,
+      const vector<Hash>& ids) override {
+    ++numRequests;
+    if (fail) {
+      return folly::makeFuture<vector<Optional<IOBuf>>>(
+          std::runtime_error("cache unavailable"));
+    }
+    vector<Optional<IOBuf>> results;
+    for (const auto& id : ids) {
+      auto it = objects.find(std::make_pair(type, id));
+      if (it == objects.end()) {
+        results.emplace_back();
+      } else {
+        results.emplace_back(it->second);
+      }
+    }
+    return folly::makeFuture(std::move(results));
+  }
+
+  void put(ObjectType type, const Hash& id, const IOBuf& data) override {
+    objects[std::make_pair(type, id)] = data;
+  }
+
+  bool has(ObjectType type, const Hash& id) const {
+    return objects.count(std::make_pair(type, id)) != 0;
+  }
+
+  struct KeyHasher {
+    size_t operator()(const std::pair<ObjectType, Hash>& key) const {
+      return std::hash<Hash>()(key.second) ^ static_cast<size_t>(key.first);
+    }
+  };
+
+  std::unordered_map<std::pair<ObjectType, Hash>, IOBuf, KeyHasher> objects;
+  size_t numRequests{0};
+  bool fail{false};
+};
+
+std::string blobContents(const Blob& blob) {
+  return blob.getContents().clone()->moveToFbString().toStdString();
+}
+}
+
+class CachingBackingStoreTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    testDir_ = std::make_unique<TemporaryDirectory>("eden_test");
+    localStore_ =
+        make_shared<LocalStore>(AbsolutePathPiece{testDir_->path().string()});
+    innerStore_ = make_shared<FakeBackingStore>(localStore_);
+    cache_ = make_shared<FakeSharedObjectCache>();
+    store_ = std::make_unique<CachingBackingStore>(
+        innerStore_,
+        cache_,
+        localStore_.get(),
+        true,
+        std::chrono::milliseconds(1000),
+        2);
+  }
+
+  std::unique_ptr<TemporaryDirectory> testDir_;
+  shared_ptr<LocalStore> localStore_;
+  shared_ptr<FakeBackingStore> innerStore_;
+  shared_ptr<FakeSharedObjectCache> cache_;
+  std::unique_ptr<CachingBackingStore> store_;
+};
+
+TEST_F(CachingBackingStoreTest, blobFromSharedCache) {
+  auto blob = FakeBackingStore::makeBlob("shared contents");
+  cache_->put(ObjectType::BLOB, blob.getHash(), blob.getContents());
+
+  // The inner store does not have this blob, so it must come from the cache.
+  auto result = store_->getBlob(blob.getHash()).get();
+  EXPECT_EQ("shared contents", blobContents(*result));
+}
+
+TEST_F(CachingBackingStoreTest, blobMissFetchesFromInnerStore) {
+  auto* storedBlob = innerStore_->putBlob("local contents");
+  storedBlob->setReady();
+  auto id = storedBlob->get().getHash();
+
+  auto result = store_->getBlob(id).get();
+  EXPECT_EQ("local contents", blobContents(*result));
+  EXPECT_TRUE(cache_->has(ObjectType::BLOB, id));
+}
+
+TEST_F(CachingBackingStoreTest, cacheErrorsFallBackToInnerStore) {
+  auto* storedBlob = innerStore_->putBlob("local contents");
+  storedBlob->setReady();
+  cache_->fail = true;
+
+  auto result = store_->getBlob(storedBlob->get().getHash()).get();
+  EXPECT_EQ("local contents", blobContents(*result));
+}
+
+TEST_F(CachingBackingStoreTest, getBlobsIsBatched) {
+  vector<Hash> ids;
+  for (int n = 0; n < 5; ++n) {
+    auto blob = FakeBackingStore::makeBlob(folly::to<std::string>("blob", n));
+    cache_->put(ObjectType::BLOB, blob.getHash(), blob.getContents());
+    ids.push_back(blob.getHash());
+  }
+  auto* storedBlob = innerStore_->putBlob("not shared");
+  storedBlob->setReady();
+  ids.push_back(storedBlob->get().getHash());
+
+  auto results = store_->getBlobs(ids);
+  ASSERT_EQ(6, results.size());
+  EXPECT_EQ(3, cache_->numRequests);
+  for (int n = 0; n < 5; ++n) {
+    EXPECT_EQ(
+        folly::to<std::string>("blob", n), blobContents(*results[n].get()));
+  }
+  EXPECT_EQ("not shared", blobContents(*results[5].get()));
+}
+
+TEST_F(CachingBackingStoreTest, treeFromSharedCacheIsStoredLocally) {
+  auto blob = FakeBackingStore::makeBlob("contents");
+  Hash treeID("0123456789abcdef0123456789abcdef01234567");
+  vector<TreeEntry> entries;
+  entries.emplace_back(
+      blob.getHash(), "file.txt", FileType::REGULAR_FILE, 0b110);
+  Tree tree(std::move(entries), treeID);
+  cache_->put(ObjectType::TREE, treeID, serializeNativeTree(tree));
+
+  auto result = store_->getTree(treeID).get();
+  ASSERT_EQ(1, result->getTreeEntries().size());
+  EXPECT_EQ("file.txt", result->getTreeEntries()[0].getName().stringPiece());
+  EXPECT_TRUE(localStore_->getTree(treeID));
+}
+
+TEST_F(CachingBackingStoreTest, treesBypassCacheWhenDisabled) {
+  CachingBackingStore store(
+      innerStore_,
+      cache_,
+      localStore_.get(),
+      false,
+      std::chrono::milliseconds(1000),
+      2);
+  auto* storedTree = innerStore_->putTree(vector<TreeEntry>{});
+  storedTree->setReady();
+
+  store.getTree(storedTree->get().getHash()).get();
+  EXPECT_EQ(0, cache_->numRequests);
+}
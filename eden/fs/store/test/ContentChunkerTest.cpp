@@ -0,0 +1,105 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/store/ContentChunker.h"
+
+#include <folly/io/IOBuf.h>
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+#include <random>
+#include <string>
+
+using namespace facebook::eden;
+using folly::IOBuf;
+using std::string;
+
+namespace {
+constexpr size_t kMinSize = 1024;
+constexpr size_t kAverageSize = 4096;
+constexpr size_t kMaxSize = 16 * 1024;
+
+string randomData(size_t size, uint32_t seed) {
+  std::mt19937 rng(seed);
+  string data(size, '\0');
+  for (auto& c : data) {
+    c = static_cast<char>(rng());
+  }
+  return data;
+}
+
+std::vector<size_t> findChunks(const string& data) {
+  return findContentDefinedChunks(
+      IOBuf{IOBuf::WRAP_BUFFER, folly::ByteRange{folly::StringPiece{data}}},
+      kMinSize,
+      kAverageSize,
+      kMaxSize);
+}
+
+/** Returns the chunks of data, as strings */
+std::vector<string> splitChunks(const string& data) {
+  std::vector<string> chunks;
+  size_t offset = 0;
+  for (auto length : findChunks(data)) {
+    chunks.push_back(data.substr(offset, length));
+    offset += length;
+  }
+  return chunks;
+}
+}
+
+TEST(ContentChunker, chunksCoverDataWithinBounds) {
+  auto data = randomData(1024 * 1024, 1);
+  auto chunks = findChunks(data);
+  EXPECT_EQ(
+      data.size(), std::accumulate(chunks.begin(), chunks.end(), size_t{0}));
+  for (size_t n = 0; n < chunks.size(); ++n) {
+    EXPECT_LE(chunks[n], kMaxSize);
+    if (n + 1 < chunks.size()) {
+      EXPECT_GE(chunks[n], kMinSize);
+    }
+  }
+  // The average chunk length is roughly kMinSize + kAverageSize.
+  auto average = data.size() / chunks.size();
+  EXPECT_GT(average, kAverageSize / 2);
+  EXPECT_LT(average, 2 * (kMinSize + kAverageSize));
+}
+
+TEST(ContentChunker, chainedBuffersGiveTheSameChunks) {
+  auto data = randomData(256 * 1024, 2);
+  auto buf = IOBuf::copyBuffer(data.data(), 1000);
+  buf->prependChain(IOBuf::copyBuffer(data.data() + 1000, data.size() - 1000));
+  EXPECT_EQ(
+      findChunks(data),
+      findContentDefinedChunks(*buf, kMinSize, kAverageSize, kMaxSize));
+}
+
+TEST(ContentChunker, insertionOnlyChangesNearbyChunks) {
+  auto data = randomData(512 * 1024, 3);
+  auto edited = data;
+  edited.insert(200 * 1024, "some inserted text");
+
+  auto original = splitChunks(data);
+  auto changed = splitChunks(edited);
+  std::sort(original.begin(), original.end());
+  std::sort(changed.begin(), changed.end());
+  std::vector<string> shared;
+  std::set_intersection(
+      original.begin(),
+      original.end(),
+      changed.begin(),
+      changed.end(),
+      std::back_inserter(shared));
+  EXPECT_GE(shared.size() + 3, original.size());
+}
+
+TEST(ContentChunker, emptyData) {
+  EXPECT_TRUE(findChunks("").empty());
+}
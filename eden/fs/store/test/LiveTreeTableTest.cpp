@@ -0,0 +1,77 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Conv.h>
+#include <gtest/gtest.h>
+#include "eden/fs/model/Tree.h"
+#include "eden/fs/store/LiveTreeTable.h"
+#include "eden/fs/store/TreeCache.h"
+
+using namespace facebook::eden;
+using std::make_shared;
+using std::shared_ptr;
+
+namespace {
+shared_ptr<const Tree> makeTree(const std::string& hash) {
+  std::vector<TreeEntry> entries;
+  entries.emplace_back(
+      Hash("0123456789abcdef0123456789abcdef01234567"),
+      "file",
+      FileType::REGULAR_FILE,
+      0b110);
+  return make_shared<Tree>(std::move(entries), Hash(hash));
+}
+
+const std::string kHash1 = "1111111111111111111111111111111111111111";
+const std::string kHash2 = "2222222222222222222222222222222222222222";
+}
+
+TEST(LiveTreeTable, internSharesTreesInUse) {
+  LiveTreeTable table(4);
+  EXPECT_EQ(nullptr, table.get(Hash(kHash1)));
+
+  auto tree = makeTree(kHash1);
+  EXPECT_EQ(tree, table.intern(tree));
+  // A second copy of the same Tree is replaced with the first.
+  EXPECT_EQ(tree, table.intern(makeTree(kHash1)));
+  EXPECT_EQ(tree, table.get(Hash(kHash1)));
+  EXPECT_EQ(nullptr, table.get(Hash(kHash2)));
+
+  auto stats = table.getStats();
+  EXPECT_EQ(2, stats.hits);
+  EXPECT_EQ(3, stats.misses);
+  EXPECT_EQ(1, stats.numTrees);
+  EXPECT_EQ(TreeCache::estimateSize(*tree), stats.totalBytes);
+}
+
+TEST(LiveTreeTable, forgetsUnusedTrees) {
+  LiveTreeTable table(1);
+  auto tree = makeTree(kHash1);
+  table.intern(tree);
+  tree.reset();
+  EXPECT_EQ(nullptr, table.get(Hash(kHash1)));
+  EXPECT_EQ(0, table.getStats().numTrees);
+
+  // A new copy can take its place.
+  auto replacement = makeTree(kHash1);
+  EXPECT_EQ(replacement, table.intern(replacement));
+  EXPECT_EQ(replacement, table.get(Hash(kHash1)));
+}
+
+TEST(LiveTreeTable, sweepsUnusedTrees) {
+  LiveTreeTable table(1);
+  auto kept = makeTree(kHash1);
+  table.intern(kept);
+  for (size_t n = 0; n < 1000; ++n) {
+    table.intern(makeTree(folly::to<std::string>(
+        "00000000000000000000000000000000", 10000000 + n)));
+  }
+  EXPECT_EQ(kept, table.get(Hash(kHash1)));
+  EXPECT_EQ(1, table.getStats().numTrees);
+}
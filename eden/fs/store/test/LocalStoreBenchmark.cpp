@@ -0,0 +1,403 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Benchmark.h>
+#include <folly/Conv.h>
+#include <folly/Optional.h>
+#include <folly/experimental/TestUtil.h>
+#include <folly/init/Init.h>
+#include <folly/io/IOBuf.h>
+#include <gflags/gflags.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "eden/fs/model/Blob.h"
+#include "eden/fs/model/Hash.h"
+#include "eden/fs/model/Tree.h"
+#include "eden/fs/model/TreeEntry.h"
+#include "eden/fs/store/LocalStore.h"
+
+/*
+ * Throughput and latency of the LocalStore and the RocksDB underneath it.
+ *
+ * The stores are opened with the options given by the flags below, so the
+ * same binary can compare RocksDB configurations, e.g.:
+ *
+ *   LocalStoreBenchmark --blob_compression=lz4 --block_cache_mb=512
+ */
+
+DEFINE_string(
+    store_dir,
+    "",
+    "The directory to create the benchmark stores in.  Defaults to a "
+    "temporary directory, which may be on tmpfs; point this at the disk eden "
+    "runs on to measure it.");
+DEFINE_uint64(block_cache_mb, 128, "LocalStoreOptions::blockCacheSize");
+DEFINE_uint64(
+    blob_block_cache_mb,
+    64,
+    "LocalStoreOptions::blobBlockCacheSize");
+DEFINE_uint64(write_buffer_mb, 8, "LocalStoreOptions::writeBufferSize");
+DEFINE_uint64(
+    blob_write_buffer_mb,
+    64,
+    "LocalStoreOptions::blobWriteBufferSize");
+DEFINE_int32(bloom_bits, 10, "LocalStoreOptions::bloomFilterBitsPerKey");
+DEFINE_string(
+    blob_compression,
+    "zstd",
+    "LocalStoreOptions::blobCompression: none, snappy, lz4 or zstd");
+DEFINE_string(
+    tree_compression,
+    "none",
+    "LocalStoreOptions::treeCompression: none, snappy, lz4 or zstd");
+DEFINE_uint64(
+    compression_dictionary_size,
+    16 * 1024,
+    "LocalStoreOptions::blobCompressionDictionarySize");
+DEFINE_int32(
+    mixed_threads,
+    8,
+    "The number of threads used by the multi-threaded benchmarks");
+
+using namespace facebook::eden;
+using folly::ByteRange;
+using folly::IOBuf;
+using folly::StringPiece;
+using folly::test::TemporaryDirectory;
+
+namespace {
+constexpr size_t kBatchBufferSize = 64 * 1024 * 1024;
+constexpr size_t kMiB = 1024 * 1024;
+// The read benchmarks look up objects from a store populated with up to
+// kPopulateCount objects, or kPopulateBytes of data for large objects, so
+// that lookups go through the block cache and bloom filters rather than
+// only hitting the memtable.
+constexpr size_t kPopulateCount = 10000;
+constexpr size_t kPopulateBytes = 256 * kMiB;
+// The number of distinct blobs that the write benchmarks store under
+// different keys, to bound their memory use.
+constexpr size_t kBlobPoolSize = 64;
+
+LocalStoreOptions getOptions() {
+  LocalStoreOptions options;
+  options.blockCacheSize = FLAGS_block_cache_mb * kMiB;
+  options.blobBlockCacheSize = FLAGS_blob_block_cache_mb * kMiB;
+  options.writeBufferSize = FLAGS_write_buffer_mb * kMiB;
+  options.blobWriteBufferSize = FLAGS_blob_write_buffer_mb * kMiB;
+  options.bloomFilterBitsPerKey = FLAGS_bloom_bits;
+  options.blobCompression = parseLocalStoreCompression(FLAGS_blob_compression);
+  options.treeCompression = parseLocalStoreCompression(FLAGS_tree_compression);
+  options.blobCompressionDictionarySize = FLAGS_compression_dictionary_size;
+  return options;
+}
+
+/**
+ * A LocalStore in a fresh directory, which is removed when the store is
+ * destroyed.
+ */
+class BenchmarkStore {
+ public:
+  BenchmarkStore()
+      : dir_{"eden_bench",
+             FLAGS_store_dir.empty() ? boost::filesystem::path{}
+                                     : FLAGS_store_dir},
+        store_{AbsolutePathPiece{dir_.path().string()}, getOptions()} {}
+
+  LocalStore& operator*() {
+    return store_;
+  }
+  LocalStore* operator->() {
+    return &store_;
+  }
+
+ private:
+  TemporaryDirectory dir_;
+  LocalStore store_;
+};
+
+/**
+ * A store with objects already in it, and the keys they are stored under.
+ */
+struct PopulatedStore {
+  BenchmarkStore store;
+  std::vector<Hash> hashes;
+};
+
+// Keys are never reused across stores or benchmark runs, so that writes
+// always store new objects.
+std::atomic<size_t> nextKey{0};
+
+std::vector<Hash> makeHashes(size_t count) {
+  auto first = nextKey.fetch_add(count);
+  std::vector<Hash> hashes;
+  hashes.reserve(count);
+  for (size_t n = first; n < first + count; ++n) {
+    hashes.push_back(
+        Hash::sha1(ByteRange{StringPiece{folly::to<std::string>(n)}}));
+  }
+  return hashes;
+}
+
+/**
+ * Blob contents that look like source code, so that compression ratios are
+ * realistic.  The seed makes each blob different.
+ */
+IOBuf makeContents(size_t size, size_t seed) {
+  std::string contents;
+  contents.reserve(size + 64);
+  for (size_t line = 0; contents.size() < size; ++line) {
+    folly::toAppend(
+        "  auto value", line, " = computeSomething(", seed, ", ", line, ");\n",
+        &contents);
+  }
+  contents.resize(size);
+  return IOBuf{IOBuf::COPY_BUFFER, contents};
+}
+
+std::vector<Blob> makeBlobPool(size_t blobSize, size_t maxCount) {
+  auto hashes = makeHashes(std::min(kBlobPoolSize, maxCount));
+  std::vector<Blob> blobs;
+  blobs.reserve(hashes.size());
+  for (size_t n = 0; n < hashes.size(); ++n) {
+    blobs.emplace_back(hashes[n], makeContents(blobSize, n));
+  }
+  return blobs;
+}
+
+/**
+ * A Tree with numEntries entries, like a typical source directory.  Every
+ * tree has different entry hashes, and therefore a different hash itself.
+ */
+Tree makeTree(size_t numEntries) {
+  auto hashes = makeHashes(numEntries);
+  std::vector<TreeEntry> entries;
+  entries.reserve(numEntries);
+  for (size_t n = 0; n < numEntries; ++n) {
+    auto name = folly::to<std::string>("source_file_", 100000 + n, ".cpp");
+    entries.emplace_back(hashes[n], name, FileType::REGULAR_FILE, 0b110);
+  }
+  return Tree(std::move(entries));
+}
+
+/**
+ * Returns a store populated with blobs of blobSize bytes.  The store is
+ * shared by all of the read benchmarks with that blob size, since folly
+ * calls each benchmark several times.
+ */
+PopulatedStore& getBlobStore(size_t blobSize) {
+  static std::map<size_t, std::unique_ptr<PopulatedStore>> stores;
+  auto& populated = stores[blobSize];
+  if (!populated) {
+    populated = std::make_unique<PopulatedStore>();
+    auto count = std::min(kPopulateCount, kPopulateBytes / blobSize);
+    populated->hashes = makeHashes(count);
+    auto pool = makeBlobPool(blobSize, count);
+    populated->store->enableBatchMode(kBatchBufferSize);
+    for (size_t n = 0; n < count; ++n) {
+      populated->store->putBlob(populated->hashes[n], &pool[n % pool.size()]);
+    }
+    populated->store->disableBatchMode();
+  }
+  return *populated;
+}
+
+PopulatedStore& getTreeStore(size_t numEntries) {
+  static std::map<size_t, std::unique_ptr<PopulatedStore>> stores;
+  auto& populated = stores[numEntries];
+  if (!populated) {
+    populated = std::make_unique<PopulatedStore>();
+    // Serialized entries take about 60 bytes each.
+    auto count = std::min(kPopulateCount, kPopulateBytes / (numEntries * 60));
+    populated->store->enableBatchMode(kBatchBufferSize);
+    for (size_t n = 0; n < count; ++n) {
+      auto tree = makeTree(numEntries);
+      populated->hashes.push_back(populated->store->putTree(&tree));
+    }
+    populated->store->disableBatchMode();
+  }
+  return *populated;
+}
+
+void putBlob(size_t iters, size_t blobSize, bool batch) {
+  folly::Optional<BenchmarkStore> store;
+  std::vector<Blob> pool;
+  std::vector<Hash> hashes;
+  BENCHMARK_SUSPEND {
+    store.emplace();
+    pool = makeBlobPool(blobSize, iters);
+    hashes = makeHashes(iters);
+  }
+  if (batch) {
+    (*store)->enableBatchMode(kBatchBufferSize);
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    (*store)->putBlob(hashes[n], &pool[n % pool.size()]);
+  }
+  if (batch) {
+    (*store)->disableBatchMode();
+  }
+  BENCHMARK_SUSPEND {
+    store.clear();
+  }
+}
+
+void putTree(size_t iters, size_t numEntries, bool batch) {
+  folly::Optional<BenchmarkStore> store;
+  std::vector<Tree> trees;
+  BENCHMARK_SUSPEND {
+    store.emplace();
+    trees.reserve(iters);
+    for (size_t n = 0; n < iters; ++n) {
+      trees.push_back(makeTree(numEntries));
+    }
+  }
+  if (batch) {
+    (*store)->enableBatchMode(kBatchBufferSize);
+  }
+  for (const auto& tree : trees) {
+    (*store)->putTree(&tree);
+  }
+  if (batch) {
+    (*store)->disableBatchMode();
+  }
+  BENCHMARK_SUSPEND {
+    store.clear();
+  }
+}
+
+/**
+ * Look up stored blobs with fn(store, hash), cycling through all of them.
+ */
+template <typename Fn>
+void readBlobs(size_t iters, size_t blobSize, Fn&& fn) {
+  PopulatedStore* populated;
+  BENCHMARK_SUSPEND {
+    populated = &getBlobStore(blobSize);
+  }
+  const auto& hashes = populated->hashes;
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(
+        fn(*populated->store, hashes[n % hashes.size()]));
+  }
+}
+
+void getRaw(size_t iters, size_t blobSize) {
+  readBlobs(iters, blobSize, [](LocalStore& store, const Hash& hash) {
+    return store.get(LocalStore::BlobFamily, hash).isValid();
+  });
+}
+
+void getBlob(size_t iters, size_t blobSize) {
+  readBlobs(iters, blobSize, [](LocalStore& store, const Hash& hash) {
+    return store.getBlob(hash);
+  });
+}
+
+void getBlobMetadata(size_t iters, size_t blobSize) {
+  readBlobs(iters, blobSize, [](LocalStore& store, const Hash& hash) {
+    return store.getBlobMetadata(hash);
+  });
+}
+
+void getMissing(size_t iters, size_t blobSize) {
+  PopulatedStore* populated;
+  std::vector<Hash> missing;
+  BENCHMARK_SUSPEND {
+    populated = &getBlobStore(blobSize);
+    missing = makeHashes(std::min<size_t>(iters, kPopulateCount));
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(
+        populated->store->getBlob(missing[n % missing.size()]));
+  }
+}
+
+void getTree(size_t iters, size_t numEntries) {
+  PopulatedStore* populated;
+  BENCHMARK_SUSPEND {
+    populated = &getTreeStore(numEntries);
+  }
+  const auto& hashes = populated->hashes;
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(
+        populated->store->getTree(hashes[n % hashes.size()]));
+  }
+}
+
+/**
+ * Spread iters operations over --mixed_threads threads, where one in every
+ * writeOneIn operations stores a new 4KB blob and the rest read existing
+ * ones.
+ */
+void mixedReadWrite(size_t iters, size_t writeOneIn) {
+  constexpr size_t kBlobSize = 4096;
+  PopulatedStore* populated;
+  std::vector<Blob> pool;
+  std::vector<Hash> newHashes;
+  BENCHMARK_SUSPEND {
+    populated = &getBlobStore(kBlobSize);
+    pool = makeBlobPool(kBlobSize, kBlobPoolSize);
+    newHashes = makeHashes(iters / writeOneIn + 1);
+  }
+
+  const auto& hashes = populated->hashes;
+  std::atomic<size_t> nextOp{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < std::max(FLAGS_mixed_threads, 1); ++t) {
+    threads.emplace_back([&] {
+      for (auto n = nextOp++; n < iters; n = nextOp++) {
+        if (n % writeOneIn == 0) {
+          populated->store->putBlob(
+              newHashes[n / writeOneIn], &pool[n % pool.size()]);
+        } else {
+          folly::doNotOptimizeAway(
+              populated->store->getBlob(hashes[n % hashes.size()]));
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+}
+
+BENCHMARK_NAMED_PARAM(putBlob, 1k_unbatched, 1024, false);
+BENCHMARK_NAMED_PARAM(putBlob, 1k_batched, 1024, true);
+BENCHMARK_NAMED_PARAM(putBlob, 64k_unbatched, 64 * 1024, false);
+BENCHMARK_NAMED_PARAM(putBlob, 64k_batched, 64 * 1024, true);
+BENCHMARK_NAMED_PARAM(putTree, 50_unbatched, 50, false);
+BENCHMARK_NAMED_PARAM(putTree, 50_batched, 50, true);
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_NAMED_PARAM(getRaw, 1k, 1024);
+BENCHMARK_NAMED_PARAM(getBlob, 1k, 1024);
+BENCHMARK_NAMED_PARAM(getBlobMetadata, 1k, 1024);
+BENCHMARK_NAMED_PARAM(getMissing, 1k, 1024);
+BENCHMARK_NAMED_PARAM(getTree, 50, 50);
+BENCHMARK_NAMED_PARAM(getTree, 1000, 1000);
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_NAMED_PARAM(getBlob, 1m, 1024 * 1024);
+BENCHMARK_NAMED_PARAM(getBlob, 16m, 16 * 1024 * 1024);
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_NAMED_PARAM(mixedReadWrite, write_1_in_10, 10);
+BENCHMARK_NAMED_PARAM(mixedReadWrite, write_1_in_100, 100);
+
+int main(int argc, char** argv) {
+  folly::init(&argc, &argv);
+  folly::runBenchmarks();
+  return 0;
+}
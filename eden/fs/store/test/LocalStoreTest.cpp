@@ -7,21 +7,35 @@
  *  of patent rights can be found in the PATENTS file in the same directory.
  *
  */
+#include <folly/Conv.h>
 #include <folly/Optional.h>
 #include <folly/String.h>
 #include <folly/experimental/TestUtil.h>
 #include <folly/io/IOBuf.h>
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <random>
+#include <set>
 #include <stdexcept>
+#include <thread>
+#include <unordered_set>
 #include "eden/fs/model/Blob.h"
 #include "eden/fs/model/Hash.h"
+#include "eden/fs/model/NativeTree.h"
 #include "eden/fs/model/Tree.h"
 #include "eden/fs/model/TreeEntry.h"
+#include "common/stats/ServiceData.h"
+#include "eden/fs/rocksdb/RocksDbUtil.h"
+#include "eden/fs/store/ContentChunker.h"
 #include "eden/fs/store/LocalStore.h"
 #include "eden/fs/store/StoreResult.h"
 
 using namespace facebook::eden;
 
+using folly::ByteRange;
 using folly::IOBuf;
 using folly::StringPiece;
 using folly::test::TemporaryDirectory;
@@ -67,6 +81,48 @@ TEST_F(LocalStoreTest, testReadAndWriteBlob) {
   EXPECT_EQ(contents.size(), retreivedMetadata.value().size);
 }
 
+TEST_F(LocalStoreTest, testReadAndWriteChunkedBlob) {
+  Hash hash("4a7ffd9d83d2d7c4dd4c3da8eb3a2e6a6e0ddb1b");
+  string contents;
+  for (size_t n = 0; contents.size() < 5 * LocalStore::kBlobChunkSize / 2;
+       ++n) {
+    contents += folly::to<string>(n, "\n");
+  }
+
+  auto inBlob = Blob{hash, IOBuf{IOBuf::COPY_BUFFER, contents}};
+  store_->putBlob(hash, &inBlob);
+
+  auto outBlob = store_->getBlob(hash);
+  ASSERT_NE(nullptr, outBlob);
+  EXPECT_EQ(
+      contents, outBlob->getContents().clone()->moveToFbString().toStdString());
+  EXPECT_EQ(contents.size(), store_->getBlobMetadata(hash).value().size);
+
+  // A range that spans a chunk boundary.
+  auto offset = LocalStore::kBlobChunkSize - 10;
+  auto range = store_->getBlobRange(hash, offset, 100);
+  ASSERT_NE(nullptr, range);
+  EXPECT_EQ(
+      contents.substr(offset, 100), range->moveToFbString().toStdString());
+
+  // A range that runs past the end of the blob.
+  range = store_->getBlobRange(hash, contents.size() - 10, 100);
+  ASSERT_NE(nullptr, range);
+  EXPECT_EQ(
+      contents.substr(contents.size() - 10),
+      range->moveToFbString().toStdString());
+
+  range = store_->getBlobRange(hash, contents.size(), 100);
+  ASSERT_NE(nullptr, range);
+  EXPECT_EQ(0, range->computeChainDataLength());
+
+  // Small blobs are not stored in chunks.
+  Hash smallHash("3a8f8eb91101860fd8484154885838bf322964d0");
+  auto smallBlob = Blob{smallHash, IOBuf{IOBuf::COPY_BUFFER, "small"}};
+  store_->putBlob(smallHash, &smallBlob);
+  EXPECT_EQ(nullptr, store_->getBlobRange(smallHash, 0, 5));
+}
+
 TEST_F(LocalStoreTest, testReadNonexistent) {
   Hash hash("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
   EXPECT_TRUE(nullptr == store_->getBlob(hash));
@@ -113,7 +169,8 @@ TEST_F(LocalStoreTest, testReadsAndWriteTree) {
       string("100644 xdebug.ini\x00", 18),
       unhexlify("9ed5bbccd1b9b0077561d14c0130dc086ab27e04"));
 
-  store_->put(hash.getBytes(), folly::StringPiece{gitTreeObject});
+  store_->put(
+      LocalStore::TreeFamily, hash, folly::StringPiece{gitTreeObject});
   auto tree = store_->getTree(hash);
   EXPECT_EQ(Hash("8e073e366ed82de6465d1209d3f07da7eebabb93"), tree->getHash());
   EXPECT_EQ(11, tree->getTreeEntries().size());
@@ -127,19 +184,490 @@ TEST_F(LocalStoreTest, testReadsAndWriteTree) {
   EXPECT_EQ(0b0110, readmeEntry.getOwnerPermissions());
 }
 
+TEST_F(LocalStoreTest, testPutTreeUsesNativeFormat) {
+  Hash blobHash("3a8f8eb91101860fd8484154885838bf322964d0");
+  Hash treeHash("8e073e366ed82de6465d1209d3f07da7eebabb93");
+  std::vector<TreeEntry> entries;
+  entries.emplace_back(blobHash, "README", FileType::REGULAR_FILE, 0b110);
+  entries.emplace_back(treeHash, "src", FileType::DIRECTORY, 0b111);
+  Tree tree(std::move(entries));
+
+  // Trees without a hash are keyed by the hash of their git serialization,
+  // as they always have been, but stored in the native format.
+  auto id = store_->putTree(&tree);
+  EXPECT_EQ(store_->serializeTree(&tree).first, id);
+  EXPECT_TRUE(isNativeTree(store_->get(LocalStore::TreeFamily, id).bytes()));
+
+  auto result = store_->getTree(id);
+  ASSERT_TRUE(result);
+  EXPECT_EQ(id, result->getHash());
+  ASSERT_EQ(2, result->getTreeEntries().size());
+  EXPECT_EQ("README", result->getEntryAt(0).getName());
+  EXPECT_EQ(blobHash, result->getEntryAt(0).getHash());
+  EXPECT_EQ("src", result->getEntryAt(1).getName());
+  EXPECT_EQ(TreeEntryType::TREE, result->getEntryAt(1).getType());
+}
+
+TEST_F(LocalStoreTest, testGetTreeView) {
+  Hash blobHash("3a8f8eb91101860fd8484154885838bf322964d0");
+  std::vector<TreeEntry> entries;
+  entries.emplace_back(blobHash, "README", FileType::REGULAR_FILE, 0b110);
+  Tree tree(std::move(entries));
+  auto id = store_->putTree(&tree);
+
+  auto view = store_->getTreeView(id);
+  ASSERT_TRUE(view);
+  EXPECT_EQ(id, view->getHash());
+  ASSERT_EQ(1, view->size());
+  auto entry = view->getEntry(PathComponentPiece{"README"});
+  ASSERT_TRUE(entry.hasValue());
+  EXPECT_EQ(blobHash, entry->getHash());
+
+  EXPECT_FALSE(
+      store_->getTreeView(Hash("0000000000000000000000000000000000000000")));
+}
+
 TEST_F(LocalStoreTest, testGetResult) {
   StringPiece key1 = "foo";
   StringPiece key2 = "bar";
 
-  EXPECT_FALSE(store_->get(key1).isValid());
-  EXPECT_FALSE(store_->get(key2).isValid());
+  EXPECT_FALSE(store_->get(LocalStore::BlobFamily, key1).isValid());
+  EXPECT_FALSE(store_->get(LocalStore::BlobFamily, key2).isValid());
 
-  store_->put(key1, StringPiece{"hello world"});
-  auto result1 = store_->get(key1);
+  store_->put(LocalStore::BlobFamily, key1, StringPiece{"hello world"});
+  auto result1 = store_->get(LocalStore::BlobFamily, key1);
   ASSERT_TRUE(result1.isValid());
   EXPECT_EQ("hello world", result1.piece());
 
-  auto result2 = store_->get(key2);
+  auto result2 = store_->get(LocalStore::BlobFamily, key2);
   EXPECT_FALSE(result2.isValid());
   EXPECT_THROW(result2.piece(), std::domain_error);
 }
+
+TEST_F(LocalStoreTest, testCommitRootTree) {
+  Hash commitID("d00b4b6c9d1b6b8b5e4c1b3c6d6c8f3a1e5b7c9d");
+  Hash rootTreeID("8e073e366ed82de6465d1209d3f07da7eebabb93");
+
+  EXPECT_FALSE(store_->getCommitRootTree(commitID).hasValue());
+
+  store_->putCommitRootTree(commitID, rootTreeID);
+  auto result = store_->getCommitRootTree(commitID);
+  ASSERT_TRUE(result.hasValue());
+  EXPECT_EQ(rootTreeID, result.value());
+
+  // The mapping is stored in its own key space
+  EXPECT_FALSE(store_->hasKey(LocalStore::TreeFamily, commitID));
+}
+
+TEST_F(LocalStoreTest, testKeySpacesAreIndependent) {
+  StringPiece key = "foo";
+  store_->put(LocalStore::BlobFamily, key, StringPiece{"blob data"});
+  store_->put(LocalStore::TreeFamily, key, StringPiece{"tree data"});
+
+  EXPECT_EQ("blob data", store_->get(LocalStore::BlobFamily, key).piece());
+  EXPECT_EQ("tree data", store_->get(LocalStore::TreeFamily, key).piece());
+  EXPECT_FALSE(store_->hasKey(LocalStore::HgProxyHashFamily, key));
+}
+
+TEST(LocalStoreLegacyTest, readsDataWrittenWithKeySuffixes) {
+  TemporaryDirectory testDir("eden_test");
+  auto path = testDir.path().string();
+  Hash commitID("d00b4b6c9d1b6b8b5e4c1b3c6d6c8f3a1e5b7c9d");
+  Hash rootTreeID("8e073e366ed82de6465d1209d3f07da7eebabb93");
+
+  {
+    // Older versions of eden stored everything in the default column
+    // family, distinguishing key types with a suffix.
+    auto db = createRocksDb(path);
+    auto key = StringPiece{commitID.getBytes()}.str() + "hgc";
+    auto status = db->Put(
+        rocksdb::WriteOptions(),
+        key,
+        rocksdb::Slice{
+            reinterpret_cast<const char*>(rootTreeID.getBytes().data()),
+            Hash::RAW_SIZE});
+    ASSERT_TRUE(status.ok());
+  }
+
+  LocalStore store(AbsolutePathPiece{path});
+  auto result = store.getCommitRootTree(commitID);
+  ASSERT_TRUE(result.hasValue());
+  EXPECT_EQ(rootTreeID, result.value());
+  EXPECT_FALSE(store.getCommitRootTree(rootTreeID).hasValue());
+}
+
+TEST(LocalStoreOptionsTest, opensWithCustomOptions) {
+  TemporaryDirectory testDir("eden_test");
+  LocalStoreOptions options;
+  options.blockCacheSize = 1024 * 1024;
+  options.blobBlockCacheSize = 1024 * 1024;
+  options.writeBufferSize = 1024 * 1024;
+  options.blobWriteBufferSize = 1024 * 1024;
+  options.bloomFilterBitsPerKey = 0;
+  options.backgroundThreads = 1;
+  LocalStore store(AbsolutePathPiece{testDir.path().string()}, options);
+
+  Hash hash("3a8f8eb91101860fd8484154885838bf322964d0");
+  auto blob = Blob{hash, IOBuf{IOBuf::COPY_BUFFER, "hello world"}};
+  store.putBlob(hash, &blob);
+  EXPECT_EQ(11, store.getBlobMetadata(hash).value().size);
+}
+
+TEST_F(LocalStoreTest, testGetBatch) {
+  Hash hash1("3a8f8eb91101860fd8484154885838bf322964d0");
+  Hash hash2("8e073e366ed82de6465d1209d3f07da7eebabb93");
+  Hash hash3("d00b4b6c9d1b6b8b5e4c1b3c6d6c8f3a1e5b7c9d");
+  store_->put(LocalStore::BlobFamily, hash1, StringPiece{"one"});
+  store_->put(LocalStore::BlobFamily, hash3, StringPiece{"three"});
+
+  auto results =
+      store_->getBatch(LocalStore::BlobFamily, {hash1, hash2, hash3});
+  ASSERT_EQ(3, results.size());
+  EXPECT_EQ("one", results[0].piece());
+  EXPECT_FALSE(results[1].isValid());
+  EXPECT_EQ("three", results[2].piece());
+
+  auto metadata = store_->getBlobMetadataBatch({hash1});
+  ASSERT_EQ(1, metadata.size());
+  EXPECT_FALSE(metadata[0].hasValue());
+}
+
+TEST(LocalStoreOptionsTest, parseCompression) {
+  EXPECT_EQ(LocalStoreCompression::None, parseLocalStoreCompression("none"));
+  EXPECT_EQ(
+      LocalStoreCompression::Snappy, parseLocalStoreCompression("snappy"));
+  EXPECT_EQ(LocalStoreCompression::LZ4, parseLocalStoreCompression("lz4"));
+  EXPECT_EQ(LocalStoreCompression::Zstd, parseLocalStoreCompression("zstd"));
+  EXPECT_THROW(parseLocalStoreCompression("gzip"), std::invalid_argument);
+  EXPECT_THROW(parseLocalStoreCompression(""), std::invalid_argument);
+}
+
+TEST_F(LocalStoreTest, testSetCompression) {
+  Hash hash("3a8f8eb91101860fd8484154885838bf322964d0");
+  store_->put(LocalStore::BlobFamily, hash, StringPiece{"before"});
+
+  store_->setCompression(LocalStore::BlobFamily, LocalStoreCompression::None);
+  // Setting the current compression again is a no-op.
+  store_->setCompression(LocalStore::BlobFamily, LocalStoreCompression::None);
+  store_->setCompression(LocalStore::TreeFamily, LocalStoreCompression::None);
+
+  Hash hash2("8e073e366ed82de6465d1209d3f07da7eebabb93");
+  store_->put(LocalStore::BlobFamily, hash2, StringPiece{"after"});
+  EXPECT_EQ("before", store_->get(LocalStore::BlobFamily, hash).piece());
+  EXPECT_EQ("after", store_->get(LocalStore::BlobFamily, hash2).piece());
+}
+
+TEST_F(LocalStoreTest, testCollectGarbage) {
+  Hash hash1("3a8f8eb91101860fd8484154885838bf322964d0");
+  Hash hash2("8e073e366ed82de6465d1209d3f07da7eebabb93");
+  Hash hash3("d00b4b6c9d1b6b8b5e4c1b3c6d6c8f3a1e5b7c9d");
+  for (const auto& hash : {hash1, hash2, hash3}) {
+    auto blob = Blob{hash, IOBuf{IOBuf::COPY_BUFFER, "some contents"}};
+    store_->putBlob(hash, &blob);
+  }
+
+  // Nothing is evicted while the store is under the limit.
+  auto stats = store_->collectGarbage(
+      std::numeric_limits<uint64_t>::max(), std::unordered_set<Hash>{});
+  EXPECT_EQ(0, stats.blobsEvicted);
+  EXPECT_NE(nullptr, store_->getBlob(hash1));
+
+  stats = store_->collectGarbage(0, std::unordered_set<Hash>{hash2});
+  EXPECT_EQ(2, stats.blobsEvicted);
+  EXPECT_EQ(26, stats.bytesEvicted);
+  EXPECT_EQ(nullptr, store_->getBlob(hash1));
+  EXPECT_FALSE(store_->hasKey(LocalStore::BlobFamily, hash1));
+  EXPECT_FALSE(store_->getBlobMetadata(hash1).hasValue());
+  EXPECT_EQ(nullptr, store_->getBlob(hash3));
+  ASSERT_NE(nullptr, store_->getBlob(hash2));
+  EXPECT_EQ(13, store_->getBlobMetadata(hash2).value().size);
+
+  // Evicted blobs can be stored again.
+  auto blob = Blob{hash1, IOBuf{IOBuf::COPY_BUFFER, "some contents"}};
+  store_->putBlob(hash1, &blob);
+  EXPECT_NE(nullptr, store_->getBlob(hash1));
+}
+
+TEST(LocalStoreChunkingTest, contentDefinedChunksAreShared) {
+  TemporaryDirectory testDir("eden_test");
+  LocalStoreOptions options;
+  options.contentDefinedBlobChunks = true;
+  LocalStore store(AbsolutePathPiece{testDir.path().string()}, options);
+
+  std::mt19937 rng(0);
+  string contents1(4 * LocalStore::kBlobChunkSize, '\0');
+  for (auto& c : contents1) {
+    c = static_cast<char>(rng());
+  }
+  auto contents2 = contents1;
+  contents2.insert(contents2.size() - 1000, "an edit near the end");
+
+  // The IDs of the chunks of each blob
+  auto getChunkIds = [](const string& contents) {
+    IOBuf buf{IOBuf::WRAP_BUFFER, ByteRange{StringPiece{contents}}};
+    std::set<Hash> ids;
+    size_t offset = 0;
+    for (auto length : findContentDefinedChunks(
+             buf,
+             LocalStore::kBlobChunkSize / 4,
+             LocalStore::kBlobChunkSize,
+             LocalStore::kBlobChunkSize * 4)) {
+      ids.insert(Hash::sha1(ByteRange{StringPiece{contents}}.subpiece(
+          offset, length)));
+      offset += length;
+    }
+    return ids;
+  };
+  auto chunks1 = getChunkIds(contents1);
+  auto chunks2 = getChunkIds(contents2);
+  std::vector<Hash> sharedChunks;
+  std::set_intersection(
+      chunks1.begin(),
+      chunks1.end(),
+      chunks2.begin(),
+      chunks2.end(),
+      std::back_inserter(sharedChunks));
+  ASSERT_FALSE(sharedChunks.empty());
+  ASSERT_LT(sharedChunks.size(), chunks1.size());
+
+  Hash hash1("3a8f8eb91101860fd8484154885838bf322964d0");
+  Hash hash2("8e073e366ed82de6465d1209d3f07da7eebabb93");
+  auto blob1 = Blob{hash1, IOBuf{IOBuf::COPY_BUFFER, contents1}};
+  store.putBlob(hash1, &blob1);
+  auto blob2 = Blob{hash2, IOBuf{IOBuf::COPY_BUFFER, contents2}};
+  store.putBlob(hash2, &blob2);
+
+  auto outBlob = store.getBlob(hash2);
+  ASSERT_NE(nullptr, outBlob);
+  EXPECT_EQ(
+      contents2,
+      outBlob->getContents().clone()->moveToFbString().toStdString());
+  auto range = store.getBlobRange(hash1, contents1.size() - 100, 1000);
+  ASSERT_NE(nullptr, range);
+  EXPECT_EQ(
+      contents1.substr(contents1.size() - 100),
+      range->moveToFbString().toStdString());
+  for (const auto& id : chunks1) {
+    EXPECT_TRUE(store.hasKey(LocalStore::BlobChunkFamily, id));
+  }
+
+  // Evicting one blob keeps the chunks the other still uses.
+  auto stats = store.collectGarbage(0, std::unordered_set<Hash>{hash2});
+  EXPECT_EQ(1, stats.blobsEvicted);
+  EXPECT_EQ(nullptr, store.getBlob(hash1));
+  for (const auto& id : chunks1) {
+    EXPECT_EQ(
+        chunks2.count(id) != 0, store.hasKey(LocalStore::BlobChunkFamily, id));
+  }
+  outBlob = store.getBlob(hash2);
+  ASSERT_NE(nullptr, outBlob);
+  EXPECT_EQ(
+      contents2,
+      outBlob->getContents().clone()->moveToFbString().toStdString());
+
+  store.collectGarbage(0, std::unordered_set<Hash>{});
+  EXPECT_EQ(nullptr, store.getBlob(hash2));
+  for (const auto& id : chunks2) {
+    EXPECT_FALSE(store.hasKey(LocalStore::BlobChunkFamily, id));
+  }
+}
+
+TEST_F(LocalStoreTest, testBatchModeReadsPendingWrites) {
+  // Use a buffer large enough that nothing is flushed during the test.
+  store_->enableBatchMode(1024 * 1024 * 1024);
+  store_->enableBatchMode(1024);
+
+  constexpr size_t kNumThreads = 4;
+  constexpr size_t kKeysPerThread = 100;
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([this, t] {
+      for (size_t n = 0; n < kKeysPerThread; ++n) {
+        auto data = folly::to<string>("thread ", t, " key ", n);
+        auto id = Hash::sha1(ByteRange{StringPiece{data}});
+        store_->put(LocalStore::TreeFamily, id, StringPiece{data});
+        // Pending writes are visible without flushing them.
+        EXPECT_TRUE(store_->hasKey(LocalStore::TreeFamily, id));
+        EXPECT_EQ(data, store_->get(LocalStore::TreeFamily, id).piece());
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  auto id = Hash::sha1(ByteRange{StringPiece{"thread 0 key 0"}});
+  EXPECT_FALSE(store_->hasKey(LocalStore::BlobFamily, id));
+  auto results = store_->getBatch(LocalStore::TreeFamily, {id});
+  EXPECT_EQ("thread 0 key 0", results[0].piece());
+
+  // Each enableBatchMode() call is paired with a disableBatchMode().
+  store_->disableBatchMode();
+  store_->disableBatchMode();
+  EXPECT_EQ(
+      "thread 3 key 99",
+      store_->get(
+                LocalStore::TreeFamily,
+                Hash::sha1(ByteRange{StringPiece{"thread 3 key 99"}}))
+          .piece());
+}
+
+TEST_F(LocalStoreTest, testHasKeyAfterReopen) {
+  std::vector<Hash> ids;
+  for (size_t n = 0; n < 100; ++n) {
+    auto data = folly::to<string>("tree ", n);
+    ids.push_back(Hash::sha1(ByteRange{StringPiece{data}}));
+    store_->put(LocalStore::TreeFamily, ids.back(), StringPiece{data});
+    EXPECT_TRUE(store_->hasKey(LocalStore::TreeFamily, ids.back()));
+  }
+
+  // A new LocalStore has not seen the keys written, so it has to find them
+  // in RocksDB.
+  store_.reset();
+  store_ = std::make_unique<LocalStore>(
+      AbsolutePathPiece{testDir_->path().string()});
+  for (const auto& id : ids) {
+    EXPECT_TRUE(store_->hasKey(LocalStore::TreeFamily, id));
+    EXPECT_FALSE(store_->hasKey(LocalStore::BlobFamily, id));
+  }
+  EXPECT_FALSE(store_->hasKey(
+      LocalStore::TreeFamily, Hash::sha1(ByteRange{StringPiece{"missing"}})));
+}
+
+TEST_F(LocalStoreTest, testCompact) {
+  EXPECT_EQ(0, store_->getHealth().bulkBytesWritten);
+  store_->enableBatchMode(1024 * 1024);
+  for (size_t n = 0; n < 100; ++n) {
+    auto data = folly::to<string>("tree ", n);
+    store_->put(
+        LocalStore::TreeFamily,
+        Hash::sha1(ByteRange{StringPiece{data}}),
+        StringPiece{data});
+  }
+  store_->disableBatchMode();
+  auto health = store_->getHealth();
+  ASSERT_EQ(LocalStore::KeySpace::End, health.columns.size());
+  EXPECT_GT(health.bulkBytesWritten, 0);
+  EXPECT_FALSE(health.writesStopped);
+
+  // Compaction flushes the memtable, and leaves nothing in level 0.
+  store_->compact(LocalStore::TreeFamily);
+  health = store_->getHealth();
+  EXPECT_GE(health.columns[LocalStore::TreeFamily].numSstFiles, 1);
+  EXPECT_EQ(0, health.columns[LocalStore::TreeFamily].numLevel0Files);
+  EXPECT_EQ(0, health.columns[LocalStore::BlobFamily].numSstFiles);
+  EXPECT_EQ(
+      "tree 42",
+      store_->get(
+                LocalStore::TreeFamily,
+                Hash::sha1(ByteRange{StringPiece{"tree 42"}}))
+          .piece());
+}
+
+TEST_F(LocalStoreTest, testScrubRemovesCorruptObjects) {
+  Hash good("3a8f8eb91101860fd8484154885838bf322964d0");
+  Hash bad("8e073e366ed82de6465d1209d3f07da7eebabb93");
+  for (const auto& id : {good, bad}) {
+    auto blob = Blob{id, IOBuf{IOBuf::COPY_BUFFER, "some contents"}};
+    store_->putBlob(id, &blob);
+  }
+  // Make the stored contents of one blob disagree with its metadata.
+  store_->putBlobMetadata(
+      bad, BlobMetadata{Hash::sha1(ByteRange{StringPiece{"other"}}), 13});
+  Hash badTree("d00b4b6c9d1b6b8b5e4c1b3c6d6c8f3a1e5b7c9d");
+  store_->put(LocalStore::TreeFamily, badTree, StringPiece{"not a tree"});
+
+  // A small budget makes the pass take several calls.
+  LocalStoreScrubPosition position;
+  LocalStoreScrubStats total;
+  size_t calls = 0;
+  while (!position.finished) {
+    auto stats = store_->scrub(&position, 1);
+    total.objectsChecked += stats.objectsChecked;
+    total.objectsQuarantined += stats.objectsQuarantined;
+    ++calls;
+  }
+  EXPECT_GT(calls, 1);
+  EXPECT_EQ(3, total.objectsChecked);
+  EXPECT_EQ(2, total.objectsQuarantined);
+
+  EXPECT_NE(nullptr, store_->getBlob(good));
+  EXPECT_EQ(nullptr, store_->getBlob(bad));
+  EXPECT_FALSE(store_->getBlobMetadata(bad).hasValue());
+  EXPECT_FALSE(store_->hasKey(LocalStore::TreeFamily, badTree));
+
+  // The removed objects are not found by the next pass.
+  position = LocalStoreScrubPosition();
+  auto stats = store_->scrub(&position, std::numeric_limits<uint64_t>::max());
+  EXPECT_TRUE(position.finished);
+  EXPECT_EQ(1, stats.objectsChecked);
+  EXPECT_EQ(0, stats.objectsQuarantined);
+}
+
+TEST_F(LocalStoreTest, testPutBlobWithKnownSha1) {
+  Hash id("3a8f8eb91101860fd8484154885838bf322964d0");
+  auto contents = StringPiece{"hello world"};
+  auto sha1 = Hash::sha1(ByteRange{contents});
+  auto blob = Blob{id, IOBuf{IOBuf::COPY_BUFFER, contents}};
+
+  auto metadata = store_->putBlob(id, &blob, sha1);
+  EXPECT_EQ(sha1, metadata.sha1);
+  EXPECT_EQ(11, metadata.size);
+  EXPECT_EQ(sha1, store_->getSha1ForBlob(id).value());
+}
+
+TEST_F(LocalStoreTest, testPutExistingBlobReturnsStoredMetadata) {
+  Hash id("3a8f8eb91101860fd8484154885838bf322964d0");
+  auto blob = Blob{id, IOBuf{IOBuf::COPY_BUFFER, "hello world"}};
+  auto metadata = store_->putBlob(id, &blob);
+
+  // The existing metadata is returned rather than being recomputed.
+  auto stored = store_->putBlob(id, &blob);
+  EXPECT_EQ(metadata.sha1, stored.sha1);
+  EXPECT_EQ(metadata.size, stored.size);
+}
+
+TEST_F(LocalStoreTest, testPutBlobMetadataOnly) {
+  Hash id("3a8f8eb91101860fd8484154885838bf322964d0");
+  auto contents = StringPiece{"hello world"};
+  auto blob = Blob{id, IOBuf{IOBuf::COPY_BUFFER, contents}};
+
+  auto metadata = store_->putBlobMetadata(id, &blob);
+  EXPECT_EQ(Hash::sha1(ByteRange{contents}), metadata.sha1);
+  EXPECT_EQ(11, metadata.size);
+  EXPECT_EQ(metadata.sha1, store_->getSha1ForBlob(id).value());
+  EXPECT_FALSE(store_->hasKey(LocalStore::BlobFamily, id));
+  EXPECT_EQ(nullptr, store_->getBlob(id));
+
+  // Storing the whole blob later still stores its contents.
+  store_->putBlob(id, &blob);
+  auto stored = store_->getBlob(id);
+  ASSERT_NE(nullptr, stored);
+  EXPECT_EQ(
+      contents, stored->getContents().clone()->moveToFbString().toStdString());
+}
+
+TEST_F(LocalStoreTest, testGetRecordsStoreStats) {
+  auto getCounter = [](StringPiece name) {
+    std::map<string, int64_t> counters;
+    facebook::fbData->getCounters(counters);
+    return counters[name.str()];
+  };
+  auto hits = getCounter("local_store.blob.hit.sum");
+  auto misses = getCounter("local_store.blob.miss.sum");
+  auto bytesRead = getCounter("local_store.blob.bytes_read.sum");
+
+  Hash id("3a8f8eb91101860fd8484154885838bf322964d0");
+  auto blob = Blob{id, IOBuf{IOBuf::COPY_BUFFER, "hello world"}};
+  store_->putBlob(id, &blob);
+  ASSERT_NE(nullptr, store_->getBlob(id));
+  EXPECT_EQ(
+      nullptr,
+      store_->getBlob(Hash("0000000000000000000000000000000000000000")));
+
+  EXPECT_EQ(hits + 1, getCounter("local_store.blob.hit.sum"));
+  EXPECT_EQ(misses + 1, getCounter("local_store.blob.miss.sum"));
+  // The stored blob includes the git-style "blob <size>" header.
+  EXPECT_EQ(
+      bytesRead + 19, getCounter("local_store.blob.bytes_read.sum"));
+}
@@ -0,0 +1,276 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/experimental/TestUtil.h>
+#include <folly/io/IOBuf.h>
+#include <gtest/gtest.h>
+#include "eden/fs/model/Blob.h"
+#include "eden/fs/model/Tree.h"
+#include "eden/fs/store/LiveTreeTable.h"
+#include "eden/fs/store/LocalStore.h"
+#include "eden/fs/store/ObjectBatch.h"
+#include "eden/fs/store/ObjectStore.h"
+#include "eden/fs/testharness/FakeBackingStore.h"
+#include "eden/fs/testharness/StoredObject.h"
+
+using namespace facebook::eden;
+using folly::test::TemporaryDirectory;
+using std::make_shared;
+using std::shared_ptr;
+
+class ObjectStoreTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    testDir_ = std::make_unique<TemporaryDirectory>("eden_test");
+    auto path = AbsolutePathPiece{testDir_->path().string()};
+    localStore_ = make_shared<LocalStore>(path);
+    backingStore_ = make_shared<FakeBackingStore>(localStore_);
+    objectStore_ = std::make_unique<ObjectStore>(localStore_, backingStore_);
+  }
+
+  void TearDown() override {
+    objectStore_.reset();
+    backingStore_.reset();
+    localStore_.reset();
+    testDir_.reset();
+  }
+
+  std::unique_ptr<TemporaryDirectory> testDir_;
+  shared_ptr<LocalStore> localStore_;
+  shared_ptr<FakeBackingStore> backingStore_;
+  std::unique_ptr<ObjectStore> objectStore_;
+};
+
+TEST_F(ObjectStoreTest, concurrentBlobFetchesAreShared) {
+  auto* storedBlob = backingStore_->putBlob("hello world");
+  auto id = storedBlob->get().getHash();
+
+  auto future1 = objectStore_->getBlobFuture(id);
+  auto future2 = objectStore_->getBlobFuture(id);
+  auto metadataFuture = objectStore_->getBlobMetadata(id);
+  EXPECT_EQ(1, storedBlob->getNumPendingFutures());
+  EXPECT_FALSE(future1.isReady());
+
+  storedBlob->setReady();
+  ASSERT_TRUE(future1.isReady());
+  ASSERT_TRUE(future2.isReady());
+  ASSERT_TRUE(metadataFuture.isReady());
+  EXPECT_EQ(
+      "hello world",
+      future1.get()->getContents().clone()->moveToFbString().toStdString());
+  EXPECT_EQ(
+      "hello world",
+      future2.get()->getContents().clone()->moveToFbString().toStdString());
+  EXPECT_EQ(11, metadataFuture.get().size);
+}
+
+TEST_F(ObjectStoreTest, concurrentTreeFetchesAreShared) {
+  auto* storedBlob = backingStore_->putBlob("contents");
+  auto* storedTree = backingStore_->putTree({{"file.txt", storedBlob}});
+  auto id = storedTree->get().getHash();
+
+  auto future1 = objectStore_->getTreeFuture(id);
+  auto future2 = objectStore_->getTreeFuture(id);
+  EXPECT_EQ(1, storedTree->getNumPendingFutures());
+
+  storedTree->setReady();
+  ASSERT_TRUE(future1.isReady());
+  ASSERT_TRUE(future2.isReady());
+  EXPECT_EQ(1, future1.get()->getTreeEntries().size());
+  EXPECT_EQ(1, future2.get()->getTreeEntries().size());
+}
+
+TEST_F(ObjectStoreTest, sharedFetchErrors) {
+  auto* storedBlob = backingStore_->putBlob("hello world");
+  auto id = storedBlob->get().getHash();
+
+  auto future1 = objectStore_->getBlobFuture(id);
+  auto future2 = objectStore_->getBlobFuture(id);
+  storedBlob->triggerError(std::runtime_error("fetch failed"));
+  EXPECT_THROW(future1.get(), std::runtime_error);
+  EXPECT_THROW(future2.get(), std::runtime_error);
+}
+
+TEST_F(ObjectStoreTest, blobMetadataBatch) {
+  auto* localBlob = backingStore_->putBlob("already imported");
+  auto* remoteBlob = backingStore_->putBlob("not yet imported");
+  auto localID = localBlob->get().getHash();
+  auto remoteID = remoteBlob->get().getHash();
+  localStore_->putBlob(localID, &localBlob->get());
+
+  auto results = objectStore_->getBlobMetadataBatch({localID, remoteID});
+  ASSERT_EQ(2, results.size());
+  ASSERT_TRUE(results[0].isReady());
+  EXPECT_EQ(16, results[0].get().size);
+  EXPECT_EQ(0, localBlob->getNumPendingFutures());
+
+  EXPECT_FALSE(results[1].isReady());
+  remoteBlob->setReady();
+  ASSERT_TRUE(results[1].isReady());
+  EXPECT_EQ(16, results[1].get().size);
+}
+
+namespace {
+/**
+ * A FakeBackingStore that can answer metadata requests without the blob.
+ */
+class MetadataBackingStore : public FakeBackingStore {
+ public:
+  using FakeBackingStore::FakeBackingStore;
+
+  folly::Future<folly::Optional<BlobMetadata>> getBlobMetadata(
+      const Hash& id) override {
+    ++numMetadataFetches;
+    return folly::makeFuture(folly::Optional<BlobMetadata>{
+        BlobMetadata{Hash::sha1(id.getBytes()), 1234}});
+  }
+
+  size_t numMetadataFetches{0};
+};
+}
+
+TEST_F(ObjectStoreTest, blobMetadataFromBackingStore) {
+  auto backingStore = make_shared<MetadataBackingStore>(localStore_);
+  ObjectStore objectStore(localStore_, backingStore);
+  auto* storedBlob = backingStore->putBlob("hello world");
+  auto id = storedBlob->get().getHash();
+
+  auto metadata = objectStore.getBlobMetadata(id).get();
+  EXPECT_EQ(1234, metadata.size);
+  EXPECT_EQ(1, backingStore->numMetadataFetches);
+  EXPECT_EQ(0, storedBlob->getNumPendingFutures());
+
+  // Only the metadata was stored, so it is answered locally from now on.
+  EXPECT_EQ(nullptr, localStore_->getBlob(id));
+  EXPECT_EQ(1234, objectStore.getBlobMetadata(id).get().size);
+  EXPECT_EQ(1, backingStore->numMetadataFetches);
+}
+
+TEST_F(ObjectStoreTest, treesBatch) {
+  auto* storedBlob = backingStore_->putBlob("contents");
+  auto* localTree = backingStore_->putTree({{"a.txt", storedBlob}});
+  auto* remoteTree = backingStore_->putTree({{"b.txt", storedBlob}});
+  localStore_->putTree(&localTree->get());
+
+  auto results = objectStore_->getTreesBatch(
+      {localTree->get().getHash(), remoteTree->get().getHash()});
+  ASSERT_EQ(2, results.size());
+  ASSERT_TRUE(results[0].isReady());
+  EXPECT_EQ("a.txt", results[0].get()->getEntryAt(0).getName());
+
+  EXPECT_FALSE(results[1].isReady());
+  remoteTree->setReady();
+  ASSERT_TRUE(results[1].isReady());
+  EXPECT_EQ("b.txt", results[1].get()->getEntryAt(0).getName());
+}
+
+TEST_F(ObjectStoreTest, sharedTreesComeFromCache) {
+  auto* storedBlob = backingStore_->putBlob("contents");
+  auto* storedTree = backingStore_->putTree({{"file.txt", storedBlob}});
+  auto id = storedTree->get().getHash();
+
+  auto future1 = objectStore_->getSharedTreeFuture(id);
+  EXPECT_FALSE(future1.isReady());
+  storedTree->setReady();
+  ASSERT_TRUE(future1.isReady());
+  auto tree1 = future1.get();
+  EXPECT_EQ("file.txt", tree1->getEntryAt(0).getName());
+
+  // The second lookup is served from the tree cache without a copy.
+  auto future2 = objectStore_->getSharedTreeFuture(id);
+  ASSERT_TRUE(future2.isReady());
+  EXPECT_EQ(tree1, future2.get());
+}
+
+TEST_F(ObjectStoreTest, liveTreesAreSharedBetweenStores) {
+  auto liveTrees = make_shared<LiveTreeTable>();
+  ObjectStore store1(localStore_, backingStore_, nullptr, nullptr, liveTrees);
+  ObjectStore store2(localStore_, backingStore_, nullptr, nullptr, liveTrees);
+  store1.setTreeCacheSize(0);
+  store2.setTreeCacheSize(0);
+
+  auto* storedBlob = backingStore_->putBlob("contents");
+  auto* storedTree = backingStore_->putTree({{"file.txt", storedBlob}});
+  auto id = storedTree->get().getHash();
+  storedTree->setReady();
+
+  auto tree1 = store1.getSharedTreeFuture(id).get();
+  // The other store uses the same Tree without fetching it again, even with
+  // its tree cache disabled.
+  auto future2 = store2.getSharedTreeFuture(id);
+  ASSERT_TRUE(future2.isReady());
+  EXPECT_EQ(tree1, future2.get());
+  EXPECT_EQ(1, liveTrees->getStats().numTrees);
+
+  // Once nothing uses the Tree, it is no longer shared.
+  tree1.reset();
+  EXPECT_EQ(0, liveTrees->getStats().numTrees);
+  EXPECT_EQ(nullptr, liveTrees->get(id));
+}
+
+TEST_F(ObjectStoreTest, warmUpTreesStopsAtDepth) {
+  auto* storedBlob = backingStore_->putBlob("contents");
+  auto* leafTree = backingStore_->putTree({{"file.txt", storedBlob}});
+  auto* midTree = backingStore_->putTree({{"leaf", leafTree}});
+  auto* rootTree =
+      backingStore_->putTree({{"mid", midTree}, {"root.txt", storedBlob}});
+  rootTree->setReady();
+  midTree->setReady();
+
+  auto future =
+      objectStore_->warmUpTrees({rootTree->get().getHash()}, 2, 100);
+  ASSERT_TRUE(future.isReady());
+  auto stats = future.get();
+  EXPECT_EQ(2, stats.treesLoaded);
+  EXPECT_EQ(0, stats.treesFailed);
+  EXPECT_EQ(0, leafTree->getNumPendingFutures());
+}
+
+TEST_F(ObjectStoreTest, warmUpTreesLimitsTrees) {
+  auto* storedBlob = backingStore_->putBlob("contents");
+  auto* tree1 = backingStore_->putTree({{"a.txt", storedBlob}});
+  auto* tree2 = backingStore_->putTree({{"b.txt", storedBlob}});
+  tree1->setReady();
+  tree2->setReady();
+
+  auto future = objectStore_->warmUpTrees(
+      {tree1->get().getHash(), tree2->get().getHash()}, 1, 1);
+  ASSERT_TRUE(future.isReady());
+  EXPECT_EQ(1, future.get().treesLoaded);
+  EXPECT_EQ(0, tree2->getNumPendingFutures());
+}
+
+TEST_F(ObjectStoreTest, objectBatchStartsLoadsOnFlush) {
+  auto* storedBlob = backingStore_->putBlob("contents");
+  auto* storedTree = backingStore_->putTree({{"a.txt", storedBlob}});
+
+  ObjectBatch batch;
+  auto treeFuture = batch.loadTree(storedTree->get().getHash());
+  auto metadataFuture = batch.loadBlobMetadata(storedBlob->get().getHash());
+  EXPECT_EQ(0, storedTree->getNumPendingFutures());
+  EXPECT_EQ(0, storedBlob->getNumPendingFutures());
+
+  auto counts = batch.flush(objectStore_.get());
+  EXPECT_EQ(1, counts.trees);
+  EXPECT_EQ(1, counts.blobMetadata);
+  EXPECT_FALSE(treeFuture.isReady());
+  EXPECT_FALSE(metadataFuture.isReady());
+
+  storedTree->setReady();
+  storedBlob->setReady();
+  ASSERT_TRUE(treeFuture.isReady());
+  EXPECT_EQ("a.txt", treeFuture.get()->getEntryAt(0).getName());
+  ASSERT_TRUE(metadataFuture.isReady());
+  EXPECT_EQ(8, metadataFuture.get().size);
+
+  // Everything was started by the first flush.
+  counts = batch.flush(objectStore_.get());
+  EXPECT_EQ(0, counts.trees);
+  EXPECT_EQ(0, counts.blobMetadata);
+}
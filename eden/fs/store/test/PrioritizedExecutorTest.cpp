@@ -0,0 +1,75 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/store/PrioritizedExecutor.h"
+
+#include <folly/futures/ManualExecutor.h>
+#include <folly/io/async/Request.h>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+using namespace facebook::eden;
+using namespace std::chrono_literals;
+
+TEST(PrioritizedExecutor, runsMostUrgentFirst) {
+  folly::ManualExecutor manual;
+  PrioritizedExecutor executor(&manual, 1h);
+  std::vector<int> order;
+
+  executor.addWithImportPriority(
+      [&] { order.push_back(1); }, ImportPriority::PREFETCH);
+  executor.addWithImportPriority(
+      [&] { order.push_back(2); }, ImportPriority::CHECKOUT);
+  executor.addWithImportPriority(
+      [&] { order.push_back(3); }, ImportPriority::PREFETCH);
+  executor.addWithImportPriority(
+      [&] { order.push_back(4); }, ImportPriority::INTERACTIVE);
+  EXPECT_EQ(2, executor.getNumQueued(ImportPriority::PREFETCH));
+  EXPECT_EQ(1, executor.getNumQueued(ImportPriority::CHECKOUT));
+  EXPECT_EQ(1, executor.getNumQueued(ImportPriority::INTERACTIVE));
+
+  manual.run();
+  EXPECT_EQ((std::vector<int>{4, 2, 1, 3}), order);
+  EXPECT_EQ(0, executor.getNumQueued(ImportPriority::PREFETCH));
+}
+
+TEST(PrioritizedExecutor, runsOverdueFunctionsFirst) {
+  folly::ManualExecutor manual;
+  PrioritizedExecutor executor(&manual, 1ms);
+  std::vector<int> order;
+
+  executor.addWithImportPriority(
+      [&] { order.push_back(1); }, ImportPriority::PREFETCH);
+  std::this_thread::sleep_for(5ms);
+  executor.addWithImportPriority(
+      [&] { order.push_back(2); }, ImportPriority::INTERACTIVE);
+  executor.addWithImportPriority(
+      [&] { order.push_back(3); }, ImportPriority::CHECKOUT);
+
+  manual.run();
+  EXPECT_EQ((std::vector<int>{1, 2, 3}), order);
+}
+
+TEST(PrioritizedExecutor, usesRequestPriority) {
+  folly::ManualExecutor manual;
+  PrioritizedExecutor executor(&manual, 1h);
+
+  EXPECT_EQ(ImportPriority::INTERACTIVE, getCurrentImportPriority());
+  {
+    folly::RequestContextScopeGuard guard;
+    setCurrentImportPriority(ImportPriority::CHECKOUT);
+    setCurrentImportPriority(ImportPriority::PREFETCH);
+    EXPECT_EQ(ImportPriority::PREFETCH, getCurrentImportPriority());
+    executor.add([] {});
+  }
+  EXPECT_EQ(ImportPriority::INTERACTIVE, getCurrentImportPriority());
+  EXPECT_EQ(1, executor.getNumQueued(ImportPriority::PREFETCH));
+  manual.run();
+}
@@ -0,0 +1,48 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/store/RecentKeyFilter.h"
+
+#include <gtest/gtest.h>
+
+using namespace facebook::eden;
+
+TEST(RecentKeyFilter, containsInsertedKeys) {
+  RecentKeyFilter filter(16);
+  EXPECT_FALSE(filter.contains(1234));
+  filter.insert(1234);
+  filter.insert(5678);
+  EXPECT_TRUE(filter.contains(1234));
+  EXPECT_TRUE(filter.contains(5678));
+  EXPECT_FALSE(filter.contains(4321));
+}
+
+TEST(RecentKeyFilter, zeroHash) {
+  RecentKeyFilter filter(16);
+  // Empty slots must not look like they hold a hash of 0.
+  EXPECT_FALSE(filter.contains(0));
+  filter.insert(0);
+  EXPECT_TRUE(filter.contains(0));
+}
+
+TEST(RecentKeyFilter, collidingKeysReplaceEachOther) {
+  // 10 is rounded up to 16 slots, so these share a slot.
+  RecentKeyFilter filter(10);
+  filter.insert(3);
+  filter.insert(3 + 16);
+  EXPECT_FALSE(filter.contains(3));
+  EXPECT_TRUE(filter.contains(3 + 16));
+}
+
+TEST(RecentKeyFilter, clear) {
+  RecentKeyFilter filter(16);
+  filter.insert(1234);
+  filter.clear();
+  EXPECT_FALSE(filter.contains(1234));
+}
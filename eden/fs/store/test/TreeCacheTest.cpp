@@ -0,0 +1,167 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Conv.h>
+#include <gtest/gtest.h>
+#include "eden/fs/model/Tree.h"
+#include "eden/fs/store/TreeCache.h"
+
+using namespace facebook::eden;
+using std::make_shared;
+using std::shared_ptr;
+
+namespace {
+shared_ptr<const Tree> makeTree(const std::string& hash, size_t numEntries) {
+  std::vector<TreeEntry> entries;
+  for (size_t n = 0; n < numEntries; ++n) {
+    entries.emplace_back(
+        Hash("0123456789abcdef0123456789abcdef01234567"),
+        folly::to<std::string>("file", n),
+        FileType::REGULAR_FILE,
+        0b110);
+  }
+  return make_shared<Tree>(std::move(entries), Hash(hash));
+}
+
+const std::string kHash1 = "1111111111111111111111111111111111111111";
+const std::string kHash2 = "2222222222222222222222222222222222222222";
+const std::string kHash3 = "3333333333333333333333333333333333333333";
+
+/** A TreeCache that uses the shards of whichever node the test chooses. */
+class TestNodeTreeCache : public TreeCache {
+ public:
+  using TreeCache::TreeCache;
+
+  size_t node{0};
+
+ protected:
+  size_t getCurrentNode() const override {
+    return node;
+  }
+};
+}
+
+TEST(TreeCache, getAndInsert) {
+  TreeCache cache(1024 * 1024, 4);
+  EXPECT_EQ(nullptr, cache.get(Hash(kHash1)));
+
+  auto tree = makeTree(kHash1, 3);
+  cache.insert(tree);
+  auto result = cache.get(Hash(kHash1));
+  EXPECT_EQ(tree, result);
+  EXPECT_EQ(nullptr, cache.get(Hash(kHash2)));
+
+  auto stats = cache.getStats();
+  EXPECT_EQ(1, stats.hits);
+  EXPECT_EQ(2, stats.misses);
+  EXPECT_EQ(1, stats.numEntries);
+  EXPECT_EQ(TreeCache::estimateSize(*tree), stats.totalBytes);
+}
+
+TEST(TreeCache, evictsLeastRecentlyUsed) {
+  auto tree1 = makeTree(kHash1, 10);
+  auto tree2 = makeTree(kHash2, 10);
+  auto tree3 = makeTree(kHash3, 10);
+  // Use a single shard with room for two of these trees.
+  auto size = TreeCache::estimateSize(*tree1);
+  TreeCache cache(size * 2 + size / 2, 1);
+
+  cache.insert(tree1);
+  cache.insert(tree2);
+  // Touch tree1 so that tree2 is the least recently used.
+  EXPECT_EQ(tree1, cache.get(Hash(kHash1)));
+  cache.insert(tree3);
+
+  EXPECT_EQ(tree1, cache.get(Hash(kHash1)));
+  EXPECT_EQ(nullptr, cache.get(Hash(kHash2)));
+  EXPECT_EQ(tree3, cache.get(Hash(kHash3)));
+
+  auto stats = cache.getStats();
+  EXPECT_EQ(1, stats.evictions);
+  EXPECT_EQ(2, stats.numEntries);
+  EXPECT_EQ(size * 2, stats.totalBytes);
+}
+
+TEST(TreeCache, doesNotCacheOversizedTrees) {
+  auto tree = makeTree(kHash1, 100);
+  TreeCache cache(TreeCache::estimateSize(*tree) - 1, 1);
+  cache.insert(tree);
+  EXPECT_EQ(nullptr, cache.get(Hash(kHash1)));
+  EXPECT_EQ(0, cache.getStats().totalBytes);
+}
+
+TEST(TreeCache, duplicateInsert) {
+  TreeCache cache(1024 * 1024, 1);
+  auto tree = makeTree(kHash1, 3);
+  cache.insert(tree);
+  cache.insert(makeTree(kHash1, 3));
+  EXPECT_EQ(tree, cache.get(Hash(kHash1)));
+  auto stats = cache.getStats();
+  EXPECT_EQ(1, stats.numEntries);
+  EXPECT_EQ(TreeCache::estimateSize(*tree), stats.totalBytes);
+}
+
+TEST(TreeCache, getRecentIds) {
+  TreeCache cache(1024 * 1024, 1);
+  cache.insert(makeTree(kHash1, 3));
+  cache.insert(makeTree(kHash2, 3));
+  cache.insert(makeTree(kHash3, 3));
+  cache.get(Hash(kHash1));
+
+  EXPECT_EQ(
+      (std::vector<Hash>{Hash(kHash1), Hash(kHash3), Hash(kHash2)}),
+      cache.getRecentIds(10));
+  EXPECT_EQ(
+      (std::vector<Hash>{Hash(kHash1), Hash(kHash3)}), cache.getRecentIds(2));
+}
+
+TEST(TreeCache, setMaxBytes) {
+  auto tree1 = makeTree(kHash1, 10);
+  auto tree2 = makeTree(kHash2, 10);
+  auto size = TreeCache::estimateSize(*tree1);
+  TreeCache cache(size * 2, 1);
+  cache.insert(tree1);
+  cache.insert(tree2);
+
+  // Shrinking the cache evicts the least recently used Tree right away.
+  cache.setMaxBytes(size);
+  EXPECT_EQ(nullptr, cache.get(Hash(kHash1)));
+  EXPECT_EQ(tree2, cache.get(Hash(kHash2)));
+  EXPECT_EQ(1, cache.getStats().evictions);
+
+  cache.setMaxBytes(0);
+  EXPECT_EQ(0, cache.getStats().numEntries);
+  cache.insert(tree1);
+  EXPECT_EQ(nullptr, cache.get(Hash(kHash1)));
+}
+
+TEST(TreeCache, copiesTreesFromOtherNodes) {
+  TestNodeTreeCache cache(1024 * 1024, 2, 2);
+  auto tree = makeTree(kHash1, 3);
+  cache.insert(tree);
+  EXPECT_EQ(tree, cache.get(Hash(kHash1)));
+
+  // Node 1 gets its own copy, and then finds that copy locally.
+  cache.node = 1;
+  auto copy = cache.get(Hash(kHash1));
+  ASSERT_NE(nullptr, copy);
+  EXPECT_NE(tree, copy);
+  EXPECT_EQ(tree->getHash(), copy->getHash());
+  EXPECT_EQ(3, copy->getTreeEntries().size());
+  EXPECT_EQ(copy, cache.get(Hash(kHash1)));
+  EXPECT_EQ(nullptr, cache.get(Hash(kHash2)));
+
+  auto stats = cache.getStats();
+  EXPECT_EQ(3, stats.hits);
+  EXPECT_EQ(1, stats.remoteHits);
+  EXPECT_EQ(1, stats.misses);
+  EXPECT_EQ(2, stats.numEntries);
+  // The Tree is only reported once, although both nodes cache it.
+  EXPECT_EQ(std::vector<Hash>{Hash(kHash1)}, cache.getRecentIds(10));
+}
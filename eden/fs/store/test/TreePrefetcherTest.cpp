@@ -0,0 +1,109 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/store/TreePrefetcher.h"
+
+#include <folly/Conv.h>
+#include <folly/experimental/TestUtil.h>
+#include <gtest/gtest.h>
+#include "eden/fs/model/Tree.h"
+#include "eden/fs/store/LocalStore.h"
+#include "eden/fs/store/ObjectStore.h"
+#include "eden/fs/testharness/FakeBackingStore.h"
+#include "eden/fs/testharness/StoredObject.h"
+
+using namespace facebook::eden;
+using folly::test::TemporaryDirectory;
+using std::make_shared;
+using std::shared_ptr;
+
+class TreePrefetcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    testDir_ = std::make_unique<TemporaryDirectory>("eden_test");
+    auto path = AbsolutePathPiece{testDir_->path().string()};
+    localStore_ = make_shared<LocalStore>(path);
+    backingStore_ = make_shared<FakeBackingStore>(localStore_);
+    objectStore_ = std::make_unique<ObjectStore>(localStore_, backingStore_);
+  }
+
+  void TearDown() override {
+    objectStore_.reset();
+    backingStore_.reset();
+    localStore_.reset();
+    testDir_.reset();
+  }
+
+  std::unique_ptr<TemporaryDirectory> testDir_;
+  shared_ptr<LocalStore> localStore_;
+  shared_ptr<FakeBackingStore> backingStore_;
+  std::unique_ptr<ObjectStore> objectStore_;
+};
+
+TEST_F(TreePrefetcherTest, prefetchesStartAtDepthOne) {
+  auto* storedBlob = backingStore_->putBlob("contents");
+  auto* leafTree = backingStore_->putTree({{"file.txt", storedBlob}});
+  auto* childTree = backingStore_->putTree({{"leaf", leafTree}});
+  childTree->setReady();
+
+  TreePrefetcher prefetcher(objectStore_.get(), 2, 100);
+  prefetcher.prefetch({childTree->get().getHash()});
+  auto stats = prefetcher.getStats();
+  EXPECT_EQ(1, stats.prefetches);
+  EXPECT_EQ(1, stats.treesLoaded);
+  EXPECT_EQ(1, stats.depth);
+  EXPECT_EQ(0, leafTree->getNumPendingFutures());
+}
+
+TEST_F(TreePrefetcherTest, skipsWhenOverBudget) {
+  auto* storedBlob = backingStore_->putBlob("contents");
+  auto* tree1 = backingStore_->putTree({{"a.txt", storedBlob}});
+  auto* tree2 = backingStore_->putTree({{"b.txt", storedBlob}});
+
+  TreePrefetcher prefetcher(objectStore_.get(), 1, 1);
+  prefetcher.prefetch({tree1->get().getHash()});
+  prefetcher.prefetch({tree2->get().getHash()});
+  EXPECT_EQ(1, prefetcher.getStats().prefetches);
+  EXPECT_EQ(1, prefetcher.getStats().skipped);
+  EXPECT_EQ(0, tree2->getNumPendingFutures());
+
+  // The budget is given back once the prefetch completes.
+  tree1->setReady();
+  EXPECT_EQ(1, prefetcher.getStats().treesLoaded);
+  prefetcher.prefetch({tree2->get().getHash()});
+  EXPECT_EQ(2, prefetcher.getStats().prefetches);
+  tree2->setReady();
+}
+
+TEST_F(TreePrefetcherTest, depthFollowsHitRate) {
+  auto* storedBlob = backingStore_->putBlob("contents");
+  std::vector<Hash> ids;
+  for (size_t n = 0; n < 256; ++n) {
+    auto* tree = backingStore_->putTree(
+        {{folly::to<std::string>("file", n), storedBlob}});
+    tree->setReady();
+    ids.push_back(tree->get().getHash());
+  }
+
+  TreePrefetcher prefetcher(objectStore_.get(), 3, 1000);
+  prefetcher.prefetch(ids);
+  for (size_t n = 0; n < 128; ++n) {
+    prefetcher.recordLoad(ids[n]);
+  }
+  auto stats = prefetcher.getStats();
+  EXPECT_EQ(128, stats.hits);
+  EXPECT_EQ(100.0, stats.getHitRate());
+  EXPECT_EQ(2, stats.depth);
+
+  // Loading an ID that was not prefetched, or was already counted, is not
+  // a hit.
+  prefetcher.recordLoad(ids[0]);
+  prefetcher.recordLoad(storedBlob->get().getHash());
+  EXPECT_EQ(128, prefetcher.getStats().hits);
+}
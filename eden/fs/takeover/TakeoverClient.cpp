@@ -0,0 +1,52 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/takeover/TakeoverClient.h"
+
+#include <folly/Conv.h>
+#include <folly/Exception.h>
+#include <folly/File.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <cstring>
+
+using folly::checkUnixError;
+
+namespace facebook {
+namespace eden {
+
+TakeoverData takeOverMounts(AbsolutePathPiece socketPath) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  auto path = socketPath.stringPiece();
+  if (path.size() >= sizeof(addr.sun_path)) {
+    throw std::runtime_error(folly::to<std::string>(
+        "takeover socket path is too long: ", socketPath));
+  }
+  memcpy(addr.sun_path, path.data(), path.size());
+
+  auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  checkUnixError(fd, "failed to create a socket");
+  folly::File connection(fd, /*ownsFd=*/true);
+  checkUnixError(
+      connect(
+          connection.fd(),
+          reinterpret_cast<const struct sockaddr*>(&addr),
+          sizeof(addr)),
+      "failed to connect to the edenfs takeover socket at ",
+      socketPath);
+
+  // Connecting is the request; the other process replies once it has
+  // stopped serving its mount points.
+  return TakeoverData::receive(connection.fd());
+}
+}
+} // facebook::eden
@@ -0,0 +1,24 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include "eden/fs/takeover/TakeoverData.h"
+#include "eden/utils/PathFuncs.h"
+
+namespace facebook {
+namespace eden {
+
+/**
+ * Ask the edenfs process listening on socketPath to hand over its mount
+ * points, and wait until it has stopped serving them.
+ */
+TakeoverData takeOverMounts(AbsolutePathPiece socketPath);
+}
+} // facebook::eden
@@ -0,0 +1,190 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/takeover/TakeoverData.h"
+
+#include <folly/Conv.h>
+#include <folly/Exception.h>
+#include <folly/FileUtil.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <thrift/lib/cpp2/protocol/Serializer.h>
+#include <cstring>
+
+using apache::thrift::CompactSerializer;
+using folly::checkUnixError;
+
+namespace facebook {
+namespace eden {
+
+namespace {
+constexpr uint32_t kProtocolVersion = 1;
+// The kernel does not pass more than SCM_MAX_FD descriptors in one message.
+constexpr size_t kMaxFds = 253;
+constexpr uint64_t kMaxDataLength = 1ULL << 30;
+
+struct MessageHeader {
+  uint32_t version;
+  uint32_t numFds;
+  uint64_t dataLength;
+};
+}
+
+void TakeoverData::send(int socket) const {
+  if (mounts.size() > kMaxFds) {
+    throw std::runtime_error(folly::to<std::string>(
+        "cannot hand over ",
+        mounts.size(),
+        " mount points at once; the limit is ",
+        kMaxFds));
+  }
+
+  takeover::SerializedTakeoverData data;
+  for (const auto& mount : mounts) {
+    data.mounts.push_back(mount.state);
+  }
+  auto body = CompactSerializer::serialize<std::string>(data);
+
+  MessageHeader header;
+  header.version = kProtocolVersion;
+  header.numFds = mounts.size();
+  header.dataLength = body.size();
+
+  struct iovec iov;
+  iov.iov_base = &header;
+  iov.iov_len = sizeof(header);
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  // The descriptors go with the header, so that the receiver gets them
+  // before reading any of the body.
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * mounts.size()));
+  if (!mounts.empty()) {
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    auto* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * mounts.size());
+    auto* fds = reinterpret_cast<int*>(CMSG_DATA(cmsg));
+    for (size_t n = 0; n < mounts.size(); ++n) {
+      fds[n] = mounts[n].fuseDevice.fd();
+    }
+  }
+
+  ssize_t sent;
+  do {
+    sent = sendmsg(socket, &msg, MSG_NOSIGNAL);
+  } while (sent < 0 && errno == EINTR);
+  checkUnixError(sent, "failed to send the takeover header");
+  if (static_cast<size_t>(sent) != sizeof(header)) {
+    throw std::runtime_error("short write sending the takeover header");
+  }
+
+  auto written = folly::writeFull(socket, body.data(), body.size());
+  checkUnixError(written, "failed to send the takeover data");
+}
+
+TakeoverData TakeoverData::receive(int socket) {
+  MessageHeader header;
+  struct iovec iov;
+  iov.iov_base = &header;
+  iov.iov_len = sizeof(header);
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * kMaxFds));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+
+  ssize_t received;
+  do {
+    received = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+  } while (received < 0 && errno == EINTR);
+  checkUnixError(received, "failed to receive the takeover header");
+
+  // Take ownership of the descriptors before checking anything else, so
+  // that they are closed if the data turns out to be bad.
+  std::vector<folly::File> files;
+  for (auto* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    auto numFds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    auto* fds = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+    for (size_t n = 0; n < numFds; ++n) {
+      files.emplace_back(fds[n], /*ownsFd=*/true);
+    }
+  }
+
+  if (received == 0) {
+    throw std::runtime_error(
+        "the edenfs process closed the connection without handing over "
+        "its mount points");
+  }
+  if (msg.msg_flags & MSG_CTRUNC) {
+    throw std::runtime_error("too many file descriptors in takeover data");
+  }
+  if (static_cast<size_t>(received) < sizeof(header)) {
+    auto* rest = reinterpret_cast<char*>(&header) + received;
+    auto remaining = sizeof(header) - received;
+    auto bytesRead = folly::readFull(socket, rest, remaining);
+    checkUnixError(bytesRead, "failed to receive the takeover header");
+    if (static_cast<size_t>(bytesRead) != remaining) {
+      throw std::runtime_error("truncated takeover header");
+    }
+  }
+
+  if (header.version != kProtocolVersion) {
+    throw std::runtime_error(folly::to<std::string>(
+        "unsupported takeover protocol version ", header.version));
+  }
+  if (header.numFds != files.size()) {
+    throw std::runtime_error(folly::to<std::string>(
+        "expected ",
+        header.numFds,
+        " file descriptors with the takeover data, but received ",
+        files.size()));
+  }
+  if (header.dataLength > kMaxDataLength) {
+    throw std::runtime_error(folly::to<std::string>(
+        "takeover data is too large: ", header.dataLength, " bytes"));
+  }
+
+  std::string body(header.dataLength, '\0');
+  auto bytesRead = folly::readFull(socket, &body[0], body.size());
+  checkUnixError(bytesRead, "failed to receive the takeover data");
+  if (static_cast<size_t>(bytesRead) != body.size()) {
+    throw std::runtime_error("truncated takeover data");
+  }
+
+  auto data =
+      CompactSerializer::deserialize<takeover::SerializedTakeoverData>(body);
+  if (data.mounts.size() != files.size()) {
+    throw std::runtime_error(folly::to<std::string>(
+        "received ",
+        data.mounts.size(),
+        " mount points but ",
+        files.size(),
+        " FUSE devices"));
+  }
+
+  TakeoverData result;
+  for (size_t n = 0; n < files.size(); ++n) {
+    result.mounts.push_back(
+        MountInfo{std::move(data.mounts[n]), std::move(files[n])});
+  }
+  return result;
+}
+}
+} // facebook::eden
@@ -0,0 +1,46 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/File.h>
+#include <vector>
+#include "eden/fs/takeover/gen-cpp2/takeover_types.h"
+
+namespace facebook {
+namespace eden {
+
+/**
+ * The mount points that an edenfs process hands over to a new edenfs
+ * process during a graceful restart.
+ *
+ * The FUSE device descriptors cannot be serialized, so they are sent over
+ * the unix socket as SCM_RIGHTS ancillary data, followed by the rest of the
+ * state serialized with thrift.
+ */
+struct TakeoverData {
+  struct MountInfo {
+    takeover::SerializedMountState state;
+    folly::File fuseDevice;
+  };
+
+  std::vector<MountInfo> mounts;
+
+  /**
+   * Send the data over a connected unix socket.
+   */
+  void send(int socket) const;
+
+  /**
+   * Receive data sent with send() from a connected unix socket.
+   */
+  static TakeoverData receive(int socket);
+};
+}
+} // facebook::eden
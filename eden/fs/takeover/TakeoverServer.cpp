@@ -0,0 +1,124 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/fs/takeover/TakeoverServer.h"
+
+#include <folly/Conv.h>
+#include <folly/Exception.h>
+#include <folly/ThreadName.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstring>
+
+using folly::checkUnixError;
+
+namespace facebook {
+namespace eden {
+
+TakeoverServer::TakeoverServer(AbsolutePathPiece socketPath, Handler handler)
+    : socketPath_{socketPath}, handler_{std::move(handler)} {}
+
+TakeoverServer::~TakeoverServer() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  stopping_.store(true);
+  // This wakes up the thread if it is waiting in accept().
+  shutdown(socket_.fd(), SHUT_RDWR);
+  thread_.join();
+  unlink(socketPath_.c_str());
+}
+
+void TakeoverServer::start() {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  auto path = socketPath_.stringPiece();
+  if (path.size() >= sizeof(addr.sun_path)) {
+    throw std::runtime_error(folly::to<std::string>(
+        "takeover socket path is too long: ", socketPath_));
+  }
+  memcpy(addr.sun_path, path.data(), path.size());
+
+  auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  checkUnixError(fd, "failed to create the takeover socket");
+  socket_ = folly::File(fd, /*ownsFd=*/true);
+
+  unlink(socketPath_.c_str());
+  checkUnixError(
+      bind(
+          socket_.fd(),
+          reinterpret_cast<const struct sockaddr*>(&addr),
+          sizeof(addr)),
+      "failed to bind the takeover socket to ",
+      socketPath_);
+  checkUnixError(
+      chmod(socketPath_.c_str(), 0600),
+      "failed to set the permissions of ",
+      socketPath_);
+  checkUnixError(
+      listen(socket_.fd(), 1), "failed to listen on the takeover socket");
+
+  thread_ = std::thread([this] { acceptLoop(); });
+}
+
+void TakeoverServer::acceptLoop() {
+  folly::setThreadName("takeover");
+  while (!stopping_.load()) {
+    auto fd = accept4(socket_.fd(), nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      if (!stopping_.load()) {
+        LOG(ERROR) << "error accepting takeover connections: "
+                   << folly::errnoStr(errno);
+      }
+      return;
+    }
+    if (handleConnection(folly::File(fd, /*ownsFd=*/true))) {
+      // Our mount points are gone, so there is nothing left to hand over.
+      return;
+    }
+  }
+}
+
+bool TakeoverServer::handleConnection(folly::File connection) {
+  struct ucred cred;
+  socklen_t credLength = sizeof(cred);
+  auto rc = getsockopt(
+      connection.fd(), SOL_SOCKET, SO_PEERCRED, &cred, &credLength);
+  if (rc != 0) {
+    LOG(ERROR) << "unable to get the credentials of a takeover client: "
+               << folly::errnoStr(errno);
+    return false;
+  }
+  if (cred.uid != getuid()) {
+    LOG(ERROR) << "rejecting takeover request from process " << cred.pid
+               << " owned by UID " << cred.uid;
+    return false;
+  }
+
+  LOG(INFO) << "process " << cred.pid << " is taking over our mount points";
+  try {
+    auto data = handler_().get();
+    data.send(connection.fd());
+    LOG(INFO) << "handed over " << data.mounts.size() << " mount points";
+    return true;
+  } catch (const std::exception& ex) {
+    LOG(ERROR) << "error handing over our mount points: "
+               << folly::exceptionStr(ex);
+    return false;
+  }
+}
+}
+} // facebook::eden
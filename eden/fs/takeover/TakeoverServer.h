@@ -0,0 +1,68 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/File.h>
+#include <folly/futures/Future.h>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include "eden/fs/takeover/TakeoverData.h"
+#include "eden/utils/PathFuncs.h"
+
+namespace facebook {
+namespace eden {
+
+/**
+ * Listens on a unix socket for a new edenfs process that wants to take over
+ * this process's mount points.
+ *
+ * When one connects, the handler stops serving the mount points and returns
+ * their state, which is then sent to the new process.  Only connections from
+ * the same user are accepted, and only one takeover can succeed.
+ */
+class TakeoverServer {
+ public:
+  using Handler = std::function<folly::Future<TakeoverData>()>;
+
+  TakeoverServer(AbsolutePathPiece socketPath, Handler handler);
+
+  /**
+   * Stop listening, waiting for a takeover in progress to finish first.
+   */
+  ~TakeoverServer();
+
+  /**
+   * Create the socket and start accepting connections in a new thread.
+   *
+   * Any existing file at the socket path is removed, so the caller must
+   * already hold the eden lock.
+   */
+  void start();
+
+ private:
+  TakeoverServer(TakeoverServer const&) = delete;
+  TakeoverServer& operator=(TakeoverServer const&) = delete;
+
+  void acceptLoop();
+
+  /**
+   * Returns true if the mount points were handed over.
+   */
+  bool handleConnection(folly::File connection);
+
+  AbsolutePath socketPath_;
+  Handler handler_;
+  folly::File socket_;
+  std::thread thread_;
+  std::atomic<bool> stopping_{false};
+};
+}
+} // facebook::eden
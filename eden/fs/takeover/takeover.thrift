@@ -0,0 +1,47 @@
+namespace cpp2 facebook.eden.takeover
+
+typedef string PathComponent
+
+// An inode number that the kernel may still refer to.
+struct SerializedInode {
+  1: i64 inodeNumber
+  2: i64 parentInode
+  3: PathComponent name
+  // The number of lookups that FUSE has not yet released with forget().
+  4: i64 numFuseReferences
+}
+
+// The state of a mount point's InodeMap.
+struct SerializedInodeMap {
+  1: i64 nextInodeNumber
+  // All inodes except the root, loaded or not.  They are all unloaded in the
+  // process that takes over the mount point.
+  2: list<SerializedInode> unloadedInodes
+}
+
+// A file or directory handle that the kernel has open.
+struct SerializedFileHandle {
+  1: i64 handleId
+  2: i64 inodeNumber
+  3: bool isDir
+  // The flags the file was opened with.  Not used for directories.
+  4: i32 flags
+}
+
+struct SerializedMountState {
+  1: string mountPath
+  2: string clientPath
+  // The FUSE_INIT request the kernel sent when the mount point was set up.
+  3: binary fuseInitRequest
+  4: SerializedInodeMap inodeMap
+  5: list<SerializedFileHandle> fileHandles
+  // The bind mounts inside the mount point, which stay mounted too.
+  6: list<string> bindMounts
+}
+
+// Everything sent to a new edenfs process taking over the mount points,
+// apart from the FUSE device descriptors, which are sent alongside it in
+// the same order as mounts.
+struct SerializedTakeoverData {
+  1: list<SerializedMountState> mounts
+}
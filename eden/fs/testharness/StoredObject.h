@@ -48,6 +48,14 @@ class StoredObject {
     return object_;
   }
 
+  /**
+   * Get the number of Futures returned by getFuture() that are still waiting
+   * for this object to become ready.
+   */
+  size_t getNumPendingFutures() const {
+    return data_.rlock()->promises.size();
+  }
+
   /**
    * Get a Future for this object.
    *
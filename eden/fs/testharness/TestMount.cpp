@@ -324,7 +324,7 @@ Future<Unit> TestMount::loadAllInodesFuture(const TreeInodePtr& treeInode) {
   {
     auto contents = treeInode->getContents().rlock();
     for (const auto& entry : contents->entries) {
-      childNames.emplace_back(entry.first);
+      childNames.emplace_back(entry.first.copy());
     }
   }
 
@@ -55,8 +55,8 @@ TEST(TestMount, createSimpleTestMount) {
     auto dir = dirTreeEntry->getContents().rlock();
     auto& rootEntries = dir->entries;
     auto& path1Entry = rootEntries.at(PathComponentPiece("path1"));
-    ASSERT_FALSE(path1Entry->isMaterialized());
-    EXPECT_EQ(expectedSha1, path1Entry->getHash())
+    ASSERT_FALSE(path1Entry.isMaterialized());
+    EXPECT_EQ(expectedSha1, path1Entry.getHash())
         << "Getting the Entry from the root Dir should also work.";
   }
 
@@ -9,26 +9,84 @@
  */
 #include "BufVec.h"
 
+#include <folly/Exception.h>
+#include <unistd.h>
+#include <cstdlib>
+
 namespace facebook {
 namespace eden {
 namespace fusell {
 
 BufVec::Buf::Buf(std::unique_ptr<folly::IOBuf> buf) : buf(std::move(buf)) {}
 
+BufVec::Buf::Buf(folly::File file, size_t size, off_t pos)
+    : file(std::move(file)), fd_size(size), fd_pos(pos) {}
+
+void BufVec::Buf::readFile() {
+  if (buf) {
+    return;
+  }
+  buf = folly::IOBuf::createCombined(fd_size);
+  auto res = ::pread(file.fd(), buf->writableBuffer(), fd_size, fd_pos);
+  folly::checkUnixError(res, "error reading file data for a BufVec");
+  buf->append(res);
+}
+
 BufVec::BufVec(std::unique_ptr<folly::IOBuf> buf) {
   items_.emplace_back(std::make_shared<Buf>(std::move(buf)));
 }
 
+BufVec::BufVec(folly::File file, size_t size, off_t pos) {
+  items_.emplace_back(std::make_shared<Buf>(std::move(file), size, pos));
+}
+
 folly::fbvector<struct iovec> BufVec::getIov() const {
   folly::fbvector<struct iovec> vec;
 
   for (const auto& b : items_) {
-    DCHECK(b->fd == -1) << "we don't support splicing yet";
+    // Callers that need an iovec get no benefit from deferring the read.
+    b->readFile();
     b->buf->appendToIov(&vec);
   }
 
   return vec;
 }
+
+#if FUSE_MINOR_VERSION >= 9
+BufVec::FuseBufvecPtr BufVec::getFuseBufvec() const {
+  size_t count = 0;
+  for (const auto& b : items_) {
+    count += b->buf ? b->buf->countChainElements() : 1;
+  }
+
+  // fuse_bufvec ends with a variable length array of fuse_buf.
+  auto size = sizeof(fuse_bufvec) + count * sizeof(fuse_buf);
+  FuseBufvecPtr result(static_cast<fuse_bufvec*>(calloc(1, size)), free);
+  if (!result) {
+    throw std::bad_alloc();
+  }
+  result->count = count;
+
+  auto* out = result->buf;
+  for (const auto& b : items_) {
+    if (!b->buf) {
+      out->flags =
+          static_cast<fuse_buf_flags>(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+      out->fd = b->file.fd();
+      out->pos = b->fd_pos;
+      out->size = b->fd_size;
+      ++out;
+      continue;
+    }
+    for (const auto& range : *b->buf) {
+      out->mem = const_cast<uint8_t*>(range.data());
+      out->size = range.size();
+      ++out;
+    }
+  }
+  return result;
+}
+#endif
 }
 }
 }
@@ -9,7 +9,9 @@
  */
 #pragma once
 #include <folly/FBVector.h>
+#include <folly/File.h>
 #include <folly/io/IOBuf.h>
+#include "eden/fuse/fuse_headers.h"
 
 namespace facebook {
 namespace eden {
@@ -18,14 +20,15 @@ namespace fusell {
 /**
  * Represents data that may come from a buffer or a file descriptor.
  *
- * While we don't currently have a fuse client lib that supports this,
- * we want to make sure we're ready to use it, so this looks like
- * a dumb wrapper around IOBuf at the moment.
+ * Data that comes from a file descriptor is not read until it is needed.
+ * When replying to the kernel, getFuseBufvec() lets libfuse splice it
+ * straight from the file to the FUSE device without copying it through
+ * user space.
  */
 class BufVec {
   struct Buf {
     std::unique_ptr<folly::IOBuf> buf;
-    int fd{-1};
+    folly::File file;
     size_t fd_size{0};
     off_t fd_pos{-1};
 
@@ -35,6 +38,13 @@ class BufVec {
     Buf& operator=(Buf&&) = default;
 
     explicit Buf(std::unique_ptr<folly::IOBuf> buf);
+    Buf(folly::File file, size_t size, off_t pos);
+
+    /**
+     * Read the file data into buf, if this Buf refers to a file that has
+     * not been read yet.
+     */
+    void readFile();
   };
   folly::fbvector<std::shared_ptr<Buf>> items_;
 
@@ -46,12 +56,34 @@ class BufVec {
 
   explicit BufVec(std::unique_ptr<folly::IOBuf> buf);
 
+  /**
+   * Create a BufVec referring to up to size bytes of a file, starting at
+   * offset pos.  The data is read from the file when the BufVec is used,
+   * so the file must not be modified in the meantime if the caller needs
+   * a consistent snapshot.  Reads past the end of the file are truncated.
+   */
+  BufVec(folly::File file, size_t size, off_t pos);
+
   /**
    * Return an iovector suitable for e.g. writev()
    *   auto iov = buf->getIov();
    *   auto xfer = writev(fd, iov.data(), iov.size());
    */
   folly::fbvector<struct iovec> getIov() const;
+
+#if FUSE_MINOR_VERSION >= 9
+  using FuseBufvecPtr = std::unique_ptr<fuse_bufvec, void (*)(void*)>;
+
+  /**
+   * Return a fuse_bufvec describing this data, suitable for
+   * fuse_reply_data().  File-backed data is described by its file
+   * descriptor rather than read into memory, so that it can be spliced.
+   *
+   * The result refers to the buffers and files held by this BufVec, and
+   * must not be used after the BufVec is destroyed.
+   */
+  FuseBufvecPtr getFuseBufvec() const;
+#endif
 };
 }
 }
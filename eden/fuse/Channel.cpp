@@ -9,24 +9,65 @@
  */
 #include "Channel.h"
 
+#include <folly/Conv.h>
 #include <folly/Exception.h>
 #include <folly/File.h>
 #include <folly/Format.h>
+#include <folly/ScopeGuard.h>
 #include <folly/String.h>
+#include <folly/ThreadName.h>
+#include <gflags/gflags.h>
 #include <linux/fuse.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <unistd.h>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <vector>
 
 #include "Dispatcher.h"
 #include "MountPoint.h"
 #include "SessionDeleter.h"
+#include "eden/utils/NumaTopology.h"
 #include "eden/fuse/privhelper/PrivHelper.h"
 
 using namespace folly;
 
+DEFINE_int32(
+    fuseNumThreads,
+    16,
+    "The number of threads reading and dispatching requests from each FUSE "
+    "mount");
+DEFINE_bool(
+    fuseThreadAffinity,
+    false,
+    "Pin each FUSE worker thread to a single CPU, assigned round-robin");
+DEFINE_int32(
+    fuseMaxWrite,
+    128 * 1024,
+    "The largest write request to accept from the kernel.  Each FUSE worker "
+    "thread allocates a receive buffer of this size plus a page.");
+DEFINE_bool(
+    fuseCloneDevice,
+    true,
+    "Give each FUSE worker thread its own clone of the /dev/fuse file "
+    "descriptor, when the kernel supports it");
+
+#ifndef FUSE_DEV_IOC_CLONE
+// Older kernel headers do not define this.  Kernels without support for it
+// fail the ioctl with ENOTTY, so it is safe to try regardless.
+#define FUSE_DEV_IOC_CLONE _IOR(229, 0, uint32_t)
+#endif
+
 namespace facebook {
 namespace eden {
 namespace fusell {
@@ -42,16 +83,34 @@ namespace {
  * implementations.
  */
 
+/**
+ * Get the session that a channel belongs to.
+ *
+ * A fuse_session only tracks a single channel, so the cloned channels are
+ * never added to it.  They point to their session through their user data
+ * instead.
+ */
+fuse_session* getChanSession(struct fuse_chan* ch) {
+  auto session = fuse_chan_session(ch);
+  if (!session) {
+    session = static_cast<fuse_session*>(fuse_chan_data(ch));
+  }
+  return session;
+}
+
 int fuseChanReceive(struct fuse_chan** chp, char* buf, size_t size) {
   struct fuse_chan* ch = *chp;
-  auto session = fuse_chan_session(ch);
+  auto session = getChanSession(ch);
 
   int fd = fuse_chan_fd(ch);
   while (true) {
     auto res = read(fd, buf, size);
     int err = errno;
 
-    if (fuse_session_exited(session)) {
+    // A request read after the session exited must still be processed.  If
+    // the session is stopping for a takeover, the next process never sees
+    // it, and the kernel would wait forever for the reply.
+    if (res <= 0 && fuse_session_exited(session)) {
       return 0;
     }
     if (res < 0) {
@@ -99,7 +158,7 @@ int fuseChanSend(struct fuse_chan* ch, const struct iovec iov[], size_t count) {
   if (res < 0) {
     if (err == ENOENT) {
       // Interrupted by a signal.  This is not an issue
-    } else if (fuse_session_exited(fuse_chan_session(ch))) {
+    } else if (fuse_session_exited(getChanSession(ch))) {
       LOG(INFO) << "error writing to fuse device: session closed";
     } else {
       LOG(WARNING) << "error writing to fuse device: " << folly::errnoStr(err);
@@ -113,16 +172,22 @@ void fuseChanDestroy(struct fuse_chan* ch) {
   close(fuse_chan_fd(ch));
 }
 
-fuse_chan* fuseChanNew(folly::File&& fuseDevice) {
+fuse_chan* fuseChanNew(
+    folly::File&& fuseDevice,
+    fuse_session* cloneSession = nullptr) {
   struct fuse_chan_ops op;
   op.receive = fuseChanReceive;
   op.send = fuseChanSend;
   op.destroy = fuseChanDestroy;
 
+  // libfuse limits max_write to the buffer size minus 4KB of room for the
+  // request headers.  Like libfuse's own channels, never use less than
+  // 0x21000 bytes, which allows 128KB writes.
+  constexpr size_t kHeaderRoom = 0x1000;
   constexpr size_t MIN_BUFSIZE = 0x21000;
-  size_t bufsize =
-      std::min(static_cast<size_t>(getpagesize()) + 0x1000, MIN_BUFSIZE);
-  auto* ch = fuse_chan_new(&op, fuseDevice.fd(), bufsize, nullptr);
+  size_t maxWrite = std::max<int32_t>(FLAGS_fuseMaxWrite, getpagesize());
+  size_t bufsize = std::max(maxWrite + kHeaderRoom, MIN_BUFSIZE);
+  auto* ch = fuse_chan_new(&op, fuseDevice.fd(), bufsize, cloneSession);
   if (!ch) {
     throw std::runtime_error("failed to mount");
   }
@@ -134,6 +199,192 @@ fuse_chan* fuseChanNew(folly::File&& fuseDevice) {
   return ch;
 }
 
+/**
+ * Create a new channel attached to the same FUSE connection as an existing
+ * one.  The kernel queues each request on a single device file descriptor
+ * and expects the reply on that descriptor, so every worker reading from its
+ * own clone gets its own queue.
+ *
+ * Returns nullptr if the kernel does not support cloning, in which case the
+ * caller should share the original channel.
+ */
+fuse_chan* fuseChanClone(fuse_chan* chan, fuse_session* sess) {
+  int fd = open("/dev/fuse", O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    LOG(WARNING) << "unable to open /dev/fuse to clone the FUSE channel: "
+                 << folly::errnoStr(errno);
+    return nullptr;
+  }
+  folly::File cloneDevice(fd, /*ownsFd=*/true);
+
+  uint32_t masterFd = fuse_chan_fd(chan);
+  if (ioctl(cloneDevice.fd(), FUSE_DEV_IOC_CLONE, &masterFd) != 0) {
+    int err = errno;
+    if (err == ENOTTY || err == EINVAL) {
+      LOG(INFO) << "the kernel does not support cloning FUSE channels";
+    } else {
+      LOG(WARNING) << "error cloning FUSE channel: " << folly::errnoStr(err);
+    }
+    return nullptr;
+  }
+  return fuseChanNew(std::move(cloneDevice), sess);
+}
+
+/*
+ * fuse_chan_ops functions for a channel that discards the replies sent to
+ * it.  This is used to replay the FUSE_INIT request of a connection that
+ * was taken over from another process, which already replied to it.
+ */
+
+int discardChanSend(struct fuse_chan*, const struct iovec[], size_t) {
+  return 0;
+}
+
+void discardChanDestroy(struct fuse_chan*) {}
+
+/**
+ * Run a FUSE_INIT request through a new session, so that it is ready to
+ * process requests on a connection that was already initialized.
+ */
+void replayInitRequest(
+    fuse_session* sess,
+    fuse_chan* chan,
+    const std::string& initRequest) {
+  struct fuse_chan_ops op;
+  op.receive = nullptr;
+  op.send = discardChanSend;
+  op.destroy = discardChanDestroy;
+
+  // libfuse derives the connection's max_write from the size of the
+  // channel's buffer, so make it match the real channel.
+  auto* discardChan = fuse_chan_new(&op, -1, fuse_chan_bufsize(chan), nullptr);
+  if (!discardChan) {
+    throw std::runtime_error("failed to create FUSE channel");
+  }
+  SCOPE_EXIT {
+    fuse_chan_destroy(discardChan);
+  };
+
+  std::vector<char> buf(initRequest.begin(), initRequest.end());
+  fuse_session_process(sess, buf.data(), buf.size(), discardChan);
+}
+
+/**
+ * The signal used to interrupt workers blocked reading from the FUSE device
+ * when the session stops for a takeover.
+ */
+constexpr int kStopSignal = SIGUSR2;
+
+void installStopSignalHandler() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = [](int) {};
+    sigemptyset(&action.sa_mask);
+    // Leave out SA_RESTART, so that read() fails with EINTR.
+    action.sa_flags = 0;
+    checkUnixError(
+        sigaction(kStopSignal, &action, nullptr),
+        "failed to install the FUSE worker stop signal handler");
+  });
+}
+
+/**
+ * Bind a FUSE worker thread to CPUs.
+ *
+ * With more than one NUMA node in use, the workers are spread over the
+ * nodes in turn, and each is bound to its node.  The requests it dispatches
+ * then use the node's own shard of the caches that are split by node.
+ * --fuseThreadAffinity further pins each worker to a single CPU, within its
+ * node if there is more than one.
+ */
+void placeCurrentThread(size_t workerIndex) {
+#ifdef __linux__
+  const auto& numa = NumaTopology::get();
+  auto numNodes = numa.getNumNodes();
+  if (numNodes == 1 && !FLAGS_fuseThreadAffinity) {
+    return;
+  }
+  try {
+    auto node = workerIndex % numNodes;
+    if (FLAGS_fuseThreadAffinity) {
+      std::vector<unsigned> cpus = numa.getNodeCpus(node);
+      if (numNodes == 1) {
+        auto numCpus = std::thread::hardware_concurrency();
+        if (numCpus == 0) {
+          return;
+        }
+        cpus = {static_cast<unsigned>(workerIndex % numCpus)};
+      } else if (!cpus.empty()) {
+        cpus = {cpus[(workerIndex / numNodes) % cpus.size()]};
+      }
+      NumaTopology::setCurrentThreadCpus(cpus);
+    } else {
+      numa.bindCurrentThread(node);
+    }
+  } catch (const std::exception& ex) {
+    LOG(WARNING) << "failed to bind FUSE worker " << workerIndex
+                 << " to its CPUs: " << folly::exceptionStr(ex);
+  }
+#else
+  (void)workerIndex;
+#endif
+}
+
+/**
+ * Read requests from the channel and dispatch them until the session exits.
+ *
+ * waitUntilActive is called before each read, and blocks while this worker
+ * is not needed.
+ *
+ * Returns false if the session was stopped by an error reading from the
+ * FUSE device rather than by the filesystem being unmounted.
+ */
+bool processRequests(
+    fuse_session* sess,
+    fuse_chan* chan,
+    std::atomic<bool>* reading,
+    std::string* initRequest,
+    const std::function<void()>& waitUntilActive) {
+  std::vector<char> buf(fuse_chan_bufsize(chan));
+  while (!fuse_session_exited(sess)) {
+    waitUntilActive();
+    if (fuse_session_exited(sess)) {
+      break;
+    }
+    // fuse_chan_recv() may replace the channel to reply on, so pass it a
+    // copy rather than our only pointer to it.
+    auto ch = chan;
+    reading->store(true);
+    auto res = fuse_chan_recv(&ch, buf.data(), buf.size());
+    reading->store(false);
+    if (res == -EINTR || res == -EAGAIN) {
+      continue;
+    }
+    if (res < 0) {
+      // Stop the other workers too.  They will notice once their current
+      // read returns.
+      fuse_session_exit(sess);
+      return false;
+    }
+    if (res == 0) {
+      // The filesystem was unmounted.  Exit the session, so that workers
+      // that are not reading notice too.
+      fuse_session_exit(sess);
+      break;
+    }
+    auto header = reinterpret_cast<const fuse_in_header*>(buf.data());
+    if (header->opcode == FUSE_INIT) {
+      // Keep the request, in case another process takes over the connection
+      // and needs to initialize its own session.
+      initRequest->assign(buf.data(), res);
+    }
+    fuse_session_process(sess, buf.data(), res, ch);
+  }
+  return true;
+}
+
 } // unnamed namespace
 
 Channel::Channel(const MountPoint* mount) : mountPoint_(mount) {
@@ -141,6 +392,15 @@ Channel::Channel(const MountPoint* mount) : mountPoint_(mount) {
   ch_ = fuseChanNew(std::move(fuseDevice));
 }
 
+Channel::Channel(const MountPoint* mount, FuseChannelData&& takeoverData)
+    : mountPoint_(mount), initRequest_(std::move(takeoverData.initRequest)) {
+  if (initRequest_.empty()) {
+    throw std::invalid_argument(
+        "cannot take over a FUSE connection without its FUSE_INIT request");
+  }
+  ch_ = fuseChanNew(std::move(takeoverData.fuseDevice));
+}
+
 const MountPoint* Channel::getMountPoint() const {
   return mountPoint_;
 }
@@ -180,12 +440,162 @@ void Channel::invalidateEntry(fuse_ino_t parent, PathComponentPiece name) {
 #endif
 }
 
+void Channel::setNumWorkers(size_t numWorkers) {
+  std::lock_guard<std::mutex> guard(stateMutex_);
+  targetWorkers_ = std::max<size_t>(numWorkers, 1);
+  stateCV_.notify_all();
+}
+
+void Channel::stopForTakeover() {
+  installStopSignalHandler();
+
+  std::lock_guard<std::mutex> guard(stateMutex_);
+  if (!session_) {
+    throw std::runtime_error("the FUSE session is not running");
+  }
+  stoppingForTakeover_ = true;
+  fuse_session_exit(session_);
+  stateCV_.notify_all();
+}
+
+FuseChannelData Channel::releaseForTakeover() {
+  CHECK(ch_ != nullptr);
+  {
+    std::lock_guard<std::mutex> guard(stateMutex_);
+    CHECK(stoppingForTakeover_ && !session_);
+  }
+
+  FuseChannelData data;
+  auto fd = fcntl(fuse_chan_fd(ch_), F_DUPFD_CLOEXEC, 0);
+  checkUnixError(fd, "failed to duplicate the FUSE device descriptor");
+  data.fuseDevice = folly::File(fd, /*ownsFd=*/true);
+  data.initRequest = std::move(initRequest_);
+
+  // This closes our descriptor for the device, but not the duplicate, so
+  // the kernel keeps the connection open.
+  fuse_chan_destroy(ch_);
+  ch_ = nullptr;
+  return data;
+}
+
 void Channel::runSession(Dispatcher* disp, bool debug) {
   auto sess = disp->makeSession(*this, debug);
   fuse_session_add_chan(sess.get(), ch_);
+  if (!initRequest_.empty()) {
+    // The connection was taken over from another process, which already
+    // answered the kernel's FUSE_INIT request.
+    replayInitRequest(sess.get(), ch_, initRequest_);
+  }
+
+  // Rather than using fuse_session_loop_mt(), which creates threads on
+  // demand whenever all of its threads are busy, run a fixed number of
+  // workers.  This keeps the number of threads bounded under heavy parallel
+  // load.  setNumWorkers() can change the number while the session runs:
+  // more workers are started as needed, and surplus ones wait without
+  // reading until they are needed again.
+
+  // Give the workers their own device descriptors where possible, so that
+  // they do not all contend on a single kernel request queue.
+  std::vector<fuse_chan*> clones;
+  SCOPE_EXIT {
+    for (auto* clone : clones) {
+      fuse_chan_destroy(clone);
+    }
+  };
+  bool canClone = FLAGS_fuseCloneDevice;
+
+  std::atomic<bool> failed{false};
+  // A deque, so that the flags stay in place as workers are added.
+  std::deque<std::atomic<bool>> reading;
+  std::vector<std::thread> workers;
+  // Start another worker.  stateMutex_ must be held.
+  auto startWorker = [&] {
+    auto index = workers.size();
+    auto* chan = ch_;
+    if (index > 0 && canClone) {
+      auto* clone = fuseChanClone(ch_, sess.get());
+      if (clone) {
+        clones.push_back(clone);
+        chan = clone;
+      } else {
+        // Cloning is unsupported, so don't try again.
+        canClone = false;
+      }
+    }
+    reading.emplace_back(false);
+    auto* readingFlag = &reading.back();
+    ++numRunningWorkers_;
+    workers.emplace_back([this, &sess, &failed, chan, readingFlag, index] {
+      folly::setThreadName(folly::to<std::string>("fuse", index));
+      placeCurrentThread(index);
+      auto waitUntilActive = [this, &sess, index] {
+        std::unique_lock<std::mutex> lock(stateMutex_);
+        stateCV_.wait(lock, [this, &sess, index] {
+          return index < targetWorkers_ || fuse_session_exited(sess.get());
+        });
+      };
+      if (!processRequests(
+              sess.get(), chan, readingFlag, &initRequest_, waitUntilActive)) {
+        failed = true;
+      }
+      std::lock_guard<std::mutex> guard(stateMutex_);
+      --numRunningWorkers_;
+      stateCV_.notify_all();
+    });
+  };
 
-  auto err = fuse_session_loop_mt(sess.get());
-  if (err) {
+  bool takeover = false;
+  {
+    std::unique_lock<std::mutex> lock(stateMutex_);
+    session_ = sess.get();
+    if (targetWorkers_ == 0) {
+      targetWorkers_ = static_cast<size_t>(std::max(FLAGS_fuseNumThreads, 1));
+    }
+    while (true) {
+      if (stoppingForTakeover_) {
+        if (numRunningWorkers_ == 0) {
+          break;
+        }
+        // Workers blocked in read() do not notice that the session has
+        // exited until a request arrives, so interrupt them.  A signal can
+        // arrive just before a worker starts reading, so keep trying until
+        // they all stop.
+        for (size_t n = 0; n < workers.size(); ++n) {
+          if (reading[n].load()) {
+            pthread_kill(workers[n].native_handle(), kStopSignal);
+          }
+        }
+        stateCV_.wait_for(lock, std::chrono::milliseconds(10));
+        continue;
+      }
+      if (!fuse_session_exited(sess.get()) &&
+          workers.size() < targetWorkers_) {
+        startWorker();
+        continue;
+      }
+      if (numRunningWorkers_ == 0) {
+        break;
+      }
+      stateCV_.wait(lock);
+    }
+    session_ = nullptr;
+    takeover = stoppingForTakeover_;
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  if (takeover) {
+    // Requests that the workers already dispatched reply through the
+    // session, so they must finish before it is destroyed.
+    while (disp->getRequestMetrics().getTotalOutstanding() > 0) {
+      /* sleep override */
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    LOG(INFO) << "session stopped for takeover";
+    return;
+  }
+  if (failed) {
     throw std::runtime_error("session failed");
   }
   LOG(INFO) << "session completed";
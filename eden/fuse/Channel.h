@@ -9,6 +9,10 @@
  */
 #pragma once
 #include <folly/Range.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include "eden/fuse/FuseChannelData.h"
 #include "eden/fuse/fuse_headers.h"
 #include "eden/utils/PathFuncs.h"
 
@@ -23,21 +27,73 @@ class Channel {
   fuse_chan* ch_;
   const MountPoint* mountPoint_;
 
+  /**
+   * The raw FUSE_INIT request that started the session.
+   *
+   * This is written by the worker that reads the request, before the kernel
+   * sends anything else, and is only read once the workers have stopped.
+   */
+  std::string initRequest_;
+
+  std::mutex stateMutex_;
+  std::condition_variable stateCV_;
+  // The fields below are protected by stateMutex_.
+  fuse_session* session_{nullptr};
+  size_t numRunningWorkers_{0};
+  /** The number of workers that should be reading requests */
+  size_t targetWorkers_{0};
+  bool stoppingForTakeover_{false};
+
   friend class SessionDeleter;
 
  public:
   Channel(const Channel&) = delete;
   Channel& operator=(const Channel&) = delete;
-  Channel(Channel&&) = default;
-  Channel& operator=(Channel&&) = default;
+  Channel(Channel&&) = delete;
+  Channel& operator=(Channel&&) = delete;
 
   explicit Channel(const MountPoint* mountPoint);
+
+  /**
+   * Create a channel for a FUSE connection that another process set up and
+   * then released with releaseForTakeover().
+   */
+  Channel(const MountPoint* mountPoint, FuseChannelData&& takeoverData);
   ~Channel();
 
   const MountPoint* getMountPoint() const;
 
   void runSession(Dispatcher* disp, bool debug);
 
+  /**
+   * Change the number of worker threads reading requests from the kernel.
+   *
+   * This may be called before or while runSession() runs.  Until it is
+   * called, runSession() uses --fuseNumThreads.  Workers are started as
+   * needed.  When the number is lowered, the surplus workers finish the
+   * request they are handling and then wait until they are needed again.
+   */
+  void setNumWorkers(size_t numWorkers);
+
+  /**
+   * Make runSession() return without unmounting, so that another process
+   * can take over the FUSE connection.
+   *
+   * This returns immediately.  runSession() finishes any requests already
+   * read from the kernel before returning; requests not yet read stay queued
+   * in the kernel for the next process.
+   */
+  void stopForTakeover();
+
+  /**
+   * Once runSession() has returned after stopForTakeover(), release the FUSE
+   * connection so that it can be handed to another process.
+   *
+   * The channel must not be used afterwards, and destroying it no longer
+   * unmounts the filesystem.
+   */
+  FuseChannelData releaseForTakeover();
+
   /**
    * Notify to invalidate cache for an inode
    *
@@ -11,6 +11,7 @@
 #include <folly/Exception.h>
 #include <folly/Format.h>
 #include <folly/MoveWrapper.h>
+#include <gflags/gflags.h>
 #include <wangle/concurrent/GlobalExecutor.h>
 #include "DirHandle.h"
 #include "FileHandle.h"
@@ -21,6 +22,22 @@
 using namespace folly;
 using namespace std::chrono;
 
+DEFINE_bool(
+    fuseSpliceWrite,
+    true,
+    "Splice file-backed read replies to the FUSE device, if the kernel "
+    "supports it");
+DEFINE_int32(
+    fuseMaxReadahead,
+    0,
+    "The largest readahead request the kernel may send, in bytes.  0 uses the "
+    "largest value the kernel offers");
+DEFINE_int32(
+    fuseSlowRequestLogSize,
+    256,
+    "The number of recent slow FUSE requests to remember for each mount");
+DECLARE_int32(fuseMaxWrite);
+
 namespace facebook {
 namespace eden {
 namespace fusell {
@@ -32,7 +49,8 @@ Dispatcher::Attr::Attr(const MountPoint* mount)
 
 Dispatcher::~Dispatcher() {}
 
-Dispatcher::Dispatcher(folly::ThreadLocal<EdenStats>* stats) : stats_(stats) {}
+Dispatcher::Dispatcher(folly::ThreadLocal<EdenStats>* stats)
+    : stats_(stats), slowRequests_(FLAGS_fuseSlowRequestLogSize) {}
 
 void Dispatcher::setMountPoint(MountPoint* mountPoint) {
   CHECK(mountPoint_ == nullptr);
@@ -96,6 +114,9 @@ static std::unordered_map<int32_t, const char*> capsLabels = {
     {FUSE_CAP_FLOCK_LOCKS, "FLOCK_LOCKS"},
     {FUSE_CAP_IOCTL_DIR, "IOCTL_DIR"},
 #endif
+#ifdef FUSE_CAP_CACHE_SYMLINKS
+    {FUSE_CAP_CACHE_SYMLINKS, "CACHE_SYMLINKS"},
+#endif
 #ifdef __APPLE__
     {FUSE_CAP_ALLOCATE, "ALLOCATE"},
     {FUSE_CAP_EXCHANGE_DATA, "EXCHANGE_DATA"},
@@ -114,6 +135,27 @@ void Dispatcher::disp_init(void* userdata, struct fuse_conn_info* conn) {
 #endif
                                     FUSE_CAP_ATOMIC_O_TRUNC |
                                     FUSE_CAP_BIG_WRITES | FUSE_CAP_ASYNC_READ);
+  // libfuse has already limited these to what the kernel and the channel's
+  // receive buffer allow, so they can only be lowered here.
+  conn->max_write =
+      std::min<uint32_t>(conn->max_write, std::max(FLAGS_fuseMaxWrite, 4096));
+  if (FLAGS_fuseMaxReadahead > 0) {
+    conn->max_readahead =
+        std::min<uint32_t>(conn->max_readahead, FLAGS_fuseMaxReadahead);
+  }
+
+#ifdef FUSE_CAP_CACHE_SYMLINKS
+  // A symlink's target never changes once it has been created, so the
+  // kernel can keep it in its page cache instead of asking for it again on
+  // every path lookup that goes through the symlink.
+  conn->want |= conn->capable & FUSE_CAP_CACHE_SYMLINKS;
+#endif
+
+#ifdef FUSE_CAP_SPLICE_WRITE
+  if (FLAGS_fuseSpliceWrite) {
+    conn->want |= conn->capable & FUSE_CAP_SPLICE_WRITE;
+  }
+#endif
 
   disp->initConnection(*conn);
   disp->connInfo_ = *conn;
@@ -142,14 +184,11 @@ folly::Future<fuse_entry_param> Dispatcher::lookup(
 static void disp_lookup(fuse_req_t req, fuse_ino_t parent, const char* name) {
   auto& request = RequestData::create(req);
   auto* dispatcher = request.getDispatcher();
-  request.setRequestFuture(
-      request.startRequest(dispatcher->getStats(), &EdenStats::lookup)
-          .then([=, &request] {
-            return dispatcher->lookup(parent, PathComponentPiece(name));
-          })
-          .then([](fuse_entry_param&& param) {
-            RequestData::get().replyEntry(param);
-          }));
+  request.dispatch(
+      dispatcher->getStats(),
+      &EdenStats::lookup,
+      [=] { return dispatcher->lookup(parent, PathComponentPiece(name)); },
+      [](fuse_entry_param&& param) { RequestData::get().replyEntry(param); });
 }
 
 folly::Future<folly::Unit> Dispatcher::forget(fuse_ino_t ino,
@@ -157,6 +196,14 @@ folly::Future<folly::Unit> Dispatcher::forget(fuse_ino_t ino,
   return Unit{};
 }
 
+folly::Future<folly::Unit> Dispatcher::forgetMulti(
+    std::vector<std::pair<fuse_ino_t, uint32_t>> forgets) {
+  for (const auto& forget : forgets) {
+    this->forget(forget.first, forget.second);
+  }
+  return Unit{};
+}
+
 static void disp_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
   auto& request = RequestData::create(req);
   auto* dispatcher = request.getDispatcher();
@@ -170,15 +217,16 @@ static void disp_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
 static void
 disp_forget_multi(fuse_req_t req, size_t count, fuse_forget_data* forgets) {
   auto& request = RequestData::create(req);
-  std::vector<fuse_forget_data> forget(forgets, forgets + count);
+  std::vector<std::pair<fuse_ino_t, uint32_t>> forget;
+  forget.reserve(count);
+  for (size_t n = 0; n < count; ++n) {
+    forget.emplace_back(forgets[n].ino, forgets[n].nlookup);
+  }
   auto* dispatcher = request.getDispatcher();
   request.catchErrors(
       request.startRequest(dispatcher->getStats(), &EdenStats::forgetmulti)
-          .then([ =, &request, forget = std::move(forget) ] {
-            for (auto& f : forget) {
-              dispatcher->forget(f.ino, f.nlookup);
-            }
-            return Unit{};
+          .then([ =, &request, forget = std::move(forget) ]() mutable {
+            return dispatcher->forgetMulti(std::move(forget));
           })
           .then([]() { RequestData::get().replyNone(); }));
 }
@@ -194,23 +242,21 @@ static void disp_getattr(fuse_req_t req,
   auto& request = RequestData::create(req);
   auto* dispatcher = request.getDispatcher();
 
+  auto replyAttr = [](Dispatcher::Attr&& attr) {
+    RequestData::get().replyAttr(attr.st, attr.timeout);
+  };
   if (fi) {
-    request.setRequestFuture(
-        request.startRequest(dispatcher->getStats(), &EdenStats::getattr)
-            .then([ =, &request, fi = *fi ] {
-              return dispatcher->getGenericFileHandle(fi.fh)->getattr();
-            })
-            .then([](Dispatcher::Attr&& attr) {
-              RequestData::get().replyAttr(attr.st, attr.timeout);
-            }));
-
+    request.dispatch(
+        dispatcher->getStats(),
+        &EdenStats::getattr,
+        [=] { return dispatcher->getGenericFileHandle(fi->fh)->getattr(); },
+        replyAttr);
   } else {
-    request.setRequestFuture(
-        request.startRequest(dispatcher->getStats(), &EdenStats::getattr)
-            .then([=, &request] { return dispatcher->getattr(ino); })
-            .then([](Dispatcher::Attr&& attr) {
-              RequestData::get().replyAttr(attr.st, attr.timeout);
-            }));
+    request.dispatch(
+        dispatcher->getStats(),
+        &EdenStats::getattr,
+        [=] { return dispatcher->getattr(ino); },
+        replyAttr);
   }
 }
 
@@ -258,12 +304,11 @@ folly::Future<std::string> Dispatcher::readlink(fuse_ino_t ino) {
 static void disp_readlink(fuse_req_t req, fuse_ino_t ino) {
   auto& request = RequestData::create(req);
   auto* dispatcher = request.getDispatcher();
-  request.setRequestFuture(
-      request.startRequest(dispatcher->getStats(), &EdenStats::readlink)
-          .then([=, &request] { return dispatcher->readlink(ino); })
-          .then([](std::string&& str) {
-            RequestData::get().replyReadLink(str);
-          }));
+  request.dispatch(
+      dispatcher->getStats(),
+      &EdenStats::readlink,
+      [=] { return dispatcher->readlink(ino); },
+      [](std::string&& str) { RequestData::get().replyReadLink(str); });
 }
 
 folly::Future<fuse_entry_param> Dispatcher::mknod(
@@ -461,10 +506,7 @@ static void disp_read(fuse_req_t req,
             auto fh = dispatcher->getFileHandle(fi.fh);
             return fh->read(size, off);
           })
-          .then([](BufVec&& buf) {
-            auto iov = buf.getIov();
-            RequestData::get().replyIov(iov.data(), iov.size());
-          }));
+          .then([](BufVec&& buf) { RequestData::get().replyData(buf); }));
 }
 
 static void disp_write(fuse_req_t req,
@@ -694,19 +736,20 @@ static void disp_getxattr(fuse_req_t req,
   }
 #endif
 
-  request.setRequestFuture(
-      request.startRequest(dispatcher->getStats(), &EdenStats::getxattr)
-          .then([=, &request] { return dispatcher->getxattr(ino, name); })
-          .then([size](std::string attr) {
-            auto& request = RequestData::get();
-            if (size == 0) {
-              request.replyXattr(attr.size());
-            } else if (size < attr.size()) {
-              request.replyError(ERANGE);
-            } else {
-              request.replyBuf(attr.data(), attr.size());
-            }
-          }));
+  request.dispatch(
+      dispatcher->getStats(),
+      &EdenStats::getxattr,
+      [=] { return dispatcher->getxattr(ino, name); },
+      [size](std::string&& attr) {
+        auto& request = RequestData::get();
+        if (size == 0) {
+          request.replyXattr(attr.size());
+        } else if (size < attr.size()) {
+          request.replyError(ERANGE);
+        } else {
+          request.replyBuf(attr.data(), attr.size());
+        }
+      });
 }
 
 folly::Future<std::vector<std::string>> Dispatcher::listxattr(fuse_ino_t ino) {
@@ -14,10 +14,15 @@
 #include <folly/Range.h>
 #include <folly/ThreadLocal.h>
 #include <folly/futures/Future.h>
+#include <utility>
+#include <vector>
 #include "eden/fuse/EdenStats.h"
 #include "eden/fuse/FileHandleMap.h"
+#include "eden/fuse/RequestMetrics.h"
+#include "eden/fuse/SlowRequestLog.h"
 #include "eden/fuse/fuse_headers.h"
 #include "eden/utils/PathFuncs.h"
+#include "eden/utils/RequestSampler.h"
 
 namespace facebook {
 namespace eden {
@@ -49,6 +54,9 @@ class Dispatcher {
   MountPoint* mountPoint_{nullptr};
   folly::ThreadLocal<EdenStats>* stats_{nullptr};
   FileHandleMap fileHandles_;
+  SlowRequestLog slowRequests_;
+  RequestSampler requestSampler_;
+  RequestMetrics requestMetrics_;
 
  public:
   virtual ~Dispatcher();
@@ -70,6 +78,29 @@ class Dispatcher {
   const fuse_conn_info& getConnInfo() const;
   FileHandleMap& getFileHandles();
 
+  /**
+   * Returns the log of recent requests that took longer than
+   * --fuseSlowRequestThresholdUs.
+   */
+  SlowRequestLog& getSlowRequestLog() {
+    return slowRequests_;
+  }
+
+  /**
+   * Returns the sampler used by debugStartRequestSampling() to profile
+   * requests on this mount point.
+   */
+  RequestSampler& getRequestSampler() {
+    return requestSampler_;
+  }
+
+  /**
+   * Returns the gauges and counters for requests on this mount point.
+   */
+  RequestMetrics& getRequestMetrics() {
+    return requestMetrics_;
+  }
+
   // delegates to FileHandleMap::getGenericFileHandle
   std::shared_ptr<FileHandleBase> getGenericFileHandle(uint64_t fh);
   // delegates to FileHandleMap::getFileHandle
@@ -133,6 +164,16 @@ class Dispatcher {
   virtual folly::Future<folly::Unit> forget(fuse_ino_t ino,
                                             unsigned long nlookup);
 
+  /**
+   * Forget about several inodes at once
+   *
+   * Each entry is an inode number and the number of lookups to forget, as
+   * for forget().  The kernel sends these in bulk when it prunes its dentry
+   * cache.  The default implementation calls forget() for each entry.
+   */
+  virtual folly::Future<folly::Unit> forgetMulti(
+      std::vector<std::pair<fuse_ino_t, uint32_t>> forgets);
+
   /**
    * The stat information and the cache TTL for the kernel
    *
@@ -10,7 +10,9 @@
 #include "EdenStats.h"
 
 #include <folly/Array.h>
+#include <glog/logging.h>
 #include <chrono>
+#include <utility>
 
 using namespace folly;
 using namespace std::chrono;
@@ -19,6 +21,8 @@ namespace {
 constexpr std::chrono::microseconds kMinValue{0};
 constexpr std::chrono::microseconds kMaxValue{10000};
 constexpr std::chrono::microseconds kBucketSize{1000};
+constexpr std::chrono::microseconds kCheckoutMaxValue{60000000};
+constexpr std::chrono::microseconds kCheckoutBucketSize{500000};
 constexpr unsigned int kNumTimeseriesBuckets{60};
 constexpr auto kDurations = folly::make_array(
     std::chrono::seconds(60),
@@ -31,16 +35,80 @@ namespace facebook {
 namespace eden {
 namespace fusell {
 
+namespace {
+const std::pair<EdenStats::HistogramPtr, const char*> kOperations[] = {
+    {&EdenStats::lookup, "lookup"},
+    {&EdenStats::forget, "forget"},
+    {&EdenStats::getattr, "getattr"},
+    {&EdenStats::setattr, "setattr"},
+    {&EdenStats::readlink, "readlink"},
+    {&EdenStats::mknod, "mknod"},
+    {&EdenStats::mkdir, "mkdir"},
+    {&EdenStats::unlink, "unlink"},
+    {&EdenStats::rmdir, "rmdir"},
+    {&EdenStats::symlink, "symlink"},
+    {&EdenStats::rename, "rename"},
+    {&EdenStats::link, "link"},
+    {&EdenStats::open, "open"},
+    {&EdenStats::read, "read"},
+    {&EdenStats::write, "write"},
+    {&EdenStats::flush, "flush"},
+    {&EdenStats::release, "release"},
+    {&EdenStats::fsync, "fsync"},
+    {&EdenStats::opendir, "opendir"},
+    {&EdenStats::readdir, "readdir"},
+    {&EdenStats::releasedir, "releasedir"},
+    {&EdenStats::fsyncdir, "fsyncdir"},
+    {&EdenStats::statfs, "statfs"},
+    {&EdenStats::setxattr, "setxattr"},
+    {&EdenStats::getxattr, "getxattr"},
+    {&EdenStats::listxattr, "listxattr"},
+    {&EdenStats::removexattr, "removexattr"},
+    {&EdenStats::access, "access"},
+    {&EdenStats::create, "create"},
+    {&EdenStats::bmap, "bmap"},
+    {&EdenStats::ioctl, "ioctl"},
+    {&EdenStats::poll, "poll"},
+    {&EdenStats::forgetmulti, "forgetmulti"},
+};
+
+static_assert(
+    sizeof(kOperations) / sizeof(kOperations[0]) == EdenStats::kNumOperations,
+    "kOperations must list every FUSE operation histogram");
+}
+
+constexpr size_t EdenStats::kNumOperations;
+
 EdenStats::EdenStats() {}
 
+EdenStats::EdenStats(
+    folly::StringPiece prefix,
+    folly::ThreadLocal<EdenStats>* parent)
+    : prefix_(prefix.str()), parent_(parent) {}
+
 #if EDEN_HAS_COMMON_STATS
 EdenStats::Histogram EdenStats::createHistogram(const std::string& name) {
+  return createHistogram(name, kBucketSize, kMinValue, kMaxValue);
+}
+
+EdenStats::Histogram EdenStats::createCheckoutHistogram(
+    const std::string& name) {
+  return createHistogram(
+      name, kCheckoutBucketSize, kMinValue, kCheckoutMaxValue);
+}
+
+EdenStats::Histogram EdenStats::createHistogram(
+    const std::string& name,
+    microseconds bucketSize,
+    microseconds minValue,
+    microseconds maxValue) {
   return Histogram{this,
-                   name,
-                   kBucketSize.count(),
-                   kMinValue.count(),
-                   kMaxValue.count(),
+                   prefix_ + name,
+                   bucketSize.count(),
+                   minValue.count(),
+                   maxValue.count(),
                    facebook::stats::COUNT,
+                   facebook::stats::SUM,
                    50,
                    90,
                    99};
@@ -49,11 +117,25 @@ EdenStats::Histogram EdenStats::createHistogram(const std::string& name) {
 #else
 
 folly::TimeseriesHistogram<int64_t> EdenStats::createHistogram(
-    const std::string& /* name */) {
+    const std::string& name) {
+  return createHistogram(name, kBucketSize, kMinValue, kMaxValue);
+}
+
+folly::TimeseriesHistogram<int64_t> EdenStats::createCheckoutHistogram(
+    const std::string& name) {
+  return createHistogram(
+      name, kCheckoutBucketSize, kMinValue, kCheckoutMaxValue);
+}
+
+folly::TimeseriesHistogram<int64_t> EdenStats::createHistogram(
+    const std::string& /* name */,
+    microseconds bucketSize,
+    microseconds minValue,
+    microseconds maxValue) {
   return folly::TimeseriesHistogram<int64_t>{
-      kBucketSize.count(),
-      kMinValue.count(),
-      kMaxValue.count(),
+      bucketSize.count(),
+      minValue.count(),
+      maxValue.count(),
       MultiLevelTimeSeries<int64_t>{
           kNumTimeseriesBuckets, kDurations.size(), kDurations.data()}};
 }
@@ -69,6 +151,31 @@ void EdenStats::recordLatency(
 #else
   (this->*item)->addValue(now, elapsed.count());
 #endif
+  if (parent_) {
+    parent_->get()->recordLatency(item, elapsed, now);
+  }
+}
+
+folly::StringPiece EdenStats::getOperationName(HistogramPtr item) {
+  auto index = getOperationIndex(item);
+  if (index >= kNumOperations) {
+    return "unknown";
+  }
+  return getOperationName(index);
+}
+
+folly::StringPiece EdenStats::getOperationName(size_t index) {
+  CHECK_LT(index, kNumOperations);
+  return kOperations[index].second;
+}
+
+size_t EdenStats::getOperationIndex(HistogramPtr item) {
+  for (size_t index = 0; index < kNumOperations; ++index) {
+    if (kOperations[index].first == item) {
+      return index;
+    }
+  }
+  return kNumOperations;
 }
 }
 }
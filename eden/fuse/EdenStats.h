@@ -10,14 +10,18 @@
 #pragma once
 
 // Unless overridden by the build machinery, we assume that common/stats is
-// available to the build.  This isn't currently true in our opensource build.
-// If you want to explicitly check that we do the right thing for the opensource
-// build from inside our non-opensource build, you can edit this header and
-// force this to have the value 0.
+// available to the build.  The opensource build provides its own
+// implementation of it in the top-level common/ directory.  Setting this to 0
+// falls back to unexported per-thread folly histograms.
 #ifndef EDEN_HAS_COMMON_STATS
 #define EDEN_HAS_COMMON_STATS 1
 #endif
 
+#include <folly/Range.h>
+#include <folly/ThreadLocal.h>
+#include <chrono>
+#include <string>
+
 #if EDEN_HAS_COMMON_STATS
 #include "common/stats/ThreadLocalStats.h"
 #else
@@ -35,6 +39,10 @@ class EdenStats
           facebook::stats::TLStatsThreadSafe>
 #endif
 {
+  // These are declared before the histograms, whose names use prefix_.
+  std::string prefix_;
+  folly::ThreadLocal<EdenStats>* parent_{nullptr};
+
  public:
   using Histogram =
 #if EDEN_HAS_COMMON_STATS
@@ -44,7 +52,16 @@ class EdenStats
 #endif
       ;
 
-  explicit EdenStats();
+  EdenStats();
+
+  /**
+   * Create the stats for one mount point.
+   *
+   * The histogram names start with prefix, and every latency recorded here
+   * is also recorded in the calling thread's instance of parent, so that the
+   * parent aggregates all of the mount points.
+   */
+  EdenStats(folly::StringPiece prefix, folly::ThreadLocal<EdenStats>* parent);
 
   // We track latency in units of microseconds, hence the _us suffix
   // in the histogram names below.
@@ -83,6 +100,21 @@ class EdenStats
   Histogram poll{createHistogram("fuse.poll_us")};
   Histogram forgetmulti{createHistogram("fuse.forgetmulti_us")};
 
+  // Checkout operations take far longer than FUSE requests, so these use
+  // much larger buckets.  The phase times are summed over all of the
+  // directories in one checkout, which are processed concurrently.
+  Histogram checkoutTotal{createCheckoutHistogram("checkout.total_us")};
+  Histogram checkoutFetchTrees{
+      createCheckoutHistogram("checkout.fetch_trees_us")};
+  Histogram checkoutFetchBlobs{
+      createCheckoutHistogram("checkout.fetch_blobs_us")};
+  Histogram checkoutWriteOverlay{
+      createCheckoutHistogram("checkout.write_overlay_us")};
+  Histogram checkoutInvalidate{
+      createCheckoutHistogram("checkout.invalidate_us")};
+  Histogram checkoutCheckConflicts{
+      createCheckoutHistogram("checkout.check_conflicts_us")};
+
   // Since we can potentially finish a request in a different
   // thread from the one used to initiate it, we use HistogramPtr
   // as a helper for referencing the pointer-to-member that we
@@ -101,11 +133,40 @@ class EdenStats
       std::chrono::microseconds elapsed,
       std::chrono::seconds now);
 
+  /** The number of FUSE operations with a histogram above */
+  static constexpr size_t kNumOperations = 33;
+
+  /**
+   * Returns the name of the FUSE operation that a histogram tracks.
+   */
+  static folly::StringPiece getOperationName(HistogramPtr item);
+  static folly::StringPiece getOperationName(size_t index);
+
+  /**
+   * Returns a dense index in [0, kNumOperations) identifying the FUSE
+   * operation that a histogram tracks, or kNumOperations if item is not one
+   * of the histograms above.
+   */
+  static size_t getOperationIndex(HistogramPtr item);
+
  private:
 #if EDEN_HAS_COMMON_STATS
   Histogram createHistogram(const std::string& name);
+  Histogram createCheckoutHistogram(const std::string& name);
+  Histogram createHistogram(
+      const std::string& name,
+      std::chrono::microseconds bucketSize,
+      std::chrono::microseconds minValue,
+      std::chrono::microseconds maxValue);
 #else
   folly::TimeseriesHistogram<int64_t> createHistogram(const std::string& name);
+  folly::TimeseriesHistogram<int64_t> createCheckoutHistogram(
+      const std::string& name);
+  folly::TimeseriesHistogram<int64_t> createHistogram(
+      const std::string& name,
+      std::chrono::microseconds bucketSize,
+      std::chrono::microseconds minValue,
+      std::chrono::microseconds maxValue);
 #endif
 };
 }
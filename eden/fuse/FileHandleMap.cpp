@@ -10,7 +10,7 @@
 #include "FileHandleMap.h"
 
 #include <folly/Exception.h>
-#include <folly/Random.h>
+#include <algorithm>
 #include "DirHandle.h"
 #include "FileHandle.h"
 
@@ -18,15 +18,50 @@ namespace facebook {
 namespace eden {
 namespace fusell {
 
+constexpr size_t FileHandleMap::kSlotsPerChunk;
+constexpr size_t FileHandleMap::kMaxChunks;
+
+FileHandleMap::FileHandleMap() {
+  for (auto& chunk : chunks_) {
+    chunk.store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+FileHandleMap::~FileHandleMap() {
+  for (auto& chunk : chunks_) {
+    delete[] chunk.load(std::memory_order_relaxed);
+  }
+}
+
+FileHandleMap::Slot* FileHandleMap::getSlot(uint64_t fh) const {
+  auto slotNumber = static_cast<uint32_t>(fh);
+  if (slotNumber == 0) {
+    return nullptr;
+  }
+  auto index = slotNumber - 1;
+  auto chunkIndex = index / kSlotsPerChunk;
+  if (chunkIndex >= kMaxChunks) {
+    return nullptr;
+  }
+  auto* chunk = chunks_[chunkIndex].load(std::memory_order_acquire);
+  if (!chunk) {
+    return nullptr;
+  }
+  return &chunk[index % kSlotsPerChunk];
+}
+
 std::shared_ptr<FileHandleBase> FileHandleMap::getGenericFileHandle(
     uint64_t fh) {
-  auto handles = handles_.rlock();
-  auto iter = handles->find(fh);
-  if (iter == handles->end()) {
-    folly::throwSystemErrorExplicit(
-        EBADF, "file number ", fh, " is not tracked by this FileHandleMap");
+  auto* slot = getSlot(fh);
+  if (slot) {
+    auto generation = static_cast<uint32_t>(fh >> 32);
+    std::lock_guard<folly::MicroSpinLock> guard(slot->lock);
+    if (slot->handle && slot->generation == generation) {
+      return slot->handle;
+    }
   }
-  return iter->second;
+  folly::throwSystemErrorExplicit(
+      EBADF, "file number ", fh, " is not tracked by this FileHandleMap");
 }
 
 std::shared_ptr<FileHandle> FileHandleMap::getFileHandle(uint64_t fh) {
@@ -50,58 +85,118 @@ std::shared_ptr<DirHandle> FileHandleMap::getDirHandle(uint64_t fh) {
 }
 
 uint64_t FileHandleMap::recordHandle(std::shared_ptr<FileHandleBase> fh) {
-  auto handles = handles_.wlock();
-
-  // Our assignment strategy is just to take the address of the instance
-  // and return that as a 64-bit number.  This avoids needing to use
-  // any other mechanism for assigning or tracking numbers and keeps the
-  // cost of the assignment constant.
-  //
-  // However, in the future hot upgrade case, we need to be able to pass
-  // the mapping from another process where there is no way for us to
-  // contrive an address for a given instance.
-  //
-  // So what we do it first try to take the address from the incoming
-  // file handle, but if we get a collision we fall back to attempting
-  // a random assignment a reasonable number of times.  This is similar
-  // to the AUTOINCREMENT behavior in sqlite.
-  //
-  // The collision handling scenario should be pretty rare.
-
-  auto number = reinterpret_cast<uint64_t>(fh.get());
-  for (auto attempts = 0; attempts < 100; ++attempts) {
-    auto& entry = (*handles)[number];
-
-    if (LIKELY(!entry)) {
-      // Successfully inserted with no collision
-      entry = std::move(fh);
-      return number;
+  uint32_t index;
+  {
+    std::lock_guard<std::mutex> guard(freeListMutex_);
+    if (!freeSlots_.empty()) {
+      index = freeSlots_.back();
+      freeSlots_.pop_back();
+    } else {
+      if (numSlots_ == kSlotsPerChunk * kMaxChunks) {
+        LOG(ERROR) << "all " << numSlots_ << " file handle slots are in use";
+        folly::throwSystemErrorExplicit(EMFILE);
+      }
+      index = numSlots_++;
+      auto& chunk = chunks_[index / kSlotsPerChunk];
+      if (!chunk.load(std::memory_order_relaxed)) {
+        chunk.store(new Slot[kSlotsPerChunk], std::memory_order_release);
+      }
     }
-
-    // There was a collision, we try at random for a bounded number of
-    // attempts.  100 was picked as a reasonable number of tries and is
-    // the same number used by sqlite in a similar situation.
-    number = folly::Random::rand64();
   }
 
-  // Fail this request with a reasonable approximation of the problem
-  LOG(ERROR) << "Unable to find a usable file number within "
-                "a reasonable number of attempts";
-  folly::throwSystemErrorExplicit(EMFILE);
+  auto* slot = &chunks_[index / kSlotsPerChunk].load(
+      std::memory_order_acquire)[index % kSlotsPerChunk];
+  std::lock_guard<folly::MicroSpinLock> guard(slot->lock);
+  DCHECK(!slot->handle);
+  slot->handle = std::move(fh);
+  return (static_cast<uint64_t>(slot->generation) << 32) | (index + 1);
 }
 
 std::shared_ptr<FileHandleBase> FileHandleMap::forgetGenericHandle(
     uint64_t fh) {
-  auto handles = handles_.wlock();
-
-  auto iter = handles->find(fh);
-  if (iter == handles->end()) {
+  auto* slot = getSlot(fh);
+  if (!slot) {
     folly::throwSystemErrorExplicit(EBADF);
   }
-  auto result = iter->second;
-  handles->erase(iter);
+
+  std::shared_ptr<FileHandleBase> result;
+  {
+    std::lock_guard<folly::MicroSpinLock> guard(slot->lock);
+    if (!slot->handle || slot->generation != static_cast<uint32_t>(fh >> 32)) {
+      folly::throwSystemErrorExplicit(EBADF);
+    }
+    result = std::move(slot->handle);
+    slot->handle.reset();
+    // Make sure that the old number no longer refers to this slot once it
+    // has been reused.
+    ++slot->generation;
+  }
+
+  std::lock_guard<std::mutex> guard(freeListMutex_);
+  freeSlots_.push_back(static_cast<uint32_t>(fh) - 1);
   return result;
 }
+
+std::vector<std::pair<uint64_t, std::shared_ptr<FileHandleBase>>>
+FileHandleMap::getAllHandles() {
+  uint32_t numSlots;
+  {
+    std::lock_guard<std::mutex> guard(freeListMutex_);
+    numSlots = numSlots_;
+  }
+
+  std::vector<std::pair<uint64_t, std::shared_ptr<FileHandleBase>>> result;
+  for (uint32_t index = 0; index < numSlots; ++index) {
+    auto* slot = getSlot(index + 1);
+    std::lock_guard<folly::MicroSpinLock> guard(slot->lock);
+    if (slot->handle) {
+      auto fh = (static_cast<uint64_t>(slot->generation) << 32) | (index + 1);
+      result.emplace_back(fh, slot->handle);
+    }
+  }
+  return result;
+}
+
+void FileHandleMap::restoreHandle(
+    uint64_t fh,
+    std::shared_ptr<FileHandleBase> handle) {
+  auto slotNumber = static_cast<uint32_t>(fh);
+  if (slotNumber == 0 || slotNumber > kSlotsPerChunk * kMaxChunks) {
+    folly::throwSystemErrorExplicit(
+        EBADF, "invalid file number ", fh, " for FileHandleMap");
+  }
+  uint32_t index = slotNumber - 1;
+  {
+    std::lock_guard<std::mutex> guard(freeListMutex_);
+    if (index >= numSlots_) {
+      // Allocate the slots up to this one, and put the ones we skip over on
+      // the free list.
+      for (auto n = numSlots_; n <= index; ++n) {
+        auto& chunk = chunks_[n / kSlotsPerChunk];
+        if (!chunk.load(std::memory_order_relaxed)) {
+          chunk.store(new Slot[kSlotsPerChunk], std::memory_order_release);
+        }
+        if (n != index) {
+          freeSlots_.push_back(n);
+        }
+      }
+      numSlots_ = index + 1;
+    } else {
+      auto it = std::find(freeSlots_.begin(), freeSlots_.end(), index);
+      if (it == freeSlots_.end()) {
+        folly::throwSystemErrorExplicit(
+            EEXIST, "file number ", fh, " is already in use");
+      }
+      freeSlots_.erase(it);
+    }
+  }
+
+  auto* slot = getSlot(fh);
+  std::lock_guard<folly::MicroSpinLock> guard(slot->lock);
+  DCHECK(!slot->handle);
+  slot->generation = static_cast<uint32_t>(fh >> 32);
+  slot->handle = std::move(handle);
+}
 }
 }
 }
@@ -8,8 +8,13 @@
  *
  */
 #pragma once
-#include <folly/Synchronized.h>
-#include <unordered_map>
+#include <folly/SmallLocks.h>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 namespace facebook {
 namespace eden {
@@ -27,12 +32,23 @@ class FileHandleBase;
  * a way to map that number and return a shared_ptr to the associated
  * file handle.
  *
- * During a hot upgrade we intend to use this mapping to pass information
- * on to the replacement child process, although that functionality has
- * not yet been written.
+ * Handles are stored in an array of slots.  The low 32 bits of a file handle
+ * number are the slot index plus one, and the high 32 bits are the slot's
+ * generation, which changes every time a handle is forgotten so that stale
+ * numbers are rejected rather than finding whatever handle reuses the slot.
+ * Looking up a handle only locks its own slot, so reads and writes on
+ * different files never contend with each other.  Free slots are reused
+ * from a free list, so assigning a number takes constant time.
+ *
+ * During a graceful restart the handles are passed to the new process,
+ * which restores them with the same numbers, since the kernel keeps using
+ * the numbers it was given.
  */
 class FileHandleMap {
  public:
+  FileHandleMap();
+  ~FileHandleMap();
+
   /** Returns the FileHandleBase associated with a file handle number.
    * Can throw EBADF if the file handle is not one that is tracked by this map.
    */
@@ -52,8 +68,7 @@ class FileHandleMap {
    * Repeated calls with the same instance should not happen (it's not
    * how fuse works) and will return a different file handle number
    * each time.
-   * In some situations, it may not be possible to assign a number
-   * in a reasonable number of attempts and EMFILE will be thrown.
+   * Throws EMFILE if all of the slots are in use.
    **/
   uint64_t recordHandle(std::shared_ptr<FileHandleBase> fh);
 
@@ -62,11 +77,49 @@ class FileHandleMap {
    * On success, returns the instance. */
   std::shared_ptr<FileHandleBase> forgetGenericHandle(uint64_t fh);
 
+  /** Returns all of the handles in the map, with their numbers. */
+  std::vector<std::pair<uint64_t, std::shared_ptr<FileHandleBase>>>
+  getAllHandles();
+
+  /** Associates a specific file handle number with a handle instance.
+   * This is used to restore the handles of a mount point taken over from
+   * another process, and must happen before any other handle is recorded.
+   * Throws EBADF if the number is invalid, or EEXIST if it is already
+   * in use. */
+  void restoreHandle(uint64_t fh, std::shared_ptr<FileHandleBase> handle);
+
  private:
+  struct Slot {
+    /** Protects generation and handle. */
+    folly::MicroSpinLock lock{0};
+    uint32_t generation{0};
+    std::shared_ptr<FileHandleBase> handle;
+  };
+
+  /**
+   * Slots are allocated in chunks that are never freed or moved while the
+   * map exists, so a chunk can be used without holding freeListMutex_ once
+   * its pointer has been loaded.
+   */
+  static constexpr size_t kSlotsPerChunk = 1024;
+  static constexpr size_t kMaxChunks = 4096;
+
+  // Forbidden copy constructor and assignment operator
+  FileHandleMap(const FileHandleMap&) = delete;
+  FileHandleMap& operator=(const FileHandleMap&) = delete;
+
+  /**
+   * Returns the slot for a file handle number, or nullptr if the number does
+   * not refer to an allocated slot.
+   */
+  Slot* getSlot(uint64_t fh) const;
+
+  std::array<std::atomic<Slot*>, kMaxChunks> chunks_;
 
-  folly::Synchronized<
-      std::unordered_map<uint64_t, std::shared_ptr<FileHandleBase>>>
-      handles_;
+  /** Protects freeSlots_, numSlots_ and the allocation of chunks_. */
+  std::mutex freeListMutex_;
+  std::vector<uint32_t> freeSlots_;
+  uint32_t numSlots_{0};
 };
 }
 }
@@ -0,0 +1,30 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/File.h>
+#include <string>
+
+namespace facebook {
+namespace eden {
+namespace fusell {
+
+/**
+ * What another process needs to resume serving a FUSE mount: the /dev/fuse
+ * descriptor for the connection, and the FUSE_INIT request that the kernel
+ * sent when the connection was set up.
+ */
+struct FuseChannelData {
+  folly::File fuseDevice;
+  std::string initRequest;
+};
+}
+}
+} // facebook::eden::fusell
@@ -29,15 +29,33 @@ void MountPoint::start(bool debug) {
 }
 
 void MountPoint::start(bool debug, const std::function<void()>& onStop) {
+  startThread([this, debug] { run(debug); }, onStop);
+}
+
+void MountPoint::startTakeover(
+    bool debug,
+    FuseChannelData&& channelData,
+    const std::function<void()>& onStop) {
+  auto data = std::make_shared<FuseChannelData>(std::move(channelData));
+  auto run = [this, debug, data] {
+    dispatcher_->setMountPoint(this);
+    runChannel(std::make_unique<Channel>(this, std::move(*data)), debug);
+  };
+  startThread(run, onStop);
+}
+
+void MountPoint::startThread(
+    const std::function<void()>& run,
+    const std::function<void()>& onStop) {
   std::unique_lock<std::mutex> lock(mutex_);
   if (status_ != Status::UNINIT) {
     throw std::runtime_error("mount point has already been started");
   }
 
   status_ = Status::STARTING;
-  auto runner = [this, debug, onStop]() {
+  auto runner = [this, run, onStop]() {
     try {
-      this->run(debug);
+      run();
     } catch (const std::exception& ex) {
       std::lock_guard<std::mutex> guard(mutex_);
       if (status_ == Status::STARTING) {
@@ -83,13 +101,74 @@ void MountPoint::mountStarted() {
   }
 }
 
+void MountPoint::stopForTakeover() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (status_ != Status::RUNNING) {
+    throw std::runtime_error("mount point is not running");
+  }
+  if (!stoppingForTakeover_) {
+    stoppingForTakeover_ = true;
+    channel_->stopForTakeover();
+  }
+}
+
+folly::Optional<FuseChannelData> MountPoint::takeStoppedChannelData() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto data = std::move(takeoverData_);
+  takeoverData_.clear();
+  return data;
+}
+
 void MountPoint::run(bool debug) {
   // This next line is responsible for indirectly calling mount().
   dispatcher_->setMountPoint(this);
-  channel_ = std::make_unique<Channel>(this);
+  runChannel(std::make_unique<Channel>(this), debug);
+}
+
+void MountPoint::setNumFuseWorkers(size_t numWorkers) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  numFuseWorkers_ = numWorkers;
+  if (channel_) {
+    channel_->setNumWorkers(numWorkers);
+  }
+}
+
+void MountPoint::runChannel(std::unique_ptr<Channel> channel, bool debug) {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (numFuseWorkers_ > 0) {
+      channel->setNumWorkers(numFuseWorkers_);
+    }
+    channel_ = std::move(channel);
+  }
   channel_->runSession(dispatcher_, debug);
-  channel_.reset();
+
+  bool takeover = false;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (status_ == Status::RUNNING) {
+      status_ = Status::STOPPED;
+    }
+    takeover = stoppingForTakeover_;
+  }
+  // Release the connection rather than unmounting if another process is
+  // taking it over.
+  folly::Optional<FuseChannelData> takeoverData;
+  if (takeover) {
+    takeoverData = channel_->releaseForTakeover();
+  }
+  std::unique_ptr<Channel> stoppedChannel;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stoppedChannel = std::move(channel_);
+  }
+  stoppedChannel.reset();
   dispatcher_->unsetMountPoint();
+
+  if (takeoverData) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    takeoverData_ = std::move(takeoverData);
+  }
 }
 
 struct stat MountPoint::initStatData() const {
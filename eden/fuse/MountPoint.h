@@ -9,9 +9,11 @@
  */
 #pragma once
 
+#include <folly/Optional.h>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
+#include "eden/fuse/FuseChannelData.h"
 #include "eden/utils/PathFuncs.h"
 
 struct stat;
@@ -47,6 +49,34 @@ class MountPoint {
   void start(bool debug);
   void start(bool debug, const std::function<void()>& onStop);
 
+  /**
+   * Like start(), but resume serving a FUSE connection that another process
+   * handed over, instead of mounting the filesystem.
+   */
+  void startTakeover(
+      bool debug,
+      FuseChannelData&& channelData,
+      const std::function<void()>& onStop);
+
+  /**
+   * Stop serving the mount point without unmounting it, so that another
+   * process can take it over.
+   *
+   * This returns immediately.  The onStop() function passed to start() is
+   * called once the FUSE channel has stopped, and it can then retrieve the
+   * connection with takeStoppedChannelData().
+   */
+  void stopForTakeover();
+
+  /**
+   * Return the FUSE connection of a mount point that stopped after
+   * stopForTakeover().
+   *
+   * Returns folly::none if the mount point did not stop for a takeover, or
+   * if the connection was already taken.
+   */
+  folly::Optional<FuseChannelData> takeStoppedChannelData();
+
   /**
    * Mount the file system, and run the fuse channel.
    *
@@ -77,6 +107,15 @@ class MountPoint {
     return channel_.get();
   }
 
+  /**
+   * Change the number of threads serving FUSE requests for this mount.
+   *
+   * This may be called at any time.  It takes effect immediately if the
+   * mount is running, and otherwise when it starts.  See
+   * Channel::setNumWorkers().
+   */
+  void setNumFuseWorkers(size_t numWorkers);
+
   /**
    * Indicate that the mount point has been successfully started.
    *
@@ -94,12 +133,17 @@ class MountPoint {
   struct stat initStatData() const;
 
  private:
-  enum class Status { UNINIT, STARTING, RUNNING, ERROR };
+  enum class Status { UNINIT, STARTING, RUNNING, ERROR, STOPPED };
 
   // Forbidden copy constructor and assignment operator
   MountPoint(MountPoint const&) = delete;
   MountPoint& operator=(MountPoint const&) = delete;
 
+  void startThread(
+      const std::function<void()>& run,
+      const std::function<void()>& onStop);
+  void runChannel(std::unique_ptr<Channel> channel, bool debug);
+
   AbsolutePath const path_; // the path where this MountPoint is mounted
   uid_t uid_;
   gid_t gid_;
@@ -111,6 +155,10 @@ class MountPoint {
   std::condition_variable statusCV_;
   Status status_{Status::UNINIT};
   std::exception_ptr startError_;
+  bool stoppingForTakeover_{false};
+  folly::Optional<FuseChannelData> takeoverData_;
+  /** The number of FUSE workers to run, or 0 for the default */
+  size_t numFuseWorkers_{0};
 };
 }
 }
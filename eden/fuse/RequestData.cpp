@@ -8,13 +8,22 @@
  *
  */
 #include "RequestData.h"
+#include "BufVec.h"
 #include "Dispatcher.h"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include "eden/utils/RequestTrace.h"
 
 using namespace folly;
 using namespace std::chrono;
 
+DEFINE_int64(
+    fuseSlowRequestThresholdUs,
+    10000,
+    "FUSE requests that take longer than this many microseconds are recorded "
+    "with their timeline for debugGetRecentSlowRequests.  0 disables tracing");
+
 namespace facebook {
 namespace eden {
 namespace fusell {
@@ -22,7 +31,10 @@ namespace fusell {
 const std::string RequestData::kKey("fusell");
 
 RequestData::RequestData(fuse_req_t req)
-    : req_(req), requestContext_(folly::RequestContext::saveContext()) {
+    : req_(req),
+      requestContext_(folly::RequestContext::saveContext()),
+      dispatcher_(static_cast<Dispatcher*>(fuse_req_userdata(req))),
+      cancellation_(std::make_shared<CancellationToken>()) {
   fuse_req_interrupt_func(req, RequestData::interrupter, this);
 }
 
@@ -36,6 +48,8 @@ void RequestData::interrupter(fuse_req_t req, void* data) {
   // Adopt the context of the target request
   folly::RequestContext::setContext(request.requestContext_.lock());
 
+  request.dispatcher_->getRequestMetrics().requestInterrupted();
+  request.cancellation_->cancel();
   if (request.interrupter_) {
     request.interrupter_->fut_.cancel();
   }
@@ -58,23 +72,66 @@ RequestData& RequestData::create(fuse_req_t req) {
   folly::RequestContext::create();
   folly::RequestContext::get()->setContextData(
       RequestData::kKey, std::make_unique<RequestData>(req));
-  return get();
+  auto& request = get();
+  CancellationToken::install(request.cancellation_);
+  request.sampled_ = request.dispatcher_->getRequestSampler().shouldSample();
+  if (FLAGS_fuseSlowRequestThresholdUs > 0 || request.sampled_) {
+    RequestTrace::install();
+  }
+  return request;
 }
 
 Future<folly::Unit> RequestData::startRequest(
     folly::ThreadLocal<EdenStats>* stats,
     EdenStats::HistogramPtr histogram) {
+  start(stats, histogram);
+  return folly::Unit{};
+}
+
+void RequestData::start(
+    folly::ThreadLocal<EdenStats>* stats,
+    EdenStats::HistogramPtr histogram) {
   startTime_ = steady_clock::now();
   DCHECK(latencyHistogram_ == nullptr);
   latencyHistogram_ = histogram;
   stats_ = stats;
-  return folly::Unit{};
+  dispatcher_->getRequestMetrics().requestStarted(histogram);
 }
 
 void RequestData::finishRequest() {
-  auto now = duration_cast<seconds>(steady_clock::now().time_since_epoch());
-  auto diff = duration_cast<microseconds>(steady_clock::now() - startTime_);
+  auto finishTime = steady_clock::now();
+  auto now = duration_cast<seconds>(finishTime.time_since_epoch());
+  auto diff = duration_cast<microseconds>(finishTime - startTime_);
   stats_->get()->recordLatency(latencyHistogram_, diff, now);
+  dispatcher_->getRequestMetrics().requestFinished(latencyHistogram_, diff);
+
+  if (sampled_) {
+    auto* trace = RequestTrace::get();
+    if (trace) {
+      dispatcher_->getRequestSampler().add(
+          EdenStats::getOperationName(latencyHistogram_),
+          diff,
+          trace->getDurations());
+    }
+  }
+
+  if (FLAGS_fuseSlowRequestThresholdUs > 0 &&
+      diff.count() >= FLAGS_fuseSlowRequestThresholdUs) {
+    auto* trace = RequestTrace::get();
+    if (trace) {
+      SlowRequest slow;
+      slow.operation = EdenStats::getOperationName(latencyHistogram_);
+      slow.startTime = system_clock::now() -
+          duration_cast<system_clock::duration>(finishTime - startTime_);
+      slow.total = diff;
+      if (replyTime_ != steady_clock::time_point{}) {
+        slow.untilReply = duration_cast<microseconds>(replyTime_ - startTime_);
+      }
+      slow.phases = trace->getDurations();
+      dispatcher_->getSlowRequestLog().add(std::move(slow));
+    }
+  }
+
   latencyHistogram_ = nullptr;
   stats_ = nullptr;
 }
@@ -84,6 +141,7 @@ fuse_req_t RequestData::stealReq() {
   if (res == nullptr || !req_.compare_exchange_strong(res, nullptr)) {
     throw std::runtime_error("req_ has been released");
   }
+  replyTime_ = steady_clock::now();
   return res;
 }
 
@@ -137,6 +195,21 @@ void RequestData::replyError(int err) {
   checkKernelError(fuse_reply_err(stealReq(), err));
 }
 
+void RequestData::replyException(const std::exception& ex) {
+  VLOG(5) << folly::exceptionStr(ex);
+  int errnum = EIO;
+  auto* err = dynamic_cast<const std::system_error*>(&ex);
+  if (err && err->code().category() == std::system_category()) {
+    errnum = err->code().value();
+  }
+  try {
+    replyError(errnum);
+  } catch (const std::exception& replyEx) {
+    VLOG(5) << "unable to reply with error " << errnum << ": "
+            << folly::exceptionStr(replyEx);
+  }
+}
+
 void RequestData::replyNone() {
   fuse_reply_none(stealReq());
 }
@@ -189,6 +262,19 @@ void RequestData::replyIov(const struct iovec* iov, int count) {
   checkKernelError(fuse_reply_iov(stealReq(), iov, count));
 }
 
+void RequestData::replyData(const BufVec& buf) {
+#if FUSE_MINOR_VERSION >= 9
+  auto bufvec = buf.getFuseBufvec();
+  // libfuse reads the data into memory itself if splicing is not
+  // available.
+  checkKernelError(
+      fuse_reply_data(stealReq(), bufvec.get(), FUSE_BUF_SPLICE_NONBLOCK));
+#else
+  auto iov = buf.getIov();
+  replyIov(iov.data(), iov.size());
+#endif
+}
+
 void RequestData::replyStatfs(const struct statvfs& st) {
   checkKernelError(fuse_reply_statfs(stealReq(), &st));
 }
@@ -13,11 +13,13 @@
 #include <folly/io/async/Request.h>
 #include "eden/fuse/EdenStats.h"
 #include "eden/fuse/fuse_headers.h"
+#include "eden/utils/CancellationToken.h"
 
 namespace facebook {
 namespace eden {
 namespace fusell {
 
+class BufVec;
 class Channel;
 class Dispatcher;
 
@@ -29,6 +31,15 @@ class RequestData : public folly::RequestData {
   std::chrono::time_point<std::chrono::steady_clock> startTime_;
   EdenStats::HistogramPtr latencyHistogram_{nullptr};
   folly::ThreadLocal<EdenStats>* stats_{nullptr};
+  // Needed to record slow requests, since the fuse_req_t has been released
+  // by the time the request finishes.
+  Dispatcher* dispatcher_{nullptr};
+  std::chrono::time_point<std::chrono::steady_clock> replyTime_;
+  // Whether this request was picked by the Dispatcher's RequestSampler.
+  bool sampled_{false};
+  // Cancelled when the request is interrupted, so that backing store
+  // fetches that only this request is waiting on can be dropped.
+  std::shared_ptr<CancellationToken> cancellation_;
 
   static void interrupter(fuse_req_t req, void* data);
   fuse_req_t stealReq();
@@ -55,8 +66,42 @@ class RequestData : public folly::RequestData {
   folly::Future<folly::Unit> startRequest(
       folly::ThreadLocal<EdenStats>* stats,
       EdenStats::HistogramPtr histogram);
+  /** Like startRequest(), without creating a Future */
+  void start(
+      folly::ThreadLocal<EdenStats>* stats,
+      EdenStats::HistogramPtr histogram);
   void finishRequest();
 
+  /**
+   * Start the request, get the Future of its result from call(), and pass
+   * the result to reply().
+   *
+   * Many requests, such as getattr or lookup of a loaded inode, have their
+   * result ready as soon as call() returns.  Those are replied to right
+   * away, without chaining any continuations or registering a cancellation
+   * handler, which saves several allocations per request.  Other requests
+   * continue as with setRequestFuture().
+   */
+  template <typename Call, typename Reply>
+  void dispatch(
+      folly::ThreadLocal<EdenStats>* stats,
+      EdenStats::HistogramPtr histogram,
+      Call&& call,
+      Reply&& reply) {
+    start(stats, histogram);
+    auto fut = folly::makeFutureWith(std::forward<Call>(call));
+    if (!fut.isReady()) {
+      setRequestFuture(fut.then(std::forward<Reply>(reply)));
+      return;
+    }
+    try {
+      reply(std::move(fut.value()));
+    } catch (const std::exception& ex) {
+      replyException(ex);
+    }
+    finishRequest();
+  }
+
   // Returns the request context, which holds uid, gid, pid and umask info
   const fuse_ctx& getContext() const;
 
@@ -91,17 +136,8 @@ class RequestData : public folly::RequestData {
   template <typename FUTURE>
   folly::Future<folly::Unit> catchErrors(FUTURE&& fut) {
     return fut
-        .onError([](const std::system_error& err) {
-          int errnum = EIO;
-          if (err.code().category() == std::system_category()) {
-            errnum = err.code().value();
-          }
-          VLOG(5) << folly::exceptionStr(err);
-          RequestData::get().replyError(errnum);
-        })
         .onError([](const std::exception& err) {
-          VLOG(5) << folly::exceptionStr(err);
-          RequestData::get().replyError(EIO);
+          RequestData::get().replyException(err);
         })
         .ensure([] { RequestData::get().finishRequest(); });
   }
@@ -120,6 +156,13 @@ class RequestData : public folly::RequestData {
   // Reply with a negative errno value or 0 for success
   void replyError(int err);
 
+  /**
+   * Reply with the errno of a std::system_error, or EIO for any other
+   * exception.  Failing to send the reply, usually because an earlier
+   * reply already released the request, is logged rather than thrown.
+   */
+  void replyException(const std::exception& ex);
+
   // Don't send a reply, just release req_
   void replyNone();
 
@@ -136,6 +179,11 @@ class RequestData : public folly::RequestData {
   void replyWrite(size_t count);
   void replyBuf(const char* buf, size_t size);
   void replyIov(const struct iovec* iov, int count);
+  /**
+   * Reply with the contents of a BufVec.  File-backed data is spliced to
+   * the kernel when the connection supports it.
+   */
+  void replyData(const BufVec& buf);
   void replyStatfs(const struct statvfs& st);
   void replyXattr(size_t count);
   void replyLock(struct flock& lock);
@@ -0,0 +1,105 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "RequestMetrics.h"
+
+#include <folly/Bits.h>
+#include <algorithm>
+#include <glog/logging.h>
+
+namespace facebook {
+namespace eden {
+namespace fusell {
+
+constexpr size_t RequestMetrics::kNumAgeBuckets;
+
+RequestMetrics::RequestMetrics() {
+  for (auto& count : outstanding_) {
+    count.store(0, std::memory_order_relaxed);
+  }
+  for (auto& count : ages_) {
+    count.store(0, std::memory_order_relaxed);
+  }
+}
+
+void RequestMetrics::requestStarted(EdenStats::HistogramPtr histogram) {
+  auto index = EdenStats::getOperationIndex(histogram);
+  DCHECK_LT(index, EdenStats::kNumOperations);
+  outstanding_[index].fetch_add(1, std::memory_order_relaxed);
+}
+
+void RequestMetrics::requestFinished(
+    EdenStats::HistogramPtr histogram,
+    std::chrono::microseconds age) {
+  auto index = EdenStats::getOperationIndex(histogram);
+  DCHECK_LT(index, EdenStats::kNumOperations);
+  outstanding_[index].fetch_sub(1, std::memory_order_relaxed);
+  ages_[getAgeBucket(age)].fetch_add(1, std::memory_order_relaxed);
+}
+
+int64_t RequestMetrics::getOutstanding(size_t operationIndex) const {
+  CHECK_LT(operationIndex, EdenStats::kNumOperations);
+  return outstanding_[operationIndex].load(std::memory_order_relaxed);
+}
+
+int64_t RequestMetrics::getTotalOutstanding() const {
+  int64_t total = 0;
+  for (const auto& count : outstanding_) {
+    total += count.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+RequestMetrics::AgeHistogram RequestMetrics::getAgeHistogram() const {
+  AgeHistogram result;
+  for (size_t n = 0; n < kNumAgeBuckets; ++n) {
+    result[n] = ages_[n].load(std::memory_order_relaxed);
+  }
+  return result;
+}
+
+std::chrono::microseconds RequestMetrics::getAgePercentile(
+    double percentile) const {
+  return getAgePercentile(getAgeHistogram(), percentile);
+}
+
+std::chrono::microseconds RequestMetrics::getAgePercentile(
+    const AgeHistogram& histogram,
+    double percentile) {
+  uint64_t total = 0;
+  for (auto count : histogram) {
+    total += count;
+  }
+  if (total == 0) {
+    return std::chrono::microseconds{0};
+  }
+
+  auto threshold = static_cast<uint64_t>(total * percentile / 100.0);
+  uint64_t seen = 0;
+  for (size_t n = 0; n < kNumAgeBuckets; ++n) {
+    seen += histogram[n];
+    if (seen > threshold || n == kNumAgeBuckets - 1) {
+      return std::chrono::microseconds{n == 0 ? 1 : (int64_t(1) << n)};
+    }
+  }
+  return std::chrono::microseconds{0};
+}
+
+size_t RequestMetrics::getAgeBucket(std::chrono::microseconds age) {
+  if (age.count() <= 0) {
+    return 0;
+  }
+  // findLastSet() returns the 1-based index of the most significant bit, so
+  // an age in [2^(N-1), 2^N) lands in bucket N.
+  size_t bucket = folly::findLastSet(static_cast<uint64_t>(age.count()));
+  return std::min(bucket, kNumAgeBuckets - 1);
+}
+}
+}
+}
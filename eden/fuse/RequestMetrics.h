@@ -0,0 +1,115 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include "eden/fuse/EdenStats.h"
+
+namespace facebook {
+namespace eden {
+namespace fusell {
+
+/**
+ * RequestMetrics tracks the FUSE requests in flight on a single mount point.
+ *
+ * EdenStats records latency histograms shared by all mount points, which
+ * cannot tell a mount that is saturated with requests apart from one whose
+ * requests are slow.  RequestMetrics keeps a gauge of outstanding requests
+ * per operation, a histogram of request age at completion, and a count of
+ * interrupted requests, for one mount.
+ *
+ * All of the state is kept in atomics, since it is updated by every FUSE
+ * worker thread on every request.
+ */
+class RequestMetrics {
+ public:
+  /**
+   * The age histogram uses power of two buckets: bucket 0 counts requests
+   * that completed in under 1us, and bucket N counts requests that took
+   * [2^(N-1), 2^N) microseconds.  The last bucket also counts anything
+   * slower.
+   */
+  static constexpr size_t kNumAgeBuckets = 32;
+  using AgeHistogram = std::array<uint64_t, kNumAgeBuckets>;
+
+  RequestMetrics();
+
+  /**
+   * Called when a request for the operation tracked by histogram starts.
+   */
+  void requestStarted(EdenStats::HistogramPtr histogram);
+
+  /**
+   * Called when a request previously passed to requestStarted() finishes.
+   */
+  void requestFinished(
+      EdenStats::HistogramPtr histogram,
+      std::chrono::microseconds age);
+
+  /**
+   * Called when the kernel interrupts a request.
+   */
+  void requestInterrupted() {
+    interrupted_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * Returns the number of requests currently in flight for the operation
+   * with the given EdenStats::getOperationIndex().
+   */
+  int64_t getOutstanding(size_t operationIndex) const;
+
+  /**
+   * Returns the number of requests currently in flight for all operations.
+   */
+  int64_t getTotalOutstanding() const;
+
+  /**
+   * Returns the number of requests that have been interrupted.
+   */
+  uint64_t getInterrupted() const {
+    return interrupted_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Returns a snapshot of the age histogram.
+   */
+  AgeHistogram getAgeHistogram() const;
+
+  /**
+   * Returns an estimate of the given percentile of request age at
+   * completion, as the upper bound of the bucket it falls in.
+   *
+   * Returns 0 if no requests have completed.
+   */
+  std::chrono::microseconds getAgePercentile(double percentile) const;
+
+  /**
+   * Like getAgePercentile(), but for the given histogram, such as the
+   * difference between two snapshots.
+   */
+  static std::chrono::microseconds getAgePercentile(
+      const AgeHistogram& histogram,
+      double percentile);
+
+  static size_t getAgeBucket(std::chrono::microseconds age);
+
+ private:
+  RequestMetrics(const RequestMetrics&) = delete;
+  RequestMetrics& operator=(const RequestMetrics&) = delete;
+
+  std::array<std::atomic<int64_t>, EdenStats::kNumOperations> outstanding_;
+  std::array<std::atomic<uint64_t>, kNumAgeBuckets> ages_;
+  std::atomic<uint64_t> interrupted_{0};
+};
+}
+}
+}
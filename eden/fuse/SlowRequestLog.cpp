@@ -0,0 +1,45 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "SlowRequestLog.h"
+
+#include <algorithm>
+
+namespace facebook {
+namespace eden {
+namespace fusell {
+
+SlowRequestLog::SlowRequestLog(size_t capacity)
+    : capacity_(std::max<size_t>(capacity, 1)) {}
+
+void SlowRequestLog::add(SlowRequest request) {
+  auto ring = ring_.lock();
+  if (ring->requests.size() < capacity_) {
+    ring->requests.push_back(std::move(request));
+    return;
+  }
+  ring->requests[ring->next] = std::move(request);
+  ring->next = (ring->next + 1) % capacity_;
+}
+
+std::vector<SlowRequest> SlowRequestLog::getRequests() const {
+  auto ring = ring_.lock();
+  std::vector<SlowRequest> result;
+  result.reserve(ring->requests.size());
+  result.insert(
+      result.end(), ring->requests.begin() + ring->next, ring->requests.end());
+  result.insert(
+      result.end(),
+      ring->requests.begin(),
+      ring->requests.begin() + ring->next);
+  return result;
+}
+}
+}
+}
@@ -0,0 +1,69 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+#include <folly/Range.h>
+#include <folly/Synchronized.h>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include "eden/utils/RequestTrace.h"
+
+namespace facebook {
+namespace eden {
+namespace fusell {
+
+/**
+ * The timeline of a FUSE request that took longer than the slow request
+ * threshold.
+ */
+struct SlowRequest {
+  /** The FUSE operation, such as "lookup" or "read" */
+  folly::StringPiece operation;
+  /** When the request was dispatched */
+  std::chrono::system_clock::time_point startTime;
+  /** The time from dispatch until the request finished */
+  std::chrono::microseconds total{0};
+  /** The time from dispatch until the reply was sent to the kernel */
+  std::chrono::microseconds untilReply{0};
+  /** The time spent in each phase traced by RequestTrace */
+  RequestTrace::Durations phases;
+};
+
+/**
+ * SlowRequestLog remembers the most recent slow requests for a mount point
+ * in a fixed-size ring buffer.
+ *
+ * Only requests that exceed the threshold are recorded, so the lock is not
+ * taken on the fast path.
+ */
+class SlowRequestLog {
+ public:
+  explicit SlowRequestLog(size_t capacity);
+
+  void add(SlowRequest request);
+
+  /**
+   * Returns the requests currently in the log, oldest first.
+   */
+  std::vector<SlowRequest> getRequests() const;
+
+ private:
+  struct Ring {
+    std::vector<SlowRequest> requests;
+    /** The index of the oldest entry, once the ring is full */
+    size_t next{0};
+  };
+
+  const size_t capacity_;
+  folly::Synchronized<Ring, std::mutex> ring_;
+};
+}
+}
+}
@@ -10,13 +10,17 @@
 #include "PrivHelper.h"
 
 #include <folly/Exception.h>
+#include <folly/Conv.h>
 #include <folly/Expected.h>
 #include <folly/File.h>
+#include <folly/ScopeGuard.h>
 #include <folly/String.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <condition_variable>
 #include <mutex>
+#include <unordered_map>
 
 #include "PrivHelperConn.h"
 #include "PrivHelperServer.h"
@@ -91,58 +95,100 @@ class PrivHelper {
    * Send a request then receive the response.
    *
    * The response is placed into the same message buffer used for the request.
+   *
+   * Several threads may call this at once.  Their requests are matched with
+   * the responses by transaction ID, so one slow request does not hold up
+   * sending the others.  (The privhelper process still handles them one at a
+   * time, in order.)
    */
   void sendAndRecv(PrivHelperConn::Message* msg, folly::File* fd) {
-    // Hold the lock.
-    // We only support a single operation at a time for now.
-    // (The privhelper process only has a single thread anyway, and we don't
-    // currently support processing out-of-order responses.)
-    std::lock_guard<std::mutex> guard(mutex_);
-
-    auto requestXid = nextXid_;
-    ++nextXid_;
+    uint32_t requestXid;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      requestXid = nextXid_;
+      ++nextXid_;
+      pending_[requestXid];
+    }
     msg->xid = requestXid;
 
-    // Send the message
-    conn_.sendMsg(msg);
+    // If anything fails, stop waiting for the response.  It is ignored
+    // as a stale one if it still arrives.
+    auto forgetRequest = folly::makeGuard([&] {
+      std::lock_guard<std::mutex> guard(mutex_);
+      pending_.erase(requestXid);
+    });
 
-    // Receive the response
-    size_t numRetries = 0;
+    {
+      std::lock_guard<std::mutex> guard(sendMutex_);
+      conn_.sendMsg(msg);
+    }
+
+    // Whichever waiting thread gets there first reads responses off the
+    // socket and hands them to their requesters, until its own arrives.
+    std::unique_lock<std::mutex> lock(mutex_);
     while (true) {
-      conn_.recvMsg(msg, fd);
-      if (msg->xid == requestXid) {
-        break;
+      auto& response = pending_[requestXid];
+      if (response.received) {
+        *msg = response.msg;
+        if (fd) {
+          *fd = std::move(response.fd);
+        }
+        return;
       }
-
-      // If we timed out waiting for a response to a previous request
-      // we might receive it now, before the response to our request.
-      //
-      // If the transaction ID looks like a fairly recent one, just
-      // ignore it and try to receive another message.
-      if (msg->xid < requestXid && msg->xid >= requestXid - 5 &&
-          numRetries < 5) {
-        VLOG(1) << "ignoring stale privhelper response " << msg->xid
-                << " while waiting for " << requestXid;
-        numRetries++;
+      if (receiving_) {
+        receivedCV_.wait(lock);
         continue;
       }
 
-      // Otherwise give up.
-      throw std::runtime_error(folly::to<string>(
-          "mismatched privhelper response: request XID was ",
-          requestXid,
-          "; got response XID ",
-          msg->xid));
+      receiving_ = true;
+      lock.unlock();
+      auto stopReceiving = folly::makeGuard([&] {
+        if (!lock.owns_lock()) {
+          lock.lock();
+        }
+        receiving_ = false;
+        receivedCV_.notify_all();
+      });
+      PrivHelperConn::Message received;
+      folly::File receivedFile;
+      conn_.recvMsg(&received, &receivedFile);
+      lock.lock();
+
+      auto it = pending_.find(received.xid);
+      if (it == pending_.end()) {
+        // This is the response to a request that failed or timed out.
+        VLOG(1) << "ignoring stale privhelper response " << received.xid
+                << " while waiting for " << requestXid;
+      } else {
+        it->second.received = true;
+        it->second.msg = received;
+        it->second.fd = std::move(receivedFile);
+      }
     }
   }
 
  private:
-  std::mutex mutex_;
+  struct PendingResponse {
+    bool received{false};
+    PrivHelperConn::Message msg;
+    folly::File fd;
+  };
+
+  std::mutex sendMutex_;
   PrivHelperConn conn_;
   const pid_t helperPid_{0};
   const uid_t uid_{0};
   const gid_t gid_{0};
+
+  /**
+   * Protects the state below, which tracks the requests that are waiting
+   * for a response.
+   */
+  std::mutex mutex_;
+  std::condition_variable receivedCV_;
   uint32_t nextXid_{1};
+  bool receiving_{false};
+  std::unordered_map<uint32_t, PendingResponse> pending_;
 };
 
 // The global PrivHelper for use in the parent (non-privileged) process
@@ -225,6 +271,24 @@ void privilegedFuseUnmount(folly::StringPiece mountPath) {
   PrivHelperConn::parseEmptyResponse(&msg);
 }
 
+void privilegedTakeoverShutdown(folly::StringPiece mountPath) {
+  PrivHelperConn::Message msg;
+  PrivHelperConn::serializeTakeoverShutdownRequest(&msg, mountPath);
+
+  gPrivHelper->sendAndRecv(&msg, nullptr);
+  PrivHelperConn::parseEmptyResponse(&msg);
+}
+
+void privilegedTakeoverStartup(
+    folly::StringPiece mountPath,
+    const std::vector<std::string>& bindMounts) {
+  PrivHelperConn::Message msg;
+  PrivHelperConn::serializeTakeoverStartupRequest(&msg, mountPath, bindMounts);
+
+  gPrivHelper->sendAndRecv(&msg, nullptr);
+  PrivHelperConn::parseEmptyResponse(&msg);
+}
+
 void privilegedBindMount(
     folly::StringPiece clientPath,
     folly::StringPiece mountPath) {
@@ -234,6 +298,34 @@ void privilegedBindMount(
   gPrivHelper->sendAndRecv(&msg, nullptr);
   PrivHelperConn::parseEmptyResponse(&msg);
 }
+
+std::vector<folly::exception_wrapper> privilegedBindMounts(
+    const std::vector<std::pair<std::string, std::string>>& bindMounts) {
+  std::vector<folly::exception_wrapper> results;
+  results.reserve(bindMounts.size());
+  size_t start = 0;
+  while (start < bindMounts.size()) {
+    PrivHelperConn::Message msg;
+    auto count =
+        PrivHelperConn::serializeBindMountBatchRequest(&msg, bindMounts, start);
+
+    gPrivHelper->sendAndRecv(&msg, nullptr);
+    auto batchResults = PrivHelperConn::parseBatchResponse(&msg);
+    if (batchResults.size() != count) {
+      throw std::runtime_error(folly::to<string>(
+          "privhelper returned ",
+          batchResults.size(),
+          " results for ",
+          count,
+          " bind mounts"));
+    }
+    for (auto& result : batchResults) {
+      results.push_back(std::move(result));
+    }
+    start += count;
+  }
+  return results;
+}
 }
 }
 } // facebook::eden::fusell
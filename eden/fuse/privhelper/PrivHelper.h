@@ -9,8 +9,12 @@
  */
 #pragma once
 
+#include <folly/ExceptionWrapper.h>
 #include <folly/Range.h>
 #include <sys/types.h>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace folly {
 class File;
@@ -87,6 +91,22 @@ folly::File privilegedFuseMount(folly::StringPiece mountPath);
  */
 void privilegedFuseUnmount(folly::StringPiece mountPath);
 
+/*
+ * Tell the privhelper process that another edenfs process is taking over a
+ * FUSE mount, so it should no longer unmount it (or its bind mounts) when it
+ * exits.
+ */
+void privilegedTakeoverShutdown(folly::StringPiece mountPath);
+
+/*
+ * Tell the privhelper process about a FUSE mount and its bind mounts that
+ * were taken over from a previous edenfs process, so that they are cleaned
+ * up like the mounts it performed itself.
+ */
+void privilegedTakeoverStartup(
+    folly::StringPiece mountPath,
+    const std::vector<std::string>& bindMounts);
+
 /*
  * @param clientPath Absolute path (that should be under
  *     .eden/clients/<client-name>/bind-mounts/) where the "real" storage is.
@@ -95,6 +115,20 @@ void privilegedFuseUnmount(folly::StringPiece mountPath);
 void privilegedBindMount(
     folly::StringPiece clientPath,
     folly::StringPiece mountPath);
+
+/*
+ * Perform several bind mounts, with as few round trips to the privhelper
+ * process as possible.
+ *
+ * @param bindMounts (clientPath, mountPath) pairs, as passed to
+ *     privilegedBindMount().
+ *
+ * Returns one result per bind mount, which is empty if it succeeded or
+ * holds the error it failed with.  One failed bind mount does not stop the
+ * others.  Throws if the privhelper could not be asked at all.
+ */
+std::vector<folly::exception_wrapper> privilegedBindMounts(
+    const std::vector<std::pair<std::string, std::string>>& bindMounts);
 }
 }
 } // facebook::eden::fusell
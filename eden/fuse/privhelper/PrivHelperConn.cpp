@@ -21,6 +21,7 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 
 using folly::io::Appender;
 using folly::io::Cursor;
@@ -71,7 +72,9 @@ void deserializeMessage(
 
 void serializeString(Appender& a, StringPiece str) {
   a.writeBE<uint32_t>(str.size());
-  a.push(ByteRange(str));
+  if (!str.empty()) {
+    a.push(ByteRange(str));
+  }
 }
 
 std::string deserializeString(Cursor& cursor) {
@@ -79,6 +82,56 @@ std::string deserializeString(Cursor& cursor) {
   return cursor.readFixedString(length);
 }
 
+// Error messages in batched responses are truncated to these lengths, so
+// that MAX_BATCH_LENGTH of them fit in one message.
+constexpr size_t kMaxBatchErrorLength = 160;
+constexpr size_t kMaxBatchErrorTypeLength = 64;
+
+int getErrnum(const std::exception& ex) {
+  auto* sysEx = dynamic_cast<const std::system_error*>(&ex);
+  if (sysEx != nullptr && sysEx->code().category() == std::system_category()) {
+    return sysEx->code().value();
+  }
+  return 0;
+}
+
+void serializeError(
+    Appender& a,
+    StringPiece message,
+    int errnum,
+    StringPiece excType) {
+  a.writeBE<uint32_t>(errnum);
+  serializeString(a, message);
+  serializeString(a, excType);
+}
+
+folly::exception_wrapper deserializeError(Cursor& cursor) {
+  int errnum = cursor.readBE<uint32_t>();
+  auto errmsg = deserializeString(cursor);
+  auto errtype = deserializeString(cursor);
+  if (errnum != 0) {
+    return folly::make_exception_wrapper<std::system_error>(
+        errnum, std::system_category(), errmsg);
+  }
+  return folly::make_exception_wrapper<PrivHelperError>(errtype, errmsg);
+}
+
+// Read exactly length bytes, throwing if the socket is closed first.
+void readFullOrThrow(int socket, void* buf, size_t length) {
+  auto bytesRead = folly::readFull(socket, buf, length);
+  if (bytesRead < 0) {
+    throwSystemError("error reading from privhelper socket");
+  }
+  if (static_cast<size_t>(bytesRead) != length) {
+    throw std::runtime_error(folly::to<string>(
+        "privhelper socket closed in the middle of a message: received ",
+        bytesRead,
+        " of ",
+        length,
+        " bytes"));
+  }
+}
+
 } // unnamed namespace
 
 PrivHelperConn::PrivHelperConn() {}
@@ -220,9 +273,13 @@ void PrivHelperConn::sendMsg(const Message* msg, int fd) {
 }
 
 void PrivHelperConn::recvMsg(Message* msg, folly::File* f) {
+  // Only read the header at first.  Several messages may be queued on the
+  // stream socket when requests are pipelined, so the header tells us how
+  // much more belongs to this one.
+  constexpr auto headerSize = offsetof(Message, data);
   std::array<struct iovec, 1> vec;
   vec[0].iov_base = msg;
-  vec[0].iov_len = sizeof(*msg);
+  vec[0].iov_len = headerSize;
 
   constexpr auto cmsgPayloadSize = sizeof(int);
   std::array<char, CMSG_SPACE(cmsgPayloadSize)> ctrlBuf;
@@ -251,29 +308,16 @@ void PrivHelperConn::recvMsg(Message* msg, folly::File* f) {
     // EOF
     throw PrivHelperClosedError();
   }
-  // Make sure we got at least a full header before we try
-  // accessing the header data
-  if (bytesRead < offsetof(Message, data)) {
-    throw std::runtime_error(folly::to<string>(
-        "received partial message header from privhelper socket: size=",
-        bytesRead));
-  }
   // Make sure the control data wasn't truncated
   if (mh.msg_flags & MSG_CTRUNC) {
     throw std::runtime_error(
         "received truncated control message data from "
         "privhelper socket");
   }
-  // Make sure we got the full message
-  if (bytesRead != msg->getFullLength()) {
-    throw std::runtime_error(folly::to<string>(
-        "privhelper message size mismatch: received ",
-        bytesRead,
-        " bytes, expected ",
-        msg->getFullLength()));
-  }
 
-  // Pull any file descriptor(s) out of the control message data
+  // Pull any file descriptor(s) out of the control message data.
+  // The file descriptor is attached to the first byte of the message, so it
+  // always arrives with the first part of the header.
   folly::File recvdFile;
   for (auto cmsg = CMSG_FIRSTHDR(&mh); cmsg != nullptr;
        cmsg = CMSG_NXTHDR(&mh, cmsg)) {
@@ -297,6 +341,17 @@ void PrivHelperConn::recvMsg(Message* msg, folly::File* f) {
     // ever be more than one, but it is nice to double check.
   }
 
+  // recvmsg() may have returned only part of the header.
+  readFullOrThrow(
+      socket_,
+      reinterpret_cast<uint8_t*>(msg) + bytesRead,
+      headerSize - bytesRead);
+  if (msg->dataSize > MAX_MSG_LENGTH) {
+    throw std::runtime_error(folly::to<string>(
+        "privhelper message too large: ", msg->dataSize, " bytes"));
+  }
+  readFullOrThrow(socket_, msg->data, msg->dataSize);
+
   if (f != nullptr) {
     *f = std::move(recvdFile);
   }
@@ -332,6 +387,108 @@ void PrivHelperConn::parseUnmountRequest(Message* msg, string& mountPoint) {
   deserializeMessage(msg, parseBody);
 }
 
+void PrivHelperConn::serializeTakeoverShutdownRequest(
+    Message* msg,
+    StringPiece mountPoint) {
+  auto serializeBody = [&](Appender& a) { serializeString(a, mountPoint); };
+  serializeMessage(msg, REQ_TAKEOVER_SHUTDOWN, serializeBody);
+}
+
+void PrivHelperConn::parseTakeoverShutdownRequest(
+    Message* msg,
+    string& mountPoint) {
+  CHECK_EQ(msg->msgType, REQ_TAKEOVER_SHUTDOWN);
+  auto parseBody = [&](Cursor& cursor) {
+    mountPoint = deserializeString(cursor);
+  };
+  deserializeMessage(msg, parseBody);
+}
+
+void PrivHelperConn::serializeTakeoverStartupRequest(
+    Message* msg,
+    StringPiece mountPoint,
+    const std::vector<string>& bindMounts) {
+  auto serializeBody = [&](Appender& a) {
+    serializeString(a, mountPoint);
+    a.writeBE<uint32_t>(bindMounts.size());
+    for (const auto& path : bindMounts) {
+      serializeString(a, path);
+    }
+  };
+  serializeMessage(msg, REQ_TAKEOVER_STARTUP, serializeBody);
+}
+
+void PrivHelperConn::parseTakeoverStartupRequest(
+    Message* msg,
+    string& mountPoint,
+    std::vector<string>& bindMounts) {
+  CHECK_EQ(msg->msgType, REQ_TAKEOVER_STARTUP);
+  auto parseBody = [&](Cursor& cursor) {
+    mountPoint = deserializeString(cursor);
+    auto numBindMounts = cursor.readBE<uint32_t>();
+    bindMounts.clear();
+    for (uint32_t n = 0; n < numBindMounts; ++n) {
+      bindMounts.push_back(deserializeString(cursor));
+    }
+  };
+  deserializeMessage(msg, parseBody);
+}
+
+size_t PrivHelperConn::serializeBindMountBatchRequest(
+    Message* msg,
+    const BindMountList& bindMounts,
+    size_t start) {
+  CHECK_LT(start, bindMounts.size());
+  auto end = std::min<size_t>(bindMounts.size(), start + MAX_BATCH_LENGTH);
+  size_t dataSize = sizeof(uint32_t);
+  size_t count = 0;
+  for (auto index = start; index < end; ++index) {
+    auto entrySize = 2 * sizeof(uint32_t) + bindMounts[index].first.size() +
+        bindMounts[index].second.size();
+    if (dataSize + entrySize > MAX_MSG_LENGTH) {
+      break;
+    }
+    dataSize += entrySize;
+    ++count;
+  }
+  if (count == 0) {
+    throw std::length_error(folly::to<string>(
+        "bind mount paths are too long for a privhelper request: ",
+        bindMounts[start].second));
+  }
+
+  auto serializeBody = [&](Appender& a) {
+    a.writeBE<uint32_t>(count);
+    for (auto index = start; index < start + count; ++index) {
+      // Paths are in the same order as in a REQ_MOUNT_BIND request.
+      serializeString(a, bindMounts[index].second);
+      serializeString(a, bindMounts[index].first);
+    }
+  };
+  serializeMessage(msg, REQ_MOUNT_BIND_BATCH, serializeBody);
+  return count;
+}
+
+void PrivHelperConn::parseBindMountBatchRequest(
+    Message* msg,
+    BindMountList& bindMounts) {
+  CHECK_EQ(msg->msgType, REQ_MOUNT_BIND_BATCH);
+  auto parseBody = [&](Cursor& cursor) {
+    auto count = cursor.readBE<uint32_t>();
+    if (count > MAX_BATCH_LENGTH) {
+      throw std::runtime_error(folly::to<string>(
+          "too many bind mounts in one privhelper request: ", count));
+    }
+    bindMounts.clear();
+    for (uint32_t n = 0; n < count; ++n) {
+      auto mountPath = deserializeString(cursor);
+      auto clientPath = deserializeString(cursor);
+      bindMounts.emplace_back(std::move(clientPath), std::move(mountPath));
+    }
+  };
+  deserializeMessage(msg, parseBody);
+}
+
 void PrivHelperConn::serializeEmptyResponse(Message* msg) {
   msg->msgType = RESP_EMPTY;
   msg->dataSize = 0;
@@ -346,6 +503,63 @@ void PrivHelperConn::parseEmptyResponse(const Message* msg) {
   }
 }
 
+void PrivHelperConn::serializeBatchResponse(
+    Message* msg,
+    const std::vector<std::exception_ptr>& results) {
+  CHECK_LE(results.size(), MAX_BATCH_LENGTH);
+  auto serializeBody = [&](Appender& a) {
+    a.writeBE<uint32_t>(results.size());
+    for (const auto& result : results) {
+      if (!result) {
+        a.write<uint8_t>(0);
+        continue;
+      }
+      a.write<uint8_t>(1);
+      try {
+        std::rethrow_exception(result);
+      } catch (const std::exception& ex) {
+        auto exceptionType = folly::demangle(typeid(ex));
+        serializeError(
+            a,
+            StringPiece{ex.what()}.subpiece(0, kMaxBatchErrorLength),
+            getErrnum(ex),
+            StringPiece{exceptionType}.subpiece(0, kMaxBatchErrorTypeLength));
+      } catch (...) {
+        serializeError(a, "unknown error", 0, StringPiece{});
+      }
+    }
+  };
+  serializeMessage(msg, RESP_BATCH, serializeBody);
+}
+
+std::vector<folly::exception_wrapper> PrivHelperConn::parseBatchResponse(
+    const Message* msg) {
+  if (msg->msgType == RESP_ERROR) {
+    rethrowErrorResponse(msg);
+  } else if (msg->msgType != RESP_BATCH) {
+    throw std::runtime_error(
+        folly::to<string>("unexpected response type: ", msg->msgType));
+  }
+  CHECK_LE(msg->dataSize, sizeof(msg->data));
+
+  IOBuf buf{IOBuf::WRAP_BUFFER, msg->data, msg->dataSize};
+  Cursor cursor{&buf};
+  auto count = cursor.readBE<uint32_t>();
+  if (count > MAX_BATCH_LENGTH) {
+    throw std::runtime_error(folly::to<string>(
+        "too many results in one privhelper response: ", count));
+  }
+  std::vector<folly::exception_wrapper> results;
+  for (uint32_t n = 0; n < count; ++n) {
+    if (cursor.read<uint8_t>() == 0) {
+      results.emplace_back();
+    } else {
+      results.push_back(deserializeError(cursor));
+    }
+  }
+  return results;
+}
+
 void PrivHelperConn::serializeBindMountRequest(
     Message* msg,
     folly::StringPiece clientPath,
@@ -372,14 +586,8 @@ void PrivHelperConn::parseBindMountRequest(
 void PrivHelperConn::serializeErrorResponse(
     Message* msg,
     const std::exception& ex) {
-  int errnum = 0;
-  auto* sysEx = dynamic_cast<const std::system_error*>(&ex);
-  if (sysEx != nullptr && sysEx->code().category() == std::system_category()) {
-    errnum = sysEx->code().value();
-  }
-
   auto exceptionType = folly::demangle(typeid(ex));
-  serializeErrorResponse(msg, ex.what(), errnum, exceptionType);
+  serializeErrorResponse(msg, ex.what(), getErrnum(ex), exceptionType);
 }
 
 void PrivHelperConn::serializeErrorResponse(
@@ -392,13 +600,7 @@ void PrivHelperConn::serializeErrorResponse(
   buf.clear(); // Mark all the buffer space as unused
   Appender a{&buf, 0};
 
-  a.writeBE<uint32_t>(errnum);
-  a.writeBE<uint32_t>(message.size());
-  a.push(ByteRange(message));
-  a.writeBE<uint32_t>(excType.size());
-  if (!excType.empty()) {
-    a.push(excType);
-  }
+  serializeError(a, message, errnum, excType);
 
   msg->dataSize = buf.length();
 }
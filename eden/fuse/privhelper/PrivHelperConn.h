@@ -9,9 +9,14 @@
  */
 #pragma once
 
+#include <folly/ExceptionWrapper.h>
 #include <folly/Range.h>
 #include <cinttypes>
+#include <exception>
 #include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace folly {
 class File;
@@ -35,6 +40,9 @@ class PrivHelperConn {
  public:
   // The maximum body data size allowed for a privhelper message.
   enum { MAX_MSG_LENGTH = 4000 };
+  // The maximum number of operations in one batched request.  This is small
+  // enough that the results always fit in a response message.
+  enum { MAX_BATCH_LENGTH = 16 };
 
   enum MsgType : uint32_t {
     MSG_TYPE_NONE = 0,
@@ -43,8 +51,15 @@ class PrivHelperConn {
     REQ_MOUNT_FUSE = 3,
     REQ_MOUNT_BIND = 4,
     REQ_UNMOUNT_FUSE = 5,
+    REQ_TAKEOVER_SHUTDOWN = 6,
+    REQ_TAKEOVER_STARTUP = 7,
+    REQ_MOUNT_BIND_BATCH = 8,
+    RESP_BATCH = 9,
   };
 
+  // A list of (clientPath, mountPath) pairs to bind mount.
+  using BindMountList = std::vector<std::pair<std::string, std::string>>;
+
   struct Message {
     size_t getFullLength() const {
       return offsetof(Message, data) + dataSize;
@@ -118,6 +133,8 @@ class PrivHelperConn {
    *
    * The File argument can be nullptr if you don't expect to receive a file
    * descriptor.
+   *
+   * Exactly one message is read, even if several are queued on the socket.
    */
   void recvMsg(Message* msg, folly::File* f);
 
@@ -134,6 +151,22 @@ class PrivHelperConn {
       folly::StringPiece mountPoint);
   static void parseUnmountRequest(Message* msg, std::string& mountPoint);
 
+  static void serializeTakeoverShutdownRequest(
+      Message* msg,
+      folly::StringPiece mountPoint);
+  static void parseTakeoverShutdownRequest(
+      Message* msg,
+      std::string& mountPoint);
+
+  static void serializeTakeoverStartupRequest(
+      Message* msg,
+      folly::StringPiece mountPoint,
+      const std::vector<std::string>& bindMounts);
+  static void parseTakeoverStartupRequest(
+      Message* msg,
+      std::string& mountPoint,
+      std::vector<std::string>& bindMounts);
+
   static void serializeBindMountRequest(
       Message* msg,
       folly::StringPiece clientPath,
@@ -143,8 +176,42 @@ class PrivHelperConn {
       std::string& clientPath,
       std::string& mountPath);
 
+  /**
+   * Serialize a request for as many of the bind mounts starting at index
+   * start as fit in one message, up to MAX_BATCH_LENGTH.
+   *
+   * Returns the number of bind mounts in the request, which is at least 1.
+   * Throws if the bind mount at index start does not fit on its own.
+   */
+  static size_t serializeBindMountBatchRequest(
+      Message* msg,
+      const BindMountList& bindMounts,
+      size_t start);
+  static void parseBindMountBatchRequest(
+      Message* msg,
+      BindMountList& bindMounts);
+
   static void serializeEmptyResponse(Message* msg);
 
+  /**
+   * Serialize the response to a batched request, with one result per
+   * operation: null if it succeeded, or the error it failed with.
+   *
+   * Error messages are truncated so that the response always fits.
+   */
+  static void serializeBatchResponse(
+      Message* msg,
+      const std::vector<std::exception_ptr>& results);
+
+  /**
+   * Parse the response to a batched request into one result per operation,
+   * which is empty if the operation succeeded.
+   *
+   * Throws if this is an error response for the request as a whole.
+   */
+  static std::vector<folly::exception_wrapper> parseBatchResponse(
+      const Message* msg);
+
   /**
    * Parse a response that is expected to be empty.
    * Will throw an exception if this is actually an error response.
@@ -25,6 +25,7 @@
 #include <unistd.h>
 #include <chrono>
 #include <set>
+#include <vector>
 
 #include "PrivHelperConn.h"
 
@@ -175,6 +176,43 @@ void PrivHelperServer::processBindMountMsg(PrivHelperConn::Message* msg) {
   string mountPath;
   conn_.parseBindMountRequest(msg, clientPath, mountPath);
 
+  try {
+    performBindMount(clientPath, mountPath);
+    conn_.serializeEmptyResponse(msg);
+  } catch (const std::exception& ex) {
+    // Note that we re-use the request message buffer for the response data
+    conn_.serializeErrorResponse(msg, ex);
+    conn_.sendMsg(msg);
+    return;
+  }
+
+  // Note that we re-use the request message buffer for the response data
+  conn_.sendMsg(msg);
+}
+
+void PrivHelperServer::processBindMountBatchMsg(
+    PrivHelperConn::Message* msg) {
+  PrivHelperConn::BindMountList bindMounts;
+  conn_.parseBindMountBatchRequest(msg, bindMounts);
+
+  // A failed bind mount does not stop the others.
+  std::vector<std::exception_ptr> results;
+  for (const auto& bindMount : bindMounts) {
+    try {
+      performBindMount(bindMount.first, bindMount.second);
+      results.emplace_back();
+    } catch (const std::exception&) {
+      results.push_back(std::current_exception());
+    }
+  }
+
+  conn_.serializeBatchResponse(msg, results);
+  conn_.sendMsg(msg);
+}
+
+void PrivHelperServer::performBindMount(
+    const string& clientPath,
+    const string& mountPath) {
   // Figure out which FUSE mount the mountPath belongs to.
   // (Alternatively, we could just make this part of the Message.)
   string key;
@@ -189,18 +227,44 @@ void PrivHelperServer::processBindMountMsg(PrivHelperConn::Message* msg) {
         folly::to<string>("No FUSE mount found for ", mountPath));
   }
 
+  bindMount(clientPath.c_str(), mountPath.c_str());
+  bindMountPoints_.insert({key, mountPath});
+}
+
+void PrivHelperServer::processTakeoverShutdownMsg(
+    PrivHelperConn::Message* msg) {
+  string mountPath;
+  conn_.parseTakeoverShutdownRequest(msg, mountPath);
+
   try {
-    bindMount(clientPath.c_str(), mountPath.c_str());
-    bindMountPoints_.insert({key, mountPath});
+    // Stop tracking the mount point and its bind mounts without unmounting
+    // them.  Another edenfs process is taking them over, and its own
+    // privhelper will be responsible for cleaning them up.
+    if (mountPoints_.erase(mountPath) == 0) {
+      throw std::domain_error(
+          folly::to<string>("No FUSE mount found for ", mountPath));
+    }
+    bindMountPoints_.erase(mountPath);
     conn_.serializeEmptyResponse(msg);
   } catch (const std::exception& ex) {
-    // Note that we re-use the request message buffer for the response data
     conn_.serializeErrorResponse(msg, ex);
-    conn_.sendMsg(msg);
-    return;
   }
+  conn_.sendMsg(msg);
+}
 
-  // Note that we re-use the request message buffer for the response data
+void PrivHelperServer::processTakeoverStartupMsg(
+    PrivHelperConn::Message* msg) {
+  string mountPath;
+  std::vector<string> bindMounts;
+  conn_.parseTakeoverStartupRequest(msg, mountPath, bindMounts);
+
+  // Start tracking a mount point that a previous edenfs process mounted, so
+  // that it gets unmounted along with the ones we mounted ourselves.
+  mountPoints_.insert(mountPath);
+  for (auto& bindMount : bindMounts) {
+    bindMountPoints_.insert({mountPath, std::move(bindMount)});
+  }
+  conn_.serializeEmptyResponse(msg);
   conn_.sendMsg(msg);
 }
 
@@ -214,8 +278,14 @@ void PrivHelperServer::messageLoop() {
       processMountMsg(&msg);
     } else if (msgType == PrivHelperConn::REQ_MOUNT_BIND) {
       processBindMountMsg(&msg);
+    } else if (msgType == PrivHelperConn::REQ_MOUNT_BIND_BATCH) {
+      processBindMountBatchMsg(&msg);
     } else if (msgType == PrivHelperConn::REQ_UNMOUNT_FUSE) {
       processUnmountMsg(&msg);
+    } else if (msgType == PrivHelperConn::REQ_TAKEOVER_SHUTDOWN) {
+      processTakeoverShutdownMsg(&msg);
+    } else if (msgType == PrivHelperConn::REQ_TAKEOVER_STARTUP) {
+      processTakeoverStartupMsg(&msg);
     } else {
       // This shouldn't ever happen unless we have a bug.
       // Crash if it does occur.  (We could send back an error message and
@@ -49,6 +49,12 @@ class PrivHelperServer {
   void processMountMsg(PrivHelperConn::Message* msg);
   void processUnmountMsg(PrivHelperConn::Message* msg);
   void processBindMountMsg(PrivHelperConn::Message* msg);
+  void processBindMountBatchMsg(PrivHelperConn::Message* msg);
+  void performBindMount(
+      const std::string& clientPath,
+      const std::string& mountPath);
+  void processTakeoverShutdownMsg(PrivHelperConn::Message* msg);
+  void processTakeoverStartupMsg(PrivHelperConn::Message* msg);
 
   // These methods are virtual so we can override them during unit tests
   virtual folly::File fuseMount(const char* mountPath);
@@ -12,6 +12,7 @@
 #include "eden/fuse/privhelper/PrivHelperConn.h"
 
 #include <boost/filesystem.hpp>
+#include <folly/Conv.h>
 #include <folly/Exception.h>
 #include <folly/File.h>
 #include <folly/FileUtil.h>
@@ -197,6 +198,68 @@ TEST(PrivHelper, SerializeMount) {
   testSerializeMount(StringPiece("foo\0\0\0bar", 9));
 }
 
+TEST(PrivHelper, SerializeTakeoverStartup) {
+  std::vector<string> bindMounts{"/mnt/eden/buck-out", "/mnt/eden/foo/bar"};
+  PrivHelperConn::Message msg;
+  msg.xid = 1;
+  PrivHelperConn::serializeTakeoverStartupRequest(
+      &msg, "/mnt/eden", bindMounts);
+
+  string readMountPath;
+  std::vector<string> readBindMounts;
+  PrivHelperConn::parseTakeoverStartupRequest(
+      &msg, readMountPath, readBindMounts);
+  EXPECT_EQ("/mnt/eden", readMountPath);
+  EXPECT_EQ(bindMounts, readBindMounts);
+}
+
+TEST(PrivHelper, SerializeBindMountBatch) {
+  PrivHelperConn::BindMountList bindMounts;
+  for (int n = 0; n < PrivHelperConn::MAX_BATCH_LENGTH + 4; ++n) {
+    bindMounts.emplace_back(
+        folly::to<string>("/home/user/.eden/clients/c/bind-mounts/", n),
+        folly::to<string>("/mnt/eden/dir", n));
+  }
+
+  // The first request stops at the batch length limit.
+  PrivHelperConn::Message msg;
+  EXPECT_EQ(
+      PrivHelperConn::MAX_BATCH_LENGTH,
+      PrivHelperConn::serializeBindMountBatchRequest(&msg, bindMounts, 0));
+  PrivHelperConn::BindMountList readBindMounts;
+  PrivHelperConn::parseBindMountBatchRequest(&msg, readBindMounts);
+  EXPECT_EQ(
+      PrivHelperConn::BindMountList(
+          bindMounts.begin(),
+          bindMounts.begin() + PrivHelperConn::MAX_BATCH_LENGTH),
+      readBindMounts);
+
+  // A path that cannot fit on its own is rejected.
+  PrivHelperConn::BindMountList tooLong{
+      {string(PrivHelperConn::MAX_MSG_LENGTH, 'a'), "/mnt/eden/dir"}};
+  EXPECT_THROW(
+      PrivHelperConn::serializeBindMountBatchRequest(&msg, tooLong, 0),
+      std::length_error);
+
+  // Every result fits in the response, even with long error messages.
+  std::vector<std::exception_ptr> results;
+  for (int n = 0; n < PrivHelperConn::MAX_BATCH_LENGTH; ++n) {
+    if (n % 2 == 0) {
+      results.emplace_back();
+    } else {
+      results.push_back(std::make_exception_ptr(std::system_error(
+          ENOENT, std::system_category(), string(1000, 'x'))));
+    }
+  }
+  PrivHelperConn::serializeBatchResponse(&msg, results);
+  auto readResults = PrivHelperConn::parseBatchResponse(&msg);
+  ASSERT_EQ(results.size(), readResults.size());
+  for (size_t n = 0; n < results.size(); ++n) {
+    EXPECT_EQ(n % 2 != 0, static_cast<bool>(readResults[n])) << n;
+  }
+  EXPECT_TRUE(readResults[1].is_compatible_with<std::system_error>());
+}
+
 TEST(PrivHelper, SerializeError) {
   PrivHelperConn::Message msg;
   // Serialize an exception
@@ -0,0 +1,411 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# All rights reserved.
+#
+# This source code is licensed under the BSD-style license found in the
+# LICENSE file in the root directory of this source tree. An additional grant
+# of patent rights can be found in the PATENTS file in the same directory.
+
+'''
+An end-to-end load generator for the FUSE path.
+
+This starts a private edenfs daemon, clones a synthetic git repository into
+it, and then drives the mount with real syscalls from several threads at
+once: stat storms, parallel opens and reads, compiler-like write patterns,
+and optionally a checkout to a different commit in the middle of the run.
+Alternatively, a recorded trace can be replayed against the mount.
+
+At the end it prints latency percentiles for every syscall it issued.  With
+--baseline it compares those against the JSON output of an earlier run and
+exits non-zero if any of them regressed by more than --max-regression
+percent, so that it can be used to gate changes to the FUSE path.
+
+Trace files contain one JSON object per line, e.g.:
+
+  {"op": "stat", "path": "dir3/file12.c"}
+  {"op": "read", "path": "dir3/file12.c", "thread": 2}
+  {"op": "write", "path": "out/a.o", "size": 8192}
+  {"op": "rename", "path": "out/a.o.tmp", "dest": "out/a.o"}
+  {"op": "checkout"}
+
+Paths are relative to the mount point.  Entries with a "thread" field are
+replayed in order on that worker; the rest are distributed round-robin.
+'''
+
+import argparse
+import collections
+import json
+import os
+import shutil
+import sys
+import tempfile
+import threading
+import time
+
+from eden.integration.lib import edenclient
+from eden.integration.lib import gitrepo
+
+WORKLOADS = ('stat', 'read', 'compile', 'listdir')
+
+
+class LatencyRecorder(object):
+    '''Collects per-operation latencies from all worker threads.'''
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self._samples = collections.defaultdict(list)
+        self._errors = collections.Counter()
+
+    def timed(self, op, fn, *args):
+        start = time.perf_counter()
+        try:
+            result = fn(*args)
+        except OSError:
+            # Files can disappear under us while a checkout is running.
+            # Count these, but keep them out of the latency distribution.
+            with self._lock:
+                self._errors[op] += 1
+            return None
+        elapsed = time.perf_counter() - start
+        with self._lock:
+            self._samples[op].append(elapsed)
+        return result
+
+    def summarize(self):
+        '''
+        Returns {op: {count, errors, p50, p90, p99, max}}, with latencies in
+        microseconds.
+        '''
+        with self._lock:
+            result = {}
+            for op in set(self._samples) | set(self._errors):
+                samples = sorted(self._samples[op]) or [0]
+                summary = {
+                    'count': len(self._samples[op]),
+                    'errors': self._errors[op],
+                    'max': _to_us(samples[-1]),
+                }
+                for pct in (50, 90, 99):
+                    summary['p%d' % pct] = _to_us(_percentile(samples, pct))
+                result[op] = summary
+            return result
+
+
+def _percentile(sorted_samples, pct):
+    # Nearest-rank percentile; good enough with thousands of samples.
+    index = int(round(pct / 100.0 * len(sorted_samples) + 0.5)) - 1
+    index = max(0, min(index, len(sorted_samples) - 1))
+    return sorted_samples[index]
+
+
+def _to_us(seconds):
+    return int(seconds * 1000000)
+
+
+class LoadEnvironment(object):
+    '''
+    A private edenfs daemon with a single mount of a synthetic git repository
+    that has two commits, so that checkouts have something to do.
+    '''
+
+    def __init__(self, args):
+        self.args = args
+        self.tmp_dir = tempfile.mkdtemp(prefix='eden_loadgen.')
+        self.eden = None
+        self.old_home = os.getenv('HOME')
+        self.files = []
+        self.dirs = []
+        self.commits = []
+
+    def setup(self):
+        home_dir = os.path.join(self.tmp_dir, 'homedir')
+        os.mkdir(home_dir)
+        os.environ['HOME'] = home_dir
+        eden_dir = os.path.join(home_dir, 'local/.eden')
+        os.makedirs(eden_dir)
+        etc_eden_dir = os.path.join(self.tmp_dir, 'etc-eden')
+        os.makedirs(os.path.join(etc_eden_dir, 'config.d'))
+
+        repo_path = os.path.join(self.tmp_dir, 'repo')
+        os.mkdir(repo_path)
+        self._create_repo(repo_path)
+
+        self.eden = edenclient.EdenFS(eden_dir,
+                                      etc_eden_dir=etc_eden_dir,
+                                      home_dir=home_dir)
+        self.eden.start()
+        self.eden.add_repository('main', repo_path)
+        self.mount = os.path.join(self.tmp_dir, 'mounts', 'main')
+        os.makedirs(self.mount)
+        self.eden.clone('main', self.mount)
+        os.mkdir(os.path.join(self.mount, 'out'))
+
+    def _create_repo(self, path):
+        repo = gitrepo.GitRepository(path)
+        repo.init()
+        contents = 'x' * self.args.file_size
+        for d in range(self.args.dirs):
+            dir_name = 'dir%d' % d
+            self.dirs.append(dir_name)
+            for f in range(self.args.files_per_dir):
+                file_name = '%s/file%d.c' % (dir_name, f)
+                self.files.append(file_name)
+                repo.write_file(file_name, contents)
+        repo.commit('Initial commit.')
+        self.commits.append(repo.get_head_hash())
+
+        # The second commit modifies every tenth file, so that a checkout
+        # invalidates part of the tree while readers are running.
+        modified = 'y' * self.args.file_size
+        for file_name in self.files[::10]:
+            repo.write_file(file_name, modified)
+        repo.commit('Modify some files.')
+        self.commits.append(repo.get_head_hash())
+
+    def checkout(self, index):
+        self.eden.run_cmd('checkout', '--client', self.mount,
+                          self.commits[index % len(self.commits)])
+
+    def cleanup(self):
+        try:
+            if self.eden is not None:
+                self.eden.cleanup()
+        finally:
+            if self.old_home is not None:
+                os.environ['HOME'] = self.old_home
+            shutil.rmtree(self.tmp_dir, ignore_errors=True)
+
+
+def _read_file(path):
+    with open(path, 'rb') as f:
+        while f.read(65536):
+            pass
+
+
+def _write_file(path, data):
+    with open(path, 'wb') as f:
+        f.write(data)
+
+
+class Worker(object):
+    def __init__(self, env, recorder, index, deadline):
+        self.env = env
+        self.recorder = recorder
+        self.index = index
+        self.deadline = deadline
+        self.mount = env.mount
+
+    def path(self, rel):
+        return os.path.join(self.mount, rel)
+
+    def done(self):
+        return time.monotonic() >= self.deadline
+
+    def run_synthetic(self, workloads):
+        files = self.env.files
+        # Start each worker at a different offset so that they do not all
+        # hit the same inodes in lock-step.
+        n = self.index * 997
+        data = b'o' * 4096
+        while not self.done():
+            n += 1
+            rel = files[n % len(files)]
+            if 'stat' in workloads:
+                self.recorder.timed('lstat', os.lstat, self.path(rel))
+            if 'read' in workloads:
+                self.recorder.timed('read', _read_file, self.path(rel))
+            if 'listdir' in workloads:
+                dir_name = self.env.dirs[n % len(self.env.dirs)]
+                self.recorder.timed('readdir', os.listdir,
+                                    self.path(dir_name))
+            if 'compile' in workloads:
+                # Mimic a compiler: probe for a header that does not exist,
+                # write the object file to a temporary name, and rename it
+                # into place.
+                self.recorder.timed('stat_missing', os.path.lexists,
+                                    self.path(rel + '.h'))
+                out = self.path('out/w%d_%d.o' % (self.index, n % 64))
+                self.recorder.timed('write', _write_file, out + '.tmp', data)
+                self.recorder.timed('rename', os.rename, out + '.tmp', out)
+
+    def replay(self, entries):
+        for entry in entries:
+            if self.done():
+                return
+            op = entry['op']
+            if op == 'checkout':
+                self.recorder.timed('checkout', self.env.checkout,
+                                    entry.get('index', 1))
+                continue
+            path = self.path(entry['path'])
+            if op in ('stat', 'lstat'):
+                self.recorder.timed(op, getattr(os, op), path)
+            elif op == 'read':
+                self.recorder.timed(op, _read_file, path)
+            elif op == 'write':
+                data = b'o' * entry.get('size', 4096)
+                self.recorder.timed(op, _write_file, path, data)
+            elif op == 'listdir':
+                self.recorder.timed('readdir', os.listdir, path)
+            elif op == 'mkdir':
+                self.recorder.timed(op, os.mkdir, path)
+            elif op == 'unlink':
+                self.recorder.timed(op, os.unlink, path)
+            elif op == 'rename':
+                self.recorder.timed(op, os.rename, path,
+                                    self.path(entry['dest']))
+            else:
+                raise Exception('unknown trace operation %r' % op)
+
+
+def load_trace(path, concurrency):
+    per_thread = [[] for _ in range(concurrency)]
+    next_thread = 0
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line or line.startswith('#'):
+                continue
+            entry = json.loads(line)
+            thread = entry.get('thread')
+            if thread is None:
+                thread = next_thread
+                next_thread += 1
+            per_thread[thread % concurrency].append(entry)
+    return per_thread
+
+
+def run_load(env, args):
+    recorder = LatencyRecorder()
+    deadline = time.monotonic() + args.duration
+    workers = [Worker(env, recorder, i, deadline)
+               for i in range(args.concurrency)]
+
+    if args.trace:
+        traces = load_trace(args.trace, args.concurrency)
+        targets = [(w.replay, (t,)) for w, t in zip(workers, traces)]
+    else:
+        workloads = set(args.workloads.split(','))
+        unknown = workloads - set(WORKLOADS)
+        if unknown:
+            raise Exception('unknown workloads: %s' % ', '.join(unknown))
+        targets = [(w.run_synthetic, (workloads,)) for w in workers]
+
+    threads = [threading.Thread(target=fn, args=fn_args)
+               for fn, fn_args in targets]
+    for t in threads:
+        t.start()
+
+    if args.checkout and not args.trace:
+        # Check out the second commit half way through the run, and go back
+        # to the first one at three quarters, so that both directions are
+        # exercised while the workers are active.
+        for index, fraction in ((1, 0.5), (0, 0.75)):
+            wait = deadline - args.duration * (1 - fraction) - time.monotonic()
+            if wait > 0:
+                time.sleep(wait)
+            recorder.timed('checkout', env.checkout, index)
+
+    for t in threads:
+        t.join()
+    return recorder.summarize()
+
+
+def print_summary(summary, out=sys.stdout):
+    fmt = '{:<14} {:>9} {:>7} {:>9} {:>9} {:>9} {:>10}\n'
+    out.write(fmt.format('syscall', 'count', 'errors',
+                         'p50_us', 'p90_us', 'p99_us', 'max_us'))
+    for op in sorted(summary):
+        s = summary[op]
+        out.write(fmt.format(op, s['count'], s['errors'],
+                             s['p50'], s['p90'], s['p99'], s['max']))
+
+
+def find_regressions(summary, baseline, max_regression):
+    '''
+    Returns a list of human-readable descriptions of every percentile in
+    summary that is more than max_regression percent slower than baseline.
+    '''
+    regressions = []
+    limit = 1 + max_regression / 100.0
+    for op in sorted(summary):
+        if op not in baseline:
+            continue
+        for key in ('p50', 'p90', 'p99'):
+            old = baseline[op].get(key)
+            new = summary[op][key]
+            if old and new > old * limit:
+                regressions.append('%s %s: %dus -> %dus (+%.0f%%)' % (
+                    op, key, old, new, (new - old) * 100.0 / old))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Drive an eden mount with a syscall load and report '
+                    'per-syscall latency percentiles.')
+    parser.add_argument(
+        '--concurrency', '-j', type=int, default=8,
+        help='Number of threads issuing syscalls')
+    parser.add_argument(
+        '--duration', '-d', type=float, default=30,
+        help='How long to run the load for, in seconds')
+    parser.add_argument(
+        '--workloads', default=','.join(WORKLOADS),
+        help='Comma separated list of synthetic workloads to run: %s' %
+             ', '.join(WORKLOADS))
+    parser.add_argument(
+        '--no-checkout', dest='checkout', action='store_false',
+        help='Do not run checkouts in the middle of the synthetic load')
+    parser.add_argument(
+        '--trace',
+        help='Replay this JSON-lines trace instead of the synthetic load')
+    parser.add_argument(
+        '--dirs', type=int, default=50,
+        help='Number of directories in the synthetic repository')
+    parser.add_argument(
+        '--files-per-dir', type=int, default=100,
+        help='Number of files in each directory of the synthetic repository')
+    parser.add_argument(
+        '--file-size', type=int, default=4096,
+        help='Size of each file in the synthetic repository, in bytes')
+    parser.add_argument(
+        '--json', dest='json_output',
+        help='Also write the results to this file as JSON')
+    parser.add_argument(
+        '--baseline',
+        help='JSON results from an earlier run to compare against')
+    parser.add_argument(
+        '--max-regression', type=float, default=20,
+        help='Fail if any percentile is this many percent slower than '
+             'the baseline')
+    args = parser.parse_args()
+
+    env = LoadEnvironment(args)
+    try:
+        env.setup()
+        summary = run_load(env, args)
+    finally:
+        env.cleanup()
+
+    print_summary(summary)
+    if args.json_output:
+        with open(args.json_output, 'w') as f:
+            json.dump(summary, f, indent=2, sort_keys=True)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        regressions = find_regressions(summary, baseline, args.max_regression)
+        if regressions:
+            sys.stderr.write('latency regressions against %s:\n' %
+                             args.baseline)
+            for r in regressions:
+                sys.stderr.write('  %s\n' % r)
+            return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -9,7 +9,7 @@
 
 import hashlib
 
-from facebook.eden.ttypes import SHA1Result, EdenError
+from facebook.eden.ttypes import SHA1Result, EdenError, FileSHA1
 from .lib import testcase
 
 
@@ -55,6 +55,25 @@ class ThriftTest:
             ], self.client.getSHA1(self.mount, ['hello', 'adir/file'])
         )
 
+    def test_get_sha1_for_directory(self):
+        def result(path, contents):
+            sha1 = SHA1Result()
+            sha1.set_sha1(hashlib.sha1(contents).digest())
+            return FileSHA1(path=path, sha1=sha1)
+
+        self.assertEqual(
+            [result('hello', b'hola\n')],
+            self.client.getSHA1ForDirectory(self.mount, '', False)
+        )
+        self.assertEqual(
+            [result('adir/file', b'foo!\n'), result('hello', b'hola\n')],
+            self.client.getSHA1ForDirectory(self.mount, '', True)
+        )
+        self.assertEqual(
+            [result('adir/file', b'foo!\n')],
+            self.client.getSHA1ForDirectory(self.mount, 'adir', True)
+        )
+
     def test_get_sha1_throws_for_empty_string(self):
         results = self.client.getSHA1(self.mount, [''])
         self.assertEqual(1, len(results))
@@ -0,0 +1,122 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/utils/CancellationToken.h"
+
+#include <folly/Exception.h>
+#include <folly/io/async/Request.h>
+#include <string>
+
+namespace facebook {
+namespace eden {
+
+namespace {
+const std::string kCancellationTokenKey("eden.cancellation_token");
+
+class CurrentToken : public folly::RequestData {
+ public:
+  explicit CurrentToken(std::shared_ptr<CancellationToken> token)
+      : token(std::move(token)) {}
+
+  // Scope may replace the token while other threads of the same request
+  // read it.
+  std::mutex mutex;
+  std::shared_ptr<CancellationToken> token;
+};
+
+CurrentToken* getCurrentToken() {
+  return static_cast<CurrentToken*>(
+      folly::RequestContext::get()->getContextData(kCancellationTokenKey));
+}
+}
+
+void CancellationToken::cancel() {
+  cancelled_.store(true, std::memory_order_release);
+}
+
+bool CancellationToken::isCancelled() const {
+  if (cancelled_.load(std::memory_order_acquire)) {
+    return true;
+  }
+  std::lock_guard<std::mutex> guard(mutex_);
+  return allWaitersCancelled();
+}
+
+void CancellationToken::throwIfCancelled() const {
+  if (isCancelled()) {
+    folly::throwSystemErrorExplicit(
+        EINTR, "every request waiting on this work was interrupted");
+  }
+}
+
+bool CancellationToken::addWaiter(std::shared_ptr<CancellationToken> waiter) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (cancelled_.load(std::memory_order_acquire) || allWaitersCancelled()) {
+    return false;
+  }
+  if (!waiter) {
+    hasUncancellableWaiter_ = true;
+    waiters_.clear();
+  } else if (!hasUncancellableWaiter_) {
+    waiters_.push_back(std::move(waiter));
+  }
+  return true;
+}
+
+bool CancellationToken::allWaitersCancelled() const {
+  if (waiters_.empty() || hasUncancellableWaiter_) {
+    return false;
+  }
+  for (const auto& waiter : waiters_) {
+    if (!waiter->isCancelled()) {
+      return false;
+    }
+  }
+  // No waiter can be added any more, so remember the answer.
+  cancelled_.store(true, std::memory_order_release);
+  return true;
+}
+
+void CancellationToken::install(std::shared_ptr<CancellationToken> token) {
+  folly::RequestContext::get()->setContextData(
+      kCancellationTokenKey, std::make_unique<CurrentToken>(std::move(token)));
+}
+
+std::shared_ptr<CancellationToken> CancellationToken::getCurrent() {
+  auto* current = getCurrentToken();
+  if (!current) {
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> guard(current->mutex);
+  return current->token;
+}
+
+bool CancellationToken::exchangeCurrent(
+    std::shared_ptr<CancellationToken>& token) {
+  auto* current = getCurrentToken();
+  if (!current) {
+    return false;
+  }
+  std::lock_guard<std::mutex> guard(current->mutex);
+  std::swap(current->token, token);
+  return true;
+}
+
+CancellationToken::Scope::Scope(std::shared_ptr<CancellationToken> token)
+    : saved_(std::move(token)) {
+  active_ = exchangeCurrent(saved_);
+}
+
+CancellationToken::Scope::~Scope() {
+  if (active_) {
+    exchangeCurrent(saved_);
+  }
+}
+}
+}
@@ -0,0 +1,111 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace facebook {
+namespace eden {
+
+/**
+ * A CancellationToken tells work done on behalf of a request that nobody is
+ * waiting for its result any more, so that it can be skipped.
+ *
+ * FUSE requests install a token in their folly::RequestContext, and cancel
+ * it when the kernel interrupts the request.  Layers that share one piece of
+ * work between several requests, such as the InFlightMaps of the
+ * ObjectStore, give the shared work a token of its own, and add each
+ * request's token to it as a waiter.  That token is only cancelled once
+ * every one of its waiters is.
+ *
+ * Work that is already running is not stopped; it is up to each queue to
+ * check isCancelled() before starting a queued item.
+ *
+ * CancellationToken is thread-safe.
+ */
+class CancellationToken {
+ public:
+  /**
+   * Cancel the token.
+   */
+  void cancel();
+
+  /**
+   * Returns true if cancel() was called, or if waiters were added with
+   * addWaiter() and all of them are cancelled.  Once a token is cancelled
+   * it stays cancelled.
+   */
+  bool isCancelled() const;
+
+  /**
+   * Throw a std::system_error with EINTR if the token is cancelled.
+   */
+  void throwIfCancelled() const;
+
+  /**
+   * Record that a request with the given token is also waiting on the work
+   * this token is for.  A null waiter cannot be cancelled, so the token
+   * will then never be cancelled by its waiters.
+   *
+   * Returns false, without adding the waiter, if the token is already
+   * cancelled.  The caller should then start the work afresh rather than
+   * wait on the cancelled work.
+   */
+  bool addWaiter(std::shared_ptr<CancellationToken> waiter);
+
+  /**
+   * Install token as the token of the current request context.
+   */
+  static void install(std::shared_ptr<CancellationToken> token);
+
+  /**
+   * Returns the token of the current request context, or nullptr if it has
+   * none, in which case the request cannot be cancelled.
+   */
+  static std::shared_ptr<CancellationToken> getCurrent();
+
+  /**
+   * Scope makes another token current for the duration of a synchronous
+   * call, e.g. while starting work that is shared with other requests.  It
+   * does nothing if the current request context has no token installed.
+   */
+  class Scope {
+   public:
+    explicit Scope(std::shared_ptr<CancellationToken> token);
+    ~Scope();
+
+   private:
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+    bool active_{false};
+    std::shared_ptr<CancellationToken> saved_;
+  };
+
+ private:
+  /**
+   * Replace the current request context's token.  Returns false if the
+   * context has no token installed.
+   */
+  static bool exchangeCurrent(std::shared_ptr<CancellationToken>& token);
+  /** Must be called with mutex_ held. */
+  bool allWaitersCancelled() const;
+
+  mutable std::atomic<bool> cancelled_{false};
+  mutable std::mutex mutex_;
+  // The fields below are protected by mutex_.
+  std::vector<std::shared_ptr<CancellationToken>> waiters_;
+  bool hasUncancellableWaiter_{false};
+};
+}
+}
@@ -0,0 +1,236 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "DirEntryName.h"
+
+#include <folly/Hash.h>
+#include <folly/Synchronized.h>
+#include <glog/logging.h>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <ostream>
+#include <unordered_map>
+
+using folly::StringPiece;
+
+namespace facebook {
+namespace eden {
+
+namespace {
+/**
+ * The header of a pooled name.  The name itself, followed by a nul
+ * terminator, is stored immediately after the header in the same allocation.
+ */
+struct PooledName {
+  explicit PooledName(uint32_t nameSize) : refCount{1}, size{nameSize} {}
+
+  std::atomic<uint32_t> refCount;
+  const uint32_t size;
+
+  char* data() {
+    return reinterpret_cast<char*>(this + 1);
+  }
+  static PooledName* fromData(const char* data) {
+    return reinterpret_cast<PooledName*>(const_cast<char*>(data)) - 1;
+  }
+};
+
+struct StringPieceHash {
+  size_t operator()(StringPiece str) const {
+    return folly::hash::fnv64_buf(str.data(), str.size());
+  }
+};
+
+/**
+ * The process-wide pool of owned DirEntryName data.
+ *
+ * The pool is sharded by the hash of the name to reduce lock contention.
+ * Adding a reference to a name that is already held never takes a lock, and
+ * neither does dropping a reference other than the last one.
+ */
+class NamePool {
+ public:
+  const char* intern(StringPiece name);
+  void addRef(const char* data);
+  void release(const char* data);
+  DirEntryName::PoolStats getStats() const;
+
+ private:
+  struct Shard {
+    std::unordered_map<StringPiece, PooledName*, StringPieceHash> names;
+    size_t nameBytes{0};
+  };
+  static constexpr size_t kNumShards = 32;
+
+  folly::Synchronized<Shard>& getShard(StringPiece name) {
+    return shards_[StringPieceHash()(name) % kNumShards];
+  }
+
+  std::array<folly::Synchronized<Shard>, kNumShards> shards_;
+};
+
+constexpr size_t NamePool::kNumShards;
+
+size_t allocationSize(size_t nameSize) {
+  return sizeof(PooledName) + nameSize + 1;
+}
+
+const char* NamePool::intern(StringPiece name) {
+  auto shard = getShard(name).wlock();
+  auto it = shard->names.find(name);
+  if (it != shard->names.end()) {
+    it->second->refCount.fetch_add(1, std::memory_order_relaxed);
+    return it->second->data();
+  }
+
+  auto size = allocationSize(name.size());
+  auto* pooled =
+      new (operator new(size)) PooledName(static_cast<uint32_t>(name.size()));
+  memcpy(pooled->data(), name.data(), name.size());
+  pooled->data()[name.size()] = '\0';
+  shard->names.emplace(StringPiece{pooled->data(), name.size()}, pooled);
+  shard->nameBytes += size;
+  return pooled->data();
+}
+
+void NamePool::addRef(const char* data) {
+  // The caller already holds a reference, so the name cannot be freed
+  // concurrently.
+  PooledName::fromData(data)->refCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void NamePool::release(const char* data) {
+  auto* pooled = PooledName::fromData(data);
+  auto count = pooled->refCount.load(std::memory_order_relaxed);
+  while (count > 1) {
+    if (pooled->refCount.compare_exchange_weak(
+            count, count - 1, std::memory_order_acq_rel)) {
+      return;
+    }
+  }
+
+  // This looks like the last reference.  The only way another one can be
+  // added now is through intern(), which holds the shard lock, so check the
+  // count again with the lock held.
+  StringPiece name{data, pooled->size};
+  auto shard = getShard(name).wlock();
+  if (pooled->refCount.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    return;
+  }
+  shard->names.erase(name);
+  shard->nameBytes -= allocationSize(pooled->size);
+  pooled->~PooledName();
+  operator delete(pooled);
+}
+
+DirEntryName::PoolStats NamePool::getStats() const {
+  // Each map entry is a separately allocated node holding the key, the
+  // value, the cached hash and the next pointer.
+  constexpr size_t kNodeSize =
+      sizeof(std::pair<const StringPiece, PooledName*>) + sizeof(size_t) +
+      sizeof(void*);
+  DirEntryName::PoolStats stats;
+  for (const auto& shard : shards_) {
+    auto data = shard.rlock();
+    stats.numNames += data->names.size();
+    stats.totalBytes += data->names.size() * kNodeSize +
+        data->names.bucket_count() * sizeof(void*) + data->nameBytes;
+  }
+  return stats;
+}
+
+NamePool& getNamePool() {
+  // Intentionally leaked, since DirEntryNames in static objects may be
+  // destroyed after it would be.
+  static auto* pool = new NamePool();
+  return *pool;
+}
+}
+
+DirEntryName::DirEntryName(PathComponentPiece name) {
+  assign(name.stringPiece(), true);
+}
+
+DirEntryName::DirEntryName(StringPiece name, BorrowTag) noexcept
+    : data_(name.data()),
+      size_(static_cast<uint32_t>(name.size())),
+      owned_(false) {}
+
+DirEntryName DirEntryName::borrow(const PathComponent& name) {
+  auto str = name.stringPiece();
+  CHECK_LE(str.size(), std::numeric_limits<uint32_t>::max());
+  return DirEntryName{str, BorrowTag{}};
+}
+
+DirEntryName::DirEntryName(const DirEntryName& other)
+    : data_(other.data_), size_(other.size_), owned_(other.owned_) {
+  if (owned_) {
+    getNamePool().addRef(data_);
+  }
+}
+
+DirEntryName::DirEntryName(DirEntryName&& other) noexcept
+    : data_(other.data_), size_(other.size_), owned_(other.owned_) {
+  other.owned_ = false;
+}
+
+DirEntryName& DirEntryName::operator=(const DirEntryName& other) {
+  if (this != &other) {
+    DirEntryName tmp(other);
+    *this = std::move(tmp);
+  }
+  return *this;
+}
+
+DirEntryName& DirEntryName::operator=(DirEntryName&& other) noexcept {
+  if (this != &other) {
+    release();
+    data_ = other.data_;
+    size_ = other.size_;
+    owned_ = other.owned_;
+    other.owned_ = false;
+  }
+  return *this;
+}
+
+DirEntryName::~DirEntryName() {
+  release();
+}
+
+void DirEntryName::assign(StringPiece name, bool owned) {
+  CHECK_LE(name.size(), std::numeric_limits<uint32_t>::max());
+  size_ = static_cast<uint32_t>(name.size());
+  owned_ = owned;
+  if (!owned) {
+    data_ = name.data();
+    return;
+  }
+
+  data_ = getNamePool().intern(name);
+}
+
+void DirEntryName::release() noexcept {
+  if (owned_) {
+    getNamePool().release(data_);
+    owned_ = false;
+  }
+}
+
+DirEntryName::PoolStats DirEntryName::getPoolStats() {
+  return getNamePool().getStats();
+}
+
+std::ostream& operator<<(std::ostream& os, const DirEntryName& name) {
+  return os << name.stringPiece();
+}
+}
+}
@@ -0,0 +1,129 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+#include <folly/Range.h>
+#include <cstdint>
+#include <iosfwd>
+#include "eden/utils/PathFuncs.h"
+
+namespace facebook {
+namespace eden {
+
+/**
+ * A directory entry name, for use as a PathMap key.
+ *
+ * A DirEntryName either owns a copy of its name, or borrows it from an
+ * immutable PathComponent that is guaranteed to outlive it, such as a
+ * TreeEntry in a Tree that the containing directory holds a reference to.
+ * Borrowing lets a directory built from a Tree share the Tree's names
+ * rather than copying every one of them.
+ *
+ * Names constructed from a PathComponentPiece, including the keys PathMap
+ * creates on insert, are owned.  Owned names are interned in a process-wide
+ * pool and reference counted, so the many directories containing a BUCK,
+ * TARGETS or __init__.py entry all share one copy of that name, and copying
+ * an owned name never allocates.  Copying a borrowed name produces another
+ * borrowed name.
+ *
+ * The name is always nul-terminated, so c_str() is valid in both cases.
+ */
+class DirEntryName {
+ public:
+  using piece_type = PathComponentPiece;
+  using stored_type = PathComponent;
+
+  /** Statistics about the pool of owned names */
+  struct PoolStats {
+    /** The number of distinct names in the pool */
+    size_t numNames{0};
+    /** An estimate of the memory used by the pool */
+    size_t totalBytes{0};
+  };
+
+  /** Create an owned name, sharing the pooled copy of name if there is one */
+  explicit DirEntryName(PathComponentPiece name);
+
+  /**
+   * Create a DirEntryName referring to name without copying it.
+   *
+   * The caller must ensure that name is neither modified nor destroyed for
+   * as long as the returned DirEntryName or any copy of it exists.
+   */
+  static DirEntryName borrow(const PathComponent& name);
+
+  DirEntryName(const DirEntryName& other);
+  DirEntryName(DirEntryName&& other) noexcept;
+  DirEntryName& operator=(const DirEntryName& other);
+  DirEntryName& operator=(DirEntryName&& other) noexcept;
+  ~DirEntryName();
+
+  folly::StringPiece stringPiece() const {
+    return folly::StringPiece{data_, size_};
+  }
+  const char* c_str() const {
+    return data_;
+  }
+
+  PathComponentPiece piece() const {
+    return PathComponentPiece{stringPiece(), detail::SkipPathSanityCheck()};
+  }
+  /* implicit */ operator PathComponentPiece() const {
+    return piece();
+  }
+
+  /** Return a PathComponent holding a copy of this name */
+  PathComponent copy() const {
+    return PathComponent{stringPiece(), detail::SkipPathSanityCheck()};
+  }
+
+  /** Returns true if the name is borrowed rather than owned */
+  bool isBorrowed() const {
+    return !owned_;
+  }
+
+  static PoolStats getPoolStats();
+
+ private:
+  struct BorrowTag {};
+  DirEntryName(folly::StringPiece name, BorrowTag) noexcept;
+
+  void assign(folly::StringPiece name, bool owned);
+  void release() noexcept;
+
+  const char* data_;
+  uint32_t size_;
+  bool owned_;
+};
+
+inline bool operator==(const DirEntryName& lhs, PathComponentPiece rhs) {
+  return lhs.stringPiece() == rhs.stringPiece();
+}
+inline bool operator==(PathComponentPiece lhs, const DirEntryName& rhs) {
+  return lhs.stringPiece() == rhs.stringPiece();
+}
+inline bool operator==(const DirEntryName& lhs, const DirEntryName& rhs) {
+  return lhs.stringPiece() == rhs.stringPiece();
+}
+inline bool operator!=(const DirEntryName& lhs, PathComponentPiece rhs) {
+  return !(lhs == rhs);
+}
+inline bool operator!=(PathComponentPiece lhs, const DirEntryName& rhs) {
+  return !(lhs == rhs);
+}
+inline bool operator!=(const DirEntryName& lhs, const DirEntryName& rhs) {
+  return !(lhs == rhs);
+}
+inline bool operator<(const DirEntryName& lhs, const DirEntryName& rhs) {
+  return lhs.stringPiece() < rhs.stringPiece();
+}
+
+std::ostream& operator<<(std::ostream& os, const DirEntryName& name);
+}
+}
@@ -8,8 +8,13 @@
  *
  */
 #include "HgCommand.h"
+#include <algorithm>
+#include <cctype>
 #include <thread>
 #include <gflags/gflags.h>
+#include <folly/Bits.h>
+#include <folly/FileUtil.h>
+#include <folly/String.h>
 #include <folly/dynamic.h>
 
 namespace facebook {
@@ -23,6 +28,15 @@ folly::Singleton<HgCommand> cmd_singleton;
 }
 
 DEFINE_int32(file_cache_size, 65536, "maximum number of file entries to cache");
+DEFINE_bool(
+    hg_command_server,
+    true,
+    "run hg commands in persistent `hg serve --cmdserver` processes rather "
+    "than starting a new hg process for each one");
+DEFINE_int32(
+    hg_command_servers,
+    4,
+    "the number of hg command servers to run concurrent commands in");
 
 static folly::StringPiece dirname(folly::StringPiece name) {
   auto slash = name.rfind('/');
@@ -41,6 +55,19 @@ static folly::StringPiece basename(folly::StringPiece name) {
   return name;
 }
 
+// Calls fn with each non-empty line of output, without its newline
+template <typename FN>
+static void forEachLine(folly::StringPiece output, FN fn) {
+  while (!output.empty()) {
+    auto end = output.find('\n');
+    auto line = output.subpiece(0, end);
+    output.advance(end == folly::StringPiece::npos ? output.size() : end + 1);
+    if (!line.empty()) {
+      fn(line);
+    }
+  }
+}
+
 // Generic function to insert an item in sorted order
 template <typename T, typename COMP, typename CONT>
 inline typename CONT::iterator sorted_insert(CONT &vec,
@@ -84,41 +111,26 @@ HgDirInformation& HgTreeInformation::makeDir(folly::StringPiece name) {
 void HgTreeInformation::loadManifest() {
   std::thread thr([this] {
     LOG(INFO) << "Parsing manifest for " << repoDir_ << " @ " << rev_;
-    folly::Subprocess proc({"hg", "manifest", "-v", "-r", rev_},
-                           folly::Subprocess::pipeStdout()
-                               .chdir(repoDir_)
-                               .closeOtherFds()
-                               .usePath());
-    auto read_cb = folly::Subprocess::readLinesCallback(
-        [this](int fd, folly::StringPiece line) {
-          if (fd == STDOUT_FILENO) {
-            if (line.empty()) {
-              return false;
-            }
-            line.removeSuffix("\n");
-
-            folly::StringPiece flags("");
-            if (line[4] == '@') {
-              flags = "l";
-            } else if (line[4] == '*') {
-              flags = "x";
-            }
-            auto filename = line.subpiece(6);
-            fileInfo_.set(filename.str(),
-                       std::make_shared<HgFileInformation>(
-                           flags, 0, basename(filename)));
-          } else {
-            LOG(ERROR) << "[" << repoDir_ << "] hg files -r " << rev_
-                       << " stderr: " << line;
-          }
-          return false; // Keep reading from the child
-        });
-    proc.communicate(std::ref(read_cb),
-                     [](int pfd, int cfd) {
-                       // Don't write to the child
-                       return true;
-                     });
-    proc.wait();
+    std::string output;
+    try {
+      output = hg_->runInRepo({"manifest", "-v", "-r", rev_});
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "[" << repoDir_ << "] hg manifest -r " << rev_
+                 << " failed: " << ex.what();
+      return;
+    }
+    forEachLine(output, [this](folly::StringPiece line) {
+      folly::StringPiece flags("");
+      if (line[4] == '@') {
+        flags = "l";
+      } else if (line[4] == '*') {
+        flags = "x";
+      }
+      auto filename = line.subpiece(6);
+      fileInfo_.set(filename.str(),
+                    std::make_shared<HgFileInformation>(
+                        flags, 0, basename(filename)));
+    });
     LOG(INFO) << "manifest loaded";
   });
   thr.detach();
@@ -128,39 +140,17 @@ void HgTreeInformation::buildTree() {
   LOG(INFO) << "Parsing file list for " << repoDir_ << " @ " << rev_;
   size_t num_files = 0;
 
-  folly::Subprocess proc({"hg", "files", "-r", rev_},
-                         folly::Subprocess::pipeStdout()
-                             .chdir(repoDir_)
-                             .closeOtherFds()
-                             .usePath());
-
-  auto read_cb = folly::Subprocess::readLinesCallback(
-      [this, &num_files](int fd, folly::StringPiece line) {
-        if (fd == STDOUT_FILENO) {
-          if (line.empty()) {
-            return false;
-          }
-          line.removeSuffix("\n");
-          folly::StringPiece dir = dirname(line);
-          folly::StringPiece filename = basename(line);
-
-          // This will create the dir node on demand
-          auto &d = makeDir(dir);
-          // and add this file to its list
-          sorted_insert(d.files, filename.str(), compare_str());
-          num_files++;
-        } else {
-          LOG(ERROR) << "[" << repoDir_ << "] hg files -r " << rev_
-                     << " stderr: " << line;
-        }
-        return false; // Keep reading from the child
-      });
-  proc.communicate(std::ref(read_cb),
-                   [](int pfd, int cfd) {
-                     // Don't write to the child
-                     return true;
-                   });
-  proc.waitChecked();
+  auto output = hg_->runInRepo({"files", "-r", rev_});
+  forEachLine(output, [this, &num_files](folly::StringPiece line) {
+    folly::StringPiece dir = dirname(line);
+    folly::StringPiece filename = basename(line);
+
+    // This will create the dir node on demand
+    auto &d = makeDir(dir);
+    // and add this file to its list
+    sorted_insert(d.files, filename.str(), compare_str());
+    num_files++;
+  });
   LOG(INFO) << "build tree with " << dirs_.size() << " dirs";
   fileInfo_.setMaxSize(num_files * 1.2);
   loadManifest();
@@ -205,22 +195,13 @@ HgTreeInformation::rawStatFile(const std::string& filename) {
 
   std::thread thr([ this, promise = std::move(promise), filename ]() mutable {
     promise.setWith([ this, filename = std::move(filename) ] {
-      std::vector<std::string> args = {"hg",
-                                       "files",
-                                       "-r",
-                                       rev_,
-                                       "-vT",
-                                       "{size}\\0{flags}\\0{abspath}\\n",
-                                       filename};
-      folly::Subprocess proc(args,
-                             folly::Subprocess::pipeStdout()
-                                 .chdir(repoDir_)
-                                 .closeOtherFds()
-                                 .usePath());
-      auto output = proc.communicate();
-      proc.waitChecked();
-
-      folly::StringPiece line(output.first);
+      auto output = hg_->runInRepo({"files",
+                                    "-r",
+                                    rev_,
+                                    "-vT",
+                                    "{size}\\0{flags}\\0{abspath}\\n",
+                                    filename});
+      folly::StringPiece line(output);
 
       line.removeSuffix("\n");
       folly::fbvector<folly::StringPiece> fields;
@@ -280,15 +261,157 @@ HgTreeInformation::statDir(folly::StringPiece name) {
   return statFiles(names);
 }
 
-HgTreeInformation::HgTreeInformation(const std::string& repoDir,
-                                     const std::string& rev)
-    : repoDir_(repoDir),
+HgTreeInformation::HgTreeInformation(
+    HgCommand* hg,
+    const std::string& repoDir,
+    const std::string& rev)
+    : hg_(hg),
+      repoDir_(repoDir),
       rev_(rev),
       fileInfo_(FLAGS_file_cache_size,
                 [=](const std::string name) { return rawStatFile(name); }) {
   buildTree();
 }
 
+HgCommandServer::HgCommandServer(const std::string& repoDir)
+    : repoDir_(repoDir) {}
+
+HgCommandServer::~HgCommandServer() {
+  std::lock_guard<std::mutex> g(lock_);
+  stopLocked();
+}
+
+void HgCommandServer::startLocked() {
+  proc_ = std::make_unique<folly::Subprocess>(
+      std::vector<std::string>{"hg",
+                               "serve",
+                               "--cmdserver",
+                               "pipe",
+                               "--config",
+                               "ui.interactive=False"},
+      folly::Subprocess::pipeStdin()
+          .pipeStdout()
+          .chdir(repoDir_)
+          .closeOtherFds()
+          .usePath());
+
+  // The server starts by describing itself on the output channel.
+  std::string hello;
+  uint32_t length;
+  if (readMessageLocked(&hello, &length) != 'o' ||
+      hello.find("runcommand") == std::string::npos) {
+    throw std::runtime_error(folly::to<std::string>(
+        "unexpected greeting from hg command server: ", hello));
+  }
+  LOG(INFO) << "started hg command server in " << repoDir_;
+}
+
+void HgCommandServer::stopLocked() {
+  if (!proc_) {
+    return;
+  }
+  // The server exits once its stdin is closed, but it may be wedged after
+  // a protocol error, so don't rely on that.
+  proc_->closeParentFd(STDIN_FILENO);
+  if (proc_->poll().running()) {
+    proc_->terminate();
+    proc_->wait();
+  }
+  proc_.reset();
+}
+
+char HgCommandServer::readMessageLocked(std::string* data, uint32_t* length) {
+  // Each message is a channel byte and a big-endian 32-bit length.
+  auto fd = proc_->stdoutFd();
+  uint8_t header[5];
+  if (folly::readFull(fd, header, sizeof(header)) !=
+      static_cast<ssize_t>(sizeof(header))) {
+    throw std::runtime_error("hg command server exited unexpectedly");
+  }
+  auto channel = static_cast<char>(header[0]);
+  uint32_t bigEndianLength;
+  memcpy(&bigEndianLength, header + 1, sizeof(bigEndianLength));
+  *length = folly::Endian::big(bigEndianLength);
+
+  data->clear();
+  if (channel == 'I' || channel == 'L') {
+    return channel;
+  }
+  data->resize(*length);
+  if (*length > 0 &&
+      folly::readFull(fd, &(*data)[0], *length) !=
+          static_cast<ssize_t>(*length)) {
+    throw std::runtime_error("hg command server exited unexpectedly");
+  }
+  return channel;
+}
+
+std::string HgCommandServer::run(const std::vector<std::string>& args) {
+  std::lock_guard<std::mutex> g(lock_);
+  std::string out;
+  std::string err;
+  int32_t exitCode = 0;
+  try {
+    if (!proc_) {
+      startLocked();
+    }
+
+    auto joined = folly::join(folly::StringPiece("\0", 1), args);
+    uint32_t bigEndianLength =
+        folly::Endian::big(static_cast<uint32_t>(joined.size()));
+    std::string request = "runcommand\n";
+    request.append(
+        reinterpret_cast<const char*>(&bigEndianLength),
+        sizeof(bigEndianLength));
+    request.append(joined);
+    folly::checkUnixError(
+        folly::writeFull(proc_->stdinFd(), request.data(), request.size()),
+        "error writing to hg command server");
+
+    std::string data;
+    while (true) {
+      uint32_t length;
+      auto channel = readMessageLocked(&data, &length);
+      if (channel == 'o') {
+        out.append(data);
+      } else if (channel == 'e') {
+        err.append(data);
+      } else if (channel == 'r') {
+        if (data.size() != sizeof(exitCode)) {
+          throw std::runtime_error("bad result from hg command server");
+        }
+        memcpy(&exitCode, data.data(), sizeof(exitCode));
+        exitCode = folly::Endian::big(exitCode);
+        break;
+      } else if (channel == 'I' || channel == 'L') {
+        // Nothing we run should read input, so answer with end of input.
+        uint32_t empty = 0;
+        folly::checkUnixError(
+            folly::writeFull(proc_->stdinFd(), &empty, sizeof(empty)),
+            "error writing to hg command server");
+      } else if (isupper(channel)) {
+        // Lower case channels are optional, but upper case ones must be
+        // handled.
+        throw std::runtime_error(folly::to<std::string>(
+            "unsupported hg command server channel ", channel));
+      }
+    }
+  } catch (const std::exception&) {
+    stopLocked();
+    throw;
+  }
+
+  if (exitCode != 0) {
+    throw std::runtime_error(folly::to<std::string>(
+        "hg ", folly::join(" ", args), " exited with ", exitCode, ": ", err));
+  }
+  if (!err.empty()) {
+    LOG(WARNING) << "[" << repoDir_ << "] hg " << folly::join(" ", args)
+                 << " stderr: " << err;
+  }
+  return out;
+}
+
 folly::Future<std::string> HgCommand::future_run(folly::Subprocess&& proc) {
   struct proc_state {
     folly::Subprocess proc;
@@ -310,7 +433,11 @@ folly::Future<std::string> HgCommand::future_run(folly::Subprocess&& proc) {
   return state->promise.getFuture();
 }
 
-void HgCommand::setRepoDir(const std::string& repoDir) { repoDir_ = repoDir; }
+void HgCommand::setRepoDir(const std::string& repoDir) {
+  std::lock_guard<std::mutex> g(lock_);
+  repoDir_ = repoDir;
+  servers_.clear();
+}
 void HgCommand::setRepoRev(const std::string& rev) { rev_ = rev; }
 const std::string& HgCommand::getRepoRev() { return rev_; }
 
@@ -327,18 +454,66 @@ std::string HgCommand::run(const std::vector<std::string>& args) {
   return output.first;
 }
 
+std::string HgCommand::runInRepo(const std::vector<std::string>& args) {
+  if (!FLAGS_hg_command_server) {
+    std::vector<std::string> argv{"hg"};
+    argv.insert(argv.end(), args.begin(), args.end());
+    folly::Subprocess proc(
+        argv,
+        folly::Subprocess::pipeStdout()
+            .pipeStderr()
+            .chdir(repoDir_)
+            .closeOtherFds()
+            .usePath());
+    auto output = proc.communicate();
+    auto res = proc.wait();
+    if (!res.exited() || res.exitStatus() != 0) {
+      throw std::runtime_error(folly::to<std::string>(
+          "hg ", folly::join(" ", args), " ", res.str(), ": ", output.second));
+    }
+    return output.first;
+  }
+
+  std::shared_ptr<HgCommandServer> server;
+  {
+    std::lock_guard<std::mutex> g(lock_);
+    if (servers_.empty()) {
+      auto count = std::max(FLAGS_hg_command_servers, 1);
+      for (int n = 0; n < count; ++n) {
+        servers_.push_back(std::make_shared<HgCommandServer>(repoDir_));
+      }
+    }
+    server = servers_[nextServer_++ % servers_.size()];
+  }
+  return server->run(args);
+}
+
+std::string HgCommand::resolveRev(const std::string& rev) {
+  if (rev.size() == 40 &&
+      std::all_of(rev.begin(), rev.end(), [](char c) { return isxdigit(c); })) {
+    return rev;
+  }
+  auto node = runInRepo({"log", "-r", rev, "-T", "{node}"});
+  if (node.empty()) {
+    throw std::runtime_error(
+        folly::to<std::string>("unable to resolve revision ", rev));
+  }
+  return node;
+}
+
 std::shared_ptr<HgTreeInformation> HgCommand::getTree(const std::string& rev) {
+  auto node = resolveRev(rev);
   {
     std::lock_guard<std::mutex> g(lock_);
-    auto find = treeInfo_.find(rev);
+    auto find = treeInfo_.find(node);
     if (find != treeInfo_.end()) {
       return find->second;
     }
   }
-  auto t = std::make_shared<HgTreeInformation>(repoDir_, rev);
+  auto t = std::make_shared<HgTreeInformation>(this, repoDir_, node);
   {
     std::lock_guard<std::mutex> g(lock_);
-    treeInfo_.set(rev, t);
+    treeInfo_.set(node, t);
   }
   return t;
 }
@@ -346,13 +521,8 @@ std::shared_ptr<HgTreeInformation> HgCommand::getTree(const std::string& rev) {
 HgCommand::HgCommand() : treeInfo_(16) {}
 
 std::string HgCommand::identifyRev() {
-  folly::Subprocess proc(
-      {"hg", "log", "-r", ".", "-T", "{node}"},
-      folly::Subprocess::pipeStdout().closeOtherFds().usePath().chdir(
-          repoDir_));
-  auto output = proc.communicate();
-  proc.waitChecked();
-  folly::StringPiece hash(output.first);
+  auto output = runInRepo({"log", "-r", ".", "-T", "{node}"});
+  folly::StringPiece hash(output);
   hash.removeSuffix('+');
   return hash.str();
 }
@@ -8,6 +8,7 @@
  *
  */
 #pragma once
+#include <memory>
 #include <string>
 #include <vector>
 #include <mutex>
@@ -19,6 +20,8 @@
 namespace facebook {
 namespace hgsparse {
 
+class HgCommand;
+
 struct HgFileInformation {
   size_t size;
   std::string name;
@@ -36,6 +39,7 @@ struct HgDirInformation {
 
 class HgTreeInformation
     : public std::enable_shared_from_this<HgTreeInformation> {
+  HgCommand* hg_;
   std::string repoDir_;
   std::string rev_;
   std::unordered_map<std::string, HgDirInformation> dirs_;
@@ -49,8 +53,12 @@ class HgTreeInformation
       const std::string& filename);
 
  public:
-  // Constructs the tree information and parses the initial manifest data
-  HgTreeInformation(const std::string& repoDir, const std::string& rev);
+  // Constructs the tree information and parses the initial manifest data.
+  // The hg commands are run with hg, which must outlive this object.
+  HgTreeInformation(
+      HgCommand* hg,
+      const std::string& repoDir,
+      const std::string& rev);
 
   // Get the stat information for the files in the specified dir
   folly::Future<std::vector<std::shared_ptr<HgFileInformation>>> statDir(
@@ -64,12 +72,48 @@ class HgTreeInformation
   const HgDirInformation& readDir(folly::StringPiece name);
 };
 
+/**
+ * A persistent `hg serve --cmdserver pipe` process, which runs hg commands
+ * without paying for python startup and extension loading every time.
+ *
+ * Commands are run one at a time.  If the server exits or the protocol
+ * breaks, the command fails, and the next command starts a new server.
+ */
+class HgCommandServer {
+ public:
+  explicit HgCommandServer(const std::string& repoDir);
+  ~HgCommandServer();
+
+  // Runs `hg args...` in the repository, returning stdout.
+  // If the command failed, throws an exception with the exit code and the
+  // stderr text
+  std::string run(const std::vector<std::string>& args);
+
+ private:
+  HgCommandServer(const HgCommandServer&) = delete;
+  HgCommandServer& operator=(const HgCommandServer&) = delete;
+
+  void startLocked();
+  void stopLocked();
+  // Reads one message, returning its channel.  For the input channels the
+  // length is the amount requested, and there is no data.
+  char readMessageLocked(std::string* data, uint32_t* length);
+
+  std::string repoDir_;
+  std::mutex lock_;
+  std::unique_ptr<folly::Subprocess> proc_;
+};
+
 class HgCommand {
   folly::EvictingCacheMap<std::string, std::shared_ptr<HgTreeInformation>>
       treeInfo_;
   std::mutex lock_;
   std::string repoDir_;
   std::string rev_;
+  // Shared, so that a server stays alive while it runs a command even if
+  // setRepoDir() replaces it
+  std::vector<std::shared_ptr<HgCommandServer>> servers_;
+  size_t nextServer_{0};
 
  public:
   HgCommand();
@@ -83,8 +127,20 @@ class HgCommand {
   // code and the stderr text
   static std::string run(const std::vector<std::string>& args);
 
+  // Executes `hg args...` in the repository, returning stdout.  Uses the
+  // command servers unless --hg_command_server is false, with concurrent
+  // commands spread over --hg_command_servers processes.
+  // Throws if the command fails.
+  std::string runInRepo(const std::vector<std::string>& args);
+
   std::string identifyRev();
 
+  // Returns the commit hash that rev currently refers to
+  std::string resolveRev(const std::string& rev);
+
+  // Returns the tree information for rev, which is cached by the commit
+  // hash it resolves to, so that symbolic revisions such as "." are never
+  // served stale results
   std::shared_ptr<HgTreeInformation> getTree(const std::string& rev);
 
   // Wait for a subprocess to complete.  Yields the stdout or
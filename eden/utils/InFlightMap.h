@@ -0,0 +1,138 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+#include <folly/futures/Future.h>
+#include <folly/futures/SharedPromise.h>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "eden/utils/CancellationToken.h"
+
+namespace facebook {
+namespace eden {
+
+/**
+ * InFlightMap de-duplicates concurrent asynchronous fetches of the same key.
+ *
+ * The first caller to request a key starts the fetch, and callers that
+ * request the same key before it completes share its result rather than
+ * starting another fetch.  The key is forgotten as soon as the fetch
+ * completes, so unlike LeaseCache, InFlightMap never caches results.
+ *
+ * Each fetch gets a CancellationToken, which is current while fetch() runs
+ * and has the CancellationToken of every caller waiting on the fetch as a
+ * waiter.  So a fetch is only cancelled once all of its callers have been
+ * interrupted, and a caller that asks for a key whose fetch was cancelled
+ * starts a fresh one.
+ *
+ * InFlightMap is thread-safe.  Fetches that are still running when the
+ * InFlightMap is destroyed complete normally.
+ */
+template <typename KEY, typename VAL, typename HASH = std::hash<KEY>>
+class InFlightMap {
+ public:
+  using ValuePtr = std::shared_ptr<VAL>;
+  using FutureType = folly::Future<ValuePtr>;
+
+  InFlightMap() : state_(std::make_shared<State>()) {}
+
+  /**
+   * Get the value for the given key.
+   *
+   * If a fetch for this key is already in progress the returned Future
+   * completes with its result.  Otherwise fetch() is called to start a new
+   * fetch, and should return a FutureType.
+   */
+  template <typename Fetch>
+  FutureType get(const KEY& key, Fetch&& fetch) {
+    auto waiter = CancellationToken::getCurrent();
+    Entry entry;
+    {
+      std::lock_guard<std::mutex> g(state_->lock);
+      auto it = state_->pending.find(key);
+      if (it != state_->pending.end() &&
+          (!it->second.token || it->second.token->addWaiter(waiter))) {
+        ++state_->numCoalesced;
+        return it->second.promise->getFuture();
+      }
+
+      entry.promise = std::make_shared<folly::SharedPromise<ValuePtr>>();
+      // A fetch for a caller that cannot be cancelled needs no token.
+      if (waiter) {
+        entry.token = std::make_shared<CancellationToken>();
+        entry.token->addWaiter(std::move(waiter));
+      }
+      state_->pending[key] = entry;
+    }
+
+    auto future = entry.promise->getFuture();
+    auto fetched = [&] {
+      CancellationToken::Scope scope(entry.token);
+      return folly::makeFutureWith(std::forward<Fetch>(fetch));
+    }();
+    fetched.then([state = state_, key, promise = entry.promise](
+                     folly::Try<ValuePtr>&& t) {
+      // Forget the key before fulfilling the promise, so that callers
+      // who see the result and ask again start a fresh fetch.  If this
+      // fetch was cancelled, the key may already belong to a fresh one.
+      {
+        std::lock_guard<std::mutex> g(state->lock);
+        auto it = state->pending.find(key);
+        if (it != state->pending.end() && it->second.promise == promise) {
+          state->pending.erase(it);
+        }
+      }
+      promise->setTry(std::move(t));
+    });
+    return future;
+  }
+
+  /**
+   * Get the number of fetches currently in progress.
+   */
+  size_t getNumPending() const {
+    std::lock_guard<std::mutex> g(state_->lock);
+    return state_->pending.size();
+  }
+
+  /**
+   * Get the number of get() calls that shared an in-progress fetch rather
+   * than starting a new one.
+   */
+  uint64_t getNumCoalesced() const {
+    std::lock_guard<std::mutex> g(state_->lock);
+    return state_->numCoalesced;
+  }
+
+ private:
+  using SharedPromisePtr = std::shared_ptr<folly::SharedPromise<ValuePtr>>;
+
+  struct Entry {
+    SharedPromisePtr promise;
+    /** Null if one of the callers cannot be cancelled */
+    std::shared_ptr<CancellationToken> token;
+  };
+
+  // The state is shared with the continuations of pending fetches, so that
+  // they remain valid if the InFlightMap is destroyed first.
+  struct State {
+    mutable std::mutex lock;
+    std::unordered_map<KEY, Entry, HASH> pending;
+    uint64_t numCoalesced{0};
+  };
+
+  // Forbidden copy constructor and assignment operator
+  InFlightMap(const InFlightMap&) = delete;
+  InFlightMap& operator=(const InFlightMap&) = delete;
+
+  std::shared_ptr<State> state_;
+};
+}
+} // facebook::eden
@@ -0,0 +1,275 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+#include <glog/logging.h>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace facebook {
+namespace eden {
+
+/** An open-addressing hash map from an integer key to an arbitrary value.
+ *
+ * This is intended for maps with very many entries, such as the InodeMap,
+ * where std::unordered_map's separate node allocation per entry costs both
+ * memory and a cache miss on every lookup.  It differs from
+ * std::unordered_map in a couple of ways:
+ * - All entries are stored inline in a single power-of-two sized array, and
+ *   collisions are resolved with linear probing.  The array is kept at most
+ *   3/4 full.
+ * - The key EmptyKey is reserved to mark empty slots, and may not be
+ *   inserted.
+ * - Value must be default constructible and move assignable, since empty
+ *   slots hold a default constructed Value and entries are moved around
+ *   when the table grows or an entry is erased.
+ * - Both insert and erase operations may move other entries, so they
+ *   invalidate all iterators and pointers to values.
+ */
+template <typename Key, typename Value, Key EmptyKey = 0>
+class IntHashMap {
+  static_assert(std::is_integral<Key>::value, "Key must be an integer type");
+
+ public:
+  using value_type = std::pair<Key, Value>;
+
+ private:
+  using Slots = std::vector<value_type>;
+
+  template <typename SlotsType, typename ValueType>
+  class Iterator
+      : public std::iterator<std::forward_iterator_tag, ValueType> {
+   public:
+    Iterator() = default;
+    Iterator(SlotsType* slots, size_t index) : slots_(slots), index_(index) {
+      skipEmpty();
+    }
+    // Allow conversion from iterator to const_iterator
+    template <typename OtherSlots, typename OtherValue>
+    /* implicit */ Iterator(const Iterator<OtherSlots, OtherValue>& other)
+        : slots_(other.slots_), index_(other.index_) {}
+
+    ValueType& operator*() const {
+      return (*slots_)[index_];
+    }
+    ValueType* operator->() const {
+      return &(*slots_)[index_];
+    }
+    Iterator& operator++() {
+      ++index_;
+      skipEmpty();
+      return *this;
+    }
+    Iterator operator++(int) {
+      auto result = *this;
+      ++*this;
+      return result;
+    }
+    bool operator==(const Iterator& other) const {
+      return index_ == other.index_;
+    }
+    bool operator!=(const Iterator& other) const {
+      return index_ != other.index_;
+    }
+
+   private:
+    friend class IntHashMap;
+    template <typename, typename>
+    friend class Iterator;
+
+    void skipEmpty() {
+      while (index_ < slots_->size() && (*slots_)[index_].first == EmptyKey) {
+        ++index_;
+      }
+    }
+
+    SlotsType* slots_{nullptr};
+    size_t index_{0};
+  };
+
+ public:
+  using iterator = Iterator<Slots, value_type>;
+  using const_iterator = Iterator<const Slots, const value_type>;
+
+  IntHashMap() = default;
+  IntHashMap(IntHashMap&&) = default;
+  IntHashMap& operator=(IntHashMap&&) = default;
+
+  iterator begin() {
+    return iterator{&slots_, 0};
+  }
+  iterator end() {
+    return iterator{&slots_, slots_.size()};
+  }
+  const_iterator begin() const {
+    return const_iterator{&slots_, 0};
+  }
+  const_iterator end() const {
+    return const_iterator{&slots_, slots_.size()};
+  }
+
+  size_t size() const {
+    return size_;
+  }
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  iterator find(Key key) {
+    auto index = findIndex(key);
+    return iterator{&slots_, index};
+  }
+  const_iterator find(Key key) const {
+    auto index = findIndex(key);
+    return const_iterator{&slots_, index};
+  }
+  size_t count(Key key) const {
+    return findIndex(key) == slots_.size() ? 0 : 1;
+  }
+
+  /**
+   * Insert a new entry constructed from args, unless the key is already
+   * present.
+   *
+   * Returns an iterator to the entry for key, and a boolean indicating
+   * whether a new entry was inserted.
+   */
+  template <typename... Args>
+  std::pair<iterator, bool> emplace(Key key, Args&&... args) {
+    DCHECK_NE(key, EmptyKey);
+    auto existing = findIndex(key);
+    if (existing != slots_.size()) {
+      return std::make_pair(iterator{&slots_, existing}, false);
+    }
+
+    if ((size_ + 1) * 4 > slots_.size() * 3) {
+      rehash(slots_.empty() ? kMinSlots : slots_.size() * 2);
+    }
+    auto index = findSlot(key);
+    slots_[index].first = key;
+    slots_[index].second = Value(std::forward<Args>(args)...);
+    ++size_;
+    return std::make_pair(iterator{&slots_, index}, true);
+  }
+
+  /**
+   * Erase the entry at the given iterator.
+   *
+   * Following entries in the same probe sequence are shifted back to fill
+   * the hole, rather than leaving a tombstone.
+   */
+  void erase(iterator it) {
+    auto mask = slots_.size() - 1;
+    auto hole = it.index_;
+    auto next = (hole + 1) & mask;
+    while (slots_[next].first != EmptyKey) {
+      auto home = getHomeSlot(slots_[next].first);
+      // Move the entry at next into the hole if its home slot does not lie
+      // in the (cyclic) range (hole, next].
+      if (((next - home) & mask) >= ((next - hole) & mask)) {
+        slots_[hole] = std::move(slots_[next]);
+        hole = next;
+      }
+      next = (next + 1) & mask;
+    }
+    slots_[hole].first = EmptyKey;
+    slots_[hole].second = Value();
+    --size_;
+  }
+
+  size_t erase(Key key) {
+    auto it = find(key);
+    if (it == end()) {
+      return 0;
+    }
+    erase(it);
+    return 1;
+  }
+
+  void clear() {
+    Slots().swap(slots_);
+    size_ = 0;
+  }
+
+  /**
+   * Returns the number of bytes allocated for entries.
+   *
+   * This does not include any memory owned by the values themselves.
+   */
+  size_t getMemoryUsage() const {
+    return slots_.capacity() * sizeof(value_type);
+  }
+
+ private:
+  static constexpr size_t kMinSlots = 16;
+
+  size_t getHomeSlot(Key key) const {
+    // Fibonacci hashing.  Keys are often allocated sequentially, and this
+    // spreads them over the table while keeping runs of keys from forming
+    // long probe sequences.
+    auto hash = static_cast<uint64_t>(key) * 0x9e3779b97f4a7c15ULL;
+    return (hash >> 32) & (slots_.size() - 1);
+  }
+
+  /**
+   * Returns the index of key, or slots_.size() if key is not present.
+   */
+  size_t findIndex(Key key) const {
+    if (size_ == 0 || key == EmptyKey) {
+      return slots_.size();
+    }
+    auto mask = slots_.size() - 1;
+    for (auto index = getHomeSlot(key);; index = (index + 1) & mask) {
+      if (slots_[index].first == key) {
+        return index;
+      }
+      if (slots_[index].first == EmptyKey) {
+        return slots_.size();
+      }
+    }
+  }
+
+  /**
+   * Returns the empty slot that key should be inserted into.  key must not
+   * already be present, and the table must not be full.
+   */
+  size_t findSlot(Key key) const {
+    auto mask = slots_.size() - 1;
+    auto index = getHomeSlot(key);
+    while (slots_[index].first != EmptyKey) {
+      index = (index + 1) & mask;
+    }
+    return index;
+  }
+
+  void rehash(size_t numSlots) {
+    Slots oldSlots(numSlots);
+    for (auto& slot : oldSlots) {
+      slot.first = EmptyKey;
+    }
+    oldSlots.swap(slots_);
+    for (auto& slot : oldSlots) {
+      if (slot.first != EmptyKey) {
+        auto index = findSlot(slot.first);
+        slots_[index] = std::move(slot);
+      }
+    }
+  }
+
+  Slots slots_;
+  size_t size_{0};
+};
+
+template <typename Key, typename Value, Key EmptyKey>
+constexpr size_t IntHashMap<Key, Value, EmptyKey>::kMinSlots;
+}
+}
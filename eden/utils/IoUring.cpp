@@ -0,0 +1,288 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/utils/IoUring.h"
+
+#include <folly/Exception.h>
+#include <glog/logging.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <system_error>
+#include <vector>
+
+#if EDEN_HAS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using folly::Future;
+
+namespace facebook {
+namespace eden {
+
+#if EDEN_HAS_IO_URING
+
+namespace {
+int ioUringSetup(unsigned entries, io_uring_params* params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete) {
+  auto flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+  return static_cast<int>(syscall(
+      __NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+void* mapRing(int fd, size_t size, off_t offset) {
+  auto addr = mmap(
+      nullptr,
+      size,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE,
+      fd,
+      offset);
+  folly::checkUnixError(
+      addr == MAP_FAILED ? -1 : 0, "unable to map io_uring ring");
+  return addr;
+}
+
+template <typename T>
+T* ringField(void* ring, uint32_t offset) {
+  return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+}
+}
+
+struct IoUring::Request {
+  Request() {
+    memset(&sqe, 0, sizeof(sqe));
+  }
+
+  io_uring_sqe sqe;
+  // Vectored operations refer to this, which stays put until the request
+  // completes.  Older kernels read it after submission.
+  iovec iov;
+  folly::Promise<int> promise;
+};
+
+IoUring::IoUring(unsigned entries) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ringFd_ = ioUringSetup(entries, &params);
+  folly::checkUnixError(ringFd_, "unable to set up io_uring");
+
+  try {
+    numEntries_ = params.sq_entries;
+    numCompletions_ = params.cq_entries;
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    sqRing_ = mapRing(ringFd_, sqRingSize_, IORING_OFF_SQ_RING);
+    cqRingSize_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    cqRing_ = mapRing(ringFd_, cqRingSize_, IORING_OFF_CQ_RING);
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(
+        mapRing(ringFd_, sqesSize_, IORING_OFF_SQES));
+  } catch (...) {
+    destroyRing();
+    throw;
+  }
+
+  sqHead_ = ringField<unsigned>(sqRing_, params.sq_off.head);
+  sqTail_ = ringField<unsigned>(sqRing_, params.sq_off.tail);
+  sqMask_ = ringField<unsigned>(sqRing_, params.sq_off.ring_mask);
+  sqArray_ = ringField<unsigned>(sqRing_, params.sq_off.array);
+  cqHead_ = ringField<unsigned>(cqRing_, params.cq_off.head);
+  cqTail_ = ringField<unsigned>(cqRing_, params.cq_off.tail);
+  cqMask_ = ringField<unsigned>(cqRing_, params.cq_off.ring_mask);
+  cqes_ = ringField<io_uring_cqe>(cqRing_, params.cq_off.cqes);
+
+  completionThread_ = std::thread([this] { processCompletions(); });
+}
+
+IoUring::~IoUring() {
+  // Wake up the completion thread with a no-op, which it ignores since it
+  // has no Request.  It exits once every outstanding request has completed.
+  io_uring_sqe wakeup;
+  memset(&wakeup, 0, sizeof(wakeup));
+  wakeup.opcode = IORING_OP_NOP;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stopping_ = true;
+    auto tail = *sqTail_;
+    auto index = tail & *sqMask_;
+    sqes_[index] = wakeup;
+    sqArray_[index] = index;
+    __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+    int result;
+    do {
+      result = ioUringEnter(ringFd_, 1, 0);
+    } while (result < 0 && errno == EINTR);
+    PCHECK(result >= 0) << "unable to stop io_uring";
+  }
+  completionThread_.join();
+  destroyRing();
+}
+
+void IoUring::destroyRing() {
+  if (sqes_) {
+    munmap(sqes_, sqesSize_);
+  }
+  if (cqRing_) {
+    munmap(cqRing_, cqRingSize_);
+  }
+  if (sqRing_) {
+    munmap(sqRing_, sqRingSize_);
+  }
+  close(ringFd_);
+}
+
+Future<size_t> IoUring::read(int fd, void* buf, size_t size, off_t off) {
+  auto request = std::make_unique<Request>();
+  request->iov.iov_base = buf;
+  request->iov.iov_len = size;
+  request->sqe.opcode = IORING_OP_READV;
+  request->sqe.fd = fd;
+  request->sqe.off = off;
+  request->sqe.addr = reinterpret_cast<uint64_t>(&request->iov);
+  request->sqe.len = 1;
+  return submit(std::move(request)).then([](int result) {
+    return static_cast<size_t>(result);
+  });
+}
+
+Future<size_t>
+IoUring::write(int fd, const void* buf, size_t size, off_t off) {
+  auto request = std::make_unique<Request>();
+  request->iov.iov_base = const_cast<void*>(buf);
+  request->iov.iov_len = size;
+  request->sqe.opcode = IORING_OP_WRITEV;
+  request->sqe.fd = fd;
+  request->sqe.off = off;
+  request->sqe.addr = reinterpret_cast<uint64_t>(&request->iov);
+  request->sqe.len = 1;
+  return submit(std::move(request)).then([](int result) {
+    return static_cast<size_t>(result);
+  });
+}
+
+Future<folly::Unit> IoUring::fsync(int fd, bool datasync) {
+  auto request = std::make_unique<Request>();
+  request->sqe.opcode = IORING_OP_FSYNC;
+  request->sqe.fd = fd;
+  request->sqe.fsync_flags = datasync ? IORING_FSYNC_DATASYNC : 0;
+  return submit(std::move(request)).then([](int) {});
+}
+
+Future<int> IoUring::submit(std::unique_ptr<Request> request) {
+  auto future = request->promise.getFuture();
+  request->sqe.user_data = reinterpret_cast<uint64_t>(request.get());
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Leave room in the completion queue for the no-op that stops the ring.
+  spaceCV_.wait(lock, [this] { return numInFlight_ + 1 < numCompletions_; });
+  auto tail = *sqTail_;
+  auto index = tail & *sqMask_;
+  sqes_[index] = request->sqe;
+  sqArray_[index] = index;
+  __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+
+  int result;
+  do {
+    result = ioUringEnter(ringFd_, 1, 0);
+  } while (result < 0 && errno == EINTR);
+  if (result < 0 && __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) == tail) {
+    // The kernel did not take the entry, so take it back out of the queue.
+    auto error = errno;
+    __atomic_store_n(sqTail_, tail, __ATOMIC_RELEASE);
+    folly::throwSystemErrorExplicit(
+        error, "unable to submit io_uring request");
+  }
+
+  // The completion thread needs mutex_ to account for the request, so it
+  // cannot complete it before this.
+  ++numInFlight_;
+  request.release();
+  return future;
+}
+
+void IoUring::processCompletions() {
+  std::vector<std::pair<Request*, int>> completed;
+  while (true) {
+    auto result = ioUringEnter(ringFd_, 0, 1);
+    PCHECK(result >= 0 || errno == EINTR) << "error waiting for io_uring";
+
+    completed.clear();
+    auto head = *cqHead_;
+    auto tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      const auto& cqe = cqes_[head & *cqMask_];
+      auto* request = reinterpret_cast<Request*>(cqe.user_data);
+      if (request) {
+        completed.emplace_back(request, cqe.res);
+      }
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+
+    bool stop;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      numInFlight_ -= completed.size();
+      stop = stopping_ && numInFlight_ == 0;
+    }
+    spaceCV_.notify_all();
+
+    for (const auto& entry : completed) {
+      std::unique_ptr<Request> request(entry.first);
+      if (entry.second < 0) {
+        request->promise.setException(std::system_error(
+            -entry.second, std::system_category(), "io_uring request failed"));
+      } else {
+        request->promise.setValue(entry.second);
+      }
+    }
+    if (stop) {
+      break;
+    }
+  }
+}
+
+#else // !EDEN_HAS_IO_URING
+
+struct IoUring::Request {};
+
+IoUring::IoUring(unsigned /* entries */) {
+  throw std::runtime_error("eden was built without io_uring support");
+}
+
+IoUring::~IoUring() {}
+
+void IoUring::destroyRing() {}
+
+Future<size_t> IoUring::read(int, void*, size_t, off_t) {
+  throw std::runtime_error("eden was built without io_uring support");
+}
+
+Future<size_t> IoUring::write(int, const void*, size_t, off_t) {
+  throw std::runtime_error("eden was built without io_uring support");
+}
+
+Future<folly::Unit> IoUring::fsync(int, bool) {
+  throw std::runtime_error("eden was built without io_uring support");
+}
+
+Future<int> IoUring::submit(std::unique_ptr<Request>) {
+  throw std::runtime_error("eden was built without io_uring support");
+}
+
+void IoUring::processCompletions() {}
+
+#endif // EDEN_HAS_IO_URING
+}
+}
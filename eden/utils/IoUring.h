@@ -0,0 +1,122 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+// io_uring is only available on Linux, and needs the kernel headers that
+// define it at build time.  Whether the running kernel supports it is only
+// known once IoUring is constructed.
+#ifndef EDEN_HAS_IO_URING
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define EDEN_HAS_IO_URING 1
+#endif
+#endif
+#endif
+#ifndef EDEN_HAS_IO_URING
+#define EDEN_HAS_IO_URING 0
+#endif
+
+#include <folly/futures/Future.h>
+#include <sys/types.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+struct io_uring_cqe;
+struct io_uring_sqe;
+
+namespace facebook {
+namespace eden {
+
+/**
+ * IoUring performs file I/O asynchronously through a Linux io_uring.
+ *
+ * Each operation is submitted to the kernel right away, and returns a Future
+ * that is fulfilled when it completes, so the calling thread does not block
+ * on the disk.  The Futures are fulfilled on a thread owned by the IoUring,
+ * so their callbacks should not block either.
+ *
+ * The caller must keep the file descriptor open and the buffer valid until
+ * the operation completes.
+ *
+ * IoUring is thread-safe.
+ */
+class IoUring {
+ public:
+  /**
+   * Set up a ring that can hold up to entries submissions at a time.
+   *
+   * Throws std::system_error if the kernel does not support io_uring, or
+   * std::runtime_error if eden was built without it.
+   */
+  explicit IoUring(unsigned entries);
+  ~IoUring();
+
+  /** Like pread(): returns the number of bytes read. */
+  folly::Future<size_t> read(int fd, void* buf, size_t size, off_t off);
+  /** Like pwrite(): returns the number of bytes written. */
+  folly::Future<size_t>
+  write(int fd, const void* buf, size_t size, off_t off);
+  /** Like fsync(), or fdatasync() if datasync is true. */
+  folly::Future<folly::Unit> fsync(int fd, bool datasync);
+
+ private:
+  struct Request;
+
+  // Forbidden copy constructor and assignment operator
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+
+  /**
+   * Submit the request's submission queue entry to the kernel.  The Future
+   * is fulfilled with the operation's result, or a std::system_error if it
+   * failed.
+   */
+  folly::Future<int> submit(std::unique_ptr<Request> request);
+  /** Run by completionThread_ to fulfill the completed requests. */
+  void processCompletions();
+  /** Unmap the rings and close ringFd_. */
+  void destroyRing();
+
+  int ringFd_{-1};
+  unsigned numEntries_{0};
+  unsigned numCompletions_{0};
+
+  void* sqRing_{nullptr};
+  size_t sqRingSize_{0};
+  void* cqRing_{nullptr};
+  size_t cqRingSize_{0};
+  io_uring_sqe* sqes_{nullptr};
+  size_t sqesSize_{0};
+
+  // Pointers into the shared ring buffers
+  unsigned* sqHead_{nullptr};
+  unsigned* sqTail_{nullptr};
+  unsigned* sqMask_{nullptr};
+  unsigned* sqArray_{nullptr};
+  unsigned* cqHead_{nullptr};
+  unsigned* cqTail_{nullptr};
+  unsigned* cqMask_{nullptr};
+  io_uring_cqe* cqes_{nullptr};
+
+  std::mutex mutex_;
+  std::condition_variable spaceCV_;
+  // The fields below are protected by mutex_.
+  /**
+   * The number of requests submitted but not yet completed.  This is kept
+   * within the size of the completion queue, so that it cannot overflow.
+   */
+  size_t numInFlight_{0};
+  bool stopping_{false};
+
+  std::thread completionThread_;
+};
+}
+}
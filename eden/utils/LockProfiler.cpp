@@ -0,0 +1,203 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/utils/LockProfiler.h"
+
+#include <algorithm>
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::nanoseconds;
+
+namespace facebook {
+namespace eden {
+
+constexpr microseconds LockProfiler::kContendedThreshold;
+constexpr size_t LockProfiler::kNumBuckets;
+
+std::atomic<bool> LockProfiler::enabled_{false};
+thread_local const char* LockProfiler::currentSite_{nullptr};
+
+namespace {
+const char* const kUnknownSite = "unknown";
+
+void updateMax(std::atomic<uint64_t>& max, uint64_t value) {
+  auto current = max.load(std::memory_order_relaxed);
+  while (value > current &&
+         !max.compare_exchange_weak(
+             current, value, std::memory_order_relaxed)) {
+  }
+}
+
+uint64_t bucketUpperBound(size_t bucket) {
+  return bucket == 0 ? 0 : (uint64_t{1} << bucket) - 1;
+}
+}
+
+std::array<LockProfiler::LockStats, LockProfiler::NUM_LOCKS>&
+LockProfiler::getStats() {
+  // Leaked so that locks released during static destruction are safe.
+  static auto* stats = new std::array<LockStats, NUM_LOCKS>();
+  return *stats;
+}
+
+void LockProfiler::setEnabled(bool enabled) {
+  if (enabled) {
+    for (auto& lockStats : getStats()) {
+      lockStats.wait.reset();
+      lockStats.hold.reset();
+      lockStats.contended.store(0, std::memory_order_relaxed);
+      lockStats.sites.lock()->clear();
+    }
+  }
+  enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+size_t LockProfiler::getBucket(microseconds duration) {
+  auto us = static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0));
+  size_t bucket = 0;
+  while (us != 0 && bucket < kNumBuckets - 1) {
+    us >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+void LockProfiler::recordWait(Lock lock, nanoseconds wait) {
+  if (!isEnabled()) {
+    return;
+  }
+  auto us = duration_cast<microseconds>(wait);
+  auto& lockStats = getStats()[lock];
+  lockStats.wait.add(us.count());
+  if (us < kContendedThreshold) {
+    return;
+  }
+
+  lockStats.contended.fetch_add(1, std::memory_order_relaxed);
+  auto site = currentSite_ ? currentSite_ : kUnknownSite;
+  auto sites = lockStats.sites.lock();
+  auto& siteStats = (*sites)[site];
+  ++siteStats.contended;
+  siteStats.totalWaitUs += us.count();
+  siteStats.maxWaitUs =
+      std::max<uint64_t>(siteStats.maxWaitUs, us.count());
+}
+
+void LockProfiler::recordHold(Lock lock, nanoseconds hold) {
+  if (!isEnabled()) {
+    return;
+  }
+  getStats()[lock].hold.add(duration_cast<microseconds>(hold).count());
+}
+
+std::vector<LockProfiler::LockSummary> LockProfiler::getSummary(
+    size_t maxSites) {
+  std::vector<LockSummary> result;
+  auto& stats = getStats();
+  for (size_t n = 0; n < NUM_LOCKS; ++n) {
+    LockSummary summary;
+    summary.lock = static_cast<Lock>(n);
+    summary.wait = stats[n].wait.summarize();
+    summary.hold = stats[n].hold.summarize();
+    summary.contended = stats[n].contended.load(std::memory_order_relaxed);
+
+    // The same site name may appear at several addresses if it is used in
+    // more than one translation unit, so merge by name.
+    std::unordered_map<std::string, SiteSummary> byName;
+    {
+      auto sites = stats[n].sites.lock();
+      for (const auto& entry : *sites) {
+        auto& site = byName[entry.first];
+        site.contended += entry.second.contended;
+        site.totalWaitUs += entry.second.totalWaitUs;
+        site.maxWaitUs = std::max(site.maxWaitUs, entry.second.maxWaitUs);
+      }
+    }
+    for (auto& entry : byName) {
+      entry.second.site = entry.first;
+      summary.topSites.push_back(std::move(entry.second));
+    }
+    std::sort(
+        summary.topSites.begin(),
+        summary.topSites.end(),
+        [](const SiteSummary& a, const SiteSummary& b) {
+          return a.totalWaitUs > b.totalWaitUs;
+        });
+    if (summary.topSites.size() > maxSites) {
+      summary.topSites.resize(maxSites);
+    }
+    result.push_back(std::move(summary));
+  }
+  return result;
+}
+
+folly::StringPiece LockProfiler::getLockName(Lock lock) {
+  switch (lock) {
+    case RENAME_LOCK:
+      return "rename_lock";
+    case CONTENTS_LOCK:
+      return "contents_lock";
+    case INODE_MAP_LOCK:
+      return "inode_map_lock";
+    case NUM_LOCKS:
+      break;
+  }
+  return "unknown";
+}
+
+void LockProfiler::Histogram::add(uint64_t us) {
+  buckets_[getBucket(microseconds(us))].fetch_add(
+      1, std::memory_order_relaxed);
+  totalUs_.fetch_add(us, std::memory_order_relaxed);
+  updateMax(maxUs_, us);
+}
+
+void LockProfiler::Histogram::reset() {
+  for (auto& bucket : buckets_) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  totalUs_.store(0, std::memory_order_relaxed);
+  maxUs_.store(0, std::memory_order_relaxed);
+}
+
+LockProfiler::DurationSummary LockProfiler::Histogram::summarize() const {
+  std::array<uint64_t, kNumBuckets> buckets;
+  uint64_t count = 0;
+  for (size_t n = 0; n < kNumBuckets; ++n) {
+    buckets[n] = buckets_[n].load(std::memory_order_relaxed);
+    count += buckets[n];
+  }
+
+  DurationSummary summary;
+  summary.count = count;
+  summary.totalUs = totalUs_.load(std::memory_order_relaxed);
+  summary.maxUs = maxUs_.load(std::memory_order_relaxed);
+  if (count == 0) {
+    return summary;
+  }
+  auto percentile = [&](uint64_t pct) {
+    // The rank of the percentile, rounded up, in [1, count].
+    auto rank = std::max<uint64_t>((count * pct + 99) / 100, 1);
+    uint64_t seen = 0;
+    for (size_t n = 0; n < kNumBuckets; ++n) {
+      seen += buckets[n];
+      if (seen >= rank) {
+        return std::min(bucketUpperBound(n), summary.maxUs);
+      }
+    }
+    return summary.maxUs;
+  };
+  summary.p50Us = percentile(50);
+  summary.p90Us = percentile(90);
+  summary.p99Us = percentile(99);
+  return summary;
+}
+}
+}
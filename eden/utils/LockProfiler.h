@@ -0,0 +1,233 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+#include <folly/Range.h>
+#include <folly/SharedMutex.h>
+#include <folly/Synchronized.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace facebook {
+namespace eden {
+
+/**
+ * LockProfiler records how long threads wait for, and hold, the few locks
+ * that serialize work on a mount point: the rename lock, the TreeInode
+ * contents locks and the InodeMap shard locks.  docs/InodeLocks.md describes
+ * the order these are acquired in.
+ *
+ * Profiling is off by default, in which case ProfiledMutex costs one relaxed
+ * atomic load per acquisition.  While it is enabled, every acquisition adds
+ * to log2-bucketed wait and hold time histograms, and each acquisition that
+ * had to wait is also attributed to the call site that requested it.
+ *
+ * The statistics cover all mount points: the locks are identified by kind,
+ * not by the object they protect.
+ */
+class LockProfiler {
+ public:
+  enum Lock : size_t {
+    RENAME_LOCK,
+    CONTENTS_LOCK,
+    INODE_MAP_LOCK,
+    NUM_LOCKS,
+  };
+
+  /**
+   * Acquisitions that waited at least this long count as contended, and are
+   * attributed to their call site.
+   */
+  static constexpr std::chrono::microseconds kContendedThreshold{1};
+  /**
+   * Bucket 0 holds durations under 1us, and bucket n > 0 holds durations in
+   * [2^(n-1), 2^n) us.  The last bucket also holds anything longer.
+   */
+  static constexpr size_t kNumBuckets = 32;
+
+  struct DurationSummary {
+    uint64_t count{0};
+    uint64_t totalUs{0};
+    uint64_t maxUs{0};
+    // Upper bounds of the buckets containing each percentile.
+    uint64_t p50Us{0};
+    uint64_t p90Us{0};
+    uint64_t p99Us{0};
+  };
+
+  struct SiteSummary {
+    std::string site;
+    uint64_t contended{0};
+    uint64_t totalWaitUs{0};
+    uint64_t maxWaitUs{0};
+  };
+
+  struct LockSummary {
+    Lock lock;
+    DurationSummary wait;
+    // Hold times are only recorded for exclusive acquisitions.
+    DurationSummary hold;
+    uint64_t contended{0};
+    // The call sites with the most total wait time, longest first.
+    std::vector<SiteSummary> topSites;
+  };
+
+  /**
+   * Sets the call site that is attributed with any lock wait on this thread
+   * for as long as the SiteScope exists.  site must be a string literal.
+   */
+  class SiteScope {
+   public:
+    explicit SiteScope(const char* site) : previous_{currentSite_} {
+      currentSite_ = site;
+    }
+    ~SiteScope() {
+      currentSite_ = previous_;
+    }
+    SiteScope(const SiteScope&) = delete;
+    SiteScope& operator=(const SiteScope&) = delete;
+
+   private:
+    const char* previous_;
+  };
+
+  static bool isEnabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Turn profiling on or off.  Turning it on discards the statistics
+   * recorded so far.
+   */
+  static void setEnabled(bool enabled);
+
+  static void recordWait(Lock lock, std::chrono::nanoseconds wait);
+  static void recordHold(Lock lock, std::chrono::nanoseconds hold);
+
+  /**
+   * Returns the statistics recorded since profiling was last enabled, with
+   * at most maxSites call sites per lock.
+   */
+  static std::vector<LockSummary> getSummary(size_t maxSites);
+
+  /**
+   * Returns a short name for a lock, such as "rename_lock".
+   */
+  static folly::StringPiece getLockName(Lock lock);
+
+  /**
+   * Returns the index of the histogram bucket for a duration.
+   */
+  static size_t getBucket(std::chrono::microseconds duration);
+
+ private:
+  class Histogram {
+   public:
+    void add(uint64_t us);
+    void reset();
+    DurationSummary summarize() const;
+
+   private:
+    std::array<std::atomic<uint64_t>, kNumBuckets> buckets_{};
+    std::atomic<uint64_t> totalUs_{0};
+    std::atomic<uint64_t> maxUs_{0};
+  };
+
+  struct SiteStats {
+    uint64_t contended{0};
+    uint64_t totalWaitUs{0};
+    uint64_t maxWaitUs{0};
+  };
+  // Keyed by the address of the site's string literal.
+  using SiteMap = std::unordered_map<const char*, SiteStats>;
+
+  struct LockStats {
+    Histogram wait;
+    Histogram hold;
+    std::atomic<uint64_t> contended{0};
+    folly::Synchronized<SiteMap, std::mutex> sites;
+  };
+
+  static std::array<LockStats, NUM_LOCKS>& getStats();
+
+  static std::atomic<bool> enabled_;
+  static thread_local const char* currentSite_;
+};
+
+/**
+ * A shared mutex that reports to the LockProfiler.  Use it as the Mutex
+ * parameter of folly::Synchronized, or with std::unique_lock and
+ * std::shared_lock.
+ */
+template <LockProfiler::Lock kLock, typename Mutex = folly::SharedMutex>
+class ProfiledMutex {
+ public:
+  void lock() {
+    if (!LockProfiler::isEnabled()) {
+      mutex_.lock();
+      return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    mutex_.lock();
+    // lockedAt_ is only accessed by the thread holding the lock exclusively.
+    lockedAt_ = std::chrono::steady_clock::now();
+    LockProfiler::recordWait(kLock, lockedAt_ - start);
+  }
+
+  bool try_lock() {
+    if (!mutex_.try_lock()) {
+      return false;
+    }
+    if (LockProfiler::isEnabled()) {
+      lockedAt_ = std::chrono::steady_clock::now();
+    }
+    return true;
+  }
+
+  void unlock() {
+    auto lockedAt = lockedAt_;
+    if (lockedAt == std::chrono::steady_clock::time_point{}) {
+      mutex_.unlock();
+      return;
+    }
+    lockedAt_ = std::chrono::steady_clock::time_point{};
+    auto held = std::chrono::steady_clock::now() - lockedAt;
+    mutex_.unlock();
+    LockProfiler::recordHold(kLock, held);
+  }
+
+  void lock_shared() {
+    if (!LockProfiler::isEnabled()) {
+      mutex_.lock_shared();
+      return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    mutex_.lock_shared();
+    LockProfiler::recordWait(kLock, std::chrono::steady_clock::now() - start);
+  }
+
+  bool try_lock_shared() {
+    return mutex_.try_lock_shared();
+  }
+
+  void unlock_shared() {
+    mutex_.unlock_shared();
+  }
+
+ private:
+  Mutex mutex_;
+  std::chrono::steady_clock::time_point lockedAt_;
+};
+}
+}
@@ -0,0 +1,135 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/utils/MemoryGovernor.h"
+
+#include <folly/Conv.h>
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <glog/logging.h>
+
+using folly::StringPiece;
+
+namespace facebook {
+namespace eden {
+
+MemoryGovernor::MemoryGovernor(
+    AbsolutePathPiece pressurePath,
+    double threshold,
+    double keepFraction,
+    std::chrono::steady_clock::duration cooldown)
+    : pressurePath_(pressurePath),
+      threshold_(threshold),
+      keepFraction_(keepFraction),
+      cooldown_(cooldown) {}
+
+void MemoryGovernor::addConsumer(
+    StringPiece name,
+    GetBytes getBytes,
+    Shrink shrink) {
+  Consumer consumer;
+  consumer.getBytes = std::move(getBytes);
+  consumer.shrink = std::move(shrink);
+  consumer.stats.name = name.str();
+  std::lock_guard<std::mutex> guard(mutex_);
+  consumers_.push_back(std::move(consumer));
+}
+
+void MemoryGovernor::check() {
+  std::string contents;
+  folly::Optional<double> pressure;
+  if (folly::readFile(pressurePath_.c_str(), contents)) {
+    pressure = parsePressure(contents);
+  }
+  if (!pressure.hasValue()) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (!warnedUnreadable_) {
+      LOG(WARNING) << "unable to read memory pressure from " << pressurePath_
+                   << ": caches will not be shrunk under memory pressure";
+      warnedUnreadable_ = true;
+    }
+  }
+  update(pressure.value_or(0), std::chrono::steady_clock::now());
+}
+
+bool MemoryGovernor::update(
+    double pressure,
+    std::chrono::steady_clock::time_point now) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  pressure_ = pressure;
+  bool shrink = pressure >= threshold_ &&
+      (!lastShrink_.hasValue() || now - lastShrink_.value() >= cooldown_);
+  if (shrink) {
+    ++pressureEvents_;
+    lastShrink_ = now;
+  }
+
+  size_t totalBytes = 0;
+  size_t totalFreed = 0;
+  for (auto& consumer : consumers_) {
+    auto bytes = consumer.getBytes();
+    if (shrink && consumer.shrink) {
+      consumer.shrink(keepFraction_);
+      auto after = consumer.getBytes();
+      auto freed = after < bytes ? bytes - after : 0;
+      ++consumer.stats.pressureShrinks;
+      consumer.stats.pressureFreedBytes += freed;
+      totalFreed += freed;
+      bytes = after;
+    }
+    consumer.stats.bytes = bytes;
+    totalBytes += bytes;
+  }
+
+  if (shrink) {
+    LOG(INFO) << "memory pressure " << pressure << "% is over "
+              << threshold_ << "%: freed " << totalFreed << " bytes, "
+              << totalBytes << " bytes still in use";
+  }
+  return shrink;
+}
+
+MemoryGovernorStats MemoryGovernor::getStats() const {
+  MemoryGovernorStats result;
+  std::lock_guard<std::mutex> guard(mutex_);
+  result.pressure = pressure_;
+  result.pressureEvents = pressureEvents_;
+  for (const auto& consumer : consumers_) {
+    result.totalBytes += consumer.stats.bytes;
+    result.consumers.push_back(consumer.stats);
+  }
+  return result;
+}
+
+folly::Optional<double> MemoryGovernor::parsePressure(StringPiece contents) {
+  // The file looks like:
+  //   some avg10=1.53 avg60=0.87 avg300=0.30 total=1234567
+  //   full avg10=0.00 avg60=0.00 avg300=0.00 total=0
+  std::vector<StringPiece> lines;
+  folly::split('\n', contents, lines);
+  for (auto line : lines) {
+    if (!line.removePrefix("some ")) {
+      continue;
+    }
+    std::vector<StringPiece> fields;
+    folly::split(' ', line, fields, true);
+    for (auto field : fields) {
+      if (field.removePrefix("avg10=")) {
+        auto value = folly::tryTo<double>(field);
+        if (value.hasValue()) {
+          return value.value();
+        }
+        return folly::none;
+      }
+    }
+  }
+  return folly::none;
+}
+}
+}
@@ -0,0 +1,135 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Optional.h>
+#include <folly/Range.h>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "eden/utils/PathFuncs.h"
+
+namespace facebook {
+namespace eden {
+
+/**
+ * Statistics about one kind of memory tracked by a MemoryGovernor.
+ */
+struct MemoryConsumerStats {
+  std::string name;
+  /** The number of bytes in use as of the last check */
+  size_t bytes{0};
+  /** The number of times it was shrunk because of memory pressure */
+  uint64_t pressureShrinks{0};
+  /** The number of bytes freed by those shrinks */
+  uint64_t pressureFreedBytes{0};
+};
+
+/**
+ * Statistics about a MemoryGovernor.
+ */
+struct MemoryGovernorStats {
+  /** The memory pressure seen by the last check, in percent */
+  double pressure{0};
+  /** The number of checks that found the pressure over the threshold */
+  uint64_t pressureEvents{0};
+  /** The total bytes in use by all consumers as of the last check */
+  size_t totalBytes{0};
+  std::vector<MemoryConsumerStats> consumers;
+};
+
+/**
+ * MemoryGovernor keeps track of the memory used by the caches of the whole
+ * process, and shrinks them when the host is short of memory.
+ *
+ * Memory pressure is read from a Linux pressure stall information file:
+ * /proc/pressure/memory for the whole host, or a cgroup's memory.pressure
+ * for the cgroup eden runs in.  The "some avg10" value is the percentage of
+ * the last 10 seconds in which some task was stalled waiting for memory.
+ * When it reaches the threshold, every consumer is asked to shrink to
+ * keepFraction of its current size.  Shrinking again is held off for
+ * cooldown, so that the pressure average has time to reflect the memory
+ * that was given back.
+ *
+ * Consumers only free memory when asked.  The caches fill up again as they
+ * are used, and are shrunk again if the pressure persists.
+ *
+ * MemoryGovernor is thread-safe.
+ */
+class MemoryGovernor {
+ public:
+  /** Returns the number of bytes a consumer currently uses. */
+  using GetBytes = std::function<size_t()>;
+  /** Free memory, keeping about keepFraction of the current use. */
+  using Shrink = std::function<void(double keepFraction)>;
+
+  MemoryGovernor(
+      AbsolutePathPiece pressurePath,
+      double threshold,
+      double keepFraction,
+      std::chrono::steady_clock::duration cooldown);
+
+  /**
+   * Start tracking a consumer.  shrink may be empty for memory that is
+   * tracked but cannot be given back on demand.
+   */
+  void addConsumer(folly::StringPiece name, GetBytes getBytes, Shrink shrink);
+
+  /**
+   * Read the current memory pressure and update the consumers accordingly.
+   *
+   * If the pressure file cannot be read, which is the case on kernels
+   * without pressure stall information, only the byte counts are updated.
+   */
+  void check();
+
+  /**
+   * Update the consumers given the current memory pressure.  Returns true
+   * if they were asked to shrink.
+   */
+  bool update(double pressure, std::chrono::steady_clock::time_point now);
+
+  MemoryGovernorStats getStats() const;
+
+  /**
+   * Parse the "some avg10" value out of the contents of a pressure stall
+   * information file.  Returns folly::none if it is not present.
+   */
+  static folly::Optional<double> parsePressure(folly::StringPiece contents);
+
+ private:
+  struct Consumer {
+    GetBytes getBytes;
+    Shrink shrink;
+    MemoryConsumerStats stats;
+  };
+
+  // Forbidden copy constructor and assignment operator
+  MemoryGovernor(const MemoryGovernor&) = delete;
+  MemoryGovernor& operator=(const MemoryGovernor&) = delete;
+
+  const AbsolutePath pressurePath_;
+  const double threshold_{0};
+  const double keepFraction_{0};
+  const std::chrono::steady_clock::duration cooldown_;
+
+  mutable std::mutex mutex_;
+  // The fields below are protected by mutex_.  The consumers' callbacks are
+  // called with it held, so check() and update() never run concurrently.
+  std::vector<Consumer> consumers_;
+  double pressure_{0};
+  uint64_t pressureEvents_{0};
+  bool warnedUnreadable_{false};
+  folly::Optional<std::chrono::steady_clock::time_point> lastShrink_;
+};
+}
+}
@@ -0,0 +1,173 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/utils/NumaTopology.h"
+
+#include <folly/Conv.h>
+#include <folly/Exception.h>
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+DEFINE_bool(
+    numaAware,
+    false,
+    "On machines with more than one NUMA node, bind the FUSE worker threads "
+    "of each mount to the nodes in turn, and keep a separate in-memory tree "
+    "cache for each node, so that most lookups only touch node-local memory");
+
+using folly::StringPiece;
+using std::vector;
+
+namespace facebook {
+namespace eden {
+
+namespace {
+constexpr StringPiece kNodeDir{"/sys/devices/system/node"};
+
+vector<unsigned> getAllCpus() {
+  vector<unsigned> cpus;
+  auto numCpus = std::max(std::thread::hardware_concurrency(), 1u);
+  for (unsigned cpu = 0; cpu < numCpus; ++cpu) {
+    cpus.push_back(cpu);
+  }
+  return cpus;
+}
+}
+
+NumaTopology::NumaTopology(vector<vector<unsigned>> nodeCpus)
+    : nodeCpus_(std::move(nodeCpus)) {
+  if (nodeCpus_.empty()) {
+    nodeCpus_.emplace_back();
+  }
+  for (size_t node = 0; node < nodeCpus_.size(); ++node) {
+    for (auto cpu : nodeCpus_[node]) {
+      if (cpu >= cpuNodes_.size()) {
+        cpuNodes_.resize(cpu + 1, 0);
+      }
+      cpuNodes_[cpu] = node;
+    }
+  }
+}
+
+const NumaTopology& NumaTopology::get() {
+  static const auto* topology = [] {
+    if (!FLAGS_numaAware) {
+      return new NumaTopology({getAllCpus()});
+    }
+    auto* result = new NumaTopology(readFromSysfs());
+    LOG(INFO) << "NUMA aware mode: using " << result->getNumNodes()
+              << " node(s)";
+    return result;
+  }();
+  return *topology;
+}
+
+NumaTopology NumaTopology::readFromSysfs() {
+  vector<vector<unsigned>> nodeCpus;
+  try {
+    std::string online;
+    if (!folly::readFile(
+            folly::to<std::string>(kNodeDir, "/online").c_str(), online)) {
+      throw std::runtime_error("unable to read the list of online nodes");
+    }
+    for (auto nodeId : parseCpuList(online)) {
+      std::string cpuList;
+      auto path = folly::to<std::string>(kNodeDir, "/node", nodeId, "/cpulist");
+      if (!folly::readFile(path.c_str(), cpuList)) {
+        throw std::runtime_error(
+            folly::to<std::string>("unable to read ", path));
+      }
+      auto cpus = parseCpuList(cpuList);
+      // Threads cannot be bound to nodes that only have memory.
+      if (!cpus.empty()) {
+        nodeCpus.push_back(std::move(cpus));
+      }
+    }
+  } catch (const std::exception& ex) {
+    LOG(WARNING) << "unable to read the NUMA topology, so treating this "
+                 << "machine as a single node: " << folly::exceptionStr(ex);
+    nodeCpus.clear();
+  }
+
+  if (nodeCpus.empty()) {
+    nodeCpus.push_back(getAllCpus());
+  }
+  return NumaTopology(std::move(nodeCpus));
+}
+
+size_t NumaTopology::getCurrentNode() const {
+  if (nodeCpus_.size() == 1) {
+    return 0;
+  }
+  auto cpu = sched_getcpu();
+  if (cpu < 0 || static_cast<size_t>(cpu) >= cpuNodes_.size()) {
+    return 0;
+  }
+  return cpuNodes_[cpu];
+}
+
+void NumaTopology::bindCurrentThread(size_t node) const {
+  setCurrentThreadCpus(nodeCpus_.at(node));
+}
+
+void NumaTopology::setCurrentThreadCpus(const vector<unsigned>& cpus) {
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  for (auto cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &cpuSet);
+    }
+  }
+  auto err = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+  if (err != 0) {
+    folly::throwSystemErrorExplicit(err, "unable to set the thread's CPUs");
+  }
+}
+
+vector<unsigned> NumaTopology::parseCpuList(StringPiece list) {
+  vector<unsigned> result;
+  vector<StringPiece> ranges;
+  folly::split(',', folly::trimWhitespace(list), ranges);
+  for (auto range : ranges) {
+    if (range.empty()) {
+      // An empty list describes a node without CPUs.
+      if (ranges.size() == 1) {
+        break;
+      }
+      throw std::invalid_argument(
+          folly::to<std::string>("empty range in CPU list \"", list, "\""));
+    }
+    StringPiece first;
+    StringPiece last;
+    if (!folly::split('-', range, first, last)) {
+      first = range;
+      last = range;
+    }
+    auto begin = folly::tryTo<unsigned>(first);
+    auto end = folly::tryTo<unsigned>(last);
+    if (!begin.hasValue() || !end.hasValue() || end.value() < begin.value()) {
+      throw std::invalid_argument(folly::to<std::string>(
+          "invalid range \"", range, "\" in CPU list \"", list, "\""));
+    }
+    for (auto cpu = begin.value(); cpu <= end.value(); ++cpu) {
+      result.push_back(cpu);
+    }
+  }
+  return result;
+}
+}
+}
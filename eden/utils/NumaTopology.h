@@ -0,0 +1,93 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Range.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace facebook {
+namespace eden {
+
+/**
+ * NumaTopology describes which CPUs belong to which NUMA node.
+ *
+ * Nodes are numbered densely from 0, even if the kernel's node IDs are not.
+ * A machine without NUMA support is described as a single node containing
+ * every CPU.
+ */
+class NumaTopology {
+ public:
+  /**
+   * Create a topology from the CPUs of each node.  An empty list describes a
+   * single node, with no known CPUs.
+   */
+  explicit NumaTopology(std::vector<std::vector<unsigned>> nodeCpus);
+
+  /**
+   * Get the topology that eden should use.
+   *
+   * This is the machine's topology, read from sysfs the first time it is
+   * needed, if --numaAware is set.  Otherwise it is a single node, so that
+   * code which partitions its work or data by node does not partition it.
+   */
+  static const NumaTopology& get();
+
+  /**
+   * Read the machine's topology from sysfs.  A machine whose topology
+   * cannot be read is treated as a single node.
+   */
+  static NumaTopology readFromSysfs();
+
+  size_t getNumNodes() const {
+    return nodeCpus_.size();
+  }
+
+  const std::vector<unsigned>& getNodeCpus(size_t node) const {
+    return nodeCpus_[node];
+  }
+
+  /**
+   * Get the node of the CPU that the calling thread is running on.
+   *
+   * This is cheap, but only a hint unless the thread is bound to a node:
+   * the thread may be moved to another CPU at any time.
+   */
+  size_t getCurrentNode() const;
+
+  /**
+   * Restrict the calling thread to the CPUs of a node.  The kernel then
+   * prefers that node's memory for the pages the thread touches first.
+   *
+   * Throws std::system_error on failure.
+   */
+  void bindCurrentThread(size_t node) const;
+
+  /**
+   * Restrict the calling thread to the given CPUs.
+   *
+   * Throws std::system_error on failure.
+   */
+  static void setCurrentThreadCpus(const std::vector<unsigned>& cpus);
+
+  /**
+   * Parse a list of CPU or node numbers in the kernel's format, such as
+   * "0-3,8,10-11".  Throws std::invalid_argument if it is malformed.
+   */
+  static std::vector<unsigned> parseCpuList(folly::StringPiece list);
+
+ private:
+  std::vector<std::vector<unsigned>> nodeCpus_;
+  /** The node of each CPU, indexed by CPU number */
+  std::vector<uint16_t> cpuNodes_;
+};
+}
+}
@@ -0,0 +1,195 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "OpenMetrics.h"
+
+#include <folly/Conv.h>
+#include <folly/Optional.h>
+#include <folly/Range.h>
+#include <algorithm>
+#include <set>
+
+using folly::StringPiece;
+using std::string;
+
+namespace facebook {
+namespace eden {
+
+namespace {
+struct ParsedName {
+  string mountPoint;
+  string base;
+  // The percentile, for names ending in ".p<N>".
+  folly::Optional<int> percentile;
+};
+
+ParsedName parseName(
+    StringPiece name,
+    const std::vector<string>& mountPoints) {
+  ParsedName parsed;
+  if (name.startsWith("mount.")) {
+    // mountPoints is sorted longest first, so a mount point nested inside
+    // another one matches before its parent.
+    for (const auto& mountPoint : mountPoints) {
+      auto rest = name.subpiece(6);
+      if (rest.startsWith(mountPoint) && rest.size() > mountPoint.size() &&
+          rest[mountPoint.size()] == '.') {
+        parsed.mountPoint = mountPoint;
+        name = rest.subpiece(mountPoint.size() + 1);
+        break;
+      }
+    }
+  }
+
+  auto dot = name.rfind('.');
+  if (dot != StringPiece::npos && dot + 2 < name.size() &&
+      name[dot + 1] == 'p') {
+    auto digits = name.subpiece(dot + 2);
+    if (std::all_of(digits.begin(), digits.end(), [](char c) {
+          return c >= '0' && c <= '9';
+        })) {
+      auto percentile = folly::tryTo<int>(digits);
+      if (percentile.hasValue()) {
+        parsed.percentile = percentile.value();
+        name = name.subpiece(0, dot);
+      }
+    }
+  }
+  parsed.base = name.str();
+  return parsed;
+}
+
+string metricName(StringPiece name) {
+  string result = "eden_";
+  result.reserve(result.size() + name.size());
+  for (char c : name) {
+    bool valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+        (c >= '0' && c <= '9') || c == '_';
+    result.push_back(valid ? c : '_');
+  }
+  return result;
+}
+
+string escapeLabelValue(StringPiece value) {
+  string result;
+  result.reserve(value.size());
+  for (char c : value) {
+    switch (c) {
+      case '\\':
+        result += "\\\\";
+        break;
+      case '"':
+        result += "\\\"";
+        break;
+      case '\n':
+        result += "\\n";
+        break;
+      default:
+        result.push_back(c);
+    }
+  }
+  return result;
+}
+
+string formatLabels(StringPiece mountPoint, StringPiece quantile) {
+  string labels;
+  if (!mountPoint.empty()) {
+    labels = folly::to<string>("mount=\"", escapeLabelValue(mountPoint), "\"");
+  }
+  if (!quantile.empty()) {
+    folly::toAppend(
+        labels.empty() ? "" : ",", "quantile=\"", quantile, "\"", &labels);
+  }
+  return labels.empty() ? labels : folly::to<string>("{", labels, "}");
+}
+
+struct Family {
+  bool summary{false};
+  std::vector<string> samples;
+};
+}
+
+string renderOpenMetrics(
+    const std::map<string, int64_t>& counters,
+    const std::vector<string>& mountPoints) {
+  auto sortedMounts = mountPoints;
+  std::sort(
+      sortedMounts.begin(),
+      sortedMounts.end(),
+      [](const string& a, const string& b) { return a.size() > b.size(); });
+
+  // Histograms are identified by their percentiles, so find those first in
+  // order to render their ".count" and ".sum" counters as part of them.
+  std::set<string> summaries;
+  for (const auto& entry : counters) {
+    auto parsed = parseName(entry.first, sortedMounts);
+    if (parsed.percentile) {
+      summaries.insert(parsed.base);
+    }
+  }
+
+  // All of a family's samples must be adjacent, so group them by metric name
+  // before rendering.
+  std::map<string, Family> families;
+  for (const auto& entry : counters) {
+    auto parsed = parseName(entry.first, sortedMounts);
+    if (parsed.percentile) {
+      auto& family = families[metricName(parsed.base)];
+      family.summary = true;
+      auto quantile = folly::to<string>(*parsed.percentile / 100.0);
+      family.samples.push_back(folly::to<string>(
+          metricName(parsed.base),
+          formatLabels(parsed.mountPoint, quantile),
+          " ",
+          entry.second));
+      continue;
+    }
+
+    StringPiece base{parsed.base};
+    auto dot = base.rfind('.');
+    if (dot != StringPiece::npos) {
+      auto suffix = base.subpiece(dot + 1);
+      auto prefix = base.subpiece(0, dot).str();
+      if ((suffix == "count" || suffix == "sum") && summaries.count(prefix)) {
+        auto& family = families[metricName(prefix)];
+        family.summary = true;
+        family.samples.push_back(folly::to<string>(
+            metricName(prefix),
+            "_",
+            suffix,
+            formatLabels(parsed.mountPoint, ""),
+            " ",
+            entry.second));
+        continue;
+      }
+    }
+
+    families[metricName(base)].samples.push_back(folly::to<string>(
+        metricName(base),
+        formatLabels(parsed.mountPoint, ""),
+        " ",
+        entry.second));
+  }
+
+  string result;
+  for (const auto& entry : families) {
+    folly::toAppend(
+        "# TYPE ",
+        entry.first,
+        entry.second.summary ? " summary\n" : " unknown\n",
+        &result);
+    for (const auto& sample : entry.second.samples) {
+      folly::toAppend(sample, "\n", &result);
+    }
+  }
+  result += "# EOF\n";
+  return result;
+}
+}
+}
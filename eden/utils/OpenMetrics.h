@@ -0,0 +1,39 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace facebook {
+namespace eden {
+
+/**
+ * Render fb303 counters in the OpenMetrics text format, for scraping by
+ * Prometheus.
+ *
+ * Counter names are prefixed with "eden_", and any character that is not
+ * valid in a metric name becomes '_', so "object_store.tree_cache.hit" is
+ * rendered as eden_object_store_tree_cache_hit.
+ *
+ * Counters named "mount.<mountPoint>.<name>", for any of the given mount
+ * points, are rendered as <name> with a mount="<mountPoint>" label.
+ *
+ * A counter group with percentiles, as exported for a histogram ("<name>.p50",
+ * "<name>.count", "<name>.sum"), becomes a summary with quantile labels.
+ * Everything else has the unknown type, since fb303 does not say whether a
+ * counter is monotonic.
+ */
+std::string renderOpenMetrics(
+    const std::map<std::string, int64_t>& counters,
+    const std::vector<std::string>& mountPoints);
+}
+}
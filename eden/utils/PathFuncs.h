@@ -12,6 +12,7 @@
 #include <folly/Format.h>
 #include <folly/Hash.h>
 #include <folly/String.h>
+#include <cstring>
 #include <type_traits>
 
 namespace facebook {
@@ -75,6 +76,33 @@ namespace detail {
 /// A type to select the constructors that skip sanity checks
 struct SkipPathSanityCheck {};
 
+/**
+ * Find the first directory separator in [begin, end), or return end if there
+ * is none.
+ *
+ * Path code scans for separators constantly, so this uses memchr() and
+ * memrchr() rather than a byte-at-a-time loop: glibc implements them with
+ * the widest vector instructions the CPU supports.
+ */
+inline const char* findSeparator(const char* begin, const char* end) {
+  if (begin == end) {
+    return end;
+  }
+  auto* p = memchr(begin, kDirSeparator, end - begin);
+  return p ? static_cast<const char*>(p) : end;
+}
+
+/**
+ * Find the last directory separator in [begin, end), or return nullptr if
+ * there is none.
+ */
+inline const char* rfindSeparator(const char* begin, const char* end) {
+  if (begin == end) {
+    return nullptr;
+  }
+  return static_cast<const char*>(memrchr(begin, kDirSeparator, end - begin));
+}
+
 template <typename STR>
 class PathComponentBase;
 
@@ -282,9 +310,7 @@ class PathBase :
       typename = typename std::enable_if<
           std::is_same<StorageAlias, folly::fbstring>::value>::type>
   explicit PathBase(folly::fbstring&& str, SkipPathSanityCheck)
-      : path_(std::move(str)) {
-    SanityChecker()(path_);
-  }
+      : path_(std::move(str)) {}
 
   /// Return the path as a StringPiece
   folly::StringPiece stringPiece() const {
@@ -327,7 +353,7 @@ class PathBase :
 /// Asserts that val is a well formed path component
 struct PathComponentSanityCheck {
   void operator()(folly::StringPiece val) const {
-    if (val.find(kDirSeparator) != std::string::npos) {
+    if (findSeparator(val.begin(), val.end()) != val.end()) {
       throw std::domain_error(folly::to<std::string>(
           "attempt to construct a PathComponent from a string containing a "
           "directory separator: ",
@@ -456,8 +482,10 @@ class ComposedPathIterator
   /// Returns the piece for the current iterator position.
   Piece piece() const {
     CHECK_NOTNULL(pos_);
-    // Return everything preceding the slash to which pos_ points.
-    return Piece(folly::StringPiece(path_.begin(), pos_));
+    // Return everything preceding the slash to which pos_ points.  Every
+    // such prefix of a valid path is itself valid.
+    return Piece(
+        folly::StringPiece(path_.begin(), pos_), SkipPathSanityCheck());
   }
 
   /*
@@ -512,8 +540,8 @@ class ComposedPathIterator
     }
 
     ++pos_;
-    while (pos_ < path_.end() && *pos_ != kDirSeparator) {
-      ++pos_;
+    if (pos_ < path_.end()) {
+      pos_ = findSeparator(pos_, path_.end());
     }
   }
 
@@ -535,8 +563,9 @@ class ComposedPathIterator
     }
 
     --pos_;
-    while (pos_ > stopPos && *pos_ != kDirSeparator) {
-      --pos_;
+    if (pos_ > stopPos) {
+      auto* sep = rfindSeparator(stopPos + 1, pos_ + 1);
+      pos_ = sep ? sep : stopPos;
     }
   }
 
@@ -567,12 +596,10 @@ class PathComponentIterator
   explicit PathComponentIterator(const ComposedPathType& path)
       : path_{path.stringPiece()} {
     if (IsReverse) {
-      start_ = path_.end();
       end_ = path_.end();
       // Back start_ up to just after the last '/'
-      while (start_ != path_.begin() && *(start_ - 1) != '/') {
-        --start_;
-      }
+      auto* sep = rfindSeparator(path_.begin(), path_.end());
+      start_ = sep ? sep + 1 : path_.begin();
     } else {
       // Skip over any leading slash, to handle absolute paths
       start_ = path_.begin();
@@ -580,10 +607,7 @@ class PathComponentIterator
         ++start_;
       }
       // Advance end_ until the next slash or the end of the path
-      end_ = start_;
-      while (end_ != path_.end() && *end_ != '/') {
-        ++end_;
-      }
+      end_ = findSeparator(start_, path_.end());
     }
   }
 
@@ -681,9 +705,7 @@ class PathComponentIterator
     }
     ++end_;
     start_ = end_;
-    while (end_ != path_.end() && *end_ != '/') {
-      ++end_;
-    }
+    end_ = findSeparator(start_, path_.end());
   }
 
   // Move the iterator backwards in the path.
@@ -696,9 +718,8 @@ class PathComponentIterator
 
     --start_;
     end_ = start_;
-    while (start_ != path_.begin() && *(start_ - 1) != '/') {
-      --start_;
-    }
+    auto* sep = rfindSeparator(path_.begin(), start_);
+    start_ = sep ? sep + 1 : path_.begin();
   }
 
   /// the path we're iterating over.
@@ -13,6 +13,7 @@
 #include <functional>
 #include <iterator>
 #include <utility>
+#include <vector>
 #include "PathFuncs.h"
 
 namespace facebook {
@@ -24,21 +25,26 @@ namespace eden {
  * This is similar to std::map but has a couple of different properties:
  * - lookups can be made using the Piece (non-stored) variant of the key
  *   type and won't require allocation just for the lookup.
- * - The storage is a vector maintained in sorted order using a binary
- *   search (std::lower_bound). Out-of-order inserts require moving
- *   the guts of the vector around to make space and are therefore slower
- *   than the equivalent std::map.  If bulk insert performance is critical,
- *   it is better to pre-sort the data to be inserted.
- * - Since insert and erase operations move the vector contents around,
+ * - The storage is a sequence of sorted vectors ("chunks"), each holding
+ *   at most kMaxChunkSize entries, located with a binary search
+ *   (std::lower_bound).  Directories smaller than that fit in a single
+ *   chunk, so the map is then just a sorted vector, which is compact and
+ *   fast to search.  Larger maps split into more chunks, so an
+ *   out-of-order insert only has to move the entries of one chunk rather
+ *   than the whole map, and creating n files in one directory costs
+ *   O(n * kMaxChunkSize) moves rather than O(n^2).
+ * - Iteration is always in sorted key order.
+ * - Since insert and erase operations move the chunk contents around,
  *   those operations invalidate iterators.
  */
 template <
     typename Value,
     typename Key = PathComponent,
     typename Allocator = std::allocator<std::pair<Key, Value>>>
-class PathMap : private folly::fbvector<std::pair<Key, Value>, Allocator> {
+class PathMap {
   using Pair = std::pair<Key, Value>;
-  using Vector = folly::fbvector<Pair, Allocator>;
+  using Chunk = folly::fbvector<Pair, Allocator>;
+  using Chunks = std::vector<Chunk>;
   using Piece = typename Key::piece_type;
 
   // Comparator that knows how compare Stored and Piece in the vector.
@@ -74,6 +80,84 @@ class PathMap : private folly::fbvector<std::pair<Key, Value>, Allocator> {
     }
   };
 
+  /**
+   * A bidirectional iterator over the entries of all chunks in order.
+   *
+   * The end iterator is (chunks.size(), 0).  Only the first chunk is ever
+   * allowed to be empty, and only when it is the sole chunk, so any other
+   * position refers to an entry.
+   */
+  template <typename ChunksPtr, typename PairType>
+  class IteratorImpl
+      : public std::iterator<std::bidirectional_iterator_tag, PairType> {
+   public:
+    IteratorImpl() {}
+
+    /** Allow conversion from iterator to const_iterator */
+    template <
+        typename OtherChunksPtr,
+        typename OtherPairType,
+        typename = typename std::enable_if<
+            std::is_convertible<OtherChunksPtr, ChunksPtr>::value>::type>
+    /* implicit */ IteratorImpl(
+        const IteratorImpl<OtherChunksPtr, OtherPairType>& other)
+        : chunks_{other.chunks_}, chunk_{other.chunk_}, pos_{other.pos_} {}
+
+    PairType& operator*() const {
+      return (*chunks_)[chunk_][pos_];
+    }
+    PairType* operator->() const {
+      return &(*chunks_)[chunk_][pos_];
+    }
+
+    IteratorImpl& operator++() {
+      if (++pos_ == (*chunks_)[chunk_].size()) {
+        ++chunk_;
+        pos_ = 0;
+      }
+      return *this;
+    }
+    IteratorImpl operator++(int) {
+      IteratorImpl tmp(*this);
+      ++(*this);
+      return tmp;
+    }
+
+    IteratorImpl& operator--() {
+      if (pos_ == 0) {
+        --chunk_;
+        pos_ = (*chunks_)[chunk_].size() - 1;
+      } else {
+        --pos_;
+      }
+      return *this;
+    }
+    IteratorImpl operator--(int) {
+      IteratorImpl tmp(*this);
+      --(*this);
+      return tmp;
+    }
+
+    friend bool operator==(const IteratorImpl& a, const IteratorImpl& b) {
+      return a.chunk_ == b.chunk_ && a.pos_ == b.pos_;
+    }
+    friend bool operator!=(const IteratorImpl& a, const IteratorImpl& b) {
+      return !(a == b);
+    }
+
+   private:
+    template <typename C, typename P>
+    friend class IteratorImpl;
+    friend class PathMap;
+
+    IteratorImpl(ChunksPtr chunks, size_t chunk, size_t pos)
+        : chunks_{chunks}, chunk_{chunk}, pos_{pos} {}
+
+    ChunksPtr chunks_{nullptr};
+    size_t chunk_{0};
+    size_t pos_{0};
+  };
+
   // Hold an instance of the comparator.  It doesn't actually
   // occupy any space.
   Compare compare_;
@@ -82,19 +166,27 @@ class PathMap : private folly::fbvector<std::pair<Key, Value>, Allocator> {
   // Various type aliases to satisfy container concepts.
   using key_type = Key;
   using mapped_type = Value;
-  using value_type = typename Vector::value_type;
+  using value_type = Pair;
   using key_compare = Compare;
   using allocator_type = Allocator;
   using reference = typename Allocator::reference;
   using const_reference = typename Allocator::const_reference;
-  using iterator = typename Vector::iterator;
-  using const_iterator = typename Vector::const_iterator;
-  using size_type = typename Vector::size_type;
-  using difference_type = typename Vector::difference_type;
+  using iterator = IteratorImpl<Chunks*, Pair>;
+  using const_iterator = IteratorImpl<const Chunks*, const Pair>;
+  using size_type = typename Chunk::size_type;
+  using difference_type = typename Chunk::difference_type;
   using pointer = typename Allocator::pointer;
   using const_pointer = typename Allocator::const_pointer;
-  using reverse_iterator = typename Vector::reverse_iterator;
-  using const_reverse_iterator = typename Vector::const_reverse_iterator;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  /**
+   * The largest number of entries stored in one chunk.
+   *
+   * Most directories are much smaller than this, and are stored in a single
+   * sorted vector.
+   */
+  static constexpr size_type kMaxChunkSize = 1024;
 
   // Construct empty.
   PathMap() {}
@@ -116,47 +208,113 @@ class PathMap : private folly::fbvector<std::pair<Key, Value>, Allocator> {
     }
   }
 
-  // Inherit the underlying vector copy/assignment.
-  PathMap(const PathMap& other) : Vector(other) {}
+  PathMap(const PathMap& other) = default;
   PathMap& operator=(const PathMap& other) {
     PathMap(other).swap(*this);
     return *this;
   }
 
-  // inherit Move construction.
-  PathMap(PathMap&& other) noexcept : Vector(std::move(other)) {}
+  PathMap(PathMap&& other) noexcept
+      : chunks_(std::move(other.chunks_)), size_(other.size_) {
+    other.size_ = 0;
+  }
   PathMap& operator=(PathMap&& other) {
     other.swap(*this);
     return *this;
   }
 
-  // inherit these methods from the underlying vector.
-  using Vector::begin;
-  using Vector::end;
-  using Vector::cbegin;
-  using Vector::cend;
-  using Vector::crbegin;
-  using Vector::crend;
-  using Vector::rbegin;
-  using Vector::rend;
-  using Vector::empty;
-  using Vector::size;
-  using Vector::max_size;
-  using Vector::clear;
-  using Vector::erase;
+  iterator begin() {
+    return iterator{&chunks_, beginChunk(), 0};
+  }
+  const_iterator begin() const {
+    return const_iterator{&chunks_, beginChunk(), 0};
+  }
+  iterator end() {
+    return iterator{&chunks_, chunks_.size(), 0};
+  }
+  const_iterator end() const {
+    return const_iterator{&chunks_, chunks_.size(), 0};
+  }
+  const_iterator cbegin() const {
+    return begin();
+  }
+  const_iterator cend() const {
+    return end();
+  }
+  reverse_iterator rbegin() {
+    return reverse_iterator{end()};
+  }
+  const_reverse_iterator rbegin() const {
+    return const_reverse_iterator{end()};
+  }
+  reverse_iterator rend() {
+    return reverse_iterator{begin()};
+  }
+  const_reverse_iterator rend() const {
+    return const_reverse_iterator{begin()};
+  }
+  const_reverse_iterator crbegin() const {
+    return rbegin();
+  }
+  const_reverse_iterator crend() const {
+    return rend();
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+  size_type size() const {
+    return size_;
+  }
+  size_type max_size() const {
+    return Chunk().max_size();
+  }
+
+  /** Returns the number of entries the map can hold without allocating. */
+  size_type capacity() const {
+    size_type result = 0;
+    for (const auto& chunk : chunks_) {
+      result += chunk.capacity();
+    }
+    return result;
+  }
+
+  /**
+   * Reserve space for n entries.
+   *
+   * Space is only reserved while the map fits in a single chunk.  Larger maps
+   * grow a chunk at a time, so there is nothing to gain from reserving space
+   * for them.
+   */
+  void reserve(size_type n) {
+    if (chunks_.empty()) {
+      chunks_.emplace_back();
+    }
+    if (chunks_.size() == 1) {
+      chunks_[0].reserve(std::min(n, kMaxChunkSize));
+    }
+  }
+
+  void clear() {
+    chunks_.clear();
+    size_ = 0;
+  }
 
   // Swap contents with another map.
   void swap(PathMap& other) noexcept {
-    Vector::swap(other);
+    chunks_.swap(other.chunks_);
+    std::swap(size_, other.size_);
   }
 
   // lower_bound performs the binary search for locating keys.
   iterator lower_bound(Piece key) {
-    return std::lower_bound(begin(), end(), key, compare_);
+    auto ret = lowerBoundPosition(key);
+    return iterator{&chunks_, ret.first, ret.second};
   }
 
   const_iterator lower_bound(Piece key) const {
-    return std::lower_bound(begin(), end(), key, compare_);
+    auto ret = lowerBoundPosition(key);
+    return const_iterator{&chunks_, ret.first, ret.second};
   }
 
   /** Find using the Piece representation of a key.
@@ -190,7 +348,17 @@ class PathMap : private folly::fbvector<std::pair<Key, Value>, Allocator> {
   std::pair<iterator, bool> insert(const value_type& val) {
     auto iter = lower_bound(val.first);
     if (iter == end() || compare_(val.first, iter->first)) {
-      return std::make_pair(Vector::insert(iter, val), true);
+      return std::make_pair(insertAt(iter, val), true);
+    }
+    return std::make_pair(iter, false);
+  }
+
+  /** Insert a new key-value pair, moving it into the map if the key is not
+   * already present. */
+  std::pair<iterator, bool> insert(value_type&& val) {
+    auto iter = lower_bound(val.first);
+    if (iter == end() || compare_(val.first, iter->first)) {
+      return std::make_pair(insertAt(iter, std::move(val)), true);
     }
     return std::make_pair(iter, false);
   }
@@ -205,7 +373,7 @@ class PathMap : private folly::fbvector<std::pair<Key, Value>, Allocator> {
   std::pair<iterator, bool> emplace(Piece key, Args&&... args) {
     auto iter = lower_bound(key);
     if (iter == end() || compare_(key, iter->first)) {
-      iter = Vector::emplace(
+      iter = insertAt(
           iter, std::make_pair(Key(key), Value(std::forward<Args>(args)...)));
       return std::make_pair(iter, true);
     }
@@ -218,7 +386,7 @@ class PathMap : private folly::fbvector<std::pair<Key, Value>, Allocator> {
     auto iter = lower_bound(key);
     if (iter == end() || compare_(key, iter->first)) {
       // Not yet present, make a new one
-      iter = Vector::insert(iter, std::make_pair(Key(key), mapped_type()));
+      iter = insertAt(iter, std::make_pair(Key(key), mapped_type()));
     }
     return iter->second;
   }
@@ -250,6 +418,23 @@ class PathMap : private folly::fbvector<std::pair<Key, Value>, Allocator> {
     return iter->second;
   }
 
+  /** Erase the entry at pos.
+   * Returns an iterator to the entry that followed it. */
+  iterator erase(const_iterator pos) {
+    auto chunkIndex = pos.chunk_;
+    auto& chunk = chunks_[chunkIndex];
+    chunk.erase(chunk.begin() + pos.pos_);
+    --size_;
+    if (chunk.empty() && chunks_.size() > 1) {
+      chunks_.erase(chunks_.begin() + chunkIndex);
+      return iterator{&chunks_, chunkIndex, 0};
+    }
+    if (pos.pos_ == chunk.size()) {
+      return iterator{&chunks_, chunkIndex + 1, 0};
+    }
+    return iterator{&chunks_, chunkIndex, pos.pos_};
+  }
+
   /** Erase the value associated with key.
    * Does not allocate any additional memory to look up the key.
    * Returns the number of matching elements that were erased; this is
@@ -274,25 +459,110 @@ class PathMap : private folly::fbvector<std::pair<Key, Value>, Allocator> {
   friend bool operator!=(
       const PathMap<V, K, A>& lhs,
       const PathMap<V, K, A>& rhs);
+
+ private:
+  /** The index of the first chunk that is not empty */
+  size_t beginChunk() const {
+    return (chunks_.empty() || chunks_[0].empty()) ? chunks_.size() : 0;
+  }
+
+  /** Returns the (chunk, position) of the first entry not less than key */
+  std::pair<size_t, size_t> lowerBoundPosition(Piece key) const {
+    if (empty()) {
+      return std::make_pair(chunks_.size(), size_t(0));
+    }
+    // Find the first chunk whose last entry is not less than key.  No chunk
+    // is empty when the map is not.
+    auto chunkIter = std::lower_bound(
+        chunks_.begin(),
+        chunks_.end(),
+        key,
+        [this](const Chunk& chunk, const Piece& k) {
+          return compare_(chunk.back(), k);
+        });
+    if (chunkIter == chunks_.end()) {
+      return std::make_pair(chunks_.size(), size_t(0));
+    }
+    auto pos = std::lower_bound(
+        chunkIter->begin(), chunkIter->end(), key, compare_);
+    return std::make_pair(
+        size_t(chunkIter - chunks_.begin()), size_t(pos - chunkIter->begin()));
+  }
+
+  /** Insert val at pos, which must be its sorted position. */
+  template <typename V>
+  iterator insertAt(const_iterator pos, V&& val) {
+    if (chunks_.empty()) {
+      chunks_.emplace_back();
+    }
+    auto chunkIndex = pos.chunk_;
+    auto offset = pos.pos_;
+    if (chunkIndex == chunks_.size()) {
+      // Inserting at the end goes at the end of the last chunk.
+      --chunkIndex;
+      offset = chunks_[chunkIndex].size();
+    }
+
+    if (chunks_[chunkIndex].size() >= kMaxChunkSize) {
+      if (chunkIndex + 1 == chunks_.size() &&
+          offset == chunks_[chunkIndex].size()) {
+        // Appending to the map, as when a directory is populated in sorted
+        // order.  Start a new chunk rather than leaving a half-full one.
+        chunks_.emplace_back();
+        ++chunkIndex;
+        offset = 0;
+      } else {
+        splitChunk(chunkIndex);
+        auto firstSize = chunks_[chunkIndex].size();
+        if (offset > firstSize) {
+          ++chunkIndex;
+          offset -= firstSize;
+        }
+      }
+    }
+
+    auto& chunk = chunks_[chunkIndex];
+    chunk.insert(chunk.begin() + offset, std::forward<V>(val));
+    ++size_;
+    return iterator{&chunks_, chunkIndex, offset};
+  }
+
+  /** Move the second half of a chunk into a new chunk that follows it. */
+  void splitChunk(size_t chunkIndex) {
+    chunks_.emplace(chunks_.begin() + chunkIndex + 1);
+    auto& first = chunks_[chunkIndex];
+    auto& second = chunks_[chunkIndex + 1];
+    auto middle = first.begin() + first.size() / 2;
+    second.reserve(kMaxChunkSize);
+    second.insert(
+        second.end(),
+        std::make_move_iterator(middle),
+        std::make_move_iterator(first.end()));
+    first.erase(middle, first.end());
+  }
+
+  Chunks chunks_;
+  size_type size_{0};
 };
 
+template <typename Value, typename Key, typename Allocator>
+constexpr typename PathMap<Value, Key, Allocator>::size_type
+    PathMap<Value, Key, Allocator>::kMaxChunkSize;
+
 // Implementations of the equality operators; gcc hates us if we
 // define them inline in the class above.
 
 /// Equality operator.
 template <typename V, typename K, typename A>
 bool operator==(const PathMap<V, K, A>& lhs, const PathMap<V, K, A>& rhs) {
-  // reinterpret lhs as the underlying vector type.
-  const folly::fbvector<std::pair<K, V>, A>& vector = lhs;
-  return vector == rhs;
+  return lhs.size() == rhs.size() &&
+      std::equal(lhs.begin(), lhs.end(), rhs.begin());
 }
 
 /// Inequality operator.
 template <typename V, typename K, typename A>
 bool operator!=(const PathMap<V, K, A>& lhs, const PathMap<V, K, A>& rhs) {
-  // reinterpret lhs as the underlying vector type.
-  const folly::fbvector<std::pair<K, V>, A>& vector = lhs;
-  return vector != rhs;
+  return !(lhs == rhs);
 }
 }
 }
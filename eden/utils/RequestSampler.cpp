@@ -0,0 +1,91 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "RequestSampler.h"
+
+#include <folly/Conv.h>
+#include <algorithm>
+
+using namespace std::chrono;
+
+namespace facebook {
+namespace eden {
+
+void RequestSampler::start(milliseconds duration, uint32_t sampleOneIn) {
+  stacks_.lock()->clear();
+  sampleOneIn_.store(std::max<uint32_t>(sampleOneIn, 1));
+  requestCount_.store(0);
+  endTime_.store((steady_clock::now() + duration).time_since_epoch().count());
+}
+
+bool RequestSampler::shouldSample() {
+  auto endTime = endTime_.load(std::memory_order_relaxed);
+  if (endTime == 0 ||
+      steady_clock::now().time_since_epoch().count() >= endTime) {
+    return false;
+  }
+  auto count = requestCount_.fetch_add(1, std::memory_order_relaxed);
+  return count % sampleOneIn_.load(std::memory_order_relaxed) == 0;
+}
+
+void RequestSampler::add(
+    folly::StringPiece operation,
+    microseconds total,
+    const RequestTrace::Durations& phases) {
+  auto stacks = stacks_.lock();
+  foldRequest(operation, total, phases, *stacks);
+}
+
+std::string RequestSampler::getFoldedStacks() const {
+  std::string result;
+  auto stacks = stacks_.lock();
+  for (const auto& entry : *stacks) {
+    folly::toAppend(entry.first, " ", entry.second, "\n", &result);
+  }
+  return result;
+}
+
+void RequestSampler::foldRequest(
+    folly::StringPiece operation,
+    microseconds total,
+    const RequestTrace::Durations& phases,
+    std::map<std::string, int64_t>& stacks) {
+  auto addStack = [&](folly::StringPiece phase, int64_t us) {
+    if (us <= 0) {
+      return;
+    }
+    auto stack = phase.empty() ? operation.str()
+                               : folly::to<std::string>(operation, ";", phase);
+    stacks[stack] += us;
+  };
+
+  // Loading an inode includes the store fetches made for it, so only its
+  // remaining time is attributed to inode_load itself.  Lock waits are
+  // assumed not to overlap the other phases; if they do, the operation's own
+  // time comes out smaller than it should, but never negative.
+  auto inodeLoadUs = phases[RequestTrace::INODE_LOAD].count();
+  auto storeUs = phases[RequestTrace::LOCAL_STORE].count() +
+      phases[RequestTrace::BACKING_STORE].count();
+  auto accountedUs = std::max(inodeLoadUs, storeUs);
+  addStack(
+      RequestTrace::getPhaseName(RequestTrace::INODE_LOAD),
+      inodeLoadUs - storeUs);
+  for (auto phase : {RequestTrace::LOCAL_STORE, RequestTrace::BACKING_STORE}) {
+    addStack(RequestTrace::getPhaseName(phase), phases[phase].count());
+  }
+  for (auto phase : {RequestTrace::INODE_MAP_LOCK,
+                     RequestTrace::CONTENTS_LOCK,
+                     RequestTrace::RENAME_LOCK}) {
+    addStack(RequestTrace::getPhaseName(phase), phases[phase].count());
+    accountedUs += phases[phase].count();
+  }
+  addStack("", total.count() - accountedUs);
+}
+}
+}
@@ -0,0 +1,81 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+#include <folly/Range.h>
+#include <folly/Synchronized.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include "eden/utils/RequestTrace.h"
+
+namespace facebook {
+namespace eden {
+
+/**
+ * RequestSampler aggregates the RequestTraces of a sample of requests over a
+ * limited window of time, so that an engineer can profile a mount point on
+ * demand without leaving tracing overhead on all of the time.
+ *
+ * The samples are folded into flame graph stacks of the form
+ * "<operation>;<phase>", weighted by microseconds.  The time of a request
+ * that is not accounted for by any traced phase is attributed to the
+ * operation itself.
+ */
+class RequestSampler {
+ public:
+  /**
+   * Discard the samples from any previous window and sample one in every
+   * sampleOneIn requests that start within the next duration.
+   */
+  void start(std::chrono::milliseconds duration, uint32_t sampleOneIn);
+
+  /**
+   * Returns true if a request starting now should be sampled.
+   *
+   * This only reads two atomics when sampling is not active, so it is cheap
+   * enough to call for every request.
+   */
+  bool shouldSample();
+
+  /**
+   * Add a sampled request that has finished.
+   */
+  void add(
+      folly::StringPiece operation,
+      std::chrono::microseconds total,
+      const RequestTrace::Durations& phases);
+
+  /**
+   * Returns the samples collected in the current or most recent window, in
+   * the folded format read by flamegraph.pl: one "<stack> <microseconds>"
+   * line per distinct stack.
+   */
+  std::string getFoldedStacks() const;
+
+  /**
+   * Fold one request into stacks, adding the time of each to stacks.
+   */
+  static void foldRequest(
+      folly::StringPiece operation,
+      std::chrono::microseconds total,
+      const RequestTrace::Durations& phases,
+      std::map<std::string, int64_t>& stacks);
+
+ private:
+  /** The end of the sampling window, in steady_clock ticks */
+  std::atomic<std::chrono::steady_clock::rep> endTime_{0};
+  std::atomic<uint32_t> sampleOneIn_{1};
+  std::atomic<uint32_t> requestCount_{0};
+  folly::Synchronized<std::map<std::string, int64_t>, std::mutex> stacks_;
+};
+}
+}
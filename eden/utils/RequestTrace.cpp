@@ -0,0 +1,79 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "RequestTrace.h"
+
+using namespace std::chrono;
+
+namespace facebook {
+namespace eden {
+
+const std::string RequestTrace::kKey("eden.trace");
+
+RequestTrace::RequestTrace() {
+  for (auto& value : microseconds_) {
+    value.store(0, std::memory_order_relaxed);
+  }
+}
+
+void RequestTrace::install() {
+  folly::RequestContext::get()->setContextData(
+      kKey, std::make_unique<RequestTrace>());
+}
+
+RequestTrace* RequestTrace::get() {
+  return static_cast<RequestTrace*>(
+      folly::RequestContext::get()->getContextData(kKey));
+}
+
+void RequestTrace::addTime(Phase phase, steady_clock::time_point start) {
+  auto elapsed = duration_cast<microseconds>(steady_clock::now() - start);
+  // Uncontended locks are timed on every request, so skip the context lookup
+  // when there is nothing to record.
+  if (elapsed.count() == 0) {
+    return;
+  }
+  auto* trace = get();
+  if (!trace) {
+    return;
+  }
+  trace->microseconds_[phase].fetch_add(
+      elapsed.count(), std::memory_order_relaxed);
+}
+
+folly::StringPiece RequestTrace::getPhaseName(Phase phase) {
+  switch (phase) {
+    case INODE_LOAD:
+      return "inode_load";
+    case LOCAL_STORE:
+      return "local_store";
+    case BACKING_STORE:
+      return "backing_store";
+    case INODE_MAP_LOCK:
+      return "inode_map_lock";
+    case CONTENTS_LOCK:
+      return "contents_lock";
+    case RENAME_LOCK:
+      return "rename_lock";
+    case NUM_PHASES:
+      break;
+  }
+  return "unknown";
+}
+
+RequestTrace::Durations RequestTrace::getDurations() const {
+  Durations result;
+  for (size_t n = 0; n < NUM_PHASES; ++n) {
+    result[n] =
+        microseconds(microseconds_[n].load(std::memory_order_relaxed));
+  }
+  return result;
+}
+}
+}
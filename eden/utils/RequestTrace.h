@@ -0,0 +1,111 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+#include <folly/Range.h>
+#include <folly/io/async/Request.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include "eden/utils/LockProfiler.h"
+
+namespace facebook {
+namespace eden {
+
+/**
+ * RequestTrace records how long a request spent in each layer of eden.
+ *
+ * A RequestTrace is attached to a folly::RequestContext, so it follows the
+ * request across the futures and threads used to serve it.  Code in any layer
+ * can call RequestTrace::addTime() without knowing whether the current
+ * request is being traced; the call does nothing if it is not.
+ *
+ * Phases may nest: loading an inode includes the time spent fetching its data
+ * from the LocalStore or BackingStore.
+ */
+class RequestTrace : public folly::RequestData {
+ public:
+  enum Phase : size_t {
+    /** Waiting for an inode to be loaded. */
+    INODE_LOAD,
+    /** Reading objects from the LocalStore. */
+    LOCAL_STORE,
+    /** Waiting for objects to be fetched from the BackingStore. */
+    BACKING_STORE,
+    /** Waiting for an InodeMap shard lock. */
+    INODE_MAP_LOCK,
+    /** Waiting for a TreeInode's contents lock. */
+    CONTENTS_LOCK,
+    /** Waiting for the mount's rename lock. */
+    RENAME_LOCK,
+    NUM_PHASES,
+  };
+  using Durations = std::array<std::chrono::microseconds, NUM_PHASES>;
+
+  static const std::string kKey;
+
+  RequestTrace();
+
+  /**
+   * Start tracing the current request context.
+   */
+  static void install();
+
+  /**
+   * Returns the trace for the current request context, or nullptr if the
+   * current request is not being traced.
+   */
+  static RequestTrace* get();
+
+  /**
+   * Add the time elapsed since start to a phase of the current request, if
+   * it is being traced.
+   */
+  static void addTime(
+      Phase phase,
+      std::chrono::steady_clock::time_point start);
+
+  /**
+   * Acquire a lock by calling lockFn, adding the time spent waiting for it to
+   * one of the lock phases of the current request.  If the lock is a
+   * ProfiledMutex, any wait is also attributed to site by the LockProfiler.
+   * For example:
+   *
+   *   auto contents = RequestTrace::lockTraced(
+   *       RequestTrace::CONTENTS_LOCK,
+   *       "TreeInode::getOrLoadChild",
+   *       [&] { return contents_.wlock(); });
+   */
+  template <typename LockFn>
+  static auto lockTraced(Phase phase, const char* site, LockFn&& lockFn)
+      -> decltype(lockFn()) {
+    LockProfiler::SiteScope siteScope{site};
+    auto start = std::chrono::steady_clock::now();
+    auto lock = lockFn();
+    addTime(phase, start);
+    return lock;
+  }
+
+  /**
+   * Returns a short name for a phase, such as "local_store".
+   */
+  static folly::StringPiece getPhaseName(Phase phase);
+
+  /**
+   * Returns the total time recorded for each phase so far.
+   */
+  Durations getDurations() const;
+
+ private:
+  // Phases can be recorded concurrently if a request has several fetches
+  // outstanding at once.
+  std::array<std::atomic<int64_t>, NUM_PHASES> microseconds_;
+};
+}
+}
@@ -0,0 +1,132 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/utils/SlabPool.h"
+
+#include <folly/Synchronized.h>
+#include <glog/logging.h>
+#include <algorithm>
+#include <new>
+
+namespace facebook {
+namespace eden {
+
+namespace {
+folly::Synchronized<std::vector<const SlabPool*>>& getRegistry() {
+  // Leaked, so that pools destroyed during static destruction can still
+  // unregister.
+  static auto* registry =
+      new folly::Synchronized<std::vector<const SlabPool*>>;
+  return *registry;
+}
+}
+
+SlabPool::SlabPool(
+    folly::StringPiece name,
+    size_t objectSize,
+    size_t objectsPerSlab)
+    : name_(name.str()),
+      objectsPerSlab_(std::max<size_t>(objectsPerSlab, 1)),
+      requestedSize_(objectSize) {
+  getRegistry().wlock()->push_back(this);
+}
+
+SlabPool::~SlabPool() {
+  auto registry = getRegistry().wlock();
+  registry->erase(
+      std::remove(registry->begin(), registry->end(), this), registry->end());
+}
+
+bool SlabPool::usesSlabs(size_t size) {
+  auto requested = requestedSize_.load(std::memory_order_acquire);
+  if (requested == 0 && size != 0 &&
+      requestedSize_.compare_exchange_strong(
+          requested, size, std::memory_order_acq_rel)) {
+    return true;
+  }
+  return size == requested;
+}
+
+void* SlabPool::allocate(size_t size) {
+  if (!usesSlabs(size)) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    ++fallbackAllocations_;
+    return ::operator new(size);
+  }
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (!freeList_) {
+    addSlabLocked();
+  }
+  auto* object = freeList_;
+  freeList_ = object->next;
+  ++objectsInUse_;
+  return object;
+}
+
+void SlabPool::deallocate(void* ptr, size_t size) {
+  if (!ptr) {
+    return;
+  }
+  if (size != requestedSize_.load(std::memory_order_acquire)) {
+    ::operator delete(ptr);
+    return;
+  }
+
+  auto* object = static_cast<FreeObject*>(ptr);
+  std::lock_guard<std::mutex> guard(mutex_);
+  DCHECK_GT(objectsInUse_, 0) << "too many deallocations from " << name_;
+  object->next = freeList_;
+  freeList_ = object;
+  --objectsInUse_;
+}
+
+void SlabPool::addSlabLocked() {
+  if (objectSize_ == 0) {
+    constexpr size_t kAlign = alignof(std::max_align_t);
+    auto size = std::max(
+        requestedSize_.load(std::memory_order_acquire), sizeof(FreeObject));
+    objectSize_ = (size + kAlign - 1) / kAlign * kAlign;
+  }
+
+  // operator new[] returns memory aligned for any fundamental type, and
+  // objectSize_ is a multiple of that alignment.
+  slabs_.emplace_back(new char[objectSize_ * objectsPerSlab_]);
+  auto* slab = slabs_.back().get();
+  // Thread the new objects onto the free list in address order, so that
+  // consecutive allocations are adjacent.
+  for (size_t n = objectsPerSlab_; n > 0; --n) {
+    auto* object = reinterpret_cast<FreeObject*>(slab + (n - 1) * objectSize_);
+    object->next = freeList_;
+    freeList_ = object;
+  }
+}
+
+SlabPoolStats SlabPool::getStats() const {
+  SlabPoolStats stats;
+  stats.name = name_;
+  std::lock_guard<std::mutex> guard(mutex_);
+  stats.objectSize = objectSize_;
+  stats.slabs = slabs_.size();
+  stats.objectsInUse = objectsInUse_;
+  stats.reservedBytes = slabs_.size() * objectsPerSlab_ * objectSize_;
+  stats.fallbackAllocations = fallbackAllocations_;
+  return stats;
+}
+
+std::vector<SlabPoolStats> SlabPool::getAllStats() {
+  std::vector<SlabPoolStats> result;
+  auto registry = getRegistry().rlock();
+  for (const auto* pool : *registry) {
+    result.push_back(pool->getStats());
+  }
+  return result;
+}
+}
+}
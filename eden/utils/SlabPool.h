@@ -0,0 +1,151 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Range.h>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace facebook {
+namespace eden {
+
+/**
+ * Statistics about a SlabPool.
+ */
+struct SlabPoolStats {
+  std::string name;
+  /** The size of each object, after rounding up for alignment */
+  size_t objectSize{0};
+  /** The number of slabs allocated */
+  size_t slabs{0};
+  /** The number of objects currently allocated from the pool */
+  size_t objectsInUse{0};
+  /** The bytes held by all of the slabs, whether in use or free */
+  size_t reservedBytes{0};
+  /** The number of allocations of the wrong size passed on to operator new */
+  uint64_t fallbackAllocations{0};
+};
+
+/**
+ * SlabPool allocates objects of a single size from large slabs, for types
+ * that are allocated and freed in large numbers, such as inodes.
+ *
+ * Allocation and deallocation pop and push a free list, so they are cheap,
+ * and objects allocated together are close together in memory.  Freed
+ * objects are reused by later allocations rather than returned to the
+ * system, which keeps churn from fragmenting the heap.  The memory is only
+ * released when the pool is destroyed, so the pool stays at its peak size;
+ * getStats() reports it.
+ *
+ * A pool may be created with an object size of 0, in which case the size of
+ * the first allocation is used.  This suits SlabAllocator, since the type
+ * that std::allocate_shared() actually allocates is not known to callers.
+ * Allocations of any other size are passed on to the global operator new,
+ * so that a class with a pool can still have subclasses.
+ *
+ * Every SlabPool is registered for getAllStats() while it exists.  Pools for
+ * types whose objects may outlive static destruction should be leaked
+ * rather than destroyed.
+ *
+ * SlabPool is thread-safe.
+ */
+class SlabPool {
+ public:
+  SlabPool(
+      folly::StringPiece name,
+      size_t objectSize,
+      size_t objectsPerSlab = kDefaultObjectsPerSlab);
+  ~SlabPool();
+
+  /** Allocate size bytes, aligned for any type. */
+  void* allocate(size_t size);
+
+  /** Free memory returned by allocate(size). */
+  void deallocate(void* ptr, size_t size);
+
+  SlabPoolStats getStats() const;
+
+  /** Returns the statistics of every pool that currently exists. */
+  static std::vector<SlabPoolStats> getAllStats();
+
+  static constexpr size_t kDefaultObjectsPerSlab = 256;
+
+ private:
+  // Forbidden copy constructor and assignment operator
+  SlabPool(const SlabPool&) = delete;
+  SlabPool& operator=(const SlabPool&) = delete;
+
+  struct FreeObject {
+    FreeObject* next;
+  };
+
+  /** Returns true if size is served from the slabs. */
+  bool usesSlabs(size_t size);
+  /** Add a slab to the free list.  Must be called with mutex_ held. */
+  void addSlabLocked();
+
+  const std::string name_;
+  const size_t objectsPerSlab_{0};
+  /** The requested object size, fixed by the first allocation if 0 */
+  std::atomic<size_t> requestedSize_{0};
+
+  mutable std::mutex mutex_;
+  // The fields below are protected by mutex_.
+  size_t objectSize_{0};
+  FreeObject* freeList_{nullptr};
+  std::vector<std::unique_ptr<char[]>> slabs_;
+  size_t objectsInUse_{0};
+  uint64_t fallbackAllocations_{0};
+};
+
+/**
+ * A standard allocator that allocates from a SlabPool, e.g. for
+ * std::allocate_shared().  The pool should have been created with an object
+ * size of 0, unless the size of the type actually allocated is known.
+ */
+template <typename T>
+class SlabAllocator {
+ public:
+  using value_type = T;
+
+  explicit SlabAllocator(SlabPool* pool) : pool_(pool) {}
+  template <typename U>
+  /* implicit */ SlabAllocator(const SlabAllocator<U>& other)
+      : pool_(other.getPool()) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(pool_->allocate(n * sizeof(T)));
+  }
+  void deallocate(T* ptr, size_t n) {
+    pool_->deallocate(ptr, n * sizeof(T));
+  }
+
+  SlabPool* getPool() const {
+    return pool_;
+  }
+
+ private:
+  SlabPool* pool_{nullptr};
+};
+
+template <typename T, typename U>
+bool operator==(const SlabAllocator<T>& a, const SlabAllocator<U>& b) {
+  return a.getPool() == b.getPool();
+}
+template <typename T, typename U>
+bool operator!=(const SlabAllocator<T>& a, const SlabAllocator<U>& b) {
+  return a.getPool() != b.getPool();
+}
+}
+}
@@ -85,5 +85,18 @@ void fsetxattr(int fd, folly::StringPiece name, folly::StringPiece value) {
       0 // allow create and replace
       ));
 }
+
+void fremovexattr(int fd, folly::StringPiece name) {
+  auto namestr = name.str();
+
+  folly::checkUnixError(::fremovexattr(
+      fd,
+      namestr.c_str()
+#ifdef __APPLE__
+          ,
+      0 // options
+#endif
+      ));
+}
 }
 }
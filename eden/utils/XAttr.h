@@ -27,5 +27,6 @@ constexpr folly::StringPiece kXattrSha1{"user.sha1"};
 
 std::string fgetxattr(int fd, folly::StringPiece name);
 void fsetxattr(int fd, folly::StringPiece name, folly::StringPiece value);
+void fremovexattr(int fd, folly::StringPiece name);
 }
 }
@@ -0,0 +1,70 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/utils/CancellationToken.h"
+
+#include <folly/io/async/Request.h>
+#include <gtest/gtest.h>
+#include <system_error>
+
+using namespace facebook::eden;
+using std::make_shared;
+
+TEST(CancellationToken, cancel) {
+  CancellationToken token;
+  EXPECT_FALSE(token.isCancelled());
+  token.throwIfCancelled();
+  token.cancel();
+  EXPECT_TRUE(token.isCancelled());
+  EXPECT_THROW(token.throwIfCancelled(), std::system_error);
+}
+
+TEST(CancellationToken, waiters) {
+  CancellationToken shared;
+  auto waiter1 = make_shared<CancellationToken>();
+  auto waiter2 = make_shared<CancellationToken>();
+  EXPECT_TRUE(shared.addWaiter(waiter1));
+  EXPECT_TRUE(shared.addWaiter(waiter2));
+  waiter1->cancel();
+  EXPECT_FALSE(shared.isCancelled());
+  waiter2->cancel();
+  EXPECT_TRUE(shared.isCancelled());
+  // A cancelled token stays cancelled.
+  EXPECT_FALSE(shared.addWaiter(make_shared<CancellationToken>()));
+  EXPECT_TRUE(shared.isCancelled());
+}
+
+TEST(CancellationToken, uncancellableWaiter) {
+  CancellationToken shared;
+  auto waiter = make_shared<CancellationToken>();
+  EXPECT_TRUE(shared.addWaiter(waiter));
+  EXPECT_TRUE(shared.addWaiter(nullptr));
+  waiter->cancel();
+  EXPECT_FALSE(shared.isCancelled());
+}
+
+TEST(CancellationToken, currentToken) {
+  folly::RequestContextScopeGuard guard;
+  EXPECT_EQ(nullptr, CancellationToken::getCurrent());
+  {
+    // Without an installed token there is nothing to replace.
+    CancellationToken::Scope scope(make_shared<CancellationToken>());
+    EXPECT_EQ(nullptr, CancellationToken::getCurrent());
+  }
+
+  auto token = make_shared<CancellationToken>();
+  CancellationToken::install(token);
+  EXPECT_EQ(token, CancellationToken::getCurrent());
+  auto other = make_shared<CancellationToken>();
+  {
+    CancellationToken::Scope scope(other);
+    EXPECT_EQ(other, CancellationToken::getCurrent());
+  }
+  EXPECT_EQ(token, CancellationToken::getCurrent());
+}
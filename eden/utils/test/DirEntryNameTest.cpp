@@ -0,0 +1,94 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/utils/DirEntryName.h"
+
+#include <gtest/gtest.h>
+#include "eden/utils/PathMap.h"
+
+using namespace facebook::eden;
+
+TEST(DirEntryName, ownedCopy) {
+  DirEntryName name{PathComponentPiece{"foo.txt"}};
+  EXPECT_FALSE(name.isBorrowed());
+  EXPECT_EQ("foo.txt", name.stringPiece());
+  EXPECT_STREQ("foo.txt", name.c_str());
+  EXPECT_EQ(PathComponent{"foo.txt"}, name.copy());
+  EXPECT_TRUE(name == PathComponentPiece{"foo.txt"});
+  EXPECT_TRUE(name != PathComponentPiece{"bar.txt"});
+}
+
+TEST(DirEntryName, borrow) {
+  PathComponent source{"a_name_long_enough_to_need_a_heap_allocation"};
+  auto name = DirEntryName::borrow(source);
+  EXPECT_TRUE(name.isBorrowed());
+  EXPECT_EQ(source.stringPiece().data(), name.stringPiece().data());
+  EXPECT_EQ(source, name.piece());
+
+  // Copies of a borrowed name are still borrowed
+  DirEntryName copy{name};
+  EXPECT_TRUE(copy.isBorrowed());
+  EXPECT_EQ(source.stringPiece().data(), copy.stringPiece().data());
+
+  // Copies of an owned name share the pooled data
+  copy = DirEntryName{PathComponentPiece{"other"}};
+  EXPECT_FALSE(copy.isBorrowed());
+  EXPECT_EQ("other", copy.stringPiece());
+  DirEntryName copy2{copy};
+  EXPECT_FALSE(copy2.isBorrowed());
+  EXPECT_EQ(copy.stringPiece().data(), copy2.stringPiece().data());
+}
+
+TEST(DirEntryName, pooled) {
+  auto initialStats = DirEntryName::getPoolStats();
+  {
+    // Separately constructed owned names share a single copy
+    DirEntryName name1{PathComponentPiece{"a_name_for_the_pooled_test"}};
+    DirEntryName name2{PathComponentPiece{"a_name_for_the_pooled_test"}};
+    EXPECT_EQ(name1.stringPiece().data(), name2.stringPiece().data());
+    EXPECT_STREQ("a_name_for_the_pooled_test", name2.c_str());
+    EXPECT_EQ(initialStats.numNames + 1, DirEntryName::getPoolStats().numNames);
+
+    DirEntryName name3{PathComponentPiece{"another_pooled_name"}};
+    EXPECT_EQ(initialStats.numNames + 2, DirEntryName::getPoolStats().numNames);
+    EXPECT_GT(
+        DirEntryName::getPoolStats().totalBytes, initialStats.totalBytes);
+
+    // The name stays in the pool until its last reference is gone
+    name1 = std::move(name3);
+    EXPECT_EQ(initialStats.numNames + 2, DirEntryName::getPoolStats().numNames);
+    name2 = name1;
+    EXPECT_EQ(initialStats.numNames + 1, DirEntryName::getPoolStats().numNames);
+    EXPECT_EQ("another_pooled_name", name2.stringPiece());
+  }
+  EXPECT_EQ(initialStats.numNames, DirEntryName::getPoolStats().numNames);
+}
+
+TEST(DirEntryName, pathMapKey) {
+  PathComponent borrowedSource{"b"};
+  PathMap<int, DirEntryName> map;
+  map.insert(std::make_pair(DirEntryName::borrow(borrowedSource), 2));
+  map.emplace(PathComponentPiece{"a"}, 1);
+  map.emplace(PathComponentPiece{"c"}, 3);
+
+  ASSERT_EQ(3, map.size());
+  auto it = map.begin();
+  EXPECT_EQ(PathComponentPiece{"a"}, it->first.piece());
+  EXPECT_FALSE(it->first.isBorrowed());
+  ++it;
+  EXPECT_EQ(PathComponentPiece{"b"}, it->first.piece());
+  EXPECT_TRUE(it->first.isBorrowed());
+  ++it;
+  EXPECT_EQ(PathComponentPiece{"c"}, it->first.piece());
+
+  EXPECT_EQ(2, map.at(PathComponentPiece{"b"}));
+  EXPECT_EQ(1, map.erase(PathComponentPiece{"a"}));
+  EXPECT_TRUE(map.find(PathComponentPiece{"a"}) == map.end());
+  EXPECT_EQ(3, map.at(PathComponentPiece{"c"}));
+}
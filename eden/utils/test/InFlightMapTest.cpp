@@ -0,0 +1,156 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/io/async/Request.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "eden/utils/InFlightMap.h"
+
+using facebook::eden::CancellationToken;
+using facebook::eden::InFlightMap;
+using folly::Promise;
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+
+TEST(InFlightMap, coalescesConcurrentFetches) {
+  InFlightMap<string, string> map;
+  Promise<shared_ptr<string>> promise;
+  int numFetches = 0;
+  auto fetch = [&] {
+    ++numFetches;
+    return promise.getFuture();
+  };
+
+  auto future1 = map.get("foo", fetch);
+  auto future2 = map.get("foo", fetch);
+  EXPECT_EQ(1, numFetches);
+  EXPECT_EQ(1, map.getNumPending());
+  EXPECT_EQ(1, map.getNumCoalesced());
+  EXPECT_FALSE(future1.isReady());
+  EXPECT_FALSE(future2.isReady());
+
+  promise.setValue(make_shared<string>("bar"));
+  ASSERT_TRUE(future1.isReady());
+  ASSERT_TRUE(future2.isReady());
+  EXPECT_EQ("bar", *future1.get());
+  EXPECT_EQ("bar", *future2.get());
+  EXPECT_EQ(0, map.getNumPending());
+}
+
+TEST(InFlightMap, doesNotCacheResults) {
+  InFlightMap<string, string> map;
+  int numFetches = 0;
+  auto fetch = [&] {
+    ++numFetches;
+    return folly::makeFuture(make_shared<string>("bar"));
+  };
+
+  EXPECT_EQ("bar", *map.get("foo", fetch).get());
+  EXPECT_EQ("bar", *map.get("foo", fetch).get());
+  EXPECT_EQ(2, numFetches);
+  EXPECT_EQ(0, map.getNumCoalesced());
+}
+
+TEST(InFlightMap, propagatesErrors) {
+  InFlightMap<string, string> map;
+  Promise<shared_ptr<string>> promise;
+  auto fetch = [&] { return promise.getFuture(); };
+
+  auto future1 = map.get("foo", fetch);
+  auto future2 = map.get("foo", fetch);
+  promise.setException(std::runtime_error("fetch failed"));
+  EXPECT_THROW(future1.get(), std::runtime_error);
+  EXPECT_THROW(future2.get(), std::runtime_error);
+
+  // A fetch function that throws immediately also fails the Future
+  auto future3 = map.get("foo", []() -> folly::Future<shared_ptr<string>> {
+    throw std::runtime_error("fetch failed");
+  });
+  EXPECT_THROW(future3.get(), std::runtime_error);
+  EXPECT_EQ(0, map.getNumPending());
+}
+
+TEST(InFlightMap, outlivedByPendingFetch) {
+  Promise<shared_ptr<string>> promise;
+  auto map = std::make_unique<InFlightMap<string, string>>();
+  auto future = map->get("foo", [&] { return promise.getFuture(); });
+  map.reset();
+  promise.setValue(make_shared<string>("bar"));
+  EXPECT_EQ("bar", *future.get());
+}
+
+TEST(InFlightMap, cancelledOnceEveryCallerIs) {
+  InFlightMap<string, string> map;
+  std::vector<Promise<shared_ptr<string>>> promises(2);
+  std::vector<shared_ptr<CancellationToken>> fetchTokens;
+  auto fetch = [&] {
+    fetchTokens.push_back(CancellationToken::getCurrent());
+    return promises[fetchTokens.size() - 1].getFuture();
+  };
+
+  folly::RequestContextScopeGuard guard;
+  auto caller1 = make_shared<CancellationToken>();
+  auto caller2 = make_shared<CancellationToken>();
+  CancellationToken::install(caller1);
+  auto future1 = map.get("foo", fetch);
+  EXPECT_EQ(caller1, CancellationToken::getCurrent());
+  auto future2 = [&] {
+    CancellationToken::Scope scope(caller2);
+    return map.get("foo", fetch);
+  }();
+  ASSERT_EQ(1, fetchTokens.size());
+  ASSERT_NE(nullptr, fetchTokens[0]);
+
+  caller1->cancel();
+  EXPECT_FALSE(fetchTokens[0]->isCancelled());
+  caller2->cancel();
+  EXPECT_TRUE(fetchTokens[0]->isCancelled());
+
+  // A new caller starts a fresh fetch rather than wait on the cancelled one.
+  auto caller3 = make_shared<CancellationToken>();
+  auto future3 = [&] {
+    CancellationToken::Scope scope(caller3);
+    return map.get("foo", fetch);
+  }();
+  ASSERT_EQ(2, fetchTokens.size());
+  EXPECT_FALSE(fetchTokens[1]->isCancelled());
+
+  promises[0].setException(std::runtime_error("fetch cancelled"));
+  EXPECT_THROW(future1.get(), std::runtime_error);
+  EXPECT_THROW(future2.get(), std::runtime_error);
+  EXPECT_EQ(1, map.getNumPending());
+  promises[1].setValue(make_shared<string>("bar"));
+  EXPECT_EQ("bar", *future3.get());
+}
+
+TEST(InFlightMap, uncancellableCaller) {
+  InFlightMap<string, string> map;
+  Promise<shared_ptr<string>> promise;
+  shared_ptr<CancellationToken> fetchToken;
+  auto fetch = [&] {
+    fetchToken = CancellationToken::getCurrent();
+    return promise.getFuture();
+  };
+
+  folly::RequestContextScopeGuard guard;
+  auto caller = make_shared<CancellationToken>();
+  CancellationToken::install(caller);
+  auto future1 = map.get("foo", fetch);
+  auto future2 = [&] {
+    CancellationToken::Scope scope(nullptr);
+    return map.get("foo", fetch);
+  }();
+  caller->cancel();
+  ASSERT_NE(nullptr, fetchToken);
+  EXPECT_FALSE(fetchToken->isCancelled());
+  promise.setValue(make_shared<string>("bar"));
+  EXPECT_EQ("bar", *future2.get());
+}
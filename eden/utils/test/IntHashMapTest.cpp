@@ -0,0 +1,118 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/utils/IntHashMap.h"
+
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+using facebook::eden::IntHashMap;
+
+TEST(IntHashMap, emplaceAndFind) {
+  IntHashMap<uint64_t, std::string> map;
+  EXPECT_TRUE(map.empty());
+  EXPECT_TRUE(map.find(1) == map.end());
+
+  auto ret = map.emplace(1, "one");
+  EXPECT_TRUE(ret.second);
+  EXPECT_EQ(1, ret.first->first);
+  EXPECT_EQ("one", ret.first->second);
+
+  ret = map.emplace(1, "uno");
+  EXPECT_FALSE(ret.second);
+  EXPECT_EQ("one", ret.first->second);
+
+  map.emplace(2, "two");
+  EXPECT_EQ(2, map.size());
+  EXPECT_EQ("two", map.find(2)->second);
+  EXPECT_EQ(1, map.count(1));
+  EXPECT_EQ(0, map.count(3));
+  // The empty key is never found
+  EXPECT_EQ(0, map.count(0));
+}
+
+TEST(IntHashMap, erase) {
+  IntHashMap<uint64_t, std::string> map;
+  map.emplace(1, "one");
+  map.emplace(2, "two");
+  EXPECT_EQ(1, map.erase(1));
+  EXPECT_EQ(0, map.erase(1));
+  EXPECT_EQ(1, map.size());
+  EXPECT_TRUE(map.find(1) == map.end());
+  EXPECT_EQ("two", map.find(2)->second);
+
+  map.erase(map.find(2));
+  EXPECT_TRUE(map.empty());
+  EXPECT_TRUE(map.begin() == map.end());
+}
+
+TEST(IntHashMap, iterate) {
+  IntHashMap<uint64_t, uint64_t> map;
+  for (uint64_t n = 1; n <= 100; ++n) {
+    map.emplace(n, n * 2);
+  }
+  uint64_t keySum = 0;
+  size_t count = 0;
+  for (const auto& entry : map) {
+    EXPECT_EQ(entry.first * 2, entry.second);
+    keySum += entry.first;
+    ++count;
+  }
+  EXPECT_EQ(100, count);
+  EXPECT_EQ(5050, keySum);
+}
+
+TEST(IntHashMap, randomOperationsMatchUnorderedMap) {
+  // Compare against std::unordered_map over a mix of inserts and erases,
+  // using a small key range so entries collide and erase has to shift
+  // probe sequences back.
+  IntHashMap<uint32_t, uint32_t> map;
+  std::unordered_map<uint32_t, uint32_t> expected;
+  std::mt19937 rng(1234);
+  std::uniform_int_distribution<uint32_t> keys(1, 500);
+  for (int n = 0; n < 20000; ++n) {
+    auto key = keys(rng);
+    if (rng() % 3 == 0) {
+      EXPECT_EQ(expected.erase(key), map.erase(key));
+    } else {
+      auto value = static_cast<uint32_t>(rng());
+      auto ret1 = expected.emplace(key, value);
+      auto ret2 = map.emplace(key, value);
+      EXPECT_EQ(ret1.second, ret2.second);
+      EXPECT_EQ(ret1.first->second, ret2.first->second);
+    }
+  }
+
+  EXPECT_EQ(expected.size(), map.size());
+  for (const auto& entry : expected) {
+    auto it = map.find(entry.first);
+    ASSERT_TRUE(it != map.end()) << "missing key " << entry.first;
+    EXPECT_EQ(entry.second, it->second);
+  }
+  for (const auto& entry : map) {
+    EXPECT_EQ(1, expected.count(entry.first));
+  }
+}
+
+TEST(IntHashMap, memoryUsage) {
+  IntHashMap<uint64_t, uint64_t> map;
+  EXPECT_EQ(0, map.getMemoryUsage());
+  for (uint64_t n = 1; n <= 1000; ++n) {
+    map.emplace(n, n);
+  }
+  // The table is kept between 3/8 and 3/4 full.
+  EXPECT_LE(map.getMemoryUsage(), 1000 * 16 * 8 / 3);
+  EXPECT_GE(map.getMemoryUsage(), 1000 * 16 * 4 / 3);
+
+  map.clear();
+  EXPECT_TRUE(map.empty());
+  EXPECT_EQ(0, map.getMemoryUsage());
+}
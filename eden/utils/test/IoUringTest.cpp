@@ -0,0 +1,78 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/utils/IoUring.h"
+
+#include <folly/experimental/TestUtil.h>
+#include <folly/futures/Future.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <system_error>
+#include <vector>
+
+using namespace facebook::eden;
+using folly::test::TemporaryFile;
+
+namespace {
+/** Returns nullptr if io_uring is not available here. */
+std::unique_ptr<IoUring> makeRing() {
+  try {
+    return std::make_unique<IoUring>(8);
+  } catch (const std::exception& ex) {
+    LOG(WARNING) << "skipping io_uring test: " << ex.what();
+    return nullptr;
+  }
+}
+}
+
+TEST(IoUring, writeSyncAndRead) {
+  auto ring = makeRing();
+  if (!ring) {
+    return;
+  }
+  TemporaryFile temp;
+  std::string contents = "hello io_uring";
+  EXPECT_EQ(
+      contents.size(),
+      ring->write(temp.fd(), contents.data(), contents.size(), 0).get());
+  ring->fsync(temp.fd(), true).get();
+
+  std::vector<char> buf(64);
+  auto bytesRead = ring->read(temp.fd(), buf.data(), buf.size(), 6).get();
+  EXPECT_EQ("io_uring", std::string(buf.data(), bytesRead));
+}
+
+TEST(IoUring, moreRequestsThanEntries) {
+  auto ring = makeRing();
+  if (!ring) {
+    return;
+  }
+  TemporaryFile temp;
+  std::string contents(100, 'x');
+  ring->write(temp.fd(), contents.data(), contents.size(), 0).get();
+
+  std::vector<char> bufs(100);
+  std::vector<folly::Future<size_t>> reads;
+  for (size_t n = 0; n < bufs.size(); ++n) {
+    reads.push_back(ring->read(temp.fd(), &bufs[n], 1, n));
+  }
+  for (auto& read : reads) {
+    EXPECT_EQ(1, read.get());
+  }
+  EXPECT_EQ(contents, std::string(bufs.data(), bufs.size()));
+}
+
+TEST(IoUring, errors) {
+  auto ring = makeRing();
+  if (!ring) {
+    return;
+  }
+  char buf[1];
+  EXPECT_THROW(ring->read(-1, buf, sizeof(buf), 0).get(), std::system_error);
+}
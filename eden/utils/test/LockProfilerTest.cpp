@@ -0,0 +1,122 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/utils/LockProfiler.h"
+
+#include <gtest/gtest.h>
+#include <mutex>
+#include <shared_mutex>
+
+using namespace facebook::eden;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+namespace {
+class LockProfilerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    LockProfiler::setEnabled(true);
+  }
+  void TearDown() override {
+    LockProfiler::setEnabled(false);
+  }
+
+  LockProfiler::LockSummary getSummary(LockProfiler::Lock lock) {
+    return LockProfiler::getSummary(10).at(lock);
+  }
+};
+}
+
+TEST(LockProfiler, buckets) {
+  EXPECT_EQ(0, LockProfiler::getBucket(microseconds(0)));
+  EXPECT_EQ(1, LockProfiler::getBucket(microseconds(1)));
+  EXPECT_EQ(2, LockProfiler::getBucket(microseconds(2)));
+  EXPECT_EQ(2, LockProfiler::getBucket(microseconds(3)));
+  EXPECT_EQ(11, LockProfiler::getBucket(microseconds(1024)));
+  EXPECT_EQ(
+      LockProfiler::kNumBuckets - 1,
+      LockProfiler::getBucket(microseconds(1ll << 40)));
+}
+
+TEST_F(LockProfilerTest, waitsAreAttributedToSites) {
+  {
+    LockProfiler::SiteScope scope{"TreeInode::rename"};
+    LockProfiler::recordWait(LockProfiler::RENAME_LOCK, milliseconds(3));
+    LockProfiler::recordWait(LockProfiler::RENAME_LOCK, milliseconds(1));
+  }
+  {
+    LockProfiler::SiteScope scope{"EdenMount::checkout"};
+    LockProfiler::recordWait(LockProfiler::RENAME_LOCK, milliseconds(10));
+  }
+  // Uncontended acquisitions count towards the histogram only.
+  LockProfiler::recordWait(LockProfiler::RENAME_LOCK, microseconds(0));
+
+  auto summary = getSummary(LockProfiler::RENAME_LOCK);
+  EXPECT_EQ(4, summary.wait.count);
+  EXPECT_EQ(14000, summary.wait.totalUs);
+  EXPECT_EQ(10000, summary.wait.maxUs);
+  EXPECT_EQ(3, summary.contended);
+  ASSERT_EQ(2, summary.topSites.size());
+  EXPECT_EQ("EdenMount::checkout", summary.topSites[0].site);
+  EXPECT_EQ(1, summary.topSites[0].contended);
+  EXPECT_EQ("TreeInode::rename", summary.topSites[1].site);
+  EXPECT_EQ(2, summary.topSites[1].contended);
+  EXPECT_EQ(4000, summary.topSites[1].totalWaitUs);
+  EXPECT_EQ(3000, summary.topSites[1].maxWaitUs);
+
+  EXPECT_EQ(0, getSummary(LockProfiler::CONTENTS_LOCK).wait.count);
+}
+
+TEST_F(LockProfilerTest, percentilesAreBucketBounds) {
+  for (int n = 0; n < 98; ++n) {
+    LockProfiler::recordHold(LockProfiler::CONTENTS_LOCK, microseconds(5));
+  }
+  LockProfiler::recordHold(LockProfiler::CONTENTS_LOCK, microseconds(100));
+  LockProfiler::recordHold(LockProfiler::CONTENTS_LOCK, microseconds(900));
+
+  auto hold = getSummary(LockProfiler::CONTENTS_LOCK).hold;
+  EXPECT_EQ(100, hold.count);
+  EXPECT_EQ(7, hold.p50Us);
+  EXPECT_EQ(7, hold.p90Us);
+  EXPECT_EQ(127, hold.p99Us);
+  EXPECT_EQ(900, hold.maxUs);
+}
+
+TEST_F(LockProfilerTest, enablingResets) {
+  LockProfiler::recordWait(LockProfiler::INODE_MAP_LOCK, milliseconds(1));
+  LockProfiler::setEnabled(true);
+  auto summary = getSummary(LockProfiler::INODE_MAP_LOCK);
+  EXPECT_EQ(0, summary.wait.count);
+  EXPECT_EQ(0, summary.contended);
+  EXPECT_TRUE(summary.topSites.empty());
+}
+
+TEST_F(LockProfilerTest, disabledRecordsNothing) {
+  LockProfiler::setEnabled(false);
+  LockProfiler::recordWait(LockProfiler::INODE_MAP_LOCK, milliseconds(1));
+  LockProfiler::recordHold(LockProfiler::INODE_MAP_LOCK, milliseconds(1));
+  auto summary = getSummary(LockProfiler::INODE_MAP_LOCK);
+  EXPECT_EQ(0, summary.wait.count);
+  EXPECT_EQ(0, summary.hold.count);
+}
+
+TEST_F(LockProfilerTest, profiledMutex) {
+  ProfiledMutex<LockProfiler::CONTENTS_LOCK> mutex;
+  {
+    std::unique_lock<decltype(mutex)> lock{mutex};
+  }
+  {
+    std::shared_lock<decltype(mutex)> lock{mutex};
+  }
+
+  auto summary = getSummary(LockProfiler::CONTENTS_LOCK);
+  EXPECT_EQ(2, summary.wait.count);
+  // Only the exclusive acquisition records a hold time.
+  EXPECT_EQ(1, summary.hold.count);
+}
@@ -0,0 +1,84 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/utils/MemoryGovernor.h"
+
+#include <gtest/gtest.h>
+
+using namespace facebook::eden;
+using namespace std::chrono;
+
+namespace {
+const AbsolutePathPiece kMissingFile{"/nonexistent/memory.pressure"};
+}
+
+TEST(MemoryGovernor, parsePressure) {
+  auto pressure = MemoryGovernor::parsePressure(
+      "some avg10=12.50 avg60=3.00 avg300=1.00 total=123456\n"
+      "full avg10=2.00 avg60=1.00 avg300=0.50 total=2345\n");
+  ASSERT_TRUE(pressure.hasValue());
+  EXPECT_EQ(12.5, pressure.value());
+
+  EXPECT_FALSE(MemoryGovernor::parsePressure("").hasValue());
+  EXPECT_FALSE(MemoryGovernor::parsePressure(
+                   "full avg10=2.00 avg60=1.00 avg300=0.50 total=2345\n")
+                   .hasValue());
+  EXPECT_FALSE(
+      MemoryGovernor::parsePressure("some avg10=bogus total=0\n").hasValue());
+}
+
+TEST(MemoryGovernor, shrinksUnderPressure) {
+  MemoryGovernor governor(kMissingFile, 10.0, 0.5, 10s);
+  size_t cacheBytes = 1000;
+  governor.addConsumer(
+      "cache",
+      [&] { return cacheBytes; },
+      [&](double keepFraction) { cacheBytes *= keepFraction; });
+  governor.addConsumer("fixed", [] { return 300; }, nullptr);
+
+  auto start = steady_clock::now();
+  EXPECT_FALSE(governor.update(5.0, start));
+  EXPECT_EQ(1000, cacheBytes);
+  auto stats = governor.getStats();
+  EXPECT_EQ(1300, stats.totalBytes);
+  EXPECT_EQ(0, stats.pressureEvents);
+
+  EXPECT_TRUE(governor.update(20.0, start + 1s));
+  EXPECT_EQ(500, cacheBytes);
+  stats = governor.getStats();
+  EXPECT_EQ(20.0, stats.pressure);
+  EXPECT_EQ(1, stats.pressureEvents);
+  EXPECT_EQ(800, stats.totalBytes);
+  ASSERT_EQ(2, stats.consumers.size());
+  EXPECT_EQ("cache", stats.consumers[0].name);
+  EXPECT_EQ(1, stats.consumers[0].pressureShrinks);
+  EXPECT_EQ(500, stats.consumers[0].pressureFreedBytes);
+  EXPECT_EQ("fixed", stats.consumers[1].name);
+  EXPECT_EQ(0, stats.consumers[1].pressureShrinks);
+  EXPECT_EQ(300, stats.consumers[1].bytes);
+
+  // Nothing more is shrunk until the cooldown has passed.
+  EXPECT_FALSE(governor.update(20.0, start + 5s));
+  EXPECT_EQ(500, cacheBytes);
+  EXPECT_TRUE(governor.update(20.0, start + 11s));
+  EXPECT_EQ(250, cacheBytes);
+  EXPECT_EQ(2, governor.getStats().pressureEvents);
+}
+
+TEST(MemoryGovernor, unreadablePressureFile) {
+  MemoryGovernor governor(kMissingFile, 10.0, 0.5, 10s);
+  size_t cacheBytes = 1000;
+  governor.addConsumer(
+      "cache",
+      [&] { return cacheBytes; },
+      [&](double keepFraction) { cacheBytes *= keepFraction; });
+  governor.check();
+  EXPECT_EQ(1000, cacheBytes);
+  EXPECT_EQ(1000, governor.getStats().totalBytes);
+}
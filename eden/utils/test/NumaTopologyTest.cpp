@@ -0,0 +1,47 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/utils/NumaTopology.h"
+
+#include <gtest/gtest.h>
+#include <stdexcept>
+
+using namespace facebook::eden;
+using std::vector;
+
+TEST(NumaTopology, parseCpuList) {
+  EXPECT_EQ(vector<unsigned>{}, NumaTopology::parseCpuList(""));
+  EXPECT_EQ(vector<unsigned>{}, NumaTopology::parseCpuList("\n"));
+  EXPECT_EQ(vector<unsigned>{3}, NumaTopology::parseCpuList("3\n"));
+  EXPECT_EQ(
+      (vector<unsigned>{0, 1, 2, 3, 8, 10, 11}),
+      NumaTopology::parseCpuList("0-3,8,10-11\n"));
+}
+
+TEST(NumaTopology, parseCpuListRejectsBadInput) {
+  EXPECT_THROW(NumaTopology::parseCpuList("0,,1"), std::invalid_argument);
+  EXPECT_THROW(NumaTopology::parseCpuList("3-1"), std::invalid_argument);
+  EXPECT_THROW(NumaTopology::parseCpuList("0-x"), std::invalid_argument);
+  EXPECT_THROW(NumaTopology::parseCpuList("-1"), std::invalid_argument);
+}
+
+TEST(NumaTopology, nodes) {
+  NumaTopology topology({{0, 1, 4, 5}, {2, 3, 6, 7}});
+  EXPECT_EQ(2, topology.getNumNodes());
+  EXPECT_EQ((vector<unsigned>{2, 3, 6, 7}), topology.getNodeCpus(1));
+
+  NumaTopology empty({});
+  EXPECT_EQ(1, empty.getNumNodes());
+  EXPECT_EQ(0, empty.getCurrentNode());
+}
+
+TEST(NumaTopology, singleNodeByDefault) {
+  EXPECT_EQ(1, NumaTopology::get().getNumNodes());
+  EXPECT_EQ(0, NumaTopology::get().getCurrentNode());
+}
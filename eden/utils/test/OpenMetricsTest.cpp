@@ -0,0 +1,75 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/utils/OpenMetrics.h"
+
+#include <gtest/gtest.h>
+
+using namespace facebook::eden;
+
+TEST(OpenMetrics, plainCounters) {
+  std::map<std::string, int64_t> counters{
+      {"object_store.tree_cache.hit", 7},
+      {"shared_object_cache.blob.miss", 3},
+  };
+  EXPECT_EQ(
+      "# TYPE eden_object_store_tree_cache_hit unknown\n"
+      "eden_object_store_tree_cache_hit 7\n"
+      "# TYPE eden_shared_object_cache_blob_miss unknown\n"
+      "eden_shared_object_cache_blob_miss 3\n"
+      "# EOF\n",
+      renderOpenMetrics(counters, {}));
+}
+
+TEST(OpenMetrics, histogramsAreSummaries) {
+  std::map<std::string, int64_t> counters{
+      {"fuse.lookup_us.count", 10},
+      {"fuse.lookup_us.p50", 120},
+      {"fuse.lookup_us.p99", 900},
+      {"fuse.lookup_us.sum", 2000},
+  };
+  EXPECT_EQ(
+      "# TYPE eden_fuse_lookup_us summary\n"
+      "eden_fuse_lookup_us_count 10\n"
+      "eden_fuse_lookup_us{quantile=\"0.5\"} 120\n"
+      "eden_fuse_lookup_us{quantile=\"0.99\"} 900\n"
+      "eden_fuse_lookup_us_sum 2000\n"
+      "# EOF\n",
+      renderOpenMetrics(counters, {}));
+}
+
+TEST(OpenMetrics, mountLabels) {
+  std::map<std::string, int64_t> counters{
+      {"mount./data/repo.fuse.outstanding", 2},
+      {"mount./data/repo/sub.fuse.outstanding", 1},
+      {"mount./data/repo.fuse.age_us.p90", 50},
+      {"mount./unknown.fuse.outstanding", 4},
+  };
+  EXPECT_EQ(
+      "# TYPE eden_fuse_age_us summary\n"
+      "eden_fuse_age_us{mount=\"/data/repo\",quantile=\"0.9\"} 50\n"
+      "# TYPE eden_fuse_outstanding unknown\n"
+      "eden_fuse_outstanding{mount=\"/data/repo\"} 2\n"
+      "eden_fuse_outstanding{mount=\"/data/repo/sub\"} 1\n"
+      "# TYPE eden_mount__unknown_fuse_outstanding unknown\n"
+      "eden_mount__unknown_fuse_outstanding 4\n"
+      "# EOF\n",
+      renderOpenMetrics(counters, {"/data/repo", "/data/repo/sub"}));
+}
+
+TEST(OpenMetrics, labelValuesAreEscaped) {
+  std::map<std::string, int64_t> counters{
+      {"mount./tmp/a\"b.journal.memory_bytes", 5},
+  };
+  EXPECT_EQ(
+      "# TYPE eden_journal_memory_bytes unknown\n"
+      "eden_journal_memory_bytes{mount=\"/tmp/a\\\"b\"} 5\n"
+      "# EOF\n",
+      renderOpenMetrics(counters, {"/tmp/a\"b"}));
+}
@@ -0,0 +1,93 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Benchmark.h>
+#include <folly/init/Init.h>
+
+#include "eden/utils/PathFuncs.h"
+
+using namespace facebook::eden;
+using folly::StringPiece;
+
+namespace {
+// A path shaped like the ones in large repositories, with long components.
+const StringPiece kDeepPath{
+    "fbcode/eden/fs/inodes/overlay/some_rather_long_directory_name/"
+    "another_fairly_long_directory_name/yet_another_subdirectory/"
+    "ThisIsALongFileNameThatShowsUpInJavaAndObjCProjects.java"};
+const StringPiece kShortPath{"a/b/c/d/e/f/g/h"};
+const StringPiece kLongName{
+    "ThisIsALongFileNameThatShowsUpInJavaAndObjCProjects.java"};
+
+void constructComponent(size_t iters, StringPiece name) {
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(PathComponentPiece{name});
+  }
+}
+
+void constructRelativePath(size_t iters, StringPiece path) {
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(RelativePathPiece{path});
+  }
+}
+
+void iterateComponents(size_t iters, StringPiece path) {
+  RelativePathPiece rel{path};
+  for (size_t n = 0; n < iters; ++n) {
+    for (auto component : rel.components()) {
+      folly::doNotOptimizeAway(component);
+    }
+  }
+}
+
+void iterateComponentsReverse(size_t iters, StringPiece path) {
+  RelativePathPiece rel{path};
+  for (size_t n = 0; n < iters; ++n) {
+    for (auto component : rel.rcomponents()) {
+      folly::doNotOptimizeAway(component);
+    }
+  }
+}
+
+void iteratePaths(size_t iters, StringPiece path) {
+  RelativePathPiece rel{path};
+  for (size_t n = 0; n < iters; ++n) {
+    for (auto parent : rel.paths()) {
+      folly::doNotOptimizeAway(parent);
+    }
+  }
+}
+
+void composePath(size_t iters, StringPiece path) {
+  RelativePathPiece rel{path};
+  PathComponentPiece name{"BUCK"};
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(rel + name);
+  }
+}
+}
+
+BENCHMARK_PARAM(constructComponent, kLongName);
+BENCHMARK_PARAM(constructRelativePath, kDeepPath);
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(iterateComponents, kShortPath);
+BENCHMARK_PARAM(iterateComponents, kDeepPath);
+BENCHMARK_PARAM(iterateComponentsReverse, kShortPath);
+BENCHMARK_PARAM(iterateComponentsReverse, kDeepPath);
+BENCHMARK_PARAM(iteratePaths, kDeepPath);
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(composePath, kDeepPath);
+
+int main(int argc, char** argv) {
+  folly::init(&argc, &argv);
+  folly::runBenchmarks();
+  return 0;
+}
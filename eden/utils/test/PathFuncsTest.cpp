@@ -426,6 +426,22 @@ TEST(PathFuncs, PathComponent) {
       PathComponent(".."), std::domain_error, "must not be \\. or \\.\\.");
 }
 
+TEST(PathFuncs, SkipSanityCheck) {
+  // The checks are skipped whether the value is copied or moved into place
+  EXPECT_EQ(
+      "foo/bar",
+      PathComponent("foo/bar", detail::SkipPathSanityCheck()).stringPiece());
+  EXPECT_EQ(
+      "foo/bar",
+      PathComponent(folly::fbstring{"foo/bar"}, detail::SkipPathSanityCheck())
+          .stringPiece());
+  EXPECT_EQ(
+      "/foo",
+      RelativePath(folly::fbstring{"/foo"}, detail::SkipPathSanityCheck())
+          .stringPiece());
+  EXPECT_THROW(RelativePath(folly::fbstring{"/foo"}), std::domain_error);
+}
+
 TEST(PathFuncs, RelativePath) {
   RelativePath emptyRel;
   EXPECT_EQ("", emptyRel.stringPiece());
@@ -0,0 +1,154 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/Benchmark.h>
+#include <folly/Conv.h>
+#include <folly/init/Init.h>
+#include <algorithm>
+#include <random>
+
+#include "eden/utils/PathMap.h"
+
+using namespace facebook::eden;
+
+namespace {
+/**
+ * Names shaped like the entries of a source directory, in random order.
+ * The same seed is used every time so that runs are comparable.
+ */
+std::vector<PathComponent> makeNames(size_t count, folly::StringPiece prefix) {
+  std::vector<PathComponent> names;
+  names.reserve(count);
+  for (size_t n = 0; n < count; ++n) {
+    names.emplace_back(folly::to<std::string>(prefix, n, "_handler.cpp"));
+  }
+  std::shuffle(names.begin(), names.end(), std::mt19937{1});
+  return names;
+}
+
+PathMap<size_t> makeMap(const std::vector<PathComponent>& names) {
+  PathMap<size_t> map;
+  for (size_t n = 0; n < names.size(); ++n) {
+    map.emplace(names[n], n);
+  }
+  return map;
+}
+
+void insertSorted(size_t iters, size_t size) {
+  std::vector<PathComponent> names;
+  BENCHMARK_SUSPEND {
+    names = makeNames(size, "file");
+    std::sort(names.begin(), names.end());
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(makeMap(names));
+  }
+}
+
+void insertRandom(size_t iters, size_t size) {
+  std::vector<PathComponent> names;
+  BENCHMARK_SUSPEND {
+    names = makeNames(size, "file");
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(makeMap(names));
+  }
+}
+
+void findHit(size_t iters, size_t size) {
+  std::vector<PathComponent> names;
+  PathMap<size_t> map;
+  BENCHMARK_SUSPEND {
+    names = makeNames(size, "file");
+    map = makeMap(names);
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(map.find(names[n % size]));
+  }
+}
+
+void findMiss(size_t iters, size_t size) {
+  std::vector<PathComponent> missing;
+  PathMap<size_t> map;
+  BENCHMARK_SUSPEND {
+    map = makeMap(makeNames(size, "file"));
+    missing = makeNames(size, "other");
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(map.find(missing[n % size]));
+  }
+}
+
+void iterate(size_t iters, size_t size) {
+  PathMap<size_t> map;
+  BENCHMARK_SUSPEND {
+    map = makeMap(makeNames(size, "file"));
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    for (const auto& entry : map) {
+      folly::doNotOptimizeAway(entry.second);
+    }
+  }
+}
+
+void eraseAll(size_t iters, size_t size) {
+  for (size_t n = 0; n < iters; ++n) {
+    std::vector<PathComponent> names;
+    PathMap<size_t> map;
+    BENCHMARK_SUSPEND {
+      names = makeNames(size, "file");
+      map = makeMap(names);
+    }
+    for (const auto& name : names) {
+      map.erase(name);
+    }
+  }
+}
+}
+
+// Insert and erase benchmarks report the time to build or tear down a whole
+// map of the given size; the others report the time per operation.
+BENCHMARK_PARAM(insertSorted, 16);
+BENCHMARK_PARAM(insertSorted, 256);
+BENCHMARK_PARAM(insertSorted, 4096);
+BENCHMARK_PARAM(insertSorted, 65536);
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(insertRandom, 16);
+BENCHMARK_PARAM(insertRandom, 256);
+BENCHMARK_PARAM(insertRandom, 4096);
+BENCHMARK_PARAM(insertRandom, 65536);
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(eraseAll, 16);
+BENCHMARK_PARAM(eraseAll, 256);
+BENCHMARK_PARAM(eraseAll, 4096);
+BENCHMARK_PARAM(eraseAll, 65536);
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(findHit, 16);
+BENCHMARK_PARAM(findHit, 256);
+BENCHMARK_PARAM(findHit, 4096);
+BENCHMARK_PARAM(findHit, 65536);
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(findMiss, 16);
+BENCHMARK_PARAM(findMiss, 256);
+BENCHMARK_PARAM(findMiss, 4096);
+BENCHMARK_PARAM(findMiss, 65536);
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(iterate, 16);
+BENCHMARK_PARAM(iterate, 4096);
+
+int main(int argc, char** argv) {
+  folly::init(&argc, &argv);
+  folly::runBenchmarks();
+  return 0;
+}
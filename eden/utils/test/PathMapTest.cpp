@@ -7,6 +7,7 @@
  *  of patent rights can be found in the PATENTS file in the same directory.
  *
  */
+#include <folly/Format.h>
 #include <gtest/gtest.h>
 #include "eden/utils/PathMap.h"
 
@@ -141,3 +142,56 @@ TEST(PathMap, swap) {
   EXPECT_EQ(0, b.size()) << "b now has 0 elements";
   EXPECT_EQ("foo", a.at(PathComponentPiece("foo")));
 }
+
+TEST(PathMap, largeMap) {
+  // Insert enough entries, in a scrambled order, to need several chunks.
+  constexpr int kNumEntries = 5 * PathMap<int>::kMaxChunkSize;
+  PathMap<int> map;
+  for (int n = 0; n < kNumEntries; ++n) {
+    auto key = (n * 7919) % kNumEntries;
+    auto name = folly::sformat("file{:06d}", key);
+    EXPECT_TRUE(map.emplace(PathComponentPiece(name), key).second);
+  }
+  ASSERT_EQ(kNumEntries, map.size());
+
+  // Iteration is in sorted order, forwards and backwards
+  int expected = 0;
+  for (const auto& entry : map) {
+    EXPECT_EQ(folly::sformat("file{:06d}", expected), entry.first.value());
+    EXPECT_EQ(expected, entry.second);
+    ++expected;
+  }
+  EXPECT_EQ(kNumEntries, expected);
+  for (auto it = map.rbegin(); it != map.rend(); ++it) {
+    EXPECT_EQ(--expected, it->second);
+  }
+
+  EXPECT_EQ(1234, map.at(PathComponentPiece("file001234")));
+  EXPECT_TRUE(map.find(PathComponentPiece("file1")) == map.end());
+  EXPECT_TRUE(map.find(PathComponentPiece("zzz")) == map.end());
+
+  // Erase every odd entry while iterating
+  for (auto it = map.begin(); it != map.end();) {
+    if (it->second % 2) {
+      it = map.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  ASSERT_EQ(kNumEntries / 2, map.size());
+  expected = 0;
+  for (const auto& entry : map) {
+    EXPECT_EQ(expected, entry.second);
+    expected += 2;
+  }
+
+  PathMap<int> other = map;
+  EXPECT_EQ(map, other);
+  other.erase(PathComponentPiece("file000000"));
+  EXPECT_NE(map, other);
+
+  while (!map.empty()) {
+    map.erase(map.begin());
+  }
+  EXPECT_TRUE(map.begin() == map.end());
+}
@@ -0,0 +1,87 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/utils/RequestSampler.h"
+
+#include <gtest/gtest.h>
+
+using namespace facebook::eden;
+using namespace std::chrono;
+
+namespace {
+RequestTrace::Durations makeDurations() {
+  RequestTrace::Durations durations;
+  durations.fill(microseconds(0));
+  return durations;
+}
+}
+
+TEST(RequestSampler, foldRequest) {
+  auto phases = makeDurations();
+  phases[RequestTrace::INODE_LOAD] = microseconds(500);
+  phases[RequestTrace::LOCAL_STORE] = microseconds(100);
+  phases[RequestTrace::BACKING_STORE] = microseconds(300);
+  phases[RequestTrace::CONTENTS_LOCK] = microseconds(50);
+
+  std::map<std::string, int64_t> stacks;
+  RequestSampler::foldRequest("lookup", microseconds(1000), phases, stacks);
+  std::map<std::string, int64_t> expected{
+      {"lookup", 450},
+      {"lookup;backing_store", 300},
+      {"lookup;contents_lock", 50},
+      {"lookup;inode_load", 100},
+      {"lookup;local_store", 100},
+  };
+  EXPECT_EQ(expected, stacks);
+
+  // A second request adds to the same stacks.
+  phases = makeDurations();
+  phases[RequestTrace::RENAME_LOCK] = microseconds(20);
+  RequestSampler::foldRequest("lookup", microseconds(40), phases, stacks);
+  EXPECT_EQ(470, stacks["lookup"]);
+  EXPECT_EQ(20, stacks["lookup;rename_lock"]);
+}
+
+TEST(RequestSampler, storeTimeOutsideInodeLoad) {
+  // Reads that do not load an inode fetch from the store directly.
+  auto phases = makeDurations();
+  phases[RequestTrace::LOCAL_STORE] = microseconds(200);
+
+  std::map<std::string, int64_t> stacks;
+  RequestSampler::foldRequest("read", microseconds(250), phases, stacks);
+  std::map<std::string, int64_t> expected{
+      {"read", 50},
+      {"read;local_store", 200},
+  };
+  EXPECT_EQ(expected, stacks);
+}
+
+TEST(RequestSampler, samplingWindow) {
+  RequestSampler sampler;
+  EXPECT_FALSE(sampler.shouldSample());
+
+  sampler.start(seconds(60), 3);
+  int sampled = 0;
+  for (int n = 0; n < 9; ++n) {
+    if (sampler.shouldSample()) {
+      ++sampled;
+    }
+  }
+  EXPECT_EQ(3, sampled);
+
+  sampler.add("getattr", microseconds(10), makeDurations());
+  sampler.add("getattr", microseconds(5), makeDurations());
+  EXPECT_EQ("getattr 15\n", sampler.getFoldedStacks());
+
+  // Starting a new window discards the old samples, and an expired window
+  // samples nothing.
+  sampler.start(milliseconds(0), 1);
+  EXPECT_EQ("", sampler.getFoldedStacks());
+  EXPECT_FALSE(sampler.shouldSample());
+}
@@ -0,0 +1,64 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/utils/RequestTrace.h"
+
+#include <folly/futures/Future.h>
+#include <gtest/gtest.h>
+
+using namespace facebook::eden;
+using namespace std::chrono;
+
+TEST(RequestTrace, untracedRequest) {
+  folly::RequestContextScopeGuard guard;
+  EXPECT_EQ(nullptr, RequestTrace::get());
+  // This should be a no-op rather than crashing.
+  RequestTrace::addTime(RequestTrace::LOCAL_STORE, steady_clock::now());
+}
+
+TEST(RequestTrace, addTime) {
+  folly::RequestContextScopeGuard guard;
+  RequestTrace::install();
+  auto* trace = RequestTrace::get();
+  ASSERT_NE(nullptr, trace);
+
+  auto start = steady_clock::now() - milliseconds(5);
+  RequestTrace::addTime(RequestTrace::BACKING_STORE, start);
+  RequestTrace::addTime(RequestTrace::BACKING_STORE, start);
+
+  auto durations = trace->getDurations();
+  EXPECT_EQ(microseconds(0), durations[RequestTrace::INODE_LOAD]);
+  EXPECT_EQ(microseconds(0), durations[RequestTrace::LOCAL_STORE]);
+  EXPECT_GE(durations[RequestTrace::BACKING_STORE], milliseconds(10));
+}
+
+TEST(RequestTrace, followsFutureCallbacks) {
+  folly::Promise<folly::Unit> promise;
+  folly::Future<folly::Unit> future = folly::makeFuture();
+  std::shared_ptr<folly::RequestContext> tracedContext;
+  {
+    folly::RequestContextScopeGuard guard;
+    RequestTrace::install();
+    tracedContext = folly::RequestContext::saveContext();
+    auto start = steady_clock::now() - milliseconds(1);
+    future = promise.getFuture().then([start] {
+      RequestTrace::addTime(RequestTrace::INODE_LOAD, start);
+    });
+  }
+
+  // Complete the future from outside of the traced context.  The callback
+  // should still record into the trace of the request that set it up.
+  EXPECT_EQ(nullptr, RequestTrace::get());
+  promise.setValue();
+  future.get();
+  auto* trace = static_cast<RequestTrace*>(
+      tracedContext->getContextData(RequestTrace::kKey));
+  ASSERT_NE(nullptr, trace);
+  EXPECT_GE(trace->getDurations()[RequestTrace::INODE_LOAD], milliseconds(1));
+}
@@ -0,0 +1,76 @@
+/*
+ *  Copyright (c) 2016-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include "eden/utils/SlabPool.h"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+
+using namespace facebook::eden;
+
+TEST(SlabPool, reusesFreedObjects) {
+  SlabPool pool("test", 24, 4);
+  auto* a = pool.allocate(24);
+  auto* b = pool.allocate(24);
+  EXPECT_NE(a, b);
+  pool.deallocate(a, 24);
+  EXPECT_EQ(a, pool.allocate(24));
+  pool.deallocate(a, 24);
+  pool.deallocate(b, 24);
+}
+
+TEST(SlabPool, stats) {
+  SlabPool pool("stats_test", 24, 4);
+  std::vector<void*> objects;
+  for (int n = 0; n < 5; ++n) {
+    objects.push_back(pool.allocate(24));
+  }
+  auto stats = pool.getStats();
+  EXPECT_EQ("stats_test", stats.name);
+  EXPECT_EQ(0, stats.objectSize % alignof(std::max_align_t));
+  EXPECT_EQ(2, stats.slabs);
+  EXPECT_EQ(5, stats.objectsInUse);
+  EXPECT_EQ(8 * stats.objectSize, stats.reservedBytes);
+
+  for (auto* object : objects) {
+    pool.deallocate(object, 24);
+  }
+  stats = pool.getStats();
+  EXPECT_EQ(0, stats.objectsInUse);
+  // The slabs are kept for reuse.
+  EXPECT_EQ(2, stats.slabs);
+
+  auto all = SlabPool::getAllStats();
+  EXPECT_TRUE(std::any_of(all.begin(), all.end(), [](const auto& s) {
+    return s.name == "stats_test";
+  }));
+}
+
+TEST(SlabPool, otherSizesFallBack) {
+  SlabPool pool("test", 24);
+  auto* object = pool.allocate(100);
+  auto stats = pool.getStats();
+  EXPECT_EQ(0, stats.objectsInUse);
+  EXPECT_EQ(1, stats.fallbackAllocations);
+  pool.deallocate(object, 100);
+}
+
+TEST(SlabPool, allocateShared) {
+  SlabPool pool("test", 0);
+  {
+    auto a = std::allocate_shared<int>(SlabAllocator<int>(&pool), 1);
+    auto b = std::allocate_shared<int>(SlabAllocator<int>(&pool), 2);
+    EXPECT_EQ(1, *a);
+    EXPECT_EQ(2, *b);
+    auto stats = pool.getStats();
+    EXPECT_EQ(2, stats.objectsInUse);
+    EXPECT_EQ(0, stats.fallbackAllocations);
+  }
+  EXPECT_EQ(0, pool.getStats().objectsInUse);
+}